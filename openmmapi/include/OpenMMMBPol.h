@@ -36,5 +36,6 @@
 #include "openmm/MBPolOneBodyForce.h"
 #include "openmm/MBPolTwoBodyForce.h"
 #include "openmm/MBPolThreeBodyForce.h"
+#include "openmm/MBPolEngine.h"
 
 #endif /*MBPOL_OPENMM_H_*/
@@ -69,7 +69,38 @@ public:
          * Periodic boundary conditions are used, and Particle-Mesh Ewald (PME) summation is used to compute the interaction of each particle
          * with all periodic copies of every other particle.
          */
-        PME = 1
+        PME = 1,
+
+        /**
+         * No periodic boundary conditions.  Pairs of waters that may be closer than the reach of the Thole
+         * damping are computed exactly; the rest of the system is summed with a Barnes-Hut treecode of
+         * charge and dipole multipole expansions, which scales as O(N log N) and is meant for large clusters.
+         * See setTreecodeOpeningAngle() and setTreecodeExpansionOrder().
+         */
+        Treecode = 2
+    };
+
+    /**
+     * This is an enumeration of the parts of the electrostatic energy a force can compute, so that
+     * the term can be split over the inner and outer steps of a multiple time step integrator (e.g. a
+     * ShortRange force in a fast force group and a LongRange force in a slow one).
+     */
+    enum InteractionGroup {
+        /**
+         * The full electrostatic energy with mutual polarization.  This is the default.
+         */
+        AllInteractions = 0,
+        /**
+         * A cheap, smooth short-range part: the bare interactions of the water pairs with an
+         * oxygen-oxygen distance below getSplitDistance(), switched off over getSplitWidth(), with
+         * the induced dipoles computed from the switched field of the charges alone (direct
+         * polarization, no self-consistent iterations).  It has no reciprocal space part with PME.
+         */
+        ShortRange = 1,
+        /**
+         * The rest of the electrostatic energy: AllInteractions minus ShortRange.
+         */
+        LongRange = 2
     };
 
     /**
@@ -94,6 +125,37 @@ public:
      */
     void setNonbondedMethod(NonbondedMethod method);
 
+    /**
+     * Get the part of the electrostatic energy computed by this force.
+     */
+    InteractionGroup getInteractionGroup() const;
+
+    /**
+     * Set the part of the electrostatic energy computed by this force.
+     */
+    void setInteractionGroup(InteractionGroup group);
+
+    /**
+     * Get the oxygen-oxygen distance (in nm) beyond which ShortRange pairs are zero.
+     */
+    double getSplitDistance() const;
+
+    /**
+     * Set the oxygen-oxygen distance (in nm) beyond which ShortRange pairs are zero.  With PME
+     * it must not exceed the cutoff distance.
+     */
+    void setSplitDistance(double distance);
+
+    /**
+     * Get the width (in nm) of the switch between the ShortRange and LongRange parts.
+     */
+    double getSplitWidth() const;
+
+    /**
+     * Set the width (in nm) of the switch between the ShortRange and LongRange parts.
+     */
+    void setSplitWidth(double width);
+
     /**
      * Get the cutoff distance (in nm) being used for nonbonded interactions.  If the NonbondedMethod in use
      * is NoCutoff, this value will have no effect.
@@ -114,6 +176,53 @@ public:
 
     bool getIncludeChargeRedistribution( void ) const;
 
+    /**
+     * Set whether the induced dipole iterations start from the converged dipoles of the previous
+     * evaluation when the particles have moved little since then, apart from a rescaling of the
+     * periodic box (e.g. consecutive time steps or Monte Carlo barostat trials). Otherwise they
+     * start from the directly polarized dipoles. A warm start converges to the same tolerance
+     * but not to the same bits as a cold start, so it is disabled by default.
+     */
+    void setInducedDipoleWarmStart( bool warmStart );
+
+    bool getInducedDipoleWarmStart( void ) const;
+
+    /**
+     * Set whether every evaluation also records the electrostatic potential at each site, from
+     * which getMoleculeEnergies() and getSitePotentials() split the energy into its permanent
+     * and induction parts per molecule. Disabled by default.
+     */
+    void setIncludeEnergyDecomposition( bool includeEnergyDecomposition );
+
+    bool getIncludeEnergyDecomposition( void ) const;
+
+    /**
+     * Set whether the PME grids and their FFTs are kept in single precision. The potentials
+     * interpolated from the grids, the fields and the energy are still accumulated in double
+     * precision; the reciprocal space error is then about 1e-7 of the reciprocal space terms,
+     * well below the Ewald error tolerance. Halves the memory traffic of the spreading,
+     * convolution and interpolation. Disabled by default; only used with PME.
+     */
+    void setUseSinglePrecisionPme( bool useSinglePrecisionPme );
+
+    bool getUseSinglePrecisionPme( void ) const;
+
+    /**
+     * Set the opening angle of the Treecode method: a tree node is replaced by its multipole expansion
+     * for a water if the node radius is below this fraction of its distance.  Smaller is more accurate
+     * and slower; the default is 0.5.
+     */
+    void setTreecodeOpeningAngle( double angle );
+
+    double getTreecodeOpeningAngle( void ) const;
+
+    /**
+     * Set the order of the multipole expansions of the Treecode method (default 6).
+     */
+    void setTreecodeExpansionOrder( int order );
+
+    int getTreecodeExpansionOrder( void ) const;
+
     void setTholeParameters( std::vector<double> tholeP) {
         tholeParameters=tholeP;
     }
@@ -176,6 +285,22 @@ public:
     int addElectrostatics(double charge,
                      int moleculeIndex, int atomType, double dampingFactor, double polarity);
 
+    /**
+     * Add many particles at once, e.g. all the sites of a large system, instead of
+     * calling addElectrostatics() for each. All arrays hold one entry per particle.
+     *
+     * @param charges              the particles' charges
+     * @param moleculeIndices      the index of the molecule of each particle
+     * @param atomTypes            the atom types (0 = O, 1 = H, 2 = M)
+     * @param dampingFactors       dampingFactor parameters
+     * @param polarities           polarity parameters
+     *
+     * @return the index of the first particle that was added
+     */
+    int addParticles(const std::vector<double>& charges, const std::vector<int>& moleculeIndices,
+                     const std::vector<int>& atomTypes, const std::vector<double>& dampingFactors,
+                     const std::vector<double>& polarities);
+
     /**
      * Get the multipole parameters for a particle.
      *
@@ -280,6 +405,92 @@ void getElectrostaticsParameters(int index, double& charge,
      */
     void updateParametersInContext(Context& context);
 
+    /**
+     * Compute this force for several copies of the System at once, e.g. the beads of a ring
+     * polymer. The copies share the topology, parameters and periodic box of the Context and
+     * are evaluated together, so neighbor lists and setup are shared between them and the
+     * work is spread over copies and molecules. The positions of the Context are not changed.
+     *
+     * @param context    the Context this force has been added to
+     * @param positions  positions[copy][particle] of every copy, virtual sites included
+     * @param forces     on exit, forces[copy][particle] is the force this term exerts in each copy;
+     *                   forces on virtual sites are not yet distributed to the atoms defining them
+     * @param energies   on exit, energies[copy] is the energy of this term in each copy
+     */
+    void computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+
+    /**
+     * Get the virial tensor of this force from its most recent evaluation in a Context,
+     * virial[a][b] = sum over particles of r_a f_b (kJ/mol), with periodic images and virtual
+     * sites taken into account. The pressure tensor is (sum of m v_a v_b + virial)/V, with the
+     * virials of all forces added up; no extra energy evaluations are needed.
+     *
+     * @param context    the Context this force has been added to
+     * @param virial     on exit, the three rows of the virial tensor
+     */
+    void getVirial(Context& context, std::vector<Vec3>& virial);
+
+    /**
+     * Get how often the induced dipole iterations in a Context were started from the previous
+     * dipoles (see setInducedDipoleWarmStart()), and the number of iterations this saved compared
+     * to the most recent evaluation that started from the directly polarized dipoles.
+     *
+     * @param context             the Context this force has been added to
+     * @param numWarmStarts       on exit, the number of warm-started evaluations
+     * @param numIterationsSaved  on exit, the number of induced dipole iterations saved
+     */
+    void getInducedDipoleWarmStartStatistics(Context& context, int& numWarmStarts, int& numIterationsSaved);
+
+    /**
+     * Get the shares of every molecule in the energy of this force from its most recent
+     * evaluation in a Context. The energy is half the sum over the sites of charge times
+     * potential; the permanent part takes the potential of the charges, the induction part
+     * that of the induced dipoles, and a molecule gets the terms of its sites. The shares of
+     * both parts add up to the energy of the force; with Treecode they do so within the
+     * accuracy of the multipole expansions, with PME within the accuracy of the grid.
+     * Throws an OpenMMException unless the decomposition is enabled with
+     * setIncludeEnergyDecomposition().
+     *
+     * @param context    the Context this force has been added to
+     * @param permanent  on exit, permanent[m] is the charge-charge energy of molecule index m (kJ/mol)
+     * @param induction  on exit, induction[m] is the induction energy of molecule index m (kJ/mol)
+     */
+    void getMoleculeEnergies(Context& context, std::vector<double>& permanent, std::vector<double>& induction);
+
+    /**
+     * Get the electrostatic potential at every site from its most recent evaluation in a Context,
+     * with the charges it acts on, see getMoleculeEnergies().
+     *
+     * @param context     the Context this force has been added to
+     * @param potentials  on exit, the potential of the charges and induced dipoles at every site (kJ/mol/e)
+     * @param charges     on exit, the charge of every site after the charge redistribution (e)
+     */
+    void getSitePotentials(Context& context, std::vector<double>& potentials, std::vector<double>& charges);
+
+    /**
+     * Write the state the induced dipole solver keeps between evaluations in a Context: the
+     * converged induced dipoles with the positions and box they belong to, and the neighbor
+     * list build. Saved next to Context::createCheckpoint() and restored with
+     * loadSolverCheckpoint() after Context::loadCheckpoint(), it lets a restarted run with
+     * warm starts enabled (see setInducedDipoleWarmStart()) start its first evaluation from
+     * the converged dipoles instead of from scratch. The data is binary and only meant for the same platform and
+     * build; System clones and XmlSerializer do not need it.
+     *
+     * @param context    the Context this force has been added to
+     * @param stream     the stream to write the checkpoint to
+     */
+    void createSolverCheckpoint(Context& context, std::ostream& stream);
+
+    /**
+     * Restore the solver state written by createSolverCheckpoint(). Throws an OpenMMException
+     * if the checkpoint was written for a force with different particles or nonbonded method.
+     *
+     * @param context    the Context this force has been added to
+     * @param stream     the stream to read the checkpoint from
+     */
+    void loadSolverCheckpoint(Context& context, std::istream& stream);
+
 protected:
     ForceImpl* createImpl() const;
 private:
@@ -294,6 +505,14 @@ private:
     double electricConstant;
     double ewaldErrorTol;
     bool includeChargeRedistribution;
+    bool inducedDipoleWarmStart;
+    bool includeEnergyDecomposition;
+    bool useSinglePrecisionPme;
+    double treecodeOpeningAngle;
+    int treecodeExpansionOrder;
+    InteractionGroup interactionGroup;
+    double splitDistance;
+    double splitWidth;
     std::vector<double> tholeParameters;
     class ElectrostaticsInfo;
     std::vector<ElectrostaticsInfo> multipoles;
@@ -0,0 +1,210 @@
+#ifndef OPENMM_MBPOL_ENGINE_H_
+#define OPENMM_MBPOL_ENGINE_H_
+
+/* -------------------------------------------------------------------------- *
+ *                              OpenMMMBPol                                  *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "internal/windowsExportMBPol.h"
+
+namespace MBPolPlugin {
+
+class MBPolEngineImpl;
+
+/**
+ * This class evaluates the MB-pol energy, forces and virial of a system of water
+ * molecules without an OpenMM System or Context, for codes that embed MB-pol in
+ * their own MD or MC loop.
+ *
+ * The coordinates of water i are those of its oxygen and its two hydrogens, in this
+ * order, at 9*i ... 9*i+8 of a flat array (nm); the M site is placed internally and
+ * its force is passed on to the three atoms. The engine evaluates the one-, two- and
+ * three-body terms, the electrostatics (PME for a periodic box, no cutoff for a cluster)
+ * and the dispersion with the parameters of mbpol.xml, i.e. the same energy as a System
+ * created from it. Each compute() reads the caller's positions and writes into the
+ * caller's force and virial buffers; it is implemented by the Reference platform
+ * and links against the OpenMMMBPolReference library.
+ *
+ * Successive calls are expected to be consecutive configurations of one trajectory
+ * (e.g. one bead of a path integral): the engine keeps a Verlet neighbor list of the
+ * oxygens, rebuilt only once a water has moved by half its skin. With
+ * setInducedDipoleWarmStart(true) it also starts the induced dipole iterations from the
+ * dipoles of the previous call if no site has moved by more than 0.02 nm. Use one engine
+ * per trajectory; different engines may be used concurrently.
+ */
+
+class OPENMM_EXPORT_MBPOL MBPolEngine {
+
+public:
+
+    /**
+     * The terms the energy is the sum of, see getTermEnergy().
+     */
+    enum Term {
+        OneBody = 0,
+        TwoBody = 1,
+        ThreeBody = 2,
+        Electrostatics = 3,
+        Dispersion = 4,
+        NumTerms = 5
+    };
+
+    /**
+     * Create an MBPolEngine for a cluster of water molecules.
+     *
+     * @param numWaters    the number of water molecules
+     */
+    explicit MBPolEngine(int numWaters);
+
+    ~MBPolEngine();
+
+    /**
+     * Get the number of water molecules.
+     */
+    int getNumWaters() const;
+
+    /**
+     * Get the number of atoms (three per water), i.e. a third of the length of the
+     * position and force arrays.
+     */
+    int getNumAtoms() const;
+
+    /**
+     * Set the edges of a rectangular periodic box (nm); all zero makes the system a
+     * non-periodic cluster again. Each edge must be at least twice the cutoff distance.
+     */
+    void setBox(double x, double y, double z);
+
+    /**
+     * Get the edges of the periodic box (nm); all zero for a cluster.
+     */
+    void getBox(double& x, double& y, double& z) const;
+
+    /**
+     * Get whether the system is periodic.
+     */
+    bool usesPeriodicBoundaryConditions() const;
+
+    /**
+     * Set the cutoff of the real space electrostatics and of the dispersion in a
+     * periodic box (nm). The default is 0.9 nm.
+     */
+    void setCutoffDistance(double distance);
+
+    /**
+     * Get the cutoff of the real space electrostatics and of the dispersion (nm).
+     */
+    double getCutoffDistance() const;
+
+    /**
+     * Set the relative error tolerance of the PME electrostatics, from which the Ewald
+     * parameter and the grid are chosen as for MBPolElectrostaticsForce. The default is 1e-4.
+     */
+    void setEwaldErrorTolerance(double tolerance);
+
+    /**
+     * Get the relative error tolerance of the PME electrostatics.
+     */
+    double getEwaldErrorTolerance() const;
+
+    /**
+     * Set the convergence criterion of the induced dipoles (Debye). The default is 1e-7.
+     */
+    void setMutualInducedTargetEpsilon(double epsilon);
+
+    /**
+     * Get the convergence criterion of the induced dipoles (Debye).
+     */
+    double getMutualInducedTargetEpsilon() const;
+
+    /**
+     * Set whether the induced dipole iterations start from the dipoles of the previous call
+     * when no site has moved by more than 0.02 nm, as MBPolElectrostaticsForce::setInducedDipoleWarmStart().
+     * The dipoles meet the same convergence criterion either way, but a warm-started result
+     * depends in the last digits on the previous calls. The default is false, so every call
+     * starts from the directly polarized dipoles and gives the same result for the same input.
+     */
+    void setInducedDipoleWarmStart(bool warmStart);
+
+    /**
+     * Get whether the induced dipole iterations start from the dipoles of the previous call.
+     */
+    bool getInducedDipoleWarmStart() const;
+
+    /**
+     * Evaluate the energy, forces and virial.
+     *
+     * @param positions    3*getNumAtoms() coordinates (nm), see the class description
+     * @param forces       if not NULL, the 3*getNumAtoms() force components are stored here (kJ/mol/nm)
+     * @param virial       if not NULL, the virial tensor W[a][b] = sum r_a f_b is stored here
+     *                     row by row (9 values, kJ/mol)
+     * @return the potential energy (kJ/mol)
+     */
+    double compute(const double* positions, double* forces, double* virial);
+
+    /**
+     * Get the energy of one term at the last compute() (kJ/mol); the terms add up to the
+     * energy it returned. All terms are zero before the first compute().
+     */
+    double getTermEnergy(Term term) const;
+
+    /**
+     * Get the number of times the neighbor list has been built since the periodicity or
+     * the cutoff distance last changed.
+     */
+    int getNumNeighborListBuilds() const;
+
+    /**
+     * Get the number of evaluations whose induced dipole iterations started from the
+     * dipoles of the previous call.
+     */
+    int getNumInducedDipoleWarmStarts() const;
+
+private:
+
+    MBPolEngine(const MBPolEngine&);
+    MBPolEngine& operator=(const MBPolEngine&);
+
+    MBPolEngineImpl* impl;
+};
+
+} // namespace MBPolPlugin
+
+/**
+ * Short name of the engine for embedding codes: mbpol::Engine.
+ */
+
+namespace mbpol {
+
+typedef MBPolPlugin::MBPolEngine Engine;
+
+} // namespace mbpol
+
+#endif /*OPENMM_MBPOL_ENGINE_H_*/
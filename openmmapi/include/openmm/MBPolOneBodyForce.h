@@ -34,6 +34,7 @@
 
 #include "openmm/Force.h"
 #include "internal/windowsExportMBPol.h"
+#include "openmm/Vec3.h"
 #include <vector>
 
 using namespace OpenMM;
@@ -63,6 +64,14 @@ public:
 
    void setNonbondedMethod(NonbondedMethod method);
 
+    /**
+     * Set whether every evaluation also records the share of each molecule in the energy,
+     * see getMoleculeEnergies(). Disabled by default.
+     */
+    void setIncludeEnergyDecomposition(bool includeEnergyDecomposition);
+
+    bool getIncludeEnergyDecomposition() const;
+
     /**
      * Create an MBPolOneBodyForce.
      */
@@ -89,6 +98,16 @@ public:
      */
     int addOneBody(const std::vector<int> & particleIndices    );
 
+    /**
+     * Add many one-body terms at once, e.g. for all the waters of a large system,
+     * instead of calling addOneBody() for each.
+     *
+     * @param flatIndices   the particle indices of the molecules one after another,
+     *                      three per molecule (O, H, H)
+     * @return the index of the first one-body term that was added
+     */
+    int addOneBodies(const std::vector<int> & flatIndices);
+
     /**
      * Get the force field parameters for a stretch-bend term.
      * 
@@ -127,12 +146,50 @@ public:
      */
     void updateParametersInContext(Context& context);
 
+    /**
+     * Compute this force for several copies of the System at once, e.g. the beads of a ring
+     * polymer. The copies share the topology, parameters and periodic box of the Context and
+     * are evaluated together, so neighbor lists and setup are shared between them and the
+     * work is spread over copies and molecules. The positions of the Context are not changed.
+     *
+     * @param context    the Context this force has been added to
+     * @param positions  positions[copy][particle] of every copy, virtual sites included
+     * @param forces     on exit, forces[copy][particle] is the force this term exerts in each copy;
+     *                   forces on virtual sites are not yet distributed to the atoms defining them
+     * @param energies   on exit, energies[copy] is the energy of this term in each copy
+     */
+    void computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+
+    /**
+     * Get the virial tensor of this force from its most recent evaluation in a Context,
+     * virial[a][b] = sum over particles of r_a f_b (kJ/mol), with periodic images and virtual
+     * sites taken into account. The pressure tensor is (sum of m v_a v_b + virial)/V, with the
+     * virials of all forces added up; no extra energy evaluations are needed.
+     *
+     * @param context    the Context this force has been added to
+     * @param virial     on exit, the three rows of the virial tensor
+     */
+    void getVirial(Context& context, std::vector<Vec3>& virial);
+
+    /**
+     * Get the share of every molecule in the energy of this force from its most recent
+     * evaluation in a Context: the energy of each monomer, so the shares add up to the energy of the force.
+     * Throws an OpenMMException unless the decomposition is enabled with
+     * setIncludeEnergyDecomposition().
+     *
+     * @param context    the Context this force has been added to
+     * @param energies   on exit, energies[i] is the energy of the monomer added as OneBody i (kJ/mol)
+     */
+    void getMoleculeEnergies(Context& context, std::vector<double>& energies);
+
 protected:
     ForceImpl* createImpl() const;
 private:
     class OneBodyInfo;
     std::vector<OneBodyInfo> stretchBends;
     NonbondedMethod nonbondedMethod;
+    bool includeEnergyDecomposition;
 };
 
 class MBPolOneBodyForce::OneBodyInfo {
@@ -34,6 +34,7 @@
 
 #include "openmm/Force.h"
 #include "internal/windowsExportMBPol.h"
+#include "openmm/Vec3.h"
 #include <vector>
 
 using namespace OpenMM;
@@ -122,6 +123,16 @@ public:
      */
     int addParticle(const std::vector<int> & particleIndices);
 
+    /**
+     * Add many molecules at once, e.g. all the waters of a large system, instead of
+     * calling addParticle() for each.
+     *
+     * @param flatIndices     the particle indices of the molecules one after another,
+     *                        three per molecule (O, H, H)
+     * @return index of the first added molecule
+     */
+    int addParticles(const std::vector<int> & flatIndices);
+
     int getNumMolecules(void) const;
     /**
      * Set the cutoff distance.
@@ -142,6 +153,24 @@ public:
      * Set the method used for handling long range nonbonded interactions.
      */
     void setNonbondedMethod(NonbondedMethod method);
+
+    /**
+     * Set whether every evaluation also records the share of each molecule in the energy,
+     * see getMoleculeEnergies(). Disabled by default.
+     */
+    void setIncludeEnergyDecomposition(bool includeEnergyDecomposition);
+
+    bool getIncludeEnergyDecomposition() const;
+
+    /**
+     * Set whether the three-body polynomial is evaluated in single precision. The variables,
+     * the gradients and the sums over the triplets are kept in double precision, so the
+     * error stays that of the single precision polynomial (about 1e-6 relative) while
+     * its evaluation runs on twice as many SIMD lanes. Disabled by default.
+     */
+    void setUseMixedPrecision(bool useMixedPrecision);
+
+    bool getUseMixedPrecision() const;
     /**
      * Update the per-particle parameters in a Context to match those stored in this Force object.  This method provides
      * an efficient method to update certain parameters in an existing Context without needing to reinitialize it.
@@ -153,6 +182,43 @@ public:
      */
     void updateParametersInContext(Context& context);
 
+    /**
+     * Compute this force for several copies of the System at once, e.g. the beads of a ring
+     * polymer. The copies share the topology, parameters and periodic box of the Context and
+     * are evaluated together, so neighbor lists and setup are shared between them and the
+     * work is spread over copies and molecules. The positions of the Context are not changed.
+     *
+     * @param context    the Context this force has been added to
+     * @param positions  positions[copy][particle] of every copy, virtual sites included
+     * @param forces     on exit, forces[copy][particle] is the force this term exerts in each copy;
+     *                   forces on virtual sites are not yet distributed to the atoms defining them
+     * @param energies   on exit, energies[copy] is the energy of this term in each copy
+     */
+    void computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+
+    /**
+     * Get the virial tensor of this force from its most recent evaluation in a Context,
+     * virial[a][b] = sum over particles of r_a f_b (kJ/mol), with periodic images and virtual
+     * sites taken into account. The pressure tensor is (sum of m v_a v_b + virial)/V, with the
+     * virials of all forces added up; no extra energy evaluations are needed.
+     *
+     * @param context    the Context this force has been added to
+     * @param virial     on exit, the three rows of the virial tensor
+     */
+    void getVirial(Context& context, std::vector<Vec3>& virial);
+
+    /**
+     * Get the share of every molecule in the energy of this force from its most recent
+     * evaluation in a Context: a third of the energy of each triplet of molecules is added to each of its molecules, so the shares add up to the energy of the force.
+     * Throws an OpenMMException unless the decomposition is enabled with
+     * setIncludeEnergyDecomposition().
+     *
+     * @param context    the Context this force has been added to
+     * @param energies   on exit, energies[i] is the share of the molecule added as particle i (kJ/mol)
+     */
+    void getMoleculeEnergies(Context& context, std::vector<double>& energies);
+
 protected:
     ForceImpl* createImpl() const;
 private:
@@ -160,6 +226,8 @@ private:
     class ThreeBodyInfo;
     NonbondedMethod nonbondedMethod;
     double cutoff;
+    bool includeEnergyDecomposition;
+    bool useMixedPrecision;
 
     std::vector<ThreeBodyInfo> parameters;
     std::vector< std::vector< std::vector<double> > > sigEpsTable;
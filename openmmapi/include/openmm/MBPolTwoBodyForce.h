@@ -34,6 +34,8 @@
 
 #include "openmm/Force.h"
 #include "internal/windowsExportMBPol.h"
+#include "openmm/Vec3.h"
+#include <string>
 #include <vector>
 
 using namespace OpenMM;
@@ -73,6 +75,27 @@ public:
         CutoffNonPeriodic = 2,
     };
 
+    /**
+     * This is an enumeration of the parts of the two-body energy a force can compute, so that the
+     * term can be split over the inner and outer steps of a multiple time step integrator (e.g. a
+     * ShortRange force in a fast force group and a LongRange force in a slow one).
+     */
+    enum InteractionGroup {
+        /**
+         * The full two-body energy.  This is the default.
+         */
+        AllInteractions = 0,
+        /**
+         * Pairs whose oxygens are closer than the split distance, switched off smoothly over the
+         * split width below it.
+         */
+        ShortRange = 1,
+        /**
+         * The rest of the two-body energy: AllInteractions minus ShortRange.
+         */
+        LongRange = 2
+    };
+
     /**
      * Create an MBPol TwoBodyForce.
      */
@@ -122,6 +145,16 @@ public:
      */
     int addParticle(const std::vector<int> & particleIndices);
 
+    /**
+     * Add many molecules at once, e.g. all the waters of a large system, instead of
+     * calling addParticle() for each.
+     *
+     * @param flatIndices     the particle indices of the molecules one after another,
+     *                        three per molecule (O, H, H)
+     * @return index of the first added molecule
+     */
+    int addParticles(const std::vector<int> & flatIndices);
+
     int getNumMolecules(void) const;
     /**
      * Set the cutoff distance.
@@ -142,6 +175,62 @@ public:
      * Set the method used for handling long range nonbonded interactions.
      */
     void setNonbondedMethod(NonbondedMethod method);
+
+    /**
+     * Set whether every evaluation also records the share of each molecule in the energy,
+     * see getMoleculeEnergies(). Disabled by default.
+     */
+    void setIncludeEnergyDecomposition(bool includeEnergyDecomposition);
+
+    bool getIncludeEnergyDecomposition() const;
+
+    /**
+     * Set whether the two-body polynomial is evaluated in single precision. The variables,
+     * the gradients and the sums over the pairs are kept in double precision, so the
+     * error stays that of the single precision polynomial (about 1e-6 relative) while
+     * its evaluation runs on twice as many SIMD lanes. Disabled by default.
+     */
+    void setUseMixedPrecision(bool useMixedPrecision);
+
+    bool getUseMixedPrecision() const;
+
+    /**
+     * Get the instruction set the 2B and 3B polynomials are evaluated with by the Reference
+     * platform: "generic", "avx2" or "avx512". It is picked when the Reference kernels of the
+     * plugin are loaded; empty if they have not been loaded.
+     */
+    static std::string getPolynomialInstructionSet();
+
+    /**
+     * Get the part of the two-body energy computed by this force.
+     */
+    InteractionGroup getInteractionGroup() const;
+
+    /**
+     * Set the part of the two-body energy computed by this force.
+     */
+    void setInteractionGroup(InteractionGroup group);
+
+    /**
+     * Get the oxygen-oxygen distance (in nm) beyond which ShortRange pairs are zero.
+     */
+    double getSplitDistance() const;
+
+    /**
+     * Set the oxygen-oxygen distance (in nm) beyond which ShortRange pairs are zero.
+     */
+    void setSplitDistance(double distance);
+
+    /**
+     * Get the width (in nm) of the switch between the ShortRange and LongRange parts.
+     */
+    double getSplitWidth() const;
+
+    /**
+     * Set the width (in nm) of the switch between the ShortRange and LongRange parts.
+     */
+    void setSplitWidth(double width);
+
     /**
      * Update the per-particle parameters in a Context to match those stored in this Force object.  This method provides
      * an efficient method to update certain parameters in an existing Context without needing to reinitialize it.
@@ -153,6 +242,43 @@ public:
      */
     void updateParametersInContext(Context& context);
 
+    /**
+     * Compute this force for several copies of the System at once, e.g. the beads of a ring
+     * polymer. The copies share the topology, parameters and periodic box of the Context and
+     * are evaluated together, so neighbor lists and setup are shared between them and the
+     * work is spread over copies and molecules. The positions of the Context are not changed.
+     *
+     * @param context    the Context this force has been added to
+     * @param positions  positions[copy][particle] of every copy, virtual sites included
+     * @param forces     on exit, forces[copy][particle] is the force this term exerts in each copy;
+     *                   forces on virtual sites are not yet distributed to the atoms defining them
+     * @param energies   on exit, energies[copy] is the energy of this term in each copy
+     */
+    void computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+
+    /**
+     * Get the virial tensor of this force from its most recent evaluation in a Context,
+     * virial[a][b] = sum over particles of r_a f_b (kJ/mol), with periodic images and virtual
+     * sites taken into account. The pressure tensor is (sum of m v_a v_b + virial)/V, with the
+     * virials of all forces added up; no extra energy evaluations are needed.
+     *
+     * @param context    the Context this force has been added to
+     * @param virial     on exit, the three rows of the virial tensor
+     */
+    void getVirial(Context& context, std::vector<Vec3>& virial);
+
+    /**
+     * Get the share of every molecule in the energy of this force from its most recent
+     * evaluation in a Context: half the energy of each pair of molecules is added to either molecule, so the shares add up to the energy of the force.
+     * Throws an OpenMMException unless the decomposition is enabled with
+     * setIncludeEnergyDecomposition().
+     *
+     * @param context    the Context this force has been added to
+     * @param energies   on exit, energies[i] is the share of the molecule added as particle i (kJ/mol)
+     */
+    void getMoleculeEnergies(Context& context, std::vector<double>& energies);
+
 protected:
     ForceImpl* createImpl() const;
 private:
@@ -160,6 +286,11 @@ private:
     class TwoBodyInfo;
     NonbondedMethod nonbondedMethod;
     double cutoff;
+    InteractionGroup interactionGroup;
+    double splitDistance;
+    double splitWidth;
+    bool includeEnergyDecomposition;
+    bool useMixedPrecision;
 
     std::vector<TwoBodyInfo> parameters;
     std::vector< std::vector< std::vector<double> > > sigEpsTable;
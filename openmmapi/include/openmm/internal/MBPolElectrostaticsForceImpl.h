@@ -36,6 +36,7 @@
 #include "openmm/MBPolElectrostaticsForce.h"
 #include "openmm/Kernel.h"
 #include "openmm/Vec3.h"
+#include <iosfwd>
 #include <utility>
 #include <string>
 
@@ -67,6 +68,15 @@ public:
 
     void getSystemElectrostaticsMoments( ContextImpl& context, std::vector< double >& outputElectrostaticsMonents );
     void updateParametersInContext(ContextImpl& context);
+
+    void computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& permanent, std::vector<double>& induction);
+    void getSitePotentials(ContextImpl& context, std::vector<double>& potentials, std::vector<double>& charges);
+    void getInducedDipoleWarmStartStatistics(ContextImpl& context, int& numWarmStarts, int& numIterationsSaved);
+    void createSolverCheckpoint(ContextImpl& context, std::ostream& stream);
+    void loadSolverCheckpoint(ContextImpl& context, std::istream& stream);
  
 
 private:
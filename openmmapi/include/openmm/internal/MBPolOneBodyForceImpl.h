@@ -64,6 +64,11 @@ public:
     }
     std::vector<std::string> getKernelNames();
     void updateParametersInContext(ContextImpl& context);
+
+    void computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
 private:
     const MBPolOneBodyForce& owner;
     Kernel kernel;
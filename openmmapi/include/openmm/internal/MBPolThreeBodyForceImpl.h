@@ -64,6 +64,11 @@ public:
 
 
     void updateParametersInContext(ContextImpl& context);
+
+    void computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
 private:
     const MBPolThreeBodyForce& owner;
     Kernel kernel;
@@ -64,6 +64,17 @@ public:
 
 
     void updateParametersInContext(ContextImpl& context);
+
+    void computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
+    /**
+     * Record the instruction set of the polynomials, see MBPolTwoBodyForce::getPolynomialInstructionSet().
+     * Called by the Reference platform when it selects one.
+     */
+    static void setPolynomialInstructionSet(const std::string& name);
+    static const std::string& getPolynomialInstructionSet();
 private:
     const MBPolTwoBodyForce& owner;
     Kernel kernel;
@@ -34,9 +34,11 @@
 
 #include "OpenMMMBPol.h"
 #include "openmm/KernelImpl.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/System.h"
 #include "openmm/Platform.h"
 
+#include <iosfwd>
 #include <set>
 #include <string>
 #include <vector>
@@ -74,6 +76,56 @@ public:
      * @return the potential energy due to the force
      */
     virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy) = 0;
+    /**
+     * Called before execute() with the force groups of the evaluation, so that the platform
+     * can start the other MBPol forces of the same evaluation concurrently.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    virtual void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    }
+
+    /**
+     * Compute the force for several copies of the system that share the topology,
+     * parameters and box of the context (e.g. the beads of a ring polymer).
+     * Platforms that do not batch copies throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    virtual void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                               std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolOneBodyForceKernel: evaluating copies is not supported on this platform");
+    }
+
+    /**
+     * Get the virial tensor of the most recent evaluation, virial[a][b] = sum r_a f_b.
+     * Platforms that do not compute the virial throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    virtual void getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+        throw OpenMM::OpenMMException("CalcMBPolOneBodyForceKernel: the virial is not supported on this platform");
+    }
+
+    /**
+     * Get the share of every molecule in the energy of the most recent evaluation, if the
+     * energy decomposition is enabled. Platforms that do not decompose the energy throw an
+     * OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    virtual void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolOneBodyForceKernel: the energy decomposition is not supported on this platform");
+    }
+
     /**
      * Copy changed parameters over to a context.
      *
@@ -114,6 +166,101 @@ public:
      * @return the potential energy due to the force
      */
     virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy) = 0;
+    /**
+     * Called before execute() with the force groups of the evaluation, so that the platform
+     * can start the other MBPol forces of the same evaluation concurrently.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    virtual void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    }
+
+    /**
+     * Compute the force for several copies of the system that share the topology,
+     * parameters and box of the context (e.g. the beads of a ring polymer).
+     * Platforms that do not batch copies throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    virtual void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                               std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: evaluating copies is not supported on this platform");
+    }
+
+    /**
+     * Get the virial tensor of the most recent evaluation, virial[a][b] = sum r_a f_b.
+     * Platforms that do not compute the virial throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    virtual void getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: the virial is not supported on this platform");
+    }
+
+    /**
+     * Get the shares of every molecule in the permanent and induction energies of the most
+     * recent evaluation, if the energy decomposition is enabled. Platforms that do not
+     * decompose the energy throw an OpenMMException.
+     *
+     * @param context     the context in which to execute this kernel
+     * @param permanent   on exit, the charge-charge energy of every molecule index (kJ/mol)
+     * @param induction   on exit, the induction energy of every molecule index (kJ/mol)
+     */
+    virtual void getMoleculeEnergies(ContextImpl& context, std::vector<double>& permanent, std::vector<double>& induction) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: the energy decomposition is not supported on this platform");
+    }
+
+    /**
+     * Get the electrostatic potential at every site and the site charges of the most recent
+     * evaluation, if the energy decomposition is enabled.
+     *
+     * @param context     the context in which to execute this kernel
+     * @param potentials  on exit, the potential at every site (kJ/mol/e)
+     * @param charges     on exit, the charge of every site after the charge redistribution (e)
+     */
+    virtual void getSitePotentials(ContextImpl& context, std::vector<double>& potentials, std::vector<double>& charges) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: the energy decomposition is not supported on this platform");
+    }
+
+    /**
+     * Get the statistics of the induced dipole warm starts.
+     *
+     * @param context             the context in which to execute this kernel
+     * @param numWarmStarts       on exit, the number of warm-started evaluations
+     * @param numIterationsSaved  on exit, the number of induced dipole iterations saved
+     */
+    virtual void getInducedDipoleWarmStartStatistics(ContextImpl& context, int& numWarmStarts, int& numIterationsSaved) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: induced dipole warm starts are not supported on this platform");
+    }
+
+    /**
+     * Write the solver state kept between evaluations (the converged induced dipoles and the
+     * neighbor list build) for loadSolverCheckpoint(). Platforms that keep no such state throw
+     * an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     the stream to write the checkpoint to
+     */
+    virtual void createSolverCheckpoint(ContextImpl& context, std::ostream& stream) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: solver checkpoints are not supported on this platform");
+    }
+
+    /**
+     * Restore the solver state written by createSolverCheckpoint().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     the stream to read the checkpoint from
+     */
+    virtual void loadSolverCheckpoint(ContextImpl& context, std::istream& stream) {
+        throw OpenMM::OpenMMException("CalcMBPolElectrostaticsForceKernel: solver checkpoints are not supported on this platform");
+    }
 
     virtual void getElectrostaticPotential( ContextImpl& context, const std::vector< Vec3 >& inputGrid,
                                             std::vector< double >& outputElectrostaticPotential ) = 0;
@@ -158,6 +305,56 @@ public:
      * @return the potential energy due to the force
      */
     virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy) = 0;
+    /**
+     * Called before execute() with the force groups of the evaluation, so that the platform
+     * can start the other MBPol forces of the same evaluation concurrently.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    virtual void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    }
+
+    /**
+     * Compute the force for several copies of the system that share the topology,
+     * parameters and box of the context (e.g. the beads of a ring polymer).
+     * Platforms that do not batch copies throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    virtual void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                               std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolTwoBodyForceKernel: evaluating copies is not supported on this platform");
+    }
+
+    /**
+     * Get the virial tensor of the most recent evaluation, virial[a][b] = sum r_a f_b.
+     * Platforms that do not compute the virial throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    virtual void getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+        throw OpenMM::OpenMMException("CalcMBPolTwoBodyForceKernel: the virial is not supported on this platform");
+    }
+
+    /**
+     * Get the share of every molecule in the energy of the most recent evaluation, if the
+     * energy decomposition is enabled. Platforms that do not decompose the energy throw an
+     * OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    virtual void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolTwoBodyForceKernel: the energy decomposition is not supported on this platform");
+    }
+
     /**
      * Copy changed parameters over to a context.
      *
@@ -197,6 +394,56 @@ public:
      * @return the potential energy due to the force
      */
     virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy) = 0;
+    /**
+     * Called before execute() with the force groups of the evaluation, so that the platform
+     * can start the other MBPol forces of the same evaluation concurrently.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    virtual void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    }
+
+    /**
+     * Compute the force for several copies of the system that share the topology,
+     * parameters and box of the context (e.g. the beads of a ring polymer).
+     * Platforms that do not batch copies throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    virtual void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                               std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolThreeBodyForceKernel: evaluating copies is not supported on this platform");
+    }
+
+    /**
+     * Get the virial tensor of the most recent evaluation, virial[a][b] = sum r_a f_b.
+     * Platforms that do not compute the virial throw an OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    virtual void getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+        throw OpenMM::OpenMMException("CalcMBPolThreeBodyForceKernel: the virial is not supported on this platform");
+    }
+
+    /**
+     * Get the share of every molecule in the energy of the most recent evaluation, if the
+     * energy decomposition is enabled. Platforms that do not decompose the energy throw an
+     * OpenMMException.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    virtual void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+        throw OpenMM::OpenMMException("CalcMBPolThreeBodyForceKernel: the energy decomposition is not supported on this platform");
+    }
+
     /**
      * Copy changed parameters over to a context.
      *
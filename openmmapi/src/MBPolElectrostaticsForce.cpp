@@ -41,7 +41,9 @@ using std::string;
 using std::vector;
 
 MBPolElectrostaticsForce::MBPolElectrostaticsForce() : nonbondedMethod(NoCutoff), pmeBSplineOrder(5), cutoffDistance(0.9), ewaldErrorTol(1e-4), mutualInducedMaxIterations(200),
-                                               mutualInducedTargetEpsilon(1.0e-07), scalingDistanceCutoff(100.0), electricConstant(138.9354558456), aewald(0.0), includeChargeRedistribution(true) {
+                                               mutualInducedTargetEpsilon(1.0e-07), scalingDistanceCutoff(100.0), electricConstant(138.9354558456), aewald(0.0), includeChargeRedistribution(true),
+                                               inducedDipoleWarmStart(false), includeEnergyDecomposition(false), useSinglePrecisionPme(false), treecodeOpeningAngle(0.5), treecodeExpansionOrder(6), interactionGroup(AllInteractions),
+                                               splitDistance(0.45), splitWidth(0.1) {
     pmeGridDimension.resize(3);
     pmeGridDimension[0] = pmeGridDimension[1] = pmeGridDimension[2];
     const double defaultTholeParameters[5] = { 0.4, 0.4, 0.055, 0.626, 0.055 };
@@ -56,6 +58,30 @@ void MBPolElectrostaticsForce::setNonbondedMethod( MBPolElectrostaticsForce::Non
     nonbondedMethod = method;
 }
 
+MBPolElectrostaticsForce::InteractionGroup MBPolElectrostaticsForce::getInteractionGroup( void ) const {
+    return interactionGroup;
+}
+
+void MBPolElectrostaticsForce::setInteractionGroup( MBPolElectrostaticsForce::InteractionGroup group ) {
+    interactionGroup = group;
+}
+
+double MBPolElectrostaticsForce::getSplitDistance( void ) const {
+    return splitDistance;
+}
+
+void MBPolElectrostaticsForce::setSplitDistance( double distance ) {
+    splitDistance = distance;
+}
+
+double MBPolElectrostaticsForce::getSplitWidth( void ) const {
+    return splitWidth;
+}
+
+void MBPolElectrostaticsForce::setSplitWidth( double width ) {
+    splitWidth = width;
+}
+
 double MBPolElectrostaticsForce::getCutoffDistance( void ) const {
     return cutoffDistance;
 }
@@ -75,6 +101,46 @@ void MBPolElectrostaticsForce::setIncludeChargeRedistribution( bool chargeRedist
 bool MBPolElectrostaticsForce::getIncludeChargeRedistribution( void ) const {
     return includeChargeRedistribution;
 }
+
+void MBPolElectrostaticsForce::setInducedDipoleWarmStart( bool warmStart ) {
+    inducedDipoleWarmStart = warmStart;
+}
+
+bool MBPolElectrostaticsForce::getInducedDipoleWarmStart( void ) const {
+    return inducedDipoleWarmStart;
+}
+
+void MBPolElectrostaticsForce::setIncludeEnergyDecomposition( bool includeEnergyDecomposition ) {
+    this->includeEnergyDecomposition = includeEnergyDecomposition;
+}
+
+bool MBPolElectrostaticsForce::getIncludeEnergyDecomposition( void ) const {
+    return includeEnergyDecomposition;
+}
+
+void MBPolElectrostaticsForce::setUseSinglePrecisionPme( bool useSinglePrecisionPme ) {
+    this->useSinglePrecisionPme = useSinglePrecisionPme;
+}
+
+bool MBPolElectrostaticsForce::getUseSinglePrecisionPme( void ) const {
+    return useSinglePrecisionPme;
+}
+
+void MBPolElectrostaticsForce::setTreecodeOpeningAngle( double angle ) {
+    treecodeOpeningAngle = angle;
+}
+
+double MBPolElectrostaticsForce::getTreecodeOpeningAngle( void ) const {
+    return treecodeOpeningAngle;
+}
+
+void MBPolElectrostaticsForce::setTreecodeExpansionOrder( int order ) {
+    treecodeExpansionOrder = order;
+}
+
+int MBPolElectrostaticsForce::getTreecodeExpansionOrder( void ) const {
+    return treecodeExpansionOrder;
+}
 void MBPolElectrostaticsForce::setAEwald(double inputAewald ) { 
     aewald = inputAewald; 
 } 
@@ -135,6 +201,20 @@ int MBPolElectrostaticsForce::addElectrostatics( double charge,
     return multipoles.size()-1;
 }
 
+int MBPolElectrostaticsForce::addParticles(const std::vector<double>& charges, const std::vector<int>& moleculeIndices,
+                                           const std::vector<int>& atomTypes, const std::vector<double>& dampingFactors,
+                                           const std::vector<double>& polarities) {
+    unsigned int numParticles = charges.size();
+    if (moleculeIndices.size() != numParticles || atomTypes.size() != numParticles ||
+        dampingFactors.size() != numParticles || polarities.size() != numParticles)
+        throw OpenMMException("MBPolElectrostaticsForce::addParticles: the arrays must have the same length");
+    int firstIndex = multipoles.size();
+    multipoles.reserve(multipoles.size() + numParticles);
+    for (unsigned int ii = 0; ii < numParticles; ii++)
+        multipoles.push_back(ElectrostaticsInfo(charges[ii], moleculeIndices[ii], atomTypes[ii], dampingFactors[ii], polarities[ii]));
+    return firstIndex;
+}
+
 void MBPolElectrostaticsForce::getElectrostaticsParameters(int index, double& charge,
                                                   int& moleculeIndex, int& atomType, double& dampingFactor, double& polarity ) const {
     charge                      = multipoles[index].charge;
@@ -168,3 +248,32 @@ ForceImpl* MBPolElectrostaticsForce::createImpl()  const {
 void MBPolElectrostaticsForce::updateParametersInContext(Context& context) {
     dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+void MBPolElectrostaticsForce::computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                                std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).computeCopies(getContextImpl(context), positions, forces, energies);
+}
+
+void MBPolElectrostaticsForce::getVirial(Context& context, std::vector<Vec3>& virial) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).getVirial(getContextImpl(context), virial);
+}
+
+void MBPolElectrostaticsForce::getInducedDipoleWarmStartStatistics(Context& context, int& numWarmStarts, int& numIterationsSaved) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).getInducedDipoleWarmStartStatistics(getContextImpl(context), numWarmStarts, numIterationsSaved);
+}
+
+void MBPolElectrostaticsForce::getMoleculeEnergies(Context& context, std::vector<double>& permanent, std::vector<double>& induction) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).getMoleculeEnergies(getContextImpl(context), permanent, induction);
+}
+
+void MBPolElectrostaticsForce::getSitePotentials(Context& context, std::vector<double>& potentials, std::vector<double>& charges) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).getSitePotentials(getContextImpl(context), potentials, charges);
+}
+
+void MBPolElectrostaticsForce::createSolverCheckpoint(Context& context, std::ostream& stream) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).createSolverCheckpoint(getContextImpl(context), stream);
+}
+
+void MBPolElectrostaticsForce::loadSolverCheckpoint(Context& context, std::istream& stream) {
+    dynamic_cast<MBPolElectrostaticsForceImpl&>(getImplInContext(context)).loadSolverCheckpoint(getContextImpl(context), stream);
+}
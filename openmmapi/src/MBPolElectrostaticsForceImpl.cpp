@@ -63,13 +63,23 @@ void MBPolElectrostaticsForceImpl::initialize(ContextImpl& context) {
             throw OpenMMException("MBPolElectrostaticsForce: The cutoff distance cannot be greater than half the periodic box size.");
     }   
 
+    if (owner.getNonbondedMethod() == MBPolElectrostaticsForce::Treecode) {
+        if (owner.getTreecodeOpeningAngle() <= 0.0 || owner.getTreecodeOpeningAngle() >= 1.0)
+            throw OpenMMException("MBPolElectrostaticsForce: The treecode opening angle must be between 0 and 1.");
+        if (owner.getTreecodeExpansionOrder() < 1)
+            throw OpenMMException("MBPolElectrostaticsForce: The treecode expansion order must be at least 1.");
+    }
+
     kernel = context.getPlatform().createKernel(CalcMBPolElectrostaticsForceKernel::Name(), context);
     kernel.getAs<CalcMBPolElectrostaticsForceKernel>().initialize(context.getSystem(), owner);
 }
 
 double MBPolElectrostaticsForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
-    if ((groups&(1<<owner.getForceGroup())) != 0)
-        return kernel.getAs<CalcMBPolElectrostaticsForceKernel>().execute(context, includeForces, includeEnergy);
+    if ((groups&(1<<owner.getForceGroup())) != 0) {
+        CalcMBPolElectrostaticsForceKernel& forceKernel = kernel.getAs<CalcMBPolElectrostaticsForceKernel>();
+        forceKernel.beginEvaluation(context, includeForces, includeEnergy, groups);
+        return forceKernel.execute(context, includeForces, includeEnergy);
+    }
     return 0.0;
 }
 
@@ -87,3 +97,32 @@ void MBPolElectrostaticsForceImpl::getElectrostaticPotential( ContextImpl& conte
 void MBPolElectrostaticsForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcMBPolElectrostaticsForceKernel>().copyParametersToContext(context, owner);
 }
+
+void MBPolElectrostaticsForceImpl::computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                                    std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().executeCopies(context, positions, forces, energies);
+}
+
+void MBPolElectrostaticsForceImpl::getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().getVirial(context, virial);
+}
+
+void MBPolElectrostaticsForceImpl::getMoleculeEnergies(ContextImpl& context, std::vector<double>& permanent, std::vector<double>& induction) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().getMoleculeEnergies(context, permanent, induction);
+}
+
+void MBPolElectrostaticsForceImpl::getSitePotentials(ContextImpl& context, std::vector<double>& potentials, std::vector<double>& charges) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().getSitePotentials(context, potentials, charges);
+}
+
+void MBPolElectrostaticsForceImpl::getInducedDipoleWarmStartStatistics(ContextImpl& context, int& numWarmStarts, int& numIterationsSaved) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().getInducedDipoleWarmStartStatistics(context, numWarmStarts, numIterationsSaved);
+}
+
+void MBPolElectrostaticsForceImpl::createSolverCheckpoint(ContextImpl& context, std::ostream& stream) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().createSolverCheckpoint(context, stream);
+}
+
+void MBPolElectrostaticsForceImpl::loadSolverCheckpoint(ContextImpl& context, std::istream& stream) {
+    kernel.getAs<CalcMBPolElectrostaticsForceKernel>().loadSolverCheckpoint(context, stream);
+}
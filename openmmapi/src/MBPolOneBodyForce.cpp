@@ -37,7 +37,7 @@
 using namespace  OpenMM;
 using namespace MBPolPlugin;
 
-MBPolOneBodyForce::MBPolOneBodyForce() {
+MBPolOneBodyForce::MBPolOneBodyForce() : includeEnergyDecomposition(false) {
 }
 
 int MBPolOneBodyForce::addOneBody(const std::vector<int> & particleIndices    ) {
@@ -45,6 +45,16 @@ int MBPolOneBodyForce::addOneBody(const std::vector<int> & particleIndices    )
     return stretchBends.size()-1;
 }
 
+int MBPolOneBodyForce::addOneBodies(const std::vector<int> & flatIndices) {
+    if (flatIndices.size() % 3 != 0)
+        throw OpenMMException("MBPolOneBodyForce::addOneBodies: the number of indices must be a multiple of 3");
+    int firstIndex = stretchBends.size();
+    stretchBends.reserve(stretchBends.size() + flatIndices.size()/3);
+    for (unsigned int ii = 0; ii < flatIndices.size(); ii += 3)
+        stretchBends.push_back(OneBodyInfo(std::vector<int>(flatIndices.begin() + ii, flatIndices.begin() + ii + 3)));
+    return firstIndex;
+}
+
 void MBPolOneBodyForce::getOneBodyParameters(int particleIndex, std::vector<int>& particleIndices ) const {
     particleIndices     = stretchBends[particleIndex].particleIndices;
 }
@@ -60,6 +70,14 @@ void MBPolOneBodyForce::setNonbondedMethod(NonbondedMethod method) {
     nonbondedMethod = method;
 }
 
+void MBPolOneBodyForce::setIncludeEnergyDecomposition(bool includeEnergyDecomposition) {
+    this->includeEnergyDecomposition = includeEnergyDecomposition;
+}
+
+bool MBPolOneBodyForce::getIncludeEnergyDecomposition() const {
+    return includeEnergyDecomposition;
+}
+
 ForceImpl* MBPolOneBodyForce::createImpl() const {
     return new MBPolOneBodyForceImpl(*this);
 }
@@ -67,3 +85,16 @@ ForceImpl* MBPolOneBodyForce::createImpl() const {
 void MBPolOneBodyForce::updateParametersInContext(Context& context) {
     dynamic_cast<MBPolOneBodyForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+void MBPolOneBodyForce::computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                                std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    dynamic_cast<MBPolOneBodyForceImpl&>(getImplInContext(context)).computeCopies(getContextImpl(context), positions, forces, energies);
+}
+
+void MBPolOneBodyForce::getVirial(Context& context, std::vector<Vec3>& virial) {
+    dynamic_cast<MBPolOneBodyForceImpl&>(getImplInContext(context)).getVirial(getContextImpl(context), virial);
+}
+
+void MBPolOneBodyForce::getMoleculeEnergies(Context& context, std::vector<double>& energies) {
+    dynamic_cast<MBPolOneBodyForceImpl&>(getImplInContext(context)).getMoleculeEnergies(getContextImpl(context), energies);
+}
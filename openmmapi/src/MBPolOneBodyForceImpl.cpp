@@ -52,8 +52,11 @@ void MBPolOneBodyForceImpl::initialize(ContextImpl& context) {
 }
 
 double MBPolOneBodyForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
-    if ((groups&(1<<owner.getForceGroup())) != 0)
-        return kernel.getAs<CalcMBPolOneBodyForceKernel>().execute(context, includeForces, includeEnergy);
+    if ((groups&(1<<owner.getForceGroup())) != 0) {
+        CalcMBPolOneBodyForceKernel& forceKernel = kernel.getAs<CalcMBPolOneBodyForceKernel>();
+        forceKernel.beginEvaluation(context, includeForces, includeEnergy, groups);
+        return forceKernel.execute(context, includeForces, includeEnergy);
+    }
     return 0.0;
 }
 
@@ -66,3 +69,16 @@ std::vector<std::string> MBPolOneBodyForceImpl::getKernelNames() {
 void MBPolOneBodyForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcMBPolOneBodyForceKernel>().copyParametersToContext(context, owner);
 }
+
+void MBPolOneBodyForceImpl::computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                                    std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolOneBodyForceKernel>().executeCopies(context, positions, forces, energies);
+}
+
+void MBPolOneBodyForceImpl::getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+    kernel.getAs<CalcMBPolOneBodyForceKernel>().getVirial(context, virial);
+}
+
+void MBPolOneBodyForceImpl::getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolOneBodyForceKernel>().getMoleculeEnergies(context, energies);
+}
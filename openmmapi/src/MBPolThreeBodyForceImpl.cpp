@@ -70,8 +70,11 @@ void MBPolThreeBodyForceImpl::initialize(ContextImpl& context) {
 }
 
 double MBPolThreeBodyForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
-    if ((groups&(1<<owner.getForceGroup())) != 0)
-        return kernel.getAs<CalcMBPolThreeBodyForceKernel>().execute(context, includeForces, includeEnergy);
+    if ((groups&(1<<owner.getForceGroup())) != 0) {
+        CalcMBPolThreeBodyForceKernel& forceKernel = kernel.getAs<CalcMBPolThreeBodyForceKernel>();
+        forceKernel.beginEvaluation(context, includeForces, includeEnergy, groups);
+        return forceKernel.execute(context, includeForces, includeEnergy);
+    }
     return 0.0;
 }
 
@@ -84,3 +87,16 @@ std::vector<std::string> MBPolThreeBodyForceImpl::getKernelNames() {
 void MBPolThreeBodyForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcMBPolThreeBodyForceKernel>().copyParametersToContext(context, owner);
 }
+
+void MBPolThreeBodyForceImpl::computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                                    std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolThreeBodyForceKernel>().executeCopies(context, positions, forces, energies);
+}
+
+void MBPolThreeBodyForceImpl::getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+    kernel.getAs<CalcMBPolThreeBodyForceKernel>().getVirial(context, virial);
+}
+
+void MBPolThreeBodyForceImpl::getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolThreeBodyForceKernel>().getMoleculeEnergies(context, energies);
+}
@@ -39,7 +39,8 @@ using namespace MBPolPlugin;
 using std::string;
 using std::vector;
 
-MBPolThreeBodyForce::MBPolThreeBodyForce() : nonbondedMethod(CutoffNonPeriodic), cutoff(1.0e+10) {
+MBPolThreeBodyForce::MBPolThreeBodyForce() : nonbondedMethod(CutoffNonPeriodic), cutoff(1.0e+10),
+                                             includeEnergyDecomposition(false), useMixedPrecision(false) {
 }
 
 int MBPolThreeBodyForce::addParticle(const std::vector<int> & particleIndices ) {
@@ -47,6 +48,16 @@ int MBPolThreeBodyForce::addParticle(const std::vector<int> & particleIndices )
     return parameters.size()-1;
 }
 
+int MBPolThreeBodyForce::addParticles(const std::vector<int> & flatIndices ) {
+    if (flatIndices.size() % 3 != 0)
+        throw OpenMMException("MBPolThreeBodyForce::addParticles: the number of indices must be a multiple of 3");
+    int firstIndex = parameters.size();
+    parameters.reserve(parameters.size() + flatIndices.size()/3);
+    for (unsigned int ii = 0; ii < flatIndices.size(); ii += 3)
+        parameters.push_back(ThreeBodyInfo(std::vector<int>(flatIndices.begin() + ii, flatIndices.begin() + ii + 3)));
+    return firstIndex;
+}
+
 int MBPolThreeBodyForce::getNumMolecules() const {
     return parameters.size();
 }
@@ -75,6 +86,22 @@ void MBPolThreeBodyForce::setNonbondedMethod(NonbondedMethod method) {
     nonbondedMethod = method;
 }
 
+void MBPolThreeBodyForce::setIncludeEnergyDecomposition(bool includeEnergyDecomposition) {
+    this->includeEnergyDecomposition = includeEnergyDecomposition;
+}
+
+bool MBPolThreeBodyForce::getIncludeEnergyDecomposition() const {
+    return includeEnergyDecomposition;
+}
+
+void MBPolThreeBodyForce::setUseMixedPrecision(bool useMixedPrecision) {
+    this->useMixedPrecision = useMixedPrecision;
+}
+
+bool MBPolThreeBodyForce::getUseMixedPrecision() const {
+    return useMixedPrecision;
+}
+
 ForceImpl* MBPolThreeBodyForce::createImpl() const {
     return new MBPolThreeBodyForceImpl(*this);
 }
@@ -82,3 +109,16 @@ ForceImpl* MBPolThreeBodyForce::createImpl() const {
 void MBPolThreeBodyForce::updateParametersInContext(Context& context) {
     dynamic_cast<MBPolThreeBodyForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+void MBPolThreeBodyForce::computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                                std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    dynamic_cast<MBPolThreeBodyForceImpl&>(getImplInContext(context)).computeCopies(getContextImpl(context), positions, forces, energies);
+}
+
+void MBPolThreeBodyForce::getVirial(Context& context, std::vector<Vec3>& virial) {
+    dynamic_cast<MBPolThreeBodyForceImpl&>(getImplInContext(context)).getVirial(getContextImpl(context), virial);
+}
+
+void MBPolThreeBodyForce::getMoleculeEnergies(Context& context, std::vector<double>& energies) {
+    dynamic_cast<MBPolThreeBodyForceImpl&>(getImplInContext(context)).getMoleculeEnergies(getContextImpl(context), energies);
+}
@@ -40,7 +40,9 @@ using namespace MBPolPlugin;
 using std::string;
 using std::vector;
 
-MBPolTwoBodyForce::MBPolTwoBodyForce() : nonbondedMethod(CutoffNonPeriodic), cutoff(1.0e+10) {
+MBPolTwoBodyForce::MBPolTwoBodyForce() : nonbondedMethod(CutoffNonPeriodic), cutoff(1.0e+10),
+                                         interactionGroup(AllInteractions), splitDistance(0.45), splitWidth(0.1),
+                                         includeEnergyDecomposition(false), useMixedPrecision(false) {
 }
 
 int MBPolTwoBodyForce::addParticle(const std::vector<int> & particleIndices ) {
@@ -48,6 +50,16 @@ int MBPolTwoBodyForce::addParticle(const std::vector<int> & particleIndices ) {
     return parameters.size()-1;
 }
 
+int MBPolTwoBodyForce::addParticles(const std::vector<int> & flatIndices ) {
+    if (flatIndices.size() % 3 != 0)
+        throw OpenMMException("MBPolTwoBodyForce::addParticles: the number of indices must be a multiple of 3");
+    int firstIndex = parameters.size();
+    parameters.reserve(parameters.size() + flatIndices.size()/3);
+    for (unsigned int ii = 0; ii < flatIndices.size(); ii += 3)
+        parameters.push_back(TwoBodyInfo(std::vector<int>(flatIndices.begin() + ii, flatIndices.begin() + ii + 3)));
+    return firstIndex;
+}
+
 int MBPolTwoBodyForce::getNumMolecules() const {
     return parameters.size();
 }
@@ -76,6 +88,50 @@ void MBPolTwoBodyForce::setNonbondedMethod(NonbondedMethod method) {
     nonbondedMethod = method;
 }
 
+void MBPolTwoBodyForce::setIncludeEnergyDecomposition(bool includeEnergyDecomposition) {
+    this->includeEnergyDecomposition = includeEnergyDecomposition;
+}
+
+bool MBPolTwoBodyForce::getIncludeEnergyDecomposition() const {
+    return includeEnergyDecomposition;
+}
+
+void MBPolTwoBodyForce::setUseMixedPrecision(bool useMixedPrecision) {
+    this->useMixedPrecision = useMixedPrecision;
+}
+
+bool MBPolTwoBodyForce::getUseMixedPrecision() const {
+    return useMixedPrecision;
+}
+
+string MBPolTwoBodyForce::getPolynomialInstructionSet() {
+    return MBPolTwoBodyForceImpl::getPolynomialInstructionSet();
+}
+
+MBPolTwoBodyForce::InteractionGroup MBPolTwoBodyForce::getInteractionGroup() const {
+    return interactionGroup;
+}
+
+void MBPolTwoBodyForce::setInteractionGroup(InteractionGroup group) {
+    interactionGroup = group;
+}
+
+double MBPolTwoBodyForce::getSplitDistance() const {
+    return splitDistance;
+}
+
+void MBPolTwoBodyForce::setSplitDistance(double distance) {
+    splitDistance = distance;
+}
+
+double MBPolTwoBodyForce::getSplitWidth() const {
+    return splitWidth;
+}
+
+void MBPolTwoBodyForce::setSplitWidth(double width) {
+    splitWidth = width;
+}
+
 ForceImpl* MBPolTwoBodyForce::createImpl() const {
     return new MBPolTwoBodyForceImpl(*this);
 }
@@ -83,3 +139,16 @@ ForceImpl* MBPolTwoBodyForce::createImpl() const {
 void MBPolTwoBodyForce::updateParametersInContext(Context& context) {
     dynamic_cast<MBPolTwoBodyForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+void MBPolTwoBodyForce::computeCopies(Context& context, const std::vector<std::vector<Vec3> >& positions,
+                                std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    dynamic_cast<MBPolTwoBodyForceImpl&>(getImplInContext(context)).computeCopies(getContextImpl(context), positions, forces, energies);
+}
+
+void MBPolTwoBodyForce::getVirial(Context& context, std::vector<Vec3>& virial) {
+    dynamic_cast<MBPolTwoBodyForceImpl&>(getImplInContext(context)).getVirial(getContextImpl(context), virial);
+}
+
+void MBPolTwoBodyForce::getMoleculeEnergies(Context& context, std::vector<double>& energies) {
+    dynamic_cast<MBPolTwoBodyForceImpl&>(getImplInContext(context)).getMoleculeEnergies(getContextImpl(context), energies);
+}
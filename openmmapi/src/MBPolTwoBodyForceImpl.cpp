@@ -70,8 +70,11 @@ void MBPolTwoBodyForceImpl::initialize(ContextImpl& context) {
 }
 
 double MBPolTwoBodyForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
-    if ((groups&(1<<owner.getForceGroup())) != 0)
-        return kernel.getAs<CalcMBPolTwoBodyForceKernel>().execute(context, includeForces, includeEnergy);
+    if ((groups&(1<<owner.getForceGroup())) != 0) {
+        CalcMBPolTwoBodyForceKernel& forceKernel = kernel.getAs<CalcMBPolTwoBodyForceKernel>();
+        forceKernel.beginEvaluation(context, includeForces, includeEnergy, groups);
+        return forceKernel.execute(context, includeForces, includeEnergy);
+    }
     return 0.0;
 }
 
@@ -84,3 +87,31 @@ std::vector<std::string> MBPolTwoBodyForceImpl::getKernelNames() {
 void MBPolTwoBodyForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcMBPolTwoBodyForceKernel>().copyParametersToContext(context, owner);
 }
+
+void MBPolTwoBodyForceImpl::computeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                                    std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolTwoBodyForceKernel>().executeCopies(context, positions, forces, energies);
+}
+
+void MBPolTwoBodyForceImpl::getVirial(ContextImpl& context, std::vector<Vec3>& virial) {
+    kernel.getAs<CalcMBPolTwoBodyForceKernel>().getVirial(context, virial);
+}
+
+void MBPolTwoBodyForceImpl::getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies) {
+    kernel.getAs<CalcMBPolTwoBodyForceKernel>().getMoleculeEnergies(context, energies);
+}
+
+// a function static, so it exists before the Reference plugin sets it at load time
+
+static std::string& polynomialInstructionSet() {
+    static std::string name;
+    return name;
+}
+
+void MBPolTwoBodyForceImpl::setPolynomialInstructionSet(const std::string& name) {
+    polynomialInstructionSet() = name;
+}
+
+const std::string& MBPolTwoBodyForceImpl::getPolynomialInstructionSet() {
+    return polynomialInstructionSet();
+}
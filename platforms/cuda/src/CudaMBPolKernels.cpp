@@ -463,6 +463,9 @@ static int findFFTDimension(int minimum) {
 
 void CudaCalcMBPolElectrostaticsForceKernel::initialize(const System& system,
 		const MBPolElectrostaticsForce& force) {
+	if (force.getNonbondedMethod() == MBPolElectrostaticsForce::Treecode)
+		throw OpenMMException(
+				"MBPolElectrostaticsForce: the Treecode method is only implemented on the Reference platform");
 	cu.setAsCurrent();
 
 	// Initialize multipole parameters.
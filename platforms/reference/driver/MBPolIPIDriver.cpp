@@ -0,0 +1,354 @@
+#include "MBPolIPIDriver.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <stdint.h>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace OpenMM;
+using namespace std;
+
+namespace MBPolPlugin {
+
+// i-PI sends and expects atomic units
+
+static const double bohrInNm          = 0.052917721067;
+static const double hartreeInKJPerMol = 2625.499638;
+
+// every message starts with a 12 character header, padded with blanks
+
+static const int headerLength = 12;
+
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+static void receiveBytes(int socket, void* data, size_t length) {
+    char* buffer = static_cast<char*>(data);
+    size_t done  = 0;
+    while( done < length ){
+        ssize_t count = recv(socket, buffer + done, length - done, 0);
+        if( count == 0 ){
+            throw OpenMMException("MBPolIPIDriver: the server closed the connection in the middle of a message");
+        }
+        if( count < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            throw OpenMMException(string("MBPolIPIDriver: receive failed: ") + strerror(errno));
+        }
+        done += count;
+    }
+}
+
+static void sendBytes(int socket, const void* data, size_t length) {
+    const char* buffer = static_cast<const char*>(data);
+    size_t done        = 0;
+    while( done < length ){
+        ssize_t count = ::send(socket, buffer + done, length - done, sendFlags);
+        if( count < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            throw OpenMMException(string("MBPolIPIDriver: send failed: ") + strerror(errno));
+        }
+        done += count;
+    }
+}
+
+// false if the server closed the connection between messages
+
+static bool receiveHeader(int socket, string& header) {
+    char buffer[headerLength];
+    ssize_t count;
+    do {
+        count = recv(socket, buffer, 1, 0);
+    } while( count < 0 && errno == EINTR );
+    if( count <= 0 ){
+        return false;
+    }
+    receiveBytes(socket, buffer + 1, headerLength - 1);
+    header.assign(buffer, headerLength);
+    header.erase(header.find_last_not_of(' ') + 1);
+    return true;
+}
+
+static void sendHeader(int socket, const string& header) {
+    string padded(header);
+    padded.resize(headerLength, ' ');
+    sendBytes(socket, padded.data(), headerLength);
+}
+
+MBPolIPIDriver::MBPolIPIDriver() : address("mbpol"), numConnections(1), usePeriodic(true), cutoffDistance(0.9),
+                  ewaldErrorTolerance(1.0e-4), mutualInducedTargetEpsilon(1.0e-7), inducedDipoleWarmStart(false),
+                  numEvaluations(0) {
+}
+
+MBPolIPIDriver::~MBPolIPIDriver() {
+    for( map<int, Bead*>::iterator bead = beads.begin(); bead != beads.end(); ++bead ){
+        delete bead->second->engine;
+        delete bead->second;
+    }
+}
+
+void MBPolIPIDriver::setAddress(const string& address) {
+    this->address = address;
+}
+
+const string& MBPolIPIDriver::getAddress() const {
+    return address;
+}
+
+string MBPolIPIDriver::getSocketPath(const string& address) {
+    if( !address.empty() && address[0] == '/' ){
+        return address;
+    }
+    return "/tmp/ipi_" + address;
+}
+
+void MBPolIPIDriver::setNumConnections(int numConnections) {
+    if( numConnections < 1 ){
+        throw OpenMMException("MBPolIPIDriver: the number of connections must be at least 1");
+    }
+    this->numConnections = numConnections;
+}
+
+int MBPolIPIDriver::getNumConnections() const {
+    return numConnections;
+}
+
+void MBPolIPIDriver::setUsePeriodic(bool usePeriodic) {
+    this->usePeriodic = usePeriodic;
+}
+
+bool MBPolIPIDriver::getUsePeriodic() const {
+    return usePeriodic;
+}
+
+void MBPolIPIDriver::setCutoffDistance(double distance) {
+    cutoffDistance = distance;
+}
+
+void MBPolIPIDriver::setEwaldErrorTolerance(double tolerance) {
+    ewaldErrorTolerance = tolerance;
+}
+
+void MBPolIPIDriver::setMutualInducedTargetEpsilon(double epsilon) {
+    mutualInducedTargetEpsilon = epsilon;
+}
+
+void MBPolIPIDriver::setInducedDipoleWarmStart(bool warmStart) {
+    inducedDipoleWarmStart = warmStart;
+}
+
+int MBPolIPIDriver::getNumEvaluations() const {
+    return numEvaluations;
+}
+
+int MBPolIPIDriver::openConnection() const {
+
+    string path = getSocketPath(address);
+    sockaddr_un socketAddress;
+    memset(&socketAddress, 0, sizeof(socketAddress));
+    socketAddress.sun_family = AF_UNIX;
+    if( path.size() >= sizeof(socketAddress.sun_path) ){
+        throw OpenMMException("MBPolIPIDriver: the socket path " + path + " is too long");
+    }
+    strcpy(socketAddress.sun_path, path.c_str());
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( connection < 0 ){
+        throw OpenMMException(string("MBPolIPIDriver: cannot create a socket: ") + strerror(errno));
+    }
+    if( ::connect(connection, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0 ){
+        string reason = strerror(errno);
+        close(connection);
+        throw OpenMMException("MBPolIPIDriver: cannot connect to " + path + ": " + reason);
+    }
+    return connection;
+}
+
+void MBPolIPIDriver::run() {
+
+    vector<int> connections;
+    try {
+        for( int ii = 0; ii < numConnections; ii++ ){
+            connections.push_back(openConnection());
+        }
+    } catch (...) {
+        for( unsigned int ii = 0; ii < connections.size(); ii++ ){
+            close(connections[ii]);
+        }
+        throw;
+    }
+
+    // one thread per connection; if one fails the others are shut down as well
+
+    exception_ptr error;
+    mutex errorLock;
+    vector<thread> threads;
+    for( int ii = 0; ii < numConnections; ii++ ){
+        threads.push_back(thread([&, ii]() {
+            try {
+                serve(connections[ii], ii);
+            } catch (...) {
+                lock_guard<mutex> guard(errorLock);
+                if( !error ){
+                    error = current_exception();
+                    for( unsigned int jj = 0; jj < connections.size(); jj++ ){
+                        shutdown(connections[jj], SHUT_RDWR);
+                    }
+                }
+            }
+        }));
+    }
+    for( unsigned int ii = 0; ii < threads.size(); ii++ ){
+        threads[ii].join();
+    }
+    for( unsigned int ii = 0; ii < connections.size(); ii++ ){
+        close(connections[ii]);
+    }
+    if( error ){
+        rethrow_exception(error);
+    }
+}
+
+void MBPolIPIDriver::serve(int socket, int connection) {
+
+    // until the server names the bead, its state is kept for the connection
+
+    int bead         = -1 - connection;
+    bool initialized = false;
+    bool haveData    = false;
+    int32_t numAtoms = 0;
+    double energy    = 0.0;
+    vector<double> cell(9);
+    vector<double> inverseCell(9);
+    vector<double> positions;
+    vector<double> forces;
+    vector<double> virial(9);
+
+    string header;
+    while( receiveHeader(socket, header) ){
+        if( header == "STATUS" ){
+            sendHeader(socket, haveData ? "HAVEDATA" : (initialized ? "READY" : "NEEDINIT"));
+        } else if( header == "INIT" ){
+            int32_t index;
+            int32_t length;
+            receiveBytes(socket, &index, sizeof(index));
+            receiveBytes(socket, &length, sizeof(length));
+            vector<char> parameters(std::max(length, 0));
+            if( length > 0 ){
+                receiveBytes(socket, &parameters[0], length);
+            }
+            bead        = index;
+            initialized = true;
+        } else if( header == "POSDATA" ){
+            receiveBytes(socket, &cell[0], 9*sizeof(double));
+            receiveBytes(socket, &inverseCell[0], 9*sizeof(double));
+            receiveBytes(socket, &numAtoms, sizeof(numAtoms));
+            if( numAtoms < 1 ){
+                throw OpenMMException("MBPolIPIDriver: the server sent no atoms");
+            }
+            positions.resize(3*numAtoms);
+            receiveBytes(socket, &positions[0], positions.size()*sizeof(double));
+            energy   = evaluate(bead, cell, positions, forces, virial);
+            haveData = true;
+        } else if( header == "GETFORCE" ){
+            if( !haveData ){
+                throw OpenMMException("MBPolIPIDriver: GETFORCE before POSDATA");
+            }
+            const char extra[] = "nothing";
+            int32_t extraLength = sizeof(extra) - 1;
+            sendHeader(socket, "FORCEREADY");
+            sendBytes(socket, &energy, sizeof(energy));
+            sendBytes(socket, &numAtoms, sizeof(numAtoms));
+            sendBytes(socket, &forces[0], forces.size()*sizeof(double));
+            sendBytes(socket, &virial[0], virial.size()*sizeof(double));
+            sendBytes(socket, &extraLength, sizeof(extraLength));
+            sendBytes(socket, extra, extraLength);
+
+            // the connection keeps its bead until the server sends another INIT
+
+            haveData = false;
+        } else if( header == "EXIT" ){
+            return;
+        } else {
+            throw OpenMMException("MBPolIPIDriver: unknown message " + header);
+        }
+    }
+}
+
+MBPolIPIDriver::Bead& MBPolIPIDriver::getBead(int bead) {
+    lock_guard<mutex> guard(beadsLock);
+    Bead*& entry = beads[bead];
+    if( entry == NULL ){
+        entry = new Bead();
+    }
+    return *entry;
+}
+
+double MBPolIPIDriver::evaluate(int bead, const vector<double>& cell, vector<double>& positions,
+                                vector<double>& forces, vector<double>& virial) {
+
+    int numAtoms = positions.size()/3;
+    if( numAtoms % 3 != 0 ){
+        throw OpenMMException("MBPolIPIDriver: the number of atoms must be a multiple of 3, ordered O, H, H for every water");
+    }
+
+    Bead& state = getBead(bead);
+    lock_guard<mutex> guard(state.lock);
+    if( state.engine == NULL || state.engine->getNumAtoms() != numAtoms ){
+        delete state.engine;
+        state.engine = NULL;
+        state.engine = new MBPolEngine(numAtoms/3);
+        state.engine->setCutoffDistance(cutoffDistance);
+        state.engine->setEwaldErrorTolerance(ewaldErrorTolerance);
+        state.engine->setMutualInducedTargetEpsilon(mutualInducedTargetEpsilon);
+        state.engine->setInducedDipoleWarmStart(inducedDipoleWarmStart);
+    }
+    MBPolEngine& engine = *state.engine;
+
+    // the rows of the cell are the cell vectors
+
+    if( usePeriodic ){
+        double largest = std::max(std::fabs(cell[0]), std::max(std::fabs(cell[4]), std::fabs(cell[8])));
+        for( int ii = 0; ii < 9; ii++ ){
+            if( ii % 4 != 0 && std::fabs(cell[ii]) > 1.0e-10*largest ){
+                throw OpenMMException("MBPolIPIDriver: only orthorhombic cells are supported");
+            }
+        }
+        engine.setBox(cell[0]*bohrInNm, cell[4]*bohrInNm, cell[8]*bohrInNm);
+    }
+
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        positions[ii] *= bohrInNm;
+    }
+    forces.resize(positions.size());
+    double engineVirial[9];
+    double energy = engine.compute(&positions[0], &forces[0], engineVirial);
+
+    for( unsigned int ii = 0; ii < forces.size(); ii++ ){
+        forces[ii] *= bohrInNm/hartreeInKJPerMol;
+    }
+
+    // sent column by column, as the reference driver of i-PI does
+
+    for( int a = 0; a < 3; a++ ){
+        for( int b = 0; b < 3; b++ ){
+            virial[3*a+b] = engineVirial[3*b+a]/hartreeInKJPerMol;
+        }
+    }
+    numEvaluations++;
+    return energy/hartreeInKJPerMol;
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,118 @@
+#ifndef OPENMM_MBPOL_IPI_DRIVER_H_
+#define OPENMM_MBPOL_IPI_DRIVER_H_
+
+#include "openmm/MBPolEngine.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Client of the i-PI socket protocol that evaluates MB-pol for the beads of a path
+ * integral run.
+ *
+ * The driver opens several connections to the i-PI server over a UNIX domain socket
+ * and serves each on its own thread, so i-PI can hand out one bead per connection and
+ * have them evaluated concurrently. The state of a bead, i.e. its MBPolEngine with the
+ * neighbor list and, with setInducedDipoleWarmStart(), the induced dipoles of the
+ * previous step, is kept by bead index
+ * (sent by i-PI with INIT) rather than by connection, so it is reused whichever
+ * connection the bead arrives on. A connection asks for INIT only once and then keeps
+ * its bead until the server sends another INIT.
+ *
+ * The atoms must be ordered O, H, H for every water. Periodic runs need an orthorhombic
+ * cell; in cluster mode the cell is ignored.
+ */
+class MBPolIPIDriver {
+public:
+
+    MBPolIPIDriver();
+
+    ~MBPolIPIDriver();
+
+    /**
+     * Set the address of the server: an absolute path is the socket file itself,
+     * any other name is the i-PI convention /tmp/ipi_<address>.
+     */
+    void setAddress(const std::string& address);
+
+    const std::string& getAddress() const;
+
+    /**
+     * Path of the UNIX domain socket for an address, see setAddress().
+     */
+    static std::string getSocketPath(const std::string& address);
+
+    /**
+     * Set the number of connections, i.e. of beads evaluated at the same time (default 1).
+     */
+    void setNumConnections(int numConnections);
+
+    int getNumConnections() const;
+
+    /**
+     * Set whether the cell sent by the server is used as a periodic box (default true).
+     */
+    void setUsePeriodic(bool usePeriodic);
+
+    bool getUsePeriodic() const;
+
+    /**
+     * Settings of the MBPolEngine of every bead, see MBPolEngine.
+     */
+    void setCutoffDistance(double distance);
+
+    void setEwaldErrorTolerance(double tolerance);
+
+    void setMutualInducedTargetEpsilon(double epsilon);
+
+    void setInducedDipoleWarmStart(bool warmStart);
+
+    /**
+     * Connect to the server and answer its requests until it sends EXIT or closes the
+     * connections. Throws an OpenMMException if a connection fails or the server sends
+     * an unknown message.
+     */
+    void run();
+
+    /**
+     * Number of force evaluations served so far, over all connections.
+     */
+    int getNumEvaluations() const;
+
+private:
+
+    // state of one bead; the engine is used by one connection at a time
+
+    struct Bead {
+        Bead() : engine(NULL) {
+        }
+        MBPolEngine* engine;
+        std::mutex lock;
+    };
+
+    int openConnection() const;
+    void serve(int socket, int connection);
+    double evaluate(int bead, const std::vector<double>& cell, std::vector<double>& positions,
+                    std::vector<double>& forces, std::vector<double>& virial);
+    Bead& getBead(int bead);
+
+    std::string address;
+    int numConnections;
+    bool usePeriodic;
+    double cutoffDistance;
+    double ewaldErrorTolerance;
+    double mutualInducedTargetEpsilon;
+    bool inducedDipoleWarmStart;
+
+    std::map<int, Bead*> beads;
+    std::mutex beadsLock;
+    std::atomic<int> numEvaluations;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_MBPOL_IPI_DRIVER_H_
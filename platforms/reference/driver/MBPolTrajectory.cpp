@@ -0,0 +1,262 @@
+#include "MBPolTrajectory.h"
+#include "openmm/OpenMMException.h"
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace OpenMM;
+using namespace std;
+
+namespace MBPolPlugin {
+
+static const double angstromInNm = 0.1;
+
+static bool endsWith(const string& text, const string& suffix) {
+    if( text.size() < suffix.size() ){
+        return false;
+    }
+    for( unsigned int ii = 0; ii < suffix.size(); ii++ ){
+        if( tolower(text[text.size() - suffix.size() + ii]) != suffix[ii] ){
+            return false;
+        }
+    }
+    return true;
+}
+
+MBPolTrajectory::MBPolTrajectory(const string& path) : path(path), data(NULL), size(0), numAtoms(0), numFrames(0),
+                                                        unitCell(false), firstFrameOffset(0), frameSize(0) {
+
+    if( endsWith(path, ".dcd") ){
+        isDCD = true;
+    } else if( endsWith(path, ".xyz") ){
+        isDCD = false;
+    } else {
+        throw OpenMMException("MBPolTrajectory: unknown format of " + path + ", expected .dcd or .xyz");
+    }
+
+    int file = open(path.c_str(), O_RDONLY);
+    if( file < 0 ){
+        throw OpenMMException("MBPolTrajectory: cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat status;
+    if( fstat(file, &status) != 0 || status.st_size == 0 ){
+        close(file);
+        throw OpenMMException("MBPolTrajectory: " + path + " is empty or cannot be read");
+    }
+    size = status.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if( mapping == MAP_FAILED ){
+        throw OpenMMException("MBPolTrajectory: cannot map " + path + ": " + strerror(errno));
+    }
+    data = static_cast<const char*>(mapping);
+
+    try {
+        if( isDCD ){
+            indexDCD();
+        } else {
+            indexXYZ();
+        }
+    } catch (...) {
+        munmap(const_cast<char*>(data), size);
+        throw;
+    }
+}
+
+MBPolTrajectory::~MBPolTrajectory() {
+    munmap(const_cast<char*>(data), size);
+}
+
+int MBPolTrajectory::getNumFrames() const {
+    return numFrames;
+}
+
+int MBPolTrajectory::getNumAtoms() const {
+    return numAtoms;
+}
+
+bool MBPolTrajectory::hasBox() const {
+    return unitCell;
+}
+
+// a Fortran record: a length, the data and the length again
+
+static size_t readRecord(const char* data, size_t size, size_t offset, size_t& length, const string& path) {
+    int32_t head, tail;
+    if( offset + sizeof(head) > size ){
+        throw OpenMMException("MBPolTrajectory: " + path + " is truncated");
+    }
+    memcpy(&head, data + offset, sizeof(head));
+    if( head < 0 || offset + 2*sizeof(head) + head > size ){
+        throw OpenMMException("MBPolTrajectory: " + path + " is not a DCD file in the byte order of this machine, or is truncated");
+    }
+    memcpy(&tail, data + offset + sizeof(head) + head, sizeof(tail));
+    if( tail != head ){
+        throw OpenMMException("MBPolTrajectory: " + path + " is not a DCD file in the byte order of this machine");
+    }
+    length = head;
+    return offset + sizeof(head);
+}
+
+void MBPolTrajectory::indexDCD() {
+
+    // header: "CORD" and 20 control integers, the titles and the number of atoms
+
+    size_t length;
+    size_t offset = readRecord(data, size, 0, length, path);
+    if( length != 84 || memcmp(data + offset, "CORD", 4) != 0 ){
+        throw OpenMMException("MBPolTrajectory: " + path + " is not a DCD file in the byte order of this machine");
+    }
+    int32_t control[20];
+    memcpy(control, data + offset + 4, sizeof(control));
+    if( control[8] != 0 ){
+        throw OpenMMException("MBPolTrajectory: DCD files with fixed atoms are not supported");
+    }
+    if( control[11] != 0 ){
+        throw OpenMMException("MBPolTrajectory: four-dimensional DCD files are not supported");
+    }
+    unitCell = (control[10] != 0);
+    offset  += length + 4;
+    offset   = readRecord(data, size, offset, length, path);
+    offset  += length + 4;
+    offset   = readRecord(data, size, offset, length, path);
+    int32_t atoms;
+    if( length != 4 ){
+        throw OpenMMException("MBPolTrajectory: " + path + " has no number of atoms");
+    }
+    memcpy(&atoms, data + offset, 4);
+    if( atoms < 1 ){
+        throw OpenMMException("MBPolTrajectory: " + path + " has no atoms");
+    }
+    numAtoms         = atoms;
+    firstFrameOffset = offset + length + 4;
+
+    // the count in the header is not updated by every writer; the frames are counted from the size
+
+    frameSize = 3*(numAtoms*sizeof(float) + 8) + (unitCell ? 6*sizeof(double) + 8 : 0);
+    numFrames = (size - firstFrameOffset)/frameSize;
+    if( numFrames > 0 ){
+        size_t check = firstFrameOffset + (unitCell ? 6*sizeof(double) + 8 : 0);
+        readRecord(data, size, check, length, path);
+        if( length != numAtoms*sizeof(float) ){
+            throw OpenMMException("MBPolTrajectory: the frames of " + path + " do not match its number of atoms");
+        }
+    }
+}
+
+void MBPolTrajectory::indexXYZ() {
+
+    // every frame is a count line, a comment line and one line per atom
+
+    const char* end    = data + size;
+    const char* cursor = data;
+    while( cursor < end ){
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        if( lineEnd == NULL ){
+            lineEnd = end;
+        }
+        string countLine(cursor, lineEnd);
+        if( countLine.find_first_not_of(" \t\r") == string::npos ){
+            cursor = lineEnd + 1;
+            continue;
+        }
+        char* parsed;
+        long count = strtol(countLine.c_str(), &parsed, 10);
+        if( count < 1 || parsed == countLine.c_str() ){
+            throw OpenMMException("MBPolTrajectory: expected the number of atoms of frame " + to_string(numFrames) + " of " + path);
+        }
+        if( numFrames == 0 ){
+            numAtoms = count;
+        } else if( count != numAtoms ){
+            throw OpenMMException("MBPolTrajectory: frame " + to_string(numFrames) + " of " + path + " has a different number of atoms");
+        }
+        frameOffsets.push_back(cursor - data);
+        cursor = lineEnd + 1;
+        for( long line = 0; line < count + 1; line++ ){
+            if( cursor >= end ){
+                throw OpenMMException("MBPolTrajectory: the last frame of " + path + " is truncated");
+            }
+            lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+            cursor  = (lineEnd == NULL ? end : lineEnd + 1);
+        }
+        numFrames++;
+    }
+}
+
+void MBPolTrajectory::readFrame(int frame, double* positions, double* box) const {
+
+    if( frame < 0 || frame >= numFrames ){
+        throw OpenMMException("MBPolTrajectory: frame " + to_string(frame) + " is out of range");
+    }
+    box[0] = box[1] = box[2] = 0.0;
+
+    if( isDCD ){
+        const char* cursor = data + firstFrameOffset + frame*frameSize;
+        if( unitCell ){
+
+            // a, gamma, b, beta, alpha, c; the angles are in degrees (OpenMM, NAMD) or their
+            // cosines (CHARMM), and only orthorhombic cells are supported
+
+            double cell[6];
+            memcpy(cell, cursor + 4, sizeof(cell));
+            const int angles[3] = { 1, 3, 4 };
+            for( int ii = 0; ii < 3; ii++ ){
+                double angle = cell[angles[ii]];
+                if( fabs(angle - 90.0) > 1.0e-4 && fabs(angle) > 1.0e-6 ){
+                    throw OpenMMException("MBPolTrajectory: frame " + to_string(frame) + " of " + path +
+                                          " has a triclinic unit cell; only orthorhombic cells are supported");
+                }
+            }
+            box[0]  = cell[0]*angstromInNm;
+            box[1]  = cell[2]*angstromInNm;
+            box[2]  = cell[5]*angstromInNm;
+            cursor += sizeof(cell) + 8;
+        }
+        vector<float> coordinates(numAtoms);
+        for( int d = 0; d < 3; d++ ){
+            memcpy(&coordinates[0], cursor + 4, numAtoms*sizeof(float));
+            for( int ii = 0; ii < numAtoms; ii++ ){
+                positions[3*ii+d] = coordinates[ii]*angstromInNm;
+            }
+            cursor += numAtoms*sizeof(float) + 8;
+        }
+        return;
+    }
+
+    const char* end    = data + size;
+    const char* cursor = data + frameOffsets[frame];
+    for( int line = 0; line < 2; line++ ){
+        cursor = static_cast<const char*>(memchr(cursor, '\n', end - cursor)) + 1;
+    }
+    for( int ii = 0; ii < numAtoms; ii++ ){
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        if( lineEnd == NULL ){
+            lineEnd = end;
+        }
+
+        // the mapping is not NUL terminated, so every line is parsed from a copy
+
+        string line(cursor, lineEnd);
+        const char* field = line.c_str();
+        field += strspn(field, " \t");
+        field += strcspn(field, " \t");
+        for( int d = 0; d < 3; d++ ){
+            char* parsed;
+            positions[3*ii+d] = strtod(field, &parsed)*angstromInNm;
+            if( parsed == field ){
+                throw OpenMMException("MBPolTrajectory: cannot read atom " + to_string(ii) + " of frame " + to_string(frame) + " of " + path);
+            }
+            field = parsed;
+        }
+        cursor = lineEnd + 1;
+    }
+}
+
+} // namespace MBPolPlugin
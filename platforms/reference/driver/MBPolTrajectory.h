@@ -0,0 +1,74 @@
+#ifndef OPENMM_MBPOL_TRAJECTORY_H_
+#define OPENMM_MBPOL_TRAJECTORY_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Read-only view of a trajectory file, memory-mapped so that frames are read from the
+ * page cache on demand rather than loaded up front.
+ *
+ * Two formats are recognized by the file extension: .dcd (CHARMM/NAMD/OpenMM, native
+ * byte order, with or without unit cell) and .xyz (a count line, a comment line and one
+ * "element x y z" line per atom for every frame). Both store Angstroms; readFrame()
+ * returns nm. Opening indexes the frames, so readFrame() can be called for any frame
+ * from several threads at once.
+ */
+class MBPolTrajectory {
+public:
+
+    /**
+     * Map and index a trajectory. Throws an OpenMMException if the file cannot be read,
+     * the format is unknown or the frames do not all have the same number of atoms.
+     */
+    explicit MBPolTrajectory(const std::string& path);
+
+    ~MBPolTrajectory();
+
+    int getNumFrames() const;
+
+    int getNumAtoms() const;
+
+    /**
+     * Whether the frames carry a unit cell (DCD files written with periodic boundaries).
+     */
+    bool hasBox() const;
+
+    /**
+     * Copy the coordinates of a frame, 3 per atom, in nm, and its box edges in nm (zero if
+     * the file has no unit cell). Throws an OpenMMException if an angle of the unit cell
+     * is not 90 degrees.
+     */
+    void readFrame(int frame, double* positions, double* box) const;
+
+private:
+
+    void indexDCD();
+    void indexXYZ();
+
+    // not copyable: owns the mapping
+
+    MBPolTrajectory(const MBPolTrajectory&);
+    MBPolTrajectory& operator=(const MBPolTrajectory&);
+
+    std::string path;
+    bool isDCD;
+    const char* data;
+    size_t size;
+    int numAtoms;
+    int numFrames;
+    bool unitCell;
+
+    // DCD frames have a fixed size; XYZ frames are found by scanning the lines
+
+    size_t firstFrameOffset;
+    size_t frameSize;
+    std::vector<size_t> frameOffsets;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_MBPOL_TRAJECTORY_H_
@@ -0,0 +1,222 @@
+#include "MBPolTrajectoryRescorer.h"
+#include "MBPolTrajectory.h"
+#include "ReferenceMBPolParallel.h"
+#include "openmm/MBPolEngine.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace OpenMM;
+using namespace std;
+
+namespace MBPolPlugin {
+
+// frames per block: enough for the neighbor list and the warm starts to pay off, few enough to
+// balance the threads
+
+static const int maxBlockSize = 256;
+
+static const int columnNameLength = 32;
+
+static void writeAt(int file, const void* data, size_t length, off_t offset, const string& path) {
+    const char* buffer = static_cast<const char*>(data);
+    while( length > 0 ){
+        ssize_t count = pwrite(file, buffer, length, offset);
+        if( count < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            throw OpenMMException("MBPolTrajectoryRescorer: cannot write " + path + ": " + strerror(errno));
+        }
+        buffer += count;
+        offset += count;
+        length -= count;
+    }
+}
+
+MBPolTrajectoryRescorer::MBPolTrajectoryRescorer() : sitesPerWater(3),
+                  usePeriodic(true), cutoffDistance(0.9), ewaldErrorTolerance(1.0e-4), mutualInducedTargetEpsilon(1.0e-7),
+                  inducedDipoleWarmStart(false), includeVirial(false), includeTermEnergies(false), numWarmStarts(0) {
+    box[0] = box[1] = box[2] = 0.0;
+}
+
+void MBPolTrajectoryRescorer::setSitesPerWater(int sitesPerWater) {
+    if( sitesPerWater < 3 ){
+        throw OpenMMException("MBPolTrajectoryRescorer: a water has at least 3 sites, O, H, H");
+    }
+    this->sitesPerWater = sitesPerWater;
+}
+
+int MBPolTrajectoryRescorer::getSitesPerWater() const {
+    return sitesPerWater;
+}
+
+void MBPolTrajectoryRescorer::setBox(double x, double y, double z) {
+    box[0] = x;
+    box[1] = y;
+    box[2] = z;
+}
+
+void MBPolTrajectoryRescorer::setUsePeriodic(bool usePeriodic) {
+    this->usePeriodic = usePeriodic;
+}
+
+void MBPolTrajectoryRescorer::setCutoffDistance(double distance) {
+    cutoffDistance = distance;
+}
+
+void MBPolTrajectoryRescorer::setEwaldErrorTolerance(double tolerance) {
+    ewaldErrorTolerance = tolerance;
+}
+
+void MBPolTrajectoryRescorer::setMutualInducedTargetEpsilon(double epsilon) {
+    mutualInducedTargetEpsilon = epsilon;
+}
+
+void MBPolTrajectoryRescorer::setInducedDipoleWarmStart(bool warmStart) {
+    inducedDipoleWarmStart = warmStart;
+}
+
+void MBPolTrajectoryRescorer::setIncludeVirial(bool includeVirial) {
+    this->includeVirial = includeVirial;
+}
+
+void MBPolTrajectoryRescorer::setIncludeTermEnergies(bool includeTermEnergies) {
+    this->includeTermEnergies = includeTermEnergies;
+}
+
+vector<string> MBPolTrajectoryRescorer::getColumnNames() const {
+    vector<string> names(1, "energy");
+    if( includeTermEnergies ){
+        const char* terms[MBPolEngine::NumTerms] = { "1b", "2b", "3b", "electrostatics", "dispersion" };
+        for( int term = 0; term < MBPolEngine::NumTerms; term++ ){
+            names.push_back(string("energy_") + terms[term]);
+        }
+    }
+    if( includeVirial ){
+        const char* axes = "xyz";
+        for( int a = 0; a < 3; a++ ){
+            for( int b = 0; b < 3; b++ ){
+                names.push_back(string("virial_") + axes[a] + axes[b]);
+            }
+        }
+    }
+    return names;
+}
+
+int MBPolTrajectoryRescorer::getNumInducedDipoleWarmStarts() const {
+    return numWarmStarts;
+}
+
+int MBPolTrajectoryRescorer::rescore(const string& trajectoryPath, const string& output) {
+
+    MBPolTrajectory trajectory(trajectoryPath);
+    const int numFrames = trajectory.getNumFrames();
+    const int numAtoms  = trajectory.getNumAtoms();
+    if( numAtoms % sitesPerWater != 0 ){
+        throw OpenMMException("MBPolTrajectoryRescorer: the number of atoms of " + trajectoryPath +
+                              " is not a multiple of the sites per water");
+    }
+    const int numWaters = numAtoms/sitesPerWater;
+    const bool fixedBox = (box[0] > 0.0 || box[1] > 0.0 || box[2] > 0.0);
+
+    // header; the columns follow, numFrames values each
+
+    vector<string> names = getColumnNames();
+    const int numColumns = names.size();
+    const int virialColumn = 1 + (includeTermEnergies ? (int) MBPolEngine::NumTerms : 0);
+    vector<char> header(8 + 2*sizeof(int32_t) + sizeof(int64_t) + numColumns*columnNameLength, '\0');
+    int32_t counts[2] = { numColumns, 0 };
+    int64_t frames    = numFrames;
+    memcpy(&header[0], "MBPOLCOL", 8);
+    memcpy(&header[8], counts, sizeof(counts));
+    memcpy(&header[8 + sizeof(counts)], &frames, sizeof(frames));
+    for( int column = 0; column < numColumns; column++ ){
+        strncpy(&header[8 + sizeof(counts) + sizeof(frames) + column*columnNameLength], names[column].c_str(), columnNameLength - 1);
+    }
+
+    int file = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if( file < 0 ){
+        throw OpenMMException("MBPolTrajectoryRescorer: cannot create " + output + ": " + strerror(errno));
+    }
+    try {
+        writeAt(file, &header[0], header.size(), 0, output);
+        off_t dataOffset = header.size();
+        if( ftruncate(file, dataOffset + (off_t) numColumns*numFrames*sizeof(double)) != 0 ){
+            throw OpenMMException("MBPolTrajectoryRescorer: cannot size " + output + ": " + strerror(errno));
+        }
+
+        // blocks of consecutive frames, at least a few per thread
+
+        const int numThreads = ReferenceMBPolParallel::getNumThreads();
+        const int blockSize = std::max(1, std::min(maxBlockSize, numFrames/(4*numThreads)));
+        const int numBlocks = (numFrames + blockSize - 1)/blockSize;
+        atomic<int> nextBlock(0);
+        atomic<int> warmStarts(0);
+
+        // one engine per thread, the threads share the blocks; the parallelFor() inside
+        // the engine runs on the thread of its worker
+
+        ReferenceMBPolParallel::parallelFor(std::min(numThreads, std::max(numBlocks, 1)), [&](int worker) {
+            MBPolEngine engine(numWaters);
+            engine.setCutoffDistance(cutoffDistance);
+            engine.setEwaldErrorTolerance(ewaldErrorTolerance);
+            engine.setMutualInducedTargetEpsilon(mutualInducedTargetEpsilon);
+            engine.setInducedDipoleWarmStart(inducedDipoleWarmStart);
+            if( usePeriodic && !trajectory.hasBox() && fixedBox ){
+                engine.setBox(box[0], box[1], box[2]);
+            }
+            vector<double> frame(3*numAtoms);
+            vector<double> positions(9*numWaters);
+            vector<double> columns(numColumns*blockSize);
+            double frameBox[3];
+            double virial[9];
+            for( int block = nextBlock++; block < numBlocks; block = nextBlock++ ){
+                int first = block*blockSize;
+                int count = std::min(blockSize, numFrames - first);
+                for( int ii = 0; ii < count; ii++ ){
+                    trajectory.readFrame(first + ii, &frame[0], frameBox);
+                    for( int m = 0; m < numWaters; m++ ){
+                        std::copy(frame.begin() + 3*sitesPerWater*m, frame.begin() + 3*sitesPerWater*m + 9, positions.begin() + 9*m);
+                    }
+                    if( usePeriodic && trajectory.hasBox() ){
+                        engine.setBox(frameBox[0], frameBox[1], frameBox[2]);
+                    }
+                    columns[ii] = engine.compute(&positions[0], NULL, includeVirial ? virial : NULL);
+                    if( includeTermEnergies ){
+                        for( int term = 0; term < MBPolEngine::NumTerms; term++ ){
+                            columns[(1 + term)*blockSize + ii] = engine.getTermEnergy((MBPolEngine::Term) term);
+                        }
+                    }
+                    if( includeVirial ){
+                        for( int component = 0; component < 9; component++ ){
+                            columns[(virialColumn + component)*blockSize + ii] = virial[component];
+                        }
+                    }
+                }
+                for( int column = 0; column < numColumns; column++ ){
+                    writeAt(file, &columns[column*blockSize], count*sizeof(double),
+                            dataOffset + ((off_t) column*numFrames + first)*sizeof(double), output);
+                }
+            }
+            warmStarts += engine.getNumInducedDipoleWarmStarts();
+        });
+        numWarmStarts = warmStarts;
+    } catch (...) {
+        close(file);
+        throw;
+    }
+    if( close(file) != 0 ){
+        throw OpenMMException("MBPolTrajectoryRescorer: cannot write " + output + ": " + strerror(errno));
+    }
+    return numFrames;
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,117 @@
+#ifndef OPENMM_MBPOL_TRAJECTORY_RESCORER_H_
+#define OPENMM_MBPOL_TRAJECTORY_RESCORER_H_
+
+#include <string>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Evaluates MB-pol for every frame of a trajectory and writes the results to a columnar
+ * binary file.
+ *
+ * The trajectory is memory-mapped (see MBPolTrajectory) and cut into blocks of
+ * consecutive frames, which are handed out to ReferenceMBPolParallel::getNumThreads()
+ * threads as they become free. Every
+ * thread keeps one MBPolEngine for all its blocks, so the neighbor list of one frame is
+ * the starting point for the next, and with setInducedDipoleWarmStart() the induced
+ * dipoles as well. The results of a block are
+ * written to their place in the output file as soon as it is done, so memory use does not
+ * grow with the length of the trajectory.
+ *
+ * The output file starts with the 8 characters "MBPOLCOL", the number of columns and
+ * a reserved value (int32 each), the number of frames (int64) and the column names
+ * (32 characters each, NUL padded). Then come the columns one after the other, one
+ * float64 per frame: "energy" (kJ/mol); the energies of the terms (MBPolEngine::Term),
+ * "energy_1b", "energy_2b", "energy_3b", "energy_electrostatics" and "energy_dispersion"
+ * (kJ/mol), if setIncludeTermEnergies() is set; and the nine components of the virial,
+ * "virial_xx" ... "virial_zz" (kJ/mol), if setIncludeVirial() is set.
+ */
+class MBPolTrajectoryRescorer {
+public:
+
+    MBPolTrajectoryRescorer();
+
+    /**
+     * Set the number of atoms stored per water, e.g. 4 for trajectories of an OpenMM
+     * simulation that include the M site. The first three must be O, H, H; the others are
+     * skipped. The default is 3.
+     */
+    void setSitesPerWater(int sitesPerWater);
+
+    int getSitesPerWater() const;
+
+    /**
+     * Set the box edges (nm) for trajectories without unit cell; all zero (the default)
+     * treats them as clusters. The unit cell of a DCD file takes precedence.
+     */
+    void setBox(double x, double y, double z);
+
+    /**
+     * Set whether the unit cell of the trajectory is used (default true); false treats
+     * every frame as a cluster.
+     */
+    void setUsePeriodic(bool usePeriodic);
+
+    /**
+     * Settings of the MBPolEngine of every thread, see MBPolEngine.
+     */
+    void setCutoffDistance(double distance);
+
+    void setEwaldErrorTolerance(double tolerance);
+
+    void setMutualInducedTargetEpsilon(double epsilon);
+
+    /**
+     * Set whether the induced dipoles of a frame start from those of the previous frame
+     * of the same thread (default false). This saves iterations, but the last digits of
+     * the results then depend on how the frames were split over the threads.
+     */
+    void setInducedDipoleWarmStart(bool warmStart);
+
+    /**
+     * Set whether the virial columns are written (default false).
+     */
+    void setIncludeVirial(bool includeVirial);
+
+    /**
+     * Set whether a column is written for the energy of every term (default false).
+     */
+    void setIncludeTermEnergies(bool includeTermEnergies);
+
+    /**
+     * Names of the columns written with the current settings.
+     */
+    std::vector<std::string> getColumnNames() const;
+
+    /**
+     * Evaluate every frame of trajectory and write the columns to output. Throws an
+     * OpenMMException if a file cannot be read or written or a frame cannot be evaluated.
+     *
+     * @return the number of frames
+     */
+    int rescore(const std::string& trajectory, const std::string& output);
+
+    /**
+     * Number of frames of the last rescore() whose induced dipoles were started from
+     * those of the previous frame.
+     */
+    int getNumInducedDipoleWarmStarts() const;
+
+private:
+
+    int sitesPerWater;
+    double box[3];
+    bool usePeriodic;
+    double cutoffDistance;
+    double ewaldErrorTolerance;
+    double mutualInducedTargetEpsilon;
+    bool inducedDipoleWarmStart;
+    bool includeVirial;
+    bool includeTermEnergies;
+    int numWarmStarts;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_MBPOL_TRAJECTORY_RESCORER_H_
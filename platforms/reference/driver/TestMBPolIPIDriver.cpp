@@ -0,0 +1,282 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests MBPolIPIDriver against an i-PI server played by the test over a UNIX domain
+ * socket: two beads on two connections, swapped between the steps, must get the energy,
+ * forces and virial of MBPolEngine in atomic units.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Vec3.h"
+#include "MBPolIPIDriver.h"
+#include "MBPolTestWaters.h"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const double bohrInNm          = 0.052917721067;
+const double hartreeInKJPerMol = 2625.499638;
+const int    numberOfWaters    = 3;
+const int    numberOfBeads     = 2;
+
+// O, H, H of a small cluster, a little different for every bead and step (nm)
+
+std::vector<double> buildCluster( int bead, int step ) {
+
+    std::vector<double> positions( 9*numberOfWaters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        double shift = 0.004*bead + 0.001*step;
+        Vec3 oxygen( 0.28*m + shift, 0.05*std::sin( 1.7*m ) - shift, 0.05*std::cos( 2.3*m ) );
+        Vec3 atoms[3];
+        getWaterAtoms( oxygen, 0.8*m + 0.1*bead, 0.5*m, 1.0, atoms );
+        for( int s = 0; s < 3; s++ ){
+            for( int d = 0; d < 3; d++ ){
+                positions[9*m+3*s+d] = atoms[s][d];
+            }
+        }
+    }
+    return positions;
+}
+
+void sendBytes( int socket, const void* data, size_t length ) {
+    ASSERT( send( socket, data, length, 0 ) == (ssize_t) length );
+}
+
+void receiveBytes( int socket, void* data, size_t length ) {
+    char* buffer = static_cast<char*>( data );
+    size_t done  = 0;
+    while( done < length ){
+        ssize_t count = recv( socket, buffer + done, length - done, 0 );
+        ASSERT( count > 0 );
+        done += count;
+    }
+}
+
+void sendHeader( int socket, const std::string& header ) {
+    std::string padded( header );
+    padded.resize( 12, ' ' );
+    sendBytes( socket, padded.data(), 12 );
+}
+
+void expectHeader( int socket, const std::string& expected ) {
+    char buffer[12];
+    receiveBytes( socket, buffer, 12 );
+    std::string header( buffer, 12 );
+    header.erase( header.find_last_not_of( ' ' ) + 1 );
+    if( header != expected ){
+        throw OpenMMException( "expected " + expected + " from the driver, got " + header );
+    }
+}
+
+// the driver asks for INIT until it gets one and then stays ready; the server sends
+// INIT again only to hand the connection another bead (bead < 0 keeps the current one)
+
+void sendPositions( int socket, int bead, bool initialized, const std::vector<double>& positions ) {
+
+    sendHeader( socket, "STATUS" );
+    expectHeader( socket, initialized ? "READY" : "NEEDINIT" );
+    if( bead >= 0 ){
+        sendHeader( socket, "INIT" );
+        int32_t index  = bead;
+        int32_t length = 1;
+        sendBytes( socket, &index, sizeof(index) );
+        sendBytes( socket, &length, sizeof(length) );
+        sendBytes( socket, " ", 1 );
+        sendHeader( socket, "STATUS" );
+        expectHeader( socket, "READY" );
+    }
+
+    // a cluster: the cell is ignored by the driver
+
+    std::vector<double> cell( 18, 0.0 );
+    for( int d = 0; d < 3; d++ ){
+        cell[4*d]   = 100.0;
+        cell[9+4*d] = 0.01;
+    }
+    std::vector<double> atomicPositions( positions );
+    for( unsigned int ii = 0; ii < atomicPositions.size(); ii++ ){
+        atomicPositions[ii] /= bohrInNm;
+    }
+    int32_t numAtoms = atomicPositions.size()/3;
+    sendHeader( socket, "POSDATA" );
+    sendBytes( socket, &cell[0], 18*sizeof(double) );
+    sendBytes( socket, &numAtoms, sizeof(numAtoms) );
+    sendBytes( socket, &atomicPositions[0], atomicPositions.size()*sizeof(double) );
+}
+
+double getForces( int socket, std::vector<double>& forces, std::vector<double>& virial ) {
+
+    sendHeader( socket, "STATUS" );
+    expectHeader( socket, "HAVEDATA" );
+    sendHeader( socket, "GETFORCE" );
+    expectHeader( socket, "FORCEREADY" );
+    double energy;
+    int32_t numAtoms;
+    receiveBytes( socket, &energy, sizeof(energy) );
+    receiveBytes( socket, &numAtoms, sizeof(numAtoms) );
+    forces.resize( 3*numAtoms );
+    virial.resize( 9 );
+    receiveBytes( socket, &forces[0], forces.size()*sizeof(double) );
+    receiveBytes( socket, &virial[0], 9*sizeof(double) );
+    int32_t length;
+    receiveBytes( socket, &length, sizeof(length) );
+    std::vector<char> extra( length );
+    if( length > 0 ){
+        receiveBytes( socket, &extra[0], length );
+    }
+    return energy;
+}
+
+void testTwoBeads( ) {
+
+    std::stringstream path;
+    path << "/tmp/mbpol_ipi_test_" << getpid();
+    unlink( path.str().c_str() );
+
+    int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    ASSERT( listener >= 0 );
+    sockaddr_un address;
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    strcpy( address.sun_path, path.str().c_str() );
+    ASSERT( bind( listener, reinterpret_cast<sockaddr*>(&address), sizeof(address) ) == 0 );
+    ASSERT( listen( listener, numberOfBeads ) == 0 );
+
+    MBPolIPIDriver driver;
+    driver.setAddress( path.str() );
+    driver.setNumConnections( numberOfBeads );
+    driver.setUsePeriodic( false );
+    driver.setMutualInducedTargetEpsilon( 1.0e-10 );
+    std::exception_ptr driverError;
+    std::thread client( [&]() {
+        try {
+            driver.run();
+        } catch (...) {
+            driverError = std::current_exception();
+        }
+    } );
+
+    std::vector<int> connections( numberOfBeads );
+    for( int c = 0; c < numberOfBeads; c++ ){
+        connections[c] = accept( listener, NULL, NULL );
+        ASSERT( connections[c] >= 0 );
+    }
+
+    // every connection gets its positions before any result is collected, so the beads
+    // are evaluated at the same time; the beads change connection with the INIT of the
+    // second step and stay there for the third, which sends no INIT
+
+    const int numberOfSteps = 3;
+    for( int step = 0; step < numberOfSteps; step++ ){
+        for( int c = 0; c < numberOfBeads; c++ ){
+            int bead = (c + std::min( step, 1 )) % numberOfBeads;
+            sendPositions( connections[c], step < 2 ? bead : -1, step > 0, buildCluster( bead, step ) );
+        }
+        for( int c = 0; c < numberOfBeads; c++ ){
+            int bead = (c + std::min( step, 1 )) % numberOfBeads;
+            std::vector<double> forces;
+            std::vector<double> virial;
+            double energy = getForces( connections[c], forces, virial );
+
+            std::vector<double> positions = buildCluster( bead, step );
+            MBPolEngine engine( numberOfWaters );
+            engine.setMutualInducedTargetEpsilon( 1.0e-10 );
+            std::vector<double> expectedForces( positions.size() );
+            std::vector<double> expectedVirial( 9 );
+            double expectedEnergy = engine.compute( &positions[0], &expectedForces[0], &expectedVirial[0] );
+
+            std::cout << "testTwoBeads: step " << step << " bead " << bead << " energy " << energy << " Hartree" << std::endl;
+            ASSERT_EQUAL_TOL( expectedEnergy/hartreeInKJPerMol, energy, 1.0e-7 );
+            ASSERT_EQUAL( (int) expectedForces.size(), (int) forces.size() );
+            for( unsigned int ii = 0; ii < forces.size(); ii += 3 ){
+                Vec3 expected( expectedForces[ii], expectedForces[ii+1], expectedForces[ii+2] );
+                ASSERT_EQUAL_VEC( expected*(bohrInNm/hartreeInKJPerMol), Vec3( forces[ii], forces[ii+1], forces[ii+2] ), 1.0e-5 );
+            }
+            for( int a = 0; a < 3; a++ ){
+                for( int b = 0; b < 3; b++ ){
+                    ASSERT_EQUAL_TOL( expectedVirial[3*b+a]/hartreeInKJPerMol, virial[3*a+b], 1.0e-5 );
+                }
+            }
+        }
+    }
+
+    for( int c = 0; c < numberOfBeads; c++ ){
+        sendHeader( connections[c], "EXIT" );
+    }
+    client.join();
+    for( int c = 0; c < numberOfBeads; c++ ){
+        close( connections[c] );
+    }
+    close( listener );
+    unlink( path.str().c_str() );
+    if( driverError ){
+        std::rethrow_exception( driverError );
+    }
+    ASSERT_EQUAL( numberOfSteps*numberOfBeads, driver.getNumEvaluations() );
+}
+
+void testSocketPath( ) {
+    ASSERT( MBPolIPIDriver::getSocketPath( "mbpol" ) == "/tmp/ipi_mbpol" );
+    ASSERT( MBPolIPIDriver::getSocketPath( "/var/run/mbpol.sock" ) == "/var/run/mbpol.sock" );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestMBPolIPIDriver running test..." << std::endl;
+
+        testSocketPath();
+        testTwoBeads();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
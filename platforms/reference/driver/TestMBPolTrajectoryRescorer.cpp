@@ -0,0 +1,359 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests MBPolTrajectoryRescorer: the energies and virials it writes for the frames
+ * of an XYZ cluster trajectory with M sites and of a periodic DCD trajectory must be
+ * those of MBPolEngine, in frame order, and consecutive frames must be warm-started
+ * if and only if the warm start is enabled. DCD cells that are not orthorhombic must be
+ * rejected.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Vec3.h"
+#include "openmm/MBPolEngine.h"
+#include "MBPolTrajectory.h"
+#include "MBPolTrajectoryRescorer.h"
+#include "ReferenceMBPolParallel.h"
+#include "MBPolTestWaters.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const int    side         = 4;
+const double waterSpacing = 0.3104;
+
+// O, H, H of the waters on a distorted cubic lattice (nm), a little different for every frame
+
+std::vector<double> buildFrame( int numWaters, int frame ) {
+
+    std::vector<double> positions( 9*numWaters );
+    for( int m = 0; m < numWaters; m++ ){
+        Vec3 oxygen( (m % side + 0.5)*waterSpacing, ((m/side) % side + 0.5)*waterSpacing, (m/(side*side) + 0.5)*waterSpacing );
+        oxygen += Vec3( std::sin( 1.7*m + 0.1*frame ), std::cos( 2.3*m ), std::sin( 0.9*m + 0.3 ) )*0.03;
+        Vec3 atoms[3];
+        getWaterAtoms( oxygen, 0.8*m + 0.02*frame, 0.5*m, 1.0, atoms );
+        for( int s = 0; s < 3; s++ ){
+            for( int d = 0; d < 3; d++ ){
+                positions[9*m+3*s+d] = atoms[s][d];
+            }
+        }
+    }
+    return positions;
+}
+
+std::string temporaryPath( const std::string& suffix ) {
+    char name[] = "/tmp/TestMBPolTrajectoryRescorerXXXXXX";
+    int file = mkstemp( name );
+    ASSERT( file >= 0 );
+    close( file );
+    unlink( name );
+    return std::string( name ) + suffix;
+}
+
+// an XYZ file with an M site after the hydrogens of every water, in Angstrom
+
+void writeXYZ( const std::string& path, int numWaters, int numFrames ) {
+    std::ofstream file( path.c_str() );
+    file.precision( 10 );
+    const char* elements[4] = { "O", "H", "H", "M" };
+    for( int frame = 0; frame < numFrames; frame++ ){
+        std::vector<double> positions = buildFrame( numWaters, frame );
+        file << 4*numWaters << std::endl << "frame " << frame << std::endl;
+        for( int m = 0; m < numWaters; m++ ){
+            for( int s = 0; s < 4; s++ ){
+                int site = (s < 3 ? s : 0);
+                file << elements[s] << " " << 10.0*positions[9*m+3*site] << " " << 10.0*positions[9*m+3*site+1]
+                     << " " << 10.0*positions[9*m+3*site+2] << std::endl;
+            }
+        }
+    }
+}
+
+template <class T>
+void writeRecord( std::ofstream& file, const T* data, int32_t count ) {
+    int32_t length = count*sizeof(T);
+    file.write( reinterpret_cast<const char*>( &length ), sizeof(length) );
+    file.write( reinterpret_cast<const char*>( data ), length );
+    file.write( reinterpret_cast<const char*>( &length ), sizeof(length) );
+}
+
+// a DCD file with unit cell as OpenMM writes it, in Angstrom; the header leaves the number of frames at 0
+
+// a cubic box with edge boxEdge (nm) and all three cell angles set to cellAngle, 0 being the
+// cosine of 90 degrees
+
+void writeDCD( const std::string& path, int numWaters, int numFrames, double boxEdge, double cellAngle = 0.0 ) {
+    std::ofstream file( path.c_str(), std::ios::binary );
+    char header[84];
+    memset( header, 0, sizeof(header) );
+    memcpy( header, "CORD", 4 );
+    int32_t control[20];
+    memset( control, 0, sizeof(control) );
+    control[10] = 1;
+    control[19] = 24;
+    memcpy( header + 4, control, sizeof(control) );
+    writeRecord( file, header, 84 );
+    char titles[4 + 80];
+    int32_t numTitles = 1;
+    memcpy( titles, &numTitles, 4 );
+    memset( titles + 4, ' ', 80 );
+    writeRecord( file, titles, sizeof(titles) );
+    int32_t numAtoms = 3*numWaters;
+    writeRecord( file, &numAtoms, 1 );
+    for( int frame = 0; frame < numFrames; frame++ ){
+        double cell[6] = { 10.0*boxEdge, cellAngle, 10.0*boxEdge, cellAngle, cellAngle, 10.0*boxEdge };
+        writeRecord( file, cell, 6 );
+        std::vector<double> positions = buildFrame( numWaters, frame );
+        std::vector<float> coordinates( numAtoms );
+        for( int d = 0; d < 3; d++ ){
+            for( int ii = 0; ii < numAtoms; ii++ ){
+                coordinates[ii] = (float) (10.0*positions[3*ii+d]);
+            }
+            writeRecord( file, &coordinates[0], numAtoms );
+        }
+    }
+}
+
+// the columns of the output file, checking its header
+
+std::vector<std::vector<double> > readColumns( const std::string& path, const std::vector<std::string>& names, int numFrames ) {
+    std::ifstream file( path.c_str(), std::ios::binary );
+    char magic[8];
+    int32_t counts[2];
+    int64_t frames;
+    file.read( magic, 8 );
+    file.read( reinterpret_cast<char*>( counts ), sizeof(counts) );
+    file.read( reinterpret_cast<char*>( &frames ), sizeof(frames) );
+    ASSERT( memcmp( magic, "MBPOLCOL", 8 ) == 0 );
+    ASSERT_EQUAL( (int) names.size(), counts[0] );
+    ASSERT_EQUAL( numFrames, (int) frames );
+    for( unsigned int column = 0; column < names.size(); column++ ){
+        char name[32];
+        file.read( name, 32 );
+        ASSERT_EQUAL( names[column], std::string( name ) );
+    }
+    std::vector<std::vector<double> > columns( names.size(), std::vector<double>( numFrames ) );
+    for( unsigned int column = 0; column < names.size(); column++ ){
+        file.read( reinterpret_cast<char*>( &columns[column][0] ), numFrames*sizeof(double) );
+    }
+    ASSERT( file.good() );
+    return columns;
+}
+
+void testCluster( ) {
+
+    const int numWaters = 5;
+    const int numFrames = 40;
+    std::string trajectory = temporaryPath( ".xyz" );
+    std::string output     = temporaryPath( ".mbpol" );
+    writeXYZ( trajectory, numWaters, numFrames );
+
+    MBPolTrajectoryRescorer rescorer;
+    rescorer.setSitesPerWater( 4 );
+    rescorer.setMutualInducedTargetEpsilon( 1.0e-10 );
+    rescorer.setIncludeTermEnergies( true );
+    rescorer.setInducedDipoleWarmStart( true );
+    ASSERT_EQUAL( numFrames, rescorer.rescore( trajectory, output ) );
+    std::vector<std::string> names = rescorer.getColumnNames();
+    ASSERT_EQUAL( 1 + MBPolEngine::NumTerms, (int) names.size() );
+    ASSERT_EQUAL( std::string( "energy_electrostatics" ), names[1 + MBPolEngine::Electrostatics] );
+    std::vector<std::vector<double> > columns = readColumns( output, names, numFrames );
+    std::cout << "testCluster: " << rescorer.getNumInducedDipoleWarmStarts() << " of " << numFrames << " frames warm-started" << std::endl;
+    ASSERT( rescorer.getNumInducedDipoleWarmStarts() > 0 );
+
+    for( int frame = 0; frame < numFrames; frame++ ){
+        MBPolEngine engine( numWaters );
+        engine.setMutualInducedTargetEpsilon( 1.0e-10 );
+        double energy = engine.compute( &buildFrame( numWaters, frame )[0], NULL, NULL );
+        ASSERT_EQUAL_TOL( energy, columns[0][frame], 1.0e-6 );
+
+        // the terms add up to the energy
+
+        double sum = 0.0;
+        for( int term = 0; term < MBPolEngine::NumTerms; term++ ){
+            double termEnergy = engine.getTermEnergy( (MBPolEngine::Term) term );
+            ASSERT_EQUAL_TOL( termEnergy, columns[1+term][frame], 1.0e-6 );
+            sum += termEnergy;
+        }
+        ASSERT_EQUAL_TOL( energy, sum, 1.0e-10 );
+    }
+    unlink( trajectory.c_str() );
+    unlink( output.c_str() );
+}
+
+void testPeriodic( ) {
+
+    const int numWaters  = side*side*side;
+    const int numFrames  = 6;
+    const double boxEdge = side*waterSpacing;
+    std::string trajectory = temporaryPath( ".dcd" );
+    std::string output     = temporaryPath( ".mbpol" );
+    writeDCD( trajectory, numWaters, numFrames, boxEdge );
+
+    MBPolTrajectoryRescorer rescorer;
+    rescorer.setCutoffDistance( 0.45 );
+    rescorer.setIncludeVirial( true );
+    ASSERT_EQUAL( numFrames, rescorer.rescore( trajectory, output ) );
+    ASSERT_EQUAL( 0, rescorer.getNumInducedDipoleWarmStarts() );
+    std::vector<std::string> names = rescorer.getColumnNames();
+    ASSERT_EQUAL( 10, (int) names.size() );
+    std::vector<std::vector<double> > columns = readColumns( output, names, numFrames );
+
+    for( int frame = 0; frame < numFrames; frame++ ){
+
+        // the DCD file stores single precision Angstroms
+
+        std::vector<double> positions = buildFrame( numWaters, frame );
+        for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+            positions[ii] = ((float) (10.0*positions[ii]))*0.1;
+        }
+        MBPolEngine engine( numWaters );
+        engine.setCutoffDistance( 0.45 );
+        engine.setBox( boxEdge, boxEdge, boxEdge );
+        double virial[9];
+        double energy = engine.compute( &positions[0], NULL, virial );
+        ASSERT_EQUAL_TOL( energy, columns[0][frame], 1.0e-5 );
+        for( int component = 0; component < 9; component++ ){
+            ASSERT_EQUAL_TOL( virial[component], columns[1+component][frame], 1.0e-4 );
+        }
+    }
+    unlink( trajectory.c_str() );
+    unlink( output.c_str() );
+}
+
+void testCellAngles( ) {
+
+    const int numWaters  = 2;
+    const double boxEdge = 2.0;
+    std::string trajectory = temporaryPath( ".dcd" );
+    std::vector<double> positions( 9*numWaters );
+    double box[3];
+
+    // right angles given in degrees, as OpenMM writes them
+
+    writeDCD( trajectory, numWaters, 1, boxEdge, 90.0 );
+    {
+        MBPolTrajectory dcd( trajectory );
+        ASSERT( dcd.hasBox() );
+        dcd.readFrame( 0, &positions[0], box );
+        ASSERT_EQUAL_VEC( Vec3( boxEdge, boxEdge, boxEdge ), Vec3( box[0], box[1], box[2] ), 1.0e-10 );
+    }
+
+    // 60 degrees, or a cosine of 0.5: a rhombohedral cell
+
+    const double triclinicAngles[2] = { 60.0, 0.5 };
+    for( int ii = 0; ii < 2; ii++ ){
+        writeDCD( trajectory, numWaters, 1, boxEdge, triclinicAngles[ii] );
+        MBPolTrajectory dcd( trajectory );
+        bool threw = false;
+        try {
+            dcd.readFrame( 0, &positions[0], box );
+        } catch( const OpenMMException& ) {
+            threw = true;
+        }
+        ASSERT( threw );
+
+        MBPolTrajectoryRescorer rescorer;
+        std::string output = temporaryPath( ".mbpol" );
+        threw = false;
+        try {
+            rescorer.rescore( trajectory, output );
+        } catch( const OpenMMException& ) {
+            threw = true;
+        }
+        ASSERT( threw );
+        unlink( output.c_str() );
+    }
+    unlink( trajectory.c_str() );
+}
+
+void testInvalidTrajectory( ) {
+
+    MBPolTrajectoryRescorer rescorer;
+    std::string output = temporaryPath( ".mbpol" );
+    bool threw = false;
+    try {
+        rescorer.rescore( temporaryPath( ".pdb" ), output );
+    } catch( const OpenMMException& ) {
+        threw = true;
+    }
+    ASSERT( threw );
+
+    // 5 atoms cannot be O, H, H waters
+
+    std::string trajectory = temporaryPath( ".xyz" );
+    std::ofstream file( trajectory.c_str() );
+    file << "5\n\nO 0 0 0\nH 1 0 0\nH 0 1 0\nO 3 0 0\nH 4 0 0\n";
+    file.close();
+    threw = false;
+    try {
+        rescorer.rescore( trajectory, output );
+    } catch( const OpenMMException& ) {
+        threw = true;
+    }
+    ASSERT( threw );
+    unlink( trajectory.c_str() );
+    unlink( output.c_str() );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestMBPolTrajectoryRescorer running test..." << std::endl;
+
+        // several threads even on a small test machine, so that blocks finish out of order
+
+        ReferenceMBPolParallel::setNumThreads( 3 );
+        testCluster();
+        testPeriodic();
+        testCellAngles();
+        testInvalidTrajectory();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "MBPolIPIDriver.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace MBPolPlugin;
+using namespace std;
+
+// Evaluates MB-pol for i-PI over a UNIX domain socket, e.g. for the <ffsocket mode="unix">
+// of an i-PI input with <address>mbpol</address>:
+//
+//     mbpol_ipi_driver -a mbpol -n 8
+
+static void printUsage() {
+    cerr << "usage: mbpol_ipi_driver [-a ADDRESS] [-n CONNECTIONS] [--cluster] [--warm-start] [--cutoff NM]"
+            " [--ewald-tolerance TOL] [--dipole-epsilon EPS]" << endl
+         << "  -a ADDRESS              socket /tmp/ipi_ADDRESS, or the path ADDRESS if it starts with / (default mbpol)" << endl
+         << "  -n CONNECTIONS          connections to the server, i.e. beads evaluated concurrently (default 1)" << endl
+         << "  --cluster               ignore the cell: the waters are a cluster" << endl
+         << "  --warm-start            start the induced dipoles of a bead from those of its previous step" << endl
+         << "  --cutoff NM             real space electrostatics and dispersion cutoff (default 0.9)" << endl
+         << "  --ewald-tolerance TOL   PME error tolerance (default 1e-4)" << endl
+         << "  --dipole-epsilon EPS    induced dipole convergence criterion (default 1e-7)" << endl
+         << "The atoms must be ordered O, H, H for every water." << endl;
+}
+
+static double parsePositive(const char* value, const char* option) {
+    char* end;
+    double number = strtod(value, &end);
+    if( *end != '\0' || !(number > 0.0) ){
+        throw invalid_argument(string("invalid value for ") + option + ": " + value);
+    }
+    return number;
+}
+
+int main(int argc, char* argv[]) {
+
+    // a server that goes away must not kill the driver in the middle of a send
+
+    signal(SIGPIPE, SIG_IGN);
+
+    MBPolIPIDriver driver;
+    try {
+        for( int ii = 1; ii < argc; ii++ ){
+            string option = argv[ii];
+            if( option == "-h" || option == "--help" ){
+                printUsage();
+                return 0;
+            } else if( option == "--cluster" ){
+                driver.setUsePeriodic(false);
+                continue;
+            } else if( option == "--warm-start" ){
+                driver.setInducedDipoleWarmStart(true);
+                continue;
+            }
+            if( ii + 1 >= argc ){
+                throw invalid_argument("missing value for " + option);
+            }
+            const char* value = argv[++ii];
+            if( option == "-a" ){
+                driver.setAddress(value);
+            } else if( option == "-n" ){
+                driver.setNumConnections((int) parsePositive(value, "-n"));
+            } else if( option == "--cutoff" ){
+                driver.setCutoffDistance(parsePositive(value, "--cutoff"));
+            } else if( option == "--ewald-tolerance" ){
+                driver.setEwaldErrorTolerance(parsePositive(value, "--ewald-tolerance"));
+            } else if( option == "--dipole-epsilon" ){
+                driver.setMutualInducedTargetEpsilon(parsePositive(value, "--dipole-epsilon"));
+            } else {
+                throw invalid_argument("unknown option " + option);
+            }
+        }
+    } catch(const exception& e) {
+        cerr << "mbpol_ipi_driver: " << e.what() << endl;
+        printUsage();
+        return 1;
+    }
+
+    try {
+        driver.run();
+    } catch(const exception& e) {
+        cerr << "mbpol_ipi_driver: " << e.what() << endl;
+        return 1;
+    }
+    cerr << "mbpol_ipi_driver: " << driver.getNumEvaluations() << " evaluations" << endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "MBPolTrajectoryRescorer.h"
+#include "ReferenceMBPolParallel.h"
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace MBPolPlugin;
+using namespace std;
+
+// Evaluates MB-pol for every frame of a trajectory, e.g. the energies and virials of a
+// simulation written with the M sites, on 16 threads:
+//
+//     mbpol_rescore -j 16 --sites-per-water 4 --virial -o energies.mbpol trajectory.dcd
+
+static void printUsage() {
+    cerr << "usage: mbpol_rescore [-o OUTPUT] [-j THREADS] [--sites-per-water N] [--box X Y Z] [--cluster] [--virial]"
+            " [--terms] [--warm-start] [--cutoff NM] [--ewald-tolerance TOL] [--dipole-epsilon EPS] TRAJECTORY" << endl
+         << "  TRAJECTORY              .dcd or .xyz file, in Angstrom" << endl
+         << "  -o OUTPUT               columnar binary output (default TRAJECTORY.mbpol)" << endl
+         << "  -j THREADS              threads evaluating frames (default MBPOL_NUM_THREADS or all cores)" << endl
+         << "  --sites-per-water N     atoms stored per water, O, H, H first (default 3)" << endl
+         << "  --box X Y Z             box edges in nm for trajectories without unit cell" << endl
+         << "  --cluster               ignore the unit cell: the waters are a cluster" << endl
+         << "  --virial                also write the nine components of the virial" << endl
+         << "  --terms                 also write the energies of the 1B, 2B, 3B, electrostatics and dispersion terms" << endl
+         << "  --warm-start            start the induced dipoles from those of the previous frame; faster, but the" << endl
+         << "                          last digits then depend on how the frames are split over the threads" << endl
+         << "  --cutoff NM             real space electrostatics and dispersion cutoff (default 0.9)" << endl
+         << "  --ewald-tolerance TOL   PME error tolerance (default 1e-4)" << endl
+         << "  --dipole-epsilon EPS    induced dipole convergence criterion (default 1e-7)" << endl;
+}
+
+static double parsePositive(const char* value, const string& option) {
+    char* end;
+    double number = strtod(value, &end);
+    if( *end != '\0' || !(number > 0.0) ){
+        throw invalid_argument("invalid value for " + option + ": " + value);
+    }
+    return number;
+}
+
+int main(int argc, char* argv[]) {
+
+    MBPolTrajectoryRescorer rescorer;
+    string trajectory;
+    string output;
+    try {
+        for( int ii = 1; ii < argc; ii++ ){
+            string option = argv[ii];
+            if( option == "-h" || option == "--help" ){
+                printUsage();
+                return 0;
+            } else if( option == "--cluster" ){
+                rescorer.setUsePeriodic(false);
+                continue;
+            } else if( option == "--virial" ){
+                rescorer.setIncludeVirial(true);
+                continue;
+            } else if( option == "--terms" ){
+                rescorer.setIncludeTermEnergies(true);
+                continue;
+            } else if( option == "--warm-start" ){
+                rescorer.setInducedDipoleWarmStart(true);
+                continue;
+            } else if( option.empty() || option[0] != '-' ){
+                if( !trajectory.empty() ){
+                    throw invalid_argument("more than one trajectory given");
+                }
+                trajectory = option;
+                continue;
+            }
+            int numValues = (option == "--box" ? 3 : 1);
+            if( ii + numValues >= argc ){
+                throw invalid_argument("missing value for " + option);
+            }
+            const char* value = argv[++ii];
+            if( option == "-o" ){
+                output = value;
+            } else if( option == "-j" ){
+                ReferenceMBPolParallel::setNumThreads((int) parsePositive(value, option));
+            } else if( option == "--sites-per-water" ){
+                rescorer.setSitesPerWater((int) parsePositive(value, option));
+            } else if( option == "--box" ){
+                double x = parsePositive(value, option);
+                double y = parsePositive(argv[++ii], option);
+                double z = parsePositive(argv[++ii], option);
+                rescorer.setBox(x, y, z);
+            } else if( option == "--cutoff" ){
+                rescorer.setCutoffDistance(parsePositive(value, option));
+            } else if( option == "--ewald-tolerance" ){
+                rescorer.setEwaldErrorTolerance(parsePositive(value, option));
+            } else if( option == "--dipole-epsilon" ){
+                rescorer.setMutualInducedTargetEpsilon(parsePositive(value, option));
+            } else {
+                throw invalid_argument("unknown option " + option);
+            }
+        }
+        if( trajectory.empty() ){
+            throw invalid_argument("no trajectory given");
+        }
+    } catch(const exception& e) {
+        cerr << "mbpol_rescore: " << e.what() << endl;
+        printUsage();
+        return 1;
+    }
+    if( output.empty() ){
+        output = trajectory + ".mbpol";
+    }
+
+    try {
+        int numFrames = rescorer.rescore(trajectory, output);
+        cerr << "mbpol_rescore: " << numFrames << " frames written to " << output << endl;
+    } catch(const exception& e) {
+        cerr << "mbpol_rescore: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef OPENMM_REFERENCE_MBPOL_CHECKPOINT_H_
+#define OPENMM_REFERENCE_MBPOL_CHECKPOINT_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/internal/windowsExport.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+
+namespace MBPolPlugin {
+
+/**
+ * Binary records of the solver state of the Reference kernels (converged induced dipoles,
+ * neighbor list builds), written next to an OpenMM checkpoint so that a restarted run
+ * starts with warm caches.
+ *
+ * Values are written in the native byte order and precision: a record is meant to be read
+ * back by the same build on the same machine, like Context::createCheckpoint(). Every
+ * read throws an OpenMMException if the stream ends early.
+ */
+class OPENMM_EXPORT ReferenceMBPolCheckpoint {
+public:
+
+    /**
+     * Write a tag naming the record and the format version.
+     */
+    static void writeHeader(std::ostream& stream, const std::string& tag, int version);
+
+    /**
+     * Read a header written by writeHeader(); throws an OpenMMException unless it has
+     * the same tag and version.
+     */
+    static void checkHeader(std::istream& stream, const std::string& tag, int version);
+
+    static void writeInt(std::ostream& stream, int value);
+
+    static int readInt(std::istream& stream);
+
+    static void writeDouble(std::ostream& stream, double value);
+
+    static double readDouble(std::istream& stream);
+
+    static void writeVec(std::ostream& stream, const RealVec& value);
+
+    static RealVec readVec(std::istream& stream);
+
+    static void writeInts(std::ostream& stream, const std::vector<int>& values);
+
+    static void readInts(std::istream& stream, std::vector<int>& values);
+
+    static void writeVecs(std::ostream& stream, const std::vector<RealVec>& values);
+
+    static void readVecs(std::istream& stream, std::vector<RealVec>& values);
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_CHECKPOINT_H_
@@ -0,0 +1,68 @@
+#ifndef OPENMM_REFERENCE_MBPOL_FIXED_POINT_H_
+#define OPENMM_REFERENCE_MBPOL_FIXED_POINT_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/internal/windowsExport.h"
+#include <cstddef>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Accumulator of one thread for the deterministic mode of ReferenceMBPolScheduler.
+ *
+ * A chunk adds its contributions in double precision to the scratch vectors and
+ * scalars and marks the entries it touched; flush() rounds every touched entry to
+ * 64-bit fixed point with 32 fractional bits, like the force buffers of OpenMM's
+ * CUDA platform, adds it to the sums and clears it. Integer addition does not
+ * depend on the order, so the sums of all chunks are the same whichever thread
+ * ran which chunk, and for any number of threads.
+ */
+class OPENMM_EXPORT ReferenceMBPolFixedPointBuffer {
+public:
+
+    /**
+     * Round a value to fixed point.
+     */
+    static long long toFixed(double value);
+
+    static double toDouble(long long value);
+
+    /**
+     * Size the buffer and set every entry to zero.
+     */
+    void initialize(int numVectors, int numScalars = 0);
+
+    std::vector<OpenMM::RealVec>& getVectors();
+
+    std::vector<RealOpenMM>& getScalars();
+
+    void touchVector(int index);
+
+    void touchScalar(int index);
+
+    /**
+     * Move the touched entries of the scratch arrays into the fixed point sums.
+     */
+    void flush();
+
+    /**
+     * Add the sums of several buffers to vectors and, if not NULL, scalars.
+     */
+    static void reduce(const std::vector<ReferenceMBPolFixedPointBuffer>& buffers,
+                       std::vector<OpenMM::RealVec>& vectors, std::vector<RealOpenMM>* scalars = NULL);
+
+private:
+    std::vector<OpenMM::RealVec> vectors;
+    std::vector<RealOpenMM> scalars;
+    std::vector<long long> fixedVectors;
+    std::vector<long long> fixedScalars;
+    std::vector<char> vectorTouched;
+    std::vector<char> scalarTouched;
+    std::vector<int> touchedVectors;
+    std::vector<int> touchedScalars;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_FIXED_POINT_H_
@@ -0,0 +1,56 @@
+#ifndef OPENMM_REFERENCE_MBPOL_PARALLEL_H_
+#define OPENMM_REFERENCE_MBPOL_PARALLEL_H_
+
+#include "openmm/internal/windowsExport.h"
+#include <functional>
+
+namespace MBPolPlugin {
+
+/**
+ * Data-parallel loops for the Reference kernels.
+ *
+ * parallelFor() runs a body for every index of a range on up to getNumThreads()
+ * threads, handing out indices one at a time. The body must only write to data
+ * owned by its index; results are combined by the caller afterwards, in index
+ * order, so they do not depend on the number of threads.
+ */
+class OPENMM_EXPORT ReferenceMBPolParallel {
+public:
+
+    /**
+     * Number of threads used by parallelFor(). The initial value is taken from the
+     * environment variable MBPOL_NUM_THREADS; the default is the number of hardware threads.
+     */
+    static int getNumThreads();
+
+    /**
+     * Set the number of threads used by parallelFor(); 1 runs every loop on the calling thread.
+     */
+    static void setNumThreads(int numThreads);
+
+    /**
+     * Call body(index) for index = 0 ... numItems-1 and wait for all calls to finish.
+     * If a call throws, the remaining indices are skipped and the first exception is
+     * rethrown on the calling thread. A parallelFor() inside a body runs on the thread
+     * of that body, so nested loops do not start more threads than getNumThreads().
+     */
+    static void parallelFor(int numItems, const std::function<void(int)>& body);
+
+    /**
+     * Call worker(thread) for thread = 0 ... numThreads-1, each on its own thread (thread 0
+     * on the calling one), and wait for all of them. Loops inside a worker run like those
+     * inside a parallelFor() body; the first exception is rethrown on the calling thread.
+     * The other threads are taken from a pool that lives as long as the process, so a
+     * call costs a wake-up rather than creating and joining threads.
+     */
+    static void runOnThreads(int numThreads, const std::function<void(int)>& worker);
+
+    /**
+     * True on the threads running a parallelFor() body or a runOnThreads() worker.
+     */
+    static bool isInsideParallelLoop();
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_PARALLEL_H_
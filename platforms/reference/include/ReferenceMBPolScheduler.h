@@ -0,0 +1,129 @@
+#ifndef OPENMM_REFERENCE_MBPOL_SCHEDULER_H_
+#define OPENMM_REFERENCE_MBPOL_SCHEDULER_H_
+
+#include "openmm/internal/windowsExport.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Work-stealing execution of the chunked loops of the Reference kernels: the
+ * 2B pairs, the 3B triplets and the induced dipole fields.
+ *
+ * A scheduler belongs to one loop of one kernel. run() deals the chunks out to
+ * the ReferenceMBPolParallel threads in contiguous blocks of equal estimated
+ * cost. Every thread works through its own block from the front; a thread
+ * that runs out takes chunks from the back of the block with the most chunks
+ * left. The estimate of a chunk is the time it took at the previous run() with
+ * the same number of chunks (equal costs at the first one), so callers keep the
+ * chunks stable from step to step, e.g. blocks of molecules in the order of
+ * ReferenceMoleculeOrdering.
+ *
+ * Work stealing is off by default; set the environment variable
+ * MBPOL_WORK_STEALING=1 or call setEnabled(). When it is off, with a single
+ * thread, or inside another parallel loop, run() calls the chunks in order on
+ * the calling thread. Bodies accumulate into buffers of their thread, which the
+ * caller sums in thread order afterwards; since the chunks a thread gets depend
+ * on the timing, the sums can differ in the last bits from run to run.
+ *
+ * In the deterministic mode (MBPOL_DETERMINISTIC=1 or setDeterministic()) the
+ * callers take the chunked path even on a single thread and sum the chunks in
+ * fixed point (ReferenceMBPolFixedPointBuffer), so their results are the same
+ * bits for any number of threads and any scheduling. The PME electrostatics also
+ * adds the atom contributions to its grid points in fixed point then.
+ *
+ * The load balance is summed per loop name over all schedulers of the process;
+ * getReport() lists it.
+ */
+class OPENMM_EXPORT ReferenceMBPolScheduler {
+public:
+
+    /**
+     * Load balance of a loop, summed over its runs on more than one thread.
+     */
+    struct Statistics {
+        Statistics() : runs(0), chunks(0), steals(0), meanBusySeconds(0.0), maxBusySeconds(0.0), staticMaxBusySeconds(0.0) {
+        }
+        int runs;
+        int chunks;
+        /** Chunks run by a thread other than the one they were dealt to. */
+        int steals;
+        /** Time the threads spent in chunks, averaged over the threads. */
+        double meanBusySeconds;
+        /** Time the busiest thread spent in chunks. */
+        double maxBusySeconds;
+        /** Time the busiest thread would have spent without stealing, from the measured chunk times. */
+        double staticMaxBusySeconds;
+        /** maxBusySeconds/meanBusySeconds; 1 is a perfect balance. */
+        double getImbalance() const;
+        /** staticMaxBusySeconds/meanBusySeconds. */
+        double getStaticImbalance() const;
+    };
+
+    /**
+     * @param loop  name of the loop, "<force>.<phase>" like the ReferenceMBPolTimers phases
+     */
+    explicit ReferenceMBPolScheduler(const std::string& loop);
+
+    /**
+     * Number of threads run() should use here: 1 if work stealing is off or the caller
+     * is inside a parallel loop, ReferenceMBPolParallel::getNumThreads() otherwise.
+     */
+    static int getNumThreads();
+
+    /**
+     * Call body(chunk, thread) for chunk = 0 ... numChunks-1 and wait for all calls to finish.
+     * If a call throws, the remaining chunks are skipped and the exception is rethrown.
+     *
+     * @param numChunks   number of chunks
+     * @param numThreads  the value of getNumThreads() the per-thread buffers were sized for;
+     *                    body gets thread = 0 ... numThreads-1
+     * @param body        the work of one chunk
+     */
+    void run(int numChunks, int numThreads, const std::function<void(int, int)>& body);
+
+    /**
+     * Forget the chunk costs, e.g. when the chunks of the next run() cover different work.
+     */
+    void resetCosts();
+
+    static void setEnabled(bool enabled);
+
+    static bool getEnabled();
+
+    /**
+     * Set whether the loops using a scheduler sum their chunks in fixed point. The mode
+     * is off by default; the initial value is taken from the environment variable
+     * MBPOL_DETERMINISTIC.
+     */
+    static void setDeterministic(bool deterministic);
+
+    static bool getDeterministic();
+
+    /**
+     * Statistics of a loop; all zero if it has not run on more than one thread.
+     */
+    static Statistics getStatistics(const std::string& loop);
+
+    /**
+     * Names of the loops recorded since the last resetStatistics(), in alphabetical order.
+     */
+    static std::vector<std::string> getLoops();
+
+    static void resetStatistics();
+
+    /**
+     * Table of all loops with their runs, steals and imbalance.
+     */
+    static std::string getReport();
+
+private:
+    std::string loop;
+    std::vector<double> chunkCosts;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_SCHEDULER_H_
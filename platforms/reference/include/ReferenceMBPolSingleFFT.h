@@ -0,0 +1,65 @@
+#ifndef OPENMM_REFERENCE_MBPOL_SINGLE_FFT_H_
+#define OPENMM_REFERENCE_MBPOL_SINGLE_FFT_H_
+
+#include "openmm/internal/windowsExport.h"
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Complex-to-complex 3D FFT in single precision, for the PME grids of
+ * MBPolReferencePmeElectrostaticsForce.
+ *
+ * The grid is stored like the fftpack grids, x slowest and z fastest, and the
+ * transforms follow the fftpack conventions: forward with exp(-2 pi i jk/n),
+ * backward with exp(+2 pi i jk/n), neither normalized. Each dimension is
+ * transformed with a mixed radix Stockham algorithm, one radix per pass and no
+ * bit reversal, on all lines of the dimension at once: the innermost loop runs
+ * over the lines, which are contiguous for x and y and transposed into place for
+ * z. Radix 2, 3 and 4 have their own butterflies; the PME grid sizes only have
+ * factors 2, 3, 5 and 7, and other factors use a direct DFT of that length.
+ */
+class OPENMM_EXPORT ReferenceMBPolSingleFFT {
+public:
+
+    struct Complex {
+        float re;
+        float im;
+    };
+
+    ReferenceMBPolSingleFFT();
+
+    /**
+     * Set the grid dimensions and precompute the factors and twiddle factors.
+     */
+    void initialize(int xsize, int ysize, int zsize);
+
+    /**
+     * Transform the grid in place.
+     *
+     * @param grid     xsize*ysize*zsize values
+     * @param forward  true for the forward transform, false for the backward one
+     */
+    void execute(Complex* grid, bool forward);
+
+private:
+
+    struct Dimension {
+        int size;
+        std::vector<int> factors;
+        std::vector<Complex> twiddles;
+    };
+
+    /**
+     * Transform numLines interleaved lines, element j of line q at data[q + numLines*j];
+     * work must hold as many values as data.
+     */
+    void transformLines(const Dimension& dimension, Complex* data, Complex* work, int numLines, bool forward) const;
+
+    Dimension dimensions[3];
+    std::vector<Complex> work;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_SINGLE_FFT_H_
@@ -0,0 +1,207 @@
+#ifndef OPENMM_REFERENCE_MBPOL_TASK_GRAPH_H_
+#define OPENMM_REFERENCE_MBPOL_TASK_GRAPH_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/internal/windowsExport.h"
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace OpenMM {
+class ContextImpl;
+}
+
+using namespace OpenMM;
+
+namespace MBPolPlugin {
+
+/**
+ * A force computation that the task graph can run on another thread. The forces
+ * go into the buffer passed in, never into the context.
+ */
+class ReferenceMBPolTask {
+public:
+    virtual ~ReferenceMBPolTask() {
+    }
+    /**
+     * Name used in the timing report, e.g. "ThreeBody".
+     */
+    virtual std::string getTaskName() const = 0;
+    /**
+     * Force group of the force this task computes.
+     */
+    virtual int getTaskForceGroup() const = 0;
+    /**
+     * Compute the forces and energy.
+     *
+     * @param context        the context, only read
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param forces         forces are added to this buffer, one entry per particle
+     * @return the potential energy
+     */
+    virtual double computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces) = 0;
+};
+
+/**
+ * Runs the MBPol forces of one evaluation concurrently.
+ *
+ * OpenMM executes the forces of a System one after another. When the task graph is
+ * enabled, the first MBPol force of an evaluation starts all other MBPol forces in
+ * the evaluated force groups on their own threads, so that the one-, two- and
+ * three-body polynomials run while the induced dipoles converge. Each force then
+ * waits for its own task when OpenMM executes it and adds the forces to the context,
+ * so the sum is formed on the calling thread as before. Every task has one worker
+ * thread, created the first time the task is started and kept until the task is
+ * removed, so an evaluation does not pay for creating threads.
+ *
+ * Results are only used for the positions they were computed from; an evaluation
+ * that is interrupted by an exception discards the remaining tasks.
+ */
+class OPENMM_EXPORT ReferenceMBPolTaskGraph {
+public:
+
+    ReferenceMBPolTaskGraph();
+
+    ~ReferenceMBPolTaskGraph();
+
+    /**
+     * Get the task graph shared by the kernels of a context, creating it if needed.
+     * Every acquire() must be matched by a release() with the same owner.
+     */
+    static ReferenceMBPolTaskGraph* acquire(const void* owner);
+
+    static void release(const void* owner);
+
+    /**
+     * Number of existing task graphs (one per Context using MBPol forces), for diagnostics.
+     */
+    static int getNumTaskGraphs();
+
+    static ReferenceMBPolTaskGraph* getTaskGraph(int index);
+
+    /**
+     * Whether newly created task graphs are enabled. The initial value is taken from the
+     * environment variable MBPOL_TASK_GRAPH (1 or 0); the default is disabled.
+     */
+    static void setDefaultEnabled(bool enabled);
+
+    static bool getDefaultEnabled();
+
+    void setEnabled(bool enabled);
+
+    bool getEnabled() const;
+
+    /**
+     * Wait for a task started by beginEvaluation() and discard its result, e.g. because its
+     * parameters changed.
+     */
+    void discardPending(ReferenceMBPolTask* task);
+
+    void addTask(ReferenceMBPolTask* task);
+
+    /**
+     * Remove a task, waiting for it if it is running.
+     */
+    void removeTask(ReferenceMBPolTask* task);
+
+    /**
+     * Called before a task is executed: if it has no result waiting, this is the first
+     * MBPol force of an evaluation, and the other tasks in groups are started.
+     *
+     * @param task           the task about to be executed
+     * @param context        the context
+     * @param positions      positions of the evaluation
+     * @param box            periodic box of the evaluation
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         the force groups evaluated
+     */
+    void beginEvaluation(ReferenceMBPolTask* task, ContextImpl& context, const std::vector<RealVec>& positions,
+                         const RealVec& box, bool includeForces, bool includeEnergy, int groups);
+
+    /**
+     * Get the result of a task: join the task if it was started by beginEvaluation() for the
+     * same configuration, otherwise compute it here.
+     *
+     * @param forces    forces of the context, the task's forces are added
+     * @return the potential energy
+     */
+    double execute(ReferenceMBPolTask* task, ContextImpl& context, const std::vector<RealVec>& positions,
+                   const RealVec& box, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces);
+
+    int getNumTasks() const;
+
+    std::string getTaskName(int index) const;
+
+    /**
+     * Number of times a task has been computed.
+     */
+    int getTaskCount(int index) const;
+
+    /**
+     * Number of those computations that ran concurrently with other forces.
+     */
+    int getTaskOverlapCount(int index) const;
+
+    /**
+     * Wall time of the last computation of a task, in seconds.
+     */
+    double getTaskLastTime(int index) const;
+
+    /**
+     * Total wall time of all computations of a task, in seconds.
+     */
+    double getTaskTotalTime(int index) const;
+
+    /**
+     * Total time the calling thread spent waiting for a task started on another thread, in seconds.
+     */
+    double getTaskWaitTime(int index) const;
+
+    void resetTimings();
+
+    /**
+     * Timing table, one line per task.
+     */
+    std::string getTimingReport() const;
+
+private:
+
+    struct TaskSlot {
+        ReferenceMBPolTask* task;
+        std::thread worker;
+        std::mutex lock;
+        std::condition_variable wakeup;
+        ContextImpl* context;
+        bool running, stop;
+        bool pending;
+        bool includeForces, includeEnergy;
+        std::vector<RealVec> forces;
+        double energy;
+        std::exception_ptr error;
+        int count, overlapCount;
+        double lastTime, totalTime, waitTime;
+    };
+
+    int findTask(ReferenceMBPolTask* task) const;
+    void run(TaskSlot& slot, ContextImpl& context);
+    void work(TaskSlot& slot);
+    void launch(TaskSlot& slot, ContextImpl& context);
+    void wait(TaskSlot& slot);
+    void stopWorker(TaskSlot& slot);
+    void joinAll();
+
+    bool enabled;
+    std::vector<TaskSlot*> slots;
+    bool launchValid;
+    unsigned long long launchFingerprint;
+    int numOwners;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_TASK_GRAPH_H_
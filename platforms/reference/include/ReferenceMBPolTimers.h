@@ -0,0 +1,89 @@
+#ifndef OPENMM_REFERENCE_MBPOL_TIMERS_H_
+#define OPENMM_REFERENCE_MBPOL_TIMERS_H_
+
+#include "openmm/internal/windowsExport.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace MBPolPlugin {
+
+/**
+ * Wall-clock time spent in the phases of the Reference MBPol kernels
+ * (neighbor lists, polynomials, induced dipole iterations, PME steps), summed
+ * over all contexts and threads of the process. Phases are named
+ * "<force>.<phase>", e.g. "ThreeBody.polynomial" or "Electrostatics.pmeFFT".
+ *
+ * Timing is off by default; when it is off a Scope costs one test of a flag.
+ */
+class OPENMM_EXPORT ReferenceMBPolTimers {
+public:
+
+    /**
+     * Times the enclosing block and adds it to a phase on destruction.
+     */
+    class OPENMM_EXPORT Scope {
+    public:
+        /**
+         * @param phase  name of the phase; must outlive the Scope (use a literal)
+         */
+        explicit Scope(const char* phase);
+        ~Scope();
+        /**
+         * Number of steps recorded for this pass through the phase (default 1),
+         * e.g. the number of induced dipole iterations.
+         */
+        void setCount(int count);
+        /**
+         * Record the time now instead of at the end of the block.
+         */
+        void stop();
+    private:
+        const char* phase;
+        int count;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    static void setEnabled(bool enabled);
+
+    static bool getEnabled();
+
+    /**
+     * Add time to a phase.
+     *
+     * @param phase    name of the phase
+     * @param seconds  wall-clock time
+     * @param count    number of steps the time covers
+     */
+    static void add(const std::string& phase, double seconds, int count = 1);
+
+    /**
+     * Forget all recorded times.
+     */
+    static void reset();
+
+    /**
+     * Names of the phases recorded since the last reset(), in alphabetical order.
+     */
+    static std::vector<std::string> getPhases();
+
+    /**
+     * Total time in seconds recorded for a phase; 0 if it was not recorded.
+     */
+    static double getTime(const std::string& phase);
+
+    /**
+     * Total number of steps recorded for a phase.
+     */
+    static int getCount(const std::string& phase);
+
+    /**
+     * Table of all phases with their counts and times.
+     */
+    static std::string getReport();
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_TIMERS_H_
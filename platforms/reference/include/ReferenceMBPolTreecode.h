@@ -0,0 +1,162 @@
+#ifndef OPENMM_REFERENCE_MBPOL_TREECODE_H_
+#define OPENMM_REFERENCE_MBPOL_TREECODE_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/internal/windowsExport.h"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+using namespace OpenMM;
+
+namespace MBPolPlugin {
+
+/**
+ * Barnes-Hut treecode for the undamped far field of point charges and point dipoles
+ * in a non-periodic system.
+ *
+ * The sites are grouped (the MBPol waters) and an octree is built over the centers of
+ * the groups. Each node carries the Cartesian moments of its charges and dipoles about
+ * its center up to the expansion order; the Taylor coefficients of 1/r are generated by
+ * the recurrence of Duan and Krasny. For every group, build() sorts the rest of the
+ * system into
+ *
+ *   - near groups, which may have sites closer than the near distance (judged by the
+ *     distance of the group centers and the radii of the groups); these interactions
+ *     are left to the caller, who computes them exactly (with Thole damping),
+ *   - far groups in leaves that are too close to be expanded; their sites are summed
+ *     directly without damping,
+ *   - nodes that satisfy radius < openingAngle*distance and contain no near group;
+ *     their moments are used.
+ *
+ * The lists only depend on the positions, so the far field of any number of source
+ * sets (e.g. once per induced dipole iteration) costs O(N log N) each.
+ */
+class OPENMM_EXPORT ReferenceMBPolTreecode {
+public:
+
+    ReferenceMBPolTreecode();
+
+    /**
+     * Set the opening angle: a node is expanded for a group if the radius of the node is
+     * smaller than openingAngle times its distance from every site of the group.
+     */
+    void setOpeningAngle(double angle);
+
+    double getOpeningAngle() const;
+
+    /**
+     * Set the order of the multipole expansions (at least 1); the error of an expansion
+     * falls roughly as openingAngle^(order+1).
+     */
+    void setExpansionOrder(int order);
+
+    int getExpansionOrder() const;
+
+    /**
+     * Set the site-site distance below which interactions are left to the caller.
+     */
+    void setNearDistance(double distance);
+
+    double getNearDistance() const;
+
+    /**
+     * Build the tree and the interaction lists.
+     *
+     * @param positions   site positions
+     * @param groups      site indices of each group; every site is in exactly one group
+     */
+    void build(const std::vector<RealVec>& positions, const std::vector<std::vector<int> >& groups);
+
+    /**
+     * Pairs of near groups (first < second).
+     */
+    const std::vector<std::pair<int, int> >& getNearPairs() const;
+
+    /**
+     * Largest distance of a site from the center of its group.
+     */
+    double getMaxGroupRadius() const;
+
+    /**
+     * A set of sources and the quantities of their far field to accumulate.
+     */
+    struct FieldSet {
+        FieldSet() : charges(NULL), dipoles(NULL), potential(NULL), field(NULL), gradient(NULL) {}
+        const std::vector<RealOpenMM>* charges;
+        const std::vector<RealVec>* dipoles;
+        std::vector<RealOpenMM>* potential;
+        std::vector<RealVec>* field;
+        std::vector<RealVec>* gradient;
+    };
+
+    /**
+     * Add the far field of a set of sources at every site, i.e. of all sources not in the
+     * same group or a near group.
+     *
+     * @param charges     charge of each site, or NULL
+     * @param dipoles     dipole of each site, or NULL
+     * @param potential   if not NULL, the potential at each site is added
+     * @param field       the field (minus the gradient of the potential) at each site is added
+     * @param gradient    if not NULL, the field gradient at each site is added: rows 3*i .. 3*i+2,
+     *                    (*gradient)[3*i+a][b] = d field_a / d r_b
+     */
+    void addFarField(const std::vector<RealOpenMM>* charges, const std::vector<RealVec>* dipoles,
+                     std::vector<RealOpenMM>* potential, std::vector<RealVec>& field,
+                     std::vector<RealVec>* gradient) const;
+
+    /**
+     * Add the far fields of several sets of sources; the Taylor coefficients of each
+     * (site, node) expansion are computed once for all of them.
+     */
+    void addFarFields(const std::vector<FieldSet>& sets) const;
+
+    /**
+     * Number of (group, node) expansions and (group, group) direct interactions in the lists.
+     */
+    void getNumInteractions(int& numExpansions, int& numDirect) const;
+
+private:
+
+    struct Node {
+        RealVec center;
+        RealOpenMM radius;
+        RealOpenMM groupRadius;
+        int firstGroup, lastGroup;
+        int numSites;
+        int children[8];
+        int numChildren;
+    };
+
+    int buildNode(int firstGroup, int lastGroup, const RealVec& low, const RealVec& high, int depth);
+    void findInteractions(int group, int node);
+    void computeMoments(const std::vector<RealOpenMM>* charges, const std::vector<RealVec>* dipoles,
+                        std::vector<RealOpenMM>& moments) const;
+    void computeTaylorCoefficients(const RealVec& delta, int numCoefficients, std::vector<RealOpenMM>& coefficients) const;
+    void setupTerms(int order);
+
+    double openingAngle;
+    int expansionOrder;
+    std::vector<int> termPowers;
+    std::vector<int> termRaised;
+    std::vector<int> recurrenceFirst;
+    std::vector<int> recurrenceSecond;
+    std::vector<RealOpenMM> recurrenceScale;
+    std::vector<int> numTermsOfOrder;
+    double nearDistance;
+    double maxGroupRadius;
+    std::vector<RealVec> positions;
+    std::vector<std::vector<int> > groups;
+    std::vector<RealVec> groupCenters;
+    std::vector<RealOpenMM> groupRadii;
+    std::vector<int> groupOrder;
+    std::vector<Node> nodes;
+    std::vector<std::pair<int, int> > nearPairs;
+    std::vector<int> expansionStart, expansionNodes;
+    std::vector<int> directStart, directGroups;
+    std::vector<int> pendingExpansions, pendingDirect;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_TREECODE_H_
@@ -0,0 +1,50 @@
+#ifndef OPENMM_REFERENCE_MBPOL_WATER_PARAMETERS_H_
+#define OPENMM_REFERENCE_MBPOL_WATER_PARAMETERS_H_
+
+namespace MBPolPlugin {
+
+/*
+ * The water parameters of the force field file python/mbpol.xml, for the code that
+ * evaluates MB-pol without building a System from it (MBPolEngine). This is the only
+ * copy in the C++ sources; TestReferenceMBPolEngine reads mbpol.xml and fails if the
+ * two disagree, so a change of the force field file has to be made here as well.
+ *
+ * The sites of a water are O, H, H and the M site; the site types index the
+ * electrostatics tables and the atom types (O = 0, H = 1) the dispersion tables.
+ */
+
+namespace MBPolWaterParameters {
+
+// MBPolTwoBodyForce cutoff_nm and MBPolThreeBodyForce cutoff_nm
+
+static const double twoBodyCutoff   = 0.65;
+static const double threeBodyCutoff = 0.45;
+
+// the average3 virtual site of the HOH residue: M = wO*O + wH*(H1 + H2)
+
+static const double virtualSiteWeightO = 0.573293118;
+static const double virtualSiteWeightH = 0.213353441;
+
+// MBPolElectrostaticsForce: charge, damping factor and polarizability of the O, H
+// and M types, and the Thole parameters charge-charge, charge-dipole, dipole-dipole,
+// dipole-dipole of the O-H bond and dipole-dipole of H-H, in the order of
+// TholeIndices (MBPolElectrostaticsForce.h)
+
+static const int siteType[4] = { 0, 1, 1, 2 };
+static const double siteCharge[3]        = { -5.1966000e-01, 2.5983000e-01, 0.0 };
+static const double siteDampingFactor[3] = { 0.00131, 0.000294, 0.00131 };
+static const double sitePolarity[3]      = { 0.00131, 0.000294, 0.0 };
+static const double thole[5]             = { 0.4, 0.4, 0.055, 0.626, 0.055 };
+
+// dispersion -C6*tt6(d6*r)/r^6 between the O and H atoms of different waters, from the
+// C6table and d6table of the force field script, with the Tang-Toennies damping
+// tt6(x) = 1 - exp(-x)*sum_{k=0..6} x^k/k!
+
+static const double dispersionC6[2][2] = { { 9.92951990e-4, 3.49345451e-4 }, { 3.49345451e-4, 8.40715638e-5 } };
+static const double dispersionD6[2][2] = { { 9.29548582e+01, 9.77520243e+01 }, { 9.77520243e+01, 9.40647517e+01 } };
+
+} // namespace MBPolWaterParameters
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MBPOL_WATER_PARAMETERS_H_
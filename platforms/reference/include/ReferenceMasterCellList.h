@@ -0,0 +1,140 @@
+#ifndef OPENMM_REFERENCE_MASTER_CELL_LIST_H_
+#define OPENMM_REFERENCE_MASTER_CELL_LIST_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/reference/ReferenceNeighborList.h"
+#include "openmm/internal/windowsExport.h"
+#include "ReferenceThreeNeighborList.h"
+#include <iosfwd>
+#include <mutex>
+#include <vector>
+
+using namespace OpenMM;
+
+namespace MBPolPlugin {
+
+/**
+ * Spatial index shared by all MBPol forces of a Context.
+ *
+ * Every force registers its molecules by one reference atom each (the oxygen) and
+ * the largest molecule-molecule distance it needs. The master list holds all pairs
+ * of reference atoms within that distance plus a skin; it is only rebuilt when a
+ * reference atom has moved by more than half the skin or the box has changed, so
+ * it is built at most once per step no matter how many forces use it. Each force
+ * then derives its own pair or triplet list by filtering the master pairs at its
+ * own cutoff with the current positions. The kernels may do so from several
+ * threads at once (see ReferenceMBPolTaskGraph).
+ */
+class OPENMM_EXPORT ReferenceMasterCellList {
+public:
+
+    ReferenceMasterCellList();
+
+    /**
+     * Get the master list shared by the kernels of a context, creating it if needed.
+     * Every acquire() must be matched by a release() with the same owner.
+     */
+    static ReferenceMasterCellList* acquire(const void* owner);
+
+    static void release(const void* owner);
+
+    /**
+     * Set the Verlet skin added to the largest registered cutoff (nm).
+     */
+    void setSkin(double skin);
+
+    double getSkin() const;
+
+    /**
+     * Register molecules by their reference atoms and the largest distance they will be queried at.
+     *
+     * @return false if the list was set up with a different periodicity; the caller must then build its own lists
+     */
+    bool addMolecules(const std::vector<int>& referenceAtoms, double cutoff, bool usePeriodic);
+
+    /**
+     * Largest registered cutoff plus skin.
+     */
+    double getListCutoff() const;
+
+    /**
+     * Rebuild the master pairs if any reference atom moved more than half the skin since the
+     * last build or the box changed.
+     *
+     * @param allPositions      positions of all atoms in the System
+     * @param periodicBoxSize   box size, ignored for non-periodic lists
+     * @return true if the list was rebuilt
+     */
+    bool update(const std::vector<RealVec>& allPositions, const RealVec& periodicBoxSize);
+
+    /**
+     * Pairs of molecules within cutoff.
+     *
+     * @param pairs           output, in molecule indices of the caller
+     * @param moleculeOfAtom  index of the caller's molecule for each reference atom of the System, -1 for atoms it does not use
+     * @param allPositions    positions of all atoms in the System
+     * @param cutoff          distance between reference atoms, at most the registered cutoff
+     */
+    void getPairs(NeighborList& pairs, const std::vector<int>& moleculeOfAtom,
+                  const std::vector<RealVec>& allPositions, double cutoff) const;
+
+    /**
+     * Triplets of molecules in the format of computeThreeNeighborListVoxelHash(): (i, j, k) with
+     * i > j > k, where j is within cutoff of both i and k.
+     */
+    void getTriplets(ThreeNeighborList& triplets, const std::vector<int>& moleculeOfAtom,
+                     const std::vector<RealVec>& allPositions, double cutoff) const;
+
+    /**
+     * Number of times the master pairs have been built.
+     */
+    int getNumBuilds() const;
+
+    /**
+     * Number of calls to update().
+     */
+    int getNumUpdates() const;
+
+    /**
+     * Write the last build (reference atoms, box, positions and pairs) for loadBuild();
+     * nothing useful is written before the first build.
+     */
+    void saveBuild(std::ostream& stream) const;
+
+    /**
+     * Read a build written by saveBuild(). The next update() takes it over instead of
+     * building the pairs again if it covers the molecules and cutoffs registered by then
+     * and has the same periodicity, and ignores it otherwise.
+     */
+    void loadBuild(std::istream& stream);
+
+private:
+
+    double distanceSquared(const RealVec& a, const RealVec& b) const;
+    void build(const std::vector<RealVec>& allPositions);
+
+    std::vector<int> referenceAtoms;
+    double maxCutoff;
+    double skin;
+    bool usePeriodic;
+    bool registered;
+    bool valid;
+    RealVec boxSize;
+    std::vector<RealVec> positionsAtBuild;
+    NeighborList masterPairs;
+    bool hasLoadedBuild;
+    std::vector<int> loadedReferenceAtoms;
+    double loadedListCutoff;
+    bool loadedUsePeriodic;
+    RealVec loadedBoxSize;
+    std::vector<RealVec> loadedPositionsAtBuild;
+    NeighborList loadedPairs;
+    int numBuilds;
+    int numUpdates;
+    int numOwners;
+    mutable std::mutex lock;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MASTER_CELL_LIST_H_
@@ -0,0 +1,123 @@
+#ifndef OPENMM_REFERENCE_MOLECULE_ORDERING_H_
+#define OPENMM_REFERENCE_MOLECULE_ORDERING_H_
+
+#include "openmm/reference/RealVec.h"
+#include "openmm/internal/windowsExport.h"
+#include <vector>
+
+using namespace OpenMM;
+
+namespace MBPolPlugin {
+
+// Compute a permutation of molecules that follows a Morton (Z-order) curve
+// through their reference positions (typically the oxygens).
+// order[k] is the original index of the k-th molecule along the curve.
+void OPENMM_EXPORT computeMortonOrder(std::vector<int>& order,
+                                      const std::vector<RealVec>& moleculePositions,
+                                      const RealVec& periodicBoxSize,
+                                      bool usePeriodic);
+
+/**
+ * Keeps the molecules of a many-body force in space-filling-curve order.
+ *
+ * Every reorderInterval calls to gather() the molecules are re-sorted along a
+ * Morton curve; in between the previous order is reused. gather() copies the
+ * sites of every molecule into a contiguous, sorted position buffer, so pair and
+ * triplet lists built on it touch neighbouring memory, and scatterForces() adds
+ * the forces accumulated in the sorted buffer back to the caller's atom order.
+ * The ordering is purely internal: energies and forces do not depend on it
+ * beyond floating point summation order.
+ */
+class OPENMM_EXPORT ReferenceMoleculeOrdering {
+public:
+
+    ReferenceMoleculeOrdering();
+
+    /**
+     * Set the number of evaluations between two re-sorts; 0 disables reordering.
+     */
+    void setReorderInterval(int interval);
+
+    int getReorderInterval() const;
+
+    /**
+     * Default interval used by newly created orderings.
+     */
+    static void setDefaultReorderInterval(int interval);
+
+    static int getDefaultReorderInterval();
+
+    /**
+     * Force a re-sort at the next call to gather().
+     */
+    void invalidate();
+
+    /**
+     * Update the order if due and copy the sites of all molecules into the sorted buffer.
+     *
+     * @param allPositions         positions of all atoms in the System
+     * @param allParticleIndices   allParticleIndices[molecule][site], the first site is used for sorting
+     * @param periodicBoxSize      box size, used when usePeriodic is set
+     * @param usePeriodic          wrap positions into the box before sorting
+     */
+    void gather(const std::vector<RealVec>& allPositions,
+                const std::vector<std::vector<int> >& allParticleIndices,
+                const RealVec& periodicBoxSize, bool usePeriodic);
+
+    /**
+     * Sorted site positions, molecule after molecule.
+     */
+    const std::vector<RealVec>& getPositions() const;
+
+    /**
+     * Positions of the first site of every sorted molecule.
+     */
+    const std::vector<RealVec>& getReferencePositions() const;
+
+    /**
+     * Indices into getPositions()/getForces() with the layout of allParticleIndices.
+     */
+    const std::vector<std::vector<int> >& getLocalParticleIndices() const;
+
+    /**
+     * Zeroed force buffer matching getPositions().
+     */
+    std::vector<RealVec>& getForces();
+
+    /**
+     * order[k] is the original index of the k-th sorted molecule.
+     */
+    const std::vector<int>& getOrder() const;
+
+    /**
+     * inverseOrder[m] is the sorted index of original molecule m.
+     */
+    const std::vector<int>& getInverseOrder() const;
+
+    /**
+     * Add the forces accumulated in getForces() into forces, in the original atom order.
+     */
+    void scatterForces(std::vector<RealVec>& forces) const;
+
+    /**
+     * Number of re-sorts performed so far.
+     */
+    int getNumReorders() const;
+
+private:
+    static int defaultReorderInterval;
+    int reorderInterval;
+    int callsSinceReorder;
+    int numReorders;
+    std::vector<int> order;
+    std::vector<int> inverseOrder;
+    std::vector<int> atomIndices;
+    std::vector<RealVec> positions;
+    std::vector<RealVec> referencePositions;
+    std::vector<RealVec> forces;
+    std::vector<std::vector<int> > localParticleIndices;
+};
+
+} // namespace MBPolPlugin
+
+#endif // OPENMM_REFERENCE_MOLECULE_ORDERING_H_
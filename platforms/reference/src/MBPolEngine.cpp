@@ -0,0 +1,631 @@
+#include "openmm/MBPolEngine.h"
+#include "openmm/MBPolElectrostaticsForce.h"
+#include "MBPolReferenceOneBodyForce.h"
+#include "MBPolReferenceTwoBodyForce.h"
+#include "MBPolReferenceThreeBodyForce.h"
+#include "MBPolReferenceElectrostaticsForce.h"
+#include "ReferenceMasterCellList.h"
+#include "ReferenceThreeNeighborList.h"
+#include "ReferenceMBPolParallel.h"
+#include "ReferenceMBPolTimers.h"
+#include "ReferenceMBPolWaterParameters.h"
+#include "openmm/reference/ReferenceNeighborList.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include "openmm/internal/NonbondedForceImpl.h"
+#include <cmath>
+#include <set>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+namespace MBPolPlugin {
+
+using namespace MBPolWaterParameters;
+
+// the pair lists of the electrostatics are taken from the oxygens' list if no site is further
+// than this from its oxygen, as in ReferenceCalcMBPolElectrostaticsForceKernel; the induced
+// dipoles of the previous evaluation are the starting point if no site moved by more than
+// warmStartDistance
+
+static const double maxSiteDistance   = 0.15;
+static const double warmStartDistance = 0.02;
+
+// the terms are evaluated concurrently, each into its own buffers
+
+enum EngineTerm { OneBodyTerm = MBPolEngine::OneBody, TwoBodyTerm = MBPolEngine::TwoBody, ThreeBodyTerm = MBPolEngine::ThreeBody,
+                  ElectrostaticsTerm = MBPolEngine::Electrostatics, DispersionTerm = MBPolEngine::Dispersion,
+                  NumEngineTerms = MBPolEngine::NumTerms };
+
+class MBPolEngineImpl {
+public:
+
+    explicit MBPolEngineImpl(int numWaters);
+
+    ~MBPolEngineImpl();
+
+    int getNumNeighborListBuilds() const {
+        return (cellList == NULL ? 0 : cellList->getNumBuilds());
+    }
+
+    double compute(const double* positions, double* forces, double* virial);
+
+    double getTermEnergy(int term) const {
+        return termEnergies[term];
+    }
+
+    void clearInducedDipoleGuess() {
+        lastInducedDipole.clear();
+    }
+
+    int numWaters;
+    RealVec box;
+    bool usePBC;
+    double cutoffDistance;
+    double ewaldErrorTolerance;
+    double mutualInducedTargetEpsilon;
+    bool inducedDipoleWarmStart;
+    int numWarmStarts;
+
+private:
+
+    void updatePmeParameters();
+    void updateNeighborLists();
+    void setInducedDipoleGuess(MBPolReferenceElectrostaticsForce& force);
+    double computeTerm(int term, vector<RealVec>& forceData, vector<RealVec>& virialData);
+    double computeElectrostatics(vector<RealVec>& forceData, vector<RealVec>& virialData);
+    double computeDispersion(vector<RealVec>& forceData, vector<RealVec>& virialData) const;
+    void getPeriodicDelta(RealVec& delta) const;
+
+    // four sites per water: O, H, H, M
+
+    vector<RealVec> sites;
+    vector<vector<int> > waterSites;
+    vector<RealOpenMM> charges;
+    vector<RealOpenMM> dampingFactors;
+    vector<RealOpenMM> polarity;
+    vector<RealOpenMM> tholes;
+    vector<RealOpenMM> tholeParameters;
+    vector<int> moleculeIndices;
+    vector<int> atomTypes;
+
+    // the pair lists of an evaluation, filtered from a Verlet list of the oxygens that is
+    // kept between evaluations
+
+    ReferenceMasterCellList* cellList;
+    double cellListCutoff;
+    bool cellListPeriodic;
+    vector<int> waterOfSite;
+    vector<set<int> > noSiteExclusions;
+    NeighborList waterPairs;
+    ThreeNeighborList waterTriplets;
+    NeighborList sitePairs;
+
+    // converged induced dipoles of the previous evaluation
+
+    vector<RealVec> lastInducedDipole;
+    vector<RealVec> lastInducedDipolePolar;
+    vector<RealVec> lastSites;
+    RealVec lastBox;
+
+    vector<vector<RealVec> > termForces;
+    vector<vector<RealVec> > termVirials;
+    vector<double> termEnergies;
+    bool computeVirial;
+
+    RealVec pmeBox;
+    double pmeCutoffDistance;
+    double pmeErrorTolerance;
+    double alphaEwald;
+    vector<int> pmeGridDimension;
+};
+
+MBPolEngineImpl::MBPolEngineImpl(int numWaters) : numWaters(numWaters), box(0.0, 0.0, 0.0), usePBC(false),
+                  cutoffDistance(0.9), ewaldErrorTolerance(1.0e-4), mutualInducedTargetEpsilon(1.0e-7),
+                  inducedDipoleWarmStart(false), numWarmStarts(0), cellList(NULL), cellListCutoff(0.0), cellListPeriodic(false), lastBox(0.0, 0.0, 0.0), computeVirial(false),
+                  pmeBox(0.0, 0.0, 0.0), pmeCutoffDistance(0.0), pmeErrorTolerance(0.0), alphaEwald(0.0), pmeGridDimension(3, 0) {
+
+    if( numWaters < 1 ){
+        throw OpenMMException("MBPolEngine: the number of waters must be positive");
+    }
+    int numSites = 4*numWaters;
+    sites.resize(numSites);
+    waterSites.resize(numWaters, vector<int>(3));
+    charges.resize(numSites);
+    dampingFactors.resize(numSites);
+    polarity.resize(numSites);
+    moleculeIndices.resize(numSites);
+    atomTypes.resize(numSites);
+    for( int m = 0; m < numWaters; m++ ){
+        for( int s = 0; s < 4; s++ ){
+            int site             = 4*m + s;
+            charges[site]        = siteCharge[siteType[s]];
+            dampingFactors[site] = siteDampingFactor[siteType[s]];
+            polarity[site]       = sitePolarity[siteType[s]];
+            moleculeIndices[site] = m;
+            atomTypes[site]      = siteType[s];
+            if( s < 3 ){
+                waterSites[m][s] = site;
+            }
+        }
+    }
+    tholeParameters.assign(thole, thole + 5);
+
+    waterOfSite.assign(numSites, -1);
+    for( int m = 0; m < numWaters; m++ ){
+        waterOfSite[4*m] = m;
+    }
+    noSiteExclusions.resize(numSites);
+    termForces.resize(NumEngineTerms, vector<RealVec>(numSites));
+    termVirials.resize(NumEngineTerms, vector<RealVec>(3));
+    termEnergies.resize(NumEngineTerms);
+}
+
+MBPolEngineImpl::~MBPolEngineImpl() {
+    delete cellList;
+}
+
+void MBPolEngineImpl::getPeriodicDelta(RealVec& delta) const {
+    if( usePBC ){
+        for( int d = 0; d < 3; d++ ){
+            delta[d] -= box[d]*floor(delta[d]/box[d] + 0.5);
+        }
+    }
+}
+
+void MBPolEngineImpl::updatePmeParameters() {
+
+    // as MBPolElectrostaticsForce without an Ewald parameter: chosen by OpenMM for the tolerance
+
+    if( pmeBox[0] == box[0] && pmeBox[1] == box[1] && pmeBox[2] == box[2] &&
+        pmeCutoffDistance == cutoffDistance && pmeErrorTolerance == ewaldErrorTolerance ){
+        return;
+    }
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(box[0], 0.0, 0.0), Vec3(0.0, box[1], 0.0), Vec3(0.0, 0.0, box[2]));
+    NonbondedForce nb;
+    nb.setEwaldErrorTolerance(ewaldErrorTolerance);
+    nb.setCutoffDistance(cutoffDistance);
+    NonbondedForceImpl::calcPMEParameters(system, nb, alphaEwald, pmeGridDimension[0], pmeGridDimension[1], pmeGridDimension[2]);
+    pmeBox            = box;
+    pmeCutoffDistance = cutoffDistance;
+    pmeErrorTolerance = ewaldErrorTolerance;
+}
+
+double MBPolEngineImpl::compute(const double* positions, double* forces, double* virial) {
+
+    if( usePBC ){
+        double minAllowedSize = 1.999999*cutoffDistance;
+        if( box[0] < minAllowedSize || box[1] < minAllowedSize || box[2] < minAllowedSize ){
+            throw OpenMMException("MBPolEngine: the periodic box size is less than twice the cutoff.");
+        }
+        updatePmeParameters();
+    }
+
+    // sites of the caller's atoms, the M site as in mbpol.xml
+
+    for( int m = 0; m < numWaters; m++ ){
+        const double* water = positions + 9*m;
+        for( int s = 0; s < 3; s++ ){
+            sites[4*m+s] = RealVec(water[3*s], water[3*s+1], water[3*s+2]);
+        }
+        sites[4*m+3] = sites[4*m]*virtualSiteWeightO + (sites[4*m+1] + sites[4*m+2])*virtualSiteWeightH;
+    }
+
+    {
+        ReferenceMBPolTimers::Scope timer("Engine.neighborList");
+        updateNeighborLists();
+    }
+
+    computeVirial = (virial != NULL);
+    ReferenceMBPolParallel::parallelFor(NumEngineTerms, [&](int term) {
+        termForces[term].assign(sites.size(), RealVec(0.0, 0.0, 0.0));
+        termVirials[term].assign(3, RealVec(0.0, 0.0, 0.0));
+        termEnergies[term] = computeTerm(term, termForces[term], termVirials[term]);
+    });
+
+    // sum the terms in a fixed order; the force on M is passed on to O, H and H
+
+    double energy = 0.0;
+    for( int term = 0; term < NumEngineTerms; term++ ){
+        energy += termEnergies[term];
+    }
+    if( forces ){
+        for( int m = 0; m < numWaters; m++ ){
+            RealVec siteForces[4];
+            for( int s = 0; s < 4; s++ ){
+                siteForces[s] = RealVec(0.0, 0.0, 0.0);
+                for( int term = 0; term < NumEngineTerms; term++ ){
+                    siteForces[s] += termForces[term][4*m+s];
+                }
+            }
+            siteForces[0] += siteForces[3]*virtualSiteWeightO;
+            siteForces[1] += siteForces[3]*virtualSiteWeightH;
+            siteForces[2] += siteForces[3]*virtualSiteWeightH;
+            for( int s = 0; s < 3; s++ ){
+                for( int d = 0; d < 3; d++ ){
+                    forces[9*m+3*s+d] = siteForces[s][d];
+                }
+            }
+        }
+    }
+
+    // r_M f_M = sum_k w_k r_k f_M, so the virial of the sites is that of the atoms
+
+    if( virial ){
+        for( int a = 0; a < 3; a++ ){
+            for( int b = 0; b < 3; b++ ){
+                double sum = 0.0;
+                for( int term = 0; term < NumEngineTerms; term++ ){
+                    sum += termVirials[term][a][b];
+                }
+                virial[3*a+b] = sum;
+            }
+        }
+    }
+    return energy;
+}
+
+void MBPolEngineImpl::updateNeighborLists() {
+
+    // one Verlet list of the oxygens serves all terms; it is rebuilt only once an oxygen has
+    // moved by half its skin. The polynomials vanish beyond their cutoffs, so the lists give
+    // the exact energy of a cluster too
+
+    double listCutoff = std::max(twoBodyCutoff, threeBodyCutoff);
+    if( usePBC ){
+        listCutoff = std::max(listCutoff, cutoffDistance + 2.0*maxSiteDistance);
+    }
+    if( cellList == NULL || cellListCutoff != listCutoff || cellListPeriodic != usePBC ){
+        delete cellList;
+        cellList = new ReferenceMasterCellList();
+        vector<int> oxygens(numWaters);
+        for( int m = 0; m < numWaters; m++ ){
+            oxygens[m] = 4*m;
+        }
+        cellList->addMolecules(oxygens, listCutoff, usePBC);
+        cellListCutoff   = listCutoff;
+        cellListPeriodic = usePBC;
+    }
+    cellList->update(sites, box);
+    cellList->getPairs(waterPairs, waterOfSite, sites, twoBodyCutoff);
+    cellList->getTriplets(waterTriplets, waterOfSite, sites, threeBodyCutoff);
+    if( !usePBC ){
+        return;
+    }
+
+    // waters whose oxygens are within cutoff + 2*siteDistance contain all site pairs within the cutoff
+
+    double siteDistance = 0.0;
+    for( int m = 0; m < numWaters; m++ ){
+        for( int s = 1; s < 4; s++ ){
+            RealVec delta = sites[4*m+s] - sites[4*m];
+            getPeriodicDelta(delta);
+            siteDistance = std::max(siteDistance, (double) sqrt(delta.dot(delta)));
+        }
+    }
+    sitePairs.clear();
+    if( siteDistance > maxSiteDistance ){
+#if OPENMM_MAJOR_VERSION == 6 && OPENMM_MINOR_VERSION <= 2
+        computeNeighborListVoxelHash(sitePairs, sites.size(), sites, noSiteExclusions, box, true, cutoffDistance, 0.0, false);
+#else
+        RealVec boxVectors[3] = { RealVec(box[0], 0.0, 0.0), RealVec(0.0, box[1], 0.0), RealVec(0.0, 0.0, box[2]) };
+        computeNeighborListVoxelHash(sitePairs, sites.size(), sites, noSiteExclusions, boxVectors, true, cutoffDistance, 0.0, false);
+#endif
+        return;
+    }
+    NeighborList candidateWaterPairs;
+    cellList->getPairs(candidateWaterPairs, waterOfSite, sites, cutoffDistance + 2.0*siteDistance);
+    for( int m = 0; m < numWaters; m++ ){
+        for( int s = 0; s < 4; s++ ){
+            for( int t = s+1; t < 4; t++ ){
+                sitePairs.push_back(AtomPair(4*m+s, 4*m+t));
+            }
+        }
+    }
+    for( unsigned int ii = 0; ii < candidateWaterPairs.size(); ii++ ){
+        int first  = 4*candidateWaterPairs[ii].first;
+        int second = 4*candidateWaterPairs[ii].second;
+        for( int s = 0; s < 4; s++ ){
+            for( int t = 0; t < 4; t++ ){
+                sitePairs.push_back(AtomPair(first+s, second+t));
+            }
+        }
+    }
+}
+
+double MBPolEngineImpl::computeTerm(int term, vector<RealVec>& forceData, vector<RealVec>& virialData) {
+
+    switch( term ){
+
+        case OneBodyTerm: {
+            MBPolReferenceOneBodyForce force;
+            if( usePBC ){
+                force.setNonbondedMethod(MBPolReferenceOneBodyForce::Periodic);
+                force.setPeriodicBox(box);
+            }
+            ReferenceMBPolTimers::Scope timer("OneBody.polynomial");
+            return force.calculateForceAndEnergy(numWaters, sites, waterSites, forceData, &virialData);
+        }
+
+        case TwoBodyTerm: {
+            MBPolReferenceTwoBodyForce force;
+            force.setCutoff(twoBodyCutoff);
+            if( usePBC ){
+                force.setNonbondedMethod(MBPolReferenceTwoBodyForce::CutoffPeriodic);
+                force.setPeriodicBox(box);
+            } else {
+                force.setNonbondedMethod(MBPolReferenceTwoBodyForce::CutoffNonPeriodic);
+            }
+            ReferenceMBPolTimers::Scope timer("TwoBody.polynomial");
+            return force.calculateForceAndEnergy(numWaters, sites, waterSites, waterPairs, forceData, &virialData);
+        }
+
+        case ThreeBodyTerm: {
+            MBPolReferenceThreeBodyForce force;
+            force.setCutoff(threeBodyCutoff);
+            if( usePBC ){
+                force.setNonbondedMethod(MBPolReferenceThreeBodyForce::CutoffPeriodic);
+                force.setPeriodicBox(box);
+            } else {
+                force.setNonbondedMethod(MBPolReferenceThreeBodyForce::CutoffNonPeriodic);
+            }
+            ReferenceMBPolTimers::Scope timer("ThreeBody.polynomial");
+            return force.calculateForceAndEnergy(numWaters, sites, waterSites, waterTriplets, forceData, &virialData);
+        }
+
+        case ElectrostaticsTerm:
+            return computeElectrostatics(forceData, virialData);
+
+        case DispersionTerm: {
+            ReferenceMBPolTimers::Scope timer("Engine.dispersion");
+            return computeDispersion(forceData, virialData);
+        }
+    }
+    return 0.0;
+}
+
+double MBPolEngineImpl::computeElectrostatics(vector<RealVec>& forceData, vector<RealVec>& virialData) {
+
+    // as ReferenceCalcMBPolElectrostaticsForceKernel::setupMBPolReferenceElectrostaticsForce()
+
+    MBPolReferenceElectrostaticsForce* force = NULL;
+    if( usePBC ){
+        MBPolReferencePmeElectrostaticsForce* pmeForce = new MBPolReferencePmeElectrostaticsForce();
+        pmeForce->setAlphaEwald(alphaEwald);
+        pmeForce->setCutoffDistance(cutoffDistance);
+        pmeForce->setPmeGridDimensions(pmeGridDimension);
+        pmeForce->setPeriodicBoxSize(box);
+        pmeForce->setDirectSpaceCandidatePairs(sitePairs);
+        pmeForce->setDeferReciprocalSpaceVirial(!computeVirial);
+        force = pmeForce;
+    } else {
+        force = new MBPolReferenceElectrostaticsForce(MBPolReferenceElectrostaticsForce::NoCutoff);
+    }
+    force->setMutualInducedDipoleTargetEpsilon(mutualInducedTargetEpsilon);
+    force->setMaximumMutualInducedDipoleIterations(200);
+    force->setIncludeChargeRedistribution(true);
+    force->setTholeParameters(tholeParameters);
+    if( inducedDipoleWarmStart ){
+        setInducedDipoleGuess(*force);
+    }
+
+    RealOpenMM energy;
+    try {
+        energy = force->calculateForceAndEnergy(sites, charges, moleculeIndices, atomTypes, tholes,
+                                                dampingFactors, polarity, forceData);
+    } catch (...) {
+        delete force;
+        lastInducedDipole.clear();
+        throw;
+    }
+    for( int a = 0; a < 3; a++ ){
+        virialData[a] += force->getVirial()[a];
+    }
+    if( inducedDipoleWarmStart ){
+        lastInducedDipole      = force->getInducedDipoles();
+        lastInducedDipolePolar = force->getInducedDipolesPolar();
+        lastSites              = sites;
+        lastBox                = box;
+    }
+    delete force;
+    return static_cast<double>(energy);
+}
+
+void MBPolEngineImpl::setInducedDipoleGuess(MBPolReferenceElectrostaticsForce& force) {
+
+    // as ReferenceCalcMBPolElectrostaticsForceKernel::setInducedDipoleGuess(): consecutive
+    // steps of a trajectory, or a volume move that scales the waters with the box
+
+    if( lastInducedDipole.size() != sites.size() || (lastBox[0] > 0.0) != usePBC ){
+        return;
+    }
+    RealVec scale(1.0, 1.0, 1.0);
+    if( usePBC ){
+        for( int d = 0; d < 3; d++ ){
+            scale[d] = box[d]/lastBox[d];
+        }
+    }
+    double maxDistance2 = warmStartDistance*warmStartDistance;
+    for( unsigned int ii = 0; ii < sites.size(); ii++ ){
+        RealVec delta(sites[ii][0] - lastSites[ii][0]*scale[0],
+                      sites[ii][1] - lastSites[ii][1]*scale[1],
+                      sites[ii][2] - lastSites[ii][2]*scale[2]);
+        if( delta.dot(delta) > maxDistance2 ){
+            return;
+        }
+    }
+    force.setInitialInducedDipoles(lastInducedDipole, lastInducedDipolePolar);
+    numWarmStarts++;
+}
+
+// dispersion energy of an O or H pair of different waters; adds the force on the second site
+
+static double computeDispersionPair(int typeI, int typeJ, const RealVec& delta, RealVec& force) {
+
+    double r2       = delta.dot(delta);
+    double r        = sqrt(r2);
+    double c6       = dispersionC6[typeI][typeJ];
+    double d6       = dispersionD6[typeI][typeJ];
+    double x        = d6*r;
+    double expX     = exp(-x);
+
+    // tt6 = 1 - exp(-x)*sum_{k<=6} x^k/k!, dtt6/dx = exp(-x)*x^6/6!
+
+    double term     = 1.0;
+    double sum      = 1.0;
+    for( int k = 1; k <= 6; k++ ){
+        term *= x/k;
+        sum  += term;
+    }
+    double tt6      = 1.0 - expX*sum;
+    double r6I      = 1.0/(r2*r2*r2);
+    double dEdr     = c6*r6I*(6.0*tt6/r - d6*expX*term);
+    force           = delta*(-dEdr/r);
+    return -c6*tt6*r6I;
+}
+
+double MBPolEngineImpl::computeDispersion(vector<RealVec>& forceData, vector<RealVec>& virialData) const {
+
+    // periodic: the pairs within the cutoff, without a long range correction, as the
+    // CutoffPeriodic CustomNonbondedForce of mbpol.xml; cluster: all pairs
+
+    NeighborList clusterPairs;
+    if( !usePBC ){
+        for( int ii = 0; ii < numWaters; ii++ ){
+            for( int jj = ii+1; jj < numWaters; jj++ ){
+                for( int s = 0; s < 3; s++ ){
+                    for( int t = 0; t < 3; t++ ){
+                        clusterPairs.push_back(AtomPair(4*ii+s, 4*jj+t));
+                    }
+                }
+            }
+        }
+    }
+    const NeighborList& pairs = usePBC ? sitePairs : clusterPairs;
+
+    double energy  = 0.0;
+    double cutoff2 = cutoffDistance*cutoffDistance;
+    for( unsigned int pair = 0; pair < pairs.size(); pair++ ){
+        int ii    = pairs[pair].first;
+        int jj    = pairs[pair].second;
+        int typeI = siteType[ii % 4];
+        int typeJ = siteType[jj % 4];
+        if( ii/4 == jj/4 || typeI > 1 || typeJ > 1 ){
+            continue;
+        }
+        RealVec delta = sites[jj] - sites[ii];
+        getPeriodicDelta(delta);
+        if( usePBC && delta.dot(delta) > cutoff2 ){
+            continue;
+        }
+        RealVec force;
+        energy        += computeDispersionPair(typeI, typeJ, delta, force);
+        forceData[ii] -= force;
+        forceData[jj] += force;
+        for( int a = 0; a < 3; a++ ){
+            virialData[a] += force*delta[a];
+        }
+    }
+    return energy;
+}
+
+MBPolEngine::MBPolEngine(int numWaters) : impl(new MBPolEngineImpl(numWaters)) {
+}
+
+MBPolEngine::~MBPolEngine() {
+    delete impl;
+}
+
+int MBPolEngine::getNumWaters() const {
+    return impl->numWaters;
+}
+
+int MBPolEngine::getNumAtoms() const {
+    return 3*impl->numWaters;
+}
+
+void MBPolEngine::setBox(double x, double y, double z) {
+    if( x < 0.0 || y < 0.0 || z < 0.0 || ((x == 0.0 || y == 0.0 || z == 0.0) && !(x == 0.0 && y == 0.0 && z == 0.0)) ){
+        throw OpenMMException("MBPolEngine: the box edges must all be positive, or all zero for a cluster");
+    }
+    impl->box    = RealVec(x, y, z);
+    impl->usePBC = (x > 0.0);
+}
+
+void MBPolEngine::getBox(double& x, double& y, double& z) const {
+    x = impl->box[0];
+    y = impl->box[1];
+    z = impl->box[2];
+}
+
+bool MBPolEngine::usesPeriodicBoundaryConditions() const {
+    return impl->usePBC;
+}
+
+void MBPolEngine::setCutoffDistance(double distance) {
+    if( distance <= 0.0 ){
+        throw OpenMMException("MBPolEngine: the cutoff distance must be positive");
+    }
+    impl->cutoffDistance = distance;
+}
+
+double MBPolEngine::getCutoffDistance() const {
+    return impl->cutoffDistance;
+}
+
+void MBPolEngine::setEwaldErrorTolerance(double tolerance) {
+    if( tolerance <= 0.0 ){
+        throw OpenMMException("MBPolEngine: the Ewald error tolerance must be positive");
+    }
+    impl->ewaldErrorTolerance = tolerance;
+}
+
+double MBPolEngine::getEwaldErrorTolerance() const {
+    return impl->ewaldErrorTolerance;
+}
+
+void MBPolEngine::setMutualInducedTargetEpsilon(double epsilon) {
+    if( epsilon <= 0.0 ){
+        throw OpenMMException("MBPolEngine: the induced dipole convergence criterion must be positive");
+    }
+    impl->mutualInducedTargetEpsilon = epsilon;
+}
+
+double MBPolEngine::getMutualInducedTargetEpsilon() const {
+    return impl->mutualInducedTargetEpsilon;
+}
+
+void MBPolEngine::setInducedDipoleWarmStart(bool warmStart) {
+    impl->inducedDipoleWarmStart = warmStart;
+    if( !warmStart ){
+        impl->clearInducedDipoleGuess();
+    }
+}
+
+bool MBPolEngine::getInducedDipoleWarmStart() const {
+    return impl->inducedDipoleWarmStart;
+}
+
+double MBPolEngine::compute(const double* positions, double* forces, double* virial) {
+    return impl->compute(positions, forces, virial);
+}
+
+double MBPolEngine::getTermEnergy(Term term) const {
+    if( term < 0 || term >= NumTerms ){
+        throw OpenMMException("MBPolEngine: invalid term");
+    }
+    return impl->getTermEnergy(term);
+}
+
+int MBPolEngine::getNumNeighborListBuilds() const {
+    return impl->getNumNeighborListBuilds();
+}
+
+int MBPolEngine::getNumInducedDipoleWarmStarts() const {
+    return impl->numWarmStarts;
+}
+
+} // namespace MBPolPlugin
@@ -23,7 +23,10 @@
  */
 
 #include "MBPolReferenceElectrostaticsForce.h"
+#include "ReferenceMBPolFixedPoint.h"
+#include "ReferenceMBPolTimers.h"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <cstdio>
 #include <ctime>
@@ -42,6 +45,12 @@ using OpenMM::RealVec;
 
 const RealOpenMM EXPGAMM = EXP(ttm::gammln(3.0/4.0));
 
+// the Thole damping is skipped for pairs of different waters at least the damping distance apart,
+// where gamma*(r/A)^4 >= dampingExponent (see computeDampingDistance)
+
+static const RealOpenMM dampingExponent          = 50.0;
+static const RealOpenMM unboundedDampingDistance = 1.0e+50;
+
 #undef MBPOL_DEBUG
 
 MBPolReferenceElectrostaticsForce::MBPolReferenceElectrostaticsForce( ) :
@@ -56,13 +65,19 @@ MBPolReferenceElectrostaticsForce::MBPolReferenceElectrostaticsForce( ) :
                                                    _mutualInducedDipoleTargetEpsilon(1.0e-04),
                                                    _polarSOR(0.55),
                                                    _debye(48.033324),
-                                                   _includeChargeRedistribution(true)
+                                                   _includeChargeRedistribution(true),
+                                                   _shortRangeOnly(false),
+                                                   _splitDistance(0.45),
+                                                   _splitWidth(0.1),
+                                                   _virial(3, RealVec(0.0, 0.0, 0.0)),
+                                                   _includeEnergyDecomposition(false),
+                                                   _scheduler(NULL)
 {
     initialize();
 }
 
 MBPolReferenceElectrostaticsForce::MBPolReferenceElectrostaticsForce( NonbondedMethod nonbondedMethod ) :
-                                                   _nonbondedMethod(NoCutoff),
+                                                   _nonbondedMethod(nonbondedMethod),
                                                    _numParticles(0),
                                                    _electric(138.9354558456),
                                                    _dielectric(1.0),
@@ -73,13 +88,20 @@ MBPolReferenceElectrostaticsForce::MBPolReferenceElectrostaticsForce( NonbondedM
                                                    _mutualInducedDipoleTargetEpsilon(1.0e-04),
                                                    _polarSOR(0.55),
                                                    _debye(48.033324),
-                                                   _includeChargeRedistribution(true)
+                                                   _includeChargeRedistribution(true),
+                                                   _shortRangeOnly(false),
+                                                   _splitDistance(0.45),
+                                                   _splitWidth(0.1),
+                                                   _virial(3, RealVec(0.0, 0.0, 0.0)),
+                                                   _includeEnergyDecomposition(false),
+                                                   _scheduler(NULL)
 {
     initialize();
 }
 
 void MBPolReferenceElectrostaticsForce::initialize( void )
 {
+    _dampingDistance = unboundedDampingDistance;
     return;
 }
 
@@ -102,6 +124,109 @@ bool MBPolReferenceElectrostaticsForce::getIncludeChargeRedistribution( void ) c
     return _includeChargeRedistribution;
 }
 
+RealOpenMM MBPolReferenceElectrostaticsForce::getDampingDistance( void ) const
+{
+    return _dampingDistance;
+}
+
+const std::vector<RealVec>& MBPolReferenceElectrostaticsForce::getVirial( void ) const
+{
+    return _virial;
+}
+
+void MBPolReferenceElectrostaticsForce::setIncludeEnergyDecomposition( bool includeEnergyDecomposition )
+{
+    _includeEnergyDecomposition = includeEnergyDecomposition;
+}
+
+bool MBPolReferenceElectrostaticsForce::getIncludeEnergyDecomposition( void ) const
+{
+    return _includeEnergyDecomposition;
+}
+
+void MBPolReferenceElectrostaticsForce::setScheduler( ReferenceMBPolScheduler* scheduler )
+{
+    _scheduler = scheduler;
+}
+
+bool MBPolReferenceElectrostaticsForce::_useInducedDipolePairTable = true;
+
+void MBPolReferenceElectrostaticsForce::setUseInducedDipolePairTable( bool usePairTable )
+{
+    _useInducedDipolePairTable = usePairTable;
+}
+
+bool MBPolReferenceElectrostaticsForce::getUseInducedDipolePairTable( void )
+{
+    return _useInducedDipolePairTable;
+}
+
+const std::vector<RealOpenMM>& MBPolReferenceElectrostaticsForce::getPermanentPotentials( void ) const
+{
+    return _permanentPotential;
+}
+
+const std::vector<RealOpenMM>& MBPolReferenceElectrostaticsForce::getInducedPotentials( void ) const
+{
+    return _inducedPotential;
+}
+
+const std::vector<RealOpenMM>& MBPolReferenceElectrostaticsForce::getSiteCharges( void ) const
+{
+    return _siteCharges;
+}
+
+void MBPolReferenceElectrostaticsForce::recordSitePotentials( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                              const std::vector<RealOpenMM>& permanentPotential,
+                                                              const std::vector<RealOpenMM>& inducedPotential )
+{
+    if( !_includeEnergyDecomposition ){
+        return;
+    }
+    RealOpenMM f = _electric/_dielectric;
+    _permanentPotential.resize( particleData.size() );
+    _inducedPotential.resize( particleData.size() );
+    _siteCharges.resize( particleData.size() );
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        _permanentPotential[ii] = f*permanentPotential[ii];
+        _inducedPotential[ii]   = f*inducedPotential[ii];
+        _siteCharges[ii]        = particleData[ii].charge;
+    }
+}
+
+void MBPolReferenceElectrostaticsForce::setInitialInducedDipoles( const std::vector<RealVec>& inducedDipole,
+                                                                   const std::vector<RealVec>& inducedDipolePolar )
+{
+    _initialInducedDipole      = inducedDipole;
+    _initialInducedDipolePolar = inducedDipolePolar;
+}
+
+const std::vector<RealVec>& MBPolReferenceElectrostaticsForce::getInducedDipoles( void ) const
+{
+    return _inducedDipole;
+}
+
+const std::vector<RealVec>& MBPolReferenceElectrostaticsForce::getInducedDipolesPolar( void ) const
+{
+    return _inducedDipolePolar;
+}
+
+void MBPolReferenceElectrostaticsForce::setShortRangeOnly( bool shortRangeOnly )
+{
+    _shortRangeOnly = shortRangeOnly;
+}
+
+bool MBPolReferenceElectrostaticsForce::getShortRangeOnly( void ) const
+{
+    return _shortRangeOnly;
+}
+
+void MBPolReferenceElectrostaticsForce::setShortRangeSplit( RealOpenMM splitDistance, RealOpenMM splitWidth )
+{
+    _splitDistance = splitDistance;
+    _splitWidth    = splitWidth;
+}
+
 int MBPolReferenceElectrostaticsForce::getMutualInducedDipoleConverged( void ) const
 {
     return _mutualInducedDipoleConverged;
@@ -208,6 +333,24 @@ void MBPolReferenceElectrostaticsForce::loadParticleData( const std::vector<Real
         particleData[ii].polarity             = polarity[ii];
 
     }
+
+    // the oxygen of every water, for the switch of the short-range part; the first
+    // site stands in for it in a molecule without one
+
+    std::vector<int> moleculeOxygen;
+    for( unsigned int ii = 0; ii < _numParticles; ii++ ){
+        unsigned int molecule = particleData[ii].moleculeIndex;
+        if( molecule >= moleculeOxygen.size() ){
+            moleculeOxygen.resize( molecule+1, -1 );
+        }
+        if( moleculeOxygen[molecule] < 0 || (particleData[ii].atomType == 0 && particleData[moleculeOxygen[molecule]].atomType != 0) ){
+            moleculeOxygen[molecule] = ii;
+        }
+    }
+    for( unsigned int ii = 0; ii < _numParticles; ii++ ){
+        particleData[ii].oxygenIndex    = moleculeOxygen[particleData[ii].moleculeIndex];
+        particleData[ii].oxygenPosition = particlePositions[particleData[ii].oxygenIndex];
+    }
 }
 
 void MBPolReferenceElectrostaticsForce::zeroFixedElectrostaticsFields( void )
@@ -283,6 +426,12 @@ RealOpenMM MBPolReferenceElectrostaticsForce::getAndScaleInverseRs(  const Elect
         }
     }
 
+    // undamped beyond the damping distance
+
+    if( !isSameWater && r >= _dampingDistance ){
+        return rrI;
+    }
+
     std::vector<RealOpenMM> thole = getTholeParameters();
 
     RealOpenMM pgamma = thole[interactionType];
@@ -341,6 +490,11 @@ void MBPolReferenceElectrostaticsForce::getAndScaleInverseRs13justScaleTCC(  con
  * of interaction between an atom and the other size in the second atom water molecule.
  */
 
+    if( r >= _dampingDistance ){
+        *scale3 = 1.;
+        *scale1 = 1.;
+        return;
+    }
 
     RealOpenMM damp      = pow(particleI.dampingFactor*particleK.dampingFactor, 1/6.); // AA in MBPol
 
@@ -358,6 +512,95 @@ void MBPolReferenceElectrostaticsForce::getAndScaleInverseRs13justScaleTCC(  con
 
 }
 
+void MBPolReferenceElectrostaticsForce::computeDampingDistance( const std::vector<ElectrostaticsParticleData>& particleData )
+{
+
+    // A = (a_i a_k)^(1/6) is largest for the largest damping factor; only the intermolecular
+    // Thole parameters matter
+
+    RealOpenMM maxDampingFactor = 0.0;
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        maxDampingFactor = std::max( maxDampingFactor, FABS( particleData[ii].dampingFactor ) );
+    }
+    std::vector<RealOpenMM> thole = getTholeParameters();
+    RealOpenMM pgamma = std::min( thole[TCC], std::min( thole[TCD], thole[TDD] ) );
+    if( maxDampingFactor == 0.0 ){
+        _dampingDistance = 0.0;
+    } else if( pgamma <= 0.0 ){
+        _dampingDistance = unboundedDampingDistance;
+    } else {
+        _dampingDistance = POW( maxDampingFactor*maxDampingFactor, 1/6. )*POW( dampingExponent/pgamma, 0.25 );
+    }
+}
+
+RealOpenMM MBPolReferenceElectrostaticsForce::getShortRangeWeight( const RealVec& deltaOO, RealOpenMM& dWeight ) const
+{
+    dWeight       = 0.0;
+    RealOpenMM r  = SQRT( deltaOO.dot( deltaOO ) );
+    if( r >= _splitDistance ){
+        return 0.0;
+    }
+    RealOpenMM inner = _splitDistance - _splitWidth;
+    if( r <= inner ){
+        return 1.0;
+    }
+    RealOpenMM t1 = M_PI/_splitWidth;
+    RealOpenMM x  = (r - inner)*t1;
+    dWeight       = -std::sin( x )*t1/(2.0*r);
+    return (1.0 + std::cos( x ))/2.0;
+}
+
+RealVec MBPolReferenceElectrostaticsForce::addShortRangeWeightForces( const ElectrostaticsParticleData& particleI, const ElectrostaticsParticleData& particleK,
+                                                                    const RealVec& deltaOO, RealOpenMM pairEnergy, RealOpenMM dWeight,
+                                                                    std::vector<RealVec>& forces ) const
+{
+    RealVec force = deltaOO*(pairEnergy*dWeight);
+    forces[particleI.oxygenIndex] += force;
+    forces[particleK.oxygenIndex] -= force;
+    return -force;
+}
+
+void MBPolReferenceElectrostaticsForce::splitDampedPairs( const std::vector<ElectrostaticsParticleData>& particleData )
+{
+
+    // the charge redistribution terms of a pair also depend on the distances to the
+    // other sites of each water, which are at most 'reach' away from the site
+
+    RealOpenMM reach = 0.0;
+    if( getIncludeChargeRedistribution() ){
+        for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+            for( unsigned int s = 0; s < 3; s++ ){
+                RealVec delta = particleData[particleData[ii].otherSiteIndex[s]].position - particleData[ii].position;
+                reach         = std::max( reach, SQRT( delta.dot( delta ) ) );
+            }
+        }
+    }
+    RealOpenMM undampedDistance2 = (_dampingDistance + reach)*(_dampingDistance + reach);
+
+    // the short-range part has no pairs within a water and none beyond the split distance
+
+    RealOpenMM splitDistance2 = _splitDistance*_splitDistance;
+
+    _dampedPairs.clear();
+    _undampedPairs.clear();
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
+            if( getShortRangeOnly() ){
+                RealVec deltaOO = particleData[jj].oxygenPosition - particleData[ii].oxygenPosition;
+                if( particleData[ii].moleculeIndex == particleData[jj].moleculeIndex || deltaOO.dot( deltaOO ) >= splitDistance2 ){
+                    continue;
+                }
+            }
+            RealVec deltaR = particleData[jj].position - particleData[ii].position;
+            if( particleData[ii].moleculeIndex == particleData[jj].moleculeIndex || deltaR.dot( deltaR ) < undampedDistance2 ){
+                _dampedPairs.push_back( AtomPair( ii, jj ) );
+            } else {
+                _undampedPairs.push_back( AtomPair( ii, jj ) );
+            }
+        }
+    }
+}
+
 void MBPolReferenceElectrostaticsForce::calculateFixedElectrostaticsFieldPairIxn( const ElectrostaticsParticleData& particleI,
                                                                          const ElectrostaticsParticleData& particleJ)
 {
@@ -377,6 +620,13 @@ void MBPolReferenceElectrostaticsForce::calculateFixedElectrostaticsFieldPairIxn
     // charge - charge
     RealOpenMM rr3 = getAndScaleInverseRs( particleI, particleJ,r,false,3,TCC);
 
+    // weight of the pair in the short-range part
+
+    if( getShortRangeOnly() ){
+        RealOpenMM dWeight;
+        rr3 *= getShortRangeWeight( particleJ.oxygenPosition - particleI.oxygenPosition, dWeight );
+    }
+
     // field at particle I due multipoles at particle J
 
     RealOpenMM factor                           = rr3*particleJ.charge;
@@ -402,19 +652,34 @@ void MBPolReferenceElectrostaticsForce::calculateFixedElectrostaticsFieldPairIxn
 void MBPolReferenceElectrostaticsForce::calculateFixedElectrostaticsField( const vector<ElectrostaticsParticleData>& particleData )
 {
 
-    // calculate fixed multipole fields
-
-    // loop includes diagonal term ii == jj for GK ixn; other calculateFixedElectrostaticsFieldPairIxn() methods
-    // skip calculations for this case
-
-    for( unsigned int ii = 0; ii < _numParticles; ii++ ){
-        for( unsigned int jj = ii; jj < _numParticles; jj++ ){
+    // calculate fixed multipole fields: damped pairs through calculateFixedElectrostaticsFieldPairIxn(),
+    // undamped pairs as bare charges
 
-            // if site jj is less than max covalent scaling index then get/apply scaling constants
-            // otherwise add unmodified field and fieldPolar to particle fields
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pairList");
+        splitDampedPairs( particleData );
+    }
 
-            calculateFixedElectrostaticsFieldPairIxn( particleData[ii], particleData[jj]);
+    for( unsigned int xx = 0; xx < _dampedPairs.size(); xx++ ){
+        calculateFixedElectrostaticsFieldPairIxn( particleData[_dampedPairs[xx].first], particleData[_dampedPairs[xx].second] );
+    }
+    for( unsigned int xx = 0; xx < _undampedPairs.size(); xx++ ){
+        unsigned int ii   = _undampedPairs[xx].first;
+        unsigned int jj   = _undampedPairs[xx].second;
+        RealVec deltaR    = particleData[jj].position - particleData[ii].position;
+        RealOpenMM r2     = deltaR.dot( deltaR );
+        RealOpenMM rr3    = 1.0/(r2*SQRT( r2 ));
+        if( getShortRangeOnly() ){
+            RealOpenMM dWeight;
+            rr3          *= getShortRangeWeight( particleData[jj].oxygenPosition - particleData[ii].oxygenPosition, dWeight );
         }
+
+        RealVec fieldI    = deltaR*(rr3*particleData[jj].charge);
+        RealVec fieldJ    = deltaR*(rr3*particleData[ii].charge);
+        _fixedElectrostaticsField[ii]        -= fieldI;
+        _fixedElectrostaticsFieldPolar[ii]   -= fieldI;
+        _fixedElectrostaticsField[jj]        += fieldJ;
+        _fixedElectrostaticsFieldPolar[jj]   += fieldJ;
     }
     return;
 }
@@ -435,58 +700,158 @@ void MBPolReferenceElectrostaticsForce::initializeInducedDipoles( std::vector<Up
     return;
 }
 
-void MBPolReferenceElectrostaticsForce::calculateInducedDipolePairIxn( unsigned int particleI,
-                                                                   unsigned int particleJ,
-                                                                   const RealOpenMM & rr3,
-                                                                   const RealOpenMM & rr5,
-                                                                   const RealVec& deltaR,
-                                                                   const std::vector<RealVec>& inducedDipole,
-                                                                   std::vector<RealVec>& field ) const
+void MBPolReferenceElectrostaticsForce::InducedDipolePairs::clear( void )
 {
+    first.clear();
+    second.clear();
+    deltaX.clear();
+    deltaY.clear();
+    deltaZ.clear();
+    dipoleScale.clear();
+    deltaScale.clear();
+}
 
-    RealOpenMM dDotDelta            = rr5*(inducedDipole[particleJ].dot( deltaR ) );
-    field[particleI]               += inducedDipole[particleJ]*rr3 + deltaR*dDotDelta;
-    dDotDelta                       = rr5*(inducedDipole[particleI].dot( deltaR ) );
-    field[particleJ]               += inducedDipole[particleI]*rr3 + deltaR*dDotDelta;
+void MBPolReferenceElectrostaticsForce::InducedDipolePairs::reserve( unsigned int numberOfPairs )
+{
+    first.reserve( numberOfPairs );
+    second.reserve( numberOfPairs );
+    deltaX.reserve( numberOfPairs );
+    deltaY.reserve( numberOfPairs );
+    deltaZ.reserve( numberOfPairs );
+    dipoleScale.reserve( numberOfPairs );
+    deltaScale.reserve( numberOfPairs );
+}
 
-    return;
+void MBPolReferenceElectrostaticsForce::InducedDipolePairs::add( unsigned int ii, unsigned int jj, const RealVec& delta,
+                                                                 RealOpenMM dipoleFactor, RealOpenMM deltaFactor )
+{
+    first.push_back( ii );
+    second.push_back( jj );
+    deltaX.push_back( delta[0] );
+    deltaY.push_back( delta[1] );
+    deltaZ.push_back( delta[2] );
+    dipoleScale.push_back( dipoleFactor );
+    deltaScale.push_back( deltaFactor );
 }
 
-void MBPolReferenceElectrostaticsForce::calculateInducedDipolePairIxns( const ElectrostaticsParticleData& particleI,
-                                                                    const ElectrostaticsParticleData& particleJ,
-                                                                    std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, RealOpenMM precomputedScale3, RealOpenMM precomputedScale5 )
+unsigned int MBPolReferenceElectrostaticsForce::InducedDipolePairs::size( void ) const
 {
+    return first.size();
+}
 
-   if( particleI.particleIndex == particleJ.particleIndex )return;
+// pair ranges handed out by the scheduler; the count is fixed so that a chunk
+// covers the same pairs in every iteration of the induced dipoles
 
-    RealVec deltaR       = particleJ.position - particleI.position;
-    RealOpenMM r         =  SQRT( deltaR.dot( deltaR ) );
+static const int inducedDipoleFieldChunks = 64;
 
-    for( unsigned int ii = 0; ii < updateInducedDipoleFields.size(); ii++ ){
-        calculateInducedDipolePairIxn( particleI.particleIndex, particleJ.particleIndex, precomputedScale3, precomputedScale5, deltaR,
-                                       *(updateInducedDipoleFields[ii].inducedDipoles), updateInducedDipoleFields[ii].inducedDipoleField );
-    }
-    return;
+void MBPolReferenceElectrostaticsForce::addInducedDipolePairFieldRange( const InducedDipolePairs& pairs, unsigned int begin, unsigned int end,
+                                                                        const std::vector<RealVec>& dipole, const std::vector<RealVec>& dipolePolar,
+                                                                        std::vector<RealVec>& field, std::vector<RealVec>& fieldPolar )
+{
 
+    // inducedDipole and inducedDipolePolar share the pair geometry, so both are
+    // handled while the pair is loaded
+
+    const unsigned int* first       = pairs.first.data();
+    const unsigned int* second      = pairs.second.data();
+    const RealOpenMM* deltaX        = pairs.deltaX.data();
+    const RealOpenMM* deltaY        = pairs.deltaY.data();
+    const RealOpenMM* deltaZ        = pairs.deltaZ.data();
+    const RealOpenMM* dipoleScale   = pairs.dipoleScale.data();
+    const RealOpenMM* deltaScale    = pairs.deltaScale.data();
+
+    for( unsigned int xx = begin; xx < end; xx++ ){
+
+        unsigned int ii = first[xx];
+        unsigned int jj = second[xx];
+        RealVec delta( deltaX[xx], deltaY[xx], deltaZ[xx] );
+        RealOpenMM rr3  = dipoleScale[xx];
+        RealOpenMM rr5  = deltaScale[xx];
+
+        field[ii]      += dipole[jj]*rr3      + delta*(rr5*dipole[jj].dot( delta ));
+        field[jj]      += dipole[ii]*rr3      + delta*(rr5*dipole[ii].dot( delta ));
+        fieldPolar[ii] += dipolePolar[jj]*rr3 + delta*(rr5*dipolePolar[jj].dot( delta ));
+        fieldPolar[jj] += dipolePolar[ii]*rr3 + delta*(rr5*dipolePolar[ii].dot( delta ));
+    }
 }
 
-void MBPolReferenceElectrostaticsForce::calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
-                                                                  std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, const RealOpenMM scale3[], const RealOpenMM scale5[])
+void MBPolReferenceElectrostaticsForce::addInducedDipolePairFields( const InducedDipolePairs& pairs,
+                                                                    std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields ) const
 {
 
-    unsigned int xx = 0;
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
-            calculateInducedDipolePairIxns( particleData[ii], particleData[jj], updateInducedDipoleFields,
-                    scale3[xx], scale5[xx] );
-            xx++;
+    const std::vector<RealVec>& dipole      = *(updateInducedDipoleFields[0].inducedDipoles);
+    const std::vector<RealVec>& dipolePolar = *(updateInducedDipoleFields[1].inducedDipoles);
+    std::vector<RealVec>& field             = updateInducedDipoleFields[0].inducedDipoleField;
+    std::vector<RealVec>& fieldPolar        = updateInducedDipoleFields[1].inducedDipoleField;
+
+    int numThreads     = (_scheduler ? ReferenceMBPolScheduler::getNumThreads() : 1);
+    bool deterministic = (_scheduler && ReferenceMBPolScheduler::getDeterministic());
+    if( numThreads <= 1 && !deterministic ){
+        addInducedDipolePairFieldRange( pairs, 0, pairs.size(), dipole, dipolePolar, field, fieldPolar );
+        return;
+    }
+    unsigned int numberOfPairs = pairs.size();
+
+    if( deterministic ){
+
+        // the fields of every chunk are added in fixed point, whichever thread ran it
+
+        std::vector<ReferenceMBPolFixedPointBuffer> fieldBuffers( numThreads );
+        std::vector<ReferenceMBPolFixedPointBuffer> fieldPolarBuffers( numThreads );
+        for( int thread = 0; thread < numThreads; thread++ ){
+            fieldBuffers[thread].initialize( field.size() );
+            fieldPolarBuffers[thread].initialize( fieldPolar.size() );
+        }
+        _scheduler->run( inducedDipoleFieldChunks, numThreads, [&]( int chunk, int thread ) {
+            unsigned int begin = (unsigned int) (((long long) numberOfPairs*chunk)/inducedDipoleFieldChunks);
+            unsigned int end   = (unsigned int) (((long long) numberOfPairs*(chunk+1))/inducedDipoleFieldChunks);
+            ReferenceMBPolFixedPointBuffer& fieldBuffer      = fieldBuffers[thread];
+            ReferenceMBPolFixedPointBuffer& fieldPolarBuffer = fieldPolarBuffers[thread];
+            addInducedDipolePairFieldRange( pairs, begin, end, dipole, dipolePolar, fieldBuffer.getVectors(), fieldPolarBuffer.getVectors() );
+            for( unsigned int xx = begin; xx < end; xx++ ){
+                fieldBuffer.touchVector( pairs.first[xx] );
+                fieldBuffer.touchVector( pairs.second[xx] );
+                fieldPolarBuffer.touchVector( pairs.first[xx] );
+                fieldPolarBuffer.touchVector( pairs.second[xx] );
+            }
+            fieldBuffer.flush();
+            fieldPolarBuffer.flush();
+        });
+        ReferenceMBPolFixedPointBuffer::reduce( fieldBuffers, field );
+        ReferenceMBPolFixedPointBuffer::reduce( fieldPolarBuffers, fieldPolar );
+        return;
+    }
+
+    // every thread adds into its own fields, summed in thread order afterwards
+
+    RealVec zeroVec( 0.0, 0.0, 0.0 );
+    std::vector<std::vector<RealVec> > threadFields( numThreads, std::vector<RealVec>( field.size(), zeroVec ) );
+    std::vector<std::vector<RealVec> > threadFieldsPolar( numThreads, std::vector<RealVec>( fieldPolar.size(), zeroVec ) );
+    _scheduler->run( inducedDipoleFieldChunks, numThreads, [&]( int chunk, int thread ) {
+        unsigned int begin = (unsigned int) (((long long) numberOfPairs*chunk)/inducedDipoleFieldChunks);
+        unsigned int end   = (unsigned int) (((long long) numberOfPairs*(chunk+1))/inducedDipoleFieldChunks);
+        addInducedDipolePairFieldRange( pairs, begin, end, dipole, dipolePolar, threadFields[thread], threadFieldsPolar[thread] );
+    });
+    for( int thread = 0; thread < numThreads; thread++ ){
+        for( unsigned int ii = 0; ii < field.size(); ii++ ){
+            field[ii]      += threadFields[thread][ii];
+            fieldPolar[ii] += threadFieldsPolar[thread][ii];
         }
     }
     return;
 }
 
+void MBPolReferenceElectrostaticsForce::calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                                  std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                                                  const InducedDipolePairs& pairs )
+{
+    addInducedDipolePairFields( pairs, updateInducedDipoleFields );
+    return;
+}
+
 RealOpenMM MBPolReferenceElectrostaticsForce::runUpdateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
-                                                                     std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, const RealOpenMM scale3[], const RealOpenMM scale5[])
+                                                                     std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                                                     const InducedDipolePairs& pairs, const std::vector<RealOpenMM>& polarity )
 {
 
     // (1) zero fields
@@ -498,11 +863,11 @@ RealOpenMM MBPolReferenceElectrostaticsForce::runUpdateInducedDipoleFields( cons
         std::fill( updateInducedDipoleFields[ii].inducedDipoleField.begin(), updateInducedDipoleFields[ii].inducedDipoleField.end(), zeroVec );
     }
 
-    calculateInducedDipoleFields( particleData, updateInducedDipoleFields, scale3, scale5);
+    calculateInducedDipoleFields( particleData, updateInducedDipoleFields, pairs );
 
     RealOpenMM maxEpsilon = 0.0;
     for( unsigned int kk = 0; kk < updateInducedDipoleFields.size(); kk++ ){
-        RealOpenMM epsilon = updateInducedDipole( particleData,
+        RealOpenMM epsilon = updateInducedDipole( polarity,
                                                   *(updateInducedDipoleFields[kk].fixedElectrostaticsField),
                                                     updateInducedDipoleFields[kk].inducedDipoleField,
                                                   *(updateInducedDipoleFields[kk].inducedDipoles) );
@@ -513,16 +878,16 @@ RealOpenMM MBPolReferenceElectrostaticsForce::runUpdateInducedDipoleFields( cons
     return maxEpsilon;
 }
 
-RealOpenMM MBPolReferenceElectrostaticsForce::updateInducedDipole( const std::vector<ElectrostaticsParticleData>& particleData,
+RealOpenMM MBPolReferenceElectrostaticsForce::updateInducedDipole( const std::vector<RealOpenMM>& polarity,
                                                                const std::vector<RealVec>& fixedElectrostaticsField,
                                                                const std::vector<RealVec>& inducedDipoleField,
                                                                std::vector<RealVec>& inducedDipole )
 {
 
     RealOpenMM epsilon                    = 0.0;
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+    for( unsigned int ii = 0; ii < polarity.size(); ii++ ){
         RealVec    oldValue               = inducedDipole[ii];
-        RealVec    newValue               = fixedElectrostaticsField[ii] + inducedDipoleField[ii]*particleData[ii].polarity;
+        RealVec    newValue               = fixedElectrostaticsField[ii] + inducedDipoleField[ii]*polarity[ii];
         RealVec    delta                  = newValue - oldValue;
         inducedDipole[ii]                 = oldValue + delta*_polarSOR;
         epsilon                          += delta.dot( delta );
@@ -530,27 +895,29 @@ RealOpenMM MBPolReferenceElectrostaticsForce::updateInducedDipole( const std::ve
     return epsilon;
 }
 
-
-void MBPolReferenceElectrostaticsForce::precomputeScale35( const std::vector<ElectrostaticsParticleData>& particleData, RealOpenMM scale3[], RealOpenMM scale5[] )
+void MBPolReferenceElectrostaticsForce::buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs )
 {
-    // Precompute scale3 and scale5, the arrays will be passed into the iterative dipole estimation
-    // this has a great impact on performance
-    // The arrays are indexed by `xx`, we always scan through the arrays with the same 2 nested loops
-    // so we are always able to recover the correct element.
-    int xx = 0;
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
-	    RealVec deltaR    = particleData[jj].position - particleData[ii].position;
-
-	    getPeriodicDelta( deltaR );
-	    RealOpenMM r2     = deltaR.dot( deltaR );
-
-	    RealOpenMM r           = SQRT(r2);
-
-	    scale3[xx] = -1 * getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 3, TDD);
-	    scale5[xx] = getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 5, TDD);
-        xx++;
-        }
+    // every pair: without PME there is no cutoff; the pairs were split by calculateFixedElectrostaticsField()
+
+    pairs.clear();
+    pairs.reserve( _dampedPairs.size() + _undampedPairs.size() );
+    for( unsigned int xx = 0; xx < _dampedPairs.size(); xx++ ){
+        unsigned int ii   = _dampedPairs[xx].first;
+        unsigned int jj   = _dampedPairs[xx].second;
+        RealVec deltaR    = particleData[jj].position - particleData[ii].position;
+        RealOpenMM r      = SQRT( deltaR.dot( deltaR ) );
+
+        pairs.add( ii, jj, deltaR, -1 * getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 3, TDD),
+                                        getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 5, TDD) );
+    }
+    for( unsigned int xx = 0; xx < _undampedPairs.size(); xx++ ){
+        unsigned int ii   = _undampedPairs[xx].first;
+        unsigned int jj   = _undampedPairs[xx].second;
+        RealVec deltaR    = particleData[jj].position - particleData[ii].position;
+        RealOpenMM r2I    = 1.0/deltaR.dot( deltaR );
+        RealOpenMM rr3    = r2I*SQRT( r2I );
+
+        pairs.add( ii, jj, deltaR, -rr3, 3.0*rr3*r2I );
     }
 }
 
@@ -572,19 +939,32 @@ void MBPolReferenceElectrostaticsForce::convergeInduceDipoles( const std::vector
 
     start = std::clock();
 
-    unsigned int scale_length = particleData.size() * (particleData.size())/2;
-    RealOpenMM * scale3 = new RealOpenMM[scale_length]; 
-    RealOpenMM * scale5 = new RealOpenMM[scale_length]; 
+    // the pair geometry and damping do not change during the iterations, so they
+    // are computed once here; this has a great impact on performance
 
-    precomputeScale35( particleData, scale3, scale5);
+    bool usePairTable = getUseInducedDipolePairTable();
+    InducedDipolePairs pairs;
+    std::vector<RealOpenMM> polarity( particleData.size() );
+    {
+        ReferenceMBPolTimers::Scope pairTimer("Electrostatics.inducedDipolePairs");
+        buildInducedDipolePairs( particleData, pairs );
+        for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+            polarity[ii] = particleData[ii].polarity;
+        }
+    }
 
     duration = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
 
     start = std::clock();
 
+    ReferenceMBPolTimers::Scope timer("Electrostatics.inducedDipoles");
     while( !done ){
 
-        RealOpenMM epsilon = runUpdateInducedDipoleFields( particleData, updateInducedDipoleField, scale3, scale5);
+        if( !usePairTable && iteration > 0 ){
+            buildInducedDipolePairs( particleData, pairs );
+        }
+
+        RealOpenMM epsilon = runUpdateInducedDipoleFields( particleData, updateInducedDipoleField, pairs, polarity );
                    epsilon = _polarSOR*_debye*SQRT( epsilon/( static_cast<RealOpenMM>(_numParticles) ) );
 
         if( epsilon < getMutualInducedDipoleTargetEpsilon() ){
@@ -608,9 +988,7 @@ void MBPolReferenceElectrostaticsForce::convergeInduceDipoles( const std::vector
 
     setMutualInducedDipoleEpsilon( currentEpsilon );
     setMutualInducedDipoleIterations( iteration );
-
-    delete[] scale3;
-    delete[] scale5;
+    timer.setCount( iteration );
 
     return;
 }
@@ -636,7 +1014,25 @@ void MBPolReferenceElectrostaticsForce::calculateInducedDipoles( const std::vect
     updateInducedDipoleField.push_back( UpdateInducedDipoleFieldStruct( &_fixedElectrostaticsField,       &_inducedDipole ) );
     updateInducedDipoleField.push_back( UpdateInducedDipoleFieldStruct( &_fixedElectrostaticsFieldPolar,  &_inducedDipolePolar ) );
 
-    initializeInducedDipoles( updateInducedDipoleField );
+    // short-range part: directly polarized dipoles, no iterations
+
+    if( getShortRangeOnly() ){
+        this->MBPolReferenceElectrostaticsForce::initializeInducedDipoles( updateInducedDipoleField );
+        setMutualInducedDipoleConverged( true );
+        setMutualInducedDipoleEpsilon( 0.0 );
+        setMutualInducedDipoleIterations( 0 );
+        return;
+    }
+
+    // start from the given dipoles if there are any; the fields due to them are
+    // computed in the first iteration
+
+    if( _initialInducedDipole.size() == _numParticles && _initialInducedDipolePolar.size() == _numParticles ){
+        _inducedDipole      = _initialInducedDipole;
+        _inducedDipolePolar = _initialInducedDipolePolar;
+    } else {
+        initializeInducedDipoles( updateInducedDipoleField );
+    }
 
     // UpdateInducedDipoleFieldStruct contains induced dipole, fixed multipole fields and fields
     // due to other induced dipoles at each site
@@ -649,7 +1045,9 @@ void MBPolReferenceElectrostaticsForce::calculateInducedDipoles( const std::vect
 RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn( const std::vector<ElectrostaticsParticleData>& particleData,
                                                                          unsigned int iIndex,
                                                                          unsigned int kIndex,
-                                                                         std::vector<RealVec>& forces) const
+                                                                         std::vector<RealVec>& forces,
+                                                                         std::vector<RealOpenMM>* permanentPotential,
+                                                                         std::vector<RealOpenMM>* inducedPotential ) const
 {
     RealOpenMM temp3,temp5,temp7;
     RealOpenMM gl[9],gli[7],glip[7];
@@ -731,11 +1129,34 @@ RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn( con
     energy           += 0.5*( rr3*gli[0]*scale3CD ); // charge - induced dipole
     energy           *= f;
 
+    // weight of the pair in the short-range part
+
+    RealOpenMM weight   = 1.0;
+    RealOpenMM dWeight  = 0.0;
+    RealVec deltaOO;
+    if( getShortRangeOnly() ){
+        deltaOO = particleK.oxygenPosition - particleI.oxygenPosition;
+        weight  = getShortRangeWeight( deltaOO, dWeight );
+    }
+
+    // the derivatives of the energy with respect to the two charges
+
+    if( permanentPotential && !isSameWater ){
+        (*permanentPotential)[iIndex] += rr1*particleK.charge*scale1CC*weight;
+        (*permanentPotential)[kIndex] += rr1*particleI.charge*scale1CC*weight;
+        (*inducedPotential)[iIndex]   -= rr3*sci[3]*scale3CD*weight;
+        (*inducedPotential)[kIndex]   += rr3*sci[2]*scale3CD*weight;
+    }
+
     RealOpenMM scale3CC = getAndScaleInverseRs( particleI, particleK, r, true, 3, TCC);
     RealOpenMM scale5CD = getAndScaleInverseRs( particleI, particleK, r, true, 5, TCD);
     RealOpenMM scale5DD = getAndScaleInverseRs( particleI, particleK, r, true, 5, TDD);
     RealOpenMM scale7DD = getAndScaleInverseRs( particleI, particleK, r, true, 7, TDD);
 
+    // directly polarized dipoles do not interact with each other
+
+    RealOpenMM mutual   = getShortRangeOnly() ? 0.0 : 1.0;
+
     // intermediate variables for the permanent components
     gf[0] = rr3*gl[0]*scale3CC ; // charge -charge
 
@@ -743,8 +1164,8 @@ RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn( con
 
     gfi[0] = 0.5 * rr5 *  gli[0]*scale5CD + // charge - induced dipole
              0.5 * rr5 * glip[0]*scale5CD + // charge - induced dipole
-             0.5 * rr5 * scip[1]*scale5DD + // induced dipole - induced dipole
-           - 0.5 * rr7 * (sci[2]*scip[3] + scip[2]*sci[3])*scale7DD; // induced dipole - induced dipole
+    mutual*( 0.5 * rr5 * scip[1]*scale5DD + // induced dipole - induced dipole
+           - 0.5 * rr7 * (sci[2]*scip[3] + scip[2]*sci[3])*scale7DD ); // induced dipole - induced dipole
 
     // get the permanent force components
 
@@ -757,7 +1178,7 @@ RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn( con
     ftm2i += ( _inducedDipolePolar[iIndex] *  sci[3] + // iPdipole_i * idipole_k
                     _inducedDipole[iIndex] * scip[3] +
                _inducedDipolePolar[kIndex] *  sci[2] + // iPdipole_k * idipole_i
-                _inducedDipole[kIndex] * scip[2]  ) * 0.5 * rr5 * scale5DD;
+                _inducedDipole[kIndex] * scip[2]  ) * 0.5 * rr5 * scale5DD * mutual;
 
     // Same water atoms have no induced-dipole/charge interaction
     if (not( isSameWater )) {
@@ -829,6 +1250,103 @@ RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn( con
     RealVec force   = ftm2 + ftm2i;
             force  *= f;
 
+    // with the weight the charge - induced dipole energy counts twice in the forces,
+    // as it does in ftm2i: the dipoles minimize the polarization energy
+
+    if( dWeight != 0.0 ){
+        addShortRangeWeightForces( particleI, particleK, deltaOO,
+                                   f*(rr1*gl[0]*scale1CC + 0.5*rr3*(gli[0] + glip[0])*scale3CD), dWeight, forces );
+    }
+    energy         *= weight;
+    force          *= weight;
+
+    forces[iIndex] -= force;
+    forces[kIndex] += force;
+
+    return energy;
+}
+
+RealOpenMM MBPolReferenceElectrostaticsForce::calculateUndampedElectrostaticPairIxn( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                                                  unsigned int iIndex, unsigned int kIndex,
+                                                                                  std::vector<RealVec>& forces,
+                                                                                  std::vector<RealOpenMM>* permanentPotential,
+                                                                                  std::vector<RealOpenMM>* inducedPotential ) const
+{
+    const ElectrostaticsParticleData& particleI = particleData[iIndex];
+    const ElectrostaticsParticleData& particleK = particleData[kIndex];
+    const RealVec& dipoleI      = _inducedDipole[iIndex];
+    const RealVec& dipoleK      = _inducedDipole[kIndex];
+    const RealVec& dipolePolarI = _inducedDipolePolar[iIndex];
+    const RealVec& dipolePolarK = _inducedDipolePolar[kIndex];
+
+    RealVec delta       = particleK.position - particleI.position;
+    RealOpenMM r2I      = 1.0/delta.dot( delta );
+    RealOpenMM rr1      = SQRT( r2I );
+    RealOpenMM rr3      = rr1*r2I;
+    RealOpenMM rr5      = 3.0*rr3*r2I;
+    RealOpenMM rr7      = 5.0*rr5*r2I;
+
+    RealOpenMM sci2     = dipoleI.dot( delta );
+    RealOpenMM sci3     = dipoleK.dot( delta );
+    RealOpenMM scip1    = dipoleI.dot( dipolePolarK ) + dipolePolarI.dot( dipoleK );
+    RealOpenMM scip2    = dipolePolarI.dot( delta );
+    RealOpenMM scip3    = dipolePolarK.dot( delta );
+
+    RealOpenMM gl0      = particleI.charge*particleK.charge;
+    RealOpenMM gli0     = particleK.charge*sci2 - particleI.charge*sci3;
+    RealOpenMM glip0    = particleK.charge*scip2 - particleI.charge*scip3;
+
+    RealOpenMM f        = _electric/_dielectric;
+    RealOpenMM energy   = f*(rr1*gl0 + 0.5*rr3*gli0);
+
+    // weight of the pair in the short-range part, see calculateElectrostaticPairIxn()
+
+    RealOpenMM weight   = 1.0;
+    RealOpenMM dWeight  = 0.0;
+    RealVec deltaOO;
+    if( getShortRangeOnly() ){
+        deltaOO = particleK.oxygenPosition - particleI.oxygenPosition;
+        weight  = getShortRangeWeight( deltaOO, dWeight );
+    }
+
+    if( permanentPotential ){
+        (*permanentPotential)[iIndex] += rr1*particleK.charge*weight;
+        (*permanentPotential)[kIndex] += rr1*particleI.charge*weight;
+        (*inducedPotential)[iIndex]   -= rr3*sci3*weight;
+        (*inducedPotential)[kIndex]   += rr3*sci2*weight;
+    }
+
+    // directly polarized dipoles do not interact with each other
+
+    RealOpenMM mutual   = getShortRangeOnly() ? 0.0 : 1.0;
+
+    RealOpenMM gf0      = rr3*gl0 + 0.5*rr5*(gli0 + glip0) + mutual*0.5*(rr5*scip1 - rr7*(sci2*scip3 + scip2*sci3));
+    RealVec force       = delta*gf0;
+    force              += (dipolePolarI*sci3 + dipoleI*scip3 + dipolePolarK*sci2 + dipoleK*scip2)*(0.5*rr5*mutual);
+    force              += ((dipoleI + dipolePolarI)*-particleK.charge + (dipoleK + dipolePolarK)*particleI.charge)*(0.5*rr3);
+
+    // MBPol charge derivative terms, see calculateElectrostaticPairIxn()
+
+    if( getIncludeChargeRedistribution() ){
+        for( unsigned int s = 0; s < 3; s++ ){
+            RealVec deltaI          = particleData[particleI.otherSiteIndex[s]].position - particleK.position;
+            RealVec deltaK          = particleData[particleK.otherSiteIndex[s]].position - particleI.position;
+            RealOpenMM distanceI2I  = 1.0/deltaI.dot( deltaI );
+            RealOpenMM distanceK2I  = 1.0/deltaK.dot( deltaK );
+            RealOpenMM rrI1         = SQRT( distanceI2I );
+            RealOpenMM rrK1         = SQRT( distanceK2I );
+
+            force += particleI.chargeDerivatives[s]*(rrI1*particleK.charge + rrI1*distanceI2I*dipoleK.dot( deltaI ));
+            force -= particleK.chargeDerivatives[s]*(rrK1*particleI.charge + rrK1*distanceK2I*dipoleI.dot( deltaK ));
+        }
+    }
+
+    force          *= f;
+    if( dWeight != 0.0 ){
+        addShortRangeWeightForces( particleI, particleK, deltaOO, f*(rr1*gl0 + 0.5*rr3*(gli0 + glip0)), dWeight, forces );
+    }
+    energy         *= weight;
+    force          *= weight;
     forces[iIndex] -= force;
     forces[kIndex] += force;
 
@@ -841,13 +1359,31 @@ RealOpenMM MBPolReferenceElectrostaticsForce::calculateElectrostatic( const std:
 
     RealOpenMM energy = 0.0;
 
-    // main loop over particle pairs
+    // main loop over particle pairs, split by calculateFixedElectrostaticsField()
 
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
+    std::vector<RealVec> pairForces( particleData.size(), RealVec( 0.0, 0.0, 0.0 ) );
+    std::vector<RealOpenMM> permanentPotential, inducedPotential;
+    if( _includeEnergyDecomposition ){
+        permanentPotential.assign( particleData.size(), 0.0 );
+        inducedPotential.assign( particleData.size(), 0.0 );
+    }
+    std::vector<RealOpenMM>* permanent = _includeEnergyDecomposition ? &permanentPotential : NULL;
+    std::vector<RealOpenMM>* induced   = _includeEnergyDecomposition ? &inducedPotential : NULL;
+    for( unsigned int xx = 0; xx < _dampedPairs.size(); xx++ ){
+        energy += calculateElectrostaticPairIxn( particleData, _dampedPairs[xx].first, _dampedPairs[xx].second, pairForces, permanent, induced );
+    }
+    for( unsigned int xx = 0; xx < _undampedPairs.size(); xx++ ){
+        energy += calculateUndampedElectrostaticPairIxn( particleData, _undampedPairs[xx].first, _undampedPairs[xx].second, pairForces, permanent, induced );
+    }
+    recordSitePotentials( particleData, permanentPotential, inducedPotential );
 
-            energy += calculateElectrostaticPairIxn( particleData, ii, jj, forces);
+    // without periodic images the virial is sum r_i (x) f_i over all sites
 
+    _virial.assign( 3, RealVec( 0.0, 0.0, 0.0 ) );
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        forces[ii] += pairForces[ii];
+        for( unsigned int a = 0; a < 3; a++ ){
+            _virial[a] += pairForces[ii]*particleData[ii].position[a];
         }
     }
 
@@ -878,10 +1414,10 @@ void MBPolReferenceElectrostaticsForce::setup( const std::vector<RealVec>& parti
 
     if (getIncludeChargeRedistribution())
     {
-        for( unsigned int ii = 0; ii < _numParticles; ii=ii+4 ){ // FIXME this assumes only waters
-            computeWaterCharge(particleData[ii], particleData[ii+1], particleData[ii+2], particleData[ii+3]);
-        }
+        ReferenceMBPolTimers::Scope timer("Electrostatics.chargeRedistribution");
+        computeWaterCharges( particleData );
     }
+    computeDampingDistance( particleData );
 
     calculateInducedDipoles( particleData );
 
@@ -1099,7 +1635,7 @@ const RealOpenMM MBPolReferencePmeElectrostaticsForce::SQRT_PI = 1.77245385091;
 MBPolReferencePmeElectrostaticsForce::MBPolReferencePmeElectrostaticsForce( void ) :
                MBPolReferenceElectrostaticsForce(PME),
                _cutoffDistance(0.9), _cutoffDistanceSquared(0.81),
-               _pmeGridSize(0), _totalGridSize(0), _alphaEwald(0.0)
+               _pmeGridSize(0), _totalGridSize(0), _alphaEwald(0.0), _useSinglePrecisionGrid(false), _deferReciprocalSpaceVirial(false), _hasCandidatePairs(false)
 {
 
     _fftplan = NULL;
@@ -1161,6 +1697,7 @@ void MBPolReferencePmeElectrostaticsForce::setPmeGridDimensions( std::vector<int
         fftpack_destroy(_fftplan);
     }
     fftpack_init_3d(&_fftplan,pmeGridDimensions[0], pmeGridDimensions[1], pmeGridDimensions[2]);
+    _singleFFT.initialize(pmeGridDimensions[0], pmeGridDimensions[1], pmeGridDimensions[2]);
 
     _pmeGridDimensions[0] = pmeGridDimensions[0];
     _pmeGridDimensions[1] = pmeGridDimensions[1];
@@ -1187,6 +1724,94 @@ void MBPolReferencePmeElectrostaticsForce::setPeriodicBoxSize( RealVec& boxSize
     return;
 };
 
+void MBPolReferencePmeElectrostaticsForce::setUseSinglePrecisionGrid( bool useSinglePrecisionGrid )
+{
+    _useSinglePrecisionGrid = useSinglePrecisionGrid;
+}
+
+bool MBPolReferencePmeElectrostaticsForce::getUseSinglePrecisionGrid( void ) const
+{
+    return _useSinglePrecisionGrid;
+}
+
+void MBPolReferencePmeElectrostaticsForce::setDeferReciprocalSpaceVirial( bool deferReciprocalSpaceVirial )
+{
+    _deferReciprocalSpaceVirial = deferReciprocalSpaceVirial;
+}
+
+bool MBPolReferencePmeElectrostaticsForce::getDeferReciprocalSpaceVirial( void ) const
+{
+    return _deferReciprocalSpaceVirial;
+}
+
+void MBPolReferencePmeElectrostaticsForce::addReciprocalSpaceVirial( std::vector<RealVec>& virial )
+{
+    if( _virialParticleData.empty() ){
+        return;
+    }
+    ReferenceMBPolTimers::Scope timer("Electrostatics.reciprocalVirial");
+    computeReciprocalSpaceVirial( _virialParticleData, virial );
+    _virialParticleData.clear();
+}
+
+void MBPolReferencePmeElectrostaticsForce::setDirectSpaceCandidatePairs( const NeighborList& candidatePairs )
+{
+    _candidatePairs    = candidatePairs;
+    _hasCandidatePairs = true;
+}
+
+const NeighborList& MBPolReferencePmeElectrostaticsForce::getDirectSpacePairs( void ) const
+{
+    return _directSpacePairs;
+}
+
+void MBPolReferencePmeElectrostaticsForce::buildDirectSpacePairs( const std::vector<ElectrostaticsParticleData>& particleData )
+{
+
+    // all direct-space pair interactions vanish beyond the cutoff, so the
+    // loops below only need the pairs within it
+
+    _directSpacePairs.clear();
+    if( _hasCandidatePairs ){
+        for( unsigned int xx = 0; xx < _candidatePairs.size(); xx++ ){
+            unsigned int ii = _candidatePairs[xx].first;
+            unsigned int jj = _candidatePairs[xx].second;
+            if( isDirectSpacePair( particleData[ii], particleData[jj] ) ){
+                _directSpacePairs.push_back( ii < jj ? AtomPair( ii, jj ) : AtomPair( jj, ii ) );
+            }
+        }
+    } else {
+        for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+            for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
+                if( isDirectSpacePair( particleData[ii], particleData[jj] ) ){
+                    _directSpacePairs.push_back( AtomPair( ii, jj ) );
+                }
+            }
+        }
+    }
+    return;
+}
+
+bool MBPolReferencePmeElectrostaticsForce::isDirectSpacePair( const ElectrostaticsParticleData& particleI, const ElectrostaticsParticleData& particleJ ) const
+{
+
+    // the short-range part keeps the pairs of different waters within the split distance,
+    // whatever the distance of the sites
+
+    if( getShortRangeOnly() ){
+        if( particleI.moleculeIndex == particleJ.moleculeIndex ){
+            return false;
+        }
+        RealVec deltaOO = particleJ.oxygenPosition - particleI.oxygenPosition;
+        getPeriodicDelta( deltaOO );
+        RealOpenMM dWeight;
+        return getShortRangeWeight( deltaOO, dWeight ) > 0.0;
+    }
+    RealVec deltaR  = particleJ.position - particleI.position;
+    getPeriodicDelta( deltaR );
+    return deltaR.dot( deltaR ) <= _cutoffDistanceSquared;
+}
+
 int compareInt2( const int2& v1, const int2& v2 )
 {
     return v1[1] < v2[1];
@@ -1196,7 +1821,9 @@ void MBPolReferencePmeElectrostaticsForce::resizePmeArrays( void )
 {
 
     _totalGridSize = _pmeGridDimensions[0]*_pmeGridDimensions[1]*_pmeGridDimensions[2];
-    if( _pmeGridSize < _totalGridSize ){
+    if( _useSinglePrecisionGrid ){
+        _pmeGridSingle.resize( _totalGridSize );
+    } else if( _pmeGridSize < _totalGridSize ){
         if( _pmeGrid ){
             delete _pmeGrid;
         }
@@ -1222,7 +1849,13 @@ void MBPolReferencePmeElectrostaticsForce::resizePmeArrays( void )
 
 void MBPolReferencePmeElectrostaticsForce::initializePmeGrid( void )
 {
-    if( _pmeGrid == NULL )return;
+    if( _useSinglePrecisionGrid ){
+        for (unsigned int jj = 0; jj < _pmeGridSingle.size(); jj++){
+            _pmeGridSingle[jj].re = _pmeGridSingle[jj].im = 0.0f;
+        }
+        return;
+    }
+    if( _pmeGrid == NULL )return;
     //memset( _pmeGrid, 0, sizeof( t_complex )*_totalGridSize );
 
     for (int jj = 0; jj < _totalGridSize; jj++){
@@ -1231,6 +1864,51 @@ void MBPolReferencePmeElectrostaticsForce::initializePmeGrid( void )
     return;
 }
 
+// the grid values are rounded to float on the way in and widened on the way out,
+// so everything computed from them stays in double precision
+
+inline t_complex MBPolReferencePmeElectrostaticsForce::getPmeGridValue( int index ) const
+{
+    if( _useSinglePrecisionGrid ){
+        t_complex value;
+        value.re = _pmeGridSingle[index].re;
+        value.im = _pmeGridSingle[index].im;
+        return value;
+    }
+    return _pmeGrid[index];
+}
+
+inline void MBPolReferencePmeElectrostaticsForce::setPmeGridValue( int index, RealOpenMM re, RealOpenMM im )
+{
+    if( _useSinglePrecisionGrid ){
+        _pmeGridSingle[index].re = (float) re;
+        _pmeGridSingle[index].im = (float) im;
+    } else {
+        _pmeGrid[index].re = re;
+        _pmeGrid[index].im = im;
+    }
+}
+
+inline void MBPolReferencePmeElectrostaticsForce::scalePmeGridValue( int index, RealOpenMM factor )
+{
+    if( _useSinglePrecisionGrid ){
+        _pmeGridSingle[index].re *= (float) factor;
+        _pmeGridSingle[index].im *= (float) factor;
+    } else {
+        _pmeGrid[index].re *= factor;
+        _pmeGrid[index].im *= factor;
+    }
+}
+
+void MBPolReferencePmeElectrostaticsForce::transformPmeGrid( bool forward )
+{
+    if( _useSinglePrecisionGrid ){
+        _singleFFT.execute( &_pmeGridSingle[0], forward );
+    } else {
+        fftpack_exec_3d( _fftplan, forward ? FFTPACK_FORWARD : FFTPACK_BACKWARD, _pmeGrid, _pmeGrid);
+    }
+}
+
 void MBPolReferencePmeElectrostaticsForce::getPeriodicDelta( RealVec& deltaR ) const
 {
     deltaR[0]  -= FLOOR(deltaR[0]*_invPeriodicBoxSize[0]+0.5)*_periodicBoxSize[0];
@@ -1356,7 +2034,7 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsFieldPair
     getPeriodicDelta( deltaR );
     RealOpenMM r2     = deltaR.dot( deltaR );
 
-    if( r2 > _cutoffDistanceSquared )return;
+    if( r2 > _cutoffDistanceSquared && !getShortRangeOnly() )return;
 
     RealOpenMM r           = SQRT(r2);
 
@@ -1366,7 +2044,10 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsFieldPair
 
     RealOpenMM bn0         = erfc(ralpha)/r;
     RealOpenMM alsq2       = 2.0*_alphaEwald*_alphaEwald;
-    RealOpenMM alsq2n      = 1.0/(SQRT_PI*_alphaEwald);
+    RealOpenMM alsq2n      = 0.0;
+    if( _alphaEwald > 0.0 ){
+        alsq2n = 1.0/(SQRT_PI*_alphaEwald);
+    }
     RealOpenMM exp2a       = EXP(-(ralpha*ralpha));
     alsq2n                *= alsq2;
     RealOpenMM bn1         = (bn0+alsq2n*exp2a)/r2;
@@ -1378,11 +2059,13 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsFieldPair
     // charge - charge
     RealOpenMM s3 = getAndScaleInverseRs( particleI, particleJ, r, true, 3,TCC);
 
-    // FIXME verify this
+    // the real-space term is the bare field less the damped-out part (1 - s3)/r^3;
+    // sites of the same water molecule do not see each other at all
+
     if( isSameWater ){
-    s3 = 2;
+    s3 = 0;
     }
-    RealOpenMM rr3 = (s3 - 1.)/(r2*r);
+    RealOpenMM rr3 = (1. - s3)/(r2*r);
 
     RealVec fid            = - deltaR * rr3 * particleJ.charge;
     RealVec fjd            = + deltaR * rr3 * particleI.charge;
@@ -1390,6 +2073,21 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsFieldPair
     RealVec fip            = - deltaR * rr3 * particleJ.charge;
     RealVec fjp            = + deltaR * rr3 * particleI.charge;
 
+    // weight of the pair in the short-range part
+
+    if( getShortRangeOnly() ){
+        RealVec deltaOO    = particleJ.oxygenPosition - particleI.oxygenPosition;
+        getPeriodicDelta( deltaOO );
+        RealOpenMM dWeight;
+        RealOpenMM weight  = getShortRangeWeight( deltaOO, dWeight );
+        fim               *= weight;
+        fjm               *= weight;
+        fid               *= weight;
+        fjd               *= weight;
+        fip               *= weight;
+        fjp               *= weight;
+    }
+
     // increment the field at each site due to this interaction
 
     unsigned int iIndex    = particleI.particleIndex;
@@ -1409,19 +2107,35 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsFieldPair
 void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsField( const vector<ElectrostaticsParticleData>& particleData )
 {
 
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pairList");
+        buildDirectSpacePairs( particleData );
+    }
+
     // first calculate reciprocal space fixed multipole fields
 
-    resizePmeArrays();
-    computeMBPolBsplines( particleData );
-    sort( _pmeAtomGridIndex.begin(), _pmeAtomGridIndex.end(), compareInt2 );
-    findMBPolAtomRangeForGrid( particleData );
-    initializePmeGrid();
-    spreadFixedElectrostaticssOntoGrid( particleData );
-    fftpack_exec_3d( _fftplan, FFTPACK_FORWARD, _pmeGrid, _pmeGrid);
-    performMBPolReciprocalConvolution();
-    fftpack_exec_3d( _fftplan, FFTPACK_BACKWARD, _pmeGrid, _pmeGrid);
-    computeFixedPotentialFromGrid();
-    recordFixedElectrostaticsField();
+    if( !getShortRangeOnly() ){
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pmeSpread");
+        resizePmeArrays();
+        computeMBPolBsplines( particleData );
+        sort( _pmeAtomGridIndex.begin(), _pmeAtomGridIndex.end(), compareInt2 );
+        findMBPolAtomRangeForGrid( particleData );
+        initializePmeGrid();
+        spreadFixedElectrostaticssOntoGrid( particleData );
+    }
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pmeFFT");
+        transformPmeGrid( true );
+        performMBPolReciprocalConvolution();
+        transformPmeGrid( false );
+    }
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pmeGather");
+        computeFixedPotentialFromGrid();
+        recordFixedElectrostaticsField();
+    }
+    }
 
     // include self-energy portion of the multipole field
     // and initialize _fixedElectrostaticsFieldPolar to _fixedElectrostaticsField
@@ -1433,7 +2147,10 @@ void MBPolReferencePmeElectrostaticsForce::calculateFixedElectrostaticsField( co
 
     // include direct space fixed multipole fields
 
-    this->MBPolReferenceElectrostaticsForce::calculateFixedElectrostaticsField( particleData );
+    ReferenceMBPolTimers::Scope timer("Electrostatics.fixedFieldDirect");
+    for( unsigned int xx = 0; xx < _directSpacePairs.size(); xx++ ){
+        calculateFixedElectrostaticsFieldPairIxn( particleData[_directSpacePairs[xx].first], particleData[_directSpacePairs[xx].second] );
+    }
 
     return;
 }
@@ -1609,10 +2326,12 @@ void MBPolReferencePmeElectrostaticsForce::getGridPointGivenGridIndex( int gridI
 
 RealOpenMM MBPolReferencePmeElectrostaticsForce::computeFixedElectrostaticssGridValue( const vector<ElectrostaticsParticleData>& particleData,
                                                                               const int2& particleGridIndices, const RealVec& scale,
-                                                                              int ix, int iy, const IntVec& gridPoint ) const
+                                                                              int ix, int iy, const IntVec& gridPoint,
+                                                                              bool fixedPoint ) const
 {
 
-    RealOpenMM gridValue = 0.0;
+    RealOpenMM gridValue      = 0.0;
+    long long fixedGridValue  = 0;
     for (int i = _pmeAtomRange[particleGridIndices[0]]; i < _pmeAtomRange[particleGridIndices[1]+1]; ++i) {
         int2 atomData = _pmeAtomGridIndex[i];
         int atomIndex = atomData[0];
@@ -1628,9 +2347,13 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::computeFixedElectrostaticssGrid
         RealOpenMM4 u = _thetai[1][atomIndex*MBPOL_PME_ORDER+iy];
         RealOpenMM4 v = _thetai[2][atomIndex*MBPOL_PME_ORDER+iz];
         RealOpenMM term0 = atomCharge*u[0]*v[0];
-        gridValue += term0*t[0];
+        if( fixedPoint ){
+            fixedGridValue += ReferenceMBPolFixedPointBuffer::toFixed( term0*t[0] );
+        } else {
+            gridValue += term0*t[0];
+        }
     }
-    return gridValue;
+    return fixedPoint ? ReferenceMBPolFixedPointBuffer::toDouble( fixedGridValue ) : gridValue;
 }
 
 void MBPolReferencePmeElectrostaticsForce::spreadFixedElectrostaticssOntoGrid( const vector<ElectrostaticsParticleData>& particleData )
@@ -1638,6 +2361,7 @@ void MBPolReferencePmeElectrostaticsForce::spreadFixedElectrostaticssOntoGrid( c
 
     RealVec scale;
     getPmeScale( scale );
+    bool fixedPoint = (_scheduler && ReferenceMBPolScheduler::getDeterministic());
 
     for (int gridIndex = 0; gridIndex < _totalGridSize; gridIndex++ ){
 
@@ -1658,17 +2382,17 @@ void MBPolReferencePmeElectrostaticsForce::spreadFixedElectrostaticssOntoGrid( c
                 int2 particleGridIndices;
                 particleGridIndices[0]  = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+z1;
                 particleGridIndices[1]  = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+z2;
-                result                 += computeFixedElectrostaticssGridValue( particleData, particleGridIndices, scale, ix, iy, gridPoint );
+                result                 += computeFixedElectrostaticssGridValue( particleData, particleGridIndices, scale, ix, iy, gridPoint, fixedPoint );
 
                 if (z1 > gridPoint[2]){
 
                     particleGridIndices[0]  = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2];
                     particleGridIndices[1]  = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+gridPoint[2];
-                    result                 += computeFixedElectrostaticssGridValue( particleData, particleGridIndices, scale, ix, iy, gridPoint );
+                    result                 += computeFixedElectrostaticssGridValue( particleData, particleGridIndices, scale, ix, iy, gridPoint, fixedPoint );
                 }
             }
         }
-        _pmeGrid[gridIndex].re = result;
+        setPmeGridValue( gridIndex, result, 0.0 );
     }
     return;
 }
@@ -1687,7 +2411,7 @@ void MBPolReferencePmeElectrostaticsForce::performMBPolReciprocalConvolution( vo
         int kz = remainder-ky*_pmeGridDimensions[2];
 
         if (kx == 0 && ky == 0 && kz == 0){
-            _pmeGrid[index].re = _pmeGrid[index].im = 0.0;
+            setPmeGridValue( index, 0.0, 0.0 );
             continue;
         }
 
@@ -1707,8 +2431,7 @@ void MBPolReferencePmeElectrostaticsForce::performMBPolReciprocalConvolution( vo
         RealOpenMM denom = m2*bx*by*bz;
         RealOpenMM eterm = scaleFactor*EXP(-expFactor*m2)/denom;
 
-        _pmeGrid[index].re *= eterm;
-        _pmeGrid[index].im *= eterm;
+        scalePmeGridValue( index, eterm );
     }
 }
 
@@ -1758,7 +2481,7 @@ void MBPolReferencePmeElectrostaticsForce::computeFixedPotentialFromGrid( void )
                 for (int ix = 0; ix < MBPOL_PME_ORDER; ix++) {
                     int i = gridPoint[0]+ix-(gridPoint[0]+ix >= _pmeGridDimensions[0] ? _pmeGridDimensions[0] : 0);
                     int gridIndex = i*_pmeGridDimensions[1]*_pmeGridDimensions[2] + j*_pmeGridDimensions[2] + k;
-                    RealOpenMM tq = _pmeGrid[gridIndex].re;
+                    RealOpenMM tq = getPmeGridValue( gridIndex ).re;
                     RealOpenMM4 tadd = _thetai[0][m*MBPOL_PME_ORDER+ix];
                     t[0] += tq*tadd[0];
                     t[1] += tq*tadd[1];
@@ -1823,7 +2546,7 @@ void MBPolReferencePmeElectrostaticsForce::computeFixedPotentialFromGrid( void )
 t_complex MBPolReferencePmeElectrostaticsForce::computeInducedDipoleGridValue( const int2& particleGridIndices, const RealVec& scale, int ix, int iy,
                                                                            const IntVec& gridPoint,
                                                                            const std::vector<RealVec>& inputInducedDipole,
-                                                                           const std::vector<RealVec>& inputInducedDipolePolar ) const
+                                                                           const std::vector<RealVec>& inputInducedDipolePolar, bool fixedPoint ) const
 {
 
 
@@ -1831,6 +2554,7 @@ t_complex MBPolReferencePmeElectrostaticsForce::computeInducedDipoleGridValue( c
 
     t_complex gridValue;
     gridValue.re = gridValue.im = 0.0;
+    long long fixedGridValue[2] = { 0, 0 };
 
     for (int i = _pmeAtomRange[particleGridIndices[0]]; i < _pmeAtomRange[particleGridIndices[1]+1]; ++i){
         int2 atomData = _pmeAtomGridIndex[i];
@@ -1857,10 +2581,19 @@ t_complex MBPolReferencePmeElectrostaticsForce::computeInducedDipoleGridValue( c
         RealOpenMM term02 = inducedDipolePolar[1]*u[1]*v[0] + inducedDipolePolar[2]*u[0]*v[1];
         RealOpenMM term12 = inducedDipolePolar[0]*u[0]*v[0];
 
-        gridValue.re += term01*t[0] + term11*t[1];
-        gridValue.im += term02*t[0] + term12*t[1];
+        if( fixedPoint ){
+            fixedGridValue[0] += ReferenceMBPolFixedPointBuffer::toFixed( term01*t[0] + term11*t[1] );
+            fixedGridValue[1] += ReferenceMBPolFixedPointBuffer::toFixed( term02*t[0] + term12*t[1] );
+        } else {
+            gridValue.re += term01*t[0] + term11*t[1];
+            gridValue.im += term02*t[0] + term12*t[1];
+        }
 
     }
+    if( fixedPoint ){
+        gridValue.re = ReferenceMBPolFixedPointBuffer::toDouble( fixedGridValue[0] );
+        gridValue.im = ReferenceMBPolFixedPointBuffer::toDouble( fixedGridValue[1] );
+    }
     return gridValue;
 }
 
@@ -1869,6 +2602,7 @@ void MBPolReferencePmeElectrostaticsForce::spreadInducedDipolesOnGrid( const std
 {
     RealVec scale;
     getPmeScale( scale );
+    bool fixedPoint = (_scheduler && ReferenceMBPolScheduler::getDeterministic());
 
     for (int gridIndex = 0; gridIndex < _totalGridSize; gridIndex++ )
     {
@@ -1891,17 +2625,17 @@ void MBPolReferencePmeElectrostaticsForce::spreadInducedDipolesOnGrid( const std
                 int2 particleGridIndices;
                 particleGridIndices[0] = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+z1;
                 particleGridIndices[1] = x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+z2;
-                gridValue             += computeInducedDipoleGridValue( particleGridIndices, scale, ix, iy, gridPoint, inputInducedDipole, inputInducedDipolePolar );
+                gridValue             += computeInducedDipoleGridValue( particleGridIndices, scale, ix, iy, gridPoint, inputInducedDipole, inputInducedDipolePolar, fixedPoint );
 
                 if (z1 > gridPoint[2])
                 {
                     particleGridIndices[0]  =  x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2];
                     particleGridIndices[1]  =  x*_pmeGridDimensions[1]*_pmeGridDimensions[2]+y*_pmeGridDimensions[2]+gridPoint[2];
-                    gridValue              +=  computeInducedDipoleGridValue( particleGridIndices, scale, ix, iy, gridPoint, inputInducedDipole, inputInducedDipolePolar );
+                    gridValue              +=  computeInducedDipoleGridValue( particleGridIndices, scale, ix, iy, gridPoint, inputInducedDipole, inputInducedDipolePolar, fixedPoint );
                 }
             }
         }
-        _pmeGrid[gridIndex] = gridValue;
+        setPmeGridValue( gridIndex, gridValue.re, gridValue.im );
     }
 
     return;
@@ -1989,7 +2723,7 @@ void MBPolReferencePmeElectrostaticsForce::computeInducedPotentialFromGrid( void
                 for (int ix = 0; ix < MBPOL_PME_ORDER; ix++) {
                     int i = gridPoint[0]+ix-(gridPoint[0]+ix >= _pmeGridDimensions[0] ? _pmeGridDimensions[0] : 0);
                     int gridIndex = i*_pmeGridDimensions[1]*_pmeGridDimensions[2] + j*_pmeGridDimensions[2] + k;
-                    t_complex tq = _pmeGrid[gridIndex];
+                    t_complex tq = getPmeGridValue( gridIndex );
                     RealOpenMM4 tadd = _thetai[0][m*MBPOL_PME_ORDER+ix];
                     t0_1 += tq.re*tadd[0];
                     t1_1 += tq.re*tadd[1];
@@ -2264,6 +2998,82 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::computeReciprocalSpaceInducedDi
     return (0.5*_electric*energy);
 }
 
+void MBPolReferencePmeElectrostaticsForce::computeReciprocalSpaceVirial( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                                         std::vector<RealVec>& virial )
+{
+    // structure factor of the charges and the induced dipoles together
+
+    initializePmeGrid();
+    spreadInducedDipolesOnGrid( _inducedDipole, _inducedDipole );
+    std::vector<RealOpenMM> dipoleGrid( _totalGridSize );
+    for (int index = 0; index < _totalGridSize; index++) {
+        dipoleGrid[index] = getPmeGridValue( index ).re;
+    }
+    initializePmeGrid();
+    spreadFixedElectrostaticssOntoGrid( particleData );
+    for (int index = 0; index < _totalGridSize; index++) {
+        setPmeGridValue( index, getPmeGridValue( index ).re + dipoleGrid[index], 0.0 );
+    }
+    transformPmeGrid( true );
+
+    // k-space sum: W_ab = E_k (delta_ab - 2 (1 + pi^2 m^2/alpha^2) m_a m_b/m^2)
+
+    RealOpenMM expFactor   = (M_PI*M_PI)/(_alphaEwald*_alphaEwald);
+    RealOpenMM scaleFactor = 1.0/(M_PI*_periodicBoxSize[0]*_periodicBoxSize[1]*_periodicBoxSize[2]);
+
+    for (int index = 0; index < _totalGridSize; index++)
+    {
+        int kx = index/(_pmeGridDimensions[1]*_pmeGridDimensions[2]);
+        int remainder = index-kx*_pmeGridDimensions[1]*_pmeGridDimensions[2];
+        int ky = remainder/_pmeGridDimensions[2];
+        int kz = remainder-ky*_pmeGridDimensions[2];
+
+        if (kx == 0 && ky == 0 && kz == 0){
+            setPmeGridValue( index, 0.0, 0.0 );
+            continue;
+        }
+
+        int mx = (kx < (_pmeGridDimensions[0]+1)/2) ? kx : (kx-_pmeGridDimensions[0]);
+        int my = (ky < (_pmeGridDimensions[1]+1)/2) ? ky : (ky-_pmeGridDimensions[1]);
+        int mz = (kz < (_pmeGridDimensions[2]+1)/2) ? kz : (kz-_pmeGridDimensions[2]);
+
+        RealVec mh( mx*_invPeriodicBoxSize[0], my*_invPeriodicBoxSize[1], mz*_invPeriodicBoxSize[2] );
+
+        RealOpenMM bx = _pmeBsplineModuli[0][kx];
+        RealOpenMM by = _pmeBsplineModuli[1][ky];
+        RealOpenMM bz = _pmeBsplineModuli[2][kz];
+
+        RealOpenMM m2 = mh.dot( mh );
+        RealOpenMM denom = m2*bx*by*bz;
+        RealOpenMM eterm = scaleFactor*EXP(-expFactor*m2)/denom;
+
+        t_complex structureFactor = getPmeGridValue( index );
+        RealOpenMM energyK = 0.5*_electric*eterm*(structureFactor.re*structureFactor.re + structureFactor.im*structureFactor.im);
+        RealOpenMM vterm   = 2.0*(expFactor + 1.0/m2);
+        for (unsigned int a = 0; a < 3; a++) {
+            for (unsigned int b = 0; b < 3; b++) {
+                virial[a][b] += energyK*((a == b ? 1.0 : 0.0) - vterm*mh[a]*mh[b]);
+            }
+        }
+
+        scalePmeGridValue( index, eterm );
+    }
+    transformPmeGrid( false );
+    computeFixedPotentialFromGrid();
+
+    // the dipoles keep their Cartesian components under strain, which adds -mu_a E_b
+
+    RealVec scale;
+    getPmeScale( scale );
+    for (int i = 0; i < _numParticles; i++ ) {
+        for (unsigned int a = 0; a < 3; a++) {
+            for (unsigned int b = 0; b < 3; b++) {
+                virial[a][b] += _electric*_inducedDipole[i][a]*scale[b]*_phi[20*i+1+b];
+            }
+        }
+    }
+}
+
 void MBPolReferencePmeElectrostaticsForce::recordFixedElectrostaticsField( void )
 {
     RealVec scale;
@@ -2277,23 +3087,53 @@ void MBPolReferencePmeElectrostaticsForce::recordFixedElectrostaticsField( void
     return;
 }
 
-void MBPolReferencePmeElectrostaticsForce::precomputeScale35( const std::vector<ElectrostaticsParticleData>& particleData, RealOpenMM * scale3, RealOpenMM * scale5 )
+void MBPolReferencePmeElectrostaticsForce::buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs )
 {
-    // Precompute scale3 and scale5
-    int xx = 0;
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
-	    RealVec deltaR    = particleData[jj].position - particleData[ii].position;
 
-	    getPeriodicDelta( deltaR );
-	    RealOpenMM r2     = deltaR.dot( deltaR );
+    // the real space Ewald terms and the Thole damping of the direct space pairs
 
-	    RealOpenMM r           = SQRT(r2);
+    RealOpenMM alsq2       = 2.0*_alphaEwald*_alphaEwald;
+    RealOpenMM alsq2n0     = 1.0/(SQRT_PI*_alphaEwald);
 
-	    scale3[xx] = getAndScaleInverseRs(particleData[ii], particleData[jj], r, true, 3, TDD);
-	    scale5[xx] = getAndScaleInverseRs(particleData[ii], particleData[jj], r, true, 5, TDD);
-        xx++;
-        }
+    pairs.clear();
+    pairs.reserve( _directSpacePairs.size() );
+    for( unsigned int xx = 0; xx < _directSpacePairs.size(); xx++ ){
+        unsigned int ii        = _directSpacePairs[xx].first;
+        unsigned int jj        = _directSpacePairs[xx].second;
+        RealVec deltaR         = particleData[jj].position - particleData[ii].position;
+
+        // periodic boundary conditions
+
+        getPeriodicDelta( deltaR );
+        RealOpenMM r2          = deltaR.dot( deltaR );
+
+        if( r2 > _cutoffDistanceSquared )continue;
+
+        RealOpenMM r           = SQRT(r2);
+
+        // calculate the error function damping terms
+
+        RealOpenMM ralpha      = _alphaEwald*r;
+
+        RealOpenMM bn0         = erfc(ralpha)/r;
+        RealOpenMM exp2a       = EXP(-(ralpha*ralpha));
+        RealOpenMM alsq2n      = alsq2n0*alsq2;
+        RealOpenMM bn1         = (bn0+alsq2n*exp2a)/r2;
+
+        alsq2n                *= alsq2;
+        RealOpenMM bn2         = (3.0*bn1+alsq2n*exp2a)/r2;
+
+        // compute the error function scaled and unscaled terms
+
+        RealOpenMM scale3      = getAndScaleInverseRs(particleData[ii], particleData[jj], r, true, 3, TDD);
+        RealOpenMM scale5      = getAndScaleInverseRs(particleData[ii], particleData[jj], r, true, 5, TDD);
+
+        RealOpenMM r3          = (r*r2);
+        RealOpenMM r5          = (r3*r2);
+        RealOpenMM rr3         = (1.0-scale3)/r3;
+        RealOpenMM rr5         = 3.0*(1.0-scale5)/r5;
+
+        pairs.add( ii, jj, deltaR, rr3 - bn1, bn2 - rr5 );
     }
 }
 
@@ -2327,26 +3167,30 @@ void MBPolReferencePmeElectrostaticsForce::calculateReciprocalSpaceInducedDipole
 {
     // Perform PME for the induced dipoles.
 
-    initializePmeGrid();
-    spreadInducedDipolesOnGrid( *(updateInducedDipoleFields[0].inducedDipoles), *(updateInducedDipoleFields[1].inducedDipoles) );
-    fftpack_exec_3d( _fftplan, FFTPACK_FORWARD, _pmeGrid, _pmeGrid);
-    performMBPolReciprocalConvolution();
-    fftpack_exec_3d( _fftplan, FFTPACK_BACKWARD, _pmeGrid, _pmeGrid);
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pmeSpread");
+        initializePmeGrid();
+        spreadInducedDipolesOnGrid( *(updateInducedDipoleFields[0].inducedDipoles), *(updateInducedDipoleFields[1].inducedDipoles) );
+    }
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.pmeFFT");
+        transformPmeGrid( true );
+        performMBPolReciprocalConvolution();
+        transformPmeGrid( false );
+    }
+    ReferenceMBPolTimers::Scope timer("Electrostatics.pmeGather");
     computeInducedPotentialFromGrid();
     recordInducedDipoleField( updateInducedDipoleFields[0].inducedDipoleField, updateInducedDipoleFields[1].inducedDipoleField );
 }
 
 void MBPolReferencePmeElectrostaticsForce::calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
-                                                                     std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, const RealOpenMM scale3[], const RealOpenMM scale5[])
+                                                                     std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                                                     const InducedDipolePairs& pairs )
 {
 
-    unsigned int xx = 0;
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii + 1; jj < particleData.size(); jj++ ){
-            calculateDirectInducedDipolePairIxns( particleData[ii], particleData[jj], updateInducedDipoleFields, scale3[xx], scale5[xx] );
-            xx++;
-        }
-    }
+    // direct space ixns
+
+    addInducedDipolePairFields( pairs, updateInducedDipoleFields );
 
 // FIXME segfault!   // reciprocal space ixns
 
@@ -2366,109 +3210,6 @@ void MBPolReferencePmeElectrostaticsForce::calculateInducedDipoleFields( const s
     return;
 }
 
-void MBPolReferencePmeElectrostaticsForce::calculateDirectInducedDipolePairIxn( unsigned int iIndex, unsigned int jIndex,
-                                                                            RealOpenMM preFactor1, RealOpenMM preFactor2,
-                                                                            const RealVec& delta,
-                                                                            const std::vector<RealVec>& inducedDipole,
-                                                                            std::vector<RealVec>& field ) const
-{
-
-    // field at i due induced dipole at j
-
-    RealOpenMM dur  = inducedDipole[jIndex].dot( delta );
-    field[iIndex]  += delta*(dur*preFactor2) + inducedDipole[jIndex]*preFactor1;
-
-    // field at j due induced dipole at i
-
-               dur  = inducedDipole[iIndex].dot( delta );
-    field[jIndex]  += delta*(dur*preFactor2) + inducedDipole[iIndex]*preFactor1;
-
-    return;
-}
-
-void MBPolReferencePmeElectrostaticsForce::calculateDirectInducedDipolePairIxns( const ElectrostaticsParticleData& particleI,
-                                                                             const ElectrostaticsParticleData& particleJ,
-                                                                             std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
-RealOpenMM scale3, RealOpenMM scale5 )
-{
-
-    // compute the real space portion of the Ewald summation
-
-    RealOpenMM uscale = 1.0;
-    RealVec deltaR    = particleJ.position - particleI.position;
-
-    // periodic boundary conditions
-
-    getPeriodicDelta( deltaR );
-    RealOpenMM r2     = deltaR.dot( deltaR );
-
-    if( r2 > _cutoffDistanceSquared )return;
-
-    RealOpenMM r           = SQRT(r2);
-
-    // calculate the error function damping terms
-
-    RealOpenMM ralpha      = _alphaEwald*r;
-
-    RealOpenMM bn0         = erfc(ralpha)/r;
-    RealOpenMM alsq2       = 2.0*_alphaEwald*_alphaEwald;
-    RealOpenMM alsq2n      = 1.0/(SQRT_PI*_alphaEwald);
-    RealOpenMM exp2a       = EXP(-(ralpha*ralpha));
-    alsq2n                *= alsq2;
-    RealOpenMM bn1         = (bn0+alsq2n*exp2a)/r2;
-
-    alsq2n                *= alsq2;
-    RealOpenMM bn2         = (3.0*bn1+alsq2n*exp2a)/r2;
-
-    // compute the error function scaled and unscaled terms
-
-//    // TODO check if we can use get and scale
-//    RealOpenMM scale3      = 1.0;
-//    RealOpenMM scale5      = 1.0;
-//    RealOpenMM damp        = particleI.dampingFactor*particleJ.dampingFactor;
-//    if( damp != 0.0 ){
-//
-//        RealOpenMM ratio  = (r/damp);
-//        ratio       = ratio*ratio*ratio;
-//        // TODO implement variable thole in PME
-//        RealOpenMM pgamma = particleI.thole[TCC] < particleJ.thole[TCC] ? particleI.thole[TCC] : particleJ.thole[TCC];
-//        damp        = -pgamma*ratio;
-//
-//        if( damp > -50.0) {
-//            RealOpenMM expdamp = expf(damp);
-//            scale3        = 1.0 - expdamp;
-//            scale5        = 1.0 - expdamp*(1.0-damp);
-//        }
-//    }
-
-    RealOpenMM dsc3        = uscale*scale3;
-    RealOpenMM dsc5        = uscale*scale5;
-
-    RealOpenMM r3          = (r*r2);
-    RealOpenMM r5          = (r3*r2);
-    RealOpenMM rr3         = (1.0-dsc3)/r3;
-    RealOpenMM rr5         = 3.0*(1.0-dsc5)/r5;
-
-    RealOpenMM preFactor1  = rr3 - bn1;
-    RealOpenMM preFactor2  = bn2 - rr5;
-
-
-	//if ((particleI.particleIndex==0) & ((particleJ.particleIndex==7) | (particleJ.particleIndex==8)))
-	//{
-    //    printf("preFactor1 %.8g\n", preFactor1);
-    //    printf("preFactor2 %.8g\n", preFactor2);
-    //    printf("r %.8g\n", r);
-	//}
-
-    for( unsigned int ii = 0; ii < updateInducedDipoleFields.size(); ii++ ){
-        calculateDirectInducedDipolePairIxn( particleI.particleIndex, particleJ.particleIndex, preFactor1, preFactor2, deltaR,
-                                            *(updateInducedDipoleFields[ii].inducedDipoles),
-                                              updateInducedDipoleFields[ii].inducedDipoleField );
-    }
-
-    return;
-}
-
 RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeSelfEnergy( const std::vector<ElectrostaticsParticleData>& particleData,
         std::vector<RealVec>& forces, std::vector<RealOpenMM>& electrostaticPotential ) const
 {
@@ -2511,7 +3252,9 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
                                              unsigned int iIndex,
                                              unsigned int jIndex,
                                                                                          std::vector<RealVec>& forces,
-                                                                                         std::vector<RealOpenMM>& electrostaticPotential ) const
+                                                                                         std::vector<RealOpenMM>& electrostaticPotential,
+                                                                                         std::vector<RealOpenMM>& dipolePotential,
+                                                                                         std::vector<RealVec>& virial ) const
 {
 
     ElectrostaticsParticleData particleI = particleData[iIndex];
@@ -2522,7 +3265,7 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
     getPeriodicDelta( deltaR );
     RealOpenMM r2    = deltaR.dot( deltaR );
 
-    if( r2 > _cutoffDistanceSquared )return 0.0;
+    if( r2 > _cutoffDistanceSquared && !getShortRangeOnly() )return 0.0;
 
     RealOpenMM xr    = deltaR[0];
     RealOpenMM yr    = deltaR[1];
@@ -2619,17 +3362,32 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
 	//printf("Energy [%d, %d] %g Kcal\n", particleI.particleIndex, particleJ.particleIndex, (energy/2 ) / 4.184 * conversionFactor);
 	//printf("Energy [%d, %d] %.3f Kcal\n", particleI.particleIndex, particleJ.particleIndex, ralpha);
 
-    electrostaticPotential[iIndex] += ck * (bn0 - rr1 * (1 - scale1CC)); // /2.;
-    electrostaticPotential[jIndex] += ci * (bn0 - rr1 * (1 - scale1CC));//  /2.;
+    // weight of the pair in the short-range part
+
+    RealOpenMM weight   = 1.0;
+    RealOpenMM dWeight  = 0.0;
+    RealVec deltaOO;
+    if( getShortRangeOnly() ){
+        deltaOO = particleJ.oxygenPosition - particleI.oxygenPosition;
+        getPeriodicDelta( deltaOO );
+        weight  = getShortRangeWeight( deltaOO, dWeight );
+    }
+
+    electrostaticPotential[iIndex] += ck * (bn0 - rr1 * (1 - scale1CC)) * weight; // /2.;
+    electrostaticPotential[jIndex] += ci * (bn0 - rr1 * (1 - scale1CC)) * weight;//  /2.;
 
-    electrostaticPotential[iIndex] -= sci4 * (bn1 - rr3 * (1 - scale3CD)); // /2.;
-    electrostaticPotential[jIndex] += sci3 * (bn1 - rr3 * (1 - scale3CD));//  /2.;
+    dipolePotential[iIndex] -= sci4 * (bn1 - rr3 * (1 - scale3CD)) * weight; // /2.;
+    dipolePotential[jIndex] += sci3 * (bn1 - rr3 * (1 - scale3CD)) * weight;//  /2.;
 
     RealOpenMM scale3CC = 0.;
     RealOpenMM scale5CD = 0.;
     RealOpenMM scale5DD =getAndScaleInverseRs(particleI,particleJ,r,true,5,TDD);
     RealOpenMM scale7DD =getAndScaleInverseRs(particleI,particleJ,r,true,7,TDD);
 
+    // directly polarized dipoles do not interact with each other
+
+    RealOpenMM mutual   = getShortRangeOnly() ? 0.0 : 1.0;
+
     if( !isSameWater ) {
         scale3CC = getAndScaleInverseRs(particleI,particleJ,r,true,3,TCC);
         scale5CD = getAndScaleInverseRs(particleI,particleJ,r,true,5,TCD);
@@ -2645,17 +3403,17 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
 
     RealOpenMM gfi1  = 0.5*( bn2* ( gli1
                               + glip1
-                              + scip2 ) // inddip - inddip
-               - bn3*(sci3*scip4+scip3*sci4));
+                              + mutual*scip2 ) // inddip - inddip
+               - mutual*bn3*(sci3*scip4+scip3*sci4));
 
     RealOpenMM gfi2 = -ck*bn1;
     RealOpenMM gfi3 =  ci*bn1;
 
     RealOpenMM gfri1 = 0.5*(rr5 * ( gli1  * (1 - scale5CD)   // charge - inddip
                         + glip1 * (1 - scale5CD)   // charge - inddip
-                  + scip2 * (1 - scale5DD) ) // inddip - inddip
+                  + mutual*scip2 * (1 - scale5DD) ) // inddip - inddip
         //FIXME Should there be an rr7 in front of sci3*scip4????!?
-                      - rr7 * (sci3*scip4+scip3*sci4)
+                      - mutual*rr7 * (sci3*scip4+scip3*sci4)
                               * (1 - scale7DD)   // inddip - inddip
                );
 
@@ -2677,9 +3435,9 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
               +       _inducedDipolePolar[jIndex]) * gfi3
     // inddipP_i* inddip_j
                   + ( _inducedDipolePolar[iIndex] * sci4
-              + _inducedDipole[iIndex] * scip4   ) * bn2
+              + _inducedDipole[iIndex] * scip4   ) * bn2 * mutual
               +  ( _inducedDipolePolar[jIndex] * sci3
-              + _inducedDipole[jIndex]  * scip3   ) * bn2) * 0.5;
+              + _inducedDipole[jIndex]  * scip3   ) * bn2 * mutual) * 0.5;
 
     // get the induced force without screening
 
@@ -2687,7 +3445,7 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
     ftm2ri += ( _inducedDipolePolar[iIndex] * sci4
                       + _inducedDipole[iIndex] * scip4
                           +  _inducedDipolePolar[jIndex] * sci3
-                      + _inducedDipole[jIndex] * scip3)*0.5*rr5*(1 - scale5DD);
+                      + _inducedDipole[jIndex] * scip3)*0.5*rr5*(1 - scale5DD)*mutual;
 
     // Same water atoms have no induced-dipole/charge interaction
 
@@ -2707,9 +3465,27 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculatePmeDirectElectrostatic
 
     energy                 *= conversionFactor;
 
-    forces[iIndex]      -= (ftm2 + ftm2i)*conversionFactor;
+    // the charge - induced dipole energy counts twice in the forces of the weight,
+    // see MBPolReferenceElectrostaticsForce::calculateElectrostaticPairIxn()
+
+    if( dWeight != 0.0 ){
+        RealOpenMM pairEnergy = (e + 0.5*(bn1 - rr3*(1 - scale3CD))*(gli1 + glip1))*conversionFactor;
+        RealVec forceO        = addShortRangeWeightForces( particleI, particleJ, deltaOO, pairEnergy, dWeight, forces );
+        for( unsigned int a = 0; a < 3; a++ ){
+            virial[a]        += forceO*deltaOO[a];
+        }
+    }
+    energy                 *= weight;
+
+    RealVec forceJ       = (ftm2 + ftm2i)*(conversionFactor*weight);
 
-    forces[jIndex]      += (ftm2 + ftm2i)*conversionFactor;
+    forces[iIndex]      -= forceJ;
+
+    forces[jIndex]      += forceJ;
+
+    for( unsigned int a = 0; a < 3; a++ ){
+        virial[a]       += forceJ*deltaR[a];
+    }
 
     return energy;
 
@@ -2720,8 +3496,11 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculateElectrostatic( const s
 {
 
     RealOpenMM energy = 0.0;
+    _virial.assign( 3, RealVec( 0.0, 0.0, 0.0 ) );
+    _virialParticleData.clear();
 
     std::vector<RealOpenMM> electrostaticPotentialDirect(particleData.size());
+    std::vector<RealOpenMM> electrostaticPotentialDirectDipoles(particleData.size());
     std::vector<RealOpenMM> electrostaticPotentialInduced(particleData.size());
     std::vector<RealOpenMM> electrostaticPotentialReciprocal(particleData.size());
     std::vector<RealOpenMM> electrostaticPotentialSelf(particleData.size());
@@ -2730,13 +3509,13 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculateElectrostatic( const s
         electrostaticPotentialReciprocal[ii] = 0.;
         electrostaticPotentialSelf[ii] = 0.;
     }
-    // loop over particle pairs for direct space interactions
-
-    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
-        for( unsigned int jj = ii+1; jj < particleData.size(); jj++ ){
-
-            energy += calculatePmeDirectElectrostaticPairIxn( particleData, ii, jj, forces, electrostaticPotentialDirect );
+    // loop over particle pairs within the cutoff for direct space interactions
 
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.directForces");
+        for( unsigned int xx = 0; xx < _directSpacePairs.size(); xx++ ){
+            energy += calculatePmeDirectElectrostaticPairIxn( particleData, _directSpacePairs[xx].first, _directSpacePairs[xx].second,
+                                                              forces, electrostaticPotentialDirect, electrostaticPotentialDirectDipoles, _virial );
         }
     }
 
@@ -2744,6 +3523,10 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculateElectrostatic( const s
 
     double previousEnergy = energy;
 
+    // the short-range part is the real space sum only
+
+    if( !getShortRangeOnly() ){
+    ReferenceMBPolTimers::Scope timer("Electrostatics.reciprocalForces");
     energy += computeReciprocalSpaceInducedDipoleForceAndEnergy( particleData, forces, electrostaticPotentialInduced );
     printPotential (electrostaticPotentialInduced, energy - previousEnergy , "Reciprocal Induced", particleData);
 
@@ -2756,27 +3539,305 @@ RealOpenMM MBPolReferencePmeElectrostaticsForce::calculateElectrostatic( const s
 
     printPotential (electrostaticPotentialSelf, energy - previousEnergy , "Pme Self energy", particleData);
 
+    // the self energy does not depend on the box; the reciprocal space virial costs another
+    // spreading and a pair of FFTs, so it may be left to addReciprocalSpaceVirial()
+
+    if( _deferReciprocalSpaceVirial ){
+        _virialParticleData = particleData;
+    } else {
+        ReferenceMBPolTimers::Scope virialTimer("Electrostatics.reciprocalVirial");
+        computeReciprocalSpaceVirial( particleData, _virial );
+    }
+    }
+
+    // the potentials of the charges and of the induced dipoles
+
     for (int i=0; i<particleData.size(); i++) {
         electrostaticPotentialDirect[i] += electrostaticPotentialReciprocal[i];
-        electrostaticPotentialDirect[i] += electrostaticPotentialInduced[i];
         electrostaticPotentialDirect[i] += electrostaticPotentialSelf[i];
+        electrostaticPotentialInduced[i] += electrostaticPotentialDirectDipoles[i];
+    }
+    recordSitePotentials( particleData, electrostaticPotentialDirect, electrostaticPotentialInduced );
+    for (int i=0; i<particleData.size(); i++) {
+        electrostaticPotentialDirect[i] += electrostaticPotentialInduced[i];
     }
 
     printPotential (electrostaticPotentialDirect, energy, "Total", particleData);
 
+    // the charges depend only on the geometry of their molecule, so the charge derivative
+    // forces of a molecule add up to zero and their virial is taken relative to one of its sites
+
+    std::vector<int> moleculeReference;
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        unsigned int molecule = particleData[ii].moleculeIndex;
+        if( molecule >= moleculeReference.size() ){
+            moleculeReference.resize( molecule+1, -1 );
+        }
+        if( moleculeReference[molecule] < 0 ){
+            moleculeReference[molecule] = ii;
+        }
+    }
+
     for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        RealVec chargeForce( 0.0, 0.0, 0.0 );
         for( unsigned int s = 0; s < 3; s++ ){
             for( unsigned int xyz = 0; xyz < 3; xyz++ ){
 
-            forces[ii][xyz] += particleData[ii].chargeDerivatives[s][xyz] * electrostaticPotentialDirect[particleData[ii].otherSiteIndex[s]] * -(_electric/(_dielectric));
+            chargeForce[xyz] += particleData[ii].chargeDerivatives[s][xyz] * electrostaticPotentialDirect[particleData[ii].otherSiteIndex[s]] * -(_electric/(_dielectric));
+
+        }}
+        forces[ii] += chargeForce;
 
-        }}    }
+        RealVec deltaR = particleData[ii].position - particleData[moleculeReference[particleData[ii].moleculeIndex]].position;
+        getPeriodicDelta( deltaR );
+        for( unsigned int a = 0; a < 3; a++ ){
+            _virial[a] += chargeForce*deltaR[a];
+        }
+    }
 
 
     return energy;
 }
 
 
+MBPolReferenceTreecodeElectrostaticsForce::MBPolReferenceTreecodeElectrostaticsForce( void ) :
+               MBPolReferenceElectrostaticsForce(Treecode)
+{
+}
+
+MBPolReferenceTreecodeElectrostaticsForce::~MBPolReferenceTreecodeElectrostaticsForce( )
+{
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::setOpeningAngle( RealOpenMM openingAngle )
+{
+    _treecode.setOpeningAngle( openingAngle );
+}
+
+RealOpenMM MBPolReferenceTreecodeElectrostaticsForce::getOpeningAngle( void ) const
+{
+    return _treecode.getOpeningAngle();
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::setExpansionOrder( int order )
+{
+    _treecode.setExpansionOrder( order );
+}
+
+int MBPolReferenceTreecodeElectrostaticsForce::getExpansionOrder( void ) const
+{
+    return _treecode.getExpansionOrder();
+}
+
+int MBPolReferenceTreecodeElectrostaticsForce::getNumNearMoleculePairs( void ) const
+{
+    return _treecode.getNearPairs().size();
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::buildTreecode( const std::vector<ElectrostaticsParticleData>& particleData )
+{
+
+    // sites of each molecule
+
+    std::map<unsigned int, int> moleculeIndexMap;
+    _moleculeSites.clear();
+    std::vector<RealVec> positions( particleData.size() );
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        std::map<unsigned int, int>::iterator entry = moleculeIndexMap.find( particleData[ii].moleculeIndex );
+        if( entry == moleculeIndexMap.end() ){
+            entry = moleculeIndexMap.insert( std::make_pair( particleData[ii].moleculeIndex, (int) _moleculeSites.size() ) ).first;
+            _moleculeSites.push_back( std::vector<int>() );
+        }
+        _moleculeSites[entry->second].push_back( ii );
+        positions[ii] = particleData[ii].position;
+    }
+
+    // molecules within the damping distance are near
+
+    if( _dampingDistance >= unboundedDampingDistance ){
+        throw OpenMMException("MBPolElectrostaticsForce: the treecode requires positive Thole parameters");
+    }
+
+    _treecode.setNearDistance( _dampingDistance );
+    _treecode.build( positions, _moleculeSites );
+
+    // site pairs computed exactly: within each molecule and between near molecules
+
+    _exactPairs.clear();
+    for( unsigned int ii = 0; ii < _moleculeSites.size(); ii++ ){
+        const std::vector<int>& sites = _moleculeSites[ii];
+        for( unsigned int jj = 0; jj < sites.size(); jj++ ){
+            for( unsigned int kk = jj+1; kk < sites.size(); kk++ ){
+                _exactPairs.push_back( AtomPair( sites[jj], sites[kk] ) );
+            }
+        }
+    }
+    const std::vector<std::pair<int, int> >& nearPairs = _treecode.getNearPairs();
+    for( unsigned int ii = 0; ii < nearPairs.size(); ii++ ){
+        const std::vector<int>& sitesI = _moleculeSites[nearPairs[ii].first];
+        const std::vector<int>& sitesJ = _moleculeSites[nearPairs[ii].second];
+        for( unsigned int jj = 0; jj < sitesI.size(); jj++ ){
+            for( unsigned int kk = 0; kk < sitesJ.size(); kk++ ){
+                _exactPairs.push_back( AtomPair( sitesI[jj], sitesJ[kk] ) );
+            }
+        }
+    }
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::calculateFixedElectrostaticsField( const vector<ElectrostaticsParticleData>& particleData )
+{
+
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.treecode");
+        buildTreecode( particleData );
+    }
+
+    for( unsigned int xx = 0; xx < _exactPairs.size(); xx++ ){
+        calculateFixedElectrostaticsFieldPairIxn( particleData[_exactPairs[xx].first], particleData[_exactPairs[xx].second] );
+    }
+
+    std::vector<RealOpenMM> charges( particleData.size() );
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        charges[ii] = particleData[ii].charge;
+    }
+    std::vector<RealVec> field( particleData.size(), RealVec( 0.0, 0.0, 0.0 ) );
+    _treecode.addFarField( &charges, NULL, NULL, field, NULL );
+    for( unsigned int ii = 0; ii < particleData.size(); ii++ ){
+        _fixedElectrostaticsField[ii]      += field[ii];
+        _fixedElectrostaticsFieldPolar[ii] += field[ii];
+    }
+    return;
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs )
+{
+    pairs.clear();
+    pairs.reserve( _exactPairs.size() );
+    for( unsigned int xx = 0; xx < _exactPairs.size(); xx++ ){
+        unsigned int ii   = _exactPairs[xx].first;
+        unsigned int jj   = _exactPairs[xx].second;
+        RealVec deltaR    = particleData[jj].position - particleData[ii].position;
+        RealOpenMM r      = SQRT( deltaR.dot( deltaR ) );
+
+        pairs.add( ii, jj, deltaR, -1 * getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 3, TDD),
+                                        getAndScaleInverseRs(particleData[ii], particleData[jj], r, false, 5, TDD) );
+    }
+}
+
+void MBPolReferenceTreecodeElectrostaticsForce::calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                                              std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                                                              const InducedDipolePairs& pairs )
+{
+    addInducedDipolePairFields( pairs, updateInducedDipoleFields );
+    std::vector<MBPolPlugin::ReferenceMBPolTreecode::FieldSet> sets( updateInducedDipoleFields.size() );
+    for( unsigned int kk = 0; kk < updateInducedDipoleFields.size(); kk++ ){
+        sets[kk].dipoles = updateInducedDipoleFields[kk].inducedDipoles;
+        sets[kk].field   = &updateInducedDipoleFields[kk].inducedDipoleField;
+    }
+    _treecode.addFarFields( sets );
+    return;
+}
+
+RealOpenMM MBPolReferenceTreecodeElectrostaticsForce::calculateElectrostatic( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                                          std::vector<RealVec>& forces )
+{
+
+    RealOpenMM energy = 0.0;
+    unsigned int numParticles = particleData.size();
+    RealVec zeroVec( 0.0, 0.0, 0.0 );
+
+    std::vector<RealVec> pairForces( numParticles, zeroVec );
+    std::vector<RealOpenMM> nearPotential, nearDipolePotential;
+    if( _includeEnergyDecomposition ){
+        nearPotential.assign( numParticles, 0.0 );
+        nearDipolePotential.assign( numParticles, 0.0 );
+    }
+    {
+        ReferenceMBPolTimers::Scope timer("Electrostatics.directForces");
+        for( unsigned int xx = 0; xx < _exactPairs.size(); xx++ ){
+            energy += calculateElectrostaticPairIxn( particleData, _exactPairs[xx].first, _exactPairs[xx].second, pairForces,
+                                                     _includeEnergyDecomposition ? &nearPotential : NULL,
+                                                     _includeEnergyDecomposition ? &nearDipolePotential : NULL );
+        }
+    }
+
+    // the undamped far field of the charges, induced dipoles and polar induced dipoles gives
+    //
+    //   energy = f sum_i ( q_i phi_q/2 - mu_i.E_q/2 )
+    //   force  = f ( q_i (E_q + (E_mu + E_muPolar)/2) + (mu_i + muPolar_i)/2 . grad E_q
+    //                + (mu_i . grad E_muPolar + muPolar_i . grad E_mu)/2 )
+    //
+    // and the charge derivative forces -f sum_s dq_s/dr_i (phi_q + phi_mu) at the charge sites s
+
+    ReferenceMBPolTimers::Scope timer("Electrostatics.treecodeForces");
+    std::vector<RealOpenMM> charges( numParticles );
+    for( unsigned int ii = 0; ii < numParticles; ii++ ){
+        charges[ii] = particleData[ii].charge;
+    }
+    std::vector<RealOpenMM> potential( numParticles, 0.0 ), dipolePotential( numParticles, 0.0 );
+    std::vector<RealVec> field( numParticles, zeroVec ), dipoleField( numParticles, zeroVec ), polarField( numParticles, zeroVec );
+    std::vector<RealVec> gradient( 3*numParticles, zeroVec ), dipoleGradient( 3*numParticles, zeroVec ), polarGradient( 3*numParticles, zeroVec );
+    std::vector<MBPolPlugin::ReferenceMBPolTreecode::FieldSet> sets( 3 );
+    sets[0].charges   = &charges;
+    sets[0].potential = &potential;
+    sets[0].field     = &field;
+    sets[0].gradient  = &gradient;
+    sets[1].dipoles   = &_inducedDipole;
+    sets[1].potential = &dipolePotential;
+    sets[1].field     = &dipoleField;
+    sets[1].gradient  = &dipoleGradient;
+    sets[2].dipoles   = &_inducedDipolePolar;
+    sets[2].field     = &polarField;
+    sets[2].gradient  = &polarGradient;
+    _treecode.addFarFields( sets );
+
+    RealOpenMM f         = _electric/_dielectric;
+    RealOpenMM mutual    = getShortRangeOnly() ? 0.0 : 1.0;
+    RealOpenMM farEnergy = 0.0;
+    for( unsigned int ii = 0; ii < numParticles; ii++ ){
+        const RealVec& dipole      = _inducedDipole[ii];
+        const RealVec& dipolePolar = _inducedDipolePolar[ii];
+        RealVec meanDipole         = (dipole + dipolePolar)*0.5;
+        RealOpenMM charge          = particleData[ii].charge;
+
+        farEnergy    += 0.5*(charge*potential[ii] - dipole.dot( field[ii] ));
+
+        RealVec force = (field[ii] + (dipoleField[ii] + polarField[ii])*0.5)*charge;
+        for( unsigned int c = 0; c < 3; c++ ){
+            force[c] += meanDipole.dot( gradient[3*ii+c] ) +
+                        0.5*mutual*(dipole.dot( polarGradient[3*ii+c] ) + dipolePolar.dot( dipoleGradient[3*ii+c] ));
+        }
+        if( getIncludeChargeRedistribution() ){
+            for( unsigned int s = 0; s < 3; s++ ){
+                unsigned int site = particleData[ii].otherSiteIndex[s];
+                force -= particleData[ii].chargeDerivatives[s]*(potential[site] + dipolePotential[site]);
+            }
+        }
+        pairForces[ii] += force*f;
+    }
+    energy += f*farEnergy;
+
+    if( _includeEnergyDecomposition ){
+        for( unsigned int ii = 0; ii < numParticles; ii++ ){
+            nearPotential[ii]       += potential[ii];
+            nearDipolePotential[ii] += dipolePotential[ii];
+        }
+        recordSitePotentials( particleData, nearPotential, nearDipolePotential );
+    }
+
+    // without periodic images the virial is sum r_i (x) f_i over all sites
+
+    _virial.assign( 3, RealVec( 0.0, 0.0, 0.0 ) );
+    for( unsigned int ii = 0; ii < numParticles; ii++ ){
+        forces[ii] += pairForces[ii];
+        for( unsigned int a = 0; a < 3; a++ ){
+            _virial[a] += pairForces[ii]*particleData[ii].position[a];
+        }
+    }
+
+    return energy;
+}
+
 void MBPolReferenceElectrostaticsForce::printPotential (std::vector<RealOpenMM> electrostaticPotential, RealOpenMM energy, std::string name, const std::vector<ElectrostaticsParticleData>& particleData ) {
 #ifdef DEBUG_MBPOL
     RealOpenMM energyFromPotential = 0;
@@ -2790,9 +3851,92 @@ void MBPolReferenceElectrostaticsForce::printPotential (std::vector<RealOpenMM>
 #endif
 }
 
+// Partridge-Schwenke dipole moment surface: exponents of x1, x2, x3 (plus one) and
+// coefficients of its 84 terms
+
+static const unsigned int idxD0[84] = {
+       1, 1, 1, 2, 1, 1, 1, 2, 2, 3, 1, 1, 1, 1, 2, 2, 2, 3, 3, 4,
+       1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 4, 4, 5, 1, 1, 1, 1, 1,
+       1, 2, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 5, 5, 6, 1, 1, 1, 1,
+       1, 1, 1, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5,
+       5, 6, 6, 7
+};
+
+static const unsigned int idxD1[84] = {
+       1, 1, 2, 1, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1,
+       1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4, 5,
+       6, 1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4,
+       5, 6, 7, 1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2,
+       3, 1, 2, 1
+};
+
+static const unsigned int idxD2[84] = {
+       1, 2, 1, 1, 3, 2, 1, 2, 1, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1,
+       5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1, 6, 5, 4, 3, 2,
+       1, 5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1, 7, 6, 5, 4,
+       3, 2, 1, 6, 5, 4, 3, 2, 1, 5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2,
+       1, 2, 1, 1
+};
+
+
+static const double coefD[84] = {
+      -2.1689686086730e-03, 1.4910379754728e-02, 5.3546078430060e-02,
+      -7.4055995388666e-02,-3.7764333017616e-03, 1.4089887256484e-01,
+      -6.2584207687264e-02,-1.1260393113022e-01,-5.7824159269319e-02,
+       1.4360743650655e-02,-1.5469680141070e-02,-1.3036350092795e-02,
+       2.7515837781556e-02, 1.4098478875076e-01,-2.7663168397781e-02,
+      -5.2378176254797e-03,-1.0237198381792e-02, 8.9571999265473e-02,
+       7.2920263098603e-03,-2.6873260551686e-01, 2.0220870325864e-02,
+      -7.0764766270927e-02, 1.2140640273760e-01, 2.0978491966341e-02,
+      -1.9443840512668e-01, 4.0826835370618e-02,-4.5365190474650e-02,
+       6.2779900072132e-02,-1.3194351021000e-01,-1.4673032718563e-01,
+       1.1894031277247e-01,-6.4952851564679e-03, 8.8503610374493e-02,
+       1.4899437409291e-01, 1.3962841511565e-01,-2.6459446720450e-02,
+      -5.0128914532773e-02, 1.8329676428116e-01,-1.5559089125095e-01,
+      -4.0176879767592e-02, 3.6192059996636e-01, 1.0202887240343e-01,
+       1.9318668580051e-01,-4.3435977107932e-01,-4.2080828803311e-02,
+       1.9144626027273e-01,-1.7851138969948e-01, 1.0524533875070e-01,
+      -1.7954071602185e-02, 5.2022455612120e-02,-2.8891891146828e-01,
+      -4.7452036576319e-02,-1.0939400546289e-01, 3.5916564473568e-01,
+      -2.0162789820172e-01,-3.5838629543696e-01, 5.6706523551202e-03,
+       1.3849337488211e-01,-4.1733982195604e-01, 4.1641570764241e-01,
+      -1.2243429796296e-01, 4.7141730971228e-02,-1.8224510249551e-01,
+      -1.8880981556620e-01,-3.1992359561800e-01,-1.8567550546587e-01,
+       6.1850530431280e-01,-6.1142756235141e-02,-1.6996135584933e-01,
+       5.4252879499871e-01, 6.6128603899427e-01, 1.2107016404639e-02,
+      -1.9633639729189e-01, 2.7652059420824e-03,-2.2684111109778e-01,
+      -4.7924491598635e-01, 2.4287790137314e-01,-1.4296023329441e-01,
+       8.9664665907006e-02,-1.4003228575602e-01,-1.3321543452254e-01,
+      -1.8340983193745e-01, 2.3426707273520e-01, 1.5141050914514e-01
+};
+
+// number of waters whose charges are evaluated together; the per-water arrays of a
+// block stay in the L1 cache and the loops over them vectorize
+
+static const unsigned int waterChargeBlockSize = 64;
+
 void MBPolReferenceElectrostaticsForce::computeWaterCharge(
         ElectrostaticsParticleData& particleO, ElectrostaticsParticleData& particleH1,
         ElectrostaticsParticleData& particleH2,ElectrostaticsParticleData& particleM)
+{
+    ElectrostaticsParticleData* sites[4] = { &particleO, &particleH1, &particleH2, &particleM };
+    computeWaterChargeBlock( sites, 1 );
+}
+
+void MBPolReferenceElectrostaticsForce::computeWaterCharges( std::vector<ElectrostaticsParticleData>& particleData )
+{
+    ElectrostaticsParticleData* sites[4*waterChargeBlockSize];
+    unsigned int numberOfWaters = particleData.size()/4; // FIXME this assumes only waters
+    for( unsigned int first = 0; first < numberOfWaters; first += waterChargeBlockSize ){
+        unsigned int count = std::min( waterChargeBlockSize, numberOfWaters - first );
+        for( unsigned int ii = 0; ii < 4*count; ii++ ){
+            sites[ii] = &particleData[4*first + ii];
+        }
+        computeWaterChargeBlock( sites, count );
+    }
+}
+
+void MBPolReferenceElectrostaticsForce::computeWaterChargeBlock( ElectrostaticsParticleData* const sites[], unsigned int count )
 {
     const double Bohr_A = 0.52917721092; // CODATA 2010
     // M-site positioning (TTM2.1-F)
@@ -2800,7 +3944,6 @@ void MBPolReferenceElectrostaticsForce::computeWaterCharge(
 
     const double gamma1 = 1.0 - gammaM;
     const double gamma2 = gammaM/2;
-    const double ath0 = 1.82400520401572996557;
     const double costhe = -0.24780227221366464506;
     const double reoh = 0.958649;
     const double b1D = 1.0;
@@ -2810,287 +3953,221 @@ void MBPolReferenceElectrostaticsForce::computeWaterCharge(
     const double c1 = -0.1801e0;
     const double c2 = 0.0892e0;
 
+    const unsigned int B = waterChargeBlockSize;
+
+    // geometry, one lane per water (in A)
+
+    double ROH1[3][B], ROH2[3][B], dROH1[B], dROH2[B], costh[B];
 
-    const double e =  1.602176565e-19; // C CODATA 2010
-
-    // interaction energy of 2 unit charges 1A apart
-    const double E_cc = 1.0e-7*(c0*e*c0*e)/1.0e-10; // in J
-    const double Na = 6.02214129e+23; // CODATA 2010
-    const double kcal_J = 4184.0;
-
-    const double CHARGECON = sqrt(E_cc*Na/kcal_J);
-
-    const size_t idxD0[84] = {
-           1, 1, 1, 2, 1, 1, 1, 2, 2, 3, 1, 1, 1, 1, 2, 2, 2, 3, 3, 4,
-           1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 4, 4, 5, 1, 1, 1, 1, 1,
-           1, 2, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 5, 5, 6, 1, 1, 1, 1,
-           1, 1, 1, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5,
-           5, 6, 6, 7
-    };
-
-    const size_t idxD1[84] = {
-           1, 1, 2, 1, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1,
-           1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4, 5,
-           6, 1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2, 3, 1, 2, 1, 1, 2, 3, 4,
-           5, 6, 7, 1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 5, 1, 2, 3, 4, 1, 2,
-           3, 1, 2, 1
-    };
-
-    const size_t idxD2[84] = {
-           1, 2, 1, 1, 3, 2, 1, 2, 1, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1,
-           5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1, 6, 5, 4, 3, 2,
-           1, 5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2, 1, 2, 1, 1, 7, 6, 5, 4,
-           3, 2, 1, 6, 5, 4, 3, 2, 1, 5, 4, 3, 2, 1, 4, 3, 2, 1, 3, 2,
-           1, 2, 1, 1
-    };
-
-
-    const double coefD[84] = {
-          -2.1689686086730e-03, 1.4910379754728e-02, 5.3546078430060e-02,
-          -7.4055995388666e-02,-3.7764333017616e-03, 1.4089887256484e-01,
-          -6.2584207687264e-02,-1.1260393113022e-01,-5.7824159269319e-02,
-           1.4360743650655e-02,-1.5469680141070e-02,-1.3036350092795e-02,
-           2.7515837781556e-02, 1.4098478875076e-01,-2.7663168397781e-02,
-          -5.2378176254797e-03,-1.0237198381792e-02, 8.9571999265473e-02,
-           7.2920263098603e-03,-2.6873260551686e-01, 2.0220870325864e-02,
-          -7.0764766270927e-02, 1.2140640273760e-01, 2.0978491966341e-02,
-          -1.9443840512668e-01, 4.0826835370618e-02,-4.5365190474650e-02,
-           6.2779900072132e-02,-1.3194351021000e-01,-1.4673032718563e-01,
-           1.1894031277247e-01,-6.4952851564679e-03, 8.8503610374493e-02,
-           1.4899437409291e-01, 1.3962841511565e-01,-2.6459446720450e-02,
-          -5.0128914532773e-02, 1.8329676428116e-01,-1.5559089125095e-01,
-          -4.0176879767592e-02, 3.6192059996636e-01, 1.0202887240343e-01,
-           1.9318668580051e-01,-4.3435977107932e-01,-4.2080828803311e-02,
-           1.9144626027273e-01,-1.7851138969948e-01, 1.0524533875070e-01,
-          -1.7954071602185e-02, 5.2022455612120e-02,-2.8891891146828e-01,
-          -4.7452036576319e-02,-1.0939400546289e-01, 3.5916564473568e-01,
-          -2.0162789820172e-01,-3.5838629543696e-01, 5.6706523551202e-03,
-           1.3849337488211e-01,-4.1733982195604e-01, 4.1641570764241e-01,
-          -1.2243429796296e-01, 4.7141730971228e-02,-1.8224510249551e-01,
-          -1.8880981556620e-01,-3.1992359561800e-01,-1.8567550546587e-01,
-           6.1850530431280e-01,-6.1142756235141e-02,-1.6996135584933e-01,
-           5.4252879499871e-01, 6.6128603899427e-01, 1.2107016404639e-02,
-          -1.9633639729189e-01, 2.7652059420824e-03,-2.2684111109778e-01,
-          -4.7924491598635e-01, 2.4287790137314e-01,-1.4296023329441e-01,
-           8.9664665907006e-02,-1.4003228575602e-01,-1.3321543452254e-01,
-          -1.8340983193745e-01, 2.3426707273520e-01, 1.5141050914514e-01
-    };
-
-    double ROH1[3], ROH2[3], RHH[3], dROH1(0), dROH2(0), dRHH(0);
-
-    for (size_t i = 0; i < 3; ++i) {
-        ROH1[i] = particleH1.position[i]*10. - particleO.position[i]*10.; // H1 - O
-        ROH2[i] = particleH2.position[i]*10. - particleO.position[i]*10.; // H2 - O
-        RHH[i] = particleH1.position[i]*10. - particleH2.position[i]*10.; // H1 - H2
-
-        dROH1 += ROH1[i]*ROH1[i];
-        dROH2 += ROH2[i]*ROH2[i];
-        dRHH += RHH[i]*RHH[i];
-    }
-
-    dROH1 = std::sqrt(dROH1);
-    dROH2 = std::sqrt(dROH2);
-    dRHH = std::sqrt(dRHH);
-
-    const double costh =
-        (ROH1[0]*ROH2[0] + ROH1[1]*ROH2[1] + ROH1[2]*ROH2[2])/(dROH1*dROH2);
-
-    const double efac = exp(-b1D*(std::pow((dROH1 - reoh), 2)
-                                     + std::pow((dROH2 - reoh), 2)));
-
-    const double x1 = (dROH1 - reoh)/reoh;
-    const double x2 = (dROH2 - reoh)/reoh;
-    const double x3 = costh - costhe;
-
-    double fmat[3][16];
-
-    for (size_t i = 0; i < 3; ++i) {
-        fmat[i][0] = 0.0;
-        fmat[i][1] = 1.0;
-    }
-
-    for (size_t j = 2; j < 16; ++j) {
-        fmat[0][j] = fmat[0][j - 1]*x1;
-        fmat[1][j] = fmat[1][j - 1]*x2;
-        fmat[2][j] = fmat[2][j - 1]*x3;
-    }
-
-    // Calculate the dipole moment
-
-    double p1(0), p2(0);
-    double pl1 = costh;
-    double pl2 = 0.5*(3*pl1*pl1 - 1.0);
-
-    double dp1dr1(0);
-    double dp1dr2(0);
-    double dp1dcabc(0);
-    double dp2dr1(0);
-    double dp2dr2(0);
-    double dp2dcabc(0);
-
-    for (size_t j = 1; j < 84; ++j) {
-        const size_t inI = idxD0[j];
-        const size_t inJ = idxD1[j];
-        const size_t inK = idxD2[j];
-
-        p1 += coefD[j]*fmat[0][inI]*fmat[1][inJ]*fmat[2][inK];
-        p2 += coefD[j]*fmat[0][inJ]*fmat[1][inI]*fmat[2][inK];
-
-        dp1dr1 +=
-            coefD[j]*(inI - 1)*fmat[0][inI - 1]*fmat[1][inJ]*fmat[2][inK];
-        dp1dr2 +=
-            coefD[j]*(inJ - 1)*fmat[0][inI]*fmat[1][inJ - 1]*fmat[2][inK];
-        dp1dcabc +=
-            coefD[j]*(inK - 1)*fmat[0][inI]*fmat[1][inJ]*fmat[2][inK - 1];
-        dp2dr1 +=
-            coefD[j]*(inJ - 1)*fmat[0][inJ - 1]*fmat[1][inI]*fmat[2][inK];
-        dp2dr2 +=
-            coefD[j]*(inI - 1)*fmat[0][inJ]*fmat[1][inI - 1]*fmat[2][inK];
-        dp2dcabc +=
-            coefD[j]*(inK - 1)*fmat[0][inJ]*fmat[1][inI]*fmat[2][inK - 1];
+    for (unsigned int w = 0; w < count; ++w) {
+        const RealVec& positionO  = sites[4*w]->position;
+        const RealVec& positionH1 = sites[4*w+1]->position;
+        const RealVec& positionH2 = sites[4*w+2]->position;
+        double d1(0), d2(0), dot(0);
+        for (unsigned int i = 0; i < 3; ++i) {
+            ROH1[i][w] = positionH1[i]*10. - positionO[i]*10.; // H1 - O
+            ROH2[i][w] = positionH2[i]*10. - positionO[i]*10.; // H2 - O
+            d1  += ROH1[i][w]*ROH1[i][w];
+            d2  += ROH2[i][w]*ROH2[i][w];
+            dot += ROH1[i][w]*ROH2[i][w];
+        }
+        dROH1[w] = std::sqrt(d1);
+        dROH2[w] = std::sqrt(d2);
+        costh[w] = dot/(dROH1[w]*dROH2[w]);
+    }
+
+    // powers of x1, x2, x3: fmat[.][k] = x^(k-1), fmat[.][0] = 0
+
+    double fmat[3][8][B], efac[B];
+
+    for (unsigned int w = 0; w < count; ++w) {
+        efac[w] = exp(-b1D*(std::pow((dROH1[w] - reoh), 2)
+                          + std::pow((dROH2[w] - reoh), 2)));
+        for (unsigned int i = 0; i < 3; ++i) {
+            fmat[i][0][w] = 0.0;
+            fmat[i][1][w] = 1.0;
+        }
+        fmat[0][2][w] = (dROH1[w] - reoh)/reoh;
+        fmat[1][2][w] = (dROH2[w] - reoh)/reoh;
+        fmat[2][2][w] = costh[w] - costhe;
+    }
+    for (unsigned int k = 3; k < 8; ++k) {
+        for (unsigned int w = 0; w < count; ++w) {
+            fmat[0][k][w] = fmat[0][k - 1][w]*fmat[0][2][w];
+            fmat[1][k][w] = fmat[1][k - 1][w]*fmat[1][2][w];
+            fmat[2][k][w] = fmat[2][k - 1][w]*fmat[2][2][w];
+        }
+    }
+
+    // Calculate the dipole moment: the terms in the outer loop, the waters in the inner one
+
+    double p1[B], p2[B], dp1dr1[B], dp1dr2[B], dp1dcabc[B], dp2dr1[B], dp2dr2[B], dp2dcabc[B];
+
+    for (unsigned int w = 0; w < count; ++w) {
+        p1[w] = p2[w] = 0.0;
+        dp1dr1[w] = dp1dr2[w] = dp1dcabc[w] = 0.0;
+        dp2dr1[w] = dp2dr2[w] = dp2dcabc[w] = 0.0;
+    }
+
+    for (unsigned int j = 1; j < 84; ++j) {
+        const unsigned int inI = idxD0[j];
+        const unsigned int inJ = idxD1[j];
+        const unsigned int inK = idxD2[j];
+
+        const double coef  = coefD[j];
+        const double coefI = coefD[j]*(inI - 1.0);
+        const double coefJ = coefD[j]*(inJ - 1.0);
+        const double coefK = coefD[j]*(inK - 1.0);
+
+        const double* f0I  = fmat[0][inI];
+        const double* f0J  = fmat[0][inJ];
+        const double* f0I1 = fmat[0][inI - 1];
+        const double* f0J1 = fmat[0][inJ - 1];
+        const double* f1I  = fmat[1][inI];
+        const double* f1J  = fmat[1][inJ];
+        const double* f1I1 = fmat[1][inI - 1];
+        const double* f1J1 = fmat[1][inJ - 1];
+        const double* f2K  = fmat[2][inK];
+        const double* f2K1 = fmat[2][inK - 1];
+
+        for (unsigned int w = 0; w < count; ++w) {
+            p1[w]       += coef*f0I[w]*f1J[w]*f2K[w];
+            p2[w]       += coef*f0J[w]*f1I[w]*f2K[w];
+            dp1dr1[w]   += coefI*f0I1[w]*f1J[w]*f2K[w];
+            dp1dr2[w]   += coefJ*f0I[w]*f1J1[w]*f2K[w];
+            dp1dcabc[w] += coefK*f0I[w]*f1J[w]*f2K1[w];
+            dp2dr1[w]   += coefJ*f0J1[w]*f1I[w]*f2K[w];
+            dp2dr2[w]   += coefI*f0J[w]*f1I1[w]*f2K[w];
+            dp2dcabc[w] += coefK*f0J[w]*f1I[w]*f2K1[w];
+        }
     }
 
     const double xx = Bohr_A;
     const double xx2 = xx*xx;
-
-    dp1dr1 /= reoh/xx;
-    dp1dr2 /= reoh/xx;
-    dp2dr1 /= reoh/xx;
-    dp2dr2 /= reoh/xx;
-
-    const double pc0 =
-        a*(std::pow(dROH1, b) + std::pow(dROH2, b))*(c0 + pl1*c1 + pl2*c2);
-
-    const double dpc0dr1 =
-        a*b*std::pow(dROH1, b - 1)*(c0 + pl1*c1 + pl2*c2)*xx2;
-    const double dpc0dr2 =
-        a*b*std::pow(dROH2, b - 1)*(c0 + pl1*c1 + pl2*c2)*xx2;
-    double dpc0dcabc =
-        a*(std::pow(dROH1, b) + std::pow(dROH2, b))*(c1 + 0.5*(6.0*pl1)*c2)*xx;
-
-    const double defacdr1 = -2.0*b1D*(dROH1 - reoh)*efac*xx;
-    const double defacdr2 = -2.0*b1D*(dROH2 - reoh)*efac*xx;
-
-    dp1dr1 = dp1dr1*efac + p1*defacdr1 + dpc0dr1;
-    dp1dr2 = dp1dr2*efac + p1*defacdr2 + dpc0dr2;
-    dp1dcabc = dp1dcabc*efac + dpc0dcabc;
-    dp2dr1 = dp2dr1*efac + p2*defacdr1 + dpc0dr1;
-    dp2dr2 = dp2dr2*efac + p2*defacdr2 + dpc0dr2;
-    dp2dcabc = dp2dcabc*efac + dpc0dcabc;
-
-    p1 = coefD[0] + p1*efac + pc0*xx; // q^H1 in TTM2-F
-    p2 = coefD[0] + p2*efac + pc0*xx; // q^H2 paper
-
-    double chargeO= -(p1 + p2);  // Oxygen
-    double chargeH1 = p1; // Hydrogen-1
-    double chargeH2 = p2;  // Hydrogen-2
-    double gamma2div1 = gamma2/gamma1;
-
-    particleO.charge = 0.;
-    particleH1.charge = chargeH1 + gamma2div1*(chargeH1 + chargeH2);
-    particleH2.charge = chargeH2 + gamma2div1*(chargeH1 + chargeH2);
-    particleM.charge = chargeO/gamma1;
-
-    dp1dr1 /= xx;
-    dp1dr2 /= xx;
-    dp2dr1 /= xx;
-    dp2dr2 /= xx;
-
-    const double f1q1r13 = (dp1dr1 - (dp1dcabc*costh/dROH1))/dROH1;
-    const double f1q1r23 = dp1dcabc/(dROH1*dROH2);
-    const double f2q1r23 = (dp1dr2 - (dp1dcabc*costh/dROH2))/dROH2;
-    const double f2q1r13 = dp1dcabc/(dROH2*dROH1);
-    const double f1q2r13 = (dp2dr1 - (dp2dcabc*costh/dROH1))/dROH1;
-    const double f1q2r23 = dp2dcabc/(dROH1*dROH2);
-    const double f2q2r23 = (dp2dr2 - (dp2dcabc*costh/dROH2))/dROH2;
-    const double f2q2r13 = dp2dcabc/(dROH2*dROH1);
+    const double gamma2div1 = gamma2/gamma1;
 
     // first index is atom w.r.t. to which the derivative is
     // second index is the charge being differentiated
 
     enum ChargeDerivativesIndices { vsH1, vsH2, vsO };
 
-    std:vector<RealVec> chargeDerivativesH1;
-    chargeDerivativesH1.resize(3);
+    for (unsigned int w = 0; w < count; ++w) {
 
-    //gradient of charge h1(second index) wrt displacement of h1(first index)
-    for (size_t i = 0; i < 3; ++i) {
-        chargeDerivativesH1[vsH1][i] = f1q1r13*ROH1[i] + f1q1r23*ROH2[i];
-        chargeDerivativesH1[vsH2][i] = f2q1r13*ROH1[i] + f2q1r23*ROH2[i];
-        chargeDerivativesH1[vsO][i] = -(chargeDerivativesH1[vsH1][i]+chargeDerivativesH1[vsH2][i]);
-    }
+        ElectrostaticsParticleData& particleO  = *sites[4*w];
+        ElectrostaticsParticleData& particleH1 = *sites[4*w+1];
+        ElectrostaticsParticleData& particleH2 = *sites[4*w+2];
+        ElectrostaticsParticleData& particleM  = *sites[4*w+3];
 
-    std::vector<RealVec> chargeDerivativesH2;
-    chargeDerivativesH2.resize(3);
+        const double pl1 = costh[w];
+        const double pl2 = 0.5*(3*pl1*pl1 - 1.0);
 
-        //gradient of charge h1(second index) wrt displacement of h1(first index)
-    for (size_t i = 0; i < 3; ++i) {
-            chargeDerivativesH2[vsH1][i] = f1q2r13*ROH1[i] + f1q2r23*ROH2[i];
-            chargeDerivativesH2[vsH2][i] = f2q2r13*ROH1[i] + f2q2r23*ROH2[i];
-            chargeDerivativesH2[vsO][i] = -(chargeDerivativesH2[vsH1][i]+chargeDerivativesH2[vsH2][i]);
-    }
+        double q1dr1   = dp1dr1[w]/(reoh/xx);
+        double q1dr2   = dp1dr2[w]/(reoh/xx);
+        double q2dr1   = dp2dr1[w]/(reoh/xx);
+        double q2dr2   = dp2dr2[w]/(reoh/xx);
 
-    std::vector<RealVec> chargeDerivativesO;
-    chargeDerivativesO.resize(3);
+        const double pc0 =
+            a*(std::pow(dROH1[w], b) + std::pow(dROH2[w], b))*(c0 + pl1*c1 + pl2*c2);
 
-        //gradient of charge h1(second index) wrt displacement of h1(first index)
-    for (size_t i = 0; i < 3; ++i) {
-            chargeDerivativesO[vsH1][i] = -(chargeDerivativesH1[vsH1][i]+ chargeDerivativesH2[vsH1][i]);
-            chargeDerivativesO[vsH2][i] =  -(chargeDerivativesH1[vsH2][i]+ chargeDerivativesH2[vsH2][i]);
-            chargeDerivativesO[vsO][i] =  -(chargeDerivativesH1[vsO][i]+ chargeDerivativesH2[vsO][i]);
-    }
+        const double dpc0dr1 =
+            a*b*std::pow(dROH1[w], b - 1)*(c0 + pl1*c1 + pl2*c2)*xx2;
+        const double dpc0dr2 =
+            a*b*std::pow(dROH2[w], b - 1)*(c0 + pl1*c1 + pl2*c2)*xx2;
+        const double dpc0dcabc =
+            a*(std::pow(dROH1[w], b) + std::pow(dROH2[w], b))*(c1 + 0.5*(6.0*pl1)*c2)*xx;
 
-    double sumH1, sumH2, sumO;
+        const double defacdr1 = -2.0*b1D*(dROH1[w] - reoh)*efac[w]*xx;
+        const double defacdr2 = -2.0*b1D*(dROH2[w] - reoh)*efac[w]*xx;
 
-    for (size_t i = 0; i < 3; ++i) {
-        particleM.chargeDerivatives[vsH1f][i] = 0.;
-        particleM.chargeDerivatives[vsH2f][i] = 0.;
-        particleM.chargeDerivatives[vsMf][i] = 0.;
+        q1dr1 = q1dr1*efac[w] + p1[w]*defacdr1 + dpc0dr1;
+        q1dr2 = q1dr2*efac[w] + p1[w]*defacdr2 + dpc0dr2;
+        const double q1dcabc = dp1dcabc[w]*efac[w] + dpc0dcabc;
+        q2dr1 = q2dr1*efac[w] + p2[w]*defacdr1 + dpc0dr1;
+        q2dr2 = q2dr2*efac[w] + p2[w]*defacdr2 + dpc0dr2;
+        const double q2dcabc = dp2dcabc[w]*efac[w] + dpc0dcabc;
 
-        sumH1 = gamma2div1*(chargeDerivativesH1[vsH1][i]+chargeDerivativesH2[vsH1][i]);
-        sumH2 = gamma2div1*(chargeDerivativesH1[vsH2][i]+chargeDerivativesH2[vsH2][i]);
-        sumO = gamma2div1*(chargeDerivativesH1[vsO][i]+chargeDerivativesH2[vsO][i]);
+        const double chargeH1 = coefD[0] + p1[w]*efac[w] + pc0*xx; // q^H1 in TTM2-F
+        const double chargeH2 = coefD[0] + p2[w]*efac[w] + pc0*xx; // q^H2 paper
+        const double chargeO  = -(chargeH1 + chargeH2);  // Oxygen
 
-        particleH1.chargeDerivatives[vsH1f][i] = chargeDerivativesH1[vsH1][i] + sumH1;
-        particleH2.chargeDerivatives[vsH1f][i] = chargeDerivativesH1[vsH2][i] + sumH2;
-        particleO.chargeDerivatives[vsH1f][i]  = chargeDerivativesH1[vsO][i] + sumO;
+        particleO.charge = 0.;
+        particleH1.charge = chargeH1 + gamma2div1*(chargeH1 + chargeH2);
+        particleH2.charge = chargeH2 + gamma2div1*(chargeH1 + chargeH2);
+        particleM.charge = chargeO/gamma1;
 
-        particleH1.chargeDerivatives[vsH2f][i] = chargeDerivativesH2[vsH1][i] + sumH1;
-        particleH2.chargeDerivatives[vsH2f][i] = chargeDerivativesH2[vsH2][i] + sumH2;
-        particleO.chargeDerivatives[vsH2f][i]  = chargeDerivativesH2[vsO][i] +  sumO;
+        q1dr1 /= xx;
+        q1dr2 /= xx;
+        q2dr1 /= xx;
+        q2dr2 /= xx;
 
-        particleH1.chargeDerivatives[vsMf][i] = chargeDerivativesO[vsH1][i] - 2*sumH1;
-        particleH2.chargeDerivatives[vsMf][i] = chargeDerivativesO[vsH2][i] - 2*sumH2;
-        particleO.chargeDerivatives[vsMf][i]  = chargeDerivativesO[vsO][i]  - 2*sumO;
+        const double f1q1r13 = (q1dr1 - (q1dcabc*costh[w]/dROH1[w]))/dROH1[w];
+        const double f1q1r23 = q1dcabc/(dROH1[w]*dROH2[w]);
+        const double f2q1r23 = (q1dr2 - (q1dcabc*costh[w]/dROH2[w]))/dROH2[w];
+        const double f2q1r13 = q1dcabc/(dROH2[w]*dROH1[w]);
+        const double f1q2r13 = (q2dr1 - (q2dcabc*costh[w]/dROH1[w]))/dROH1[w];
+        const double f1q2r23 = q2dcabc/(dROH1[w]*dROH2[w]);
+        const double f2q2r23 = (q2dr2 - (q2dcabc*costh[w]/dROH2[w]))/dROH2[w];
+        const double f2q2r13 = q2dcabc/(dROH2[w]*dROH1[w]);
 
-    }
+        double chargeDerivativesH1[3][3], chargeDerivativesH2[3][3], chargeDerivativesO[3][3];
+
+        for (unsigned int i = 0; i < 3; ++i) {
+
+            //gradient of charge h1(second index) wrt displacement of h1(first index)
+
+            chargeDerivativesH1[vsH1][i] = f1q1r13*ROH1[i][w] + f1q1r23*ROH2[i][w];
+            chargeDerivativesH1[vsH2][i] = f2q1r13*ROH1[i][w] + f2q1r23*ROH2[i][w];
+            chargeDerivativesH1[vsO][i] = -(chargeDerivativesH1[vsH1][i]+chargeDerivativesH1[vsH2][i]);
+
+            chargeDerivativesH2[vsH1][i] = f1q2r13*ROH1[i][w] + f1q2r23*ROH2[i][w];
+            chargeDerivativesH2[vsH2][i] = f2q2r13*ROH1[i][w] + f2q2r23*ROH2[i][w];
+            chargeDerivativesH2[vsO][i] = -(chargeDerivativesH2[vsH1][i]+chargeDerivativesH2[vsH2][i]);
 
-    // convert from q/A to q/nm
-    for (unsigned int i = 0; i < 3; ++i) {
-        for (unsigned int s = 0; s < 3; ++s) {
-            particleH1.chargeDerivatives[s][i] *= 10;
-            particleH2.chargeDerivatives[s][i] *= 10;
-            particleO.chargeDerivatives[s][i] *= 10;
+            chargeDerivativesO[vsH1][i] = -(chargeDerivativesH1[vsH1][i]+ chargeDerivativesH2[vsH1][i]);
+            chargeDerivativesO[vsH2][i] =  -(chargeDerivativesH1[vsH2][i]+ chargeDerivativesH2[vsH2][i]);
+            chargeDerivativesO[vsO][i] =  -(chargeDerivativesH1[vsO][i]+ chargeDerivativesH2[vsO][i]);
         }
 
-    }
+        for (unsigned int i = 0; i < 3; ++i) {
+            particleM.chargeDerivatives[vsH1f][i] = 0.;
+            particleM.chargeDerivatives[vsH2f][i] = 0.;
+            particleM.chargeDerivatives[vsMf][i] = 0.;
 
-    // TODO implement as list
+            double sumH1 = gamma2div1*(chargeDerivativesH1[vsH1][i]+chargeDerivativesH2[vsH1][i]);
+            double sumH2 = gamma2div1*(chargeDerivativesH1[vsH2][i]+chargeDerivativesH2[vsH2][i]);
+            double sumO = gamma2div1*(chargeDerivativesH1[vsO][i]+chargeDerivativesH2[vsO][i]);
 
-    particleH1.otherSiteIndex[vsH1f] = particleH1.particleIndex;
-    particleH1.otherSiteIndex[vsH2f] = particleH2.particleIndex;
-    particleH1.otherSiteIndex[vsMf]  = particleM.particleIndex;
+            // convert from q/A to q/nm
 
-    particleH2.otherSiteIndex[vsH1f] = particleH1.particleIndex;
-    particleH2.otherSiteIndex[vsH2f] = particleH2.particleIndex;
-    particleH2.otherSiteIndex[vsMf]  = particleM.particleIndex;
+            particleH1.chargeDerivatives[vsH1f][i] = (chargeDerivativesH1[vsH1][i] + sumH1)*10;
+            particleH2.chargeDerivatives[vsH1f][i] = (chargeDerivativesH1[vsH2][i] + sumH2)*10;
+            particleO.chargeDerivatives[vsH1f][i]  = (chargeDerivativesH1[vsO][i] + sumO)*10;
 
-    particleM.otherSiteIndex[vsH1f] = particleH1.particleIndex;
-    particleM.otherSiteIndex[vsH2f] = particleH2.particleIndex;
-    particleM.otherSiteIndex[vsMf]  = particleM.particleIndex;
+            particleH1.chargeDerivatives[vsH2f][i] = (chargeDerivativesH2[vsH1][i] + sumH1)*10;
+            particleH2.chargeDerivatives[vsH2f][i] = (chargeDerivativesH2[vsH2][i] + sumH2)*10;
+            particleO.chargeDerivatives[vsH2f][i]  = (chargeDerivativesH2[vsO][i] +  sumO)*10;
 
-    particleO.otherSiteIndex[vsH1f] = particleH1.particleIndex;
-    particleO.otherSiteIndex[vsH2f] = particleH2.particleIndex;
-    particleO.otherSiteIndex[vsMf]  = particleM.particleIndex;
+            particleH1.chargeDerivatives[vsMf][i] = (chargeDerivativesO[vsH1][i] - 2*sumH1)*10;
+            particleH2.chargeDerivatives[vsMf][i] = (chargeDerivativesO[vsH2][i] - 2*sumH2)*10;
+            particleO.chargeDerivatives[vsMf][i]  = (chargeDerivativesO[vsO][i]  - 2*sumO)*10;
+        }
 
+        // TODO implement as list
+
+        particleH1.otherSiteIndex[vsH1f] = particleH1.particleIndex;
+        particleH1.otherSiteIndex[vsH2f] = particleH2.particleIndex;
+        particleH1.otherSiteIndex[vsMf]  = particleM.particleIndex;
+
+        particleH2.otherSiteIndex[vsH1f] = particleH1.particleIndex;
+        particleH2.otherSiteIndex[vsH2f] = particleH2.particleIndex;
+        particleH2.otherSiteIndex[vsMf]  = particleM.particleIndex;
+
+        particleM.otherSiteIndex[vsH1f] = particleH1.particleIndex;
+        particleM.otherSiteIndex[vsH2f] = particleH2.particleIndex;
+        particleM.otherSiteIndex[vsMf]  = particleM.particleIndex;
+
+        particleO.otherSiteIndex[vsH1f] = particleH1.particleIndex;
+        particleO.otherSiteIndex[vsH2f] = particleH2.particleIndex;
+        particleO.otherSiteIndex[vsMf]  = particleM.particleIndex;
+    }
 }
@@ -26,8 +26,12 @@
 
 #include <vector>
 #include "openmm/reference/RealVec.h"
+#include "openmm/reference/ReferenceNeighborList.h"
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include "openmm/MBPolElectrostaticsForce.h"
+#include "ReferenceMBPolTreecode.h"
+#include "ReferenceMBPolSingleFFT.h"
+#include "ReferenceMBPolScheduler.h"
 #include <map>
 #include "openmm/reference/fftpack.h"
 #include <complex>
@@ -300,9 +304,10 @@ class MBPolReferenceElectrostaticsForce {
     *
     *           virtual calculateInducedDipoleFields()      calculate induced dipole field at each site by looping over particle pairs
     *                                                       for PME includes reciprocal space calculation calculateReciprocalSpaceInducedDipoleField(),
-    *                                                       direct space calculateDirectInducedDipolePairIxns() and self terms
+    *                                                       direct space and self terms
     *
-    *              virtual calculateInducedDipolePairIxns() field at particle i due particle j's induced dipole and vice versa; for GK includes GK field
+    *              addInducedDipolePairFields()             field at particle i due particle j's induced dipole and vice versa, from the
+    *                                                       pair table filled once per evaluation by virtual buildInducedDipolePairs()
     */
 
 public:
@@ -322,7 +327,13 @@ public:
          * Periodic boundary conditions are used, and Particle-Mesh Ewald (PME) summation is used to compute the interaction of each particle
          * with all periodic copies of every other particle.
          */
-        PME = 1
+        PME = 1,
+
+        /**
+         * No periodic boundary conditions. Interactions of molecules beyond the Thole damping distance
+         * are computed with a Barnes-Hut treecode in O(N log N), the rest exactly.
+         */
+        Treecode = 2
     };
 
     enum ChargeDerivativesIndicesFinal { vsH1f, vsH2f, vsMf };
@@ -381,6 +392,119 @@ public:
 
     bool getIncludeChargeRedistribution( void ) const;
 
+    /**
+     * Restrict the calculation to the short-range part used on the inner step of a
+     * multiple time step integrator: the induced dipoles are the directly polarized
+     * ones (no self-consistent iterations), the induced dipole - induced dipole
+     * interactions are omitted, and every pair is weighted by a switch of the
+     * oxygen-oxygen distance of its waters (see setShortRangeSplit()). For PME there
+     * are no reciprocal space terms; set alphaEwald to 0 for bare interactions.
+     *
+     * @param shortRangeOnly if true, only compute the short-range part
+     */
+    void setShortRangeOnly( bool shortRangeOnly );
+
+    /**
+     * Set the switch of the short-range part: pairs of waters closer than
+     * splitDistance - splitWidth have weight 1, pairs beyond splitDistance weight 0,
+     * with the cosine switch of MBPolReferenceTwoBodyForce in between.
+     *
+     * @param splitDistance  oxygen-oxygen distance beyond which pairs are omitted (nm)
+     * @param splitWidth     width of the switch (nm)
+     */
+    void setShortRangeSplit( RealOpenMM splitDistance, RealOpenMM splitWidth );
+
+    /**
+     * Get whether only the short-range part is computed.
+     *
+     * @return true if only the short-range part is computed
+     */
+    bool getShortRangeOnly( void ) const;
+
+    /**
+     * Get the virial tensor of the last call to calculateForceAndEnergy(): three rows with
+     * virial[a][b] = sum r_a f_b, i.e. minus the derivative of the energy with respect to
+     * the strain of the system at fixed induced dipoles. With PME and a deferred reciprocal
+     * space virial, that part is missing until addReciprocalSpaceVirial() adds it.
+     *
+     * @return virial tensor (kJ/mol)
+     */
+    const std::vector<RealVec>& getVirial( void ) const;
+
+    /**
+     * Set whether calculateForceAndEnergy() also records the electrostatic potential at every
+     * site, see getPermanentPotentials() and getInducedPotentials().
+     *
+     * @param includeEnergyDecomposition if true, record the site potentials
+     */
+    void setIncludeEnergyDecomposition( bool includeEnergyDecomposition );
+
+    bool getIncludeEnergyDecomposition( void ) const;
+
+    /**
+     * Set the scheduler that spreads the induced dipole field loop over threads;
+     * with none (the default) the loop runs on the calling thread.
+     *
+     * @param scheduler  scheduler owned by the caller, kept from evaluation to evaluation
+     */
+    void setScheduler( ReferenceMBPolScheduler* scheduler );
+
+    /**
+     * Set whether the induced dipole iterations reuse the pair table built once per
+     * evaluation (the default); if false the table is rebuilt in every iteration, which
+     * gives the same dipoles and is only kept to measure what the table saves.
+     *
+     * @param usePairTable  if true, build the pair table once per evaluation
+     */
+    static void setUseInducedDipolePairTable( bool usePairTable );
+
+    static bool getUseInducedDipolePairTable( void );
+
+    /**
+     * Get the potential at every site due to the charges of the other sites in the last call to
+     * calculateForceAndEnergy() with the energy decomposition, damped, screened and excluded as
+     * in the energy (kJ/mol/e). Half the sum of charge times potential is the charge - charge energy.
+     */
+    const std::vector<RealOpenMM>& getPermanentPotentials( void ) const;
+
+    /**
+     * Get the potential at every site due to the induced dipoles of the other sites, as
+     * getPermanentPotentials(). Half the sum of charge times potential is the induction energy.
+     */
+    const std::vector<RealOpenMM>& getInducedPotentials( void ) const;
+
+    /**
+     * Get the site charges the potentials go with, after the charge redistribution of the waters.
+     */
+    const std::vector<RealOpenMM>& getSiteCharges( void ) const;
+
+    /**
+     * Get the damping distance of the last evaluation: beyond it the Thole damping of every
+     * pair of sites of different waters is 1 to double precision.
+     *
+     * @return damping distance (nm)
+     */
+    RealOpenMM getDampingDistance( void ) const;
+
+    /**
+     * Start the induced dipole iterations from the given dipoles, e.g. the converged ones of
+     * a nearby configuration, instead of from the directly polarized dipoles.
+     *
+     * @param inducedDipole       initial induced dipoles, one per particle
+     * @param inducedDipolePolar  initial polar induced dipoles, one per particle
+     */
+    void setInitialInducedDipoles( const std::vector<RealVec>& inducedDipole, const std::vector<RealVec>& inducedDipolePolar );
+
+    /**
+     * Get the induced dipoles of the last call to calculateForceAndEnergy().
+     */
+    const std::vector<RealVec>& getInducedDipoles( void ) const;
+
+    /**
+     * Get the polar induced dipoles of the last call to calculateForceAndEnergy().
+     */
+    const std::vector<RealVec>& getInducedDipolesPolar( void ) const;
+
     void setTholeParameters( std::vector<RealOpenMM> tholeP) {
         _tholeParameters=tholeP;
     }
@@ -517,6 +641,8 @@ protected:
             RealOpenMM polarity;
             unsigned int moleculeIndex;
             unsigned int atomType;
+            unsigned int oxygenIndex;
+            RealVec oxygenPosition;
     };
 
     /*
@@ -529,11 +655,42 @@ protected:
             std::vector<OpenMM::RealVec> inducedDipoleField;
     };
 
+    /*
+     * Pairs whose induced dipole fields are summed in every iteration, one array per
+     * quantity: the periodic delta r_j - r_i and the two damped factors, so that the
+     * field at i due the dipole at j is dipoleScale*mu_j + deltaScale*(mu_j.delta)*delta
+     */
+    struct InducedDipolePairs {
+            std::vector<unsigned int> first;
+            std::vector<unsigned int> second;
+            std::vector<RealOpenMM> deltaX;
+            std::vector<RealOpenMM> deltaY;
+            std::vector<RealOpenMM> deltaZ;
+            std::vector<RealOpenMM> dipoleScale;
+            std::vector<RealOpenMM> deltaScale;
+            void clear( void );
+            void reserve( unsigned int numberOfPairs );
+            void add( unsigned int ii, unsigned int jj, const RealVec& delta, RealOpenMM dipoleFactor, RealOpenMM deltaFactor );
+            unsigned int size( void ) const;
+    };
+
     unsigned int _numParticles;
 
     NonbondedMethod _nonbondedMethod;
     bool _includeChargeRedistribution;
+    bool _shortRangeOnly;
+    RealOpenMM _splitDistance;
+    RealOpenMM _splitWidth;
+    std::vector<RealVec> _virial;
+    bool _includeEnergyDecomposition;
+    ReferenceMBPolScheduler* _scheduler;
+    std::vector<RealOpenMM> _permanentPotential;
+    std::vector<RealOpenMM> _inducedPotential;
+    std::vector<RealOpenMM> _siteCharges;
     std::vector<RealOpenMM> _tholeParameters;
+    RealOpenMM _dampingDistance;
+    NeighborList _dampedPairs;
+    NeighborList _undampedPairs;
     RealOpenMM _electric;
     RealOpenMM _dielectric;
 
@@ -541,6 +698,8 @@ protected:
     std::vector<RealVec> _fixedElectrostaticsFieldPolar;
     std::vector<RealVec> _inducedDipole;
     std::vector<RealVec> _inducedDipolePolar;
+    std::vector<RealVec> _initialInducedDipole;
+    std::vector<RealVec> _initialInducedDipolePolar;
 
     int _mutualInducedDipoleConverged;
     int _mutualInducedDipoleIterations;
@@ -550,6 +709,8 @@ protected:
     RealOpenMM  _polarSOR;
     RealOpenMM  _debye;
 
+    static bool _useInducedDipolePairTable;
+
     /**
      * Helper constructor method to centralize initialization of objects.
      *
@@ -581,6 +742,23 @@ protected:
     void computeWaterCharge(ElectrostaticsParticleData& particleO, ElectrostaticsParticleData& particleH1,
                    ElectrostaticsParticleData& particleH2,ElectrostaticsParticleData& particleM);
 
+    /**
+     * Compute the geometry dependent charges and their derivatives of all waters
+     * (O, H, H, M sites in consecutive order), a block of waters at a time.
+     *
+     * @param particleData        particle data, charges and charge derivatives are set
+     */
+    void computeWaterCharges( std::vector<ElectrostaticsParticleData>& particleData );
+
+    /**
+     * Compute the charges of count waters together; the polynomial is evaluated
+     * term by term over the waters of the block.
+     *
+     * @param sites               O, H1, H2 and M site of each water, 4*count entries
+     * @param count               number of waters, at most 64
+     */
+    void computeWaterChargeBlock( ElectrostaticsParticleData* const sites[], unsigned int count );
+
     /**
      * Calculate fixed multipole fields.
      *
@@ -631,6 +809,51 @@ protected:
                                                                     const ElectrostaticsParticleData& particleK,
                                                      const RealOpenMM pgamma, RealOpenMM r, RealOpenMM * scale3, RealOpenMM * scale5) const;
 
+    /**
+     * Find the damping distance of the current parameters. With x = gamma*(r/A)^4 the damped
+     * powers of 1/r differ from the undamped ones by at most (4/15)*x*(4x-1)*exp(-x) relative
+     * (the rr7 dipole-dipole term), which is below 1e-18 for x >= 50; the distance is where
+     * the most weakly damped pair of different waters reaches x = 50.
+     *
+     * @param particleData      vector of particle positions and parameters
+     */
+    void computeDampingDistance( const std::vector<ElectrostaticsParticleData>& particleData );
+
+    /**
+     * Get the weight of a pair in the short-range part, see setShortRangeSplit().
+     *
+     * @param deltaOO  vector between the oxygens of the two waters
+     * @param dWeight  on exit, the derivative of the weight with respect to the
+     *                 oxygen-oxygen distance divided by that distance
+     * @return weight
+     */
+    RealOpenMM getShortRangeWeight( const RealVec& deltaOO, RealOpenMM& dWeight ) const;
+
+    /**
+     * Add the forces due to the weight of a pair in the short-range part; they act on the
+     * two oxygens.
+     *
+     * @param particleI     first site of the pair
+     * @param particleK     second site of the pair
+     * @param deltaOO       vector between the oxygens of the two waters
+     * @param pairEnergy    energy of the pair at fixed induced dipoles, without the weight
+     * @param dWeight       derivative from getShortRangeWeight()
+     * @param forces        forces are added to the oxygens
+     * @return the force on the oxygen of particleK
+     */
+    RealVec addShortRangeWeightForces( const ElectrostaticsParticleData& particleI, const ElectrostaticsParticleData& particleK,
+                                       const RealVec& deltaOO, RealOpenMM pairEnergy, RealOpenMM dWeight,
+                                       std::vector<RealVec>& forces ) const;
+
+    /**
+     * Split all site pairs into _dampedPairs and _undampedPairs. A pair is undamped if the sites
+     * are in different waters and neither they nor the charge redistribution sites of their waters
+     * come closer than the damping distance.
+     *
+     * @param particleData      vector of particle positions and parameters
+     */
+    void splitDampedPairs( const std::vector<ElectrostaticsParticleData>& particleData );
+
     /**
      * Zero fixed multipole fields.
      */
@@ -655,42 +878,43 @@ protected:
     virtual void initializeInducedDipoles( std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields );
 
     /**
-     * Calculate field at particle I due induced dipole at particle J and vice versa
-     * (field at particle J due induced dipole at particle I).
+     * Fill the pair table used by the induced dipole iterations; the geometry and the
+     * damping only depend on the positions, so they are computed once per evaluation.
      *
-     * @param particleI               index of particle I
-     * @param particleJ               index of particle J
-     * @param rr3                     damped 1/r^3 factor
-     * @param rr5                     damped 1/r^5 factor
-     * @param delta                   delta of particle positions: particleJ.x - particleI.x, ...
-     * @param inducedDipole           vector of induced dipoles
-     * @param field                   vector of induced dipole fields
+     * @param particleData      vector of particle positions and parameters (charge, labFrame dipoles, quadrupoles, ...)
+     * @param pairs             output pair table
      */
-    void calculateInducedDipolePairIxn( unsigned int particleI, unsigned int particleJ,
-                                        const RealOpenMM & rr3, const RealOpenMM & rr5, const RealVec& delta,
-                                        const std::vector<RealVec>& inducedDipole,
-                                        std::vector<RealVec>& field ) const;
+    virtual void buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs );
 
-    virtual void precomputeScale35( const std::vector<ElectrostaticsParticleData>& particleData, RealOpenMM scale3[], RealOpenMM scale5[] );
     /**
-     * Calculate fields due induced dipoles at each site.
+     * Add the fields due the induced dipoles of all pairs of the table, for both
+     * inducedDipole and inducedDipolePolar in a single pass over the pairs. With a
+     * scheduler (setScheduler()) the table is split into ranges spread over its threads,
+     * added in fixed point in the deterministic mode of ReferenceMBPolScheduler.
      *
-     * @param particleI                 positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle I
-     * @param particleJ                 positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle J
+     * @param pairs                     pair table filled by buildInducedDipolePairs()
      * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
      */
-    virtual void calculateInducedDipolePairIxns( const ElectrostaticsParticleData& particleI, const ElectrostaticsParticleData& particleJ,
-                                                 std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, RealOpenMM precomputedScale3, RealOpenMM precomputedScale5  );
+    void addInducedDipolePairFields( const InducedDipolePairs& pairs,
+                                     std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields ) const;
+
+    /**
+     * Add the fields of the pairs [begin, end) of the table; the loop of addInducedDipolePairFields().
+     */
+    static void addInducedDipolePairFieldRange( const InducedDipolePairs& pairs, unsigned int begin, unsigned int end,
+                                                const std::vector<RealVec>& dipole, const std::vector<RealVec>& dipolePolar,
+                                                std::vector<RealVec>& field, std::vector<RealVec>& fieldPolar );
 
     /**
      * Calculate induced dipole fields.
      *
      * @param particleData              vector of particle positions and parameters (charge, labFrame dipoles, quadrupoles, ...)
      * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
+     * @param pairs                     pair table filled by buildInducedDipolePairs()
      */
     virtual void calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
                                                std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
-						 const RealOpenMM scale3[], const RealOpenMM scale5[]);
+                                               const InducedDipolePairs& pairs );
     /**
      * Converge induced dipoles.
      *
@@ -708,17 +932,17 @@ protected:
      */
     RealOpenMM runUpdateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
                                           std::vector<UpdateInducedDipoleFieldStruct>& calculateInducedDipoleField,
-						 const RealOpenMM scale3[], const RealOpenMM scale5[]);
+                                          const InducedDipolePairs& pairs, const std::vector<RealOpenMM>& polarity );
 
     /**
      * Update induced dipole for a particle given updated induced dipole field at the site.
      *
-     * @param particleI                 positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle I
+     * @param polarity                  polarity of each site
      * @param fixedElectrostaticsField       fields due fixed multipoles at each site
      * @param inducedDipoleField        fields due induced dipoles at each site
      * @param inducedDipoles            output vector of updated induced dipoles
      */
-    RealOpenMM updateInducedDipole( const std::vector<ElectrostaticsParticleData>& particleI,
+    RealOpenMM updateInducedDipole( const std::vector<RealOpenMM>& polarity,
                                     const std::vector<RealVec>& fixedElectrostaticsField,
                                     const std::vector<RealVec>& inducedDipoleField,
                                     std::vector<RealVec>& inducedDipoles);
@@ -761,12 +985,43 @@ protected:
      * @param particleK         positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle K
      * @param scalingFactors    scaling factors for interaction
      * @param forces            vector of particle forces to be updated
+     * @param permanentPotential if not NULL, add the potentials of the charges of the pair to this vector
+     * @param inducedPotential   if not NULL, add the potentials of the induced dipoles of the pair to this vector
      */
     RealOpenMM calculateElectrostaticPairIxn(
             const std::vector<ElectrostaticsParticleData>& particleData,
                                                                                     unsigned int iIndex,
                                                                                     unsigned int kIndex,
-                                                                                    std::vector<OpenMM::RealVec>& forces) const;
+                                                                                    std::vector<OpenMM::RealVec>& forces,
+                                                                                    std::vector<RealOpenMM>* permanentPotential = NULL,
+                                                                                    std::vector<RealOpenMM>* inducedPotential = NULL ) const;
+
+    /**
+     * Calculate the electrostatic interaction of an undamped pair (see splitDampedPairs()):
+     * calculateElectrostaticPairIxn() with every Thole scale factor equal to 1.
+     *
+     * @param particleData      vector of particle positions and parameters
+     * @param iIndex            index of particle I
+     * @param kIndex            index of particle K, in a different water
+     * @param forces            vector of particle forces to be updated
+     * @param permanentPotential if not NULL, add the potentials of the charges of the pair to this vector
+     * @param inducedPotential   if not NULL, add the potentials of the induced dipoles of the pair to this vector
+     *
+     * @return energy
+     */
+    RealOpenMM calculateUndampedElectrostaticPairIxn( const std::vector<ElectrostaticsParticleData>& particleData,
+                                                      unsigned int iIndex, unsigned int kIndex,
+                                                      std::vector<OpenMM::RealVec>& forces,
+                                                      std::vector<RealOpenMM>* permanentPotential = NULL,
+                                                      std::vector<RealOpenMM>* inducedPotential = NULL ) const;
+
+    /**
+     * Keep the site potentials accumulated by calculateElectrostatic() (without the factor
+     * _electric/_dielectric) and the site charges, if the energy decomposition is included.
+     */
+    void recordSitePotentials( const std::vector<ElectrostaticsParticleData>& particleData,
+                               const std::vector<RealOpenMM>& permanentPotential,
+                               const std::vector<RealOpenMM>& inducedPotential );
 
     /**
      * Calculate electrostatic forces
@@ -906,6 +1161,50 @@ public:
      */
      void setPeriodicBoxSize( RealVec& boxSize );
 
+    /**
+     * Set whether the PME grids and their FFTs are kept in single precision. The
+     * potentials and fields interpolated from the grid are still accumulated in double
+     * precision. Must be set before the first evaluation.
+     *
+     * @param useSinglePrecisionGrid true for single precision grids
+     */
+    void setUseSinglePrecisionGrid( bool useSinglePrecisionGrid );
+
+    bool getUseSinglePrecisionGrid( void ) const;
+
+    /**
+     * Set whether the reciprocal space part of the virial is left out of the evaluation. The
+     * particle data are then kept, and addReciprocalSpaceVirial() adds that part afterwards,
+     * so callers that need no virial do not pay for it.
+     *
+     * @param deferReciprocalSpaceVirial true to leave the reciprocal space virial to addReciprocalSpaceVirial()
+     */
+    void setDeferReciprocalSpaceVirial( bool deferReciprocalSpaceVirial );
+
+    bool getDeferReciprocalSpaceVirial( void ) const;
+
+    /**
+     * Add the reciprocal space virial of the last evaluation, made with
+     * setDeferReciprocalSpaceVirial( true ), to virial.
+     *
+     * @param virial            virial tensor to be updated
+     */
+    void addReciprocalSpaceVirial( std::vector<RealVec>& virial );
+
+    /**
+     * Set the site pairs (i < j) considered by the direct-space loops. Every pair within the
+     * cutoff must be included; pairs beyond it are dropped. Without candidates all pairs are
+     * scanned once per evaluation.
+     *
+     * @param candidatePairs candidate site pairs
+     */
+    void setDirectSpaceCandidatePairs( const NeighborList& candidatePairs );
+
+    /**
+     * Get the site pairs within the cutoff used in the last evaluation.
+     */
+    const NeighborList& getDirectSpacePairs( void ) const;
+
 protected:
 
      /**
@@ -924,10 +1223,14 @@ protected:
       * @param particleJ         positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle J
       * @param scalingFactors    scaling factors for interaction
       * @param forces            vector of particle forces to be updated
+      * @param electrostaticPotential  potentials of the charges of the pair, updated
+      * @param dipolePotential         potentials of the induced dipoles of the pair, updated
       */
      RealOpenMM calculatePmeDirectElectrostaticPairIxn( const std::vector<ElectrostaticsParticleData>& particleData,
                             unsigned int iIndex, unsigned int jIndex,
-                                                        std::vector<RealVec>& forces, std::vector<RealOpenMM>& electrostaticPotential ) const;
+                                                        std::vector<RealVec>& forces, std::vector<RealOpenMM>& electrostaticPotential,
+                                                        std::vector<RealOpenMM>& dipolePotential,
+                                                        std::vector<RealVec>& virial ) const;
 
 
 private:
@@ -950,6 +1253,12 @@ private:
     unsigned int _pmeGridSize;
     t_complex* _pmeGrid;
 
+    bool _useSinglePrecisionGrid;
+    bool _deferReciprocalSpaceVirial;
+    std::vector<ElectrostaticsParticleData> _virialParticleData;
+    ReferenceMBPolSingleFFT _singleFFT;
+    std::vector<ReferenceMBPolSingleFFT::Complex> _pmeGridSingle;
+
     std::vector<RealOpenMM> _pmeBsplineModuli[3];
     std::vector<RealOpenMM4> _thetai[3];
     std::vector<IntVec> _iGrid;
@@ -962,6 +1271,23 @@ private:
     std::vector<RealOpenMM4> _pmeBsplineTheta;
     std::vector<RealOpenMM4> _pmeBsplineDtheta;
 
+    bool _hasCandidatePairs;
+    NeighborList _candidatePairs;
+    NeighborList _directSpacePairs;
+
+    /**
+     * Collect the site pairs within the cutoff, from the candidates if set; for the
+     * short-range part the candidates must include all pairs of waters within the split distance.
+     *
+     * @param particleData vector of particle positions and parameters (charge, labFrame dipoles, quadrupoles, ...)
+     */
+    void buildDirectSpacePairs( const std::vector<ElectrostaticsParticleData>& particleData );
+
+    /**
+     * Whether a pair of sites is within the cutoff or, for the short-range part, whether
+     * their waters are within the split distance.
+     */
+    bool isDirectSpacePair( const ElectrostaticsParticleData& particleI, const ElectrostaticsParticleData& particleJ ) const;
 
 
     /**
@@ -969,6 +1295,22 @@ private:
      */
     void initializePmeGrid( void );
 
+    /**
+     * Get, set or scale the value of a grid point in the grid of the selected precision.
+     */
+    t_complex getPmeGridValue( int index ) const;
+
+    void setPmeGridValue( int index, RealOpenMM re, RealOpenMM im );
+
+    void scalePmeGridValue( int index, RealOpenMM factor );
+
+    /**
+     * Transform the Pme grid in place, with fftpack or in single precision.
+     *
+     * @param forward  true for the forward transform
+     */
+    void transformPmeGrid( bool forward );
+
     /**
      * Modify input vector of differences in particle positions for periodic boundary conditions.
      *
@@ -1064,12 +1406,16 @@ private:
      * @param gridPoint               grid point for which value is to be computed
      * @param inputInducedDipole      induced dipole value
      * @param inputInducedDipolePolar induced dipole value
+     * @param fixedPoint              add the atom contributions in fixed point (ReferenceMBPolFixedPointBuffer)
      */
      RealOpenMM computeFixedElectrostaticssGridValue( const vector<ElectrostaticsParticleData>& particleData,
-                                                 const int2& particleGridIndices, const RealVec& scale, int ix, int iy, const IntVec& gridPoint ) const;
+                                                 const int2& particleGridIndices, const RealVec& scale, int ix, int iy, const IntVec& gridPoint,
+                                                 bool fixedPoint ) const;
 
     /**
-     * Spread fixed multipoles onto PME grid.
+     * Spread fixed multipoles onto PME grid. In the deterministic mode of ReferenceMBPolScheduler
+     * the contributions to a grid point are added in fixed point, so the grid does not depend
+     * on the order of the atoms sharing a grid cell in _pmeAtomGridIndex.
      *
      * @param particleData vector of particle positions and parameters (charge, labFrame dipoles, quadrupoles, ...)
      */
@@ -1110,43 +1456,18 @@ private:
      */
     void recordFixedElectrostaticsField( void );
 
-    void precomputeScale35( const std::vector<ElectrostaticsParticleData>& particleData, RealOpenMM scale3[], RealOpenMM scale5[] );
     /**
-     * Compute the potential due to the reciprocal space PME calculation for induced dipoles.
-     *
-     * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
-     */
-    void calculateReciprocalSpaceInducedDipoleField( std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields );
-
-    /**
-     * Calculate field at particleI due to induced dipole at particle J and vice versa.
-     *
-     * @param iIndex        particle I index
-     * @param jIndex        particle J index
-     * @param preFactor1    first factor used in calculating field
-     * @param preFactor2    second factor used in calculating field
-     * @param deltaR        delta in particle positions after adjusting for periodic boundary conditions
-     * @param inducedDipole vector of induced dipoles
-     * @param field         vector of field at each particle due induced dipole of other particles
+     * Fill the pair table with the direct space pairs, folding the real space Ewald
+     * terms into the damped factors.
      */
-    void calculateDirectInducedDipolePairIxn( unsigned int iIndex, unsigned int jIndex,
-                                              RealOpenMM preFactor1, RealOpenMM preFactor2, const RealVec& delta,
-                                              const std::vector<RealVec>& inducedDipole,
-                                              std::vector<RealVec>& field ) const;
+    void buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs );
 
     /**
-     * Calculate direct space field at particleI due to induced dipole at particle J and vice versa for
-     * inducedDipole and inducedDipolePolar.
+     * Compute the potential due to the reciprocal space PME calculation for induced dipoles.
      *
-     * @param particleI                 positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle I
-     * @param particleJ                 positions and parameters (charge, labFrame dipoles, quadrupoles, ...) for particle J
      * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
      */
-    void calculateDirectInducedDipolePairIxns( const ElectrostaticsParticleData& particleI,
-                                               const ElectrostaticsParticleData& particleJ,
-                                               std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
-                                               RealOpenMM precomputedScale3,
-                                               RealOpenMM precomputedScale5 );
+    void calculateReciprocalSpaceInducedDipoleField( std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields );
 
     /**
      * Initialize induced dipoles
@@ -1165,13 +1486,15 @@ private:
      * @param gridPoint               grid point for which value is to be computed
      * @param inputInducedDipole      induced dipole value
      * @param inputInducedDipolePolar induced dipole polar value
+     * @param fixedPoint              add the atom contributions in fixed point (ReferenceMBPolFixedPointBuffer)
      */
     t_complex computeInducedDipoleGridValue( const int2& atomIndices, const RealVec& scale, int ix, int iy, const IntVec& gridPoint,
                                              const std::vector<RealVec>& inputInducedDipole,
-                                             const std::vector<RealVec>& inputInducedDipolePolar ) const;
+                                             const std::vector<RealVec>& inputInducedDipolePolar, bool fixedPoint ) const;
 
     /**
-     * Spread induced dipoles onto grid.
+     * Spread induced dipoles onto grid, in fixed point in the deterministic mode like
+     * spreadFixedElectrostaticssOntoGrid().
      *
      * @param inputInducedDipole      induced dipole value
      * @param inputInducedDipolePolar induced dipole polar value
@@ -1186,7 +1509,8 @@ private:
      * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
      */
     void calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
-                                       std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields, const RealOpenMM scale3[], const RealOpenMM scale5[]);
+                                       std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                       const InducedDipolePairs& pairs );
 
     /**
      * Set reciprocal space induced dipole fields.
@@ -1213,6 +1537,15 @@ private:
      RealOpenMM computeReciprocalSpaceInducedDipoleForceAndEnergy( const std::vector<ElectrostaticsParticleData>& particleData,
                                                                    std::vector<RealVec>& forces, std::vector<RealOpenMM>& electrostaticPotential) const;
 
+    /**
+     * Add the reciprocal space virial of the charges and induced dipoles to virial. The grid and
+     * the potential derivatives in _phi are overwritten, so this must come after the reciprocal forces.
+     *
+     * @param particleData      vector of particle positions and parameters
+     * @param virial            virial tensor to be updated
+     */
+    void computeReciprocalSpaceVirial( const std::vector<ElectrostaticsParticleData>& particleData, std::vector<RealVec>& virial );
+
     /**
      * Calculate electrostatic forces.
      *
@@ -1226,4 +1559,106 @@ private:
 
 };
 
+class MBPolReferenceTreecodeElectrostaticsForce : public MBPolReferenceElectrostaticsForce {
+
+   /**
+    * Non-periodic electrostatics for large clusters. Molecules that have sites within the
+    * damping distance, beyond which every Thole damping factor is 1 to double precision,
+    * interact through the pair terms of the base class; all other molecules interact as
+    * undamped charges and induced dipoles, whose potential, field and field gradient are
+    * taken from a ReferenceMBPolTreecode.
+    */
+
+public:
+
+    /**
+     * Constructor
+     *
+     */
+    MBPolReferenceTreecodeElectrostaticsForce( void );
+
+    /**
+     * Destructor
+     *
+     */
+    ~MBPolReferenceTreecodeElectrostaticsForce( );
+
+    /**
+     * Set the opening angle of the treecode.
+     *
+     * @param openingAngle  a cell is expanded if its radius is less than openingAngle times its distance
+     */
+    void setOpeningAngle( RealOpenMM openingAngle );
+
+    RealOpenMM getOpeningAngle( void ) const;
+
+    /**
+     * Set the order of the multipole expansions of the treecode.
+     *
+     * @param order expansion order
+     */
+    void setExpansionOrder( int order );
+
+    int getExpansionOrder( void ) const;
+
+    /**
+     * Get the number of molecule pairs computed exactly in the last evaluation.
+     */
+    int getNumNearMoleculePairs( void ) const;
+
+protected:
+
+    /**
+     * Group the sites by molecule and build the treecode.
+     *
+     * @param particleData      vector of particle positions and parameters
+     */
+    void buildTreecode( const std::vector<ElectrostaticsParticleData>& particleData );
+
+    /**
+     * Calculate fixed multipole fields: the damped pair terms of near molecules and the
+     * treecode field of the charges of all other molecules.
+     *
+     * @param particleData vector of particle data
+     *
+     */
+    void calculateFixedElectrostaticsField( const vector<ElectrostaticsParticleData>& particleData );
+
+    /**
+     * Fill the pair table with the site pairs of each molecule and of near molecules.
+     *
+     * @param particleData      vector of particle positions and parameters
+     * @param pairs             output pair table
+     */
+    void buildInducedDipolePairs( const std::vector<ElectrostaticsParticleData>& particleData, InducedDipolePairs& pairs );
+
+    /**
+     * Calculate induced dipole fields: pair table plus treecode far field.
+     *
+     * @param particleData              vector of particle positions and parameters
+     * @param updateInducedDipoleFields vector of UpdateInducedDipoleFieldStruct containing input induced dipoles and output fields
+     * @param pairs                     pair table filled by buildInducedDipolePairs()
+     */
+    void calculateInducedDipoleFields( const std::vector<ElectrostaticsParticleData>& particleData,
+                                       std::vector<UpdateInducedDipoleFieldStruct>& updateInducedDipoleFields,
+                                       const InducedDipolePairs& pairs );
+
+    /**
+     * Calculate electrostatic forces.
+     *
+     * @param particleData            vector of parameters (charge, labFrame dipoles, quadrupoles, ...) for particles
+     * @param forces                  output forces
+     *
+     * @return energy
+     */
+    RealOpenMM calculateElectrostatic( const std::vector<ElectrostaticsParticleData>& particleData,
+                                       std::vector<OpenMM::RealVec>& forces );
+
+private:
+
+    MBPolPlugin::ReferenceMBPolTreecode _treecode;
+    std::vector<std::vector<int> > _moleculeSites;
+    NeighborList _exactPairs;
+};
+
 #endif // _MBPolReferenceElectrostaticsForce___
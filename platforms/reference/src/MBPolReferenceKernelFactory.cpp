@@ -29,6 +29,7 @@
 #include "openmm/reference/ReferencePlatform.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/OpenMMException.h"
+#include "poly-dispatch.h"
 
 using namespace  OpenMM;
 using namespace MBPolPlugin;
@@ -46,6 +47,7 @@ using namespace MBPolPlugin;
 #endif
 
 extern "C" void initMBPolReferenceKernels() {
+    selectPolynomialIsa();
     for( int ii = 0; ii < Platform::getNumPlatforms(); ii++ ){
         Platform& platform = Platform::getPlatform(ii);
         if( platform.getName() == "Reference" ){
@@ -63,19 +65,18 @@ extern "C" void initMBPolReferenceKernels() {
 KernelImpl* MBPolReferenceKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     ReferencePlatform::PlatformData& referencePlatformData = *static_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
 
-    // create MBPolReferenceData object if contextToMBPolDataMap does not contain
-    // key equal to current context
+    // the kernels of a context share its ReferenceMBPolTaskGraph and ReferenceMasterCellList
     if (name == CalcMBPolOneBodyForceKernel::Name())
-        return new ReferenceCalcMBPolOneBodyForceKernel(name, platform, context.getSystem());
+        return new ReferenceCalcMBPolOneBodyForceKernel(name, platform, context);
 
     if (name == CalcMBPolTwoBodyForceKernel::Name())
-        return new ReferenceCalcMBPolTwoBodyForceKernel(name, platform, context.getSystem());
+        return new ReferenceCalcMBPolTwoBodyForceKernel(name, platform, context);
 
     if (name == CalcMBPolThreeBodyForceKernel::Name())
-            return new ReferenceCalcMBPolThreeBodyForceKernel(name, platform, context.getSystem());
+            return new ReferenceCalcMBPolThreeBodyForceKernel(name, platform, context);
 
     if (name == CalcMBPolElectrostaticsForceKernel::Name())
-        return new ReferenceCalcMBPolElectrostaticsForceKernel(name, platform, context.getSystem());
+        return new ReferenceCalcMBPolElectrostaticsForceKernel(name, platform, context);
 
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
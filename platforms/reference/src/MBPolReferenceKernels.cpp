@@ -28,6 +28,11 @@
 #include "MBPolReferenceOneBodyForce.h"
 #include "MBPolReferenceTwoBodyForce.h"
 #include "MBPolReferenceThreeBodyForce.h"
+#include "ReferenceMBPolTimers.h"
+#include "ReferenceMBPolParallel.h"
+#include "ReferenceMBPolScheduler.h"
+#include "ReferenceMBPolFixedPoint.h"
+#include "ReferenceMBPolCheckpoint.h"
 #include "openmm/reference/ReferencePlatform.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/MBPolElectrostaticsForce.h"
@@ -37,6 +42,8 @@
 #include "openmm/NonbondedForce.h"
 #include "openmm/System.h"
 #include "openmm/internal/NonbondedForceImpl.h"
+#include <algorithm>
+#include <map>
 #include <iostream>
 
 #include <cmath>
@@ -74,13 +81,209 @@ static RealVec* extractBoxVectors(ContextImpl& context) {
 }
 #endif
 
-ReferenceCalcMBPolOneBodyForceKernel::ReferenceCalcMBPolOneBodyForceKernel(std::string name, const Platform& platform, const OpenMM::System& system) :
-                   CalcMBPolOneBodyForceKernel(name, platform), system(system) {
-    usePBC = 0;
+// single evaluations on the ReferenceMBPolScheduler threads: the pairs or triplets of a list in
+// sorted molecule order are split into chunks by the block of moleculesPerChunk molecules their
+// lowest molecule falls in, so a chunk covers the same region of space from step to step and the
+// time it took at the previous step is a good estimate of its cost; in the deterministic mode
+// every chunk is summed on its own and added in fixed point
+
+static const int moleculesPerChunk = 16;
+
+static int lowestMolecule(const AtomPair& pair) {
+    return min(pair.first, pair.second);
+}
+
+static int lowestMolecule(const AtomTriplet& triplet) {
+    return min(triplet.first, min(triplet.second, triplet.third));
+}
 
+static void getMolecules(const AtomPair& pair, int molecules[3]) {
+    molecules[0] = pair.first;
+    molecules[1] = pair.second;
+    molecules[2] = pair.second;
+}
+
+static void getMolecules(const AtomTriplet& triplet, int molecules[3]) {
+    molecules[0] = triplet.first;
+    molecules[1] = triplet.second;
+    molecules[2] = triplet.third;
+}
+
+template <class ForceType, class ListType>
+static RealOpenMM evaluateMoleculeChunks(ReferenceMBPolScheduler& scheduler, const ForceType& force, int numMolecules, const ListType& list,
+                                         ReferenceMoleculeOrdering& moleculeOrdering, vector<RealVec>& virial,
+                                         vector<RealOpenMM>* moleculeEnergies) {
+
+    const int numChunks = (numMolecules + moleculesPerChunk - 1)/moleculesPerChunk;
+    vector<int> chunkStart(numChunks+1, 0);
+    for( unsigned int ii = 0; ii < list.size(); ii++ ){
+        chunkStart[lowestMolecule(list[ii])/moleculesPerChunk + 1]++;
+    }
+    for( int chunk = 0; chunk < numChunks; chunk++ ){
+        chunkStart[chunk+1] += chunkStart[chunk];
+    }
+    vector<int> next(chunkStart.begin(), chunkStart.end() - 1);
+    ListType chunkedList(list.size());
+    for( unsigned int ii = 0; ii < list.size(); ii++ ){
+        chunkedList[next[lowestMolecule(list[ii])/moleculesPerChunk]++] = list[ii];
+    }
+
+    const int numThreads = ReferenceMBPolScheduler::getNumThreads();
+    vector<RealVec>& forces = moleculeOrdering.getForces();
+    if( ReferenceMBPolScheduler::getDeterministic() ){
+
+        // scalars: the molecule energies, then the energy and the nine virial components
+
+        const int totals = (moleculeEnergies ? numMolecules : 0);
+        vector<ReferenceMBPolFixedPointBuffer> buffers(numThreads);
+        for( int thread = 0; thread < numThreads; thread++ ){
+            buffers[thread].initialize(forces.size(), totals + 10);
+        }
+        const vector<vector<int> >& localParticleIndices = moleculeOrdering.getLocalParticleIndices();
+        scheduler.run(numChunks, numThreads, [&](int chunk, int thread) {
+            ReferenceMBPolFixedPointBuffer& buffer = buffers[thread];
+            vector<RealOpenMM>& scalars = buffer.getScalars();
+            vector<RealVec> chunkVirial(3, RealVec(0.0, 0.0, 0.0));
+            ListType chunkItems(chunkedList.begin() + chunkStart[chunk], chunkedList.begin() + chunkStart[chunk+1]);
+            scalars[totals] = force.calculateForceAndEnergy( numMolecules, moleculeOrdering.getPositions(), localParticleIndices,
+                                                             chunkItems, buffer.getVectors(), &chunkVirial,
+                                                             moleculeEnergies ? &scalars : NULL );
+            for( int a = 0; a < 3; a++ ){
+                for( int b = 0; b < 3; b++ ){
+                    scalars[totals+1+3*a+b] = chunkVirial[a][b];
+                }
+            }
+            for( int ii = 0; ii < 10; ii++ ){
+                buffer.touchScalar(totals+ii);
+            }
+            for( unsigned int ii = 0; ii < chunkItems.size(); ii++ ){
+                int molecules[3];
+                getMolecules(chunkItems[ii], molecules);
+                for( int jj = 0; jj < 3; jj++ ){
+                    const vector<int>& sites = localParticleIndices[molecules[jj]];
+                    for( unsigned int kk = 0; kk < sites.size(); kk++ ){
+                        buffer.touchVector(sites[kk]);
+                    }
+                    if( moleculeEnergies ){
+                        buffer.touchScalar(molecules[jj]);
+                    }
+                }
+            }
+            buffer.flush();
+        });
+
+        vector<RealOpenMM> scalars(totals + 10, 0.0);
+        ReferenceMBPolFixedPointBuffer::reduce(buffers, forces, &scalars);
+        for( int a = 0; a < 3; a++ ){
+            virial[a] += RealVec(scalars[totals+1+3*a], scalars[totals+2+3*a], scalars[totals+3+3*a]);
+        }
+        for( int ii = 0; ii < totals; ii++ ){
+            (*moleculeEnergies)[ii] += scalars[ii];
+        }
+        return scalars[totals];
+    }
+
+    // every thread accumulates into its own buffers, summed in thread order afterwards
+
+    vector<vector<RealVec> > threadForces(numThreads, vector<RealVec>(forces.size(), RealVec(0.0, 0.0, 0.0)));
+    vector<vector<RealVec> > threadVirials(numThreads, vector<RealVec>(3, RealVec(0.0, 0.0, 0.0)));
+    vector<vector<RealOpenMM> > threadMoleculeEnergies(numThreads);
+    vector<RealOpenMM> threadEnergies(numThreads, 0.0);
+    if( moleculeEnergies ){
+        threadMoleculeEnergies.assign(numThreads, vector<RealOpenMM>(numMolecules, 0.0));
+    }
+    scheduler.run(numChunks, numThreads, [&](int chunk, int thread) {
+        ListType chunkItems(chunkedList.begin() + chunkStart[chunk], chunkedList.begin() + chunkStart[chunk+1]);
+        threadEnergies[thread] += force.calculateForceAndEnergy( numMolecules, moleculeOrdering.getPositions(), moleculeOrdering.getLocalParticleIndices(),
+                                                                 chunkItems, threadForces[thread], &threadVirials[thread],
+                                                                 moleculeEnergies ? &threadMoleculeEnergies[thread] : NULL );
+    });
+
+    RealOpenMM energy = 0.0;
+    for( int thread = 0; thread < numThreads; thread++ ){
+        energy += threadEnergies[thread];
+        for( unsigned int ii = 0; ii < forces.size(); ii++ ){
+            forces[ii] += threadForces[thread][ii];
+        }
+        for( int a = 0; a < 3; a++ ){
+            virial[a] += threadVirials[thread][a];
+        }
+        if( moleculeEnergies ){
+            for( int ii = 0; ii < numMolecules; ii++ ){
+                (*moleculeEnergies)[ii] += threadMoleculeEnergies[thread][ii];
+            }
+        }
+    }
+    return energy;
+}
+
+// executeCopies(): the positions of every copy, checked against the System
+
+static void copyCopyPositions(const vector<vector<Vec3> >& positions, int numParticles, vector<vector<RealVec> >& posData) {
+    posData.resize(positions.size());
+    for( unsigned int copy = 0; copy < positions.size(); copy++ ){
+        if( (int) positions[copy].size() != numParticles ){
+            throw OpenMMException("computeCopies: every copy must have one position per particle of the System");
+        }
+        posData[copy].resize(numParticles);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            posData[copy][ii] = positions[copy][ii];
+        }
+    }
+}
+
+// items handed out to the threads: every copy is split into the same number of chunks
+
+static const int chunksPerCopy = 8;
+
+static void getChunkRange(int numItems, int chunk, int& begin, int& end) {
+    begin = (int) (((long long) numItems*chunk)/chunksPerCopy);
+    end   = (int) (((long long) numItems*(chunk+1))/chunksPerCopy);
+}
+
+// evaluate body(copy, chunk, forces) for every chunk of every copy on the ReferenceMBPolParallel
+// threads, each into its own buffer; the buffers of a copy are then summed in chunk order,
+// so the result does not depend on the number of threads
+
+static void evaluateCopies(int numCopies, int numParticles,
+                           const std::function<double(int, int, vector<RealVec>&)>& body,
+                           vector<vector<Vec3> >& forces, vector<double>& energies) {
+
+    vector<vector<RealVec> > chunkForces(numCopies*chunksPerCopy);
+    vector<double> chunkEnergies(numCopies*chunksPerCopy, 0.0);
+    ReferenceMBPolParallel::parallelFor(numCopies*chunksPerCopy, [&](int item) {
+        chunkForces[item].assign(numParticles, RealVec(0.0, 0.0, 0.0));
+        chunkEnergies[item] = body(item/chunksPerCopy, item%chunksPerCopy, chunkForces[item]);
+    });
+
+    forces.resize(numCopies);
+    energies.assign(numCopies, 0.0);
+    for( int copy = 0; copy < numCopies; copy++ ){
+        forces[copy].assign(numParticles, Vec3());
+        for( int chunk = 0; chunk < chunksPerCopy; chunk++ ){
+            const vector<RealVec>& buffer = chunkForces[copy*chunksPerCopy+chunk];
+            for( int ii = 0; ii < numParticles; ii++ ){
+                forces[copy][ii] += Vec3(buffer[ii][0], buffer[ii][1], buffer[ii][2]);
+            }
+            energies[copy] += chunkEnergies[copy*chunksPerCopy+chunk];
+        }
+    }
+}
+
+ReferenceCalcMBPolOneBodyForceKernel::ReferenceCalcMBPolOneBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context) :
+                   CalcMBPolOneBodyForceKernel(name, platform), system(context.getSystem()), forceGroup(0) {
+    usePBC = 0;
+    hasVirial = false;
+    includeEnergyDecomposition = false;
+    hasEnergyDecomposition     = false;
+    taskGraphContext = &context;
+    taskGraph        = ReferenceMBPolTaskGraph::acquire(taskGraphContext);
+    taskGraph->addTask(this);
 }
 
 ReferenceCalcMBPolOneBodyForceKernel::~ReferenceCalcMBPolOneBodyForceKernel() {
+    taskGraph->removeTask(this);
+    ReferenceMBPolTaskGraph::release(taskGraphContext);
 }
 
 void ReferenceCalcMBPolOneBodyForceKernel::initialize(const OpenMM::System& system, const MBPolOneBodyForce& force) {
@@ -95,12 +298,29 @@ void ReferenceCalcMBPolOneBodyForceKernel::initialize(const OpenMM::System& syst
 
     }
     usePBC                 = (force.getNonbondedMethod() == MBPolOneBodyForce::Periodic);
+    forceGroup             = force.getForceGroup();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
 
 }
 
 double ReferenceCalcMBPolOneBodyForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    return taskGraph->execute(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, extractForces(context));
+}
+
+void ReferenceCalcMBPolOneBodyForceKernel::beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    taskGraph->beginEvaluation(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, groups);
+}
+
+std::string ReferenceCalcMBPolOneBodyForceKernel::getTaskName() const {
+    return "OneBody";
+}
+
+int ReferenceCalcMBPolOneBodyForceKernel::getTaskForceGroup() const {
+    return forceGroup;
+}
+
+double ReferenceCalcMBPolOneBodyForceKernel::computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, vector<RealVec>& forceData) {
     vector<RealVec>& posData   = extractPositions(context);
-    vector<RealVec>& forceData = extractForces(context);
     MBPolReferenceOneBodyForce force;
 
     if (usePBC)
@@ -109,13 +329,77 @@ double ReferenceCalcMBPolOneBodyForceKernel::execute(ContextImpl& context, bool
         RealVec& box = extractBoxSize(context);
         force.setPeriodicBox(box);
     }
-    RealOpenMM energy      = force.calculateForceAndEnergy( numOneBodys, posData, allParticleIndices, forceData );
+    ReferenceMBPolTimers::Scope timer("OneBody.polynomial");
+    vector<RealVec> localVirial(3, RealVec(0.0, 0.0, 0.0));
+    vector<RealOpenMM> localEnergies;
+    if( includeEnergyDecomposition ){
+        localEnergies.assign(numOneBodys, 0.0);
+    }
+    RealOpenMM energy      = force.calculateForceAndEnergy( numOneBodys, posData, allParticleIndices, forceData, &localVirial,
+                                                            includeEnergyDecomposition ? &localEnergies : NULL );
+    virial                 = localVirial;
+    hasVirial              = true;
+    if( includeEnergyDecomposition ){
+        moleculeEnergies.assign(localEnergies.begin(), localEnergies.end());
+        hasEnergyDecomposition = true;
+    }
     return static_cast<double>(energy);
 }
 
+void ReferenceCalcMBPolOneBodyForceKernel::getVirial(ContextImpl& context, vector<Vec3>& virialOut) {
+    if( !hasVirial ){
+        throw OpenMMException("MBPolOneBodyForce: the virial is only available after the force has been evaluated");
+    }
+    virialOut.resize(3);
+    for( int a = 0; a < 3; a++ ){
+        virialOut[a] = Vec3(virial[a][0], virial[a][1], virial[a][2]);
+    }
+}
+
+void ReferenceCalcMBPolOneBodyForceKernel::getMoleculeEnergies(ContextImpl& context, vector<double>& energies) {
+    if( !includeEnergyDecomposition ){
+        throw OpenMMException("MBPolOneBodyForce: the energy decomposition is not enabled, see setIncludeEnergyDecomposition()");
+    }
+    if( !hasEnergyDecomposition ){
+        throw OpenMMException("MBPolOneBodyForce: the energy decomposition is only available after the force has been evaluated");
+    }
+    energies = moleculeEnergies;
+}
+
+void ReferenceCalcMBPolOneBodyForceKernel::executeCopies(ContextImpl& context, const vector<vector<Vec3> >& positions,
+                                                         vector<vector<Vec3> >& forces, vector<double>& energies) {
+
+    vector<vector<RealVec> > posData;
+    copyCopyPositions(positions, system.getNumParticles(), posData);
+
+    // the molecules of each chunk, the same for every copy
+
+    vector<vector<vector<int> > > chunkParticleIndices(chunksPerCopy);
+    for( int chunk = 0; chunk < chunksPerCopy; chunk++ ){
+        int begin, end;
+        getChunkRange(numOneBodys, chunk, begin, end);
+        chunkParticleIndices[chunk].assign(allParticleIndices.begin() + begin, allParticleIndices.begin() + end);
+    }
+    RealVec box = extractBoxSize(context);
+
+    ReferenceMBPolTimers::Scope timer("OneBody.polynomial");
+    timer.setCount(positions.size());
+    evaluateCopies(positions.size(), system.getNumParticles(), [&](int copy, int chunk, vector<RealVec>& forceData) {
+        MBPolReferenceOneBodyForce force;
+        if (usePBC)
+        {
+            force.setNonbondedMethod( MBPolReferenceOneBodyForce::Periodic);
+            force.setPeriodicBox(box);
+        }
+        const vector<vector<int> >& particleIndices = chunkParticleIndices[chunk];
+        return static_cast<double>(force.calculateForceAndEnergy( particleIndices.size(), posData[copy], particleIndices, forceData ));
+    }, forces, energies);
+}
+
 void ReferenceCalcMBPolOneBodyForceKernel::copyParametersToContext(ContextImpl& context, const MBPolOneBodyForce& force) {
     if (numOneBodys != force.getNumOneBodys())
         throw OpenMMException("updateParametersInContext: The number of stretch-bends has changed");
+    taskGraph->discardPending(this);
 
     // Record the values.
     for (int i = 0; i < numOneBodys; ++i) {
@@ -123,19 +407,74 @@ void ReferenceCalcMBPolOneBodyForceKernel::copyParametersToContext(ContextImpl&
         force.getOneBodyParameters(i, particleIndices);
         allParticleIndices[i] = particleIndices;
     }
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    hasEnergyDecomposition     = false;
 }
 
 /* -------------------------------------------------------------------------- *
  *                             MBPolElectrostatics                                *
  * -------------------------------------------------------------------------- */
 
-ReferenceCalcMBPolElectrostaticsForceKernel::ReferenceCalcMBPolElectrostaticsForceKernel(std::string name, const Platform& platform, const OpenMM::System& system) : 
-         CalcMBPolElectrostaticsForceKernel(name, platform), system(system), numElectrostatics(0), mutualInducedMaxIterations(200), mutualInducedTargetEpsilon(1.0e-03),
-                                                         usePme(false),alphaEwald(0.0), cutoffDistance(1.0) {  
+// the MBPol kernels of a context share one ReferenceMasterCellList; each registers the
+// first atom of its molecules and the largest distance it queries them at
+
+static bool addMoleculesToMasterCellList(ReferenceMasterCellList& masterCellList, const vector< vector<int> >& allParticleIndices,
+                                         double cutoff, bool usePBC) {
+    vector<int> referenceAtoms(allParticleIndices.size());
+    for( unsigned int ii = 0; ii < allParticleIndices.size(); ii++ ){
+        referenceAtoms[ii] = allParticleIndices[ii][0];
+    }
+    return masterCellList.addMolecules(referenceAtoms, cutoff, usePBC);
+}
+
+// sites further than this from the first site of their molecule (the oxygen)
+// are not covered by the master cell list pairs
+
+static const double maxSiteDistance = 0.15;
+
+// sites grouped by molecule, in order of first appearance, for the PME direct-space pair list
 
+static void groupSitesByMolecule(const vector<int>& moleculeIndices, vector< vector<int> >& moleculeSites) {
+    map<int, int> moleculeIndexMap;
+    moleculeSites.clear();
+    for( unsigned int ii = 0; ii < moleculeIndices.size(); ii++ ){
+        map<int, int>::iterator entry = moleculeIndexMap.find(moleculeIndices[ii]);
+        if( entry == moleculeIndexMap.end() ){
+            entry = moleculeIndexMap.insert(make_pair(moleculeIndices[ii], (int) moleculeSites.size())).first;
+            moleculeSites.push_back(vector<int>());
+        }
+        moleculeSites[entry->second].push_back(ii);
+    }
+}
+
+ReferenceCalcMBPolElectrostaticsForceKernel::ReferenceCalcMBPolElectrostaticsForceKernel(std::string name, const Platform& platform, ContextImpl& context) : 
+         CalcMBPolElectrostaticsForceKernel(name, platform), system(context.getSystem()), numElectrostatics(0), mutualInducedMaxIterations(200), mutualInducedTargetEpsilon(1.0e-03),
+                                                         interactionGroup(MBPolElectrostaticsForce::AllInteractions), splitDistance(0.45), splitWidth(0.1),
+                                                         usePme(false),alphaEwald(0.0), cutoffDistance(1.0), useSinglePrecisionPme(false), treecodeOpeningAngle(0.5), treecodeExpansionOrder(6),
+                                                         masterCellList(NULL), masterCellListContext(NULL), useMasterCellList(false), forceGroup(0),
+                                                         fieldScheduler("Electrostatics.inducedField"), shortRangeFieldScheduler("Electrostatics.inducedField") {  
+
+    hasVirial        = false;
+    reciprocalVirialForce      = NULL;
+    includeEnergyDecomposition = false;
+    hasEnergyDecomposition     = false;
+    inducedDipoleWarmStart  = false;
+    inducedDipoleGuessUsed  = false;
+    lastColdStartIterations = 0;
+    numWarmStarts           = 0;
+    numIterationsSaved      = 0;
+    taskGraphContext = &context;
+    taskGraph        = ReferenceMBPolTaskGraph::acquire(taskGraphContext);
+    taskGraph->addTask(this);
 }
 
 ReferenceCalcMBPolElectrostaticsForceKernel::~ReferenceCalcMBPolElectrostaticsForceKernel() {
+    taskGraph->removeTask(this);
+    ReferenceMBPolTaskGraph::release(taskGraphContext);
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+    }
+    delete reciprocalVirialForce;
 }
 
 void ReferenceCalcMBPolElectrostaticsForceKernel::initialize(const OpenMM::System& system, const MBPolElectrostaticsForce& force) {
@@ -168,12 +507,19 @@ void ReferenceCalcMBPolElectrostaticsForceKernel::initialize(const OpenMM::Syste
 		atomTypes[ii] = atomType;
 
     }
+    groupSitesByMolecule(moleculeIndices, moleculeSites);
 
     mutualInducedMaxIterations = force.getMutualInducedMaxIterations();
     mutualInducedTargetEpsilon = force.getMutualInducedTargetEpsilon();
+    inducedDipoleWarmStart     = force.getInducedDipoleWarmStart();
+    forceGroup                 = force.getForceGroup();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
 
     includeChargeRedistribution = force.getIncludeChargeRedistribution();
     tholeParameters = force.getTholeParameters();
+    interactionGroup = force.getInteractionGroup();
+    splitDistance    = force.getSplitDistance();
+    splitWidth       = force.getSplitWidth();
 
     // PME
 
@@ -182,6 +528,12 @@ void ReferenceCalcMBPolElectrostaticsForceKernel::initialize(const OpenMM::Syste
         usePme     = true;
         alphaEwald = force.getAEwald();
         cutoffDistance = force.getCutoffDistance();
+
+        // the short-range pairs are taken from the direct space candidates
+
+        if( interactionGroup != MBPolElectrostaticsForce::AllInteractions && splitDistance > cutoffDistance ){
+            throw OpenMMException("MBPolElectrostaticsForce: the split distance must not exceed the cutoff distance");
+        }
         force.getPmeGridDimensions(pmeGridDimension);
         if (pmeGridDimension[0] == 0 || alphaEwald == 0.0) {
             NonbondedForce nb;
@@ -198,22 +550,38 @@ void ReferenceCalcMBPolElectrostaticsForceKernel::initialize(const OpenMM::Syste
     } else {
         usePme = false;
     }
+    useSinglePrecisionPme  = force.getUseSinglePrecisionPme();
+    treecodeOpeningAngle   = force.getTreecodeOpeningAngle();
+    treecodeExpansionOrder = force.getTreecodeExpansionOrder();
     return;
 }
 
 MBPolReferenceElectrostaticsForce* ReferenceCalcMBPolElectrostaticsForceKernel::setupMBPolReferenceElectrostaticsForce(ContextImpl& context )
+{
+    return setupMBPolReferenceElectrostaticsForce( context, extractPositions(context) );
+}
+
+MBPolReferenceElectrostaticsForce* ReferenceCalcMBPolElectrostaticsForceKernel::setupMBPolReferenceElectrostaticsForce(ContextImpl& context,
+                                                                                                                     const vector<RealVec>& posData,
+                                                                                                                     bool shortRangeOnly )
 {
 
     // mbpolReferenceElectrostaticsForce is set to MBPolReferenceGeneralizedKirkwoodForce if MBPolGeneralizedKirkwoodForce is present
     // mbpolReferenceElectrostaticsForce is set to MBPolReferencePmeElectrostaticsForce if 'usePme' is set
+    // mbpolReferenceElectrostaticsForce is set to MBPolReferenceTreecodeElectrostaticsForce for the Treecode method
     // mbpolReferenceElectrostaticsForce is set to MBPolReferenceElectrostaticsForce otherwise
+    //
+    // the short-range part is a switched direct sum: with PME the bare real space terms
+    // (alphaEwald 0) without a reciprocal part, otherwise the NoCutoff force
 
     MBPolReferenceElectrostaticsForce* mbpolReferenceElectrostaticsForce = NULL;
     if( usePme ) {
 
          MBPolReferencePmeElectrostaticsForce* mbpolReferencePmeElectrostaticsForce = new MBPolReferencePmeElectrostaticsForce( );
-         mbpolReferencePmeElectrostaticsForce->setAlphaEwald( alphaEwald );
+         mbpolReferencePmeElectrostaticsForce->setAlphaEwald( shortRangeOnly ? 0.0 : alphaEwald );
          mbpolReferencePmeElectrostaticsForce->setCutoffDistance( cutoffDistance );
+         mbpolReferencePmeElectrostaticsForce->setUseSinglePrecisionGrid( useSinglePrecisionPme );
+         mbpolReferencePmeElectrostaticsForce->setDeferReciprocalSpaceVirial( true );
          mbpolReferencePmeElectrostaticsForce->setPmeGridDimensions( pmeGridDimension );
          RealVec& box = extractBoxSize(context);
          double minAllowedSize = 1.999999*cutoffDistance;
@@ -221,8 +589,16 @@ MBPolReferenceElectrostaticsForce* ReferenceCalcMBPolElectrostaticsForceKernel::
             throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
          }
          mbpolReferencePmeElectrostaticsForce->setPeriodicBoxSize(box);
+         setDirectSpaceCandidatePairs(context, posData, *mbpolReferencePmeElectrostaticsForce);
          mbpolReferenceElectrostaticsForce = static_cast<MBPolReferenceElectrostaticsForce*>(mbpolReferencePmeElectrostaticsForce);
 
+    } else if( nonbondedMethod == MBPolElectrostaticsForce::Treecode && !shortRangeOnly ){
+
+         MBPolReferenceTreecodeElectrostaticsForce* mbpolReferenceTreecodeElectrostaticsForce = new MBPolReferenceTreecodeElectrostaticsForce( );
+         mbpolReferenceTreecodeElectrostaticsForce->setOpeningAngle( treecodeOpeningAngle );
+         mbpolReferenceTreecodeElectrostaticsForce->setExpansionOrder( treecodeExpansionOrder );
+         mbpolReferenceElectrostaticsForce = static_cast<MBPolReferenceElectrostaticsForce*>(mbpolReferenceTreecodeElectrostaticsForce);
+
     } else {
          mbpolReferenceElectrostaticsForce = new MBPolReferenceElectrostaticsForce( MBPolReferenceElectrostaticsForce::NoCutoff );
     }
@@ -231,6 +607,8 @@ MBPolReferenceElectrostaticsForce* ReferenceCalcMBPolElectrostaticsForceKernel::
     mbpolReferenceElectrostaticsForce->setMaximumMutualInducedDipoleIterations( mutualInducedMaxIterations );
 
     mbpolReferenceElectrostaticsForce->setIncludeChargeRedistribution(includeChargeRedistribution);
+    mbpolReferenceElectrostaticsForce->setShortRangeOnly(shortRangeOnly);
+    mbpolReferenceElectrostaticsForce->setShortRangeSplit(splitDistance, splitWidth);
     if (tholeParameters.size() > 0)
         mbpolReferenceElectrostaticsForce->setTholeParameters(tholeParameters);
 
@@ -238,19 +616,432 @@ MBPolReferenceElectrostaticsForce* ReferenceCalcMBPolElectrostaticsForceKernel::
 
 }
 
+void ReferenceCalcMBPolElectrostaticsForceKernel::setupInteractionGroup(ContextImpl& context, const vector<RealVec>& posData,
+                                                                        MBPolReferenceElectrostaticsForce*& fullForce,
+                                                                        MBPolReferenceElectrostaticsForce*& shortRangeForce) {
+    fullForce       = NULL;
+    shortRangeForce = NULL;
+    try {
+        if( interactionGroup != MBPolElectrostaticsForce::ShortRange ){
+            fullForce = setupMBPolReferenceElectrostaticsForce( context, posData );
+        }
+        if( interactionGroup != MBPolElectrostaticsForce::AllInteractions ){
+            shortRangeForce = setupMBPolReferenceElectrostaticsForce( context, posData, true );
+        }
+    } catch (...) {
+        delete fullForce;
+        throw;
+    }
+}
+
+double ReferenceCalcMBPolElectrostaticsForceKernel::calculateInteractionGroup(const vector<RealVec>& posData,
+                                                                              MBPolReferenceElectrostaticsForce* fullForce,
+                                                                              MBPolReferenceElectrostaticsForce* shortRangeForce,
+                                                                              vector<RealVec>& forceData,
+                                                                              vector<RealVec>* groupVirial,
+                                                                              const RealVec* warmStartBox) {
+    RealOpenMM energy = 0.0;
+    try {
+        if( groupVirial ){
+            groupVirial->assign(3, RealVec(0.0, 0.0, 0.0));
+        }
+        if( fullForce ){
+            energy += fullForce->calculateForceAndEnergy( posData, charges, moleculeIndices, atomTypes, tholes,
+                                                          dampingFactors, polarity, forceData );
+            if( fullForce->getIncludeEnergyDecomposition() ){
+                accumulateSitePotentials( *fullForce, 1.0, true );
+            }
+            if( warmStartBox ){
+                recordInducedDipoles( posData, *warmStartBox, *fullForce );
+            }
+            if( groupVirial ){
+                for( int a = 0; a < 3; a++ ){
+                    (*groupVirial)[a] += fullForce->getVirial()[a];
+                }
+            }
+        }
+        if( shortRangeForce ){
+            RealOpenMM sign = (interactionGroup == MBPolElectrostaticsForce::ShortRange) ? 1.0 : -1.0;
+            vector<RealVec> shortRangeForces(forceData.size(), RealVec(0.0, 0.0, 0.0));
+            energy += sign*shortRangeForce->calculateForceAndEnergy( posData, charges, moleculeIndices, atomTypes, tholes,
+                                                                     dampingFactors, polarity, shortRangeForces );
+            for( unsigned int ii = 0; ii < forceData.size(); ii++ ){
+                forceData[ii] += shortRangeForces[ii]*sign;
+            }
+            if( shortRangeForce->getIncludeEnergyDecomposition() ){
+                accumulateSitePotentials( *shortRangeForce, sign, fullForce == NULL );
+            }
+            if( groupVirial ){
+                for( int a = 0; a < 3; a++ ){
+                    (*groupVirial)[a] += shortRangeForce->getVirial()[a]*sign;
+                }
+            }
+        }
+    } catch (...) {
+        delete fullForce;
+        delete shortRangeForce;
+        throw;
+    }
+
+    // the PME instance is kept until getVirial() asks for its reciprocal space virial
+
+    if( groupVirial && fullForce && usePme ){
+        delete reciprocalVirialForce;
+        reciprocalVirialForce = static_cast<MBPolReferencePmeElectrostaticsForce*>(fullForce);
+        fullForce             = NULL;
+    }
+    delete fullForce;
+    delete shortRangeForce;
+    return static_cast<double>(energy);
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::acquireMasterCellList(ContextImpl& context) {
+    if( masterCellListContext == NULL ){
+        masterCellListContext = &context;
+        masterCellList        = ReferenceMasterCellList::acquire(masterCellListContext);
+        useMasterCellList     = addMoleculesToMasterCellList(*masterCellList, moleculeSites, cutoffDistance + 2.0*maxSiteDistance, true);
+        moleculeOfAtom.assign(context.getSystem().getNumParticles(), -1);
+        for( unsigned int ii = 0; ii < moleculeSites.size(); ii++ ){
+            moleculeOfAtom[moleculeSites[ii][0]] = ii;
+        }
+    }
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::setDirectSpaceCandidatePairs(ContextImpl& context, const vector<RealVec>& posData,
+                                                                               MBPolReferencePmeElectrostaticsForce& pmeForce) {
+
+    acquireMasterCellList(context);
+    if( !useMasterCellList ){
+        return;
+    }
+
+    // molecules whose first sites are within cutoff + 2*siteDistance contain all site pairs within the cutoff;
+    // if a site is too far from its oxygen the PME force scans all pairs itself
+
+    RealVec& box             = extractBoxSize(context);
+    double siteDistance      = 0.0;
+    for( unsigned int ii = 0; ii < moleculeSites.size(); ii++ ){
+        const RealVec& reference = posData[moleculeSites[ii][0]];
+        for( unsigned int jj = 1; jj < moleculeSites[ii].size(); jj++ ){
+            RealVec delta = posData[moleculeSites[ii][jj]] - reference;
+            for( int d = 0; d < 3; d++ ){
+                delta[d] -= box[d]*floor(delta[d]/box[d] + 0.5);
+            }
+            siteDistance = std::max(siteDistance, (double) SQRT(delta.dot(delta)));
+        }
+    }
+    if( siteDistance > maxSiteDistance ){
+        return;
+    }
+
+    masterCellList->update(posData, box);
+    NeighborList moleculePairs;
+    masterCellList->getPairs(moleculePairs, moleculeOfAtom, posData, cutoffDistance + 2.0*siteDistance);
+
+    NeighborList candidatePairs;
+    for( unsigned int ii = 0; ii < moleculeSites.size(); ii++ ){
+        const std::vector<int>& sites = moleculeSites[ii];
+        for( unsigned int jj = 0; jj < sites.size(); jj++ ){
+            for( unsigned int kk = jj + 1; kk < sites.size(); kk++ ){
+                candidatePairs.push_back(AtomPair(sites[jj], sites[kk]));
+            }
+        }
+    }
+    for( unsigned int ii = 0; ii < moleculePairs.size(); ii++ ){
+        const std::vector<int>& sitesI = moleculeSites[moleculePairs[ii].first];
+        const std::vector<int>& sitesJ = moleculeSites[moleculePairs[ii].second];
+        for( unsigned int jj = 0; jj < sitesI.size(); jj++ ){
+            for( unsigned int kk = 0; kk < sitesJ.size(); kk++ ){
+                candidatePairs.push_back(AtomPair(sitesI[jj], sitesJ[kk]));
+            }
+        }
+    }
+    pmeForce.setDirectSpaceCandidatePairs(candidatePairs);
+}
+
 double ReferenceCalcMBPolElectrostaticsForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    return taskGraph->execute(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, extractForces(context));
+}
 
-    MBPolReferenceElectrostaticsForce* mbpolReferenceElectrostaticsForce = setupMBPolReferenceElectrostaticsForce( context );
+void ReferenceCalcMBPolElectrostaticsForceKernel::beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    taskGraph->beginEvaluation(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, groups);
+}
+
+std::string ReferenceCalcMBPolElectrostaticsForceKernel::getTaskName() const {
+    return "Electrostatics";
+}
+
+int ReferenceCalcMBPolElectrostaticsForceKernel::getTaskForceGroup() const {
+    return forceGroup;
+}
+
+double ReferenceCalcMBPolElectrostaticsForceKernel::computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, vector<RealVec>& forceData) {
 
     vector<RealVec>& posData   = extractPositions(context);
-    vector<RealVec>& forceData = extractForces(context);
-    RealOpenMM energy          = mbpolReferenceElectrostaticsForce->calculateForceAndEnergy( posData, charges, moleculeIndices, atomTypes, tholes,
-                                                                                         dampingFactors, polarity,
-                                                                                         forceData);
+    MBPolReferenceElectrostaticsForce* fullForce;
+    MBPolReferenceElectrostaticsForce* shortRangeForce;
+    setupInteractionGroup( context, posData, fullForce, shortRangeForce );
 
-    delete mbpolReferenceElectrostaticsForce;
+    RealVec box( 0.0, 0.0, 0.0 );
+    if( usePme ){
+        box = extractBoxSize(context);
+    }
+    if( fullForce && inducedDipoleWarmStart ){
+        setInducedDipoleGuess( posData, box, *fullForce );
+    }
+    if( fullForce ){
+        fullForce->setScheduler( &fieldScheduler );
+    }
+    if( shortRangeForce ){
+        shortRangeForce->setScheduler( &shortRangeFieldScheduler );
+    }
+    if( includeEnergyDecomposition ){
+        if( fullForce ){
+            fullForce->setIncludeEnergyDecomposition( true );
+        }
+        if( shortRangeForce ){
+            shortRangeForce->setIncludeEnergyDecomposition( true );
+        }
+    }
 
-    return static_cast<double>(energy);
+    vector<RealVec> localVirial;
+    double energy = calculateInteractionGroup( posData, fullForce, shortRangeForce, forceData, &localVirial,
+                                               inducedDipoleWarmStart ? &box : NULL );
+    virial        = localVirial;
+    hasVirial     = true;
+    hasEnergyDecomposition = includeEnergyDecomposition;
+    return energy;
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::accumulateSitePotentials(const MBPolReferenceElectrostaticsForce& force, double sign, bool reset) {
+    const vector<RealOpenMM>& permanent = force.getPermanentPotentials();
+    const vector<RealOpenMM>& induced   = force.getInducedPotentials();
+    if( reset ){
+        sitePermanentPotentials.assign( permanent.size(), 0.0 );
+        siteInducedPotentials.assign( induced.size(), 0.0 );
+        const vector<RealOpenMM>& charges = force.getSiteCharges();
+        siteCharges.assign( charges.begin(), charges.end() );
+    }
+    for( unsigned int ii = 0; ii < permanent.size(); ii++ ){
+        sitePermanentPotentials[ii] += sign*permanent[ii];
+        siteInducedPotentials[ii]   += sign*induced[ii];
+    }
+}
+
+// largest displacement of a site, once the change of the box is scaled out, for which
+// the induced dipoles of the previous evaluation are used as the starting point
+
+static const double warmStartDistance = 0.02;
+
+bool ReferenceCalcMBPolElectrostaticsForceKernel::setInducedDipoleGuess(const vector<RealVec>& posData, const RealVec& box,
+                                                                        MBPolReferenceElectrostaticsForce& force) {
+    inducedDipoleGuessUsed = false;
+    if( lastInducedDipole.size() != posData.size() || lastPositions.size() != posData.size() ){
+        return false;
+    }
+
+    // a Monte Carlo barostat scales the molecules with the box
+
+    RealVec scale( 1.0, 1.0, 1.0 );
+    if( usePme ){
+        for( int d = 0; d < 3; d++ ){
+            scale[d] = box[d]/lastBox[d];
+        }
+    }
+    double maxDistance2 = warmStartDistance*warmStartDistance;
+    for( unsigned int ii = 0; ii < posData.size(); ii++ ){
+        RealVec delta( posData[ii][0] - lastPositions[ii][0]*scale[0],
+                       posData[ii][1] - lastPositions[ii][1]*scale[1],
+                       posData[ii][2] - lastPositions[ii][2]*scale[2] );
+        if( delta.dot( delta ) > maxDistance2 ){
+            return false;
+        }
+    }
+    force.setInitialInducedDipoles( lastInducedDipole, lastInducedDipolePolar );
+    inducedDipoleGuessUsed = true;
+    return true;
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::recordInducedDipoles(const vector<RealVec>& posData, const RealVec& box,
+                                                                       const MBPolReferenceElectrostaticsForce& force) {
+    int iterations = force.getMutualInducedDipoleIterations();
+    if( inducedDipoleGuessUsed ){
+        numWarmStarts++;
+        numIterationsSaved += std::max(0, lastColdStartIterations - iterations);
+    } else {
+        lastColdStartIterations = iterations;
+    }
+    lastInducedDipole      = force.getInducedDipoles();
+    lastInducedDipolePolar = force.getInducedDipolesPolar();
+    lastPositions          = posData;
+    lastBox                = box;
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::getInducedDipoleWarmStartStatistics(ContextImpl& context, int& numWarmStartsOut,
+                                                                                      int& numIterationsSavedOut) {
+    numWarmStartsOut      = numWarmStarts;
+    numIterationsSavedOut = numIterationsSaved;
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::getMoleculeEnergies(ContextImpl& context, vector<double>& permanent, vector<double>& induction) {
+    if( !includeEnergyDecomposition ){
+        throw OpenMMException("MBPolElectrostaticsForce: the energy decomposition is not enabled, see setIncludeEnergyDecomposition()");
+    }
+    if( !hasEnergyDecomposition ){
+        throw OpenMMException("MBPolElectrostaticsForce: the energy decomposition is only available after the force has been evaluated");
+    }
+
+    // E = 1/2 sum q phi over the sites, by molecule index
+
+    int numMolecules = 0;
+    for( int ii = 0; ii < numElectrostatics; ii++ ){
+        numMolecules = std::max(numMolecules, moleculeIndices[ii] + 1);
+    }
+    permanent.assign( numMolecules, 0.0 );
+    induction.assign( numMolecules, 0.0 );
+    for( int ii = 0; ii < numElectrostatics; ii++ ){
+        permanent[moleculeIndices[ii]] += 0.5*siteCharges[ii]*sitePermanentPotentials[ii];
+        induction[moleculeIndices[ii]] += 0.5*siteCharges[ii]*siteInducedPotentials[ii];
+    }
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::getSitePotentials(ContextImpl& context, vector<double>& potentials, vector<double>& chargesOut) {
+    if( !includeEnergyDecomposition ){
+        throw OpenMMException("MBPolElectrostaticsForce: the energy decomposition is not enabled, see setIncludeEnergyDecomposition()");
+    }
+    if( !hasEnergyDecomposition ){
+        throw OpenMMException("MBPolElectrostaticsForce: the energy decomposition is only available after the force has been evaluated");
+    }
+    potentials.resize( numElectrostatics );
+    for( int ii = 0; ii < numElectrostatics; ii++ ){
+        potentials[ii] = sitePermanentPotentials[ii] + siteInducedPotentials[ii];
+    }
+    chargesOut = siteCharges;
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::createSolverCheckpoint(ContextImpl& context, ostream& stream) {
+    ReferenceMBPolCheckpoint::writeHeader( stream, "MBPolElectrostaticsForce", 1 );
+    ReferenceMBPolCheckpoint::writeInt( stream, numElectrostatics );
+    ReferenceMBPolCheckpoint::writeInt( stream, (int) nonbondedMethod );
+    ReferenceMBPolCheckpoint::writeVecs( stream, lastInducedDipole );
+    ReferenceMBPolCheckpoint::writeVecs( stream, lastInducedDipolePolar );
+    ReferenceMBPolCheckpoint::writeVecs( stream, lastPositions );
+    ReferenceMBPolCheckpoint::writeVec( stream, lastBox );
+    ReferenceMBPolCheckpoint::writeInt( stream, lastColdStartIterations );
+    bool saveList = masterCellList != NULL && useMasterCellList;
+    ReferenceMBPolCheckpoint::writeInt( stream, saveList );
+    if( saveList ){
+        masterCellList->saveBuild( stream );
+    }
+    if( !stream ){
+        throw OpenMMException("MBPolElectrostaticsForce: writing the solver checkpoint failed");
+    }
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::loadSolverCheckpoint(ContextImpl& context, istream& stream) {
+    ReferenceMBPolCheckpoint::checkHeader( stream, "MBPolElectrostaticsForce", 1 );
+    if( ReferenceMBPolCheckpoint::readInt( stream ) != numElectrostatics ||
+        ReferenceMBPolCheckpoint::readInt( stream ) != (int) nonbondedMethod ){
+        throw OpenMMException("MBPolElectrostaticsForce: the solver checkpoint was written for a different force");
+    }
+    vector<RealVec> inducedDipole, inducedDipolePolar, positions;
+    ReferenceMBPolCheckpoint::readVecs( stream, inducedDipole );
+    ReferenceMBPolCheckpoint::readVecs( stream, inducedDipolePolar );
+    ReferenceMBPolCheckpoint::readVecs( stream, positions );
+    RealVec box             = ReferenceMBPolCheckpoint::readVec( stream );
+    int coldStartIterations = ReferenceMBPolCheckpoint::readInt( stream );
+    if( inducedDipolePolar.size() != inducedDipole.size() || positions.size() != inducedDipole.size() ||
+        (!positions.empty() && (int) positions.size() != context.getSystem().getNumParticles()) ){
+        throw OpenMMException("MBPolElectrostaticsForce: the solver checkpoint is corrupt");
+    }
+    if( ReferenceMBPolCheckpoint::readInt( stream ) ){
+        acquireMasterCellList( context );
+        if( useMasterCellList ){
+            masterCellList->loadBuild( stream );
+        } else {
+            ReferenceMasterCellList unused;
+            unused.loadBuild( stream );
+        }
+    }
+
+    lastInducedDipole.swap( inducedDipole );
+    lastInducedDipolePolar.swap( inducedDipolePolar );
+    lastPositions.swap( positions );
+    lastBox                 = box;
+    lastColdStartIterations = coldStartIterations;
+    taskGraph->discardPending(this);
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::getVirial(ContextImpl& context, vector<Vec3>& virialOut) {
+    if( !hasVirial ){
+        throw OpenMMException("MBPolElectrostaticsForce: the virial is only available after the force has been evaluated");
+    }
+    if( reciprocalVirialForce ){
+        reciprocalVirialForce->addReciprocalSpaceVirial( virial );
+        delete reciprocalVirialForce;
+        reciprocalVirialForce = NULL;
+    }
+    virialOut.resize(3);
+    for( int a = 0; a < 3; a++ ){
+        virialOut[a] = Vec3(virial[a][0], virial[a][1], virial[a][2]);
+    }
+}
+
+void ReferenceCalcMBPolElectrostaticsForceKernel::executeCopies(ContextImpl& context, const vector<vector<Vec3> >& positions,
+                                                                vector<vector<Vec3> >& forces, vector<double>& energies) {
+
+    int numCopies    = positions.size();
+    int numParticles = system.getNumParticles();
+    vector<vector<RealVec> > posData;
+    copyCopyPositions(positions, numParticles, posData);
+
+    // the PME pair lists are filtered from the shared master cell list, so the copies are set up
+    // one after another; the induced dipoles of each copy are then solved on their own thread
+
+    vector<MBPolReferenceElectrostaticsForce*> copyForces(numCopies, NULL);
+    vector<MBPolReferenceElectrostaticsForce*> copyShortRangeForces(numCopies, NULL);
+    vector<vector<RealVec> > forceData(numCopies);
+    vector<double> copyEnergies(numCopies, 0.0);
+    try {
+        for( int copy = 0; copy < numCopies; copy++ ){
+            setupInteractionGroup( context, posData[copy], copyForces[copy], copyShortRangeForces[copy] );
+        }
+    } catch (...) {
+        for( int copy = 0; copy < numCopies; copy++ ){
+            delete copyForces[copy];
+            delete copyShortRangeForces[copy];
+        }
+        throw;
+    }
+
+    // calculateInteractionGroup() deletes the instances of its copy, also on failure
+
+    try {
+        ReferenceMBPolParallel::parallelFor(numCopies, [&](int copy) {
+            forceData[copy].assign(numParticles, RealVec(0.0, 0.0, 0.0));
+            MBPolReferenceElectrostaticsForce* fullForce       = copyForces[copy];
+            MBPolReferenceElectrostaticsForce* shortRangeForce = copyShortRangeForces[copy];
+            copyForces[copy]           = NULL;
+            copyShortRangeForces[copy] = NULL;
+            copyEnergies[copy] = calculateInteractionGroup( posData[copy], fullForce, shortRangeForce, forceData[copy] );
+        });
+    } catch (...) {
+        for( int copy = 0; copy < numCopies; copy++ ){
+            delete copyForces[copy];
+            delete copyShortRangeForces[copy];
+        }
+        throw;
+    }
+
+    forces.resize(numCopies);
+    energies.resize(numCopies);
+    for( int copy = 0; copy < numCopies; copy++ ){
+        forces[copy].resize(numParticles);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            forces[copy][ii] = Vec3(forceData[copy][ii][0], forceData[copy][ii][1], forceData[copy][ii][2]);
+        }
+        energies[copy] = copyEnergies[copy];
+    }
 }
 
 void ReferenceCalcMBPolElectrostaticsForceKernel::getElectrostaticPotential(ContextImpl& context, const std::vector< Vec3 >& inputGrid,
@@ -301,6 +1092,12 @@ void ReferenceCalcMBPolElectrostaticsForceKernel::getSystemElectrostaticsMoments
 void ReferenceCalcMBPolElectrostaticsForceKernel::copyParametersToContext(ContextImpl& context, const MBPolElectrostaticsForce& force) {
     if (numElectrostatics != force.getNumElectrostatics())
         throw OpenMMException("updateParametersInContext: The number of multipoles has changed");
+    taskGraph->discardPending(this);
+
+    // dipoles converged with the old parameters are no starting point for the new ones
+
+    lastInducedDipole.clear();
+    lastInducedDipolePolar.clear();
 
     // Record the values.
 
@@ -316,21 +1113,50 @@ void ReferenceCalcMBPolElectrostaticsForceKernel::copyParametersToContext(Contex
         dampingFactors[i] = (RealOpenMM) dampingFactorD;
         polarity[i] = (RealOpenMM) polarityD;
     }
+    groupSitesByMolecule(moleculeIndices, moleculeSites);
+    interactionGroup = force.getInteractionGroup();
+    useSinglePrecisionPme      = force.getUseSinglePrecisionPme();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    hasEnergyDecomposition     = false;
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+        masterCellList        = NULL;
+        masterCellListContext = NULL;
+        useMasterCellList     = false;
+    }
 }
 
 
-ReferenceCalcMBPolTwoBodyForceKernel::ReferenceCalcMBPolTwoBodyForceKernel(std::string name, const Platform& platform, const OpenMM::System& system) :
-       CalcMBPolTwoBodyForceKernel(name, platform), system(system) {
+ReferenceCalcMBPolTwoBodyForceKernel::ReferenceCalcMBPolTwoBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context) :
+       CalcMBPolTwoBodyForceKernel(name, platform), system(context.getSystem()), forceGroup(0), polynomialScheduler("TwoBody.polynomial") {
     useCutoff = 0;
     usePBC = 0;
     cutoff = 1.0e+10;
+    interactionGroup = MBPolTwoBodyForce::AllInteractions;
+    splitDistance = 0.45;
+    splitWidth = 0.1;
     neighborList = NULL;
+    masterCellList = NULL;
+    masterCellListContext = NULL;
+    useMasterCellList = false;
+    hasVirial = false;
+    includeEnergyDecomposition = false;
+    hasEnergyDecomposition     = false;
+    useMixedPrecision          = false;
+    taskGraphContext = &context;
+    taskGraph = ReferenceMBPolTaskGraph::acquire(taskGraphContext);
+    taskGraph->addTask(this);
 }
 
 ReferenceCalcMBPolTwoBodyForceKernel::~ReferenceCalcMBPolTwoBodyForceKernel() {
+    taskGraph->removeTask(this);
+    ReferenceMBPolTaskGraph::release(taskGraphContext);
     if( neighborList ){
         delete neighborList;
     } 
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+    }
 }
 
 void ReferenceCalcMBPolTwoBodyForceKernel::initialize(const OpenMM::System& system, const MBPolTwoBodyForce& force) {
@@ -351,31 +1177,137 @@ void ReferenceCalcMBPolTwoBodyForceKernel::initialize(const OpenMM::System& syst
     usePBC                 = (force.getNonbondedMethod() == MBPolTwoBodyForce::CutoffPeriodic);
     cutoff                 = force.getCutoff();
     neighborList           = useCutoff ? new NeighborList() : NULL;
+    forceGroup             = force.getForceGroup();
+    interactionGroup       = force.getInteractionGroup();
+    splitDistance          = force.getSplitDistance();
+    splitWidth             = force.getSplitWidth();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    useMixedPrecision      = force.getUseMixedPrecision();
 
 }
 
 double ReferenceCalcMBPolTwoBodyForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    return taskGraph->execute(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, extractForces(context));
+}
+
+void ReferenceCalcMBPolTwoBodyForceKernel::beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    taskGraph->beginEvaluation(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, groups);
+}
+
+std::string ReferenceCalcMBPolTwoBodyForceKernel::getTaskName() const {
+    return "TwoBody";
+}
+
+int ReferenceCalcMBPolTwoBodyForceKernel::getTaskForceGroup() const {
+    return forceGroup;
+}
+
+double ReferenceCalcMBPolTwoBodyForceKernel::computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, vector<RealVec>& forceData) {
 
     vector<RealVec>& allPosData   = extractPositions(context);
-    vector<RealVec> posData;
-    posData.resize(numParticles);
+    // molecules are kept in space-filling-curve order, their atoms copied contiguously
+    moleculeOrdering.gather(allPosData, allParticleIndices, extractBoxSize(context), usePBC);
+    // posData has only oxygens
+    const vector<RealVec>& posData = moleculeOrdering.getReferencePositions();
     vector<set<int> > allExclusions;
     allExclusions.resize(numParticles);
-    // posData has only oxygens
-    for( int ii = 0; ii < numParticles; ii++ ){
-        posData[ii] = allPosData[allParticleIndices[ii][0]];
-    }
-    vector<RealVec>& forceData = extractForces(context);
     MBPolReferenceTwoBodyForce TwoBodyForce;
     RealOpenMM energy;
-    TwoBodyForce.setCutoff( cutoff );
     // neighborList created only with oxygens, then allParticleIndices is used to get reference to the hydrogens
 
+    if( useCutoff ){
+        initializeMasterCellList(context);
+    }
+    ReferenceMBPolTimers::Scope neighborListTimer("TwoBody.neighborList");
+    if( useMasterCellList ){
+        // pairs filtered from the list shared with the other MBPol forces, in sorted molecule indices
+        const vector<int>& inverseOrder = moleculeOrdering.getInverseOrder();
+        for( int ii = 0; ii < numParticles; ii++ ){
+            moleculeOfAtom[allParticleIndices[ii][0]] = inverseOrder[ii];
+        }
+        masterCellList->update(allPosData, extractBoxSize(context));
+        masterCellList->getPairs(*neighborList, moleculeOfAtom, allPosData, getListCutoff());
+    } else {
 #if OPENMM_MAJOR_VERSION == 6 && OPENMM_MINOR_VERSION <= 2
-    computeNeighborListVoxelHash( *neighborList, numParticles, posData, allExclusions, extractBoxSize(context), usePBC, cutoff, 0.0, false);
+        computeNeighborListVoxelHash( *neighborList, numParticles, posData, allExclusions, extractBoxSize(context), usePBC, getListCutoff(), 0.0, false);
 #else
-    computeNeighborListVoxelHash( *neighborList, numParticles, posData, allExclusions, extractBoxVectors(context), usePBC, cutoff, 0.0, false);
+        computeNeighborListVoxelHash( *neighborList, numParticles, posData, allExclusions, extractBoxVectors(context), usePBC, getListCutoff(), 0.0, false);
 #endif
+    }
+    neighborListTimer.stop();
+    setupTwoBodyForce(context, TwoBodyForce);
+    // the sorted buffer holds every atom of the force's molecules
+    ReferenceMBPolTimers::Scope polynomialTimer("TwoBody.polynomial");
+    vector<RealVec> localVirial(3, RealVec(0.0, 0.0, 0.0));
+    vector<RealOpenMM> sortedEnergies;
+    if( includeEnergyDecomposition ){
+        sortedEnergies.assign(numParticles, 0.0);
+    }
+    if( ReferenceMBPolScheduler::getNumThreads() > 1 || ReferenceMBPolScheduler::getDeterministic() ){
+        energy = evaluateMoleculeChunks( polynomialScheduler, TwoBodyForce, numParticles, *neighborList, moleculeOrdering, localVirial,
+                                         includeEnergyDecomposition ? &sortedEnergies : NULL);
+    } else {
+        energy = TwoBodyForce.calculateForceAndEnergy( numParticles, moleculeOrdering.getPositions(), moleculeOrdering.getLocalParticleIndices(),
+                                                       *neighborList, moleculeOrdering.getForces(), &localVirial,
+                                                       includeEnergyDecomposition ? &sortedEnergies : NULL);
+    }
+    moleculeOrdering.scatterForces(forceData);
+    virial    = localVirial;
+    hasVirial = true;
+    if( includeEnergyDecomposition ){
+        // back from the sorted to the force's molecule order
+        const vector<int>& inverseOrder = moleculeOrdering.getInverseOrder();
+        moleculeEnergies.resize(numParticles);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            moleculeEnergies[ii] = sortedEnergies[inverseOrder[ii]];
+        }
+        hasEnergyDecomposition = true;
+    }
+
+    return static_cast<double>(energy);
+}
+
+void ReferenceCalcMBPolTwoBodyForceKernel::getVirial(ContextImpl& context, vector<Vec3>& virialOut) {
+    if( !hasVirial ){
+        throw OpenMMException("MBPolTwoBodyForce: the virial is only available after the force has been evaluated");
+    }
+    virialOut.resize(3);
+    for( int a = 0; a < 3; a++ ){
+        virialOut[a] = Vec3(virial[a][0], virial[a][1], virial[a][2]);
+    }
+}
+
+void ReferenceCalcMBPolTwoBodyForceKernel::getMoleculeEnergies(ContextImpl& context, vector<double>& energies) {
+    if( !includeEnergyDecomposition ){
+        throw OpenMMException("MBPolTwoBodyForce: the energy decomposition is not enabled, see setIncludeEnergyDecomposition()");
+    }
+    if( !hasEnergyDecomposition ){
+        throw OpenMMException("MBPolTwoBodyForce: the energy decomposition is only available after the force has been evaluated");
+    }
+    energies = moleculeEnergies;
+}
+
+void ReferenceCalcMBPolTwoBodyForceKernel::initializeMasterCellList(ContextImpl& context) {
+    if( masterCellListContext == NULL ){
+        masterCellListContext = &context;
+        masterCellList        = ReferenceMasterCellList::acquire(masterCellListContext);
+        useMasterCellList     = addMoleculesToMasterCellList(*masterCellList, allParticleIndices, cutoff, usePBC);
+        moleculeOfAtom.assign(system.getNumParticles(), -1);
+    }
+}
+
+double ReferenceCalcMBPolTwoBodyForceKernel::getListCutoff() const {
+    // the short-range part of a split has no pairs beyond the split distance
+    if( interactionGroup == MBPolTwoBodyForce::ShortRange ){
+        return std::min(cutoff, splitDistance);
+    }
+    return cutoff;
+}
+
+void ReferenceCalcMBPolTwoBodyForceKernel::setupTwoBodyForce(ContextImpl& context, MBPolReferenceTwoBodyForce& TwoBodyForce) const {
+    TwoBodyForce.setCutoff( cutoff );
+    TwoBodyForce.setUseMixedPrecision( useMixedPrecision );
+    TwoBodyForce.setInteractionGroup( static_cast<MBPolReferenceTwoBodyForce::InteractionGroup>(interactionGroup), splitDistance, splitWidth );
     if( usePBC ){
         TwoBodyForce.setNonbondedMethod( MBPolReferenceTwoBodyForce::CutoffPeriodic);
         RealVec& box = extractBoxSize(context);
@@ -387,15 +1319,77 @@ double ReferenceCalcMBPolTwoBodyForceKernel::execute(ContextImpl& context, bool
     } else {
         TwoBodyForce.setNonbondedMethod( MBPolReferenceTwoBodyForce::CutoffNonPeriodic);
     }
-    // here we need allPosData, every atom!
-    energy  = TwoBodyForce.calculateForceAndEnergy( numParticles, allPosData, allParticleIndices, *neighborList, forceData);
+}
 
-    return static_cast<double>(energy);
+void ReferenceCalcMBPolTwoBodyForceKernel::executeCopies(ContextImpl& context, const vector<vector<Vec3> >& positions,
+                                                         vector<vector<Vec3> >& forces, vector<double>& energies) {
+
+    int numCopies = positions.size();
+    vector<vector<RealVec> > posData;
+    copyCopyPositions(positions, system.getNumParticles(), posData);
+    MBPolReferenceTwoBodyForce TwoBodyForce;
+    setupTwoBodyForce(context, TwoBodyForce);
+
+    // pair lists in the molecule order of the force; the beads of a ring polymer stay within
+    // half the skin of each other, so the master list built for the first copy serves them all
+
+    ReferenceMBPolTimers::Scope neighborListTimer("TwoBody.neighborList");
+    neighborListTimer.setCount(numCopies);
+    vector<NeighborList> copyPairs(numCopies);
+    if( useCutoff ){
+        initializeMasterCellList(context);
+    }
+    if( useMasterCellList ){
+        vector<int> copyMoleculeOfAtom(system.getNumParticles(), -1);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            copyMoleculeOfAtom[allParticleIndices[ii][0]] = ii;
+        }
+        for( int copy = 0; copy < numCopies; copy++ ){
+            masterCellList->update(posData[copy], extractBoxSize(context));
+            masterCellList->getPairs(copyPairs[copy], copyMoleculeOfAtom, posData[copy], getListCutoff());
+        }
+    } else {
+        ReferenceMBPolParallel::parallelFor(numCopies, [&](int copy) {
+            if( !useCutoff ){
+                for( int ii = 0; ii < numParticles; ii++ ){
+                    for( int jj = ii + 1; jj < numParticles; jj++ ){
+                        copyPairs[copy].push_back(AtomPair(ii, jj));
+                    }
+                }
+                return;
+            }
+            vector<RealVec> oxygens(numParticles);
+            for( int ii = 0; ii < numParticles; ii++ ){
+                oxygens[ii] = posData[copy][allParticleIndices[ii][0]];
+            }
+            vector<set<int> > allExclusions(numParticles);
+#if OPENMM_MAJOR_VERSION == 6 && OPENMM_MINOR_VERSION <= 2
+            computeNeighborListVoxelHash( copyPairs[copy], numParticles, oxygens, allExclusions, extractBoxSize(context), usePBC, getListCutoff(), 0.0, false);
+#else
+            computeNeighborListVoxelHash( copyPairs[copy], numParticles, oxygens, allExclusions, extractBoxVectors(context), usePBC, getListCutoff(), 0.0, false);
+#endif
+        });
+    }
+    neighborListTimer.stop();
+
+    ReferenceMBPolTimers::Scope polynomialTimer("TwoBody.polynomial");
+    polynomialTimer.setCount(numCopies);
+    evaluateCopies(numCopies, system.getNumParticles(), [&](int copy, int chunk, vector<RealVec>& forceData) {
+        int begin, end;
+        getChunkRange(copyPairs[copy].size(), chunk, begin, end);
+        NeighborList chunkPairs(copyPairs[copy].begin() + begin, copyPairs[copy].begin() + end);
+        return static_cast<double>(TwoBodyForce.calculateForceAndEnergy( numParticles, posData[copy], allParticleIndices, chunkPairs, forceData ));
+    }, forces, energies);
 }
 
 void ReferenceCalcMBPolTwoBodyForceKernel::copyParametersToContext(ContextImpl& context, const MBPolTwoBodyForce& force) {
     if (numParticles != force.getNumParticles())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
+    taskGraph->discardPending(this);
+
+    interactionGroup = force.getInteractionGroup();
+    splitDistance    = force.getSplitDistance();
+    splitWidth       = force.getSplitWidth();
 
     // Record the values.
 
@@ -406,20 +1400,53 @@ void ReferenceCalcMBPolTwoBodyForceKernel::copyParametersToContext(ContextImpl&
         allParticleIndices[i] = particleIndices;
 
     }
+    moleculeOrdering.invalidate();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    hasEnergyDecomposition     = false;
+    useMixedPrecision          = force.getUseMixedPrecision();
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+        masterCellList        = NULL;
+        masterCellListContext = NULL;
+        useMasterCellList     = false;
+    }
+}
+
+static bool compareAtomTriplets(const AtomTriplet& a, const AtomTriplet& b) {
+    if (a.first != b.first)
+        return a.first < b.first;
+    if (a.second != b.second)
+        return a.second < b.second;
+    return a.third < b.third;
 }
 
-ReferenceCalcMBPolThreeBodyForceKernel::ReferenceCalcMBPolThreeBodyForceKernel(std::string name, const Platform& platform, const OpenMM::System& system) :
-       CalcMBPolThreeBodyForceKernel(name, platform), system(system) {
+ReferenceCalcMBPolThreeBodyForceKernel::ReferenceCalcMBPolThreeBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context) :
+       CalcMBPolThreeBodyForceKernel(name, platform), system(context.getSystem()), forceGroup(0), polynomialScheduler("ThreeBody.polynomial") {
     useCutoff = 0;
     usePBC = 0;
     cutoff = 1.0e+10;
     neighborList = NULL;
+    masterCellList = NULL;
+    masterCellListContext = NULL;
+    useMasterCellList = false;
+    hasVirial = false;
+    includeEnergyDecomposition = false;
+    hasEnergyDecomposition     = false;
+    useMixedPrecision          = false;
+    taskGraphContext = &context;
+    taskGraph = ReferenceMBPolTaskGraph::acquire(taskGraphContext);
+    taskGraph->addTask(this);
 }
 
 ReferenceCalcMBPolThreeBodyForceKernel::~ReferenceCalcMBPolThreeBodyForceKernel() {
+    taskGraph->removeTask(this);
+    ReferenceMBPolTaskGraph::release(taskGraphContext);
     if( neighborList ){
         delete neighborList;
     }
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+    }
 }
 
 void ReferenceCalcMBPolThreeBodyForceKernel::initialize(const OpenMM::System& system, const MBPolThreeBodyForce& force) {
@@ -440,26 +1467,129 @@ void ReferenceCalcMBPolThreeBodyForceKernel::initialize(const OpenMM::System& sy
     usePBC                 = (force.getNonbondedMethod() == MBPolThreeBodyForce::CutoffPeriodic);
     cutoff                 = force.getCutoff();
     neighborList           = useCutoff ? new ThreeNeighborList() : NULL;
+    forceGroup             = force.getForceGroup();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    useMixedPrecision      = force.getUseMixedPrecision();
 
 }
 
 double ReferenceCalcMBPolThreeBodyForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    return taskGraph->execute(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, extractForces(context));
+}
+
+void ReferenceCalcMBPolThreeBodyForceKernel::beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    taskGraph->beginEvaluation(this, context, extractPositions(context), extractBoxSize(context), includeForces, includeEnergy, groups);
+}
+
+std::string ReferenceCalcMBPolThreeBodyForceKernel::getTaskName() const {
+    return "ThreeBody";
+}
+
+int ReferenceCalcMBPolThreeBodyForceKernel::getTaskForceGroup() const {
+    return forceGroup;
+}
+
+double ReferenceCalcMBPolThreeBodyForceKernel::computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, vector<RealVec>& forceData) {
 
     vector<RealVec>& allPosData   = extractPositions(context);
+    // molecules are kept in space-filling-curve order, their atoms copied contiguously
+    moleculeOrdering.gather(allPosData, allParticleIndices, extractBoxSize(context), usePBC);
+    // posData has only oxygens; the triplets found depend on the molecule order,
+    // so the list is built in the order of the force and then mapped to sorted molecules
     vector<RealVec> posData;
     posData.resize(numParticles);
-    vector<set<int> > allExclusions;
-    allExclusions.resize(numParticles);
-    // posData has only oxygens
     for( int ii = 0; ii < numParticles; ii++ ){
         posData[ii] = allPosData[allParticleIndices[ii][0]];
     }
-    vector<RealVec>& forceData = extractForces(context);
     MBPolReferenceThreeBodyForce force;
     RealOpenMM energy;
-    force.setCutoff( cutoff );
     // neighborList created only with oxygens, then allParticleIndices is used to get reference to the hydrogens
-    computeThreeNeighborListVoxelHash( *neighborList, numParticles, posData, extractBoxSize(context), usePBC, cutoff, 0.0);
+    if( useCutoff ){
+        initializeMasterCellList(context);
+    }
+    ReferenceMBPolTimers::Scope neighborListTimer("ThreeBody.neighborList");
+    if( useMasterCellList ){
+        masterCellList->update(allPosData, extractBoxSize(context));
+        masterCellList->getTriplets(*neighborList, moleculeOfAtom, allPosData, cutoff);
+    } else {
+        computeThreeNeighborListVoxelHash( *neighborList, numParticles, posData, extractBoxSize(context), usePBC, cutoff, 0.0);
+    }
+    const vector<int>& inverseOrder = moleculeOrdering.getInverseOrder();
+    for( unsigned int ii = 0; ii < neighborList->size(); ii++ ){
+        AtomTriplet& triplet = (*neighborList)[ii];
+        triplet.first  = inverseOrder[triplet.first];
+        triplet.second = inverseOrder[triplet.second];
+        triplet.third  = inverseOrder[triplet.third];
+    }
+    sort( neighborList->begin(), neighborList->end(), compareAtomTriplets );
+    neighborListTimer.stop();
+    setupThreeBodyForce(context, force);
+    // the sorted buffer holds every atom of the force's molecules
+    ReferenceMBPolTimers::Scope polynomialTimer("ThreeBody.polynomial");
+    vector<RealVec> localVirial(3, RealVec(0.0, 0.0, 0.0));
+    vector<RealOpenMM> sortedEnergies;
+    if( includeEnergyDecomposition ){
+        sortedEnergies.assign(numParticles, 0.0);
+    }
+    if( ReferenceMBPolScheduler::getNumThreads() > 1 || ReferenceMBPolScheduler::getDeterministic() ){
+        energy = evaluateMoleculeChunks( polynomialScheduler, force, numParticles, *neighborList, moleculeOrdering, localVirial,
+                                         includeEnergyDecomposition ? &sortedEnergies : NULL);
+    } else {
+        energy = force.calculateForceAndEnergy( numParticles, moleculeOrdering.getPositions(), moleculeOrdering.getLocalParticleIndices(),
+                                                *neighborList, moleculeOrdering.getForces(), &localVirial,
+                                                includeEnergyDecomposition ? &sortedEnergies : NULL);
+    }
+    moleculeOrdering.scatterForces(forceData);
+    virial    = localVirial;
+    hasVirial = true;
+    if( includeEnergyDecomposition ){
+        // back from the sorted to the force's molecule order
+        const vector<int>& inverseOrder = moleculeOrdering.getInverseOrder();
+        moleculeEnergies.resize(numParticles);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            moleculeEnergies[ii] = sortedEnergies[inverseOrder[ii]];
+        }
+        hasEnergyDecomposition = true;
+    }
+
+    return static_cast<double>(energy);
+}
+
+void ReferenceCalcMBPolThreeBodyForceKernel::getVirial(ContextImpl& context, vector<Vec3>& virialOut) {
+    if( !hasVirial ){
+        throw OpenMMException("MBPolThreeBodyForce: the virial is only available after the force has been evaluated");
+    }
+    virialOut.resize(3);
+    for( int a = 0; a < 3; a++ ){
+        virialOut[a] = Vec3(virial[a][0], virial[a][1], virial[a][2]);
+    }
+}
+
+void ReferenceCalcMBPolThreeBodyForceKernel::getMoleculeEnergies(ContextImpl& context, vector<double>& energies) {
+    if( !includeEnergyDecomposition ){
+        throw OpenMMException("MBPolThreeBodyForce: the energy decomposition is not enabled, see setIncludeEnergyDecomposition()");
+    }
+    if( !hasEnergyDecomposition ){
+        throw OpenMMException("MBPolThreeBodyForce: the energy decomposition is only available after the force has been evaluated");
+    }
+    energies = moleculeEnergies;
+}
+
+void ReferenceCalcMBPolThreeBodyForceKernel::initializeMasterCellList(ContextImpl& context) {
+    if( masterCellListContext == NULL ){
+        masterCellListContext = &context;
+        masterCellList        = ReferenceMasterCellList::acquire(masterCellListContext);
+        useMasterCellList     = addMoleculesToMasterCellList(*masterCellList, allParticleIndices, cutoff, usePBC);
+        moleculeOfAtom.assign(system.getNumParticles(), -1);
+        for( int ii = 0; ii < numParticles; ii++ ){
+            moleculeOfAtom[allParticleIndices[ii][0]] = ii;
+        }
+    }
+}
+
+void ReferenceCalcMBPolThreeBodyForceKernel::setupThreeBodyForce(ContextImpl& context, MBPolReferenceThreeBodyForce& force) const {
+    force.setCutoff( cutoff );
+    force.setUseMixedPrecision( useMixedPrecision );
     if( usePBC ){
         force.setNonbondedMethod( MBPolReferenceThreeBodyForce::CutoffPeriodic);
         RealVec& box = extractBoxSize(context);
@@ -471,15 +1601,69 @@ double ReferenceCalcMBPolThreeBodyForceKernel::execute(ContextImpl& context, boo
     } else {
         force.setNonbondedMethod( MBPolReferenceThreeBodyForce::CutoffNonPeriodic);
     }
-    // here we need allPosData, every atom!
-    energy  = force.calculateForceAndEnergy( numParticles, allPosData, allParticleIndices, *neighborList, forceData);
+}
 
-    return static_cast<double>(energy);
+void ReferenceCalcMBPolThreeBodyForceKernel::executeCopies(ContextImpl& context, const vector<vector<Vec3> >& positions,
+                                                           vector<vector<Vec3> >& forces, vector<double>& energies) {
+
+    int numCopies = positions.size();
+    vector<vector<RealVec> > posData;
+    copyCopyPositions(positions, system.getNumParticles(), posData);
+    MBPolReferenceThreeBodyForce force;
+    setupThreeBodyForce(context, force);
+
+    // triplet lists in the molecule order of the force, from the master list as for the two-body force
+
+    ReferenceMBPolTimers::Scope neighborListTimer("ThreeBody.neighborList");
+    neighborListTimer.setCount(numCopies);
+    vector<ThreeNeighborList> copyTriplets(numCopies);
+    if( useCutoff ){
+        initializeMasterCellList(context);
+    }
+    if( useMasterCellList ){
+        for( int copy = 0; copy < numCopies; copy++ ){
+            masterCellList->update(posData[copy], extractBoxSize(context));
+            masterCellList->getTriplets(copyTriplets[copy], moleculeOfAtom, posData[copy], cutoff);
+        }
+    } else {
+        ReferenceMBPolParallel::parallelFor(numCopies, [&](int copy) {
+            if( !useCutoff ){
+                for( int ii = 0; ii < numParticles; ii++ ){
+                    for( int jj = 0; jj < ii; jj++ ){
+                        for( int kk = 0; kk < jj; kk++ ){
+                            AtomTriplet triplet;
+                            triplet.first  = ii;
+                            triplet.second = jj;
+                            triplet.third  = kk;
+                            copyTriplets[copy].push_back(triplet);
+                        }
+                    }
+                }
+                return;
+            }
+            vector<RealVec> oxygens(numParticles);
+            for( int ii = 0; ii < numParticles; ii++ ){
+                oxygens[ii] = posData[copy][allParticleIndices[ii][0]];
+            }
+            computeThreeNeighborListVoxelHash( copyTriplets[copy], numParticles, oxygens, extractBoxSize(context), usePBC, cutoff, 0.0);
+        });
+    }
+    neighborListTimer.stop();
+
+    ReferenceMBPolTimers::Scope polynomialTimer("ThreeBody.polynomial");
+    polynomialTimer.setCount(numCopies);
+    evaluateCopies(numCopies, system.getNumParticles(), [&](int copy, int chunk, vector<RealVec>& forceData) {
+        int begin, end;
+        getChunkRange(copyTriplets[copy].size(), chunk, begin, end);
+        ThreeNeighborList chunkTriplets(copyTriplets[copy].begin() + begin, copyTriplets[copy].begin() + end);
+        return static_cast<double>(force.calculateForceAndEnergy( numParticles, posData[copy], allParticleIndices, chunkTriplets, forceData ));
+    }, forces, energies);
 }
 
 void ReferenceCalcMBPolThreeBodyForceKernel::copyParametersToContext(ContextImpl& context, const MBPolThreeBodyForce& force) {
     if (numParticles != force.getNumParticles())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
+    taskGraph->discardPending(this);
 
     // Record the values.
 
@@ -490,4 +1674,14 @@ void ReferenceCalcMBPolThreeBodyForceKernel::copyParametersToContext(ContextImpl
         allParticleIndices[i] = particleIndices;
 
     }
+    moleculeOrdering.invalidate();
+    includeEnergyDecomposition = force.getIncludeEnergyDecomposition();
+    hasEnergyDecomposition     = false;
+    useMixedPrecision          = force.getUseMixedPrecision();
+    if( masterCellListContext ){
+        ReferenceMasterCellList::release(masterCellListContext);
+        masterCellList        = NULL;
+        masterCellListContext = NULL;
+        useMasterCellList     = false;
+    }
 }
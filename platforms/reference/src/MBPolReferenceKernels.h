@@ -31,8 +31,14 @@
 #include "openmm/mbpolKernels.h"
 #include "openmm/MBPolElectrostaticsForce.h"
 #include "MBPolReferenceElectrostaticsForce.h"
+#include "MBPolReferenceTwoBodyForce.h"
+#include "MBPolReferenceThreeBodyForce.h"
 #include "openmm/reference/ReferenceNeighborList.h"
 #include "ReferenceThreeNeighborList.h"
+#include "ReferenceMoleculeOrdering.h"
+#include "ReferenceMasterCellList.h"
+#include "ReferenceMBPolTaskGraph.h"
+#include "ReferenceMBPolScheduler.h"
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include <string>
 
@@ -42,9 +48,9 @@ namespace MBPolPlugin {
 /**
  * This kernel is invoked by MBPolOneBodyForce to calculate the forces acting on the system and the energy of the system.
  */
-class ReferenceCalcMBPolOneBodyForceKernel : public CalcMBPolOneBodyForceKernel {
+class ReferenceCalcMBPolOneBodyForceKernel : public CalcMBPolOneBodyForceKernel, public ReferenceMBPolTask {
 public:
-    ReferenceCalcMBPolOneBodyForceKernel(std::string name, const Platform& platform, const System& system);
+    ReferenceCalcMBPolOneBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context);
     ~ReferenceCalcMBPolOneBodyForceKernel();
     /**
      * Initialize the kernel.
@@ -62,6 +68,46 @@ public:
      * @return the potential energy due to the force
      */
     double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Start the other MBPol forces of this evaluation if the task graph is enabled.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Calculate the forces into a buffer; execute() calls this directly or gets its result from the task graph.
+     */
+    double computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces);
+    std::string getTaskName() const;
+    int getTaskForceGroup() const;
+    /**
+     * Calculate the forces and energies of several copies of the system, spreading
+     * copies and molecules over the ReferenceMBPolParallel threads.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    /**
+     * Get the virial tensor of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    /**
+     * Get the share of every molecule in the energy of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
     /**
      * Copy changed parameters over to a context.
      *
@@ -73,15 +119,23 @@ private:
     int numOneBodys;
     std::vector< std::vector<int> > allParticleIndices;
     const System& system;
+    int forceGroup;
+    ReferenceMBPolTaskGraph* taskGraph;
+    ContextImpl* taskGraphContext;
     int usePBC;
+    std::vector<RealVec> virial;
+    bool hasVirial;
+    bool includeEnergyDecomposition;
+    std::vector<double> moleculeEnergies;
+    bool hasEnergyDecomposition;
 };
 
 /**
  * This kernel is invoked by MBPolElectrostaticsForce to calculate the forces acting on the system and the energy of the system.
  */
-class ReferenceCalcMBPolElectrostaticsForceKernel : public CalcMBPolElectrostaticsForceKernel {
+class ReferenceCalcMBPolElectrostaticsForceKernel : public CalcMBPolElectrostaticsForceKernel, public ReferenceMBPolTask {
 public:
-    ReferenceCalcMBPolElectrostaticsForceKernel(std::string name, const Platform& platform, const System& system);
+    ReferenceCalcMBPolElectrostaticsForceKernel(std::string name, const Platform& platform, ContextImpl& context);
     ~ReferenceCalcMBPolElectrostaticsForceKernel();
     /**
      * Initialize the kernel.
@@ -98,6 +152,11 @@ public:
      * @return pointer to initialized instance of MBPolReferenceElectrostaticsForce
      */
     MBPolReferenceElectrostaticsForce* setupMBPolReferenceElectrostaticsForce(ContextImpl& context );
+    /**
+     * Setup for MBPolReferenceElectrostaticsForce instance at the given positions instead of those of the context.
+     */
+    MBPolReferenceElectrostaticsForce* setupMBPolReferenceElectrostaticsForce(ContextImpl& context, const std::vector<RealVec>& posData,
+                                                                              bool shortRangeOnly = false );
     /**
      * Execute the kernel to calculate the forces and/or energy.
      *
@@ -107,6 +166,39 @@ public:
      * @return the potential energy due to the force
      */
     double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Start the other MBPol forces of this evaluation if the task graph is enabled.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Calculate the forces into a buffer; execute() calls this directly or gets its result from the task graph.
+     */
+    double computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces);
+    std::string getTaskName() const;
+    int getTaskForceGroup() const;
+    /**
+     * Calculate the forces and energies of several copies of the system, spreading
+     * copies and molecules over the ReferenceMBPolParallel threads.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    /**
+     * Get the virial tensor of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
     /** 
      * Calculate the electrostatic potential given vector of grid coordinates.
      *
@@ -129,6 +221,44 @@ public:
                                       quadrupole_zx, quadrupole_zy, quadrupole_zz )
      */
     void getSystemElectrostaticsMoments(ContextImpl& context, std::vector< double >& outputElectrostaticsMoments);
+    /**
+     * Get the statistics of the induced dipole warm starts.
+     *
+     * @param context             the context in which to execute this kernel
+     * @param numWarmStarts       on exit, the number of warm-started evaluations
+     * @param numIterationsSaved  on exit, the number of induced dipole iterations saved
+     */
+    void getInducedDipoleWarmStartStatistics(ContextImpl& context, int& numWarmStarts, int& numIterationsSaved);
+    /**
+     * Get the shares of every molecule in the permanent and induction energies of the most recent execute().
+     *
+     * @param context     the context in which to execute this kernel
+     * @param permanent   on exit, the charge-charge energy of every molecule index (kJ/mol)
+     * @param induction   on exit, the induction energy of every molecule index (kJ/mol)
+     */
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& permanent, std::vector<double>& induction);
+    /**
+     * Get the electrostatic potential at every site and the site charges of the most recent execute().
+     *
+     * @param context     the context in which to execute this kernel
+     * @param potentials  on exit, the potential at every site (kJ/mol/e)
+     * @param charges     on exit, the charge of every site after the charge redistribution (e)
+     */
+    void getSitePotentials(ContextImpl& context, std::vector<double>& potentials, std::vector<double>& charges);
+    /**
+     * Write the induced dipoles kept for the warm start and the master cell list build.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     the stream to write the checkpoint to
+     */
+    void createSolverCheckpoint(ContextImpl& context, std::ostream& stream);
+    /**
+     * Restore the state written by createSolverCheckpoint().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param stream     the stream to read the checkpoint from
+     */
+    void loadSolverCheckpoint(ContextImpl& context, std::istream& stream);
     /**
      * Copy changed parameters over to a context.
      *
@@ -139,8 +269,55 @@ public:
 
 private:
 
+    /**
+     * Acquire the master cell list of the context and register the molecules with it, once.
+     */
+    void acquireMasterCellList(ContextImpl& context);
+
+    /**
+     * Pass the site pairs of nearby molecules, taken from the master cell list, to the PME direct-space loops.
+     */
+    void setDirectSpaceCandidatePairs(ContextImpl& context, const std::vector<RealVec>& posData, MBPolReferencePmeElectrostaticsForce& pmeForce);
+
+    /**
+     * Set up the instances needed for the interaction group: the full calculation unless the
+     * group is ShortRange and the short-range one unless it is AllInteractions.
+     */
+    void setupInteractionGroup(ContextImpl& context, const std::vector<RealVec>& posData,
+                               MBPolReferenceElectrostaticsForce*& fullForce, MBPolReferenceElectrostaticsForce*& shortRangeForce);
+
+    /**
+     * Combine the full and short-range calculations into the energy and forces of the interaction group;
+     * the long-range part is the full calculation minus the short-range one. Deletes both instances,
+     * except that with groupVirial a PME full instance is kept for the reciprocal space virial.
+     */
+    double calculateInteractionGroup(const std::vector<RealVec>& posData, MBPolReferenceElectrostaticsForce* fullForce,
+                                     MBPolReferenceElectrostaticsForce* shortRangeForce, std::vector<RealVec>& forceData,
+                                     std::vector<RealVec>* groupVirial = NULL, const RealVec* warmStartBox = NULL);
+
+    /**
+     * Add sign times the site potentials of force to the energy decomposition, after clearing it if reset is set.
+     */
+    void accumulateSitePotentials(const MBPolReferenceElectrostaticsForce& force, double sign, bool reset);
+
+    /**
+     * Start the induced dipole iterations of force from the dipoles of the previous evaluation if
+     * no site has moved by more than warmStartDistance, once the change of the box is scaled out.
+     *
+     * @return true if the previous dipoles are used
+     */
+    bool setInducedDipoleGuess(const std::vector<RealVec>& posData, const RealVec& box, MBPolReferenceElectrostaticsForce& force);
+
+    /**
+     * Keep the converged induced dipoles of force, its positions and box for the next evaluation.
+     */
+    void recordInducedDipoles(const std::vector<RealVec>& posData, const RealVec& box, const MBPolReferenceElectrostaticsForce& force);
+
     int numElectrostatics;
     MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod;
+    MBPolElectrostaticsForce::InteractionGroup interactionGroup;
+    double splitDistance;
+    double splitWidth;
     std::vector<RealOpenMM> charges;
     std::vector<RealOpenMM> dipoles;
     std::vector<RealOpenMM> quadrupoles;
@@ -159,16 +336,50 @@ private:
     RealOpenMM alphaEwald;
     RealOpenMM cutoffDistance;
     std::vector<int> pmeGridDimension;
+    bool useSinglePrecisionPme;
+
+    RealOpenMM treecodeOpeningAngle;
+    int treecodeExpansionOrder;
+
+    std::vector< std::vector<int> > moleculeSites;
+    std::vector<int> moleculeOfAtom;
+    ReferenceMasterCellList* masterCellList;
+    ContextImpl* masterCellListContext;
+    bool useMasterCellList;
 
     const System& system;
+    int forceGroup;
+    ReferenceMBPolTaskGraph* taskGraph;
+    ContextImpl* taskGraphContext;
+    ReferenceMBPolScheduler fieldScheduler;
+    ReferenceMBPolScheduler shortRangeFieldScheduler;
+    std::vector<RealVec> virial;
+    bool hasVirial;
+    MBPolReferencePmeElectrostaticsForce* reciprocalVirialForce;
+
+    bool includeEnergyDecomposition;
+    std::vector<double> sitePermanentPotentials;
+    std::vector<double> siteInducedPotentials;
+    std::vector<double> siteCharges;
+    bool hasEnergyDecomposition;
+
+    bool inducedDipoleWarmStart;
+    bool inducedDipoleGuessUsed;
+    std::vector<RealVec> lastInducedDipole;
+    std::vector<RealVec> lastInducedDipolePolar;
+    std::vector<RealVec> lastPositions;
+    RealVec lastBox;
+    int lastColdStartIterations;
+    int numWarmStarts;
+    int numIterationsSaved;
 };
 
 /**
  * This kernel is invoked to calculate the TwoBody forces acting on the system and the energy of the system.
  */
-class ReferenceCalcMBPolTwoBodyForceKernel : public CalcMBPolTwoBodyForceKernel {
+class ReferenceCalcMBPolTwoBodyForceKernel : public CalcMBPolTwoBodyForceKernel, public ReferenceMBPolTask {
 public:
-    ReferenceCalcMBPolTwoBodyForceKernel(std::string name, const Platform& platform, const System& system);
+    ReferenceCalcMBPolTwoBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context);
     ~ReferenceCalcMBPolTwoBodyForceKernel();
     /**
      * Initialize the kernel.
@@ -186,6 +397,46 @@ public:
      * @return the potential energy due to the force
      */
     double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Start the other MBPol forces of this evaluation if the task graph is enabled.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Calculate the forces into a buffer; execute() calls this directly or gets its result from the task graph.
+     */
+    double computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces);
+    std::string getTaskName() const;
+    int getTaskForceGroup() const;
+    /**
+     * Calculate the forces and energies of several copies of the system, spreading
+     * copies and molecules over the ReferenceMBPolParallel threads.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    /**
+     * Get the virial tensor of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    /**
+     * Get the share of every molecule in the energy of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
     /**
      * Copy changed parameters over to a context.
      *
@@ -194,21 +445,42 @@ public:
      */
     void copyParametersToContext(ContextImpl& context, const MBPolTwoBodyForce& force);
 private:
+    void initializeMasterCellList(ContextImpl& context);
+    double getListCutoff() const;
+    void setupTwoBodyForce(ContextImpl& context, MBPolReferenceTwoBodyForce& TwoBodyForce) const;
     int numParticles;
     int useCutoff;
     int usePBC;
     double cutoff;
+    MBPolTwoBodyForce::InteractionGroup interactionGroup;
+    double splitDistance;
+    double splitWidth;
     std::vector< std::vector<int> > allParticleIndices;
     const System& system;
+    int forceGroup;
+    ReferenceMBPolTaskGraph* taskGraph;
+    ContextImpl* taskGraphContext;
     NeighborList* neighborList;
+    ReferenceMoleculeOrdering moleculeOrdering;
+    ReferenceMBPolScheduler polynomialScheduler;
+    std::vector<int> moleculeOfAtom;
+    ReferenceMasterCellList* masterCellList;
+    ContextImpl* masterCellListContext;
+    bool useMasterCellList;
+    std::vector<RealVec> virial;
+    bool hasVirial;
+    bool includeEnergyDecomposition;
+    std::vector<double> moleculeEnergies;
+    bool hasEnergyDecomposition;
+    bool useMixedPrecision;
 };
 
 /**
  * This kernel is invoked to calculate the TwoBody forces acting on the system and the energy of the system.
  */
-class ReferenceCalcMBPolThreeBodyForceKernel : public CalcMBPolThreeBodyForceKernel {
+class ReferenceCalcMBPolThreeBodyForceKernel : public CalcMBPolThreeBodyForceKernel, public ReferenceMBPolTask {
 public:
-    ReferenceCalcMBPolThreeBodyForceKernel(std::string name, const Platform& platform, const System& system);
+    ReferenceCalcMBPolThreeBodyForceKernel(std::string name, const Platform& platform, ContextImpl& context);
     ~ReferenceCalcMBPolThreeBodyForceKernel();
     /**
      * Initialize the kernel.
@@ -226,6 +498,46 @@ public:
      * @return the potential energy due to the force
      */
     double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Start the other MBPol forces of this evaluation if the task graph is enabled.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param groups         a set of bit flags for the force groups being evaluated
+     */
+    void beginEvaluation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Calculate the forces into a buffer; execute() calls this directly or gets its result from the task graph.
+     */
+    double computeTask(ContextImpl& context, bool includeForces, bool includeEnergy, std::vector<RealVec>& forces);
+    std::string getTaskName() const;
+    int getTaskForceGroup() const;
+    /**
+     * Calculate the forces and energies of several copies of the system, spreading
+     * copies and molecules over the ReferenceMBPolParallel threads.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param positions  positions[copy][particle] of every copy
+     * @param forces     on exit, the forces of every copy
+     * @param energies   on exit, the energy of every copy
+     */
+    void executeCopies(ContextImpl& context, const std::vector<std::vector<Vec3> >& positions,
+                       std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies);
+    /**
+     * Get the virial tensor of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param virial     on exit, the three rows of the virial tensor (kJ/mol)
+     */
+    void getVirial(ContextImpl& context, std::vector<Vec3>& virial);
+    /**
+     * Get the share of every molecule in the energy of the most recent execute().
+     *
+     * @param context    the context in which to execute this kernel
+     * @param energies   on exit, the energy of every molecule (kJ/mol)
+     */
+    void getMoleculeEnergies(ContextImpl& context, std::vector<double>& energies);
     /**
      * Copy changed parameters over to a context.
      *
@@ -234,13 +546,30 @@ public:
      */
     void copyParametersToContext(ContextImpl& context, const MBPolThreeBodyForce& force);
 private:
+    void initializeMasterCellList(ContextImpl& context);
+    void setupThreeBodyForce(ContextImpl& context, MBPolReferenceThreeBodyForce& force) const;
     int numParticles;
     int useCutoff;
     int usePBC;
     double cutoff;
     std::vector< std::vector<int> > allParticleIndices;
     const System& system;
+    int forceGroup;
+    ReferenceMBPolTaskGraph* taskGraph;
+    ContextImpl* taskGraphContext;
     ThreeNeighborList* neighborList;
+    ReferenceMoleculeOrdering moleculeOrdering;
+    ReferenceMBPolScheduler polynomialScheduler;
+    std::vector<int> moleculeOfAtom;
+    ReferenceMasterCellList* masterCellList;
+    ContextImpl* masterCellListContext;
+    bool useMasterCellList;
+    std::vector<RealVec> virial;
+    bool hasVirial;
+    bool includeEnergyDecomposition;
+    std::vector<double> moleculeEnergies;
+    bool hasEnergyDecomposition;
+    bool useMixedPrecision;
 };
 
 } // namespace MBPolPlugin
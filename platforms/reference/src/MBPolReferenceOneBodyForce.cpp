@@ -202,7 +202,8 @@ double MBPolReferenceOneBodyForce::calculateOneBodyIxn(const RealVec& positionO,
 
 
 RealOpenMM MBPolReferenceOneBodyForce::calculateForceAndEnergy( int numOneBodys, const std::vector<RealVec>& particlePositions, const std::vector<std::vector<int> >& allParticleIndices,
-                                                                       vector<RealVec>& forces) const {
+                                                                       vector<RealVec>& forces, vector<RealVec>* virial,
+                                                                       vector<RealOpenMM>* moleculeEnergies) const {
     RealOpenMM energy      = 0.0; 
     for (unsigned int ii = 0; ii < static_cast<unsigned int>(numOneBodys); ii++) {
         std::vector<RealVec> allPositions;
@@ -213,8 +214,18 @@ RealOpenMM MBPolReferenceOneBodyForce::calculateForceAndEnergy( int numOneBodys,
         if( _nonbondedMethod == Periodic )
             imageMolecules(_periodicBoxDimensions, allPositions);
 
-        energy                 +=  calculateOneBodyIxn(allPositions[0], allPositions[1], allPositions[2],
-                forces[allParticleIndices[ii][0]], forces[allParticleIndices[ii][1]], forces[allParticleIndices[ii][2]]);
+        std::vector<RealVec> allForces(3, RealVec(0.0, 0.0, 0.0));
+        RealOpenMM monomerEnergy = calculateOneBodyIxn(allPositions[0], allPositions[1], allPositions[2],
+                allForces[0], allForces[1], allForces[2]);
+        energy                 += monomerEnergy;
+        if( moleculeEnergies )
+            (*moleculeEnergies)[ii] += monomerEnergy;
+
+        for (unsigned int i=0; i < 3; i++)
+            forces[allParticleIndices[ii][i]] += allForces[i];
+
+        if( virial )
+            addClusterVirial(allPositions, allForces, *virial);
 
     }   
     return energy;
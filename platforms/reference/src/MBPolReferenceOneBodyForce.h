@@ -26,6 +26,7 @@
 #define __MBPolReferenceOneBodyForce_H__
 
 #include "openmm/reference/RealVec.h"
+#include <cstddef>
 #include <vector>
 
 using OpenMM::RealVec;
@@ -49,8 +50,14 @@ public:
  
     ~MBPolReferenceOneBodyForce( ){};
 
+    /**
+     * Calculate the energy and add the forces of all monomers; if virial is not NULL,
+     * also add their virial tensor (3 rows, virial[a][b] = sum r_a f_b) to it; if
+     * moleculeEnergies is not NULL, also add the energy of monomer ii to its entry ii.
+     */
     RealOpenMM calculateForceAndEnergy( int numOneBodys, const std::vector<RealVec>& particlePositions, const std::vector<std::vector<int> >& allParticleIndices,
-                                                                           std::vector<RealVec>& forces) const;
+                                                                           std::vector<RealVec>& forces, std::vector<RealVec>* virial = NULL,
+                                                                           std::vector<RealOpenMM>* moleculeEnergies = NULL) const;
 
 
     void setPeriodicBox( const RealVec& box );
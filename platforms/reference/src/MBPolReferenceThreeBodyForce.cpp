@@ -28,14 +28,15 @@
 #include <algorithm>
 #include <cctype>
 #include "mbpol_3body_constants.h"
-#include "poly-3b-v2x.h"
+#include "poly-dispatch.h"
 #include <list>
 #include <iostream>
 
 using std::vector;
 using OpenMM::RealVec;
 
-MBPolReferenceThreeBodyForce::MBPolReferenceThreeBodyForce( ) : _nonbondedMethod(NoCutoff), _cutoff(1.0e+10) {
+MBPolReferenceThreeBodyForce::MBPolReferenceThreeBodyForce( ) : _nonbondedMethod(NoCutoff), _cutoff(1.0e+10),
+                                                                _useMixedPrecision(false) {
 
     _periodicBoxDimensions = RealVec( 0.0, 0.0, 0.0 );
 }
@@ -64,6 +65,29 @@ RealVec MBPolReferenceThreeBodyForce::getPeriodicBox( void ) const {
     return _periodicBoxDimensions;
 }
 
+void MBPolReferenceThreeBodyForce::setUseMixedPrecision( bool useMixedPrecision ){
+    _useMixedPrecision = useMixedPrecision;
+}
+
+bool MBPolReferenceThreeBodyForce::getUseMixedPrecision( void ) const {
+    return _useMixedPrecision;
+}
+
+// the polynomial in single precision: the coefficients are converted once, the
+// variables on the way in and the gradients on the way out
+
+static double poly_3b_v2x_mixed(const double x[36], double g[36])
+{
+    static const std::vector<float> singleFit(thefit, thefit + sizeof(thefit)/sizeof(thefit[0]));
+
+    float xs[36], gs[36];
+    std::copy(x, x + 36, xs);
+    const double retval = poly_3b_v2x_single_dispatch(&singleFit[0], xs, gs);
+    std::copy(gs, gs + 36, g);
+
+    return retval;
+}
+
 double var(const double& k,
            const double& r0,
            const OpenMM::RealVec& a1, const OpenMM::RealVec& a2)
@@ -122,7 +146,8 @@ double threebody_f_switch(const double& r, double& g)
 RealOpenMM MBPolReferenceThreeBodyForce::calculateTripletIxn( int siteI, int siteJ, int siteQ,
                                                       const std::vector<RealVec>& particlePositions,
                                                       const std::vector<std::vector<int> >& allParticleIndices,
-                                                      vector<RealVec>& forces ) const {
+                                                      vector<RealVec>& forces,
+                                                      vector<RealVec>* virial ) const {
 
         // siteI and siteJ are indices in a oxygen-only array, in order to get the position of an oxygen, we need:
         // allParticleIndices[siteI][0]
@@ -206,7 +231,8 @@ RealOpenMM MBPolReferenceThreeBodyForce::calculateTripletIxn( int siteI, int sit
           x[35] = var(kOO, dOO, allPositions[ Ob], allPositions[ Oc]);
 
           double g[36];
-          double retval = poly_3b_v2x::eval(thefit, x, g);
+          double retval = _useMixedPrecision ? poly_3b_v2x_mixed(x, g)
+                                             : poly_3b_v2x_dispatch(thefit, x, g);
 
           double gab, gac, gbc;
 
@@ -286,6 +312,9 @@ RealOpenMM MBPolReferenceThreeBodyForce::calculateTripletIxn( int siteI, int sit
               }
           }
 
+          if (virial)
+              addClusterVirial(allPositions, allForces, *virial);
+
     RealOpenMM energy=retval * cal2joule;
 
     return energy;
@@ -296,7 +325,9 @@ RealOpenMM MBPolReferenceThreeBodyForce::calculateForceAndEnergy( int numParticl
                                                              const vector<RealVec>& particlePositions,
                                                              const std::vector<std::vector<int> >& allParticleIndices,
                                                              const ThreeNeighborList& neighborList,
-                                                             vector<RealVec>& forces ) const {
+                                                             vector<RealVec>& forces,
+                                                             vector<RealVec>* virial,
+                                                             vector<RealOpenMM>* moleculeEnergies ) const {
 
     // loop over neighbor list
     //    (1) calculate pair vdw ixn
@@ -313,8 +344,14 @@ RealOpenMM MBPolReferenceThreeBodyForce::calculateForceAndEnergy( int numParticl
         int siteJ                   = triplet.second;
         int siteQ                   = triplet.third;
 
-        energy                     += calculateTripletIxn( siteI, siteJ, siteQ,
-                particlePositions, allParticleIndices, forces );
+        RealOpenMM tripletEnergy    = calculateTripletIxn( siteI, siteJ, siteQ,
+                particlePositions, allParticleIndices, forces, virial );
+        energy                     += tripletEnergy;
+        if( moleculeEnergies ){
+            (*moleculeEnergies)[siteI] += tripletEnergy/3.0;
+            (*moleculeEnergies)[siteJ] += tripletEnergy/3.0;
+            (*moleculeEnergies)[siteQ] += tripletEnergy/3.0;
+        }
 
     }
 
@@ -135,6 +135,19 @@ public:
     
     RealVec getPeriodicBox( void ) const;
 
+    /**---------------------------------------------------------------------------------------
+    
+       Set whether the polynomial is evaluated in single precision; the variables, the
+       gradients and the accumulation of energy and forces stay in double precision
+    
+       @param useMixedPrecision   true for the single precision polynomial
+    
+       --------------------------------------------------------------------------------------- */
+    
+    void setUseMixedPrecision( bool useMixedPrecision );
+
+    bool getUseMixedPrecision( void ) const;
+
     /**---------------------------------------------------------------------------------------
     
        Calculate ThreeBody ixn using neighbor list
@@ -147,6 +160,8 @@ public:
        @param reductions              particle reduction factors
        @param neighborList            neighbor list
        @param forces                  add forces to this vector
+       @param virial                  if not NULL, add the virial tensor (3 rows) to this vector
+       @param moleculeEnergies        if not NULL, add a third of the energy of every triplet to each of its three molecules
     
        @return energy
     
@@ -155,12 +170,15 @@ public:
     RealOpenMM calculateForceAndEnergy( int numParticles, const std::vector<OpenMM::RealVec>& particlePositions, 
                                         const std::vector<std::vector<int> >& allParticleIndices,
                                         const ThreeNeighborList& neighborList,
-                                        std::vector<OpenMM::RealVec>& forces ) const;
+                                        std::vector<OpenMM::RealVec>& forces,
+                                        std::vector<OpenMM::RealVec>* virial = NULL,
+                                        std::vector<RealOpenMM>* moleculeEnergies = NULL ) const;
          
 private:
 
     NonbondedMethod _nonbondedMethod;
     double _cutoff;
+    bool _useMixedPrecision;
 
     RealVec _periodicBoxDimensions;
 
@@ -181,7 +199,8 @@ private:
     RealOpenMM calculateTripletIxn( int siteI, int siteJ, int siteQ,
                                                           const std::vector<RealVec> & particlePositions,
                                                           const std::vector<std::vector<int> >& allParticleIndices,
-                                                          std::vector<RealVec>& forces ) const;
+                                                          std::vector<RealVec>& forces,
+                                                          std::vector<RealVec>* virial ) const;
 };
 
 // ---------------------------------------------------------------------------------------
@@ -26,15 +26,18 @@
 #include "MBPolReferenceTwoBodyForce.h"
 #include <algorithm>
 #include <cctype>
+#include <cmath>
 #include "mbpol_2body_constants.h"
-#include "poly-2b-v6x.h"
+#include "poly-dispatch.h"
 #include "openmm/internal/MBPolConstants.h"
 
 using std::vector;
 using OpenMM::RealVec;
 using namespace MBPolPlugin;
 
-MBPolReferenceTwoBodyForce::MBPolReferenceTwoBodyForce( ) : _nonbondedMethod(NoCutoff), _cutoff(1.0e+10) {
+MBPolReferenceTwoBodyForce::MBPolReferenceTwoBodyForce( ) : _nonbondedMethod(NoCutoff), _cutoff(1.0e+10),
+                                                            _interactionGroup(AllInteractions), _splitDistance(0.45), _splitWidth(0.1),
+                                                            _useMixedPrecision(false) {
 
     _periodicBoxDimensions = RealVec( 0.0, 0.0, 0.0 );
 }
@@ -59,6 +62,54 @@ void MBPolReferenceTwoBodyForce::setPeriodicBox( const RealVec& box ){
     _periodicBoxDimensions = box;
 }
 
+void MBPolReferenceTwoBodyForce::setInteractionGroup( InteractionGroup interactionGroup, double splitDistance, double splitWidth ){
+    _interactionGroup = interactionGroup;
+    _splitDistance    = splitDistance;
+    _splitWidth       = splitWidth;
+}
+
+void MBPolReferenceTwoBodyForce::setUseMixedPrecision( bool useMixedPrecision ){
+    _useMixedPrecision = useMixedPrecision;
+}
+
+bool MBPolReferenceTwoBodyForce::getUseMixedPrecision( void ) const {
+    return _useMixedPrecision;
+}
+
+// the polynomial in single precision: the coefficients are converted once, the
+// variables on the way in and the gradients on the way out
+
+static double poly_2b_v6x_mixed(const double x[31], double g[31])
+{
+    static const std::vector<float> singleFit(thefit, thefit + sizeof(thefit)/sizeof(thefit[0]));
+
+    float xs[31], gs[31];
+    std::copy(x, x + 31, xs);
+    const double E_poly = poly_2b_v6x_single_dispatch(&singleFit[0], xs, gs);
+    std::copy(gs, gs + 31, g);
+
+    return E_poly;
+}
+
+// weight of the short-range part of a pair: 1 below r_i, 0 beyond r_f, the same
+// cosine switch as f_switch() in between
+
+static double f_split(const double& r, const double& r_i, const double& r_f, double& g)
+{
+    if (r >= r_f) {
+        g = 0.0;
+        return 0.0;
+    } else if (r > r_i) {
+        const double t1 = M_PI/(r_f - r_i);
+        const double x = (r - r_i)*t1;
+        g = - std::sin(x)*t1/2.0;
+        return (1.0 + std::cos(x))/2.0;
+    } else {
+        g = 0.0;
+        return 1.0;
+    }
+}
+
 RealVec MBPolReferenceTwoBodyForce::getPeriodicBox( void ) const {
     return _periodicBoxDimensions;
 }
@@ -107,10 +158,20 @@ void imageMolecules(const RealVec& box, std::vector<RealVec>& allPositions)
     }
 
 }
+void addClusterVirial(const std::vector<RealVec>& positions, const std::vector<RealVec>& forces, std::vector<RealVec>& virial)
+{
+    for (unsigned int i = 0; i < positions.size(); i++) {
+        for (int a = 0; a < 3; a++) {
+            virial[a] += forces[i]*positions[i][a];
+        }
+    }
+}
+
 RealOpenMM MBPolReferenceTwoBodyForce::calculatePairIxn( int siteI, int siteJ,
                                                       const std::vector<RealVec>& particlePositions,
                                                       const std::vector<std::vector<int> >& allParticleIndices,
-                                                      vector<RealVec>& forces ) const {
+                                                      vector<RealVec>& forces,
+                                                      vector<RealVec>* virial ) const {
 
         // siteI and siteJ are indices in a oxygen-only array, in order to get the position of an oxygen, we need:
         // allParticleIndices[siteI][0]
@@ -144,6 +205,15 @@ RealOpenMM MBPolReferenceTwoBodyForce::calculatePairIxn( int siteI, int siteJ,
         if (rOO < 2.)
             return 0.0;
 
+        // the pairs of the other part of a short-/long-range split are skipped
+
+        const double splitInner = (_splitDistance - _splitWidth)*nm_to_A;
+        const double splitOuter = _splitDistance*nm_to_A;
+        if (_interactionGroup == ShortRange && rOO >= splitOuter)
+            return 0.0;
+        if (_interactionGroup == LongRange && rOO <= splitInner)
+            return 0.0;
+
 
         // the extra-points
 
@@ -207,7 +277,8 @@ RealOpenMM MBPolReferenceTwoBodyForce::calculatePairIxn( int siteI, int siteJ,
         v[30] = ctxt[30].v_exp(d0_inter, k_XX_main,  extraPoints[Xa2], extraPoints[Xb2]);
 
         double g[31];
-        const double E_poly = poly_2b_v6x_eval(thefit, v, g);
+        const double E_poly = _useMixedPrecision ? poly_2b_v6x_mixed(v, g)
+                                                 : poly_2b_v6x_dispatch(thefit, v, g);
 
 
         std::vector<RealVec> allForces;
@@ -270,23 +341,45 @@ RealOpenMM MBPolReferenceTwoBodyForce::calculatePairIxn( int siteI, int siteJ,
         double gsw;
         double sw = f_switch(rOO, gsw);
 
+        if (_interactionGroup != AllInteractions) {
+            double gsplit;
+            double split = f_split(rOO, splitInner, splitOuter, gsplit);
+            if (_interactionGroup == LongRange) {
+                split  = 1.0 - split;
+                gsplit = -gsplit;
+            }
+            gsw = gsw*split + sw*gsplit;
+            sw *= split;
+        }
+
         double cal2joule = 4.184;
 
-        // first water molecule
-        forces[allParticleIndices[siteI][0]] += allForces[Oa]  * sw * cal2joule * -10.;
-        forces[allParticleIndices[siteI][1]] += allForces[Ha1] * sw * cal2joule * -10.;
-        forces[allParticleIndices[siteI][2]] += allForces[Ha2] * sw * cal2joule * -10.;
-        // second water molecule
-        forces[allParticleIndices[siteJ][0]] += allForces[Ob]  * sw * cal2joule * -10.;
-        forces[allParticleIndices[siteJ][1]] += allForces[Hb1] * sw * cal2joule * -10.;
-        forces[allParticleIndices[siteJ][2]] += allForces[Hb2] * sw * cal2joule * -10.;
+        for (int n = 0; n < 6; ++n) {
+            allForces[n] *= sw * cal2joule * -10.;
+        }
 
         // gradient of the switch
         gsw *= E_poly/rOO;
         for (int i = 0; i < 3; ++i) {
             const double d = gsw*dOO[i];
-            forces[allParticleIndices[siteI][0]][i] += d * cal2joule * -10.;
-            forces[allParticleIndices[siteJ][0]][i] -= d * cal2joule * -10.;
+            allForces[Oa][i] += d * cal2joule * -10.;
+            allForces[Ob][i] -= d * cal2joule * -10.;
+        }
+
+        // first water molecule
+        forces[allParticleIndices[siteI][0]] += allForces[Oa];
+        forces[allParticleIndices[siteI][1]] += allForces[Ha1];
+        forces[allParticleIndices[siteI][2]] += allForces[Ha2];
+        // second water molecule
+        forces[allParticleIndices[siteJ][0]] += allForces[Ob];
+        forces[allParticleIndices[siteJ][1]] += allForces[Hb1];
+        forces[allParticleIndices[siteJ][2]] += allForces[Hb2];
+
+        if (virial) {
+            for (int n = 0; n < 6; ++n) {
+                allPositions[n] *= 1.0/nm_to_A;
+            }
+            addClusterVirial(allPositions, allForces, *virial);
         }
 
     RealOpenMM energy=sw*E_poly * cal2joule;
@@ -299,7 +392,9 @@ RealOpenMM MBPolReferenceTwoBodyForce::calculateForceAndEnergy( int numParticles
                                                              const vector<RealVec>& particlePositions,
                                                              const std::vector<std::vector<int> >& allParticleIndices,
                                                              const NeighborList& neighborList,
-                                                             vector<RealVec>& forces ) const {
+                                                             vector<RealVec>& forces,
+                                                             vector<RealVec>* virial,
+                                                             vector<RealOpenMM>* moleculeEnergies ) const {
 
     // loop over neighbor list
     //    (1) calculate pair TwoBody ixn
@@ -314,8 +409,13 @@ RealOpenMM MBPolReferenceTwoBodyForce::calculateForceAndEnergy( int numParticles
         int siteI                   = pair.first;
         int siteJ                   = pair.second;
 
-        energy                     += calculatePairIxn( siteI, siteJ,
-                particlePositions, allParticleIndices, forces );
+        RealOpenMM pairEnergy       = calculatePairIxn( siteI, siteJ,
+                particlePositions, allParticleIndices, forces, virial );
+        energy                     += pairEnergy;
+        if( moleculeEnergies ){
+            (*moleculeEnergies)[siteI] += 0.5*pairEnergy;
+            (*moleculeEnergies)[siteJ] += 0.5*pairEnergy;
+        }
 
     }
 
@@ -42,6 +42,13 @@ void imageParticles(const RealVec& box, const RealVec & referenceParticle, RealV
 
 void imageMolecules(const RealVec& box, std::vector<RealVec>& allPositions);
 
+/**
+ * Add sum_i r_i (x) f_i over the atoms of one cluster (monomer, dimer or trimer) to virial,
+ * virial[a][b] += r_i[a]*f_i[b]. The positions must be imaged consistently within the cluster
+ * and its forces must add up to zero, so the result does not depend on the origin.
+ */
+void addClusterVirial(const std::vector<RealVec>& positions, const std::vector<RealVec>& forces, std::vector<RealVec>& virial);
+
 // ---------------------------------------------------------------------------------------
 
 class MBPolReferenceTwoBodyForce {
@@ -70,6 +77,15 @@ public:
          */
         CutoffPeriodic = 2,
     };
+
+    /**
+     * Part of the two-body energy to compute (see MBPolTwoBodyForce::InteractionGroup).
+     */
+    enum InteractionGroup {
+        AllInteractions = 0,
+        ShortRange = 1,
+        LongRange = 2
+    };
  
     /**---------------------------------------------------------------------------------------
        
@@ -130,6 +146,32 @@ public:
 
     void setPeriodicBox( const RealVec& box );
 
+    /**---------------------------------------------------------------------------------------
+    
+       Set the part of the energy to compute; ShortRange pairs are switched off between
+       splitDistance - splitWidth and splitDistance (oxygen-oxygen distance), LongRange is the rest
+    
+       @param interactionGroup    AllInteractions, ShortRange or LongRange
+       @param splitDistance       outer edge of the switch (nm)
+       @param splitWidth          width of the switch (nm)
+    
+       --------------------------------------------------------------------------------------- */
+    
+    void setInteractionGroup( InteractionGroup interactionGroup, double splitDistance, double splitWidth );
+
+    /**---------------------------------------------------------------------------------------
+    
+       Set whether the polynomial is evaluated in single precision; the variables, the
+       gradients and the accumulation of energy and forces stay in double precision
+    
+       @param useMixedPrecision   true for the single precision polynomial
+    
+       --------------------------------------------------------------------------------------- */
+    
+    void setUseMixedPrecision( bool useMixedPrecision );
+
+    bool getUseMixedPrecision( void ) const;
+
     /**---------------------------------------------------------------------------------------
     
        Get box dimensions
@@ -152,6 +194,8 @@ public:
        @param reductions              particle reduction factors
        @param neighborList            neighbor list
        @param forces                  add forces to this vector
+       @param virial                  if not NULL, add the virial tensor (3 rows) to this vector
+       @param moleculeEnergies        if not NULL, add half of the energy of every pair to each of its two molecules
     
        @return energy
     
@@ -160,12 +204,18 @@ public:
     RealOpenMM calculateForceAndEnergy( int numParticles, const std::vector<OpenMM::RealVec>& particlePositions, 
                                         const std::vector<std::vector<int> >& allParticleIndices,
                                         const NeighborList& neighborList,
-                                        std::vector<OpenMM::RealVec>& forces ) const;
+                                        std::vector<OpenMM::RealVec>& forces,
+                                        std::vector<OpenMM::RealVec>* virial = NULL,
+                                        std::vector<RealOpenMM>* moleculeEnergies = NULL ) const;
          
 private:
 
     NonbondedMethod _nonbondedMethod;
     double _cutoff;
+    InteractionGroup _interactionGroup;
+    double _splitDistance;
+    double _splitWidth;
+    bool _useMixedPrecision;
 
     RealVec _periodicBoxDimensions;
 
@@ -186,7 +236,8 @@ private:
     RealOpenMM calculatePairIxn( int siteI, int siteJ,
                                                           const std::vector<RealVec> & particlePositions,
                                                           const std::vector<std::vector<int> >& allParticleIndices,
-                                                          std::vector<RealVec>& forces ) const;
+                                                          std::vector<RealVec>& forces,
+                                                          std::vector<RealVec>* virial ) const;
 };
 
 // ---------------------------------------------------------------------------------------
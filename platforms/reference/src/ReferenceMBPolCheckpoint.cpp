@@ -0,0 +1,96 @@
+#include "ReferenceMBPolCheckpoint.h"
+#include "openmm/OpenMMException.h"
+#include <istream>
+#include <ostream>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+static void readBytes(istream& stream, void* data, size_t length) {
+    stream.read(static_cast<char*>(data), length);
+    if (!stream)
+        throw OpenMMException("ReferenceMBPolCheckpoint: the checkpoint is truncated");
+}
+
+void ReferenceMBPolCheckpoint::writeHeader(ostream& stream, const string& tag, int version) {
+    writeInt(stream, tag.size());
+    stream.write(tag.data(), tag.size());
+    writeInt(stream, version);
+}
+
+void ReferenceMBPolCheckpoint::checkHeader(istream& stream, const string& tag, int version) {
+    int length = readInt(stream);
+    if (length != (int) tag.size())
+        throw OpenMMException("ReferenceMBPolCheckpoint: expected a checkpoint of " + tag);
+    string found(length, ' ');
+    readBytes(stream, &found[0], length);
+    if (found != tag)
+        throw OpenMMException("ReferenceMBPolCheckpoint: expected a checkpoint of " + tag + ", found " + found);
+    if (readInt(stream) != version)
+        throw OpenMMException("ReferenceMBPolCheckpoint: unsupported version of the checkpoint of " + tag);
+}
+
+void ReferenceMBPolCheckpoint::writeInt(ostream& stream, int value) {
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+int ReferenceMBPolCheckpoint::readInt(istream& stream) {
+    int value;
+    readBytes(stream, &value, sizeof(value));
+    return value;
+}
+
+void ReferenceMBPolCheckpoint::writeDouble(ostream& stream, double value) {
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+double ReferenceMBPolCheckpoint::readDouble(istream& stream) {
+    double value;
+    readBytes(stream, &value, sizeof(value));
+    return value;
+}
+
+void ReferenceMBPolCheckpoint::writeVec(ostream& stream, const RealVec& value) {
+    for (int d = 0; d < 3; d++)
+        writeDouble(stream, value[d]);
+}
+
+RealVec ReferenceMBPolCheckpoint::readVec(istream& stream) {
+    RealVec value;
+    for (int d = 0; d < 3; d++)
+        value[d] = readDouble(stream);
+    return value;
+}
+
+void ReferenceMBPolCheckpoint::writeInts(ostream& stream, const vector<int>& values) {
+    writeInt(stream, values.size());
+    if (!values.empty())
+        stream.write(reinterpret_cast<const char*>(&values[0]), values.size()*sizeof(int));
+}
+
+void ReferenceMBPolCheckpoint::readInts(istream& stream, vector<int>& values) {
+    int size = readInt(stream);
+    if (size < 0)
+        throw OpenMMException("ReferenceMBPolCheckpoint: the checkpoint is corrupt");
+    values.resize(size);
+    if (size > 0)
+        readBytes(stream, &values[0], size*sizeof(int));
+}
+
+void ReferenceMBPolCheckpoint::writeVecs(ostream& stream, const vector<RealVec>& values) {
+    writeInt(stream, values.size());
+    for (unsigned int ii = 0; ii < values.size(); ii++)
+        writeVec(stream, values[ii]);
+}
+
+void ReferenceMBPolCheckpoint::readVecs(istream& stream, vector<RealVec>& values) {
+    int size = readInt(stream);
+    if (size < 0)
+        throw OpenMMException("ReferenceMBPolCheckpoint: the checkpoint is corrupt");
+    values.resize(size);
+    for (int ii = 0; ii < size; ii++)
+        values[ii] = readVec(stream);
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,90 @@
+#include "ReferenceMBPolFixedPoint.h"
+#include <cmath>
+
+using namespace OpenMM;
+using namespace std;
+
+namespace MBPolPlugin {
+
+static const double fixedPointScale = 4294967296.0;
+
+long long ReferenceMBPolFixedPointBuffer::toFixed(double value) {
+    return (long long) floor(value*fixedPointScale + 0.5);
+}
+
+double ReferenceMBPolFixedPointBuffer::toDouble(long long value) {
+    return value/fixedPointScale;
+}
+
+void ReferenceMBPolFixedPointBuffer::initialize(int numVectors, int numScalars) {
+    vectors.assign(numVectors, RealVec(0.0, 0.0, 0.0));
+    scalars.assign(numScalars, 0.0);
+    fixedVectors.assign(3*numVectors, 0);
+    fixedScalars.assign(numScalars, 0);
+    vectorTouched.assign(numVectors, 0);
+    scalarTouched.assign(numScalars, 0);
+    touchedVectors.clear();
+    touchedScalars.clear();
+}
+
+vector<RealVec>& ReferenceMBPolFixedPointBuffer::getVectors() {
+    return vectors;
+}
+
+vector<RealOpenMM>& ReferenceMBPolFixedPointBuffer::getScalars() {
+    return scalars;
+}
+
+void ReferenceMBPolFixedPointBuffer::touchVector(int index) {
+    if (!vectorTouched[index]) {
+        vectorTouched[index] = 1;
+        touchedVectors.push_back(index);
+    }
+}
+
+void ReferenceMBPolFixedPointBuffer::touchScalar(int index) {
+    if (!scalarTouched[index]) {
+        scalarTouched[index] = 1;
+        touchedScalars.push_back(index);
+    }
+}
+
+void ReferenceMBPolFixedPointBuffer::flush() {
+    for (unsigned int ii = 0; ii < touchedVectors.size(); ii++) {
+        int index = touchedVectors[ii];
+        for (int a = 0; a < 3; a++)
+            fixedVectors[3*index+a] += toFixed(vectors[index][a]);
+        vectors[index] = RealVec(0.0, 0.0, 0.0);
+        vectorTouched[index] = 0;
+    }
+    for (unsigned int ii = 0; ii < touchedScalars.size(); ii++) {
+        int index = touchedScalars[ii];
+        fixedScalars[index] += toFixed(scalars[index]);
+        scalars[index] = 0.0;
+        scalarTouched[index] = 0;
+    }
+    touchedVectors.clear();
+    touchedScalars.clear();
+}
+
+void ReferenceMBPolFixedPointBuffer::reduce(const vector<ReferenceMBPolFixedPointBuffer>& buffers,
+                                            vector<RealVec>& vectors, vector<RealOpenMM>* scalars) {
+    for (unsigned int ii = 0; ii < vectors.size(); ii++) {
+        for (int a = 0; a < 3; a++) {
+            long long sum = 0;
+            for (unsigned int buffer = 0; buffer < buffers.size(); buffer++)
+                sum += buffers[buffer].fixedVectors[3*ii+a];
+            vectors[ii][a] += toDouble(sum);
+        }
+    }
+    if (scalars == NULL)
+        return;
+    for (unsigned int ii = 0; ii < scalars->size(); ii++) {
+        long long sum = 0;
+        for (unsigned int buffer = 0; buffer < buffers.size(); buffer++)
+            sum += buffers[buffer].fixedScalars[ii];
+        (*scalars)[ii] += toDouble(sum);
+    }
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,157 @@
+#include "ReferenceMBPolParallel.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+static int readDefaultNumThreads() {
+    const char* value = getenv("MBPOL_NUM_THREADS");
+    if (value != NULL && atoi(value) > 0)
+        return atoi(value);
+    int hardwareThreads = (int) thread::hardware_concurrency();
+    return (hardwareThreads > 0 ? hardwareThreads : 1);
+}
+
+static atomic<int> numThreads(readDefaultNumThreads());
+
+int ReferenceMBPolParallel::getNumThreads() {
+    return numThreads;
+}
+
+void ReferenceMBPolParallel::setNumThreads(int threads) {
+    if (threads < 1)
+        throw OpenMM::OpenMMException("ReferenceMBPolParallel: the number of threads must be at least 1");
+    numThreads = threads;
+}
+
+// set on the threads running a parallelFor() body
+
+static thread_local bool insideParallelFor = false;
+
+void ReferenceMBPolParallel::parallelFor(int numItems, const function<void(int)>& body) {
+    int threads = min((int) numThreads, numItems);
+    if (threads <= 1 || insideParallelFor) {
+        for (int ii = 0; ii < numItems; ii++)
+            body(ii);
+        return;
+    }
+    atomic<int> nextItem(0);
+    runOnThreads(threads, [&](int thread) {
+        try {
+            for (int index = nextItem++; index < numItems; index = nextItem++)
+                body(index);
+        }
+        catch (...) {
+            nextItem = numItems;
+            throw;
+        }
+    });
+}
+
+// A runOnThreads() call waiting for pool threads. Threads 1 ... numThreads-1 are
+// handed out to the pool in order; the caller runs thread 0 and waits until the
+// other threads have finished.
+
+struct ParallelJob {
+    const function<void(int)>* worker;
+    int numThreads, nextThread, running;
+    exception_ptr error;
+    mutex errorLock;
+};
+
+// The pool threads are never destroyed, so that they can still be waiting when
+// static objects are destroyed at exit. The pool grows to the largest number of
+// threads ever requested at the same time, e.g. by the forces of a task graph.
+
+struct ParallelPool {
+    ParallelPool() : numIdle(0), numQueued(0) {
+    }
+    mutex lock;
+    condition_variable jobQueued, jobFinished;
+    deque<ParallelJob*> jobs;
+    int numIdle, numQueued;
+};
+
+static ParallelPool& getPool() {
+    static ParallelPool* pool = new ParallelPool();
+    return *pool;
+}
+
+static void runThread(ParallelJob& job, int thread) {
+    bool wasInside = insideParallelFor;
+    insideParallelFor = true;
+    try {
+        (*job.worker)(thread);
+    }
+    catch (...) {
+        lock_guard<mutex> guard(job.errorLock);
+        if (!job.error)
+            job.error = current_exception();
+    }
+    insideParallelFor = wasInside;
+}
+
+static void poolThread() {
+    ParallelPool& pool = getPool();
+    unique_lock<mutex> guard(pool.lock);
+    while (true) {
+        while (pool.jobs.empty())
+            pool.jobQueued.wait(guard);
+        ParallelJob& job = *pool.jobs.front();
+        int thread = job.nextThread++;
+        if (job.nextThread == job.numThreads)
+            pool.jobs.pop_front();
+        pool.numIdle--;
+        pool.numQueued--;
+        guard.unlock();
+        runThread(job, thread);
+        guard.lock();
+        pool.numIdle++;
+        if (--job.running == 0)
+            pool.jobFinished.notify_all();
+    }
+}
+
+void ReferenceMBPolParallel::runOnThreads(int threads, const function<void(int)>& worker) {
+    ParallelJob job;
+    job.worker     = &worker;
+    job.numThreads = threads;
+    job.nextThread = 1;
+    job.running    = threads-1;
+    ParallelPool& pool = getPool();
+    if (threads > 1) {
+
+        // every thread of the job must run at the same time, so start threads until
+        // there is an idle one for each queued thread
+
+        lock_guard<mutex> guard(pool.lock);
+        pool.jobs.push_back(&job);
+        pool.numQueued += threads-1;
+        for (; pool.numIdle < pool.numQueued; pool.numIdle++)
+            std::thread(poolThread).detach();
+        pool.jobQueued.notify_all();
+    }
+    runThread(job, 0);
+    if (threads > 1) {
+        unique_lock<mutex> guard(pool.lock);
+        while (job.running > 0)
+            pool.jobFinished.wait(guard);
+    }
+    if (job.error)
+        rethrow_exception(job.error);
+}
+
+bool ReferenceMBPolParallel::isInsideParallelLoop() {
+    return insideParallelFor;
+}
+
+} // namespace MBPolPlugin
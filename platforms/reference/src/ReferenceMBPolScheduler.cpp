@@ -0,0 +1,216 @@
+#include "ReferenceMBPolScheduler.h"
+#include "ReferenceMBPolParallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+static bool readFlag(const char* name) {
+    const char* value = getenv(name);
+    return (value != NULL && strcmp(value, "") != 0 && strcmp(value, "0") != 0);
+}
+
+static atomic<bool> schedulerEnabled(readFlag("MBPOL_WORK_STEALING"));
+static atomic<bool> schedulerDeterministic(readFlag("MBPOL_DETERMINISTIC"));
+
+static map<string, ReferenceMBPolScheduler::Statistics> loopStatistics;
+static mutex loopStatisticsLock;
+
+double ReferenceMBPolScheduler::Statistics::getImbalance() const {
+    return (meanBusySeconds > 0.0 ? maxBusySeconds/meanBusySeconds : 1.0);
+}
+
+double ReferenceMBPolScheduler::Statistics::getStaticImbalance() const {
+    return (meanBusySeconds > 0.0 ? staticMaxBusySeconds/meanBusySeconds : 1.0);
+}
+
+ReferenceMBPolScheduler::ReferenceMBPolScheduler(const string& loop) : loop(loop) {
+}
+
+int ReferenceMBPolScheduler::getNumThreads() {
+    if (!schedulerEnabled || ReferenceMBPolParallel::isInsideParallelLoop())
+        return 1;
+    return ReferenceMBPolParallel::getNumThreads();
+}
+
+// the chunks dealt to one thread, chunks [front, back) not yet taken
+
+struct ChunkBlock {
+    mutex lock;
+    int front;
+    int back;
+};
+
+void ReferenceMBPolScheduler::run(int numChunks, int numThreads, const function<void(int, int)>& body) {
+    int threads = min(numThreads, numChunks);
+    if (threads <= 1) {
+        for (int chunk = 0; chunk < numChunks; chunk++)
+            body(chunk, 0);
+        return;
+    }
+
+    // contiguous blocks of equal estimated cost; a chunk goes to the block its middle falls in
+
+    double totalCost = 0.0;
+    if ((int) chunkCosts.size() == numChunks)
+        for (int chunk = 0; chunk < numChunks; chunk++)
+            totalCost += chunkCosts[chunk];
+    if (totalCost <= 0.0) {
+        chunkCosts.assign(numChunks, 1.0);
+        totalCost = numChunks;
+    }
+    vector<ChunkBlock> blocks(threads);
+    int chunk = 0;
+    double cost = 0.0;
+    for (int thread = 0; thread < threads; thread++) {
+        blocks[thread].front = chunk;
+        double target = (totalCost*(thread+1))/threads;
+        while (chunk < numChunks && (thread == threads-1 || cost + 0.5*chunkCosts[chunk] < target))
+            cost += chunkCosts[chunk++];
+        blocks[thread].back = chunk;
+    }
+    vector<int> blockEnd(threads);
+    for (int thread = 0; thread < threads; thread++)
+        blockEnd[thread] = blocks[thread].back;
+
+    vector<double> measuredCosts(numChunks, 0.0);
+    vector<double> busySeconds(threads, 0.0);
+    vector<int> steals(threads, 0);
+    atomic<bool> failed(false);
+    ReferenceMBPolParallel::runOnThreads(threads, [&](int thread) {
+        while (!failed) {
+            int next = -1;
+            {
+                lock_guard<mutex> guard(blocks[thread].lock);
+                if (blocks[thread].front < blocks[thread].back)
+                    next = blocks[thread].front++;
+            }
+            if (next < 0) {
+
+                // steal the last chunk of the block with the most chunks left
+
+                int victim = -1;
+                int mostLeft = 0;
+                for (int other = 0; other < threads; other++) {
+                    if (other == thread)
+                        continue;
+                    lock_guard<mutex> guard(blocks[other].lock);
+                    if (blocks[other].back - blocks[other].front > mostLeft) {
+                        mostLeft = blocks[other].back - blocks[other].front;
+                        victim = other;
+                    }
+                }
+                if (victim < 0)
+                    break;
+                {
+                    lock_guard<mutex> guard(blocks[victim].lock);
+                    if (blocks[victim].front < blocks[victim].back)
+                        next = --blocks[victim].back;
+                }
+                if (next < 0)
+                    continue;
+                steals[thread]++;
+            }
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            try {
+                body(next, thread);
+            }
+            catch (...) {
+                failed = true;
+                throw;
+            }
+            measuredCosts[next] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            busySeconds[thread] += measuredCosts[next];
+        }
+    });
+    chunkCosts.swap(measuredCosts);
+
+    // the busiest thread, and the busiest one had every thread kept the chunks it was dealt
+
+    Statistics statistics;
+    statistics.runs   = 1;
+    statistics.chunks = numChunks;
+    chunk = 0;
+    for (int thread = 0; thread < threads; thread++) {
+        double dealtSeconds = 0.0;
+        for (; chunk < blockEnd[thread]; chunk++)
+            dealtSeconds += chunkCosts[chunk];
+        statistics.steals               += steals[thread];
+        statistics.meanBusySeconds      += busySeconds[thread]/threads;
+        statistics.maxBusySeconds        = max(statistics.maxBusySeconds, busySeconds[thread]);
+        statistics.staticMaxBusySeconds  = max(statistics.staticMaxBusySeconds, dealtSeconds);
+    }
+    lock_guard<mutex> guard(loopStatisticsLock);
+    Statistics& entry = loopStatistics[loop];
+    entry.runs                 += statistics.runs;
+    entry.chunks               += statistics.chunks;
+    entry.steals               += statistics.steals;
+    entry.meanBusySeconds      += statistics.meanBusySeconds;
+    entry.maxBusySeconds       += statistics.maxBusySeconds;
+    entry.staticMaxBusySeconds += statistics.staticMaxBusySeconds;
+}
+
+void ReferenceMBPolScheduler::resetCosts() {
+    chunkCosts.clear();
+}
+
+void ReferenceMBPolScheduler::setEnabled(bool enabled) {
+    schedulerEnabled = enabled;
+}
+
+bool ReferenceMBPolScheduler::getEnabled() {
+    return schedulerEnabled;
+}
+
+void ReferenceMBPolScheduler::setDeterministic(bool deterministic) {
+    schedulerDeterministic = deterministic;
+}
+
+bool ReferenceMBPolScheduler::getDeterministic() {
+    return schedulerDeterministic;
+}
+
+ReferenceMBPolScheduler::Statistics ReferenceMBPolScheduler::getStatistics(const string& loop) {
+    lock_guard<mutex> guard(loopStatisticsLock);
+    map<string, Statistics>::const_iterator entry = loopStatistics.find(loop);
+    return (entry == loopStatistics.end() ? Statistics() : entry->second);
+}
+
+vector<string> ReferenceMBPolScheduler::getLoops() {
+    lock_guard<mutex> guard(loopStatisticsLock);
+    vector<string> loops;
+    for (map<string, Statistics>::const_iterator entry = loopStatistics.begin(); entry != loopStatistics.end(); ++entry)
+        loops.push_back(entry->first);
+    return loops;
+}
+
+void ReferenceMBPolScheduler::resetStatistics() {
+    lock_guard<mutex> guard(loopStatisticsLock);
+    loopStatistics.clear();
+}
+
+string ReferenceMBPolScheduler::getReport() {
+    lock_guard<mutex> guard(loopStatisticsLock);
+    stringstream report;
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %8s %10s %10s %10s %10s\n", "loop", "runs", "chunks", "steals", "imbalance", "static");
+    report << line;
+    for (map<string, Statistics>::const_iterator entry = loopStatistics.begin(); entry != loopStatistics.end(); ++entry) {
+        const Statistics& statistics = entry->second;
+        snprintf(line, sizeof(line), "%-36s %8d %10d %10d %10.3f %10.3f\n", entry->first.c_str(), statistics.runs,
+                 statistics.chunks, statistics.steals, statistics.getImbalance(), statistics.getStaticImbalance());
+        report << line;
+    }
+    return report.str();
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,220 @@
+#include "ReferenceMBPolSingleFFT.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+ReferenceMBPolSingleFFT::ReferenceMBPolSingleFFT() {
+    for (int d = 0; d < 3; d++)
+        dimensions[d].size = 0;
+}
+
+void ReferenceMBPolSingleFFT::initialize(int xsize, int ysize, int zsize) {
+    const int sizes[3] = {xsize, ysize, zsize};
+    for (int d = 0; d < 3; d++) {
+        if (sizes[d] < 1)
+            throw OpenMM::OpenMMException("ReferenceMBPolSingleFFT: grid dimensions must be positive");
+        Dimension& dimension = dimensions[d];
+        dimension.size = sizes[d];
+
+        // radix 4 for pairs of factors 2, then the prime factors in increasing order; the
+        // butterflies of a factor p cost p^2 per p points, so an unusual large prime is simply
+        // a direct DFT of that length
+
+        dimension.factors.clear();
+        int remainder = sizes[d];
+        while (remainder%4 == 0) {
+            dimension.factors.push_back(4);
+            remainder /= 4;
+        }
+        for (int factor = 2; factor*factor <= remainder; factor++) {
+            while (remainder%factor == 0) {
+                dimension.factors.push_back(factor);
+                remainder /= factor;
+            }
+        }
+        if (remainder > 1)
+            dimension.factors.push_back(remainder);
+
+        // exp(-2 pi i j/n), computed in double and rounded once
+
+        dimension.twiddles.resize(sizes[d]);
+        for (int j = 0; j < sizes[d]; j++) {
+            double angle = -2.0*M_PI*j/sizes[d];
+            dimension.twiddles[j].re = (float) cos(angle);
+            dimension.twiddles[j].im = (float) sin(angle);
+        }
+    }
+
+    // the x pass works on the whole grid, the z pass on a transposed y-z slab and its copy
+
+    work.resize(max(xsize*ysize*zsize, 2*ysize*zsize));
+}
+
+void ReferenceMBPolSingleFFT::transformLines(const Dimension& dimension, Complex* data, Complex* work, int numLines, bool forward) const {
+
+    // decimation in frequency: a pass of radix p splits every transform of length n into p
+    // transforms of length n/p, X[p k + t] = DFT_{n/p}( W_n^(j t) sum_r W_p^(r t) x[j + r n/p] )[k],
+    // and stores the p new lines next to each other, so the output is in natural order
+
+    const int size          = dimension.size;
+    const Complex* twiddles = &dimension.twiddles[0];
+    const float sign        = (forward ? 1.0f : -1.0f);
+    Complex* x = data;
+    Complex* y = work;
+    int n = size;
+    int s = numLines;
+    vector<Complex> roots;
+    for (unsigned int f = 0; f < dimension.factors.size(); f++) {
+        const int p = dimension.factors[f];
+        const int m = n/p;
+        const int twiddleStep = size/n;
+        if (p > 4) {
+            roots.resize(p);
+            for (int r = 0; r < p; r++) {
+                roots[r].re = twiddles[r*(size/p)].re;
+                roots[r].im = sign*twiddles[r*(size/p)].im;
+            }
+        }
+        for (int j = 0; j < m; j++) {
+            Complex w[4];
+            for (int t = 1; t < min(p, 4); t++) {
+                w[t].re = twiddles[j*t*twiddleStep].re;
+                w[t].im = sign*twiddles[j*t*twiddleStep].im;
+            }
+            const Complex* in = x + s*j;
+            Complex* out      = y + s*p*j;
+            if (p == 2) {
+                for (int q = 0; q < s; q++) {
+                    const Complex a = in[q];
+                    const Complex b = in[q + s*m];
+                    const float dr = a.re - b.re, di = a.im - b.im;
+                    out[q].re       = a.re + b.re;
+                    out[q].im       = a.im + b.im;
+                    out[q + s].re   = dr*w[1].re - di*w[1].im;
+                    out[q + s].im   = dr*w[1].im + di*w[1].re;
+                }
+            } else if (p == 3) {
+
+                // W_3 = -1/2 - i sqrt(3)/2 forward
+
+                const float c = -0.866025403784438647f*sign;
+                for (int q = 0; q < s; q++) {
+                    const Complex a0 = in[q];
+                    const Complex a1 = in[q + s*m];
+                    const Complex a2 = in[q + 2*s*m];
+                    const float sr = a1.re + a2.re, si = a1.im + a2.im;
+                    const float dr = a1.re - a2.re, di = a1.im - a2.im;
+                    const float hr = a0.re - 0.5f*sr, hi = a0.im - 0.5f*si;
+                    const float x1r = hr - c*di, x1i = hi + c*dr;
+                    const float x2r = hr + c*di, x2i = hi - c*dr;
+                    out[q].re         = a0.re + sr;
+                    out[q].im         = a0.im + si;
+                    out[q + s].re     = x1r*w[1].re - x1i*w[1].im;
+                    out[q + s].im     = x1r*w[1].im + x1i*w[1].re;
+                    out[q + 2*s].re   = x2r*w[2].re - x2i*w[2].im;
+                    out[q + 2*s].im   = x2r*w[2].im + x2i*w[2].re;
+                }
+            } else if (p == 4) {
+
+                // W_4 = -i forward
+
+                for (int q = 0; q < s; q++) {
+                    const Complex a0 = in[q];
+                    const Complex a1 = in[q + s*m];
+                    const Complex a2 = in[q + 2*s*m];
+                    const Complex a3 = in[q + 3*s*m];
+                    const float t0r = a0.re + a2.re, t0i = a0.im + a2.im;
+                    const float t1r = a0.re - a2.re, t1i = a0.im - a2.im;
+                    const float t2r = a1.re + a3.re, t2i = a1.im + a3.im;
+                    const float t3r = sign*(a1.im - a3.im), t3i = -sign*(a1.re - a3.re);
+                    const float x1r = t1r + t3r, x1i = t1i + t3i;
+                    const float x2r = t0r - t2r, x2i = t0i - t2i;
+                    const float x3r = t1r - t3r, x3i = t1i - t3i;
+                    out[q].re         = t0r + t2r;
+                    out[q].im         = t0i + t2i;
+                    out[q + s].re     = x1r*w[1].re - x1i*w[1].im;
+                    out[q + s].im     = x1r*w[1].im + x1i*w[1].re;
+                    out[q + 2*s].re   = x2r*w[2].re - x2i*w[2].im;
+                    out[q + 2*s].im   = x2r*w[2].im + x2i*w[2].re;
+                    out[q + 3*s].re   = x3r*w[3].re - x3i*w[3].im;
+                    out[q + 3*s].im   = x3r*w[3].im + x3i*w[3].re;
+                }
+            } else {
+
+                // direct DFT of length p, one output line at a time
+
+                for (int t = 0; t < p; t++) {
+                    Complex* line = out + t*s;
+                    for (int q = 0; q < s; q++)
+                        line[q] = in[q];
+                    for (int r = 1; r < p; r++) {
+                        const Complex root   = roots[(r*t)%p];
+                        const Complex* value = in + r*s*m;
+                        for (int q = 0; q < s; q++) {
+                            const float re = line[q].re + value[q].re*root.re - value[q].im*root.im;
+                            const float im = line[q].im + value[q].re*root.im + value[q].im*root.re;
+                            line[q].re = re;
+                            line[q].im = im;
+                        }
+                    }
+                    Complex twiddle;
+                    twiddle.re = twiddles[j*t*twiddleStep].re;
+                    twiddle.im = sign*twiddles[j*t*twiddleStep].im;
+                    for (int q = 0; q < s; q++) {
+                        const float re = line[q].re*twiddle.re - line[q].im*twiddle.im;
+                        const float im = line[q].re*twiddle.im + line[q].im*twiddle.re;
+                        line[q].re = re;
+                        line[q].im = im;
+                    }
+                }
+            }
+        }
+        swap(x, y);
+        n  = m;
+        s *= p;
+    }
+    if (x != data)
+        copy(x, x + size*numLines, data);
+}
+
+void ReferenceMBPolSingleFFT::execute(Complex* grid, bool forward) {
+    const int xsize = dimensions[0].size;
+    const int ysize = dimensions[1].size;
+    const int zsize = dimensions[2].size;
+    const int slab  = ysize*zsize;
+
+    // x: the lines start at every point of the first y-z slab, one slab apart
+
+    if (xsize > 1)
+        transformLines(dimensions[0], grid, &work[0], slab, forward);
+
+    // y: within a slab the lines start at every z, zsize apart
+
+    if (ysize > 1) {
+        for (int x = 0; x < xsize; x++)
+            transformLines(dimensions[1], grid + x*slab, &work[0], zsize, forward);
+    }
+
+    // z: the lines are contiguous, so each slab is transposed to interleave them
+
+    if (zsize > 1) {
+        Complex* transposed = &work[0];
+        Complex* scratch    = &work[slab];
+        for (int x = 0; x < xsize; x++) {
+            Complex* start = grid + x*slab;
+            for (int y = 0; y < ysize; y++)
+                for (int z = 0; z < zsize; z++)
+                    transposed[z*ysize + y] = start[y*zsize + z];
+            transformLines(dimensions[2], transposed, scratch, ysize, forward);
+            for (int y = 0; y < ysize; y++)
+                for (int z = 0; z < zsize; z++)
+                    start[y*zsize + z] = transposed[z*ysize + y];
+        }
+    }
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,343 @@
+#include "ReferenceMBPolTaskGraph.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+// one task graph per context, shared by the kernels that acquired it
+
+static map<const void*, ReferenceMBPolTaskGraph*> taskGraphs;
+static mutex taskGraphsLock;
+
+static bool readDefaultEnabled() {
+    const char* value = getenv("MBPOL_TASK_GRAPH");
+    return (value != NULL && strcmp(value, "") != 0 && strcmp(value, "0") != 0);
+}
+
+static bool defaultEnabled = readDefaultEnabled();
+
+static double secondsSince(const chrono::steady_clock::time_point& start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// 64-bit fingerprint of the positions and the box, so that a task started by beginEvaluation()
+// is only used for the configuration it was started for, without keeping a copy of it. Equal configurations always have the same fingerprint; two
+// different ones collide with a probability of about 2^-64. The x, y and z coordinates are
+// mixed into separate hashes, which the processor can update in parallel.
+
+static unsigned long long mixFingerprint(unsigned long long hash, double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    hash = (hash ^ bits)*0xff51afd7ed558ccdULL;
+    return hash ^ (hash >> 29);
+}
+
+static unsigned long long getFingerprint(const vector<RealVec>& positions, const RealVec& box) {
+    unsigned long long hash[3] = { 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL };
+    for (unsigned int ii = 0; ii < positions.size(); ii++)
+        for (int a = 0; a < 3; a++)
+            hash[a] = mixFingerprint(hash[a], positions[ii][a]);
+    unsigned long long fingerprint = positions.size();
+    for (int a = 0; a < 3; a++)
+        fingerprint = mixFingerprint(fingerprint ^ hash[a], box[a]);
+    return fingerprint;
+}
+
+ReferenceMBPolTaskGraph::ReferenceMBPolTaskGraph() : enabled(defaultEnabled), launchValid(false), launchFingerprint(0), numOwners(0) {
+}
+
+ReferenceMBPolTaskGraph::~ReferenceMBPolTaskGraph() {
+    for (unsigned int ii = 0; ii < slots.size(); ii++) {
+        stopWorker(*slots[ii]);
+        delete slots[ii];
+    }
+}
+
+ReferenceMBPolTaskGraph* ReferenceMBPolTaskGraph::acquire(const void* owner) {
+    lock_guard<mutex> guard(taskGraphsLock);
+    map<const void*, ReferenceMBPolTaskGraph*>::iterator entry = taskGraphs.find(owner);
+    if (entry == taskGraphs.end())
+        entry = taskGraphs.insert(make_pair(owner, new ReferenceMBPolTaskGraph())).first;
+    entry->second->numOwners++;
+    return entry->second;
+}
+
+void ReferenceMBPolTaskGraph::release(const void* owner) {
+    lock_guard<mutex> guard(taskGraphsLock);
+    map<const void*, ReferenceMBPolTaskGraph*>::iterator entry = taskGraphs.find(owner);
+    if (entry == taskGraphs.end())
+        return;
+    if (--entry->second->numOwners == 0) {
+        delete entry->second;
+        taskGraphs.erase(entry);
+    }
+}
+
+int ReferenceMBPolTaskGraph::getNumTaskGraphs() {
+    lock_guard<mutex> guard(taskGraphsLock);
+    return taskGraphs.size();
+}
+
+ReferenceMBPolTaskGraph* ReferenceMBPolTaskGraph::getTaskGraph(int index) {
+    lock_guard<mutex> guard(taskGraphsLock);
+    map<const void*, ReferenceMBPolTaskGraph*>::iterator entry = taskGraphs.begin();
+    for (int ii = 0; ii < index && entry != taskGraphs.end(); ii++)
+        ++entry;
+    return (entry == taskGraphs.end() ? NULL : entry->second);
+}
+
+void ReferenceMBPolTaskGraph::setDefaultEnabled(bool enabled) {
+    defaultEnabled = enabled;
+}
+
+bool ReferenceMBPolTaskGraph::getDefaultEnabled() {
+    return defaultEnabled;
+}
+
+void ReferenceMBPolTaskGraph::setEnabled(bool enabled) {
+    if (!enabled)
+        joinAll();
+    this->enabled = enabled;
+}
+
+bool ReferenceMBPolTaskGraph::getEnabled() const {
+    return enabled;
+}
+
+void ReferenceMBPolTaskGraph::discardPending(ReferenceMBPolTask* task) {
+    int index = findTask(task);
+    if (index < 0)
+        return;
+
+    // the task may still be reading the old parameters, so it has to finish first
+
+    TaskSlot& slot = *slots[index];
+    if (slot.pending)
+        wait(slot);
+}
+
+void ReferenceMBPolTaskGraph::addTask(ReferenceMBPolTask* task) {
+    if (findTask(task) >= 0)
+        return;
+    TaskSlot* slot = new TaskSlot();
+    slot->task = task;
+    slot->context = NULL;
+    slot->running = slot->stop = false;
+    slot->pending = false;
+    slot->includeForces = slot->includeEnergy = false;
+    slot->energy = 0.0;
+    slot->count = slot->overlapCount = 0;
+    slot->lastTime = slot->totalTime = slot->waitTime = 0.0;
+    slots.push_back(slot);
+}
+
+void ReferenceMBPolTaskGraph::removeTask(ReferenceMBPolTask* task) {
+    int index = findTask(task);
+    if (index < 0)
+        return;
+    stopWorker(*slots[index]);
+    delete slots[index];
+    slots.erase(slots.begin()+index);
+}
+
+int ReferenceMBPolTaskGraph::findTask(ReferenceMBPolTask* task) const {
+    for (unsigned int ii = 0; ii < slots.size(); ii++)
+        if (slots[ii]->task == task)
+            return ii;
+    return -1;
+}
+
+void ReferenceMBPolTaskGraph::run(TaskSlot& slot, ContextImpl& context) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    try {
+        slot.energy = slot.task->computeTask(context, slot.includeForces, slot.includeEnergy, slot.forces);
+    } catch (...) {
+        slot.error = current_exception();
+    }
+    slot.lastTime   = secondsSince(start);
+    slot.totalTime += slot.lastTime;
+}
+
+void ReferenceMBPolTaskGraph::work(TaskSlot& slot) {
+    unique_lock<mutex> guard(slot.lock);
+    while (true) {
+        while (!slot.running && !slot.stop)
+            slot.wakeup.wait(guard);
+        if (!slot.running)
+            return;
+        guard.unlock();
+        run(slot, *slot.context);
+        guard.lock();
+        slot.running = false;
+        slot.wakeup.notify_all();
+    }
+}
+
+void ReferenceMBPolTaskGraph::launch(TaskSlot& slot, ContextImpl& context) {
+    if (!slot.worker.joinable())
+        slot.worker = thread(&ReferenceMBPolTaskGraph::work, this, ref(slot));
+    lock_guard<mutex> guard(slot.lock);
+    slot.context = &context;
+    slot.running = true;
+    slot.pending = true;
+    slot.wakeup.notify_all();
+}
+
+void ReferenceMBPolTaskGraph::wait(TaskSlot& slot) {
+    unique_lock<mutex> guard(slot.lock);
+    while (slot.running)
+        slot.wakeup.wait(guard);
+    slot.pending = false;
+}
+
+void ReferenceMBPolTaskGraph::stopWorker(TaskSlot& slot) {
+    if (!slot.worker.joinable())
+        return;
+    wait(slot);
+    {
+        lock_guard<mutex> guard(slot.lock);
+        slot.stop = true;
+        slot.wakeup.notify_all();
+    }
+    slot.worker.join();
+}
+
+void ReferenceMBPolTaskGraph::joinAll() {
+    for (unsigned int ii = 0; ii < slots.size(); ii++)
+        if (slots[ii]->pending)
+            wait(*slots[ii]);
+}
+
+void ReferenceMBPolTaskGraph::beginEvaluation(ReferenceMBPolTask* task, ContextImpl& context, const vector<RealVec>& positions,
+                                              const RealVec& box, bool includeForces, bool includeEnergy, int groups) {
+    if (!enabled)
+        return;
+    int index = findTask(task);
+    if (index < 0)
+        return;
+    TaskSlot& current = *slots[index];
+    unsigned long long fingerprint = getFingerprint(positions, box);
+    bool launched = (launchValid && fingerprint == launchFingerprint);
+    if (current.pending && (current.includeForces || !includeForces) && (current.includeEnergy || !includeEnergy) && launched)
+        return;
+
+    // first MBPol force of this evaluation: start the others
+
+    joinAll();
+    launchValid       = true;
+    launchFingerprint = fingerprint;
+    for (unsigned int ii = 0; ii < slots.size(); ii++) {
+        TaskSlot& slot = *slots[ii];
+        if (&slot == &current || (groups&(1<<slot.task->getTaskForceGroup())) == 0)
+            continue;
+        slot.includeForces = includeForces;
+        slot.includeEnergy = includeEnergy;
+        slot.forces.assign(positions.size(), RealVec(0.0, 0.0, 0.0));
+        slot.energy  = 0.0;
+        slot.error   = exception_ptr();
+        launch(slot, context);
+    }
+}
+
+double ReferenceMBPolTaskGraph::execute(ReferenceMBPolTask* task, ContextImpl& context, const vector<RealVec>& positions,
+                                        const RealVec& box, bool includeForces, bool includeEnergy, vector<RealVec>& forces) {
+    int index = findTask(task);
+    if (index >= 0 && slots[index]->pending) {
+        TaskSlot& slot = *slots[index];
+        if ((slot.includeForces || !includeForces) && (slot.includeEnergy || !includeEnergy) &&
+                launchValid && getFingerprint(positions, box) == launchFingerprint) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            wait(slot);
+            slot.waitTime += secondsSince(start);
+            if (slot.error) {
+                joinAll();
+                rethrow_exception(slot.error);
+            }
+            slot.count++;
+            slot.overlapCount++;
+            for (unsigned int ii = 0; ii < forces.size(); ii++)
+                forces[ii] += slot.forces[ii];
+            return slot.energy;
+        }
+
+        // left over from an evaluation at other positions
+
+        joinAll();
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double energy;
+    try {
+        energy = task->computeTask(context, includeForces, includeEnergy, forces);
+    } catch (...) {
+        joinAll();
+        throw;
+    }
+    if (index >= 0) {
+        TaskSlot& slot = *slots[index];
+        slot.count++;
+        slot.lastTime   = secondsSince(start);
+        slot.totalTime += slot.lastTime;
+    }
+    return energy;
+}
+
+int ReferenceMBPolTaskGraph::getNumTasks() const {
+    return slots.size();
+}
+
+string ReferenceMBPolTaskGraph::getTaskName(int index) const {
+    return slots[index]->task->getTaskName();
+}
+
+int ReferenceMBPolTaskGraph::getTaskCount(int index) const {
+    return slots[index]->count;
+}
+
+int ReferenceMBPolTaskGraph::getTaskOverlapCount(int index) const {
+    return slots[index]->overlapCount;
+}
+
+double ReferenceMBPolTaskGraph::getTaskLastTime(int index) const {
+    return slots[index]->lastTime;
+}
+
+double ReferenceMBPolTaskGraph::getTaskTotalTime(int index) const {
+    return slots[index]->totalTime;
+}
+
+double ReferenceMBPolTaskGraph::getTaskWaitTime(int index) const {
+    return slots[index]->waitTime;
+}
+
+void ReferenceMBPolTaskGraph::resetTimings() {
+    joinAll();
+    for (unsigned int ii = 0; ii < slots.size(); ii++) {
+        slots[ii]->count = slots[ii]->overlapCount = 0;
+        slots[ii]->lastTime = slots[ii]->totalTime = slots[ii]->waitTime = 0.0;
+    }
+}
+
+string ReferenceMBPolTaskGraph::getTimingReport() const {
+    stringstream report;
+    char line[256];
+    snprintf(line, sizeof(line), "%-16s %8s %10s %12s %12s %12s\n", "task", "count", "overlapped",
+             "last (ms)", "total (s)", "wait (s)");
+    report << line;
+    for (unsigned int ii = 0; ii < slots.size(); ii++) {
+        const TaskSlot& slot = *slots[ii];
+        snprintf(line, sizeof(line), "%-16s %8d %10d %12.3f %12.4f %12.4f\n", slot.task->getTaskName().c_str(),
+                 slot.count, slot.overlapCount, 1000.0*slot.lastTime, slot.totalTime, slot.waitTime);
+        report << line;
+    }
+    return report.str();
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,95 @@
+#include "ReferenceMBPolTimers.h"
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+struct PhaseTime {
+    PhaseTime() : seconds(0.0), count(0) {
+    }
+    double seconds;
+    int count;
+};
+
+static map<string, PhaseTime> phaseTimes;
+static mutex phaseTimesLock;
+static atomic<bool> timersEnabled(false);
+
+ReferenceMBPolTimers::Scope::Scope(const char* phase) : phase(phase), count(1), active(timersEnabled) {
+    if (active)
+        start = chrono::steady_clock::now();
+}
+
+ReferenceMBPolTimers::Scope::~Scope() {
+    stop();
+}
+
+void ReferenceMBPolTimers::Scope::stop() {
+    if (active)
+        add(phase, chrono::duration<double>(chrono::steady_clock::now() - start).count(), count);
+    active = false;
+}
+
+void ReferenceMBPolTimers::Scope::setCount(int count) {
+    this->count = count;
+}
+
+void ReferenceMBPolTimers::setEnabled(bool enabled) {
+    timersEnabled = enabled;
+}
+
+bool ReferenceMBPolTimers::getEnabled() {
+    return timersEnabled;
+}
+
+void ReferenceMBPolTimers::add(const string& phase, double seconds, int count) {
+    lock_guard<mutex> guard(phaseTimesLock);
+    PhaseTime& entry = phaseTimes[phase];
+    entry.seconds   += seconds;
+    entry.count     += count;
+}
+
+void ReferenceMBPolTimers::reset() {
+    lock_guard<mutex> guard(phaseTimesLock);
+    phaseTimes.clear();
+}
+
+vector<string> ReferenceMBPolTimers::getPhases() {
+    lock_guard<mutex> guard(phaseTimesLock);
+    vector<string> phases;
+    for (map<string, PhaseTime>::const_iterator entry = phaseTimes.begin(); entry != phaseTimes.end(); ++entry)
+        phases.push_back(entry->first);
+    return phases;
+}
+
+double ReferenceMBPolTimers::getTime(const string& phase) {
+    lock_guard<mutex> guard(phaseTimesLock);
+    map<string, PhaseTime>::const_iterator entry = phaseTimes.find(phase);
+    return (entry == phaseTimes.end() ? 0.0 : entry->second.seconds);
+}
+
+int ReferenceMBPolTimers::getCount(const string& phase) {
+    lock_guard<mutex> guard(phaseTimesLock);
+    map<string, PhaseTime>::const_iterator entry = phaseTimes.find(phase);
+    return (entry == phaseTimes.end() ? 0 : entry->second.count);
+}
+
+string ReferenceMBPolTimers::getReport() {
+    lock_guard<mutex> guard(phaseTimesLock);
+    stringstream report;
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %10s %12s\n", "phase", "count", "total (s)");
+    report << line;
+    for (map<string, PhaseTime>::const_iterator entry = phaseTimes.begin(); entry != phaseTimes.end(); ++entry) {
+        snprintf(line, sizeof(line), "%-36s %10d %12.4f\n", entry->first.c_str(), entry->second.count, entry->second.seconds);
+        report << line;
+    }
+    return report.str();
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,486 @@
+#include "ReferenceMBPolTreecode.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+// groups per leaf and deepest level of the octree (coincident groups end up in one leaf)
+
+static const int treecodeLeafSize = 8;
+static const int treecodeMaxDepth = 24;
+
+ReferenceMBPolTreecode::ReferenceMBPolTreecode() : openingAngle(0.5), nearDistance(0.0), maxGroupRadius(0.0) {
+    setupTerms(6);
+}
+
+void ReferenceMBPolTreecode::setOpeningAngle(double angle) {
+    if (angle <= 0.0 || angle >= 1.0)
+        throw OpenMMException("ReferenceMBPolTreecode: the opening angle must be between 0 and 1");
+    openingAngle = angle;
+}
+
+double ReferenceMBPolTreecode::getOpeningAngle() const {
+    return openingAngle;
+}
+
+void ReferenceMBPolTreecode::setExpansionOrder(int order) {
+    if (order < 1)
+        throw OpenMMException("ReferenceMBPolTreecode: the expansion order must be at least 1");
+    setupTerms(order);
+}
+
+int ReferenceMBPolTreecode::getExpansionOrder() const {
+    return expansionOrder;
+}
+
+void ReferenceMBPolTreecode::setupTerms(int order) {
+
+    // multi-indices k = (kx, ky, kz) by increasing |k|, up to order+2 for the field gradient
+
+    expansionOrder = order;
+    int maxOrder   = order + 2;
+    termPowers.clear();
+    numTermsOfOrder.clear();
+    vector<int> index((maxOrder+1)*(maxOrder+1)*(maxOrder+1), -1);
+    for (int n = 0; n <= maxOrder; n++) {
+        for (int kx = n; kx >= 0; kx--) {
+            for (int ky = n-kx; ky >= 0; ky--) {
+                index[(kx*(maxOrder+1) + ky)*(maxOrder+1) + n-kx-ky] = termPowers.size()/3;
+                termPowers.push_back(kx);
+                termPowers.push_back(ky);
+                termPowers.push_back(n-kx-ky);
+            }
+        }
+        numTermsOfOrder.push_back(termPowers.size()/3);
+    }
+    // recurrence tables of the Taylor coefficients; missing terms point at a trailing zero
+
+    int numTerms = termPowers.size()/3;
+    termRaised.assign(3*numTerms, -1);
+    recurrenceFirst.assign(3*numTerms, numTerms);
+    recurrenceSecond.assign(3*numTerms, numTerms);
+    recurrenceScale.assign(2*numTerms, 0.0);
+    for (int t = 0; t < numTerms; t++) {
+        int k[3] = {termPowers[3*t], termPowers[3*t+1], termPowers[3*t+2]};
+        int n    = k[0] + k[1] + k[2];
+        if (n > 0) {
+            recurrenceScale[2*t]   = (2.0*n-1.0)/n;
+            recurrenceScale[2*t+1] = (n-1.0)/n;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (k[i] > 0) {
+                k[i]--;
+                recurrenceFirst[3*t+i] = index[(k[0]*(maxOrder+1) + k[1])*(maxOrder+1) + k[2]];
+                if (k[i] > 0) {
+                    k[i]--;
+                    recurrenceSecond[3*t+i] = index[(k[0]*(maxOrder+1) + k[1])*(maxOrder+1) + k[2]];
+                    k[i]++;
+                }
+                k[i]++;
+            }
+            if (n < maxOrder) {
+                k[i]++;
+                termRaised[3*t+i] = index[(k[0]*(maxOrder+1) + k[1])*(maxOrder+1) + k[2]];
+                k[i]--;
+            }
+        }
+    }
+}
+
+void ReferenceMBPolTreecode::setNearDistance(double distance) {
+    nearDistance = distance;
+}
+
+double ReferenceMBPolTreecode::getNearDistance() const {
+    return nearDistance;
+}
+
+const vector<pair<int, int> >& ReferenceMBPolTreecode::getNearPairs() const {
+    return nearPairs;
+}
+
+double ReferenceMBPolTreecode::getMaxGroupRadius() const {
+    return maxGroupRadius;
+}
+
+void ReferenceMBPolTreecode::getNumInteractions(int& numExpansions, int& numDirect) const {
+    numExpansions = expansionNodes.size();
+    numDirect     = directGroups.size();
+}
+
+void ReferenceMBPolTreecode::build(const vector<RealVec>& sitePositions, const vector<vector<int> >& siteGroups) {
+    positions = sitePositions;
+    groups    = siteGroups;
+    int numGroups = groups.size();
+
+    groupCenters.assign(numGroups, RealVec(0.0, 0.0, 0.0));
+    groupRadii.assign(numGroups, 0.0);
+    maxGroupRadius = 0.0;
+    for (int ii = 0; ii < numGroups; ii++) {
+        const vector<int>& sites = groups[ii];
+        if (sites.empty())
+            throw OpenMMException("ReferenceMBPolTreecode: empty group");
+        for (unsigned int jj = 0; jj < sites.size(); jj++)
+            groupCenters[ii] += positions[sites[jj]];
+        groupCenters[ii] *= 1.0/sites.size();
+        for (unsigned int jj = 0; jj < sites.size(); jj++) {
+            RealVec delta = positions[sites[jj]] - groupCenters[ii];
+            groupRadii[ii] = max(groupRadii[ii], (RealOpenMM) sqrt(delta.dot(delta)));
+        }
+        maxGroupRadius = max(maxGroupRadius, (double) groupRadii[ii]);
+    }
+
+    // octree over the group centers, in a cube around all of them
+
+    nodes.clear();
+    groupOrder.resize(numGroups);
+    for (int ii = 0; ii < numGroups; ii++)
+        groupOrder[ii] = ii;
+    if (numGroups > 0) {
+        RealVec low = groupCenters[0], high = groupCenters[0];
+        for (int ii = 1; ii < numGroups; ii++) {
+            for (int d = 0; d < 3; d++) {
+                low[d]  = min(low[d], groupCenters[ii][d]);
+                high[d] = max(high[d], groupCenters[ii][d]);
+            }
+        }
+        RealOpenMM size = max(high[0]-low[0], max(high[1]-low[1], high[2]-low[2]));
+        for (int d = 0; d < 3; d++) {
+            RealOpenMM middle = 0.5*(low[d]+high[d]);
+            low[d]  = middle - 0.5*size;
+            high[d] = middle + 0.5*size;
+        }
+        buildNode(0, numGroups, low, high, 0);
+    }
+
+    // interaction lists of each group
+
+    nearPairs.clear();
+    expansionStart.assign(1, 0);
+    expansionNodes.clear();
+    directStart.assign(1, 0);
+    directGroups.clear();
+    for (int ii = 0; ii < numGroups; ii++) {
+        pendingExpansions.clear();
+        pendingDirect.clear();
+        if (!nodes.empty())
+            findInteractions(ii, 0);
+        expansionNodes.insert(expansionNodes.end(), pendingExpansions.begin(), pendingExpansions.end());
+        directGroups.insert(directGroups.end(), pendingDirect.begin(), pendingDirect.end());
+        expansionStart.push_back(expansionNodes.size());
+        directStart.push_back(directGroups.size());
+    }
+}
+
+int ReferenceMBPolTreecode::buildNode(int firstGroup, int lastGroup, const RealVec& low, const RealVec& high, int depth) {
+    int index = nodes.size();
+    nodes.push_back(Node());
+
+    // expand about the center of the bounding box of the sites
+
+    RealVec siteLow  = positions[groups[groupOrder[firstGroup]][0]];
+    RealVec siteHigh = siteLow;
+    for (int ii = firstGroup; ii < lastGroup; ii++) {
+        const vector<int>& sites = groups[groupOrder[ii]];
+        for (unsigned int jj = 0; jj < sites.size(); jj++) {
+            for (int d = 0; d < 3; d++) {
+                siteLow[d]  = min(siteLow[d], positions[sites[jj]][d]);
+                siteHigh[d] = max(siteHigh[d], positions[sites[jj]][d]);
+            }
+        }
+    }
+    Node node;
+    node.center      = (siteLow + siteHigh)*0.5;
+    node.radius      = 0.0;
+    node.groupRadius = 0.0;
+    node.firstGroup  = firstGroup;
+    node.lastGroup   = lastGroup;
+    node.numSites    = 0;
+    node.numChildren = 0;
+    for (int ii = firstGroup; ii < lastGroup; ii++) {
+        const vector<int>& sites = groups[groupOrder[ii]];
+        node.numSites += sites.size();
+        for (unsigned int jj = 0; jj < sites.size(); jj++) {
+            RealVec delta = positions[sites[jj]] - node.center;
+            node.radius = max(node.radius, (RealOpenMM) sqrt(delta.dot(delta)));
+        }
+        RealVec delta = groupCenters[groupOrder[ii]] - node.center;
+        node.groupRadius = max(node.groupRadius, (RealOpenMM) sqrt(delta.dot(delta)));
+    }
+
+    if (lastGroup - firstGroup > treecodeLeafSize && depth < treecodeMaxDepth) {
+
+        // sort the groups into octants
+
+        RealVec middle = (low + high)*0.5;
+        vector<int> octantGroups[8];
+        for (int ii = firstGroup; ii < lastGroup; ii++) {
+            const RealVec& center = groupCenters[groupOrder[ii]];
+            int octant = (center[0] < middle[0] ? 0 : 1) + (center[1] < middle[1] ? 0 : 2) + (center[2] < middle[2] ? 0 : 4);
+            octantGroups[octant].push_back(groupOrder[ii]);
+        }
+        int start = firstGroup;
+        for (int octant = 0; octant < 8; octant++) {
+            copy(octantGroups[octant].begin(), octantGroups[octant].end(), groupOrder.begin() + start);
+            start += octantGroups[octant].size();
+        }
+        start = firstGroup;
+        for (int octant = 0; octant < 8; octant++) {
+            int count = octantGroups[octant].size();
+            if (count == 0)
+                continue;
+            RealVec childLow, childHigh;
+            for (int d = 0; d < 3; d++) {
+                bool upper   = ((octant >> d) & 1) != 0;
+                childLow[d]  = upper ? middle[d] : low[d];
+                childHigh[d] = upper ? high[d] : middle[d];
+            }
+            node.children[node.numChildren++] = buildNode(start, start+count, childLow, childHigh, depth+1);
+            start += count;
+        }
+    }
+    nodes[index] = node;
+    return index;
+}
+
+void ReferenceMBPolTreecode::findInteractions(int group, int nodeIndex) {
+    const Node& node = nodes[nodeIndex];
+    RealVec delta    = node.center - groupCenters[group];
+    RealOpenMM distance = sqrt(delta.dot(delta));
+
+    // no group of the node is near and the node looks small from every site of the group;
+    // a node with fewer sites than its expansion has terms is cheaper to sum directly
+
+    RealOpenMM siteDistance = distance - groupRadii[group];
+    if (siteDistance - node.groupRadius - maxGroupRadius > nearDistance && node.radius < openingAngle*siteDistance) {
+        if (node.numSites >= numTermsOfOrder[expansionOrder]) {
+            pendingExpansions.push_back(nodeIndex);
+        } else {
+            for (int ii = node.firstGroup; ii < node.lastGroup; ii++)
+                pendingDirect.push_back(groupOrder[ii]);
+        }
+        return;
+    }
+    if (node.numChildren > 0) {
+        for (int ii = 0; ii < node.numChildren; ii++)
+            findInteractions(group, node.children[ii]);
+        return;
+    }
+    for (int ii = node.firstGroup; ii < node.lastGroup; ii++) {
+        int other = groupOrder[ii];
+        if (other == group)
+            continue;
+        RealVec groupDelta = groupCenters[other] - groupCenters[group];
+        if (sqrt(groupDelta.dot(groupDelta)) - groupRadii[group] - groupRadii[other] <= nearDistance) {
+            if (group < other)
+                nearPairs.push_back(make_pair(group, other));
+        } else {
+            pendingDirect.push_back(other);
+        }
+    }
+}
+
+void ReferenceMBPolTreecode::computeMoments(const vector<RealOpenMM>* charges, const vector<RealVec>* dipoles,
+                                            vector<RealOpenMM>& moments) const {
+
+    // m_k = sum q d^k + sum mu.grad d^k with d = r - center
+
+    int numTerms = numTermsOfOrder[expansionOrder];
+    moments.assign(nodes.size()*numTerms, 0.0);
+    vector<RealOpenMM> powers[3];
+    for (int i = 0; i < 3; i++)
+        powers[i].resize(expansionOrder+1);
+    for (unsigned int nn = 0; nn < nodes.size(); nn++) {
+        const Node& node = nodes[nn];
+        RealOpenMM* moment = &moments[nn*numTerms];
+        for (int ii = node.firstGroup; ii < node.lastGroup; ii++) {
+            const vector<int>& sites = groups[groupOrder[ii]];
+            for (unsigned int jj = 0; jj < sites.size(); jj++) {
+                RealVec d = positions[sites[jj]] - node.center;
+                for (int i = 0; i < 3; i++) {
+                    powers[i][0] = 1.0;
+                    for (int n = 1; n <= expansionOrder; n++)
+                        powers[i][n] = powers[i][n-1]*d[i];
+                }
+                RealOpenMM q = charges ? (*charges)[sites[jj]] : 0.0;
+                for (int t = 0; t < numTerms; t++) {
+                    const int* k = &termPowers[3*t];
+                    if (q != 0.0)
+                        moment[t] += q*powers[0][k[0]]*powers[1][k[1]]*powers[2][k[2]];
+                    if (dipoles) {
+                        const RealVec& mu = (*dipoles)[sites[jj]];
+                        if (k[0] > 0)
+                            moment[t] += mu[0]*k[0]*powers[0][k[0]-1]*powers[1][k[1]]*powers[2][k[2]];
+                        if (k[1] > 0)
+                            moment[t] += mu[1]*k[1]*powers[0][k[0]]*powers[1][k[1]-1]*powers[2][k[2]];
+                        if (k[2] > 0)
+                            moment[t] += mu[2]*k[2]*powers[0][k[0]]*powers[1][k[1]]*powers[2][k[2]-1];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ReferenceMBPolTreecode::computeTaylorCoefficients(const RealVec& delta, int numCoefficients, vector<RealOpenMM>& a) const {
+
+    // a_k = (1/k!) D^k_y 1/|x - y| at the expansion center, delta = x - center:
+    // |k| r^2 a_k = (2|k|-1) sum_i delta_i a_{k-e_i} - (|k|-1) sum_i a_{k-2e_i}
+
+    RealOpenMM r2   = delta.dot(delta);
+    RealOpenMM ir2  = 1.0/r2;
+    a[0]            = sqrt(ir2);
+    a[termPowers.size()/3] = 0.0;
+    const int* first        = &recurrenceFirst[0];
+    const int* second       = &recurrenceSecond[0];
+    const RealOpenMM* scale = &recurrenceScale[0];
+    for (int t = 1; t < numCoefficients; t++) {
+        RealOpenMM sum1 = delta[0]*a[first[3*t]] + delta[1]*a[first[3*t+1]] + delta[2]*a[first[3*t+2]];
+        RealOpenMM sum2 = a[second[3*t]] + a[second[3*t+1]] + a[second[3*t+2]];
+        a[t] = (scale[2*t]*sum1 - scale[2*t+1]*sum2)*ir2;
+    }
+}
+
+/**
+ * Add the potential, field and field gradient at delta = target - source of a point charge and dipole,
+ * given ri = 1/r, rr3 = 1/r^3, rr5 = 3/r^5 and rr7 = 15/r^7.
+ */
+static void addPointSourceField(const RealVec& delta, RealOpenMM ri, RealOpenMM rr3, RealOpenMM rr5, RealOpenMM rr7,
+                                RealOpenMM charge, const RealVec& dipole,
+                                RealOpenMM* potential, RealVec& field, RealVec* gradient) {
+    RealOpenMM dipoleDelta = dipole.dot(delta);
+    if (potential)
+        *potential += charge*ri + dipoleDelta*rr3;
+    RealOpenMM radial = charge*rr3 + dipoleDelta*rr5;
+    field += delta*radial - dipole*rr3;
+    if (gradient) {
+        RealOpenMM outer = -charge*rr5 - dipoleDelta*rr7;
+        for (int c = 0; c < 3; c++) {
+            for (int d = 0; d < 3; d++)
+                gradient[c][d] += outer*delta[c]*delta[d] + rr5*(dipole[c]*delta[d] + delta[c]*dipole[d]);
+            gradient[c][c] += radial;
+        }
+    }
+}
+
+void ReferenceMBPolTreecode::addFarField(const vector<RealOpenMM>* charges, const vector<RealVec>* dipoles,
+                                         vector<RealOpenMM>* potential, vector<RealVec>& field,
+                                         vector<RealVec>* gradient) const {
+    vector<FieldSet> sets(1);
+    sets[0].charges   = charges;
+    sets[0].dipoles   = dipoles;
+    sets[0].potential = potential;
+    sets[0].field     = &field;
+    sets[0].gradient  = gradient;
+    addFarFields(sets);
+}
+
+void ReferenceMBPolTreecode::addFarFields(const vector<FieldSet>& sets) const {
+    int numSets = sets.size();
+    vector<vector<RealOpenMM> > moments(numSets);
+    bool anyGradient = false;
+    for (int ss = 0; ss < numSets; ss++) {
+        computeMoments(sets[ss].charges, sets[ss].dipoles, moments[ss]);
+        anyGradient = anyGradient || sets[ss].gradient != NULL;
+    }
+
+    // phi = sum_k a_k m_k, and since d a_k/dx_i = -(k_i+1) a_{k+e_i}
+    // E_i = sum_k (k_i+1) a_{k+e_i} m_k, dE_i/dx_j = -sum_k (k_i+1) ((k+e_i)_j+1) a_{k+e_i+e_j} m_k
+
+    int numTerms        = numTermsOfOrder[expansionOrder];
+    int numCoefficients = numTermsOfOrder[expansionOrder + (anyGradient ? 2 : 1)];
+    vector<RealOpenMM> a(termPowers.size()/3 + 1);
+    vector<RealVec> deltas;
+    vector<RealOpenMM> factors;
+    RealVec zero(0.0, 0.0, 0.0);
+    for (unsigned int group = 0; group < groups.size(); group++) {
+        const vector<int>& sites = groups[group];
+        for (unsigned int jj = 0; jj < sites.size(); jj++) {
+            int site = sites[jj];
+            const RealVec& position = positions[site];
+
+            for (int ii = expansionStart[group]; ii < expansionStart[group+1]; ii++) {
+                int nodeIndex = expansionNodes[ii];
+                computeTaylorCoefficients(position - nodes[nodeIndex].center, numCoefficients, a);
+                for (int ss = 0; ss < numSets; ss++) {
+                    const FieldSet& set      = sets[ss];
+                    const RealOpenMM* moment = &moments[ss][nodeIndex*numTerms];
+                    RealOpenMM phi = 0.0;
+                    RealVec e(0.0, 0.0, 0.0);
+                    RealOpenMM g[3][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+                    for (int t = 0; t < numTerms; t++) {
+                        RealOpenMM m = moment[t];
+                        if (m == 0.0)
+                            continue;
+                        phi += a[t]*m;
+                        for (int i = 0; i < 3; i++) {
+                            int raised = termRaised[3*t+i];
+                            RealOpenMM factor = (termPowers[3*t+i]+1)*m;
+                            e[i] += factor*a[raised];
+                            if (set.gradient) {
+                                for (int j = 0; j < 3; j++)
+                                    g[i][j] -= factor*(termPowers[3*raised+j]+1)*a[termRaised[3*raised+j]];
+                            }
+                        }
+                    }
+                    if (set.potential)
+                        (*set.potential)[site] += phi;
+                    (*set.field)[site] += e;
+                    if (set.gradient) {
+                        for (int i = 0; i < 3; i++)
+                            (*set.gradient)[3*site+i] += RealVec(g[i][0], g[i][1], g[i][2]);
+                    }
+                }
+            }
+            for (int ii = directStart[group]; ii < directStart[group+1]; ii++) {
+                const vector<int>& sources = groups[directGroups[ii]];
+                int numSources = sources.size();
+                deltas.resize(numSources);
+                factors.resize(4*numSources);
+                for (int kk = 0; kk < numSources; kk++) {
+                    RealVec delta    = position - positions[sources[kk]];
+                    RealOpenMM ri    = 1.0/sqrt(delta.dot(delta));
+                    RealOpenMM ri2   = ri*ri;
+                    deltas[kk]       = delta;
+                    factors[4*kk]    = ri;
+                    factors[4*kk+1]  = ri*ri2;
+                    factors[4*kk+2]  = 3.0*factors[4*kk+1]*ri2;
+                    factors[4*kk+3]  = 5.0*factors[4*kk+2]*ri2;
+                }
+                for (int ss = 0; ss < numSets; ss++) {
+                    const FieldSet& set = sets[ss];
+                    RealVec& siteField  = (*set.field)[site];
+                    if (set.potential == NULL && set.gradient == NULL) {
+
+                        // field only, as needed in every induced dipole iteration
+
+                        for (int kk = 0; kk < numSources; kk++) {
+                            RealOpenMM radial = set.charges ? (*set.charges)[sources[kk]]*factors[4*kk+1] : 0.0;
+                            if (set.dipoles) {
+                                const RealVec& dipole = (*set.dipoles)[sources[kk]];
+                                radial    += dipole.dot(deltas[kk])*factors[4*kk+2];
+                                siteField -= dipole*factors[4*kk+1];
+                            }
+                            siteField += deltas[kk]*radial;
+                        }
+                    } else {
+                        for (int kk = 0; kk < numSources; kk++) {
+                            int source = sources[kk];
+                            addPointSourceField(deltas[kk], factors[4*kk], factors[4*kk+1], factors[4*kk+2], factors[4*kk+3],
+                                                set.charges ? (*set.charges)[source] : 0.0,
+                                                set.dipoles ? (*set.dipoles)[source] : zero,
+                                                set.potential ? &(*set.potential)[site] : NULL, siteField,
+                                                set.gradient ? &(*set.gradient)[3*site] : NULL);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace MBPolPlugin
@@ -0,0 +1,363 @@
+#include "ReferenceMasterCellList.h"
+#include "ReferenceMBPolCheckpoint.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+// one master list per context, shared by the kernels that acquired it
+
+static map<const void*, ReferenceMasterCellList*> masterCellLists;
+static mutex masterCellListsLock;
+
+ReferenceMasterCellList::ReferenceMasterCellList() : maxCutoff(0.0), skin(0.1), usePeriodic(false),
+        registered(false), valid(false), hasLoadedBuild(false), loadedListCutoff(0.0), loadedUsePeriodic(false), numBuilds(0), numUpdates(0), numOwners(0) {
+}
+
+ReferenceMasterCellList* ReferenceMasterCellList::acquire(const void* owner) {
+    lock_guard<mutex> guard(masterCellListsLock);
+    map<const void*, ReferenceMasterCellList*>::iterator entry = masterCellLists.find(owner);
+    if (entry == masterCellLists.end())
+        entry = masterCellLists.insert(make_pair(owner, new ReferenceMasterCellList())).first;
+    entry->second->numOwners++;
+    return entry->second;
+}
+
+void ReferenceMasterCellList::release(const void* owner) {
+    lock_guard<mutex> guard(masterCellListsLock);
+    map<const void*, ReferenceMasterCellList*>::iterator entry = masterCellLists.find(owner);
+    if (entry == masterCellLists.end())
+        return;
+    if (--entry->second->numOwners == 0) {
+        delete entry->second;
+        masterCellLists.erase(entry);
+    }
+}
+
+void ReferenceMasterCellList::setSkin(double skin) {
+    if (skin < 0.0)
+        throw OpenMMException("ReferenceMasterCellList: the skin must not be negative");
+    lock_guard<mutex> guard(lock);
+    this->skin = skin;
+    valid = false;
+}
+
+double ReferenceMasterCellList::getSkin() const {
+    return skin;
+}
+
+bool ReferenceMasterCellList::addMolecules(const vector<int>& atoms, double cutoff, bool usePeriodic) {
+    lock_guard<mutex> guard(lock);
+    if (registered && usePeriodic != this->usePeriodic)
+        return false;
+    this->usePeriodic = usePeriodic;
+    registered = true;
+    if (cutoff > maxCutoff) {
+        maxCutoff = cutoff;
+        valid = false;
+    }
+    vector<int> merged;
+    merged.reserve(referenceAtoms.size() + atoms.size());
+    vector<int> sortedAtoms(atoms);
+    sort(sortedAtoms.begin(), sortedAtoms.end());
+    set_union(referenceAtoms.begin(), referenceAtoms.end(), sortedAtoms.begin(), sortedAtoms.end(), back_inserter(merged));
+    merged.erase(unique(merged.begin(), merged.end()), merged.end());
+    if (merged != referenceAtoms) {
+        referenceAtoms.swap(merged);
+        valid = false;
+    }
+    return true;
+}
+
+double ReferenceMasterCellList::getListCutoff() const {
+    return maxCutoff + skin;
+}
+
+int ReferenceMasterCellList::getNumBuilds() const {
+    return numBuilds;
+}
+
+int ReferenceMasterCellList::getNumUpdates() const {
+    return numUpdates;
+}
+
+void ReferenceMasterCellList::saveBuild(ostream& stream) const {
+    lock_guard<mutex> guard(lock);
+    ReferenceMBPolCheckpoint::writeHeader(stream, "ReferenceMasterCellList", 1);
+    ReferenceMBPolCheckpoint::writeInt(stream, valid);
+    if (!valid)
+        return;
+    ReferenceMBPolCheckpoint::writeInts(stream, referenceAtoms);
+    ReferenceMBPolCheckpoint::writeDouble(stream, getListCutoff());
+    ReferenceMBPolCheckpoint::writeInt(stream, usePeriodic);
+    ReferenceMBPolCheckpoint::writeVec(stream, boxSize);
+    ReferenceMBPolCheckpoint::writeVecs(stream, positionsAtBuild);
+    vector<int> pairs;
+    pairs.reserve(2*masterPairs.size());
+    for (unsigned int ii = 0; ii < masterPairs.size(); ii++) {
+        pairs.push_back(masterPairs[ii].first);
+        pairs.push_back(masterPairs[ii].second);
+    }
+    ReferenceMBPolCheckpoint::writeInts(stream, pairs);
+}
+
+void ReferenceMasterCellList::loadBuild(istream& stream) {
+    ReferenceMBPolCheckpoint::checkHeader(stream, "ReferenceMasterCellList", 1);
+    if (!ReferenceMBPolCheckpoint::readInt(stream))
+        return;
+    vector<int> atoms;
+    ReferenceMBPolCheckpoint::readInts(stream, atoms);
+    double listCutoff = ReferenceMBPolCheckpoint::readDouble(stream);
+    bool periodic = ReferenceMBPolCheckpoint::readInt(stream) != 0;
+    RealVec box = ReferenceMBPolCheckpoint::readVec(stream);
+    vector<RealVec> positions;
+    ReferenceMBPolCheckpoint::readVecs(stream, positions);
+    vector<int> pairs;
+    ReferenceMBPolCheckpoint::readInts(stream, pairs);
+    bool sorted = (atoms.empty() || atoms[0] >= 0) && adjacent_find(atoms.begin(), atoms.end(), greater_equal<int>()) == atoms.end();
+    if (!sorted || positions.size() != atoms.size() || pairs.size() % 2 != 0)
+        throw OpenMMException("ReferenceMasterCellList: the checkpoint is corrupt");
+    for (unsigned int ii = 0; ii < pairs.size(); ii++)
+        if (!binary_search(atoms.begin(), atoms.end(), pairs[ii]))
+            throw OpenMMException("ReferenceMasterCellList: the checkpoint is corrupt");
+
+    lock_guard<mutex> guard(lock);
+    loadedReferenceAtoms.swap(atoms);
+    loadedListCutoff  = listCutoff;
+    loadedUsePeriodic = periodic;
+    loadedBoxSize     = box;
+    loadedPositionsAtBuild.swap(positions);
+    loadedPairs.resize(pairs.size()/2);
+    for (unsigned int ii = 0; ii < loadedPairs.size(); ii++)
+        loadedPairs[ii] = AtomPair(pairs[2*ii], pairs[2*ii+1]);
+    hasLoadedBuild = true;
+}
+
+double ReferenceMasterCellList::distanceSquared(const RealVec& a, const RealVec& b) const {
+    double r2 = 0.0;
+    for (int d = 0; d < 3; d++) {
+        double delta = b[d] - a[d];
+        if (usePeriodic)
+            delta -= boxSize[d]*floor(delta/boxSize[d] + 0.5);
+        r2 += delta*delta;
+    }
+    return r2;
+}
+
+bool ReferenceMasterCellList::update(const vector<RealVec>& allPositions, const RealVec& periodicBoxSize) {
+    lock_guard<mutex> guard(lock);
+    numUpdates++;
+    if (hasLoadedBuild) {
+
+        // the kernels register on their first evaluation, so the loaded build is taken over as soon as
+        // it covers what is registered; kernels registering later then find their molecules and cutoff in it
+
+        hasLoadedBuild = false;
+        if (registered && loadedUsePeriodic == usePeriodic && getListCutoff() <= loadedListCutoff && skin <= loadedListCutoff &&
+                (loadedReferenceAtoms.empty() || loadedReferenceAtoms.back() < (int) allPositions.size()) &&
+                includes(loadedReferenceAtoms.begin(), loadedReferenceAtoms.end(), referenceAtoms.begin(), referenceAtoms.end())) {
+            referenceAtoms.swap(loadedReferenceAtoms);
+            maxCutoff = loadedListCutoff - skin;
+            boxSize   = loadedBoxSize;
+            positionsAtBuild.swap(loadedPositionsAtBuild);
+            masterPairs.swap(loadedPairs);
+            valid = true;
+        }
+        loadedReferenceAtoms.clear();
+        loadedPositionsAtBuild.clear();
+        loadedPairs.clear();
+    }
+    if (valid && usePeriodic && (periodicBoxSize[0] != boxSize[0] || periodicBoxSize[1] != boxSize[1] || periodicBoxSize[2] != boxSize[2]))
+        valid = false;
+    if (valid) {
+        double maxMove2 = 0.25*skin*skin;
+        for (unsigned int ii = 0; ii < referenceAtoms.size(); ii++) {
+            if (distanceSquared(positionsAtBuild[ii], allPositions[referenceAtoms[ii]]) > maxMove2) {
+                valid = false;
+                break;
+            }
+        }
+    }
+    if (valid)
+        return false;
+    boxSize = periodicBoxSize;
+    build(allPositions);
+    return true;
+}
+
+void ReferenceMasterCellList::build(const vector<RealVec>& allPositions) {
+
+    const int numAtoms = referenceAtoms.size();
+    const double listCutoff = getListCutoff();
+    const double listCutoff2 = listCutoff*listCutoff;
+
+    positionsAtBuild.resize(numAtoms);
+    for (int ii = 0; ii < numAtoms; ii++)
+        positionsAtBuild[ii] = allPositions[referenceAtoms[ii]];
+    masterPairs.clear();
+    valid = true;
+    numBuilds++;
+    if (numAtoms < 2)
+        return;
+
+    // cells at least listCutoff wide: the box for periodic systems, the bounding box otherwise
+
+    RealVec origin, cellSize;
+    int numCells[3];
+    if (usePeriodic) {
+        for (int d = 0; d < 3; d++) {
+            origin[d] = 0.0;
+            numCells[d] = max(1, (int) floor(boxSize[d]/listCutoff));
+            cellSize[d] = boxSize[d]/numCells[d];
+        }
+    } else {
+        RealVec minPos = positionsAtBuild[0];
+        RealVec maxPos = positionsAtBuild[0];
+        for (int ii = 1; ii < numAtoms; ii++) {
+            for (int d = 0; d < 3; d++) {
+                minPos[d] = min(minPos[d], positionsAtBuild[ii][d]);
+                maxPos[d] = max(maxPos[d], positionsAtBuild[ii][d]);
+            }
+        }
+        for (int d = 0; d < 3; d++) {
+            origin[d] = minPos[d];
+            double extent = maxPos[d] - minPos[d];
+
+            // a sparse cluster must not allocate more cells than it has atoms
+
+            numCells[d] = min(max(1, (int) floor(extent/listCutoff)), numAtoms);
+            cellSize[d] = max(extent/numCells[d], listCutoff);
+        }
+    }
+
+    // counting sort of the atoms by cell
+
+    const int totalCells = numCells[0]*numCells[1]*numCells[2];
+    vector<int> cellOfAtom(numAtoms);
+    vector<int> cellStart(totalCells + 1, 0);
+    for (int ii = 0; ii < numAtoms; ii++) {
+        int cell[3];
+        for (int d = 0; d < 3; d++) {
+            double x = positionsAtBuild[ii][d] - origin[d];
+            if (usePeriodic)
+                x -= boxSize[d]*floor(x/boxSize[d]);
+            cell[d] = min(max((int) floor(x/cellSize[d]), 0), numCells[d] - 1);
+        }
+        cellOfAtom[ii] = (cell[0]*numCells[1] + cell[1])*numCells[2] + cell[2];
+        cellStart[cellOfAtom[ii] + 1]++;
+    }
+    for (int cell = 0; cell < totalCells; cell++)
+        cellStart[cell + 1] += cellStart[cell];
+    vector<int> cellAtoms(numAtoms);
+    vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int ii = 0; ii < numAtoms; ii++)
+        cellAtoms[fill[cellOfAtom[ii]]++] = ii;
+
+    // each unordered pair of atoms is visited once: from both cells, but only with ii < jj
+
+    vector<int> neighborCells;
+    for (int cx = 0; cx < numCells[0]; cx++) {
+        for (int cy = 0; cy < numCells[1]; cy++) {
+            for (int cz = 0; cz < numCells[2]; cz++) {
+                int cell = (cx*numCells[1] + cy)*numCells[2] + cz;
+                if (cellStart[cell] == cellStart[cell + 1])
+                    continue;
+                neighborCells.clear();
+                for (int dx = -1; dx <= 1; dx++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dz = -1; dz <= 1; dz++) {
+                            int n[3] = {cx + dx, cy + dy, cz + dz};
+                            bool inside = true;
+                            for (int d = 0; d < 3; d++) {
+                                if (usePeriodic)
+                                    n[d] = (n[d] + numCells[d]) % numCells[d];
+                                else if (n[d] < 0 || n[d] >= numCells[d])
+                                    inside = false;
+                            }
+                            if (inside)
+                                neighborCells.push_back((n[0]*numCells[1] + n[1])*numCells[2] + n[2]);
+                        }
+                    }
+                }
+
+                // with fewer than three cells along an axis the periodic neighbors repeat
+
+                sort(neighborCells.begin(), neighborCells.end());
+                neighborCells.erase(unique(neighborCells.begin(), neighborCells.end()), neighborCells.end());
+                for (int ii = cellStart[cell]; ii < cellStart[cell + 1]; ii++) {
+                    int atomI = cellAtoms[ii];
+                    for (unsigned int nn = 0; nn < neighborCells.size(); nn++) {
+                        int neighbor = neighborCells[nn];
+                        for (int jj = cellStart[neighbor]; jj < cellStart[neighbor + 1]; jj++) {
+                            int atomJ = cellAtoms[jj];
+                            if (atomJ <= atomI)
+                                continue;
+                            if (distanceSquared(positionsAtBuild[atomI], positionsAtBuild[atomJ]) <= listCutoff2)
+                                masterPairs.push_back(AtomPair(referenceAtoms[atomI], referenceAtoms[atomJ]));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ReferenceMasterCellList::getPairs(NeighborList& pairs, const vector<int>& moleculeOfAtom,
+                                       const vector<RealVec>& allPositions, double cutoff) const {
+    if (cutoff > maxCutoff)
+        throw OpenMMException("ReferenceMasterCellList: cutoff exceeds the registered cutoff");
+    lock_guard<mutex> guard(lock);
+    pairs.clear();
+    const double cutoff2 = cutoff*cutoff;
+    for (unsigned int ii = 0; ii < masterPairs.size(); ii++) {
+        int moleculeI = moleculeOfAtom[masterPairs[ii].first];
+        int moleculeJ = moleculeOfAtom[masterPairs[ii].second];
+        if (moleculeI < 0 || moleculeJ < 0)
+            continue;
+        if (distanceSquared(allPositions[masterPairs[ii].first], allPositions[masterPairs[ii].second]) <= cutoff2)
+            pairs.push_back(AtomPair(moleculeI, moleculeJ));
+    }
+}
+
+void ReferenceMasterCellList::getTriplets(ThreeNeighborList& triplets, const vector<int>& moleculeOfAtom,
+                                          const vector<RealVec>& allPositions, double cutoff) const {
+
+    NeighborList pairs;
+    getPairs(pairs, moleculeOfAtom, allPositions, cutoff);
+
+    // lower[i] lists the molecules j < i within cutoff, as nearbyAtoms in computeThreeNeighborListVoxelHash()
+
+    int numMolecules = 0;
+    for (unsigned int ii = 0; ii < pairs.size(); ii++)
+        numMolecules = max(numMolecules, (int) max(pairs[ii].first, pairs[ii].second) + 1);
+    vector<vector<AtomIndex> > lower(numMolecules);
+    for (unsigned int ii = 0; ii < pairs.size(); ii++) {
+        AtomIndex a = pairs[ii].first;
+        AtomIndex b = pairs[ii].second;
+        if (a > b)
+            lower[a].push_back(b);
+        else
+            lower[b].push_back(a);
+    }
+
+    triplets.clear();
+    for (int i = 0; i < numMolecules; i++) {
+        for (unsigned int jj = 0; jj < lower[i].size(); jj++) {
+            AtomIndex j = lower[i][jj];
+            for (unsigned int kk = 0; kk < lower[j].size(); kk++) {
+                AtomTriplet triplet;
+                triplet.first = i;
+                triplet.second = j;
+                triplet.third = lower[j][kk];
+                triplets.push_back(triplet);
+            }
+        }
+    }
+}
+
+} // namespace MBPolPlugin
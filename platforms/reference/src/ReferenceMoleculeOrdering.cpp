@@ -0,0 +1,172 @@
+#include "ReferenceMoleculeOrdering.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace MBPolPlugin {
+
+// spread the lower 10 bits of v so that there are two zero bits between each of them
+static unsigned int spreadBits(unsigned int v) {
+    v &= 0x000003ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v <<  8)) & 0x0300f00f;
+    v = (v | (v <<  4)) & 0x030c30c3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+
+void computeMortonOrder(vector<int>& order, const vector<RealVec>& moleculePositions,
+                        const RealVec& periodicBoxSize, bool usePeriodic) {
+
+    const int numMolecules = moleculePositions.size();
+    const unsigned int cells = 1024;
+
+    // map positions to [0,1) along each axis: the box for periodic systems, the bounding box otherwise
+
+    RealVec origin, extent;
+    if (usePeriodic) {
+        origin = RealVec(0.0, 0.0, 0.0);
+        extent = periodicBoxSize;
+    } else if (numMolecules > 0) {
+        RealVec minPos = moleculePositions[0];
+        RealVec maxPos = moleculePositions[0];
+        for (int ii = 1; ii < numMolecules; ii++) {
+            for (int d = 0; d < 3; d++) {
+                minPos[d] = min(minPos[d], moleculePositions[ii][d]);
+                maxPos[d] = max(maxPos[d], moleculePositions[ii][d]);
+            }
+        }
+        origin = minPos;
+        extent = (maxPos - minPos)*1.000001;
+    }
+
+    vector<pair<unsigned int, int> > keys(numMolecules);
+    for (int ii = 0; ii < numMolecules; ii++) {
+        unsigned int cell[3];
+        for (int d = 0; d < 3; d++) {
+            double s = extent[d] > 0.0 ? (moleculePositions[ii][d] - origin[d])/extent[d] : 0.0;
+            if (usePeriodic)
+                s -= floor(s);
+            int c = static_cast<int>(s*cells);
+            cell[d] = static_cast<unsigned int>(min(max(c, 0), static_cast<int>(cells) - 1));
+        }
+        keys[ii] = make_pair(spreadBits(cell[0]) | (spreadBits(cell[1]) << 1) | (spreadBits(cell[2]) << 2), ii);
+    }
+    sort(keys.begin(), keys.end());
+
+    order.resize(numMolecules);
+    for (int ii = 0; ii < numMolecules; ii++)
+        order[ii] = keys[ii].second;
+}
+
+int ReferenceMoleculeOrdering::defaultReorderInterval = 100;
+
+ReferenceMoleculeOrdering::ReferenceMoleculeOrdering() : reorderInterval(defaultReorderInterval), callsSinceReorder(0), numReorders(0) {
+}
+
+void ReferenceMoleculeOrdering::setReorderInterval(int interval) {
+    reorderInterval = interval;
+    invalidate();
+}
+
+int ReferenceMoleculeOrdering::getReorderInterval() const {
+    return reorderInterval;
+}
+
+void ReferenceMoleculeOrdering::setDefaultReorderInterval(int interval) {
+    defaultReorderInterval = interval;
+}
+
+int ReferenceMoleculeOrdering::getDefaultReorderInterval() {
+    return defaultReorderInterval;
+}
+
+void ReferenceMoleculeOrdering::invalidate() {
+    order.clear();
+}
+
+void ReferenceMoleculeOrdering::gather(const vector<RealVec>& allPositions, const vector<vector<int> >& allParticleIndices,
+                                       const RealVec& periodicBoxSize, bool usePeriodic) {
+
+    const int numMolecules = allParticleIndices.size();
+
+    if (static_cast<int>(order.size()) != numMolecules || (reorderInterval > 0 && callsSinceReorder >= reorderInterval)) {
+        if (reorderInterval > 0) {
+            vector<RealVec> moleculePositions(numMolecules);
+            for (int ii = 0; ii < numMolecules; ii++)
+                moleculePositions[ii] = allPositions[allParticleIndices[ii][0]];
+            computeMortonOrder(order, moleculePositions, periodicBoxSize, usePeriodic);
+            numReorders++;
+        } else {
+            order.resize(numMolecules);
+            for (int ii = 0; ii < numMolecules; ii++)
+                order[ii] = ii;
+        }
+        callsSinceReorder = 0;
+
+        inverseOrder.resize(numMolecules);
+        for (int ii = 0; ii < numMolecules; ii++)
+            inverseOrder[order[ii]] = ii;
+
+        // local layout: the sites of each molecule are contiguous, molecules follow the curve
+
+        atomIndices.clear();
+        localParticleIndices.resize(numMolecules);
+        for (int ii = 0; ii < numMolecules; ii++) {
+            const vector<int>& sites = allParticleIndices[order[ii]];
+            localParticleIndices[ii].resize(sites.size());
+            for (unsigned int jj = 0; jj < sites.size(); jj++) {
+                localParticleIndices[ii][jj] = atomIndices.size();
+                atomIndices.push_back(sites[jj]);
+            }
+        }
+    }
+    callsSinceReorder++;
+
+    positions.resize(atomIndices.size());
+    for (unsigned int ii = 0; ii < atomIndices.size(); ii++)
+        positions[ii] = allPositions[atomIndices[ii]];
+
+    referencePositions.resize(numMolecules);
+    for (int ii = 0; ii < numMolecules; ii++)
+        referencePositions[ii] = positions[localParticleIndices[ii][0]];
+
+    forces.assign(atomIndices.size(), RealVec(0.0, 0.0, 0.0));
+}
+
+const vector<RealVec>& ReferenceMoleculeOrdering::getPositions() const {
+    return positions;
+}
+
+const vector<RealVec>& ReferenceMoleculeOrdering::getReferencePositions() const {
+    return referencePositions;
+}
+
+const vector<vector<int> >& ReferenceMoleculeOrdering::getLocalParticleIndices() const {
+    return localParticleIndices;
+}
+
+vector<RealVec>& ReferenceMoleculeOrdering::getForces() {
+    return forces;
+}
+
+const vector<int>& ReferenceMoleculeOrdering::getOrder() const {
+    return order;
+}
+
+const vector<int>& ReferenceMoleculeOrdering::getInverseOrder() const {
+    return inverseOrder;
+}
+
+void ReferenceMoleculeOrdering::scatterForces(vector<RealVec>& allForces) const {
+    for (unsigned int ii = 0; ii < atomIndices.size(); ii++)
+        allForces[atomIndices[ii]] += forces[ii];
+}
+
+int ReferenceMoleculeOrdering::getNumReorders() const {
+    return numReorders;
+}
+
+} // namespace MBPolPlugin
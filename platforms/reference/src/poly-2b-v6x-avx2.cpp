@@ -0,0 +1,12 @@
+//
+// poly-2b-v6x.cpp built for avx2; compile flags are set in
+// platforms/reference/CMakeLists.txt, selection happens in poly-dispatch.cpp
+//
+
+#ifdef MBPOL_POLY_ISA_DISPATCH
+
+#define poly_2b_v6x_eval poly_2b_v6x_eval_avx2
+#include "poly-2b-v6x.cpp"
+#undef poly_2b_v6x_eval
+
+#endif
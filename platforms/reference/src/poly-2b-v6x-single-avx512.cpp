@@ -0,0 +1,14 @@
+//
+// poly-2b-v6x.cpp built in single precision for avx512; compile flags are set in
+// platforms/reference/CMakeLists.txt, selection happens in poly-dispatch.cpp
+//
+
+#ifdef MBPOL_POLY_ISA_DISPATCH
+
+#define MBPOL_POLY_REAL float
+#define poly_2b_v6x_eval poly_2b_v6x_eval_single_avx512
+#include "poly-2b-v6x.cpp"
+#undef poly_2b_v6x_eval
+#undef MBPOL_POLY_REAL
+
+#endif
@@ -0,0 +1,10 @@
+//
+// poly-2b-v6x.cpp built in single precision for the mixed precision mode,
+// selection happens in poly-dispatch.cpp
+//
+
+#define MBPOL_POLY_REAL float
+#define poly_2b_v6x_eval poly_2b_v6x_eval_single
+#include "poly-2b-v6x.cpp"
+#undef poly_2b_v6x_eval
+#undef MBPOL_POLY_REAL
@@ -1,6583 +1,6583 @@
 #include "poly-2b-v6x.h"
 
-double poly_2b_v6x_eval(const double a[1153],
-                         const double x[31],
-                               double g[31])
+MBPOL_POLY_REAL poly_2b_v6x_eval(const MBPOL_POLY_REAL a[1153],
+                         const MBPOL_POLY_REAL x[31],
+                               MBPOL_POLY_REAL g[31])
 {
-    double df[4138];
+    MBPOL_POLY_REAL df[4138];
 
-    const double t1 = a[3];
-    const double t2 = a[57];
-    const double t3 = a[474];
-    const double t5 = x[30];
-    const double t4 = t3*t5;
-    const double t6 = (t2+t4)*t5;
-    const double t7 = a[465];
-    const double t8 = t7*t5;
-    const double t20 = x[29];
-    const double t9 = t3*t20;
-    const double t12 = a[48];
-    const double t13 = a[454];
-    const double t14 = t13*t20;
-    const double t15 = a[226];
-    const double t16 = t15*t5;
-    const double t17 = a[314];
-    const double t26 = x[28];
-    const double t18 = t17*t26;
-    const double t21 = a[236];
-    const double t23 = t13*t5;
-    const double t24 = t15*t20;
-    const double t37 = x[27];
-    const double t25 = t17*t37;
-    const double t28 = a[466];
-    const double t29 = t28*t5;
-    const double t30 = a[66];
-    const double t31 = t28*t20;
-    const double t32 = t28*t26;
-    const double t33 = t28*t37;
-    const double t34 = a[487];
-    const double t50 = x[26];
-    const double t35 = t34*t50;
-    const double t38 = a[449];
-    const double t39 = t38*t5;
-    const double t40 = a[34];
-    const double t41 = t38*t20;
-    const double t42 = a[311];
-    const double t43 = t42*t26;
-    const double t44 = t42*t37;
-    const double t45 = a[117];
-    const double t51 = a[36];
-    const double t52 = a[210];
-    const double t53 = t52*t5;
-    const double t54 = a[201];
-    const double t55 = t54*t20;
-    const double t56 = t52*t26;
-    const double t57 = t54*t37;
-    const double t58 = a[250];
-    const double t59 = t58*t50;
-    const double t67 = x[25];
-    const double t60 = t58*t67;
-    const double t61 = a[333];
-    const double t72 = x[24];
-    const double t62 = t61*t72;
-    const double t63 = a[189];
-    const double t73 = x[23];
-    const double t64 = t63*t73;
-    const double t65 = a[203];
-    const double t77 = x[22];
-    const double t10 = t65*t77;
-    const double t68 = (t51+t53+t55+t56+t57+t59+t60+t62+t64+t10)*t77;
-    const double t69 = a[5];
-    const double t70 = a[17];
-    const double t71 = a[105];
-    const double t19 = t71*t5;
-    const double t74 = (t70+t19)*t5;
-    const double t75 = a[458];
-    const double t76 = t75*t5;
-    const double t22 = t71*t20;
-    const double t79 = (t70+t76+t22)*t20;
-    const double t80 = a[367];
-    const double t27 = t80*t20;
-    const double t36 = t71*t26;
-    const double t84 = (t27+t70+t76+t36)*t26;
-    const double t85 = t52*t20;
-    const double t86 = t54*t26;
-    const double t87 = t61*t50;
-    const double t88 = t63*t67;
-    const double t89 = t58*t72;
-    const double t90 = t58*t73;
-    const double t91 = a[119];
-    const double t92 = t91*t77;
-    const double t93 = a[361];
-    const double t126 = x[21];
-    const double t94 = t93*t126;
-    const double t132 = x[20];
-    const double t95 = t91*t132;
-    const double t136 = x[19];
-    const double t96 = t93*t136;
-    const double t139 = x[18];
-    const double t97 = t65*t139;
-    const double t98 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t92+t94+t95+t96+t97;
-    const double t46 = t80*t5;
-    const double t47 = t75*t20;
-    const double t48 = t75*t26;
-    const double t49 = t71*t37;
-    const double t105 = (t70+t46+t47+t48+t49)*t37;
-    const double t106 = a[327];
-    const double t107 = t106*t5;
-    const double t108 = t106*t20;
-    const double t109 = a[44];
-    const double t110 = t106*t26;
-    const double t111 = t106*t37;
-    const double t112 = a[197];
-    const double t113 = t112*t50;
-    const double t114 = t112*t67;
-    const double t115 = a[304];
-    const double t116 = t115*t72;
-    const double t117 = t115*t73;
-    const double t118 = a[402];
-    const double t143 = x[9];
-    const double t119 = t118*t143;
-    const double t120 = a[219];
-    const double t121 = t120*t139;
-    const double t145 = x[17];
-    const double t122 = t120*t145;
-    const double t123 = t107+t108+t109+t110+t111+t113+t114+t116+t117+t119+t121+t122;
-    const double t146 = x[16];
-    const double t124 = t120*t146;
-    const double t155 = x[15];
-    const double t125 = t120*t155;
-    const double t66 = a[479];
-    const double t179 = x[14];
-    const double t127 = t66*t179;
-    const double t128 = a[310];
-    const double t212 = x[11];
-    const double t129 = t128*t212;
-    const double t215 = x[10];
-    const double t130 = t128*t215;
-    const double t131 = a[192];
-    const double t133 = a[401];
-    const double t135 = a[244];
-    const double t137 = a[506];
-    const double t141 = a[494];
-    const double t240 = x[7];
-    const double t142 = t141*t240;
-    const double t254 = x[12];
-    const double t275 = x[13];
-    const double t309 = x[8];
-    const double t144 = t124+t125+t127+t129+t130+t131*t126+t133*t254+t135*t275+t137*t132+
+    const MBPOL_POLY_REAL t1 = a[3];
+    const MBPOL_POLY_REAL t2 = a[57];
+    const MBPOL_POLY_REAL t3 = a[474];
+    const MBPOL_POLY_REAL t5 = x[30];
+    const MBPOL_POLY_REAL t4 = t3*t5;
+    const MBPOL_POLY_REAL t6 = (t2+t4)*t5;
+    const MBPOL_POLY_REAL t7 = a[465];
+    const MBPOL_POLY_REAL t8 = t7*t5;
+    const MBPOL_POLY_REAL t20 = x[29];
+    const MBPOL_POLY_REAL t9 = t3*t20;
+    const MBPOL_POLY_REAL t12 = a[48];
+    const MBPOL_POLY_REAL t13 = a[454];
+    const MBPOL_POLY_REAL t14 = t13*t20;
+    const MBPOL_POLY_REAL t15 = a[226];
+    const MBPOL_POLY_REAL t16 = t15*t5;
+    const MBPOL_POLY_REAL t17 = a[314];
+    const MBPOL_POLY_REAL t26 = x[28];
+    const MBPOL_POLY_REAL t18 = t17*t26;
+    const MBPOL_POLY_REAL t21 = a[236];
+    const MBPOL_POLY_REAL t23 = t13*t5;
+    const MBPOL_POLY_REAL t24 = t15*t20;
+    const MBPOL_POLY_REAL t37 = x[27];
+    const MBPOL_POLY_REAL t25 = t17*t37;
+    const MBPOL_POLY_REAL t28 = a[466];
+    const MBPOL_POLY_REAL t29 = t28*t5;
+    const MBPOL_POLY_REAL t30 = a[66];
+    const MBPOL_POLY_REAL t31 = t28*t20;
+    const MBPOL_POLY_REAL t32 = t28*t26;
+    const MBPOL_POLY_REAL t33 = t28*t37;
+    const MBPOL_POLY_REAL t34 = a[487];
+    const MBPOL_POLY_REAL t50 = x[26];
+    const MBPOL_POLY_REAL t35 = t34*t50;
+    const MBPOL_POLY_REAL t38 = a[449];
+    const MBPOL_POLY_REAL t39 = t38*t5;
+    const MBPOL_POLY_REAL t40 = a[34];
+    const MBPOL_POLY_REAL t41 = t38*t20;
+    const MBPOL_POLY_REAL t42 = a[311];
+    const MBPOL_POLY_REAL t43 = t42*t26;
+    const MBPOL_POLY_REAL t44 = t42*t37;
+    const MBPOL_POLY_REAL t45 = a[117];
+    const MBPOL_POLY_REAL t51 = a[36];
+    const MBPOL_POLY_REAL t52 = a[210];
+    const MBPOL_POLY_REAL t53 = t52*t5;
+    const MBPOL_POLY_REAL t54 = a[201];
+    const MBPOL_POLY_REAL t55 = t54*t20;
+    const MBPOL_POLY_REAL t56 = t52*t26;
+    const MBPOL_POLY_REAL t57 = t54*t37;
+    const MBPOL_POLY_REAL t58 = a[250];
+    const MBPOL_POLY_REAL t59 = t58*t50;
+    const MBPOL_POLY_REAL t67 = x[25];
+    const MBPOL_POLY_REAL t60 = t58*t67;
+    const MBPOL_POLY_REAL t61 = a[333];
+    const MBPOL_POLY_REAL t72 = x[24];
+    const MBPOL_POLY_REAL t62 = t61*t72;
+    const MBPOL_POLY_REAL t63 = a[189];
+    const MBPOL_POLY_REAL t73 = x[23];
+    const MBPOL_POLY_REAL t64 = t63*t73;
+    const MBPOL_POLY_REAL t65 = a[203];
+    const MBPOL_POLY_REAL t77 = x[22];
+    const MBPOL_POLY_REAL t10 = t65*t77;
+    const MBPOL_POLY_REAL t68 = (t51+t53+t55+t56+t57+t59+t60+t62+t64+t10)*t77;
+    const MBPOL_POLY_REAL t69 = a[5];
+    const MBPOL_POLY_REAL t70 = a[17];
+    const MBPOL_POLY_REAL t71 = a[105];
+    const MBPOL_POLY_REAL t19 = t71*t5;
+    const MBPOL_POLY_REAL t74 = (t70+t19)*t5;
+    const MBPOL_POLY_REAL t75 = a[458];
+    const MBPOL_POLY_REAL t76 = t75*t5;
+    const MBPOL_POLY_REAL t22 = t71*t20;
+    const MBPOL_POLY_REAL t79 = (t70+t76+t22)*t20;
+    const MBPOL_POLY_REAL t80 = a[367];
+    const MBPOL_POLY_REAL t27 = t80*t20;
+    const MBPOL_POLY_REAL t36 = t71*t26;
+    const MBPOL_POLY_REAL t84 = (t27+t70+t76+t36)*t26;
+    const MBPOL_POLY_REAL t85 = t52*t20;
+    const MBPOL_POLY_REAL t86 = t54*t26;
+    const MBPOL_POLY_REAL t87 = t61*t50;
+    const MBPOL_POLY_REAL t88 = t63*t67;
+    const MBPOL_POLY_REAL t89 = t58*t72;
+    const MBPOL_POLY_REAL t90 = t58*t73;
+    const MBPOL_POLY_REAL t91 = a[119];
+    const MBPOL_POLY_REAL t92 = t91*t77;
+    const MBPOL_POLY_REAL t93 = a[361];
+    const MBPOL_POLY_REAL t126 = x[21];
+    const MBPOL_POLY_REAL t94 = t93*t126;
+    const MBPOL_POLY_REAL t132 = x[20];
+    const MBPOL_POLY_REAL t95 = t91*t132;
+    const MBPOL_POLY_REAL t136 = x[19];
+    const MBPOL_POLY_REAL t96 = t93*t136;
+    const MBPOL_POLY_REAL t139 = x[18];
+    const MBPOL_POLY_REAL t97 = t65*t139;
+    const MBPOL_POLY_REAL t98 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t92+t94+t95+t96+t97;
+    const MBPOL_POLY_REAL t46 = t80*t5;
+    const MBPOL_POLY_REAL t47 = t75*t20;
+    const MBPOL_POLY_REAL t48 = t75*t26;
+    const MBPOL_POLY_REAL t49 = t71*t37;
+    const MBPOL_POLY_REAL t105 = (t70+t46+t47+t48+t49)*t37;
+    const MBPOL_POLY_REAL t106 = a[327];
+    const MBPOL_POLY_REAL t107 = t106*t5;
+    const MBPOL_POLY_REAL t108 = t106*t20;
+    const MBPOL_POLY_REAL t109 = a[44];
+    const MBPOL_POLY_REAL t110 = t106*t26;
+    const MBPOL_POLY_REAL t111 = t106*t37;
+    const MBPOL_POLY_REAL t112 = a[197];
+    const MBPOL_POLY_REAL t113 = t112*t50;
+    const MBPOL_POLY_REAL t114 = t112*t67;
+    const MBPOL_POLY_REAL t115 = a[304];
+    const MBPOL_POLY_REAL t116 = t115*t72;
+    const MBPOL_POLY_REAL t117 = t115*t73;
+    const MBPOL_POLY_REAL t118 = a[402];
+    const MBPOL_POLY_REAL t143 = x[9];
+    const MBPOL_POLY_REAL t119 = t118*t143;
+    const MBPOL_POLY_REAL t120 = a[219];
+    const MBPOL_POLY_REAL t121 = t120*t139;
+    const MBPOL_POLY_REAL t145 = x[17];
+    const MBPOL_POLY_REAL t122 = t120*t145;
+    const MBPOL_POLY_REAL t123 = t107+t108+t109+t110+t111+t113+t114+t116+t117+t119+t121+t122;
+    const MBPOL_POLY_REAL t146 = x[16];
+    const MBPOL_POLY_REAL t124 = t120*t146;
+    const MBPOL_POLY_REAL t155 = x[15];
+    const MBPOL_POLY_REAL t125 = t120*t155;
+    const MBPOL_POLY_REAL t66 = a[479];
+    const MBPOL_POLY_REAL t179 = x[14];
+    const MBPOL_POLY_REAL t127 = t66*t179;
+    const MBPOL_POLY_REAL t128 = a[310];
+    const MBPOL_POLY_REAL t212 = x[11];
+    const MBPOL_POLY_REAL t129 = t128*t212;
+    const MBPOL_POLY_REAL t215 = x[10];
+    const MBPOL_POLY_REAL t130 = t128*t215;
+    const MBPOL_POLY_REAL t131 = a[192];
+    const MBPOL_POLY_REAL t133 = a[401];
+    const MBPOL_POLY_REAL t135 = a[244];
+    const MBPOL_POLY_REAL t137 = a[506];
+    const MBPOL_POLY_REAL t141 = a[494];
+    const MBPOL_POLY_REAL t240 = x[7];
+    const MBPOL_POLY_REAL t142 = t141*t240;
+    const MBPOL_POLY_REAL t254 = x[12];
+    const MBPOL_POLY_REAL t275 = x[13];
+    const MBPOL_POLY_REAL t309 = x[8];
+    const MBPOL_POLY_REAL t144 = t124+t125+t127+t129+t130+t131*t126+t133*t254+t135*t275+t137*t132+
 t131*t136+t118*t309+t142+t137*t77;
-    const double t147 = a[135];
-    const double t148 = t147*t5;
-    const double t149 = a[28];
-    const double t150 = t147*t20;
-    const double t151 = a[187];
-    const double t152 = t151*t26;
-    const double t153 = t151*t37;
-    const double t154 = a[359];
-    const double t83 = t154*t50;
-    const double t157 = (t148+t149+t150+t152+t153+t83)*t50;
-    const double t158 = a[500];
-    const double t159 = t158*t5;
-    const double t160 = a[29];
-    const double t161 = t158*t20;
-    const double t162 = t158*t26;
-    const double t163 = t158*t37;
-    const double t164 = a[364];
-    const double t165 = t164*t50;
-    const double t166 = t164*t67;
-    const double t167 = t164*t72;
-    const double t168 = t164*t73;
-    const double t169 = a[188];
-    const double t170 = t169*t77;
-    const double t171 = t169*t126;
-    const double t172 = t159+t160+t161+t162+t163+t165+t166+t167+t168+t170+t171;
-    const double t173 = t169*t132;
-    const double t174 = t169*t136;
-    const double t175 = t169*t139;
-    const double t176 = t169*t145;
-    const double t177 = t169*t146;
-    const double t178 = t169*t155;
-    const double t100 = a[145];
-    const double t180 = t100*t179;
-    const double t181 = a[281];
-    const double t182 = t181*t275;
-    const double t183 = t181*t254;
-    const double t184 = t181*t212;
-    const double t185 = t181*t215;
-    const double t186 = a[451];
-    const double t187 = t186*t143;
-    const double t188 = t173+t174+t175+t176+t177+t178+t180+t182+t183+t184+t185+t187;
-    const double t191 = a[46];
-    const double t192 = a[344];
-    const double t193 = t192*t5;
-    const double t194 = t192*t20;
-    const double t195 = t192*t26;
-    const double t196 = t192*t37;
-    const double t197 = a[379];
-    const double t198 = t197*t50;
-    const double t199 = t197*t67;
-    const double t200 = t197*t72;
-    const double t201 = t197*t73;
-    const double t202 = a[271];
-    const double t203 = t202*t77;
-    const double t204 = a[217];
-    const double t205 = t204*t126;
-    const double t206 = t202*t132;
-    const double t207 = t204*t136;
-    const double t208 = t202*t139;
-    const double t209 = t204*t145;
-    const double t210 = t202*t146;
-    const double t211 = t204*t155;
-    const double t101 = a[470];
-    const double t213 = t101*t179;
-    const double t214 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t203+t205+t206+t207+
+    const MBPOL_POLY_REAL t147 = a[135];
+    const MBPOL_POLY_REAL t148 = t147*t5;
+    const MBPOL_POLY_REAL t149 = a[28];
+    const MBPOL_POLY_REAL t150 = t147*t20;
+    const MBPOL_POLY_REAL t151 = a[187];
+    const MBPOL_POLY_REAL t152 = t151*t26;
+    const MBPOL_POLY_REAL t153 = t151*t37;
+    const MBPOL_POLY_REAL t154 = a[359];
+    const MBPOL_POLY_REAL t83 = t154*t50;
+    const MBPOL_POLY_REAL t157 = (t148+t149+t150+t152+t153+t83)*t50;
+    const MBPOL_POLY_REAL t158 = a[500];
+    const MBPOL_POLY_REAL t159 = t158*t5;
+    const MBPOL_POLY_REAL t160 = a[29];
+    const MBPOL_POLY_REAL t161 = t158*t20;
+    const MBPOL_POLY_REAL t162 = t158*t26;
+    const MBPOL_POLY_REAL t163 = t158*t37;
+    const MBPOL_POLY_REAL t164 = a[364];
+    const MBPOL_POLY_REAL t165 = t164*t50;
+    const MBPOL_POLY_REAL t166 = t164*t67;
+    const MBPOL_POLY_REAL t167 = t164*t72;
+    const MBPOL_POLY_REAL t168 = t164*t73;
+    const MBPOL_POLY_REAL t169 = a[188];
+    const MBPOL_POLY_REAL t170 = t169*t77;
+    const MBPOL_POLY_REAL t171 = t169*t126;
+    const MBPOL_POLY_REAL t172 = t159+t160+t161+t162+t163+t165+t166+t167+t168+t170+t171;
+    const MBPOL_POLY_REAL t173 = t169*t132;
+    const MBPOL_POLY_REAL t174 = t169*t136;
+    const MBPOL_POLY_REAL t175 = t169*t139;
+    const MBPOL_POLY_REAL t176 = t169*t145;
+    const MBPOL_POLY_REAL t177 = t169*t146;
+    const MBPOL_POLY_REAL t178 = t169*t155;
+    const MBPOL_POLY_REAL t100 = a[145];
+    const MBPOL_POLY_REAL t180 = t100*t179;
+    const MBPOL_POLY_REAL t181 = a[281];
+    const MBPOL_POLY_REAL t182 = t181*t275;
+    const MBPOL_POLY_REAL t183 = t181*t254;
+    const MBPOL_POLY_REAL t184 = t181*t212;
+    const MBPOL_POLY_REAL t185 = t181*t215;
+    const MBPOL_POLY_REAL t186 = a[451];
+    const MBPOL_POLY_REAL t187 = t186*t143;
+    const MBPOL_POLY_REAL t188 = t173+t174+t175+t176+t177+t178+t180+t182+t183+t184+t185+t187;
+    const MBPOL_POLY_REAL t191 = a[46];
+    const MBPOL_POLY_REAL t192 = a[344];
+    const MBPOL_POLY_REAL t193 = t192*t5;
+    const MBPOL_POLY_REAL t194 = t192*t20;
+    const MBPOL_POLY_REAL t195 = t192*t26;
+    const MBPOL_POLY_REAL t196 = t192*t37;
+    const MBPOL_POLY_REAL t197 = a[379];
+    const MBPOL_POLY_REAL t198 = t197*t50;
+    const MBPOL_POLY_REAL t199 = t197*t67;
+    const MBPOL_POLY_REAL t200 = t197*t72;
+    const MBPOL_POLY_REAL t201 = t197*t73;
+    const MBPOL_POLY_REAL t202 = a[271];
+    const MBPOL_POLY_REAL t203 = t202*t77;
+    const MBPOL_POLY_REAL t204 = a[217];
+    const MBPOL_POLY_REAL t205 = t204*t126;
+    const MBPOL_POLY_REAL t206 = t202*t132;
+    const MBPOL_POLY_REAL t207 = t204*t136;
+    const MBPOL_POLY_REAL t208 = t202*t139;
+    const MBPOL_POLY_REAL t209 = t204*t145;
+    const MBPOL_POLY_REAL t210 = t202*t146;
+    const MBPOL_POLY_REAL t211 = t204*t155;
+    const MBPOL_POLY_REAL t101 = a[470];
+    const MBPOL_POLY_REAL t213 = t101*t179;
+    const MBPOL_POLY_REAL t214 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t203+t205+t206+t207+
 t208+t209+t210+t211+t213;
-    const double t216 = a[75];
-    const double t217 = t216*t5;
-    const double t218 = a[22];
-    const double t219 = t216*t20;
-    const double t220 = t216*t26;
-    const double t221 = t216*t37;
-    const double t222 = a[366];
-    const double t223 = t222*t50;
-    const double t224 = t222*t67;
-    const double t225 = a[232];
-    const double t226 = t225*t72;
-    const double t227 = t225*t73;
-    const double t228 = a[386];
-    const double t229 = t228*t77;
-    const double t230 = a[302];
-    const double t231 = t230*t126;
-    const double t232 = t228*t132;
-    const double t233 = t230*t136;
-    const double t234 = a[412];
-    const double t235 = t234*t139;
-    const double t236 = a[376];
-    const double t237 = t236*t145;
-    const double t238 = t234*t146;
-    const double t239 = t236*t155;
-    const double t102 = a[237];
-    const double t241 = t102*t179;
-    const double t242 = a[215];
-    const double t243 = t242*t275;
-    const double t244 = a[371];
-    const double t245 = t244*t254;
-    const double t246 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t229+t231+t232+t233+
+    const MBPOL_POLY_REAL t216 = a[75];
+    const MBPOL_POLY_REAL t217 = t216*t5;
+    const MBPOL_POLY_REAL t218 = a[22];
+    const MBPOL_POLY_REAL t219 = t216*t20;
+    const MBPOL_POLY_REAL t220 = t216*t26;
+    const MBPOL_POLY_REAL t221 = t216*t37;
+    const MBPOL_POLY_REAL t222 = a[366];
+    const MBPOL_POLY_REAL t223 = t222*t50;
+    const MBPOL_POLY_REAL t224 = t222*t67;
+    const MBPOL_POLY_REAL t225 = a[232];
+    const MBPOL_POLY_REAL t226 = t225*t72;
+    const MBPOL_POLY_REAL t227 = t225*t73;
+    const MBPOL_POLY_REAL t228 = a[386];
+    const MBPOL_POLY_REAL t229 = t228*t77;
+    const MBPOL_POLY_REAL t230 = a[302];
+    const MBPOL_POLY_REAL t231 = t230*t126;
+    const MBPOL_POLY_REAL t232 = t228*t132;
+    const MBPOL_POLY_REAL t233 = t230*t136;
+    const MBPOL_POLY_REAL t234 = a[412];
+    const MBPOL_POLY_REAL t235 = t234*t139;
+    const MBPOL_POLY_REAL t236 = a[376];
+    const MBPOL_POLY_REAL t237 = t236*t145;
+    const MBPOL_POLY_REAL t238 = t234*t146;
+    const MBPOL_POLY_REAL t239 = t236*t155;
+    const MBPOL_POLY_REAL t102 = a[237];
+    const MBPOL_POLY_REAL t241 = t102*t179;
+    const MBPOL_POLY_REAL t242 = a[215];
+    const MBPOL_POLY_REAL t243 = t242*t275;
+    const MBPOL_POLY_REAL t244 = a[371];
+    const MBPOL_POLY_REAL t245 = t244*t254;
+    const MBPOL_POLY_REAL t246 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t229+t231+t232+t233+
 t235+t237+t238+t239+t241+t243+t245;
-    const double t248 = t151*t5;
-    const double t249 = t151*t20;
-    const double t250 = t147*t26;
-    const double t251 = t147*t37;
-    const double t252 = a[378];
-    const double t103 = t252*t50;
-    const double t104 = t154*t67;
-    const double t256 = (t149+t248+t249+t250+t251+t103+t104)*t67;
-    const double t134 = t123+t144;
-    const double t138 = t172+t188;
-    const double t257 = t68+t69+t74+t79+t84+t98*t139+t105+t134*t240+t157+t138*t143+t214*t179
+    const MBPOL_POLY_REAL t248 = t151*t5;
+    const MBPOL_POLY_REAL t249 = t151*t20;
+    const MBPOL_POLY_REAL t250 = t147*t26;
+    const MBPOL_POLY_REAL t251 = t147*t37;
+    const MBPOL_POLY_REAL t252 = a[378];
+    const MBPOL_POLY_REAL t103 = t252*t50;
+    const MBPOL_POLY_REAL t104 = t154*t67;
+    const MBPOL_POLY_REAL t256 = (t149+t248+t249+t250+t251+t103+t104)*t67;
+    const MBPOL_POLY_REAL t134 = t123+t144;
+    const MBPOL_POLY_REAL t138 = t172+t188;
+    const MBPOL_POLY_REAL t257 = t68+t69+t74+t79+t84+t98*t139+t105+t134*t240+t157+t138*t143+t214*t179
 +t246*t254+t256;
-    const double t258 = a[108];
-    const double t259 = t258*t5;
-    const double t260 = a[162];
-    const double t261 = t260*t20;
-    const double t262 = a[7];
-    const double t263 = t258*t26;
-    const double t264 = t260*t37;
-    const double t265 = a[303];
-    const double t266 = t265*t50;
-    const double t267 = t265*t67;
-    const double t268 = a[154];
-    const double t269 = t268*t72;
-    const double t270 = a[358];
-    const double t271 = t270*t73;
-    const double t272 = a[206];
-    const double t273 = t272*t77;
-    const double t274 = a[122];
-    const double t276 = t259+t261+t262+t263+t264+t266+t267+t269+t271+t273+t274*t126;
-    const double t277 = t276*t126;
-    const double t278 = t54*t5;
-    const double t279 = t52*t37;
-    const double t280 = t63*t72;
-    const double t281 = t61*t73;
-    const double t282 = a[340];
-    const double t284 = a[290];
-    const double t285 = t284*t126;
-    const double t287 = t51+t85+t278+t86+t279+t59+t60+t280+t281+t282*t77+t285+t65*t132;
-    const double t288 = t287*t132;
-    const double t289 = a[275];
-    const double t290 = t289*t50;
-    const double t291 = t289*t67;
-    const double t156 = t154*t72;
-    const double t294 = (t148+t249+t149+t250+t153+t290+t291+t156)*t72;
-    const double t295 = t258*t20;
-    const double t296 = t260*t26;
-    const double t297 = t268*t50;
-    const double t298 = t270*t67;
-    const double t299 = t265*t72;
-    const double t300 = t265*t73;
-    const double t301 = t93*t77;
-    const double t302 = a[78];
-    const double t303 = t302*t126;
-    const double t304 = t93*t132;
-    const double t305 = t302*t136;
-    const double t306 = t272*t139;
-    const double t307 = t274*t145;
-    const double t308 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t301+t303+t304+t305+
+    const MBPOL_POLY_REAL t258 = a[108];
+    const MBPOL_POLY_REAL t259 = t258*t5;
+    const MBPOL_POLY_REAL t260 = a[162];
+    const MBPOL_POLY_REAL t261 = t260*t20;
+    const MBPOL_POLY_REAL t262 = a[7];
+    const MBPOL_POLY_REAL t263 = t258*t26;
+    const MBPOL_POLY_REAL t264 = t260*t37;
+    const MBPOL_POLY_REAL t265 = a[303];
+    const MBPOL_POLY_REAL t266 = t265*t50;
+    const MBPOL_POLY_REAL t267 = t265*t67;
+    const MBPOL_POLY_REAL t268 = a[154];
+    const MBPOL_POLY_REAL t269 = t268*t72;
+    const MBPOL_POLY_REAL t270 = a[358];
+    const MBPOL_POLY_REAL t271 = t270*t73;
+    const MBPOL_POLY_REAL t272 = a[206];
+    const MBPOL_POLY_REAL t273 = t272*t77;
+    const MBPOL_POLY_REAL t274 = a[122];
+    const MBPOL_POLY_REAL t276 = t259+t261+t262+t263+t264+t266+t267+t269+t271+t273+t274*t126;
+    const MBPOL_POLY_REAL t277 = t276*t126;
+    const MBPOL_POLY_REAL t278 = t54*t5;
+    const MBPOL_POLY_REAL t279 = t52*t37;
+    const MBPOL_POLY_REAL t280 = t63*t72;
+    const MBPOL_POLY_REAL t281 = t61*t73;
+    const MBPOL_POLY_REAL t282 = a[340];
+    const MBPOL_POLY_REAL t284 = a[290];
+    const MBPOL_POLY_REAL t285 = t284*t126;
+    const MBPOL_POLY_REAL t287 = t51+t85+t278+t86+t279+t59+t60+t280+t281+t282*t77+t285+t65*t132;
+    const MBPOL_POLY_REAL t288 = t287*t132;
+    const MBPOL_POLY_REAL t289 = a[275];
+    const MBPOL_POLY_REAL t290 = t289*t50;
+    const MBPOL_POLY_REAL t291 = t289*t67;
+    const MBPOL_POLY_REAL t156 = t154*t72;
+    const MBPOL_POLY_REAL t294 = (t148+t249+t149+t250+t153+t290+t291+t156)*t72;
+    const MBPOL_POLY_REAL t295 = t258*t20;
+    const MBPOL_POLY_REAL t296 = t260*t26;
+    const MBPOL_POLY_REAL t297 = t268*t50;
+    const MBPOL_POLY_REAL t298 = t270*t67;
+    const MBPOL_POLY_REAL t299 = t265*t72;
+    const MBPOL_POLY_REAL t300 = t265*t73;
+    const MBPOL_POLY_REAL t301 = t93*t77;
+    const MBPOL_POLY_REAL t302 = a[78];
+    const MBPOL_POLY_REAL t303 = t302*t126;
+    const MBPOL_POLY_REAL t304 = t93*t132;
+    const MBPOL_POLY_REAL t305 = t302*t136;
+    const MBPOL_POLY_REAL t306 = t272*t139;
+    const MBPOL_POLY_REAL t307 = t274*t145;
+    const MBPOL_POLY_REAL t308 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t301+t303+t304+t305+
 t306+t307;
-    const double t189 = t252*t72;
-    const double t190 = t154*t73;
-    const double t313 = (t150+t248+t149+t152+t251+t290+t291+t189+t190)*t73;
-    const double t314 = t260*t5;
-    const double t315 = t258*t37;
-    const double t316 = t270*t72;
-    const double t317 = t268*t73;
-    const double t318 = t284*t77;
-    const double t319 = a[174];
-    const double t321 = t272*t132;
-    const double t323 = t262+t295+t314+t296+t315+t266+t267+t316+t317+t318+t319*t126+t321+
+    const MBPOL_POLY_REAL t189 = t252*t72;
+    const MBPOL_POLY_REAL t190 = t154*t73;
+    const MBPOL_POLY_REAL t313 = (t150+t248+t149+t152+t251+t290+t291+t189+t190)*t73;
+    const MBPOL_POLY_REAL t314 = t260*t5;
+    const MBPOL_POLY_REAL t315 = t258*t37;
+    const MBPOL_POLY_REAL t316 = t270*t72;
+    const MBPOL_POLY_REAL t317 = t268*t73;
+    const MBPOL_POLY_REAL t318 = t284*t77;
+    const MBPOL_POLY_REAL t319 = a[174];
+    const MBPOL_POLY_REAL t321 = t272*t132;
+    const MBPOL_POLY_REAL t323 = t262+t295+t314+t296+t315+t266+t267+t316+t317+t318+t319*t126+t321+
 t274*t136;
-    const double t324 = t323*t136;
-    const double t325 = a[288];
-    const double t327 = a[418];
-    const double t328 = t327*t275;
-    const double t329 = a[328];
-    const double t330 = t329*t5;
-    const double t331 = t329*t20;
-    const double t332 = t329*t26;
-    const double t333 = t141*t309;
-    const double t334 = a[20];
-    const double t335 = t329*t37;
-    const double t336 = a[345];
-    const double t337 = t336*t50;
-    const double t338 = t336*t67;
-    const double t339 = t336*t72;
-    const double t340 = t336*t73;
-    const double t341 = a[82];
-    const double t342 = t341*t139;
-    const double t475 = x[6];
-    const double t343 = t325*t475+t328+t330+t331+t332+t333+t334+t335+t337+t338+t339+t340+
+    const MBPOL_POLY_REAL t324 = t323*t136;
+    const MBPOL_POLY_REAL t325 = a[288];
+    const MBPOL_POLY_REAL t327 = a[418];
+    const MBPOL_POLY_REAL t328 = t327*t275;
+    const MBPOL_POLY_REAL t329 = a[328];
+    const MBPOL_POLY_REAL t330 = t329*t5;
+    const MBPOL_POLY_REAL t331 = t329*t20;
+    const MBPOL_POLY_REAL t332 = t329*t26;
+    const MBPOL_POLY_REAL t333 = t141*t309;
+    const MBPOL_POLY_REAL t334 = a[20];
+    const MBPOL_POLY_REAL t335 = t329*t37;
+    const MBPOL_POLY_REAL t336 = a[345];
+    const MBPOL_POLY_REAL t337 = t336*t50;
+    const MBPOL_POLY_REAL t338 = t336*t67;
+    const MBPOL_POLY_REAL t339 = t336*t72;
+    const MBPOL_POLY_REAL t340 = t336*t73;
+    const MBPOL_POLY_REAL t341 = a[82];
+    const MBPOL_POLY_REAL t342 = t341*t139;
+    const MBPOL_POLY_REAL t475 = x[6];
+    const MBPOL_POLY_REAL t343 = t325*t475+t328+t330+t331+t332+t333+t334+t335+t337+t338+t339+t340+
 t342;
-    const double t344 = a[185];
-    const double t345 = t344*t145;
-    const double t346 = t341*t146;
-    const double t347 = t344*t155;
-    const double t253 = a[468];
-    const double t349 = t253*t179;
-    const double t350 = t327*t212;
-    const double t351 = a[353];
-    const double t352 = t351*t215;
-    const double t353 = t344*t126;
-    const double t354 = t341*t77;
-    const double t355 = t341*t132;
-    const double t356 = t344*t136;
-    const double t357 = t351*t254;
-    const double t358 = t345+t346+t347+t349+t350+t352+t353+t354+t355+t356+t357+t142+t187;
-    const double t361 = t115*t50;
-    const double t362 = t115*t67;
-    const double t363 = t112*t72;
-    const double t364 = t112*t73;
-    const double t365 = t120*t77;
-    const double t366 = t120*t126;
-    const double t367 = t120*t132;
-    const double t368 = t109+t107+t108+t110+t111+t361+t362+t363+t364+t365+t366+t367;
-    const double t369 = t120*t136;
-    const double t374 = t128*t275;
-    const double t375 = t128*t254;
-    const double t378 = t369+t137*t139+t131*t145+t137*t146+t131*t155+t127+t374+t375+t135*
+    const MBPOL_POLY_REAL t344 = a[185];
+    const MBPOL_POLY_REAL t345 = t344*t145;
+    const MBPOL_POLY_REAL t346 = t341*t146;
+    const MBPOL_POLY_REAL t347 = t344*t155;
+    const MBPOL_POLY_REAL t253 = a[468];
+    const MBPOL_POLY_REAL t349 = t253*t179;
+    const MBPOL_POLY_REAL t350 = t327*t212;
+    const MBPOL_POLY_REAL t351 = a[353];
+    const MBPOL_POLY_REAL t352 = t351*t215;
+    const MBPOL_POLY_REAL t353 = t344*t126;
+    const MBPOL_POLY_REAL t354 = t341*t77;
+    const MBPOL_POLY_REAL t355 = t341*t132;
+    const MBPOL_POLY_REAL t356 = t344*t136;
+    const MBPOL_POLY_REAL t357 = t351*t254;
+    const MBPOL_POLY_REAL t358 = t345+t346+t347+t349+t350+t352+t353+t354+t355+t356+t357+t142+t187;
+    const MBPOL_POLY_REAL t361 = t115*t50;
+    const MBPOL_POLY_REAL t362 = t115*t67;
+    const MBPOL_POLY_REAL t363 = t112*t72;
+    const MBPOL_POLY_REAL t364 = t112*t73;
+    const MBPOL_POLY_REAL t365 = t120*t77;
+    const MBPOL_POLY_REAL t366 = t120*t126;
+    const MBPOL_POLY_REAL t367 = t120*t132;
+    const MBPOL_POLY_REAL t368 = t109+t107+t108+t110+t111+t361+t362+t363+t364+t365+t366+t367;
+    const MBPOL_POLY_REAL t369 = t120*t136;
+    const MBPOL_POLY_REAL t374 = t128*t275;
+    const MBPOL_POLY_REAL t375 = t128*t254;
+    const MBPOL_POLY_REAL t378 = t369+t137*t139+t131*t145+t137*t146+t131*t155+t127+t374+t375+t135*
 t212+t133*t215+t119+t333;
-    const double t381 = t225*t50;
-    const double t382 = t225*t67;
-    const double t383 = t222*t72;
-    const double t384 = t222*t73;
-    const double t385 = t234*t77;
-    const double t386 = t236*t126;
-    const double t387 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t385+t386;
-    const double t388 = t234*t132;
-    const double t389 = t236*t136;
-    const double t390 = t228*t139;
-    const double t391 = t230*t145;
-    const double t392 = t228*t146;
-    const double t393 = t230*t155;
-    const double t394 = a[153];
-    const double t395 = t394*t275;
-    const double t396 = a[551];
-    const double t397 = t396*t254;
-    const double t398 = t242*t212;
-    const double t399 = t244*t215;
-    const double t400 = t388+t389+t390+t391+t392+t393+t241+t395+t397+t398+t399;
-    const double t403 = t63*t50;
-    const double t404 = t61*t67;
-    const double t405 = t282*t139;
-    const double t406 = t284*t145;
-    const double t407 = t65*t146;
-    const double t408 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t92+t94+t95+t96+t405+t406+
+    const MBPOL_POLY_REAL t381 = t225*t50;
+    const MBPOL_POLY_REAL t382 = t225*t67;
+    const MBPOL_POLY_REAL t383 = t222*t72;
+    const MBPOL_POLY_REAL t384 = t222*t73;
+    const MBPOL_POLY_REAL t385 = t234*t77;
+    const MBPOL_POLY_REAL t386 = t236*t126;
+    const MBPOL_POLY_REAL t387 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t385+t386;
+    const MBPOL_POLY_REAL t388 = t234*t132;
+    const MBPOL_POLY_REAL t389 = t236*t136;
+    const MBPOL_POLY_REAL t390 = t228*t139;
+    const MBPOL_POLY_REAL t391 = t230*t145;
+    const MBPOL_POLY_REAL t392 = t228*t146;
+    const MBPOL_POLY_REAL t393 = t230*t155;
+    const MBPOL_POLY_REAL t394 = a[153];
+    const MBPOL_POLY_REAL t395 = t394*t275;
+    const MBPOL_POLY_REAL t396 = a[551];
+    const MBPOL_POLY_REAL t397 = t396*t254;
+    const MBPOL_POLY_REAL t398 = t242*t212;
+    const MBPOL_POLY_REAL t399 = t244*t215;
+    const MBPOL_POLY_REAL t400 = t388+t389+t390+t391+t392+t393+t241+t395+t397+t398+t399;
+    const MBPOL_POLY_REAL t403 = t63*t50;
+    const MBPOL_POLY_REAL t404 = t61*t67;
+    const MBPOL_POLY_REAL t405 = t282*t139;
+    const MBPOL_POLY_REAL t406 = t284*t145;
+    const MBPOL_POLY_REAL t407 = t65*t146;
+    const MBPOL_POLY_REAL t408 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t92+t94+t95+t96+t405+t406+
 t407;
-    const double t410 = a[26];
-    const double t411 = a[133];
-    const double t412 = t411*t5;
-    const double t413 = t411*t20;
-    const double t414 = t411*t26;
-    const double t415 = t411*t37;
-    const double t416 = a[124];
-    const double t417 = t416*t50;
-    const double t418 = t416*t67;
-    const double t419 = a[190];
-    const double t420 = t419*t72;
-    const double t421 = t419*t73;
-    const double t422 = a[422];
-    const double t423 = t422*t77;
-    const double t425 = a[260];
-    const double t426 = t425*t126;
-    const double t427 = t422*t132;
-    const double t428 = t425*t136;
-    const double t429 = a[155];
-    const double t430 = t429*t139;
-    const double t431 = a[301];
-    const double t432 = t431*t145;
-    const double t433 = t429*t146;
-    const double t434 = t431*t155;
-    const double t293 = a[480];
-    const double t436 = t293*t179;
-    const double t437 = a[533];
-    const double t438 = t437*t275;
-    const double t439 = t394*t254;
-    const double t440 = a[483];
-    const double t441 = t440*t212;
-    const double t442 = t426+t427+t428+t430+t432+t433+t434+t436+t438+t439+t441;
-    const double t445 = t419*t50;
-    const double t446 = t419*t67;
-    const double t447 = t416*t72;
-    const double t448 = t416*t73;
-    const double t449 = t429*t77;
-    const double t450 = t431*t126;
-    const double t451 = t429*t132;
-    const double t452 = t431*t136;
-    const double t453 = t422*t139;
-    const double t454 = t425*t145;
-    const double t455 = t422*t146;
-    const double t456 = t425*t155;
-    const double t457 = t440*t275;
-    const double t458 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t449+t450+t451+t452+
+    const MBPOL_POLY_REAL t410 = a[26];
+    const MBPOL_POLY_REAL t411 = a[133];
+    const MBPOL_POLY_REAL t412 = t411*t5;
+    const MBPOL_POLY_REAL t413 = t411*t20;
+    const MBPOL_POLY_REAL t414 = t411*t26;
+    const MBPOL_POLY_REAL t415 = t411*t37;
+    const MBPOL_POLY_REAL t416 = a[124];
+    const MBPOL_POLY_REAL t417 = t416*t50;
+    const MBPOL_POLY_REAL t418 = t416*t67;
+    const MBPOL_POLY_REAL t419 = a[190];
+    const MBPOL_POLY_REAL t420 = t419*t72;
+    const MBPOL_POLY_REAL t421 = t419*t73;
+    const MBPOL_POLY_REAL t422 = a[422];
+    const MBPOL_POLY_REAL t423 = t422*t77;
+    const MBPOL_POLY_REAL t425 = a[260];
+    const MBPOL_POLY_REAL t426 = t425*t126;
+    const MBPOL_POLY_REAL t427 = t422*t132;
+    const MBPOL_POLY_REAL t428 = t425*t136;
+    const MBPOL_POLY_REAL t429 = a[155];
+    const MBPOL_POLY_REAL t430 = t429*t139;
+    const MBPOL_POLY_REAL t431 = a[301];
+    const MBPOL_POLY_REAL t432 = t431*t145;
+    const MBPOL_POLY_REAL t433 = t429*t146;
+    const MBPOL_POLY_REAL t434 = t431*t155;
+    const MBPOL_POLY_REAL t293 = a[480];
+    const MBPOL_POLY_REAL t436 = t293*t179;
+    const MBPOL_POLY_REAL t437 = a[533];
+    const MBPOL_POLY_REAL t438 = t437*t275;
+    const MBPOL_POLY_REAL t439 = t394*t254;
+    const MBPOL_POLY_REAL t440 = a[483];
+    const MBPOL_POLY_REAL t441 = t440*t212;
+    const MBPOL_POLY_REAL t442 = t426+t427+t428+t430+t432+t433+t434+t436+t438+t439+t441;
+    const MBPOL_POLY_REAL t445 = t419*t50;
+    const MBPOL_POLY_REAL t446 = t419*t67;
+    const MBPOL_POLY_REAL t447 = t416*t72;
+    const MBPOL_POLY_REAL t448 = t416*t73;
+    const MBPOL_POLY_REAL t449 = t429*t77;
+    const MBPOL_POLY_REAL t450 = t431*t126;
+    const MBPOL_POLY_REAL t451 = t429*t132;
+    const MBPOL_POLY_REAL t452 = t431*t136;
+    const MBPOL_POLY_REAL t453 = t422*t139;
+    const MBPOL_POLY_REAL t454 = t425*t145;
+    const MBPOL_POLY_REAL t455 = t422*t146;
+    const MBPOL_POLY_REAL t456 = t425*t155;
+    const MBPOL_POLY_REAL t457 = t440*t275;
+    const MBPOL_POLY_REAL t458 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t449+t450+t451+t452+
 t453+t454+t455+t456+t436+t457;
-    const double t460 = t270*t50;
-    const double t461 = t268*t67;
-    const double t462 = t284*t139;
-    const double t463 = t319*t145;
-    const double t464 = t272*t146;
-    const double t465 = t274*t155;
-    const double t466 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t301+t303+t304+t305+
+    const MBPOL_POLY_REAL t460 = t270*t50;
+    const MBPOL_POLY_REAL t461 = t268*t67;
+    const MBPOL_POLY_REAL t462 = t284*t139;
+    const MBPOL_POLY_REAL t463 = t319*t145;
+    const MBPOL_POLY_REAL t464 = t272*t146;
+    const MBPOL_POLY_REAL t465 = t274*t155;
+    const MBPOL_POLY_REAL t466 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t301+t303+t304+t305+
 t462+t463+t464+t465;
-    const double t311 = (t343+t358)*t475;
-    const double t312 = t368+t378;
-    const double t322 = t387+t400;
-    const double t359 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t423+t442;
-    const double t468 = t277+t288+t294+t308*t145+t313+t324+t311+t312*t309+t322*t215+t408*
+    const MBPOL_POLY_REAL t311 = (t343+t358)*t475;
+    const MBPOL_POLY_REAL t312 = t368+t378;
+    const MBPOL_POLY_REAL t322 = t387+t400;
+    const MBPOL_POLY_REAL t359 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t423+t442;
+    const MBPOL_POLY_REAL t468 = t277+t288+t294+t308*t145+t313+t324+t311+t312*t309+t322*t215+t408*
 t146+t359*t212+t458*t275+t466*t155;
-    const double t471 = a[0];
-    const double t472 = a[37];
-    const double t473 = a[316];
-    const double t372 = t473*t5;
-    const double t476 = (t472+t372)*t5;
-    const double t477 = a[415];
-    const double t478 = t477*t5;
-    const double t479 = a[13];
-    const double t480 = a[497];
-    const double t481 = t480*t20;
-    const double t376 = t478+t479+t481;
-    const double t483 = t376*t20;
-    const double t484 = a[492];
-    const double t485 = t484*t20;
-    const double t486 = a[198];
-    const double t487 = t486*t5;
-    const double t488 = t473*t26;
-    const double t377 = t485+t487+t472+t488;
-    const double t490 = t377*t26;
-    const double t491 = t484*t5;
-    const double t492 = a[223];
-    const double t494 = t477*t26;
-    const double t495 = t480*t37;
-    const double t380 = t491+t492*t20+t479+t494+t495;
-    const double t497 = t380*t37;
-    const double t498 = a[431];
-    const double t499 = t498*t5;
-    const double t500 = a[11];
-    const double t501 = a[247];
-    const double t502 = t501*t20;
-    const double t503 = a[387];
-    const double t504 = t503*t37;
-    const double t505 = a[107];
-    const double t506 = t505*t26;
-    const double t507 = a[110];
-    const double t508 = t507*t50;
-    const double t401 = t499+t500+t502+t504+t506+t508;
-    const double t510 = t401*t50;
-    const double t511 = t503*t20;
-    const double t512 = a[299];
-    const double t513 = t512*t50;
-    const double t514 = t501*t37;
-    const double t515 = t505*t5;
-    const double t516 = t498*t26;
-    const double t517 = t507*t67;
-    const double t402 = t511+t513+t514+t500+t515+t516+t517;
-    const double t519 = t402*t67;
-    const double t520 = a[325];
-    const double t521 = t520*t20;
-    const double t522 = a[264];
-    const double t523 = t522*t5;
-    const double t524 = a[38];
-    const double t525 = t522*t26;
-    const double t526 = t520*t37;
-    const double t527 = a[278];
-    const double t528 = t527*t50;
-    const double t529 = t527*t67;
-    const double t530 = a[472];
-    const double t409 = t530*t72;
-    const double t533 = (t521+t523+t524+t525+t526+t528+t529+t409)*t72;
-    const double t534 = a[9];
-    const double t535 = a[306];
-    const double t536 = t535*t5;
-    const double t537 = a[129];
-    const double t538 = t537*t20;
-    const double t539 = t535*t26;
-    const double t540 = t537*t37;
-    const double t541 = a[338];
-    const double t542 = t541*t50;
-    const double t543 = t541*t67;
-    const double t544 = a[524];
-    const double t545 = t544*t72;
-    const double t546 = a[509];
-    const double t435 = t546*t73;
-    const double t549 = (t534+t536+t538+t539+t540+t542+t543+t545+t435)*t73;
-    const double t550 = a[208];
-    const double t551 = t550*t5;
-    const double t552 = a[67];
-    const double t553 = t550*t20;
-    const double t554 = t550*t26;
-    const double t555 = t550*t37;
-    const double t556 = a[445];
-    const double t557 = t556*t50;
-    const double t558 = t556*t67;
-    const double t559 = a[421];
-    const double t560 = t559*t72;
-    const double t561 = t559*t73;
-    const double t562 = a[457];
-    const double t563 = t562*t77;
-    const double t566 = a[6];
-    const double t567 = a[126];
-    const double t568 = t567*t5;
-    const double t569 = t567*t20;
-    const double t570 = t567*t26;
-    const double t571 = t567*t37;
-    const double t572 = a[491];
-    const double t573 = t572*t50;
-    const double t574 = t572*t67;
-    const double t575 = a[111];
-    const double t576 = t575*t72;
-    const double t577 = t575*t73;
-    const double t578 = a[425];
-    const double t579 = t578*t77;
-    const double t580 = a[259];
-    const double t581 = t580*t126;
-    const double t582 = t566+t568+t569+t570+t571+t573+t574+t576+t577+t579+t581;
-    const double t584 = a[45];
-    const double t585 = a[183];
-    const double t586 = t585*t20;
-    const double t587 = a[143];
-    const double t588 = t587*t5;
-    const double t589 = t587*t26;
-    const double t590 = t585*t37;
-    const double t591 = a[460];
-    const double t592 = t591*t50;
-    const double t593 = t591*t67;
-    const double t594 = a[279];
-    const double t596 = a[473];
-    const double t599 = a[417];
-    const double t600 = t599*t132;
-    const double t601 = t584+t586+t588+t589+t590+t592+t593+t594*t72+t596*t73+t579+t578*t126+
+    const MBPOL_POLY_REAL t471 = a[0];
+    const MBPOL_POLY_REAL t472 = a[37];
+    const MBPOL_POLY_REAL t473 = a[316];
+    const MBPOL_POLY_REAL t372 = t473*t5;
+    const MBPOL_POLY_REAL t476 = (t472+t372)*t5;
+    const MBPOL_POLY_REAL t477 = a[415];
+    const MBPOL_POLY_REAL t478 = t477*t5;
+    const MBPOL_POLY_REAL t479 = a[13];
+    const MBPOL_POLY_REAL t480 = a[497];
+    const MBPOL_POLY_REAL t481 = t480*t20;
+    const MBPOL_POLY_REAL t376 = t478+t479+t481;
+    const MBPOL_POLY_REAL t483 = t376*t20;
+    const MBPOL_POLY_REAL t484 = a[492];
+    const MBPOL_POLY_REAL t485 = t484*t20;
+    const MBPOL_POLY_REAL t486 = a[198];
+    const MBPOL_POLY_REAL t487 = t486*t5;
+    const MBPOL_POLY_REAL t488 = t473*t26;
+    const MBPOL_POLY_REAL t377 = t485+t487+t472+t488;
+    const MBPOL_POLY_REAL t490 = t377*t26;
+    const MBPOL_POLY_REAL t491 = t484*t5;
+    const MBPOL_POLY_REAL t492 = a[223];
+    const MBPOL_POLY_REAL t494 = t477*t26;
+    const MBPOL_POLY_REAL t495 = t480*t37;
+    const MBPOL_POLY_REAL t380 = t491+t492*t20+t479+t494+t495;
+    const MBPOL_POLY_REAL t497 = t380*t37;
+    const MBPOL_POLY_REAL t498 = a[431];
+    const MBPOL_POLY_REAL t499 = t498*t5;
+    const MBPOL_POLY_REAL t500 = a[11];
+    const MBPOL_POLY_REAL t501 = a[247];
+    const MBPOL_POLY_REAL t502 = t501*t20;
+    const MBPOL_POLY_REAL t503 = a[387];
+    const MBPOL_POLY_REAL t504 = t503*t37;
+    const MBPOL_POLY_REAL t505 = a[107];
+    const MBPOL_POLY_REAL t506 = t505*t26;
+    const MBPOL_POLY_REAL t507 = a[110];
+    const MBPOL_POLY_REAL t508 = t507*t50;
+    const MBPOL_POLY_REAL t401 = t499+t500+t502+t504+t506+t508;
+    const MBPOL_POLY_REAL t510 = t401*t50;
+    const MBPOL_POLY_REAL t511 = t503*t20;
+    const MBPOL_POLY_REAL t512 = a[299];
+    const MBPOL_POLY_REAL t513 = t512*t50;
+    const MBPOL_POLY_REAL t514 = t501*t37;
+    const MBPOL_POLY_REAL t515 = t505*t5;
+    const MBPOL_POLY_REAL t516 = t498*t26;
+    const MBPOL_POLY_REAL t517 = t507*t67;
+    const MBPOL_POLY_REAL t402 = t511+t513+t514+t500+t515+t516+t517;
+    const MBPOL_POLY_REAL t519 = t402*t67;
+    const MBPOL_POLY_REAL t520 = a[325];
+    const MBPOL_POLY_REAL t521 = t520*t20;
+    const MBPOL_POLY_REAL t522 = a[264];
+    const MBPOL_POLY_REAL t523 = t522*t5;
+    const MBPOL_POLY_REAL t524 = a[38];
+    const MBPOL_POLY_REAL t525 = t522*t26;
+    const MBPOL_POLY_REAL t526 = t520*t37;
+    const MBPOL_POLY_REAL t527 = a[278];
+    const MBPOL_POLY_REAL t528 = t527*t50;
+    const MBPOL_POLY_REAL t529 = t527*t67;
+    const MBPOL_POLY_REAL t530 = a[472];
+    const MBPOL_POLY_REAL t409 = t530*t72;
+    const MBPOL_POLY_REAL t533 = (t521+t523+t524+t525+t526+t528+t529+t409)*t72;
+    const MBPOL_POLY_REAL t534 = a[9];
+    const MBPOL_POLY_REAL t535 = a[306];
+    const MBPOL_POLY_REAL t536 = t535*t5;
+    const MBPOL_POLY_REAL t537 = a[129];
+    const MBPOL_POLY_REAL t538 = t537*t20;
+    const MBPOL_POLY_REAL t539 = t535*t26;
+    const MBPOL_POLY_REAL t540 = t537*t37;
+    const MBPOL_POLY_REAL t541 = a[338];
+    const MBPOL_POLY_REAL t542 = t541*t50;
+    const MBPOL_POLY_REAL t543 = t541*t67;
+    const MBPOL_POLY_REAL t544 = a[524];
+    const MBPOL_POLY_REAL t545 = t544*t72;
+    const MBPOL_POLY_REAL t546 = a[509];
+    const MBPOL_POLY_REAL t435 = t546*t73;
+    const MBPOL_POLY_REAL t549 = (t534+t536+t538+t539+t540+t542+t543+t545+t435)*t73;
+    const MBPOL_POLY_REAL t550 = a[208];
+    const MBPOL_POLY_REAL t551 = t550*t5;
+    const MBPOL_POLY_REAL t552 = a[67];
+    const MBPOL_POLY_REAL t553 = t550*t20;
+    const MBPOL_POLY_REAL t554 = t550*t26;
+    const MBPOL_POLY_REAL t555 = t550*t37;
+    const MBPOL_POLY_REAL t556 = a[445];
+    const MBPOL_POLY_REAL t557 = t556*t50;
+    const MBPOL_POLY_REAL t558 = t556*t67;
+    const MBPOL_POLY_REAL t559 = a[421];
+    const MBPOL_POLY_REAL t560 = t559*t72;
+    const MBPOL_POLY_REAL t561 = t559*t73;
+    const MBPOL_POLY_REAL t562 = a[457];
+    const MBPOL_POLY_REAL t563 = t562*t77;
+    const MBPOL_POLY_REAL t566 = a[6];
+    const MBPOL_POLY_REAL t567 = a[126];
+    const MBPOL_POLY_REAL t568 = t567*t5;
+    const MBPOL_POLY_REAL t569 = t567*t20;
+    const MBPOL_POLY_REAL t570 = t567*t26;
+    const MBPOL_POLY_REAL t571 = t567*t37;
+    const MBPOL_POLY_REAL t572 = a[491];
+    const MBPOL_POLY_REAL t573 = t572*t50;
+    const MBPOL_POLY_REAL t574 = t572*t67;
+    const MBPOL_POLY_REAL t575 = a[111];
+    const MBPOL_POLY_REAL t576 = t575*t72;
+    const MBPOL_POLY_REAL t577 = t575*t73;
+    const MBPOL_POLY_REAL t578 = a[425];
+    const MBPOL_POLY_REAL t579 = t578*t77;
+    const MBPOL_POLY_REAL t580 = a[259];
+    const MBPOL_POLY_REAL t581 = t580*t126;
+    const MBPOL_POLY_REAL t582 = t566+t568+t569+t570+t571+t573+t574+t576+t577+t579+t581;
+    const MBPOL_POLY_REAL t584 = a[45];
+    const MBPOL_POLY_REAL t585 = a[183];
+    const MBPOL_POLY_REAL t586 = t585*t20;
+    const MBPOL_POLY_REAL t587 = a[143];
+    const MBPOL_POLY_REAL t588 = t587*t5;
+    const MBPOL_POLY_REAL t589 = t587*t26;
+    const MBPOL_POLY_REAL t590 = t585*t37;
+    const MBPOL_POLY_REAL t591 = a[460];
+    const MBPOL_POLY_REAL t592 = t591*t50;
+    const MBPOL_POLY_REAL t593 = t591*t67;
+    const MBPOL_POLY_REAL t594 = a[279];
+    const MBPOL_POLY_REAL t596 = a[473];
+    const MBPOL_POLY_REAL t599 = a[417];
+    const MBPOL_POLY_REAL t600 = t599*t132;
+    const MBPOL_POLY_REAL t601 = t584+t586+t588+t589+t590+t592+t593+t594*t72+t596*t73+t579+t578*t126+
 t600;
-    const double t603 = a[137];
-    const double t604 = t603*t5;
-    const double t605 = a[150];
-    const double t606 = t605*t20;
-    const double t607 = a[50];
-    const double t608 = t603*t26;
-    const double t609 = t605*t37;
-    const double t610 = a[312];
-    const double t611 = t610*t50;
-    const double t612 = t610*t67;
-    const double t613 = a[141];
-    const double t614 = t613*t72;
-    const double t615 = a[427];
-    const double t616 = t615*t73;
-    const double t617 = a[382];
-    const double t619 = t604+t606+t607+t608+t609+t611+t612+t614+t616+t563+t581+t600+t617*
+    const MBPOL_POLY_REAL t603 = a[137];
+    const MBPOL_POLY_REAL t604 = t603*t5;
+    const MBPOL_POLY_REAL t605 = a[150];
+    const MBPOL_POLY_REAL t606 = t605*t20;
+    const MBPOL_POLY_REAL t607 = a[50];
+    const MBPOL_POLY_REAL t608 = t603*t26;
+    const MBPOL_POLY_REAL t609 = t605*t37;
+    const MBPOL_POLY_REAL t610 = a[312];
+    const MBPOL_POLY_REAL t611 = t610*t50;
+    const MBPOL_POLY_REAL t612 = t610*t67;
+    const MBPOL_POLY_REAL t613 = a[141];
+    const MBPOL_POLY_REAL t614 = t613*t72;
+    const MBPOL_POLY_REAL t615 = a[427];
+    const MBPOL_POLY_REAL t616 = t615*t73;
+    const MBPOL_POLY_REAL t617 = a[382];
+    const MBPOL_POLY_REAL t619 = t604+t606+t607+t608+t609+t611+t612+t614+t616+t563+t581+t600+t617*
 t136;
-    const double t470 = t551+t552+t553+t554+t555+t557+t558+t560+t561+t563;
-    const double t489 = t619*t136;
-    const double t621 = t471+t476+t483+t490+t497+t510+t519+t533+t549+t470*t77+t582*t126+t601
+    const MBPOL_POLY_REAL t470 = t551+t552+t553+t554+t555+t557+t558+t560+t561+t563;
+    const MBPOL_POLY_REAL t489 = t619*t136;
+    const MBPOL_POLY_REAL t621 = t471+t476+t483+t490+t497+t510+t519+t533+t549+t470*t77+t582*t126+t601
 *t132+t489;
-    const double t493 = t274*t77;
-    const double t625 = (t259+t261+t262+t263+t264+t266+t267+t269+t271+t493)*t77;
-    const double t627 = t51+t53+t55+t56+t57+t59+t60+t62+t64+t273+t65*t126;
-    const double t628 = t627*t126;
-    const double t631 = t262+t295+t314+t296+t315+t266+t267+t316+t317+t319*t77+t285+t274*t132
+    const MBPOL_POLY_REAL t493 = t274*t77;
+    const MBPOL_POLY_REAL t625 = (t259+t261+t262+t263+t264+t266+t267+t269+t271+t493)*t77;
+    const MBPOL_POLY_REAL t627 = t51+t53+t55+t56+t57+t59+t60+t62+t64+t273+t65*t126;
+    const MBPOL_POLY_REAL t628 = t627*t126;
+    const MBPOL_POLY_REAL t631 = t262+t295+t314+t296+t315+t266+t267+t316+t317+t319*t77+t285+t274*t132
 ;
-    const double t632 = t631*t132;
-    const double t633 = t69+t74+t79+t84+t105+t157+t256+t294+t313+t625+t628+t632;
-    const double t636 = t51+t85+t278+t86+t279+t59+t60+t280+t281+t318+t282*t126+t321+t65*t136
+    const MBPOL_POLY_REAL t632 = t631*t132;
+    const MBPOL_POLY_REAL t633 = t69+t74+t79+t84+t105+t157+t256+t294+t313+t625+t628+t632;
+    const MBPOL_POLY_REAL t636 = t51+t85+t278+t86+t279+t59+t60+t280+t281+t318+t282*t126+t321+t65*t136
 ;
-    const double t637 = t636*t136;
-    const double t638 = t91*t126;
-    const double t639 = t91*t136;
-    const double t640 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t301+t638+t304+t639+t97;
-    const double t642 = t302*t77;
-    const double t643 = t302*t132;
-    const double t644 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t642+t94+t643+t96+t306+
+    const MBPOL_POLY_REAL t637 = t636*t136;
+    const MBPOL_POLY_REAL t638 = t91*t126;
+    const MBPOL_POLY_REAL t639 = t91*t136;
+    const MBPOL_POLY_REAL t640 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t301+t638+t304+t639+t97;
+    const MBPOL_POLY_REAL t642 = t302*t77;
+    const MBPOL_POLY_REAL t643 = t302*t132;
+    const MBPOL_POLY_REAL t644 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t642+t94+t643+t96+t306+
 t307;
-    const double t646 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t301+t638+t304+t639+t405+
+    const MBPOL_POLY_REAL t646 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t301+t638+t304+t639+t405+
 t406+t407;
-    const double t648 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t642+t94+t643+t96+t462+
+    const MBPOL_POLY_REAL t648 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t642+t94+t643+t96+t462+
 t463+t464+t465;
-    const double t650 = t204*t77;
-    const double t651 = t202*t126;
-    const double t652 = t204*t132;
-    const double t653 = t202*t136;
-    const double t654 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t650+t651+t652+t653+
+    const MBPOL_POLY_REAL t650 = t204*t77;
+    const MBPOL_POLY_REAL t651 = t202*t126;
+    const MBPOL_POLY_REAL t652 = t204*t132;
+    const MBPOL_POLY_REAL t653 = t202*t136;
+    const MBPOL_POLY_REAL t654 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t650+t651+t652+t653+
 t208+t209+t210+t211+t213;
-    const double t656 = t230*t77;
-    const double t657 = t228*t126;
-    const double t658 = t230*t132;
-    const double t659 = t228*t136;
-    const double t660 = t244*t275;
-    const double t661 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t656+t657+t658+t659+
+    const MBPOL_POLY_REAL t656 = t230*t77;
+    const MBPOL_POLY_REAL t657 = t228*t126;
+    const MBPOL_POLY_REAL t658 = t230*t132;
+    const MBPOL_POLY_REAL t659 = t228*t136;
+    const MBPOL_POLY_REAL t660 = t244*t275;
+    const MBPOL_POLY_REAL t661 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t656+t657+t658+t659+
 t235+t237+t238+t239+t241+t660;
-    const double t663 = t431*t77;
-    const double t664 = t429*t126;
-    const double t665 = t431*t132;
-    const double t666 = t429*t136;
-    const double t667 = t440*t254;
-    const double t668 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t663+t664+t665+t666+
+    const MBPOL_POLY_REAL t663 = t431*t77;
+    const MBPOL_POLY_REAL t664 = t429*t126;
+    const MBPOL_POLY_REAL t665 = t431*t132;
+    const MBPOL_POLY_REAL t666 = t429*t136;
+    const MBPOL_POLY_REAL t667 = t440*t254;
+    const MBPOL_POLY_REAL t668 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t663+t664+t665+t666+
 t453+t454+t455+t456+t436+t243+t667;
-    const double t670 = t425*t77;
-    const double t672 = t422*t126;
-    const double t673 = t425*t132;
-    const double t674 = t422*t136;
-    const double t675 = t437*t254;
-    const double t676 = t672+t673+t674+t430+t432+t433+t434+t436+t395+t675+t441;
-    const double t679 = t236*t77;
-    const double t680 = t234*t126;
-    const double t681 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t679+t680;
-    const double t682 = t236*t132;
-    const double t683 = t234*t136;
-    const double t684 = t396*t275;
-    const double t685 = t682+t683+t390+t391+t392+t393+t241+t684+t439+t398+t399;
-    const double t690 = t109+t107+t108+t110+t111+t113+t114+t116+t117+t131*t77+t137*t126;
-    const double t695 = t141*t143;
-    const double t696 = t131*t132+t137*t136+t121+t122+t124+t125+t127+t133*t275+t135*t254+
+    const MBPOL_POLY_REAL t670 = t425*t77;
+    const MBPOL_POLY_REAL t672 = t422*t126;
+    const MBPOL_POLY_REAL t673 = t425*t132;
+    const MBPOL_POLY_REAL t674 = t422*t136;
+    const MBPOL_POLY_REAL t675 = t437*t254;
+    const MBPOL_POLY_REAL t676 = t672+t673+t674+t430+t432+t433+t434+t436+t395+t675+t441;
+    const MBPOL_POLY_REAL t679 = t236*t77;
+    const MBPOL_POLY_REAL t680 = t234*t126;
+    const MBPOL_POLY_REAL t681 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t679+t680;
+    const MBPOL_POLY_REAL t682 = t236*t132;
+    const MBPOL_POLY_REAL t683 = t234*t136;
+    const MBPOL_POLY_REAL t684 = t396*t275;
+    const MBPOL_POLY_REAL t685 = t682+t683+t390+t391+t392+t393+t241+t684+t439+t398+t399;
+    const MBPOL_POLY_REAL t690 = t109+t107+t108+t110+t111+t113+t114+t116+t117+t131*t77+t137*t126;
+    const MBPOL_POLY_REAL t695 = t141*t143;
+    const MBPOL_POLY_REAL t696 = t131*t132+t137*t136+t121+t122+t124+t125+t127+t133*t275+t135*t254+
 t129+t130+t695;
-    const double t699 = t344*t77;
-    const double t700 = t341*t126;
-    const double t701 = t344*t132;
-    const double t702 = t334+t330+t331+t332+t335+t337+t338+t339+t340+t699+t700+t701;
-    const double t703 = t341*t136;
-    const double t704 = t351*t275;
-    const double t705 = t327*t254;
-    const double t707 = t703+t342+t345+t346+t347+t349+t704+t705+t350+t352+t695+t325*t309;
-    const double t629 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t670+t676;
-    const double t634 = t681+t685;
-    const double t641 = t690+t696;
-    const double t649 = (t702+t707)*t309;
-    const double t710 = t637+t640*t139+t644*t145+t646*t146+t648*t155+t654*t179+t661*t275+
+    const MBPOL_POLY_REAL t699 = t344*t77;
+    const MBPOL_POLY_REAL t700 = t341*t126;
+    const MBPOL_POLY_REAL t701 = t344*t132;
+    const MBPOL_POLY_REAL t702 = t334+t330+t331+t332+t335+t337+t338+t339+t340+t699+t700+t701;
+    const MBPOL_POLY_REAL t703 = t341*t136;
+    const MBPOL_POLY_REAL t704 = t351*t275;
+    const MBPOL_POLY_REAL t705 = t327*t254;
+    const MBPOL_POLY_REAL t707 = t703+t342+t345+t346+t347+t349+t704+t705+t350+t352+t695+t325*t309;
+    const MBPOL_POLY_REAL t629 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t670+t676;
+    const MBPOL_POLY_REAL t634 = t681+t685;
+    const MBPOL_POLY_REAL t641 = t690+t696;
+    const MBPOL_POLY_REAL t649 = (t702+t707)*t309;
+    const MBPOL_POLY_REAL t710 = t637+t640*t139+t644*t145+t646*t146+t648*t155+t654*t179+t661*t275+
 t668*t254+t629*t212+t634*t215+t641*t143+t649;
-    const double t713 = a[1];
-    const double t714 = a[64];
-    const double t715 = a[399];
-    const double t716 = t715*t5;
-    const double t655 = t714+t716;
-    const double t718 = t655*t5;
-    const double t719 = a[60];
-    const double t720 = a[471];
-    const double t726 = t473*t20;
-    const double t662 = t487+t472+t726;
-    const double t728 = t662*t20;
-    const double t729 = t480*t26;
-    const double t669 = t478+t485+t479+t729;
-    const double t731 = t669*t26;
-    const double t732 = t477*t20;
-    const double t677 = t732+t492*t26+t491+t479+t495;
-    const double t735 = t677*t37;
-    const double t736 = t522*t20;
-    const double t737 = t520*t26;
-    const double t678 = t530*t50;
-    const double t740 = (t523+t524+t736+t737+t526+t678)*t50;
-    const double t741 = t535*t20;
-    const double t742 = t537*t26;
-    const double t743 = t544*t50;
-    const double t687 = t546*t67;
-    const double t746 = (t534+t536+t741+t742+t540+t743+t687)*t67;
-    const double t747 = t501*t26;
-    const double t748 = t505*t20;
-    const double t749 = t507*t72;
-    const double t689 = t747+t499+t528+t543+t504+t500+t748+t749;
-    const double t751 = t689*t72;
-    const double t752 = t512*t72;
-    const double t753 = t498*t20;
-    const double t754 = t503*t26;
-    const double t755 = t507*t73;
-    const double t691 = t514+t752+t500+t528+t753+t515+t543+t754+t755;
-    const double t757 = t691*t73;
-    const double t758 = a[139];
-    const double t759 = t758*t20;
-    const double t760 = a[274];
-    const double t761 = t760*t26;
-    const double t762 = a[14];
-    const double t763 = a[83];
-    const double t764 = t763*t5;
-    const double t765 = t763*t37;
-    const double t766 = a[96];
-    const double t767 = t766*t50;
-    const double t768 = a[200];
-    const double t769 = t768*t67;
-    const double t770 = t768*t72;
-    const double t771 = t766*t73;
-    const double t772 = a[255];
-    const double t773 = t772*t77;
-    const double t692 = t759+t761+t762+t764+t765+t767+t769+t770+t771+t773;
-    const double t775 = t692*t77;
-    const double t776 = a[84];
-    const double t777 = t776*t77;
-    const double t778 = t772*t126;
-    const double t779 = t759+t761+t762+t764+t765+t767+t769+t770+t771+t777+t778;
-    const double t780 = t779*t126;
-    const double t781 = t758*t5;
-    const double t782 = t763*t20;
-    const double t783 = t763*t26;
-    const double t784 = t760*t37;
-    const double t785 = t766*t72;
-    const double t786 = t768*t73;
-    const double t787 = a[354];
-    const double t788 = t787*t77;
-    const double t789 = a[79];
-    const double t790 = t789*t126;
-    const double t791 = t772*t132;
-    const double t792 = t781+t762+t782+t783+t784+t767+t769+t785+t786+t788+t790+t791;
-    const double t793 = t792*t132;
-    const double t794 = t789*t77;
-    const double t795 = t787*t126;
-    const double t796 = t776*t132;
-    const double t797 = t772*t136;
-    const double t798 = t781+t762+t782+t783+t784+t767+t769+t785+t786+t794+t795+t796+t797;
-    const double t799 = t798*t136;
-    const double t800 = t559*t50;
-    const double t801 = t559*t67;
-    const double t802 = t556*t72;
-    const double t803 = t556*t73;
-    const double t804 = t789*t132;
-    const double t805 = t789*t136;
-    const double t806 = t562*t139;
-    const double t807 = t551+t552+t553+t554+t555+t800+t801+t802+t803+t794+t790+t804+t805+
+    const MBPOL_POLY_REAL t713 = a[1];
+    const MBPOL_POLY_REAL t714 = a[64];
+    const MBPOL_POLY_REAL t715 = a[399];
+    const MBPOL_POLY_REAL t716 = t715*t5;
+    const MBPOL_POLY_REAL t655 = t714+t716;
+    const MBPOL_POLY_REAL t718 = t655*t5;
+    const MBPOL_POLY_REAL t719 = a[60];
+    const MBPOL_POLY_REAL t720 = a[471];
+    const MBPOL_POLY_REAL t726 = t473*t20;
+    const MBPOL_POLY_REAL t662 = t487+t472+t726;
+    const MBPOL_POLY_REAL t728 = t662*t20;
+    const MBPOL_POLY_REAL t729 = t480*t26;
+    const MBPOL_POLY_REAL t669 = t478+t485+t479+t729;
+    const MBPOL_POLY_REAL t731 = t669*t26;
+    const MBPOL_POLY_REAL t732 = t477*t20;
+    const MBPOL_POLY_REAL t677 = t732+t492*t26+t491+t479+t495;
+    const MBPOL_POLY_REAL t735 = t677*t37;
+    const MBPOL_POLY_REAL t736 = t522*t20;
+    const MBPOL_POLY_REAL t737 = t520*t26;
+    const MBPOL_POLY_REAL t678 = t530*t50;
+    const MBPOL_POLY_REAL t740 = (t523+t524+t736+t737+t526+t678)*t50;
+    const MBPOL_POLY_REAL t741 = t535*t20;
+    const MBPOL_POLY_REAL t742 = t537*t26;
+    const MBPOL_POLY_REAL t743 = t544*t50;
+    const MBPOL_POLY_REAL t687 = t546*t67;
+    const MBPOL_POLY_REAL t746 = (t534+t536+t741+t742+t540+t743+t687)*t67;
+    const MBPOL_POLY_REAL t747 = t501*t26;
+    const MBPOL_POLY_REAL t748 = t505*t20;
+    const MBPOL_POLY_REAL t749 = t507*t72;
+    const MBPOL_POLY_REAL t689 = t747+t499+t528+t543+t504+t500+t748+t749;
+    const MBPOL_POLY_REAL t751 = t689*t72;
+    const MBPOL_POLY_REAL t752 = t512*t72;
+    const MBPOL_POLY_REAL t753 = t498*t20;
+    const MBPOL_POLY_REAL t754 = t503*t26;
+    const MBPOL_POLY_REAL t755 = t507*t73;
+    const MBPOL_POLY_REAL t691 = t514+t752+t500+t528+t753+t515+t543+t754+t755;
+    const MBPOL_POLY_REAL t757 = t691*t73;
+    const MBPOL_POLY_REAL t758 = a[139];
+    const MBPOL_POLY_REAL t759 = t758*t20;
+    const MBPOL_POLY_REAL t760 = a[274];
+    const MBPOL_POLY_REAL t761 = t760*t26;
+    const MBPOL_POLY_REAL t762 = a[14];
+    const MBPOL_POLY_REAL t763 = a[83];
+    const MBPOL_POLY_REAL t764 = t763*t5;
+    const MBPOL_POLY_REAL t765 = t763*t37;
+    const MBPOL_POLY_REAL t766 = a[96];
+    const MBPOL_POLY_REAL t767 = t766*t50;
+    const MBPOL_POLY_REAL t768 = a[200];
+    const MBPOL_POLY_REAL t769 = t768*t67;
+    const MBPOL_POLY_REAL t770 = t768*t72;
+    const MBPOL_POLY_REAL t771 = t766*t73;
+    const MBPOL_POLY_REAL t772 = a[255];
+    const MBPOL_POLY_REAL t773 = t772*t77;
+    const MBPOL_POLY_REAL t692 = t759+t761+t762+t764+t765+t767+t769+t770+t771+t773;
+    const MBPOL_POLY_REAL t775 = t692*t77;
+    const MBPOL_POLY_REAL t776 = a[84];
+    const MBPOL_POLY_REAL t777 = t776*t77;
+    const MBPOL_POLY_REAL t778 = t772*t126;
+    const MBPOL_POLY_REAL t779 = t759+t761+t762+t764+t765+t767+t769+t770+t771+t777+t778;
+    const MBPOL_POLY_REAL t780 = t779*t126;
+    const MBPOL_POLY_REAL t781 = t758*t5;
+    const MBPOL_POLY_REAL t782 = t763*t20;
+    const MBPOL_POLY_REAL t783 = t763*t26;
+    const MBPOL_POLY_REAL t784 = t760*t37;
+    const MBPOL_POLY_REAL t785 = t766*t72;
+    const MBPOL_POLY_REAL t786 = t768*t73;
+    const MBPOL_POLY_REAL t787 = a[354];
+    const MBPOL_POLY_REAL t788 = t787*t77;
+    const MBPOL_POLY_REAL t789 = a[79];
+    const MBPOL_POLY_REAL t790 = t789*t126;
+    const MBPOL_POLY_REAL t791 = t772*t132;
+    const MBPOL_POLY_REAL t792 = t781+t762+t782+t783+t784+t767+t769+t785+t786+t788+t790+t791;
+    const MBPOL_POLY_REAL t793 = t792*t132;
+    const MBPOL_POLY_REAL t794 = t789*t77;
+    const MBPOL_POLY_REAL t795 = t787*t126;
+    const MBPOL_POLY_REAL t796 = t776*t132;
+    const MBPOL_POLY_REAL t797 = t772*t136;
+    const MBPOL_POLY_REAL t798 = t781+t762+t782+t783+t784+t767+t769+t785+t786+t794+t795+t796+t797;
+    const MBPOL_POLY_REAL t799 = t798*t136;
+    const MBPOL_POLY_REAL t800 = t559*t50;
+    const MBPOL_POLY_REAL t801 = t559*t67;
+    const MBPOL_POLY_REAL t802 = t556*t72;
+    const MBPOL_POLY_REAL t803 = t556*t73;
+    const MBPOL_POLY_REAL t804 = t789*t132;
+    const MBPOL_POLY_REAL t805 = t789*t136;
+    const MBPOL_POLY_REAL t806 = t562*t139;
+    const MBPOL_POLY_REAL t807 = t551+t552+t553+t554+t555+t800+t801+t802+t803+t794+t790+t804+t805+
 t806;
-    const double t809 = t575*t50;
-    const double t810 = t575*t67;
-    const double t811 = t572*t72;
-    const double t812 = t572*t73;
-    const double t813 = t787*t132;
-    const double t814 = t787*t136;
-    const double t815 = t578*t139;
-    const double t816 = t580*t145;
-    const double t817 = t566+t568+t569+t570+t571+t809+t810+t811+t812+t788+t795+t813+t814+
+    const MBPOL_POLY_REAL t809 = t575*t50;
+    const MBPOL_POLY_REAL t810 = t575*t67;
+    const MBPOL_POLY_REAL t811 = t572*t72;
+    const MBPOL_POLY_REAL t812 = t572*t73;
+    const MBPOL_POLY_REAL t813 = t787*t132;
+    const MBPOL_POLY_REAL t814 = t787*t136;
+    const MBPOL_POLY_REAL t815 = t578*t139;
+    const MBPOL_POLY_REAL t816 = t580*t145;
+    const MBPOL_POLY_REAL t817 = t566+t568+t569+t570+t571+t809+t810+t811+t812+t788+t795+t813+t814+
 t815+t816;
-    const double t819 = t587*t20;
-    const double t820 = t585*t26;
-    const double t823 = t591*t72;
-    const double t824 = t591*t73;
-    const double t825 = t776*t126;
-    const double t826 = t776*t136;
-    const double t828 = t599*t146;
-    const double t829 = t584+t588+t819+t820+t590+t594*t50+t596*t67+t823+t824+t777+t825+t796+
+    const MBPOL_POLY_REAL t819 = t587*t20;
+    const MBPOL_POLY_REAL t820 = t585*t26;
+    const MBPOL_POLY_REAL t823 = t591*t72;
+    const MBPOL_POLY_REAL t824 = t591*t73;
+    const MBPOL_POLY_REAL t825 = t776*t126;
+    const MBPOL_POLY_REAL t826 = t776*t136;
+    const MBPOL_POLY_REAL t828 = t599*t146;
+    const MBPOL_POLY_REAL t829 = t584+t588+t819+t820+t590+t594*t50+t596*t67+t823+t824+t777+t825+t796+
 t826+t815+t578*t145+t828;
-    const double t831 = t603*t20;
-    const double t832 = t605*t26;
-    const double t833 = t613*t50;
-    const double t834 = t615*t67;
-    const double t835 = t610*t72;
-    const double t836 = t610*t73;
-    const double t838 = t604+t607+t831+t832+t609+t833+t834+t835+t836+t773+t778+t791+t797+
+    const MBPOL_POLY_REAL t831 = t603*t20;
+    const MBPOL_POLY_REAL t832 = t605*t26;
+    const MBPOL_POLY_REAL t833 = t613*t50;
+    const MBPOL_POLY_REAL t834 = t615*t67;
+    const MBPOL_POLY_REAL t835 = t610*t72;
+    const MBPOL_POLY_REAL t836 = t610*t73;
+    const MBPOL_POLY_REAL t838 = t604+t607+t831+t832+t609+t833+t834+t835+t836+t773+t778+t791+t797+
 t806+t816+t828+t617*t155;
-    const double t711 = t838*t155;
-    const double t840 = t471+t476+t728+t731+t735+t740+t746+t751+t757+t775+t780+t793+t799+
+    const MBPOL_POLY_REAL t711 = t838*t155;
+    const MBPOL_POLY_REAL t840 = t471+t476+t728+t731+t735+t740+t746+t751+t757+t775+t780+t793+t799+
 t807*t139+t817*t145+t829*t146+t711;
-    const double t843 = a[59];
-    const double t844 = a[293];
-    const double t848 = a[548];
-    const double t849 = t848*t5;
-    const double t853 = a[220];
-    const double t864 = a[33];
-    const double t865 = a[482];
-    const double t866 = t865*t5;
-    const double t867 = t865*t20;
-    const double t868 = a[400];
-    const double t869 = t868*t26;
-    const double t870 = t868*t37;
-    const double t871 = a[337];
-    const double t875 = t868*t5;
-    const double t876 = t868*t20;
-    const double t877 = t865*t26;
-    const double t878 = t865*t37;
-    const double t879 = a[537];
-    const double t884 = a[177];
-    const double t885 = t884*t50;
-    const double t886 = t884*t67;
-    const double t894 = a[138];
-    const double t895 = t894*t5;
-    const double t896 = a[362];
-    const double t897 = t896*t20;
-    const double t898 = a[52];
-    const double t899 = t894*t26;
-    const double t900 = t896*t37;
-    const double t901 = a[317];
-    const double t902 = t901*t50;
-    const double t903 = t901*t67;
-    const double t904 = a[459];
-    const double t905 = t904*t72;
-    const double t906 = a[519];
-    const double t907 = t906*t73;
-    const double t908 = a[120];
-    const double t912 = a[475];
-    const double t915 = t895+t897+t898+t899+t900+t902+t903+t905+t907+t912*t77+t908*t126;
-    const double t917 = t894*t20;
-    const double t918 = t896*t5;
-    const double t919 = t896*t26;
-    const double t920 = t894*t37;
-    const double t921 = t906*t72;
-    const double t922 = t904*t73;
-    const double t923 = a[501];
-    const double t925 = a[536];
-    const double t928 = t917+t898+t918+t919+t920+t902+t903+t921+t922+t923*t77+t925*t126+t908
+    const MBPOL_POLY_REAL t843 = a[59];
+    const MBPOL_POLY_REAL t844 = a[293];
+    const MBPOL_POLY_REAL t848 = a[548];
+    const MBPOL_POLY_REAL t849 = t848*t5;
+    const MBPOL_POLY_REAL t853 = a[220];
+    const MBPOL_POLY_REAL t864 = a[33];
+    const MBPOL_POLY_REAL t865 = a[482];
+    const MBPOL_POLY_REAL t866 = t865*t5;
+    const MBPOL_POLY_REAL t867 = t865*t20;
+    const MBPOL_POLY_REAL t868 = a[400];
+    const MBPOL_POLY_REAL t869 = t868*t26;
+    const MBPOL_POLY_REAL t870 = t868*t37;
+    const MBPOL_POLY_REAL t871 = a[337];
+    const MBPOL_POLY_REAL t875 = t868*t5;
+    const MBPOL_POLY_REAL t876 = t868*t20;
+    const MBPOL_POLY_REAL t877 = t865*t26;
+    const MBPOL_POLY_REAL t878 = t865*t37;
+    const MBPOL_POLY_REAL t879 = a[537];
+    const MBPOL_POLY_REAL t884 = a[177];
+    const MBPOL_POLY_REAL t885 = t884*t50;
+    const MBPOL_POLY_REAL t886 = t884*t67;
+    const MBPOL_POLY_REAL t894 = a[138];
+    const MBPOL_POLY_REAL t895 = t894*t5;
+    const MBPOL_POLY_REAL t896 = a[362];
+    const MBPOL_POLY_REAL t897 = t896*t20;
+    const MBPOL_POLY_REAL t898 = a[52];
+    const MBPOL_POLY_REAL t899 = t894*t26;
+    const MBPOL_POLY_REAL t900 = t896*t37;
+    const MBPOL_POLY_REAL t901 = a[317];
+    const MBPOL_POLY_REAL t902 = t901*t50;
+    const MBPOL_POLY_REAL t903 = t901*t67;
+    const MBPOL_POLY_REAL t904 = a[459];
+    const MBPOL_POLY_REAL t905 = t904*t72;
+    const MBPOL_POLY_REAL t906 = a[519];
+    const MBPOL_POLY_REAL t907 = t906*t73;
+    const MBPOL_POLY_REAL t908 = a[120];
+    const MBPOL_POLY_REAL t912 = a[475];
+    const MBPOL_POLY_REAL t915 = t895+t897+t898+t899+t900+t902+t903+t905+t907+t912*t77+t908*t126;
+    const MBPOL_POLY_REAL t917 = t894*t20;
+    const MBPOL_POLY_REAL t918 = t896*t5;
+    const MBPOL_POLY_REAL t919 = t896*t26;
+    const MBPOL_POLY_REAL t920 = t894*t37;
+    const MBPOL_POLY_REAL t921 = t906*t72;
+    const MBPOL_POLY_REAL t922 = t904*t73;
+    const MBPOL_POLY_REAL t923 = a[501];
+    const MBPOL_POLY_REAL t925 = a[536];
+    const MBPOL_POLY_REAL t928 = t917+t898+t918+t919+t920+t902+t903+t921+t922+t923*t77+t925*t126+t908
 *t132;
-    const double t934 = t917+t898+t918+t919+t920+t902+t903+t921+t922+t925*t77+t923*t126+t912
+    const MBPOL_POLY_REAL t934 = t917+t898+t918+t919+t920+t902+t903+t921+t922+t925*t77+t923*t126+t912
 *t132+t908*t136;
-    const double t936 = t904*t50;
-    const double t937 = t906*t67;
-    const double t938 = t901*t72;
-    const double t939 = t901*t73;
-    const double t940 = a[164];
-    const double t941 = t940*t77;
-    const double t942 = t940*t126;
-    const double t943 = t940*t132;
-    const double t944 = t940*t136;
-    const double t946 = t895+t898+t917+t919+t900+t936+t937+t938+t939+t941+t942+t943+t944+
+    const MBPOL_POLY_REAL t936 = t904*t50;
+    const MBPOL_POLY_REAL t937 = t906*t67;
+    const MBPOL_POLY_REAL t938 = t901*t72;
+    const MBPOL_POLY_REAL t939 = t901*t73;
+    const MBPOL_POLY_REAL t940 = a[164];
+    const MBPOL_POLY_REAL t941 = t940*t77;
+    const MBPOL_POLY_REAL t942 = t940*t126;
+    const MBPOL_POLY_REAL t943 = t940*t132;
+    const MBPOL_POLY_REAL t944 = t940*t136;
+    const MBPOL_POLY_REAL t946 = t895+t898+t917+t919+t900+t936+t937+t938+t939+t941+t942+t943+t944+
 t908*t139;
-    const double t950 = t895+t898+t917+t919+t900+t936+t937+t938+t939+t941+t942+t943+t944+
+    const MBPOL_POLY_REAL t950 = t895+t898+t917+t919+t900+t936+t937+t938+t939+t941+t942+t943+t944+
 t912*t139+t908*t145;
-    const double t952 = t906*t50;
-    const double t953 = t904*t67;
-    const double t957 = t898+t918+t897+t899+t920+t952+t953+t938+t939+t941+t942+t943+t944+
+    const MBPOL_POLY_REAL t952 = t906*t50;
+    const MBPOL_POLY_REAL t953 = t904*t67;
+    const MBPOL_POLY_REAL t957 = t898+t918+t897+t899+t920+t952+t953+t938+t939+t941+t942+t943+t944+
 t923*t139+t925*t145+t908*t146;
-    const double t963 = t898+t918+t897+t899+t920+t952+t953+t938+t939+t941+t942+t943+t944+
+    const MBPOL_POLY_REAL t963 = t898+t918+t897+t899+t920+t952+t953+t938+t939+t941+t942+t943+t944+
 t925*t139+t923*t145+t912*t146+t908*t155;
-    const double t965 = a[199];
-    const double t971 = a[450];
-    const double t976 = a[346];
-    const double t856 = a[508];
-    const double t987 = t965*t5+a[68]+t965*t20+t965*t26+t965*t37+t971*t50+t971*t67+t971*t72+
+    const MBPOL_POLY_REAL t965 = a[199];
+    const MBPOL_POLY_REAL t971 = a[450];
+    const MBPOL_POLY_REAL t976 = a[346];
+    const MBPOL_POLY_REAL t856 = a[508];
+    const MBPOL_POLY_REAL t987 = t965*t5+a[68]+t965*t20+t965*t26+t965*t37+t971*t50+t971*t67+t971*t72+
 t971*t73+t976*t77+t976*t126+t976*t132+t976*t136+t976*t139+t976*t145+t976*t146+
 t976*t155+t856*t179;
-    const double t859 = t844*t5;
-    const double t862 = t844*t20;
-    const double t873 = t853*t20;
-    const double t874 = t844*t26;
-    const double t882 = t848*t20;
-    const double t883 = t853*t5;
-    const double t887 = t848*t26;
-    const double t888 = t844*t37;
-    const double t891 = t871*t50;
-    const double t909 = t879*t50;
-    const double t910 = t871*t67;
-    const double t914 = t871*t72;
-    const double t926 = t879*t72;
-    const double t927 = t871*t73;
-    const double t931 = t908*t77;
-    const double t955 = t987*t179;
-    const double t989 = a[2]+(t843+t859)*t5+(t849+t843+t862)*t20+(t849+t873+t843+t874)*t26+(
+    const MBPOL_POLY_REAL t859 = t844*t5;
+    const MBPOL_POLY_REAL t862 = t844*t20;
+    const MBPOL_POLY_REAL t873 = t853*t20;
+    const MBPOL_POLY_REAL t874 = t844*t26;
+    const MBPOL_POLY_REAL t882 = t848*t20;
+    const MBPOL_POLY_REAL t883 = t853*t5;
+    const MBPOL_POLY_REAL t887 = t848*t26;
+    const MBPOL_POLY_REAL t888 = t844*t37;
+    const MBPOL_POLY_REAL t891 = t871*t50;
+    const MBPOL_POLY_REAL t909 = t879*t50;
+    const MBPOL_POLY_REAL t910 = t871*t67;
+    const MBPOL_POLY_REAL t914 = t871*t72;
+    const MBPOL_POLY_REAL t926 = t879*t72;
+    const MBPOL_POLY_REAL t927 = t871*t73;
+    const MBPOL_POLY_REAL t931 = t908*t77;
+    const MBPOL_POLY_REAL t955 = t987*t179;
+    const MBPOL_POLY_REAL t989 = a[2]+(t843+t859)*t5+(t849+t843+t862)*t20+(t849+t873+t843+t874)*t26+(
 t882+t883+t843+t887+t888)*t37+(t864+t866+t867+t869+t870+t891)*t50+(t875+t864+
 t876+t877+t878+t909+t910)*t67+(t876+t864+t866+t877+t870+t885+t886+t914)*t72+(
 t875+t864+t867+t869+t878+t885+t886+t926+t927)*t73+(t895+t897+t898+t899+t900+
 t902+t903+t905+t907+t931)*t77+t915*t126+t928*t132+t934*t136+t946*t139+t950*t145
 +t957*t146+t963*t155+t955;
-    const double t991 = a[4];
-    const double t992 = a[15];
-    const double t993 = a[77];
-    const double t956 = t993*t5;
-    const double t996 = (t992+t956)*t5;
-    const double t997 = a[488];
-    const double t998 = t997*t5;
-    const double t999 = t993*t20;
-    const double t959 = t998+t992+t999;
-    const double t1001 = t959*t20;
-    const double t1002 = a[455];
-    const double t1003 = t1002*t5;
-    const double t1004 = a[265];
-    const double t1005 = t1004*t20;
-    const double t1006 = t993*t26;
-    const double t960 = t1003+t1005+t992+t1006;
-    const double t1008 = t960*t26;
-    const double t1011 = t1004*t5;
-    const double t1012 = t993*t37;
-    const double t964 = t992+t997*t26+t1002*t20+t1011+t1012;
-    const double t1014 = t964*t37;
-    const double t1015 = a[30];
-    const double t1016 = a[156];
-    const double t1017 = t1016*t5;
-    const double t1018 = t1016*t20;
-    const double t1019 = a[98];
-    const double t1020 = t1019*t26;
-    const double t1021 = t1019*t37;
-    const double t1022 = a[538];
-    const double t966 = t1022*t50;
-    const double t1025 = (t1015+t1017+t1018+t1020+t1021+t966)*t50;
-    const double t1026 = t1019*t5;
-    const double t1027 = t1019*t20;
-    const double t1028 = t1016*t26;
-    const double t1029 = t1016*t37;
-    const double t1030 = a[496];
-    const double t968 = t1030*t50;
-    const double t969 = t1022*t67;
-    const double t1034 = (t1015+t1026+t1027+t1028+t1029+t968+t969)*t67;
-    const double t1035 = a[444];
-    const double t1036 = t1035*t20;
-    const double t1037 = a[123];
-    const double t1038 = t1037*t5;
-    const double t1039 = a[51];
-    const double t1040 = t1037*t26;
-    const double t1041 = t1035*t37;
-    const double t1042 = a[252];
-    const double t1043 = t1042*t50;
-    const double t1044 = t1042*t67;
-    const double t1045 = a[140];
-    const double t972 = t1045*t72;
-    const double t1048 = (t1036+t1038+t1039+t1040+t1041+t1043+t1044+t972)*t72;
-    const double t1049 = t1035*t5;
-    const double t1050 = t1037*t20;
-    const double t1051 = t1035*t26;
-    const double t1052 = t1037*t37;
-    const double t1053 = a[522];
-    const double t974 = t1053*t72;
-    const double t975 = t1045*t73;
-    const double t1057 = (t1049+t1050+t1039+t1051+t1052+t1043+t1044+t974+t975)*t73;
-    const double t1058 = a[342];
-    const double t1059 = t1058*t20;
-    const double t1060 = a[205];
-    const double t1061 = t1060*t5;
-    const double t1062 = a[56];
-    const double t1063 = t1060*t26;
-    const double t1064 = t1058*t37;
-    const double t1065 = a[180];
-    const double t1066 = t1065*t50;
-    const double t1067 = t1065*t67;
-    const double t1068 = a[269];
-    const double t1069 = t1068*t72;
-    const double t1070 = a[158];
-    const double t1071 = t1070*t73;
-    const double t1072 = a[350];
-    const double t978 = t1072*t77;
-    const double t1075 = (t1059+t1061+t1062+t1063+t1064+t1066+t1067+t1069+t1071+t978)*t77;
-    const double t1076 = a[262];
-    const double t1079 = t1059+t1061+t1062+t1063+t1064+t1066+t1067+t1069+t1071+t1076*t77+
+    const MBPOL_POLY_REAL t991 = a[4];
+    const MBPOL_POLY_REAL t992 = a[15];
+    const MBPOL_POLY_REAL t993 = a[77];
+    const MBPOL_POLY_REAL t956 = t993*t5;
+    const MBPOL_POLY_REAL t996 = (t992+t956)*t5;
+    const MBPOL_POLY_REAL t997 = a[488];
+    const MBPOL_POLY_REAL t998 = t997*t5;
+    const MBPOL_POLY_REAL t999 = t993*t20;
+    const MBPOL_POLY_REAL t959 = t998+t992+t999;
+    const MBPOL_POLY_REAL t1001 = t959*t20;
+    const MBPOL_POLY_REAL t1002 = a[455];
+    const MBPOL_POLY_REAL t1003 = t1002*t5;
+    const MBPOL_POLY_REAL t1004 = a[265];
+    const MBPOL_POLY_REAL t1005 = t1004*t20;
+    const MBPOL_POLY_REAL t1006 = t993*t26;
+    const MBPOL_POLY_REAL t960 = t1003+t1005+t992+t1006;
+    const MBPOL_POLY_REAL t1008 = t960*t26;
+    const MBPOL_POLY_REAL t1011 = t1004*t5;
+    const MBPOL_POLY_REAL t1012 = t993*t37;
+    const MBPOL_POLY_REAL t964 = t992+t997*t26+t1002*t20+t1011+t1012;
+    const MBPOL_POLY_REAL t1014 = t964*t37;
+    const MBPOL_POLY_REAL t1015 = a[30];
+    const MBPOL_POLY_REAL t1016 = a[156];
+    const MBPOL_POLY_REAL t1017 = t1016*t5;
+    const MBPOL_POLY_REAL t1018 = t1016*t20;
+    const MBPOL_POLY_REAL t1019 = a[98];
+    const MBPOL_POLY_REAL t1020 = t1019*t26;
+    const MBPOL_POLY_REAL t1021 = t1019*t37;
+    const MBPOL_POLY_REAL t1022 = a[538];
+    const MBPOL_POLY_REAL t966 = t1022*t50;
+    const MBPOL_POLY_REAL t1025 = (t1015+t1017+t1018+t1020+t1021+t966)*t50;
+    const MBPOL_POLY_REAL t1026 = t1019*t5;
+    const MBPOL_POLY_REAL t1027 = t1019*t20;
+    const MBPOL_POLY_REAL t1028 = t1016*t26;
+    const MBPOL_POLY_REAL t1029 = t1016*t37;
+    const MBPOL_POLY_REAL t1030 = a[496];
+    const MBPOL_POLY_REAL t968 = t1030*t50;
+    const MBPOL_POLY_REAL t969 = t1022*t67;
+    const MBPOL_POLY_REAL t1034 = (t1015+t1026+t1027+t1028+t1029+t968+t969)*t67;
+    const MBPOL_POLY_REAL t1035 = a[444];
+    const MBPOL_POLY_REAL t1036 = t1035*t20;
+    const MBPOL_POLY_REAL t1037 = a[123];
+    const MBPOL_POLY_REAL t1038 = t1037*t5;
+    const MBPOL_POLY_REAL t1039 = a[51];
+    const MBPOL_POLY_REAL t1040 = t1037*t26;
+    const MBPOL_POLY_REAL t1041 = t1035*t37;
+    const MBPOL_POLY_REAL t1042 = a[252];
+    const MBPOL_POLY_REAL t1043 = t1042*t50;
+    const MBPOL_POLY_REAL t1044 = t1042*t67;
+    const MBPOL_POLY_REAL t1045 = a[140];
+    const MBPOL_POLY_REAL t972 = t1045*t72;
+    const MBPOL_POLY_REAL t1048 = (t1036+t1038+t1039+t1040+t1041+t1043+t1044+t972)*t72;
+    const MBPOL_POLY_REAL t1049 = t1035*t5;
+    const MBPOL_POLY_REAL t1050 = t1037*t20;
+    const MBPOL_POLY_REAL t1051 = t1035*t26;
+    const MBPOL_POLY_REAL t1052 = t1037*t37;
+    const MBPOL_POLY_REAL t1053 = a[522];
+    const MBPOL_POLY_REAL t974 = t1053*t72;
+    const MBPOL_POLY_REAL t975 = t1045*t73;
+    const MBPOL_POLY_REAL t1057 = (t1049+t1050+t1039+t1051+t1052+t1043+t1044+t974+t975)*t73;
+    const MBPOL_POLY_REAL t1058 = a[342];
+    const MBPOL_POLY_REAL t1059 = t1058*t20;
+    const MBPOL_POLY_REAL t1060 = a[205];
+    const MBPOL_POLY_REAL t1061 = t1060*t5;
+    const MBPOL_POLY_REAL t1062 = a[56];
+    const MBPOL_POLY_REAL t1063 = t1060*t26;
+    const MBPOL_POLY_REAL t1064 = t1058*t37;
+    const MBPOL_POLY_REAL t1065 = a[180];
+    const MBPOL_POLY_REAL t1066 = t1065*t50;
+    const MBPOL_POLY_REAL t1067 = t1065*t67;
+    const MBPOL_POLY_REAL t1068 = a[269];
+    const MBPOL_POLY_REAL t1069 = t1068*t72;
+    const MBPOL_POLY_REAL t1070 = a[158];
+    const MBPOL_POLY_REAL t1071 = t1070*t73;
+    const MBPOL_POLY_REAL t1072 = a[350];
+    const MBPOL_POLY_REAL t978 = t1072*t77;
+    const MBPOL_POLY_REAL t1075 = (t1059+t1061+t1062+t1063+t1064+t1066+t1067+t1069+t1071+t978)*t77;
+    const MBPOL_POLY_REAL t1076 = a[262];
+    const MBPOL_POLY_REAL t1079 = t1059+t1061+t1062+t1063+t1064+t1066+t1067+t1069+t1071+t1076*t77+
 t1072*t126;
-    const double t1080 = t1079*t126;
-    const double t1081 = t991+t996+t1001+t1008+t1014+t1025+t1034+t1048+t1057+t1075+t1080;
-    const double t1082 = t1060*t20;
-    const double t1083 = t1058*t5;
-    const double t1084 = t1058*t26;
-    const double t1085 = t1060*t37;
-    const double t1086 = t1070*t72;
-    const double t1087 = t1068*t73;
-    const double t1088 = a[507];
-    const double t1090 = a[234];
-    const double t1093 = t1082+t1062+t1083+t1084+t1085+t1066+t1067+t1086+t1087+t1088*t77+
+    const MBPOL_POLY_REAL t1080 = t1079*t126;
+    const MBPOL_POLY_REAL t1081 = t991+t996+t1001+t1008+t1014+t1025+t1034+t1048+t1057+t1075+t1080;
+    const MBPOL_POLY_REAL t1082 = t1060*t20;
+    const MBPOL_POLY_REAL t1083 = t1058*t5;
+    const MBPOL_POLY_REAL t1084 = t1058*t26;
+    const MBPOL_POLY_REAL t1085 = t1060*t37;
+    const MBPOL_POLY_REAL t1086 = t1070*t72;
+    const MBPOL_POLY_REAL t1087 = t1068*t73;
+    const MBPOL_POLY_REAL t1088 = a[507];
+    const MBPOL_POLY_REAL t1090 = a[234];
+    const MBPOL_POLY_REAL t1093 = t1082+t1062+t1083+t1084+t1085+t1066+t1067+t1086+t1087+t1088*t77+
 t1090*t126+t1072*t132;
-    const double t1094 = t1093*t132;
-    const double t1099 = t1082+t1062+t1083+t1084+t1085+t1066+t1067+t1086+t1087+t1090*t77+
+    const MBPOL_POLY_REAL t1094 = t1093*t132;
+    const MBPOL_POLY_REAL t1099 = t1082+t1062+t1083+t1084+t1085+t1066+t1067+t1086+t1087+t1090*t77+
 t1088*t126+t1076*t132+t1072*t136;
-    const double t1100 = t1099*t136;
-    const double t1101 = a[116];
-    const double t1102 = t1101*t5;
-    const double t1103 = a[32];
-    const double t1104 = t1101*t20;
-    const double t1105 = a[125];
-    const double t1106 = t1105*t26;
-    const double t1107 = t1105*t37;
-    const double t1108 = a[85];
-    const double t1109 = t1108*t50;
-    const double t1110 = a[391];
-    const double t1111 = t1110*t67;
-    const double t1112 = a[112];
-    const double t1113 = t1112*t72;
-    const double t1114 = t1112*t73;
-    const double t1115 = a[295];
-    const double t1116 = t1115*t77;
-    const double t1117 = t1115*t126;
-    const double t1118 = t1115*t132;
-    const double t1119 = t1115*t136;
-    const double t1120 = a[230];
-    const double t1122 = t1102+t1103+t1104+t1106+t1107+t1109+t1111+t1113+t1114+t1116+t1117+
+    const MBPOL_POLY_REAL t1100 = t1099*t136;
+    const MBPOL_POLY_REAL t1101 = a[116];
+    const MBPOL_POLY_REAL t1102 = t1101*t5;
+    const MBPOL_POLY_REAL t1103 = a[32];
+    const MBPOL_POLY_REAL t1104 = t1101*t20;
+    const MBPOL_POLY_REAL t1105 = a[125];
+    const MBPOL_POLY_REAL t1106 = t1105*t26;
+    const MBPOL_POLY_REAL t1107 = t1105*t37;
+    const MBPOL_POLY_REAL t1108 = a[85];
+    const MBPOL_POLY_REAL t1109 = t1108*t50;
+    const MBPOL_POLY_REAL t1110 = a[391];
+    const MBPOL_POLY_REAL t1111 = t1110*t67;
+    const MBPOL_POLY_REAL t1112 = a[112];
+    const MBPOL_POLY_REAL t1113 = t1112*t72;
+    const MBPOL_POLY_REAL t1114 = t1112*t73;
+    const MBPOL_POLY_REAL t1115 = a[295];
+    const MBPOL_POLY_REAL t1116 = t1115*t77;
+    const MBPOL_POLY_REAL t1117 = t1115*t126;
+    const MBPOL_POLY_REAL t1118 = t1115*t132;
+    const MBPOL_POLY_REAL t1119 = t1115*t136;
+    const MBPOL_POLY_REAL t1120 = a[230];
+    const MBPOL_POLY_REAL t1122 = t1102+t1103+t1104+t1106+t1107+t1109+t1111+t1113+t1114+t1116+t1117+
 t1118+t1119+t1120*t139;
-    const double t1124 = a[53];
-    const double t1125 = a[69];
-    const double t1126 = t1125*t5;
-    const double t1127 = t1125*t20;
-    const double t1128 = a[324];
-    const double t1129 = t1128*t26;
-    const double t1130 = t1128*t37;
-    const double t1131 = a[227];
-    const double t1132 = t1131*t50;
-    const double t1133 = a[95];
-    const double t1134 = t1133*t67;
-    const double t1135 = a[70];
-    const double t1136 = t1135*t72;
-    const double t1137 = t1135*t73;
-    const double t1138 = a[74];
-    const double t1139 = t1138*t77;
-    const double t1140 = t1138*t126;
-    const double t1141 = t1138*t132;
-    const double t1142 = t1138*t136;
-    const double t1143 = a[309];
-    const double t1144 = t1143*t139;
-    const double t1145 = a[86];
-    const double t1147 = t1124+t1126+t1127+t1129+t1130+t1132+t1134+t1136+t1137+t1139+t1140+
+    const MBPOL_POLY_REAL t1124 = a[53];
+    const MBPOL_POLY_REAL t1125 = a[69];
+    const MBPOL_POLY_REAL t1126 = t1125*t5;
+    const MBPOL_POLY_REAL t1127 = t1125*t20;
+    const MBPOL_POLY_REAL t1128 = a[324];
+    const MBPOL_POLY_REAL t1129 = t1128*t26;
+    const MBPOL_POLY_REAL t1130 = t1128*t37;
+    const MBPOL_POLY_REAL t1131 = a[227];
+    const MBPOL_POLY_REAL t1132 = t1131*t50;
+    const MBPOL_POLY_REAL t1133 = a[95];
+    const MBPOL_POLY_REAL t1134 = t1133*t67;
+    const MBPOL_POLY_REAL t1135 = a[70];
+    const MBPOL_POLY_REAL t1136 = t1135*t72;
+    const MBPOL_POLY_REAL t1137 = t1135*t73;
+    const MBPOL_POLY_REAL t1138 = a[74];
+    const MBPOL_POLY_REAL t1139 = t1138*t77;
+    const MBPOL_POLY_REAL t1140 = t1138*t126;
+    const MBPOL_POLY_REAL t1141 = t1138*t132;
+    const MBPOL_POLY_REAL t1142 = t1138*t136;
+    const MBPOL_POLY_REAL t1143 = a[309];
+    const MBPOL_POLY_REAL t1144 = t1143*t139;
+    const MBPOL_POLY_REAL t1145 = a[86];
+    const MBPOL_POLY_REAL t1147 = t1124+t1126+t1127+t1129+t1130+t1132+t1134+t1136+t1137+t1139+t1140+
 t1141+t1142+t1144+t1145*t145;
-    const double t1149 = t1105*t5;
-    const double t1150 = t1105*t20;
-    const double t1151 = t1101*t26;
-    const double t1152 = t1101*t37;
-    const double t1153 = t1110*t50;
-    const double t1154 = t1108*t67;
-    const double t1155 = a[467];
-    const double t1157 = a[424];
-    const double t1158 = t1157*t145;
-    const double t1160 = t1103+t1149+t1150+t1151+t1152+t1153+t1154+t1113+t1114+t1116+t1117+
+    const MBPOL_POLY_REAL t1149 = t1105*t5;
+    const MBPOL_POLY_REAL t1150 = t1105*t20;
+    const MBPOL_POLY_REAL t1151 = t1101*t26;
+    const MBPOL_POLY_REAL t1152 = t1101*t37;
+    const MBPOL_POLY_REAL t1153 = t1110*t50;
+    const MBPOL_POLY_REAL t1154 = t1108*t67;
+    const MBPOL_POLY_REAL t1155 = a[467];
+    const MBPOL_POLY_REAL t1157 = a[424];
+    const MBPOL_POLY_REAL t1158 = t1157*t145;
+    const MBPOL_POLY_REAL t1160 = t1103+t1149+t1150+t1151+t1152+t1153+t1154+t1113+t1114+t1116+t1117+
 t1118+t1119+t1155*t139+t1158+t1120*t146;
-    const double t1162 = t1128*t5;
-    const double t1163 = t1128*t20;
-    const double t1164 = t1125*t26;
-    const double t1165 = t1125*t37;
-    const double t1166 = t1133*t50;
-    const double t1167 = t1131*t67;
-    const double t1168 = t1157*t139;
-    const double t1169 = a[239];
-    const double t1171 = t1143*t146;
-    const double t1173 = t1124+t1162+t1163+t1164+t1165+t1166+t1167+t1136+t1137+t1139+t1140+
+    const MBPOL_POLY_REAL t1162 = t1128*t5;
+    const MBPOL_POLY_REAL t1163 = t1128*t20;
+    const MBPOL_POLY_REAL t1164 = t1125*t26;
+    const MBPOL_POLY_REAL t1165 = t1125*t37;
+    const MBPOL_POLY_REAL t1166 = t1133*t50;
+    const MBPOL_POLY_REAL t1167 = t1131*t67;
+    const MBPOL_POLY_REAL t1168 = t1157*t139;
+    const MBPOL_POLY_REAL t1169 = a[239];
+    const MBPOL_POLY_REAL t1171 = t1143*t146;
+    const MBPOL_POLY_REAL t1173 = t1124+t1162+t1163+t1164+t1165+t1166+t1167+t1136+t1137+t1139+t1140+
 t1141+t1142+t1168+t1169*t145+t1171+t1145*t155;
-    const double t1175 = a[169];
-    const double t1176 = t1175*t5;
-    const double t1177 = a[18];
-    const double t1178 = t1175*t20;
-    const double t1179 = t1175*t26;
-    const double t1180 = t1175*t37;
-    const double t1181 = a[152];
-    const double t1182 = t1181*t50;
-    const double t1183 = t1181*t67;
-    const double t1184 = a[130];
-    const double t1185 = t1184*t72;
-    const double t1186 = t1184*t73;
-    const double t1187 = a[93];
-    const double t1188 = t1187*t77;
-    const double t1189 = t1187*t126;
-    const double t1190 = t1187*t132;
-    const double t1191 = t1187*t136;
-    const double t1192 = a[540];
-    const double t1194 = a[452];
-    const double t1013 = a[503];
-    const double t1199 = t1013*t179;
-    const double t1200 = t1176+t1177+t1178+t1179+t1180+t1182+t1183+t1185+t1186+t1188+t1189+
+    const MBPOL_POLY_REAL t1175 = a[169];
+    const MBPOL_POLY_REAL t1176 = t1175*t5;
+    const MBPOL_POLY_REAL t1177 = a[18];
+    const MBPOL_POLY_REAL t1178 = t1175*t20;
+    const MBPOL_POLY_REAL t1179 = t1175*t26;
+    const MBPOL_POLY_REAL t1180 = t1175*t37;
+    const MBPOL_POLY_REAL t1181 = a[152];
+    const MBPOL_POLY_REAL t1182 = t1181*t50;
+    const MBPOL_POLY_REAL t1183 = t1181*t67;
+    const MBPOL_POLY_REAL t1184 = a[130];
+    const MBPOL_POLY_REAL t1185 = t1184*t72;
+    const MBPOL_POLY_REAL t1186 = t1184*t73;
+    const MBPOL_POLY_REAL t1187 = a[93];
+    const MBPOL_POLY_REAL t1188 = t1187*t77;
+    const MBPOL_POLY_REAL t1189 = t1187*t126;
+    const MBPOL_POLY_REAL t1190 = t1187*t132;
+    const MBPOL_POLY_REAL t1191 = t1187*t136;
+    const MBPOL_POLY_REAL t1192 = a[540];
+    const MBPOL_POLY_REAL t1194 = a[452];
+    const MBPOL_POLY_REAL t1013 = a[503];
+    const MBPOL_POLY_REAL t1199 = t1013*t179;
+    const MBPOL_POLY_REAL t1200 = t1176+t1177+t1178+t1179+t1180+t1182+t1183+t1185+t1186+t1188+t1189+
 t1190+t1191+t1192*t139+t1194*t145+t1192*t146+t1194*t155+t1199;
-    const double t1202 = a[42];
-    const double t1203 = a[313];
-    const double t1204 = t1203*t5;
-    const double t1205 = t1203*t20;
-    const double t1206 = t1203*t26;
-    const double t1207 = t1203*t37;
-    const double t1208 = a[88];
-    const double t1209 = t1208*t50;
-    const double t1210 = t1208*t67;
-    const double t1211 = t1208*t72;
-    const double t1212 = t1208*t73;
-    const double t1213 = a[339];
-    const double t1214 = t1213*t77;
-    const double t1215 = a[171];
-    const double t1216 = t1215*t126;
-    const double t1217 = t1213*t132;
-    const double t1218 = t1215*t136;
-    const double t1219 = t1215*t139;
-    const double t1220 = t1213*t145;
-    const double t1221 = t1215*t146;
-    const double t1222 = t1213*t155;
-    const double t1033 = a[266];
-    const double t1224 = t1033*t179;
-    const double t1225 = a[416];
-    const double t1226 = t1225*t275;
-    const double t1227 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1214+t1216+
+    const MBPOL_POLY_REAL t1202 = a[42];
+    const MBPOL_POLY_REAL t1203 = a[313];
+    const MBPOL_POLY_REAL t1204 = t1203*t5;
+    const MBPOL_POLY_REAL t1205 = t1203*t20;
+    const MBPOL_POLY_REAL t1206 = t1203*t26;
+    const MBPOL_POLY_REAL t1207 = t1203*t37;
+    const MBPOL_POLY_REAL t1208 = a[88];
+    const MBPOL_POLY_REAL t1209 = t1208*t50;
+    const MBPOL_POLY_REAL t1210 = t1208*t67;
+    const MBPOL_POLY_REAL t1211 = t1208*t72;
+    const MBPOL_POLY_REAL t1212 = t1208*t73;
+    const MBPOL_POLY_REAL t1213 = a[339];
+    const MBPOL_POLY_REAL t1214 = t1213*t77;
+    const MBPOL_POLY_REAL t1215 = a[171];
+    const MBPOL_POLY_REAL t1216 = t1215*t126;
+    const MBPOL_POLY_REAL t1217 = t1213*t132;
+    const MBPOL_POLY_REAL t1218 = t1215*t136;
+    const MBPOL_POLY_REAL t1219 = t1215*t139;
+    const MBPOL_POLY_REAL t1220 = t1213*t145;
+    const MBPOL_POLY_REAL t1221 = t1215*t146;
+    const MBPOL_POLY_REAL t1222 = t1213*t155;
+    const MBPOL_POLY_REAL t1033 = a[266];
+    const MBPOL_POLY_REAL t1224 = t1033*t179;
+    const MBPOL_POLY_REAL t1225 = a[416];
+    const MBPOL_POLY_REAL t1226 = t1225*t275;
+    const MBPOL_POLY_REAL t1227 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1214+t1216+
 t1217+t1218+t1219+t1220+t1221+t1222+t1224+t1226;
-    const double t1229 = t1215*t77;
-    const double t1230 = t1213*t126;
-    const double t1231 = t1215*t132;
-    const double t1232 = t1213*t136;
-    const double t1233 = a[514];
-    const double t1234 = t1233*t275;
-    const double t1235 = t1225*t254;
-    const double t1236 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1229+t1230+
+    const MBPOL_POLY_REAL t1229 = t1215*t77;
+    const MBPOL_POLY_REAL t1230 = t1213*t126;
+    const MBPOL_POLY_REAL t1231 = t1215*t132;
+    const MBPOL_POLY_REAL t1232 = t1213*t136;
+    const MBPOL_POLY_REAL t1233 = a[514];
+    const MBPOL_POLY_REAL t1234 = t1233*t275;
+    const MBPOL_POLY_REAL t1235 = t1225*t254;
+    const MBPOL_POLY_REAL t1236 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1229+t1230+
 t1231+t1232+t1219+t1220+t1221+t1222+t1224+t1234+t1235;
-    const double t1238 = a[254];
-    const double t1239 = t1238*t5;
-    const double t1240 = a[19];
-    const double t1241 = t1238*t20;
-    const double t1242 = t1238*t26;
-    const double t1243 = t1238*t37;
-    const double t1244 = a[550];
-    const double t1247 = a[377];
-    const double t1250 = a[136];
-    const double t1256 = a[439];
-    const double t1046 = a[531];
-    const double t1262 = t1046*t179;
-    const double t1264 = a[499];
-    const double t1265 = t1264*t212;
-    const double t1266 = t1250*t126+t1250*t132+t1250*t136+t1256*t139+t1256*t145+t1256*t146+
+    const MBPOL_POLY_REAL t1238 = a[254];
+    const MBPOL_POLY_REAL t1239 = t1238*t5;
+    const MBPOL_POLY_REAL t1240 = a[19];
+    const MBPOL_POLY_REAL t1241 = t1238*t20;
+    const MBPOL_POLY_REAL t1242 = t1238*t26;
+    const MBPOL_POLY_REAL t1243 = t1238*t37;
+    const MBPOL_POLY_REAL t1244 = a[550];
+    const MBPOL_POLY_REAL t1247 = a[377];
+    const MBPOL_POLY_REAL t1250 = a[136];
+    const MBPOL_POLY_REAL t1256 = a[439];
+    const MBPOL_POLY_REAL t1046 = a[531];
+    const MBPOL_POLY_REAL t1262 = t1046*t179;
+    const MBPOL_POLY_REAL t1264 = a[499];
+    const MBPOL_POLY_REAL t1265 = t1264*t212;
+    const MBPOL_POLY_REAL t1266 = t1250*t126+t1250*t132+t1250*t136+t1256*t139+t1256*t145+t1256*t146+
 t1256*t155+t1262+t1234+t1233*t254+t1265;
-    const double t1269 = a[65];
-    const double t1270 = a[258];
-    const double t1271 = t1270*t5;
-    const double t1272 = t1270*t20;
-    const double t1273 = t1270*t26;
-    const double t1274 = t1270*t37;
-    const double t1275 = a[163];
-    const double t1276 = t1275*t50;
-    const double t1277 = t1275*t67;
-    const double t1278 = a[225];
-    const double t1279 = t1278*t72;
-    const double t1280 = t1278*t73;
-    const double t1281 = a[114];
-    const double t1282 = t1281*t77;
-    const double t1283 = t1281*t126;
-    const double t1284 = t1269+t1271+t1272+t1273+t1274+t1276+t1277+t1279+t1280+t1282+t1283;
-    const double t1285 = t1281*t132;
-    const double t1286 = t1281*t136;
-    const double t1287 = a[149];
-    const double t1289 = a[221];
-    const double t1089 = a[394];
-    const double t1294 = t1089*t179;
-    const double t1295 = a[513];
-    const double t1297 = t1285+t1286+t1287*t139+t1289*t145+t1287*t146+t1289*t155+t1294+t1226
+    const MBPOL_POLY_REAL t1269 = a[65];
+    const MBPOL_POLY_REAL t1270 = a[258];
+    const MBPOL_POLY_REAL t1271 = t1270*t5;
+    const MBPOL_POLY_REAL t1272 = t1270*t20;
+    const MBPOL_POLY_REAL t1273 = t1270*t26;
+    const MBPOL_POLY_REAL t1274 = t1270*t37;
+    const MBPOL_POLY_REAL t1275 = a[163];
+    const MBPOL_POLY_REAL t1276 = t1275*t50;
+    const MBPOL_POLY_REAL t1277 = t1275*t67;
+    const MBPOL_POLY_REAL t1278 = a[225];
+    const MBPOL_POLY_REAL t1279 = t1278*t72;
+    const MBPOL_POLY_REAL t1280 = t1278*t73;
+    const MBPOL_POLY_REAL t1281 = a[114];
+    const MBPOL_POLY_REAL t1282 = t1281*t77;
+    const MBPOL_POLY_REAL t1283 = t1281*t126;
+    const MBPOL_POLY_REAL t1284 = t1269+t1271+t1272+t1273+t1274+t1276+t1277+t1279+t1280+t1282+t1283;
+    const MBPOL_POLY_REAL t1285 = t1281*t132;
+    const MBPOL_POLY_REAL t1286 = t1281*t136;
+    const MBPOL_POLY_REAL t1287 = a[149];
+    const MBPOL_POLY_REAL t1289 = a[221];
+    const MBPOL_POLY_REAL t1089 = a[394];
+    const MBPOL_POLY_REAL t1294 = t1089*t179;
+    const MBPOL_POLY_REAL t1295 = a[513];
+    const MBPOL_POLY_REAL t1297 = t1285+t1286+t1287*t139+t1289*t145+t1287*t146+t1289*t155+t1294+t1226
 +t1235+t1265+t1295*t215;
-    const double t1195 = t1239+t1240+t1241+t1242+t1243+t1244*t50+t1244*t67+t1247*t72+t1247*
+    const MBPOL_POLY_REAL t1195 = t1239+t1240+t1241+t1242+t1243+t1244*t50+t1244*t67+t1247*t72+t1247*
 t73+t1250*t77+t1266;
-    const double t1198 = (t1284+t1297)*t215;
-    const double t1300 = t1094+t1100+t1122*t139+t1147*t145+t1160*t146+t1173*t155+t1200*t179+
+    const MBPOL_POLY_REAL t1198 = (t1284+t1297)*t215;
+    const MBPOL_POLY_REAL t1300 = t1094+t1100+t1122*t139+t1147*t145+t1160*t146+t1173*t155+t1200*t179+
 t1227*t275+t1236*t254+t1195*t212+t1198;
-    const double t1303 = a[27];
-    const double t1304 = a[396];
-    const double t1305 = t1304*t5;
-    const double t1306 = a[146];
-    const double t1307 = t1306*t20;
-    const double t1201 = t1003+t992+t999;
-    const double t1316 = t1201*t20;
-    const double t1223 = t998+t1005+t992+t1006;
-    const double t1318 = t1223*t26;
-    const double t1245 = t1011+t992+t1002*t26+t997*t20+t1012;
-    const double t1322 = t1245*t37;
-    const double t1246 = t1045*t50;
-    const double t1325 = (t1038+t1039+t1050+t1051+t1041+t1246)*t50;
-    const double t1249 = t1053*t50;
-    const double t1251 = t1045*t67;
-    const double t1329 = (t1039+t1049+t1036+t1040+t1052+t1249+t1251)*t67;
-    const double t1253 = t1022*t72;
-    const double t1332 = (t1015+t1017+t1027+t1028+t1021+t1043+t1044+t1253)*t72;
-    const double t1255 = t1030*t72;
-    const double t1257 = t1022*t73;
-    const double t1336 = (t1015+t1026+t1018+t1020+t1029+t1043+t1044+t1255+t1257)*t73;
-    const double t1337 = t1135*t50;
-    const double t1338 = t1135*t67;
-    const double t1339 = t1131*t72;
-    const double t1340 = t1133*t73;
-    const double t1344 = t1112*t50;
-    const double t1345 = t1112*t67;
-    const double t1346 = t1108*t72;
-    const double t1347 = t1110*t73;
-    const double t1348 = t1143*t77;
-    const double t1350 = t1150+t1102+t1103+t1151+t1107+t1344+t1345+t1346+t1347+t1348+t1120*
+    const MBPOL_POLY_REAL t1303 = a[27];
+    const MBPOL_POLY_REAL t1304 = a[396];
+    const MBPOL_POLY_REAL t1305 = t1304*t5;
+    const MBPOL_POLY_REAL t1306 = a[146];
+    const MBPOL_POLY_REAL t1307 = t1306*t20;
+    const MBPOL_POLY_REAL t1201 = t1003+t992+t999;
+    const MBPOL_POLY_REAL t1316 = t1201*t20;
+    const MBPOL_POLY_REAL t1223 = t998+t1005+t992+t1006;
+    const MBPOL_POLY_REAL t1318 = t1223*t26;
+    const MBPOL_POLY_REAL t1245 = t1011+t992+t1002*t26+t997*t20+t1012;
+    const MBPOL_POLY_REAL t1322 = t1245*t37;
+    const MBPOL_POLY_REAL t1246 = t1045*t50;
+    const MBPOL_POLY_REAL t1325 = (t1038+t1039+t1050+t1051+t1041+t1246)*t50;
+    const MBPOL_POLY_REAL t1249 = t1053*t50;
+    const MBPOL_POLY_REAL t1251 = t1045*t67;
+    const MBPOL_POLY_REAL t1329 = (t1039+t1049+t1036+t1040+t1052+t1249+t1251)*t67;
+    const MBPOL_POLY_REAL t1253 = t1022*t72;
+    const MBPOL_POLY_REAL t1332 = (t1015+t1017+t1027+t1028+t1021+t1043+t1044+t1253)*t72;
+    const MBPOL_POLY_REAL t1255 = t1030*t72;
+    const MBPOL_POLY_REAL t1257 = t1022*t73;
+    const MBPOL_POLY_REAL t1336 = (t1015+t1026+t1018+t1020+t1029+t1043+t1044+t1255+t1257)*t73;
+    const MBPOL_POLY_REAL t1337 = t1135*t50;
+    const MBPOL_POLY_REAL t1338 = t1135*t67;
+    const MBPOL_POLY_REAL t1339 = t1131*t72;
+    const MBPOL_POLY_REAL t1340 = t1133*t73;
+    const MBPOL_POLY_REAL t1344 = t1112*t50;
+    const MBPOL_POLY_REAL t1345 = t1112*t67;
+    const MBPOL_POLY_REAL t1346 = t1108*t72;
+    const MBPOL_POLY_REAL t1347 = t1110*t73;
+    const MBPOL_POLY_REAL t1348 = t1143*t77;
+    const MBPOL_POLY_REAL t1350 = t1150+t1102+t1103+t1151+t1107+t1344+t1345+t1346+t1347+t1348+t1120*
 t126;
-    const double t1352 = t1133*t72;
-    const double t1353 = t1131*t73;
-    const double t1355 = t1157*t126;
-    const double t1357 = t1124+t1127+t1162+t1129+t1165+t1337+t1338+t1352+t1353+t1169*t77+
+    const MBPOL_POLY_REAL t1352 = t1133*t72;
+    const MBPOL_POLY_REAL t1353 = t1131*t73;
+    const MBPOL_POLY_REAL t1355 = t1157*t126;
+    const MBPOL_POLY_REAL t1357 = t1124+t1127+t1162+t1129+t1165+t1337+t1338+t1352+t1353+t1169*t77+
 t1355+t1145*t132;
-    const double t1359 = t1110*t72;
-    const double t1360 = t1108*t73;
-    const double t1361 = t1157*t77;
-    const double t1363 = t1143*t132;
-    const double t1365 = t1103+t1104+t1149+t1106+t1152+t1344+t1345+t1359+t1360+t1361+t1155*
+    const MBPOL_POLY_REAL t1359 = t1110*t72;
+    const MBPOL_POLY_REAL t1360 = t1108*t73;
+    const MBPOL_POLY_REAL t1361 = t1157*t77;
+    const MBPOL_POLY_REAL t1363 = t1143*t132;
+    const MBPOL_POLY_REAL t1365 = t1103+t1104+t1149+t1106+t1152+t1344+t1345+t1359+t1360+t1361+t1155*
 t126+t1363+t1120*t136;
-    const double t1367 = t1068*t50;
-    const double t1368 = t1070*t67;
-    const double t1369 = t1065*t72;
-    const double t1370 = t1065*t73;
-    const double t1371 = t1072*t139;
-    const double t1372 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1139+t1117+
+    const MBPOL_POLY_REAL t1367 = t1068*t50;
+    const MBPOL_POLY_REAL t1368 = t1070*t67;
+    const MBPOL_POLY_REAL t1369 = t1065*t72;
+    const MBPOL_POLY_REAL t1370 = t1065*t73;
+    const MBPOL_POLY_REAL t1371 = t1072*t139;
+    const MBPOL_POLY_REAL t1372 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1139+t1117+
 t1141+t1119+t1371;
-    const double t1374 = t1076*t139;
-    const double t1375 = t1072*t145;
-    const double t1376 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1139+t1117+
+    const MBPOL_POLY_REAL t1374 = t1076*t139;
+    const MBPOL_POLY_REAL t1375 = t1072*t145;
+    const MBPOL_POLY_REAL t1376 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1139+t1117+
 t1141+t1119+t1374+t1375;
-    const double t1378 = t1070*t50;
-    const double t1379 = t1068*t67;
-    const double t1380 = t1088*t139;
-    const double t1381 = t1090*t145;
-    const double t1382 = t1072*t146;
-    const double t1383 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1139+t1117+
+    const MBPOL_POLY_REAL t1378 = t1070*t50;
+    const MBPOL_POLY_REAL t1379 = t1068*t67;
+    const MBPOL_POLY_REAL t1380 = t1088*t139;
+    const MBPOL_POLY_REAL t1381 = t1090*t145;
+    const MBPOL_POLY_REAL t1382 = t1072*t146;
+    const MBPOL_POLY_REAL t1383 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1139+t1117+
 t1141+t1119+t1380+t1381+t1382;
-    const double t1385 = t1090*t139;
-    const double t1386 = t1088*t145;
-    const double t1387 = t1076*t146;
-    const double t1388 = t1072*t155;
-    const double t1389 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1139+t1117+
+    const MBPOL_POLY_REAL t1385 = t1090*t139;
+    const MBPOL_POLY_REAL t1386 = t1088*t145;
+    const MBPOL_POLY_REAL t1387 = t1076*t146;
+    const MBPOL_POLY_REAL t1388 = t1072*t155;
+    const MBPOL_POLY_REAL t1389 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1139+t1117+
 t1141+t1119+t1385+t1386+t1387+t1388;
-    const double t1391 = t1184*t50;
-    const double t1392 = t1184*t67;
-    const double t1393 = t1181*t72;
-    const double t1394 = t1181*t73;
-    const double t1399 = t1187*t139;
-    const double t1400 = t1187*t145;
-    const double t1401 = t1187*t146;
-    const double t1402 = t1187*t155;
-    const double t1403 = t1176+t1177+t1178+t1179+t1180+t1391+t1392+t1393+t1394+t1194*t77+
+    const MBPOL_POLY_REAL t1391 = t1184*t50;
+    const MBPOL_POLY_REAL t1392 = t1184*t67;
+    const MBPOL_POLY_REAL t1393 = t1181*t72;
+    const MBPOL_POLY_REAL t1394 = t1181*t73;
+    const MBPOL_POLY_REAL t1399 = t1187*t139;
+    const MBPOL_POLY_REAL t1400 = t1187*t145;
+    const MBPOL_POLY_REAL t1401 = t1187*t146;
+    const MBPOL_POLY_REAL t1402 = t1187*t155;
+    const MBPOL_POLY_REAL t1403 = t1176+t1177+t1178+t1179+t1180+t1391+t1392+t1393+t1394+t1194*t77+
 t1192*t126+t1194*t132+t1192*t136+t1399+t1400+t1401+t1402+t1199;
-    const double t1405 = t1278*t50;
-    const double t1406 = t1278*t67;
-    const double t1407 = t1275*t72;
-    const double t1408 = t1275*t73;
-    const double t1413 = t1281*t139;
-    const double t1414 = t1281*t145;
-    const double t1415 = t1281*t146;
-    const double t1416 = t1281*t155;
-    const double t1418 = t1269+t1271+t1272+t1273+t1274+t1405+t1406+t1407+t1408+t1289*t77+
+    const MBPOL_POLY_REAL t1405 = t1278*t50;
+    const MBPOL_POLY_REAL t1406 = t1278*t67;
+    const MBPOL_POLY_REAL t1407 = t1275*t72;
+    const MBPOL_POLY_REAL t1408 = t1275*t73;
+    const MBPOL_POLY_REAL t1413 = t1281*t139;
+    const MBPOL_POLY_REAL t1414 = t1281*t145;
+    const MBPOL_POLY_REAL t1415 = t1281*t146;
+    const MBPOL_POLY_REAL t1416 = t1281*t155;
+    const MBPOL_POLY_REAL t1418 = t1269+t1271+t1272+t1273+t1274+t1405+t1406+t1407+t1408+t1289*t77+
 t1287*t126+t1289*t132+t1287*t136+t1413+t1414+t1415+t1416+t1294+t1295*t275;
-    const double t1301 = t1145*t77;
-    const double t1319 = t1418*t275;
-    const double t1420 = t991+t996+t1316+t1318+t1322+t1325+t1329+t1332+t1336+(t1163+t1124+
+    const MBPOL_POLY_REAL t1301 = t1145*t77;
+    const MBPOL_POLY_REAL t1319 = t1418*t275;
+    const MBPOL_POLY_REAL t1420 = t991+t996+t1316+t1318+t1322+t1325+t1329+t1332+t1336+(t1163+t1124+
 t1126+t1164+t1130+t1337+t1338+t1339+t1340+t1301)*t77+t1350*t126+t1357*t132+
 t1365*t136+t1372*t139+t1376*t145+t1383*t146+t1389*t155+t1403*t179+t1319;
-    const double t1422 = a[375];
-    const double t1423 = t1422*t5;
-    const double t1424 = a[25];
-    const double t1425 = a[166];
-    const double t1426 = t1425*t20;
-    const double t1427 = t1422*t26;
-    const double t1428 = t1425*t37;
-    const double t1429 = a[191];
-    const double t1430 = t1429*t50;
-    const double t1431 = t1429*t67;
-    const double t1432 = a[389];
-    const double t1433 = t1432*t72;
-    const double t1434 = a[249];
-    const double t1435 = t1434*t73;
-    const double t1436 = a[335];
-    const double t1440 = a[151];
-    const double t1441 = t1440*t5;
-    const double t1442 = a[267];
-    const double t1443 = t1442*t20;
-    const double t1444 = a[41];
-    const double t1445 = t1440*t26;
-    const double t1446 = t1442*t37;
-    const double t1447 = a[193];
-    const double t1448 = t1447*t50;
-    const double t1449 = t1447*t67;
-    const double t1450 = a[323];
-    const double t1451 = t1450*t72;
-    const double t1452 = a[410];
-    const double t1453 = t1452*t73;
-    const double t1454 = a[109];
-    const double t1455 = t1454*t77;
-    const double t1456 = a[222];
-    const double t1458 = t1441+t1443+t1444+t1445+t1446+t1448+t1449+t1451+t1453+t1455+t1456*
+    const MBPOL_POLY_REAL t1422 = a[375];
+    const MBPOL_POLY_REAL t1423 = t1422*t5;
+    const MBPOL_POLY_REAL t1424 = a[25];
+    const MBPOL_POLY_REAL t1425 = a[166];
+    const MBPOL_POLY_REAL t1426 = t1425*t20;
+    const MBPOL_POLY_REAL t1427 = t1422*t26;
+    const MBPOL_POLY_REAL t1428 = t1425*t37;
+    const MBPOL_POLY_REAL t1429 = a[191];
+    const MBPOL_POLY_REAL t1430 = t1429*t50;
+    const MBPOL_POLY_REAL t1431 = t1429*t67;
+    const MBPOL_POLY_REAL t1432 = a[389];
+    const MBPOL_POLY_REAL t1433 = t1432*t72;
+    const MBPOL_POLY_REAL t1434 = a[249];
+    const MBPOL_POLY_REAL t1435 = t1434*t73;
+    const MBPOL_POLY_REAL t1436 = a[335];
+    const MBPOL_POLY_REAL t1440 = a[151];
+    const MBPOL_POLY_REAL t1441 = t1440*t5;
+    const MBPOL_POLY_REAL t1442 = a[267];
+    const MBPOL_POLY_REAL t1443 = t1442*t20;
+    const MBPOL_POLY_REAL t1444 = a[41];
+    const MBPOL_POLY_REAL t1445 = t1440*t26;
+    const MBPOL_POLY_REAL t1446 = t1442*t37;
+    const MBPOL_POLY_REAL t1447 = a[193];
+    const MBPOL_POLY_REAL t1448 = t1447*t50;
+    const MBPOL_POLY_REAL t1449 = t1447*t67;
+    const MBPOL_POLY_REAL t1450 = a[323];
+    const MBPOL_POLY_REAL t1451 = t1450*t72;
+    const MBPOL_POLY_REAL t1452 = a[410];
+    const MBPOL_POLY_REAL t1453 = t1452*t73;
+    const MBPOL_POLY_REAL t1454 = a[109];
+    const MBPOL_POLY_REAL t1455 = t1454*t77;
+    const MBPOL_POLY_REAL t1456 = a[222];
+    const MBPOL_POLY_REAL t1458 = t1441+t1443+t1444+t1445+t1446+t1448+t1449+t1451+t1453+t1455+t1456*
 t126;
-    const double t1460 = a[55];
-    const double t1461 = a[87];
-    const double t1462 = t1461*t5;
-    const double t1463 = t1461*t20;
-    const double t1464 = t1461*t26;
-    const double t1465 = t1461*t37;
-    const double t1466 = a[202];
-    const double t1467 = t1466*t50;
-    const double t1468 = t1466*t67;
-    const double t1469 = a[104];
-    const double t1470 = t1469*t72;
-    const double t1471 = t1469*t73;
-    const double t1472 = a[251];
-    const double t1473 = t1472*t77;
-    const double t1474 = a[73];
-    const double t1475 = t1474*t126;
-    const double t1476 = t1472*t132;
-    const double t1477 = t1460+t1462+t1463+t1464+t1465+t1467+t1468+t1470+t1471+t1473+t1475+
+    const MBPOL_POLY_REAL t1460 = a[55];
+    const MBPOL_POLY_REAL t1461 = a[87];
+    const MBPOL_POLY_REAL t1462 = t1461*t5;
+    const MBPOL_POLY_REAL t1463 = t1461*t20;
+    const MBPOL_POLY_REAL t1464 = t1461*t26;
+    const MBPOL_POLY_REAL t1465 = t1461*t37;
+    const MBPOL_POLY_REAL t1466 = a[202];
+    const MBPOL_POLY_REAL t1467 = t1466*t50;
+    const MBPOL_POLY_REAL t1468 = t1466*t67;
+    const MBPOL_POLY_REAL t1469 = a[104];
+    const MBPOL_POLY_REAL t1470 = t1469*t72;
+    const MBPOL_POLY_REAL t1471 = t1469*t73;
+    const MBPOL_POLY_REAL t1472 = a[251];
+    const MBPOL_POLY_REAL t1473 = t1472*t77;
+    const MBPOL_POLY_REAL t1474 = a[73];
+    const MBPOL_POLY_REAL t1475 = t1474*t126;
+    const MBPOL_POLY_REAL t1476 = t1472*t132;
+    const MBPOL_POLY_REAL t1477 = t1460+t1462+t1463+t1464+t1465+t1467+t1468+t1470+t1471+t1473+t1475+
 t1476;
-    const double t1478 = t1474*t136;
-    const double t1479 = a[438];
-    const double t1480 = t1479*t139;
-    const double t1481 = a[176];
-    const double t1482 = t1481*t145;
-    const double t1483 = t1479*t146;
-    const double t1484 = t1481*t155;
-    const double t1321 = a[433];
-    const double t1486 = t1321*t179;
-    const double t1487 = a[99];
-    const double t1488 = t1487*t275;
-    const double t1489 = a[409];
-    const double t1490 = t1489*t254;
-    const double t1491 = a[541];
-    const double t1492 = t1491*t212;
-    const double t1493 = a[296];
-    const double t1494 = t1493*t215;
-    const double t1495 = a[529];
-    const double t1496 = t1495*t143;
-    const double t1497 = a[461];
-    const double t1498 = t1497*t309;
-    const double t1499 = t1478+t1480+t1482+t1483+t1484+t1486+t1488+t1490+t1492+t1494+t1496+
+    const MBPOL_POLY_REAL t1478 = t1474*t136;
+    const MBPOL_POLY_REAL t1479 = a[438];
+    const MBPOL_POLY_REAL t1480 = t1479*t139;
+    const MBPOL_POLY_REAL t1481 = a[176];
+    const MBPOL_POLY_REAL t1482 = t1481*t145;
+    const MBPOL_POLY_REAL t1483 = t1479*t146;
+    const MBPOL_POLY_REAL t1484 = t1481*t155;
+    const MBPOL_POLY_REAL t1321 = a[433];
+    const MBPOL_POLY_REAL t1486 = t1321*t179;
+    const MBPOL_POLY_REAL t1487 = a[99];
+    const MBPOL_POLY_REAL t1488 = t1487*t275;
+    const MBPOL_POLY_REAL t1489 = a[409];
+    const MBPOL_POLY_REAL t1490 = t1489*t254;
+    const MBPOL_POLY_REAL t1491 = a[541];
+    const MBPOL_POLY_REAL t1492 = t1491*t212;
+    const MBPOL_POLY_REAL t1493 = a[296];
+    const MBPOL_POLY_REAL t1494 = t1493*t215;
+    const MBPOL_POLY_REAL t1495 = a[529];
+    const MBPOL_POLY_REAL t1496 = t1495*t143;
+    const MBPOL_POLY_REAL t1497 = a[461];
+    const MBPOL_POLY_REAL t1498 = t1497*t309;
+    const MBPOL_POLY_REAL t1499 = t1478+t1480+t1482+t1483+t1484+t1486+t1488+t1490+t1492+t1494+t1496+
 t1498;
-    const double t1502 = a[607];
-    const double t1503 = t1502*t20;
-    const double t1504 = a[212];
-    const double t1505 = a[638];
-    const double t1506 = t1505*t5;
-    const double t1507 = t1505*t26;
-    const double t1508 = t1502*t37;
-    const double t1509 = a[913];
-    const double t1510 = t1509*t50;
-    const double t1511 = t1509*t67;
-    const double t1512 = a[701];
-    const double t1513 = t1512*t72;
-    const double t1514 = a[1020];
-    const double t1515 = t1514*t73;
-    const double t1516 = a[1087];
-    const double t1520 = a[670];
-    const double t1523 = t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+t1515+t1520*t77+
+    const MBPOL_POLY_REAL t1502 = a[607];
+    const MBPOL_POLY_REAL t1503 = t1502*t20;
+    const MBPOL_POLY_REAL t1504 = a[212];
+    const MBPOL_POLY_REAL t1505 = a[638];
+    const MBPOL_POLY_REAL t1506 = t1505*t5;
+    const MBPOL_POLY_REAL t1507 = t1505*t26;
+    const MBPOL_POLY_REAL t1508 = t1502*t37;
+    const MBPOL_POLY_REAL t1509 = a[913];
+    const MBPOL_POLY_REAL t1510 = t1509*t50;
+    const MBPOL_POLY_REAL t1511 = t1509*t67;
+    const MBPOL_POLY_REAL t1512 = a[701];
+    const MBPOL_POLY_REAL t1513 = t1512*t72;
+    const MBPOL_POLY_REAL t1514 = a[1020];
+    const MBPOL_POLY_REAL t1515 = t1514*t73;
+    const MBPOL_POLY_REAL t1516 = a[1087];
+    const MBPOL_POLY_REAL t1520 = a[670];
+    const MBPOL_POLY_REAL t1523 = t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+t1515+t1520*t77+
 t1516*t126;
-    const double t1525 = t1502*t5;
-    const double t1526 = t1505*t20;
-    const double t1527 = t1502*t26;
-    const double t1528 = t1505*t37;
-    const double t1529 = t1514*t72;
-    const double t1530 = t1512*t73;
-    const double t1531 = a[1058];
-    const double t1533 = a[1102];
-    const double t1537 = t1525+t1526+t1504+t1527+t1528+t1510+t1511+t1529+t1530+t1531*t77+
+    const MBPOL_POLY_REAL t1525 = t1502*t5;
+    const MBPOL_POLY_REAL t1526 = t1505*t20;
+    const MBPOL_POLY_REAL t1527 = t1502*t26;
+    const MBPOL_POLY_REAL t1528 = t1505*t37;
+    const MBPOL_POLY_REAL t1529 = t1514*t72;
+    const MBPOL_POLY_REAL t1530 = t1512*t73;
+    const MBPOL_POLY_REAL t1531 = a[1058];
+    const MBPOL_POLY_REAL t1533 = a[1102];
+    const MBPOL_POLY_REAL t1537 = t1525+t1526+t1504+t1527+t1528+t1510+t1511+t1529+t1530+t1531*t77+
 t1533*t126+t1520*t132+t1516*t136;
-    const double t1539 = a[257];
-    const double t1540 = a[737];
-    const double t1541 = t1540*t5;
-    const double t1542 = t1540*t20;
-    const double t1543 = t1540*t26;
-    const double t1544 = t1540*t37;
-    const double t1545 = a[948];
-    const double t1546 = t1545*t50;
-    const double t1547 = t1545*t67;
-    const double t1548 = a[857];
-    const double t1549 = t1548*t72;
-    const double t1550 = t1548*t73;
-    const double t1551 = a[813];
-    const double t1553 = a[1036];
-    const double t1557 = a[780];
-    const double t1558 = t1557*t139;
-    const double t1559 = t1557*t145;
-    const double t1560 = t1557*t146;
-    const double t1561 = t1557*t155;
-    const double t1331 = a[1042];
-    const double t1563 = t1331*t179;
-    const double t1564 = a[1034];
-    const double t1566 = t1539+t1541+t1542+t1543+t1544+t1546+t1547+t1549+t1550+t1551*t77+
+    const MBPOL_POLY_REAL t1539 = a[257];
+    const MBPOL_POLY_REAL t1540 = a[737];
+    const MBPOL_POLY_REAL t1541 = t1540*t5;
+    const MBPOL_POLY_REAL t1542 = t1540*t20;
+    const MBPOL_POLY_REAL t1543 = t1540*t26;
+    const MBPOL_POLY_REAL t1544 = t1540*t37;
+    const MBPOL_POLY_REAL t1545 = a[948];
+    const MBPOL_POLY_REAL t1546 = t1545*t50;
+    const MBPOL_POLY_REAL t1547 = t1545*t67;
+    const MBPOL_POLY_REAL t1548 = a[857];
+    const MBPOL_POLY_REAL t1549 = t1548*t72;
+    const MBPOL_POLY_REAL t1550 = t1548*t73;
+    const MBPOL_POLY_REAL t1551 = a[813];
+    const MBPOL_POLY_REAL t1553 = a[1036];
+    const MBPOL_POLY_REAL t1557 = a[780];
+    const MBPOL_POLY_REAL t1558 = t1557*t139;
+    const MBPOL_POLY_REAL t1559 = t1557*t145;
+    const MBPOL_POLY_REAL t1560 = t1557*t146;
+    const MBPOL_POLY_REAL t1561 = t1557*t155;
+    const MBPOL_POLY_REAL t1331 = a[1042];
+    const MBPOL_POLY_REAL t1563 = t1331*t179;
+    const MBPOL_POLY_REAL t1564 = a[1034];
+    const MBPOL_POLY_REAL t1566 = t1539+t1541+t1542+t1543+t1544+t1546+t1547+t1549+t1550+t1551*t77+
 t1553*t126+t1551*t132+t1553*t136+t1558+t1559+t1560+t1561+t1563+t1564*t275;
-    const double t1568 = a[478];
-    const double t1569 = a[668];
-    const double t1343 = t1569*t5;
-    const double t1572 = (t1568+t1343)*t5;
-    const double t1573 = a[276];
-    const double t1574 = a[836];
-    const double t1575 = t1574*t5;
-    const double t1576 = t1574*t20;
-    const double t1577 = t1574*t26;
-    const double t1578 = t1574*t37;
-    const double t1579 = a[815];
-    const double t1580 = t1579*t50;
-    const double t1581 = t1579*t67;
-    const double t1582 = a[919];
-    const double t1583 = t1582*t72;
-    const double t1584 = t1582*t73;
-    const double t1585 = a[576];
-    const double t1586 = t1585*t77;
-    const double t1587 = a[994];
-    const double t1588 = t1587*t126;
-    const double t1589 = t1585*t132;
-    const double t1590 = t1573+t1575+t1576+t1577+t1578+t1580+t1581+t1583+t1584+t1586+t1588+
+    const MBPOL_POLY_REAL t1568 = a[478];
+    const MBPOL_POLY_REAL t1569 = a[668];
+    const MBPOL_POLY_REAL t1343 = t1569*t5;
+    const MBPOL_POLY_REAL t1572 = (t1568+t1343)*t5;
+    const MBPOL_POLY_REAL t1573 = a[276];
+    const MBPOL_POLY_REAL t1574 = a[836];
+    const MBPOL_POLY_REAL t1575 = t1574*t5;
+    const MBPOL_POLY_REAL t1576 = t1574*t20;
+    const MBPOL_POLY_REAL t1577 = t1574*t26;
+    const MBPOL_POLY_REAL t1578 = t1574*t37;
+    const MBPOL_POLY_REAL t1579 = a[815];
+    const MBPOL_POLY_REAL t1580 = t1579*t50;
+    const MBPOL_POLY_REAL t1581 = t1579*t67;
+    const MBPOL_POLY_REAL t1582 = a[919];
+    const MBPOL_POLY_REAL t1583 = t1582*t72;
+    const MBPOL_POLY_REAL t1584 = t1582*t73;
+    const MBPOL_POLY_REAL t1585 = a[576];
+    const MBPOL_POLY_REAL t1586 = t1585*t77;
+    const MBPOL_POLY_REAL t1587 = a[994];
+    const MBPOL_POLY_REAL t1588 = t1587*t126;
+    const MBPOL_POLY_REAL t1589 = t1585*t132;
+    const MBPOL_POLY_REAL t1590 = t1573+t1575+t1576+t1577+t1578+t1580+t1581+t1583+t1584+t1586+t1588+
 t1589;
-    const double t1591 = t1587*t136;
-    const double t1592 = a[806];
-    const double t1593 = t1592*t139;
-    const double t1594 = a[896];
-    const double t1595 = t1594*t145;
-    const double t1596 = t1592*t146;
-    const double t1597 = t1594*t155;
-    const double t1351 = a[954];
-    const double t1599 = t1351*t179;
-    const double t1600 = a[1150];
-    const double t1601 = t1600*t275;
-    const double t1602 = a[739];
-    const double t1603 = t1602*t254;
-    const double t1604 = a[1023];
-    const double t1605 = t1604*t212;
-    const double t1606 = a[1044];
-    const double t1607 = t1606*t215;
-    const double t1608 = a[1045];
-    const double t1609 = t1608*t143;
-    const double t1610 = a[753];
-    const double t1611 = t1610*t309;
-    const double t1612 = t1591+t1593+t1595+t1596+t1597+t1599+t1601+t1603+t1605+t1607+t1609+
+    const MBPOL_POLY_REAL t1591 = t1587*t136;
+    const MBPOL_POLY_REAL t1592 = a[806];
+    const MBPOL_POLY_REAL t1593 = t1592*t139;
+    const MBPOL_POLY_REAL t1594 = a[896];
+    const MBPOL_POLY_REAL t1595 = t1594*t145;
+    const MBPOL_POLY_REAL t1596 = t1592*t146;
+    const MBPOL_POLY_REAL t1597 = t1594*t155;
+    const MBPOL_POLY_REAL t1351 = a[954];
+    const MBPOL_POLY_REAL t1599 = t1351*t179;
+    const MBPOL_POLY_REAL t1600 = a[1150];
+    const MBPOL_POLY_REAL t1601 = t1600*t275;
+    const MBPOL_POLY_REAL t1602 = a[739];
+    const MBPOL_POLY_REAL t1603 = t1602*t254;
+    const MBPOL_POLY_REAL t1604 = a[1023];
+    const MBPOL_POLY_REAL t1605 = t1604*t212;
+    const MBPOL_POLY_REAL t1606 = a[1044];
+    const MBPOL_POLY_REAL t1607 = t1606*t215;
+    const MBPOL_POLY_REAL t1608 = a[1045];
+    const MBPOL_POLY_REAL t1609 = t1608*t143;
+    const MBPOL_POLY_REAL t1610 = a[753];
+    const MBPOL_POLY_REAL t1611 = t1610*t309;
+    const MBPOL_POLY_REAL t1612 = t1591+t1593+t1595+t1596+t1597+t1599+t1601+t1603+t1605+t1607+t1609+
 t1611;
-    const double t1615 = a[848];
-    const double t1616 = t1615*t5;
-    const double t1617 = a[428];
-    const double t1618 = t1615*t20;
-    const double t1619 = a[802];
-    const double t1620 = t1619*t26;
-    const double t1621 = t1619*t37;
-    const double t1622 = a[792];
-    const double t1623 = t1622*t50;
-    const double t1624 = a[1122];
-    const double t1625 = t1624*t67;
-    const double t1626 = a[1018];
-    const double t1627 = t1626*t72;
-    const double t1628 = t1626*t73;
-    const double t1629 = a[856];
-    const double t1630 = t1629*t77;
-    const double t1631 = t1629*t126;
-    const double t1632 = t1629*t132;
-    const double t1633 = t1629*t136;
-    const double t1634 = a[1136];
-    const double t1636 = a[847];
-    const double t1638 = a[867];
-    const double t1640 = a[799];
-    const double t1642 = t1616+t1617+t1618+t1620+t1621+t1623+t1625+t1627+t1628+t1630+t1631+
+    const MBPOL_POLY_REAL t1615 = a[848];
+    const MBPOL_POLY_REAL t1616 = t1615*t5;
+    const MBPOL_POLY_REAL t1617 = a[428];
+    const MBPOL_POLY_REAL t1618 = t1615*t20;
+    const MBPOL_POLY_REAL t1619 = a[802];
+    const MBPOL_POLY_REAL t1620 = t1619*t26;
+    const MBPOL_POLY_REAL t1621 = t1619*t37;
+    const MBPOL_POLY_REAL t1622 = a[792];
+    const MBPOL_POLY_REAL t1623 = t1622*t50;
+    const MBPOL_POLY_REAL t1624 = a[1122];
+    const MBPOL_POLY_REAL t1625 = t1624*t67;
+    const MBPOL_POLY_REAL t1626 = a[1018];
+    const MBPOL_POLY_REAL t1627 = t1626*t72;
+    const MBPOL_POLY_REAL t1628 = t1626*t73;
+    const MBPOL_POLY_REAL t1629 = a[856];
+    const MBPOL_POLY_REAL t1630 = t1629*t77;
+    const MBPOL_POLY_REAL t1631 = t1629*t126;
+    const MBPOL_POLY_REAL t1632 = t1629*t132;
+    const MBPOL_POLY_REAL t1633 = t1629*t136;
+    const MBPOL_POLY_REAL t1634 = a[1136];
+    const MBPOL_POLY_REAL t1636 = a[847];
+    const MBPOL_POLY_REAL t1638 = a[867];
+    const MBPOL_POLY_REAL t1640 = a[799];
+    const MBPOL_POLY_REAL t1642 = t1616+t1617+t1618+t1620+t1621+t1623+t1625+t1627+t1628+t1630+t1631+
 t1632+t1633+t1634*t139+t1636*t145+t1638*t146+t1640*t155;
-    const double t1644 = a[484];
-    const double t1645 = a[795];
-    const double t1646 = t1645*t5;
-    const double t1647 = t1645*t20;
-    const double t1648 = t1645*t26;
-    const double t1649 = t1645*t37;
-    const double t1650 = a[1106];
-    const double t1651 = t1650*t50;
-    const double t1652 = t1650*t67;
-    const double t1653 = a[1114];
-    const double t1654 = t1653*t72;
-    const double t1655 = t1653*t73;
-    const double t1656 = a[658];
-    const double t1657 = t1656*t77;
-    const double t1658 = t1656*t126;
-    const double t1659 = t1644+t1646+t1647+t1648+t1649+t1651+t1652+t1654+t1655+t1657+t1658;
-    const double t1660 = t1656*t132;
-    const double t1661 = t1656*t136;
-    const double t1662 = a[675];
-    const double t1664 = a[1038];
-    const double t1364 = a[907];
-    const double t1669 = t1364*t179;
-    const double t1670 = a[964];
-    const double t1671 = t1670*t275;
-    const double t1672 = t1670*t254;
-    const double t1673 = a[1142];
-    const double t1675 = a[681];
-    const double t1677 = t1660+t1661+t1662*t139+t1664*t145+t1662*t146+t1664*t155+t1669+t1671
+    const MBPOL_POLY_REAL t1644 = a[484];
+    const MBPOL_POLY_REAL t1645 = a[795];
+    const MBPOL_POLY_REAL t1646 = t1645*t5;
+    const MBPOL_POLY_REAL t1647 = t1645*t20;
+    const MBPOL_POLY_REAL t1648 = t1645*t26;
+    const MBPOL_POLY_REAL t1649 = t1645*t37;
+    const MBPOL_POLY_REAL t1650 = a[1106];
+    const MBPOL_POLY_REAL t1651 = t1650*t50;
+    const MBPOL_POLY_REAL t1652 = t1650*t67;
+    const MBPOL_POLY_REAL t1653 = a[1114];
+    const MBPOL_POLY_REAL t1654 = t1653*t72;
+    const MBPOL_POLY_REAL t1655 = t1653*t73;
+    const MBPOL_POLY_REAL t1656 = a[658];
+    const MBPOL_POLY_REAL t1657 = t1656*t77;
+    const MBPOL_POLY_REAL t1658 = t1656*t126;
+    const MBPOL_POLY_REAL t1659 = t1644+t1646+t1647+t1648+t1649+t1651+t1652+t1654+t1655+t1657+t1658;
+    const MBPOL_POLY_REAL t1660 = t1656*t132;
+    const MBPOL_POLY_REAL t1661 = t1656*t136;
+    const MBPOL_POLY_REAL t1662 = a[675];
+    const MBPOL_POLY_REAL t1664 = a[1038];
+    const MBPOL_POLY_REAL t1364 = a[907];
+    const MBPOL_POLY_REAL t1669 = t1364*t179;
+    const MBPOL_POLY_REAL t1670 = a[964];
+    const MBPOL_POLY_REAL t1671 = t1670*t275;
+    const MBPOL_POLY_REAL t1672 = t1670*t254;
+    const MBPOL_POLY_REAL t1673 = a[1142];
+    const MBPOL_POLY_REAL t1675 = a[681];
+    const MBPOL_POLY_REAL t1677 = t1660+t1661+t1662*t139+t1664*t145+t1662*t146+t1664*t155+t1669+t1671
 +t1672+t1673*t212+t1675*t215;
-    const double t1680 = a[1062];
-    const double t1681 = t1680*t5;
-    const double t1682 = a[256];
-    const double t1683 = a[1039];
-    const double t1684 = t1683*t20;
-    const double t1685 = t1680*t26;
-    const double t1686 = t1683*t37;
-    const double t1687 = a[585];
-    const double t1688 = t1687*t50;
-    const double t1689 = t1687*t67;
-    const double t1690 = a[1151];
-    const double t1692 = a[1061];
-    const double t1696 = a[1141];
-    const double t1697 = t1696*t5;
-    const double t1698 = a[555];
-    const double t1699 = t1696*t20;
-    const double t1700 = t1696*t26;
-    const double t1701 = t1696*t37;
-    const double t1702 = a[1076];
-    const double t1705 = a[1014];
-    const double t1708 = a[940];
-    const double t1713 = a[703];
-    const double t1396 = a[1152];
-    const double t1719 = t1396*t179;
-    const double t1720 = t1697+t1698+t1699+t1700+t1701+t1702*t50+t1702*t67+t1705*t72+t1705*
+    const MBPOL_POLY_REAL t1680 = a[1062];
+    const MBPOL_POLY_REAL t1681 = t1680*t5;
+    const MBPOL_POLY_REAL t1682 = a[256];
+    const MBPOL_POLY_REAL t1683 = a[1039];
+    const MBPOL_POLY_REAL t1684 = t1683*t20;
+    const MBPOL_POLY_REAL t1685 = t1680*t26;
+    const MBPOL_POLY_REAL t1686 = t1683*t37;
+    const MBPOL_POLY_REAL t1687 = a[585];
+    const MBPOL_POLY_REAL t1688 = t1687*t50;
+    const MBPOL_POLY_REAL t1689 = t1687*t67;
+    const MBPOL_POLY_REAL t1690 = a[1151];
+    const MBPOL_POLY_REAL t1692 = a[1061];
+    const MBPOL_POLY_REAL t1696 = a[1141];
+    const MBPOL_POLY_REAL t1697 = t1696*t5;
+    const MBPOL_POLY_REAL t1698 = a[555];
+    const MBPOL_POLY_REAL t1699 = t1696*t20;
+    const MBPOL_POLY_REAL t1700 = t1696*t26;
+    const MBPOL_POLY_REAL t1701 = t1696*t37;
+    const MBPOL_POLY_REAL t1702 = a[1076];
+    const MBPOL_POLY_REAL t1705 = a[1014];
+    const MBPOL_POLY_REAL t1708 = a[940];
+    const MBPOL_POLY_REAL t1713 = a[703];
+    const MBPOL_POLY_REAL t1396 = a[1152];
+    const MBPOL_POLY_REAL t1719 = t1396*t179;
+    const MBPOL_POLY_REAL t1720 = t1697+t1698+t1699+t1700+t1701+t1702*t50+t1702*t67+t1705*t72+t1705*
 t73+t1708*t77+t1708*t126+t1708*t132+t1708*t136+t1713*t139+t1713*t145+t1713*t146
 +t1713*t155+t1719;
-    const double t1722 = t1619*t5;
-    const double t1723 = t1619*t20;
-    const double t1724 = t1615*t26;
-    const double t1725 = t1615*t37;
-    const double t1726 = t1624*t50;
-    const double t1727 = t1622*t67;
-    const double t1729 = t1617+t1722+t1723+t1724+t1725+t1726+t1727+t1627+t1628+t1630+t1631+
+    const MBPOL_POLY_REAL t1722 = t1619*t5;
+    const MBPOL_POLY_REAL t1723 = t1619*t20;
+    const MBPOL_POLY_REAL t1724 = t1615*t26;
+    const MBPOL_POLY_REAL t1725 = t1615*t37;
+    const MBPOL_POLY_REAL t1726 = t1624*t50;
+    const MBPOL_POLY_REAL t1727 = t1622*t67;
+    const MBPOL_POLY_REAL t1729 = t1617+t1722+t1723+t1724+t1725+t1726+t1727+t1627+t1628+t1630+t1631+
 t1632+t1633+t1640*t139;
-    const double t1731 = a[933];
-    const double t1732 = t1731*t5;
-    const double t1733 = t1569*t20;
-    const double t1457 = t1516*t77;
-    const double t1518 = t1590+t1612;
-    const double t1522 = t1659+t1677;
-    const double t1532 = t1690*t72;
-    const double t1534 = t1692*t73;
-    const double t1554 = t1732+t1568+t1733;
-    const double t1736 = (t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+t1515+t1457)*t77+
+    const MBPOL_POLY_REAL t1731 = a[933];
+    const MBPOL_POLY_REAL t1732 = t1731*t5;
+    const MBPOL_POLY_REAL t1733 = t1569*t20;
+    const MBPOL_POLY_REAL t1457 = t1516*t77;
+    const MBPOL_POLY_REAL t1518 = t1590+t1612;
+    const MBPOL_POLY_REAL t1522 = t1659+t1677;
+    const MBPOL_POLY_REAL t1532 = t1690*t72;
+    const MBPOL_POLY_REAL t1534 = t1692*t73;
+    const MBPOL_POLY_REAL t1554 = t1732+t1568+t1733;
+    const MBPOL_POLY_REAL t1736 = (t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+t1515+t1457)*t77+
 t1523*t126+t1537*t136+t1566*t275+t1572+t1518*t309+t1642*t155+t1522*t215+(t1681+
 t1682+t1684+t1685+t1686+t1688+t1689+t1532+t1534)*t73+t1720*t179+t1729*t139+
 t1554*t20;
-    const double t1737 = a[630];
-    const double t1738 = t1737*t20;
-    const double t1739 = a[922];
-    const double t1740 = t1739*t5;
-    const double t1741 = t1569*t26;
-    const double t1744 = a[1046];
-    const double t1745 = t1744*t5;
-    const double t1746 = a[282];
-    const double t1747 = t1744*t20;
-    const double t1748 = a[860];
-    const double t1749 = t1748*t26;
-    const double t1750 = t1748*t37;
-    const double t1751 = a[1059];
-    const double t1755 = t1594*t139;
-    const double t1756 = t1592*t145;
-    const double t1757 = a[1081];
-    const double t1758 = t1757*t143;
-    const double t1759 = t1610*t240;
-    const double t1760 = t1580+t1581+t1583+t1584+t1755+t1756+t1758+t1759+t1576+t1599+t1577+
+    const MBPOL_POLY_REAL t1737 = a[630];
+    const MBPOL_POLY_REAL t1738 = t1737*t20;
+    const MBPOL_POLY_REAL t1739 = a[922];
+    const MBPOL_POLY_REAL t1740 = t1739*t5;
+    const MBPOL_POLY_REAL t1741 = t1569*t26;
+    const MBPOL_POLY_REAL t1744 = a[1046];
+    const MBPOL_POLY_REAL t1745 = t1744*t5;
+    const MBPOL_POLY_REAL t1746 = a[282];
+    const MBPOL_POLY_REAL t1747 = t1744*t20;
+    const MBPOL_POLY_REAL t1748 = a[860];
+    const MBPOL_POLY_REAL t1749 = t1748*t26;
+    const MBPOL_POLY_REAL t1750 = t1748*t37;
+    const MBPOL_POLY_REAL t1751 = a[1059];
+    const MBPOL_POLY_REAL t1755 = t1594*t139;
+    const MBPOL_POLY_REAL t1756 = t1592*t145;
+    const MBPOL_POLY_REAL t1757 = a[1081];
+    const MBPOL_POLY_REAL t1758 = t1757*t143;
+    const MBPOL_POLY_REAL t1759 = t1610*t240;
+    const MBPOL_POLY_REAL t1760 = t1580+t1581+t1583+t1584+t1755+t1756+t1758+t1759+t1576+t1599+t1577+
 t1578;
-    const double t1761 = a[893];
-    const double t1762 = t1761*t309;
-    const double t1763 = t1594*t146;
-    const double t1764 = t1592*t155;
-    const double t1765 = t1606*t212;
-    const double t1766 = t1604*t215;
-    const double t1767 = t1585*t126;
-    const double t1768 = t1585*t136;
-    const double t1769 = t1587*t132;
-    const double t1770 = t1587*t77;
-    const double t1771 = t1600*t254;
-    const double t1772 = t1602*t275;
-    const double t1773 = t1762+t1763+t1764+t1765+t1766+t1575+t1767+t1768+t1769+t1770+t1771+
+    const MBPOL_POLY_REAL t1761 = a[893];
+    const MBPOL_POLY_REAL t1762 = t1761*t309;
+    const MBPOL_POLY_REAL t1763 = t1594*t146;
+    const MBPOL_POLY_REAL t1764 = t1592*t155;
+    const MBPOL_POLY_REAL t1765 = t1606*t212;
+    const MBPOL_POLY_REAL t1766 = t1604*t215;
+    const MBPOL_POLY_REAL t1767 = t1585*t126;
+    const MBPOL_POLY_REAL t1768 = t1585*t136;
+    const MBPOL_POLY_REAL t1769 = t1587*t132;
+    const MBPOL_POLY_REAL t1770 = t1587*t77;
+    const MBPOL_POLY_REAL t1771 = t1600*t254;
+    const MBPOL_POLY_REAL t1772 = t1602*t275;
+    const MBPOL_POLY_REAL t1773 = t1762+t1763+t1764+t1765+t1766+t1575+t1767+t1768+t1769+t1770+t1771+
 t1772+t1573;
-    const double t1780 = a[1132];
-    const double t1783 = t1539+t1541+t1542+t1543+t1544+t1546+t1547+t1549+t1550+t1553*t77+
+    const MBPOL_POLY_REAL t1780 = a[1132];
+    const MBPOL_POLY_REAL t1783 = t1539+t1541+t1542+t1543+t1544+t1546+t1547+t1549+t1550+t1553*t77+
 t1551*t126+t1553*t132+t1551*t136+t1558+t1559+t1560+t1561+t1563+t1780*t275+t1564
 *t254;
-    const double t1787 = t1617+t1722+t1723+t1724+t1725+t1726+t1727+t1627+t1628+t1630+t1631+
+    const MBPOL_POLY_REAL t1787 = t1617+t1722+t1723+t1724+t1725+t1726+t1727+t1627+t1628+t1630+t1631+
 t1632+t1633+t1638*t139+t1640*t145;
-    const double t1792 = t1525+t1526+t1504+t1527+t1528+t1510+t1511+t1529+t1530+t1533*t77+
+    const MBPOL_POLY_REAL t1792 = t1525+t1526+t1504+t1527+t1528+t1510+t1511+t1529+t1530+t1533*t77+
 t1531*t126+t1516*t132;
-    const double t1800 = t1658+t1660+t1661+t1664*t139+t1662*t145+t1664*t146+t1662*t155+t1669
+    const MBPOL_POLY_REAL t1800 = t1658+t1660+t1661+t1664*t139+t1662*t145+t1664*t146+t1662*t155+t1669
 +t1671+t1672+t1675*t212;
-    const double t1803 = t1748*t5;
-    const double t1804 = t1748*t20;
-    const double t1805 = t1744*t26;
-    const double t1806 = t1744*t37;
-    const double t1807 = a[943];
-    const double t1812 = t1683*t5;
-    const double t1813 = t1680*t20;
-    const double t1814 = t1683*t26;
-    const double t1815 = t1680*t37;
-    const double t1819 = t1610*t475;
-    const double t1820 = t1761*t143;
-    const double t1823 = t1580+t1581+t1583+t1584+t1819+t1820+t1576+t1599+t1577+t1578+t1608*
+    const MBPOL_POLY_REAL t1803 = t1748*t5;
+    const MBPOL_POLY_REAL t1804 = t1748*t20;
+    const MBPOL_POLY_REAL t1805 = t1744*t26;
+    const MBPOL_POLY_REAL t1806 = t1744*t37;
+    const MBPOL_POLY_REAL t1807 = a[943];
+    const MBPOL_POLY_REAL t1812 = t1683*t5;
+    const MBPOL_POLY_REAL t1813 = t1680*t20;
+    const MBPOL_POLY_REAL t1814 = t1683*t26;
+    const MBPOL_POLY_REAL t1815 = t1680*t37;
+    const MBPOL_POLY_REAL t1819 = t1610*t475;
+    const MBPOL_POLY_REAL t1820 = t1761*t143;
+    const MBPOL_POLY_REAL t1823 = t1580+t1581+t1583+t1584+t1819+t1820+t1576+t1599+t1577+t1578+t1608*
 t240+t1757*t309+t1593;
-    const double t1824 = t1595+t1596+t1597+t1605+t1607+t1575+t1767+t1768+t1769+t1770+t1771+
+    const MBPOL_POLY_REAL t1824 = t1595+t1596+t1597+t1605+t1607+t1575+t1767+t1768+t1769+t1770+t1771+
 t1772+t1573;
-    const double t1829 = t1737*t5;
-    const double t1830 = t1569*t37;
-    const double t1833 = t1573+t1575+t1576+t1577+t1578+t1580+t1581+t1583+t1584+t1586+t1588;
-    const double t1834 = t1610*t143;
-    const double t1835 = t1589+t1591+t1755+t1756+t1763+t1764+t1599+t1601+t1603+t1765+t1766+
+    const MBPOL_POLY_REAL t1829 = t1737*t5;
+    const MBPOL_POLY_REAL t1830 = t1569*t37;
+    const MBPOL_POLY_REAL t1833 = t1573+t1575+t1576+t1577+t1578+t1580+t1581+t1583+t1584+t1586+t1588;
+    const MBPOL_POLY_REAL t1834 = t1610*t143;
+    const MBPOL_POLY_REAL t1835 = t1589+t1591+t1755+t1756+t1763+t1764+t1599+t1601+t1603+t1765+t1766+
 t1834;
-    const double t1841 = t1616+t1617+t1618+t1620+t1621+t1623+t1625+t1627+t1628+t1630+t1631+
+    const MBPOL_POLY_REAL t1841 = t1616+t1617+t1618+t1620+t1621+t1623+t1625+t1627+t1628+t1630+t1631+
 t1632+t1633+t1636*t139+t1634*t145+t1640*t146;
-    const double t1691 = t1751*t50;
-    const double t1695 = t1760+t1773;
-    const double t1709 = t1644+t1646+t1647+t1648+t1649+t1651+t1652+t1654+t1655+t1657+t1800;
-    const double t1711 = t1807*t50;
-    const double t1712 = t1751*t67;
-    const double t1716 = t1692*t72;
-    const double t1721 = t1823+t1824;
-    const double t1735 = t1739*t20+t1568+t1731*t26+t1829+t1830;
-    const double t1743 = t1833+t1835;
-    const double t1843 = (t1738+t1740+t1568+t1741)*t26+(t1745+t1746+t1747+t1749+t1750+t1691)
+    const MBPOL_POLY_REAL t1691 = t1751*t50;
+    const MBPOL_POLY_REAL t1695 = t1760+t1773;
+    const MBPOL_POLY_REAL t1709 = t1644+t1646+t1647+t1648+t1649+t1651+t1652+t1654+t1655+t1657+t1800;
+    const MBPOL_POLY_REAL t1711 = t1807*t50;
+    const MBPOL_POLY_REAL t1712 = t1751*t67;
+    const MBPOL_POLY_REAL t1716 = t1692*t72;
+    const MBPOL_POLY_REAL t1721 = t1823+t1824;
+    const MBPOL_POLY_REAL t1735 = t1739*t20+t1568+t1731*t26+t1829+t1830;
+    const MBPOL_POLY_REAL t1743 = t1833+t1835;
+    const MBPOL_POLY_REAL t1843 = (t1738+t1740+t1568+t1741)*t26+(t1745+t1746+t1747+t1749+t1750+t1691)
 *t50+t1695*t240+t1783*t254+t1787*t145+t1792*t132+t1709*t212+(t1746+t1803+t1804+
 t1805+t1806+t1711+t1712)*t67+(t1812+t1682+t1813+t1814+t1815+t1688+t1689+t1716)*
 t72+t1721*t475+t1735*t37+t1743*t143+t1841*t146;
-    const double t1846 = a[16];
-    const double t1847 = a[184];
-    const double t1754 = t1847*t5;
-    const double t1850 = (t1846+t1754)*t5;
-    const double t1851 = t1425*t5;
-    const double t1852 = t1422*t20;
-    const double t1853 = t1425*t26;
-    const double t1854 = t1422*t37;
-    const double t1855 = t1434*t72;
-    const double t1856 = t1432*t73;
-    const double t1857 = a[393];
-    const double t1859 = a[89];
-    const double t1860 = t1859*t126;
-    const double t1862 = t1851+t1852+t1424+t1853+t1854+t1430+t1431+t1855+t1856+t1857*t77+
+    const MBPOL_POLY_REAL t1846 = a[16];
+    const MBPOL_POLY_REAL t1847 = a[184];
+    const MBPOL_POLY_REAL t1754 = t1847*t5;
+    const MBPOL_POLY_REAL t1850 = (t1846+t1754)*t5;
+    const MBPOL_POLY_REAL t1851 = t1425*t5;
+    const MBPOL_POLY_REAL t1852 = t1422*t20;
+    const MBPOL_POLY_REAL t1853 = t1425*t26;
+    const MBPOL_POLY_REAL t1854 = t1422*t37;
+    const MBPOL_POLY_REAL t1855 = t1434*t72;
+    const MBPOL_POLY_REAL t1856 = t1432*t73;
+    const MBPOL_POLY_REAL t1857 = a[393];
+    const MBPOL_POLY_REAL t1859 = a[89];
+    const MBPOL_POLY_REAL t1860 = t1859*t126;
+    const MBPOL_POLY_REAL t1862 = t1851+t1852+t1424+t1853+t1854+t1430+t1431+t1855+t1856+t1857*t77+
 t1860+t1436*t132;
-    const double t1864 = a[58];
-    const double t1865 = a[147];
-    const double t1866 = t1865*t20;
-    const double t1867 = a[388];
-    const double t1868 = t1867*t5;
-    const double t1869 = t1867*t26;
-    const double t1870 = t1865*t37;
-    const double t1871 = a[294];
-    const double t1872 = t1871*t50;
-    const double t1873 = t1871*t67;
-    const double t1874 = a[235];
-    const double t1777 = t1874*t72;
-    const double t1877 = (t1864+t1866+t1868+t1869+t1870+t1872+t1873+t1777)*t72;
-    const double t1878 = a[406];
-    const double t1879 = t1878*t20;
-    const double t1880 = a[229];
-    const double t1881 = t1880*t5;
-    const double t1882 = t1847*t26;
-    const double t1779 = t1879+t1846+t1881+t1882;
-    const double t1884 = t1779*t26;
-    const double t1885 = t1442*t5;
-    const double t1886 = t1440*t20;
-    const double t1887 = t1442*t26;
-    const double t1888 = t1440*t37;
-    const double t1889 = t1452*t72;
-    const double t1890 = t1450*t73;
-    const double t1891 = t1859*t77;
-    const double t1892 = a[549];
-    const double t1894 = t1454*t132;
-    const double t1896 = t1885+t1444+t1886+t1887+t1888+t1448+t1449+t1889+t1890+t1891+t1892*
+    const MBPOL_POLY_REAL t1864 = a[58];
+    const MBPOL_POLY_REAL t1865 = a[147];
+    const MBPOL_POLY_REAL t1866 = t1865*t20;
+    const MBPOL_POLY_REAL t1867 = a[388];
+    const MBPOL_POLY_REAL t1868 = t1867*t5;
+    const MBPOL_POLY_REAL t1869 = t1867*t26;
+    const MBPOL_POLY_REAL t1870 = t1865*t37;
+    const MBPOL_POLY_REAL t1871 = a[294];
+    const MBPOL_POLY_REAL t1872 = t1871*t50;
+    const MBPOL_POLY_REAL t1873 = t1871*t67;
+    const MBPOL_POLY_REAL t1874 = a[235];
+    const MBPOL_POLY_REAL t1777 = t1874*t72;
+    const MBPOL_POLY_REAL t1877 = (t1864+t1866+t1868+t1869+t1870+t1872+t1873+t1777)*t72;
+    const MBPOL_POLY_REAL t1878 = a[406];
+    const MBPOL_POLY_REAL t1879 = t1878*t20;
+    const MBPOL_POLY_REAL t1880 = a[229];
+    const MBPOL_POLY_REAL t1881 = t1880*t5;
+    const MBPOL_POLY_REAL t1882 = t1847*t26;
+    const MBPOL_POLY_REAL t1779 = t1879+t1846+t1881+t1882;
+    const MBPOL_POLY_REAL t1884 = t1779*t26;
+    const MBPOL_POLY_REAL t1885 = t1442*t5;
+    const MBPOL_POLY_REAL t1886 = t1440*t20;
+    const MBPOL_POLY_REAL t1887 = t1442*t26;
+    const MBPOL_POLY_REAL t1888 = t1440*t37;
+    const MBPOL_POLY_REAL t1889 = t1452*t72;
+    const MBPOL_POLY_REAL t1890 = t1450*t73;
+    const MBPOL_POLY_REAL t1891 = t1859*t77;
+    const MBPOL_POLY_REAL t1892 = a[549];
+    const MBPOL_POLY_REAL t1894 = t1454*t132;
+    const MBPOL_POLY_REAL t1896 = t1885+t1444+t1886+t1887+t1888+t1448+t1449+t1889+t1890+t1891+t1892*
 t126+t1894+t1456*t136;
-    const double t1898 = a[168];
-    const double t1899 = t1898*t5;
-    const double t1900 = a[23];
-    const double t1901 = t1898*t20;
-    const double t1902 = a[286];
-    const double t1903 = t1902*t26;
-    const double t1904 = t1902*t37;
-    const double t1905 = a[407];
-    const double t1906 = t1905*t50;
-    const double t1907 = a[142];
-    const double t1908 = t1907*t67;
-    const double t1909 = a[432];
-    const double t1910 = t1909*t72;
-    const double t1911 = t1909*t73;
-    const double t1912 = a[194];
-    const double t1913 = t1912*t77;
-    const double t1914 = a[157];
-    const double t1915 = t1914*t126;
-    const double t1916 = t1912*t132;
-    const double t1917 = t1914*t136;
-    const double t1918 = a[535];
-    const double t1919 = t1918*t139;
-    const double t1920 = a[489];
-    const double t1921 = t1920*t145;
-    const double t1922 = a[413];
-    const double t1923 = t1922*t146;
-    const double t1924 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t1913+t1915+
+    const MBPOL_POLY_REAL t1898 = a[168];
+    const MBPOL_POLY_REAL t1899 = t1898*t5;
+    const MBPOL_POLY_REAL t1900 = a[23];
+    const MBPOL_POLY_REAL t1901 = t1898*t20;
+    const MBPOL_POLY_REAL t1902 = a[286];
+    const MBPOL_POLY_REAL t1903 = t1902*t26;
+    const MBPOL_POLY_REAL t1904 = t1902*t37;
+    const MBPOL_POLY_REAL t1905 = a[407];
+    const MBPOL_POLY_REAL t1906 = t1905*t50;
+    const MBPOL_POLY_REAL t1907 = a[142];
+    const MBPOL_POLY_REAL t1908 = t1907*t67;
+    const MBPOL_POLY_REAL t1909 = a[432];
+    const MBPOL_POLY_REAL t1910 = t1909*t72;
+    const MBPOL_POLY_REAL t1911 = t1909*t73;
+    const MBPOL_POLY_REAL t1912 = a[194];
+    const MBPOL_POLY_REAL t1913 = t1912*t77;
+    const MBPOL_POLY_REAL t1914 = a[157];
+    const MBPOL_POLY_REAL t1915 = t1914*t126;
+    const MBPOL_POLY_REAL t1916 = t1912*t132;
+    const MBPOL_POLY_REAL t1917 = t1914*t136;
+    const MBPOL_POLY_REAL t1918 = a[535];
+    const MBPOL_POLY_REAL t1919 = t1918*t139;
+    const MBPOL_POLY_REAL t1920 = a[489];
+    const MBPOL_POLY_REAL t1921 = t1920*t145;
+    const MBPOL_POLY_REAL t1922 = a[413];
+    const MBPOL_POLY_REAL t1923 = t1922*t146;
+    const MBPOL_POLY_REAL t1924 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t1913+t1915+
 t1916+t1917+t1919+t1921+t1923;
-    const double t1926 = a[207];
-    const double t1927 = t1926*t5;
-    const double t1928 = t1847*t20;
-    const double t1784 = t1846+t1927+t1928;
-    const double t1930 = t1784*t20;
-    const double t1931 = a[21];
-    const double t1932 = a[204];
-    const double t1933 = t1932*t5;
-    const double t1934 = t1932*t20;
-    const double t1935 = a[253];
-    const double t1936 = t1935*t26;
-    const double t1937 = t1935*t37;
-    const double t1938 = a[307];
-    const double t1785 = t1938*t50;
-    const double t1941 = (t1931+t1933+t1934+t1936+t1937+t1785)*t50;
-    const double t1942 = a[43];
-    const double t1943 = a[348];
-    const double t1944 = t1943*t5;
-    const double t1945 = t1943*t20;
-    const double t1946 = t1943*t26;
-    const double t1947 = t1943*t37;
-    const double t1948 = a[148];
-    const double t1949 = t1948*t50;
-    const double t1950 = t1948*t67;
-    const double t1951 = a[343];
-    const double t1952 = t1951*t72;
-    const double t1953 = t1951*t73;
-    const double t1954 = a[172];
-    const double t1955 = t1954*t77;
-    const double t1957 = a[336];
-    const double t1958 = t1957*t126;
-    const double t1959 = t1954*t132;
-    const double t1960 = t1957*t136;
-    const double t1961 = a[186];
-    const double t1962 = t1961*t139;
-    const double t1963 = a[305];
-    const double t1964 = t1963*t145;
-    const double t1965 = t1961*t146;
-    const double t1966 = t1963*t155;
-    const double t1788 = a[228];
-    const double t1968 = t1788*t179;
-    const double t1969 = a[159];
-    const double t1970 = t1969*t275;
-    const double t1971 = a[283];
-    const double t1972 = t1971*t254;
-    const double t1973 = a[182];
-    const double t1974 = t1973*t212;
-    const double t1975 = t1958+t1959+t1960+t1962+t1964+t1965+t1966+t1968+t1970+t1972+t1974;
-    const double t1978 = a[960];
-    const double t1979 = t1978*t5;
-    const double t1980 = a[891];
-    const double t1981 = t1980*t20;
-    const double t1982 = a[287];
-    const double t1983 = t1978*t26;
-    const double t1984 = t1980*t37;
-    const double t1985 = a[683];
-    const double t1986 = t1985*t50;
-    const double t1987 = t1985*t67;
-    const double t1988 = a[718];
-    const double t1989 = t1988*t72;
-    const double t1990 = a[678];
-    const double t1991 = t1990*t73;
-    const double t1992 = a[766];
-    const double t1994 = a[621];
-    const double t1995 = t1994*t126;
-    const double t1996 = a[652];
-    const double t1998 = t1979+t1981+t1982+t1983+t1984+t1986+t1987+t1989+t1991+t1992*t77+
+    const MBPOL_POLY_REAL t1926 = a[207];
+    const MBPOL_POLY_REAL t1927 = t1926*t5;
+    const MBPOL_POLY_REAL t1928 = t1847*t20;
+    const MBPOL_POLY_REAL t1784 = t1846+t1927+t1928;
+    const MBPOL_POLY_REAL t1930 = t1784*t20;
+    const MBPOL_POLY_REAL t1931 = a[21];
+    const MBPOL_POLY_REAL t1932 = a[204];
+    const MBPOL_POLY_REAL t1933 = t1932*t5;
+    const MBPOL_POLY_REAL t1934 = t1932*t20;
+    const MBPOL_POLY_REAL t1935 = a[253];
+    const MBPOL_POLY_REAL t1936 = t1935*t26;
+    const MBPOL_POLY_REAL t1937 = t1935*t37;
+    const MBPOL_POLY_REAL t1938 = a[307];
+    const MBPOL_POLY_REAL t1785 = t1938*t50;
+    const MBPOL_POLY_REAL t1941 = (t1931+t1933+t1934+t1936+t1937+t1785)*t50;
+    const MBPOL_POLY_REAL t1942 = a[43];
+    const MBPOL_POLY_REAL t1943 = a[348];
+    const MBPOL_POLY_REAL t1944 = t1943*t5;
+    const MBPOL_POLY_REAL t1945 = t1943*t20;
+    const MBPOL_POLY_REAL t1946 = t1943*t26;
+    const MBPOL_POLY_REAL t1947 = t1943*t37;
+    const MBPOL_POLY_REAL t1948 = a[148];
+    const MBPOL_POLY_REAL t1949 = t1948*t50;
+    const MBPOL_POLY_REAL t1950 = t1948*t67;
+    const MBPOL_POLY_REAL t1951 = a[343];
+    const MBPOL_POLY_REAL t1952 = t1951*t72;
+    const MBPOL_POLY_REAL t1953 = t1951*t73;
+    const MBPOL_POLY_REAL t1954 = a[172];
+    const MBPOL_POLY_REAL t1955 = t1954*t77;
+    const MBPOL_POLY_REAL t1957 = a[336];
+    const MBPOL_POLY_REAL t1958 = t1957*t126;
+    const MBPOL_POLY_REAL t1959 = t1954*t132;
+    const MBPOL_POLY_REAL t1960 = t1957*t136;
+    const MBPOL_POLY_REAL t1961 = a[186];
+    const MBPOL_POLY_REAL t1962 = t1961*t139;
+    const MBPOL_POLY_REAL t1963 = a[305];
+    const MBPOL_POLY_REAL t1964 = t1963*t145;
+    const MBPOL_POLY_REAL t1965 = t1961*t146;
+    const MBPOL_POLY_REAL t1966 = t1963*t155;
+    const MBPOL_POLY_REAL t1788 = a[228];
+    const MBPOL_POLY_REAL t1968 = t1788*t179;
+    const MBPOL_POLY_REAL t1969 = a[159];
+    const MBPOL_POLY_REAL t1970 = t1969*t275;
+    const MBPOL_POLY_REAL t1971 = a[283];
+    const MBPOL_POLY_REAL t1972 = t1971*t254;
+    const MBPOL_POLY_REAL t1973 = a[182];
+    const MBPOL_POLY_REAL t1974 = t1973*t212;
+    const MBPOL_POLY_REAL t1975 = t1958+t1959+t1960+t1962+t1964+t1965+t1966+t1968+t1970+t1972+t1974;
+    const MBPOL_POLY_REAL t1978 = a[960];
+    const MBPOL_POLY_REAL t1979 = t1978*t5;
+    const MBPOL_POLY_REAL t1980 = a[891];
+    const MBPOL_POLY_REAL t1981 = t1980*t20;
+    const MBPOL_POLY_REAL t1982 = a[287];
+    const MBPOL_POLY_REAL t1983 = t1978*t26;
+    const MBPOL_POLY_REAL t1984 = t1980*t37;
+    const MBPOL_POLY_REAL t1985 = a[683];
+    const MBPOL_POLY_REAL t1986 = t1985*t50;
+    const MBPOL_POLY_REAL t1987 = t1985*t67;
+    const MBPOL_POLY_REAL t1988 = a[718];
+    const MBPOL_POLY_REAL t1989 = t1988*t72;
+    const MBPOL_POLY_REAL t1990 = a[678];
+    const MBPOL_POLY_REAL t1991 = t1990*t73;
+    const MBPOL_POLY_REAL t1992 = a[766];
+    const MBPOL_POLY_REAL t1994 = a[621];
+    const MBPOL_POLY_REAL t1995 = t1994*t126;
+    const MBPOL_POLY_REAL t1996 = a[652];
+    const MBPOL_POLY_REAL t1998 = t1979+t1981+t1982+t1983+t1984+t1986+t1987+t1989+t1991+t1992*t77+
 t1995+t1996*t132;
-    const double t2000 = a[721];
-    const double t2001 = t2000*t126;
-    const double t2002 = a[794];
-    const double t2003 = t2002*t132;
-    const double t2004 = t2000*t136;
-    const double t2005 = t2002*t77;
-    const double t2006 = a[659];
-    const double t2007 = t2006*t139;
-    const double t2008 = a[636];
-    const double t2009 = t2008*t72;
-    const double t2010 = a[624];
-    const double t2011 = t2010*t50;
-    const double t2012 = t2010*t67;
-    const double t2013 = t2006*t146;
-    const double t2014 = a[864];
-    const double t2015 = t2014*t155;
-    const double t2016 = a[711];
-    const double t2017 = t2016*t212;
-    const double t2018 = a[807];
-    const double t2019 = t2018*t215;
-    const double t2020 = t2001+t2003+t2004+t2005+t2007+t2009+t2011+t2012+t2013+t2015+t2017+
+    const MBPOL_POLY_REAL t2000 = a[721];
+    const MBPOL_POLY_REAL t2001 = t2000*t126;
+    const MBPOL_POLY_REAL t2002 = a[794];
+    const MBPOL_POLY_REAL t2003 = t2002*t132;
+    const MBPOL_POLY_REAL t2004 = t2000*t136;
+    const MBPOL_POLY_REAL t2005 = t2002*t77;
+    const MBPOL_POLY_REAL t2006 = a[659];
+    const MBPOL_POLY_REAL t2007 = t2006*t139;
+    const MBPOL_POLY_REAL t2008 = a[636];
+    const MBPOL_POLY_REAL t2009 = t2008*t72;
+    const MBPOL_POLY_REAL t2010 = a[624];
+    const MBPOL_POLY_REAL t2011 = t2010*t50;
+    const MBPOL_POLY_REAL t2012 = t2010*t67;
+    const MBPOL_POLY_REAL t2013 = t2006*t146;
+    const MBPOL_POLY_REAL t2014 = a[864];
+    const MBPOL_POLY_REAL t2015 = t2014*t155;
+    const MBPOL_POLY_REAL t2016 = a[711];
+    const MBPOL_POLY_REAL t2017 = t2016*t212;
+    const MBPOL_POLY_REAL t2018 = a[807];
+    const MBPOL_POLY_REAL t2019 = t2018*t215;
+    const MBPOL_POLY_REAL t2020 = t2001+t2003+t2004+t2005+t2007+t2009+t2011+t2012+t2013+t2015+t2017+
 t2019;
-    const double t2021 = a[868];
-    const double t2022 = t2021*t275;
-    const double t2023 = t2014*t145;
-    const double t2024 = a[131];
-    const double t2025 = t2008*t73;
-    const double t2026 = a[715];
-    const double t2027 = t2026*t5;
-    const double t2028 = t2026*t20;
-    const double t2029 = t2026*t26;
-    const double t2030 = t2026*t37;
-    const double t1791 = a[1121];
-    const double t2032 = t1791*t179;
-    const double t2033 = a[777];
-    const double t2034 = t2033*t143;
-    const double t2035 = a[677];
-    const double t2036 = t2035*t254;
-    const double t2037 = a[767];
-    const double t2038 = t2037*t309;
-    const double t2039 = a[719];
-    const double t2040 = t2039*t240;
-    const double t2041 = t2022+t2023+t2024+t2025+t2027+t2028+t2029+t2030+t2032+t2034+t2036+
+    const MBPOL_POLY_REAL t2021 = a[868];
+    const MBPOL_POLY_REAL t2022 = t2021*t275;
+    const MBPOL_POLY_REAL t2023 = t2014*t145;
+    const MBPOL_POLY_REAL t2024 = a[131];
+    const MBPOL_POLY_REAL t2025 = t2008*t73;
+    const MBPOL_POLY_REAL t2026 = a[715];
+    const MBPOL_POLY_REAL t2027 = t2026*t5;
+    const MBPOL_POLY_REAL t2028 = t2026*t20;
+    const MBPOL_POLY_REAL t2029 = t2026*t26;
+    const MBPOL_POLY_REAL t2030 = t2026*t37;
+    const MBPOL_POLY_REAL t1791 = a[1121];
+    const MBPOL_POLY_REAL t2032 = t1791*t179;
+    const MBPOL_POLY_REAL t2033 = a[777];
+    const MBPOL_POLY_REAL t2034 = t2033*t143;
+    const MBPOL_POLY_REAL t2035 = a[677];
+    const MBPOL_POLY_REAL t2036 = t2035*t254;
+    const MBPOL_POLY_REAL t2037 = a[767];
+    const MBPOL_POLY_REAL t2038 = t2037*t309;
+    const MBPOL_POLY_REAL t2039 = a[719];
+    const MBPOL_POLY_REAL t2040 = t2039*t240;
+    const MBPOL_POLY_REAL t2041 = t2022+t2023+t2024+t2025+t2027+t2028+t2029+t2030+t2032+t2034+t2036+
 t2038+t2040;
-    const double t2044 = a[241];
-    const double t2045 = a[983];
-    const double t2046 = t2045*t5;
-    const double t2047 = a[932];
-    const double t2048 = t2047*t20;
-    const double t2049 = a[759];
-    const double t2050 = t2049*t26;
-    const double t1793 = t2044+t2046+t2048+t2050;
-    const double t2052 = t1793*t26;
-    const double t2053 = a[724];
-    const double t2054 = t2053*t5;
-    const double t2055 = a[554];
-    const double t2056 = t2053*t20;
-    const double t2057 = t2053*t26;
-    const double t2058 = t2053*t37;
-    const double t2059 = a[730];
-    const double t2060 = t2059*t50;
-    const double t2061 = t2059*t67;
-    const double t2062 = a[686];
-    const double t2063 = t2062*t72;
-    const double t2064 = t2062*t73;
-    const double t2065 = a[1089];
-    const double t2067 = a[1000];
-    const double t2071 = a[1031];
-    const double t2072 = t2071*t139;
-    const double t2073 = t2071*t145;
-    const double t2074 = t2071*t146;
-    const double t2075 = t2071*t155;
-    const double t1794 = a[1009];
-    const double t2077 = t1794*t179;
-    const double t2078 = a[1123];
-    const double t2079 = t2078*t275;
-    const double t2080 = a[704];
-    const double t2082 = t2054+t2055+t2056+t2057+t2058+t2060+t2061+t2063+t2064+t2065*t77+
+    const MBPOL_POLY_REAL t2044 = a[241];
+    const MBPOL_POLY_REAL t2045 = a[983];
+    const MBPOL_POLY_REAL t2046 = t2045*t5;
+    const MBPOL_POLY_REAL t2047 = a[932];
+    const MBPOL_POLY_REAL t2048 = t2047*t20;
+    const MBPOL_POLY_REAL t2049 = a[759];
+    const MBPOL_POLY_REAL t2050 = t2049*t26;
+    const MBPOL_POLY_REAL t1793 = t2044+t2046+t2048+t2050;
+    const MBPOL_POLY_REAL t2052 = t1793*t26;
+    const MBPOL_POLY_REAL t2053 = a[724];
+    const MBPOL_POLY_REAL t2054 = t2053*t5;
+    const MBPOL_POLY_REAL t2055 = a[554];
+    const MBPOL_POLY_REAL t2056 = t2053*t20;
+    const MBPOL_POLY_REAL t2057 = t2053*t26;
+    const MBPOL_POLY_REAL t2058 = t2053*t37;
+    const MBPOL_POLY_REAL t2059 = a[730];
+    const MBPOL_POLY_REAL t2060 = t2059*t50;
+    const MBPOL_POLY_REAL t2061 = t2059*t67;
+    const MBPOL_POLY_REAL t2062 = a[686];
+    const MBPOL_POLY_REAL t2063 = t2062*t72;
+    const MBPOL_POLY_REAL t2064 = t2062*t73;
+    const MBPOL_POLY_REAL t2065 = a[1089];
+    const MBPOL_POLY_REAL t2067 = a[1000];
+    const MBPOL_POLY_REAL t2071 = a[1031];
+    const MBPOL_POLY_REAL t2072 = t2071*t139;
+    const MBPOL_POLY_REAL t2073 = t2071*t145;
+    const MBPOL_POLY_REAL t2074 = t2071*t146;
+    const MBPOL_POLY_REAL t2075 = t2071*t155;
+    const MBPOL_POLY_REAL t1794 = a[1009];
+    const MBPOL_POLY_REAL t2077 = t1794*t179;
+    const MBPOL_POLY_REAL t2078 = a[1123];
+    const MBPOL_POLY_REAL t2079 = t2078*t275;
+    const MBPOL_POLY_REAL t2080 = a[704];
+    const MBPOL_POLY_REAL t2082 = t2054+t2055+t2056+t2057+t2058+t2060+t2061+t2063+t2064+t2065*t77+
 t2067*t126+t2065*t132+t2067*t136+t2072+t2073+t2074+t2075+t2077+t2079+t2080*t254
 ;
-    const double t2084 = a[579];
-    const double t2085 = t2084*t5;
-    const double t2086 = a[270];
-    const double t2087 = t2084*t20;
-    const double t2088 = a[757];
-    const double t2089 = t2088*t26;
-    const double t2090 = t2088*t37;
-    const double t2091 = a[754];
-    const double t2092 = t2091*t50;
-    const double t2093 = a[699];
-    const double t2094 = t2093*t67;
-    const double t2095 = a[568];
-    const double t2096 = t2095*t72;
-    const double t2097 = t2095*t73;
-    const double t2098 = a[839];
-    const double t2099 = t2098*t77;
-    const double t2100 = a[583];
-    const double t2101 = t2100*t126;
-    const double t2102 = t2098*t132;
-    const double t2103 = t2100*t136;
-    const double t2104 = a[1115];
-    const double t2105 = t2104*t139;
-    const double t2106 = a[885];
-    const double t2107 = t2106*t145;
-    const double t2108 = t2085+t2086+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t2099+t2101+
+    const MBPOL_POLY_REAL t2084 = a[579];
+    const MBPOL_POLY_REAL t2085 = t2084*t5;
+    const MBPOL_POLY_REAL t2086 = a[270];
+    const MBPOL_POLY_REAL t2087 = t2084*t20;
+    const MBPOL_POLY_REAL t2088 = a[757];
+    const MBPOL_POLY_REAL t2089 = t2088*t26;
+    const MBPOL_POLY_REAL t2090 = t2088*t37;
+    const MBPOL_POLY_REAL t2091 = a[754];
+    const MBPOL_POLY_REAL t2092 = t2091*t50;
+    const MBPOL_POLY_REAL t2093 = a[699];
+    const MBPOL_POLY_REAL t2094 = t2093*t67;
+    const MBPOL_POLY_REAL t2095 = a[568];
+    const MBPOL_POLY_REAL t2096 = t2095*t72;
+    const MBPOL_POLY_REAL t2097 = t2095*t73;
+    const MBPOL_POLY_REAL t2098 = a[839];
+    const MBPOL_POLY_REAL t2099 = t2098*t77;
+    const MBPOL_POLY_REAL t2100 = a[583];
+    const MBPOL_POLY_REAL t2101 = t2100*t126;
+    const MBPOL_POLY_REAL t2102 = t2098*t132;
+    const MBPOL_POLY_REAL t2103 = t2100*t136;
+    const MBPOL_POLY_REAL t2104 = a[1115];
+    const MBPOL_POLY_REAL t2105 = t2104*t139;
+    const MBPOL_POLY_REAL t2106 = a[885];
+    const MBPOL_POLY_REAL t2107 = t2106*t145;
+    const MBPOL_POLY_REAL t2108 = t2085+t2086+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t2099+t2101+
 t2102+t2103+t2105+t2107;
-    const double t2110 = a[181];
-    const double t2111 = a[613];
-    const double t2112 = t2111*t20;
-    const double t2113 = a[709];
-    const double t2114 = t2113*t5;
-    const double t2115 = t2113*t26;
-    const double t2116 = t2111*t37;
-    const double t2117 = a[679];
-    const double t2118 = t2117*t50;
-    const double t2119 = t2117*t67;
-    const double t2120 = a[765];
-    const double t2122 = a[901];
-    const double t1801 = t2120*t72;
-    const double t1802 = t2122*t73;
-    const double t2125 = (t2110+t2112+t2114+t2115+t2116+t2118+t2119+t1801+t1802)*t73;
-    const double t2126 = t2111*t5;
-    const double t2127 = t2113*t20;
-    const double t2128 = t2111*t26;
-    const double t2129 = t2113*t37;
-    const double t1809 = t2122*t72;
-    const double t2132 = (t2126+t2110+t2127+t2128+t2129+t2118+t2119+t1809)*t72;
-    const double t2133 = a[1035];
-    const double t2134 = t2133*t5;
-    const double t2135 = a[113];
-    const double t2136 = t2133*t20;
-    const double t2137 = t2133*t26;
-    const double t2138 = t2133*t37;
-    const double t2139 = a[865];
-    const double t2140 = t2139*t50;
-    const double t2141 = t2139*t67;
-    const double t2142 = a[830];
-    const double t2143 = t2142*t72;
-    const double t2144 = t2142*t73;
-    const double t2145 = a[992];
-    const double t2146 = t2145*t77;
-    const double t2147 = a[918];
-    const double t2148 = t2147*t126;
-    const double t2149 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t2146+t2148;
-    const double t2150 = t2145*t132;
-    const double t2151 = t2147*t136;
-    const double t2152 = a[661];
-    const double t2153 = t2152*t139;
-    const double t2154 = a[875];
-    const double t2155 = t2154*t145;
-    const double t2156 = t2152*t146;
-    const double t2157 = t2154*t155;
-    const double t1811 = a[819];
-    const double t2159 = t1811*t179;
-    const double t2160 = a[989];
-    const double t2161 = t2160*t275;
-    const double t2162 = a[899];
-    const double t2163 = t2162*t254;
-    const double t2164 = a[1128];
-    const double t2165 = t2164*t212;
-    const double t2166 = a[1143];
-    const double t2167 = t2166*t215;
-    const double t2168 = t2150+t2151+t2153+t2155+t2156+t2157+t2159+t2161+t2163+t2165+t2167;
-    const double t2172 = t2047*t5;
-    const double t2173 = a[1053];
-    const double t2175 = t2049*t37;
-    const double t1818 = t2045*t20+t2172+t2173*t26+t2044+t2175;
-    const double t2177 = t1818*t37;
-    const double t2178 = a[897];
-    const double t2179 = t2178*t5;
-    const double t2180 = a[127];
-    const double t2181 = t2178*t20;
-    const double t2182 = a[694];
-    const double t2183 = t2182*t26;
-    const double t2184 = t2182*t37;
-    const double t2185 = a[1003];
-    const double t1821 = t2185*t50;
-    const double t2188 = (t2179+t2180+t2181+t2183+t2184+t1821)*t50;
-    const double t2189 = a[435];
-    const double t2190 = a[1070];
-    const double t2191 = t2190*t5;
-    const double t2192 = t2190*t20;
-    const double t2193 = t2190*t26;
-    const double t2194 = t2190*t37;
-    const double t2195 = a[967];
-    const double t2196 = t2195*t50;
-    const double t2197 = t2195*t67;
-    const double t2198 = a[980];
-    const double t2199 = t2198*t72;
-    const double t2200 = t2198*t73;
-    const double t2201 = a[672];
-    const double t2203 = a[783];
-    const double t2207 = a[688];
-    const double t2208 = t2207*t139;
-    const double t2209 = t2207*t145;
-    const double t2210 = t2207*t146;
-    const double t2211 = t2207*t155;
-    const double t1825 = a[1129];
-    const double t2213 = t1825*t179;
-    const double t2214 = a[974];
-    const double t2216 = t2189+t2191+t2192+t2193+t2194+t2196+t2197+t2199+t2200+t2201*t77+
+    const MBPOL_POLY_REAL t2110 = a[181];
+    const MBPOL_POLY_REAL t2111 = a[613];
+    const MBPOL_POLY_REAL t2112 = t2111*t20;
+    const MBPOL_POLY_REAL t2113 = a[709];
+    const MBPOL_POLY_REAL t2114 = t2113*t5;
+    const MBPOL_POLY_REAL t2115 = t2113*t26;
+    const MBPOL_POLY_REAL t2116 = t2111*t37;
+    const MBPOL_POLY_REAL t2117 = a[679];
+    const MBPOL_POLY_REAL t2118 = t2117*t50;
+    const MBPOL_POLY_REAL t2119 = t2117*t67;
+    const MBPOL_POLY_REAL t2120 = a[765];
+    const MBPOL_POLY_REAL t2122 = a[901];
+    const MBPOL_POLY_REAL t1801 = t2120*t72;
+    const MBPOL_POLY_REAL t1802 = t2122*t73;
+    const MBPOL_POLY_REAL t2125 = (t2110+t2112+t2114+t2115+t2116+t2118+t2119+t1801+t1802)*t73;
+    const MBPOL_POLY_REAL t2126 = t2111*t5;
+    const MBPOL_POLY_REAL t2127 = t2113*t20;
+    const MBPOL_POLY_REAL t2128 = t2111*t26;
+    const MBPOL_POLY_REAL t2129 = t2113*t37;
+    const MBPOL_POLY_REAL t1809 = t2122*t72;
+    const MBPOL_POLY_REAL t2132 = (t2126+t2110+t2127+t2128+t2129+t2118+t2119+t1809)*t72;
+    const MBPOL_POLY_REAL t2133 = a[1035];
+    const MBPOL_POLY_REAL t2134 = t2133*t5;
+    const MBPOL_POLY_REAL t2135 = a[113];
+    const MBPOL_POLY_REAL t2136 = t2133*t20;
+    const MBPOL_POLY_REAL t2137 = t2133*t26;
+    const MBPOL_POLY_REAL t2138 = t2133*t37;
+    const MBPOL_POLY_REAL t2139 = a[865];
+    const MBPOL_POLY_REAL t2140 = t2139*t50;
+    const MBPOL_POLY_REAL t2141 = t2139*t67;
+    const MBPOL_POLY_REAL t2142 = a[830];
+    const MBPOL_POLY_REAL t2143 = t2142*t72;
+    const MBPOL_POLY_REAL t2144 = t2142*t73;
+    const MBPOL_POLY_REAL t2145 = a[992];
+    const MBPOL_POLY_REAL t2146 = t2145*t77;
+    const MBPOL_POLY_REAL t2147 = a[918];
+    const MBPOL_POLY_REAL t2148 = t2147*t126;
+    const MBPOL_POLY_REAL t2149 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t2146+t2148;
+    const MBPOL_POLY_REAL t2150 = t2145*t132;
+    const MBPOL_POLY_REAL t2151 = t2147*t136;
+    const MBPOL_POLY_REAL t2152 = a[661];
+    const MBPOL_POLY_REAL t2153 = t2152*t139;
+    const MBPOL_POLY_REAL t2154 = a[875];
+    const MBPOL_POLY_REAL t2155 = t2154*t145;
+    const MBPOL_POLY_REAL t2156 = t2152*t146;
+    const MBPOL_POLY_REAL t2157 = t2154*t155;
+    const MBPOL_POLY_REAL t1811 = a[819];
+    const MBPOL_POLY_REAL t2159 = t1811*t179;
+    const MBPOL_POLY_REAL t2160 = a[989];
+    const MBPOL_POLY_REAL t2161 = t2160*t275;
+    const MBPOL_POLY_REAL t2162 = a[899];
+    const MBPOL_POLY_REAL t2163 = t2162*t254;
+    const MBPOL_POLY_REAL t2164 = a[1128];
+    const MBPOL_POLY_REAL t2165 = t2164*t212;
+    const MBPOL_POLY_REAL t2166 = a[1143];
+    const MBPOL_POLY_REAL t2167 = t2166*t215;
+    const MBPOL_POLY_REAL t2168 = t2150+t2151+t2153+t2155+t2156+t2157+t2159+t2161+t2163+t2165+t2167;
+    const MBPOL_POLY_REAL t2172 = t2047*t5;
+    const MBPOL_POLY_REAL t2173 = a[1053];
+    const MBPOL_POLY_REAL t2175 = t2049*t37;
+    const MBPOL_POLY_REAL t1818 = t2045*t20+t2172+t2173*t26+t2044+t2175;
+    const MBPOL_POLY_REAL t2177 = t1818*t37;
+    const MBPOL_POLY_REAL t2178 = a[897];
+    const MBPOL_POLY_REAL t2179 = t2178*t5;
+    const MBPOL_POLY_REAL t2180 = a[127];
+    const MBPOL_POLY_REAL t2181 = t2178*t20;
+    const MBPOL_POLY_REAL t2182 = a[694];
+    const MBPOL_POLY_REAL t2183 = t2182*t26;
+    const MBPOL_POLY_REAL t2184 = t2182*t37;
+    const MBPOL_POLY_REAL t2185 = a[1003];
+    const MBPOL_POLY_REAL t1821 = t2185*t50;
+    const MBPOL_POLY_REAL t2188 = (t2179+t2180+t2181+t2183+t2184+t1821)*t50;
+    const MBPOL_POLY_REAL t2189 = a[435];
+    const MBPOL_POLY_REAL t2190 = a[1070];
+    const MBPOL_POLY_REAL t2191 = t2190*t5;
+    const MBPOL_POLY_REAL t2192 = t2190*t20;
+    const MBPOL_POLY_REAL t2193 = t2190*t26;
+    const MBPOL_POLY_REAL t2194 = t2190*t37;
+    const MBPOL_POLY_REAL t2195 = a[967];
+    const MBPOL_POLY_REAL t2196 = t2195*t50;
+    const MBPOL_POLY_REAL t2197 = t2195*t67;
+    const MBPOL_POLY_REAL t2198 = a[980];
+    const MBPOL_POLY_REAL t2199 = t2198*t72;
+    const MBPOL_POLY_REAL t2200 = t2198*t73;
+    const MBPOL_POLY_REAL t2201 = a[672];
+    const MBPOL_POLY_REAL t2203 = a[783];
+    const MBPOL_POLY_REAL t2207 = a[688];
+    const MBPOL_POLY_REAL t2208 = t2207*t139;
+    const MBPOL_POLY_REAL t2209 = t2207*t145;
+    const MBPOL_POLY_REAL t2210 = t2207*t146;
+    const MBPOL_POLY_REAL t2211 = t2207*t155;
+    const MBPOL_POLY_REAL t1825 = a[1129];
+    const MBPOL_POLY_REAL t2213 = t1825*t179;
+    const MBPOL_POLY_REAL t2214 = a[974];
+    const MBPOL_POLY_REAL t2216 = t2189+t2191+t2192+t2193+t2194+t2196+t2197+t2199+t2200+t2201*t77+
 t2203*t126+t2201*t132+t2203*t136+t2208+t2209+t2210+t2211+t2213+t2214*t275;
-    const double t2219 = t2154*t139;
-    const double t2220 = t2152*t145;
-    const double t2221 = t2154*t146;
-    const double t2222 = t2152*t155;
-    const double t2223 = t2166*t212;
-    const double t2224 = t2148+t2150+t2151+t2219+t2220+t2221+t2222+t2159+t2161+t2163+t2223;
-    const double t1837 = t2020+t2041;
-    const double t1842 = t2149+t2168;
-    const double t1848 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t2146+t2224;
-    const double t2227 = t1998*t132+t1837*t240+t2052+t2082*t254+t2108*t145+t2125+t2132+t1842
+    const MBPOL_POLY_REAL t2219 = t2154*t139;
+    const MBPOL_POLY_REAL t2220 = t2152*t145;
+    const MBPOL_POLY_REAL t2221 = t2154*t146;
+    const MBPOL_POLY_REAL t2222 = t2152*t155;
+    const MBPOL_POLY_REAL t2223 = t2166*t212;
+    const MBPOL_POLY_REAL t2224 = t2148+t2150+t2151+t2219+t2220+t2221+t2222+t2159+t2161+t2163+t2223;
+    const MBPOL_POLY_REAL t1837 = t2020+t2041;
+    const MBPOL_POLY_REAL t1842 = t2149+t2168;
+    const MBPOL_POLY_REAL t1848 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t2146+t2224;
+    const MBPOL_POLY_REAL t2227 = t1998*t132+t1837*t240+t2052+t2082*t254+t2108*t145+t2125+t2132+t1842
 *t215+t2177+t2188+t2216*t275+t1848*t212;
-    const double t2228 = t2182*t5;
-    const double t2229 = t2182*t20;
-    const double t2230 = t2178*t26;
-    const double t2231 = t2178*t37;
-    const double t2232 = a[1060];
-    const double t1858 = t2232*t50;
-    const double t1861 = t2185*t67;
-    const double t2236 = (t2228+t2180+t2229+t2230+t2231+t1858+t1861)*t67;
-    const double t2237 = t2088*t5;
-    const double t2238 = t2088*t20;
-    const double t2239 = t2084*t26;
-    const double t2240 = t2084*t37;
-    const double t2241 = t2093*t50;
-    const double t2242 = t2091*t67;
-    const double t2243 = a[560];
-    const double t2244 = t2243*t139;
-    const double t2245 = a[863];
-    const double t2246 = t2245*t145;
-    const double t2247 = t2106*t146;
-    const double t2248 = t2086+t2237+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t2099+t2101+
+    const MBPOL_POLY_REAL t2228 = t2182*t5;
+    const MBPOL_POLY_REAL t2229 = t2182*t20;
+    const MBPOL_POLY_REAL t2230 = t2178*t26;
+    const MBPOL_POLY_REAL t2231 = t2178*t37;
+    const MBPOL_POLY_REAL t2232 = a[1060];
+    const MBPOL_POLY_REAL t1858 = t2232*t50;
+    const MBPOL_POLY_REAL t1861 = t2185*t67;
+    const MBPOL_POLY_REAL t2236 = (t2228+t2180+t2229+t2230+t2231+t1858+t1861)*t67;
+    const MBPOL_POLY_REAL t2237 = t2088*t5;
+    const MBPOL_POLY_REAL t2238 = t2088*t20;
+    const MBPOL_POLY_REAL t2239 = t2084*t26;
+    const MBPOL_POLY_REAL t2240 = t2084*t37;
+    const MBPOL_POLY_REAL t2241 = t2093*t50;
+    const MBPOL_POLY_REAL t2242 = t2091*t67;
+    const MBPOL_POLY_REAL t2243 = a[560];
+    const MBPOL_POLY_REAL t2244 = t2243*t139;
+    const MBPOL_POLY_REAL t2245 = a[863];
+    const MBPOL_POLY_REAL t2246 = t2245*t145;
+    const MBPOL_POLY_REAL t2247 = t2106*t146;
+    const MBPOL_POLY_REAL t2248 = t2086+t2237+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t2099+t2101+
 t2102+t2103+t2244+t2246+t2247;
-    const double t2250 = t2106*t139;
-    const double t2251 = t2085+t2086+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t2099+t2101+
+    const MBPOL_POLY_REAL t2250 = t2106*t139;
+    const MBPOL_POLY_REAL t2251 = t2085+t2086+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t2099+t2101+
 t2102+t2103+t2250;
-    const double t2253 = t2039*t475;
-    const double t2254 = t2037*t143;
-    const double t2255 = t2001+t2003+t2004+t2005+t2009+t2011+t2012+t2022+t2024+t2025+t2253+
+    const MBPOL_POLY_REAL t2253 = t2039*t475;
+    const MBPOL_POLY_REAL t2254 = t2037*t143;
+    const MBPOL_POLY_REAL t2255 = t2001+t2003+t2004+t2005+t2009+t2011+t2012+t2022+t2024+t2025+t2253+
 t2254+t2027;
-    const double t2256 = a[1112];
-    const double t2258 = t2006*t155;
-    const double t2259 = t2016*t215;
-    const double t2260 = t2033*t309;
-    const double t2261 = t2014*t146;
-    const double t2262 = t2014*t139;
-    const double t2263 = t2018*t212;
-    const double t2264 = t2006*t145;
-    const double t2265 = t2028+t2029+t2030+t2032+t2036+t2256*t240+t2258+t2259+t2260+t2261+
+    const MBPOL_POLY_REAL t2256 = a[1112];
+    const MBPOL_POLY_REAL t2258 = t2006*t155;
+    const MBPOL_POLY_REAL t2259 = t2016*t215;
+    const MBPOL_POLY_REAL t2260 = t2033*t309;
+    const MBPOL_POLY_REAL t2261 = t2014*t146;
+    const MBPOL_POLY_REAL t2262 = t2014*t139;
+    const MBPOL_POLY_REAL t2263 = t2018*t212;
+    const MBPOL_POLY_REAL t2264 = t2006*t145;
+    const MBPOL_POLY_REAL t2265 = t2028+t2029+t2030+t2032+t2036+t2256*t240+t2258+t2259+t2260+t2261+
 t2262+t2263+t2264;
-    const double t2268 = a[525];
-    const double t2269 = a[782];
-    const double t2270 = t2269*t5;
-    const double t2271 = t2269*t20;
-    const double t2272 = t2269*t26;
-    const double t2273 = t2269*t37;
-    const double t2274 = a[791];
-    const double t2275 = t2274*t50;
-    const double t2276 = t2274*t67;
-    const double t2277 = a[563];
-    const double t2278 = t2277*t72;
-    const double t2279 = t2277*t73;
-    const double t2280 = a[824];
-    const double t2281 = t2280*t77;
-    const double t2282 = a[744];
-    const double t2283 = t2282*t126;
-    const double t2284 = t2268+t2270+t2271+t2272+t2273+t2275+t2276+t2278+t2279+t2281+t2283;
-    const double t2285 = t2280*t132;
-    const double t2286 = t2282*t136;
-    const double t2287 = a[909];
-    const double t2288 = t2287*t139;
-    const double t2289 = a[618];
-    const double t2290 = t2289*t145;
-    const double t2291 = t2287*t146;
-    const double t2292 = t2289*t155;
-    const double t1876 = a[973];
-    const double t2294 = t1876*t179;
-    const double t2295 = a[758];
-    const double t2296 = t2295*t275;
-    const double t2297 = a[1091];
-    const double t2298 = t2297*t254;
-    const double t2299 = a[1075];
-    const double t2300 = t2299*t212;
-    const double t2301 = a[1008];
-    const double t2302 = t2301*t215;
-    const double t2303 = a[853];
-    const double t2304 = t2303*t143;
-    const double t2305 = t2285+t2286+t2288+t2290+t2291+t2292+t2294+t2296+t2298+t2300+t2302+
+    const MBPOL_POLY_REAL t2268 = a[525];
+    const MBPOL_POLY_REAL t2269 = a[782];
+    const MBPOL_POLY_REAL t2270 = t2269*t5;
+    const MBPOL_POLY_REAL t2271 = t2269*t20;
+    const MBPOL_POLY_REAL t2272 = t2269*t26;
+    const MBPOL_POLY_REAL t2273 = t2269*t37;
+    const MBPOL_POLY_REAL t2274 = a[791];
+    const MBPOL_POLY_REAL t2275 = t2274*t50;
+    const MBPOL_POLY_REAL t2276 = t2274*t67;
+    const MBPOL_POLY_REAL t2277 = a[563];
+    const MBPOL_POLY_REAL t2278 = t2277*t72;
+    const MBPOL_POLY_REAL t2279 = t2277*t73;
+    const MBPOL_POLY_REAL t2280 = a[824];
+    const MBPOL_POLY_REAL t2281 = t2280*t77;
+    const MBPOL_POLY_REAL t2282 = a[744];
+    const MBPOL_POLY_REAL t2283 = t2282*t126;
+    const MBPOL_POLY_REAL t2284 = t2268+t2270+t2271+t2272+t2273+t2275+t2276+t2278+t2279+t2281+t2283;
+    const MBPOL_POLY_REAL t2285 = t2280*t132;
+    const MBPOL_POLY_REAL t2286 = t2282*t136;
+    const MBPOL_POLY_REAL t2287 = a[909];
+    const MBPOL_POLY_REAL t2288 = t2287*t139;
+    const MBPOL_POLY_REAL t2289 = a[618];
+    const MBPOL_POLY_REAL t2290 = t2289*t145;
+    const MBPOL_POLY_REAL t2291 = t2287*t146;
+    const MBPOL_POLY_REAL t2292 = t2289*t155;
+    const MBPOL_POLY_REAL t1876 = a[973];
+    const MBPOL_POLY_REAL t2294 = t1876*t179;
+    const MBPOL_POLY_REAL t2295 = a[758];
+    const MBPOL_POLY_REAL t2296 = t2295*t275;
+    const MBPOL_POLY_REAL t2297 = a[1091];
+    const MBPOL_POLY_REAL t2298 = t2297*t254;
+    const MBPOL_POLY_REAL t2299 = a[1075];
+    const MBPOL_POLY_REAL t2300 = t2299*t212;
+    const MBPOL_POLY_REAL t2301 = a[1008];
+    const MBPOL_POLY_REAL t2302 = t2301*t215;
+    const MBPOL_POLY_REAL t2303 = a[853];
+    const MBPOL_POLY_REAL t2304 = t2303*t143;
+    const MBPOL_POLY_REAL t2305 = t2285+t2286+t2288+t2290+t2291+t2292+t2294+t2296+t2298+t2300+t2302+
 t2304;
-    const double t2308 = a[558];
-    const double t2309 = a[939];
-    const double t2310 = t2309*t5;
-    const double t2311 = t2309*t20;
-    const double t2312 = t2309*t26;
-    const double t2313 = t2309*t37;
-    const double t2314 = a[808];
-    const double t2315 = t2314*t50;
-    const double t2316 = t2314*t67;
-    const double t2317 = a[1104];
-    const double t2318 = t2317*t72;
-    const double t2319 = t2317*t73;
-    const double t2320 = a[570];
-    const double t2322 = a[851];
-    const double t2326 = a[820];
-    const double t2327 = t2326*t139;
-    const double t2328 = t2326*t145;
-    const double t2329 = t2326*t146;
-    const double t2330 = t2326*t155;
-    const double t1883 = a[804];
-    const double t2332 = t1883*t179;
-    const double t2333 = t2308+t2310+t2311+t2312+t2313+t2315+t2316+t2318+t2319+t2320*t77+
+    const MBPOL_POLY_REAL t2308 = a[558];
+    const MBPOL_POLY_REAL t2309 = a[939];
+    const MBPOL_POLY_REAL t2310 = t2309*t5;
+    const MBPOL_POLY_REAL t2311 = t2309*t20;
+    const MBPOL_POLY_REAL t2312 = t2309*t26;
+    const MBPOL_POLY_REAL t2313 = t2309*t37;
+    const MBPOL_POLY_REAL t2314 = a[808];
+    const MBPOL_POLY_REAL t2315 = t2314*t50;
+    const MBPOL_POLY_REAL t2316 = t2314*t67;
+    const MBPOL_POLY_REAL t2317 = a[1104];
+    const MBPOL_POLY_REAL t2318 = t2317*t72;
+    const MBPOL_POLY_REAL t2319 = t2317*t73;
+    const MBPOL_POLY_REAL t2320 = a[570];
+    const MBPOL_POLY_REAL t2322 = a[851];
+    const MBPOL_POLY_REAL t2326 = a[820];
+    const MBPOL_POLY_REAL t2327 = t2326*t139;
+    const MBPOL_POLY_REAL t2328 = t2326*t145;
+    const MBPOL_POLY_REAL t2329 = t2326*t146;
+    const MBPOL_POLY_REAL t2330 = t2326*t155;
+    const MBPOL_POLY_REAL t1883 = a[804];
+    const MBPOL_POLY_REAL t2332 = t1883*t179;
+    const MBPOL_POLY_REAL t2333 = t2308+t2310+t2311+t2312+t2313+t2315+t2316+t2318+t2319+t2320*t77+
 t2322*t126+t2320*t132+t2322*t136+t2327+t2328+t2329+t2330+t2332;
-    const double t2335 = t1980*t5;
-    const double t2336 = t1978*t20;
-    const double t2337 = t1980*t26;
-    const double t2338 = t1978*t37;
-    const double t2339 = t1990*t72;
-    const double t2340 = t1988*t73;
-    const double t2344 = t2268+t2270+t2271+t2272+t2273+t2275+t2276+t2278+t2279+t2281+t2283+
+    const MBPOL_POLY_REAL t2335 = t1980*t5;
+    const MBPOL_POLY_REAL t2336 = t1978*t20;
+    const MBPOL_POLY_REAL t2337 = t1980*t26;
+    const MBPOL_POLY_REAL t2338 = t1978*t37;
+    const MBPOL_POLY_REAL t2339 = t1990*t72;
+    const MBPOL_POLY_REAL t2340 = t1988*t73;
+    const MBPOL_POLY_REAL t2344 = t2268+t2270+t2271+t2272+t2273+t2275+t2276+t2278+t2279+t2281+t2283+
 t2285;
-    const double t2345 = t2289*t139;
-    const double t2346 = t2287*t145;
-    const double t2347 = t2289*t146;
-    const double t2348 = t2287*t155;
-    const double t2349 = t2301*t212;
-    const double t2350 = t2299*t215;
-    const double t2351 = a[1090];
-    const double t2352 = t2351*t143;
-    const double t2353 = t2303*t309;
-    const double t2354 = t2286+t2345+t2346+t2347+t2348+t2294+t2296+t2298+t2349+t2350+t2352+
+    const MBPOL_POLY_REAL t2345 = t2289*t139;
+    const MBPOL_POLY_REAL t2346 = t2287*t145;
+    const MBPOL_POLY_REAL t2347 = t2289*t146;
+    const MBPOL_POLY_REAL t2348 = t2287*t155;
+    const MBPOL_POLY_REAL t2349 = t2301*t212;
+    const MBPOL_POLY_REAL t2350 = t2299*t215;
+    const MBPOL_POLY_REAL t2351 = a[1090];
+    const MBPOL_POLY_REAL t2352 = t2351*t143;
+    const MBPOL_POLY_REAL t2353 = t2303*t309;
+    const MBPOL_POLY_REAL t2354 = t2286+t2345+t2346+t2347+t2348+t2294+t2296+t2298+t2349+t2350+t2352+
 t2353;
-    const double t2357 = a[858];
-    const double t2358 = t2357*t20;
-    const double t2359 = a[272];
-    const double t2360 = a[650];
-    const double t2361 = t2360*t5;
-    const double t2362 = t2360*t26;
-    const double t2363 = t2357*t37;
-    const double t2364 = a[707];
-    const double t2365 = t2364*t50;
-    const double t2366 = t2364*t67;
-    const double t2367 = a[846];
-    const double t2368 = t2367*t72;
-    const double t2369 = a[1086];
-    const double t2370 = t2369*t73;
-    const double t2371 = t1994*t77;
-    const double t2372 = a[914];
-    const double t2374 = a[854];
-    const double t2375 = t2374*t132;
-    const double t2376 = a[632];
-    const double t2378 = t2358+t2359+t2361+t2362+t2363+t2365+t2366+t2368+t2370+t2371+t2372*
+    const MBPOL_POLY_REAL t2357 = a[858];
+    const MBPOL_POLY_REAL t2358 = t2357*t20;
+    const MBPOL_POLY_REAL t2359 = a[272];
+    const MBPOL_POLY_REAL t2360 = a[650];
+    const MBPOL_POLY_REAL t2361 = t2360*t5;
+    const MBPOL_POLY_REAL t2362 = t2360*t26;
+    const MBPOL_POLY_REAL t2363 = t2357*t37;
+    const MBPOL_POLY_REAL t2364 = a[707];
+    const MBPOL_POLY_REAL t2365 = t2364*t50;
+    const MBPOL_POLY_REAL t2366 = t2364*t67;
+    const MBPOL_POLY_REAL t2367 = a[846];
+    const MBPOL_POLY_REAL t2368 = t2367*t72;
+    const MBPOL_POLY_REAL t2369 = a[1086];
+    const MBPOL_POLY_REAL t2370 = t2369*t73;
+    const MBPOL_POLY_REAL t2371 = t1994*t77;
+    const MBPOL_POLY_REAL t2372 = a[914];
+    const MBPOL_POLY_REAL t2374 = a[854];
+    const MBPOL_POLY_REAL t2375 = t2374*t132;
+    const MBPOL_POLY_REAL t2376 = a[632];
+    const MBPOL_POLY_REAL t2378 = t2358+t2359+t2361+t2362+t2363+t2365+t2366+t2368+t2370+t2371+t2372*
 t126+t2375+t2376*t136;
-    const double t2380 = t2245*t139;
-    const double t2381 = t2243*t145;
-    const double t2382 = t2104*t146;
-    const double t2383 = t2106*t155;
-    const double t2384 = t2086+t2237+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t2099+t2101+
+    const MBPOL_POLY_REAL t2380 = t2245*t139;
+    const MBPOL_POLY_REAL t2381 = t2243*t145;
+    const MBPOL_POLY_REAL t2382 = t2104*t146;
+    const MBPOL_POLY_REAL t2383 = t2106*t155;
+    const MBPOL_POLY_REAL t2384 = t2086+t2237+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t2099+t2101+
 t2102+t2103+t2380+t2381+t2382+t2383;
-    const double t1940 = t2049*t5;
-    const double t2388 = (t2044+t1940)*t5;
-    const double t2389 = t2360*t20;
-    const double t2390 = t2357*t5;
-    const double t2391 = t2357*t26;
-    const double t2392 = t2360*t37;
-    const double t2393 = t2369*t72;
-    const double t2394 = t2367*t73;
-    const double t2395 = t2374*t77;
-    const double t2397 = t2389+t2390+t2359+t2391+t2392+t2365+t2366+t2393+t2394+t2395+t2376*
+    const MBPOL_POLY_REAL t1940 = t2049*t5;
+    const MBPOL_POLY_REAL t2388 = (t2044+t1940)*t5;
+    const MBPOL_POLY_REAL t2389 = t2360*t20;
+    const MBPOL_POLY_REAL t2390 = t2357*t5;
+    const MBPOL_POLY_REAL t2391 = t2357*t26;
+    const MBPOL_POLY_REAL t2392 = t2360*t37;
+    const MBPOL_POLY_REAL t2393 = t2369*t72;
+    const MBPOL_POLY_REAL t2394 = t2367*t73;
+    const MBPOL_POLY_REAL t2395 = t2374*t77;
+    const MBPOL_POLY_REAL t2397 = t2389+t2390+t2359+t2391+t2392+t2365+t2366+t2393+t2394+t2395+t2376*
 t126;
-    const double t2399 = t2173*t5;
-    const double t2400 = t2049*t20;
-    const double t1976 = t2044+t2399+t2400;
-    const double t2402 = t1976*t20;
-    const double t1997 = t2255+t2265;
-    const double t2031 = t2284+t2305;
-    const double t2051 = t1996*t77;
-    const double t2069 = t2344+t2354;
-    const double t2403 = t2236+t2248*t146+t2251*t139+t1997*t475+t2031*t143+t2333*t179+(t2335
+    const MBPOL_POLY_REAL t2399 = t2173*t5;
+    const MBPOL_POLY_REAL t2400 = t2049*t20;
+    const MBPOL_POLY_REAL t1976 = t2044+t2399+t2400;
+    const MBPOL_POLY_REAL t2402 = t1976*t20;
+    const MBPOL_POLY_REAL t1997 = t2255+t2265;
+    const MBPOL_POLY_REAL t2031 = t2284+t2305;
+    const MBPOL_POLY_REAL t2051 = t1996*t77;
+    const MBPOL_POLY_REAL t2069 = t2344+t2354;
+    const MBPOL_POLY_REAL t2403 = t2236+t2248*t146+t2251*t139+t1997*t475+t2031*t143+t2333*t179+(t2335
 +t2336+t1982+t2337+t2338+t1986+t1987+t2339+t2340+t2051)*t77+t2069*t309+t2378*
 t136+t2384*t155+t2388+t2397*t126+t2402;
-    const double t2109 = t1436*t77;
-    const double t2130 = t1477+t1499;
-    const double t2158 = t1736+t1843;
-    const double t2176 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t1955+t1975;
-    const double t2341 = x[2];
-    const double t2202 = (t2227+t2403)*t2341;
-    const double t2404 = x[3];
-    const double t2406 = (t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+t1435+t2109)*t77+
+    const MBPOL_POLY_REAL t2109 = t1436*t77;
+    const MBPOL_POLY_REAL t2130 = t1477+t1499;
+    const MBPOL_POLY_REAL t2158 = t1736+t1843;
+    const MBPOL_POLY_REAL t2176 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t1955+t1975;
+    const MBPOL_POLY_REAL t2341 = x[2];
+    const MBPOL_POLY_REAL t2202 = (t2227+t2403)*t2341;
+    const MBPOL_POLY_REAL t2404 = x[3];
+    const MBPOL_POLY_REAL t2406 = (t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+t1435+t2109)*t77+
 t1458*t126+t2130*t309+t2158*t2404+t1850+t1862*t132+t1877+t1884+t1896*t136+t1924
 *t146+t1930+t1941+t2176*t212+t2202;
-    const double t2407 = t1902*t5;
-    const double t2408 = t1902*t20;
-    const double t2409 = t1898*t26;
-    const double t2410 = t1898*t37;
-    const double t2411 = t1907*t50;
-    const double t2412 = t1905*t67;
-    const double t2413 = t1922*t139;
-    const double t2414 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t1913+t1915+
+    const MBPOL_POLY_REAL t2407 = t1902*t5;
+    const MBPOL_POLY_REAL t2408 = t1902*t20;
+    const MBPOL_POLY_REAL t2409 = t1898*t26;
+    const MBPOL_POLY_REAL t2410 = t1898*t37;
+    const MBPOL_POLY_REAL t2411 = t1907*t50;
+    const MBPOL_POLY_REAL t2412 = t1905*t67;
+    const MBPOL_POLY_REAL t2413 = t1922*t139;
+    const MBPOL_POLY_REAL t2414 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t1913+t1915+
 t1916+t1917+t2413;
-    const double t2416 = t1920*t139;
-    const double t2417 = t1918*t145;
-    const double t2418 = a[373];
-    const double t2419 = t2418*t146;
-    const double t2420 = t1922*t155;
-    const double t2421 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t1913+t1915+
+    const MBPOL_POLY_REAL t2416 = t1920*t139;
+    const MBPOL_POLY_REAL t2417 = t1918*t145;
+    const MBPOL_POLY_REAL t2418 = a[373];
+    const MBPOL_POLY_REAL t2419 = t2418*t146;
+    const MBPOL_POLY_REAL t2420 = t1922*t155;
+    const MBPOL_POLY_REAL t2421 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t1913+t1915+
 t1916+t1917+t2416+t2417+t2419+t2420;
-    const double t2423 = t1460+t1462+t1463+t1464+t1465+t1467+t1468+t1470+t1471+t1473+t1475;
-    const double t2424 = t1481*t139;
-    const double t2425 = t1479*t145;
-    const double t2426 = t1481*t146;
-    const double t2427 = t1479*t155;
-    const double t2428 = t1493*t212;
-    const double t2429 = t1491*t215;
-    const double t2430 = t1497*t143;
-    const double t2431 = t1476+t1478+t2424+t2425+t2426+t2427+t1486+t1488+t1490+t2428+t2429+
+    const MBPOL_POLY_REAL t2423 = t1460+t1462+t1463+t1464+t1465+t1467+t1468+t1470+t1471+t1473+t1475;
+    const MBPOL_POLY_REAL t2424 = t1481*t139;
+    const MBPOL_POLY_REAL t2425 = t1479*t145;
+    const MBPOL_POLY_REAL t2426 = t1481*t146;
+    const MBPOL_POLY_REAL t2427 = t1479*t155;
+    const MBPOL_POLY_REAL t2428 = t1493*t212;
+    const MBPOL_POLY_REAL t2429 = t1491*t215;
+    const MBPOL_POLY_REAL t2430 = t1497*t143;
+    const MBPOL_POLY_REAL t2431 = t1476+t1478+t2424+t2425+t2426+t2427+t1486+t1488+t1490+t2428+t2429+
 t2430;
-    const double t2434 = a[76];
-    const double t2435 = t2434*t5;
-    const double t2436 = a[62];
-    const double t2437 = t2434*t20;
-    const double t2438 = t2434*t26;
-    const double t2439 = t2434*t37;
-    const double t2440 = a[240];
-    const double t2441 = t2440*t50;
-    const double t2442 = t2440*t67;
-    const double t2443 = a[349];
-    const double t2444 = t2443*t72;
-    const double t2445 = t2443*t73;
-    const double t2446 = a[543];
-    const double t2448 = a[118];
-    const double t2452 = a[351];
-    const double t2453 = t2452*t139;
-    const double t2454 = t2452*t145;
-    const double t2455 = t2452*t146;
-    const double t2456 = t2452*t155;
-    const double t2204 = a[546];
-    const double t2458 = t2204*t179;
-    const double t2459 = t2435+t2436+t2437+t2438+t2439+t2441+t2442+t2444+t2445+t2446*t77+
+    const MBPOL_POLY_REAL t2434 = a[76];
+    const MBPOL_POLY_REAL t2435 = t2434*t5;
+    const MBPOL_POLY_REAL t2436 = a[62];
+    const MBPOL_POLY_REAL t2437 = t2434*t20;
+    const MBPOL_POLY_REAL t2438 = t2434*t26;
+    const MBPOL_POLY_REAL t2439 = t2434*t37;
+    const MBPOL_POLY_REAL t2440 = a[240];
+    const MBPOL_POLY_REAL t2441 = t2440*t50;
+    const MBPOL_POLY_REAL t2442 = t2440*t67;
+    const MBPOL_POLY_REAL t2443 = a[349];
+    const MBPOL_POLY_REAL t2444 = t2443*t72;
+    const MBPOL_POLY_REAL t2445 = t2443*t73;
+    const MBPOL_POLY_REAL t2446 = a[543];
+    const MBPOL_POLY_REAL t2448 = a[118];
+    const MBPOL_POLY_REAL t2452 = a[351];
+    const MBPOL_POLY_REAL t2453 = t2452*t139;
+    const MBPOL_POLY_REAL t2454 = t2452*t145;
+    const MBPOL_POLY_REAL t2455 = t2452*t146;
+    const MBPOL_POLY_REAL t2456 = t2452*t155;
+    const MBPOL_POLY_REAL t2204 = a[546];
+    const MBPOL_POLY_REAL t2458 = t2204*t179;
+    const MBPOL_POLY_REAL t2459 = t2435+t2436+t2437+t2438+t2439+t2441+t2442+t2444+t2445+t2446*t77+
 t2448*t126+t2446*t132+t2448*t136+t2453+t2454+t2455+t2456+t2458;
-    const double t2461 = t2418*t139;
-    const double t2462 = t1922*t145;
-    const double t2463 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t1913+t1915+
+    const MBPOL_POLY_REAL t2461 = t2418*t139;
+    const MBPOL_POLY_REAL t2462 = t1922*t145;
+    const MBPOL_POLY_REAL t2463 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t1913+t1915+
 t1916+t1917+t2461+t2462;
-    const double t2465 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t1955+t1958;
-    const double t2466 = t1963*t139;
-    const double t2467 = t1961*t145;
-    const double t2468 = t1963*t146;
-    const double t2469 = t1961*t155;
-    const double t2470 = a[341];
-    const double t2471 = t2470*t212;
-    const double t2472 = t1973*t215;
-    const double t2473 = t1959+t1960+t2466+t2467+t2468+t2469+t1968+t1970+t1972+t2471+t2472;
-    const double t2476 = a[115];
-    const double t2477 = t2476*t77;
-    const double t2478 = a[405];
-    const double t2479 = t2478*t146;
-    const double t2480 = a[440];
-    const double t2481 = t2480*t309;
-    const double t2482 = t2478*t139;
-    const double t2483 = a[224];
-    const double t2484 = t2483*t145;
-    const double t2485 = a[463];
-    const double t2486 = t2485*t72;
-    const double t2487 = a[291];
-    const double t2488 = t2487*t67;
-    const double t2489 = t2487*t50;
-    const double t2490 = a[532];
-    const double t2491 = t2490*t240;
-    const double t2492 = t2485*t73;
-    const double t2493 = a[263];
-    const double t2494 = t2493*t126;
-    const double t2495 = t2483*t155;
-    const double t2496 = t2477+t2479+t2481+t2482+t2484+t2486+t2488+t2489+t2491+t2492+t2494+
+    const MBPOL_POLY_REAL t2465 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t1955+t1958;
+    const MBPOL_POLY_REAL t2466 = t1963*t139;
+    const MBPOL_POLY_REAL t2467 = t1961*t145;
+    const MBPOL_POLY_REAL t2468 = t1963*t146;
+    const MBPOL_POLY_REAL t2469 = t1961*t155;
+    const MBPOL_POLY_REAL t2470 = a[341];
+    const MBPOL_POLY_REAL t2471 = t2470*t212;
+    const MBPOL_POLY_REAL t2472 = t1973*t215;
+    const MBPOL_POLY_REAL t2473 = t1959+t1960+t2466+t2467+t2468+t2469+t1968+t1970+t1972+t2471+t2472;
+    const MBPOL_POLY_REAL t2476 = a[115];
+    const MBPOL_POLY_REAL t2477 = t2476*t77;
+    const MBPOL_POLY_REAL t2478 = a[405];
+    const MBPOL_POLY_REAL t2479 = t2478*t146;
+    const MBPOL_POLY_REAL t2480 = a[440];
+    const MBPOL_POLY_REAL t2481 = t2480*t309;
+    const MBPOL_POLY_REAL t2482 = t2478*t139;
+    const MBPOL_POLY_REAL t2483 = a[224];
+    const MBPOL_POLY_REAL t2484 = t2483*t145;
+    const MBPOL_POLY_REAL t2485 = a[463];
+    const MBPOL_POLY_REAL t2486 = t2485*t72;
+    const MBPOL_POLY_REAL t2487 = a[291];
+    const MBPOL_POLY_REAL t2488 = t2487*t67;
+    const MBPOL_POLY_REAL t2489 = t2487*t50;
+    const MBPOL_POLY_REAL t2490 = a[532];
+    const MBPOL_POLY_REAL t2491 = t2490*t240;
+    const MBPOL_POLY_REAL t2492 = t2485*t73;
+    const MBPOL_POLY_REAL t2493 = a[263];
+    const MBPOL_POLY_REAL t2494 = t2493*t126;
+    const MBPOL_POLY_REAL t2495 = t2483*t155;
+    const MBPOL_POLY_REAL t2496 = t2477+t2479+t2481+t2482+t2484+t2486+t2488+t2489+t2491+t2492+t2494+
 t2495;
-    const double t2497 = a[72];
-    const double t2498 = t2497*t275;
-    const double t2499 = a[134];
-    const double t2500 = t2499*t254;
-    const double t2501 = t2476*t132;
-    const double t2502 = t2493*t136;
-    const double t2503 = a[398];
-    const double t2504 = t2503*t212;
-    const double t2505 = a[374];
-    const double t2506 = t2505*t215;
-    const double t2507 = a[12];
-    const double t2508 = a[370];
-    const double t2509 = t2508*t5;
-    const double t2510 = t2508*t20;
-    const double t2511 = t2508*t26;
-    const double t2512 = t2508*t37;
-    const double t2217 = a[91];
-    const double t2514 = t2217*t179;
-    const double t2515 = a[319];
-    const double t2516 = t2515*t143;
-    const double t2517 = t2498+t2500+t2501+t2502+t2504+t2506+t2507+t2509+t2510+t2511+t2512+
+    const MBPOL_POLY_REAL t2497 = a[72];
+    const MBPOL_POLY_REAL t2498 = t2497*t275;
+    const MBPOL_POLY_REAL t2499 = a[134];
+    const MBPOL_POLY_REAL t2500 = t2499*t254;
+    const MBPOL_POLY_REAL t2501 = t2476*t132;
+    const MBPOL_POLY_REAL t2502 = t2493*t136;
+    const MBPOL_POLY_REAL t2503 = a[398];
+    const MBPOL_POLY_REAL t2504 = t2503*t212;
+    const MBPOL_POLY_REAL t2505 = a[374];
+    const MBPOL_POLY_REAL t2506 = t2505*t215;
+    const MBPOL_POLY_REAL t2507 = a[12];
+    const MBPOL_POLY_REAL t2508 = a[370];
+    const MBPOL_POLY_REAL t2509 = t2508*t5;
+    const MBPOL_POLY_REAL t2510 = t2508*t20;
+    const MBPOL_POLY_REAL t2511 = t2508*t26;
+    const MBPOL_POLY_REAL t2512 = t2508*t37;
+    const MBPOL_POLY_REAL t2217 = a[91];
+    const MBPOL_POLY_REAL t2514 = t2217*t179;
+    const MBPOL_POLY_REAL t2515 = a[319];
+    const MBPOL_POLY_REAL t2516 = t2515*t143;
+    const MBPOL_POLY_REAL t2517 = t2498+t2500+t2501+t2502+t2504+t2506+t2507+t2509+t2510+t2511+t2512+
 t2514+t2516;
-    const double t2521 = t1878*t5;
-    const double t2523 = t1847*t37;
-    const double t2226 = t1846+t1926*t26+t2521+t1880*t20+t2523;
-    const double t2525 = t2226*t37;
-    const double t2526 = t1867*t20;
-    const double t2527 = t1865*t5;
-    const double t2528 = t1865*t26;
-    const double t2529 = t1867*t37;
-    const double t2530 = a[347];
-    const double t2233 = t2530*t72;
-    const double t2234 = t1874*t73;
-    const double t2534 = (t1864+t2526+t2527+t2528+t2529+t1872+t1873+t2233+t2234)*t73;
-    const double t2535 = a[24];
-    const double t2536 = a[510];
-    const double t2537 = t2536*t5;
-    const double t2538 = t2536*t20;
-    const double t2539 = t2536*t26;
-    const double t2540 = t2536*t37;
-    const double t2541 = a[414];
-    const double t2542 = t2541*t50;
-    const double t2543 = t2541*t67;
-    const double t2544 = a[71];
-    const double t2545 = t2544*t72;
-    const double t2546 = t2544*t73;
-    const double t2547 = a[321];
-    const double t2549 = a[495];
-    const double t2553 = a[404];
-    const double t2554 = t2553*t139;
-    const double t2555 = t2553*t145;
-    const double t2556 = t2553*t146;
-    const double t2557 = t2553*t155;
-    const double t2249 = a[383];
-    const double t2559 = t2249*t179;
-    const double t2560 = a[446];
-    const double t2561 = t2560*t275;
-    const double t2562 = a[527];
-    const double t2564 = t2535+t2537+t2538+t2539+t2540+t2542+t2543+t2545+t2546+t2547*t77+
+    const MBPOL_POLY_REAL t2521 = t1878*t5;
+    const MBPOL_POLY_REAL t2523 = t1847*t37;
+    const MBPOL_POLY_REAL t2226 = t1846+t1926*t26+t2521+t1880*t20+t2523;
+    const MBPOL_POLY_REAL t2525 = t2226*t37;
+    const MBPOL_POLY_REAL t2526 = t1867*t20;
+    const MBPOL_POLY_REAL t2527 = t1865*t5;
+    const MBPOL_POLY_REAL t2528 = t1865*t26;
+    const MBPOL_POLY_REAL t2529 = t1867*t37;
+    const MBPOL_POLY_REAL t2530 = a[347];
+    const MBPOL_POLY_REAL t2233 = t2530*t72;
+    const MBPOL_POLY_REAL t2234 = t1874*t73;
+    const MBPOL_POLY_REAL t2534 = (t1864+t2526+t2527+t2528+t2529+t1872+t1873+t2233+t2234)*t73;
+    const MBPOL_POLY_REAL t2535 = a[24];
+    const MBPOL_POLY_REAL t2536 = a[510];
+    const MBPOL_POLY_REAL t2537 = t2536*t5;
+    const MBPOL_POLY_REAL t2538 = t2536*t20;
+    const MBPOL_POLY_REAL t2539 = t2536*t26;
+    const MBPOL_POLY_REAL t2540 = t2536*t37;
+    const MBPOL_POLY_REAL t2541 = a[414];
+    const MBPOL_POLY_REAL t2542 = t2541*t50;
+    const MBPOL_POLY_REAL t2543 = t2541*t67;
+    const MBPOL_POLY_REAL t2544 = a[71];
+    const MBPOL_POLY_REAL t2545 = t2544*t72;
+    const MBPOL_POLY_REAL t2546 = t2544*t73;
+    const MBPOL_POLY_REAL t2547 = a[321];
+    const MBPOL_POLY_REAL t2549 = a[495];
+    const MBPOL_POLY_REAL t2553 = a[404];
+    const MBPOL_POLY_REAL t2554 = t2553*t139;
+    const MBPOL_POLY_REAL t2555 = t2553*t145;
+    const MBPOL_POLY_REAL t2556 = t2553*t146;
+    const MBPOL_POLY_REAL t2557 = t2553*t155;
+    const MBPOL_POLY_REAL t2249 = a[383];
+    const MBPOL_POLY_REAL t2559 = t2249*t179;
+    const MBPOL_POLY_REAL t2560 = a[446];
+    const MBPOL_POLY_REAL t2561 = t2560*t275;
+    const MBPOL_POLY_REAL t2562 = a[527];
+    const MBPOL_POLY_REAL t2564 = t2535+t2537+t2538+t2539+t2540+t2542+t2543+t2545+t2546+t2547*t77+
 t2549*t126+t2547*t132+t2549*t136+t2554+t2555+t2556+t2557+t2559+t2561+t2562*t254
 ;
-    const double t2566 = a[748];
-    const double t2567 = t2566*t5;
-    const double t2568 = a[245];
-    const double t2569 = t2566*t20;
-    const double t2570 = t2566*t26;
-    const double t2571 = t2566*t37;
-    const double t2572 = a[1124];
-    const double t2573 = t2572*t50;
-    const double t2574 = t2572*t67;
-    const double t2575 = a[816];
-    const double t2576 = t2575*t72;
-    const double t2577 = t2575*t73;
-    const double t2578 = a[988];
-    const double t2579 = t2578*t77;
-    const double t2581 = a[790];
-    const double t2582 = t2581*t126;
-    const double t2583 = t2578*t132;
-    const double t2584 = t2581*t136;
-    const double t2585 = a[778];
-    const double t2586 = t2585*t139;
-    const double t2587 = a[895];
-    const double t2588 = t2587*t145;
-    const double t2589 = t2585*t146;
-    const double t2590 = t2587*t155;
-    const double t2306 = a[1144];
-    const double t2592 = t2306*t179;
-    const double t2593 = a[1083];
-    const double t2594 = t2593*t275;
-    const double t2595 = a[569];
-    const double t2596 = t2595*t254;
-    const double t2597 = a[1097];
-    const double t2598 = t2597*t212;
-    const double t2599 = t2582+t2583+t2584+t2586+t2588+t2589+t2590+t2592+t2594+t2596+t2598;
-    const double t2602 = a[329];
-    const double t2603 = a[592];
-    const double t2604 = t2603*t5;
-    const double t2605 = t2603*t20;
-    const double t2606 = a[798];
-    const double t2607 = t2606*t26;
-    const double t2608 = t2606*t37;
-    const double t2609 = a[669];
-    const double t2307 = t2609*t50;
-    const double t2612 = (t2602+t2604+t2605+t2607+t2608+t2307)*t50;
-    const double t2613 = t2606*t5;
-    const double t2614 = t2606*t20;
-    const double t2615 = t2603*t26;
-    const double t2616 = t2603*t37;
-    const double t2617 = a[1065];
-    const double t2323 = t2617*t50;
-    const double t2324 = t2609*t67;
-    const double t2621 = (t2602+t2613+t2614+t2615+t2616+t2323+t2324)*t67;
-    const double t2622 = a[178];
-    const double t2623 = a[634];
-    const double t2624 = t2623*t5;
-    const double t2625 = t2623*t20;
-    const double t2626 = a[633];
-    const double t2627 = t2626*t26;
-    const double t2628 = t2626*t37;
-    const double t2629 = a[835];
-    const double t2630 = t2629*t50;
-    const double t2631 = a[680];
-    const double t2632 = t2631*t67;
-    const double t2633 = a[812];
-    const double t2634 = t2633*t72;
-    const double t2635 = t2633*t73;
-    const double t2636 = a[1011];
-    const double t2637 = t2636*t77;
-    const double t2638 = a[871];
-    const double t2639 = t2638*t126;
-    const double t2640 = t2636*t132;
-    const double t2641 = t2638*t136;
-    const double t2642 = a[962];
-    const double t2643 = t2642*t139;
-    const double t2644 = a[645];
-    const double t2645 = t2644*t145;
-    const double t2646 = a[995];
-    const double t2647 = t2646*t146;
-    const double t2648 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2637+t2639+
+    const MBPOL_POLY_REAL t2566 = a[748];
+    const MBPOL_POLY_REAL t2567 = t2566*t5;
+    const MBPOL_POLY_REAL t2568 = a[245];
+    const MBPOL_POLY_REAL t2569 = t2566*t20;
+    const MBPOL_POLY_REAL t2570 = t2566*t26;
+    const MBPOL_POLY_REAL t2571 = t2566*t37;
+    const MBPOL_POLY_REAL t2572 = a[1124];
+    const MBPOL_POLY_REAL t2573 = t2572*t50;
+    const MBPOL_POLY_REAL t2574 = t2572*t67;
+    const MBPOL_POLY_REAL t2575 = a[816];
+    const MBPOL_POLY_REAL t2576 = t2575*t72;
+    const MBPOL_POLY_REAL t2577 = t2575*t73;
+    const MBPOL_POLY_REAL t2578 = a[988];
+    const MBPOL_POLY_REAL t2579 = t2578*t77;
+    const MBPOL_POLY_REAL t2581 = a[790];
+    const MBPOL_POLY_REAL t2582 = t2581*t126;
+    const MBPOL_POLY_REAL t2583 = t2578*t132;
+    const MBPOL_POLY_REAL t2584 = t2581*t136;
+    const MBPOL_POLY_REAL t2585 = a[778];
+    const MBPOL_POLY_REAL t2586 = t2585*t139;
+    const MBPOL_POLY_REAL t2587 = a[895];
+    const MBPOL_POLY_REAL t2588 = t2587*t145;
+    const MBPOL_POLY_REAL t2589 = t2585*t146;
+    const MBPOL_POLY_REAL t2590 = t2587*t155;
+    const MBPOL_POLY_REAL t2306 = a[1144];
+    const MBPOL_POLY_REAL t2592 = t2306*t179;
+    const MBPOL_POLY_REAL t2593 = a[1083];
+    const MBPOL_POLY_REAL t2594 = t2593*t275;
+    const MBPOL_POLY_REAL t2595 = a[569];
+    const MBPOL_POLY_REAL t2596 = t2595*t254;
+    const MBPOL_POLY_REAL t2597 = a[1097];
+    const MBPOL_POLY_REAL t2598 = t2597*t212;
+    const MBPOL_POLY_REAL t2599 = t2582+t2583+t2584+t2586+t2588+t2589+t2590+t2592+t2594+t2596+t2598;
+    const MBPOL_POLY_REAL t2602 = a[329];
+    const MBPOL_POLY_REAL t2603 = a[592];
+    const MBPOL_POLY_REAL t2604 = t2603*t5;
+    const MBPOL_POLY_REAL t2605 = t2603*t20;
+    const MBPOL_POLY_REAL t2606 = a[798];
+    const MBPOL_POLY_REAL t2607 = t2606*t26;
+    const MBPOL_POLY_REAL t2608 = t2606*t37;
+    const MBPOL_POLY_REAL t2609 = a[669];
+    const MBPOL_POLY_REAL t2307 = t2609*t50;
+    const MBPOL_POLY_REAL t2612 = (t2602+t2604+t2605+t2607+t2608+t2307)*t50;
+    const MBPOL_POLY_REAL t2613 = t2606*t5;
+    const MBPOL_POLY_REAL t2614 = t2606*t20;
+    const MBPOL_POLY_REAL t2615 = t2603*t26;
+    const MBPOL_POLY_REAL t2616 = t2603*t37;
+    const MBPOL_POLY_REAL t2617 = a[1065];
+    const MBPOL_POLY_REAL t2323 = t2617*t50;
+    const MBPOL_POLY_REAL t2324 = t2609*t67;
+    const MBPOL_POLY_REAL t2621 = (t2602+t2613+t2614+t2615+t2616+t2323+t2324)*t67;
+    const MBPOL_POLY_REAL t2622 = a[178];
+    const MBPOL_POLY_REAL t2623 = a[634];
+    const MBPOL_POLY_REAL t2624 = t2623*t5;
+    const MBPOL_POLY_REAL t2625 = t2623*t20;
+    const MBPOL_POLY_REAL t2626 = a[633];
+    const MBPOL_POLY_REAL t2627 = t2626*t26;
+    const MBPOL_POLY_REAL t2628 = t2626*t37;
+    const MBPOL_POLY_REAL t2629 = a[835];
+    const MBPOL_POLY_REAL t2630 = t2629*t50;
+    const MBPOL_POLY_REAL t2631 = a[680];
+    const MBPOL_POLY_REAL t2632 = t2631*t67;
+    const MBPOL_POLY_REAL t2633 = a[812];
+    const MBPOL_POLY_REAL t2634 = t2633*t72;
+    const MBPOL_POLY_REAL t2635 = t2633*t73;
+    const MBPOL_POLY_REAL t2636 = a[1011];
+    const MBPOL_POLY_REAL t2637 = t2636*t77;
+    const MBPOL_POLY_REAL t2638 = a[871];
+    const MBPOL_POLY_REAL t2639 = t2638*t126;
+    const MBPOL_POLY_REAL t2640 = t2636*t132;
+    const MBPOL_POLY_REAL t2641 = t2638*t136;
+    const MBPOL_POLY_REAL t2642 = a[962];
+    const MBPOL_POLY_REAL t2643 = t2642*t139;
+    const MBPOL_POLY_REAL t2644 = a[645];
+    const MBPOL_POLY_REAL t2645 = t2644*t145;
+    const MBPOL_POLY_REAL t2646 = a[995];
+    const MBPOL_POLY_REAL t2647 = t2646*t146;
+    const MBPOL_POLY_REAL t2648 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2637+t2639+
 t2640+t2641+t2643+t2645+t2647;
-    const double t2650 = a[587];
-    const double t2651 = t2650*t5;
-    const double t2652 = a[785];
-    const double t2653 = t2652*t20;
-    const double t2654 = a[326];
-    const double t2655 = t2650*t26;
-    const double t2656 = t2652*t37;
-    const double t2657 = a[657];
-    const double t2658 = t2657*t50;
-    const double t2659 = t2657*t67;
-    const double t2660 = a[740];
-    const double t2661 = t2660*t72;
-    const double t2662 = a[616];
-    const double t2663 = t2662*t73;
-    const double t2664 = t2644*t77;
-    const double t2665 = a[1134];
-    const double t2667 = a[902];
-    const double t2668 = t2667*t132;
-    const double t2669 = a[612];
-    const double t2671 = t2651+t2653+t2654+t2655+t2656+t2658+t2659+t2661+t2663+t2664+t2665*
+    const MBPOL_POLY_REAL t2650 = a[587];
+    const MBPOL_POLY_REAL t2651 = t2650*t5;
+    const MBPOL_POLY_REAL t2652 = a[785];
+    const MBPOL_POLY_REAL t2653 = t2652*t20;
+    const MBPOL_POLY_REAL t2654 = a[326];
+    const MBPOL_POLY_REAL t2655 = t2650*t26;
+    const MBPOL_POLY_REAL t2656 = t2652*t37;
+    const MBPOL_POLY_REAL t2657 = a[657];
+    const MBPOL_POLY_REAL t2658 = t2657*t50;
+    const MBPOL_POLY_REAL t2659 = t2657*t67;
+    const MBPOL_POLY_REAL t2660 = a[740];
+    const MBPOL_POLY_REAL t2661 = t2660*t72;
+    const MBPOL_POLY_REAL t2662 = a[616];
+    const MBPOL_POLY_REAL t2663 = t2662*t73;
+    const MBPOL_POLY_REAL t2664 = t2644*t77;
+    const MBPOL_POLY_REAL t2665 = a[1134];
+    const MBPOL_POLY_REAL t2667 = a[902];
+    const MBPOL_POLY_REAL t2668 = t2667*t132;
+    const MBPOL_POLY_REAL t2669 = a[612];
+    const MBPOL_POLY_REAL t2671 = t2651+t2653+t2654+t2655+t2656+t2658+t2659+t2661+t2663+t2664+t2665*
 t126+t2668+t2669*t136;
-    const double t2672 = t2671*t136;
-    const double t2673 = t2652*t5;
-    const double t2674 = t2650*t20;
-    const double t2675 = t2652*t26;
-    const double t2676 = t2650*t37;
-    const double t2677 = t2662*t72;
-    const double t2678 = t2660*t73;
-    const double t2679 = t2667*t77;
-    const double t2681 = t2654+t2673+t2674+t2675+t2676+t2658+t2659+t2677+t2678+t2679+t2669*
+    const MBPOL_POLY_REAL t2672 = t2671*t136;
+    const MBPOL_POLY_REAL t2673 = t2652*t5;
+    const MBPOL_POLY_REAL t2674 = t2650*t20;
+    const MBPOL_POLY_REAL t2675 = t2652*t26;
+    const MBPOL_POLY_REAL t2676 = t2650*t37;
+    const MBPOL_POLY_REAL t2677 = t2662*t72;
+    const MBPOL_POLY_REAL t2678 = t2660*t73;
+    const MBPOL_POLY_REAL t2679 = t2667*t77;
+    const MBPOL_POLY_REAL t2681 = t2654+t2673+t2674+t2675+t2676+t2658+t2659+t2677+t2678+t2679+t2669*
 t126;
-    const double t2682 = t2681*t126;
-    const double t2683 = a[97];
-    const double t2684 = a[596];
-    const double t2685 = t2684*t5;
-    const double t2686 = t2684*t20;
-    const double t2687 = t2684*t26;
-    const double t2688 = t2684*t37;
-    const double t2689 = a[720];
-    const double t2690 = t2689*t50;
-    const double t2691 = t2689*t67;
-    const double t2692 = a[702];
-    const double t2693 = t2692*t72;
-    const double t2694 = t2692*t73;
-    const double t2695 = a[961];
-    const double t2696 = t2695*t77;
-    const double t2697 = a[641];
-    const double t2698 = t2697*t126;
-    const double t2699 = t2695*t132;
-    const double t2700 = t2683+t2685+t2686+t2687+t2688+t2690+t2691+t2693+t2694+t2696+t2698+
+    const MBPOL_POLY_REAL t2682 = t2681*t126;
+    const MBPOL_POLY_REAL t2683 = a[97];
+    const MBPOL_POLY_REAL t2684 = a[596];
+    const MBPOL_POLY_REAL t2685 = t2684*t5;
+    const MBPOL_POLY_REAL t2686 = t2684*t20;
+    const MBPOL_POLY_REAL t2687 = t2684*t26;
+    const MBPOL_POLY_REAL t2688 = t2684*t37;
+    const MBPOL_POLY_REAL t2689 = a[720];
+    const MBPOL_POLY_REAL t2690 = t2689*t50;
+    const MBPOL_POLY_REAL t2691 = t2689*t67;
+    const MBPOL_POLY_REAL t2692 = a[702];
+    const MBPOL_POLY_REAL t2693 = t2692*t72;
+    const MBPOL_POLY_REAL t2694 = t2692*t73;
+    const MBPOL_POLY_REAL t2695 = a[961];
+    const MBPOL_POLY_REAL t2696 = t2695*t77;
+    const MBPOL_POLY_REAL t2697 = a[641];
+    const MBPOL_POLY_REAL t2698 = t2697*t126;
+    const MBPOL_POLY_REAL t2699 = t2695*t132;
+    const MBPOL_POLY_REAL t2700 = t2683+t2685+t2686+t2687+t2688+t2690+t2691+t2693+t2694+t2696+t2698+
 t2699;
-    const double t2701 = t2697*t136;
-    const double t2702 = a[605];
-    const double t2703 = t2702*t139;
-    const double t2704 = a[676];
-    const double t2705 = t2704*t145;
-    const double t2706 = t2702*t146;
-    const double t2707 = t2704*t155;
-    const double t2342 = a[1030];
-    const double t2709 = t2342*t179;
-    const double t2710 = a[1107];
-    const double t2711 = t2710*t275;
-    const double t2712 = a[979];
-    const double t2713 = t2712*t254;
-    const double t2714 = a[969];
-    const double t2715 = t2714*t212;
-    const double t2716 = a[1016];
-    const double t2717 = t2716*t215;
-    const double t2718 = a[584];
-    const double t2719 = t2718*t143;
-    const double t2720 = a[916];
-    const double t2721 = t2720*t309;
-    const double t2722 = t2701+t2703+t2705+t2706+t2707+t2709+t2711+t2713+t2715+t2717+t2719+
+    const MBPOL_POLY_REAL t2701 = t2697*t136;
+    const MBPOL_POLY_REAL t2702 = a[605];
+    const MBPOL_POLY_REAL t2703 = t2702*t139;
+    const MBPOL_POLY_REAL t2704 = a[676];
+    const MBPOL_POLY_REAL t2705 = t2704*t145;
+    const MBPOL_POLY_REAL t2706 = t2702*t146;
+    const MBPOL_POLY_REAL t2707 = t2704*t155;
+    const MBPOL_POLY_REAL t2342 = a[1030];
+    const MBPOL_POLY_REAL t2709 = t2342*t179;
+    const MBPOL_POLY_REAL t2710 = a[1107];
+    const MBPOL_POLY_REAL t2711 = t2710*t275;
+    const MBPOL_POLY_REAL t2712 = a[979];
+    const MBPOL_POLY_REAL t2713 = t2712*t254;
+    const MBPOL_POLY_REAL t2714 = a[969];
+    const MBPOL_POLY_REAL t2715 = t2714*t212;
+    const MBPOL_POLY_REAL t2716 = a[1016];
+    const MBPOL_POLY_REAL t2717 = t2716*t215;
+    const MBPOL_POLY_REAL t2718 = a[584];
+    const MBPOL_POLY_REAL t2719 = t2718*t143;
+    const MBPOL_POLY_REAL t2720 = a[916];
+    const MBPOL_POLY_REAL t2721 = t2720*t309;
+    const MBPOL_POLY_REAL t2722 = t2701+t2703+t2705+t2706+t2707+t2709+t2711+t2713+t2715+t2717+t2719+
 t2721;
-    const double t2725 = a[381];
-    const double t2726 = a[934];
-    const double t2727 = t2726*t5;
-    const double t2728 = t2726*t20;
-    const double t2729 = t2726*t26;
-    const double t2730 = t2726*t37;
-    const double t2731 = a[831];
-    const double t2732 = t2731*t50;
-    const double t2733 = t2731*t67;
-    const double t2734 = t2731*t72;
-    const double t2735 = t2731*t73;
-    const double t2736 = a[862];
-    const double t2737 = t2736*t77;
-    const double t2738 = a[700];
-    const double t2739 = t2738*t126;
-    const double t2740 = t2725+t2727+t2728+t2729+t2730+t2732+t2733+t2734+t2735+t2737+t2739;
-    const double t2741 = t2736*t132;
-    const double t2742 = t2738*t136;
-    const double t2743 = t2736*t139;
-    const double t2744 = t2738*t145;
-    const double t2745 = t2736*t146;
-    const double t2746 = t2738*t155;
-    const double t2343 = a[727];
-    const double t2748 = t2343*t179;
-    const double t2749 = a[880];
-    const double t2750 = t2749*t275;
-    const double t2751 = a[1019];
-    const double t2752 = t2751*t254;
-    const double t2753 = t2749*t212;
-    const double t2754 = t2751*t215;
-    const double t2755 = a[1055];
-    const double t2757 = t2741+t2742+t2743+t2744+t2745+t2746+t2748+t2750+t2752+t2753+t2754+
+    const MBPOL_POLY_REAL t2725 = a[381];
+    const MBPOL_POLY_REAL t2726 = a[934];
+    const MBPOL_POLY_REAL t2727 = t2726*t5;
+    const MBPOL_POLY_REAL t2728 = t2726*t20;
+    const MBPOL_POLY_REAL t2729 = t2726*t26;
+    const MBPOL_POLY_REAL t2730 = t2726*t37;
+    const MBPOL_POLY_REAL t2731 = a[831];
+    const MBPOL_POLY_REAL t2732 = t2731*t50;
+    const MBPOL_POLY_REAL t2733 = t2731*t67;
+    const MBPOL_POLY_REAL t2734 = t2731*t72;
+    const MBPOL_POLY_REAL t2735 = t2731*t73;
+    const MBPOL_POLY_REAL t2736 = a[862];
+    const MBPOL_POLY_REAL t2737 = t2736*t77;
+    const MBPOL_POLY_REAL t2738 = a[700];
+    const MBPOL_POLY_REAL t2739 = t2738*t126;
+    const MBPOL_POLY_REAL t2740 = t2725+t2727+t2728+t2729+t2730+t2732+t2733+t2734+t2735+t2737+t2739;
+    const MBPOL_POLY_REAL t2741 = t2736*t132;
+    const MBPOL_POLY_REAL t2742 = t2738*t136;
+    const MBPOL_POLY_REAL t2743 = t2736*t139;
+    const MBPOL_POLY_REAL t2744 = t2738*t145;
+    const MBPOL_POLY_REAL t2745 = t2736*t146;
+    const MBPOL_POLY_REAL t2746 = t2738*t155;
+    const MBPOL_POLY_REAL t2343 = a[727];
+    const MBPOL_POLY_REAL t2748 = t2343*t179;
+    const MBPOL_POLY_REAL t2749 = a[880];
+    const MBPOL_POLY_REAL t2750 = t2749*t275;
+    const MBPOL_POLY_REAL t2751 = a[1019];
+    const MBPOL_POLY_REAL t2752 = t2751*t254;
+    const MBPOL_POLY_REAL t2753 = t2749*t212;
+    const MBPOL_POLY_REAL t2754 = t2751*t215;
+    const MBPOL_POLY_REAL t2755 = a[1055];
+    const MBPOL_POLY_REAL t2757 = t2741+t2742+t2743+t2744+t2745+t2746+t2748+t2750+t2752+t2753+t2754+
 t2755*t143;
-    const double t2760 = a[597];
-    const double t2761 = t2760*t50;
-    const double t2762 = t2760*t67;
-    const double t2356 = t2609*t72;
-    const double t2765 = (t2602+t2604+t2614+t2615+t2608+t2761+t2762+t2356)*t72;
-    const double t2766 = t2660*t50;
-    const double t2767 = t2662*t67;
-    const double t2768 = t2657*t72;
-    const double t2769 = t2657*t73;
-    const double t2770 = t2638*t77;
-    const double t2771 = a[787];
-    const double t2772 = t2771*t126;
-    const double t2773 = t2638*t132;
-    const double t2774 = t2771*t136;
-    const double t2775 = t2644*t139;
-    const double t2776 = t2665*t145;
-    const double t2777 = t2667*t146;
-    const double t2778 = t2669*t155;
-    const double t2779 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t2770+t2772+
+    const MBPOL_POLY_REAL t2760 = a[597];
+    const MBPOL_POLY_REAL t2761 = t2760*t50;
+    const MBPOL_POLY_REAL t2762 = t2760*t67;
+    const MBPOL_POLY_REAL t2356 = t2609*t72;
+    const MBPOL_POLY_REAL t2765 = (t2602+t2604+t2614+t2615+t2608+t2761+t2762+t2356)*t72;
+    const MBPOL_POLY_REAL t2766 = t2660*t50;
+    const MBPOL_POLY_REAL t2767 = t2662*t67;
+    const MBPOL_POLY_REAL t2768 = t2657*t72;
+    const MBPOL_POLY_REAL t2769 = t2657*t73;
+    const MBPOL_POLY_REAL t2770 = t2638*t77;
+    const MBPOL_POLY_REAL t2771 = a[787];
+    const MBPOL_POLY_REAL t2772 = t2771*t126;
+    const MBPOL_POLY_REAL t2773 = t2638*t132;
+    const MBPOL_POLY_REAL t2774 = t2771*t136;
+    const MBPOL_POLY_REAL t2775 = t2644*t139;
+    const MBPOL_POLY_REAL t2776 = t2665*t145;
+    const MBPOL_POLY_REAL t2777 = t2667*t146;
+    const MBPOL_POLY_REAL t2778 = t2669*t155;
+    const MBPOL_POLY_REAL t2779 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t2770+t2772+
 t2773+t2774+t2775+t2776+t2777+t2778;
-    const double t2781 = a[552];
-    const double t2782 = a[874];
-    const double t2783 = t2782*t5;
-    const double t2784 = t2782*t20;
-    const double t2785 = a[951];
-    const double t2786 = t2785*t309;
-    const double t2787 = a[573];
-    const double t2788 = t2787*t143;
-    const double t2789 = t2785*t240;
-    const double t2790 = a[747];
-    const double t2791 = t2790*t50;
-    const double t2792 = a[671];
-    const double t2793 = t2792*t254;
-    const double t2794 = a[628];
-    const double t2795 = t2794*t126;
-    const double t2796 = a[946];
-    const double t2797 = t2796*t132;
-    const double t2798 = t2794*t136;
-    const double t2799 = a[687];
-    const double t2800 = t2799*t275;
-    const double t2377 = a[1079];
-    const double t2802 = t2377*t179;
-    const double t2803 = t2781+t2783+t2784+t2786+t2788+t2789+t2791+t2793+t2795+t2797+t2798+
+    const MBPOL_POLY_REAL t2781 = a[552];
+    const MBPOL_POLY_REAL t2782 = a[874];
+    const MBPOL_POLY_REAL t2783 = t2782*t5;
+    const MBPOL_POLY_REAL t2784 = t2782*t20;
+    const MBPOL_POLY_REAL t2785 = a[951];
+    const MBPOL_POLY_REAL t2786 = t2785*t309;
+    const MBPOL_POLY_REAL t2787 = a[573];
+    const MBPOL_POLY_REAL t2788 = t2787*t143;
+    const MBPOL_POLY_REAL t2789 = t2785*t240;
+    const MBPOL_POLY_REAL t2790 = a[747];
+    const MBPOL_POLY_REAL t2791 = t2790*t50;
+    const MBPOL_POLY_REAL t2792 = a[671];
+    const MBPOL_POLY_REAL t2793 = t2792*t254;
+    const MBPOL_POLY_REAL t2794 = a[628];
+    const MBPOL_POLY_REAL t2795 = t2794*t126;
+    const MBPOL_POLY_REAL t2796 = a[946];
+    const MBPOL_POLY_REAL t2797 = t2796*t132;
+    const MBPOL_POLY_REAL t2798 = t2794*t136;
+    const MBPOL_POLY_REAL t2799 = a[687];
+    const MBPOL_POLY_REAL t2800 = t2799*t275;
+    const MBPOL_POLY_REAL t2377 = a[1079];
+    const MBPOL_POLY_REAL t2802 = t2377*t179;
+    const MBPOL_POLY_REAL t2803 = t2781+t2783+t2784+t2786+t2788+t2789+t2791+t2793+t2795+t2797+t2798+
 t2800+t2802;
-    const double t2804 = t2782*t26;
-    const double t2805 = t2782*t37;
-    const double t2806 = t2790*t67;
-    const double t2807 = t2790*t72;
-    const double t2808 = t2790*t73;
-    const double t2809 = t2796*t139;
-    const double t2810 = t2794*t145;
-    const double t2811 = t2796*t146;
-    const double t2812 = t2794*t155;
-    const double t2813 = t2799*t212;
-    const double t2814 = t2792*t215;
-    const double t2815 = a[642];
-    const double t2817 = t2796*t77;
-    const double t2818 = t2804+t2805+t2806+t2807+t2808+t2809+t2810+t2811+t2812+t2813+t2814+
+    const MBPOL_POLY_REAL t2804 = t2782*t26;
+    const MBPOL_POLY_REAL t2805 = t2782*t37;
+    const MBPOL_POLY_REAL t2806 = t2790*t67;
+    const MBPOL_POLY_REAL t2807 = t2790*t72;
+    const MBPOL_POLY_REAL t2808 = t2790*t73;
+    const MBPOL_POLY_REAL t2809 = t2796*t139;
+    const MBPOL_POLY_REAL t2810 = t2794*t145;
+    const MBPOL_POLY_REAL t2811 = t2796*t146;
+    const MBPOL_POLY_REAL t2812 = t2794*t155;
+    const MBPOL_POLY_REAL t2813 = t2799*t212;
+    const MBPOL_POLY_REAL t2814 = t2792*t215;
+    const MBPOL_POLY_REAL t2815 = a[642];
+    const MBPOL_POLY_REAL t2817 = t2796*t77;
+    const MBPOL_POLY_REAL t2818 = t2804+t2805+t2806+t2807+t2808+t2809+t2810+t2811+t2812+t2813+t2814+
 t2815*t475+t2817;
-    const double t2821 = a[924];
-    const double t2823 = a[231];
-    const double t2824 = a[617];
-    const double t2827 = a[823];
-    const double t2385 = t2821*t20;
-    const double t2386 = t2824*t5;
-    const double t2387 = t2821*t26;
-    const double t2396 = t2827*t37;
-    const double t2830 = (t2385+t2823+t2386+t2387+t2396)*t37;
-    const double t2401 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t2579+t2599;
-    const double t2415 = t2700+t2722;
-    const double t2432 = t2740+t2757;
-    const double t2449 = t2803+t2818;
-    const double t2831 = t2401*t212+t2612+t2621+t2648*t146+t2672+t2682+t2415*t309+t2432*t143
+    const MBPOL_POLY_REAL t2821 = a[924];
+    const MBPOL_POLY_REAL t2823 = a[231];
+    const MBPOL_POLY_REAL t2824 = a[617];
+    const MBPOL_POLY_REAL t2827 = a[823];
+    const MBPOL_POLY_REAL t2385 = t2821*t20;
+    const MBPOL_POLY_REAL t2386 = t2824*t5;
+    const MBPOL_POLY_REAL t2387 = t2821*t26;
+    const MBPOL_POLY_REAL t2396 = t2827*t37;
+    const MBPOL_POLY_REAL t2830 = (t2385+t2823+t2386+t2387+t2396)*t37;
+    const MBPOL_POLY_REAL t2401 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t2579+t2599;
+    const MBPOL_POLY_REAL t2415 = t2700+t2722;
+    const MBPOL_POLY_REAL t2432 = t2740+t2757;
+    const MBPOL_POLY_REAL t2449 = t2803+t2818;
+    const MBPOL_POLY_REAL t2831 = t2401*t212+t2612+t2621+t2648*t146+t2672+t2682+t2415*t309+t2432*t143
 +t2765+t2779*t155+t2449*t475+t2830;
-    const double t2832 = t2821*t5;
-    const double t2451 = t2827*t20;
-    const double t2835 = (t2832+t2823+t2451)*t20;
-    const double t2460 = t2617*t72;
-    const double t2464 = t2609*t73;
-    const double t2839 = (t2605+t2613+t2602+t2607+t2616+t2761+t2762+t2460+t2464)*t73;
-    const double t2475 = t2824*t20;
-    const double t2513 = t2827*t26;
-    const double t2843 = (t2475+t2832+t2823+t2513)*t26;
-    const double t2844 = t2626*t5;
-    const double t2845 = t2626*t20;
-    const double t2846 = t2623*t26;
-    const double t2847 = t2623*t37;
-    const double t2848 = t2631*t50;
-    const double t2849 = t2629*t67;
-    const double t2850 = t2646*t139;
-    const double t2851 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2637+t2639+
+    const MBPOL_POLY_REAL t2832 = t2821*t5;
+    const MBPOL_POLY_REAL t2451 = t2827*t20;
+    const MBPOL_POLY_REAL t2835 = (t2832+t2823+t2451)*t20;
+    const MBPOL_POLY_REAL t2460 = t2617*t72;
+    const MBPOL_POLY_REAL t2464 = t2609*t73;
+    const MBPOL_POLY_REAL t2839 = (t2605+t2613+t2602+t2607+t2616+t2761+t2762+t2460+t2464)*t73;
+    const MBPOL_POLY_REAL t2475 = t2824*t20;
+    const MBPOL_POLY_REAL t2513 = t2827*t26;
+    const MBPOL_POLY_REAL t2843 = (t2475+t2832+t2823+t2513)*t26;
+    const MBPOL_POLY_REAL t2844 = t2626*t5;
+    const MBPOL_POLY_REAL t2845 = t2626*t20;
+    const MBPOL_POLY_REAL t2846 = t2623*t26;
+    const MBPOL_POLY_REAL t2847 = t2623*t37;
+    const MBPOL_POLY_REAL t2848 = t2631*t50;
+    const MBPOL_POLY_REAL t2849 = t2629*t67;
+    const MBPOL_POLY_REAL t2850 = t2646*t139;
+    const MBPOL_POLY_REAL t2851 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2637+t2639+
 t2640+t2641+t2850;
-    const double t2853 = a[930];
-    const double t2854 = t2853*t5;
-    const double t2855 = a[365];
-    const double t2856 = t2853*t20;
-    const double t2857 = t2853*t26;
-    const double t2858 = t2853*t37;
-    const double t2859 = a[872];
-    const double t2860 = t2859*t50;
-    const double t2861 = t2859*t67;
-    const double t2862 = a[889];
-    const double t2863 = t2862*t72;
-    const double t2864 = t2862*t73;
-    const double t2865 = a[982];
-    const double t2866 = t2865*t77;
-    const double t2867 = a[577];
-    const double t2868 = t2867*t126;
-    const double t2869 = t2865*t132;
-    const double t2870 = t2867*t136;
-    const double t2871 = a[653];
-    const double t2872 = t2871*t139;
-    const double t2873 = a[1029];
-    const double t2874 = t2873*t145;
-    const double t2875 = t2871*t146;
-    const double t2876 = t2873*t155;
-    const double t2519 = a[734];
-    const double t2878 = t2519*t179;
-    const double t2879 = a[1071];
-    const double t2880 = t2879*t275;
-    const double t2881 = a[991];
-    const double t2882 = t2881*t254;
-    const double t2883 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t2866+t2868+
+    const MBPOL_POLY_REAL t2853 = a[930];
+    const MBPOL_POLY_REAL t2854 = t2853*t5;
+    const MBPOL_POLY_REAL t2855 = a[365];
+    const MBPOL_POLY_REAL t2856 = t2853*t20;
+    const MBPOL_POLY_REAL t2857 = t2853*t26;
+    const MBPOL_POLY_REAL t2858 = t2853*t37;
+    const MBPOL_POLY_REAL t2859 = a[872];
+    const MBPOL_POLY_REAL t2860 = t2859*t50;
+    const MBPOL_POLY_REAL t2861 = t2859*t67;
+    const MBPOL_POLY_REAL t2862 = a[889];
+    const MBPOL_POLY_REAL t2863 = t2862*t72;
+    const MBPOL_POLY_REAL t2864 = t2862*t73;
+    const MBPOL_POLY_REAL t2865 = a[982];
+    const MBPOL_POLY_REAL t2866 = t2865*t77;
+    const MBPOL_POLY_REAL t2867 = a[577];
+    const MBPOL_POLY_REAL t2868 = t2867*t126;
+    const MBPOL_POLY_REAL t2869 = t2865*t132;
+    const MBPOL_POLY_REAL t2870 = t2867*t136;
+    const MBPOL_POLY_REAL t2871 = a[653];
+    const MBPOL_POLY_REAL t2872 = t2871*t139;
+    const MBPOL_POLY_REAL t2873 = a[1029];
+    const MBPOL_POLY_REAL t2874 = t2873*t145;
+    const MBPOL_POLY_REAL t2875 = t2871*t146;
+    const MBPOL_POLY_REAL t2876 = t2873*t155;
+    const MBPOL_POLY_REAL t2519 = a[734];
+    const MBPOL_POLY_REAL t2878 = t2519*t179;
+    const MBPOL_POLY_REAL t2879 = a[1071];
+    const MBPOL_POLY_REAL t2880 = t2879*t275;
+    const MBPOL_POLY_REAL t2881 = a[991];
+    const MBPOL_POLY_REAL t2882 = t2881*t254;
+    const MBPOL_POLY_REAL t2883 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t2866+t2868+
 t2869+t2870+t2872+t2874+t2875+t2876+t2878+t2880+t2882;
-    const double t2885 = t2692*t67;
-    const double t2886 = t2689*t73;
-    const double t2887 = t2695*t146;
-    const double t2888 = t2712*t215;
-    const double t2889 = t2710*t212;
-    const double t2890 = t2697*t145;
-    const double t2891 = a[936];
-    const double t2892 = t2891*t309;
-    const double t2893 = t2720*t240;
-    const double t2894 = t2695*t139;
-    const double t2895 = t2697*t155;
-    const double t2896 = t2885+t2886+t2887+t2888+t2889+t2890+t2892+t2893+t2894+t2895+t2683+
+    const MBPOL_POLY_REAL t2885 = t2692*t67;
+    const MBPOL_POLY_REAL t2886 = t2689*t73;
+    const MBPOL_POLY_REAL t2887 = t2695*t146;
+    const MBPOL_POLY_REAL t2888 = t2712*t215;
+    const MBPOL_POLY_REAL t2889 = t2710*t212;
+    const MBPOL_POLY_REAL t2890 = t2697*t145;
+    const MBPOL_POLY_REAL t2891 = a[936];
+    const MBPOL_POLY_REAL t2892 = t2891*t309;
+    const MBPOL_POLY_REAL t2893 = t2720*t240;
+    const MBPOL_POLY_REAL t2894 = t2695*t139;
+    const MBPOL_POLY_REAL t2895 = t2697*t155;
+    const MBPOL_POLY_REAL t2896 = t2885+t2886+t2887+t2888+t2889+t2890+t2892+t2893+t2894+t2895+t2683+
 t2685;
-    const double t2897 = t2702*t77;
-    const double t2898 = t2714*t275;
-    const double t2899 = t2716*t254;
-    const double t2900 = t2702*t132;
-    const double t2901 = t2704*t136;
-    const double t2902 = t2704*t126;
-    const double t2903 = t2689*t72;
-    const double t2904 = t2692*t50;
-    const double t2905 = t2686+t2687+t2688+t2709+t2897+t2898+t2899+t2900+t2901+t2902+t2903+
+    const MBPOL_POLY_REAL t2897 = t2702*t77;
+    const MBPOL_POLY_REAL t2898 = t2714*t275;
+    const MBPOL_POLY_REAL t2899 = t2716*t254;
+    const MBPOL_POLY_REAL t2900 = t2702*t132;
+    const MBPOL_POLY_REAL t2901 = t2704*t136;
+    const MBPOL_POLY_REAL t2902 = t2704*t126;
+    const MBPOL_POLY_REAL t2903 = t2689*t72;
+    const MBPOL_POLY_REAL t2904 = t2692*t50;
+    const MBPOL_POLY_REAL t2905 = t2686+t2687+t2688+t2709+t2897+t2898+t2899+t2900+t2901+t2902+t2903+
 t2904+t2719;
-    const double t2908 = a[999];
-    const double t2909 = t2908*t5;
-    const double t2910 = a[395];
-    const double t2911 = t2908*t20;
-    const double t2912 = t2908*t26;
-    const double t2913 = t2908*t37;
-    const double t2914 = a[908];
-    const double t2915 = t2914*t50;
-    const double t2916 = t2914*t67;
-    const double t2917 = t2914*t72;
-    const double t2918 = t2914*t73;
-    const double t2919 = a[834];
-    const double t2920 = t2919*t77;
-    const double t2921 = a[562];
-    const double t2922 = t2921*t126;
-    const double t2923 = t2919*t132;
-    const double t2924 = t2921*t136;
-    const double t2925 = t2919*t139;
-    const double t2926 = t2921*t145;
-    const double t2927 = t2919*t146;
-    const double t2928 = t2921*t155;
-    const double t2520 = a[615];
-    const double t2930 = t2520*t179;
-    const double t2931 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t2920+t2922+
+    const MBPOL_POLY_REAL t2908 = a[999];
+    const MBPOL_POLY_REAL t2909 = t2908*t5;
+    const MBPOL_POLY_REAL t2910 = a[395];
+    const MBPOL_POLY_REAL t2911 = t2908*t20;
+    const MBPOL_POLY_REAL t2912 = t2908*t26;
+    const MBPOL_POLY_REAL t2913 = t2908*t37;
+    const MBPOL_POLY_REAL t2914 = a[908];
+    const MBPOL_POLY_REAL t2915 = t2914*t50;
+    const MBPOL_POLY_REAL t2916 = t2914*t67;
+    const MBPOL_POLY_REAL t2917 = t2914*t72;
+    const MBPOL_POLY_REAL t2918 = t2914*t73;
+    const MBPOL_POLY_REAL t2919 = a[834];
+    const MBPOL_POLY_REAL t2920 = t2919*t77;
+    const MBPOL_POLY_REAL t2921 = a[562];
+    const MBPOL_POLY_REAL t2922 = t2921*t126;
+    const MBPOL_POLY_REAL t2923 = t2919*t132;
+    const MBPOL_POLY_REAL t2924 = t2921*t136;
+    const MBPOL_POLY_REAL t2925 = t2919*t139;
+    const MBPOL_POLY_REAL t2926 = t2921*t145;
+    const MBPOL_POLY_REAL t2927 = t2919*t146;
+    const MBPOL_POLY_REAL t2928 = t2921*t155;
+    const MBPOL_POLY_REAL t2520 = a[615];
+    const MBPOL_POLY_REAL t2930 = t2520*t179;
+    const MBPOL_POLY_REAL t2931 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t2920+t2922+
 t2923+t2924+t2925+t2926+t2927+t2928+t2930;
-    const double t2933 = t2633*t50;
-    const double t2934 = t2633*t67;
-    const double t2935 = t2629*t72;
-    const double t2936 = t2631*t73;
-    const double t2938 = t2644*t126;
-    const double t2940 = t2622+t2845+t2624+t2846+t2628+t2933+t2934+t2935+t2936+t2642*t77+
+    const MBPOL_POLY_REAL t2933 = t2633*t50;
+    const MBPOL_POLY_REAL t2934 = t2633*t67;
+    const MBPOL_POLY_REAL t2935 = t2629*t72;
+    const MBPOL_POLY_REAL t2936 = t2631*t73;
+    const MBPOL_POLY_REAL t2938 = t2644*t126;
+    const MBPOL_POLY_REAL t2940 = t2622+t2845+t2624+t2846+t2628+t2933+t2934+t2935+t2936+t2642*t77+
 t2938+t2646*t132;
-    const double t2941 = t2940*t132;
-    const double t2942 = t2631*t72;
-    const double t2943 = t2629*t73;
-    const double t2531 = t2646*t77;
-    const double t2946 = (t2622+t2844+t2625+t2627+t2847+t2933+t2934+t2942+t2943+t2531)*t77;
-    const double t2947 = t2662*t50;
-    const double t2948 = t2660*t67;
-    const double t2949 = t2667*t139;
-    const double t2950 = t2669*t145;
-    const double t2951 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t2770+t2772+
+    const MBPOL_POLY_REAL t2941 = t2940*t132;
+    const MBPOL_POLY_REAL t2942 = t2631*t72;
+    const MBPOL_POLY_REAL t2943 = t2629*t73;
+    const MBPOL_POLY_REAL t2531 = t2646*t77;
+    const MBPOL_POLY_REAL t2946 = (t2622+t2844+t2625+t2627+t2847+t2933+t2934+t2942+t2943+t2531)*t77;
+    const MBPOL_POLY_REAL t2947 = t2662*t50;
+    const MBPOL_POLY_REAL t2948 = t2660*t67;
+    const MBPOL_POLY_REAL t2949 = t2667*t139;
+    const MBPOL_POLY_REAL t2950 = t2669*t145;
+    const MBPOL_POLY_REAL t2951 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t2770+t2772+
 t2773+t2774+t2949+t2950;
-    const double t2953 = t2862*t50;
-    const double t2954 = t2862*t67;
-    const double t2955 = t2859*t72;
-    const double t2956 = t2859*t73;
-    const double t2957 = t2871*t77;
-    const double t2958 = t2873*t126;
-    const double t2959 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t2957+t2958;
-    const double t2960 = t2871*t132;
-    const double t2961 = t2873*t136;
-    const double t2962 = t2865*t139;
-    const double t2963 = t2867*t145;
-    const double t2964 = t2865*t146;
-    const double t2965 = t2867*t155;
-    const double t2966 = t2595*t275;
-    const double t2967 = a[1111];
-    const double t2968 = t2967*t254;
-    const double t2969 = t2879*t212;
-    const double t2970 = t2881*t215;
-    const double t2971 = t2960+t2961+t2962+t2963+t2964+t2965+t2878+t2966+t2968+t2969+t2970;
-    const double t2533 = t2827*t5;
-    const double t2976 = (t2823+t2533)*t5;
-    const double t2977 = t2575*t50;
-    const double t2978 = t2575*t67;
-    const double t2979 = t2572*t72;
-    const double t2980 = t2572*t73;
-    const double t2981 = t2585*t77;
-    const double t2982 = t2587*t126;
-    const double t2983 = t2585*t132;
-    const double t2984 = t2587*t136;
-    const double t2985 = t2578*t139;
-    const double t2986 = t2581*t145;
-    const double t2987 = t2578*t146;
-    const double t2988 = t2581*t155;
-    const double t2989 = t2597*t275;
-    const double t2990 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t2981+t2982+
+    const MBPOL_POLY_REAL t2953 = t2862*t50;
+    const MBPOL_POLY_REAL t2954 = t2862*t67;
+    const MBPOL_POLY_REAL t2955 = t2859*t72;
+    const MBPOL_POLY_REAL t2956 = t2859*t73;
+    const MBPOL_POLY_REAL t2957 = t2871*t77;
+    const MBPOL_POLY_REAL t2958 = t2873*t126;
+    const MBPOL_POLY_REAL t2959 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t2957+t2958;
+    const MBPOL_POLY_REAL t2960 = t2871*t132;
+    const MBPOL_POLY_REAL t2961 = t2873*t136;
+    const MBPOL_POLY_REAL t2962 = t2865*t139;
+    const MBPOL_POLY_REAL t2963 = t2867*t145;
+    const MBPOL_POLY_REAL t2964 = t2865*t146;
+    const MBPOL_POLY_REAL t2965 = t2867*t155;
+    const MBPOL_POLY_REAL t2966 = t2595*t275;
+    const MBPOL_POLY_REAL t2967 = a[1111];
+    const MBPOL_POLY_REAL t2968 = t2967*t254;
+    const MBPOL_POLY_REAL t2969 = t2879*t212;
+    const MBPOL_POLY_REAL t2970 = t2881*t215;
+    const MBPOL_POLY_REAL t2971 = t2960+t2961+t2962+t2963+t2964+t2965+t2878+t2966+t2968+t2969+t2970;
+    const MBPOL_POLY_REAL t2533 = t2827*t5;
+    const MBPOL_POLY_REAL t2976 = (t2823+t2533)*t5;
+    const MBPOL_POLY_REAL t2977 = t2575*t50;
+    const MBPOL_POLY_REAL t2978 = t2575*t67;
+    const MBPOL_POLY_REAL t2979 = t2572*t72;
+    const MBPOL_POLY_REAL t2980 = t2572*t73;
+    const MBPOL_POLY_REAL t2981 = t2585*t77;
+    const MBPOL_POLY_REAL t2982 = t2587*t126;
+    const MBPOL_POLY_REAL t2983 = t2585*t132;
+    const MBPOL_POLY_REAL t2984 = t2587*t136;
+    const MBPOL_POLY_REAL t2985 = t2578*t139;
+    const MBPOL_POLY_REAL t2986 = t2581*t145;
+    const MBPOL_POLY_REAL t2987 = t2578*t146;
+    const MBPOL_POLY_REAL t2988 = t2581*t155;
+    const MBPOL_POLY_REAL t2989 = t2597*t275;
+    const MBPOL_POLY_REAL t2990 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t2981+t2982+
 t2983+t2984+t2985+t2986+t2987+t2988+t2592+t2989;
-    const double t2552 = t2896+t2905;
-    const double t2580 = t2959+t2971;
-    const double t2992 = t2835+t2839+t2843+t2851*t139+t2883*t254+t2552*t240+t2931*t179+t2941
+    const MBPOL_POLY_REAL t2552 = t2896+t2905;
+    const MBPOL_POLY_REAL t2580 = t2959+t2971;
+    const MBPOL_POLY_REAL t2992 = t2835+t2839+t2843+t2851*t139+t2883*t254+t2552*t240+t2931*t179+t2941
 +t2946+t2951*t145+t2580*t215+t2976+t2990*t275;
-    const double t2995 = t1935*t5;
-    const double t2996 = t1935*t20;
-    const double t2997 = t1932*t26;
-    const double t2998 = t1932*t37;
-    const double t2999 = a[539];
-    const double t2601 = t2999*t50;
-    const double t2610 = t1938*t67;
-    const double t3003 = (t1931+t2995+t2996+t2997+t2998+t2601+t2610)*t67;
-    const double t3004 = t2490*t475;
-    const double t3005 = t2480*t143;
-    const double t3006 = t2505*t212;
-    const double t3007 = t2503*t215;
-    const double t3008 = t2515*t309;
-    const double t3009 = a[523];
-    const double t3011 = t2483*t139;
-    const double t3012 = t2478*t145;
-    const double t3013 = t2483*t146;
-    const double t3014 = t2477+t3004+t3005+t3006+t3007+t3008+t3009*t240+t3011+t3012+t2486+
+    const MBPOL_POLY_REAL t2995 = t1935*t5;
+    const MBPOL_POLY_REAL t2996 = t1935*t20;
+    const MBPOL_POLY_REAL t2997 = t1932*t26;
+    const MBPOL_POLY_REAL t2998 = t1932*t37;
+    const MBPOL_POLY_REAL t2999 = a[539];
+    const MBPOL_POLY_REAL t2601 = t2999*t50;
+    const MBPOL_POLY_REAL t2610 = t1938*t67;
+    const MBPOL_POLY_REAL t3003 = (t1931+t2995+t2996+t2997+t2998+t2601+t2610)*t67;
+    const MBPOL_POLY_REAL t3004 = t2490*t475;
+    const MBPOL_POLY_REAL t3005 = t2480*t143;
+    const MBPOL_POLY_REAL t3006 = t2505*t212;
+    const MBPOL_POLY_REAL t3007 = t2503*t215;
+    const MBPOL_POLY_REAL t3008 = t2515*t309;
+    const MBPOL_POLY_REAL t3009 = a[523];
+    const MBPOL_POLY_REAL t3011 = t2483*t139;
+    const MBPOL_POLY_REAL t3012 = t2478*t145;
+    const MBPOL_POLY_REAL t3013 = t2483*t146;
+    const MBPOL_POLY_REAL t3014 = t2477+t3004+t3005+t3006+t3007+t3008+t3009*t240+t3011+t3012+t2486+
 t2488+t2489+t3013;
-    const double t3015 = t2478*t155;
-    const double t3016 = t3015+t2492+t2494+t2498+t2500+t2501+t2502+t2507+t2509+t2510+t2511+
+    const MBPOL_POLY_REAL t3015 = t2478*t155;
+    const MBPOL_POLY_REAL t3016 = t3015+t2492+t2494+t2498+t2500+t2501+t2502+t2507+t2509+t2510+t2511+
 t2512+t2514;
-    const double t3019 = t2646*t145;
-    const double t3020 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2637+t2639+
+    const MBPOL_POLY_REAL t3019 = t2646*t145;
+    const MBPOL_POLY_REAL t3020 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2637+t2639+
 t2640+t2641+t2949+t3019;
-    const double t3022 = t2683+t2685+t2686+t2687+t2688+t2690+t2691+t2693+t2694+t2696+t2698;
-    const double t3023 = t2704*t139;
-    const double t3024 = t2702*t145;
-    const double t3025 = t2704*t146;
-    const double t3026 = t2702*t155;
-    const double t3027 = t2716*t212;
-    const double t3028 = t2714*t215;
-    const double t3029 = t2720*t143;
-    const double t3030 = t2699+t2701+t3023+t3024+t3025+t3026+t2709+t2711+t2713+t3027+t3028+
+    const MBPOL_POLY_REAL t3022 = t2683+t2685+t2686+t2687+t2688+t2690+t2691+t2693+t2694+t2696+t2698;
+    const MBPOL_POLY_REAL t3023 = t2704*t139;
+    const MBPOL_POLY_REAL t3024 = t2702*t145;
+    const MBPOL_POLY_REAL t3025 = t2704*t146;
+    const MBPOL_POLY_REAL t3026 = t2702*t155;
+    const MBPOL_POLY_REAL t3027 = t2716*t212;
+    const MBPOL_POLY_REAL t3028 = t2714*t215;
+    const MBPOL_POLY_REAL t3029 = t2720*t143;
+    const MBPOL_POLY_REAL t3030 = t2699+t2701+t3023+t3024+t3025+t3026+t2709+t2711+t2713+t3027+t3028+
 t3029;
-    const double t3033 = t2665*t139;
-    const double t3034 = t2669*t146;
-    const double t3035 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t2770+t2772+
+    const MBPOL_POLY_REAL t3033 = t2665*t139;
+    const MBPOL_POLY_REAL t3034 = t2669*t146;
+    const MBPOL_POLY_REAL t3035 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t2770+t2772+
 t2773+t2774+t3033+t2645+t3034;
-    const double t3038 = t2867*t139;
-    const double t3039 = t2865*t145;
-    const double t3040 = t2867*t146;
-    const double t3041 = t2865*t155;
-    const double t3042 = t2881*t212;
-    const double t3043 = t2958+t2960+t2961+t3038+t3039+t3040+t3041+t2878+t2966+t2968+t3042;
-    const double t3046 = t2642*t145;
-    const double t3047 = t2646*t155;
-    const double t3048 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2637+t2639+
+    const MBPOL_POLY_REAL t3038 = t2867*t139;
+    const MBPOL_POLY_REAL t3039 = t2865*t145;
+    const MBPOL_POLY_REAL t3040 = t2867*t146;
+    const MBPOL_POLY_REAL t3041 = t2865*t155;
+    const MBPOL_POLY_REAL t3042 = t2881*t212;
+    const MBPOL_POLY_REAL t3043 = t2958+t2960+t2961+t3038+t3039+t3040+t3041+t2878+t2966+t2968+t3042;
+    const MBPOL_POLY_REAL t3046 = t2642*t145;
+    const MBPOL_POLY_REAL t3047 = t2646*t155;
+    const MBPOL_POLY_REAL t3048 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2637+t2639+
 t2640+t2641+t2775+t3046+t2777+t3047;
-    const double t2620 = t3022+t3030;
-    const double t2670 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t2957+t3043;
-    const double t3050 = t2612+t2621+t3020*t145+t2620*t143+t3035*t146+t2672+t2682+t2670*t212
+    const MBPOL_POLY_REAL t2620 = t3022+t3030;
+    const MBPOL_POLY_REAL t2670 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t2957+t3043;
+    const MBPOL_POLY_REAL t3050 = t2612+t2621+t3020*t145+t2620*t143+t3035*t146+t2672+t2682+t2670*t212
 +t3048*t155+t2765+t2830+t2835;
-    const double t3051 = t2581*t139;
-    const double t3052 = t2578*t145;
-    const double t3053 = t2581*t146;
-    const double t3054 = t2578*t155;
-    const double t3055 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t2981+t2982+
+    const MBPOL_POLY_REAL t3051 = t2581*t139;
+    const MBPOL_POLY_REAL t3052 = t2578*t145;
+    const MBPOL_POLY_REAL t3053 = t2581*t146;
+    const MBPOL_POLY_REAL t3054 = t2578*t155;
+    const MBPOL_POLY_REAL t3055 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t2981+t2982+
 t2983+t2984+t3051+t3052+t3053+t3054+t2592+t2989;
-    const double t3057 = t2669*t139;
-    const double t3058 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t2770+t2772+
+    const MBPOL_POLY_REAL t3057 = t2669*t139;
+    const MBPOL_POLY_REAL t3058 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t2770+t2772+
 t2773+t2774+t3057;
-    const double t3060 = t2718*t309;
-    const double t3061 = t2695*t155;
-    const double t3062 = t2891*t143;
-    const double t3063 = t2720*t475;
-    const double t3064 = t2712*t212;
-    const double t3065 = t2710*t215;
-    const double t3066 = t2695*t145;
-    const double t3067 = t2885+t2886+t3060+t3061+t3062+t3063+t3064+t3065+t3066+t2683+t2685+
+    const MBPOL_POLY_REAL t3060 = t2718*t309;
+    const MBPOL_POLY_REAL t3061 = t2695*t155;
+    const MBPOL_POLY_REAL t3062 = t2891*t143;
+    const MBPOL_POLY_REAL t3063 = t2720*t475;
+    const MBPOL_POLY_REAL t3064 = t2712*t212;
+    const MBPOL_POLY_REAL t3065 = t2710*t215;
+    const MBPOL_POLY_REAL t3066 = t2695*t145;
+    const MBPOL_POLY_REAL t3067 = t2885+t2886+t3060+t3061+t3062+t3063+t3064+t3065+t3066+t2683+t2685+
 t2686+t2687;
-    const double t3068 = t2697*t146;
-    const double t3069 = t2697*t139;
-    const double t3070 = t2688+t2709+t2897+t3068+t2898+t2899+t2789+t2900+t2901+t2902+t3069+
+    const MBPOL_POLY_REAL t3068 = t2697*t146;
+    const MBPOL_POLY_REAL t3069 = t2697*t139;
+    const MBPOL_POLY_REAL t3070 = t2688+t2709+t2897+t3068+t2898+t2899+t2789+t2900+t2901+t2902+t3069+
 t2903+t2904;
-    const double t3073 = t2921*t139;
-    const double t3074 = t2919*t145;
-    const double t3075 = t2921*t146;
-    const double t3076 = t2919*t155;
-    const double t3077 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t2920+t2922+
+    const MBPOL_POLY_REAL t3073 = t2921*t139;
+    const MBPOL_POLY_REAL t3074 = t2919*t145;
+    const MBPOL_POLY_REAL t3075 = t2921*t146;
+    const MBPOL_POLY_REAL t3076 = t2919*t155;
+    const MBPOL_POLY_REAL t3077 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t2920+t2922+
 t2923+t2924+t3073+t3074+t3075+t3076+t2930;
-    const double t3080 = t2799*t215;
-    const double t3081 = t2787*t309;
-    const double t3082 = t2815*t240+t2781+t3080+t2783+t2784+t2791+t2793+t2795+t2797+t2798+
+    const MBPOL_POLY_REAL t3080 = t2799*t215;
+    const MBPOL_POLY_REAL t3081 = t2787*t309;
+    const MBPOL_POLY_REAL t3082 = t2815*t240+t2781+t3080+t2783+t2784+t2791+t2793+t2795+t2797+t2798+
 t2800+t3081;
-    const double t3083 = t2785*t143;
-    const double t3084 = t2796*t145;
-    const double t3085 = t2796*t155;
-    const double t3086 = t2792*t212;
-    const double t3087 = t2794*t139;
-    const double t3088 = t2794*t146;
-    const double t3089 = t3083+t3084+t2802+t3085+t3086+t2804+t2805+t2806+t2807+t2808+t3087+
+    const MBPOL_POLY_REAL t3083 = t2785*t143;
+    const MBPOL_POLY_REAL t3084 = t2796*t145;
+    const MBPOL_POLY_REAL t3085 = t2796*t155;
+    const MBPOL_POLY_REAL t3086 = t2792*t212;
+    const MBPOL_POLY_REAL t3087 = t2794*t139;
+    const MBPOL_POLY_REAL t3088 = t2794*t146;
+    const MBPOL_POLY_REAL t3089 = t3083+t3084+t2802+t3085+t3086+t2804+t2805+t2806+t2807+t2808+t3087+
 t3088+t2817;
-    const double t3092 = t2873*t139;
-    const double t3093 = t2871*t145;
-    const double t3094 = t2873*t146;
-    const double t3095 = t2871*t155;
-    const double t3096 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t2866+t2868+
+    const MBPOL_POLY_REAL t3092 = t2873*t139;
+    const MBPOL_POLY_REAL t3093 = t2871*t145;
+    const MBPOL_POLY_REAL t3094 = t2873*t146;
+    const MBPOL_POLY_REAL t3095 = t2871*t155;
+    const MBPOL_POLY_REAL t3096 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t2866+t2868+
 t2869+t2870+t3092+t3093+t3094+t3095+t2878+t2880+t2882;
-    const double t3098 = t2725+t2727+t2728+t2729+t2730+t2732+t2733+t2734+t2735+t2737+t2739+
+    const MBPOL_POLY_REAL t3098 = t2725+t2727+t2728+t2729+t2730+t2732+t2733+t2734+t2735+t2737+t2739+
 t2741;
-    const double t3099 = t2738*t139;
-    const double t3100 = t2736*t145;
-    const double t3101 = t2738*t146;
-    const double t3102 = t2736*t155;
-    const double t3103 = t2751*t212;
-    const double t3104 = t2749*t215;
-    const double t3106 = t2742+t3099+t3100+t3101+t3102+t2748+t2750+t2752+t3103+t3104+t2719+
+    const MBPOL_POLY_REAL t3099 = t2738*t139;
+    const MBPOL_POLY_REAL t3100 = t2736*t145;
+    const MBPOL_POLY_REAL t3101 = t2738*t146;
+    const MBPOL_POLY_REAL t3102 = t2736*t155;
+    const MBPOL_POLY_REAL t3103 = t2751*t212;
+    const MBPOL_POLY_REAL t3104 = t2749*t215;
+    const MBPOL_POLY_REAL t3106 = t2742+t3099+t3100+t3101+t3102+t2748+t2750+t2752+t3103+t3104+t2719+
 t2755*t309;
-    const double t3109 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t2579+t2582;
-    const double t3110 = t2587*t139;
-    const double t3111 = t2585*t145;
-    const double t3112 = t2587*t146;
-    const double t3113 = t2585*t155;
-    const double t3114 = t2597*t215;
-    const double t3115 = t2583+t2584+t3110+t3111+t3112+t3113+t2592+t2594+t2596+t2969+t3114;
-    const double t2758 = t3067+t3070;
-    const double t2764 = t3082+t3089;
-    const double t2816 = t3098+t3106;
-    const double t2820 = t3109+t3115;
-    const double t3118 = t2839+t2843+t3055*t275+t3058*t139+t2758*t475+t2941+t2946+t3077*t179
+    const MBPOL_POLY_REAL t3109 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t2579+t2582;
+    const MBPOL_POLY_REAL t3110 = t2587*t139;
+    const MBPOL_POLY_REAL t3111 = t2585*t145;
+    const MBPOL_POLY_REAL t3112 = t2587*t146;
+    const MBPOL_POLY_REAL t3113 = t2585*t155;
+    const MBPOL_POLY_REAL t3114 = t2597*t215;
+    const MBPOL_POLY_REAL t3115 = t2583+t2584+t3110+t3111+t3112+t3113+t2592+t2594+t2596+t2969+t3114;
+    const MBPOL_POLY_REAL t2758 = t3067+t3070;
+    const MBPOL_POLY_REAL t2764 = t3082+t3089;
+    const MBPOL_POLY_REAL t2816 = t3098+t3106;
+    const MBPOL_POLY_REAL t2820 = t3109+t3115;
+    const MBPOL_POLY_REAL t3118 = t2839+t2843+t3055*t275+t3058*t139+t2758*t475+t2941+t2946+t3077*t179
 +t2764*t240+t3096*t254+t2976+t2816*t309+t2820*t215;
-    const double t3121 = a[47];
-    const double t3122 = a[453];
-    const double t3123 = t3122*t5;
-    const double t3124 = t3122*t20;
-    const double t3125 = t3122*t26;
-    const double t3126 = t3122*t37;
-    const double t3127 = a[512];
-    const double t3128 = t3127*t50;
-    const double t3129 = t3127*t67;
-    const double t3130 = a[380];
-    const double t3131 = t3130*t72;
-    const double t3132 = t3130*t73;
-    const double t3133 = a[261];
-    const double t3135 = a[481];
-    const double t3139 = a[100];
-    const double t3140 = t3139*t139;
-    const double t3141 = t3139*t145;
-    const double t3142 = t3139*t146;
-    const double t3143 = t3139*t155;
-    const double t2825 = a[121];
-    const double t3145 = t2825*t179;
-    const double t3146 = a[211];
-    const double t3148 = t3121+t3123+t3124+t3125+t3126+t3128+t3129+t3131+t3132+t3133*t77+
+    const MBPOL_POLY_REAL t3121 = a[47];
+    const MBPOL_POLY_REAL t3122 = a[453];
+    const MBPOL_POLY_REAL t3123 = t3122*t5;
+    const MBPOL_POLY_REAL t3124 = t3122*t20;
+    const MBPOL_POLY_REAL t3125 = t3122*t26;
+    const MBPOL_POLY_REAL t3126 = t3122*t37;
+    const MBPOL_POLY_REAL t3127 = a[512];
+    const MBPOL_POLY_REAL t3128 = t3127*t50;
+    const MBPOL_POLY_REAL t3129 = t3127*t67;
+    const MBPOL_POLY_REAL t3130 = a[380];
+    const MBPOL_POLY_REAL t3131 = t3130*t72;
+    const MBPOL_POLY_REAL t3132 = t3130*t73;
+    const MBPOL_POLY_REAL t3133 = a[261];
+    const MBPOL_POLY_REAL t3135 = a[481];
+    const MBPOL_POLY_REAL t3139 = a[100];
+    const MBPOL_POLY_REAL t3140 = t3139*t139;
+    const MBPOL_POLY_REAL t3141 = t3139*t145;
+    const MBPOL_POLY_REAL t3142 = t3139*t146;
+    const MBPOL_POLY_REAL t3143 = t3139*t155;
+    const MBPOL_POLY_REAL t2825 = a[121];
+    const MBPOL_POLY_REAL t3145 = t2825*t179;
+    const MBPOL_POLY_REAL t3146 = a[211];
+    const MBPOL_POLY_REAL t3148 = t3121+t3123+t3124+t3125+t3126+t3128+t3129+t3131+t3132+t3133*t77+
 t3135*t126+t3133*t132+t3135*t136+t3140+t3141+t3142+t3143+t3145+t3146*t275;
-    const double t2838 = t2423+t2431;
-    const double t2852 = t2465+t2473;
-    const double t2884 = t2496+t2517;
-    const double t2929 = t2831+t2992;
-    const double t2937 = t3014+t3016;
-    const double t2944 = t3050+t3118;
-    const double t3116 = x[4];
-    const double t3120 = x[5];
-    const double t3150 = t2414*t139+t2421*t155+t2838*t143+t2459*t179+t2463*t145+t2852*t215+
+    const MBPOL_POLY_REAL t2838 = t2423+t2431;
+    const MBPOL_POLY_REAL t2852 = t2465+t2473;
+    const MBPOL_POLY_REAL t2884 = t2496+t2517;
+    const MBPOL_POLY_REAL t2929 = t2831+t2992;
+    const MBPOL_POLY_REAL t2937 = t3014+t3016;
+    const MBPOL_POLY_REAL t2944 = t3050+t3118;
+    const MBPOL_POLY_REAL t3116 = x[4];
+    const MBPOL_POLY_REAL t3120 = x[5];
+    const MBPOL_POLY_REAL t3150 = t2414*t139+t2421*t155+t2838*t143+t2459*t179+t2463*t145+t2852*t215+
 t2884*t240+t2525+t2534+t2564*t254+t2929*t3116+t3003+t2937*t475+t2944*t3120+
 t3148*t275;
-    const double t3153 = a[61];
-    const double t3154 = a[456];
-    const double t3155 = t3154*t5;
-    const double t3156 = t3154*t20;
-    const double t3157 = a[233];
-    const double t3158 = t3157*t26;
-    const double t3159 = t3157*t37;
-    const double t3160 = a[516];
-    const double t3162 = a[477];
-    const double t3166 = a[63];
-    const double t3167 = a[292];
-    const double t3168 = t3167*t5;
-    const double t3169 = t3167*t20;
-    const double t3170 = t3167*t26;
-    const double t3171 = t3167*t37;
-    const double t3172 = a[334];
-    const double t3173 = t3172*t50;
-    const double t3174 = t3172*t67;
-    const double t3175 = a[357];
-    const double t3176 = t3175*t72;
-    const double t3177 = t3175*t73;
-    const double t3178 = a[132];
-    const double t3180 = a[356];
-    const double t3184 = a[103];
-    const double t3185 = t3184*t139;
-    const double t3186 = t3184*t145;
-    const double t3187 = t3184*t146;
-    const double t3188 = t3184*t155;
-    const double t2972 = a[352];
-    const double t3190 = t2972*t179;
-    const double t3191 = a[505];
-    const double t3193 = t3166+t3168+t3169+t3170+t3171+t3173+t3174+t3176+t3177+t3178*t77+
+    const MBPOL_POLY_REAL t3153 = a[61];
+    const MBPOL_POLY_REAL t3154 = a[456];
+    const MBPOL_POLY_REAL t3155 = t3154*t5;
+    const MBPOL_POLY_REAL t3156 = t3154*t20;
+    const MBPOL_POLY_REAL t3157 = a[233];
+    const MBPOL_POLY_REAL t3158 = t3157*t26;
+    const MBPOL_POLY_REAL t3159 = t3157*t37;
+    const MBPOL_POLY_REAL t3160 = a[516];
+    const MBPOL_POLY_REAL t3162 = a[477];
+    const MBPOL_POLY_REAL t3166 = a[63];
+    const MBPOL_POLY_REAL t3167 = a[292];
+    const MBPOL_POLY_REAL t3168 = t3167*t5;
+    const MBPOL_POLY_REAL t3169 = t3167*t20;
+    const MBPOL_POLY_REAL t3170 = t3167*t26;
+    const MBPOL_POLY_REAL t3171 = t3167*t37;
+    const MBPOL_POLY_REAL t3172 = a[334];
+    const MBPOL_POLY_REAL t3173 = t3172*t50;
+    const MBPOL_POLY_REAL t3174 = t3172*t67;
+    const MBPOL_POLY_REAL t3175 = a[357];
+    const MBPOL_POLY_REAL t3176 = t3175*t72;
+    const MBPOL_POLY_REAL t3177 = t3175*t73;
+    const MBPOL_POLY_REAL t3178 = a[132];
+    const MBPOL_POLY_REAL t3180 = a[356];
+    const MBPOL_POLY_REAL t3184 = a[103];
+    const MBPOL_POLY_REAL t3185 = t3184*t139;
+    const MBPOL_POLY_REAL t3186 = t3184*t145;
+    const MBPOL_POLY_REAL t3187 = t3184*t146;
+    const MBPOL_POLY_REAL t3188 = t3184*t155;
+    const MBPOL_POLY_REAL t2972 = a[352];
+    const MBPOL_POLY_REAL t3190 = t2972*t179;
+    const MBPOL_POLY_REAL t3191 = a[505];
+    const MBPOL_POLY_REAL t3193 = t3166+t3168+t3169+t3170+t3171+t3173+t3174+t3176+t3177+t3178*t77+
 t3180*t126+t3178*t132+t3180*t136+t3185+t3186+t3187+t3188+t3190+t3191*t275;
-    const double t3195 = a[544];
-    const double t3196 = t3195*t143;
-    const double t3197 = a[179];
-    const double t3199 = a[420];
-    const double t3200 = t3199*t475;
-    const double t3201 = a[426];
-    const double t3203 = a[408];
-    const double t3204 = t3203*t254;
-    const double t3205 = a[553];
-    const double t3206 = t3205*t275;
-    const double t3207 = a[280];
-    const double t3208 = t3207*t136;
-    const double t3209 = a[443];
-    const double t3210 = t3209*t77;
-    const double t3211 = t3207*t126;
-    const double t3212 = t3209*t132;
-    const double t3213 = a[308];
-    const double t3214 = t3213*t5;
-    const double t3215 = a[10];
-    const double t3216 = t3213*t20;
-    const double t3217 = t3196+t3197*t240+t3200+t3201*t309+t3204+t3206+t3208+t3210+t3211+
+    const MBPOL_POLY_REAL t3195 = a[544];
+    const MBPOL_POLY_REAL t3196 = t3195*t143;
+    const MBPOL_POLY_REAL t3197 = a[179];
+    const MBPOL_POLY_REAL t3199 = a[420];
+    const MBPOL_POLY_REAL t3200 = t3199*t475;
+    const MBPOL_POLY_REAL t3201 = a[426];
+    const MBPOL_POLY_REAL t3203 = a[408];
+    const MBPOL_POLY_REAL t3204 = t3203*t254;
+    const MBPOL_POLY_REAL t3205 = a[553];
+    const MBPOL_POLY_REAL t3206 = t3205*t275;
+    const MBPOL_POLY_REAL t3207 = a[280];
+    const MBPOL_POLY_REAL t3208 = t3207*t136;
+    const MBPOL_POLY_REAL t3209 = a[443];
+    const MBPOL_POLY_REAL t3210 = t3209*t77;
+    const MBPOL_POLY_REAL t3211 = t3207*t126;
+    const MBPOL_POLY_REAL t3212 = t3209*t132;
+    const MBPOL_POLY_REAL t3213 = a[308];
+    const MBPOL_POLY_REAL t3214 = t3213*t5;
+    const MBPOL_POLY_REAL t3215 = a[10];
+    const MBPOL_POLY_REAL t3216 = t3213*t20;
+    const MBPOL_POLY_REAL t3217 = t3196+t3197*t240+t3200+t3201*t309+t3204+t3206+t3208+t3210+t3211+
 t3212+t3214+t3215+t3216;
-    const double t3218 = t3213*t26;
-    const double t3219 = t3213*t37;
-    const double t3220 = a[196];
-    const double t3221 = t3220*t50;
-    const double t3222 = t3220*t67;
-    const double t3223 = a[368];
-    const double t3224 = t3223*t72;
-    const double t3225 = t3223*t73;
-    const double t3226 = a[284];
-    const double t3227 = t3226*t139;
-    const double t3228 = a[331];
-    const double t3229 = t3228*t145;
-    const double t3230 = t3226*t146;
-    const double t3231 = t3228*t155;
-    const double t3001 = a[102];
-    const double t3233 = t3001*t179;
-    const double t3234 = a[369];
-    const double t3235 = t3234*t212;
-    const double t3236 = a[436];
-    const double t3237 = t3236*t215;
-    const double t3238 = t3218+t3219+t3221+t3222+t3224+t3225+t3227+t3229+t3230+t3231+t3233+
+    const MBPOL_POLY_REAL t3218 = t3213*t26;
+    const MBPOL_POLY_REAL t3219 = t3213*t37;
+    const MBPOL_POLY_REAL t3220 = a[196];
+    const MBPOL_POLY_REAL t3221 = t3220*t50;
+    const MBPOL_POLY_REAL t3222 = t3220*t67;
+    const MBPOL_POLY_REAL t3223 = a[368];
+    const MBPOL_POLY_REAL t3224 = t3223*t72;
+    const MBPOL_POLY_REAL t3225 = t3223*t73;
+    const MBPOL_POLY_REAL t3226 = a[284];
+    const MBPOL_POLY_REAL t3227 = t3226*t139;
+    const MBPOL_POLY_REAL t3228 = a[331];
+    const MBPOL_POLY_REAL t3229 = t3228*t145;
+    const MBPOL_POLY_REAL t3230 = t3226*t146;
+    const MBPOL_POLY_REAL t3231 = t3228*t155;
+    const MBPOL_POLY_REAL t3001 = a[102];
+    const MBPOL_POLY_REAL t3233 = t3001*t179;
+    const MBPOL_POLY_REAL t3234 = a[369];
+    const MBPOL_POLY_REAL t3235 = t3234*t212;
+    const MBPOL_POLY_REAL t3236 = a[436];
+    const MBPOL_POLY_REAL t3237 = t3236*t215;
+    const MBPOL_POLY_REAL t3238 = t3218+t3219+t3221+t3222+t3224+t3225+t3227+t3229+t3230+t3231+t3233+
 t3235+t3237;
-    const double t3241 = a[35];
-    const double t3242 = a[173];
-    const double t3243 = t3242*t20;
-    const double t3244 = a[363];
-    const double t3245 = t3244*t5;
-    const double t3246 = t3244*t26;
-    const double t3247 = t3242*t37;
-    const double t3248 = a[297];
-    const double t3249 = t3248*t50;
-    const double t3250 = t3248*t67;
-    const double t3251 = a[170];
-    const double t3252 = t3251*t72;
-    const double t3253 = a[530];
-    const double t3254 = t3253*t73;
-    const double t3255 = a[273];
-    const double t3257 = a[355];
-    const double t3259 = a[385];
-    const double t3261 = a[144];
-    const double t3263 = t3241+t3243+t3245+t3246+t3247+t3249+t3250+t3252+t3254+t3255*t77+
+    const MBPOL_POLY_REAL t3241 = a[35];
+    const MBPOL_POLY_REAL t3242 = a[173];
+    const MBPOL_POLY_REAL t3243 = t3242*t20;
+    const MBPOL_POLY_REAL t3244 = a[363];
+    const MBPOL_POLY_REAL t3245 = t3244*t5;
+    const MBPOL_POLY_REAL t3246 = t3244*t26;
+    const MBPOL_POLY_REAL t3247 = t3242*t37;
+    const MBPOL_POLY_REAL t3248 = a[297];
+    const MBPOL_POLY_REAL t3249 = t3248*t50;
+    const MBPOL_POLY_REAL t3250 = t3248*t67;
+    const MBPOL_POLY_REAL t3251 = a[170];
+    const MBPOL_POLY_REAL t3252 = t3251*t72;
+    const MBPOL_POLY_REAL t3253 = a[530];
+    const MBPOL_POLY_REAL t3254 = t3253*t73;
+    const MBPOL_POLY_REAL t3255 = a[273];
+    const MBPOL_POLY_REAL t3257 = a[355];
+    const MBPOL_POLY_REAL t3259 = a[385];
+    const MBPOL_POLY_REAL t3261 = a[144];
+    const MBPOL_POLY_REAL t3263 = t3241+t3243+t3245+t3246+t3247+t3249+t3250+t3252+t3254+t3255*t77+
 t3257*t126+t3259*t132+t3261*t136;
-    const double t3265 = a[430];
-    const double t3266 = t3265*t5;
-    const double t3267 = a[8];
-    const double t3268 = t3265*t20;
-    const double t3269 = a[195];
-    const double t3270 = t3269*t26;
-    const double t3271 = t3269*t37;
-    const double t3272 = a[216];
-    const double t3273 = t3272*t50;
-    const double t3274 = a[165];
-    const double t3275 = t3274*t67;
-    const double t3276 = a[441];
-    const double t3277 = t3276*t72;
-    const double t3278 = t3276*t73;
-    const double t3279 = a[300];
-    const double t3280 = t3279*t77;
-    const double t3281 = t3279*t126;
-    const double t3282 = t3279*t132;
-    const double t3283 = t3279*t136;
-    const double t3284 = a[384];
-    const double t3286 = a[423];
-    const double t3288 = t3266+t3267+t3268+t3270+t3271+t3273+t3275+t3277+t3278+t3280+t3281+
+    const MBPOL_POLY_REAL t3265 = a[430];
+    const MBPOL_POLY_REAL t3266 = t3265*t5;
+    const MBPOL_POLY_REAL t3267 = a[8];
+    const MBPOL_POLY_REAL t3268 = t3265*t20;
+    const MBPOL_POLY_REAL t3269 = a[195];
+    const MBPOL_POLY_REAL t3270 = t3269*t26;
+    const MBPOL_POLY_REAL t3271 = t3269*t37;
+    const MBPOL_POLY_REAL t3272 = a[216];
+    const MBPOL_POLY_REAL t3273 = t3272*t50;
+    const MBPOL_POLY_REAL t3274 = a[165];
+    const MBPOL_POLY_REAL t3275 = t3274*t67;
+    const MBPOL_POLY_REAL t3276 = a[441];
+    const MBPOL_POLY_REAL t3277 = t3276*t72;
+    const MBPOL_POLY_REAL t3278 = t3276*t73;
+    const MBPOL_POLY_REAL t3279 = a[300];
+    const MBPOL_POLY_REAL t3280 = t3279*t77;
+    const MBPOL_POLY_REAL t3281 = t3279*t126;
+    const MBPOL_POLY_REAL t3282 = t3279*t132;
+    const MBPOL_POLY_REAL t3283 = t3279*t136;
+    const MBPOL_POLY_REAL t3284 = a[384];
+    const MBPOL_POLY_REAL t3286 = a[423];
+    const MBPOL_POLY_REAL t3288 = t3266+t3267+t3268+t3270+t3271+t3273+t3275+t3277+t3278+t3280+t3281+
 t3282+t3283+t3284*t139+t3286*t145;
-    const double t3290 = a[761];
-    const double t3291 = t3290*t5;
-    const double t3292 = a[332];
-    const double t3293 = t3290*t20;
-    const double t3294 = a[578];
-    const double t3295 = t3294*t26;
-    const double t3296 = t3294*t37;
-    const double t3297 = a[731];
-    const double t3298 = t3297*t50;
-    const double t3299 = a[655];
-    const double t3300 = t3299*t67;
-    const double t3301 = a[580];
-    const double t3302 = t3301*t72;
-    const double t3303 = t3301*t73;
-    const double t3304 = a[608];
-    const double t3305 = t3304*t77;
-    const double t3306 = a[760];
-    const double t3307 = t3306*t126;
-    const double t3308 = t3304*t132;
-    const double t3309 = t3306*t136;
-    const double t3310 = a[1002];
-    const double t3311 = t3310*t139;
-    const double t3312 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t3305+t3307+
+    const MBPOL_POLY_REAL t3290 = a[761];
+    const MBPOL_POLY_REAL t3291 = t3290*t5;
+    const MBPOL_POLY_REAL t3292 = a[332];
+    const MBPOL_POLY_REAL t3293 = t3290*t20;
+    const MBPOL_POLY_REAL t3294 = a[578];
+    const MBPOL_POLY_REAL t3295 = t3294*t26;
+    const MBPOL_POLY_REAL t3296 = t3294*t37;
+    const MBPOL_POLY_REAL t3297 = a[731];
+    const MBPOL_POLY_REAL t3298 = t3297*t50;
+    const MBPOL_POLY_REAL t3299 = a[655];
+    const MBPOL_POLY_REAL t3300 = t3299*t67;
+    const MBPOL_POLY_REAL t3301 = a[580];
+    const MBPOL_POLY_REAL t3302 = t3301*t72;
+    const MBPOL_POLY_REAL t3303 = t3301*t73;
+    const MBPOL_POLY_REAL t3304 = a[608];
+    const MBPOL_POLY_REAL t3305 = t3304*t77;
+    const MBPOL_POLY_REAL t3306 = a[760];
+    const MBPOL_POLY_REAL t3307 = t3306*t126;
+    const MBPOL_POLY_REAL t3308 = t3304*t132;
+    const MBPOL_POLY_REAL t3309 = t3306*t136;
+    const MBPOL_POLY_REAL t3310 = a[1002];
+    const MBPOL_POLY_REAL t3311 = t3310*t139;
+    const MBPOL_POLY_REAL t3312 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t3305+t3307+
 t3308+t3309+t3311;
-    const double t3314 = a[1092];
-    const double t3315 = t3314*t139;
-    const double t3316 = t3310*t145;
-    const double t3317 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t3305+t3307+
+    const MBPOL_POLY_REAL t3314 = a[1092];
+    const MBPOL_POLY_REAL t3315 = t3314*t139;
+    const MBPOL_POLY_REAL t3316 = t3310*t145;
+    const MBPOL_POLY_REAL t3317 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t3305+t3307+
 t3308+t3309+t3315+t3316;
-    const double t3319 = a[246];
-    const double t3320 = a[837];
-    const double t3321 = t3320*t5;
-    const double t3322 = a[1069];
-    const double t3323 = t3322*t20;
-    const double t3324 = t3320*t26;
-    const double t3325 = t3322*t37;
-    const double t3326 = a[841];
-    const double t3327 = t3326*t50;
-    const double t3328 = t3326*t67;
-    const double t3329 = a[1103];
-    const double t3330 = t3329*t72;
-    const double t3331 = a[929];
-    const double t3332 = t3331*t73;
-    const double t3333 = a[938];
-    const double t3335 = a[818];
-    const double t3336 = t3335*t126;
-    const double t3337 = a[842];
-    const double t3339 = t3319+t3321+t3323+t3324+t3325+t3327+t3328+t3330+t3332+t3333*t77+
+    const MBPOL_POLY_REAL t3319 = a[246];
+    const MBPOL_POLY_REAL t3320 = a[837];
+    const MBPOL_POLY_REAL t3321 = t3320*t5;
+    const MBPOL_POLY_REAL t3322 = a[1069];
+    const MBPOL_POLY_REAL t3323 = t3322*t20;
+    const MBPOL_POLY_REAL t3324 = t3320*t26;
+    const MBPOL_POLY_REAL t3325 = t3322*t37;
+    const MBPOL_POLY_REAL t3326 = a[841];
+    const MBPOL_POLY_REAL t3327 = t3326*t50;
+    const MBPOL_POLY_REAL t3328 = t3326*t67;
+    const MBPOL_POLY_REAL t3329 = a[1103];
+    const MBPOL_POLY_REAL t3330 = t3329*t72;
+    const MBPOL_POLY_REAL t3331 = a[929];
+    const MBPOL_POLY_REAL t3332 = t3331*t73;
+    const MBPOL_POLY_REAL t3333 = a[938];
+    const MBPOL_POLY_REAL t3335 = a[818];
+    const MBPOL_POLY_REAL t3336 = t3335*t126;
+    const MBPOL_POLY_REAL t3337 = a[842];
+    const MBPOL_POLY_REAL t3339 = t3319+t3321+t3323+t3324+t3325+t3327+t3328+t3330+t3332+t3333*t77+
 t3336+t3337*t132;
-    const double t3341 = a[817];
-    const double t3342 = t3341*t20;
-    const double t3343 = a[564];
-    const double t3344 = t3343*t5;
-    const double t3345 = a[493];
-    const double t3346 = t3343*t26;
-    const double t3347 = t3341*t37;
-    const double t3348 = a[647];
-    const double t3349 = t3348*t50;
-    const double t3350 = t3348*t67;
-    const double t3351 = a[966];
-    const double t3352 = t3351*t72;
-    const double t3353 = a[619];
-    const double t3354 = t3353*t73;
-    const double t3355 = a[926];
-    const double t3356 = t3355*t77;
-    const double t3357 = a[1040];
-    const double t3359 = t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354+t3356+t3357*
+    const MBPOL_POLY_REAL t3341 = a[817];
+    const MBPOL_POLY_REAL t3342 = t3341*t20;
+    const MBPOL_POLY_REAL t3343 = a[564];
+    const MBPOL_POLY_REAL t3344 = t3343*t5;
+    const MBPOL_POLY_REAL t3345 = a[493];
+    const MBPOL_POLY_REAL t3346 = t3343*t26;
+    const MBPOL_POLY_REAL t3347 = t3341*t37;
+    const MBPOL_POLY_REAL t3348 = a[647];
+    const MBPOL_POLY_REAL t3349 = t3348*t50;
+    const MBPOL_POLY_REAL t3350 = t3348*t67;
+    const MBPOL_POLY_REAL t3351 = a[966];
+    const MBPOL_POLY_REAL t3352 = t3351*t72;
+    const MBPOL_POLY_REAL t3353 = a[619];
+    const MBPOL_POLY_REAL t3354 = t3353*t73;
+    const MBPOL_POLY_REAL t3355 = a[926];
+    const MBPOL_POLY_REAL t3356 = t3355*t77;
+    const MBPOL_POLY_REAL t3357 = a[1040];
+    const MBPOL_POLY_REAL t3359 = t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354+t3356+t3357*
 t126;
-    const double t3361 = a[213];
-    const double t3362 = a[873];
-    const double t3363 = t3362*t5;
-    const double t3364 = a[965];
-    const double t3365 = t3364*t20;
-    const double t3366 = t3362*t26;
-    const double t3367 = t3364*t37;
-    const double t3368 = a[768];
-    const double t3369 = t3368*t50;
-    const double t3370 = t3368*t67;
-    const double t3371 = a[986];
-    const double t3373 = a[717];
-    const double t3044 = t3371*t72;
-    const double t3045 = t3373*t73;
-    const double t3376 = (t3361+t3363+t3365+t3366+t3367+t3369+t3370+t3044+t3045)*t73;
-    const double t3377 = a[894];
-    const double t3378 = t3377*t5;
-    const double t3379 = a[268];
-    const double t3380 = t3377*t20;
-    const double t3381 = a[878];
-    const double t3382 = t3381*t26;
-    const double t3383 = t3381*t37;
-    const double t3384 = a[861];
-    const double t3056 = t3384*t50;
-    const double t3387 = (t3378+t3379+t3380+t3382+t3383+t3056)*t50;
-    const double t3388 = a[732];
-    const double t3389 = t3388*t5;
-    const double t3390 = a[248];
-    const double t3391 = t3388*t20;
-    const double t3392 = t3388*t26;
-    const double t3393 = t3388*t37;
-    const double t3394 = a[947];
-    const double t3395 = t3394*t50;
-    const double t3396 = t3394*t67;
-    const double t3397 = a[786];
-    const double t3398 = t3397*t72;
-    const double t3399 = t3397*t73;
-    const double t3400 = a[903];
-    const double t3401 = t3400*t77;
-    const double t3402 = a[789];
-    const double t3403 = t3402*t126;
-    const double t3404 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t3401+t3403;
-    const double t3405 = t3400*t132;
-    const double t3406 = t3402*t136;
-    const double t3407 = a[1027];
-    const double t3408 = t3407*t139;
-    const double t3409 = a[945];
-    const double t3410 = t3409*t145;
-    const double t3411 = t3407*t146;
-    const double t3412 = t3409*t155;
-    const double t3071 = a[660];
-    const double t3414 = t3071*t179;
-    const double t3415 = a[1049];
-    const double t3416 = t3415*t275;
-    const double t3417 = a[1017];
-    const double t3418 = t3417*t254;
-    const double t3419 = a[955];
-    const double t3420 = t3419*t212;
-    const double t3421 = a[1026];
-    const double t3422 = t3421*t215;
-    const double t3423 = t3405+t3406+t3408+t3410+t3411+t3412+t3414+t3416+t3418+t3420+t3422;
-    const double t3426 = a[710];
-    const double t3427 = t3426*t5;
-    const double t3428 = a[469];
-    const double t3429 = t3426*t20;
-    const double t3430 = t3426*t26;
-    const double t3431 = t3426*t37;
-    const double t3432 = a[639];
-    const double t3433 = t3432*t50;
-    const double t3434 = t3432*t67;
-    const double t3435 = a[656];
-    const double t3436 = t3435*t72;
-    const double t3437 = t3435*t73;
-    const double t3438 = a[708];
-    const double t3439 = t3438*t77;
-    const double t3440 = a[648];
-    const double t3441 = t3440*t126;
-    const double t3442 = t3427+t3428+t3429+t3430+t3431+t3433+t3434+t3436+t3437+t3439+t3441;
-    const double t3443 = t3438*t132;
-    const double t3444 = t3440*t136;
-    const double t3445 = a[695];
-    const double t3446 = t3445*t139;
-    const double t3447 = a[593];
-    const double t3448 = t3447*t145;
-    const double t3449 = t3445*t146;
-    const double t3450 = t3447*t155;
-    const double t3072 = a[606];
-    const double t3452 = t3072*t179;
-    const double t3453 = a[886];
-    const double t3454 = t3453*t275;
-    const double t3455 = a[1010];
-    const double t3456 = t3455*t254;
-    const double t3457 = a[1032];
-    const double t3458 = t3457*t212;
-    const double t3459 = a[627];
-    const double t3460 = t3459*t215;
-    const double t3461 = a[572];
-    const double t3462 = t3461*t143;
-    const double t3463 = t3443+t3444+t3446+t3448+t3449+t3450+t3452+t3454+t3456+t3458+t3460+
+    const MBPOL_POLY_REAL t3361 = a[213];
+    const MBPOL_POLY_REAL t3362 = a[873];
+    const MBPOL_POLY_REAL t3363 = t3362*t5;
+    const MBPOL_POLY_REAL t3364 = a[965];
+    const MBPOL_POLY_REAL t3365 = t3364*t20;
+    const MBPOL_POLY_REAL t3366 = t3362*t26;
+    const MBPOL_POLY_REAL t3367 = t3364*t37;
+    const MBPOL_POLY_REAL t3368 = a[768];
+    const MBPOL_POLY_REAL t3369 = t3368*t50;
+    const MBPOL_POLY_REAL t3370 = t3368*t67;
+    const MBPOL_POLY_REAL t3371 = a[986];
+    const MBPOL_POLY_REAL t3373 = a[717];
+    const MBPOL_POLY_REAL t3044 = t3371*t72;
+    const MBPOL_POLY_REAL t3045 = t3373*t73;
+    const MBPOL_POLY_REAL t3376 = (t3361+t3363+t3365+t3366+t3367+t3369+t3370+t3044+t3045)*t73;
+    const MBPOL_POLY_REAL t3377 = a[894];
+    const MBPOL_POLY_REAL t3378 = t3377*t5;
+    const MBPOL_POLY_REAL t3379 = a[268];
+    const MBPOL_POLY_REAL t3380 = t3377*t20;
+    const MBPOL_POLY_REAL t3381 = a[878];
+    const MBPOL_POLY_REAL t3382 = t3381*t26;
+    const MBPOL_POLY_REAL t3383 = t3381*t37;
+    const MBPOL_POLY_REAL t3384 = a[861];
+    const MBPOL_POLY_REAL t3056 = t3384*t50;
+    const MBPOL_POLY_REAL t3387 = (t3378+t3379+t3380+t3382+t3383+t3056)*t50;
+    const MBPOL_POLY_REAL t3388 = a[732];
+    const MBPOL_POLY_REAL t3389 = t3388*t5;
+    const MBPOL_POLY_REAL t3390 = a[248];
+    const MBPOL_POLY_REAL t3391 = t3388*t20;
+    const MBPOL_POLY_REAL t3392 = t3388*t26;
+    const MBPOL_POLY_REAL t3393 = t3388*t37;
+    const MBPOL_POLY_REAL t3394 = a[947];
+    const MBPOL_POLY_REAL t3395 = t3394*t50;
+    const MBPOL_POLY_REAL t3396 = t3394*t67;
+    const MBPOL_POLY_REAL t3397 = a[786];
+    const MBPOL_POLY_REAL t3398 = t3397*t72;
+    const MBPOL_POLY_REAL t3399 = t3397*t73;
+    const MBPOL_POLY_REAL t3400 = a[903];
+    const MBPOL_POLY_REAL t3401 = t3400*t77;
+    const MBPOL_POLY_REAL t3402 = a[789];
+    const MBPOL_POLY_REAL t3403 = t3402*t126;
+    const MBPOL_POLY_REAL t3404 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t3401+t3403;
+    const MBPOL_POLY_REAL t3405 = t3400*t132;
+    const MBPOL_POLY_REAL t3406 = t3402*t136;
+    const MBPOL_POLY_REAL t3407 = a[1027];
+    const MBPOL_POLY_REAL t3408 = t3407*t139;
+    const MBPOL_POLY_REAL t3409 = a[945];
+    const MBPOL_POLY_REAL t3410 = t3409*t145;
+    const MBPOL_POLY_REAL t3411 = t3407*t146;
+    const MBPOL_POLY_REAL t3412 = t3409*t155;
+    const MBPOL_POLY_REAL t3071 = a[660];
+    const MBPOL_POLY_REAL t3414 = t3071*t179;
+    const MBPOL_POLY_REAL t3415 = a[1049];
+    const MBPOL_POLY_REAL t3416 = t3415*t275;
+    const MBPOL_POLY_REAL t3417 = a[1017];
+    const MBPOL_POLY_REAL t3418 = t3417*t254;
+    const MBPOL_POLY_REAL t3419 = a[955];
+    const MBPOL_POLY_REAL t3420 = t3419*t212;
+    const MBPOL_POLY_REAL t3421 = a[1026];
+    const MBPOL_POLY_REAL t3422 = t3421*t215;
+    const MBPOL_POLY_REAL t3423 = t3405+t3406+t3408+t3410+t3411+t3412+t3414+t3416+t3418+t3420+t3422;
+    const MBPOL_POLY_REAL t3426 = a[710];
+    const MBPOL_POLY_REAL t3427 = t3426*t5;
+    const MBPOL_POLY_REAL t3428 = a[469];
+    const MBPOL_POLY_REAL t3429 = t3426*t20;
+    const MBPOL_POLY_REAL t3430 = t3426*t26;
+    const MBPOL_POLY_REAL t3431 = t3426*t37;
+    const MBPOL_POLY_REAL t3432 = a[639];
+    const MBPOL_POLY_REAL t3433 = t3432*t50;
+    const MBPOL_POLY_REAL t3434 = t3432*t67;
+    const MBPOL_POLY_REAL t3435 = a[656];
+    const MBPOL_POLY_REAL t3436 = t3435*t72;
+    const MBPOL_POLY_REAL t3437 = t3435*t73;
+    const MBPOL_POLY_REAL t3438 = a[708];
+    const MBPOL_POLY_REAL t3439 = t3438*t77;
+    const MBPOL_POLY_REAL t3440 = a[648];
+    const MBPOL_POLY_REAL t3441 = t3440*t126;
+    const MBPOL_POLY_REAL t3442 = t3427+t3428+t3429+t3430+t3431+t3433+t3434+t3436+t3437+t3439+t3441;
+    const MBPOL_POLY_REAL t3443 = t3438*t132;
+    const MBPOL_POLY_REAL t3444 = t3440*t136;
+    const MBPOL_POLY_REAL t3445 = a[695];
+    const MBPOL_POLY_REAL t3446 = t3445*t139;
+    const MBPOL_POLY_REAL t3447 = a[593];
+    const MBPOL_POLY_REAL t3448 = t3447*t145;
+    const MBPOL_POLY_REAL t3449 = t3445*t146;
+    const MBPOL_POLY_REAL t3450 = t3447*t155;
+    const MBPOL_POLY_REAL t3072 = a[606];
+    const MBPOL_POLY_REAL t3452 = t3072*t179;
+    const MBPOL_POLY_REAL t3453 = a[886];
+    const MBPOL_POLY_REAL t3454 = t3453*t275;
+    const MBPOL_POLY_REAL t3455 = a[1010];
+    const MBPOL_POLY_REAL t3456 = t3455*t254;
+    const MBPOL_POLY_REAL t3457 = a[1032];
+    const MBPOL_POLY_REAL t3458 = t3457*t212;
+    const MBPOL_POLY_REAL t3459 = a[627];
+    const MBPOL_POLY_REAL t3460 = t3459*t215;
+    const MBPOL_POLY_REAL t3461 = a[572];
+    const MBPOL_POLY_REAL t3462 = t3461*t143;
+    const MBPOL_POLY_REAL t3463 = t3443+t3444+t3446+t3448+t3449+t3450+t3452+t3454+t3456+t3458+t3460+
 t3462;
-    const double t3466 = t3364*t5;
-    const double t3467 = t3362*t20;
-    const double t3468 = t3364*t26;
-    const double t3469 = t3362*t37;
-    const double t3078 = t3373*t72;
-    const double t3472 = (t3466+t3361+t3467+t3468+t3469+t3369+t3370+t3078)*t72;
-    const double t3090 = a[725];
-    const double t3474 = t3090*t179;
-    const double t3475 = a[826];
-    const double t3476 = t3475*t212;
-    const double t3477 = a[682];
-    const double t3478 = t3477*t309;
-    const double t3479 = a[852];
-    const double t3480 = t3479*t215;
-    const double t3481 = a[822];
-    const double t3482 = t3481*t240;
-    const double t3483 = a[736];
-    const double t3484 = t3483*t136;
-    const double t3485 = a[106];
-    const double t3486 = a[764];
-    const double t3487 = t3486*t143;
-    const double t3488 = a[850];
-    const double t3489 = t3488*t275;
-    const double t3490 = a[887];
-    const double t3491 = t3490*t146;
-    const double t3492 = a[581];
-    const double t3493 = t3492*t155;
-    const double t3494 = t3483*t126;
-    const double t3495 = t3474+t3476+t3478+t3480+t3482+t3484+t3485+t3487+t3489+t3491+t3493+
+    const MBPOL_POLY_REAL t3466 = t3364*t5;
+    const MBPOL_POLY_REAL t3467 = t3362*t20;
+    const MBPOL_POLY_REAL t3468 = t3364*t26;
+    const MBPOL_POLY_REAL t3469 = t3362*t37;
+    const MBPOL_POLY_REAL t3078 = t3373*t72;
+    const MBPOL_POLY_REAL t3472 = (t3466+t3361+t3467+t3468+t3469+t3369+t3370+t3078)*t72;
+    const MBPOL_POLY_REAL t3090 = a[725];
+    const MBPOL_POLY_REAL t3474 = t3090*t179;
+    const MBPOL_POLY_REAL t3475 = a[826];
+    const MBPOL_POLY_REAL t3476 = t3475*t212;
+    const MBPOL_POLY_REAL t3477 = a[682];
+    const MBPOL_POLY_REAL t3478 = t3477*t309;
+    const MBPOL_POLY_REAL t3479 = a[852];
+    const MBPOL_POLY_REAL t3480 = t3479*t215;
+    const MBPOL_POLY_REAL t3481 = a[822];
+    const MBPOL_POLY_REAL t3482 = t3481*t240;
+    const MBPOL_POLY_REAL t3483 = a[736];
+    const MBPOL_POLY_REAL t3484 = t3483*t136;
+    const MBPOL_POLY_REAL t3485 = a[106];
+    const MBPOL_POLY_REAL t3486 = a[764];
+    const MBPOL_POLY_REAL t3487 = t3486*t143;
+    const MBPOL_POLY_REAL t3488 = a[850];
+    const MBPOL_POLY_REAL t3489 = t3488*t275;
+    const MBPOL_POLY_REAL t3490 = a[887];
+    const MBPOL_POLY_REAL t3491 = t3490*t146;
+    const MBPOL_POLY_REAL t3492 = a[581];
+    const MBPOL_POLY_REAL t3493 = t3492*t155;
+    const MBPOL_POLY_REAL t3494 = t3483*t126;
+    const MBPOL_POLY_REAL t3495 = t3474+t3476+t3478+t3480+t3482+t3484+t3485+t3487+t3489+t3491+t3493+
 t3494;
-    const double t3496 = a[843];
-    const double t3497 = t3496*t72;
-    const double t3498 = a[610];
-    const double t3499 = t3498*t50;
-    const double t3500 = a[970];
-    const double t3501 = t3500*t77;
-    const double t3502 = t3490*t139;
-    const double t3503 = a[594];
-    const double t3504 = t3503*t20;
-    const double t3505 = t3492*t145;
-    const double t3506 = t3503*t5;
-    const double t3507 = a[1048];
-    const double t3508 = t3507*t254;
-    const double t3509 = t3503*t26;
-    const double t3510 = t3503*t37;
-    const double t3511 = t3498*t67;
-    const double t3512 = t3496*t73;
-    const double t3513 = t3500*t132;
-    const double t3514 = t3497+t3499+t3501+t3502+t3504+t3505+t3506+t3508+t3509+t3510+t3511+
+    const MBPOL_POLY_REAL t3496 = a[843];
+    const MBPOL_POLY_REAL t3497 = t3496*t72;
+    const MBPOL_POLY_REAL t3498 = a[610];
+    const MBPOL_POLY_REAL t3499 = t3498*t50;
+    const MBPOL_POLY_REAL t3500 = a[970];
+    const MBPOL_POLY_REAL t3501 = t3500*t77;
+    const MBPOL_POLY_REAL t3502 = t3490*t139;
+    const MBPOL_POLY_REAL t3503 = a[594];
+    const MBPOL_POLY_REAL t3504 = t3503*t20;
+    const MBPOL_POLY_REAL t3505 = t3492*t145;
+    const MBPOL_POLY_REAL t3506 = t3503*t5;
+    const MBPOL_POLY_REAL t3507 = a[1048];
+    const MBPOL_POLY_REAL t3508 = t3507*t254;
+    const MBPOL_POLY_REAL t3509 = t3503*t26;
+    const MBPOL_POLY_REAL t3510 = t3503*t37;
+    const MBPOL_POLY_REAL t3511 = t3498*t67;
+    const MBPOL_POLY_REAL t3512 = t3496*t73;
+    const MBPOL_POLY_REAL t3513 = t3500*t132;
+    const MBPOL_POLY_REAL t3514 = t3497+t3499+t3501+t3502+t3504+t3505+t3506+t3508+t3509+t3510+t3511+
 t3512+t3513;
-    const double t3517 = t3427+t3428+t3429+t3430+t3431+t3433+t3434+t3436+t3437+t3439+t3441+
+    const MBPOL_POLY_REAL t3517 = t3427+t3428+t3429+t3430+t3431+t3433+t3434+t3436+t3437+t3439+t3441+
 t3443;
-    const double t3518 = t3447*t139;
-    const double t3519 = t3445*t145;
-    const double t3520 = t3447*t146;
-    const double t3521 = t3445*t155;
-    const double t3522 = t3459*t212;
-    const double t3523 = t3457*t215;
-    const double t3524 = a[1050];
-    const double t3525 = t3524*t143;
-    const double t3526 = t3461*t309;
-    const double t3527 = t3444+t3518+t3519+t3520+t3521+t3452+t3454+t3456+t3522+t3523+t3525+
+    const MBPOL_POLY_REAL t3518 = t3447*t139;
+    const MBPOL_POLY_REAL t3519 = t3445*t145;
+    const MBPOL_POLY_REAL t3520 = t3447*t146;
+    const MBPOL_POLY_REAL t3521 = t3445*t155;
+    const MBPOL_POLY_REAL t3522 = t3459*t212;
+    const MBPOL_POLY_REAL t3523 = t3457*t215;
+    const MBPOL_POLY_REAL t3524 = a[1050];
+    const MBPOL_POLY_REAL t3525 = t3524*t143;
+    const MBPOL_POLY_REAL t3526 = t3461*t309;
+    const MBPOL_POLY_REAL t3527 = t3444+t3518+t3519+t3520+t3521+t3452+t3454+t3456+t3522+t3523+t3525+
 t3526;
-    const double t3530 = a[390];
-    const double t3531 = a[770];
-    const double t3532 = t3531*t5;
-    const double t3533 = t3531*t20;
-    const double t3534 = t3531*t26;
-    const double t3535 = t3531*t37;
-    const double t3536 = a[595];
-    const double t3537 = t3536*t50;
-    const double t3538 = t3536*t67;
-    const double t3539 = a[1133];
-    const double t3540 = t3539*t72;
-    const double t3541 = t3539*t73;
-    const double t3542 = a[1138];
-    const double t3544 = a[844];
-    const double t3548 = a[774];
-    const double t3549 = t3548*t139;
-    const double t3550 = t3548*t145;
-    const double t3551 = t3548*t146;
-    const double t3552 = t3548*t155;
-    const double t3091 = a[601];
-    const double t3554 = t3091*t179;
-    const double t3555 = a[654];
-    const double t3556 = t3555*t275;
-    const double t3557 = a[1146];
-    const double t3559 = t3530+t3532+t3533+t3534+t3535+t3537+t3538+t3540+t3541+t3542*t77+
+    const MBPOL_POLY_REAL t3530 = a[390];
+    const MBPOL_POLY_REAL t3531 = a[770];
+    const MBPOL_POLY_REAL t3532 = t3531*t5;
+    const MBPOL_POLY_REAL t3533 = t3531*t20;
+    const MBPOL_POLY_REAL t3534 = t3531*t26;
+    const MBPOL_POLY_REAL t3535 = t3531*t37;
+    const MBPOL_POLY_REAL t3536 = a[595];
+    const MBPOL_POLY_REAL t3537 = t3536*t50;
+    const MBPOL_POLY_REAL t3538 = t3536*t67;
+    const MBPOL_POLY_REAL t3539 = a[1133];
+    const MBPOL_POLY_REAL t3540 = t3539*t72;
+    const MBPOL_POLY_REAL t3541 = t3539*t73;
+    const MBPOL_POLY_REAL t3542 = a[1138];
+    const MBPOL_POLY_REAL t3544 = a[844];
+    const MBPOL_POLY_REAL t3548 = a[774];
+    const MBPOL_POLY_REAL t3549 = t3548*t139;
+    const MBPOL_POLY_REAL t3550 = t3548*t145;
+    const MBPOL_POLY_REAL t3551 = t3548*t146;
+    const MBPOL_POLY_REAL t3552 = t3548*t155;
+    const MBPOL_POLY_REAL t3091 = a[601];
+    const MBPOL_POLY_REAL t3554 = t3091*t179;
+    const MBPOL_POLY_REAL t3555 = a[654];
+    const MBPOL_POLY_REAL t3556 = t3555*t275;
+    const MBPOL_POLY_REAL t3557 = a[1146];
+    const MBPOL_POLY_REAL t3559 = t3530+t3532+t3533+t3534+t3535+t3537+t3538+t3540+t3541+t3542*t77+
 t3544*t126+t3542*t132+t3544*t136+t3549+t3550+t3551+t3552+t3554+t3556+t3557*t254
 ;
-    const double t3136 = t3404+t3423;
-    const double t3138 = t3442+t3463;
-    const double t3147 = t3495+t3514;
-    const double t3151 = t3517+t3527;
-    const double t3561 = t3312*t139+t3317*t145+t3339*t132+t3359*t126+t3376+t3387+t3136*t215+
+    const MBPOL_POLY_REAL t3136 = t3404+t3423;
+    const MBPOL_POLY_REAL t3138 = t3442+t3463;
+    const MBPOL_POLY_REAL t3147 = t3495+t3514;
+    const MBPOL_POLY_REAL t3151 = t3517+t3527;
+    const MBPOL_POLY_REAL t3561 = t3312*t139+t3317*t145+t3339*t132+t3359*t126+t3376+t3387+t3136*t215+
 t3138*t143+t3472+t3147*t240+t3151*t309+t3559*t254;
-    const double t3562 = a[1149];
-    const double t3563 = t3562*t5;
-    const double t3564 = a[437];
-    const double t3565 = a[956];
-    const double t3566 = t3565*t20;
-    const double t3567 = a[906];
-    const double t3568 = t3567*t26;
-    const double t3163 = t3563+t3564+t3566+t3568;
-    const double t3570 = t3163*t26;
-    const double t3571 = a[952];
-    const double t3573 = t3565*t5;
-    const double t3575 = t3567*t37;
-    const double t3179 = t3564+t3571*t26+t3573+t3562*t20+t3575;
-    const double t3577 = t3179*t37;
-    const double t3578 = t3294*t5;
-    const double t3579 = t3294*t20;
-    const double t3580 = t3290*t26;
-    const double t3581 = t3290*t37;
-    const double t3582 = t3299*t50;
-    const double t3583 = t3297*t67;
-    const double t3584 = a[1012];
-    const double t3585 = t3584*t139;
-    const double t3586 = a[1021];
-    const double t3587 = t3586*t145;
-    const double t3588 = t3310*t146;
-    const double t3589 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t3305+t3307+
+    const MBPOL_POLY_REAL t3562 = a[1149];
+    const MBPOL_POLY_REAL t3563 = t3562*t5;
+    const MBPOL_POLY_REAL t3564 = a[437];
+    const MBPOL_POLY_REAL t3565 = a[956];
+    const MBPOL_POLY_REAL t3566 = t3565*t20;
+    const MBPOL_POLY_REAL t3567 = a[906];
+    const MBPOL_POLY_REAL t3568 = t3567*t26;
+    const MBPOL_POLY_REAL t3163 = t3563+t3564+t3566+t3568;
+    const MBPOL_POLY_REAL t3570 = t3163*t26;
+    const MBPOL_POLY_REAL t3571 = a[952];
+    const MBPOL_POLY_REAL t3573 = t3565*t5;
+    const MBPOL_POLY_REAL t3575 = t3567*t37;
+    const MBPOL_POLY_REAL t3179 = t3564+t3571*t26+t3573+t3562*t20+t3575;
+    const MBPOL_POLY_REAL t3577 = t3179*t37;
+    const MBPOL_POLY_REAL t3578 = t3294*t5;
+    const MBPOL_POLY_REAL t3579 = t3294*t20;
+    const MBPOL_POLY_REAL t3580 = t3290*t26;
+    const MBPOL_POLY_REAL t3581 = t3290*t37;
+    const MBPOL_POLY_REAL t3582 = t3299*t50;
+    const MBPOL_POLY_REAL t3583 = t3297*t67;
+    const MBPOL_POLY_REAL t3584 = a[1012];
+    const MBPOL_POLY_REAL t3585 = t3584*t139;
+    const MBPOL_POLY_REAL t3586 = a[1021];
+    const MBPOL_POLY_REAL t3587 = t3586*t145;
+    const MBPOL_POLY_REAL t3588 = t3310*t146;
+    const MBPOL_POLY_REAL t3589 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t3305+t3307+
 t3308+t3309+t3585+t3587+t3588;
-    const double t3591 = t3479*t212;
-    const double t3592 = t3475*t215;
-    const double t3593 = t3474+t3484+t3485+t3489+t3494+t3497+t3499+t3501+t3504+t3591+t3592+
+    const MBPOL_POLY_REAL t3591 = t3479*t212;
+    const MBPOL_POLY_REAL t3592 = t3475*t215;
+    const MBPOL_POLY_REAL t3593 = t3474+t3484+t3485+t3489+t3494+t3497+t3499+t3501+t3504+t3591+t3592+
 t3506+t3508;
-    const double t3594 = t3486*t309;
-    const double t3595 = t3490*t155;
-    const double t3596 = t3492*t146;
-    const double t3597 = t3481*t475;
-    const double t3598 = t3492*t139;
-    const double t3599 = t3490*t145;
-    const double t3600 = a[651];
-    const double t3602 = t3477*t143;
-    const double t3603 = t3509+t3510+t3511+t3512+t3513+t3594+t3595+t3596+t3597+t3598+t3599+
+    const MBPOL_POLY_REAL t3594 = t3486*t309;
+    const MBPOL_POLY_REAL t3595 = t3490*t155;
+    const MBPOL_POLY_REAL t3596 = t3492*t146;
+    const MBPOL_POLY_REAL t3597 = t3481*t475;
+    const MBPOL_POLY_REAL t3598 = t3492*t139;
+    const MBPOL_POLY_REAL t3599 = t3490*t145;
+    const MBPOL_POLY_REAL t3600 = a[651];
+    const MBPOL_POLY_REAL t3602 = t3477*t143;
+    const MBPOL_POLY_REAL t3603 = t3509+t3510+t3511+t3512+t3513+t3594+t3595+t3596+t3597+t3598+t3599+
 t3600*t240+t3602;
-    const double t3606 = t3343*t20;
-    const double t3607 = t3341*t5;
-    const double t3608 = t3341*t26;
-    const double t3609 = t3343*t37;
-    const double t3610 = t3353*t72;
-    const double t3611 = t3351*t73;
-    const double t3612 = t3335*t77;
-    const double t3613 = a[971];
-    const double t3615 = t3355*t132;
-    const double t3617 = t3606+t3345+t3607+t3608+t3609+t3349+t3350+t3610+t3611+t3612+t3613*
+    const MBPOL_POLY_REAL t3606 = t3343*t20;
+    const MBPOL_POLY_REAL t3607 = t3341*t5;
+    const MBPOL_POLY_REAL t3608 = t3341*t26;
+    const MBPOL_POLY_REAL t3609 = t3343*t37;
+    const MBPOL_POLY_REAL t3610 = t3353*t72;
+    const MBPOL_POLY_REAL t3611 = t3351*t73;
+    const MBPOL_POLY_REAL t3612 = t3335*t77;
+    const MBPOL_POLY_REAL t3613 = a[971];
+    const MBPOL_POLY_REAL t3615 = t3355*t132;
+    const MBPOL_POLY_REAL t3617 = t3606+t3345+t3607+t3608+t3609+t3349+t3350+t3610+t3611+t3612+t3613*
 t126+t3615+t3357*t136;
-    const double t3619 = t3381*t5;
-    const double t3620 = t3381*t20;
-    const double t3621 = t3377*t26;
-    const double t3622 = t3377*t37;
-    const double t3623 = a[1137];
-    const double t3189 = t3623*t50;
-    const double t3192 = t3384*t67;
-    const double t3627 = (t3619+t3379+t3620+t3621+t3622+t3189+t3192)*t67;
-    const double t3628 = t3586*t139;
-    const double t3629 = t3584*t145;
-    const double t3630 = t3314*t146;
-    const double t3631 = t3310*t155;
-    const double t3632 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t3305+t3307+
+    const MBPOL_POLY_REAL t3619 = t3381*t5;
+    const MBPOL_POLY_REAL t3620 = t3381*t20;
+    const MBPOL_POLY_REAL t3621 = t3377*t26;
+    const MBPOL_POLY_REAL t3622 = t3377*t37;
+    const MBPOL_POLY_REAL t3623 = a[1137];
+    const MBPOL_POLY_REAL t3189 = t3623*t50;
+    const MBPOL_POLY_REAL t3192 = t3384*t67;
+    const MBPOL_POLY_REAL t3627 = (t3619+t3379+t3620+t3621+t3622+t3189+t3192)*t67;
+    const MBPOL_POLY_REAL t3628 = t3586*t139;
+    const MBPOL_POLY_REAL t3629 = t3584*t145;
+    const MBPOL_POLY_REAL t3630 = t3314*t146;
+    const MBPOL_POLY_REAL t3631 = t3310*t155;
+    const MBPOL_POLY_REAL t3632 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t3305+t3307+
 t3308+t3309+t3628+t3629+t3630+t3631;
-    const double t3634 = t3320*t20;
-    const double t3635 = t3322*t5;
-    const double t3636 = t3322*t26;
-    const double t3637 = t3320*t37;
-    const double t3638 = t3331*t72;
-    const double t3639 = t3329*t73;
-    const double t3644 = t3409*t139;
-    const double t3645 = t3407*t145;
-    const double t3646 = t3409*t146;
-    const double t3647 = t3407*t155;
-    const double t3648 = t3421*t212;
-    const double t3649 = t3403+t3405+t3406+t3644+t3645+t3646+t3647+t3414+t3416+t3418+t3648;
-    const double t3652 = a[866];
-    const double t3653 = t3652*t5;
-    const double t3654 = a[320];
-    const double t3655 = t3652*t20;
-    const double t3656 = t3652*t26;
-    const double t3657 = t3652*t37;
-    const double t3658 = a[1085];
-    const double t3659 = t3658*t50;
-    const double t3660 = t3658*t67;
-    const double t3661 = a[1105];
-    const double t3662 = t3661*t72;
-    const double t3663 = t3661*t73;
-    const double t3664 = a[773];
-    const double t3666 = a[1099];
-    const double t3670 = a[673];
-    const double t3671 = t3670*t139;
-    const double t3672 = t3670*t145;
-    const double t3673 = t3670*t146;
-    const double t3674 = t3670*t155;
-    const double t3198 = a[1037];
-    const double t3676 = t3198*t179;
-    const double t3677 = a[912];
-    const double t3679 = t3653+t3654+t3655+t3656+t3657+t3659+t3660+t3662+t3663+t3664*t77+
+    const MBPOL_POLY_REAL t3634 = t3320*t20;
+    const MBPOL_POLY_REAL t3635 = t3322*t5;
+    const MBPOL_POLY_REAL t3636 = t3322*t26;
+    const MBPOL_POLY_REAL t3637 = t3320*t37;
+    const MBPOL_POLY_REAL t3638 = t3331*t72;
+    const MBPOL_POLY_REAL t3639 = t3329*t73;
+    const MBPOL_POLY_REAL t3644 = t3409*t139;
+    const MBPOL_POLY_REAL t3645 = t3407*t145;
+    const MBPOL_POLY_REAL t3646 = t3409*t146;
+    const MBPOL_POLY_REAL t3647 = t3407*t155;
+    const MBPOL_POLY_REAL t3648 = t3421*t212;
+    const MBPOL_POLY_REAL t3649 = t3403+t3405+t3406+t3644+t3645+t3646+t3647+t3414+t3416+t3418+t3648;
+    const MBPOL_POLY_REAL t3652 = a[866];
+    const MBPOL_POLY_REAL t3653 = t3652*t5;
+    const MBPOL_POLY_REAL t3654 = a[320];
+    const MBPOL_POLY_REAL t3655 = t3652*t20;
+    const MBPOL_POLY_REAL t3656 = t3652*t26;
+    const MBPOL_POLY_REAL t3657 = t3652*t37;
+    const MBPOL_POLY_REAL t3658 = a[1085];
+    const MBPOL_POLY_REAL t3659 = t3658*t50;
+    const MBPOL_POLY_REAL t3660 = t3658*t67;
+    const MBPOL_POLY_REAL t3661 = a[1105];
+    const MBPOL_POLY_REAL t3662 = t3661*t72;
+    const MBPOL_POLY_REAL t3663 = t3661*t73;
+    const MBPOL_POLY_REAL t3664 = a[773];
+    const MBPOL_POLY_REAL t3666 = a[1099];
+    const MBPOL_POLY_REAL t3670 = a[673];
+    const MBPOL_POLY_REAL t3671 = t3670*t139;
+    const MBPOL_POLY_REAL t3672 = t3670*t145;
+    const MBPOL_POLY_REAL t3673 = t3670*t146;
+    const MBPOL_POLY_REAL t3674 = t3670*t155;
+    const MBPOL_POLY_REAL t3198 = a[1037];
+    const MBPOL_POLY_REAL t3676 = t3198*t179;
+    const MBPOL_POLY_REAL t3677 = a[912];
+    const MBPOL_POLY_REAL t3679 = t3653+t3654+t3655+t3656+t3657+t3659+t3660+t3662+t3663+t3664*t77+
 t3666*t126+t3664*t132+t3666*t136+t3671+t3672+t3673+t3674+t3676+t3677*t275;
-    const double t3681 = a[911];
-    const double t3682 = t3681*t5;
-    const double t3683 = a[557];
-    const double t3684 = t3681*t20;
-    const double t3685 = t3681*t26;
-    const double t3686 = t3681*t37;
-    const double t3687 = a[705];
-    const double t3688 = t3687*t50;
-    const double t3689 = t3687*t67;
-    const double t3690 = a[698];
-    const double t3691 = t3690*t72;
-    const double t3692 = t3690*t73;
-    const double t3693 = a[625];
-    const double t3695 = a[993];
-    const double t3699 = a[743];
-    const double t3700 = t3699*t139;
-    const double t3701 = t3699*t145;
-    const double t3702 = t3699*t146;
-    const double t3703 = t3699*t155;
-    const double t3258 = a[609];
-    const double t3705 = t3258*t179;
-    const double t3706 = t3682+t3683+t3684+t3685+t3686+t3688+t3689+t3691+t3692+t3693*t77+
+    const MBPOL_POLY_REAL t3681 = a[911];
+    const MBPOL_POLY_REAL t3682 = t3681*t5;
+    const MBPOL_POLY_REAL t3683 = a[557];
+    const MBPOL_POLY_REAL t3684 = t3681*t20;
+    const MBPOL_POLY_REAL t3685 = t3681*t26;
+    const MBPOL_POLY_REAL t3686 = t3681*t37;
+    const MBPOL_POLY_REAL t3687 = a[705];
+    const MBPOL_POLY_REAL t3688 = t3687*t50;
+    const MBPOL_POLY_REAL t3689 = t3687*t67;
+    const MBPOL_POLY_REAL t3690 = a[698];
+    const MBPOL_POLY_REAL t3691 = t3690*t72;
+    const MBPOL_POLY_REAL t3692 = t3690*t73;
+    const MBPOL_POLY_REAL t3693 = a[625];
+    const MBPOL_POLY_REAL t3695 = a[993];
+    const MBPOL_POLY_REAL t3699 = a[743];
+    const MBPOL_POLY_REAL t3700 = t3699*t139;
+    const MBPOL_POLY_REAL t3701 = t3699*t145;
+    const MBPOL_POLY_REAL t3702 = t3699*t146;
+    const MBPOL_POLY_REAL t3703 = t3699*t155;
+    const MBPOL_POLY_REAL t3258 = a[609];
+    const MBPOL_POLY_REAL t3705 = t3258*t179;
+    const MBPOL_POLY_REAL t3706 = t3682+t3683+t3684+t3685+t3686+t3688+t3689+t3691+t3692+t3693*t77+
 t3695*t126+t3693*t132+t3695*t136+t3700+t3701+t3702+t3703+t3705;
-    const double t3287 = t3567*t5;
-    const double t3710 = (t3564+t3287)*t5;
-    const double t3711 = t3571*t5;
-    const double t3712 = t3567*t20;
-    const double t3313 = t3711+t3564+t3712;
-    const double t3714 = t3313*t20;
-    const double t3334 = t3593+t3603;
-    const double t3360 = t3337*t77;
-    const double t3375 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t3401+t3649;
-    const double t3715 = t3570+t3577+t3589*t146+t3334*t475+t3617*t136+t3627+t3632*t155+(
+    const MBPOL_POLY_REAL t3287 = t3567*t5;
+    const MBPOL_POLY_REAL t3710 = (t3564+t3287)*t5;
+    const MBPOL_POLY_REAL t3711 = t3571*t5;
+    const MBPOL_POLY_REAL t3712 = t3567*t20;
+    const MBPOL_POLY_REAL t3313 = t3711+t3564+t3712;
+    const MBPOL_POLY_REAL t3714 = t3313*t20;
+    const MBPOL_POLY_REAL t3334 = t3593+t3603;
+    const MBPOL_POLY_REAL t3360 = t3337*t77;
+    const MBPOL_POLY_REAL t3375 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t3401+t3649;
+    const MBPOL_POLY_REAL t3715 = t3570+t3577+t3589*t146+t3334*t475+t3617*t136+t3627+t3632*t155+(
 t3634+t3319+t3635+t3636+t3637+t3327+t3328+t3638+t3639+t3360)*t77+t3375*t212+
 t3679*t275+t3706*t179+t3710+t3714;
-    const double t3718 = a[92];
-    const double t3719 = t3718*t5;
-    const double t3720 = a[54];
-    const double t3721 = a[504];
-    const double t3722 = t3721*t20;
-    const double t3723 = t3718*t26;
-    const double t3724 = t3721*t37;
-    const double t3725 = a[528];
-    const double t3726 = t3725*t50;
-    const double t3727 = t3725*t67;
-    const double t3728 = a[518];
-    const double t3730 = a[80];
-    const double t3734 = a[49];
-    const double t3735 = a[403];
-    const double t3736 = t3735*t5;
-    const double t3737 = t3735*t20;
-    const double t3738 = t3735*t26;
-    const double t3739 = t3735*t37;
-    const double t3740 = a[429];
-    const double t3741 = t3740*t50;
-    const double t3742 = t3740*t67;
-    const double t3743 = a[322];
-    const double t3744 = t3743*t72;
-    const double t3745 = t3743*t73;
-    const double t3746 = a[160];
-    const double t3747 = t3746*t77;
-    const double t3748 = t3746*t126;
-    const double t3749 = t3734+t3736+t3737+t3738+t3739+t3741+t3742+t3744+t3745+t3747+t3748;
-    const double t3750 = t3746*t132;
-    const double t3751 = t3746*t136;
-    const double t3752 = a[101];
-    const double t3754 = a[318];
-    const double t3424 = a[542];
-    const double t3759 = t3424*t179;
-    const double t3760 = a[486];
-    const double t3761 = t3760*t275;
-    const double t3762 = t3760*t254;
-    const double t3763 = a[559];
-    const double t3765 = a[243];
-    const double t3767 = t3750+t3751+t3752*t139+t3754*t145+t3752*t146+t3754*t155+t3759+t3761
+    const MBPOL_POLY_REAL t3718 = a[92];
+    const MBPOL_POLY_REAL t3719 = t3718*t5;
+    const MBPOL_POLY_REAL t3720 = a[54];
+    const MBPOL_POLY_REAL t3721 = a[504];
+    const MBPOL_POLY_REAL t3722 = t3721*t20;
+    const MBPOL_POLY_REAL t3723 = t3718*t26;
+    const MBPOL_POLY_REAL t3724 = t3721*t37;
+    const MBPOL_POLY_REAL t3725 = a[528];
+    const MBPOL_POLY_REAL t3726 = t3725*t50;
+    const MBPOL_POLY_REAL t3727 = t3725*t67;
+    const MBPOL_POLY_REAL t3728 = a[518];
+    const MBPOL_POLY_REAL t3730 = a[80];
+    const MBPOL_POLY_REAL t3734 = a[49];
+    const MBPOL_POLY_REAL t3735 = a[403];
+    const MBPOL_POLY_REAL t3736 = t3735*t5;
+    const MBPOL_POLY_REAL t3737 = t3735*t20;
+    const MBPOL_POLY_REAL t3738 = t3735*t26;
+    const MBPOL_POLY_REAL t3739 = t3735*t37;
+    const MBPOL_POLY_REAL t3740 = a[429];
+    const MBPOL_POLY_REAL t3741 = t3740*t50;
+    const MBPOL_POLY_REAL t3742 = t3740*t67;
+    const MBPOL_POLY_REAL t3743 = a[322];
+    const MBPOL_POLY_REAL t3744 = t3743*t72;
+    const MBPOL_POLY_REAL t3745 = t3743*t73;
+    const MBPOL_POLY_REAL t3746 = a[160];
+    const MBPOL_POLY_REAL t3747 = t3746*t77;
+    const MBPOL_POLY_REAL t3748 = t3746*t126;
+    const MBPOL_POLY_REAL t3749 = t3734+t3736+t3737+t3738+t3739+t3741+t3742+t3744+t3745+t3747+t3748;
+    const MBPOL_POLY_REAL t3750 = t3746*t132;
+    const MBPOL_POLY_REAL t3751 = t3746*t136;
+    const MBPOL_POLY_REAL t3752 = a[101];
+    const MBPOL_POLY_REAL t3754 = a[318];
+    const MBPOL_POLY_REAL t3424 = a[542];
+    const MBPOL_POLY_REAL t3759 = t3424*t179;
+    const MBPOL_POLY_REAL t3760 = a[486];
+    const MBPOL_POLY_REAL t3761 = t3760*t275;
+    const MBPOL_POLY_REAL t3762 = t3760*t254;
+    const MBPOL_POLY_REAL t3763 = a[559];
+    const MBPOL_POLY_REAL t3765 = a[243];
+    const MBPOL_POLY_REAL t3767 = t3750+t3751+t3752*t139+t3754*t145+t3752*t146+t3754*t155+t3759+t3761
 +t3762+t3763*t212+t3765*t215;
-    const double t3770 = t3721*t5;
-    const double t3771 = t3718*t20;
-    const double t3772 = t3721*t26;
-    const double t3773 = t3718*t37;
-    const double t3777 = t3157*t5;
-    const double t3778 = t3157*t20;
-    const double t3779 = t3154*t26;
-    const double t3780 = t3154*t37;
-    const double t3784 = t3207*t77;
-    const double t3785 = t3209*t126;
-    const double t3786 = t3215+t3214+t3216+t3218+t3219+t3221+t3222+t3224+t3225+t3784+t3785;
-    const double t3787 = t3207*t132;
-    const double t3788 = t3209*t136;
-    const double t3789 = t3228*t139;
-    const double t3790 = t3226*t145;
-    const double t3791 = t3228*t146;
-    const double t3792 = t3226*t155;
-    const double t3793 = t3203*t275;
-    const double t3794 = t3205*t254;
-    const double t3795 = t3236*t212;
-    const double t3796 = t3234*t215;
-    const double t3797 = t3199*t143;
-    const double t3798 = t3787+t3788+t3789+t3790+t3791+t3792+t3233+t3793+t3794+t3795+t3796+
+    const MBPOL_POLY_REAL t3770 = t3721*t5;
+    const MBPOL_POLY_REAL t3771 = t3718*t20;
+    const MBPOL_POLY_REAL t3772 = t3721*t26;
+    const MBPOL_POLY_REAL t3773 = t3718*t37;
+    const MBPOL_POLY_REAL t3777 = t3157*t5;
+    const MBPOL_POLY_REAL t3778 = t3157*t20;
+    const MBPOL_POLY_REAL t3779 = t3154*t26;
+    const MBPOL_POLY_REAL t3780 = t3154*t37;
+    const MBPOL_POLY_REAL t3784 = t3207*t77;
+    const MBPOL_POLY_REAL t3785 = t3209*t126;
+    const MBPOL_POLY_REAL t3786 = t3215+t3214+t3216+t3218+t3219+t3221+t3222+t3224+t3225+t3784+t3785;
+    const MBPOL_POLY_REAL t3787 = t3207*t132;
+    const MBPOL_POLY_REAL t3788 = t3209*t136;
+    const MBPOL_POLY_REAL t3789 = t3228*t139;
+    const MBPOL_POLY_REAL t3790 = t3226*t145;
+    const MBPOL_POLY_REAL t3791 = t3228*t146;
+    const MBPOL_POLY_REAL t3792 = t3226*t155;
+    const MBPOL_POLY_REAL t3793 = t3203*t275;
+    const MBPOL_POLY_REAL t3794 = t3205*t254;
+    const MBPOL_POLY_REAL t3795 = t3236*t212;
+    const MBPOL_POLY_REAL t3796 = t3234*t215;
+    const MBPOL_POLY_REAL t3797 = t3199*t143;
+    const MBPOL_POLY_REAL t3798 = t3787+t3788+t3789+t3790+t3791+t3792+t3233+t3793+t3794+t3795+t3796+
 t3797;
-    const double t3801 = t3199*t240;
-    const double t3802 = t3195*t309;
-    const double t3803 = t3795+t3796+t3789+t3801+t3802+t3204+t3791+t3206+t3790+t3208+t3210+
+    const MBPOL_POLY_REAL t3801 = t3199*t240;
+    const MBPOL_POLY_REAL t3802 = t3195*t309;
+    const MBPOL_POLY_REAL t3803 = t3795+t3796+t3789+t3801+t3802+t3204+t3791+t3206+t3790+t3208+t3210+
 t3211;
-    const double t3804 = t3201*t143;
-    const double t3805 = t3792+t3212+t3804+t3214+t3215+t3216+t3218+t3219+t3221+t3222+t3224+
+    const MBPOL_POLY_REAL t3804 = t3201*t143;
+    const MBPOL_POLY_REAL t3805 = t3792+t3212+t3804+t3214+t3215+t3216+t3218+t3219+t3221+t3222+t3224+
 t3225+t3233;
-    const double t3808 = a[923];
-    const double t3809 = t3808*t5;
-    const double t3810 = a[442];
-    const double t3811 = t3808*t20;
-    const double t3812 = t3808*t26;
-    const double t3813 = t3808*t37;
-    const double t3814 = a[733];
-    const double t3815 = t3814*t50;
-    const double t3816 = t3814*t67;
-    const double t3817 = a[1028];
-    const double t3818 = t3817*t72;
-    const double t3819 = t3817*t73;
-    const double t3820 = a[746];
-    const double t3821 = t3820*t77;
-    const double t3822 = t3820*t126;
-    const double t3823 = t3809+t3810+t3811+t3812+t3813+t3815+t3816+t3818+t3819+t3821+t3822;
-    const double t3824 = t3820*t132;
-    const double t3825 = t3820*t136;
-    const double t3826 = a[561];
-    const double t3828 = a[1088];
-    const double t3473 = a[1094];
-    const double t3833 = t3473*t179;
-    const double t3834 = a[750];
-    const double t3835 = t3834*t275;
-    const double t3836 = t3834*t254;
-    const double t3837 = a[849];
-    const double t3839 = a[723];
-    const double t3841 = t3824+t3825+t3826*t139+t3828*t145+t3826*t146+t3828*t155+t3833+t3835
+    const MBPOL_POLY_REAL t3808 = a[923];
+    const MBPOL_POLY_REAL t3809 = t3808*t5;
+    const MBPOL_POLY_REAL t3810 = a[442];
+    const MBPOL_POLY_REAL t3811 = t3808*t20;
+    const MBPOL_POLY_REAL t3812 = t3808*t26;
+    const MBPOL_POLY_REAL t3813 = t3808*t37;
+    const MBPOL_POLY_REAL t3814 = a[733];
+    const MBPOL_POLY_REAL t3815 = t3814*t50;
+    const MBPOL_POLY_REAL t3816 = t3814*t67;
+    const MBPOL_POLY_REAL t3817 = a[1028];
+    const MBPOL_POLY_REAL t3818 = t3817*t72;
+    const MBPOL_POLY_REAL t3819 = t3817*t73;
+    const MBPOL_POLY_REAL t3820 = a[746];
+    const MBPOL_POLY_REAL t3821 = t3820*t77;
+    const MBPOL_POLY_REAL t3822 = t3820*t126;
+    const MBPOL_POLY_REAL t3823 = t3809+t3810+t3811+t3812+t3813+t3815+t3816+t3818+t3819+t3821+t3822;
+    const MBPOL_POLY_REAL t3824 = t3820*t132;
+    const MBPOL_POLY_REAL t3825 = t3820*t136;
+    const MBPOL_POLY_REAL t3826 = a[561];
+    const MBPOL_POLY_REAL t3828 = a[1088];
+    const MBPOL_POLY_REAL t3473 = a[1094];
+    const MBPOL_POLY_REAL t3833 = t3473*t179;
+    const MBPOL_POLY_REAL t3834 = a[750];
+    const MBPOL_POLY_REAL t3835 = t3834*t275;
+    const MBPOL_POLY_REAL t3836 = t3834*t254;
+    const MBPOL_POLY_REAL t3837 = a[849];
+    const MBPOL_POLY_REAL t3839 = a[723];
+    const MBPOL_POLY_REAL t3841 = t3824+t3825+t3826*t139+t3828*t145+t3826*t146+t3828*t155+t3833+t3835
 +t3836+t3837*t212+t3839*t215;
-    const double t3844 = a[1126];
-    const double t3846 = a[985];
-    const double t3848 = a[788];
-    const double t3849 = t3848*t5;
-    const double t3850 = a[209];
-    const double t3851 = a[942];
-    const double t3852 = t3851*t37;
-    const double t3855 = a[640];
-    const double t3856 = t3855*t5;
-    const double t3857 = a[547];
-    const double t3858 = t3855*t20;
-    const double t3859 = a[1004];
-    const double t3860 = t3859*t26;
-    const double t3861 = t3859*t37;
-    const double t3862 = a[1130];
-    const double t3866 = a[629];
-    const double t3867 = t3866*t5;
-    const double t3868 = a[582];
-    const double t3869 = t3868*t20;
-    const double t3870 = a[392];
-    const double t3871 = t3866*t26;
-    const double t3872 = t3868*t37;
-    const double t3873 = a[771];
-    const double t3874 = t3873*t50;
-    const double t3875 = t3873*t67;
-    const double t3876 = a[910];
-    const double t3877 = t3876*t72;
-    const double t3878 = a[811];
-    const double t3879 = t3878*t73;
-    const double t3880 = a[892];
-    const double t3882 = a[751];
-    const double t3884 = a[963];
-    const double t3886 = a[888];
-    const double t3888 = t3867+t3869+t3870+t3871+t3872+t3874+t3875+t3877+t3879+t3880*t77+
+    const MBPOL_POLY_REAL t3844 = a[1126];
+    const MBPOL_POLY_REAL t3846 = a[985];
+    const MBPOL_POLY_REAL t3848 = a[788];
+    const MBPOL_POLY_REAL t3849 = t3848*t5;
+    const MBPOL_POLY_REAL t3850 = a[209];
+    const MBPOL_POLY_REAL t3851 = a[942];
+    const MBPOL_POLY_REAL t3852 = t3851*t37;
+    const MBPOL_POLY_REAL t3855 = a[640];
+    const MBPOL_POLY_REAL t3856 = t3855*t5;
+    const MBPOL_POLY_REAL t3857 = a[547];
+    const MBPOL_POLY_REAL t3858 = t3855*t20;
+    const MBPOL_POLY_REAL t3859 = a[1004];
+    const MBPOL_POLY_REAL t3860 = t3859*t26;
+    const MBPOL_POLY_REAL t3861 = t3859*t37;
+    const MBPOL_POLY_REAL t3862 = a[1130];
+    const MBPOL_POLY_REAL t3866 = a[629];
+    const MBPOL_POLY_REAL t3867 = t3866*t5;
+    const MBPOL_POLY_REAL t3868 = a[582];
+    const MBPOL_POLY_REAL t3869 = t3868*t20;
+    const MBPOL_POLY_REAL t3870 = a[392];
+    const MBPOL_POLY_REAL t3871 = t3866*t26;
+    const MBPOL_POLY_REAL t3872 = t3868*t37;
+    const MBPOL_POLY_REAL t3873 = a[771];
+    const MBPOL_POLY_REAL t3874 = t3873*t50;
+    const MBPOL_POLY_REAL t3875 = t3873*t67;
+    const MBPOL_POLY_REAL t3876 = a[910];
+    const MBPOL_POLY_REAL t3877 = t3876*t72;
+    const MBPOL_POLY_REAL t3878 = a[811];
+    const MBPOL_POLY_REAL t3879 = t3878*t73;
+    const MBPOL_POLY_REAL t3880 = a[892];
+    const MBPOL_POLY_REAL t3882 = a[751];
+    const MBPOL_POLY_REAL t3884 = a[963];
+    const MBPOL_POLY_REAL t3886 = a[888];
+    const MBPOL_POLY_REAL t3888 = t3867+t3869+t3870+t3871+t3872+t3874+t3875+t3877+t3879+t3880*t77+
 t3882*t126+t3884*t132+t3886*t136;
-    const double t3890 = a[1052];
-    const double t3891 = t3890*t20;
-    const double t3892 = a[1022];
-    const double t3893 = t3892*t5;
-    const double t3894 = a[502];
-    const double t3895 = t3892*t26;
-    const double t3896 = t3890*t37;
-    const double t3897 = a[749];
-    const double t3898 = t3897*t50;
-    const double t3899 = t3897*t67;
-    const double t3900 = a[1006];
-    const double t3902 = a[828];
-    const double t3912 = t3822+t3824+t3825+t3828*t139+t3826*t145+t3828*t146+t3826*t155+t3833
+    const MBPOL_POLY_REAL t3890 = a[1052];
+    const MBPOL_POLY_REAL t3891 = t3890*t20;
+    const MBPOL_POLY_REAL t3892 = a[1022];
+    const MBPOL_POLY_REAL t3893 = t3892*t5;
+    const MBPOL_POLY_REAL t3894 = a[502];
+    const MBPOL_POLY_REAL t3895 = t3892*t26;
+    const MBPOL_POLY_REAL t3896 = t3890*t37;
+    const MBPOL_POLY_REAL t3897 = a[749];
+    const MBPOL_POLY_REAL t3898 = t3897*t50;
+    const MBPOL_POLY_REAL t3899 = t3897*t67;
+    const MBPOL_POLY_REAL t3900 = a[1006];
+    const MBPOL_POLY_REAL t3902 = a[828];
+    const MBPOL_POLY_REAL t3912 = t3822+t3824+t3825+t3828*t139+t3826*t145+t3828*t146+t3826*t155+t3833
 +t3835+t3836+t3839*t212;
-    const double t3915 = t3846*t5;
-    const double t3916 = t3851*t20;
-    const double t3919 = t3844*t5;
-    const double t3920 = t3848*t20;
-    const double t3921 = t3851*t26;
-    const double t3924 = t3890*t5;
-    const double t3925 = t3892*t20;
-    const double t3926 = t3890*t26;
-    const double t3927 = t3892*t37;
-    const double t3931 = t3859*t5;
-    const double t3932 = t3859*t20;
-    const double t3933 = t3855*t26;
-    const double t3934 = t3855*t37;
-    const double t3935 = a[1139];
-    const double t3940 = a[953];
-    const double t3941 = t3940*t5;
-    const double t3942 = a[520];
-    const double t3943 = t3940*t20;
-    const double t3944 = t3940*t26;
-    const double t3945 = t3940*t37;
-    const double t3946 = a[829];
-    const double t3947 = t3946*t50;
-    const double t3948 = t3946*t67;
-    const double t3949 = a[1109];
-    const double t3950 = t3949*t72;
-    const double t3951 = t3949*t73;
-    const double t3952 = a[1077];
-    const double t3954 = a[590];
-    const double t3958 = a[716];
-    const double t3959 = t3958*t139;
-    const double t3960 = t3958*t145;
-    const double t3961 = t3958*t146;
-    const double t3962 = t3958*t155;
-    const double t3590 = a[928];
-    const double t3964 = t3590*t179;
-    const double t3965 = a[1078];
-    const double t3967 = t3941+t3942+t3943+t3944+t3945+t3947+t3948+t3950+t3951+t3952*t77+
+    const MBPOL_POLY_REAL t3915 = t3846*t5;
+    const MBPOL_POLY_REAL t3916 = t3851*t20;
+    const MBPOL_POLY_REAL t3919 = t3844*t5;
+    const MBPOL_POLY_REAL t3920 = t3848*t20;
+    const MBPOL_POLY_REAL t3921 = t3851*t26;
+    const MBPOL_POLY_REAL t3924 = t3890*t5;
+    const MBPOL_POLY_REAL t3925 = t3892*t20;
+    const MBPOL_POLY_REAL t3926 = t3890*t26;
+    const MBPOL_POLY_REAL t3927 = t3892*t37;
+    const MBPOL_POLY_REAL t3931 = t3859*t5;
+    const MBPOL_POLY_REAL t3932 = t3859*t20;
+    const MBPOL_POLY_REAL t3933 = t3855*t26;
+    const MBPOL_POLY_REAL t3934 = t3855*t37;
+    const MBPOL_POLY_REAL t3935 = a[1139];
+    const MBPOL_POLY_REAL t3940 = a[953];
+    const MBPOL_POLY_REAL t3941 = t3940*t5;
+    const MBPOL_POLY_REAL t3942 = a[520];
+    const MBPOL_POLY_REAL t3943 = t3940*t20;
+    const MBPOL_POLY_REAL t3944 = t3940*t26;
+    const MBPOL_POLY_REAL t3945 = t3940*t37;
+    const MBPOL_POLY_REAL t3946 = a[829];
+    const MBPOL_POLY_REAL t3947 = t3946*t50;
+    const MBPOL_POLY_REAL t3948 = t3946*t67;
+    const MBPOL_POLY_REAL t3949 = a[1109];
+    const MBPOL_POLY_REAL t3950 = t3949*t72;
+    const MBPOL_POLY_REAL t3951 = t3949*t73;
+    const MBPOL_POLY_REAL t3952 = a[1077];
+    const MBPOL_POLY_REAL t3954 = a[590];
+    const MBPOL_POLY_REAL t3958 = a[716];
+    const MBPOL_POLY_REAL t3959 = t3958*t139;
+    const MBPOL_POLY_REAL t3960 = t3958*t145;
+    const MBPOL_POLY_REAL t3961 = t3958*t146;
+    const MBPOL_POLY_REAL t3962 = t3958*t155;
+    const MBPOL_POLY_REAL t3590 = a[928];
+    const MBPOL_POLY_REAL t3964 = t3590*t179;
+    const MBPOL_POLY_REAL t3965 = a[1078];
+    const MBPOL_POLY_REAL t3967 = t3941+t3942+t3943+t3944+t3945+t3947+t3948+t3950+t3951+t3952*t77+
 t3954*t126+t3952*t132+t3954*t136+t3959+t3960+t3961+t3962+t3964+t3965*t275;
-    const double t3969 = a[881];
-    const double t3970 = t3969*t5;
-    const double t3971 = a[556];
-    const double t3972 = t3969*t20;
-    const double t3973 = t3969*t26;
-    const double t3974 = t3969*t37;
-    const double t3975 = a[693];
-    const double t3978 = a[566];
-    const double t3981 = a[920];
-    const double t3986 = a[814];
-    const double t3618 = a[1131];
-    const double t3992 = t3618*t179;
-    const double t3993 = t3970+t3971+t3972+t3973+t3974+t3975*t50+t3975*t67+t3978*t72+t3978*
+    const MBPOL_POLY_REAL t3969 = a[881];
+    const MBPOL_POLY_REAL t3970 = t3969*t5;
+    const MBPOL_POLY_REAL t3971 = a[556];
+    const MBPOL_POLY_REAL t3972 = t3969*t20;
+    const MBPOL_POLY_REAL t3973 = t3969*t26;
+    const MBPOL_POLY_REAL t3974 = t3969*t37;
+    const MBPOL_POLY_REAL t3975 = a[693];
+    const MBPOL_POLY_REAL t3978 = a[566];
+    const MBPOL_POLY_REAL t3981 = a[920];
+    const MBPOL_POLY_REAL t3986 = a[814];
+    const MBPOL_POLY_REAL t3618 = a[1131];
+    const MBPOL_POLY_REAL t3992 = t3618*t179;
+    const MBPOL_POLY_REAL t3993 = t3970+t3971+t3972+t3973+t3974+t3975*t50+t3975*t67+t3978*t72+t3978*
 t73+t3981*t77+t3981*t126+t3981*t132+t3981*t136+t3986*t139+t3986*t145+t3986*t146
 +t3986*t155+t3992;
-    const double t3668 = t3823+t3841;
-    const double t3680 = t3844*t20+t3846*t26+t3849+t3850+t3852;
-    const double t3696 = t3862*t50;
-    const double t3707 = t3900*t72;
-    const double t3708 = t3902*t73;
-    const double t3716 = t3809+t3810+t3811+t3812+t3813+t3815+t3816+t3818+t3819+t3821+t3912;
-    const double t3753 = t3902*t72;
-    const double t3757 = t3935*t50;
-    const double t3758 = t3862*t67;
-    const double t3995 = t3668*t215+t3680*t37+(t3856+t3857+t3858+t3860+t3861+t3696)*t50+
+    const MBPOL_POLY_REAL t3668 = t3823+t3841;
+    const MBPOL_POLY_REAL t3680 = t3844*t20+t3846*t26+t3849+t3850+t3852;
+    const MBPOL_POLY_REAL t3696 = t3862*t50;
+    const MBPOL_POLY_REAL t3707 = t3900*t72;
+    const MBPOL_POLY_REAL t3708 = t3902*t73;
+    const MBPOL_POLY_REAL t3716 = t3809+t3810+t3811+t3812+t3813+t3815+t3816+t3818+t3819+t3821+t3912;
+    const MBPOL_POLY_REAL t3753 = t3902*t72;
+    const MBPOL_POLY_REAL t3757 = t3935*t50;
+    const MBPOL_POLY_REAL t3758 = t3862*t67;
+    const MBPOL_POLY_REAL t3995 = t3668*t215+t3680*t37+(t3856+t3857+t3858+t3860+t3861+t3696)*t50+
 t3888*t136+(t3891+t3893+t3894+t3895+t3896+t3898+t3899+t3707+t3708)*t73+t3716*
 t212+(t3850+t3915+t3916)*t20+(t3919+t3850+t3920+t3921)*t26+(t3924+t3894+t3925+
 t3926+t3927+t3898+t3899+t3753)*t72+(t3931+t3857+t3932+t3933+t3934+t3757+t3758)*
 t67+t3967*t275+t3993*t179;
-    const double t4000 = a[925];
-    const double t4003 = t3941+t3942+t3943+t3944+t3945+t3947+t3948+t3950+t3951+t3954*t77+
+    const MBPOL_POLY_REAL t4000 = a[925];
+    const MBPOL_POLY_REAL t4003 = t3941+t3942+t3943+t3944+t3945+t3947+t3948+t3950+t3951+t3954*t77+
 t3952*t126+t3954*t132+t3952*t136+t3959+t3960+t3961+t3962+t3964+t4000*t275+t3965
 *t254;
-    const double t4005 = a[1013];
-    const double t4007 = a[838];
-    const double t4008 = t4007*t475;
-    const double t4009 = a[662];
-    const double t4010 = t4009*t136;
-    const double t4011 = t4009*t126;
-    const double t4012 = a[905];
-    const double t4013 = t4012*t143;
-    const double t4014 = a[685];
-    const double t4015 = t4014*t5;
-    const double t4016 = a[1108];
-    const double t4017 = t4016*t254;
-    const double t4018 = a[975];
-    const double t4020 = a[796];
-    const double t4021 = t4020*t275;
-    const double t4022 = a[315];
-    const double t4023 = a[643];
-    const double t4024 = t4023*t73;
-    const double t4025 = t4014*t20;
-    const double t4026 = t4014*t26;
-    const double t4027 = t4005*t240+t4008+t4010+t4011+t4013+t4015+t4017+t4018*t309+t4021+
+    const MBPOL_POLY_REAL t4005 = a[1013];
+    const MBPOL_POLY_REAL t4007 = a[838];
+    const MBPOL_POLY_REAL t4008 = t4007*t475;
+    const MBPOL_POLY_REAL t4009 = a[662];
+    const MBPOL_POLY_REAL t4010 = t4009*t136;
+    const MBPOL_POLY_REAL t4011 = t4009*t126;
+    const MBPOL_POLY_REAL t4012 = a[905];
+    const MBPOL_POLY_REAL t4013 = t4012*t143;
+    const MBPOL_POLY_REAL t4014 = a[685];
+    const MBPOL_POLY_REAL t4015 = t4014*t5;
+    const MBPOL_POLY_REAL t4016 = a[1108];
+    const MBPOL_POLY_REAL t4017 = t4016*t254;
+    const MBPOL_POLY_REAL t4018 = a[975];
+    const MBPOL_POLY_REAL t4020 = a[796];
+    const MBPOL_POLY_REAL t4021 = t4020*t275;
+    const MBPOL_POLY_REAL t4022 = a[315];
+    const MBPOL_POLY_REAL t4023 = a[643];
+    const MBPOL_POLY_REAL t4024 = t4023*t73;
+    const MBPOL_POLY_REAL t4025 = t4014*t20;
+    const MBPOL_POLY_REAL t4026 = t4014*t26;
+    const MBPOL_POLY_REAL t4027 = t4005*t240+t4008+t4010+t4011+t4013+t4015+t4017+t4018*t309+t4021+
 t4022+t4024+t4025+t4026;
-    const double t4028 = t4014*t37;
-    const double t4029 = a[738];
-    const double t4030 = t4029*t50;
-    const double t4031 = t4029*t67;
-    const double t4032 = t4023*t72;
-    const double t4033 = a[620];
-    const double t4034 = t4033*t132;
-    const double t4035 = t4033*t77;
-    const double t3806 = a[635];
-    const double t4037 = t3806*t179;
-    const double t4038 = a[800];
-    const double t4039 = t4038*t155;
-    const double t4040 = a[666];
-    const double t4041 = t4040*t139;
-    const double t4042 = t4038*t145;
-    const double t4043 = t4040*t146;
-    const double t4044 = a[1140];
-    const double t4045 = t4044*t212;
-    const double t4046 = a[603];
-    const double t4047 = t4046*t215;
-    const double t4048 = t4028+t4030+t4031+t4032+t4034+t4035+t4037+t4039+t4041+t4042+t4043+
+    const MBPOL_POLY_REAL t4028 = t4014*t37;
+    const MBPOL_POLY_REAL t4029 = a[738];
+    const MBPOL_POLY_REAL t4030 = t4029*t50;
+    const MBPOL_POLY_REAL t4031 = t4029*t67;
+    const MBPOL_POLY_REAL t4032 = t4023*t72;
+    const MBPOL_POLY_REAL t4033 = a[620];
+    const MBPOL_POLY_REAL t4034 = t4033*t132;
+    const MBPOL_POLY_REAL t4035 = t4033*t77;
+    const MBPOL_POLY_REAL t3806 = a[635];
+    const MBPOL_POLY_REAL t4037 = t3806*t179;
+    const MBPOL_POLY_REAL t4038 = a[800];
+    const MBPOL_POLY_REAL t4039 = t4038*t155;
+    const MBPOL_POLY_REAL t4040 = a[666];
+    const MBPOL_POLY_REAL t4041 = t4040*t139;
+    const MBPOL_POLY_REAL t4042 = t4038*t145;
+    const MBPOL_POLY_REAL t4043 = t4040*t146;
+    const MBPOL_POLY_REAL t4044 = a[1140];
+    const MBPOL_POLY_REAL t4045 = t4044*t212;
+    const MBPOL_POLY_REAL t4046 = a[603];
+    const MBPOL_POLY_REAL t4047 = t4046*t215;
+    const MBPOL_POLY_REAL t4048 = t4028+t4030+t4031+t4032+t4034+t4035+t4037+t4039+t4041+t4042+t4043+
 t4045+t4047;
-    const double t4051 = a[462];
-    const double t4052 = a[998];
-    const double t4053 = t4052*t5;
-    const double t4054 = t4052*t20;
-    const double t4055 = a[776];
-    const double t4056 = t4055*t26;
-    const double t4057 = t4055*t37;
-    const double t4058 = a[957];
-    const double t4059 = t4058*t50;
-    const double t4060 = a[1093];
-    const double t4061 = t4060*t67;
-    const double t4062 = a[987];
-    const double t4063 = t4062*t72;
-    const double t4064 = t4062*t73;
-    const double t4065 = a[809];
-    const double t4066 = t4065*t77;
-    const double t4067 = t4065*t126;
-    const double t4068 = t4065*t132;
-    const double t4069 = t4065*t136;
-    const double t4070 = a[1057];
-    const double t4072 = a[1098];
-    const double t4074 = a[978];
-    const double t4076 = t4051+t4053+t4054+t4056+t4057+t4059+t4061+t4063+t4064+t4066+t4067+
+    const MBPOL_POLY_REAL t4051 = a[462];
+    const MBPOL_POLY_REAL t4052 = a[998];
+    const MBPOL_POLY_REAL t4053 = t4052*t5;
+    const MBPOL_POLY_REAL t4054 = t4052*t20;
+    const MBPOL_POLY_REAL t4055 = a[776];
+    const MBPOL_POLY_REAL t4056 = t4055*t26;
+    const MBPOL_POLY_REAL t4057 = t4055*t37;
+    const MBPOL_POLY_REAL t4058 = a[957];
+    const MBPOL_POLY_REAL t4059 = t4058*t50;
+    const MBPOL_POLY_REAL t4060 = a[1093];
+    const MBPOL_POLY_REAL t4061 = t4060*t67;
+    const MBPOL_POLY_REAL t4062 = a[987];
+    const MBPOL_POLY_REAL t4063 = t4062*t72;
+    const MBPOL_POLY_REAL t4064 = t4062*t73;
+    const MBPOL_POLY_REAL t4065 = a[809];
+    const MBPOL_POLY_REAL t4066 = t4065*t77;
+    const MBPOL_POLY_REAL t4067 = t4065*t126;
+    const MBPOL_POLY_REAL t4068 = t4065*t132;
+    const MBPOL_POLY_REAL t4069 = t4065*t136;
+    const MBPOL_POLY_REAL t4070 = a[1057];
+    const MBPOL_POLY_REAL t4072 = a[1098];
+    const MBPOL_POLY_REAL t4074 = a[978];
+    const MBPOL_POLY_REAL t4076 = t4051+t4053+t4054+t4056+t4057+t4059+t4061+t4063+t4064+t4066+t4067+
 t4068+t4069+t4070*t139+t4072*t145+t4074*t146;
-    const double t4078 = t4055*t5;
-    const double t4079 = t4055*t20;
-    const double t4080 = t4052*t26;
-    const double t4081 = t4052*t37;
-    const double t4082 = t4060*t50;
-    const double t4083 = t4058*t67;
-    const double t4084 = a[981];
-    const double t4087 = t4051+t4078+t4079+t4080+t4081+t4082+t4083+t4063+t4064+t4066+t4067+
+    const MBPOL_POLY_REAL t4078 = t4055*t5;
+    const MBPOL_POLY_REAL t4079 = t4055*t20;
+    const MBPOL_POLY_REAL t4080 = t4052*t26;
+    const MBPOL_POLY_REAL t4081 = t4052*t37;
+    const MBPOL_POLY_REAL t4082 = t4060*t50;
+    const MBPOL_POLY_REAL t4083 = t4058*t67;
+    const MBPOL_POLY_REAL t4084 = a[981];
+    const MBPOL_POLY_REAL t4087 = t4051+t4078+t4079+t4080+t4081+t4082+t4083+t4063+t4064+t4066+t4067+
 t4068+t4069+t4084*t139+t4074*t145;
-    const double t4089 = t4009*t77;
-    const double t4090 = t4033*t126;
-    const double t4091 = t4022+t4015+t4025+t4026+t4028+t4030+t4031+t4032+t4024+t4089+t4090;
-    const double t4092 = t4009*t132;
-    const double t4093 = t4033*t136;
-    const double t4094 = t4038*t139;
-    const double t4095 = t4040*t145;
-    const double t4096 = t4038*t146;
-    const double t4097 = t4040*t155;
-    const double t4098 = t4016*t275;
-    const double t4099 = t4020*t254;
-    const double t4100 = t4046*t212;
-    const double t4101 = t4044*t215;
-    const double t4102 = t4007*t143;
-    const double t4103 = t4092+t4093+t4094+t4095+t4096+t4097+t4037+t4098+t4099+t4100+t4101+
+    const MBPOL_POLY_REAL t4089 = t4009*t77;
+    const MBPOL_POLY_REAL t4090 = t4033*t126;
+    const MBPOL_POLY_REAL t4091 = t4022+t4015+t4025+t4026+t4028+t4030+t4031+t4032+t4024+t4089+t4090;
+    const MBPOL_POLY_REAL t4092 = t4009*t132;
+    const MBPOL_POLY_REAL t4093 = t4033*t136;
+    const MBPOL_POLY_REAL t4094 = t4038*t139;
+    const MBPOL_POLY_REAL t4095 = t4040*t145;
+    const MBPOL_POLY_REAL t4096 = t4038*t146;
+    const MBPOL_POLY_REAL t4097 = t4040*t155;
+    const MBPOL_POLY_REAL t4098 = t4016*t275;
+    const MBPOL_POLY_REAL t4099 = t4020*t254;
+    const MBPOL_POLY_REAL t4100 = t4046*t212;
+    const MBPOL_POLY_REAL t4101 = t4044*t215;
+    const MBPOL_POLY_REAL t4102 = t4007*t143;
+    const MBPOL_POLY_REAL t4103 = t4092+t4093+t4094+t4095+t4096+t4097+t4037+t4098+t4099+t4100+t4101+
 t4102;
-    const double t4110 = t4051+t4053+t4054+t4056+t4057+t4059+t4061+t4063+t4064+t4066+t4067+
+    const MBPOL_POLY_REAL t4110 = t4051+t4053+t4054+t4056+t4057+t4059+t4061+t4063+t4064+t4066+t4067+
 t4068+t4069+t4072*t139+t4070*t145+t4084*t146+t4074*t155;
-    const double t4115 = t3867+t3869+t3870+t3871+t3872+t3874+t3875+t3877+t3879+t3882*t77+
+    const MBPOL_POLY_REAL t4115 = t3867+t3869+t3870+t3871+t3872+t3874+t3875+t3877+t3879+t3882*t77+
 t3880*t126+t3886*t132;
-    const double t4117 = t4010+t4011+t4015+t4017+t4021+t4022+t4024+t4025+t4026+t4028+t4030+
+    const MBPOL_POLY_REAL t4117 = t4010+t4011+t4015+t4017+t4021+t4022+t4024+t4025+t4026+t4028+t4030+
 t4031;
-    const double t4118 = t4007*t240;
-    const double t4119 = t4018*t143;
-    const double t4120 = t4012*t309;
-    const double t4121 = t4032+t4034+t4035+t4094+t4095+t4096+t4097+t4100+t4101+t4037+t4118+
+    const MBPOL_POLY_REAL t4118 = t4007*t240;
+    const MBPOL_POLY_REAL t4119 = t4018*t143;
+    const MBPOL_POLY_REAL t4120 = t4012*t309;
+    const MBPOL_POLY_REAL t4121 = t4032+t4034+t4035+t4094+t4095+t4096+t4097+t4100+t4101+t4037+t4118+
 t4119+t4120;
-    const double t4124 = t3866*t20;
-    const double t4125 = t3868*t5;
-    const double t4126 = t3868*t26;
-    const double t4127 = t3866*t37;
-    const double t4128 = t3878*t72;
-    const double t4129 = t3876*t73;
-    const double t4132 = t4124+t3870+t4125+t4126+t4127+t3874+t3875+t4128+t4129+t3884*t77+
+    const MBPOL_POLY_REAL t4124 = t3866*t20;
+    const MBPOL_POLY_REAL t4125 = t3868*t5;
+    const MBPOL_POLY_REAL t4126 = t3868*t26;
+    const MBPOL_POLY_REAL t4127 = t3866*t37;
+    const MBPOL_POLY_REAL t4128 = t3878*t72;
+    const MBPOL_POLY_REAL t4129 = t3876*t73;
+    const MBPOL_POLY_REAL t4132 = t4124+t3870+t4125+t4126+t4127+t3874+t3875+t4128+t4129+t3884*t77+
 t3886*t126;
-    const double t4137 = t4022+t4015+t4025+t4026+t4028+t4030+t4031+t4032+t4024+t4089+t4090+
+    const MBPOL_POLY_REAL t4137 = t4022+t4015+t4025+t4026+t4028+t4030+t4031+t4032+t4024+t4089+t4090+
 t4092;
-    const double t4138 = t4005*t143;
-    const double t4139 = t4007*t309;
-    const double t4140 = t4093+t4041+t4042+t4043+t4039+t4037+t4098+t4099+t4045+t4047+t4138+
+    const MBPOL_POLY_REAL t4138 = t4005*t143;
+    const MBPOL_POLY_REAL t4139 = t4007*t309;
+    const MBPOL_POLY_REAL t4140 = t4093+t4041+t4042+t4043+t4039+t4037+t4098+t4099+t4045+t4047+t4138+
 t4139;
-    const double t4144 = t4051+t4078+t4079+t4080+t4081+t4082+t4083+t4063+t4064+t4066+t4067+
+    const MBPOL_POLY_REAL t4144 = t4051+t4078+t4079+t4080+t4081+t4082+t4083+t4063+t4064+t4066+t4067+
 t4068+t4069+t4074*t139;
-    const double t3864 = t3851*t5;
-    const double t4148 = (t3850+t3864)*t5;
-    const double t3883 = t4027+t4048;
-    const double t3901 = t4091+t4103;
-    const double t3906 = t4117+t4121;
-    const double t3909 = t3886*t77;
-    const double t3913 = t4137+t4140;
-    const double t4149 = t4003*t254+t3883*t475+t4076*t146+t4087*t145+t3901*t143+t4110*t155+
+    const MBPOL_POLY_REAL t3864 = t3851*t5;
+    const MBPOL_POLY_REAL t4148 = (t3850+t3864)*t5;
+    const MBPOL_POLY_REAL t3883 = t4027+t4048;
+    const MBPOL_POLY_REAL t3901 = t4091+t4103;
+    const MBPOL_POLY_REAL t3906 = t4117+t4121;
+    const MBPOL_POLY_REAL t3909 = t3886*t77;
+    const MBPOL_POLY_REAL t3913 = t4137+t4140;
+    const MBPOL_POLY_REAL t4149 = t4003*t254+t3883*t475+t4076*t146+t4087*t145+t3901*t143+t4110*t155+
 t4115*t132+t3906*t240+t4132*t126+(t4124+t3870+t4125+t4126+t4127+t3874+t3875+
 t4128+t4129+t3909)*t77+t3913*t309+t4144*t139+t4148;
-    const double t4152 = a[411];
-    const double t4153 = t4152*t5;
-    const double t4154 = a[31];
-    const double t4155 = t4152*t20;
-    const double t4156 = t4152*t26;
-    const double t4157 = t4152*t37;
-    const double t4158 = a[534];
-    const double t4161 = a[464];
-    const double t4164 = a[238];
-    const double t4169 = a[372];
-    const double t3918 = a[485];
-    const double t4175 = t3918*t179;
-    const double t4176 = t4153+t4154+t4155+t4156+t4157+t4158*t50+t4158*t67+t4161*t72+t4161*
+    const MBPOL_POLY_REAL t4152 = a[411];
+    const MBPOL_POLY_REAL t4153 = t4152*t5;
+    const MBPOL_POLY_REAL t4154 = a[31];
+    const MBPOL_POLY_REAL t4155 = t4152*t20;
+    const MBPOL_POLY_REAL t4156 = t4152*t26;
+    const MBPOL_POLY_REAL t4157 = t4152*t37;
+    const MBPOL_POLY_REAL t4158 = a[534];
+    const MBPOL_POLY_REAL t4161 = a[464];
+    const MBPOL_POLY_REAL t4164 = a[238];
+    const MBPOL_POLY_REAL t4169 = a[372];
+    const MBPOL_POLY_REAL t3918 = a[485];
+    const MBPOL_POLY_REAL t4175 = t3918*t179;
+    const MBPOL_POLY_REAL t4176 = t4153+t4154+t4155+t4156+t4157+t4158*t50+t4158*t67+t4161*t72+t4161*
 t73+t4164*t77+t4164*t126+t4164*t132+t4164*t136+t4169*t139+t4169*t145+t4169*t146
 +t4169*t155+t4175;
-    const double t4178 = t3269*t5;
-    const double t4179 = t3269*t20;
-    const double t4180 = t3265*t26;
-    const double t4181 = t3265*t37;
-    const double t4182 = t3274*t50;
-    const double t4183 = t3272*t67;
-    const double t4184 = a[397];
-    const double t4186 = a[419];
-    const double t4189 = t4178+t3267+t4179+t4180+t4181+t4182+t4183+t3277+t3278+t3280+t3281+
+    const MBPOL_POLY_REAL t4178 = t3269*t5;
+    const MBPOL_POLY_REAL t4179 = t3269*t20;
+    const MBPOL_POLY_REAL t4180 = t3265*t26;
+    const MBPOL_POLY_REAL t4181 = t3265*t37;
+    const MBPOL_POLY_REAL t4182 = t3274*t50;
+    const MBPOL_POLY_REAL t4183 = t3272*t67;
+    const MBPOL_POLY_REAL t4184 = a[397];
+    const MBPOL_POLY_REAL t4186 = a[419];
+    const MBPOL_POLY_REAL t4189 = t4178+t3267+t4179+t4180+t4181+t4182+t4183+t3277+t3278+t3280+t3281+
 t3282+t3283+t4184*t139+t4186*t145+t3286*t146;
-    const double t3968 = t3160*t50;
-    const double t3976 = t3162*t67;
-    const double t3982 = t3217+t3238;
-    const double t3987 = t3561+t3715;
-    const double t3989 = t3728*t72;
-    const double t3990 = t3730*t73;
-    const double t3996 = t3749+t3767;
-    const double t3998 = t3730*t72;
-    const double t4002 = t3162*t50;
-    const double t4019 = t3786+t3798;
-    const double t4049 = t3803+t3805;
-    const double t4135 = x[1];
-    const double t4073 = (t3995+t4149)*t4135;
-    const double t4191 = (t3153+t3155+t3156+t3158+t3159+t3968+t3976)*t67+t3193*t275+t3982*
+    const MBPOL_POLY_REAL t3968 = t3160*t50;
+    const MBPOL_POLY_REAL t3976 = t3162*t67;
+    const MBPOL_POLY_REAL t3982 = t3217+t3238;
+    const MBPOL_POLY_REAL t3987 = t3561+t3715;
+    const MBPOL_POLY_REAL t3989 = t3728*t72;
+    const MBPOL_POLY_REAL t3990 = t3730*t73;
+    const MBPOL_POLY_REAL t3996 = t3749+t3767;
+    const MBPOL_POLY_REAL t3998 = t3730*t72;
+    const MBPOL_POLY_REAL t4002 = t3162*t50;
+    const MBPOL_POLY_REAL t4019 = t3786+t3798;
+    const MBPOL_POLY_REAL t4049 = t3803+t3805;
+    const MBPOL_POLY_REAL t4135 = x[1];
+    const MBPOL_POLY_REAL t4073 = (t3995+t4149)*t4135;
+    const MBPOL_POLY_REAL t4191 = (t3153+t3155+t3156+t3158+t3159+t3968+t3976)*t67+t3193*t275+t3982*
 t475+t3263*t136+t3288*t145+t3987*t2404+(t3719+t3720+t3722+t3723+t3724+t3726+
 t3727+t3989+t3990)*t73+t3996*t215+(t3770+t3771+t3720+t3772+t3773+t3726+t3727+
 t3998)*t72+(t3153+t3777+t3778+t3779+t3780+t4002)*t50+t4019*t143+t4049*t240+
 t4073+t4176*t179+t4189*t146;
-    const double t4192 = a[40];
-    const double t4193 = a[360];
-    const double t4085 = t4193*t5;
-    const double t4196 = (t4192+t4085)*t5;
-    const double t4197 = a[696];
-    const double t4198 = t4197*t67;
-    const double t4199 = a[775];
-    const double t4200 = t4199*t37;
-    const double t4201 = a[950];
-    const double t4202 = t4201*t77;
-    const double t4203 = a[242];
-    const double t4204 = a[1041];
-    const double t4205 = t4204*t240;
-    const double t4206 = t4197*t50;
-    const double t4207 = a[622];
-    const double t4208 = t4207*t254;
-    const double t4088 = a[691];
-    const double t4210 = t4088*t179;
-    const double t4211 = a[870];
-    const double t4212 = t4211*t212;
-    const double t4213 = a[598];
-    const double t4214 = t4213*t146;
-    const double t4215 = a[664];
-    const double t4216 = t4215*t475;
-    const double t4217 = a[1001];
-    const double t4218 = t4217*t72;
-    const double t4219 = a[810];
-    const double t4220 = t4219*t126;
-    const double t4221 = t4198+t4200+t4202+t4203+t4205+t4206+t4208+t4210+t4212+t4214+t4216+
+    const MBPOL_POLY_REAL t4192 = a[40];
+    const MBPOL_POLY_REAL t4193 = a[360];
+    const MBPOL_POLY_REAL t4085 = t4193*t5;
+    const MBPOL_POLY_REAL t4196 = (t4192+t4085)*t5;
+    const MBPOL_POLY_REAL t4197 = a[696];
+    const MBPOL_POLY_REAL t4198 = t4197*t67;
+    const MBPOL_POLY_REAL t4199 = a[775];
+    const MBPOL_POLY_REAL t4200 = t4199*t37;
+    const MBPOL_POLY_REAL t4201 = a[950];
+    const MBPOL_POLY_REAL t4202 = t4201*t77;
+    const MBPOL_POLY_REAL t4203 = a[242];
+    const MBPOL_POLY_REAL t4204 = a[1041];
+    const MBPOL_POLY_REAL t4205 = t4204*t240;
+    const MBPOL_POLY_REAL t4206 = t4197*t50;
+    const MBPOL_POLY_REAL t4207 = a[622];
+    const MBPOL_POLY_REAL t4208 = t4207*t254;
+    const MBPOL_POLY_REAL t4088 = a[691];
+    const MBPOL_POLY_REAL t4210 = t4088*t179;
+    const MBPOL_POLY_REAL t4211 = a[870];
+    const MBPOL_POLY_REAL t4212 = t4211*t212;
+    const MBPOL_POLY_REAL t4213 = a[598];
+    const MBPOL_POLY_REAL t4214 = t4213*t146;
+    const MBPOL_POLY_REAL t4215 = a[664];
+    const MBPOL_POLY_REAL t4216 = t4215*t475;
+    const MBPOL_POLY_REAL t4217 = a[1001];
+    const MBPOL_POLY_REAL t4218 = t4217*t72;
+    const MBPOL_POLY_REAL t4219 = a[810];
+    const MBPOL_POLY_REAL t4220 = t4219*t126;
+    const MBPOL_POLY_REAL t4221 = t4198+t4200+t4202+t4203+t4205+t4206+t4208+t4210+t4212+t4214+t4216+
 t4218+t4220;
-    const double t4222 = a[588];
-    const double t4223 = t4222*t143;
-    const double t4224 = a[1005];
-    const double t4225 = t4224*t155;
-    const double t4226 = a[1047];
-    const double t4228 = t4199*t20;
-    const double t4229 = a[1007];
-    const double t4230 = t4229*t275;
-    const double t4231 = t4213*t139;
-    const double t4232 = t4199*t26;
-    const double t4233 = t4199*t5;
-    const double t4234 = t4219*t136;
-    const double t4235 = t4217*t73;
-    const double t4236 = a[1025];
-    const double t4237 = t4236*t215;
-    const double t4238 = t4201*t132;
-    const double t4239 = t4224*t145;
-    const double t4240 = t4223+t4225+t4226*t309+t4228+t4230+t4231+t4232+t4233+t4234+t4235+
+    const MBPOL_POLY_REAL t4222 = a[588];
+    const MBPOL_POLY_REAL t4223 = t4222*t143;
+    const MBPOL_POLY_REAL t4224 = a[1005];
+    const MBPOL_POLY_REAL t4225 = t4224*t155;
+    const MBPOL_POLY_REAL t4226 = a[1047];
+    const MBPOL_POLY_REAL t4228 = t4199*t20;
+    const MBPOL_POLY_REAL t4229 = a[1007];
+    const MBPOL_POLY_REAL t4230 = t4229*t275;
+    const MBPOL_POLY_REAL t4231 = t4213*t139;
+    const MBPOL_POLY_REAL t4232 = t4199*t26;
+    const MBPOL_POLY_REAL t4233 = t4199*t5;
+    const MBPOL_POLY_REAL t4234 = t4219*t136;
+    const MBPOL_POLY_REAL t4235 = t4217*t73;
+    const MBPOL_POLY_REAL t4236 = a[1025];
+    const MBPOL_POLY_REAL t4237 = t4236*t215;
+    const MBPOL_POLY_REAL t4238 = t4201*t132;
+    const MBPOL_POLY_REAL t4239 = t4224*t145;
+    const MBPOL_POLY_REAL t4240 = t4223+t4225+t4226*t309+t4228+t4230+t4231+t4232+t4233+t4234+t4235+
 t4237+t4238+t4239;
-    const double t4243 = a[611];
-    const double t4244 = t4243*t5;
-    const double t4245 = a[434];
-    const double t4246 = a[840];
-    const double t4247 = t4246*t20;
-    const double t4248 = t4243*t26;
-    const double t4249 = t4246*t37;
-    const double t4250 = a[631];
-    const double t4251 = t4250*t50;
-    const double t4252 = t4250*t67;
-    const double t4253 = a[833];
-    const double t4254 = t4253*t72;
-    const double t4255 = a[575];
-    const double t4256 = t4255*t73;
-    const double t4257 = a[977];
-    const double t4259 = a[1015];
-    const double t4261 = a[1118];
-    const double t4263 = a[855];
-    const double t4265 = t4244+t4245+t4247+t4248+t4249+t4251+t4252+t4254+t4256+t4257*t77+
+    const MBPOL_POLY_REAL t4243 = a[611];
+    const MBPOL_POLY_REAL t4244 = t4243*t5;
+    const MBPOL_POLY_REAL t4245 = a[434];
+    const MBPOL_POLY_REAL t4246 = a[840];
+    const MBPOL_POLY_REAL t4247 = t4246*t20;
+    const MBPOL_POLY_REAL t4248 = t4243*t26;
+    const MBPOL_POLY_REAL t4249 = t4246*t37;
+    const MBPOL_POLY_REAL t4250 = a[631];
+    const MBPOL_POLY_REAL t4251 = t4250*t50;
+    const MBPOL_POLY_REAL t4252 = t4250*t67;
+    const MBPOL_POLY_REAL t4253 = a[833];
+    const MBPOL_POLY_REAL t4254 = t4253*t72;
+    const MBPOL_POLY_REAL t4255 = a[575];
+    const MBPOL_POLY_REAL t4256 = t4255*t73;
+    const MBPOL_POLY_REAL t4257 = a[977];
+    const MBPOL_POLY_REAL t4259 = a[1015];
+    const MBPOL_POLY_REAL t4261 = a[1118];
+    const MBPOL_POLY_REAL t4263 = a[855];
+    const MBPOL_POLY_REAL t4265 = t4244+t4245+t4247+t4248+t4249+t4251+t4252+t4254+t4256+t4257*t77+
 t4259*t126+t4261*t132+t4263*t136;
-    const double t4266 = t4265*t136;
-    const double t4267 = a[289];
-    const double t4268 = a[663];
-    const double t4109 = t4268*t5;
-    const double t4271 = (t4267+t4109)*t5;
-    const double t4272 = a[81];
-    const double t4273 = a[742];
-    const double t4274 = t4273*t5;
-    const double t4275 = t4273*t20;
-    const double t4276 = a[586];
-    const double t4277 = t4276*t26;
-    const double t4278 = t4276*t37;
-    const double t4279 = a[1063];
-    const double t4112 = t4279*t50;
-    const double t4282 = (t4272+t4274+t4275+t4277+t4278+t4112)*t50;
-    const double t4283 = a[712];
-    const double t4285 = a[900];
-    const double t4287 = a[745];
-    const double t4288 = t4287*t5;
-    const double t4289 = t4268*t37;
-    const double t4122 = t4283*t26+t4267+t4285*t20+t4288+t4289;
-    const double t4291 = t4122*t37;
-    const double t4292 = a[161];
-    const double t4293 = a[614];
-    const double t4294 = t4293*t5;
-    const double t4295 = t4293*t20;
-    const double t4296 = t4293*t26;
-    const double t4297 = t4293*t37;
-    const double t4298 = a[649];
-    const double t4299 = t4298*t50;
-    const double t4300 = t4298*t67;
-    const double t4301 = a[805];
-    const double t4302 = t4301*t72;
-    const double t4303 = t4301*t73;
-    const double t4304 = a[915];
-    const double t4305 = t4304*t77;
-    const double t4306 = a[714];
-    const double t4307 = t4306*t126;
-    const double t4308 = t4292+t4294+t4295+t4296+t4297+t4299+t4300+t4302+t4303+t4305+t4307;
-    const double t4309 = t4304*t132;
-    const double t4310 = t4306*t136;
-    const double t4311 = a[772];
-    const double t4312 = t4311*t139;
-    const double t4313 = a[904];
-    const double t4314 = t4313*t145;
-    const double t4315 = t4311*t146;
-    const double t4316 = t4313*t155;
-    const double t4123 = a[890];
-    const double t4318 = t4123*t179;
-    const double t4319 = a[1117];
-    const double t4320 = t4319*t275;
-    const double t4321 = a[803];
-    const double t4322 = t4321*t254;
-    const double t4323 = a[958];
-    const double t4324 = t4323*t212;
-    const double t4325 = a[968];
-    const double t4326 = t4325*t215;
-    const double t4327 = a[565];
-    const double t4328 = t4327*t143;
-    const double t4329 = t4309+t4310+t4312+t4314+t4315+t4316+t4318+t4320+t4322+t4324+t4326+
+    const MBPOL_POLY_REAL t4266 = t4265*t136;
+    const MBPOL_POLY_REAL t4267 = a[289];
+    const MBPOL_POLY_REAL t4268 = a[663];
+    const MBPOL_POLY_REAL t4109 = t4268*t5;
+    const MBPOL_POLY_REAL t4271 = (t4267+t4109)*t5;
+    const MBPOL_POLY_REAL t4272 = a[81];
+    const MBPOL_POLY_REAL t4273 = a[742];
+    const MBPOL_POLY_REAL t4274 = t4273*t5;
+    const MBPOL_POLY_REAL t4275 = t4273*t20;
+    const MBPOL_POLY_REAL t4276 = a[586];
+    const MBPOL_POLY_REAL t4277 = t4276*t26;
+    const MBPOL_POLY_REAL t4278 = t4276*t37;
+    const MBPOL_POLY_REAL t4279 = a[1063];
+    const MBPOL_POLY_REAL t4112 = t4279*t50;
+    const MBPOL_POLY_REAL t4282 = (t4272+t4274+t4275+t4277+t4278+t4112)*t50;
+    const MBPOL_POLY_REAL t4283 = a[712];
+    const MBPOL_POLY_REAL t4285 = a[900];
+    const MBPOL_POLY_REAL t4287 = a[745];
+    const MBPOL_POLY_REAL t4288 = t4287*t5;
+    const MBPOL_POLY_REAL t4289 = t4268*t37;
+    const MBPOL_POLY_REAL t4122 = t4283*t26+t4267+t4285*t20+t4288+t4289;
+    const MBPOL_POLY_REAL t4291 = t4122*t37;
+    const MBPOL_POLY_REAL t4292 = a[161];
+    const MBPOL_POLY_REAL t4293 = a[614];
+    const MBPOL_POLY_REAL t4294 = t4293*t5;
+    const MBPOL_POLY_REAL t4295 = t4293*t20;
+    const MBPOL_POLY_REAL t4296 = t4293*t26;
+    const MBPOL_POLY_REAL t4297 = t4293*t37;
+    const MBPOL_POLY_REAL t4298 = a[649];
+    const MBPOL_POLY_REAL t4299 = t4298*t50;
+    const MBPOL_POLY_REAL t4300 = t4298*t67;
+    const MBPOL_POLY_REAL t4301 = a[805];
+    const MBPOL_POLY_REAL t4302 = t4301*t72;
+    const MBPOL_POLY_REAL t4303 = t4301*t73;
+    const MBPOL_POLY_REAL t4304 = a[915];
+    const MBPOL_POLY_REAL t4305 = t4304*t77;
+    const MBPOL_POLY_REAL t4306 = a[714];
+    const MBPOL_POLY_REAL t4307 = t4306*t126;
+    const MBPOL_POLY_REAL t4308 = t4292+t4294+t4295+t4296+t4297+t4299+t4300+t4302+t4303+t4305+t4307;
+    const MBPOL_POLY_REAL t4309 = t4304*t132;
+    const MBPOL_POLY_REAL t4310 = t4306*t136;
+    const MBPOL_POLY_REAL t4311 = a[772];
+    const MBPOL_POLY_REAL t4312 = t4311*t139;
+    const MBPOL_POLY_REAL t4313 = a[904];
+    const MBPOL_POLY_REAL t4314 = t4313*t145;
+    const MBPOL_POLY_REAL t4315 = t4311*t146;
+    const MBPOL_POLY_REAL t4316 = t4313*t155;
+    const MBPOL_POLY_REAL t4123 = a[890];
+    const MBPOL_POLY_REAL t4318 = t4123*t179;
+    const MBPOL_POLY_REAL t4319 = a[1117];
+    const MBPOL_POLY_REAL t4320 = t4319*t275;
+    const MBPOL_POLY_REAL t4321 = a[803];
+    const MBPOL_POLY_REAL t4322 = t4321*t254;
+    const MBPOL_POLY_REAL t4323 = a[958];
+    const MBPOL_POLY_REAL t4324 = t4323*t212;
+    const MBPOL_POLY_REAL t4325 = a[968];
+    const MBPOL_POLY_REAL t4326 = t4325*t215;
+    const MBPOL_POLY_REAL t4327 = a[565];
+    const MBPOL_POLY_REAL t4328 = t4327*t143;
+    const MBPOL_POLY_REAL t4329 = t4309+t4310+t4312+t4314+t4315+t4316+t4318+t4320+t4322+t4324+t4326+
 t4328;
-    const double t4332 = t4276*t5;
-    const double t4333 = t4276*t20;
-    const double t4334 = t4273*t26;
-    const double t4335 = t4273*t37;
-    const double t4336 = a[1082];
-    const double t4130 = t4336*t50;
-    const double t4131 = t4279*t67;
-    const double t4340 = (t4332+t4272+t4333+t4334+t4335+t4130+t4131)*t67;
-    const double t4341 = a[941];
-    const double t4342 = t4341*t5;
-    const double t4343 = a[218];
-    const double t4344 = t4341*t20;
-    const double t4345 = t4341*t26;
-    const double t4346 = t4341*t37;
-    const double t4347 = a[877];
-    const double t4348 = t4347*t50;
-    const double t4349 = t4347*t67;
-    const double t4350 = a[713];
-    const double t4351 = t4350*t72;
-    const double t4352 = t4350*t73;
-    const double t4353 = a[1051];
-    const double t4354 = t4353*t77;
-    const double t4356 = t4353*t126;
-    const double t4357 = t4353*t132;
-    const double t4358 = t4353*t136;
-    const double t4359 = a[827];
-    const double t4361 = a[762];
-    const double t4134 = a[667];
-    const double t4366 = t4134*t179;
-    const double t4367 = a[972];
-    const double t4368 = t4367*t275;
-    const double t4369 = t4367*t254;
-    const double t4370 = a[741];
-    const double t4372 = t4356+t4357+t4358+t4359*t139+t4361*t145+t4359*t146+t4361*t155+t4366
+    const MBPOL_POLY_REAL t4332 = t4276*t5;
+    const MBPOL_POLY_REAL t4333 = t4276*t20;
+    const MBPOL_POLY_REAL t4334 = t4273*t26;
+    const MBPOL_POLY_REAL t4335 = t4273*t37;
+    const MBPOL_POLY_REAL t4336 = a[1082];
+    const MBPOL_POLY_REAL t4130 = t4336*t50;
+    const MBPOL_POLY_REAL t4131 = t4279*t67;
+    const MBPOL_POLY_REAL t4340 = (t4332+t4272+t4333+t4334+t4335+t4130+t4131)*t67;
+    const MBPOL_POLY_REAL t4341 = a[941];
+    const MBPOL_POLY_REAL t4342 = t4341*t5;
+    const MBPOL_POLY_REAL t4343 = a[218];
+    const MBPOL_POLY_REAL t4344 = t4341*t20;
+    const MBPOL_POLY_REAL t4345 = t4341*t26;
+    const MBPOL_POLY_REAL t4346 = t4341*t37;
+    const MBPOL_POLY_REAL t4347 = a[877];
+    const MBPOL_POLY_REAL t4348 = t4347*t50;
+    const MBPOL_POLY_REAL t4349 = t4347*t67;
+    const MBPOL_POLY_REAL t4350 = a[713];
+    const MBPOL_POLY_REAL t4351 = t4350*t72;
+    const MBPOL_POLY_REAL t4352 = t4350*t73;
+    const MBPOL_POLY_REAL t4353 = a[1051];
+    const MBPOL_POLY_REAL t4354 = t4353*t77;
+    const MBPOL_POLY_REAL t4356 = t4353*t126;
+    const MBPOL_POLY_REAL t4357 = t4353*t132;
+    const MBPOL_POLY_REAL t4358 = t4353*t136;
+    const MBPOL_POLY_REAL t4359 = a[827];
+    const MBPOL_POLY_REAL t4361 = a[762];
+    const MBPOL_POLY_REAL t4134 = a[667];
+    const MBPOL_POLY_REAL t4366 = t4134*t179;
+    const MBPOL_POLY_REAL t4367 = a[972];
+    const MBPOL_POLY_REAL t4368 = t4367*t275;
+    const MBPOL_POLY_REAL t4369 = t4367*t254;
+    const MBPOL_POLY_REAL t4370 = a[741];
+    const MBPOL_POLY_REAL t4372 = t4356+t4357+t4358+t4359*t139+t4361*t145+t4359*t146+t4361*t155+t4366
 +t4368+t4369+t4370*t212;
-    const double t4375 = a[515];
-    const double t4376 = a[832];
-    const double t4377 = t4376*t5;
-    const double t4378 = t4376*t20;
-    const double t4379 = t4376*t26;
-    const double t4380 = t4376*t37;
-    const double t4381 = a[1074];
-    const double t4382 = t4381*t50;
-    const double t4383 = t4381*t67;
-    const double t4384 = a[1116];
-    const double t4385 = t4384*t72;
-    const double t4386 = t4384*t73;
-    const double t4387 = a[755];
-    const double t4388 = t4387*t77;
-    const double t4389 = t4387*t126;
-    const double t4390 = t4375+t4377+t4378+t4379+t4380+t4382+t4383+t4385+t4386+t4388+t4389;
-    const double t4391 = t4387*t132;
-    const double t4392 = t4387*t136;
-    const double t4393 = a[935];
-    const double t4395 = a[859];
-    const double t4145 = a[898];
-    const double t4400 = t4145*t179;
-    const double t4401 = a[1110];
-    const double t4402 = t4401*t275;
-    const double t4403 = t4401*t254;
-    const double t4404 = a[1073];
-    const double t4405 = t4404*t212;
-    const double t4406 = a[697];
-    const double t4408 = t4391+t4392+t4393*t139+t4395*t145+t4393*t146+t4395*t155+t4400+t4402
+    const MBPOL_POLY_REAL t4375 = a[515];
+    const MBPOL_POLY_REAL t4376 = a[832];
+    const MBPOL_POLY_REAL t4377 = t4376*t5;
+    const MBPOL_POLY_REAL t4378 = t4376*t20;
+    const MBPOL_POLY_REAL t4379 = t4376*t26;
+    const MBPOL_POLY_REAL t4380 = t4376*t37;
+    const MBPOL_POLY_REAL t4381 = a[1074];
+    const MBPOL_POLY_REAL t4382 = t4381*t50;
+    const MBPOL_POLY_REAL t4383 = t4381*t67;
+    const MBPOL_POLY_REAL t4384 = a[1116];
+    const MBPOL_POLY_REAL t4385 = t4384*t72;
+    const MBPOL_POLY_REAL t4386 = t4384*t73;
+    const MBPOL_POLY_REAL t4387 = a[755];
+    const MBPOL_POLY_REAL t4388 = t4387*t77;
+    const MBPOL_POLY_REAL t4389 = t4387*t126;
+    const MBPOL_POLY_REAL t4390 = t4375+t4377+t4378+t4379+t4380+t4382+t4383+t4385+t4386+t4388+t4389;
+    const MBPOL_POLY_REAL t4391 = t4387*t132;
+    const MBPOL_POLY_REAL t4392 = t4387*t136;
+    const MBPOL_POLY_REAL t4393 = a[935];
+    const MBPOL_POLY_REAL t4395 = a[859];
+    const MBPOL_POLY_REAL t4145 = a[898];
+    const MBPOL_POLY_REAL t4400 = t4145*t179;
+    const MBPOL_POLY_REAL t4401 = a[1110];
+    const MBPOL_POLY_REAL t4402 = t4401*t275;
+    const MBPOL_POLY_REAL t4403 = t4401*t254;
+    const MBPOL_POLY_REAL t4404 = a[1073];
+    const MBPOL_POLY_REAL t4405 = t4404*t212;
+    const MBPOL_POLY_REAL t4406 = a[697];
+    const MBPOL_POLY_REAL t4408 = t4391+t4392+t4393*t139+t4395*t145+t4393*t146+t4395*t155+t4400+t4402
 +t4403+t4405+t4406*t215;
-    const double t4411 = t4287*t20;
-    const double t4412 = t4285*t5;
-    const double t4413 = t4268*t26;
-    const double t4160 = t4267+t4411+t4412+t4413;
-    const double t4415 = t4160*t26;
-    const double t4416 = a[277];
-    const double t4417 = a[869];
-    const double t4418 = t4417*t20;
-    const double t4419 = a[959];
-    const double t4420 = t4419*t5;
-    const double t4421 = t4419*t26;
-    const double t4422 = t4417*t37;
-    const double t4423 = a[684];
-    const double t4424 = t4423*t50;
-    const double t4425 = t4423*t67;
-    const double t4426 = a[882];
-    const double t4162 = t4426*t72;
-    const double t4429 = (t4416+t4418+t4420+t4421+t4422+t4424+t4425+t4162)*t72;
-    const double t4433 = t4244+t4245+t4247+t4248+t4249+t4251+t4252+t4254+t4256+t4259*t77+
+    const MBPOL_POLY_REAL t4411 = t4287*t20;
+    const MBPOL_POLY_REAL t4412 = t4285*t5;
+    const MBPOL_POLY_REAL t4413 = t4268*t26;
+    const MBPOL_POLY_REAL t4160 = t4267+t4411+t4412+t4413;
+    const MBPOL_POLY_REAL t4415 = t4160*t26;
+    const MBPOL_POLY_REAL t4416 = a[277];
+    const MBPOL_POLY_REAL t4417 = a[869];
+    const MBPOL_POLY_REAL t4418 = t4417*t20;
+    const MBPOL_POLY_REAL t4419 = a[959];
+    const MBPOL_POLY_REAL t4420 = t4419*t5;
+    const MBPOL_POLY_REAL t4421 = t4419*t26;
+    const MBPOL_POLY_REAL t4422 = t4417*t37;
+    const MBPOL_POLY_REAL t4423 = a[684];
+    const MBPOL_POLY_REAL t4424 = t4423*t50;
+    const MBPOL_POLY_REAL t4425 = t4423*t67;
+    const MBPOL_POLY_REAL t4426 = a[882];
+    const MBPOL_POLY_REAL t4162 = t4426*t72;
+    const MBPOL_POLY_REAL t4429 = (t4416+t4418+t4420+t4421+t4422+t4424+t4425+t4162)*t72;
+    const MBPOL_POLY_REAL t4433 = t4244+t4245+t4247+t4248+t4249+t4251+t4252+t4254+t4256+t4259*t77+
 t4257*t126+t4263*t132;
-    const double t4434 = t4433*t132;
-    const double t4168 = t4221+t4240;
-    const double t4171 = t4308+t4329;
-    const double t4173 = t4342+t4343+t4344+t4345+t4346+t4348+t4349+t4351+t4352+t4354+t4372;
-    const double t4177 = t4390+t4408;
-    const double t4435 = t4168*t475+t4266+t4271+t4282+t4291+t4171*t143+t4340+t4173*t212+
+    const MBPOL_POLY_REAL t4434 = t4433*t132;
+    const MBPOL_POLY_REAL t4168 = t4221+t4240;
+    const MBPOL_POLY_REAL t4171 = t4308+t4329;
+    const MBPOL_POLY_REAL t4173 = t4342+t4343+t4344+t4345+t4346+t4348+t4349+t4351+t4352+t4354+t4372;
+    const MBPOL_POLY_REAL t4177 = t4390+t4408;
+    const MBPOL_POLY_REAL t4435 = t4168*t475+t4266+t4271+t4282+t4291+t4171*t143+t4340+t4173*t212+
 t4177*t215+t4415+t4429+t4434;
-    const double t4436 = t4246*t5;
-    const double t4437 = t4243*t20;
-    const double t4438 = t4246*t26;
-    const double t4439 = t4243*t37;
-    const double t4440 = t4255*t72;
-    const double t4441 = t4253*t73;
-    const double t4187 = t4263*t77;
-    const double t4444 = (t4436+t4437+t4245+t4438+t4439+t4251+t4252+t4440+t4441+t4187)*t77;
-    const double t4445 = t4219*t77;
-    const double t4446 = t4201*t126;
-    const double t4447 = t4219*t132;
-    const double t4448 = t4233+t4203+t4228+t4232+t4200+t4206+t4198+t4218+t4235+t4445+t4446+
+    const MBPOL_POLY_REAL t4436 = t4246*t5;
+    const MBPOL_POLY_REAL t4437 = t4243*t20;
+    const MBPOL_POLY_REAL t4438 = t4246*t26;
+    const MBPOL_POLY_REAL t4439 = t4243*t37;
+    const MBPOL_POLY_REAL t4440 = t4255*t72;
+    const MBPOL_POLY_REAL t4441 = t4253*t73;
+    const MBPOL_POLY_REAL t4187 = t4263*t77;
+    const MBPOL_POLY_REAL t4444 = (t4436+t4437+t4245+t4438+t4439+t4251+t4252+t4440+t4441+t4187)*t77;
+    const MBPOL_POLY_REAL t4445 = t4219*t77;
+    const MBPOL_POLY_REAL t4446 = t4201*t126;
+    const MBPOL_POLY_REAL t4447 = t4219*t132;
+    const MBPOL_POLY_REAL t4448 = t4233+t4203+t4228+t4232+t4200+t4206+t4198+t4218+t4235+t4445+t4446+
 t4447;
-    const double t4449 = t4201*t136;
-    const double t4450 = t4207*t275;
-    const double t4451 = t4229*t254;
-    const double t4452 = t4204*t143;
-    const double t4453 = t4215*t309;
-    const double t4454 = t4449+t4231+t4239+t4214+t4225+t4210+t4450+t4451+t4212+t4237+t4452+
+    const MBPOL_POLY_REAL t4449 = t4201*t136;
+    const MBPOL_POLY_REAL t4450 = t4207*t275;
+    const MBPOL_POLY_REAL t4451 = t4229*t254;
+    const MBPOL_POLY_REAL t4452 = t4204*t143;
+    const MBPOL_POLY_REAL t4453 = t4215*t309;
+    const MBPOL_POLY_REAL t4454 = t4449+t4231+t4239+t4214+t4225+t4210+t4450+t4451+t4212+t4237+t4452+
 t4453;
-    const double t4459 = t4436+t4437+t4245+t4438+t4439+t4251+t4252+t4440+t4441+t4261*t77+
+    const MBPOL_POLY_REAL t4459 = t4436+t4437+t4245+t4438+t4439+t4251+t4252+t4440+t4441+t4261*t77+
 t4263*t126;
-    const double t4460 = t4459*t126;
-    const double t4461 = t4306*t77;
-    const double t4462 = t4304*t126;
-    const double t4463 = t4321*t275;
-    const double t4464 = t4461+t4312+t4292+t4302+t4318+t4462+t4463+t4296+t4299+t4295+t4294+
+    const MBPOL_POLY_REAL t4460 = t4459*t126;
+    const MBPOL_POLY_REAL t4461 = t4306*t77;
+    const MBPOL_POLY_REAL t4462 = t4304*t126;
+    const MBPOL_POLY_REAL t4463 = t4321*t275;
+    const MBPOL_POLY_REAL t4464 = t4461+t4312+t4292+t4302+t4318+t4462+t4463+t4296+t4299+t4295+t4294+
 t4297;
-    const double t4465 = t4306*t132;
-    const double t4466 = t4304*t136;
-    const double t4467 = t4327*t240;
-    const double t4468 = t4319*t254;
-    const double t4469 = t4222*t309;
-    const double t4470 = a[1068];
-    const double t4471 = t4470*t143;
-    const double t4472 = t4300+t4465+t4303+t4314+t4466+t4467+t4316+t4468+t4469+t4324+t4326+
+    const MBPOL_POLY_REAL t4465 = t4306*t132;
+    const MBPOL_POLY_REAL t4466 = t4304*t136;
+    const MBPOL_POLY_REAL t4467 = t4327*t240;
+    const MBPOL_POLY_REAL t4468 = t4319*t254;
+    const MBPOL_POLY_REAL t4469 = t4222*t309;
+    const MBPOL_POLY_REAL t4470 = a[1068];
+    const MBPOL_POLY_REAL t4471 = t4470*t143;
+    const MBPOL_POLY_REAL t4472 = t4300+t4465+t4303+t4314+t4466+t4467+t4316+t4468+t4469+t4324+t4326+
 t4471+t4315;
-    const double t4475 = a[589];
-    const double t4476 = t4475*t5;
-    const double t4477 = a[128];
-    const double t4478 = t4475*t20;
-    const double t4479 = a[821];
-    const double t4480 = t4479*t26;
-    const double t4481 = t4479*t37;
-    const double t4482 = a[623];
-    const double t4483 = t4482*t50;
-    const double t4484 = a[996];
-    const double t4485 = t4484*t67;
-    const double t4486 = a[604];
-    const double t4487 = t4486*t72;
-    const double t4488 = t4486*t73;
-    const double t4489 = a[883];
-    const double t4490 = t4489*t77;
-    const double t4491 = t4489*t126;
-    const double t4492 = t4489*t132;
-    const double t4493 = t4489*t136;
-    const double t4494 = a[1024];
-    const double t4495 = t4494*t139;
-    const double t4496 = a[722];
-    const double t4498 = t4476+t4477+t4478+t4480+t4481+t4483+t4485+t4487+t4488+t4490+t4491+
+    const MBPOL_POLY_REAL t4475 = a[589];
+    const MBPOL_POLY_REAL t4476 = t4475*t5;
+    const MBPOL_POLY_REAL t4477 = a[128];
+    const MBPOL_POLY_REAL t4478 = t4475*t20;
+    const MBPOL_POLY_REAL t4479 = a[821];
+    const MBPOL_POLY_REAL t4480 = t4479*t26;
+    const MBPOL_POLY_REAL t4481 = t4479*t37;
+    const MBPOL_POLY_REAL t4482 = a[623];
+    const MBPOL_POLY_REAL t4483 = t4482*t50;
+    const MBPOL_POLY_REAL t4484 = a[996];
+    const MBPOL_POLY_REAL t4485 = t4484*t67;
+    const MBPOL_POLY_REAL t4486 = a[604];
+    const MBPOL_POLY_REAL t4487 = t4486*t72;
+    const MBPOL_POLY_REAL t4488 = t4486*t73;
+    const MBPOL_POLY_REAL t4489 = a[883];
+    const MBPOL_POLY_REAL t4490 = t4489*t77;
+    const MBPOL_POLY_REAL t4491 = t4489*t126;
+    const MBPOL_POLY_REAL t4492 = t4489*t132;
+    const MBPOL_POLY_REAL t4493 = t4489*t136;
+    const MBPOL_POLY_REAL t4494 = a[1024];
+    const MBPOL_POLY_REAL t4495 = t4494*t139;
+    const MBPOL_POLY_REAL t4496 = a[722];
+    const MBPOL_POLY_REAL t4498 = t4476+t4477+t4478+t4480+t4481+t4483+t4485+t4487+t4488+t4490+t4491+
 t4492+t4493+t4495+t4496*t145;
-    const double t4500 = t4479*t5;
-    const double t4501 = t4479*t20;
-    const double t4502 = t4475*t26;
-    const double t4503 = t4475*t37;
-    const double t4504 = t4484*t50;
-    const double t4505 = t4482*t67;
-    const double t4506 = a[949];
-    const double t4507 = t4506*t139;
-    const double t4508 = a[644];
-    const double t4510 = t4494*t146;
-    const double t4512 = t4477+t4500+t4501+t4502+t4503+t4504+t4505+t4487+t4488+t4490+t4491+
+    const MBPOL_POLY_REAL t4500 = t4479*t5;
+    const MBPOL_POLY_REAL t4501 = t4479*t20;
+    const MBPOL_POLY_REAL t4502 = t4475*t26;
+    const MBPOL_POLY_REAL t4503 = t4475*t37;
+    const MBPOL_POLY_REAL t4504 = t4484*t50;
+    const MBPOL_POLY_REAL t4505 = t4482*t67;
+    const MBPOL_POLY_REAL t4506 = a[949];
+    const MBPOL_POLY_REAL t4507 = t4506*t139;
+    const MBPOL_POLY_REAL t4508 = a[644];
+    const MBPOL_POLY_REAL t4510 = t4494*t146;
+    const MBPOL_POLY_REAL t4512 = t4477+t4500+t4501+t4502+t4503+t4504+t4505+t4487+t4488+t4490+t4491+
 t4492+t4493+t4507+t4508*t145+t4510+t4496*t155;
-    const double t4514 = t4419*t20;
-    const double t4515 = t4417*t5;
-    const double t4516 = t4417*t26;
-    const double t4517 = t4419*t37;
-    const double t4518 = a[1135];
-    const double t4241 = t4518*t72;
-    const double t4242 = t4426*t73;
-    const double t4522 = (t4416+t4514+t4515+t4516+t4517+t4424+t4425+t4241+t4242)*t73;
-    const double t4523 = a[490];
-    const double t4524 = a[599];
-    const double t4525 = t4524*t5;
-    const double t4526 = t4524*t20;
-    const double t4527 = a[1096];
-    const double t4528 = t4527*t26;
-    const double t4529 = t4527*t37;
-    const double t4530 = a[1043];
-    const double t4531 = t4530*t50;
-    const double t4532 = a[931];
-    const double t4533 = t4532*t67;
-    const double t4534 = a[756];
-    const double t4535 = t4534*t72;
-    const double t4536 = t4534*t73;
-    const double t4537 = a[692];
-    const double t4538 = t4537*t77;
-    const double t4539 = t4537*t126;
-    const double t4540 = t4537*t132;
-    const double t4541 = t4537*t136;
-    const double t4542 = a[728];
-    const double t4544 = t4523+t4525+t4526+t4528+t4529+t4531+t4533+t4535+t4536+t4538+t4539+
+    const MBPOL_POLY_REAL t4514 = t4419*t20;
+    const MBPOL_POLY_REAL t4515 = t4417*t5;
+    const MBPOL_POLY_REAL t4516 = t4417*t26;
+    const MBPOL_POLY_REAL t4517 = t4419*t37;
+    const MBPOL_POLY_REAL t4518 = a[1135];
+    const MBPOL_POLY_REAL t4241 = t4518*t72;
+    const MBPOL_POLY_REAL t4242 = t4426*t73;
+    const MBPOL_POLY_REAL t4522 = (t4416+t4514+t4515+t4516+t4517+t4424+t4425+t4241+t4242)*t73;
+    const MBPOL_POLY_REAL t4523 = a[490];
+    const MBPOL_POLY_REAL t4524 = a[599];
+    const MBPOL_POLY_REAL t4525 = t4524*t5;
+    const MBPOL_POLY_REAL t4526 = t4524*t20;
+    const MBPOL_POLY_REAL t4527 = a[1096];
+    const MBPOL_POLY_REAL t4528 = t4527*t26;
+    const MBPOL_POLY_REAL t4529 = t4527*t37;
+    const MBPOL_POLY_REAL t4530 = a[1043];
+    const MBPOL_POLY_REAL t4531 = t4530*t50;
+    const MBPOL_POLY_REAL t4532 = a[931];
+    const MBPOL_POLY_REAL t4533 = t4532*t67;
+    const MBPOL_POLY_REAL t4534 = a[756];
+    const MBPOL_POLY_REAL t4535 = t4534*t72;
+    const MBPOL_POLY_REAL t4536 = t4534*t73;
+    const MBPOL_POLY_REAL t4537 = a[692];
+    const MBPOL_POLY_REAL t4538 = t4537*t77;
+    const MBPOL_POLY_REAL t4539 = t4537*t126;
+    const MBPOL_POLY_REAL t4540 = t4537*t132;
+    const MBPOL_POLY_REAL t4541 = t4537*t136;
+    const MBPOL_POLY_REAL t4542 = a[728];
+    const MBPOL_POLY_REAL t4544 = t4523+t4525+t4526+t4528+t4529+t4531+t4533+t4535+t4536+t4538+t4539+
 t4540+t4541+t4542*t139;
-    const double t4546 = t4283*t5;
-    const double t4547 = t4268*t20;
-    const double t4262 = t4546+t4267+t4547;
-    const double t4549 = t4262*t20;
-    const double t4550 = a[626];
-    const double t4551 = t4550*t5;
-    const double t4552 = a[298];
-    const double t4553 = t4550*t20;
-    const double t4554 = t4550*t26;
-    const double t4555 = t4550*t37;
-    const double t4556 = a[976];
-    const double t4557 = t4556*t50;
-    const double t4558 = t4556*t67;
-    const double t4559 = a[937];
-    const double t4560 = t4559*t72;
-    const double t4561 = t4559*t73;
-    const double t4562 = a[600];
-    const double t4563 = t4562*t77;
-    const double t4564 = t4562*t126;
-    const double t4565 = t4562*t132;
-    const double t4566 = t4562*t136;
-    const double t4567 = a[801];
-    const double t4569 = a[690];
-    const double t4264 = a[665];
-    const double t4574 = t4264*t179;
-    const double t4575 = t4551+t4552+t4553+t4554+t4555+t4557+t4558+t4560+t4561+t4563+t4564+
+    const MBPOL_POLY_REAL t4546 = t4283*t5;
+    const MBPOL_POLY_REAL t4547 = t4268*t20;
+    const MBPOL_POLY_REAL t4262 = t4546+t4267+t4547;
+    const MBPOL_POLY_REAL t4549 = t4262*t20;
+    const MBPOL_POLY_REAL t4550 = a[626];
+    const MBPOL_POLY_REAL t4551 = t4550*t5;
+    const MBPOL_POLY_REAL t4552 = a[298];
+    const MBPOL_POLY_REAL t4553 = t4550*t20;
+    const MBPOL_POLY_REAL t4554 = t4550*t26;
+    const MBPOL_POLY_REAL t4555 = t4550*t37;
+    const MBPOL_POLY_REAL t4556 = a[976];
+    const MBPOL_POLY_REAL t4557 = t4556*t50;
+    const MBPOL_POLY_REAL t4558 = t4556*t67;
+    const MBPOL_POLY_REAL t4559 = a[937];
+    const MBPOL_POLY_REAL t4560 = t4559*t72;
+    const MBPOL_POLY_REAL t4561 = t4559*t73;
+    const MBPOL_POLY_REAL t4562 = a[600];
+    const MBPOL_POLY_REAL t4563 = t4562*t77;
+    const MBPOL_POLY_REAL t4564 = t4562*t126;
+    const MBPOL_POLY_REAL t4565 = t4562*t132;
+    const MBPOL_POLY_REAL t4566 = t4562*t136;
+    const MBPOL_POLY_REAL t4567 = a[801];
+    const MBPOL_POLY_REAL t4569 = a[690];
+    const MBPOL_POLY_REAL t4264 = a[665];
+    const MBPOL_POLY_REAL t4574 = t4264*t179;
+    const MBPOL_POLY_REAL t4575 = t4551+t4552+t4553+t4554+t4555+t4557+t4558+t4560+t4561+t4563+t4564+
 t4565+t4566+t4567*t139+t4569*t145+t4567*t146+t4569*t155+t4574;
-    const double t4577 = a[571];
-    const double t4578 = t4577*t5;
-    const double t4579 = a[167];
-    const double t4580 = t4577*t20;
-    const double t4581 = t4577*t26;
-    const double t4582 = t4577*t37;
-    const double t4583 = a[689];
-    const double t4584 = t4583*t50;
-    const double t4585 = t4583*t67;
-    const double t4586 = a[574];
-    const double t4587 = t4586*t72;
-    const double t4588 = t4586*t73;
-    const double t4589 = a[921];
-    const double t4590 = t4589*t77;
-    const double t4591 = a[646];
-    const double t4592 = t4591*t126;
-    const double t4593 = t4589*t132;
-    const double t4594 = t4591*t136;
-    const double t4595 = a[779];
-    const double t4596 = t4595*t139;
-    const double t4597 = a[797];
-    const double t4598 = t4597*t145;
-    const double t4599 = t4595*t146;
-    const double t4600 = t4597*t155;
-    const double t4284 = a[591];
-    const double t4602 = t4284*t179;
-    const double t4603 = a[876];
-    const double t4604 = t4603*t275;
-    const double t4605 = a[944];
-    const double t4606 = t4605*t254;
-    const double t4607 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4590+t4592+
+    const MBPOL_POLY_REAL t4577 = a[571];
+    const MBPOL_POLY_REAL t4578 = t4577*t5;
+    const MBPOL_POLY_REAL t4579 = a[167];
+    const MBPOL_POLY_REAL t4580 = t4577*t20;
+    const MBPOL_POLY_REAL t4581 = t4577*t26;
+    const MBPOL_POLY_REAL t4582 = t4577*t37;
+    const MBPOL_POLY_REAL t4583 = a[689];
+    const MBPOL_POLY_REAL t4584 = t4583*t50;
+    const MBPOL_POLY_REAL t4585 = t4583*t67;
+    const MBPOL_POLY_REAL t4586 = a[574];
+    const MBPOL_POLY_REAL t4587 = t4586*t72;
+    const MBPOL_POLY_REAL t4588 = t4586*t73;
+    const MBPOL_POLY_REAL t4589 = a[921];
+    const MBPOL_POLY_REAL t4590 = t4589*t77;
+    const MBPOL_POLY_REAL t4591 = a[646];
+    const MBPOL_POLY_REAL t4592 = t4591*t126;
+    const MBPOL_POLY_REAL t4593 = t4589*t132;
+    const MBPOL_POLY_REAL t4594 = t4591*t136;
+    const MBPOL_POLY_REAL t4595 = a[779];
+    const MBPOL_POLY_REAL t4596 = t4595*t139;
+    const MBPOL_POLY_REAL t4597 = a[797];
+    const MBPOL_POLY_REAL t4598 = t4597*t145;
+    const MBPOL_POLY_REAL t4599 = t4595*t146;
+    const MBPOL_POLY_REAL t4600 = t4597*t155;
+    const MBPOL_POLY_REAL t4284 = a[591];
+    const MBPOL_POLY_REAL t4602 = t4284*t179;
+    const MBPOL_POLY_REAL t4603 = a[876];
+    const MBPOL_POLY_REAL t4604 = t4603*t275;
+    const MBPOL_POLY_REAL t4605 = a[944];
+    const MBPOL_POLY_REAL t4606 = t4605*t254;
+    const MBPOL_POLY_REAL t4607 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4590+t4592+
 t4593+t4594+t4596+t4598+t4599+t4600+t4602+t4604+t4606;
-    const double t4609 = t4527*t5;
-    const double t4610 = t4527*t20;
-    const double t4611 = t4524*t26;
-    const double t4612 = t4524*t37;
-    const double t4613 = t4532*t50;
-    const double t4614 = t4530*t67;
-    const double t4615 = a[1100];
-    const double t4617 = t4506*t145;
-    const double t4619 = t4523+t4609+t4610+t4611+t4612+t4613+t4614+t4535+t4536+t4538+t4539+
+    const MBPOL_POLY_REAL t4609 = t4527*t5;
+    const MBPOL_POLY_REAL t4610 = t4527*t20;
+    const MBPOL_POLY_REAL t4611 = t4524*t26;
+    const MBPOL_POLY_REAL t4612 = t4524*t37;
+    const MBPOL_POLY_REAL t4613 = t4532*t50;
+    const MBPOL_POLY_REAL t4614 = t4530*t67;
+    const MBPOL_POLY_REAL t4615 = a[1100];
+    const MBPOL_POLY_REAL t4617 = t4506*t145;
+    const MBPOL_POLY_REAL t4619 = t4523+t4609+t4610+t4611+t4612+t4613+t4614+t4535+t4536+t4538+t4539+
 t4540+t4541+t4615*t139+t4617+t4542*t146;
-    const double t4621 = t4591*t77;
-    const double t4622 = t4589*t126;
-    const double t4623 = t4591*t132;
-    const double t4624 = t4589*t136;
-    const double t4625 = t4605*t275;
-    const double t4626 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4621+t4622+
+    const MBPOL_POLY_REAL t4621 = t4591*t77;
+    const MBPOL_POLY_REAL t4622 = t4589*t126;
+    const MBPOL_POLY_REAL t4623 = t4591*t132;
+    const MBPOL_POLY_REAL t4624 = t4589*t136;
+    const MBPOL_POLY_REAL t4625 = t4605*t275;
+    const MBPOL_POLY_REAL t4626 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4621+t4622+
 t4623+t4624+t4596+t4598+t4599+t4600+t4602+t4625;
-    const double t4317 = t4448+t4454;
-    const double t4331 = t4464+t4472;
-    const double t4628 = t4444+t4317*t309+t4460+t4331*t240+t4498*t145+t4512*t155+t4522+t4544
+    const MBPOL_POLY_REAL t4317 = t4448+t4454;
+    const MBPOL_POLY_REAL t4331 = t4464+t4472;
+    const MBPOL_POLY_REAL t4628 = t4444+t4317*t309+t4460+t4331*t240+t4498*t145+t4512*t155+t4522+t4544
 *t139+t4549+t4575*t179+t4607*t254+t4619*t146+t4626*t275;
-    const double t4633 = t4523+t4609+t4610+t4611+t4612+t4613+t4614+t4535+t4536+t4538+t4539+
+    const MBPOL_POLY_REAL t4633 = t4523+t4609+t4610+t4611+t4612+t4613+t4614+t4535+t4536+t4538+t4539+
 t4540+t4541+t4507+t4615*t145+t4510+t4542*t155;
-    const double t4635 = t4597*t139;
-    const double t4636 = t4595*t145;
-    const double t4637 = t4597*t146;
-    const double t4638 = t4595*t155;
-    const double t4639 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4621+t4622+
+    const MBPOL_POLY_REAL t4635 = t4597*t139;
+    const MBPOL_POLY_REAL t4636 = t4595*t145;
+    const MBPOL_POLY_REAL t4637 = t4597*t146;
+    const MBPOL_POLY_REAL t4638 = t4595*t155;
+    const MBPOL_POLY_REAL t4639 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4621+t4622+
 t4623+t4624+t4635+t4636+t4637+t4638+t4602+t4625;
-    const double t4641 = t4292+t4294+t4295+t4296+t4297+t4299+t4300+t4302+t4303+t4305+t4307+
+    const MBPOL_POLY_REAL t4641 = t4292+t4294+t4295+t4296+t4297+t4299+t4300+t4302+t4303+t4305+t4307+
 t4309;
-    const double t4642 = t4313*t139;
-    const double t4643 = t4311*t145;
-    const double t4644 = t4313*t146;
-    const double t4645 = t4311*t155;
-    const double t4646 = t4325*t212;
-    const double t4647 = t4323*t215;
-    const double t4648 = t4327*t309;
-    const double t4649 = t4310+t4642+t4643+t4644+t4645+t4318+t4320+t4322+t4646+t4647+t4452+
+    const MBPOL_POLY_REAL t4642 = t4313*t139;
+    const MBPOL_POLY_REAL t4643 = t4311*t145;
+    const MBPOL_POLY_REAL t4644 = t4313*t146;
+    const MBPOL_POLY_REAL t4645 = t4311*t155;
+    const MBPOL_POLY_REAL t4646 = t4325*t212;
+    const MBPOL_POLY_REAL t4647 = t4323*t215;
+    const MBPOL_POLY_REAL t4648 = t4327*t309;
+    const MBPOL_POLY_REAL t4649 = t4310+t4642+t4643+t4644+t4645+t4318+t4320+t4322+t4646+t4647+t4452+
 t4648;
-    const double t4653 = t4476+t4477+t4478+t4480+t4481+t4483+t4485+t4487+t4488+t4490+t4491+
+    const MBPOL_POLY_REAL t4653 = t4476+t4477+t4478+t4480+t4481+t4483+t4485+t4487+t4488+t4490+t4491+
 t4492+t4493+t4496*t139;
-    const double t4659 = t4551+t4552+t4553+t4554+t4555+t4557+t4558+t4560+t4561+t4563+t4564+
+    const MBPOL_POLY_REAL t4659 = t4551+t4552+t4553+t4554+t4555+t4557+t4558+t4560+t4561+t4563+t4564+
 t4565+t4566+t4569*t139+t4567*t145+t4569*t146+t4567*t155+t4574;
-    const double t4662 = t4523+t4525+t4526+t4528+t4529+t4531+t4533+t4535+t4536+t4538+t4539+
+    const MBPOL_POLY_REAL t4662 = t4523+t4525+t4526+t4528+t4529+t4531+t4533+t4535+t4536+t4538+t4539+
 t4540+t4541+t4495+t4542*t145;
-    const double t4409 = t4641+t4649;
-    const double t4664 = t4266+t4633*t155+t4271+t4282+t4639*t275+t4291+t4409*t309+t4340+
+    const MBPOL_POLY_REAL t4409 = t4641+t4649;
+    const MBPOL_POLY_REAL t4664 = t4266+t4633*t155+t4271+t4282+t4639*t275+t4291+t4409*t309+t4340+
 t4653*t139+t4659*t179+t4662*t145+t4415;
-    const double t4671 = t4389+t4391+t4392+t4395*t139+t4393*t145+t4395*t146+t4393*t155+t4400
+    const MBPOL_POLY_REAL t4671 = t4389+t4391+t4392+t4395*t139+t4393*t145+t4395*t146+t4393*t155+t4400
 +t4402+t4403+t4406*t212;
-    const double t4674 = t4205+t4223+t4642+t4643+t4644+t4645+t4461+t4646+t4647+t4292+t4302+
+    const MBPOL_POLY_REAL t4674 = t4205+t4223+t4642+t4643+t4644+t4645+t4461+t4646+t4647+t4292+t4302+
 t4318+t4462;
-    const double t4676 = t4327*t475;
-    const double t4677 = t4463+t4296+t4299+t4295+t4294+t4297+t4300+t4465+t4303+t4466+t4468+
+    const MBPOL_POLY_REAL t4676 = t4327*t475;
+    const MBPOL_POLY_REAL t4677 = t4463+t4296+t4299+t4295+t4294+t4297+t4300+t4465+t4303+t4466+t4468+
 t4470*t309+t4676;
-    const double t4680 = t4198+t4200+t4202+t4203+t4206+t4208+t4210+t4218+t4220+t4228+t4230+
+    const MBPOL_POLY_REAL t4680 = t4198+t4200+t4202+t4203+t4206+t4208+t4210+t4218+t4220+t4228+t4230+
 t4232;
-    const double t4681 = t4215*t240;
-    const double t4682 = t4226*t143;
-    const double t4683 = t4224*t139;
-    const double t4684 = t4213*t145;
-    const double t4685 = t4224*t146;
-    const double t4686 = t4213*t155;
-    const double t4687 = t4236*t212;
-    const double t4688 = t4211*t215;
-    const double t4689 = t4233+t4234+t4681+t4682+t4469+t4683+t4684+t4685+t4686+t4687+t4688+
+    const MBPOL_POLY_REAL t4681 = t4215*t240;
+    const MBPOL_POLY_REAL t4682 = t4226*t143;
+    const MBPOL_POLY_REAL t4683 = t4224*t139;
+    const MBPOL_POLY_REAL t4684 = t4213*t145;
+    const MBPOL_POLY_REAL t4685 = t4224*t146;
+    const MBPOL_POLY_REAL t4686 = t4213*t155;
+    const MBPOL_POLY_REAL t4687 = t4236*t212;
+    const MBPOL_POLY_REAL t4688 = t4211*t215;
+    const MBPOL_POLY_REAL t4689 = t4233+t4234+t4681+t4682+t4469+t4683+t4684+t4685+t4686+t4687+t4688+
 t4235+t4238;
-    const double t4692 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4590+t4592+
+    const MBPOL_POLY_REAL t4692 = t4578+t4579+t4580+t4581+t4582+t4584+t4585+t4587+t4588+t4590+t4592+
 t4593+t4594+t4635+t4636+t4637+t4638+t4602+t4604+t4606;
-    const double t4694 = t4233+t4203+t4228+t4232+t4200+t4206+t4198+t4218+t4235+t4445+t4446;
-    const double t4695 = t4215*t143;
-    const double t4696 = t4447+t4449+t4683+t4684+t4685+t4686+t4210+t4450+t4451+t4687+t4688+
+    const MBPOL_POLY_REAL t4694 = t4233+t4203+t4228+t4232+t4200+t4206+t4198+t4218+t4235+t4445+t4446;
+    const MBPOL_POLY_REAL t4695 = t4215*t143;
+    const MBPOL_POLY_REAL t4696 = t4447+t4449+t4683+t4684+t4685+t4686+t4210+t4450+t4451+t4687+t4688+
 t4695;
-    const double t4701 = t4477+t4500+t4501+t4502+t4503+t4504+t4505+t4487+t4488+t4490+t4491+
+    const MBPOL_POLY_REAL t4701 = t4477+t4500+t4501+t4502+t4503+t4504+t4505+t4487+t4488+t4490+t4491+
 t4492+t4493+t4508*t139+t4617+t4496*t146;
-    const double t4703 = t4342+t4343+t4344+t4345+t4346+t4348+t4349+t4351+t4352+t4354+t4356;
-    const double t4709 = t4357+t4358+t4361*t139+t4359*t145+t4361*t146+t4359*t155+t4366+t4368
+    const MBPOL_POLY_REAL t4703 = t4342+t4343+t4344+t4345+t4346+t4348+t4349+t4351+t4352+t4354+t4356;
+    const MBPOL_POLY_REAL t4709 = t4357+t4358+t4361*t139+t4359*t145+t4361*t146+t4359*t155+t4366+t4368
 +t4369+t4405+t4370*t215;
-    const double t4509 = t4375+t4377+t4378+t4379+t4380+t4382+t4383+t4385+t4386+t4388+t4671;
-    const double t4513 = t4674+t4677;
-    const double t4520 = t4680+t4689;
-    const double t4545 = t4694+t4696;
-    const double t4570 = t4703+t4709;
-    const double t4712 = t4429+t4434+t4509*t212+t4444+t4460+t4513*t475+t4520*t240+t4522+
+    const MBPOL_POLY_REAL t4509 = t4375+t4377+t4378+t4379+t4380+t4382+t4383+t4385+t4386+t4388+t4671;
+    const MBPOL_POLY_REAL t4513 = t4674+t4677;
+    const MBPOL_POLY_REAL t4520 = t4680+t4689;
+    const MBPOL_POLY_REAL t4545 = t4694+t4696;
+    const MBPOL_POLY_REAL t4570 = t4703+t4709;
+    const MBPOL_POLY_REAL t4712 = t4429+t4434+t4509*t212+t4444+t4460+t4513*t475+t4520*t240+t4522+
 t4692*t254+t4549+t4545*t143+t4701*t146+t4570*t215;
-    const double t4715 = a[285];
-    const double t4716 = t4715*t20;
-    const double t4717 = a[175];
-    const double t4718 = t4717*t5;
-    const double t4719 = t4193*t26;
-    const double t4725 = t3241+t3243+t3245+t3246+t3247+t3249+t3250+t3252+t3254+t3257*t77+
+    const MBPOL_POLY_REAL t4715 = a[285];
+    const MBPOL_POLY_REAL t4716 = t4715*t20;
+    const MBPOL_POLY_REAL t4717 = a[175];
+    const MBPOL_POLY_REAL t4718 = t4717*t5;
+    const MBPOL_POLY_REAL t4719 = t4193*t26;
+    const MBPOL_POLY_REAL t4725 = t3241+t3243+t3245+t3246+t3247+t3249+t3250+t3252+t3254+t3257*t77+
 t3255*t126+t3261*t132;
-    const double t4727 = t3242*t5;
-    const double t4728 = t3244*t20;
-    const double t4729 = t3242*t26;
-    const double t4730 = t3244*t37;
-    const double t4731 = t3253*t72;
-    const double t4732 = t3251*t73;
-    const double t4740 = t4178+t3267+t4179+t4180+t4181+t4182+t4183+t3277+t3278+t3280+t3281+
+    const MBPOL_POLY_REAL t4727 = t3242*t5;
+    const MBPOL_POLY_REAL t4728 = t3244*t20;
+    const MBPOL_POLY_REAL t4729 = t3242*t26;
+    const MBPOL_POLY_REAL t4730 = t3244*t37;
+    const MBPOL_POLY_REAL t4731 = t3253*t72;
+    const MBPOL_POLY_REAL t4732 = t3251*t73;
+    const MBPOL_POLY_REAL t4740 = t4178+t3267+t4179+t4180+t4181+t4182+t4183+t3277+t3278+t3280+t3281+
 t3282+t3283+t4186*t139+t4184*t145+t3284*t146+t3286*t155;
-    const double t4742 = t3215+t3214+t3216+t3218+t3219+t3221+t3222+t3224+t3225+t3784+t3785+
+    const MBPOL_POLY_REAL t4742 = t3215+t3214+t3216+t3218+t3219+t3221+t3222+t3224+t3225+t3784+t3785+
 t3787;
-    const double t4743 = t3197*t143;
-    const double t4744 = t3199*t309;
-    const double t4745 = t3788+t3227+t3229+t3230+t3231+t3233+t3793+t3794+t3235+t3237+t4743+
+    const MBPOL_POLY_REAL t4743 = t3197*t143;
+    const MBPOL_POLY_REAL t4744 = t3199*t309;
+    const MBPOL_POLY_REAL t4745 = t3788+t3227+t3229+t3230+t3231+t3233+t3793+t3794+t3235+t3237+t4743+
 t4744;
-    const double t4748 = t4715*t5;
-    const double t4749 = a[90];
-    const double t4752 = t4193*t37;
-    const double t4757 = t4727+t3241+t4728+t4729+t4730+t3249+t3250+t4731+t4732+t3259*t77+
+    const MBPOL_POLY_REAL t4748 = t4715*t5;
+    const MBPOL_POLY_REAL t4749 = a[90];
+    const MBPOL_POLY_REAL t4752 = t4193*t37;
+    const MBPOL_POLY_REAL t4757 = t4727+t3241+t4728+t4729+t4730+t3249+t3250+t4731+t4732+t3259*t77+
 t3261*t126;
-    const double t4763 = a[511];
-    const double t4766 = t3166+t3168+t3169+t3170+t3171+t3173+t3174+t3176+t3177+t3180*t77+
+    const MBPOL_POLY_REAL t4763 = a[511];
+    const MBPOL_POLY_REAL t4766 = t3166+t3168+t3169+t3170+t3171+t3173+t3174+t3176+t3177+t3180*t77+
 t3178*t126+t3180*t132+t3178*t136+t3185+t3186+t3187+t3188+t3190+t4763*t275+t3191
 *t254;
-    const double t4768 = t3306*t77;
-    const double t4769 = t3304*t126;
-    const double t4770 = t3306*t132;
-    const double t4771 = t3304*t136;
-    const double t4772 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t4768+t4769+
+    const MBPOL_POLY_REAL t4768 = t3306*t77;
+    const MBPOL_POLY_REAL t4769 = t3304*t126;
+    const MBPOL_POLY_REAL t4770 = t3306*t132;
+    const MBPOL_POLY_REAL t4771 = t3304*t136;
+    const MBPOL_POLY_REAL t4772 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t4768+t4769+
 t4770+t4771+t3315+t3316;
-    const double t4777 = t3483*t77;
-    const double t4778 = t3500*t126;
-    const double t4779 = t3485+t3506+t3504+t3509+t3510+t3499+t3511+t3497+t3512+t4777+t4778;
-    const double t4780 = t3483*t132;
-    const double t4781 = t3500*t136;
-    const double t4782 = t3507*t275;
-    const double t4783 = t3488*t254;
-    const double t4784 = t3481*t143;
-    const double t4785 = t4780+t4781+t3502+t3505+t3491+t3493+t3474+t4782+t4783+t3476+t3480+
+    const MBPOL_POLY_REAL t4777 = t3483*t77;
+    const MBPOL_POLY_REAL t4778 = t3500*t126;
+    const MBPOL_POLY_REAL t4779 = t3485+t3506+t3504+t3509+t3510+t3499+t3511+t3497+t3512+t4777+t4778;
+    const MBPOL_POLY_REAL t4780 = t3483*t132;
+    const MBPOL_POLY_REAL t4781 = t3500*t136;
+    const MBPOL_POLY_REAL t4782 = t3507*t275;
+    const MBPOL_POLY_REAL t4783 = t3488*t254;
+    const MBPOL_POLY_REAL t4784 = t3481*t143;
+    const MBPOL_POLY_REAL t4785 = t4780+t4781+t3502+t3505+t3491+t3493+t3474+t4782+t4783+t3476+t3480+
 t4784;
-    const double t4793 = t3653+t3654+t3655+t3656+t3657+t3659+t3660+t3662+t3663+t3666*t77+
+    const MBPOL_POLY_REAL t4793 = t3653+t3654+t3655+t3656+t3657+t3659+t3660+t3662+t3663+t3666*t77+
 t3664*t126+t3666*t132+t3664*t136+t3671+t3672+t3673+t3674+t3676+t3556+t3677*t254
 ;
-    const double t4795 = t3402*t77;
-    const double t4797 = t3400*t126;
-    const double t4798 = t3402*t132;
-    const double t4799 = t3400*t136;
-    const double t4800 = t3417*t275;
-    const double t4801 = t3415*t254;
-    const double t4802 = t4797+t4798+t4799+t3644+t3645+t3646+t3647+t3414+t4800+t4801+t3648;
-    const double t4805 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t4795+t4797;
-    const double t4806 = t4798+t4799+t3408+t3410+t3411+t3412+t3414+t4800+t4801+t3420+t3422;
-    const double t4814 = t3530+t3532+t3533+t3534+t3535+t3537+t3538+t3540+t3541+t3544*t77+
+    const MBPOL_POLY_REAL t4795 = t3402*t77;
+    const MBPOL_POLY_REAL t4797 = t3400*t126;
+    const MBPOL_POLY_REAL t4798 = t3402*t132;
+    const MBPOL_POLY_REAL t4799 = t3400*t136;
+    const MBPOL_POLY_REAL t4800 = t3417*t275;
+    const MBPOL_POLY_REAL t4801 = t3415*t254;
+    const MBPOL_POLY_REAL t4802 = t4797+t4798+t4799+t3644+t3645+t3646+t3647+t3414+t4800+t4801+t3648;
+    const MBPOL_POLY_REAL t4805 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t4795+t4797;
+    const MBPOL_POLY_REAL t4806 = t4798+t4799+t3408+t3410+t3411+t3412+t3414+t4800+t4801+t3420+t3422;
+    const MBPOL_POLY_REAL t4814 = t3530+t3532+t3533+t3534+t3535+t3537+t3538+t3540+t3541+t3544*t77+
 t3542*t126+t3544*t132+t3542*t136+t3549+t3550+t3551+t3552+t3554+t3557*t275;
-    const double t4665 = t3357*t77;
-    const double t4668 = t4779+t4785;
-    const double t4672 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t4795+t4802;
-    const double t4675 = t4805+t4806;
-    const double t4816 = t4772*t145+(t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354+
+    const MBPOL_POLY_REAL t4665 = t3357*t77;
+    const MBPOL_POLY_REAL t4668 = t4779+t4785;
+    const MBPOL_POLY_REAL t4672 = t3389+t3390+t3391+t3392+t3393+t3395+t3396+t3398+t3399+t4795+t4802;
+    const MBPOL_POLY_REAL t4675 = t4805+t4806;
+    const MBPOL_POLY_REAL t4816 = t4772*t145+(t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354+
 t4665)*t77+t3376+t3387+t4668*t143+t4793*t254+t3472+t4672*t212+t4675*t215+t3570+
 t3577+t4814*t275;
-    const double t4818 = t3634+t3319+t3635+t3636+t3637+t3327+t3328+t3638+t3639+t3356+t3337*
+    const MBPOL_POLY_REAL t4818 = t3634+t3319+t3635+t3636+t3637+t3327+t3328+t3638+t3639+t3356+t3337*
 t126;
-    const double t4820 = t3436+t3437+t3434+t3429+t3446+t3448+t3449+t3427+t3433+t3431+t3478+
+    const MBPOL_POLY_REAL t4820 = t3436+t3437+t3434+t3429+t3446+t3448+t3449+t3427+t3433+t3431+t3478+
 t3450;
-    const double t4821 = t3455*t275;
-    const double t4822 = t3440*t77;
-    const double t4823 = t3453*t254;
-    const double t4824 = t3461*t240;
-    const double t4825 = t3438*t126;
-    const double t4826 = t3440*t132;
-    const double t4827 = t3438*t136;
-    const double t4828 = t3458+t3460+t3428+t3430+t3487+t4821+t4822+t4823+t4824+t3452+t4825+
+    const MBPOL_POLY_REAL t4821 = t3455*t275;
+    const MBPOL_POLY_REAL t4822 = t3440*t77;
+    const MBPOL_POLY_REAL t4823 = t3453*t254;
+    const MBPOL_POLY_REAL t4824 = t3461*t240;
+    const MBPOL_POLY_REAL t4825 = t3438*t126;
+    const MBPOL_POLY_REAL t4826 = t3440*t132;
+    const MBPOL_POLY_REAL t4827 = t3438*t136;
+    const MBPOL_POLY_REAL t4828 = t3458+t3460+t3428+t3430+t3487+t4821+t4822+t4823+t4824+t3452+t4825+
 t4826+t4827;
-    const double t4831 = t3485+t3506+t3504+t3509+t3510+t3499+t3511+t3497+t3512+t4777+t4778+
+    const MBPOL_POLY_REAL t4831 = t3485+t3506+t3504+t3509+t3510+t3499+t3511+t3497+t3512+t4777+t4778+
 t4780;
-    const double t4832 = t3600*t143;
-    const double t4833 = t3481*t309;
-    const double t4834 = t4781+t3598+t3599+t3596+t3595+t3474+t4782+t4783+t3591+t3592+t4832+
+    const MBPOL_POLY_REAL t4832 = t3600*t143;
+    const MBPOL_POLY_REAL t4833 = t3481*t309;
+    const MBPOL_POLY_REAL t4834 = t4781+t3598+t3599+t3596+t3595+t3474+t4782+t4783+t3591+t3592+t4832+
 t4833;
-    const double t4839 = t3319+t3321+t3323+t3324+t3325+t3327+t3328+t3330+t3332+t3612+t3333*
+    const MBPOL_POLY_REAL t4839 = t3319+t3321+t3323+t3324+t3325+t3327+t3328+t3330+t3332+t3612+t3333*
 t126+t3615+t3337*t136;
-    const double t4845 = t3682+t3683+t3684+t3685+t3686+t3688+t3689+t3691+t3692+t3695*t77+
+    const MBPOL_POLY_REAL t4845 = t3682+t3683+t3684+t3685+t3686+t3688+t3689+t3691+t3692+t3695*t77+
 t3693*t126+t3695*t132+t3693*t136+t3700+t3701+t3702+t3703+t3705;
-    const double t4847 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t4768+t4769+
+    const MBPOL_POLY_REAL t4847 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t4768+t4769+
 t4770+t4771+t3585+t3587+t3588;
-    const double t4849 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t4768+t4769+
+    const MBPOL_POLY_REAL t4849 = t3291+t3292+t3293+t3295+t3296+t3298+t3300+t3302+t3303+t4768+t4769+
 t4770+t4771+t3311;
-    const double t4853 = t3606+t3345+t3607+t3608+t3609+t3349+t3350+t3610+t3611+t3613*t77+
+    const MBPOL_POLY_REAL t4853 = t3606+t3345+t3607+t3608+t3609+t3349+t3350+t3610+t3611+t3613*t77+
 t3336+t3357*t132;
-    const double t4855 = t3461*t475;
-    const double t4856 = t3436+t3437+t3434+t3429+t4855+t3427+t3433+t3431+t3428+t3430+t4821+
+    const MBPOL_POLY_REAL t4855 = t3461*t475;
+    const MBPOL_POLY_REAL t4856 = t3436+t3437+t3434+t3429+t4855+t3427+t3433+t3431+t3428+t3430+t4821+
 t3594+t3518;
-    const double t4858 = t3521+t4822+t4823+t3519+t3520+t3452+t4825+t4826+t4827+t3602+t3524*
+    const MBPOL_POLY_REAL t4858 = t3521+t4822+t4823+t3519+t3520+t3452+t4825+t4826+t4827+t3602+t3524*
 t240+t3522+t3523;
-    const double t4861 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t4768+t4769+
+    const MBPOL_POLY_REAL t4861 = t3292+t3578+t3579+t3580+t3581+t3582+t3583+t3302+t3303+t4768+t4769+
 t4770+t4771+t3628+t3629+t3630+t3631;
-    const double t4707 = t4820+t4828;
-    const double t4710 = t4831+t4834;
-    const double t4723 = t4856+t4858;
-    const double t4863 = t4818*t126+t3627+t4707*t240+t4710*t309+t4839*t136+t4845*t179+t4847*
+    const MBPOL_POLY_REAL t4707 = t4820+t4828;
+    const MBPOL_POLY_REAL t4710 = t4831+t4834;
+    const MBPOL_POLY_REAL t4723 = t4856+t4858;
+    const MBPOL_POLY_REAL t4863 = t4818*t126+t3627+t4707*t240+t4710*t309+t4839*t136+t4845*t179+t4847*
 t146+t4849*t139+t4853*t132+t4723*t475+t3710+t3714+t4861*t155;
-    const double t4872 = t3748+t3750+t3751+t3754*t139+t3752*t145+t3754*t146+t3752*t155+t3759
+    const MBPOL_POLY_REAL t4872 = t3748+t3750+t3751+t3754*t139+t3752*t145+t3754*t146+t3752*t155+t3759
 +t3761+t3762+t3765*t212;
-    const double t4875 = t4749*t5;
-    const double t4876 = t4193*t20;
-    const double t4880 = t3266+t3267+t3268+t3270+t3271+t3273+t3275+t3277+t3278+t3280+t3281+
+    const MBPOL_POLY_REAL t4875 = t4749*t5;
+    const MBPOL_POLY_REAL t4876 = t4193*t20;
+    const MBPOL_POLY_REAL t4880 = t3266+t3267+t3268+t3270+t3271+t3273+t3275+t3277+t3278+t3280+t3281+
 t3282+t3283+t3286*t139;
-    const double t4739 = t4435+t4628;
-    const double t4746 = t4664+t4712;
-    const double t4754 = t3261*t77;
-    const double t4759 = t4742+t4745;
-    const double t4764 = t4748+t4749*t26+t4717*t20+t4192+t4752;
-    const double t4774 = t4816+t4863;
-    const double t4776 = t3734+t3736+t3737+t3738+t3739+t3741+t3742+t3744+t3745+t3747+t4872;
-    const double t4882 = t4196+t4739*t3116+t4746*t3120+(t4192+t4716+t4718+t4719)*t26+t4725*
+    const MBPOL_POLY_REAL t4739 = t4435+t4628;
+    const MBPOL_POLY_REAL t4746 = t4664+t4712;
+    const MBPOL_POLY_REAL t4754 = t3261*t77;
+    const MBPOL_POLY_REAL t4759 = t4742+t4745;
+    const MBPOL_POLY_REAL t4764 = t4748+t4749*t26+t4717*t20+t4192+t4752;
+    const MBPOL_POLY_REAL t4774 = t4816+t4863;
+    const MBPOL_POLY_REAL t4776 = t3734+t3736+t3737+t3738+t3739+t3741+t3742+t3744+t3745+t3747+t4872;
+    const MBPOL_POLY_REAL t4882 = t4196+t4739*t3116+t4746*t3120+(t4192+t4716+t4718+t4719)*t26+t4725*
 t132+(t4727+t3241+t4728+t4729+t4730+t3249+t3250+t4731+t4732+t4754)*t77+t4740*
 t155+t4759*t309+t4764*t37+t4757*t126+t4766*t254+t4774*t2341+t4776*t212+(t4875+
 t4192+t4876)*t20+t4880*t139;
-    const double t4889 = t1163+t1124+t1126+t1164+t1130+t1337+t1338+t1339+t1340+t1348+t1145*
+    const MBPOL_POLY_REAL t4889 = t1163+t1124+t1126+t1164+t1130+t1337+t1338+t1339+t1340+t1348+t1145*
 t126;
-    const double t4893 = t1103+t1104+t1149+t1106+t1152+t1344+t1345+t1359+t1360+t1155*t77+
+    const MBPOL_POLY_REAL t4893 = t1103+t1104+t1149+t1106+t1152+t1344+t1345+t1359+t1360+t1155*t77+
 t1355+t1120*t132;
-    const double t4897 = t1124+t1127+t1162+t1129+t1165+t1337+t1338+t1352+t1353+t1361+t1169*
+    const MBPOL_POLY_REAL t4897 = t1124+t1127+t1162+t1129+t1165+t1337+t1338+t1352+t1353+t1361+t1169*
 t126+t1363+t1145*t136;
-    const double t4899 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1116+t1140+
+    const MBPOL_POLY_REAL t4899 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1116+t1140+
 t1118+t1142+t1371;
-    const double t4901 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1116+t1140+
+    const MBPOL_POLY_REAL t4901 = t1061+t1062+t1082+t1084+t1064+t1367+t1368+t1369+t1370+t1116+t1140+
 t1118+t1142+t1374+t1375;
-    const double t4903 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1116+t1140+
+    const MBPOL_POLY_REAL t4903 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1116+t1140+
 t1118+t1142+t1380+t1381+t1382;
-    const double t4905 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1116+t1140+
+    const MBPOL_POLY_REAL t4905 = t1062+t1083+t1059+t1063+t1085+t1378+t1379+t1369+t1370+t1116+t1140+
 t1118+t1142+t1385+t1386+t1387+t1388;
-    const double t4911 = t1176+t1177+t1178+t1179+t1180+t1391+t1392+t1393+t1394+t1192*t77+
+    const MBPOL_POLY_REAL t4911 = t1176+t1177+t1178+t1179+t1180+t1391+t1392+t1393+t1394+t1192*t77+
 t1194*t126+t1192*t132+t1194*t136+t1399+t1400+t1401+t1402+t1199;
-    const double t4925 = t1264*t275;
-    const double t4926 = t1239+t1240+t1241+t1242+t1243+t1247*t50+t1247*t67+t1244*t72+t1244*
+    const MBPOL_POLY_REAL t4925 = t1264*t275;
+    const MBPOL_POLY_REAL t4926 = t1239+t1240+t1241+t1242+t1243+t1247*t50+t1247*t67+t1244*t72+t1244*
 t73+t1256*t77+t1256*t126+t1256*t132+t1256*t136+t1250*t139+t1250*t145+t1250*t146
 +t1250*t155+t1262+t4925;
-    const double t4933 = t1269+t1271+t1272+t1273+t1274+t1405+t1406+t1407+t1408+t1287*t77+
+    const MBPOL_POLY_REAL t4933 = t1269+t1271+t1272+t1273+t1274+t1405+t1406+t1407+t1408+t1287*t77+
 t1289*t126+t1287*t132+t1289*t136+t1413+t1414+t1415+t1416+t1294+t4925+t1295*t254
 ;
-    const double t4843 = t1120*t77;
-    const double t4864 = t4933*t254;
-    const double t4935 = t991+t996+t1316+t1318+t1322+t1325+t1329+t1332+t1336+(t1150+t1102+
+    const MBPOL_POLY_REAL t4843 = t1120*t77;
+    const MBPOL_POLY_REAL t4864 = t4933*t254;
+    const MBPOL_POLY_REAL t4935 = t991+t996+t1316+t1318+t1322+t1325+t1329+t1332+t1336+(t1150+t1102+
 t1103+t1151+t1107+t1344+t1345+t1346+t1347+t4843)*t77+t4889*t126+t4893*t132+
 t4897*t136+t4899*t139+t4901*t145+t4903*t146+t4905*t155+t4911*t179+t4926*t275+
 t4864;
-    const double t4865 = t480*t5;
-    const double t4944 = (t479+t4865)*t5;
-    const double t4867 = t478+t472+t726;
-    const double t4946 = t4867*t20;
-    const double t4947 = t492*t5;
-    const double t4868 = t485+t479+t4947+t729;
-    const double t4949 = t4868*t26;
-    const double t4951 = t473*t37;
-    const double t4870 = t491+t472+t494+t486*t20+t4951;
-    const double t4953 = t4870*t37;
-    const double t4954 = t505*t37;
-    const double t4955 = t501*t5;
-    const double t4871 = t754+t4954+t500+t753+t4955+t508;
-    const double t4957 = t4871*t50;
-    const double t4958 = t498*t37;
-    const double t4959 = t503*t5;
-    const double t4873 = t747+t500+t4958+t748+t4959+t513+t517;
-    const double t4961 = t4873*t67;
-    const double t4962 = t537*t5;
-    const double t4963 = t535*t37;
-    const double t4874 = t546*t72;
-    const double t4966 = (t741+t534+t4962+t742+t4963+t542+t543+t4874)*t72;
-    const double t4967 = t520*t5;
-    const double t4968 = t522*t37;
-    const double t4878 = t530*t73;
-    const double t4971 = (t524+t4967+t736+t737+t4968+t528+t529+t545+t4878)*t73;
-    const double t4972 = t585*t5;
-    const double t4973 = t587*t37;
-    const double t4976 = t599*t77;
-    const double t4979 = t605*t5;
-    const double t4980 = t603*t37;
-    const double t4981 = t615*t72;
-    const double t4982 = t613*t73;
-    const double t4984 = t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982+t4976+t617*t126;
-    const double t4885 = t584+t4972+t819+t820+t4973+t592+t593+t596*t72+t594*t73+t4976;
-    const double t4887 = t4984*t126;
-    const double t4986 = t471+t4944+t4946+t4949+t4953+t4957+t4961+t4966+t4971+t4885*t77+
+    const MBPOL_POLY_REAL t4865 = t480*t5;
+    const MBPOL_POLY_REAL t4944 = (t479+t4865)*t5;
+    const MBPOL_POLY_REAL t4867 = t478+t472+t726;
+    const MBPOL_POLY_REAL t4946 = t4867*t20;
+    const MBPOL_POLY_REAL t4947 = t492*t5;
+    const MBPOL_POLY_REAL t4868 = t485+t479+t4947+t729;
+    const MBPOL_POLY_REAL t4949 = t4868*t26;
+    const MBPOL_POLY_REAL t4951 = t473*t37;
+    const MBPOL_POLY_REAL t4870 = t491+t472+t494+t486*t20+t4951;
+    const MBPOL_POLY_REAL t4953 = t4870*t37;
+    const MBPOL_POLY_REAL t4954 = t505*t37;
+    const MBPOL_POLY_REAL t4955 = t501*t5;
+    const MBPOL_POLY_REAL t4871 = t754+t4954+t500+t753+t4955+t508;
+    const MBPOL_POLY_REAL t4957 = t4871*t50;
+    const MBPOL_POLY_REAL t4958 = t498*t37;
+    const MBPOL_POLY_REAL t4959 = t503*t5;
+    const MBPOL_POLY_REAL t4873 = t747+t500+t4958+t748+t4959+t513+t517;
+    const MBPOL_POLY_REAL t4961 = t4873*t67;
+    const MBPOL_POLY_REAL t4962 = t537*t5;
+    const MBPOL_POLY_REAL t4963 = t535*t37;
+    const MBPOL_POLY_REAL t4874 = t546*t72;
+    const MBPOL_POLY_REAL t4966 = (t741+t534+t4962+t742+t4963+t542+t543+t4874)*t72;
+    const MBPOL_POLY_REAL t4967 = t520*t5;
+    const MBPOL_POLY_REAL t4968 = t522*t37;
+    const MBPOL_POLY_REAL t4878 = t530*t73;
+    const MBPOL_POLY_REAL t4971 = (t524+t4967+t736+t737+t4968+t528+t529+t545+t4878)*t73;
+    const MBPOL_POLY_REAL t4972 = t585*t5;
+    const MBPOL_POLY_REAL t4973 = t587*t37;
+    const MBPOL_POLY_REAL t4976 = t599*t77;
+    const MBPOL_POLY_REAL t4979 = t605*t5;
+    const MBPOL_POLY_REAL t4980 = t603*t37;
+    const MBPOL_POLY_REAL t4981 = t615*t72;
+    const MBPOL_POLY_REAL t4982 = t613*t73;
+    const MBPOL_POLY_REAL t4984 = t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982+t4976+t617*t126;
+    const MBPOL_POLY_REAL t4885 = t584+t4972+t819+t820+t4973+t592+t593+t596*t72+t594*t73+t4976;
+    const MBPOL_POLY_REAL t4887 = t4984*t126;
+    const MBPOL_POLY_REAL t4986 = t471+t4944+t4946+t4949+t4953+t4957+t4961+t4966+t4971+t4885*t77+
 t4887;
-    const double t4888 = t8+t2+t9;
-    const double t4890 = t4888*t20;
-    const double t4892 = (t12+t14+t16+t18)*t26;
-    const double t4895 = t21*t26+t12+t23+t24+t25;
-    const double t4896 = t4895*t37;
-    const double t4898 = t29+t30+t31+t32+t33+t35;
-    const double t4900 = t4898*t50;
-    const double t4902 = t45*t67;
-    const double t4906 = (t39+t40+t41+t43+t44+t35+t4902)*t67;
-    const double t4915 = t720*t20;
-    const double t4917 = (t719+t716+t4915)*t20;
-    const double t4924 = t1303+t1305+t1307;
-    const double t4927 = t4924*t20;
-    const double t4928 = t720*t26;
-    const double t4930 = (t719+t1307+t716+t4928)*t26;
-    const double t4941 = t720*t5;
-    const double t4943 = (t719+t4941)*t5;
-    const double t4988 = (t1+t6+t4890+t4892+t4896+t4900+t4906)*t67+(t257+t468)*t475+t621*
+    const MBPOL_POLY_REAL t4888 = t8+t2+t9;
+    const MBPOL_POLY_REAL t4890 = t4888*t20;
+    const MBPOL_POLY_REAL t4892 = (t12+t14+t16+t18)*t26;
+    const MBPOL_POLY_REAL t4895 = t21*t26+t12+t23+t24+t25;
+    const MBPOL_POLY_REAL t4896 = t4895*t37;
+    const MBPOL_POLY_REAL t4898 = t29+t30+t31+t32+t33+t35;
+    const MBPOL_POLY_REAL t4900 = t4898*t50;
+    const MBPOL_POLY_REAL t4902 = t45*t67;
+    const MBPOL_POLY_REAL t4906 = (t39+t40+t41+t43+t44+t35+t4902)*t67;
+    const MBPOL_POLY_REAL t4915 = t720*t20;
+    const MBPOL_POLY_REAL t4917 = (t719+t716+t4915)*t20;
+    const MBPOL_POLY_REAL t4924 = t1303+t1305+t1307;
+    const MBPOL_POLY_REAL t4927 = t4924*t20;
+    const MBPOL_POLY_REAL t4928 = t720*t26;
+    const MBPOL_POLY_REAL t4930 = (t719+t1307+t716+t4928)*t26;
+    const MBPOL_POLY_REAL t4941 = t720*t5;
+    const MBPOL_POLY_REAL t4943 = (t719+t4941)*t5;
+    const MBPOL_POLY_REAL t4988 = (t1+t6+t4890+t4892+t4896+t4900+t4906)*t67+(t257+t468)*t475+t621*
 t136+(t633+t710)*t309+(t713+t718+t4917)*t20+t840*t155+t989*t179+(t1081+t1300)*
 t215+(t713+t718+t4927+t4930)*t26+t1420*t275+(t2406+t3150)*t2341+(t4191+t4882)*
 t4135+t4935*t254+(t713+t4943)*t5+t4986*t126;
-    const double t4952 = t17*t5;
-    const double t4991 = (t12+t4952)*t5;
-    const double t4992 = t21*t5;
-    const double t4993 = t17*t20;
-    const double t4996 = t3*t26;
-    const double t5000 = t3*t37;
-    const double t5003 = t42*t5;
-    const double t5004 = t42*t20;
-    const double t5005 = t38*t26;
-    const double t5006 = t38*t37;
-    const double t5012 = t580*t77;
-    const double t5015 = t562*t126;
-    const double t5016 = t551+t552+t553+t554+t555+t557+t558+t560+t561+t579+t5015;
-    const double t5019 = t604+t606+t607+t608+t609+t611+t612+t614+t616+t5012+t5015+t617*t132;
-    const double t4964 = t566+t568+t569+t570+t571+t573+t574+t576+t577+t5012;
-    const double t4970 = t5019*t132;
-    const double t5021 = t471+t476+t483+t490+t497+t510+t519+t533+t549+t4964*t77+t5016*t126+
+    const MBPOL_POLY_REAL t4952 = t17*t5;
+    const MBPOL_POLY_REAL t4991 = (t12+t4952)*t5;
+    const MBPOL_POLY_REAL t4992 = t21*t5;
+    const MBPOL_POLY_REAL t4993 = t17*t20;
+    const MBPOL_POLY_REAL t4996 = t3*t26;
+    const MBPOL_POLY_REAL t5000 = t3*t37;
+    const MBPOL_POLY_REAL t5003 = t42*t5;
+    const MBPOL_POLY_REAL t5004 = t42*t20;
+    const MBPOL_POLY_REAL t5005 = t38*t26;
+    const MBPOL_POLY_REAL t5006 = t38*t37;
+    const MBPOL_POLY_REAL t5012 = t580*t77;
+    const MBPOL_POLY_REAL t5015 = t562*t126;
+    const MBPOL_POLY_REAL t5016 = t551+t552+t553+t554+t555+t557+t558+t560+t561+t579+t5015;
+    const MBPOL_POLY_REAL t5019 = t604+t606+t607+t608+t609+t611+t612+t614+t616+t5012+t5015+t617*t132;
+    const MBPOL_POLY_REAL t4964 = t566+t568+t569+t570+t571+t573+t574+t576+t577+t5012;
+    const MBPOL_POLY_REAL t4970 = t5019*t132;
+    const MBPOL_POLY_REAL t5021 = t471+t476+t483+t490+t497+t510+t519+t533+t549+t4964*t77+t5016*t126+
 t4970;
-    const double t4974 = t479+t4947+t481;
-    const double t5024 = t4974*t20;
-    const double t4975 = t478+t472+t485+t488;
-    const double t5026 = t4975*t26;
-    const double t4978 = t732+t491+t472+t486*t26+t4951;
-    const double t5029 = t4978*t37;
-    const double t4983 = t546*t50;
-    const double t5032 = (t534+t4962+t538+t539+t4963+t4983)*t50;
-    const double t4987 = t530*t67;
-    const double t5035 = (t524+t4967+t521+t525+t4968+t743+t4987)*t67;
-    const double t4990 = t516+t4955+t529+t4954+t542+t511+t500+t749;
-    const double t5037 = t4990*t72;
-    const double t4994 = t4958+t506+t542+t500+t529+t502+t752+t4959+t755;
-    const double t5039 = t4994*t73;
-    const double t5040 = t760*t5;
-    const double t5041 = t758*t37;
-    const double t5042 = t768*t50;
-    const double t5043 = t766*t67;
-    const double t4995 = t762+t782+t5040+t783+t5041+t5042+t5043+t770+t771+t773;
-    const double t5045 = t4995*t77;
-    const double t5046 = t762+t782+t5040+t783+t5041+t5042+t5043+t770+t771+t777+t778;
-    const double t5047 = t5046*t126;
-    const double t5048 = t760*t20;
-    const double t5049 = t758*t26;
-    const double t5050 = t762+t764+t5048+t5049+t765+t5042+t5043+t785+t786+t788+t790+t791;
-    const double t5051 = t5050*t132;
-    const double t5052 = t762+t764+t5048+t5049+t765+t5042+t5043+t785+t786+t794+t795+t796+
+    const MBPOL_POLY_REAL t4974 = t479+t4947+t481;
+    const MBPOL_POLY_REAL t5024 = t4974*t20;
+    const MBPOL_POLY_REAL t4975 = t478+t472+t485+t488;
+    const MBPOL_POLY_REAL t5026 = t4975*t26;
+    const MBPOL_POLY_REAL t4978 = t732+t491+t472+t486*t26+t4951;
+    const MBPOL_POLY_REAL t5029 = t4978*t37;
+    const MBPOL_POLY_REAL t4983 = t546*t50;
+    const MBPOL_POLY_REAL t5032 = (t534+t4962+t538+t539+t4963+t4983)*t50;
+    const MBPOL_POLY_REAL t4987 = t530*t67;
+    const MBPOL_POLY_REAL t5035 = (t524+t4967+t521+t525+t4968+t743+t4987)*t67;
+    const MBPOL_POLY_REAL t4990 = t516+t4955+t529+t4954+t542+t511+t500+t749;
+    const MBPOL_POLY_REAL t5037 = t4990*t72;
+    const MBPOL_POLY_REAL t4994 = t4958+t506+t542+t500+t529+t502+t752+t4959+t755;
+    const MBPOL_POLY_REAL t5039 = t4994*t73;
+    const MBPOL_POLY_REAL t5040 = t760*t5;
+    const MBPOL_POLY_REAL t5041 = t758*t37;
+    const MBPOL_POLY_REAL t5042 = t768*t50;
+    const MBPOL_POLY_REAL t5043 = t766*t67;
+    const MBPOL_POLY_REAL t4995 = t762+t782+t5040+t783+t5041+t5042+t5043+t770+t771+t773;
+    const MBPOL_POLY_REAL t5045 = t4995*t77;
+    const MBPOL_POLY_REAL t5046 = t762+t782+t5040+t783+t5041+t5042+t5043+t770+t771+t777+t778;
+    const MBPOL_POLY_REAL t5047 = t5046*t126;
+    const MBPOL_POLY_REAL t5048 = t760*t20;
+    const MBPOL_POLY_REAL t5049 = t758*t26;
+    const MBPOL_POLY_REAL t5050 = t762+t764+t5048+t5049+t765+t5042+t5043+t785+t786+t788+t790+t791;
+    const MBPOL_POLY_REAL t5051 = t5050*t132;
+    const MBPOL_POLY_REAL t5052 = t762+t764+t5048+t5049+t765+t5042+t5043+t785+t786+t794+t795+t796+
 t797;
-    const double t5053 = t5052*t136;
-    const double t5054 = t615*t50;
-    const double t5055 = t613*t67;
-    const double t5057 = t607+t4979+t606+t608+t4980+t5054+t5055+t835+t836+t773+t778+t791+
+    const MBPOL_POLY_REAL t5053 = t5052*t136;
+    const MBPOL_POLY_REAL t5054 = t615*t50;
+    const MBPOL_POLY_REAL t5055 = t613*t67;
+    const MBPOL_POLY_REAL t5057 = t607+t4979+t606+t608+t4980+t5054+t5055+t835+t836+t773+t778+t791+
 t797+t617*t139;
-    const double t4998 = t5057*t139;
-    const double t5059 = t471+t4944+t5024+t5026+t5029+t5032+t5035+t5037+t5039+t5045+t5047+
+    const MBPOL_POLY_REAL t4998 = t5057*t139;
+    const MBPOL_POLY_REAL t5059 = t471+t4944+t5024+t5026+t5029+t5032+t5035+t5037+t5039+t5045+t5047+
 t5051+t5053+t4998;
-    const double t5061 = t2493*t77;
-    const double t5062 = t2476*t126;
-    const double t5063 = t2493*t132;
-    const double t5064 = t2509+t2507+t2510+t2511+t2512+t2489+t2488+t2486+t2492+t5061+t5062+
+    const MBPOL_POLY_REAL t5061 = t2493*t77;
+    const MBPOL_POLY_REAL t5062 = t2476*t126;
+    const MBPOL_POLY_REAL t5063 = t2493*t132;
+    const MBPOL_POLY_REAL t5064 = t2509+t2507+t2510+t2511+t2512+t2489+t2488+t2486+t2492+t5061+t5062+
 t5063;
-    const double t5065 = t2476*t136;
-    const double t5066 = t2499*t275;
-    const double t5067 = t2497*t254;
-    const double t5068 = t3009*t143;
-    const double t5069 = t2490*t309;
-    const double t5070 = t5065+t3011+t3012+t3013+t3015+t2514+t5066+t5067+t3006+t3007+t5068+
+    const MBPOL_POLY_REAL t5065 = t2476*t136;
+    const MBPOL_POLY_REAL t5066 = t2499*t275;
+    const MBPOL_POLY_REAL t5067 = t2497*t254;
+    const MBPOL_POLY_REAL t5068 = t3009*t143;
+    const MBPOL_POLY_REAL t5069 = t2490*t309;
+    const MBPOL_POLY_REAL t5070 = t5065+t3011+t3012+t3013+t3015+t2514+t5066+t5067+t3006+t3007+t5068+
 t5069;
-    const double t5078 = t3121+t3123+t3124+t3125+t3126+t3128+t3129+t3131+t3132+t3135*t77+
+    const MBPOL_POLY_REAL t5078 = t3121+t3123+t3124+t3125+t3126+t3128+t3129+t3131+t3132+t3135*t77+
 t3133*t126+t3135*t132+t3133*t136+t3140+t3141+t3142+t3143+t3145+t2561+t3146*t254
 ;
-    const double t5082 = t1885+t1444+t1886+t1887+t1888+t1448+t1449+t1889+t1890+t1892*t77+
+    const MBPOL_POLY_REAL t5082 = t1885+t1444+t1886+t1887+t1888+t1448+t1449+t1889+t1890+t1892*t77+
 t1860+t1456*t132;
-    const double t5084 = t1914*t77;
-    const double t5085 = t1912*t126;
-    const double t5086 = t1914*t132;
-    const double t5087 = t1912*t136;
-    const double t5088 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t5084+t5085+
+    const MBPOL_POLY_REAL t5084 = t1914*t77;
+    const MBPOL_POLY_REAL t5085 = t1912*t126;
+    const MBPOL_POLY_REAL t5086 = t1914*t132;
+    const MBPOL_POLY_REAL t5087 = t1912*t136;
+    const MBPOL_POLY_REAL t5088 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t5084+t5085+
 t5086+t5087+t2461+t2462;
-    const double t5092 = t2622+t2845+t2624+t2846+t2628+t2933+t2934+t2935+t2936+t2664+t2642*
+    const MBPOL_POLY_REAL t5092 = t2622+t2845+t2624+t2846+t2628+t2933+t2934+t2935+t2936+t2664+t2642*
 t126+t2668+t2646*t136;
-    const double t5093 = t5092*t136;
-    const double t5094 = t2921*t77;
-    const double t5095 = t2919*t126;
-    const double t5096 = t2921*t132;
-    const double t5097 = t2919*t136;
-    const double t5098 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t5094+t5095+
+    const MBPOL_POLY_REAL t5093 = t5092*t136;
+    const MBPOL_POLY_REAL t5094 = t2921*t77;
+    const MBPOL_POLY_REAL t5095 = t2919*t126;
+    const MBPOL_POLY_REAL t5096 = t2921*t132;
+    const MBPOL_POLY_REAL t5097 = t2919*t136;
+    const MBPOL_POLY_REAL t5098 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t5094+t5095+
 t5096+t5097+t3073+t3074+t3075+t3076+t2930;
-    const double t5100 = t2695*t126;
-    const double t5101 = t2697*t77;
-    const double t5102 = t2710*t254;
-    const double t5103 = t2712*t275;
-    const double t5104 = t2697*t132;
-    const double t5105 = t2695*t136;
-    const double t5106 = t5100+t5101+t5102+t5103+t5104+t5105+t2892+t2893+t2683+t2685+t2686+
+    const MBPOL_POLY_REAL t5100 = t2695*t126;
+    const MBPOL_POLY_REAL t5101 = t2697*t77;
+    const MBPOL_POLY_REAL t5102 = t2710*t254;
+    const MBPOL_POLY_REAL t5103 = t2712*t275;
+    const MBPOL_POLY_REAL t5104 = t2697*t132;
+    const MBPOL_POLY_REAL t5105 = t2695*t136;
+    const MBPOL_POLY_REAL t5106 = t5100+t5101+t5102+t5103+t5104+t5105+t2892+t2893+t2683+t2685+t2686+
 t2687;
-    const double t5107 = t2688+t2690+t2691+t2693+t2694+t3023+t3024+t3025+t3026+t2709+t3027+
+    const MBPOL_POLY_REAL t5107 = t2688+t2690+t2691+t2693+t2694+t3023+t3024+t3025+t3026+t2709+t3027+
 t3028+t3083;
-    const double t5014 = t2669*t77;
-    const double t5112 = (t2654+t2673+t2674+t2675+t2676+t2658+t2659+t2677+t2678+t5014)*t77;
-    const double t5115 = t2651+t2653+t2654+t2655+t2656+t2658+t2659+t2661+t2663+t2665*t77+
+    const MBPOL_POLY_REAL t5014 = t2669*t77;
+    const MBPOL_POLY_REAL t5112 = (t2654+t2673+t2674+t2675+t2676+t2658+t2659+t2677+t2678+t5014)*t77;
+    const MBPOL_POLY_REAL t5115 = t2651+t2653+t2654+t2655+t2656+t2658+t2659+t2661+t2663+t2665*t77+
 t2938+t2669*t132;
-    const double t5116 = t5115*t132;
-    const double t5118 = t2622+t2844+t2625+t2627+t2847+t2933+t2934+t2942+t2943+t2679+t2646*
+    const MBPOL_POLY_REAL t5116 = t5115*t132;
+    const MBPOL_POLY_REAL t5118 = t2622+t2844+t2625+t2627+t2847+t2933+t2934+t2942+t2943+t2679+t2646*
 t126;
-    const double t5119 = t5118*t126;
-    const double t5120 = t2873*t77;
-    const double t5122 = t2871*t126;
-    const double t5123 = t2873*t132;
-    const double t5124 = t2871*t136;
-    const double t5125 = t2967*t275;
-    const double t5126 = t5122+t5123+t5124+t3038+t3039+t3040+t3041+t2878+t5125+t2596+t3042;
-    const double t5129 = t2704*t77;
-    const double t5130 = t2702*t126;
-    const double t5131 = t2704*t132;
-    const double t5132 = t2683+t2685+t2686+t2687+t2688+t2904+t2885+t2903+t2886+t5129+t5130+
+    const MBPOL_POLY_REAL t5119 = t5118*t126;
+    const MBPOL_POLY_REAL t5120 = t2873*t77;
+    const MBPOL_POLY_REAL t5122 = t2871*t126;
+    const MBPOL_POLY_REAL t5123 = t2873*t132;
+    const MBPOL_POLY_REAL t5124 = t2871*t136;
+    const MBPOL_POLY_REAL t5125 = t2967*t275;
+    const MBPOL_POLY_REAL t5126 = t5122+t5123+t5124+t3038+t3039+t3040+t3041+t2878+t5125+t2596+t3042;
+    const MBPOL_POLY_REAL t5129 = t2704*t77;
+    const MBPOL_POLY_REAL t5130 = t2702*t126;
+    const MBPOL_POLY_REAL t5131 = t2704*t132;
+    const MBPOL_POLY_REAL t5132 = t2683+t2685+t2686+t2687+t2688+t2904+t2885+t2903+t2886+t5129+t5130+
 t5131;
-    const double t5133 = t2702*t136;
-    const double t5134 = t2716*t275;
-    const double t5135 = t2714*t254;
-    const double t5136 = t5133+t3069+t3066+t3068+t3061+t2709+t5134+t5135+t3064+t3065+t3083+
+    const MBPOL_POLY_REAL t5133 = t2702*t136;
+    const MBPOL_POLY_REAL t5134 = t2716*t275;
+    const MBPOL_POLY_REAL t5135 = t2714*t254;
+    const MBPOL_POLY_REAL t5136 = t5133+t3069+t3066+t3068+t3061+t2709+t5134+t5135+t3064+t3065+t3083+
 t2721;
-    const double t5139 = t2771*t77;
-    const double t5140 = t2771*t132;
-    const double t5141 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t5139+t2639+
+    const MBPOL_POLY_REAL t5139 = t2771*t77;
+    const MBPOL_POLY_REAL t5140 = t2771*t132;
+    const MBPOL_POLY_REAL t5141 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t5139+t2639+
 t5140+t2641+t3033+t2645+t3034;
-    const double t5143 = t2794*t77;
-    const double t5144 = t2796*t126;
-    const double t5145 = t2781+t2783+t2784+t2804+t2805+t2791+t2806+t2807+t2808+t5143+t5144;
-    const double t5146 = t2794*t132;
-    const double t5147 = t2796*t136;
-    const double t5148 = t2792*t275;
-    const double t5149 = t2799*t254;
-    const double t5151 = t5146+t5147+t3087+t3084+t3088+t3085+t2802+t5148+t5149+t3086+t3080+
+    const MBPOL_POLY_REAL t5143 = t2794*t77;
+    const MBPOL_POLY_REAL t5144 = t2796*t126;
+    const MBPOL_POLY_REAL t5145 = t2781+t2783+t2784+t2804+t2805+t2791+t2806+t2807+t2808+t5143+t5144;
+    const MBPOL_POLY_REAL t5146 = t2794*t132;
+    const MBPOL_POLY_REAL t5147 = t2796*t136;
+    const MBPOL_POLY_REAL t5148 = t2792*t275;
+    const MBPOL_POLY_REAL t5149 = t2799*t254;
+    const MBPOL_POLY_REAL t5151 = t5146+t5147+t3087+t3084+t3088+t3085+t2802+t5148+t5149+t3086+t3080+
 t2815*t143;
-    const double t5027 = t5106+t5107;
-    const double t5030 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t5120+t5126;
-    const double t5033 = t5132+t5136;
-    const double t5038 = t5145+t5151;
-    const double t5154 = t5093+t5098*t179+t2612+t2621+t5027*t240+t5112+t5116+t5119+t5030*
+    const MBPOL_POLY_REAL t5027 = t5106+t5107;
+    const MBPOL_POLY_REAL t5030 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t5120+t5126;
+    const MBPOL_POLY_REAL t5033 = t5132+t5136;
+    const MBPOL_POLY_REAL t5038 = t5145+t5151;
+    const MBPOL_POLY_REAL t5154 = t5093+t5098*t179+t2612+t2621+t5027*t240+t5112+t5116+t5119+t5030*
 t212+t5033*t309+t5141*t146+t5038*t143;
-    const double t5155 = t2636*t126;
-    const double t5156 = t2636*t136;
-    const double t5157 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2770+t5155+
+    const MBPOL_POLY_REAL t5155 = t2636*t126;
+    const MBPOL_POLY_REAL t5156 = t2636*t136;
+    const MBPOL_POLY_REAL t5157 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2770+t5155+
 t2773+t5156+t2775+t3046+t2777+t3047;
-    const double t5160 = t2751*t275;
-    const double t5161 = t2749*t254;
-    const double t5162 = t2718*t240;
-    const double t5163 = t2725+t3060+t2729+t2755*t475+t5160+t5161+t5162+t2733+t2734+t3100+
+    const MBPOL_POLY_REAL t5160 = t2751*t275;
+    const MBPOL_POLY_REAL t5161 = t2749*t254;
+    const MBPOL_POLY_REAL t5162 = t2718*t240;
+    const MBPOL_POLY_REAL t5163 = t2725+t3060+t2729+t2755*t475+t5160+t5161+t5162+t2733+t2734+t3100+
 t3101+t3102+t2748;
-    const double t5164 = t2736*t136;
-    const double t5165 = t2738*t132;
-    const double t5166 = t2736*t126;
-    const double t5167 = t2738*t77;
-    const double t5168 = t3103+t3104+t2735+t5164+t5165+t5166+t5167+t2788+t3099+t2728+t2727+
+    const MBPOL_POLY_REAL t5164 = t2736*t136;
+    const MBPOL_POLY_REAL t5165 = t2738*t132;
+    const MBPOL_POLY_REAL t5166 = t2736*t126;
+    const MBPOL_POLY_REAL t5167 = t2738*t77;
+    const MBPOL_POLY_REAL t5168 = t3103+t3104+t2735+t5164+t5165+t5166+t5167+t2788+t3099+t2728+t2727+
 t2730+t2732;
-    const double t5171 = t2867*t77;
-    const double t5172 = t2865*t126;
-    const double t5173 = t2867*t132;
-    const double t5174 = t2865*t136;
-    const double t5175 = t2881*t275;
-    const double t5176 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t5171+t5172+
+    const MBPOL_POLY_REAL t5171 = t2867*t77;
+    const MBPOL_POLY_REAL t5172 = t2865*t126;
+    const MBPOL_POLY_REAL t5173 = t2867*t132;
+    const MBPOL_POLY_REAL t5174 = t2865*t136;
+    const MBPOL_POLY_REAL t5175 = t2881*t275;
+    const MBPOL_POLY_REAL t5176 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t5171+t5172+
 t5173+t5174+t3092+t3093+t3094+t3095+t2878+t5175;
-    const double t5178 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t5139+t2639+
+    const MBPOL_POLY_REAL t5178 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t5139+t2639+
 t5140+t2641+t3057;
-    const double t5180 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2770+t5155+
+    const MBPOL_POLY_REAL t5180 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2770+t5155+
 t2773+t5156+t2949+t3019;
-    const double t5182 = t2587*t77;
-    const double t5183 = t2585*t126;
-    const double t5184 = t2587*t132;
-    const double t5185 = t2585*t136;
-    const double t5186 = t2597*t254;
-    const double t5187 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t5182+t5183+
+    const MBPOL_POLY_REAL t5182 = t2587*t77;
+    const MBPOL_POLY_REAL t5183 = t2585*t126;
+    const MBPOL_POLY_REAL t5184 = t2587*t132;
+    const MBPOL_POLY_REAL t5185 = t2585*t136;
+    const MBPOL_POLY_REAL t5186 = t2597*t254;
+    const MBPOL_POLY_REAL t5187 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t5182+t5183+
 t5184+t5185+t3051+t3052+t3053+t3054+t2592+t2880+t5186;
-    const double t5189 = t2581*t77;
-    const double t5190 = t2578*t126;
-    const double t5191 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t5189+t5190;
-    const double t5192 = t2581*t132;
-    const double t5193 = t2578*t136;
-    const double t5194 = t2593*t254;
-    const double t5195 = t5192+t5193+t3110+t3111+t3112+t3113+t2592+t2966+t5194+t2969+t3114;
-    const double t5060 = t5163+t5168;
-    const double t5076 = t5191+t5195;
-    const double t5198 = t5157*t155+t5060*t475+t2765+t5176*t275+t5178*t139+t2830+t2835+t2839
+    const MBPOL_POLY_REAL t5189 = t2581*t77;
+    const MBPOL_POLY_REAL t5190 = t2578*t126;
+    const MBPOL_POLY_REAL t5191 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t5189+t5190;
+    const MBPOL_POLY_REAL t5192 = t2581*t132;
+    const MBPOL_POLY_REAL t5193 = t2578*t136;
+    const MBPOL_POLY_REAL t5194 = t2593*t254;
+    const MBPOL_POLY_REAL t5195 = t5192+t5193+t3110+t3111+t3112+t3113+t2592+t2966+t5194+t2969+t3114;
+    const MBPOL_POLY_REAL t5060 = t5163+t5168;
+    const MBPOL_POLY_REAL t5076 = t5191+t5195;
+    const MBPOL_POLY_REAL t5198 = t5157*t155+t5060*t475+t2765+t5176*t275+t5178*t139+t2830+t2835+t2839
 +t2843+t5180*t145+t5187*t254+t5076*t215+t2976;
-    const double t5205 = t2435+t2436+t2437+t2438+t2439+t2441+t2442+t2444+t2445+t2448*t77+
+    const MBPOL_POLY_REAL t5205 = t2435+t2436+t2437+t2438+t2439+t2441+t2442+t2444+t2445+t2448*t77+
 t2446*t126+t2448*t132+t2446*t136+t2453+t2454+t2455+t2456+t2458;
-    const double t5212 = t2535+t2537+t2538+t2539+t2540+t2542+t2543+t2545+t2546+t2549*t77+
+    const MBPOL_POLY_REAL t5212 = t2535+t2537+t2538+t2539+t2540+t2542+t2543+t2545+t2546+t2549*t77+
 t2547*t126+t2549*t132+t2547*t136+t2554+t2555+t2556+t2557+t2559+t2562*t275;
-    const double t5217 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t5084+t5085+
+    const MBPOL_POLY_REAL t5217 = t1900+t2407+t2408+t2409+t2410+t2411+t2412+t1910+t1911+t5084+t5085+
 t5086+t5087+t2413;
-    const double t5220 = t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+t1435+t1455+t1436*
+    const MBPOL_POLY_REAL t5220 = t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+t1435+t1455+t1436*
 t126;
-    const double t5222 = t1497*t475;
-    const double t5223 = t1472*t136;
-    const double t5224 = t1489*t275;
-    const double t5226 = t1487*t254;
-    const double t5227 = t1472*t126;
-    const double t5228 = t1474*t77;
-    const double t5229 = t5222+t3005+t1467+t1468+t1470+t1480+t1460+t5223+t5224+t1495*t240+
+    const MBPOL_POLY_REAL t5222 = t1497*t475;
+    const MBPOL_POLY_REAL t5223 = t1472*t136;
+    const MBPOL_POLY_REAL t5224 = t1489*t275;
+    const MBPOL_POLY_REAL t5226 = t1487*t254;
+    const MBPOL_POLY_REAL t5227 = t1472*t126;
+    const MBPOL_POLY_REAL t5228 = t1474*t77;
+    const MBPOL_POLY_REAL t5229 = t5222+t3005+t1467+t1468+t1470+t1480+t1460+t5223+t5224+t1495*t240+
 t5226+t5227+t5228;
-    const double t5230 = t1474*t132;
-    const double t5231 = t1471+t3008+t5230+t1482+t1483+t1492+t1494+t1484+t1486+t1462+t1463+
+    const MBPOL_POLY_REAL t5230 = t1474*t132;
+    const MBPOL_POLY_REAL t5231 = t1471+t3008+t5230+t1482+t1483+t1492+t1494+t1484+t1486+t1462+t1463+
 t1464+t1465;
-    const double t5111 = t5064+t5070;
-    const double t5127 = t5154+t5198;
-    const double t5142 = t1456*t77;
-    const double t5159 = t5229+t5231;
-    const double t5234 = t5111*t309+t1850+t5078*t254+t5082*t132+t1877+t5088*t145+t5127*t3120
+    const MBPOL_POLY_REAL t5111 = t5064+t5070;
+    const MBPOL_POLY_REAL t5127 = t5154+t5198;
+    const MBPOL_POLY_REAL t5142 = t1456*t77;
+    const MBPOL_POLY_REAL t5159 = t5229+t5231;
+    const MBPOL_POLY_REAL t5234 = t5111*t309+t1850+t5078*t254+t5082*t132+t1877+t5088*t145+t5127*t3120
 +t5205*t179+t5212*t275+t1884+(t1441+t1443+t1444+t1445+t1446+t1448+t1449+t1451+
 t1453+t5142)*t77+t5217*t139+t5220*t126+t5159*t475;
-    const double t5235 = t1957*t77;
-    const double t5236 = t1954*t126;
-    const double t5237 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t5235+t5236;
-    const double t5238 = t1957*t132;
-    const double t5239 = t1954*t136;
-    const double t5240 = t1971*t275;
-    const double t5241 = t1969*t254;
-    const double t5242 = t5238+t5239+t2466+t2467+t2468+t2469+t1968+t5240+t5241+t2471+t2472;
-    const double t5245 = t1497*t240;
-    const double t5246 = t5245+t2481+t1467+t1468+t1470+t1460+t5223+t5224+t5226+t5227+t5228+
+    const MBPOL_POLY_REAL t5235 = t1957*t77;
+    const MBPOL_POLY_REAL t5236 = t1954*t126;
+    const MBPOL_POLY_REAL t5237 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t5235+t5236;
+    const MBPOL_POLY_REAL t5238 = t1957*t132;
+    const MBPOL_POLY_REAL t5239 = t1954*t136;
+    const MBPOL_POLY_REAL t5240 = t1971*t275;
+    const MBPOL_POLY_REAL t5241 = t1969*t254;
+    const MBPOL_POLY_REAL t5242 = t5238+t5239+t2466+t2467+t2468+t2469+t1968+t5240+t5241+t2471+t2472;
+    const MBPOL_POLY_REAL t5245 = t1497*t240;
+    const MBPOL_POLY_REAL t5246 = t5245+t2481+t1467+t1468+t1470+t1460+t5223+t5224+t5226+t5227+t5228+
 t1471;
-    const double t5247 = t5230+t2424+t2425+t2426+t2427+t2428+t2429+t1486+t2516+t1462+t1463+
+    const MBPOL_POLY_REAL t5247 = t5230+t2424+t2425+t2426+t2427+t2428+t2429+t1486+t2516+t1462+t1463+
 t1464+t1465;
-    const double t5252 = t1851+t1852+t1424+t1853+t1854+t1430+t1431+t1855+t1856+t1891+t1857*
+    const MBPOL_POLY_REAL t5252 = t1851+t1852+t1424+t1853+t1854+t1430+t1431+t1855+t1856+t1891+t1857*
 t126+t1894+t1436*t136;
-    const double t5254 = t2509+t2507+t2510+t2511+t2512+t2489+t2488+t2486+t2492+t5061+t5062;
-    const double t5255 = t2490*t143;
-    const double t5256 = t5063+t5065+t2482+t2484+t2479+t2495+t2514+t5066+t5067+t2504+t2506+
+    const MBPOL_POLY_REAL t5254 = t2509+t2507+t2510+t2511+t2512+t2489+t2488+t2486+t2492+t5061+t5062;
+    const MBPOL_POLY_REAL t5255 = t2490*t143;
+    const MBPOL_POLY_REAL t5256 = t5063+t5065+t2482+t2484+t2479+t2495+t2514+t5066+t5067+t2504+t2506+
 t5255;
-    const double t5260 = t5190+t5192+t5193+t2586+t2588+t2589+t2590+t2592+t2966+t5194+t2598;
-    const double t5263 = t3062+t3063+t5100+t5101+t5102+t5103+t5104+t5105+t2683+t2685+t2686+
+    const MBPOL_POLY_REAL t5260 = t5190+t5192+t5193+t2586+t2588+t2589+t2590+t2592+t2966+t5194+t2598;
+    const MBPOL_POLY_REAL t5263 = t3062+t3063+t5100+t5101+t5102+t5103+t5104+t5105+t2683+t2685+t2686+
 t2687+t2688;
-    const double t5264 = t2690+t2691+t2693+t2694+t5162+t2786+t2709+t2703+t2705+t2706+t2707+
+    const MBPOL_POLY_REAL t5264 = t2690+t2691+t2693+t2694+t5162+t2786+t2709+t2703+t2705+t2706+t2707+
 t2715+t2717;
-    const double t5267 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t5139+t2639+
+    const MBPOL_POLY_REAL t5267 = t2651+t2654+t2674+t2675+t2656+t2766+t2767+t2768+t2769+t5139+t2639+
 t5140+t2641+t2775+t2776+t2777+t2778;
-    const double t5269 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t5094+t5095+
+    const MBPOL_POLY_REAL t5269 = t2909+t2910+t2911+t2912+t2913+t2915+t2916+t2917+t2918+t5094+t5095+
 t5096+t5097+t2925+t2926+t2927+t2928+t2930;
-    const double t5271 = t2683+t2685+t2686+t2687+t2688+t2904+t2885+t2903+t2886+t5129+t5130;
-    const double t5272 = t5131+t5133+t2894+t2890+t2887+t2895+t2709+t5134+t5135+t2889+t2888+
+    const MBPOL_POLY_REAL t5271 = t2683+t2685+t2686+t2687+t2688+t2904+t2885+t2903+t2886+t5129+t5130;
+    const MBPOL_POLY_REAL t5272 = t5131+t5133+t2894+t2890+t2887+t2895+t2709+t5134+t5135+t2889+t2888+
 t3029;
-    const double t5275 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t5171+t5172+
+    const MBPOL_POLY_REAL t5275 = t2854+t2855+t2856+t2857+t2858+t2860+t2861+t2863+t2864+t5171+t5172+
 t5173+t5174+t2872+t2874+t2875+t2876+t2878+t5175;
-    const double t5179 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t5189+t5260;
-    const double t5188 = t5263+t5264;
-    const double t5200 = t5271+t5272;
-    const double t5277 = t5093+t2612+t2621+t5179*t212+t5188*t475+t5267*t155+t5269*t179+t5112
+    const MBPOL_POLY_REAL t5179 = t2567+t2568+t2569+t2570+t2571+t2573+t2574+t2576+t2577+t5189+t5260;
+    const MBPOL_POLY_REAL t5188 = t5263+t5264;
+    const MBPOL_POLY_REAL t5200 = t5271+t5272;
+    const MBPOL_POLY_REAL t5277 = t5093+t2612+t2621+t5179*t212+t5188*t475+t5267*t155+t5269*t179+t5112
 +t5200*t143+t5275*t275+t5116+t5119;
-    const double t5278 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2770+t5155+
+    const MBPOL_POLY_REAL t5278 = t2622+t2844+t2845+t2846+t2847+t2848+t2849+t2634+t2635+t2770+t5155+
 t2773+t5156+t2850;
-    const double t5280 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t5139+t2639+
+    const MBPOL_POLY_REAL t5280 = t2654+t2673+t2653+t2655+t2676+t2947+t2948+t2768+t2769+t5139+t2639+
 t5140+t2641+t2949+t2950;
-    const double t5282 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2770+t5155+
+    const MBPOL_POLY_REAL t5282 = t2622+t2624+t2625+t2627+t2628+t2630+t2632+t2634+t2635+t2770+t5155+
 t2773+t5156+t2643+t2645+t2647;
-    const double t5284 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t5120+t5122;
-    const double t5285 = t5123+t5124+t2962+t2963+t2964+t2965+t2878+t5125+t2596+t2969+t2970;
-    const double t5288 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t5182+t5183+
+    const MBPOL_POLY_REAL t5284 = t2854+t2855+t2856+t2857+t2858+t2953+t2954+t2955+t2956+t5120+t5122;
+    const MBPOL_POLY_REAL t5285 = t5123+t5124+t2962+t2963+t2964+t2965+t2878+t5125+t2596+t2969+t2970;
+    const MBPOL_POLY_REAL t5288 = t2567+t2568+t2569+t2570+t2571+t2977+t2978+t2979+t2980+t5182+t5183+
 t5184+t5185+t2985+t2986+t2987+t2988+t2592+t2880+t5186;
-    const double t5290 = t2781+t2783+t2784+t2804+t2805+t2791+t2806+t2807+t2808+t5143+t5144+
+    const MBPOL_POLY_REAL t5290 = t2781+t2783+t2784+t2804+t2805+t2791+t2806+t2807+t2808+t5143+t5144+
 t5146;
-    const double t5292 = t5147+t2809+t2810+t2811+t2812+t2802+t5148+t5149+t2813+t2814+t3083+
+    const MBPOL_POLY_REAL t5292 = t5147+t2809+t2810+t2811+t2812+t2802+t5148+t5149+t2813+t2814+t3083+
 t2815*t309;
-    const double t5296 = t2725+t2755*t240+t2729+t5160+t5161+t2733+t2734+t2748+t2735+t5164+
+    const MBPOL_POLY_REAL t5296 = t2725+t2755*t240+t2729+t5160+t5161+t2733+t2734+t2748+t2735+t5164+
 t5165+t5166;
-    const double t5297 = t5167+t3081+t2728+t2743+t2744+t2745+t2753+t2754+t2719+t2746+t2727+
+    const MBPOL_POLY_REAL t5297 = t5167+t3081+t2728+t2743+t2744+t2745+t2753+t2754+t2719+t2746+t2727+
 t2730+t2732;
-    const double t5209 = t5284+t5285;
-    const double t5213 = t5290+t5292;
-    const double t5215 = t5296+t5297;
-    const double t5300 = t5278*t139+t5280*t145+t5282*t146+t2765+t2830+t2835+t2839+t2843+
+    const MBPOL_POLY_REAL t5209 = t5284+t5285;
+    const MBPOL_POLY_REAL t5213 = t5290+t5292;
+    const MBPOL_POLY_REAL t5215 = t5296+t5297;
+    const MBPOL_POLY_REAL t5300 = t5278*t139+t5280*t145+t5282*t146+t2765+t2830+t2835+t2839+t2843+
 t5209*t215+t5288*t254+t5213*t309+t2976+t5215*t240;
-    const double t5303 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t5084+t5085+
+    const MBPOL_POLY_REAL t5303 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t5084+t5085+
 t5086+t5087+t1919+t1921+t1923;
-    const double t5306 = t5236+t5238+t5239+t1962+t1964+t1965+t1966+t1968+t5240+t5241+t1974;
-    const double t5310 = t2335+t2336+t1982+t2337+t2338+t1986+t1987+t2339+t2340+t2395+t1996*
+    const MBPOL_POLY_REAL t5306 = t5236+t5238+t5239+t1962+t1964+t1965+t1966+t1968+t5240+t5241+t1974;
+    const MBPOL_POLY_REAL t5310 = t2335+t2336+t1982+t2337+t2338+t1986+t1987+t2339+t2340+t2395+t1996*
 t126;
-    const double t5316 = t2310+t2308+t2311+t2312+t2313+t2315+t2316+t2318+t2319+t2322*t77+
+    const MBPOL_POLY_REAL t5316 = t2310+t2308+t2311+t2312+t2313+t2315+t2316+t2318+t2319+t2322*t77+
 t2320*t126+t2322*t132+t2320*t136+t2327+t2328+t2329+t2330+t2332;
-    const double t5320 = t2358+t2359+t2361+t2362+t2363+t2365+t2366+t2368+t2370+t2372*t77+
+    const MBPOL_POLY_REAL t5320 = t2358+t2359+t2361+t2362+t2363+t2365+t2366+t2368+t2370+t2372*t77+
 t1995+t2376*t132;
-    const double t5322 = t2147*t77;
-    const double t5324 = t2145*t126;
-    const double t5325 = t2147*t132;
-    const double t5326 = t2145*t136;
-    const double t5327 = t2162*t275;
-    const double t5328 = t2160*t254;
-    const double t5329 = t5324+t5325+t5326+t2219+t2220+t2221+t2222+t2159+t5327+t5328+t2223;
-    const double t5332 = t2100*t77;
-    const double t5333 = t2098*t126;
-    const double t5334 = t2100*t132;
-    const double t5335 = t2098*t136;
-    const double t5336 = t2237+t2086+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t5332+t5333+
+    const MBPOL_POLY_REAL t5322 = t2147*t77;
+    const MBPOL_POLY_REAL t5324 = t2145*t126;
+    const MBPOL_POLY_REAL t5325 = t2147*t132;
+    const MBPOL_POLY_REAL t5326 = t2145*t136;
+    const MBPOL_POLY_REAL t5327 = t2162*t275;
+    const MBPOL_POLY_REAL t5328 = t2160*t254;
+    const MBPOL_POLY_REAL t5329 = t5324+t5325+t5326+t2219+t2220+t2221+t2222+t2159+t5327+t5328+t2223;
+    const MBPOL_POLY_REAL t5332 = t2100*t77;
+    const MBPOL_POLY_REAL t5333 = t2098*t126;
+    const MBPOL_POLY_REAL t5334 = t2100*t132;
+    const MBPOL_POLY_REAL t5335 = t2098*t136;
+    const MBPOL_POLY_REAL t5336 = t2237+t2086+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t5332+t5333+
 t5334+t5335+t2244+t2246+t2247;
-    const double t5340 = t1981+t1979+t1982+t1983+t1984+t1986+t1987+t1989+t1991+t2371+t1992*
+    const MBPOL_POLY_REAL t5340 = t1981+t1979+t1982+t1983+t1984+t1986+t1987+t1989+t1991+t2371+t1992*
 t126+t2375+t1996*t136;
-    const double t5253 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t5322+t5329;
-    const double t5342 = t2052+t5310*t126+t5316*t179+t2125+t2132+t2177+t2188+t5320*t132+
+    const MBPOL_POLY_REAL t5253 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t5322+t5329;
+    const MBPOL_POLY_REAL t5342 = t2052+t5310*t126+t5316*t179+t2125+t2132+t2177+t2188+t5320*t132+
 t5253*t212+t5336*t146+t2236+t5340*t136;
-    const double t5343 = t2086+t2085+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t5332+t5333+
+    const MBPOL_POLY_REAL t5343 = t2086+t2085+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t5332+t5333+
 t5334+t5335+t2250;
-    const double t5345 = t2086+t2085+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t5332+t5333+
+    const MBPOL_POLY_REAL t5345 = t2086+t2085+t2087+t2089+t2090+t2092+t2094+t2096+t2097+t5332+t5333+
 t5334+t5335+t2105+t2107;
-    const double t5347 = t2303*t240;
-    const double t5348 = t2268+t2272+t2273+t2034+t5347+t2294+t2038+t2270+t2271+t2275+t2276+
+    const MBPOL_POLY_REAL t5347 = t2303*t240;
+    const MBPOL_POLY_REAL t5348 = t2268+t2272+t2273+t2034+t5347+t2294+t2038+t2270+t2271+t2275+t2276+
 t2278;
-    const double t5349 = t2295*t254;
-    const double t5350 = t2280*t126;
-    const double t5351 = t2282*t77;
-    const double t5352 = t2297*t275;
-    const double t5353 = t2282*t132;
-    const double t5354 = t2280*t136;
-    const double t5355 = t2279+t2288+t5349+t5350+t5351+t5352+t5353+t5354+t2290+t2291+t2300+
+    const MBPOL_POLY_REAL t5349 = t2295*t254;
+    const MBPOL_POLY_REAL t5350 = t2280*t126;
+    const MBPOL_POLY_REAL t5351 = t2282*t77;
+    const MBPOL_POLY_REAL t5352 = t2297*t275;
+    const MBPOL_POLY_REAL t5353 = t2282*t132;
+    const MBPOL_POLY_REAL t5354 = t2280*t136;
+    const MBPOL_POLY_REAL t5355 = t2279+t2288+t5349+t5350+t5351+t5352+t5353+t5354+t2290+t2291+t2300+
 t2302+t2292;
-    const double t5358 = t2345+t2346+t2268+t2347+t2348+t2349+t2350+t2272+t2273+t2254+t2294+
+    const MBPOL_POLY_REAL t5358 = t2345+t2346+t2268+t2347+t2348+t2349+t2350+t2272+t2273+t2254+t2294+
 t2270+t2271;
-    const double t5359 = t2303*t475;
-    const double t5361 = t2275+t2276+t2278+t2279+t5359+t5349+t5350+t5351+t5352+t5353+t5354+
+    const MBPOL_POLY_REAL t5359 = t2303*t475;
+    const MBPOL_POLY_REAL t5361 = t2275+t2276+t2278+t2279+t5359+t5349+t5350+t5351+t5352+t5353+t5354+
 t2351*t240+t2260;
-    const double t5364 = t2000*t77;
-    const double t5365 = t2002*t126;
-    const double t5366 = t2000*t132;
-    const double t5367 = t2027+t2024+t2028+t2029+t2030+t2011+t2012+t2009+t2025+t5364+t5365+
+    const MBPOL_POLY_REAL t5364 = t2000*t77;
+    const MBPOL_POLY_REAL t5365 = t2002*t126;
+    const MBPOL_POLY_REAL t5366 = t2000*t132;
+    const MBPOL_POLY_REAL t5367 = t2027+t2024+t2028+t2029+t2030+t2011+t2012+t2009+t2025+t5364+t5365+
 t5366;
-    const double t5368 = t2002*t136;
-    const double t5369 = t2035*t275;
-    const double t5370 = t2021*t254;
-    const double t5371 = t2256*t143;
-    const double t5372 = t2039*t309;
-    const double t5373 = t5368+t2262+t2264+t2261+t2258+t2032+t5369+t5370+t2263+t2259+t5371+
+    const MBPOL_POLY_REAL t5368 = t2002*t136;
+    const MBPOL_POLY_REAL t5369 = t2035*t275;
+    const MBPOL_POLY_REAL t5370 = t2021*t254;
+    const MBPOL_POLY_REAL t5371 = t2256*t143;
+    const MBPOL_POLY_REAL t5372 = t2039*t309;
+    const MBPOL_POLY_REAL t5373 = t5368+t2262+t2264+t2261+t2258+t2032+t5369+t5370+t2263+t2259+t5371+
 t5372;
-    const double t5376 = t2237+t2086+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t5332+t5333+
+    const MBPOL_POLY_REAL t5376 = t2237+t2086+t2238+t2239+t2240+t2241+t2242+t2096+t2097+t5332+t5333+
 t5334+t5335+t2380+t2381+t2382+t2383;
-    const double t5383 = t2055+t2054+t2056+t2057+t2058+t2060+t2061+t2063+t2064+t2067*t77+
+    const MBPOL_POLY_REAL t5383 = t2055+t2054+t2056+t2057+t2058+t2060+t2061+t2063+t2064+t2067*t77+
 t2065*t126+t2067*t132+t2065*t136+t2072+t2073+t2074+t2075+t2077+t2080*t275;
-    const double t5390 = t2191+t2189+t2192+t2193+t2194+t2196+t2197+t2199+t2200+t2203*t77+
+    const MBPOL_POLY_REAL t5390 = t2191+t2189+t2192+t2193+t2194+t2196+t2197+t2199+t2200+t2203*t77+
 t2201*t126+t2203*t132+t2201*t136+t2208+t2209+t2210+t2211+t2213+t2079+t2214*t254
 ;
-    const double t5392 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t5322+t5324;
-    const double t5393 = t5325+t5326+t2153+t2155+t2156+t2157+t2159+t5327+t5328+t2165+t2167;
-    const double t5396 = t2027+t2024+t2028+t2029+t2030+t2011+t2012+t2009+t2025+t5364+t5365;
-    const double t5397 = t2039*t143;
-    const double t5398 = t5366+t5368+t2007+t2023+t2013+t2015+t2032+t5369+t5370+t2017+t2019+
+    const MBPOL_POLY_REAL t5392 = t2134+t2135+t2136+t2137+t2138+t2140+t2141+t2143+t2144+t5322+t5324;
+    const MBPOL_POLY_REAL t5393 = t5325+t5326+t2153+t2155+t2156+t2157+t2159+t5327+t5328+t2165+t2167;
+    const MBPOL_POLY_REAL t5396 = t2027+t2024+t2028+t2029+t2030+t2011+t2012+t2009+t2025+t5364+t5365;
+    const MBPOL_POLY_REAL t5397 = t2039*t143;
+    const MBPOL_POLY_REAL t5398 = t5366+t5368+t2007+t2023+t2013+t2015+t2032+t5369+t5370+t2017+t2019+
 t5397;
-    const double t5287 = t5348+t5355;
-    const double t5291 = t5358+t5361;
-    const double t5294 = t5367+t5373;
-    const double t5302 = t5392+t5393;
-    const double t5305 = t5396+t5398;
-    const double t5308 = t2376*t77;
-    const double t5404 = t5343*t139+t5345*t145+t5287*t240+t5291*t475+t5294*t309+t2388+t5376*
+    const MBPOL_POLY_REAL t5287 = t5348+t5355;
+    const MBPOL_POLY_REAL t5291 = t5358+t5361;
+    const MBPOL_POLY_REAL t5294 = t5367+t5373;
+    const MBPOL_POLY_REAL t5302 = t5392+t5393;
+    const MBPOL_POLY_REAL t5305 = t5396+t5398;
+    const MBPOL_POLY_REAL t5308 = t2376*t77;
+    const MBPOL_POLY_REAL t5404 = t5343*t139+t5345*t145+t5287*t240+t5291*t475+t5294*t309+t2388+t5376*
 t155+t5383*t275+t2402+t5390*t254+t5302*t215+t5305*t143+(t2389+t2390+t2359+t2391
 +t2392+t2365+t2366+t2393+t2394+t5308)*t77;
-    const double t5407 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t5084+t5085+
+    const MBPOL_POLY_REAL t5407 = t1899+t1900+t1901+t1903+t1904+t1906+t1908+t1910+t1911+t5084+t5085+
 t5086+t5087+t2416+t2417+t2419+t2420;
-    const double t5312 = t5237+t5242;
-    const double t5314 = t5246+t5247;
-    const double t5318 = t5254+t5256;
-    const double t5321 = t5277+t5300;
-    const double t5331 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t5235+t5306;
-    const double t5339 = (t5342+t5404)*t2404;
-    const double t5409 = t5312*t215+t5314*t240+t5252*t136+t5318*t143+t1930+t1941+t5321*t3116
+    const MBPOL_POLY_REAL t5312 = t5237+t5242;
+    const MBPOL_POLY_REAL t5314 = t5246+t5247;
+    const MBPOL_POLY_REAL t5318 = t5254+t5256;
+    const MBPOL_POLY_REAL t5321 = t5277+t5300;
+    const MBPOL_POLY_REAL t5331 = t1942+t1944+t1945+t1946+t1947+t1949+t1950+t1952+t1953+t5235+t5306;
+    const MBPOL_POLY_REAL t5339 = (t5342+t5404)*t2404;
+    const MBPOL_POLY_REAL t5409 = t5312*t215+t5314*t240+t5252*t136+t5318*t143+t1930+t1941+t5321*t3116
 +t2525+t2534+t5303*t146+t3003+t5331*t212+t5339+t5407*t155;
-    const double t5414 = t599*t139;
-    const double t5415 = t584+t4972+t586+t589+t4973+t596*t50+t594*t67+t823+t824+t777+t825+
+    const MBPOL_POLY_REAL t5414 = t599*t139;
+    const MBPOL_POLY_REAL t5415 = t584+t4972+t586+t589+t4973+t596*t50+t594*t67+t823+t824+t777+t825+
 t796+t826+t5414;
-    const double t5418 = t607+t4979+t606+t608+t4980+t5054+t5055+t835+t836+t773+t778+t791+
+    const MBPOL_POLY_REAL t5418 = t607+t4979+t606+t608+t4980+t5054+t5055+t835+t836+t773+t778+t791+
 t797+t5414+t617*t145;
-    const double t5360 = t5418*t145;
-    const double t5420 = t471+t4944+t5024+t5026+t5029+t5032+t5035+t5037+t5039+t5045+t5047+
+    const MBPOL_POLY_REAL t5360 = t5418*t145;
+    const MBPOL_POLY_REAL t5420 = t471+t4944+t5024+t5026+t5029+t5032+t5035+t5037+t5039+t5045+t5047+
 t5051+t5053+t5415*t139+t5360;
-    const double t5422 = t1306*t5;
-    const double t5425 = t715*t20;
-    const double t5429 = t715*t26;
-    const double t5437 = t580*t139;
-    const double t5438 = t566+t568+t569+t570+t571+t809+t810+t811+t812+t788+t795+t813+t814+
+    const MBPOL_POLY_REAL t5422 = t1306*t5;
+    const MBPOL_POLY_REAL t5425 = t715*t20;
+    const MBPOL_POLY_REAL t5429 = t715*t26;
+    const MBPOL_POLY_REAL t5437 = t580*t139;
+    const MBPOL_POLY_REAL t5438 = t566+t568+t569+t570+t571+t809+t810+t811+t812+t788+t795+t813+t814+
 t5437;
-    const double t5440 = t562*t145;
-    const double t5441 = t551+t552+t553+t554+t555+t800+t801+t802+t803+t794+t790+t804+t805+
+    const MBPOL_POLY_REAL t5440 = t562*t145;
+    const MBPOL_POLY_REAL t5441 = t551+t552+t553+t554+t555+t800+t801+t802+t803+t794+t790+t804+t805+
 t815+t5440;
-    const double t5444 = t604+t607+t831+t832+t609+t833+t834+t835+t836+t773+t778+t791+t797+
+    const MBPOL_POLY_REAL t5444 = t604+t607+t831+t832+t609+t833+t834+t835+t836+t773+t778+t791+t797+
 t5437+t5440+t617*t146;
-    const double t5375 = t5444*t146;
-    const double t5446 = t471+t476+t728+t731+t735+t740+t746+t751+t757+t775+t780+t793+t799+
+    const MBPOL_POLY_REAL t5375 = t5444*t146;
+    const MBPOL_POLY_REAL t5446 = t471+t476+t728+t731+t735+t740+t746+t751+t757+t775+t780+t793+t799+
 t5438*t139+t5441*t145+t5375;
-    const double t5448 = t282*t145;
-    const double t5449 = t65*t155;
-    const double t5450 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t92+t94+t95+t96+t462+t5448+
+    const MBPOL_POLY_REAL t5448 = t282*t145;
+    const MBPOL_POLY_REAL t5449 = t65*t155;
+    const MBPOL_POLY_REAL t5450 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t92+t94+t95+t96+t462+t5448+
 t464+t5449;
-    const double t5452 = t328+t695+t330+t331+t332+t334+t335+t337+t338+t339+t340+t349;
-    const double t5454 = t186*t309;
-    const double t5455 = t344*t139;
-    const double t5456 = t341*t145;
-    const double t5457 = t344*t146;
-    const double t5458 = t341*t155;
-    const double t5459 = t351*t212;
-    const double t5460 = t327*t215;
-    const double t5461 = t325*t240+t5454+t353+t354+t355+t356+t357+t5455+t5456+t5457+t5458+
+    const MBPOL_POLY_REAL t5452 = t328+t695+t330+t331+t332+t334+t335+t337+t338+t339+t340+t349;
+    const MBPOL_POLY_REAL t5454 = t186*t309;
+    const MBPOL_POLY_REAL t5455 = t344*t139;
+    const MBPOL_POLY_REAL t5456 = t341*t145;
+    const MBPOL_POLY_REAL t5457 = t344*t146;
+    const MBPOL_POLY_REAL t5458 = t341*t155;
+    const MBPOL_POLY_REAL t5459 = t351*t212;
+    const MBPOL_POLY_REAL t5460 = t327*t215;
+    const MBPOL_POLY_REAL t5461 = t325*t240+t5454+t353+t354+t355+t356+t357+t5455+t5456+t5457+t5458+
 t5459+t5460;
-    const double t5464 = t65*t145;
-    const double t5465 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t92+t94+t95+t96+t306+t5464;
-    const double t5467 = t109+t107+t108+t110+t111+t361+t362+t363+t364+t365+t366;
-    const double t5474 = t367+t369+t131*t139+t137*t145+t131*t146+t137*t155+t127+t374+t375+
+    const MBPOL_POLY_REAL t5464 = t65*t145;
+    const MBPOL_POLY_REAL t5465 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t92+t94+t95+t96+t306+t5464;
+    const MBPOL_POLY_REAL t5467 = t109+t107+t108+t110+t111+t361+t362+t363+t364+t365+t366;
+    const MBPOL_POLY_REAL t5474 = t367+t369+t131*t139+t137*t145+t131*t146+t137*t155+t127+t374+t375+
 t133*t212+t135*t215+t695;
-    const double t5387 = (t5452+t5461)*t240;
-    const double t5389 = t5467+t5474;
-    const double t5477 = t68+t69+t74+t79+t84+t105+t5450*t155+t5387+t5465*t145+t157+t5389*
+    const MBPOL_POLY_REAL t5387 = (t5452+t5461)*t240;
+    const MBPOL_POLY_REAL t5389 = t5467+t5474;
+    const MBPOL_POLY_REAL t5477 = t68+t69+t74+t79+t84+t105+t5450*t155+t5387+t5465*t145+t157+t5389*
 t143+t256;
-    const double t5479 = t230*t139;
-    const double t5480 = t228*t145;
-    const double t5481 = t230*t146;
-    const double t5482 = t228*t155;
-    const double t5483 = t244*t212;
-    const double t5484 = t386+t388+t389+t5479+t5480+t5481+t5482+t241+t395+t397+t5483;
-    const double t5487 = t319*t139;
-    const double t5488 = t274*t146;
-    const double t5489 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t301+t303+t304+t305+
+    const MBPOL_POLY_REAL t5479 = t230*t139;
+    const MBPOL_POLY_REAL t5480 = t228*t145;
+    const MBPOL_POLY_REAL t5481 = t230*t146;
+    const MBPOL_POLY_REAL t5482 = t228*t155;
+    const MBPOL_POLY_REAL t5483 = t244*t212;
+    const MBPOL_POLY_REAL t5484 = t386+t388+t389+t5479+t5480+t5481+t5482+t241+t395+t397+t5483;
+    const MBPOL_POLY_REAL t5487 = t319*t139;
+    const MBPOL_POLY_REAL t5488 = t274*t146;
+    const MBPOL_POLY_REAL t5489 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t301+t303+t304+t305+
 t5487+t406+t5488;
-    const double t5491 = t204*t139;
-    const double t5492 = t202*t145;
-    const double t5493 = t204*t146;
-    const double t5494 = t202*t155;
-    const double t5495 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t203+t205+t206+t207+
+    const MBPOL_POLY_REAL t5491 = t204*t139;
+    const MBPOL_POLY_REAL t5492 = t202*t145;
+    const MBPOL_POLY_REAL t5493 = t204*t146;
+    const MBPOL_POLY_REAL t5494 = t202*t155;
+    const MBPOL_POLY_REAL t5495 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t203+t205+t206+t207+
 t5491+t5492+t5493+t5494+t213;
-    const double t5497 = t236*t139;
-    const double t5498 = t234*t145;
-    const double t5499 = t236*t146;
-    const double t5500 = t234*t155;
-    const double t5501 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t229+t231+t232+t233+
+    const MBPOL_POLY_REAL t5497 = t236*t139;
+    const MBPOL_POLY_REAL t5498 = t234*t145;
+    const MBPOL_POLY_REAL t5499 = t236*t146;
+    const MBPOL_POLY_REAL t5500 = t234*t155;
+    const MBPOL_POLY_REAL t5501 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t229+t231+t232+t233+
 t5497+t5498+t5499+t5500+t241+t243+t245;
-    const double t5503 = t159+t160+t161+t162+t163+t165+t166+t167+t168+t170+t171+t173;
-    const double t5504 = t174+t175+t176+t177+t178+t180+t182+t183+t184+t185+t119+t5454;
-    const double t5507 = t274*t139;
-    const double t5508 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t301+t303+t304+t305+
+    const MBPOL_POLY_REAL t5503 = t159+t160+t161+t162+t163+t165+t166+t167+t168+t170+t171+t173;
+    const MBPOL_POLY_REAL t5504 = t174+t175+t176+t177+t178+t180+t182+t183+t184+t185+t119+t5454;
+    const MBPOL_POLY_REAL t5507 = t274*t139;
+    const MBPOL_POLY_REAL t5508 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t301+t303+t304+t305+
 t5507;
-    const double t5510 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t423+t426;
-    const double t5511 = t431*t139;
-    const double t5512 = t429*t145;
-    const double t5513 = t431*t146;
-    const double t5514 = t429*t155;
-    const double t5515 = t440*t215;
-    const double t5516 = t427+t428+t5511+t5512+t5513+t5514+t436+t438+t439+t398+t5515;
-    const double t5519 = t425*t139;
-    const double t5520 = t422*t145;
-    const double t5521 = t425*t146;
-    const double t5522 = t422*t155;
-    const double t5523 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t449+t450+t451+t452+
+    const MBPOL_POLY_REAL t5510 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t423+t426;
+    const MBPOL_POLY_REAL t5511 = t431*t139;
+    const MBPOL_POLY_REAL t5512 = t429*t145;
+    const MBPOL_POLY_REAL t5513 = t431*t146;
+    const MBPOL_POLY_REAL t5514 = t429*t155;
+    const MBPOL_POLY_REAL t5515 = t440*t215;
+    const MBPOL_POLY_REAL t5516 = t427+t428+t5511+t5512+t5513+t5514+t436+t438+t439+t398+t5515;
+    const MBPOL_POLY_REAL t5519 = t425*t139;
+    const MBPOL_POLY_REAL t5520 = t422*t145;
+    const MBPOL_POLY_REAL t5521 = t425*t146;
+    const MBPOL_POLY_REAL t5522 = t422*t155;
+    const MBPOL_POLY_REAL t5523 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t449+t450+t451+t452+
 t5519+t5520+t5521+t5522+t436+t457;
-    const double t5394 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t385+t5484;
-    const double t5402 = t5503+t5504;
-    const double t5406 = t5510+t5516;
-    const double t5525 = t277+t288+t5394*t212+t294+t313+t5489*t146+t5495*t179+t5501*t254+
+    const MBPOL_POLY_REAL t5394 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t385+t5484;
+    const MBPOL_POLY_REAL t5402 = t5503+t5504;
+    const MBPOL_POLY_REAL t5406 = t5510+t5516;
+    const MBPOL_POLY_REAL t5525 = t277+t288+t5394*t212+t294+t313+t5489*t146+t5495*t179+t5501*t254+
 t5402*t309+t324+t5508*t139+t5406*t215+t5523*t275;
-    const double t5533 = t15*t26;
-    const double t5536 = a[39];
-    const double t5537 = a[476];
-    const double t5539 = a[498];
-    const double t5541 = a[330];
-    const double t5542 = t5541*t5;
-    const double t5543 = t5541*t37;
-    const double t5544 = a[447];
-    const double t5545 = t5544*t50;
-    const double t5549 = t5541*t20;
-    const double t5550 = t5541*t26;
-    const double t5552 = a[545];
-    const double t5553 = t5552*t50;
-    const double t5554 = t5544*t67;
-    const double t5558 = t34*t72;
-    const double t5591 = t1452*t50;
-    const double t5592 = t1450*t67;
-    const double t5593 = t1447*t72;
-    const double t5594 = t1447*t73;
-    const double t5596 = t1859*t145;
-    const double t5598 = t1885+t1444+t1443+t1445+t1888+t5591+t5592+t5593+t5594+t5084+t1915+
+    const MBPOL_POLY_REAL t5533 = t15*t26;
+    const MBPOL_POLY_REAL t5536 = a[39];
+    const MBPOL_POLY_REAL t5537 = a[476];
+    const MBPOL_POLY_REAL t5539 = a[498];
+    const MBPOL_POLY_REAL t5541 = a[330];
+    const MBPOL_POLY_REAL t5542 = t5541*t5;
+    const MBPOL_POLY_REAL t5543 = t5541*t37;
+    const MBPOL_POLY_REAL t5544 = a[447];
+    const MBPOL_POLY_REAL t5545 = t5544*t50;
+    const MBPOL_POLY_REAL t5549 = t5541*t20;
+    const MBPOL_POLY_REAL t5550 = t5541*t26;
+    const MBPOL_POLY_REAL t5552 = a[545];
+    const MBPOL_POLY_REAL t5553 = t5552*t50;
+    const MBPOL_POLY_REAL t5554 = t5544*t67;
+    const MBPOL_POLY_REAL t5558 = t34*t72;
+    const MBPOL_POLY_REAL t5591 = t1452*t50;
+    const MBPOL_POLY_REAL t5592 = t1450*t67;
+    const MBPOL_POLY_REAL t5593 = t1447*t72;
+    const MBPOL_POLY_REAL t5594 = t1447*t73;
+    const MBPOL_POLY_REAL t5596 = t1859*t145;
+    const MBPOL_POLY_REAL t5598 = t1885+t1444+t1443+t1445+t1888+t5591+t5592+t5593+t5594+t5084+t1915+
 t5086+t1917+t1892*t139+t5596+t1456*t146;
-    const double t5600 = t1434*t50;
-    const double t5601 = t1432*t67;
-    const double t5602 = t1429*t72;
-    const double t5603 = t1429*t73;
-    const double t5604 = t1859*t139;
-    const double t5606 = t1454*t146;
-    const double t5608 = t1851+t1424+t1426+t1427+t1854+t5600+t5601+t5602+t5603+t1913+t5085+
+    const MBPOL_POLY_REAL t5600 = t1434*t50;
+    const MBPOL_POLY_REAL t5601 = t1432*t67;
+    const MBPOL_POLY_REAL t5602 = t1429*t72;
+    const MBPOL_POLY_REAL t5603 = t1429*t73;
+    const MBPOL_POLY_REAL t5604 = t1859*t139;
+    const MBPOL_POLY_REAL t5606 = t1454*t146;
+    const MBPOL_POLY_REAL t5608 = t1851+t1424+t1426+t1427+t1854+t5600+t5601+t5602+t5603+t1913+t5085+
 t1916+t5087+t5604+t1857*t145+t5606+t1436*t155;
-    const double t5610 = t2443*t50;
-    const double t5611 = t2443*t67;
-    const double t5612 = t2440*t72;
-    const double t5613 = t2440*t73;
-    const double t5614 = t2452*t77;
-    const double t5615 = t2452*t126;
-    const double t5616 = t2452*t132;
-    const double t5617 = t2452*t136;
-    const double t5622 = t2436+t2435+t2437+t2438+t2439+t5610+t5611+t5612+t5613+t5614+t5615+
+    const MBPOL_POLY_REAL t5610 = t2443*t50;
+    const MBPOL_POLY_REAL t5611 = t2443*t67;
+    const MBPOL_POLY_REAL t5612 = t2440*t72;
+    const MBPOL_POLY_REAL t5613 = t2440*t73;
+    const MBPOL_POLY_REAL t5614 = t2452*t77;
+    const MBPOL_POLY_REAL t5615 = t2452*t126;
+    const MBPOL_POLY_REAL t5616 = t2452*t132;
+    const MBPOL_POLY_REAL t5617 = t2452*t136;
+    const MBPOL_POLY_REAL t5622 = t2436+t2435+t2437+t2438+t2439+t5610+t5611+t5612+t5613+t5614+t5615+
 t5616+t5617+t2448*t139+t2446*t145+t2448*t146+t2446*t155+t2458;
-    const double t5624 = t1951*t50;
-    const double t5625 = t1951*t67;
-    const double t5626 = t1948*t72;
-    const double t5627 = t1948*t73;
-    const double t5628 = t1961*t77;
-    const double t5629 = t1963*t126;
-    const double t5630 = t1961*t132;
-    const double t5631 = t1963*t136;
-    const double t5632 = t1957*t139;
-    const double t5633 = t1954*t145;
-    const double t5634 = t1957*t146;
-    const double t5635 = t1954*t155;
-    const double t5636 = t1973*t275;
-    const double t5637 = t1944+t1942+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5628+t5629+
+    const MBPOL_POLY_REAL t5624 = t1951*t50;
+    const MBPOL_POLY_REAL t5625 = t1951*t67;
+    const MBPOL_POLY_REAL t5626 = t1948*t72;
+    const MBPOL_POLY_REAL t5627 = t1948*t73;
+    const MBPOL_POLY_REAL t5628 = t1961*t77;
+    const MBPOL_POLY_REAL t5629 = t1963*t126;
+    const MBPOL_POLY_REAL t5630 = t1961*t132;
+    const MBPOL_POLY_REAL t5631 = t1963*t136;
+    const MBPOL_POLY_REAL t5632 = t1957*t139;
+    const MBPOL_POLY_REAL t5633 = t1954*t145;
+    const MBPOL_POLY_REAL t5634 = t1957*t146;
+    const MBPOL_POLY_REAL t5635 = t1954*t155;
+    const MBPOL_POLY_REAL t5636 = t1973*t275;
+    const MBPOL_POLY_REAL t5637 = t1944+t1942+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5628+t5629+
 t5630+t5631+t5632+t5633+t5634+t5635+t1968+t5636;
-    const double t5639 = t1963*t77;
-    const double t5640 = t1961*t126;
-    const double t5641 = t1963*t132;
-    const double t5642 = t1961*t136;
-    const double t5643 = t2470*t275;
-    const double t5644 = t1973*t254;
-    const double t5645 = t1944+t1942+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5639+t5640+
+    const MBPOL_POLY_REAL t5639 = t1963*t77;
+    const MBPOL_POLY_REAL t5640 = t1961*t126;
+    const MBPOL_POLY_REAL t5641 = t1963*t132;
+    const MBPOL_POLY_REAL t5642 = t1961*t136;
+    const MBPOL_POLY_REAL t5643 = t2470*t275;
+    const MBPOL_POLY_REAL t5644 = t1973*t254;
+    const MBPOL_POLY_REAL t5645 = t1944+t1942+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5639+t5640+
 t5641+t5642+t5632+t5633+t5634+t5635+t1968+t5643+t5644;
-    const double t5647 = t2544*t50;
-    const double t5648 = t2544*t67;
-    const double t5649 = t2541*t72;
-    const double t5650 = t2541*t73;
-    const double t5651 = t2553*t77;
-    const double t5653 = t2553*t126;
-    const double t5654 = t2553*t132;
-    const double t5655 = t2553*t136;
-    const double t5661 = t5653+t5654+t5655+t2549*t139+t2547*t145+t2549*t146+t2547*t155+t2559
+    const MBPOL_POLY_REAL t5647 = t2544*t50;
+    const MBPOL_POLY_REAL t5648 = t2544*t67;
+    const MBPOL_POLY_REAL t5649 = t2541*t72;
+    const MBPOL_POLY_REAL t5650 = t2541*t73;
+    const MBPOL_POLY_REAL t5651 = t2553*t77;
+    const MBPOL_POLY_REAL t5653 = t2553*t126;
+    const MBPOL_POLY_REAL t5654 = t2553*t132;
+    const MBPOL_POLY_REAL t5655 = t2553*t136;
+    const MBPOL_POLY_REAL t5661 = t5653+t5654+t5655+t2549*t139+t2547*t145+t2549*t146+t2547*t155+t2559
 +t5240+t1972+t2562*t212;
-    const double t5664 = t3130*t50;
-    const double t5665 = t3130*t67;
-    const double t5666 = t3127*t72;
-    const double t5667 = t3127*t73;
-    const double t5668 = t3139*t77;
-    const double t5669 = t3139*t126;
-    const double t5670 = t3121+t3123+t3124+t3125+t3126+t5664+t5665+t5666+t5667+t5668+t5669;
-    const double t5671 = t3139*t132;
-    const double t5672 = t3139*t136;
-    const double t5677 = t2560*t212;
-    const double t5679 = t5671+t5672+t3135*t139+t3133*t145+t3135*t146+t3133*t155+t3145+t1970
+    const MBPOL_POLY_REAL t5664 = t3130*t50;
+    const MBPOL_POLY_REAL t5665 = t3130*t67;
+    const MBPOL_POLY_REAL t5666 = t3127*t72;
+    const MBPOL_POLY_REAL t5667 = t3127*t73;
+    const MBPOL_POLY_REAL t5668 = t3139*t77;
+    const MBPOL_POLY_REAL t5669 = t3139*t126;
+    const MBPOL_POLY_REAL t5670 = t3121+t3123+t3124+t3125+t3126+t5664+t5665+t5666+t5667+t5668+t5669;
+    const MBPOL_POLY_REAL t5671 = t3139*t132;
+    const MBPOL_POLY_REAL t5672 = t3139*t136;
+    const MBPOL_POLY_REAL t5677 = t2560*t212;
+    const MBPOL_POLY_REAL t5679 = t5671+t5672+t3135*t139+t3133*t145+t3135*t146+t3133*t155+t3145+t1970
 +t5241+t5677+t3146*t215;
-    const double t5682 = t2485*t50;
-    const double t5683 = t2485*t67;
-    const double t5684 = t2487*t72;
-    const double t5685 = t2487*t73;
-    const double t5686 = t2478*t77;
-    const double t5687 = t2483*t126;
-    const double t5688 = t2509+t2507+t2510+t2511+t2512+t5682+t5683+t5684+t5685+t5686+t5687;
-    const double t5689 = t2478*t132;
-    const double t5690 = t2483*t136;
-    const double t5691 = t2493*t139;
-    const double t5692 = t2476*t145;
-    const double t5693 = t2493*t146;
-    const double t5694 = t2476*t155;
-    const double t5695 = t2503*t275;
-    const double t5696 = t2505*t254;
-    const double t5697 = t2499*t212;
-    const double t5698 = t2497*t215;
-    const double t5699 = t5689+t5690+t5691+t5692+t5693+t5694+t2514+t5695+t5696+t5697+t5698+
+    const MBPOL_POLY_REAL t5682 = t2485*t50;
+    const MBPOL_POLY_REAL t5683 = t2485*t67;
+    const MBPOL_POLY_REAL t5684 = t2487*t72;
+    const MBPOL_POLY_REAL t5685 = t2487*t73;
+    const MBPOL_POLY_REAL t5686 = t2478*t77;
+    const MBPOL_POLY_REAL t5687 = t2483*t126;
+    const MBPOL_POLY_REAL t5688 = t2509+t2507+t2510+t2511+t2512+t5682+t5683+t5684+t5685+t5686+t5687;
+    const MBPOL_POLY_REAL t5689 = t2478*t132;
+    const MBPOL_POLY_REAL t5690 = t2483*t136;
+    const MBPOL_POLY_REAL t5691 = t2493*t139;
+    const MBPOL_POLY_REAL t5692 = t2476*t145;
+    const MBPOL_POLY_REAL t5693 = t2493*t146;
+    const MBPOL_POLY_REAL t5694 = t2476*t155;
+    const MBPOL_POLY_REAL t5695 = t2503*t275;
+    const MBPOL_POLY_REAL t5696 = t2505*t254;
+    const MBPOL_POLY_REAL t5697 = t2499*t212;
+    const MBPOL_POLY_REAL t5698 = t2497*t215;
+    const MBPOL_POLY_REAL t5699 = t5689+t5690+t5691+t5692+t5693+t5694+t2514+t5695+t5696+t5697+t5698+
 t5255;
-    const double t5442 = t1846+t1926*t20+t2521+t1880*t26+t2523;
-    const double t5705 = t5442*t37;
-    const double t5443 = t1874*t50;
-    const double t5708 = (t1864+t1868+t2526+t2528+t1870+t5443)*t50;
-    const double t5447 = t2530*t50;
-    const double t5451 = t1874*t67;
-    const double t5712 = (t2527+t1864+t1866+t1869+t2529+t5447+t5451)*t67;
-    const double t5462 = t1938*t72;
-    const double t5715 = (t1931+t1933+t2996+t2997+t1937+t1872+t1873+t5462)*t72;
-    const double t5466 = t2999*t72;
-    const double t5468 = t1938*t73;
-    const double t5719 = (t1931+t2995+t1934+t1936+t2998+t1872+t1873+t5466+t5468)*t73;
-    const double t5476 = t2535+t2537+t2538+t2539+t2540+t5647+t5648+t5649+t5650+t5651+t5661;
-    const double t5485 = t5670+t5679;
-    const double t5490 = t5688+t5699;
-    const double t5720 = t5598*t146+t5608*t155+t5622*t179+t5637*t275+t5645*t254+t5476*t212+
+    const MBPOL_POLY_REAL t5442 = t1846+t1926*t20+t2521+t1880*t26+t2523;
+    const MBPOL_POLY_REAL t5705 = t5442*t37;
+    const MBPOL_POLY_REAL t5443 = t1874*t50;
+    const MBPOL_POLY_REAL t5708 = (t1864+t1868+t2526+t2528+t1870+t5443)*t50;
+    const MBPOL_POLY_REAL t5447 = t2530*t50;
+    const MBPOL_POLY_REAL t5451 = t1874*t67;
+    const MBPOL_POLY_REAL t5712 = (t2527+t1864+t1866+t1869+t2529+t5447+t5451)*t67;
+    const MBPOL_POLY_REAL t5462 = t1938*t72;
+    const MBPOL_POLY_REAL t5715 = (t1931+t1933+t2996+t2997+t1937+t1872+t1873+t5462)*t72;
+    const MBPOL_POLY_REAL t5466 = t2999*t72;
+    const MBPOL_POLY_REAL t5468 = t1938*t73;
+    const MBPOL_POLY_REAL t5719 = (t1931+t2995+t1934+t1936+t2998+t1872+t1873+t5466+t5468)*t73;
+    const MBPOL_POLY_REAL t5476 = t2535+t2537+t2538+t2539+t2540+t5647+t5648+t5649+t5650+t5651+t5661;
+    const MBPOL_POLY_REAL t5485 = t5670+t5679;
+    const MBPOL_POLY_REAL t5490 = t5688+t5699;
+    const MBPOL_POLY_REAL t5720 = t5598*t146+t5608*t155+t5622*t179+t5637*t275+t5645*t254+t5476*t212+
 t5485*t215+t5490*t143+t5705+t5708+t5712+t5715+t5719;
-    const double t5721 = t1909*t50;
-    const double t5722 = t1909*t67;
-    const double t5723 = t1907*t72;
-    const double t5724 = t1905*t73;
-    const double t5502 = t1922*t77;
-    const double t5727 = (t1900+t1901+t2407+t1903+t2410+t5721+t5722+t5723+t5724+t5502)*t77;
-    const double t5728 = t1905*t72;
-    const double t5729 = t1907*t73;
-    const double t5733 = t2408+t1899+t1900+t2409+t1904+t5721+t5722+t5728+t5729+t1918*t77+
+    const MBPOL_POLY_REAL t5721 = t1909*t50;
+    const MBPOL_POLY_REAL t5722 = t1909*t67;
+    const MBPOL_POLY_REAL t5723 = t1907*t72;
+    const MBPOL_POLY_REAL t5724 = t1905*t73;
+    const MBPOL_POLY_REAL t5502 = t1922*t77;
+    const MBPOL_POLY_REAL t5727 = (t1900+t1901+t2407+t1903+t2410+t5721+t5722+t5723+t5724+t5502)*t77;
+    const MBPOL_POLY_REAL t5728 = t1905*t72;
+    const MBPOL_POLY_REAL t5729 = t1907*t73;
+    const MBPOL_POLY_REAL t5733 = t2408+t1899+t1900+t2409+t1904+t5721+t5722+t5728+t5729+t1918*t77+
 t1920*t126+t1922*t132;
-    const double t5734 = t5733*t132;
-    const double t5739 = t2408+t1899+t1900+t2409+t1904+t5721+t5722+t5728+t5729+t1920*t77+
+    const MBPOL_POLY_REAL t5734 = t5733*t132;
+    const MBPOL_POLY_REAL t5739 = t2408+t1899+t1900+t2409+t1904+t5721+t5722+t5728+t5729+t1920*t77+
 t1918*t126+t2418*t132+t1922*t136;
-    const double t5740 = t5739*t136;
-    const double t5741 = t1469*t50;
-    const double t5742 = t1469*t67;
-    const double t5743 = t1466*t72;
-    const double t5744 = t1466*t73;
-    const double t5745 = t1481*t77;
-    const double t5746 = t1479*t126;
-    const double t5747 = t1481*t132;
-    const double t5748 = t1462+t1460+t1463+t1464+t1465+t5741+t5742+t5743+t5744+t5745+t5746+
+    const MBPOL_POLY_REAL t5740 = t5739*t136;
+    const MBPOL_POLY_REAL t5741 = t1469*t50;
+    const MBPOL_POLY_REAL t5742 = t1469*t67;
+    const MBPOL_POLY_REAL t5743 = t1466*t72;
+    const MBPOL_POLY_REAL t5744 = t1466*t73;
+    const MBPOL_POLY_REAL t5745 = t1481*t77;
+    const MBPOL_POLY_REAL t5746 = t1479*t126;
+    const MBPOL_POLY_REAL t5747 = t1481*t132;
+    const MBPOL_POLY_REAL t5748 = t1462+t1460+t1463+t1464+t1465+t5741+t5742+t5743+t5744+t5745+t5746+
 t5747;
-    const double t5749 = t1479*t136;
-    const double t5750 = t1474*t139;
-    const double t5751 = t1472*t145;
-    const double t5752 = t1474*t146;
-    const double t5753 = t1472*t155;
-    const double t5754 = t1493*t275;
-    const double t5755 = t1491*t254;
-    const double t5756 = t1489*t212;
-    const double t5757 = t1487*t215;
-    const double t5758 = t5749+t5750+t5751+t5752+t5753+t1486+t5754+t5755+t5756+t5757+t2516+
+    const MBPOL_POLY_REAL t5749 = t1479*t136;
+    const MBPOL_POLY_REAL t5750 = t1474*t139;
+    const MBPOL_POLY_REAL t5751 = t1472*t145;
+    const MBPOL_POLY_REAL t5752 = t1474*t146;
+    const MBPOL_POLY_REAL t5753 = t1472*t155;
+    const MBPOL_POLY_REAL t5754 = t1493*t275;
+    const MBPOL_POLY_REAL t5755 = t1491*t254;
+    const MBPOL_POLY_REAL t5756 = t1489*t212;
+    const MBPOL_POLY_REAL t5757 = t1487*t215;
+    const MBPOL_POLY_REAL t5758 = t5749+t5750+t5751+t5752+t5753+t1486+t5754+t5755+t5756+t5757+t2516+
 t1498;
-    const double t5761 = t2478*t126;
-    const double t5762 = t2505*t275;
-    const double t5763 = t2483*t77;
-    const double t5764 = t2503*t254;
-    const double t5765 = t2483*t132;
-    const double t5766 = t2478*t136;
-    const double t5767 = t5693+t5692+t5691+t2481+t5761+t5762+t5763+t5764+t5765+t5766+t5694+
+    const MBPOL_POLY_REAL t5761 = t2478*t126;
+    const MBPOL_POLY_REAL t5762 = t2505*t275;
+    const MBPOL_POLY_REAL t5763 = t2483*t77;
+    const MBPOL_POLY_REAL t5764 = t2503*t254;
+    const MBPOL_POLY_REAL t5765 = t2483*t132;
+    const MBPOL_POLY_REAL t5766 = t2478*t136;
+    const MBPOL_POLY_REAL t5767 = t5693+t5692+t5691+t2481+t5761+t5762+t5763+t5764+t5765+t5766+t5694+
 t5697;
-    const double t5768 = t5698+t5068+t2491+t2507+t2509+t2510+t2511+t2512+t5682+t5683+t5684+
+    const MBPOL_POLY_REAL t5768 = t5698+t5068+t2491+t2507+t2509+t2510+t2511+t2512+t5682+t5683+t5684+
 t5685+t2514;
-    const double t5528 = t1846+t1881+t1928;
-    const double t5772 = t5528*t20;
-    const double t5529 = t1927+t1846+t1879+t1882;
-    const double t5774 = t5529*t26;
-    const double t5777 = t1900+t1901+t2407+t1903+t2410+t5721+t5722+t5723+t5724+t2418*t77+
+    const MBPOL_POLY_REAL t5528 = t1846+t1881+t1928;
+    const MBPOL_POLY_REAL t5772 = t5528*t20;
+    const MBPOL_POLY_REAL t5529 = t1927+t1846+t1879+t1882;
+    const MBPOL_POLY_REAL t5774 = t5529*t26;
+    const MBPOL_POLY_REAL t5777 = t1900+t1901+t2407+t1903+t2410+t5721+t5722+t5723+t5724+t2418*t77+
 t1922*t126;
-    const double t5778 = t5777*t126;
-    const double t5779 = t2095*t50;
-    const double t5780 = t2095*t67;
-    const double t5781 = t2091*t72;
-    const double t5782 = t2093*t73;
-    const double t5532 = t2106*t77;
-    const double t5785 = (t2085+t2086+t2238+t2239+t2090+t5779+t5780+t5781+t5782+t5532)*t77;
-    const double t5788 = t2085+t2086+t2238+t2239+t2090+t5779+t5780+t5781+t5782+t2104*t77+
+    const MBPOL_POLY_REAL t5778 = t5777*t126;
+    const MBPOL_POLY_REAL t5779 = t2095*t50;
+    const MBPOL_POLY_REAL t5780 = t2095*t67;
+    const MBPOL_POLY_REAL t5781 = t2091*t72;
+    const MBPOL_POLY_REAL t5782 = t2093*t73;
+    const MBPOL_POLY_REAL t5532 = t2106*t77;
+    const MBPOL_POLY_REAL t5785 = (t2085+t2086+t2238+t2239+t2090+t5779+t5780+t5781+t5782+t5532)*t77;
+    const MBPOL_POLY_REAL t5788 = t2085+t2086+t2238+t2239+t2090+t5779+t5780+t5781+t5782+t2104*t77+
 t2106*t126;
-    const double t5789 = t5788*t126;
-    const double t5790 = t2093*t72;
-    const double t5791 = t2091*t73;
-    const double t5795 = t2237+t2086+t2087+t2089+t2240+t5779+t5780+t5790+t5791+t2243*t77+
+    const MBPOL_POLY_REAL t5789 = t5788*t126;
+    const MBPOL_POLY_REAL t5790 = t2093*t72;
+    const MBPOL_POLY_REAL t5791 = t2091*t73;
+    const MBPOL_POLY_REAL t5795 = t2237+t2086+t2087+t2089+t2240+t5779+t5780+t5790+t5791+t2243*t77+
 t2245*t126+t2106*t132;
-    const double t5796 = t5795*t132;
-    const double t5801 = t2237+t2086+t2087+t2089+t2240+t5779+t5780+t5790+t5791+t2245*t77+
+    const MBPOL_POLY_REAL t5796 = t5795*t132;
+    const MBPOL_POLY_REAL t5801 = t2237+t2086+t2087+t2089+t2240+t5779+t5780+t5790+t5791+t2245*t77+
 t2243*t126+t2104*t132+t2106*t136;
-    const double t5802 = t5801*t136;
-    const double t5557 = t2399+t2048+t2044+t2050;
-    const double t5804 = t5557*t26;
-    const double t5559 = t2122*t50;
-    const double t5807 = (t2126+t2110+t2112+t2115+t2129+t5559)*t50;
-    const double t5561 = t2120*t50;
-    const double t5562 = t2122*t67;
-    const double t5811 = (t2114+t2110+t2127+t2128+t2116+t5561+t5562)*t67;
-    const double t5566 = t2173*t20+t2044+t2045*t26+t2172+t2175;
-    const double t5815 = t5566*t37;
-    const double t5816 = t2277*t67;
-    const double t5817 = t2274*t73;
-    const double t5818 = t2033*t240;
-    const double t5819 = t2289*t77;
-    const double t5820 = t2287*t126;
-    const double t5821 = t2287*t136;
-    const double t5822 = t2289*t132;
-    const double t5823 = t2277*t50;
-    const double t5824 = t2268+t2272+t2273+t5816+t5817+t2254+t5818+t5819+t5820+t5821+t5822+
+    const MBPOL_POLY_REAL t5802 = t5801*t136;
+    const MBPOL_POLY_REAL t5557 = t2399+t2048+t2044+t2050;
+    const MBPOL_POLY_REAL t5804 = t5557*t26;
+    const MBPOL_POLY_REAL t5559 = t2122*t50;
+    const MBPOL_POLY_REAL t5807 = (t2126+t2110+t2112+t2115+t2129+t5559)*t50;
+    const MBPOL_POLY_REAL t5561 = t2120*t50;
+    const MBPOL_POLY_REAL t5562 = t2122*t67;
+    const MBPOL_POLY_REAL t5811 = (t2114+t2110+t2127+t2128+t2116+t5561+t5562)*t67;
+    const MBPOL_POLY_REAL t5566 = t2173*t20+t2044+t2045*t26+t2172+t2175;
+    const MBPOL_POLY_REAL t5815 = t5566*t37;
+    const MBPOL_POLY_REAL t5816 = t2277*t67;
+    const MBPOL_POLY_REAL t5817 = t2274*t73;
+    const MBPOL_POLY_REAL t5818 = t2033*t240;
+    const MBPOL_POLY_REAL t5819 = t2289*t77;
+    const MBPOL_POLY_REAL t5820 = t2287*t126;
+    const MBPOL_POLY_REAL t5821 = t2287*t136;
+    const MBPOL_POLY_REAL t5822 = t2289*t132;
+    const MBPOL_POLY_REAL t5823 = t2277*t50;
+    const MBPOL_POLY_REAL t5824 = t2268+t2272+t2273+t5816+t5817+t2254+t5818+t5819+t5820+t5821+t5822+
 t5823+t2294;
-    const double t5825 = t2301*t275;
-    const double t5826 = t2299*t254;
-    const double t5827 = t2274*t72;
-    const double t5828 = t2282*t139;
-    const double t5829 = t2280*t145;
-    const double t5831 = t2297*t212;
-    const double t5832 = t2295*t215;
-    const double t5833 = t2282*t146;
-    const double t5834 = t2280*t155;
-    const double t5835 = t5825+t5826+t5827+t2270+t2271+t5359+t5828+t5829+t2351*t309+t5831+
+    const MBPOL_POLY_REAL t5825 = t2301*t275;
+    const MBPOL_POLY_REAL t5826 = t2299*t254;
+    const MBPOL_POLY_REAL t5827 = t2274*t72;
+    const MBPOL_POLY_REAL t5828 = t2282*t139;
+    const MBPOL_POLY_REAL t5829 = t2280*t145;
+    const MBPOL_POLY_REAL t5831 = t2297*t212;
+    const MBPOL_POLY_REAL t5832 = t2295*t215;
+    const MBPOL_POLY_REAL t5833 = t2282*t146;
+    const MBPOL_POLY_REAL t5834 = t2280*t155;
+    const MBPOL_POLY_REAL t5835 = t5825+t5826+t5827+t2270+t2271+t5359+t5828+t5829+t2351*t309+t5831+
 t5832+t5833+t5834;
-    const double t5838 = t2062*t50;
-    const double t5839 = t2062*t67;
-    const double t5840 = t2059*t72;
-    const double t5841 = t2059*t73;
-    const double t5842 = t2071*t77;
-    const double t5844 = t2071*t126;
-    const double t5845 = t2071*t132;
-    const double t5846 = t2071*t136;
-    const double t5852 = t5844+t5845+t5846+t2067*t139+t2065*t145+t2067*t146+t2065*t155+t2077
+    const MBPOL_POLY_REAL t5838 = t2062*t50;
+    const MBPOL_POLY_REAL t5839 = t2062*t67;
+    const MBPOL_POLY_REAL t5840 = t2059*t72;
+    const MBPOL_POLY_REAL t5841 = t2059*t73;
+    const MBPOL_POLY_REAL t5842 = t2071*t77;
+    const MBPOL_POLY_REAL t5844 = t2071*t126;
+    const MBPOL_POLY_REAL t5845 = t2071*t132;
+    const MBPOL_POLY_REAL t5846 = t2071*t136;
+    const MBPOL_POLY_REAL t5852 = t5844+t5845+t5846+t2067*t139+t2065*t145+t2067*t146+t2065*t155+t2077
 +t5327+t2163+t2080*t212;
-    const double t5855 = t2198*t50;
-    const double t5856 = t2198*t67;
-    const double t5857 = t2195*t72;
-    const double t5858 = t2195*t73;
-    const double t5859 = t2207*t77;
-    const double t5860 = t2207*t126;
-    const double t5861 = t2189+t2191+t2192+t2193+t2194+t5855+t5856+t5857+t5858+t5859+t5860;
-    const double t5862 = t2207*t132;
-    const double t5863 = t2207*t136;
-    const double t5868 = t2078*t212;
-    const double t5870 = t5862+t5863+t2203*t139+t2201*t145+t2203*t146+t2201*t155+t2213+t2161
+    const MBPOL_POLY_REAL t5855 = t2198*t50;
+    const MBPOL_POLY_REAL t5856 = t2198*t67;
+    const MBPOL_POLY_REAL t5857 = t2195*t72;
+    const MBPOL_POLY_REAL t5858 = t2195*t73;
+    const MBPOL_POLY_REAL t5859 = t2207*t77;
+    const MBPOL_POLY_REAL t5860 = t2207*t126;
+    const MBPOL_POLY_REAL t5861 = t2189+t2191+t2192+t2193+t2194+t5855+t5856+t5857+t5858+t5859+t5860;
+    const MBPOL_POLY_REAL t5862 = t2207*t132;
+    const MBPOL_POLY_REAL t5863 = t2207*t136;
+    const MBPOL_POLY_REAL t5868 = t2078*t212;
+    const MBPOL_POLY_REAL t5870 = t5862+t5863+t2203*t139+t2201*t145+t2203*t146+t2201*t155+t2213+t2161
 +t5328+t5868+t2214*t215;
-    const double t5873 = t1988*t50;
-    const double t5874 = t1990*t67;
-    const double t5875 = t1985*t72;
-    const double t5876 = t1985*t73;
-    const double t5877 = t1994*t139;
-    const double t5879 = t2374*t146;
-    const double t5881 = t1982+t1979+t2336+t2337+t1984+t5873+t5874+t5875+t5876+t2099+t5333+
+    const MBPOL_POLY_REAL t5873 = t1988*t50;
+    const MBPOL_POLY_REAL t5874 = t1990*t67;
+    const MBPOL_POLY_REAL t5875 = t1985*t72;
+    const MBPOL_POLY_REAL t5876 = t1985*t73;
+    const MBPOL_POLY_REAL t5877 = t1994*t139;
+    const MBPOL_POLY_REAL t5879 = t2374*t146;
+    const MBPOL_POLY_REAL t5881 = t1982+t1979+t2336+t2337+t1984+t5873+t5874+t5875+t5876+t2099+t5333+
 t2102+t5335+t5877+t1992*t145+t5879+t1996*t155;
-    const double t5580 = t5824+t5835;
-    const double t5582 = t2055+t2054+t2056+t2057+t2058+t5838+t5839+t5840+t5841+t5842+t5852;
-    const double t5584 = t5861+t5870;
-    const double t5883 = t5785+t5789+t5796+t5802+t5804+t5807+t5811+t5815+t5580*t475+t5582*
+    const MBPOL_POLY_REAL t5580 = t5824+t5835;
+    const MBPOL_POLY_REAL t5582 = t2055+t2054+t2056+t2057+t2058+t5838+t5839+t5840+t5841+t5842+t5852;
+    const MBPOL_POLY_REAL t5584 = t5861+t5870;
+    const MBPOL_POLY_REAL t5883 = t5785+t5789+t5796+t5802+t5804+t5807+t5811+t5815+t5580*t475+t5582*
 t212+t5584*t215+t5881*t155;
-    const double t5884 = t2008*t50;
-    const double t5885 = t2008*t67;
-    const double t5886 = t2010*t72;
-    const double t5887 = t2010*t73;
-    const double t5888 = t2006*t77;
-    const double t5889 = t2014*t126;
-    const double t5890 = t2027+t2024+t2028+t2029+t2030+t5884+t5885+t5886+t5887+t5888+t5889;
-    const double t5891 = t2006*t132;
-    const double t5892 = t2014*t136;
-    const double t5893 = t2000*t139;
-    const double t5894 = t2002*t145;
-    const double t5895 = t2000*t146;
-    const double t5896 = t2002*t155;
-    const double t5897 = t2016*t275;
-    const double t5898 = t2018*t254;
-    const double t5899 = t2035*t212;
-    const double t5900 = t2021*t215;
-    const double t5901 = t5891+t5892+t5893+t5894+t5895+t5896+t2032+t5897+t5898+t5899+t5900+
+    const MBPOL_POLY_REAL t5884 = t2008*t50;
+    const MBPOL_POLY_REAL t5885 = t2008*t67;
+    const MBPOL_POLY_REAL t5886 = t2010*t72;
+    const MBPOL_POLY_REAL t5887 = t2010*t73;
+    const MBPOL_POLY_REAL t5888 = t2006*t77;
+    const MBPOL_POLY_REAL t5889 = t2014*t126;
+    const MBPOL_POLY_REAL t5890 = t2027+t2024+t2028+t2029+t2030+t5884+t5885+t5886+t5887+t5888+t5889;
+    const MBPOL_POLY_REAL t5891 = t2006*t132;
+    const MBPOL_POLY_REAL t5892 = t2014*t136;
+    const MBPOL_POLY_REAL t5893 = t2000*t139;
+    const MBPOL_POLY_REAL t5894 = t2002*t145;
+    const MBPOL_POLY_REAL t5895 = t2000*t146;
+    const MBPOL_POLY_REAL t5896 = t2002*t155;
+    const MBPOL_POLY_REAL t5897 = t2016*t275;
+    const MBPOL_POLY_REAL t5898 = t2018*t254;
+    const MBPOL_POLY_REAL t5899 = t2035*t212;
+    const MBPOL_POLY_REAL t5900 = t2021*t215;
+    const MBPOL_POLY_REAL t5901 = t5891+t5892+t5893+t5894+t5895+t5896+t2032+t5897+t5898+t5899+t5900+
 t5397;
-    const double t5904 = t2287*t77;
-    const double t5905 = t2289*t126;
-    const double t5906 = t2287*t132;
-    const double t5907 = t2268+t2270+t2271+t2272+t2273+t5823+t5816+t5827+t5817+t5904+t5905+
+    const MBPOL_POLY_REAL t5904 = t2287*t77;
+    const MBPOL_POLY_REAL t5905 = t2289*t126;
+    const MBPOL_POLY_REAL t5906 = t2287*t132;
+    const MBPOL_POLY_REAL t5907 = t2268+t2270+t2271+t2272+t2273+t5823+t5816+t5827+t5817+t5904+t5905+
 t5906;
-    const double t5908 = t2289*t136;
-    const double t5909 = t2299*t275;
-    const double t5910 = t2301*t254;
-    const double t5911 = t5908+t5828+t5829+t5833+t5834+t2294+t5909+t5910+t5831+t5832+t2034+
+    const MBPOL_POLY_REAL t5908 = t2289*t136;
+    const MBPOL_POLY_REAL t5909 = t2299*t275;
+    const MBPOL_POLY_REAL t5910 = t2301*t254;
+    const MBPOL_POLY_REAL t5911 = t5908+t5828+t5829+t5833+t5834+t2294+t5909+t5910+t5831+t5832+t2034+
 t2353;
-    const double t5914 = t2317*t50;
-    const double t5915 = t2317*t67;
-    const double t5916 = t2314*t72;
-    const double t5917 = t2314*t73;
-    const double t5918 = t2326*t77;
-    const double t5919 = t2326*t126;
-    const double t5920 = t2326*t132;
-    const double t5921 = t2326*t136;
-    const double t5926 = t2310+t2308+t2311+t2312+t2313+t5914+t5915+t5916+t5917+t5918+t5919+
+    const MBPOL_POLY_REAL t5914 = t2317*t50;
+    const MBPOL_POLY_REAL t5915 = t2317*t67;
+    const MBPOL_POLY_REAL t5916 = t2314*t72;
+    const MBPOL_POLY_REAL t5917 = t2314*t73;
+    const MBPOL_POLY_REAL t5918 = t2326*t77;
+    const MBPOL_POLY_REAL t5919 = t2326*t126;
+    const MBPOL_POLY_REAL t5920 = t2326*t132;
+    const MBPOL_POLY_REAL t5921 = t2326*t136;
+    const MBPOL_POLY_REAL t5926 = t2310+t2308+t2311+t2312+t2313+t5914+t5915+t5916+t5917+t5918+t5919+
 t5920+t5921+t2322*t139+t2320*t145+t2322*t146+t2320*t155+t2332;
-    const double t5595 = t2185*t72;
-    const double t5930 = (t2229+t2179+t2180+t2230+t2184+t2118+t2119+t5595)*t72;
-    const double t5599 = t2232*t72;
-    const double t5605 = t2185*t73;
-    const double t5934 = (t2181+t2228+t2180+t2183+t2231+t2118+t2119+t5599+t5605)*t73;
-    const double t5609 = t2044+t2046+t2400;
-    const double t5936 = t5609*t20;
-    const double t5937 = t2369*t50;
-    const double t5938 = t2367*t67;
-    const double t5939 = t2364*t72;
-    const double t5940 = t2364*t73;
-    const double t5942 = t2359+t2390+t2358+t2362+t2392+t5937+t5938+t5939+t5940+t5332+t2101+
+    const MBPOL_POLY_REAL t5595 = t2185*t72;
+    const MBPOL_POLY_REAL t5930 = (t2229+t2179+t2180+t2230+t2184+t2118+t2119+t5595)*t72;
+    const MBPOL_POLY_REAL t5599 = t2232*t72;
+    const MBPOL_POLY_REAL t5605 = t2185*t73;
+    const MBPOL_POLY_REAL t5934 = (t2181+t2228+t2180+t2183+t2231+t2118+t2119+t5599+t5605)*t73;
+    const MBPOL_POLY_REAL t5609 = t2044+t2046+t2400;
+    const MBPOL_POLY_REAL t5936 = t5609*t20;
+    const MBPOL_POLY_REAL t5937 = t2369*t50;
+    const MBPOL_POLY_REAL t5938 = t2367*t67;
+    const MBPOL_POLY_REAL t5939 = t2364*t72;
+    const MBPOL_POLY_REAL t5940 = t2364*t73;
+    const MBPOL_POLY_REAL t5942 = t2359+t2390+t2358+t2362+t2392+t5937+t5938+t5939+t5940+t5332+t2101+
 t5334+t2103+t2376*t139;
-    const double t5944 = t1990*t50;
-    const double t5945 = t1988*t67;
-    const double t5946 = t2374*t139;
-    const double t5948 = t1982+t2335+t1981+t1983+t2338+t5944+t5945+t5875+t5876+t2099+t5333+
+    const MBPOL_POLY_REAL t5944 = t1990*t50;
+    const MBPOL_POLY_REAL t5945 = t1988*t67;
+    const MBPOL_POLY_REAL t5946 = t2374*t139;
+    const MBPOL_POLY_REAL t5948 = t1982+t2335+t1981+t1983+t2338+t5944+t5945+t5875+t5876+t2099+t5333+
 t2102+t5335+t5946+t1996*t145;
-    const double t5950 = t2367*t50;
-    const double t5951 = t2369*t67;
-    const double t5953 = t1994*t145;
-    const double t5955 = t2359+t2361+t2389+t2391+t2363+t5950+t5951+t5939+t5940+t5332+t2101+
+    const MBPOL_POLY_REAL t5950 = t2367*t50;
+    const MBPOL_POLY_REAL t5951 = t2369*t67;
+    const MBPOL_POLY_REAL t5953 = t1994*t145;
+    const MBPOL_POLY_REAL t5955 = t2359+t2361+t2389+t2391+t2363+t5950+t5951+t5939+t5940+t5332+t2101+
 t5334+t2103+t2372*t139+t5953+t2376*t146;
-    const double t5957 = t2142*t50;
-    const double t5958 = t2142*t67;
-    const double t5959 = t2139*t72;
-    const double t5960 = t2139*t73;
-    const double t5961 = t2154*t77;
-    const double t5962 = t2152*t126;
-    const double t5963 = t2154*t132;
-    const double t5964 = t2152*t136;
-    const double t5965 = t2147*t139;
-    const double t5966 = t2145*t145;
-    const double t5967 = t2147*t146;
-    const double t5968 = t2145*t155;
-    const double t5969 = t2166*t275;
-    const double t5970 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5961+t5962+
+    const MBPOL_POLY_REAL t5957 = t2142*t50;
+    const MBPOL_POLY_REAL t5958 = t2142*t67;
+    const MBPOL_POLY_REAL t5959 = t2139*t72;
+    const MBPOL_POLY_REAL t5960 = t2139*t73;
+    const MBPOL_POLY_REAL t5961 = t2154*t77;
+    const MBPOL_POLY_REAL t5962 = t2152*t126;
+    const MBPOL_POLY_REAL t5963 = t2154*t132;
+    const MBPOL_POLY_REAL t5964 = t2152*t136;
+    const MBPOL_POLY_REAL t5965 = t2147*t139;
+    const MBPOL_POLY_REAL t5966 = t2145*t145;
+    const MBPOL_POLY_REAL t5967 = t2147*t146;
+    const MBPOL_POLY_REAL t5968 = t2145*t155;
+    const MBPOL_POLY_REAL t5969 = t2166*t275;
+    const MBPOL_POLY_REAL t5970 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5961+t5962+
 t5963+t5964+t5965+t5966+t5967+t5968+t2159+t5969;
-    const double t5972 = t2152*t77;
-    const double t5973 = t2154*t126;
-    const double t5974 = t2152*t132;
-    const double t5975 = t2154*t136;
-    const double t5976 = t2164*t275;
-    const double t5977 = t2166*t254;
-    const double t5978 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5972+t5973+
+    const MBPOL_POLY_REAL t5972 = t2152*t77;
+    const MBPOL_POLY_REAL t5973 = t2154*t126;
+    const MBPOL_POLY_REAL t5974 = t2152*t132;
+    const MBPOL_POLY_REAL t5975 = t2154*t136;
+    const MBPOL_POLY_REAL t5976 = t2164*t275;
+    const MBPOL_POLY_REAL t5977 = t2166*t254;
+    const MBPOL_POLY_REAL t5978 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5972+t5973+
 t5974+t5975+t5965+t5966+t5967+t5968+t2159+t5976+t5977;
-    const double t5980 = t2014*t77;
-    const double t5981 = t2014*t132;
-    const double t5982 = t2016*t254;
-    const double t5983 = t2018*t275;
-    const double t5984 = t2006*t126;
-    const double t5985 = t2006*t136;
-    const double t5986 = t2024+t5980+t5981+t5982+t5983+t5984+t5985+t2027+t2028+t2029+t2030+
+    const MBPOL_POLY_REAL t5980 = t2014*t77;
+    const MBPOL_POLY_REAL t5981 = t2014*t132;
+    const MBPOL_POLY_REAL t5982 = t2016*t254;
+    const MBPOL_POLY_REAL t5983 = t2018*t275;
+    const MBPOL_POLY_REAL t5984 = t2006*t126;
+    const MBPOL_POLY_REAL t5985 = t2006*t136;
+    const MBPOL_POLY_REAL t5986 = t2024+t5980+t5981+t5982+t5983+t5984+t5985+t2027+t2028+t2029+t2030+
 t5884;
-    const double t5987 = t5885+t5886+t5887+t2032+t2038+t5893+t5894+t5895+t5896+t5899+t5900+
+    const MBPOL_POLY_REAL t5987 = t5885+t5886+t5887+t2032+t2038+t5893+t5894+t5895+t5896+t5899+t5900+
 t5371+t2040;
-    const double t5623 = t5890+t5901;
-    const double t5646 = t5907+t5911;
-    const double t5663 = t5986+t5987;
-    const double t5990 = t5623*t143+t5646*t309+t5926*t179+t5930+t5934+t2388+t5936+t5942*t139
+    const MBPOL_POLY_REAL t5623 = t5890+t5901;
+    const MBPOL_POLY_REAL t5646 = t5907+t5911;
+    const MBPOL_POLY_REAL t5663 = t5986+t5987;
+    const MBPOL_POLY_REAL t5990 = t5623*t143+t5646*t309+t5926*t179+t5930+t5934+t2388+t5936+t5942*t139
 +t5948*t145+t5955*t146+t5970*t275+t5978*t254+t5663*t240;
-    const double t5993 = t1481*t126;
-    const double t5994 = t1479*t77;
-    const double t5995 = t1493*t254;
-    const double t5996 = t1479*t132;
-    const double t5997 = t1481*t136;
-    const double t5998 = t2515*t240;
-    const double t5999 = t1491*t275;
-    const double t6000 = t5222+t5993+t5994+t5995+t5996+t5997+t3005+t5998+t5999+t1460+t5750+
+    const MBPOL_POLY_REAL t5993 = t1481*t126;
+    const MBPOL_POLY_REAL t5994 = t1479*t77;
+    const MBPOL_POLY_REAL t5995 = t1493*t254;
+    const MBPOL_POLY_REAL t5996 = t1479*t132;
+    const MBPOL_POLY_REAL t5997 = t1481*t136;
+    const MBPOL_POLY_REAL t5998 = t2515*t240;
+    const MBPOL_POLY_REAL t5999 = t1491*t275;
+    const MBPOL_POLY_REAL t6000 = t5222+t5993+t5994+t5995+t5996+t5997+t3005+t5998+t5999+t1460+t5750+
 t5751+t5752;
-    const double t6002 = t5753+t5756+t5757+t1495*t309+t5741+t5742+t5743+t5744+t1486+t1462+
+    const MBPOL_POLY_REAL t6002 = t5753+t5756+t5757+t1495*t309+t5741+t5742+t5743+t5744+t1486+t1462+
 t1463+t1464+t1465;
-    const double t6005 = t1450*t50;
-    const double t6006 = t1452*t67;
-    const double t6008 = t1444+t1441+t1886+t1887+t1446+t6005+t6006+t5593+t5594+t5084+t1915+
+    const MBPOL_POLY_REAL t6005 = t1450*t50;
+    const MBPOL_POLY_REAL t6006 = t1452*t67;
+    const MBPOL_POLY_REAL t6008 = t1444+t1441+t1886+t1887+t1446+t6005+t6006+t5593+t5594+t5084+t1915+
 t5086+t1917+t1456*t139;
-    const double t6010 = t1432*t50;
-    const double t6011 = t1434*t67;
-    const double t6012 = t1454*t139;
-    const double t6014 = t1423+t1424+t1852+t1853+t1428+t6010+t6011+t5602+t5603+t1913+t5085+
+    const MBPOL_POLY_REAL t6010 = t1432*t50;
+    const MBPOL_POLY_REAL t6011 = t1434*t67;
+    const MBPOL_POLY_REAL t6012 = t1454*t139;
+    const MBPOL_POLY_REAL t6014 = t1423+t1424+t1852+t1853+t1428+t6010+t6011+t5602+t5603+t1913+t5085+
 t1916+t5087+t6012+t1436*t145;
-    const double t5678 = t5748+t5758;
-    const double t5681 = t5767+t5768;
-    const double t5702 = (t5883+t5990)*t3120;
-    const double t5703 = t6000+t6002;
-    const double t6016 = t5727+t5734+t5740+t1850+t5678*t309+t5681*t240+t5772+t5774+t5778+
+    const MBPOL_POLY_REAL t5678 = t5748+t5758;
+    const MBPOL_POLY_REAL t5681 = t5767+t5768;
+    const MBPOL_POLY_REAL t5702 = (t5883+t5990)*t3120;
+    const MBPOL_POLY_REAL t5703 = t6000+t6002;
+    const MBPOL_POLY_REAL t6016 = t5727+t5734+t5740+t1850+t5678*t309+t5681*t240+t5772+t5774+t5778+
 t5702+t5703*t475+t6008*t139+t6014*t145;
-    const double t6019 = t69+t74+t79+t84+t105+t157+t256+t294+t313+t625+t628;
-    const double t6020 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t642+t94+t643+t96+
+    const MBPOL_POLY_REAL t6019 = t69+t74+t79+t84+t105+t157+t256+t294+t313+t625+t628;
+    const MBPOL_POLY_REAL t6020 = t259+t262+t295+t296+t264+t297+t298+t299+t300+t642+t94+t643+t96+
 t5507;
-    const double t6022 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t301+t638+t304+t639+t306+t5464;
-    const double t6024 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t642+t94+t643+t96+
+    const MBPOL_POLY_REAL t6022 = t51+t53+t85+t86+t57+t87+t88+t89+t90+t301+t638+t304+t639+t306+t5464;
+    const MBPOL_POLY_REAL t6024 = t262+t314+t261+t263+t315+t460+t461+t299+t300+t642+t94+t643+t96+
 t5487+t406+t5488;
-    const double t6026 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t301+t638+t304+t639+t462+
+    const MBPOL_POLY_REAL t6026 = t51+t278+t55+t56+t279+t403+t404+t89+t90+t301+t638+t304+t639+t462+
 t5448+t464+t5449;
-    const double t6028 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t650+t651+t652+t653+
+    const MBPOL_POLY_REAL t6028 = t191+t193+t194+t195+t196+t198+t199+t200+t201+t650+t651+t652+t653+
 t5491+t5492+t5493+t5494+t213;
-    const double t6030 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t656+t657+t658+t659+
+    const MBPOL_POLY_REAL t6030 = t217+t218+t219+t220+t221+t223+t224+t226+t227+t656+t657+t658+t659+
 t5497+t5498+t5499+t5500+t241+t660;
-    const double t6032 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t663+t664+t665+t666+
+    const MBPOL_POLY_REAL t6032 = t410+t412+t413+t414+t415+t445+t446+t447+t448+t663+t664+t665+t666+
 t5519+t5520+t5521+t5522+t436+t243+t667;
-    const double t6035 = t680+t682+t683+t5479+t5480+t5481+t5482+t241+t684+t439+t5483;
-    const double t6038 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t670+t672;
-    const double t6039 = t673+t674+t5511+t5512+t5513+t5514+t436+t395+t675+t398+t5515;
-    const double t6042 = t334+t330+t331+t332+t335+t337+t338+t339+t340+t699+t700;
-    const double t6044 = t701+t703+t5455+t5456+t5457+t5458+t349+t704+t705+t5459+t5460+t325*
+    const MBPOL_POLY_REAL t6035 = t680+t682+t683+t5479+t5480+t5481+t5482+t241+t684+t439+t5483;
+    const MBPOL_POLY_REAL t6038 = t410+t412+t413+t414+t415+t417+t418+t420+t421+t670+t672;
+    const MBPOL_POLY_REAL t6039 = t673+t674+t5511+t5512+t5513+t5514+t436+t395+t675+t398+t5515;
+    const MBPOL_POLY_REAL t6042 = t334+t330+t331+t332+t335+t337+t338+t339+t340+t699+t700;
+    const MBPOL_POLY_REAL t6044 = t701+t703+t5455+t5456+t5457+t5458+t349+t704+t705+t5459+t5460+t325*
 t143;
-    const double t5725 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t679+t6035;
-    const double t5730 = t6038+t6039;
-    const double t5735 = (t6042+t6044)*t143;
-    const double t6047 = t632+t637+t6020*t139+t6022*t145+t6024*t146+t6026*t155+t6028*t179+
+    const MBPOL_POLY_REAL t5725 = t217+t218+t219+t220+t221+t381+t382+t383+t384+t679+t6035;
+    const MBPOL_POLY_REAL t5730 = t6038+t6039;
+    const MBPOL_POLY_REAL t5735 = (t6042+t6044)*t143;
+    const MBPOL_POLY_REAL t6047 = t632+t637+t6020*t139+t6022*t145+t6024*t146+t6026*t155+t6028*t179+
 t6030*t275+t6032*t254+t5725*t212+t5730*t215+t5735;
-    const double t6056 = t5669+t5671+t5672+t3133*t139+t3135*t145+t3133*t146+t3135*t155+t3145
+    const MBPOL_POLY_REAL t6056 = t5669+t5671+t5672+t3133*t139+t3135*t145+t3133*t146+t3135*t155+t3145
 +t1970+t5241+t3146*t212;
-    const double t6060 = t2497*t212;
-    const double t6061 = t3004+t5761+t5762+t5763+t3005+t5998+t5764+t3009*t309+t5765+t5766+
+    const MBPOL_POLY_REAL t6060 = t2497*t212;
+    const MBPOL_POLY_REAL t6061 = t3004+t5761+t5762+t5763+t3005+t5998+t5764+t3009*t309+t5765+t5766+
 t6060+t2507+t2509;
-    const double t6062 = t2476*t139;
-    const double t6063 = t2493*t145;
-    const double t6064 = t2476*t146;
-    const double t6065 = t2493*t155;
-    const double t6066 = t2499*t215;
-    const double t6067 = t2510+t2511+t2512+t5682+t5683+t5684+t5685+t6062+t6063+t6064+t6065+
+    const MBPOL_POLY_REAL t6062 = t2476*t139;
+    const MBPOL_POLY_REAL t6063 = t2493*t145;
+    const MBPOL_POLY_REAL t6064 = t2476*t146;
+    const MBPOL_POLY_REAL t6065 = t2493*t155;
+    const MBPOL_POLY_REAL t6066 = t2499*t215;
+    const MBPOL_POLY_REAL t6067 = t2510+t2511+t2512+t5682+t5683+t5684+t5685+t6062+t6063+t6064+t6065+
 t2514+t6066;
-    const double t6074 = t2435+t2436+t2437+t2438+t2439+t5610+t5611+t5612+t5613+t5614+t5615+
+    const MBPOL_POLY_REAL t6074 = t2435+t2436+t2437+t2438+t2439+t5610+t5611+t5612+t5613+t5614+t5615+
 t5616+t5617+t2446*t139+t2448*t145+t2446*t146+t2448*t155+t2458;
-    const double t6077 = t1423+t1424+t1852+t1853+t1428+t6010+t6011+t5602+t5603+t1913+t5085+
+    const MBPOL_POLY_REAL t6077 = t1423+t1424+t1852+t1853+t1428+t6010+t6011+t5602+t5603+t1913+t5085+
 t1916+t5087+t1436*t139;
-    const double t5783 = t3121+t3123+t3124+t3125+t3126+t5664+t5665+t5666+t5667+t5668+t6056;
-    const double t5786 = t6061+t6067;
-    const double t6079 = t5705+t5708+t5712+t5715+t5719+t5727+t5734+t5740+t5783*t212+t5786*
+    const MBPOL_POLY_REAL t5783 = t3121+t3123+t3124+t3125+t3126+t5664+t5665+t5666+t5667+t5668+t6056;
+    const MBPOL_POLY_REAL t5786 = t6061+t6067;
+    const MBPOL_POLY_REAL t6079 = t5705+t5708+t5712+t5715+t5719+t5727+t5734+t5740+t5783*t212+t5786*
 t475+t1850+t6074*t179+t6077*t139;
-    const double t6080 = t5993+t5994+t5245+t5995+t2481+t5996+t5997+t1496+t5999+t1460+t5741+
+    const MBPOL_POLY_REAL t6080 = t5993+t5994+t5245+t5995+t2481+t5996+t5997+t1496+t5999+t1460+t5741+
 t5742;
-    const double t6081 = t1472*t139;
-    const double t6082 = t1474*t145;
-    const double t6083 = t1472*t146;
-    const double t6084 = t1474*t155;
-    const double t6085 = t1487*t212;
-    const double t6086 = t1489*t215;
-    const double t6087 = t5743+t5744+t6081+t6082+t6083+t6084+t1486+t6085+t6086+t1462+t1463+
+    const MBPOL_POLY_REAL t6081 = t1472*t139;
+    const MBPOL_POLY_REAL t6082 = t1474*t145;
+    const MBPOL_POLY_REAL t6083 = t1472*t146;
+    const MBPOL_POLY_REAL t6084 = t1474*t155;
+    const MBPOL_POLY_REAL t6085 = t1487*t212;
+    const MBPOL_POLY_REAL t6086 = t1489*t215;
+    const MBPOL_POLY_REAL t6087 = t5743+t5744+t6081+t6082+t6083+t6084+t1486+t6085+t6086+t1462+t1463+
 t1464+t1465;
-    const double t6090 = t2509+t2507+t2510+t2511+t2512+t5682+t5683+t5684+t5685+t5686+t5687+
+    const MBPOL_POLY_REAL t6090 = t2509+t2507+t2510+t2511+t2512+t5682+t5683+t5684+t5685+t5686+t5687+
 t5689;
-    const double t6091 = t5690+t6062+t6063+t6064+t6065+t2514+t5695+t5696+t6060+t6066+t2516+
+    const MBPOL_POLY_REAL t6091 = t5690+t6062+t6063+t6064+t6065+t2514+t5695+t5696+t6060+t6066+t2516+
 t5069;
-    const double t6094 = t1954*t139;
-    const double t6095 = t1957*t145;
-    const double t6096 = t1954*t146;
-    const double t6097 = t1957*t155;
-    const double t6098 = t1942+t1944+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5639+t5640+
+    const MBPOL_POLY_REAL t6094 = t1954*t139;
+    const MBPOL_POLY_REAL t6095 = t1957*t145;
+    const MBPOL_POLY_REAL t6096 = t1954*t146;
+    const MBPOL_POLY_REAL t6097 = t1957*t155;
+    const MBPOL_POLY_REAL t6098 = t1942+t1944+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5639+t5640+
 t5641+t5642+t6094+t6095+t6096+t6097+t1968+t5643+t5644;
-    const double t6100 = t1514*t50;
-    const double t6101 = t1512*t67;
-    const double t6102 = t1509*t72;
-    const double t6103 = t1509*t73;
-    const double t6107 = t1525+t1504+t1503+t1507+t1528+t6100+t6101+t6102+t6103+t1630+t1631+
+    const MBPOL_POLY_REAL t6100 = t1514*t50;
+    const MBPOL_POLY_REAL t6101 = t1512*t67;
+    const MBPOL_POLY_REAL t6102 = t1509*t72;
+    const MBPOL_POLY_REAL t6103 = t1509*t73;
+    const MBPOL_POLY_REAL t6107 = t1525+t1504+t1503+t1507+t1528+t6100+t6101+t6102+t6103+t1630+t1631+
 t1632+t1633+t1533*t139+t1531*t145+t1516*t146;
-    const double t6134 = t1697+t1698+t1699+t1700+t1701+t1705*t50+t1705*t67+t1702*t72+t1702*
+    const MBPOL_POLY_REAL t6134 = t1697+t1698+t1699+t1700+t1701+t1705*t50+t1705*t67+t1702*t72+t1702*
 t73+t1713*t77+t1713*t126+t1713*t132+t1713*t136+t1708*t139+t1708*t145+t1708*t146
 +t1708*t155+t1719;
-    const double t6136 = t1548*t50;
-    const double t6137 = t1548*t67;
-    const double t6138 = t1545*t72;
-    const double t6139 = t1545*t73;
-    const double t6140 = t1557*t77;
-    const double t6142 = t1557*t126;
-    const double t6143 = t1557*t132;
-    const double t6144 = t1557*t136;
-    const double t6150 = t6142+t6143+t6144+t1551*t139+t1553*t145+t1551*t146+t1553*t155+t1563
+    const MBPOL_POLY_REAL t6136 = t1548*t50;
+    const MBPOL_POLY_REAL t6137 = t1548*t67;
+    const MBPOL_POLY_REAL t6138 = t1545*t72;
+    const MBPOL_POLY_REAL t6139 = t1545*t73;
+    const MBPOL_POLY_REAL t6140 = t1557*t77;
+    const MBPOL_POLY_REAL t6142 = t1557*t126;
+    const MBPOL_POLY_REAL t6143 = t1557*t132;
+    const MBPOL_POLY_REAL t6144 = t1557*t136;
+    const MBPOL_POLY_REAL t6150 = t6142+t6143+t6144+t1551*t139+t1553*t145+t1551*t146+t1553*t155+t1563
 +t1671+t1672+t1564*t212;
-    const double t6153 = t1626*t50;
-    const double t6154 = t1626*t67;
-    const double t6155 = t1624*t72;
-    const double t6156 = t1622*t73;
-    const double t6160 = t1622*t72;
-    const double t6161 = t1624*t73;
-    const double t6166 = t1723+t1616+t1617+t1724+t1621+t6153+t6154+t6160+t6161+t1634*t77+
+    const MBPOL_POLY_REAL t6153 = t1626*t50;
+    const MBPOL_POLY_REAL t6154 = t1626*t67;
+    const MBPOL_POLY_REAL t6155 = t1624*t72;
+    const MBPOL_POLY_REAL t6156 = t1622*t73;
+    const MBPOL_POLY_REAL t6160 = t1622*t72;
+    const MBPOL_POLY_REAL t6161 = t1624*t73;
+    const MBPOL_POLY_REAL t6166 = t1723+t1616+t1617+t1724+t1621+t6153+t6154+t6160+t6161+t1634*t77+
 t1636*t126+t1638*t132+t1640*t136;
-    const double t6168 = t1653*t50;
-    const double t6169 = t1653*t67;
-    const double t6170 = t1650*t72;
-    const double t6171 = t1650*t73;
-    const double t6176 = t1656*t139;
-    const double t6177 = t1656*t145;
-    const double t6178 = t1656*t146;
-    const double t6179 = t1656*t155;
-    const double t6182 = t1646+t1644+t1647+t1648+t1649+t6168+t6169+t6170+t6171+t1662*t77+
+    const MBPOL_POLY_REAL t6168 = t1653*t50;
+    const MBPOL_POLY_REAL t6169 = t1653*t67;
+    const MBPOL_POLY_REAL t6170 = t1650*t72;
+    const MBPOL_POLY_REAL t6171 = t1650*t73;
+    const MBPOL_POLY_REAL t6176 = t1656*t139;
+    const MBPOL_POLY_REAL t6177 = t1656*t145;
+    const MBPOL_POLY_REAL t6178 = t1656*t146;
+    const MBPOL_POLY_REAL t6179 = t1656*t155;
+    const MBPOL_POLY_REAL t6182 = t1646+t1644+t1647+t1648+t1649+t6168+t6169+t6170+t6171+t1662*t77+
 t1664*t126+t1662*t132+t1664*t136+t6176+t6177+t6178+t6179+t1669+t1673*t275+t1675
 *t254;
-    const double t5880 = t1568+t1731*t20+t1829+t1739*t26+t1830;
-    const double t5902 = t1751*t72;
-    const double t5913 = t1690*t50;
-    const double t5922 = t1692*t67;
-    const double t5929 = t1541+t1539+t1542+t1543+t1544+t6136+t6137+t6138+t6139+t6140+t6150;
-    const double t5932 = t1640*t77;
-    const double t6186 = t6107*t146+t5880*t37+(t1804+t1745+t1746+t1805+t1750+t1688+t1689+
+    const MBPOL_POLY_REAL t5880 = t1568+t1731*t20+t1829+t1739*t26+t1830;
+    const MBPOL_POLY_REAL t5902 = t1751*t72;
+    const MBPOL_POLY_REAL t5913 = t1690*t50;
+    const MBPOL_POLY_REAL t5922 = t1692*t67;
+    const MBPOL_POLY_REAL t5929 = t1541+t1539+t1542+t1543+t1544+t6136+t6137+t6138+t6139+t6140+t6150;
+    const MBPOL_POLY_REAL t5932 = t1640*t77;
+    const MBPOL_POLY_REAL t6186 = t6107*t146+t5880*t37+(t1804+t1745+t1746+t1805+t1750+t1688+t1689+
 t5902)*t72+(t1681+t1682+t1813+t1814+t1686+t5913+t5922)*t67+(t1732+t1568+t1738+
 t1741)*t26+t6134*t179+t5929*t212+(t1617+t1618+t1722+t1620+t1725+t6153+t6154+
 t6155+t6156+t5932)*t77+t6166*t136+t1572+t6182*t254+(t1740+t1568+t1733)*t20;
-    const double t6191 = t1541+t1539+t1542+t1543+t1544+t6136+t6137+t6138+t6139+t6140+t6142;
-    const double t6198 = t6143+t6144+t1553*t139+t1551*t145+t1553*t146+t1551*t155+t1563+t1671
+    const MBPOL_POLY_REAL t6191 = t1541+t1539+t1542+t1543+t1544+t6136+t6137+t6138+t6139+t6140+t6142;
+    const MBPOL_POLY_REAL t6198 = t6143+t6144+t1553*t139+t1551*t145+t1553*t146+t1551*t155+t1563+t1671
 +t1672+t1780*t212+t1564*t215;
-    const double t6206 = t1646+t1644+t1647+t1648+t1649+t6168+t6169+t6170+t6171+t1664*t77+
+    const MBPOL_POLY_REAL t6206 = t1646+t1644+t1647+t1648+t1649+t6168+t6169+t6170+t6171+t1664*t77+
 t1662*t126+t1664*t132+t1662*t136+t6176+t6177+t6178+t6179+t1669+t1675*t275;
-    const double t6208 = t1585*t145;
-    const double t6211 = t1600*t215;
-    const double t6212 = t1587*t146;
-    const double t6213 = t1602*t212;
-    const double t6214 = t1585*t155;
-    const double t6215 = t1587*t139;
-    const double t6216 = t1592*t132;
-    const double t6217 = t1594*t136;
-    const double t6218 = t1582*t50;
-    const double t6219 = t1819+t6208+t1757*t240+t1608*t309+t6211+t1820+t6212+t6213+t6214+
+    const MBPOL_POLY_REAL t6208 = t1585*t145;
+    const MBPOL_POLY_REAL t6211 = t1600*t215;
+    const MBPOL_POLY_REAL t6212 = t1587*t146;
+    const MBPOL_POLY_REAL t6213 = t1602*t212;
+    const MBPOL_POLY_REAL t6214 = t1585*t155;
+    const MBPOL_POLY_REAL t6215 = t1587*t139;
+    const MBPOL_POLY_REAL t6216 = t1592*t132;
+    const MBPOL_POLY_REAL t6217 = t1594*t136;
+    const MBPOL_POLY_REAL t6218 = t1582*t50;
+    const MBPOL_POLY_REAL t6219 = t1819+t6208+t1757*t240+t1608*t309+t6211+t1820+t6212+t6213+t6214+
 t6215+t6216+t6217+t6218;
-    const double t6220 = t1579*t72;
-    const double t6221 = t1582*t67;
-    const double t6222 = t1604*t275;
-    const double t6223 = t1606*t254;
-    const double t6224 = t1579*t73;
-    const double t6225 = t1592*t77;
-    const double t6226 = t1594*t126;
-    const double t6227 = t6220+t6221+t1576+t1599+t1577+t6222+t6223+t6224+t1578+t6225+t6226+
+    const MBPOL_POLY_REAL t6220 = t1579*t72;
+    const MBPOL_POLY_REAL t6221 = t1582*t67;
+    const MBPOL_POLY_REAL t6222 = t1604*t275;
+    const MBPOL_POLY_REAL t6223 = t1606*t254;
+    const MBPOL_POLY_REAL t6224 = t1579*t73;
+    const MBPOL_POLY_REAL t6225 = t1592*t77;
+    const MBPOL_POLY_REAL t6226 = t1594*t126;
+    const MBPOL_POLY_REAL t6227 = t6220+t6221+t1576+t1599+t1577+t6222+t6223+t6224+t1578+t6225+t6226+
 t1575+t1573;
-    const double t6234 = t1525+t1504+t1503+t1507+t1528+t6100+t6101+t6102+t6103+t1630+t1631+
+    const MBPOL_POLY_REAL t6234 = t1525+t1504+t1503+t1507+t1528+t6100+t6101+t6102+t6103+t1630+t1631+
 t1632+t1633+t1531*t139+t1533*t145+t1520*t146+t1516*t155;
-    const double t6236 = t1512*t50;
-    const double t6237 = t1514*t67;
-    const double t6239 = t1506+t1504+t1526+t1527+t1508+t6236+t6237+t6102+t6103+t1630+t1631+
+    const MBPOL_POLY_REAL t6236 = t1512*t50;
+    const MBPOL_POLY_REAL t6237 = t1514*t67;
+    const MBPOL_POLY_REAL t6239 = t1506+t1504+t1526+t1527+t1508+t6236+t6237+t6102+t6103+t1630+t1631+
 t1632+t1633+t1516*t139;
-    const double t6241 = t1594*t77;
-    const double t6242 = t1592*t126;
-    const double t6243 = t1573+t1575+t1576+t1577+t1578+t6218+t6221+t6220+t6224+t6241+t6242;
-    const double t6244 = t1594*t132;
-    const double t6245 = t1592*t136;
-    const double t6246 = t1585*t139;
-    const double t6247 = t1587*t145;
-    const double t6248 = t1585*t146;
-    const double t6249 = t1587*t155;
-    const double t6250 = t1606*t275;
-    const double t6251 = t1604*t254;
-    const double t6252 = t1600*t212;
-    const double t6253 = t1602*t215;
-    const double t6254 = t6244+t6245+t6246+t6247+t6248+t6249+t1599+t6250+t6251+t6252+t6253+
+    const MBPOL_POLY_REAL t6241 = t1594*t77;
+    const MBPOL_POLY_REAL t6242 = t1592*t126;
+    const MBPOL_POLY_REAL t6243 = t1573+t1575+t1576+t1577+t1578+t6218+t6221+t6220+t6224+t6241+t6242;
+    const MBPOL_POLY_REAL t6244 = t1594*t132;
+    const MBPOL_POLY_REAL t6245 = t1592*t136;
+    const MBPOL_POLY_REAL t6246 = t1585*t139;
+    const MBPOL_POLY_REAL t6247 = t1587*t145;
+    const MBPOL_POLY_REAL t6248 = t1585*t146;
+    const MBPOL_POLY_REAL t6249 = t1587*t155;
+    const MBPOL_POLY_REAL t6250 = t1606*t275;
+    const MBPOL_POLY_REAL t6251 = t1604*t254;
+    const MBPOL_POLY_REAL t6252 = t1600*t212;
+    const MBPOL_POLY_REAL t6253 = t1602*t215;
+    const MBPOL_POLY_REAL t6254 = t6244+t6245+t6246+t6247+t6248+t6249+t1599+t6250+t6251+t6252+t6253+
 t1834;
-    const double t6259 = t1506+t1504+t1526+t1527+t1508+t6236+t6237+t6102+t6103+t1630+t1631+
+    const MBPOL_POLY_REAL t6259 = t1506+t1504+t1526+t1527+t1508+t6236+t6237+t6102+t6103+t1630+t1631+
 t1632+t1633+t1520*t139+t1516*t145;
-    const double t6261 = t1573+t1575+t1576+t1577+t1578+t6218+t6221+t6220+t6224+t6241+t6242+
+    const MBPOL_POLY_REAL t6261 = t1573+t1575+t1576+t1577+t1578+t6218+t6221+t6220+t6224+t6241+t6242+
 t6244;
-    const double t6262 = t6245+t6215+t6208+t6212+t6214+t1599+t6250+t6251+t6213+t6211+t1758+
+    const MBPOL_POLY_REAL t6262 = t6245+t6215+t6208+t6212+t6214+t1599+t6250+t6251+t6213+t6211+t1758+
 t1611;
-    const double t6270 = t1617+t1618+t1722+t1620+t1725+t6153+t6154+t6155+t6156+t1638*t77+
+    const MBPOL_POLY_REAL t6270 = t1617+t1618+t1722+t1620+t1725+t6153+t6154+t6155+t6156+t1638*t77+
 t1640*t126;
-    const double t6272 = t6216+t6217+t1759+t6218+t6220+t6221+t1576+t1599+t1577+t6222+t6223+
+    const MBPOL_POLY_REAL t6272 = t6216+t6217+t1759+t6218+t6220+t6221+t1576+t1599+t1577+t6222+t6223+
 t6224;
-    const double t6273 = t1578+t1762+t1609+t6246+t6225+t6226+t6247+t6252+t6248+t6249+t6253+
+    const MBPOL_POLY_REAL t6273 = t1578+t1762+t1609+t6246+t6225+t6226+t6247+t6252+t6248+t6249+t6253+
 t1575+t1573;
-    const double t6279 = t1723+t1616+t1617+t1724+t1621+t6153+t6154+t6160+t6161+t1636*t77+
+    const MBPOL_POLY_REAL t6279 = t1723+t1616+t1617+t1724+t1621+t6153+t6154+t6160+t6161+t1636*t77+
 t1634*t126+t1640*t132;
-    const double t6034 = t1807*t72;
-    const double t6036 = t1751*t73;
-    const double t6041 = t6191+t6198;
-    const double t6046 = t6219+t6227;
-    const double t6051 = t6243+t6254;
-    const double t6054 = t6261+t6262;
-    const double t6057 = t1692*t50;
-    const double t6069 = t6272+t6273;
-    const double t6281 = (t1746+t1803+t1747+t1749+t1806+t1688+t1689+t6034+t6036)*t73+t6041*
+    const MBPOL_POLY_REAL t6034 = t1807*t72;
+    const MBPOL_POLY_REAL t6036 = t1751*t73;
+    const MBPOL_POLY_REAL t6041 = t6191+t6198;
+    const MBPOL_POLY_REAL t6046 = t6219+t6227;
+    const MBPOL_POLY_REAL t6051 = t6243+t6254;
+    const MBPOL_POLY_REAL t6054 = t6261+t6262;
+    const MBPOL_POLY_REAL t6057 = t1692*t50;
+    const MBPOL_POLY_REAL t6069 = t6272+t6273;
+    const MBPOL_POLY_REAL t6281 = (t1746+t1803+t1747+t1749+t1806+t1688+t1689+t6034+t6036)*t73+t6041*
 t215+t6206*t275+t6046*t475+t6234*t155+t6239*t139+t6051*t143+t6259*t145+t6054*
 t309+(t1812+t1682+t1684+t1685+t1815+t6057)*t50+t6270*t126+t6069*t240+t6279*t132
 ;
-    const double t6285 = t1441+t1444+t1886+t1887+t1446+t6005+t6006+t5593+t5594+t5084+t1915+
+    const MBPOL_POLY_REAL t6285 = t1441+t1444+t1886+t1887+t1446+t6005+t6006+t5593+t5594+t5084+t1915+
 t5086+t1917+t6012+t1456*t145;
-    const double t6287 = t2535+t2537+t2538+t2539+t2540+t5647+t5648+t5649+t5650+t5651+t5653;
-    const double t6293 = t5654+t5655+t2547*t139+t2549*t145+t2547*t146+t2549*t155+t2559+t5240
+    const MBPOL_POLY_REAL t6287 = t2535+t2537+t2538+t2539+t2540+t5647+t5648+t5649+t5650+t5651+t5653;
+    const MBPOL_POLY_REAL t6293 = t5654+t5655+t2547*t139+t2549*t145+t2547*t146+t2549*t155+t2559+t5240
 +t1972+t5677+t2562*t215;
-    const double t6296 = t2268+t2270+t2271+t2272+t2273+t5823+t5816+t5827+t5817+t5904+t5905;
-    const double t6297 = t2280*t139;
-    const double t6298 = t2282*t145;
-    const double t6299 = t2280*t146;
-    const double t6300 = t2282*t155;
-    const double t6301 = t2295*t212;
-    const double t6302 = t2297*t215;
-    const double t6303 = t5906+t5908+t6297+t6298+t6299+t6300+t2294+t5909+t5910+t6301+t6302+
+    const MBPOL_POLY_REAL t6296 = t2268+t2270+t2271+t2272+t2273+t5823+t5816+t5827+t5817+t5904+t5905;
+    const MBPOL_POLY_REAL t6297 = t2280*t139;
+    const MBPOL_POLY_REAL t6298 = t2282*t145;
+    const MBPOL_POLY_REAL t6299 = t2280*t146;
+    const MBPOL_POLY_REAL t6300 = t2282*t155;
+    const MBPOL_POLY_REAL t6301 = t2295*t212;
+    const MBPOL_POLY_REAL t6302 = t2297*t215;
+    const MBPOL_POLY_REAL t6303 = t5906+t5908+t6297+t6298+t6299+t6300+t2294+t5909+t5910+t6301+t6302+
 t2304;
-    const double t6308 = t1979+t1982+t2336+t2337+t1984+t5873+t5874+t5875+t5876+t2099+t5333+
+    const MBPOL_POLY_REAL t6308 = t1979+t1982+t2336+t2337+t1984+t5873+t5874+t5875+t5876+t2099+t5333+
 t2102+t5335+t1992*t139+t5953+t1996*t146;
-    const double t6310 = t2145*t139;
-    const double t6311 = t2147*t145;
-    const double t6312 = t2145*t146;
-    const double t6313 = t2147*t155;
-    const double t6314 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5972+t5973+
+    const MBPOL_POLY_REAL t6310 = t2145*t139;
+    const MBPOL_POLY_REAL t6311 = t2147*t145;
+    const MBPOL_POLY_REAL t6312 = t2145*t146;
+    const MBPOL_POLY_REAL t6313 = t2147*t155;
+    const MBPOL_POLY_REAL t6314 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5972+t5973+
 t5974+t5975+t6310+t6311+t6312+t6313+t2159+t5976+t5977;
-    const double t6317 = t2359+t2390+t2358+t2362+t2392+t5937+t5938+t5939+t5940+t5332+t2101+
+    const MBPOL_POLY_REAL t6317 = t2359+t2390+t2358+t2362+t2392+t5937+t5938+t5939+t5940+t5332+t2101+
 t5334+t2103+t5946+t2376*t145;
-    const double t6319 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5961+t5962+
+    const MBPOL_POLY_REAL t6319 = t2134+t2135+t2136+t2137+t2138+t5957+t5958+t5959+t5960+t5961+t5962+
 t5963+t5964+t6310+t6311+t6312+t6313+t2159+t5969;
-    const double t6322 = t2024+t2256*t309+t5980+t5981+t2253+t2254+t5818+t5982+t5983+t5984+
+    const MBPOL_POLY_REAL t6322 = t2024+t2256*t309+t5980+t5981+t2253+t2254+t5818+t5982+t5983+t5984+
 t5985+t2027+t2028;
-    const double t6323 = t2002*t139;
-    const double t6324 = t2000*t145;
-    const double t6325 = t2002*t146;
-    const double t6326 = t2000*t155;
-    const double t6327 = t2021*t212;
-    const double t6328 = t2035*t215;
-    const double t6329 = t2029+t2030+t5884+t5885+t5886+t5887+t6323+t6324+t6325+t6326+t2032+
+    const MBPOL_POLY_REAL t6323 = t2002*t139;
+    const MBPOL_POLY_REAL t6324 = t2000*t145;
+    const MBPOL_POLY_REAL t6325 = t2002*t146;
+    const MBPOL_POLY_REAL t6326 = t2000*t155;
+    const MBPOL_POLY_REAL t6327 = t2021*t212;
+    const MBPOL_POLY_REAL t6328 = t2035*t215;
+    const MBPOL_POLY_REAL t6329 = t2029+t2030+t5884+t5885+t5886+t5887+t6323+t6324+t6325+t6326+t2032+
 t6327+t6328;
-    const double t6332 = t2055+t2054+t2056+t2057+t2058+t5838+t5839+t5840+t5841+t5842+t5844;
-    const double t6338 = t5845+t5846+t2065*t139+t2067*t145+t2065*t146+t2067*t155+t2077+t5327
+    const MBPOL_POLY_REAL t6332 = t2055+t2054+t2056+t2057+t2058+t5838+t5839+t5840+t5841+t5842+t5844;
+    const MBPOL_POLY_REAL t6338 = t5845+t5846+t2065*t139+t2067*t145+t2065*t146+t2067*t155+t2077+t5327
 +t2163+t5868+t2080*t215;
-    const double t6110 = t6296+t6303;
-    const double t6116 = t6322+t6329;
-    const double t6118 = t6332+t6338;
-    const double t6341 = t6110*t143+t6308*t146+t6314*t254+t6317*t145+t5785+t5789+t5796+t5802
+    const MBPOL_POLY_REAL t6110 = t6296+t6303;
+    const MBPOL_POLY_REAL t6116 = t6322+t6329;
+    const MBPOL_POLY_REAL t6118 = t6332+t6338;
+    const MBPOL_POLY_REAL t6341 = t6110*t143+t6308*t146+t6314*t254+t6317*t145+t5785+t5789+t5796+t5802
 +t5804+t6319*t275+t6116*t475+t6118*t215;
-    const double t6344 = t2359+t2361+t2389+t2391+t2363+t5950+t5951+t5939+t5940+t5332+t2101+
+    const MBPOL_POLY_REAL t6344 = t2359+t2361+t2389+t2391+t2363+t5950+t5951+t5939+t5940+t5332+t2101+
 t5334+t2103+t5877+t2372*t145+t5879+t2376*t155;
-    const double t6347 = t2335+t1982+t1981+t1983+t2338+t5944+t5945+t5875+t5876+t2099+t5333+
+    const MBPOL_POLY_REAL t6347 = t2335+t1982+t1981+t1983+t2338+t5944+t5945+t5875+t5876+t2099+t5333+
 t2102+t5335+t1996*t139;
-    const double t6349 = t2027+t2024+t2028+t2029+t2030+t5884+t5885+t5886+t5887+t5888+t5889+
+    const MBPOL_POLY_REAL t6349 = t2027+t2024+t2028+t2029+t2030+t5884+t5885+t5886+t5887+t5888+t5889+
 t5891;
-    const double t6350 = t5892+t6323+t6324+t6325+t6326+t2032+t5897+t5898+t6327+t6328+t2034+
+    const MBPOL_POLY_REAL t6350 = t5892+t6323+t6324+t6325+t6326+t2032+t5897+t5898+t6327+t6328+t2034+
 t5372;
-    const double t6357 = t2310+t2308+t2311+t2312+t2313+t5914+t5915+t5916+t5917+t5918+t5919+
+    const MBPOL_POLY_REAL t6357 = t2310+t2308+t2311+t2312+t2313+t5914+t5915+t5916+t5917+t5918+t5919+
 t5920+t5921+t2320*t139+t2322*t145+t2320*t146+t2322*t155+t2332;
-    const double t6359 = t2268+t2272+t2273+t5816+t5817+t5819+t5820+t5821+t5822+t5823+t6300+
+    const MBPOL_POLY_REAL t6359 = t2268+t2272+t2273+t5816+t5817+t5819+t5820+t5821+t5822+t5823+t6300+
 t6299;
-    const double t6360 = t6297+t6298+t5347+t6302+t2352+t6301+t2294+t5825+t5826+t2038+t5827+
+    const MBPOL_POLY_REAL t6360 = t6297+t6298+t5347+t6302+t2352+t6301+t2294+t5825+t5826+t2038+t5827+
 t2270+t2271;
-    const double t6369 = t5860+t5862+t5863+t2201*t139+t2203*t145+t2201*t146+t2203*t155+t2213
+    const MBPOL_POLY_REAL t6369 = t5860+t5862+t5863+t2201*t139+t2203*t145+t2201*t146+t2203*t155+t2213
 +t2161+t5328+t2214*t212;
-    const double t6135 = t6349+t6350;
-    const double t6146 = t6359+t6360;
-    const double t6148 = t2191+t2189+t2192+t2193+t2194+t5855+t5856+t5857+t5858+t5859+t6369;
-    const double t6372 = t6344*t155+t6347*t139+t6135*t309+t6357*t179+t6146*t240+t5807+t5811+
+    const MBPOL_POLY_REAL t6135 = t6349+t6350;
+    const MBPOL_POLY_REAL t6146 = t6359+t6360;
+    const MBPOL_POLY_REAL t6148 = t2191+t2189+t2192+t2193+t2194+t5855+t5856+t5857+t5858+t5859+t6369;
+    const MBPOL_POLY_REAL t6372 = t6344*t155+t6347*t139+t6135*t309+t6357*t179+t6146*t240+t5807+t5811+
 t5815+t5930+t5934+t6148*t212+t2388+t5936;
-    const double t6377 = t1444+t1885+t1443+t1445+t1888+t5591+t5592+t5593+t5594+t5084+t1915+
+    const MBPOL_POLY_REAL t6377 = t1444+t1885+t1443+t1445+t1888+t5591+t5592+t5593+t5594+t5084+t1915+
 t5086+t1917+t5604+t1892*t145+t5606+t1456*t155;
-    const double t6379 = t1942+t1944+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5628+t5629+
+    const MBPOL_POLY_REAL t6379 = t1942+t1944+t1945+t1946+t1947+t5624+t5625+t5626+t5627+t5628+t5629+
 t5630+t5631+t6094+t6095+t6096+t6097+t1968+t5636;
-    const double t6383 = t1851+t1424+t1426+t1427+t1854+t5600+t5601+t5602+t5603+t1913+t5085+
+    const MBPOL_POLY_REAL t6383 = t1851+t1424+t1426+t1427+t1854+t5600+t5601+t5602+t5603+t1913+t5085+
 t1916+t5087+t1857*t139+t5596+t1436*t146;
-    const double t6385 = t1460+t1462+t1463+t1464+t1465+t5741+t5742+t5743+t5744+t5745+t5746;
-    const double t6386 = t5747+t5749+t6081+t6082+t6083+t6084+t1486+t5754+t5755+t6085+t6086+
+    const MBPOL_POLY_REAL t6385 = t1460+t1462+t1463+t1464+t1465+t5741+t5742+t5743+t5744+t5745+t5746;
+    const MBPOL_POLY_REAL t6386 = t5747+t5749+t6081+t6082+t6083+t6084+t1486+t5754+t5755+t6085+t6086+
 t2430;
-    const double t6159 = t6080+t6087;
-    const double t6163 = t6090+t6091;
-    const double t6167 = t6186+t6281;
-    const double t6174 = t6287+t6293;
-    const double t6181 = (t6341+t6372)*t3116;
-    const double t6187 = t6385+t6386;
-    const double t6389 = t6159*t240+t6163*t309+t6098*t254+t6167*t3120+t6285*t145+t5772+t5774
+    const MBPOL_POLY_REAL t6159 = t6080+t6087;
+    const MBPOL_POLY_REAL t6163 = t6090+t6091;
+    const MBPOL_POLY_REAL t6167 = t6186+t6281;
+    const MBPOL_POLY_REAL t6174 = t6287+t6293;
+    const MBPOL_POLY_REAL t6181 = (t6341+t6372)*t3116;
+    const MBPOL_POLY_REAL t6187 = t6385+t6386;
+    const MBPOL_POLY_REAL t6389 = t6159*t240+t6163*t309+t6098*t254+t6167*t3120+t6285*t145+t5772+t5774
 +t5778+t6174*t215+t6181+t6377*t155+t6379*t275+t6383*t146+t6187*t143;
-    const double t6394 = t1124+t1126+t1127+t1129+t1130+t1132+t1134+t1136+t1137+t1139+t1140+
+    const MBPOL_POLY_REAL t6394 = t1124+t1126+t1127+t1129+t1130+t1132+t1134+t1136+t1137+t1139+t1140+
 t1141+t1142+t1145*t139;
-    const double t6397 = t1102+t1103+t1104+t1106+t1107+t1109+t1111+t1113+t1114+t1116+t1117+
+    const MBPOL_POLY_REAL t6397 = t1102+t1103+t1104+t1106+t1107+t1109+t1111+t1113+t1114+t1116+t1117+
 t1118+t1119+t1144+t1120*t145;
-    const double t6401 = t1124+t1162+t1163+t1164+t1165+t1166+t1167+t1136+t1137+t1139+t1140+
+    const MBPOL_POLY_REAL t6401 = t1124+t1162+t1163+t1164+t1165+t1166+t1167+t1136+t1137+t1139+t1140+
 t1141+t1142+t1169*t139+t1158+t1145*t146;
-    const double t6405 = t1103+t1149+t1150+t1151+t1152+t1153+t1154+t1113+t1114+t1116+t1117+
+    const MBPOL_POLY_REAL t6405 = t1103+t1149+t1150+t1151+t1152+t1153+t1154+t1113+t1114+t1116+t1117+
 t1118+t1119+t1168+t1155*t145+t1171+t1120*t155;
-    const double t6411 = t1176+t1177+t1178+t1179+t1180+t1182+t1183+t1185+t1186+t1188+t1189+
+    const MBPOL_POLY_REAL t6411 = t1176+t1177+t1178+t1179+t1180+t1182+t1183+t1185+t1186+t1188+t1189+
 t1190+t1191+t1194*t139+t1192*t145+t1194*t146+t1192*t155+t1199;
-    const double t6413 = t1213*t139;
-    const double t6414 = t1215*t145;
-    const double t6415 = t1213*t146;
-    const double t6416 = t1215*t155;
-    const double t6417 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1214+t1216+
+    const MBPOL_POLY_REAL t6413 = t1213*t139;
+    const MBPOL_POLY_REAL t6414 = t1215*t145;
+    const MBPOL_POLY_REAL t6415 = t1213*t146;
+    const MBPOL_POLY_REAL t6416 = t1215*t155;
+    const MBPOL_POLY_REAL t6417 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1214+t1216+
 t1217+t1218+t6413+t6414+t6415+t6416+t1224+t1226;
-    const double t6419 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1229+t1230+
+    const MBPOL_POLY_REAL t6419 = t1202+t1204+t1205+t1206+t1207+t1209+t1210+t1211+t1212+t1229+t1230+
 t1231+t1232+t6413+t6414+t6415+t6416+t1224+t1234+t1235;
-    const double t6427 = t1283+t1285+t1286+t1289*t139+t1287*t145+t1289*t146+t1287*t155+t1294
+    const MBPOL_POLY_REAL t6427 = t1283+t1285+t1286+t1289*t139+t1287*t145+t1289*t146+t1287*t155+t1294
 +t1226+t1235+t1295*t212;
-    const double t6232 = t1269+t1271+t1272+t1273+t1274+t1276+t1277+t1279+t1280+t1282+t6427;
-    const double t6233 = t6232*t212;
-    const double t6430 = t1080+t1094+t1100+t6394*t139+t6397*t145+t6401*t146+t6405*t155+t6411
+    const MBPOL_POLY_REAL t6232 = t1269+t1271+t1272+t1273+t1274+t1276+t1277+t1279+t1280+t1282+t6427;
+    const MBPOL_POLY_REAL t6233 = t6232*t212;
+    const MBPOL_POLY_REAL t6430 = t1080+t1094+t1100+t6394*t139+t6397*t145+t6401*t146+t6405*t155+t6411
 *t179+t6417*t275+t6419*t254+t6233;
-    const double t6433 = t3253*t50;
-    const double t6434 = t3251*t67;
-    const double t6435 = t3248*t72;
-    const double t6436 = t3248*t73;
-    const double t6439 = t4727+t3241+t3243+t3246+t4730+t6433+t6434+t6435+t6436+t3280+t3281+
+    const MBPOL_POLY_REAL t6433 = t3253*t50;
+    const MBPOL_POLY_REAL t6434 = t3251*t67;
+    const MBPOL_POLY_REAL t6435 = t3248*t72;
+    const MBPOL_POLY_REAL t6436 = t3248*t73;
+    const MBPOL_POLY_REAL t6439 = t4727+t3241+t3243+t3246+t4730+t6433+t6434+t6435+t6436+t3280+t3281+
 t3282+t3283+t3259*t139+t3261*t145;
-    const double t6441 = a[997];
-    const double t6442 = t6441*t155;
-    const double t6443 = t6441*t145;
-    const double t6444 = a[1101];
-    const double t6446 = a[1145];
-    const double t6448 = a[990];
-    const double t6449 = t6448*t20;
-    const double t6450 = a[752];
-    const double t6451 = t6450*t72;
-    const double t6240 = a[884];
-    const double t6453 = t6240*t179;
-    const double t6455 = a[984];
-    const double t6457 = a[1095];
-    const double t6458 = t6457*t212;
-    const double t6459 = a[845];
-    const double t6460 = t6459*t215;
-    const double t6461 = t6459*t254;
-    const double t6462 = t6441*t126;
-    const double t6463 = t6442+t6443+t6444*t309+t6446*t143+t6449+t6451+t6453+t6444*t240+
+    const MBPOL_POLY_REAL t6441 = a[997];
+    const MBPOL_POLY_REAL t6442 = t6441*t155;
+    const MBPOL_POLY_REAL t6443 = t6441*t145;
+    const MBPOL_POLY_REAL t6444 = a[1101];
+    const MBPOL_POLY_REAL t6446 = a[1145];
+    const MBPOL_POLY_REAL t6448 = a[990];
+    const MBPOL_POLY_REAL t6449 = t6448*t20;
+    const MBPOL_POLY_REAL t6450 = a[752];
+    const MBPOL_POLY_REAL t6451 = t6450*t72;
+    const MBPOL_POLY_REAL t6240 = a[884];
+    const MBPOL_POLY_REAL t6453 = t6240*t179;
+    const MBPOL_POLY_REAL t6455 = a[984];
+    const MBPOL_POLY_REAL t6457 = a[1095];
+    const MBPOL_POLY_REAL t6458 = t6457*t212;
+    const MBPOL_POLY_REAL t6459 = a[845];
+    const MBPOL_POLY_REAL t6460 = t6459*t215;
+    const MBPOL_POLY_REAL t6461 = t6459*t254;
+    const MBPOL_POLY_REAL t6462 = t6441*t126;
+    const MBPOL_POLY_REAL t6463 = t6442+t6443+t6444*t309+t6446*t143+t6449+t6451+t6453+t6444*t240+
 t6455*t475+t6458+t6460+t6461+t6462;
-    const double t6464 = a[706];
-    const double t6465 = t6464*t77;
-    const double t6466 = t6457*t275;
-    const double t6467 = t6464*t146;
-    const double t6468 = t6464*t139;
-    const double t6469 = t6450*t50;
-    const double t6470 = t6448*t5;
-    const double t6471 = t6448*t26;
-    const double t6472 = t6448*t37;
-    const double t6473 = t6464*t132;
-    const double t6474 = t6450*t67;
-    const double t6475 = t6450*t73;
-    const double t6476 = t6441*t136;
-    const double t6477 = a[214];
-    const double t6478 = t6465+t6466+t6467+t6468+t6469+t6470+t6471+t6472+t6473+t6474+t6475+
+    const MBPOL_POLY_REAL t6464 = a[706];
+    const MBPOL_POLY_REAL t6465 = t6464*t77;
+    const MBPOL_POLY_REAL t6466 = t6457*t275;
+    const MBPOL_POLY_REAL t6467 = t6464*t146;
+    const MBPOL_POLY_REAL t6468 = t6464*t139;
+    const MBPOL_POLY_REAL t6469 = t6450*t50;
+    const MBPOL_POLY_REAL t6470 = t6448*t5;
+    const MBPOL_POLY_REAL t6471 = t6448*t26;
+    const MBPOL_POLY_REAL t6472 = t6448*t37;
+    const MBPOL_POLY_REAL t6473 = t6464*t132;
+    const MBPOL_POLY_REAL t6474 = t6450*t67;
+    const MBPOL_POLY_REAL t6475 = t6450*t73;
+    const MBPOL_POLY_REAL t6476 = t6441*t136;
+    const MBPOL_POLY_REAL t6477 = a[214];
+    const MBPOL_POLY_REAL t6478 = t6465+t6466+t6467+t6468+t6469+t6470+t6471+t6472+t6473+t6474+t6475+
 t6476+t6477;
-    const double t6481 = a[567];
-    const double t6482 = t6481*t5;
-    const double t6483 = a[521];
-    const double t6484 = t6481*t20;
-    const double t6485 = t6481*t26;
-    const double t6486 = t6481*t37;
-    const double t6487 = a[763];
-    const double t6488 = t6487*t50;
-    const double t6489 = t6487*t67;
-    const double t6490 = a[1064];
-    const double t6491 = t6490*t72;
-    const double t6492 = t6490*t73;
-    const double t6493 = a[735];
-    const double t6494 = t6493*t77;
-    const double t6496 = t6493*t126;
-    const double t6497 = t6493*t132;
-    const double t6498 = t6493*t136;
-    const double t6499 = a[1033];
-    const double t6501 = a[793];
-    const double t6260 = a[1056];
-    const double t6506 = t6260*t179;
-    const double t6507 = a[1125];
-    const double t6508 = t6507*t275;
-    const double t6509 = t6507*t254;
-    const double t6510 = a[726];
-    const double t6512 = t6496+t6497+t6498+t6499*t139+t6501*t145+t6499*t146+t6501*t155+t6506
+    const MBPOL_POLY_REAL t6481 = a[567];
+    const MBPOL_POLY_REAL t6482 = t6481*t5;
+    const MBPOL_POLY_REAL t6483 = a[521];
+    const MBPOL_POLY_REAL t6484 = t6481*t20;
+    const MBPOL_POLY_REAL t6485 = t6481*t26;
+    const MBPOL_POLY_REAL t6486 = t6481*t37;
+    const MBPOL_POLY_REAL t6487 = a[763];
+    const MBPOL_POLY_REAL t6488 = t6487*t50;
+    const MBPOL_POLY_REAL t6489 = t6487*t67;
+    const MBPOL_POLY_REAL t6490 = a[1064];
+    const MBPOL_POLY_REAL t6491 = t6490*t72;
+    const MBPOL_POLY_REAL t6492 = t6490*t73;
+    const MBPOL_POLY_REAL t6493 = a[735];
+    const MBPOL_POLY_REAL t6494 = t6493*t77;
+    const MBPOL_POLY_REAL t6496 = t6493*t126;
+    const MBPOL_POLY_REAL t6497 = t6493*t132;
+    const MBPOL_POLY_REAL t6498 = t6493*t136;
+    const MBPOL_POLY_REAL t6499 = a[1033];
+    const MBPOL_POLY_REAL t6501 = a[793];
+    const MBPOL_POLY_REAL t6260 = a[1056];
+    const MBPOL_POLY_REAL t6506 = t6260*t179;
+    const MBPOL_POLY_REAL t6507 = a[1125];
+    const MBPOL_POLY_REAL t6508 = t6507*t275;
+    const MBPOL_POLY_REAL t6509 = t6507*t254;
+    const MBPOL_POLY_REAL t6510 = a[726];
+    const MBPOL_POLY_REAL t6512 = t6496+t6497+t6498+t6499*t139+t6501*t145+t6499*t146+t6501*t155+t6506
 +t6508+t6509+t6510*t212;
-    const double t6515 = t6490*t50;
-    const double t6516 = t6490*t67;
-    const double t6517 = t6487*t72;
-    const double t6518 = t6487*t73;
-    const double t6523 = t6493*t139;
-    const double t6524 = t6493*t145;
-    const double t6525 = t6493*t146;
-    const double t6526 = t6493*t155;
-    const double t6528 = t6482+t6483+t6484+t6485+t6486+t6515+t6516+t6517+t6518+t6499*t77+
+    const MBPOL_POLY_REAL t6515 = t6490*t50;
+    const MBPOL_POLY_REAL t6516 = t6490*t67;
+    const MBPOL_POLY_REAL t6517 = t6487*t72;
+    const MBPOL_POLY_REAL t6518 = t6487*t73;
+    const MBPOL_POLY_REAL t6523 = t6493*t139;
+    const MBPOL_POLY_REAL t6524 = t6493*t145;
+    const MBPOL_POLY_REAL t6525 = t6493*t146;
+    const MBPOL_POLY_REAL t6526 = t6493*t155;
+    const MBPOL_POLY_REAL t6528 = t6482+t6483+t6484+t6485+t6486+t6515+t6516+t6517+t6518+t6499*t77+
 t6501*t126+t6499*t132+t6501*t136+t6523+t6524+t6525+t6526+t6506+t6510*t275;
-    const double t6530 = a[1113];
-    const double t6531 = t6530*t5;
-    const double t6532 = a[448];
-    const double t6533 = t6530*t20;
-    const double t6534 = a[784];
-    const double t6535 = t6534*t26;
-    const double t6536 = t6534*t37;
-    const double t6537 = a[1148];
-    const double t6539 = a[1119];
-    const double t6543 = a[517];
-    const double t6544 = a[917];
-    const double t6545 = t6544*t5;
-    const double t6546 = a[1084];
-    const double t6548 = a[825];
-    const double t6552 = a[94];
-    const double t6553 = a[927];
-    const double t6554 = t6553*t5;
-    const double t6555 = t6553*t20;
-    const double t6556 = a[781];
-    const double t6557 = t6556*t26;
-    const double t6558 = t6556*t37;
-    const double t6559 = a[1054];
-    const double t6560 = t6559*t50;
-    const double t6561 = a[1066];
-    const double t6562 = t6561*t67;
-    const double t6563 = a[602];
-    const double t6564 = t6563*t72;
-    const double t6565 = t6563*t73;
-    const double t6566 = a[674];
-    const double t6567 = t6566*t77;
-    const double t6568 = t6566*t126;
-    const double t6569 = t6566*t132;
-    const double t6570 = t6566*t136;
-    const double t6571 = a[879];
-    const double t6573 = t6552+t6554+t6555+t6557+t6558+t6560+t6562+t6564+t6565+t6567+t6568+
+    const MBPOL_POLY_REAL t6530 = a[1113];
+    const MBPOL_POLY_REAL t6531 = t6530*t5;
+    const MBPOL_POLY_REAL t6532 = a[448];
+    const MBPOL_POLY_REAL t6533 = t6530*t20;
+    const MBPOL_POLY_REAL t6534 = a[784];
+    const MBPOL_POLY_REAL t6535 = t6534*t26;
+    const MBPOL_POLY_REAL t6536 = t6534*t37;
+    const MBPOL_POLY_REAL t6537 = a[1148];
+    const MBPOL_POLY_REAL t6539 = a[1119];
+    const MBPOL_POLY_REAL t6543 = a[517];
+    const MBPOL_POLY_REAL t6544 = a[917];
+    const MBPOL_POLY_REAL t6545 = t6544*t5;
+    const MBPOL_POLY_REAL t6546 = a[1084];
+    const MBPOL_POLY_REAL t6548 = a[825];
+    const MBPOL_POLY_REAL t6552 = a[94];
+    const MBPOL_POLY_REAL t6553 = a[927];
+    const MBPOL_POLY_REAL t6554 = t6553*t5;
+    const MBPOL_POLY_REAL t6555 = t6553*t20;
+    const MBPOL_POLY_REAL t6556 = a[781];
+    const MBPOL_POLY_REAL t6557 = t6556*t26;
+    const MBPOL_POLY_REAL t6558 = t6556*t37;
+    const MBPOL_POLY_REAL t6559 = a[1054];
+    const MBPOL_POLY_REAL t6560 = t6559*t50;
+    const MBPOL_POLY_REAL t6561 = a[1066];
+    const MBPOL_POLY_REAL t6562 = t6561*t67;
+    const MBPOL_POLY_REAL t6563 = a[602];
+    const MBPOL_POLY_REAL t6564 = t6563*t72;
+    const MBPOL_POLY_REAL t6565 = t6563*t73;
+    const MBPOL_POLY_REAL t6566 = a[674];
+    const MBPOL_POLY_REAL t6567 = t6566*t77;
+    const MBPOL_POLY_REAL t6568 = t6566*t126;
+    const MBPOL_POLY_REAL t6569 = t6566*t132;
+    const MBPOL_POLY_REAL t6570 = t6566*t136;
+    const MBPOL_POLY_REAL t6571 = a[879];
+    const MBPOL_POLY_REAL t6573 = t6552+t6554+t6555+t6557+t6558+t6560+t6562+t6564+t6565+t6567+t6568+
 t6569+t6570+t6571*t139;
-    const double t6575 = a[637];
-    const double t6578 = t6552+t6554+t6555+t6557+t6558+t6560+t6562+t6564+t6565+t6567+t6568+
+    const MBPOL_POLY_REAL t6575 = a[637];
+    const MBPOL_POLY_REAL t6578 = t6552+t6554+t6555+t6557+t6558+t6560+t6562+t6564+t6565+t6567+t6568+
 t6569+t6570+t6575*t139+t6571*t145;
-    const double t6581 = a[729];
-    const double t6586 = a[769];
-    const double t6591 = a[1067];
-    const double t6315 = a[1147];
-    const double t6602 = a[526]+t6581*t5+t6581*t20+t6581*t26+t6581*t37+t6586*t50+t6586*t67+
+    const MBPOL_POLY_REAL t6581 = a[729];
+    const MBPOL_POLY_REAL t6586 = a[769];
+    const MBPOL_POLY_REAL t6591 = a[1067];
+    const MBPOL_POLY_REAL t6315 = a[1147];
+    const MBPOL_POLY_REAL t6602 = a[526]+t6581*t5+t6581*t20+t6581*t26+t6581*t37+t6586*t50+t6586*t67+
 t6586*t72+t6586*t73+t6591*t77+t6591*t126+t6591*t132+t6591*t136+t6591*t139+t6591
 *t145+t6591*t146+t6591*t155+t6315*t179;
-    const double t6604 = t6556*t5;
-    const double t6605 = t6553*t37;
-    const double t6606 = t6563*t50;
-    const double t6607 = t6563*t67;
-    const double t6608 = t6561*t72;
-    const double t6609 = t6559*t73;
-    const double t6610 = a[1080];
-    const double t6612 = a[1120];
-    const double t6616 = t6555+t6552+t6604+t6557+t6605+t6606+t6607+t6608+t6609+t6610*t77+
+    const MBPOL_POLY_REAL t6604 = t6556*t5;
+    const MBPOL_POLY_REAL t6605 = t6553*t37;
+    const MBPOL_POLY_REAL t6606 = t6563*t50;
+    const MBPOL_POLY_REAL t6607 = t6563*t67;
+    const MBPOL_POLY_REAL t6608 = t6561*t72;
+    const MBPOL_POLY_REAL t6609 = t6559*t73;
+    const MBPOL_POLY_REAL t6610 = a[1080];
+    const MBPOL_POLY_REAL t6612 = a[1120];
+    const MBPOL_POLY_REAL t6616 = t6555+t6552+t6604+t6557+t6605+t6606+t6607+t6608+t6609+t6610*t77+
 t6612*t126+t6575*t132+t6571*t136;
-    const double t6621 = t6556*t20;
-    const double t6622 = t6553*t26;
-    const double t6623 = t6561*t50;
-    const double t6624 = t6559*t67;
-    const double t6628 = t6552+t6604+t6621+t6622+t6605+t6623+t6624+t6564+t6565+t6567+t6568+
+    const MBPOL_POLY_REAL t6621 = t6556*t20;
+    const MBPOL_POLY_REAL t6622 = t6553*t26;
+    const MBPOL_POLY_REAL t6623 = t6561*t50;
+    const MBPOL_POLY_REAL t6624 = t6559*t67;
+    const MBPOL_POLY_REAL t6628 = t6552+t6604+t6621+t6622+t6605+t6623+t6624+t6564+t6565+t6567+t6568+
 t6569+t6570+t6612*t139+t6610*t145+t6571*t146;
-    const double t6630 = t6534*t5;
-    const double t6631 = t6530*t37;
-    const double t6632 = a[1072];
-    const double t6633 = t6632*t50;
-    const double t6634 = t6632*t67;
-    const double t6335 = t6463+t6478;
-    const double t6337 = t6482+t6483+t6484+t6485+t6486+t6488+t6489+t6491+t6492+t6494+t6512;
-    const double t6342 = t6537*t50;
-    const double t6343 = t6539*t67;
-    const double t6348 = t6546*t20;
-    const double t6351 = t6548*t26;
-    const double t6361 = t6548*t5;
-    const double t6365 = t6539*t72;
-    const double t6638 = t6335*t475+t6337*t212+t6528*t275+(t6531+t6532+t6533+t6535+t6536+
+    const MBPOL_POLY_REAL t6630 = t6534*t5;
+    const MBPOL_POLY_REAL t6631 = t6530*t37;
+    const MBPOL_POLY_REAL t6632 = a[1072];
+    const MBPOL_POLY_REAL t6633 = t6632*t50;
+    const MBPOL_POLY_REAL t6634 = t6632*t67;
+    const MBPOL_POLY_REAL t6335 = t6463+t6478;
+    const MBPOL_POLY_REAL t6337 = t6482+t6483+t6484+t6485+t6486+t6488+t6489+t6491+t6492+t6494+t6512;
+    const MBPOL_POLY_REAL t6342 = t6537*t50;
+    const MBPOL_POLY_REAL t6343 = t6539*t67;
+    const MBPOL_POLY_REAL t6348 = t6546*t20;
+    const MBPOL_POLY_REAL t6351 = t6548*t26;
+    const MBPOL_POLY_REAL t6361 = t6548*t5;
+    const MBPOL_POLY_REAL t6365 = t6539*t72;
+    const MBPOL_POLY_REAL t6638 = t6335*t475+t6337*t212+t6528*t275+(t6531+t6532+t6533+t6535+t6536+
 t6342+t6343)*t67+(t6543+t6545+t6348+t6351)*t26+t6573*t139+t6578*t145+t6602*t179
 +t6616*t136+(t6543+t6361)*t5+t6628*t146+(t6630+t6533+t6532+t6535+t6631+t6633+
 t6634+t6365)*t72;
-    const double t6642 = t6534*t20;
-    const double t6643 = t6530*t26;
-    const double t6652 = t6552+t6604+t6621+t6622+t6605+t6623+t6624+t6564+t6565+t6567+t6568+
+    const MBPOL_POLY_REAL t6642 = t6534*t20;
+    const MBPOL_POLY_REAL t6643 = t6530*t26;
+    const MBPOL_POLY_REAL t6652 = t6552+t6604+t6621+t6622+t6605+t6623+t6624+t6564+t6565+t6567+t6568+
 t6569+t6570+t6610*t139+t6612*t145+t6575*t146+t6571*t155;
-    const double t6654 = t6441*t77;
-    const double t6655 = t6464*t126;
-    const double t6656 = t6441*t132;
-    const double t6657 = t6470+t6477+t6449+t6471+t6472+t6469+t6474+t6451+t6475+t6654+t6655+
+    const MBPOL_POLY_REAL t6654 = t6441*t77;
+    const MBPOL_POLY_REAL t6655 = t6464*t126;
+    const MBPOL_POLY_REAL t6656 = t6441*t132;
+    const MBPOL_POLY_REAL t6657 = t6470+t6477+t6449+t6471+t6472+t6469+t6474+t6451+t6475+t6654+t6655+
 t6656;
-    const double t6658 = t6464*t136;
-    const double t6659 = t6459*t275;
-    const double t6660 = t6457*t254;
-    const double t6661 = t6444*t143;
-    const double t6663 = t6658+t6468+t6443+t6467+t6442+t6453+t6659+t6660+t6458+t6460+t6661+
+    const MBPOL_POLY_REAL t6658 = t6464*t136;
+    const MBPOL_POLY_REAL t6659 = t6459*t275;
+    const MBPOL_POLY_REAL t6660 = t6457*t254;
+    const MBPOL_POLY_REAL t6661 = t6444*t143;
+    const MBPOL_POLY_REAL t6663 = t6658+t6468+t6443+t6467+t6442+t6453+t6659+t6660+t6458+t6460+t6661+
 t6455*t309;
-    const double t6667 = t6464*t145;
-    const double t6668 = t6441*t139;
-    const double t6669 = t6441*t146;
-    const double t6670 = t6464*t155;
-    const double t6671 = t6446*t309+t6661+t6667+t6668+t6669+t6670+t6449+t6451+t6453+t6461+
+    const MBPOL_POLY_REAL t6667 = t6464*t145;
+    const MBPOL_POLY_REAL t6668 = t6441*t139;
+    const MBPOL_POLY_REAL t6669 = t6441*t146;
+    const MBPOL_POLY_REAL t6670 = t6464*t155;
+    const MBPOL_POLY_REAL t6671 = t6446*t309+t6661+t6667+t6668+t6669+t6670+t6449+t6451+t6453+t6461+
 t6462+t6465;
-    const double t6673 = t6459*t212;
-    const double t6674 = t6457*t215;
-    const double t6675 = t6466+t6469+t6470+t6471+t6472+t6473+t6474+t6475+t6476+t6455*t240+
+    const MBPOL_POLY_REAL t6673 = t6459*t212;
+    const MBPOL_POLY_REAL t6674 = t6457*t215;
+    const MBPOL_POLY_REAL t6675 = t6466+t6469+t6470+t6471+t6472+t6473+t6474+t6475+t6476+t6455*t240+
 t6673+t6674+t6477;
-    const double t6678 = t6482+t6483+t6484+t6485+t6486+t6488+t6489+t6491+t6492+t6494+t6496;
-    const double t6683 = a[1127];
-    const double t6686 = t6497+t6498+t6501*t139+t6499*t145+t6501*t146+t6499*t155+t6506+t6508
+    const MBPOL_POLY_REAL t6678 = t6482+t6483+t6484+t6485+t6486+t6488+t6489+t6491+t6492+t6494+t6496;
+    const MBPOL_POLY_REAL t6683 = a[1127];
+    const MBPOL_POLY_REAL t6686 = t6497+t6498+t6501*t139+t6499*t145+t6501*t146+t6499*t155+t6506+t6508
 +t6509+t6683*t212+t6510*t215;
-    const double t6695 = t6555+t6552+t6604+t6557+t6605+t6606+t6607+t6608+t6609+t6612*t77+
+    const MBPOL_POLY_REAL t6695 = t6555+t6552+t6604+t6557+t6605+t6606+t6607+t6608+t6609+t6612*t77+
 t6610*t126+t6571*t132;
-    const double t6697 = t6470+t6477+t6449+t6471+t6472+t6469+t6474+t6451+t6475+t6654+t6655;
-    const double t6699 = t6656+t6658+t6668+t6667+t6669+t6670+t6453+t6659+t6660+t6673+t6674+
+    const MBPOL_POLY_REAL t6697 = t6470+t6477+t6449+t6471+t6472+t6469+t6474+t6451+t6475+t6654+t6655;
+    const MBPOL_POLY_REAL t6699 = t6656+t6658+t6668+t6667+t6669+t6670+t6453+t6659+t6660+t6673+t6674+
 t6455*t143;
-    const double t6708 = t6482+t6483+t6484+t6485+t6486+t6515+t6516+t6517+t6518+t6501*t77+
+    const MBPOL_POLY_REAL t6708 = t6482+t6483+t6484+t6485+t6486+t6515+t6516+t6517+t6518+t6501*t77+
 t6499*t126+t6501*t132+t6499*t136+t6523+t6524+t6525+t6526+t6506+t6683*t275+t6510
 *t254;
-    const double t6710 = t6559*t72;
-    const double t6711 = t6561*t73;
-    const double t6717 = t6552+t6554+t6621+t6622+t6558+t6606+t6607+t6710+t6711+t6575*t77+
+    const MBPOL_POLY_REAL t6710 = t6559*t72;
+    const MBPOL_POLY_REAL t6711 = t6561*t73;
+    const MBPOL_POLY_REAL t6717 = t6552+t6554+t6621+t6622+t6558+t6606+t6607+t6710+t6711+t6575*t77+
 t6571*t126;
-    const double t6404 = t6548*t20;
-    const double t6408 = t6537*t72;
-    const double t6409 = t6539*t73;
-    const double t6420 = t6657+t6663;
-    const double t6422 = t6671+t6675;
-    const double t6424 = t6678+t6686;
-    const double t6426 = t6539*t50;
-    const double t6432 = t6697+t6699;
-    const double t6440 = t6571*t77;
-    const double t6454 = t6544*t20;
-    const double t6456 = t6546*t5;
-    const double t6479 = t6544*t26;
-    const double t6480 = t6548*t37;
-    const double t6725 = (t6545+t6543+t6404)*t20+(t6531+t6532+t6642+t6643+t6536+t6633+t6634+
+    const MBPOL_POLY_REAL t6404 = t6548*t20;
+    const MBPOL_POLY_REAL t6408 = t6537*t72;
+    const MBPOL_POLY_REAL t6409 = t6539*t73;
+    const MBPOL_POLY_REAL t6420 = t6657+t6663;
+    const MBPOL_POLY_REAL t6422 = t6671+t6675;
+    const MBPOL_POLY_REAL t6424 = t6678+t6686;
+    const MBPOL_POLY_REAL t6426 = t6539*t50;
+    const MBPOL_POLY_REAL t6432 = t6697+t6699;
+    const MBPOL_POLY_REAL t6440 = t6571*t77;
+    const MBPOL_POLY_REAL t6454 = t6544*t20;
+    const MBPOL_POLY_REAL t6456 = t6546*t5;
+    const MBPOL_POLY_REAL t6479 = t6544*t26;
+    const MBPOL_POLY_REAL t6480 = t6548*t37;
+    const MBPOL_POLY_REAL t6725 = (t6545+t6543+t6404)*t20+(t6531+t6532+t6642+t6643+t6536+t6633+t6634+
 t6408+t6409)*t73+t6652*t155+t6420*t309+t6422*t240+t6424*t215+(t6532+t6630+t6642
 +t6643+t6631+t6426)*t50+t6695*t132+t6432*t143+t6708*t254+(t6552+t6554+t6621+
 t6622+t6558+t6606+t6607+t6710+t6711+t6440)*t77+t6717*t126+(t6543+t6454+t6456+
 t6479+t6480)*t37;
-    const double t6728 = t3226*t132;
-    const double t6729 = t3228*t136;
-    const double t6730 = t3228*t126;
-    const double t6731 = t3234*t275;
-    const double t6732 = t3236*t254;
-    const double t6733 = t3226*t77;
-    const double t6734 = t3223*t50;
-    const double t6735 = t3223*t67;
-    const double t6736 = t3220*t72;
-    const double t6737 = t4743+t6728+t6729+t6730+t3801+t6731+t6732+t6733+t3802+t6734+t6735+
+    const MBPOL_POLY_REAL t6728 = t3226*t132;
+    const MBPOL_POLY_REAL t6729 = t3228*t136;
+    const MBPOL_POLY_REAL t6730 = t3228*t126;
+    const MBPOL_POLY_REAL t6731 = t3234*t275;
+    const MBPOL_POLY_REAL t6732 = t3236*t254;
+    const MBPOL_POLY_REAL t6733 = t3226*t77;
+    const MBPOL_POLY_REAL t6734 = t3223*t50;
+    const MBPOL_POLY_REAL t6735 = t3223*t67;
+    const MBPOL_POLY_REAL t6736 = t3220*t72;
+    const MBPOL_POLY_REAL t6737 = t4743+t6728+t6729+t6730+t3801+t6731+t6732+t6733+t3802+t6734+t6735+
 t6736;
-    const double t6738 = t3220*t73;
-    const double t6739 = t3207*t139;
-    const double t6740 = t3209*t145;
-    const double t6741 = t3207*t146;
-    const double t6742 = t3209*t155;
-    const double t6743 = t3203*t212;
-    const double t6744 = t3205*t215;
-    const double t6745 = t6738+t6739+t6740+t6741+t6742+t6743+t6744+t3214+t3215+t3216+t3218+
+    const MBPOL_POLY_REAL t6738 = t3220*t73;
+    const MBPOL_POLY_REAL t6739 = t3207*t139;
+    const MBPOL_POLY_REAL t6740 = t3209*t145;
+    const MBPOL_POLY_REAL t6741 = t3207*t146;
+    const MBPOL_POLY_REAL t6742 = t3209*t155;
+    const MBPOL_POLY_REAL t6743 = t3203*t212;
+    const MBPOL_POLY_REAL t6744 = t3205*t215;
+    const MBPOL_POLY_REAL t6745 = t6738+t6739+t6740+t6741+t6742+t6743+t6744+t3214+t3215+t3216+t3218+
 t3219+t3233;
-    const double t6748 = t3276*t50;
-    const double t6749 = t3276*t67;
-    const double t6750 = t3274*t72;
-    const double t6751 = t3272*t73;
-    const double t6756 = t3267+t4178+t3268+t3270+t4181+t6748+t6749+t6750+t6751+t4186*t77+
+    const MBPOL_POLY_REAL t6748 = t3276*t50;
+    const MBPOL_POLY_REAL t6749 = t3276*t67;
+    const MBPOL_POLY_REAL t6750 = t3274*t72;
+    const MBPOL_POLY_REAL t6751 = t3272*t73;
+    const MBPOL_POLY_REAL t6756 = t3267+t4178+t3268+t3270+t4181+t6748+t6749+t6750+t6751+t4186*t77+
 t4184*t126+t3284*t132+t3286*t136;
-    const double t6758 = t3743*t50;
-    const double t6759 = t3743*t67;
-    const double t6760 = t3740*t72;
-    const double t6761 = t3740*t73;
-    const double t6766 = t3746*t139;
-    const double t6767 = t3746*t145;
-    const double t6768 = t3746*t146;
-    const double t6769 = t3746*t155;
-    const double t6771 = t3734+t3736+t3737+t3738+t3739+t6758+t6759+t6760+t6761+t3754*t77+
+    const MBPOL_POLY_REAL t6758 = t3743*t50;
+    const MBPOL_POLY_REAL t6759 = t3743*t67;
+    const MBPOL_POLY_REAL t6760 = t3740*t72;
+    const MBPOL_POLY_REAL t6761 = t3740*t73;
+    const MBPOL_POLY_REAL t6766 = t3746*t139;
+    const MBPOL_POLY_REAL t6767 = t3746*t145;
+    const MBPOL_POLY_REAL t6768 = t3746*t146;
+    const MBPOL_POLY_REAL t6769 = t3746*t155;
+    const MBPOL_POLY_REAL t6771 = t3734+t3736+t3737+t3738+t3739+t6758+t6759+t6760+t6761+t3754*t77+
 t3752*t126+t3754*t132+t3752*t136+t6766+t6767+t6768+t6769+t3759+t3765*t275;
-    const double t6779 = t3734+t3736+t3737+t3738+t3739+t6758+t6759+t6760+t6761+t3752*t77+
+    const MBPOL_POLY_REAL t6779 = t3734+t3736+t3737+t3738+t3739+t6758+t6759+t6760+t6761+t3752*t77+
 t3754*t126+t3752*t132+t3754*t136+t6766+t6767+t6768+t6769+t3759+t3763*t275+t3765
 *t254;
-    const double t6781 = t3272*t72;
-    const double t6782 = t3274*t73;
-    const double t6794 = t4727+t3241+t3243+t3246+t4730+t6433+t6434+t6435+t6436+t3280+t3281+
+    const MBPOL_POLY_REAL t6781 = t3272*t72;
+    const MBPOL_POLY_REAL t6782 = t3274*t73;
+    const MBPOL_POLY_REAL t6794 = t4727+t3241+t3243+t3246+t4730+t6433+t6434+t6435+t6436+t3280+t3281+
 t3282+t3283+t3261*t139;
-    const double t6796 = t3251*t50;
-    const double t6797 = t3253*t67;
-    const double t6802 = t3241+t3245+t4728+t4729+t3247+t6796+t6797+t6435+t6436+t3280+t3281+
+    const MBPOL_POLY_REAL t6796 = t3251*t50;
+    const MBPOL_POLY_REAL t6797 = t3253*t67;
+    const MBPOL_POLY_REAL t6802 = t3241+t3245+t4728+t4729+t3247+t6796+t6797+t6435+t6436+t3280+t3281+
 t3282+t3283+t3255*t139+t3257*t145+t3259*t146+t3261*t155;
-    const double t6804 = t3175*t50;
-    const double t6805 = t3175*t67;
-    const double t6806 = t3172*t72;
-    const double t6807 = t3172*t73;
-    const double t6808 = t3184*t77;
-    const double t6810 = t3184*t126;
-    const double t6811 = t3184*t132;
-    const double t6812 = t3184*t136;
-    const double t6818 = t6810+t6811+t6812+t3178*t139+t3180*t145+t3178*t146+t3180*t155+t3190
+    const MBPOL_POLY_REAL t6804 = t3175*t50;
+    const MBPOL_POLY_REAL t6805 = t3175*t67;
+    const MBPOL_POLY_REAL t6806 = t3172*t72;
+    const MBPOL_POLY_REAL t6807 = t3172*t73;
+    const MBPOL_POLY_REAL t6808 = t3184*t77;
+    const MBPOL_POLY_REAL t6810 = t3184*t126;
+    const MBPOL_POLY_REAL t6811 = t3184*t132;
+    const MBPOL_POLY_REAL t6812 = t3184*t136;
+    const MBPOL_POLY_REAL t6818 = t6810+t6811+t6812+t3178*t139+t3180*t145+t3178*t146+t3180*t155+t3190
 +t3761+t3762+t3191*t212;
-    const double t6823 = t4179+t3266+t3267+t4180+t3271+t6748+t6749+t6781+t6782+t3284*t77+
+    const MBPOL_POLY_REAL t6823 = t4179+t3266+t3267+t4180+t3271+t6748+t6749+t6781+t6782+t3284*t77+
 t3286*t126;
-    const double t6826 = t3209*t139;
-    const double t6827 = t3207*t145;
-    const double t6828 = t3209*t146;
-    const double t6829 = t3207*t155;
-    const double t6830 = t3205*t212;
-    const double t6832 = t6728+t6729+t3197*t309+t6730+t3196+t3200+t6826+t6827+t6828+t6829+
+    const MBPOL_POLY_REAL t6826 = t3209*t139;
+    const MBPOL_POLY_REAL t6827 = t3207*t145;
+    const MBPOL_POLY_REAL t6828 = t3209*t146;
+    const MBPOL_POLY_REAL t6829 = t3207*t155;
+    const MBPOL_POLY_REAL t6830 = t3205*t212;
+    const MBPOL_POLY_REAL t6832 = t6728+t6729+t3197*t309+t6730+t3196+t3200+t6826+t6827+t6828+t6829+
 t6830+t6731+t3201*t240;
-    const double t6833 = t3203*t215;
-    const double t6834 = t6732+t6733+t6833+t6734+t6735+t6736+t6738+t3214+t3215+t3216+t3218+
+    const MBPOL_POLY_REAL t6833 = t3203*t215;
+    const MBPOL_POLY_REAL t6834 = t6732+t6733+t6833+t6734+t6735+t6736+t6738+t3214+t3215+t3216+t3218+
 t3219+t3233;
-    const double t6585 = t6638+t6725;
-    const double t6588 = t6737+t6745;
-    const double t6594 = t3286*t77;
-    const double t6597 = t3162*t72;
-    const double t6600 = t3160*t72;
-    const double t6601 = t3162*t73;
-    const double t6615 = t3166+t3168+t3169+t3170+t3171+t6804+t6805+t6806+t6807+t6808+t6818;
-    const double t6619 = t6832+t6834;
-    const double t6837 = t6439*t145+t6585*t4135+t6588*t240+t6756*t136+t6771*t275+t6779*t254+
+    const MBPOL_POLY_REAL t6585 = t6638+t6725;
+    const MBPOL_POLY_REAL t6588 = t6737+t6745;
+    const MBPOL_POLY_REAL t6594 = t3286*t77;
+    const MBPOL_POLY_REAL t6597 = t3162*t72;
+    const MBPOL_POLY_REAL t6600 = t3160*t72;
+    const MBPOL_POLY_REAL t6601 = t3162*t73;
+    const MBPOL_POLY_REAL t6615 = t3166+t3168+t3169+t3170+t3171+t6804+t6805+t6806+t6807+t6808+t6818;
+    const MBPOL_POLY_REAL t6619 = t6832+t6834;
+    const MBPOL_POLY_REAL t6837 = t6439*t145+t6585*t4135+t6588*t240+t6756*t136+t6771*t275+t6779*t254+
 (t4179+t3266+t3267+t4180+t3271+t6748+t6749+t6781+t6782+t6594)*t77+(t3156+t3777+
 t3153+t3158+t3780+t3726+t3727+t6597)*t72+(t3778+t3153+t3155+t3779+t3159+t3726+
 t3727+t6600+t6601)*t73+t6794*t139+t6802*t155+t6615*t212+t6823*t126+t6619*t475+
 t4196;
-    const double t6849 = t3228*t77;
-    const double t6850 = t3226*t126;
-    const double t6851 = t3228*t132;
-    const double t6852 = t3215+t3214+t3216+t3218+t3219+t6734+t6735+t6736+t6738+t6849+t6850+
+    const MBPOL_POLY_REAL t6849 = t3228*t77;
+    const MBPOL_POLY_REAL t6850 = t3226*t126;
+    const MBPOL_POLY_REAL t6851 = t3228*t132;
+    const MBPOL_POLY_REAL t6852 = t3215+t3214+t3216+t3218+t3219+t6734+t6735+t6736+t6738+t6849+t6850+
 t6851;
-    const double t6853 = t3226*t136;
-    const double t6854 = t3236*t275;
-    const double t6855 = t3234*t254;
-    const double t6856 = t6853+t6826+t6827+t6828+t6829+t3233+t6854+t6855+t6830+t6833+t3804+
+    const MBPOL_POLY_REAL t6853 = t3226*t136;
+    const MBPOL_POLY_REAL t6854 = t3236*t275;
+    const MBPOL_POLY_REAL t6855 = t3234*t254;
+    const MBPOL_POLY_REAL t6856 = t6853+t6826+t6827+t6828+t6829+t3233+t6854+t6855+t6830+t6833+t3804+
 t4744;
-    const double t6861 = t4023*t50;
-    const double t6862 = t4023*t67;
-    const double t6863 = t4029*t72;
-    const double t6864 = t4029*t73;
-    const double t6865 = t4009*t139;
-    const double t6866 = t4033*t145;
-    const double t6867 = t4009*t146;
-    const double t6868 = t4033*t155;
-    const double t6869 = t4016*t212;
-    const double t6870 = t6861+t6862+t6863+t6864+t6865+t6866+t6867+t6868+t6869+t4015+t4022+
+    const MBPOL_POLY_REAL t6861 = t4023*t50;
+    const MBPOL_POLY_REAL t6862 = t4023*t67;
+    const MBPOL_POLY_REAL t6863 = t4029*t72;
+    const MBPOL_POLY_REAL t6864 = t4029*t73;
+    const MBPOL_POLY_REAL t6865 = t4009*t139;
+    const MBPOL_POLY_REAL t6866 = t4033*t145;
+    const MBPOL_POLY_REAL t6867 = t4009*t146;
+    const MBPOL_POLY_REAL t6868 = t4033*t155;
+    const MBPOL_POLY_REAL t6869 = t4016*t212;
+    const MBPOL_POLY_REAL t6870 = t6861+t6862+t6863+t6864+t6865+t6866+t6867+t6868+t6869+t4015+t4022+
 t4025;
-    const double t6871 = t4044*t275;
-    const double t6872 = t4040*t77;
-    const double t6873 = t4046*t254;
-    const double t6874 = t4038*t126;
-    const double t6875 = t4040*t132;
-    const double t6876 = t4038*t136;
-    const double t6877 = t4020*t215;
-    const double t6878 = t4026+t4028+t6871+t6872+t6873+t6874+t6875+t6876+t4037+t4138+t4118+
+    const MBPOL_POLY_REAL t6871 = t4044*t275;
+    const MBPOL_POLY_REAL t6872 = t4040*t77;
+    const MBPOL_POLY_REAL t6873 = t4046*t254;
+    const MBPOL_POLY_REAL t6874 = t4038*t126;
+    const MBPOL_POLY_REAL t6875 = t4040*t132;
+    const MBPOL_POLY_REAL t6876 = t4038*t136;
+    const MBPOL_POLY_REAL t6877 = t4020*t215;
+    const MBPOL_POLY_REAL t6878 = t4026+t4028+t6871+t6872+t6873+t6874+t6875+t6876+t4037+t4138+t4118+
 t6877+t4120;
-    const double t6883 = t3949*t50;
-    const double t6884 = t3949*t67;
-    const double t6885 = t3946*t72;
-    const double t6886 = t3946*t73;
-    const double t6887 = t3958*t77;
-    const double t6889 = t3958*t126;
-    const double t6890 = t3958*t132;
-    const double t6891 = t3958*t136;
-    const double t6897 = t6889+t6890+t6891+t3952*t139+t3954*t145+t3952*t146+t3954*t155+t3964
+    const MBPOL_POLY_REAL t6883 = t3949*t50;
+    const MBPOL_POLY_REAL t6884 = t3949*t67;
+    const MBPOL_POLY_REAL t6885 = t3946*t72;
+    const MBPOL_POLY_REAL t6886 = t3946*t73;
+    const MBPOL_POLY_REAL t6887 = t3958*t77;
+    const MBPOL_POLY_REAL t6889 = t3958*t126;
+    const MBPOL_POLY_REAL t6890 = t3958*t132;
+    const MBPOL_POLY_REAL t6891 = t3958*t136;
+    const MBPOL_POLY_REAL t6897 = t6889+t6890+t6891+t3952*t139+t3954*t145+t3952*t146+t3954*t155+t3964
 +t3835+t3836+t3965*t212;
-    const double t6904 = t3876*t50;
-    const double t6905 = t3878*t67;
-    const double t6906 = t3873*t72;
-    const double t6907 = t3873*t73;
-    const double t6911 = t3867+t3870+t4124+t4126+t3872+t6904+t6905+t6906+t6907+t4066+t4067+
+    const MBPOL_POLY_REAL t6904 = t3876*t50;
+    const MBPOL_POLY_REAL t6905 = t3878*t67;
+    const MBPOL_POLY_REAL t6906 = t3873*t72;
+    const MBPOL_POLY_REAL t6907 = t3873*t73;
+    const MBPOL_POLY_REAL t6911 = t3867+t3870+t4124+t4126+t3872+t6904+t6905+t6906+t6907+t4066+t4067+
 t4068+t4069+t3882*t139+t3880*t145+t3886*t146;
-    const double t6917 = t3817*t50;
-    const double t6918 = t3817*t67;
-    const double t6919 = t3814*t72;
-    const double t6920 = t3814*t73;
-    const double t6925 = t3820*t139;
-    const double t6926 = t3820*t145;
-    const double t6927 = t3820*t146;
-    const double t6928 = t3820*t155;
-    const double t6931 = t3809+t3810+t3811+t3812+t3813+t6917+t6918+t6919+t6920+t3826*t77+
+    const MBPOL_POLY_REAL t6917 = t3817*t50;
+    const MBPOL_POLY_REAL t6918 = t3817*t67;
+    const MBPOL_POLY_REAL t6919 = t3814*t72;
+    const MBPOL_POLY_REAL t6920 = t3814*t73;
+    const MBPOL_POLY_REAL t6925 = t3820*t139;
+    const MBPOL_POLY_REAL t6926 = t3820*t145;
+    const MBPOL_POLY_REAL t6927 = t3820*t146;
+    const MBPOL_POLY_REAL t6928 = t3820*t155;
+    const MBPOL_POLY_REAL t6931 = t3809+t3810+t3811+t3812+t3813+t6917+t6918+t6919+t6920+t3826*t77+
 t3828*t126+t3826*t132+t3828*t136+t6925+t6926+t6927+t6928+t3833+t3837*t275+t3839
 *t254;
-    const double t6933 = t4062*t50;
-    const double t6934 = t4062*t67;
-    const double t6935 = t4060*t72;
-    const double t6936 = t4058*t73;
-    const double t6952 = t3970+t3971+t3972+t3973+t3974+t3978*t50+t3978*t67+t3975*t72+t3975*
+    const MBPOL_POLY_REAL t6933 = t4062*t50;
+    const MBPOL_POLY_REAL t6934 = t4062*t67;
+    const MBPOL_POLY_REAL t6935 = t4060*t72;
+    const MBPOL_POLY_REAL t6936 = t4058*t73;
+    const MBPOL_POLY_REAL t6952 = t3970+t3971+t3972+t3973+t3974+t3978*t50+t3978*t67+t3975*t72+t3975*
 t73+t3986*t77+t3986*t126+t3986*t132+t3986*t136+t3981*t139+t3981*t145+t3981*t146
 +t3981*t155+t3992;
-    const double t6954 = t4038*t77;
-    const double t6955 = t4040*t126;
-    const double t6956 = t4022+t4015+t4025+t4026+t4028+t6861+t6862+t6863+t6864+t6954+t6955;
-    const double t6957 = t4038*t132;
-    const double t6958 = t4040*t136;
-    const double t6959 = t4046*t275;
-    const double t6960 = t4044*t254;
-    const double t6961 = t6957+t6958+t6865+t6866+t6867+t6868+t4037+t6959+t6960+t6869+t6877+
+    const MBPOL_POLY_REAL t6954 = t4038*t77;
+    const MBPOL_POLY_REAL t6955 = t4040*t126;
+    const MBPOL_POLY_REAL t6956 = t4022+t4015+t4025+t4026+t4028+t6861+t6862+t6863+t6864+t6954+t6955;
+    const MBPOL_POLY_REAL t6957 = t4038*t132;
+    const MBPOL_POLY_REAL t6958 = t4040*t136;
+    const MBPOL_POLY_REAL t6959 = t4046*t275;
+    const MBPOL_POLY_REAL t6960 = t4044*t254;
+    const MBPOL_POLY_REAL t6961 = t6957+t6958+t6865+t6866+t6867+t6868+t4037+t6959+t6960+t6869+t6877+
 t4102;
-    const double t6681 = t6870+t6878;
-    const double t6687 = t3942+t3941+t3943+t3944+t3945+t6883+t6884+t6885+t6886+t6887+t6897;
-    const double t6691 = t3846*t20+t3850+t3849+t3844*t26+t3852;
-    const double t6694 = t3900*t50;
-    const double t6696 = t3902*t67;
-    const double t6702 = t4074*t77;
-    const double t6706 = t6956+t6961;
-    const double t6709 = t3935*t72;
-    const double t6712 = t3862*t73;
-    const double t6968 = (t3850+t3919+t3916)*t20+t6681*t240+(t3915+t3850+t3920+t3921)*t26+
+    const MBPOL_POLY_REAL t6681 = t6870+t6878;
+    const MBPOL_POLY_REAL t6687 = t3942+t3941+t3943+t3944+t3945+t6883+t6884+t6885+t6886+t6887+t6897;
+    const MBPOL_POLY_REAL t6691 = t3846*t20+t3850+t3849+t3844*t26+t3852;
+    const MBPOL_POLY_REAL t6694 = t3900*t50;
+    const MBPOL_POLY_REAL t6696 = t3902*t67;
+    const MBPOL_POLY_REAL t6702 = t4074*t77;
+    const MBPOL_POLY_REAL t6706 = t6956+t6961;
+    const MBPOL_POLY_REAL t6709 = t3935*t72;
+    const MBPOL_POLY_REAL t6712 = t3862*t73;
+    const MBPOL_POLY_REAL t6968 = (t3850+t3919+t3916)*t20+t6681*t240+(t3915+t3850+t3920+t3921)*t26+
 t6687*t212+t6691*t37+t6911*t146+(t3893+t3894+t3925+t3926+t3896+t6694+t6696)*t67
 +t6931*t254+(t4054+t4051+t4078+t4056+t4081+t6933+t6934+t6935+t6936+t6702)*t77+
 t6952*t179+t6706*t143+(t3931+t3857+t3858+t3860+t3934+t3898+t3899+t6709+t6712)*
 t73;
-    const double t6969 = t3878*t50;
-    const double t6970 = t3876*t67;
-    const double t6973 = t3870+t4125+t3869+t3871+t4127+t6969+t6970+t6906+t6907+t4066+t4067+
+    const MBPOL_POLY_REAL t6969 = t3878*t50;
+    const MBPOL_POLY_REAL t6970 = t3876*t67;
+    const MBPOL_POLY_REAL t6973 = t3870+t4125+t3869+t3871+t4127+t6969+t6970+t6906+t6907+t4066+t4067+
 t4068+t4069+t3884*t139+t3886*t145;
-    const double t6975 = t3942+t3941+t3943+t3944+t3945+t6883+t6884+t6885+t6886+t6887+t6889;
-    const double t6982 = t6890+t6891+t3954*t139+t3952*t145+t3954*t146+t3952*t155+t3964+t3835
+    const MBPOL_POLY_REAL t6975 = t3942+t3941+t3943+t3944+t3945+t6883+t6884+t6885+t6886+t6887+t6889;
+    const MBPOL_POLY_REAL t6982 = t6890+t6891+t3954*t139+t3952*t145+t3954*t146+t3952*t155+t3964+t3835
 +t3836+t4000*t212+t3965*t215;
-    const double t6986 = t3870+t4125+t3869+t3871+t4127+t6969+t6970+t6906+t6907+t4066+t4067+
+    const MBPOL_POLY_REAL t6986 = t3870+t4125+t3869+t3871+t4127+t6969+t6970+t6906+t6907+t4066+t4067+
 t4068+t4069+t3886*t139;
-    const double t6990 = t4054+t4051+t4078+t4056+t4081+t6933+t6934+t6935+t6936+t4084*t77+
+    const MBPOL_POLY_REAL t6990 = t4054+t4051+t4078+t4056+t4081+t6933+t6934+t6935+t6936+t4084*t77+
 t4074*t126;
-    const double t6997 = t3809+t3810+t3811+t3812+t3813+t6917+t6918+t6919+t6920+t3828*t77+
+    const MBPOL_POLY_REAL t6997 = t3809+t3810+t3811+t3812+t3813+t6917+t6918+t6919+t6920+t3828*t77+
 t3826*t126+t3828*t132+t3826*t136+t6925+t6926+t6927+t6928+t3833+t3839*t275;
-    const double t7002 = t4033*t139;
-    const double t7003 = t4009*t145;
-    const double t7004 = t4033*t146;
-    const double t7005 = t4009*t155;
-    const double t7006 = t4020*t212;
-    const double t7007 = t4016*t215;
-    const double t7008 = t7002+t7003+t7004+t7005+t7006+t7007+t6861+t6862+t6863+t6864+t4008+
+    const MBPOL_POLY_REAL t7002 = t4033*t139;
+    const MBPOL_POLY_REAL t7003 = t4009*t145;
+    const MBPOL_POLY_REAL t7004 = t4033*t146;
+    const MBPOL_POLY_REAL t7005 = t4009*t155;
+    const MBPOL_POLY_REAL t7006 = t4020*t212;
+    const MBPOL_POLY_REAL t7007 = t4016*t215;
+    const MBPOL_POLY_REAL t7008 = t7002+t7003+t7004+t7005+t7006+t7007+t6861+t6862+t6863+t6864+t4008+
 t4013+t4015;
-    const double t7011 = t4022+t4025+t4026+t4028+t6871+t4005*t309+t6872+t6873+t6874+t4018*
+    const MBPOL_POLY_REAL t7011 = t4022+t4025+t4026+t4028+t6871+t4005*t309+t6872+t6873+t6874+t4018*
 t240+t6875+t6876+t4037;
-    const double t7014 = t4022+t4015+t4025+t4026+t4028+t6861+t6862+t6863+t6864+t6954+t6955+
+    const MBPOL_POLY_REAL t7014 = t4022+t4015+t4025+t4026+t4028+t6861+t6862+t6863+t6864+t6954+t6955+
 t6957;
-    const double t7015 = t6958+t7002+t7003+t7004+t7005+t4037+t6959+t6960+t7006+t7007+t4119+
+    const MBPOL_POLY_REAL t7015 = t6958+t7002+t7003+t7004+t7005+t4037+t6959+t6960+t7006+t7007+t4119+
 t4139;
-    const double t7021 = t4058*t72;
-    const double t7022 = t4060*t73;
-    const double t7026 = t4079+t4053+t4051+t4080+t4057+t6933+t6934+t7021+t7022+t4070*t77+
+    const MBPOL_POLY_REAL t7021 = t4058*t72;
+    const MBPOL_POLY_REAL t7022 = t4060*t73;
+    const MBPOL_POLY_REAL t7026 = t4079+t4053+t4051+t4080+t4057+t6933+t6934+t7021+t7022+t4070*t77+
 t4072*t126+t4074*t132;
-    const double t7032 = t4079+t4053+t4051+t4080+t4057+t6933+t6934+t7021+t7022+t4072*t77+
+    const MBPOL_POLY_REAL t7032 = t4079+t4053+t4051+t4080+t4057+t6933+t6934+t7021+t7022+t4072*t77+
 t4070*t126+t4084*t132+t4074*t136;
-    const double t7038 = t3867+t3870+t4124+t4126+t3872+t6904+t6905+t6906+t6907+t4066+t4067+
+    const MBPOL_POLY_REAL t7038 = t3867+t3870+t4124+t4126+t3872+t6904+t6905+t6906+t6907+t4066+t4067+
 t4068+t4069+t3880*t139+t3882*t145+t3884*t146+t3886*t155;
-    const double t6780 = t6975+t6982;
-    const double t6787 = t3862*t72;
-    const double t6790 = t7008+t7011;
-    const double t6792 = t7014+t7015;
-    const double t6795 = t3902*t50;
-    const double t7040 = t6973*t145+t6780*t215+t6986*t139+t6990*t126+t6997*t275+(t3932+t3857
+    const MBPOL_POLY_REAL t6780 = t6975+t6982;
+    const MBPOL_POLY_REAL t6787 = t3862*t72;
+    const MBPOL_POLY_REAL t6790 = t7008+t7011;
+    const MBPOL_POLY_REAL t6792 = t7014+t7015;
+    const MBPOL_POLY_REAL t6795 = t3902*t50;
+    const MBPOL_POLY_REAL t7040 = t6973*t145+t6780*t215+t6986*t139+t6990*t126+t6997*t275+(t3932+t3857
 +t3856+t3933+t3861+t3898+t3899+t6787)*t72+t6790*t475+t4148+t6792*t309+(t3894+
 t3924+t3891+t3895+t3927+t6795)*t50+t7026*t132+t7032*t136+t7038*t155;
-    const double t7043 = t3215+t3214+t3216+t3218+t3219+t6734+t6735+t6736+t6738+t6849+t6850;
-    const double t7044 = t6851+t6853+t6739+t6740+t6741+t6742+t3233+t6854+t6855+t6743+t6744+
+    const MBPOL_POLY_REAL t7043 = t3215+t3214+t3216+t3218+t3219+t6734+t6735+t6736+t6738+t6849+t6850;
+    const MBPOL_POLY_REAL t7044 = t6851+t6853+t6739+t6740+t6741+t6742+t3233+t6854+t6855+t6743+t6744+
 t3797;
-    const double t7047 = t3166+t3168+t3169+t3170+t3171+t6804+t6805+t6806+t6807+t6808+t6810;
-    const double t7054 = t6811+t6812+t3180*t139+t3178*t145+t3180*t146+t3178*t155+t3190+t3761
+    const MBPOL_POLY_REAL t7047 = t3166+t3168+t3169+t3170+t3171+t6804+t6805+t6806+t6807+t6808+t6810;
+    const MBPOL_POLY_REAL t7054 = t6811+t6812+t3180*t139+t3178*t145+t3180*t146+t3178*t155+t3190+t3761
 +t3762+t4763*t212+t3191*t215;
-    const double t7057 = t4255*t50;
-    const double t7058 = t4253*t67;
-    const double t7059 = t4250*t72;
-    const double t7060 = t4250*t73;
-    const double t7061 = t4261*t139;
-    const double t7062 = t4263*t145;
-    const double t7063 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4490+t4539+
+    const MBPOL_POLY_REAL t7057 = t4255*t50;
+    const MBPOL_POLY_REAL t7058 = t4253*t67;
+    const MBPOL_POLY_REAL t7059 = t4250*t72;
+    const MBPOL_POLY_REAL t7060 = t4250*t73;
+    const MBPOL_POLY_REAL t7061 = t4261*t139;
+    const MBPOL_POLY_REAL t7062 = t4263*t145;
+    const MBPOL_POLY_REAL t7063 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4490+t4539+
 t4492+t4541+t7061+t7062;
-    const double t7065 = t4534*t50;
-    const double t7066 = t4534*t67;
-    const double t7067 = t4530*t72;
-    const double t7068 = t4532*t73;
-    const double t7069 = t4494*t77;
-    const double t7071 = t4523+t4610+t4525+t4611+t4529+t7065+t7066+t7067+t7068+t7069+t4542*
+    const MBPOL_POLY_REAL t7065 = t4534*t50;
+    const MBPOL_POLY_REAL t7066 = t4534*t67;
+    const MBPOL_POLY_REAL t7067 = t4530*t72;
+    const MBPOL_POLY_REAL t7068 = t4532*t73;
+    const MBPOL_POLY_REAL t7069 = t4494*t77;
+    const MBPOL_POLY_REAL t7071 = t4523+t4610+t4525+t4611+t4529+t7065+t7066+t7067+t7068+t7069+t4542*
 t126;
-    const double t7073 = t4486*t50;
-    const double t7074 = t4486*t67;
-    const double t7075 = t4484*t72;
-    const double t7076 = t4482*t73;
-    const double t7078 = t4506*t126;
-    const double t7080 = t4500+t4477+t4478+t4480+t4503+t7073+t7074+t7075+t7076+t4508*t77+
+    const MBPOL_POLY_REAL t7073 = t4486*t50;
+    const MBPOL_POLY_REAL t7074 = t4486*t67;
+    const MBPOL_POLY_REAL t7075 = t4484*t72;
+    const MBPOL_POLY_REAL t7076 = t4482*t73;
+    const MBPOL_POLY_REAL t7078 = t4506*t126;
+    const MBPOL_POLY_REAL t7080 = t4500+t4477+t4478+t4480+t4503+t7073+t7074+t7075+t7076+t4508*t77+
 t7078+t4496*t132;
-    const double t7082 = t4217*t50;
-    const double t7083 = t4217*t67;
-    const double t7084 = t4197*t72;
-    const double t7085 = t4197*t73;
-    const double t7086 = t4224*t77;
-    const double t7087 = t4213*t126;
-    const double t7088 = t4224*t132;
-    const double t7089 = t4203+t4233+t4228+t4232+t4200+t7082+t7083+t7084+t7085+t7086+t7087+
+    const MBPOL_POLY_REAL t7082 = t4217*t50;
+    const MBPOL_POLY_REAL t7083 = t4217*t67;
+    const MBPOL_POLY_REAL t7084 = t4197*t72;
+    const MBPOL_POLY_REAL t7085 = t4197*t73;
+    const MBPOL_POLY_REAL t7086 = t4224*t77;
+    const MBPOL_POLY_REAL t7087 = t4213*t126;
+    const MBPOL_POLY_REAL t7088 = t4224*t132;
+    const MBPOL_POLY_REAL t7089 = t4203+t4233+t4228+t4232+t4200+t7082+t7083+t7084+t7085+t7086+t7087+
 t7088;
-    const double t7090 = t4213*t136;
-    const double t7091 = t4201*t139;
-    const double t7092 = t4219*t145;
-    const double t7093 = t4201*t146;
-    const double t7094 = t4219*t155;
-    const double t7095 = t4236*t275;
-    const double t7096 = t4211*t254;
-    const double t7097 = t4229*t212;
-    const double t7098 = t4207*t215;
-    const double t7099 = t7090+t7091+t7092+t7093+t7094+t4210+t7095+t7096+t7097+t7098+t4682+
+    const MBPOL_POLY_REAL t7090 = t4213*t136;
+    const MBPOL_POLY_REAL t7091 = t4201*t139;
+    const MBPOL_POLY_REAL t7092 = t4219*t145;
+    const MBPOL_POLY_REAL t7093 = t4201*t146;
+    const MBPOL_POLY_REAL t7094 = t4219*t155;
+    const MBPOL_POLY_REAL t7095 = t4236*t275;
+    const MBPOL_POLY_REAL t7096 = t4211*t254;
+    const MBPOL_POLY_REAL t7097 = t4229*t212;
+    const MBPOL_POLY_REAL t7098 = t4207*t215;
+    const MBPOL_POLY_REAL t7099 = t7090+t7091+t7092+t7093+t7094+t4210+t7095+t7096+t7097+t7098+t4682+
 t4453;
-    const double t6822 = t4267+t4412+t4547;
-    const double t7103 = t6822*t20;
-    const double t6831 = t4267+t4283*t20+t4285*t26+t4288+t4289;
-    const double t7107 = t6831*t37;
-    const double t6835 = t4426*t50;
-    const double t7110 = (t4416+t4420+t4514+t4516+t4422+t6835)*t50;
-    const double t6838 = t4279*t72;
-    const double t7113 = (t4274+t4272+t4333+t4334+t4278+t4424+t4425+t6838)*t72;
-    const double t6840 = t4336*t72;
-    const double t6841 = t4279*t73;
-    const double t7117 = (t4332+t4275+t4272+t4277+t4335+t4424+t4425+t6840+t6841)*t73;
-    const double t7118 = t4384*t50;
-    const double t7119 = t4384*t67;
-    const double t7120 = t4381*t72;
-    const double t7121 = t4381*t73;
-    const double t7126 = t4387*t139;
-    const double t7127 = t4387*t145;
-    const double t7128 = t4387*t146;
-    const double t7129 = t4387*t155;
-    const double t7131 = t4377+t4375+t4378+t4379+t4380+t7118+t7119+t7120+t7121+t4395*t77+
+    const MBPOL_POLY_REAL t6822 = t4267+t4412+t4547;
+    const MBPOL_POLY_REAL t7103 = t6822*t20;
+    const MBPOL_POLY_REAL t6831 = t4267+t4283*t20+t4285*t26+t4288+t4289;
+    const MBPOL_POLY_REAL t7107 = t6831*t37;
+    const MBPOL_POLY_REAL t6835 = t4426*t50;
+    const MBPOL_POLY_REAL t7110 = (t4416+t4420+t4514+t4516+t4422+t6835)*t50;
+    const MBPOL_POLY_REAL t6838 = t4279*t72;
+    const MBPOL_POLY_REAL t7113 = (t4274+t4272+t4333+t4334+t4278+t4424+t4425+t6838)*t72;
+    const MBPOL_POLY_REAL t6840 = t4336*t72;
+    const MBPOL_POLY_REAL t6841 = t4279*t73;
+    const MBPOL_POLY_REAL t7117 = (t4332+t4275+t4272+t4277+t4335+t4424+t4425+t6840+t6841)*t73;
+    const MBPOL_POLY_REAL t7118 = t4384*t50;
+    const MBPOL_POLY_REAL t7119 = t4384*t67;
+    const MBPOL_POLY_REAL t7120 = t4381*t72;
+    const MBPOL_POLY_REAL t7121 = t4381*t73;
+    const MBPOL_POLY_REAL t7126 = t4387*t139;
+    const MBPOL_POLY_REAL t7127 = t4387*t145;
+    const MBPOL_POLY_REAL t7128 = t4387*t146;
+    const MBPOL_POLY_REAL t7129 = t4387*t155;
+    const MBPOL_POLY_REAL t7131 = t4377+t4375+t4378+t4379+t4380+t7118+t7119+t7120+t7121+t4395*t77+
 t4393*t126+t4395*t132+t4393*t136+t7126+t7127+t7128+t7129+t4400+t4406*t275;
-    const double t7133 = t4325*t275;
-    const double t7134 = t4323*t254;
-    const double t7135 = t4311*t126;
-    const double t7136 = t4313*t77;
-    const double t7137 = t4311*t136;
-    const double t7138 = t4313*t132;
-    const double t7139 = t7133+t7134+t7135+t7136+t7137+t7138+t4292+t4452+t4318+t4296+t4295+
+    const MBPOL_POLY_REAL t7133 = t4325*t275;
+    const MBPOL_POLY_REAL t7134 = t4323*t254;
+    const MBPOL_POLY_REAL t7135 = t4311*t126;
+    const MBPOL_POLY_REAL t7136 = t4313*t77;
+    const MBPOL_POLY_REAL t7137 = t4311*t136;
+    const MBPOL_POLY_REAL t7138 = t4313*t132;
+    const MBPOL_POLY_REAL t7139 = t7133+t7134+t7135+t7136+t7137+t7138+t4292+t4452+t4318+t4296+t4295+
 t4294;
-    const double t7140 = t4301*t67;
-    const double t7141 = t4298*t72;
-    const double t7142 = t4298*t73;
-    const double t7143 = t4301*t50;
-    const double t7144 = t4304*t139;
-    const double t7145 = t4306*t145;
-    const double t7146 = t4304*t146;
-    const double t7147 = t4306*t155;
-    const double t7148 = t4319*t212;
-    const double t7149 = t4321*t215;
-    const double t7150 = t4297+t4467+t4469+t7140+t7141+t7142+t7143+t7144+t7145+t7146+t7147+
+    const MBPOL_POLY_REAL t7140 = t4301*t67;
+    const MBPOL_POLY_REAL t7141 = t4298*t72;
+    const MBPOL_POLY_REAL t7142 = t4298*t73;
+    const MBPOL_POLY_REAL t7143 = t4301*t50;
+    const MBPOL_POLY_REAL t7144 = t4304*t139;
+    const MBPOL_POLY_REAL t7145 = t4306*t145;
+    const MBPOL_POLY_REAL t7146 = t4304*t146;
+    const MBPOL_POLY_REAL t7147 = t4306*t155;
+    const MBPOL_POLY_REAL t7148 = t4319*t212;
+    const MBPOL_POLY_REAL t7149 = t4321*t215;
+    const MBPOL_POLY_REAL t7150 = t4297+t4467+t4469+t7140+t7141+t7142+t7143+t7144+t7145+t7146+t7147+
 t7148+t7149;
-    const double t6859 = t7089+t7099;
-    const double t6880 = t7139+t7150;
-    const double t7153 = t4271+t7063*t145+t7071*t126+t7080*t132+t6859*t309+t7103+t7107+t7110
+    const MBPOL_POLY_REAL t6859 = t7089+t7099;
+    const MBPOL_POLY_REAL t6880 = t7139+t7150;
+    const MBPOL_POLY_REAL t7153 = t4271+t7063*t145+t7071*t126+t7080*t132+t6859*t309+t7103+t7107+t7110
 +t7113+t7117+t7131*t275+t6880*t240;
-    const double t7154 = t4532*t72;
-    const double t7155 = t4530*t73;
-    const double t7156 = t4506*t77;
-    const double t7158 = t4494*t132;
-    const double t7160 = t4526+t4609+t4523+t4528+t4612+t7065+t7066+t7154+t7155+t7156+t4615*
+    const MBPOL_POLY_REAL t7154 = t4532*t72;
+    const MBPOL_POLY_REAL t7155 = t4530*t73;
+    const MBPOL_POLY_REAL t7156 = t4506*t77;
+    const MBPOL_POLY_REAL t7158 = t4494*t132;
+    const MBPOL_POLY_REAL t7160 = t4526+t4609+t4523+t4528+t4612+t7065+t7066+t7154+t7155+t7156+t4615*
 t126+t7158+t4542*t136;
-    const double t7162 = t4263*t139;
-    const double t7163 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4490+t4539+
+    const MBPOL_POLY_REAL t7162 = t4263*t139;
+    const MBPOL_POLY_REAL t7163 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4490+t4539+
 t4492+t4541+t7162;
-    const double t7165 = t4203+t4233+t4228+t4232+t4200+t7082+t7083+t7084+t7085+t7086+t7087;
-    const double t7166 = t4219*t139;
-    const double t7167 = t4201*t145;
-    const double t7168 = t4219*t146;
-    const double t7169 = t4201*t155;
-    const double t7170 = t4207*t212;
-    const double t7171 = t4229*t215;
-    const double t7172 = t7088+t7090+t7166+t7167+t7168+t7169+t4210+t7095+t7096+t7170+t7171+
+    const MBPOL_POLY_REAL t7165 = t4203+t4233+t4228+t4232+t4200+t7082+t7083+t7084+t7085+t7086+t7087;
+    const MBPOL_POLY_REAL t7166 = t4219*t139;
+    const MBPOL_POLY_REAL t7167 = t4201*t145;
+    const MBPOL_POLY_REAL t7168 = t4219*t146;
+    const MBPOL_POLY_REAL t7169 = t4201*t155;
+    const MBPOL_POLY_REAL t7170 = t4207*t212;
+    const MBPOL_POLY_REAL t7171 = t4229*t215;
+    const MBPOL_POLY_REAL t7172 = t7088+t7090+t7166+t7167+t7168+t7169+t4210+t7095+t7096+t7170+t7171+
 t4695;
-    const double t7175 = t4350*t50;
-    const double t7176 = t4350*t67;
-    const double t7177 = t4347*t72;
-    const double t7178 = t4347*t73;
-    const double t7183 = t4353*t139;
-    const double t7184 = t4353*t145;
-    const double t7185 = t4353*t146;
-    const double t7186 = t4353*t155;
-    const double t7187 = t4404*t275;
-    const double t7189 = t4343+t4342+t4344+t4345+t4346+t7175+t7176+t7177+t7178+t4361*t77+
+    const MBPOL_POLY_REAL t7175 = t4350*t50;
+    const MBPOL_POLY_REAL t7176 = t4350*t67;
+    const MBPOL_POLY_REAL t7177 = t4347*t72;
+    const MBPOL_POLY_REAL t7178 = t4347*t73;
+    const MBPOL_POLY_REAL t7183 = t4353*t139;
+    const MBPOL_POLY_REAL t7184 = t4353*t145;
+    const MBPOL_POLY_REAL t7185 = t4353*t146;
+    const MBPOL_POLY_REAL t7186 = t4353*t155;
+    const MBPOL_POLY_REAL t7187 = t4404*t275;
+    const MBPOL_POLY_REAL t7189 = t4343+t4342+t4344+t4345+t4346+t7175+t7176+t7177+t7178+t4361*t77+
 t4359*t126+t4361*t132+t4359*t136+t7183+t7184+t7185+t7186+t4366+t7187+t4370*t254
 ;
-    const double t6898 = t4267+t4546+t4411+t4413;
-    const double t7192 = t6898*t26;
-    const double t7193 = t4586*t50;
-    const double t7194 = t4586*t67;
-    const double t7195 = t4583*t72;
-    const double t7196 = t4583*t73;
-    const double t7197 = t4597*t77;
-    const double t7198 = t4595*t126;
-    const double t7199 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7197+t7198;
-    const double t7200 = t4597*t132;
-    const double t7201 = t4595*t136;
-    const double t7202 = t4589*t139;
-    const double t7203 = t4591*t145;
-    const double t7204 = t4589*t146;
-    const double t7205 = t4591*t155;
-    const double t7206 = t4603*t212;
-    const double t7207 = t4605*t215;
-    const double t7208 = t7200+t7201+t7202+t7203+t7204+t7205+t4602+t4402+t4369+t7206+t7207;
-    const double t7211 = t4253*t50;
-    const double t7212 = t4255*t67;
-    const double t7213 = t4259*t139;
-    const double t7214 = t4257*t145;
-    const double t7215 = t4263*t146;
-    const double t7216 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4490+t4539+
+    const MBPOL_POLY_REAL t6898 = t4267+t4546+t4411+t4413;
+    const MBPOL_POLY_REAL t7192 = t6898*t26;
+    const MBPOL_POLY_REAL t7193 = t4586*t50;
+    const MBPOL_POLY_REAL t7194 = t4586*t67;
+    const MBPOL_POLY_REAL t7195 = t4583*t72;
+    const MBPOL_POLY_REAL t7196 = t4583*t73;
+    const MBPOL_POLY_REAL t7197 = t4597*t77;
+    const MBPOL_POLY_REAL t7198 = t4595*t126;
+    const MBPOL_POLY_REAL t7199 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7197+t7198;
+    const MBPOL_POLY_REAL t7200 = t4597*t132;
+    const MBPOL_POLY_REAL t7201 = t4595*t136;
+    const MBPOL_POLY_REAL t7202 = t4589*t139;
+    const MBPOL_POLY_REAL t7203 = t4591*t145;
+    const MBPOL_POLY_REAL t7204 = t4589*t146;
+    const MBPOL_POLY_REAL t7205 = t4591*t155;
+    const MBPOL_POLY_REAL t7206 = t4603*t212;
+    const MBPOL_POLY_REAL t7207 = t4605*t215;
+    const MBPOL_POLY_REAL t7208 = t7200+t7201+t7202+t7203+t7204+t7205+t4602+t4402+t4369+t7206+t7207;
+    const MBPOL_POLY_REAL t7211 = t4253*t50;
+    const MBPOL_POLY_REAL t7212 = t4255*t67;
+    const MBPOL_POLY_REAL t7213 = t4259*t139;
+    const MBPOL_POLY_REAL t7214 = t4257*t145;
+    const MBPOL_POLY_REAL t7215 = t4263*t146;
+    const MBPOL_POLY_REAL t7216 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4490+t4539+
 t4492+t4541+t7213+t7214+t7215;
-    const double t7218 = t4257*t139;
-    const double t7219 = t4259*t145;
-    const double t7220 = t4261*t146;
-    const double t7221 = t4263*t155;
-    const double t7222 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4490+t4539+
+    const MBPOL_POLY_REAL t7218 = t4257*t139;
+    const MBPOL_POLY_REAL t7219 = t4259*t145;
+    const MBPOL_POLY_REAL t7220 = t4261*t146;
+    const MBPOL_POLY_REAL t7221 = t4263*t155;
+    const MBPOL_POLY_REAL t7222 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4490+t4539+
 t4492+t4541+t7218+t7219+t7220+t7221;
-    const double t7224 = t4559*t50;
-    const double t7225 = t4559*t67;
-    const double t7226 = t4556*t72;
-    const double t7227 = t4556*t73;
-    const double t7232 = t4562*t139;
-    const double t7233 = t4562*t145;
-    const double t7234 = t4562*t146;
-    const double t7235 = t4562*t155;
-    const double t7236 = t4552+t4551+t4553+t4554+t4555+t7224+t7225+t7226+t7227+t4569*t77+
+    const MBPOL_POLY_REAL t7224 = t4559*t50;
+    const MBPOL_POLY_REAL t7225 = t4559*t67;
+    const MBPOL_POLY_REAL t7226 = t4556*t72;
+    const MBPOL_POLY_REAL t7227 = t4556*t73;
+    const MBPOL_POLY_REAL t7232 = t4562*t139;
+    const MBPOL_POLY_REAL t7233 = t4562*t145;
+    const MBPOL_POLY_REAL t7234 = t4562*t146;
+    const MBPOL_POLY_REAL t7235 = t4562*t155;
+    const MBPOL_POLY_REAL t7236 = t4552+t4551+t4553+t4554+t4555+t7224+t7225+t7226+t7227+t4569*t77+
 t4567*t126+t4569*t132+t4567*t136+t7232+t7233+t7234+t7235+t4574;
-    const double t6903 = t4518*t50;
-    const double t6908 = t4426*t67;
-    const double t7241 = (t4416+t4515+t4418+t4421+t4517+t6903+t6908)*t67;
-    const double t7243 = t4591*t139;
-    const double t7244 = t4589*t145;
-    const double t7245 = t4591*t146;
-    const double t7246 = t4589*t155;
-    const double t7247 = t4605*t212;
-    const double t7248 = t7198+t7200+t7201+t7243+t7244+t7245+t7246+t4602+t4402+t4369+t7247;
-    const double t7251 = t4321*t212;
-    const double t7252 = t4204*t309;
-    const double t7253 = t4223+t7251+t7133+t7134+t7135+t7136+t7137+t7138+t7252+t4292+t4318+
+    const MBPOL_POLY_REAL t6903 = t4518*t50;
+    const MBPOL_POLY_REAL t6908 = t4426*t67;
+    const MBPOL_POLY_REAL t7241 = (t4416+t4515+t4418+t4421+t4517+t6903+t6908)*t67;
+    const MBPOL_POLY_REAL t7243 = t4591*t139;
+    const MBPOL_POLY_REAL t7244 = t4589*t145;
+    const MBPOL_POLY_REAL t7245 = t4591*t146;
+    const MBPOL_POLY_REAL t7246 = t4589*t155;
+    const MBPOL_POLY_REAL t7247 = t4605*t212;
+    const MBPOL_POLY_REAL t7248 = t7198+t7200+t7201+t7243+t7244+t7245+t7246+t4602+t4402+t4369+t7247;
+    const MBPOL_POLY_REAL t7251 = t4321*t212;
+    const MBPOL_POLY_REAL t7252 = t4204*t309;
+    const MBPOL_POLY_REAL t7253 = t4223+t7251+t7133+t7134+t7135+t7136+t7137+t7138+t7252+t4292+t4318+
 t4296+t4295;
-    const double t7254 = t4306*t139;
-    const double t7255 = t4304*t145;
-    const double t7256 = t4306*t146;
-    const double t7257 = t4304*t155;
-    const double t7258 = t4319*t215;
-    const double t7260 = t4294+t4297+t7140+t7141+t7142+t7254+t7255+t7256+t7257+t7258+t7143+
+    const MBPOL_POLY_REAL t7254 = t4306*t139;
+    const MBPOL_POLY_REAL t7255 = t4304*t145;
+    const MBPOL_POLY_REAL t7256 = t4306*t146;
+    const MBPOL_POLY_REAL t7257 = t4304*t155;
+    const MBPOL_POLY_REAL t7258 = t4319*t215;
+    const MBPOL_POLY_REAL t7260 = t4294+t4297+t7140+t7141+t7142+t7254+t7255+t7256+t7257+t7258+t7143+
 t4676+t4470*t240;
-    const double t7263 = t4482*t72;
-    const double t7264 = t4484*t73;
-    const double t6914 = t7165+t7172;
-    const double t6921 = t7199+t7208;
-    const double t6930 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7197+t7248;
-    const double t6937 = t7253+t7260;
-    const double t6939 = t4496*t77;
-    const double t7268 = t7160*t136+t7163*t139+t6914*t143+t7189*t254+t7192+t6921*t215+t7216*
+    const MBPOL_POLY_REAL t7263 = t4482*t72;
+    const MBPOL_POLY_REAL t7264 = t4484*t73;
+    const MBPOL_POLY_REAL t6914 = t7165+t7172;
+    const MBPOL_POLY_REAL t6921 = t7199+t7208;
+    const MBPOL_POLY_REAL t6930 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7197+t7248;
+    const MBPOL_POLY_REAL t6937 = t7253+t7260;
+    const MBPOL_POLY_REAL t6939 = t4496*t77;
+    const MBPOL_POLY_REAL t7268 = t7160*t136+t7163*t139+t6914*t143+t7189*t254+t7192+t6921*t215+t7216*
 t146+t7222*t155+t7236*t179+t7241+t6930*t212+t6937*t475+(t4476+t4477+t4501+t4502
 +t4481+t7073+t7074+t7263+t7264+t6939)*t77;
-    const double t7283 = t4153+t4154+t4155+t4156+t4157+t4161*t50+t4161*t67+t4158*t72+t4158*
+    const MBPOL_POLY_REAL t7283 = t4153+t4154+t4155+t4156+t4157+t4161*t50+t4161*t67+t4158*t72+t4158*
 t73+t4169*t77+t4169*t126+t4169*t132+t4169*t136+t4164*t139+t4164*t145+t4164*t146
 +t4164*t155+t4175;
-    const double t7288 = t3241+t3245+t4728+t4729+t3247+t6796+t6797+t6435+t6436+t3280+t3281+
+    const MBPOL_POLY_REAL t7288 = t3241+t3245+t4728+t4729+t3247+t6796+t6797+t6435+t6436+t3280+t3281+
 t3282+t3283+t3257*t139+t3255*t145+t3261*t146;
-    const double t7293 = t3267+t4178+t3268+t3270+t4181+t6748+t6749+t6750+t6751+t4184*t77+
+    const MBPOL_POLY_REAL t7293 = t3267+t4178+t3268+t3270+t4181+t6748+t6749+t6750+t6751+t4184*t77+
 t4186*t126+t3286*t132;
-    const double t7295 = t3301*t50;
-    const double t7296 = t3301*t67;
-    const double t7297 = t3299*t72;
-    const double t7298 = t3297*t73;
-    const double t7303 = t3293+t3578+t3292+t3295+t3581+t7295+t7296+t7297+t7298+t3586*t77+
+    const MBPOL_POLY_REAL t7295 = t3301*t50;
+    const MBPOL_POLY_REAL t7296 = t3301*t67;
+    const MBPOL_POLY_REAL t7297 = t3299*t72;
+    const MBPOL_POLY_REAL t7298 = t3297*t73;
+    const MBPOL_POLY_REAL t7303 = t3293+t3578+t3292+t3295+t3581+t7295+t7296+t7297+t7298+t3586*t77+
 t3584*t126+t3314*t132+t3310*t136;
-    const double t7304 = t7303*t136;
-    const double t7305 = t3397*t50;
-    const double t7306 = t3397*t67;
-    const double t7307 = t3394*t72;
-    const double t7308 = t3394*t73;
-    const double t7309 = t3407*t77;
-    const double t7310 = t3409*t126;
-    const double t7311 = t3407*t132;
-    const double t7312 = t3409*t136;
-    const double t7313 = t3400*t139;
-    const double t7314 = t3402*t145;
-    const double t7315 = t3400*t146;
-    const double t7316 = t3402*t155;
-    const double t7317 = t3419*t275;
-    const double t7318 = t3421*t254;
-    const double t7319 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7309+t7310+
+    const MBPOL_POLY_REAL t7304 = t7303*t136;
+    const MBPOL_POLY_REAL t7305 = t3397*t50;
+    const MBPOL_POLY_REAL t7306 = t3397*t67;
+    const MBPOL_POLY_REAL t7307 = t3394*t72;
+    const MBPOL_POLY_REAL t7308 = t3394*t73;
+    const MBPOL_POLY_REAL t7309 = t3407*t77;
+    const MBPOL_POLY_REAL t7310 = t3409*t126;
+    const MBPOL_POLY_REAL t7311 = t3407*t132;
+    const MBPOL_POLY_REAL t7312 = t3409*t136;
+    const MBPOL_POLY_REAL t7313 = t3400*t139;
+    const MBPOL_POLY_REAL t7314 = t3402*t145;
+    const MBPOL_POLY_REAL t7315 = t3400*t146;
+    const MBPOL_POLY_REAL t7316 = t3402*t155;
+    const MBPOL_POLY_REAL t7317 = t3419*t275;
+    const MBPOL_POLY_REAL t7318 = t3421*t254;
+    const MBPOL_POLY_REAL t7319 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7309+t7310+
 t7311+t7312+t7313+t7314+t7315+t7316+t3414+t7317+t7318;
-    const double t7321 = t3331*t50;
-    const double t7322 = t3329*t67;
-    const double t7323 = t3326*t72;
-    const double t7324 = t3326*t73;
-    const double t7326 = t3319+t3635+t3323+t3324+t3637+t7321+t7322+t7323+t7324+t3305+t4769+
+    const MBPOL_POLY_REAL t7321 = t3331*t50;
+    const MBPOL_POLY_REAL t7322 = t3329*t67;
+    const MBPOL_POLY_REAL t7323 = t3326*t72;
+    const MBPOL_POLY_REAL t7324 = t3326*t73;
+    const MBPOL_POLY_REAL t7326 = t3319+t3635+t3323+t3324+t3637+t7321+t7322+t7323+t7324+t3305+t4769+
 t3308+t4771+t3337*t139;
-    const double t7328 = t3435*t50;
-    const double t7329 = t3435*t67;
-    const double t7330 = t3432*t72;
-    const double t7331 = t3432*t73;
-    const double t7332 = t3445*t77;
-    const double t7333 = t3447*t126;
-    const double t7334 = t3427+t3428+t3429+t3430+t3431+t7328+t7329+t7330+t7331+t7332+t7333;
-    const double t7335 = t3445*t132;
-    const double t7336 = t3447*t136;
-    const double t7337 = t3438*t139;
-    const double t7338 = t3440*t145;
-    const double t7339 = t3438*t146;
-    const double t7340 = t3440*t155;
-    const double t7341 = t3457*t275;
-    const double t7342 = t3459*t254;
-    const double t7343 = t3453*t212;
-    const double t7344 = t3455*t215;
-    const double t7345 = t7335+t7336+t7337+t7338+t7339+t7340+t3452+t7341+t7342+t7343+t7344+
+    const MBPOL_POLY_REAL t7328 = t3435*t50;
+    const MBPOL_POLY_REAL t7329 = t3435*t67;
+    const MBPOL_POLY_REAL t7330 = t3432*t72;
+    const MBPOL_POLY_REAL t7331 = t3432*t73;
+    const MBPOL_POLY_REAL t7332 = t3445*t77;
+    const MBPOL_POLY_REAL t7333 = t3447*t126;
+    const MBPOL_POLY_REAL t7334 = t3427+t3428+t3429+t3430+t3431+t7328+t7329+t7330+t7331+t7332+t7333;
+    const MBPOL_POLY_REAL t7335 = t3445*t132;
+    const MBPOL_POLY_REAL t7336 = t3447*t136;
+    const MBPOL_POLY_REAL t7337 = t3438*t139;
+    const MBPOL_POLY_REAL t7338 = t3440*t145;
+    const MBPOL_POLY_REAL t7339 = t3438*t146;
+    const MBPOL_POLY_REAL t7340 = t3440*t155;
+    const MBPOL_POLY_REAL t7341 = t3457*t275;
+    const MBPOL_POLY_REAL t7342 = t3459*t254;
+    const MBPOL_POLY_REAL t7343 = t3453*t212;
+    const MBPOL_POLY_REAL t7344 = t3455*t215;
+    const MBPOL_POLY_REAL t7345 = t7335+t7336+t7337+t7338+t7339+t7340+t3452+t7341+t7342+t7343+t7344+
 t3462;
-    const double t7348 = t3539*t50;
-    const double t7349 = t3539*t67;
-    const double t7350 = t3536*t72;
-    const double t7351 = t3536*t73;
-    const double t7352 = t3548*t77;
-    const double t7353 = t3548*t126;
-    const double t7354 = t3530+t3532+t3533+t3534+t3535+t7348+t7349+t7350+t7351+t7352+t7353;
-    const double t7355 = t3548*t132;
-    const double t7356 = t3548*t136;
-    const double t7361 = t3555*t212;
-    const double t7363 = t7355+t7356+t3542*t139+t3544*t145+t3542*t146+t3544*t155+t3554+t4800
+    const MBPOL_POLY_REAL t7348 = t3539*t50;
+    const MBPOL_POLY_REAL t7349 = t3539*t67;
+    const MBPOL_POLY_REAL t7350 = t3536*t72;
+    const MBPOL_POLY_REAL t7351 = t3536*t73;
+    const MBPOL_POLY_REAL t7352 = t3548*t77;
+    const MBPOL_POLY_REAL t7353 = t3548*t126;
+    const MBPOL_POLY_REAL t7354 = t3530+t3532+t3533+t3534+t3535+t7348+t7349+t7350+t7351+t7352+t7353;
+    const MBPOL_POLY_REAL t7355 = t3548*t132;
+    const MBPOL_POLY_REAL t7356 = t3548*t136;
+    const MBPOL_POLY_REAL t7361 = t3555*t212;
+    const MBPOL_POLY_REAL t7363 = t7355+t7356+t3542*t139+t3544*t145+t3542*t146+t3544*t155+t3554+t4800
 +t3418+t7361+t3557*t215;
-    const double t7366 = t3353*t50;
-    const double t7367 = t3351*t67;
-    const double t7368 = t3348*t72;
-    const double t7369 = t3348*t73;
-    const double t7370 = t3335*t139;
-    const double t7372 = t3355*t146;
-    const double t7374 = t3345+t3607+t3342+t3346+t3609+t7366+t7367+t7368+t7369+t4768+t3307+
+    const MBPOL_POLY_REAL t7366 = t3353*t50;
+    const MBPOL_POLY_REAL t7367 = t3351*t67;
+    const MBPOL_POLY_REAL t7368 = t3348*t72;
+    const MBPOL_POLY_REAL t7369 = t3348*t73;
+    const MBPOL_POLY_REAL t7370 = t3335*t139;
+    const MBPOL_POLY_REAL t7372 = t3355*t146;
+    const MBPOL_POLY_REAL t7374 = t3345+t3607+t3342+t3346+t3609+t7366+t7367+t7368+t7369+t4768+t3307+
 t4770+t3309+t7370+t3613*t145+t7372+t3357*t155;
-    const double t7376 = t3661*t50;
-    const double t7377 = t3661*t67;
-    const double t7378 = t3658*t72;
-    const double t7379 = t3658*t73;
-    const double t7380 = t3670*t77;
-    const double t7382 = t3670*t126;
-    const double t7383 = t3670*t132;
-    const double t7384 = t3670*t136;
-    const double t7390 = t7382+t7383+t7384+t3664*t139+t3666*t145+t3664*t146+t3666*t155+t3676
+    const MBPOL_POLY_REAL t7376 = t3661*t50;
+    const MBPOL_POLY_REAL t7377 = t3661*t67;
+    const MBPOL_POLY_REAL t7378 = t3658*t72;
+    const MBPOL_POLY_REAL t7379 = t3658*t73;
+    const MBPOL_POLY_REAL t7380 = t3670*t77;
+    const MBPOL_POLY_REAL t7382 = t3670*t126;
+    const MBPOL_POLY_REAL t7383 = t3670*t132;
+    const MBPOL_POLY_REAL t7384 = t3670*t136;
+    const MBPOL_POLY_REAL t7390 = t7382+t7383+t7384+t3664*t139+t3666*t145+t3664*t146+t3666*t155+t3676
 +t3416+t4801+t3677*t212;
-    const double t7393 = t3496*t50;
-    const double t7394 = t3496*t67;
-    const double t7395 = t3498*t72;
-    const double t7396 = t3498*t73;
-    const double t7397 = t3490*t77;
-    const double t7398 = t3492*t126;
-    const double t7399 = t3490*t132;
-    const double t7400 = t3485+t3506+t3504+t3509+t3510+t7393+t7394+t7395+t7396+t7397+t7398+
+    const MBPOL_POLY_REAL t7393 = t3496*t50;
+    const MBPOL_POLY_REAL t7394 = t3496*t67;
+    const MBPOL_POLY_REAL t7395 = t3498*t72;
+    const MBPOL_POLY_REAL t7396 = t3498*t73;
+    const MBPOL_POLY_REAL t7397 = t3490*t77;
+    const MBPOL_POLY_REAL t7398 = t3492*t126;
+    const MBPOL_POLY_REAL t7399 = t3490*t132;
+    const MBPOL_POLY_REAL t7400 = t3485+t3506+t3504+t3509+t3510+t7393+t7394+t7395+t7396+t7397+t7398+
 t7399;
-    const double t7401 = t3492*t136;
-    const double t7402 = t3500*t139;
-    const double t7403 = t3483*t145;
-    const double t7404 = t3500*t146;
-    const double t7405 = t3483*t155;
-    const double t7406 = t3475*t275;
-    const double t7407 = t3479*t254;
-    const double t7408 = t3488*t212;
-    const double t7409 = t3507*t215;
-    const double t7410 = t7401+t7402+t7403+t7404+t7405+t3474+t7406+t7407+t7408+t7409+t3487+
+    const MBPOL_POLY_REAL t7401 = t3492*t136;
+    const MBPOL_POLY_REAL t7402 = t3500*t139;
+    const MBPOL_POLY_REAL t7403 = t3483*t145;
+    const MBPOL_POLY_REAL t7404 = t3500*t146;
+    const MBPOL_POLY_REAL t7405 = t3483*t155;
+    const MBPOL_POLY_REAL t7406 = t3475*t275;
+    const MBPOL_POLY_REAL t7407 = t3479*t254;
+    const MBPOL_POLY_REAL t7408 = t3488*t212;
+    const MBPOL_POLY_REAL t7409 = t3507*t215;
+    const MBPOL_POLY_REAL t7410 = t7401+t7402+t7403+t7404+t7405+t3474+t7406+t7407+t7408+t7409+t3487+
 t4833;
-    const double t7413 = t3297*t72;
-    const double t7414 = t3299*t73;
-    const double t6994 = t3310*t77;
-    const double t7417 = (t3292+t3291+t3579+t3580+t3296+t7295+t7296+t7413+t7414+t6994)*t77;
-    const double t7420 = t3292+t3291+t3579+t3580+t3296+t7295+t7296+t7413+t7414+t3314*t77+
+    const MBPOL_POLY_REAL t7413 = t3297*t72;
+    const MBPOL_POLY_REAL t7414 = t3299*t73;
+    const MBPOL_POLY_REAL t6994 = t3310*t77;
+    const MBPOL_POLY_REAL t7417 = (t3292+t3291+t3579+t3580+t3296+t7295+t7296+t7413+t7414+t6994)*t77;
+    const MBPOL_POLY_REAL t7420 = t3292+t3291+t3579+t3580+t3296+t7295+t7296+t7413+t7414+t3314*t77+
 t3310*t126;
-    const double t7421 = t7420*t126;
-    const double t6999 = t3384*t72;
-    const double t7424 = (t3620+t3378+t3379+t3621+t3383+t3369+t3370+t6999)*t72;
-    const double t7425 = t3690*t50;
-    const double t7426 = t3690*t67;
-    const double t7427 = t3687*t72;
-    const double t7428 = t3687*t73;
-    const double t7429 = t3699*t77;
-    const double t7430 = t3699*t126;
-    const double t7431 = t3699*t132;
-    const double t7432 = t3699*t136;
-    const double t7437 = t3682+t3683+t3684+t3685+t3686+t7425+t7426+t7427+t7428+t7429+t7430+
+    const MBPOL_POLY_REAL t7421 = t7420*t126;
+    const MBPOL_POLY_REAL t6999 = t3384*t72;
+    const MBPOL_POLY_REAL t7424 = (t3620+t3378+t3379+t3621+t3383+t3369+t3370+t6999)*t72;
+    const MBPOL_POLY_REAL t7425 = t3690*t50;
+    const MBPOL_POLY_REAL t7426 = t3690*t67;
+    const MBPOL_POLY_REAL t7427 = t3687*t72;
+    const MBPOL_POLY_REAL t7428 = t3687*t73;
+    const MBPOL_POLY_REAL t7429 = t3699*t77;
+    const MBPOL_POLY_REAL t7430 = t3699*t126;
+    const MBPOL_POLY_REAL t7431 = t3699*t132;
+    const MBPOL_POLY_REAL t7432 = t3699*t136;
+    const MBPOL_POLY_REAL t7437 = t3682+t3683+t3684+t3685+t3686+t7425+t7426+t7427+t7428+t7429+t7430+
 t7431+t7432+t3693*t139+t3695*t145+t3693*t146+t3695*t155+t3705;
-    const double t7017 = t7334+t7345;
-    const double t7019 = t7354+t7363;
-    const double t7024 = t3653+t3654+t3655+t3656+t3657+t7376+t7377+t7378+t7379+t7380+t7390;
-    const double t7027 = t7400+t7410;
-    const double t7439 = t7304+t7319*t254+t7326*t139+t7017*t143+t7019*t215+t7374*t155+t7024*
+    const MBPOL_POLY_REAL t7017 = t7334+t7345;
+    const MBPOL_POLY_REAL t7019 = t7354+t7363;
+    const MBPOL_POLY_REAL t7024 = t3653+t3654+t3655+t3656+t3657+t7376+t7377+t7378+t7379+t7380+t7390;
+    const MBPOL_POLY_REAL t7027 = t7400+t7410;
+    const MBPOL_POLY_REAL t7439 = t7304+t7319*t254+t7326*t139+t7017*t143+t7019*t215+t7374*t155+t7024*
 t212+t7027*t309+t7417+t7421+t7424+t7437*t179;
-    const double t7440 = t3329*t50;
-    const double t7441 = t3331*t67;
-    const double t7443 = t3335*t145;
-    const double t7445 = t3319+t3321+t3634+t3636+t3325+t7440+t7441+t7323+t7324+t3305+t4769+
+    const MBPOL_POLY_REAL t7440 = t3329*t50;
+    const MBPOL_POLY_REAL t7441 = t3331*t67;
+    const MBPOL_POLY_REAL t7443 = t3335*t145;
+    const MBPOL_POLY_REAL t7445 = t3319+t3321+t3634+t3636+t3325+t7440+t7441+t7323+t7324+t3305+t4769+
 t3308+t4771+t3333*t139+t7443+t3337*t146;
-    const double t7033 = t3563+t3564+t3712;
-    const double t7448 = t7033*t20;
-    const double t7452 = t3293+t3578+t3292+t3295+t3581+t7295+t7296+t7297+t7298+t3584*t77+
+    const MBPOL_POLY_REAL t7033 = t3563+t3564+t3712;
+    const MBPOL_POLY_REAL t7448 = t7033*t20;
+    const MBPOL_POLY_REAL t7452 = t3293+t3578+t3292+t3295+t3581+t7295+t7296+t7297+t7298+t3584*t77+
 t3586*t126+t3310*t132;
-    const double t7453 = t7452*t132;
-    const double t7037 = t3623*t72;
-    const double t7039 = t3384*t73;
-    const double t7457 = (t3379+t3380+t3619+t3382+t3622+t3369+t3370+t7037+t7039)*t73;
-    const double t7046 = t3571*t20+t3564+t3562*t26+t3573+t3575;
-    const double t7461 = t7046*t37;
-    const double t7048 = t3373*t50;
-    const double t7464 = (t3466+t3361+t3365+t3366+t3469+t7048)*t50;
-    const double t7050 = t3371*t50;
-    const double t7051 = t3373*t67;
-    const double t7468 = (t3361+t3363+t3467+t3468+t3367+t7050+t7051)*t67;
-    const double t7469 = t3409*t77;
-    const double t7470 = t3407*t126;
-    const double t7471 = t3409*t132;
-    const double t7472 = t3407*t136;
-    const double t7473 = t3421*t275;
-    const double t7474 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7469+t7470+
+    const MBPOL_POLY_REAL t7453 = t7452*t132;
+    const MBPOL_POLY_REAL t7037 = t3623*t72;
+    const MBPOL_POLY_REAL t7039 = t3384*t73;
+    const MBPOL_POLY_REAL t7457 = (t3379+t3380+t3619+t3382+t3622+t3369+t3370+t7037+t7039)*t73;
+    const MBPOL_POLY_REAL t7046 = t3571*t20+t3564+t3562*t26+t3573+t3575;
+    const MBPOL_POLY_REAL t7461 = t7046*t37;
+    const MBPOL_POLY_REAL t7048 = t3373*t50;
+    const MBPOL_POLY_REAL t7464 = (t3466+t3361+t3365+t3366+t3469+t7048)*t50;
+    const MBPOL_POLY_REAL t7050 = t3371*t50;
+    const MBPOL_POLY_REAL t7051 = t3373*t67;
+    const MBPOL_POLY_REAL t7468 = (t3361+t3363+t3467+t3468+t3367+t7050+t7051)*t67;
+    const MBPOL_POLY_REAL t7469 = t3409*t77;
+    const MBPOL_POLY_REAL t7470 = t3407*t126;
+    const MBPOL_POLY_REAL t7471 = t3409*t132;
+    const MBPOL_POLY_REAL t7472 = t3407*t136;
+    const MBPOL_POLY_REAL t7473 = t3421*t275;
+    const MBPOL_POLY_REAL t7474 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7469+t7470+
 t7471+t7472+t7313+t7314+t7315+t7316+t3414+t7473;
-    const double t7476 = t3351*t50;
-    const double t7477 = t3353*t67;
-    const double t7478 = t3355*t139;
-    const double t7480 = t3344+t3345+t3606+t3608+t3347+t7476+t7477+t7368+t7369+t4768+t3307+
+    const MBPOL_POLY_REAL t7476 = t3351*t50;
+    const MBPOL_POLY_REAL t7477 = t3353*t67;
+    const MBPOL_POLY_REAL t7478 = t3355*t139;
+    const MBPOL_POLY_REAL t7480 = t3344+t3345+t3606+t3608+t3347+t7476+t7477+t7368+t7369+t4768+t3307+
 t4770+t3309+t7478+t3357*t145;
-    const double t7055 = t3711+t3566+t3564+t3568;
-    const double t7483 = t7055*t26;
-    const double t7484 = t3457*t254;
-    const double t7485 = t3447*t132;
-    const double t7486 = t3445*t136;
-    const double t7487 = t3447*t77;
-    const double t7488 = t3429+t3427+t3431+t3478+t3428+t3430+t7484+t4824+t3452+t7485+t7486+
+    const MBPOL_POLY_REAL t7055 = t3711+t3566+t3564+t3568;
+    const MBPOL_POLY_REAL t7483 = t7055*t26;
+    const MBPOL_POLY_REAL t7484 = t3457*t254;
+    const MBPOL_POLY_REAL t7485 = t3447*t132;
+    const MBPOL_POLY_REAL t7486 = t3445*t136;
+    const MBPOL_POLY_REAL t7487 = t3447*t77;
+    const MBPOL_POLY_REAL t7488 = t3429+t3427+t3431+t3478+t3428+t3430+t7484+t4824+t3452+t7485+t7486+
 t7487;
-    const double t7489 = t3445*t126;
-    const double t7490 = t3459*t275;
-    const double t7491 = t7489+t7330+t7328+t7329+t7331+t7490+t3525+t7337+t7338+t7339+t7340+
+    const MBPOL_POLY_REAL t7489 = t3445*t126;
+    const MBPOL_POLY_REAL t7490 = t3459*t275;
+    const MBPOL_POLY_REAL t7491 = t7489+t7330+t7328+t7329+t7331+t7490+t3525+t7337+t7338+t7339+t7340+
 t7343+t7344;
-    const double t7494 = t3479*t275;
-    const double t7495 = t3490*t136;
-    const double t7496 = t3492*t77;
-    const double t7497 = t3474+t7402+t7403+t7404+t7405+t7408+t7395+t7393+t7394+t7396+t7494+
+    const MBPOL_POLY_REAL t7494 = t3479*t275;
+    const MBPOL_POLY_REAL t7495 = t3490*t136;
+    const MBPOL_POLY_REAL t7496 = t3492*t77;
+    const MBPOL_POLY_REAL t7497 = t3474+t7402+t7403+t7404+t7405+t7408+t7395+t7393+t7394+t7396+t7494+
 t7495+t7496;
-    const double t7498 = t3490*t126;
-    const double t7499 = t3492*t132;
-    const double t7500 = t3475*t254;
-    const double t7502 = t3486*t240;
-    const double t7503 = t7498+t7499+t3485+t3504+t7500+t3506+t3509+t3510+t7409+t3597+t3602+
+    const MBPOL_POLY_REAL t7498 = t3490*t126;
+    const MBPOL_POLY_REAL t7499 = t3492*t132;
+    const MBPOL_POLY_REAL t7500 = t3475*t254;
+    const MBPOL_POLY_REAL t7502 = t3486*t240;
+    const MBPOL_POLY_REAL t7503 = t7498+t7499+t3485+t3504+t7500+t3506+t3509+t3510+t7409+t3597+t3602+
 t3600*t309+t7502;
-    const double t7077 = t7488+t7491;
-    const double t7081 = t7497+t7503;
-    const double t7506 = t7445*t146+t7448+t7453+t7457+t7461+t7464+t7468+t3710+t7474*t275+
+    const MBPOL_POLY_REAL t7077 = t7488+t7491;
+    const MBPOL_POLY_REAL t7081 = t7497+t7503;
+    const MBPOL_POLY_REAL t7506 = t7445*t146+t7448+t7453+t7457+t7461+t7464+t7468+t3710+t7474*t275+
 t7480*t145+t7483+t7077*t240+t7081*t475;
-    const double t7515 = t3319+t3321+t3634+t3636+t3325+t7440+t7441+t7323+t7324+t3305+t4769+
+    const MBPOL_POLY_REAL t7515 = t3319+t3321+t3634+t3636+t3325+t7440+t7441+t7323+t7324+t3305+t4769+
 t3308+t4771+t7370+t3333*t145+t7372+t3337*t155;
-    const double t7517 = t3402*t139;
-    const double t7518 = t3400*t145;
-    const double t7519 = t3402*t146;
-    const double t7520 = t3400*t155;
-    const double t7521 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7309+t7310+
+    const MBPOL_POLY_REAL t7517 = t3402*t139;
+    const MBPOL_POLY_REAL t7518 = t3400*t145;
+    const MBPOL_POLY_REAL t7519 = t3402*t146;
+    const MBPOL_POLY_REAL t7520 = t3400*t155;
+    const MBPOL_POLY_REAL t7521 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7309+t7310+
 t7311+t7312+t7517+t7518+t7519+t7520+t3414+t7317+t7318;
-    const double t7523 = t3427+t3428+t3429+t3430+t3431+t7328+t7329+t7330+t7331+t7332+t7333+
+    const MBPOL_POLY_REAL t7523 = t3427+t3428+t3429+t3430+t3431+t7328+t7329+t7330+t7331+t7332+t7333+
 t7335;
-    const double t7524 = t3440*t139;
-    const double t7525 = t3438*t145;
-    const double t7526 = t3440*t146;
-    const double t7527 = t3438*t155;
-    const double t7528 = t3455*t212;
-    const double t7529 = t3453*t215;
-    const double t7530 = t7336+t7524+t7525+t7526+t7527+t3452+t7341+t7342+t7528+t7529+t3487+
+    const MBPOL_POLY_REAL t7524 = t3440*t139;
+    const MBPOL_POLY_REAL t7525 = t3438*t145;
+    const MBPOL_POLY_REAL t7526 = t3440*t146;
+    const MBPOL_POLY_REAL t7527 = t3438*t155;
+    const MBPOL_POLY_REAL t7528 = t3455*t212;
+    const MBPOL_POLY_REAL t7529 = t3453*t215;
+    const MBPOL_POLY_REAL t7530 = t7336+t7524+t7525+t7526+t7527+t3452+t7341+t7342+t7528+t7529+t3487+
 t3526;
-    const double t7534 = t3319+t3635+t3323+t3324+t3637+t7321+t7322+t7323+t7324+t3305+t4769+
+    const MBPOL_POLY_REAL t7534 = t3319+t3635+t3323+t3324+t3637+t7321+t7322+t7323+t7324+t3305+t4769+
 t3308+t4771+t7478+t3337*t145;
-    const double t7538 = t3345+t3607+t3342+t3346+t3609+t7366+t7367+t7368+t7369+t4768+t3307+
+    const MBPOL_POLY_REAL t7538 = t3345+t3607+t3342+t3346+t3609+t7366+t7367+t7368+t7369+t4768+t3307+
 t4770+t3309+t3613*t139+t7443+t3357*t146;
-    const double t7544 = t3682+t3683+t3684+t3685+t3686+t7425+t7426+t7427+t7428+t7429+t7430+
+    const MBPOL_POLY_REAL t7544 = t3682+t3683+t3684+t3685+t3686+t7425+t7426+t7427+t7428+t7429+t7430+
 t7431+t7432+t3695*t139+t3693*t145+t3695*t146+t3693*t155+t3705;
-    const double t7546 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7469+t7470+
+    const MBPOL_POLY_REAL t7546 = t3389+t3390+t3391+t3392+t3393+t7305+t7306+t7307+t7308+t7469+t7470+
 t7471+t7472+t7517+t7518+t7519+t7520+t3414+t7473;
-    const double t7116 = t7523+t7530;
-    const double t7548 = t7515*t155+t7304+t7521*t254+t7116*t309+t7534*t145+t7538*t146+t7417+
+    const MBPOL_POLY_REAL t7116 = t7523+t7530;
+    const MBPOL_POLY_REAL t7548 = t7515*t155+t7304+t7521*t254+t7116*t309+t7534*t145+t7538*t146+t7417+
 t7421+t7544*t179+t7546*t275+t7424+t7448;
-    const double t7550 = t3344+t3345+t3606+t3608+t3347+t7476+t7477+t7368+t7369+t4768+t3307+
+    const MBPOL_POLY_REAL t7550 = t3344+t3345+t3606+t3608+t3347+t7476+t7477+t7368+t7369+t4768+t3307+
 t4770+t3309+t3357*t139;
-    const double t7552 = t3483*t146;
-    const double t7553 = t3500*t155;
-    const double t7554 = t3488*t215;
-    const double t7555 = t3507*t212;
-    const double t7556 = t3483*t139;
-    const double t7557 = t3474+t7395+t7393+t7394+t7396+t7552+t7553+t7554+t7555+t7556+t7494+
+    const MBPOL_POLY_REAL t7552 = t3483*t146;
+    const MBPOL_POLY_REAL t7553 = t3500*t155;
+    const MBPOL_POLY_REAL t7554 = t3488*t215;
+    const MBPOL_POLY_REAL t7555 = t3507*t212;
+    const MBPOL_POLY_REAL t7556 = t3483*t139;
+    const MBPOL_POLY_REAL t7557 = t3474+t7395+t7393+t7394+t7396+t7552+t7553+t7554+t7555+t7556+t7494+
 t7495;
-    const double t7558 = t3500*t145;
-    const double t7559 = t7496+t7498+t7499+t7558+t3478+t3482+t3485+t3504+t7500+t3506+t3509+
+    const MBPOL_POLY_REAL t7558 = t3500*t145;
+    const MBPOL_POLY_REAL t7559 = t7496+t7498+t7499+t7558+t3478+t3482+t3485+t3504+t7500+t3506+t3509+
 t3510+t4832;
-    const double t7562 = t3653+t3654+t3655+t3656+t3657+t7376+t7377+t7378+t7379+t7380+t7382;
-    const double t7568 = t7383+t7384+t3666*t139+t3664*t145+t3666*t146+t3664*t155+t3676+t3416
+    const MBPOL_POLY_REAL t7562 = t3653+t3654+t3655+t3656+t3657+t7376+t7377+t7378+t7379+t7380+t7382;
+    const MBPOL_POLY_REAL t7568 = t7383+t7384+t3666*t139+t3664*t145+t3666*t146+t3664*t155+t3676+t3416
 +t4801+t7361+t3677*t215;
-    const double t7571 = t3485+t3506+t3504+t3509+t3510+t7393+t7394+t7395+t7396+t7397+t7398;
-    const double t7572 = t7399+t7401+t7556+t7558+t7552+t7553+t3474+t7406+t7407+t7555+t7554+
+    const MBPOL_POLY_REAL t7571 = t3485+t3506+t3504+t3509+t3510+t7393+t7394+t7395+t7396+t7397+t7398;
+    const MBPOL_POLY_REAL t7572 = t7399+t7401+t7556+t7558+t7552+t7553+t3474+t7406+t7407+t7555+t7554+
 t4784;
-    const double t7575 = t3429+t4855+t3427+t3431+t3428+t3430+t7484+t7526+t7527+t7524+t7525+
+    const MBPOL_POLY_REAL t7575 = t3429+t4855+t3427+t3431+t3428+t3430+t7484+t7526+t7527+t7524+t7525+
 t3452+t3602;
-    const double t7577 = t7485+t7486+t7529+t3524*t309+t7528+t7487+t7489+t7330+t7328+t7329+
+    const MBPOL_POLY_REAL t7577 = t7485+t7486+t7529+t3524*t309+t7528+t7487+t7489+t7330+t7328+t7329+
 t7331+t7490+t7502;
-    const double t7586 = t7353+t7355+t7356+t3544*t139+t3542*t145+t3544*t146+t3542*t155+t3554
+    const MBPOL_POLY_REAL t7586 = t7353+t7355+t7356+t3544*t139+t3542*t145+t3544*t146+t3542*t155+t3554
 +t4800+t3418+t3557*t212;
-    const double t7188 = t7557+t7559;
-    const double t7191 = t7562+t7568;
-    const double t7210 = t7571+t7572;
-    const double t7223 = t7575+t7577;
-    const double t7229 = t3530+t3532+t3533+t3534+t3535+t7348+t7349+t7350+t7351+t7352+t7586;
-    const double t7589 = t7550*t139+t7453+t7457+t7188*t240+t7191*t215+t7461+t7464+t7468+
+    const MBPOL_POLY_REAL t7188 = t7557+t7559;
+    const MBPOL_POLY_REAL t7191 = t7562+t7568;
+    const MBPOL_POLY_REAL t7210 = t7571+t7572;
+    const MBPOL_POLY_REAL t7223 = t7575+t7577;
+    const MBPOL_POLY_REAL t7229 = t3530+t3532+t3533+t3534+t3535+t7348+t7349+t7350+t7351+t7352+t7586;
+    const MBPOL_POLY_REAL t7589 = t7550*t139+t7453+t7457+t7188*t240+t7191*t215+t7461+t7464+t7468+
 t7210*t143+t3710+t7223*t475+t7483+t7229*t212;
-    const double t7597 = t4343+t4342+t4344+t4345+t4346+t7175+t7176+t7177+t7178+t4359*t77+
+    const MBPOL_POLY_REAL t7597 = t4343+t4342+t4344+t4345+t4346+t7175+t7176+t7177+t7178+t4359*t77+
 t4361*t126+t4359*t132+t4361*t136+t7183+t7184+t7185+t7186+t4366+t4370*t275;
-    const double t7599 = t4595*t77;
-    const double t7601 = t4597*t126;
-    const double t7602 = t4595*t132;
-    const double t7603 = t4597*t136;
-    const double t7604 = t7601+t7602+t7603+t7243+t7244+t7245+t7246+t4602+t4368+t4403+t7247;
-    const double t7611 = t4552+t4551+t4553+t4554+t4555+t7224+t7225+t7226+t7227+t4567*t77+
+    const MBPOL_POLY_REAL t7599 = t4595*t77;
+    const MBPOL_POLY_REAL t7601 = t4597*t126;
+    const MBPOL_POLY_REAL t7602 = t4595*t132;
+    const MBPOL_POLY_REAL t7603 = t4597*t136;
+    const MBPOL_POLY_REAL t7604 = t7601+t7602+t7603+t7243+t7244+t7245+t7246+t4602+t4368+t4403+t7247;
+    const MBPOL_POLY_REAL t7611 = t4552+t4551+t4553+t4554+t4555+t7224+t7225+t7226+t7227+t4567*t77+
 t4569*t126+t4567*t132+t4569*t136+t7232+t7233+t7234+t7235+t4574;
-    const double t7617 = t4476+t4477+t4501+t4502+t4481+t7073+t7074+t7263+t7264+t7069+t4496*
+    const MBPOL_POLY_REAL t7617 = t4476+t4477+t4501+t4502+t4481+t7073+t7074+t7263+t7264+t7069+t4496*
 t126;
-    const double t7619 = t4311*t77;
-    const double t7620 = t4313*t126;
-    const double t7621 = t4311*t132;
-    const double t7622 = t4294+t4292+t4295+t4296+t4297+t7143+t7140+t7141+t7142+t7619+t7620+
+    const MBPOL_POLY_REAL t7619 = t4311*t77;
+    const MBPOL_POLY_REAL t7620 = t4313*t126;
+    const MBPOL_POLY_REAL t7621 = t4311*t132;
+    const MBPOL_POLY_REAL t7622 = t4294+t4292+t4295+t4296+t4297+t7143+t7140+t7141+t7142+t7619+t7620+
 t7621;
-    const double t7623 = t4313*t136;
-    const double t7624 = t4323*t275;
-    const double t7625 = t4325*t254;
-    const double t7626 = t7623+t7254+t7255+t7256+t7257+t4318+t7624+t7625+t7251+t7258+t4471+
+    const MBPOL_POLY_REAL t7623 = t4313*t136;
+    const MBPOL_POLY_REAL t7624 = t4323*t275;
+    const MBPOL_POLY_REAL t7625 = t4325*t254;
+    const MBPOL_POLY_REAL t7626 = t7623+t7254+t7255+t7256+t7257+t4318+t7624+t7625+t7251+t7258+t4471+
 t4648;
-    const double t7265 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7599+t7604;
-    const double t7269 = t4542*t77;
-    const double t7273 = t7622+t7626;
-    const double t7629 = t7597*t275+t4271+t7265*t212+t7103+t7107+t7110+t7113+t7117+t7611*
+    const MBPOL_POLY_REAL t7265 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7599+t7604;
+    const MBPOL_POLY_REAL t7269 = t4542*t77;
+    const MBPOL_POLY_REAL t7273 = t7622+t7626;
+    const MBPOL_POLY_REAL t7629 = t7597*t275+t4271+t7265*t212+t7103+t7107+t7110+t7113+t7117+t7611*
 t179+(t4523+t4610+t4525+t4611+t4529+t7065+t7066+t7067+t7068+t7269)*t77+t7617*
 t126+t7273*t309;
-    const double t7630 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4538+t4491+
+    const MBPOL_POLY_REAL t7630 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4538+t4491+
 t4540+t4493+t7061+t7062;
-    const double t7632 = t4294+t4292+t4295+t4296+t4297+t7143+t7140+t7141+t7142+t7619+t7620;
-    const double t7633 = t7621+t7623+t7144+t7145+t7146+t7147+t4318+t7624+t7625+t7148+t7149+
+    const MBPOL_POLY_REAL t7632 = t4294+t4292+t4295+t4296+t4297+t7143+t7140+t7141+t7142+t7619+t7620;
+    const MBPOL_POLY_REAL t7633 = t7621+t7623+t7144+t7145+t7146+t7147+t4318+t7624+t7625+t7148+t7149+
 t4328;
-    const double t7636 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4538+t4491+
+    const MBPOL_POLY_REAL t7636 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4538+t4491+
 t4540+t4493+t7218+t7219+t7220+t7221;
-    const double t7638 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7599+t7601;
-    const double t7639 = t7602+t7603+t7202+t7203+t7204+t7205+t4602+t4368+t4403+t7206+t7207;
-    const double t7642 = t4211*t275;
-    const double t7643 = t4200+t4203+t4210+t4216+t7642+t4223+t4228+t4232+t4233+t7083+t7252+
+    const MBPOL_POLY_REAL t7638 = t4578+t4579+t4580+t4581+t4582+t7193+t7194+t7195+t7196+t7599+t7601;
+    const MBPOL_POLY_REAL t7639 = t7602+t7603+t7202+t7203+t7204+t7205+t4602+t4368+t4403+t7206+t7207;
+    const MBPOL_POLY_REAL t7642 = t4211*t275;
+    const MBPOL_POLY_REAL t7643 = t4200+t4203+t4210+t4216+t7642+t4223+t4228+t4232+t4233+t7083+t7252+
 t7097+t7098;
-    const double t7644 = t4213*t132;
-    const double t7646 = t4236*t254;
-    const double t7647 = t4224*t126;
-    const double t7648 = t4213*t77;
-    const double t7649 = t4224*t136;
-    const double t7650 = t7644+t4226*t240+t7646+t7084+t7082+t7092+t7091+t7647+t7648+t7085+
+    const MBPOL_POLY_REAL t7644 = t4213*t132;
+    const MBPOL_POLY_REAL t7646 = t4236*t254;
+    const MBPOL_POLY_REAL t7647 = t4224*t126;
+    const MBPOL_POLY_REAL t7648 = t4213*t77;
+    const MBPOL_POLY_REAL t7649 = t4224*t136;
+    const MBPOL_POLY_REAL t7650 = t7644+t4226*t240+t7646+t7084+t7082+t7092+t7091+t7647+t7648+t7085+
 t7649+t7093+t7094;
-    const double t7653 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4538+t4491+
+    const MBPOL_POLY_REAL t7653 = t4436+t4245+t4247+t4248+t4439+t7057+t7058+t7059+t7060+t4538+t4491+
 t4540+t4493+t7162;
-    const double t7657 = t4500+t4477+t4478+t4480+t4503+t7073+t7074+t7075+t7076+t7156+t4508*
+    const MBPOL_POLY_REAL t7657 = t4500+t4477+t4478+t4480+t4503+t7073+t7074+t7075+t7076+t7156+t4508*
 t126+t7158+t4496*t136;
-    const double t7659 = t4200+t4203+t4210+t7642+t4228+t4232+t4233+t7083+t7644+t7646+t7084+
+    const MBPOL_POLY_REAL t7659 = t4200+t4203+t4210+t7642+t4228+t4232+t4233+t7083+t7644+t7646+t7084+
 t7082;
-    const double t7660 = t7647+t7648+t7085+t7649+t4452+t4681+t7171+t7170+t7167+t7166+t7169+
+    const MBPOL_POLY_REAL t7660 = t7647+t7648+t7085+t7649+t4452+t4681+t7171+t7170+t7167+t7166+t7169+
 t7168+t4469;
-    const double t7668 = t4377+t4375+t4378+t4379+t4380+t7118+t7119+t7120+t7121+t4393*t77+
+    const MBPOL_POLY_REAL t7668 = t4377+t4375+t4378+t4379+t4380+t7118+t7119+t7120+t7121+t4393*t77+
 t4395*t126+t4393*t132+t4395*t136+t7126+t7127+t7128+t7129+t4400+t7187+t4406*t254
 ;
-    const double t7672 = t4526+t4609+t4523+t4528+t4612+t7065+t7066+t7154+t7155+t4615*t77+
+    const MBPOL_POLY_REAL t7672 = t4526+t4609+t4523+t4528+t4612+t7065+t7066+t7154+t7155+t4615*t77+
 t7078+t4542*t132;
-    const double t7674 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4538+t4491+
+    const MBPOL_POLY_REAL t7674 = t4245+t4244+t4437+t4438+t4249+t7211+t7212+t7059+t7060+t4538+t4491+
 t4540+t4493+t7213+t7214+t7215;
-    const double t7287 = t7632+t7633;
-    const double t7291 = t7638+t7639;
-    const double t7294 = t7643+t7650;
-    const double t7302 = t7659+t7660;
-    const double t7676 = t7630*t145+t7287*t143+t7636*t155+t7291*t215+t7294*t475+t7653*t139+
+    const MBPOL_POLY_REAL t7287 = t7632+t7633;
+    const MBPOL_POLY_REAL t7291 = t7638+t7639;
+    const MBPOL_POLY_REAL t7294 = t7643+t7650;
+    const MBPOL_POLY_REAL t7302 = t7659+t7660;
+    const MBPOL_POLY_REAL t7676 = t7630*t145+t7287*t143+t7636*t155+t7291*t215+t7294*t475+t7653*t139+
 t7657*t136+t7192+t7302*t240+t7668*t254+t7241+t7672*t132+t7674*t146;
-    const double t7360 = t4192+t4748+t4749*t20+t4717*t26+t4752;
-    const double t7364 = t3730*t50;
-    const double t7381 = t6852+t6856;
-    const double t7493 = x[0];
-    const double t7387 = (t6968+t7040)*t7493;
-    const double t7388 = t7043+t7044;
-    const double t7391 = t7047+t7054;
-    const double t7411 = t7153+t7268;
-    const double t7419 = t7439+t7506;
-    const double t7423 = t3728*t50;
-    const double t7433 = t3730*t67;
-    const double t7436 = t7548+t7589;
-    const double t7442 = t7629+t7676;
-    const double t7679 = (t4192+t4875+t4716+t4719)*t26+t7360*t37+(t3770+t3720+t3722+t3723+
+    const MBPOL_POLY_REAL t7360 = t4192+t4748+t4749*t20+t4717*t26+t4752;
+    const MBPOL_POLY_REAL t7364 = t3730*t50;
+    const MBPOL_POLY_REAL t7381 = t6852+t6856;
+    const MBPOL_POLY_REAL t7493 = x[0];
+    const MBPOL_POLY_REAL t7387 = (t6968+t7040)*t7493;
+    const MBPOL_POLY_REAL t7388 = t7043+t7044;
+    const MBPOL_POLY_REAL t7391 = t7047+t7054;
+    const MBPOL_POLY_REAL t7411 = t7153+t7268;
+    const MBPOL_POLY_REAL t7419 = t7439+t7506;
+    const MBPOL_POLY_REAL t7423 = t3728*t50;
+    const MBPOL_POLY_REAL t7433 = t3730*t67;
+    const MBPOL_POLY_REAL t7436 = t7548+t7589;
+    const MBPOL_POLY_REAL t7442 = t7629+t7676;
+    const MBPOL_POLY_REAL t7679 = (t4192+t4875+t4716+t4719)*t26+t7360*t37+(t3770+t3720+t3722+t3723+
 t3773+t7364)*t50+(t4192+t4718+t4876)*t20+t7381*t309+t7387+t7388*t143+t7391*t215
 +t7411*t2404+t7283*t179+t7288*t146+t7293*t132+t7419*t3120+(t3719+t3720+t3771+
 t3772+t3724+t7423+t7433)*t67+t7436*t3116+t7442*t2341;
-    const double t7446 = t4992+t12+t4993;
-    const double t7447 = t7446*t20;
-    const double t7450 = (t14+t2+t16+t4996)*t26;
-    const double t7454 = t7*t26+t2+t23+t24+t5000;
-    const double t7455 = t7454*t37;
-    const double t7456 = t45*t50;
-    const double t7459 = (t40+t5003+t5004+t5005+t5006+t7456)*t50;
-    const double t7479 = t1303+t5422;
-    const double t7481 = t7479*t5;
-    const double t7492 = (t714+t1305+t5425)*t20;
-    const double t7501 = t714+t1305+t1304*t20+t5429;
-    const double t7504 = t7501*t26;
-    const double t7505 = t720*t37;
-    const double t7508 = (t5425+t5422+t719+t5429+t7505)*t37;
-    const double t7516 = (t12+t16+t4993)*t20;
-    const double t7531 = (t8+t2+t14+t4996)*t26;
-    const double t7532 = t21*t20;
-    const double t7535 = (t12+t23+t7532+t5533+t25)*t37;
-    const double t7539 = t5536+t5537*t26+t5539*t20+t5542+t5543+t5545;
-    const double t7540 = t7539*t50;
-    const double t7541 = t5537*t5;
-    const double t7542 = t5539*t37;
-    const double t7545 = (t5536+t7541+t5549+t5550+t7542+t5553+t5554)*t67;
-    const double t7549 = t29+t30+t31+t32+t33+t5553+t5552*t67+t5558;
-    const double t7551 = t7549*t72;
-    const double t7560 = t45*t73;
-    const double t7563 = (t40+t39+t5004+t5005+t44+t5545+t5554+t5558+t7560)*t73;
-    const double t7566 = t617*t77;
-    const double t7569 = (t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982+t7566)*t77;
-    const double t7576 = (t2+t16+t9)*t20;
-    const double t7579 = (t14+t12+t4992+t18)*t26;
-    const double t7580 = t7*t20;
-    const double t7582 = (t5533+t2+t7580+t23+t5000)*t37;
-    const double t7585 = t5549+t5539*t5+t5536+t5550+t5537*t37+t5545;
-    const double t7587 = t7585*t50;
-    const double t7591 = t5537*t20+t5539*t26+t5536+t5542+t5543+t5553+t5554;
-    const double t7592 = t7591*t67;
-    const double t7593 = t45*t72;
-    const double t7595 = (t40+t41+t5003+t43+t5006+t5545+t5554+t7593)*t72;
-    const double t7610 = t991+t996+t1001+t1008+t1014+t1025+t1034+t1048+t1057+t1075+t6430;
-    const double t7682 = (t1+t4991+t7447+t7450+t7455+t7459)*t50+t5021*t132+t5059*t139+(t5234
+    const MBPOL_POLY_REAL t7446 = t4992+t12+t4993;
+    const MBPOL_POLY_REAL t7447 = t7446*t20;
+    const MBPOL_POLY_REAL t7450 = (t14+t2+t16+t4996)*t26;
+    const MBPOL_POLY_REAL t7454 = t7*t26+t2+t23+t24+t5000;
+    const MBPOL_POLY_REAL t7455 = t7454*t37;
+    const MBPOL_POLY_REAL t7456 = t45*t50;
+    const MBPOL_POLY_REAL t7459 = (t40+t5003+t5004+t5005+t5006+t7456)*t50;
+    const MBPOL_POLY_REAL t7479 = t1303+t5422;
+    const MBPOL_POLY_REAL t7481 = t7479*t5;
+    const MBPOL_POLY_REAL t7492 = (t714+t1305+t5425)*t20;
+    const MBPOL_POLY_REAL t7501 = t714+t1305+t1304*t20+t5429;
+    const MBPOL_POLY_REAL t7504 = t7501*t26;
+    const MBPOL_POLY_REAL t7505 = t720*t37;
+    const MBPOL_POLY_REAL t7508 = (t5425+t5422+t719+t5429+t7505)*t37;
+    const MBPOL_POLY_REAL t7516 = (t12+t16+t4993)*t20;
+    const MBPOL_POLY_REAL t7531 = (t8+t2+t14+t4996)*t26;
+    const MBPOL_POLY_REAL t7532 = t21*t20;
+    const MBPOL_POLY_REAL t7535 = (t12+t23+t7532+t5533+t25)*t37;
+    const MBPOL_POLY_REAL t7539 = t5536+t5537*t26+t5539*t20+t5542+t5543+t5545;
+    const MBPOL_POLY_REAL t7540 = t7539*t50;
+    const MBPOL_POLY_REAL t7541 = t5537*t5;
+    const MBPOL_POLY_REAL t7542 = t5539*t37;
+    const MBPOL_POLY_REAL t7545 = (t5536+t7541+t5549+t5550+t7542+t5553+t5554)*t67;
+    const MBPOL_POLY_REAL t7549 = t29+t30+t31+t32+t33+t5553+t5552*t67+t5558;
+    const MBPOL_POLY_REAL t7551 = t7549*t72;
+    const MBPOL_POLY_REAL t7560 = t45*t73;
+    const MBPOL_POLY_REAL t7563 = (t40+t39+t5004+t5005+t44+t5545+t5554+t5558+t7560)*t73;
+    const MBPOL_POLY_REAL t7566 = t617*t77;
+    const MBPOL_POLY_REAL t7569 = (t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982+t7566)*t77;
+    const MBPOL_POLY_REAL t7576 = (t2+t16+t9)*t20;
+    const MBPOL_POLY_REAL t7579 = (t14+t12+t4992+t18)*t26;
+    const MBPOL_POLY_REAL t7580 = t7*t20;
+    const MBPOL_POLY_REAL t7582 = (t5533+t2+t7580+t23+t5000)*t37;
+    const MBPOL_POLY_REAL t7585 = t5549+t5539*t5+t5536+t5550+t5537*t37+t5545;
+    const MBPOL_POLY_REAL t7587 = t7585*t50;
+    const MBPOL_POLY_REAL t7591 = t5537*t20+t5539*t26+t5536+t5542+t5543+t5553+t5554;
+    const MBPOL_POLY_REAL t7592 = t7591*t67;
+    const MBPOL_POLY_REAL t7593 = t45*t72;
+    const MBPOL_POLY_REAL t7595 = (t40+t41+t5003+t43+t5006+t5545+t5554+t7593)*t72;
+    const MBPOL_POLY_REAL t7610 = t991+t996+t1001+t1008+t1014+t1025+t1034+t1048+t1057+t1075+t6430;
+    const MBPOL_POLY_REAL t7682 = (t1+t4991+t7447+t7450+t7455+t7459)*t50+t5021*t132+t5059*t139+(t5234
 +t5409)*t2404+t5420*t145+(t713+t7481+t7492+t7504+t7508)*t37+t5446*t146+(t5477+
 t5525)*t240+(t1+t6+t7516+t7531+t7535+t7540+t7545+t7551+t7563)*t73+(t471+t4944+
 t4946+t4949+t4953+t4957+t4961+t4966+t4971+t7569)*t77+(t1+t4991+t7576+t7579+
 t7582+t7587+t7592+t7595)*t72+(t5720+t6016)*t3120+(t6019+t6047)*t143+(t6079+
 t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4135] = t7493*t2341;
-    const double t7615 = df[4135];
+    const MBPOL_POLY_REAL t7615 = df[4135];
     df[4134] = t7615*t146;
     df[4133] = t7615*t132;
     df[4132] = t7615*t254;
@@ -6586,8 +6586,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4129] = t7615*t136;
     df[4128] = t7615*t139;
     df[4127] = t7615*t475;
-    const double t7616 = df[4127];
-    const double t7922 = df[4130];
+    const MBPOL_POLY_REAL t7616 = df[4127];
+    const MBPOL_POLY_REAL t7922 = df[4130];
     df[4126] = t7922+t7616;
     df[4125] = df[4126];
     df[4124] = df[4125];
@@ -6601,8 +6601,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4115] = df[4116];
     df[4114] = t7615*t145;
     df[4112] = t7615*t309;
-    const double t7923 = df[4115];
-    const double t7928 = df[4112];
+    const MBPOL_POLY_REAL t7923 = df[4115];
+    const MBPOL_POLY_REAL t7928 = df[4112];
     df[4111] = t7923+t7928;
     df[4110] = df[4111];
     df[4109] = df[4110];
@@ -6612,15 +6612,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4104] = t7615*t126;
     df[4103] = t7615*t179;
     df[4102] = t7615*t212;
-    const double t7637 = df[4102];
-    const double t7947 = df[4118];
+    const MBPOL_POLY_REAL t7637 = df[4102];
+    const MBPOL_POLY_REAL t7947 = df[4118];
     df[4101] = t7947+t7637;
     df[4100] = df[4101];
     df[4099] = df[4101];
     df[4098] = df[4099];
     df[4097] = t7615*t275;
     df[4096] = t7493*t3116;
-    const double t7641 = df[4096];
+    const MBPOL_POLY_REAL t7641 = df[4096];
     df[4095] = t7641*t212;
     df[4094] = t7641*t475;
     df[4093] = df[4094];
@@ -6629,8 +6629,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4090] = t7641*t215;
     df[4089] = df[4090];
     df[4088] = t7641*t240;
-    const double t7948 = df[4091];
-    const double t7949 = df[4088];
+    const MBPOL_POLY_REAL t7948 = df[4091];
+    const MBPOL_POLY_REAL t7949 = df[4088];
     df[4087] = t7948+t7949;
     df[4085] = df[4087];
     df[4084] = df[4085];
@@ -6643,8 +6643,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4076] = t7641*t146;
     df[4075] = t7641*t145;
     df[4074] = t7641*t309;
-    const double t7654 = df[4074];
-    const double t7953 = df[4093];
+    const MBPOL_POLY_REAL t7654 = df[4074];
+    const MBPOL_POLY_REAL t7953 = df[4093];
     df[4073] = t7953+t7654;
     df[4072] = df[4073];
     df[4071] = df[4073];
@@ -6652,17 +6652,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4069] = df[4070];
     df[4068] = df[4069];
     df[4066] = t7641*t254;
-    const double t7656 = df[4078];
-    const double t7658 = df[4066];
+    const MBPOL_POLY_REAL t7656 = df[4078];
+    const MBPOL_POLY_REAL t7658 = df[4066];
     df[4065] = t7656+t7658;
     df[4064] = df[4065];
     df[4063] = df[4064];
     df[4062] = df[4063];
     df[4061] = t7641*t155;
     df[4060] = t7493*t3120;
-    const double t7661 = df[4060];
+    const MBPOL_POLY_REAL t7661 = df[4060];
     df[4059] = t7661*t475;
-    const double t7662 = df[4059];
+    const MBPOL_POLY_REAL t7662 = df[4059];
     df[4058] = t7953+t7662;
     df[4057] = t7949+t7662;
     df[4056] = df[4057];
@@ -6671,7 +6671,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4052] = df[4053];
     df[4051] = df[4052];
     df[4050] = t7661*t240;
-    const double t7957 = df[4050];
+    const MBPOL_POLY_REAL t7957 = df[4050];
     df[4049] = t7953+t7957;
     df[4048] = df[4049];
     df[4046] = df[4049];
@@ -6680,14 +6680,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4043] = df[4045];
     df[4042] = t7641+t7661;
     df[4041] = t7661*t145;
-    const double t7666 = df[4075];
-    const double t7667 = df[4041];
+    const MBPOL_POLY_REAL t7666 = df[4075];
+    const MBPOL_POLY_REAL t7667 = df[4041];
     df[4040] = t7666+t7667;
-    const double t7669 = df[4080];
+    const MBPOL_POLY_REAL t7669 = df[4080];
     df[4039] = t7669+t7667;
     df[4038] = df[4039];
     df[4037] = t7661*t275;
-    const double t7670 = df[4037];
+    const MBPOL_POLY_REAL t7670 = df[4037];
     df[4036] = t7656+t7670;
     df[4035] = df[4036];
     df[4034] = df[4035];
@@ -6698,19 +6698,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4029] = df[4030];
     df[4028] = df[4029];
     df[4027] = df[4028];
-    const double t7671 = df[4027];
+    const MBPOL_POLY_REAL t7671 = df[4027];
     df[4026] = t7671*t132;
     df[4025] = df[4031];
     df[4024] = t7661*t146;
-    const double t7673 = df[4076];
-    const double t7675 = df[4024];
+    const MBPOL_POLY_REAL t7673 = df[4076];
+    const MBPOL_POLY_REAL t7675 = df[4024];
     df[4023] = t7673+t7675;
-    const double t7677 = df[4061];
+    const MBPOL_POLY_REAL t7677 = df[4061];
     df[4022] = t7677+t7675;
     df[4021] = df[4022];
     df[4019] = t7661*t179;
-    const double t7680 = df[4077];
-    const double t7681 = df[4019];
+    const MBPOL_POLY_REAL t7680 = df[4077];
+    const MBPOL_POLY_REAL t7681 = df[4019];
     df[4018] = t7680+t7681;
     df[4017] = df[4018];
     df[4016] = df[4017];
@@ -6721,14 +6721,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[4011] = df[4012];
     df[4010] = df[4042];
     df[4009] = df[4010];
-    const double t7958 = df[4009];
+    const MBPOL_POLY_REAL t7958 = df[4009];
     df[4008] = t7958*t126;
-    const double t7684 = df[4008];
-    const double t7686 = t7958*t77;
+    const MBPOL_POLY_REAL t7684 = df[4008];
+    const MBPOL_POLY_REAL t7686 = t7958*t77;
     df[4006] = t7684+t7686;
     df[4005] = df[4006];
     df[4004] = t7661*t309;
-    const double t7687 = df[4004];
+    const MBPOL_POLY_REAL t7687 = df[4004];
     df[4003] = t7662+t7687;
     df[4002] = df[4003];
     df[4001] = t7948+t7687;
@@ -6746,8 +6746,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3988] = df[3989];
     df[3987] = df[3988];
     df[3986] = t7661*t212;
-    const double t7690 = df[3986];
-    const double t7974 = df[4089];
+    const MBPOL_POLY_REAL t7690 = df[3986];
+    const MBPOL_POLY_REAL t7974 = df[4089];
     df[3985] = t7974+t7690;
     df[3984] = df[3985];
     df[3983] = df[3985];
@@ -6757,7 +6757,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3979] = df[3980];
     df[3978] = df[3979];
     df[3977] = t7661*t155;
-    const double t7692 = df[3977];
+    const MBPOL_POLY_REAL t7692 = df[3977];
     df[3976] = t7677+t7692;
     df[3975] = df[3976];
     df[3974] = t7669+t7673+t7667+t7692;
@@ -6765,9 +6765,9 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3972] = t7673+t7692;
     df[3971] = df[3972];
     df[3970] = t7661*t215;
-    const double t7693 = df[3970];
+    const MBPOL_POLY_REAL t7693 = df[3970];
     df[3969] = t7974+t7693;
-    const double t7694 = df[4095];
+    const MBPOL_POLY_REAL t7694 = df[4095];
     df[3968] = t7694+t7693;
     df[3967] = df[3968];
     df[3965] = df[3968];
@@ -6777,7 +6777,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3961] = df[3962];
     df[3960] = df[3961];
     df[3959] = t7661*t143;
-    const double t7696 = df[3959];
+    const MBPOL_POLY_REAL t7696 = df[3959];
     df[3958] = t7957+t7696;
     df[3957] = df[3958];
     df[3956] = t7654+t7696;
@@ -6795,13 +6795,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3943] = df[3944];
     df[3942] = df[3943];
     df[3941] = t7661*t139;
-    const double t7699 = df[3941];
+    const MBPOL_POLY_REAL t7699 = df[3941];
     df[3940] = t7666+t7677+t7675+t7699;
     df[3939] = df[3940];
     df[3938] = t7666+t7699;
     df[3937] = df[3938];
     df[3936] = t7661*t254;
-    const double t7700 = df[3936];
+    const MBPOL_POLY_REAL t7700 = df[3936];
     df[3935] = t7658+t7700;
     df[3934] = df[3935];
     df[3933] = t7670+t7700;
@@ -6817,8 +6817,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3923] = df[3924];
     df[3922] = df[3923];
     df[3920] = t7958*t136;
-    const double t7702 = df[4026];
-    const double t7703 = df[3920];
+    const MBPOL_POLY_REAL t7702 = df[4026];
+    const MBPOL_POLY_REAL t7703 = df[3920];
     df[3919] = t7702+t7703;
     df[3918] = df[3919];
     df[3917] = t7702+t7684+t7686+t7703;
@@ -6827,13 +6827,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3914] = t7493*t146;
     df[3913] = t7493*t179;
     df[3912] = t7493*t2404;
-    const double t7704 = df[4104];
-    const double t7705 = df[3912];
-    const double t7706 = t7705*t77;
+    const MBPOL_POLY_REAL t7704 = df[4104];
+    const MBPOL_POLY_REAL t7705 = df[3912];
+    const MBPOL_POLY_REAL t7706 = t7705*t77;
     df[3911] = t7704+t7706;
     df[3910] = df[3911];
     df[3909] = t7705*t475;
-    const double t7999 = df[3909];
+    const MBPOL_POLY_REAL t7999 = df[3909];
     df[3908] = t7928+t7999;
     df[3907] = df[3908];
     df[3906] = df[3907];
@@ -6842,7 +6842,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3902] = t7616+t7999;
     df[3901] = df[3908];
     df[3900] = t7705*t212;
-    const double t7709 = df[3900];
+    const MBPOL_POLY_REAL t7709 = df[3900];
     df[3899] = t7637+t7709;
     df[3898] = df[3899];
     df[3897] = df[3898];
@@ -6850,8 +6850,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3895] = df[3896];
     df[3894] = t7615+t7705;
     df[3893] = t7705*t179;
-    const double t7710 = df[4103];
-    const double t7711 = df[3893];
+    const MBPOL_POLY_REAL t7710 = df[4103];
+    const MBPOL_POLY_REAL t7711 = df[3893];
     df[3892] = t7710+t7711;
     df[3891] = df[3892];
     df[3890] = df[3891];
@@ -6861,22 +6861,22 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3886] = df[3887];
     df[3885] = df[3886];
     df[3884] = t7705*t155;
-    const double t7712 = df[4117];
-    const double t7713 = df[3884];
+    const MBPOL_POLY_REAL t7712 = df[4117];
+    const MBPOL_POLY_REAL t7713 = df[3884];
     df[3883] = t7712+t7713;
     df[3882] = df[3883];
     df[3881] = df[3882];
     df[3880] = df[3881];
     df[3879] = t7705*t146;
-    const double t7714 = df[4134];
-    const double t7715 = df[3879];
+    const MBPOL_POLY_REAL t7714 = df[4134];
+    const MBPOL_POLY_REAL t7715 = df[3879];
     df[3878] = t7714+t7715;
     df[3877] = df[3878];
     df[3876] = df[3877];
     df[3875] = t7714+t7712+t7713+t7715;
     df[3874] = df[3875];
     df[3873] = t7705*t215;
-    const double t7716 = df[3873];
+    const MBPOL_POLY_REAL t7716 = df[3873];
     df[3872] = t7947+t7716;
     df[3871] = df[3872];
     df[3870] = df[3871];
@@ -6893,10 +6893,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3858] = df[3859];
     df[3857] = df[3894];
     df[3856] = t7705*t254;
-    const double t7718 = df[4132];
-    const double t7719 = df[3856];
+    const MBPOL_POLY_REAL t7718 = df[4132];
+    const MBPOL_POLY_REAL t7719 = df[3856];
     df[3855] = t7718+t7719;
-    const double t7720 = df[4097];
+    const MBPOL_POLY_REAL t7720 = df[4097];
     df[3854] = t7720+t7719;
     df[3853] = df[3854];
     df[3852] = df[3853];
@@ -6906,7 +6906,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3848] = df[3849];
     df[3847] = df[3848];
     df[3846] = t7705*t143;
-    const double t8004 = df[3846];
+    const MBPOL_POLY_REAL t8004 = df[3846];
     df[3845] = t7922+t8004;
     df[3844] = df[3845];
     df[3843] = df[3844];
@@ -6914,19 +6914,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3841] = df[3842];
     df[3840] = df[3841];
     df[3838] = t7705*t139;
-    const double t7722 = df[4128];
-    const double t7723 = df[3838];
+    const MBPOL_POLY_REAL t7722 = df[4128];
+    const MBPOL_POLY_REAL t7723 = df[3838];
     df[3837] = t7722+t7723;
     df[3836] = t7705*t136;
-    const double t7724 = df[4129];
-    const double t7725 = df[3836];
+    const MBPOL_POLY_REAL t7724 = df[4129];
+    const MBPOL_POLY_REAL t7725 = df[3836];
     df[3835] = t7724+t7725;
     df[3834] = df[3835];
-    const double t7726 = df[4133];
+    const MBPOL_POLY_REAL t7726 = df[4133];
     df[3833] = t7726+t7725;
     df[3832] = df[3833];
     df[3830] = t7705*t240;
-    const double t7728 = df[3830];
+    const MBPOL_POLY_REAL t7728 = df[3830];
     df[3829] = t7923+t7728;
     df[3828] = df[3829];
     df[3827] = df[3828];
@@ -6944,7 +6944,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3814] = df[3815];
     df[3813] = df[3814];
     df[3812] = t7705*t275;
-    const double t7730 = df[3812];
+    const MBPOL_POLY_REAL t7730 = df[3812];
     df[3811] = t7718+t7730;
     df[3810] = df[3811];
     df[3809] = df[3810];
@@ -6959,7 +6959,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3800] = df[3801];
     df[3799] = df[3800];
     df[3798] = t7705*t309;
-    const double t7731 = df[3798];
+    const MBPOL_POLY_REAL t7731 = df[3798];
     df[3797] = t7616+t7731;
     df[3796] = df[3797];
     df[3795] = t8004+t7731;
@@ -6977,23 +6977,23 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3782] = df[3783];
     df[3781] = df[3782];
     df[3780] = t7705*t132;
-    const double t7734 = df[3780];
+    const MBPOL_POLY_REAL t7734 = df[3780];
     df[3779] = t7726+t7734;
     df[3778] = t7724+t7734;
     df[3777] = df[3778];
     df[3776] = t7724+t7704+t7706+t7734;
     df[3775] = df[3776];
     df[3774] = t7705*t126;
-    const double t7735 = df[3774];
+    const MBPOL_POLY_REAL t7735 = df[3774];
     df[3773] = t7704+t7735;
-    const double t7736 = t7615*t77;
+    const MBPOL_POLY_REAL t7736 = t7615*t77;
     df[3772] = t7736+t7735;
     df[3771] = df[3772];
     df[3770] = t7726+t7736+t7725+t7735;
     df[3769] = df[3770];
     df[3768] = t7705*t145;
-    const double t7737 = df[4114];
-    const double t7738 = df[3768];
+    const MBPOL_POLY_REAL t7737 = df[4114];
+    const MBPOL_POLY_REAL t7738 = df[3768];
     df[3767] = t7737+t7738;
     df[3766] = df[3767];
     df[3765] = t7714+t7722+t7712+t7737+t7713+t7715+t7723+t7738;
@@ -7005,20 +7005,20 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3759] = t7493*t143;
     df[3758] = df[3759];
     df[3757] = t7493*t7493;
-    const double t7739 = df[3757];
+    const MBPOL_POLY_REAL t7739 = df[3757];
     df[3756] = t7739*t155;
     df[3755] = t7739*t136;
     df[3754] = t7739*t132;
-    const double t7740 = df[3755];
-    const double t7741 = df[3754];
+    const MBPOL_POLY_REAL t7740 = df[3755];
+    const MBPOL_POLY_REAL t7741 = df[3754];
     df[3753] = t7740+t7741;
     df[3752] = df[3753];
     df[3751] = t7739*t309;
     df[3750] = df[3751];
     df[3749] = t7739*t475;
     df[3748] = df[3749];
-    const double t7742 = df[3748];
-    const double t8019 = df[3750];
+    const MBPOL_POLY_REAL t7742 = df[3748];
+    const MBPOL_POLY_REAL t8019 = df[3750];
     df[3747] = t8019+t7742;
     df[3746] = df[3747];
     df[3745] = df[3746];
@@ -7031,12 +7031,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3738] = t7739*t215;
     df[3737] = df[3738];
     df[3736] = t7739*t145;
-    const double t7743 = df[3739];
-    const double t7744 = df[3736];
+    const MBPOL_POLY_REAL t7743 = df[3739];
+    const MBPOL_POLY_REAL t7744 = df[3736];
     df[3735] = t7743+t7744;
     df[3734] = df[3735];
     df[3732] = t7739*t143;
-    const double t7746 = df[3732];
+    const MBPOL_POLY_REAL t7746 = df[3732];
     df[3731] = t8019+t7746;
     df[3730] = df[3731];
     df[3729] = df[3730];
@@ -7044,15 +7044,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3726] = df[3728];
     df[3725] = df[3726];
     df[3724] = t7739*t179;
-    const double t7749 = df[3740];
-    const double t7750 = t7739*t77;
+    const MBPOL_POLY_REAL t7749 = df[3740];
+    const MBPOL_POLY_REAL t7750 = t7739*t77;
     df[3723] = t7749+t7750;
     df[3722] = df[3723];
     df[3721] = t7740+t7741+t7749+t7750;
     df[3720] = df[3721];
     df[3719] = t7739*t254;
-    const double t7751 = df[3741];
-    const double t7752 = df[3719];
+    const MBPOL_POLY_REAL t7751 = df[3741];
+    const MBPOL_POLY_REAL t7752 = df[3719];
     df[3718] = t7751+t7752;
     df[3717] = df[3718];
     df[3716] = df[3717];
@@ -7062,15 +7062,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3712] = df[3713];
     df[3711] = df[3712];
     df[3710] = t7739*t146;
-    const double t7753 = df[3756];
-    const double t7754 = df[3710];
+    const MBPOL_POLY_REAL t7753 = df[3756];
+    const MBPOL_POLY_REAL t7754 = df[3710];
     df[3709] = t7753+t7743+t7744+t7754;
     df[3708] = df[3709];
     df[3707] = t7753+t7754;
     df[3706] = df[3707];
     df[3705] = t7739*t212;
-    const double t7755 = df[3705];
-    const double t8020 = df[3737];
+    const MBPOL_POLY_REAL t7755 = df[3705];
+    const MBPOL_POLY_REAL t8020 = df[3737];
     df[3704] = t8020+t7755;
     df[3703] = df[3704];
     df[3702] = df[3704];
@@ -7080,7 +7080,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3698] = df[3699];
     df[3697] = df[3698];
     df[3696] = t7739*t240;
-    const double t7757 = df[3696];
+    const MBPOL_POLY_REAL t7757 = df[3696];
     df[3695] = t7746+t7757;
     df[3694] = t7742+t7757;
     df[3693] = df[3694];
@@ -7098,8 +7098,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3680] = df[3681];
     df[3679] = df[3680];
     df[3678] = t7493*t309;
-    const double t8023 = df[3758];
-    const double t8025 = df[3678];
+    const MBPOL_POLY_REAL t8023 = df[3758];
+    const MBPOL_POLY_REAL t8025 = df[3678];
     df[3677] = t8023+t8025;
     df[3676] = df[3677];
     df[3675] = df[3676];
@@ -7107,7 +7107,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3672] = df[3673];
     df[3671] = df[3672];
     df[3669] = t7493*t475;
-    const double t8043 = df[3669];
+    const MBPOL_POLY_REAL t8043 = df[3669];
     df[3668] = t8025+t8043;
     df[3666] = df[3668];
     df[3665] = df[3666];
@@ -7116,8 +7116,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3662] = df[3663];
     df[3661] = t7493*t126;
     df[3660] = t7493*t212;
-    const double t7764 = df[3660];
-    const double t8046 = df[3760];
+    const MBPOL_POLY_REAL t7764 = df[3660];
+    const MBPOL_POLY_REAL t8046 = df[3760];
     df[3659] = t8046+t7764;
     df[3658] = df[3659];
     df[3657] = df[3659];
@@ -7127,19 +7127,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3653] = df[3654];
     df[3652] = df[3653];
     df[3651] = t7493*t155;
-    const double t7766 = df[3914];
-    const double t7767 = df[3651];
+    const MBPOL_POLY_REAL t7766 = df[3914];
+    const MBPOL_POLY_REAL t7767 = df[3651];
     df[3650] = t7766+t7767;
     df[3649] = df[3650];
     df[3648] = t7493*t139;
-    const double t7768 = t7493*t77;
-    const double t7769 = df[3661];
+    const MBPOL_POLY_REAL t7768 = t7493*t77;
+    const MBPOL_POLY_REAL t7769 = df[3661];
     df[3647] = t7768+t7769;
     df[3646] = df[3647];
     df[3645] = t7493*t254;
     df[3644] = t7493*t275;
-    const double t7770 = df[3645];
-    const double t7771 = df[3644];
+    const MBPOL_POLY_REAL t7770 = df[3645];
+    const MBPOL_POLY_REAL t7771 = df[3644];
     df[3643] = t7770+t7771;
     df[3642] = df[3643];
     df[3641] = df[3642];
@@ -7149,14 +7149,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3637] = df[3638];
     df[3636] = df[3637];
     df[3635] = t7493*t136;
-    const double t7772 = df[3915];
-    const double t7773 = df[3635];
+    const MBPOL_POLY_REAL t7772 = df[3915];
+    const MBPOL_POLY_REAL t7773 = df[3635];
     df[3634] = t7772+t7773;
     df[3633] = df[3634];
     df[3632] = t7772+t7768+t7769+t7773;
     df[3631] = df[3632];
     df[3630] = t7493*t240;
-    const double t7774 = df[3630];
+    const MBPOL_POLY_REAL t7774 = df[3630];
     df[3629] = t8023+t7774;
     df[3628] = df[3629];
     df[3627] = df[3628];
@@ -7174,10 +7174,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3614] = df[3615];
     df[3613] = df[3614];
     df[3612] = t7493*t4135;
-    const double t7776 = df[3612];
+    const MBPOL_POLY_REAL t7776 = df[3612];
     df[3611] = t7776*t126;
-    const double t7777 = t7776*t77;
-    const double t7778 = df[3611];
+    const MBPOL_POLY_REAL t7777 = t7776*t77;
+    const MBPOL_POLY_REAL t7778 = df[3611];
     df[3610] = t7777+t7778;
     df[3609] = df[3610];
     df[3608] = t7776*t254;
@@ -7187,8 +7187,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3604] = t7776*t215;
     df[3603] = df[3604];
     df[3602] = t7776*t240;
-    const double t8049 = df[3606];
-    const double t8052 = df[3602];
+    const MBPOL_POLY_REAL t8049 = df[3606];
+    const MBPOL_POLY_REAL t8052 = df[3602];
     df[3601] = t8049+t8052;
     df[3600] = df[3601];
     df[3598] = df[3601];
@@ -7196,7 +7196,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3596] = df[3597];
     df[3595] = df[3596];
     df[3594] = t7776*t309;
-    const double t7781 = df[3594];
+    const MBPOL_POLY_REAL t7781 = df[3594];
     df[3593] = t8052+t7781;
     df[3592] = t8049+t7781;
     df[3591] = df[3592];
@@ -7205,25 +7205,25 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3587] = df[3588];
     df[3586] = df[3587];
     df[3585] = t7776*t155;
-    const double t7784 = t73+t50;
+    const MBPOL_POLY_REAL t7784 = t73+t50;
     df[3584] = t7776*t7784;
     df[3583] = df[3584];
-    const double t7785 = t7776*t73;
-    const double t7787 = t7776*t72;
+    const MBPOL_POLY_REAL t7785 = t7776*t73;
+    const MBPOL_POLY_REAL t7787 = t7776*t72;
     df[3581] = t7785+t7787;
     df[3580] = df[3581];
     df[3579] = t7776*t50+t7787;
     df[3578] = df[3579];
     df[3577] = t7776*t146;
-    const double t7789 = df[3585];
-    const double t7790 = df[3577];
+    const MBPOL_POLY_REAL t7789 = df[3585];
+    const MBPOL_POLY_REAL t7790 = df[3577];
     df[3576] = t7789+t7790;
     df[3575] = df[3576];
     df[3574] = t7777+t7778+t7789+t7790;
     df[3573] = df[3574];
     df[3572] = t7776*t136;
-    const double t7791 = df[3605];
-    const double t7792 = df[3572];
+    const MBPOL_POLY_REAL t7791 = df[3605];
+    const MBPOL_POLY_REAL t7792 = df[3572];
     df[3571] = t7791+t7792;
     df[3570] = df[3571];
     df[3569] = t7777+t7778+t7791+t7792;
@@ -7233,8 +7233,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3565] = t7776*t179;
     df[3564] = t7776*t145;
     df[3563] = t7776*t139;
-    const double t7793 = df[3564];
-    const double t7794 = df[3563];
+    const MBPOL_POLY_REAL t7793 = df[3564];
+    const MBPOL_POLY_REAL t7794 = df[3563];
     df[3562] = t7789+t7790+t7793+t7794;
     df[3561] = df[3562];
     df[3560] = df[3561];
@@ -7249,13 +7249,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3551] = df[3554];
     df[3550] = t7776*t20+t7776*t26;
     df[3549] = t7785+t7776*t67;
-    const double t7798 = t67+t72;
+    const MBPOL_POLY_REAL t7798 = t67+t72;
     df[3548] = t7776*t7798;
     df[3547] = df[3548];
     df[3546] = df[3549];
     df[3545] = t7776*t275;
-    const double t7799 = df[3608];
-    const double t7800 = df[3545];
+    const MBPOL_POLY_REAL t7799 = df[3608];
+    const MBPOL_POLY_REAL t7800 = df[3545];
     df[3544] = t7799+t7800;
     df[3543] = df[3544];
     df[3542] = df[3543];
@@ -7265,8 +7265,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3538] = df[3539];
     df[3537] = df[3538];
     df[3536] = t7776*t212;
-    const double t7801 = df[3536];
-    const double t8089 = df[3603];
+    const MBPOL_POLY_REAL t7801 = df[3536];
+    const MBPOL_POLY_REAL t8089 = df[3603];
     df[3535] = t8089+t7801;
     df[3534] = df[3535];
     df[3533] = t7799+t8089+t7800+t7801;
@@ -7283,7 +7283,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3522] = df[3523];
     df[3521] = df[3522];
     df[3520] = t7776*t475;
-    const double t7803 = df[3520];
+    const MBPOL_POLY_REAL t7803 = df[3520];
     df[3519] = t8052+t7803;
     df[3518] = t8049+t8052+t7781+t7803;
     df[3517] = df[3518];
@@ -7306,8 +7306,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3499] = df[3503];
     df[3498] = df[3499];
     df[3497] = t7493*t145;
-    const double t7805 = df[3648];
-    const double t7806 = df[3497];
+    const MBPOL_POLY_REAL t7805 = df[3648];
+    const MBPOL_POLY_REAL t7806 = df[3497];
     df[3496] = t7766+t7767+t7805+t7806;
     df[3495] = df[3496];
     df[3494] = t7805+t7806;
@@ -7315,8 +7315,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3491] = t212*t212;
     df[3490] = t212*t254;
     df[3489] = t212*t275;
-    const double t7807 = df[3490];
-    const double t7808 = df[3489];
+    const MBPOL_POLY_REAL t7807 = df[3490];
+    const MBPOL_POLY_REAL t7808 = df[3489];
     df[3488] = t7807+t7808;
     df[3487] = df[3488];
     df[3486] = df[3487];
@@ -7332,7 +7332,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3475] = t3116*t275;
     df[3474] = t3116*t155;
     df[3473] = t3116*t3116;
-    const double t7809 = df[3473];
+    const MBPOL_POLY_REAL t7809 = df[3473];
     df[3472] = t7809*t212;
     df[3471] = t7809*t240;
     df[3470] = df[3471];
@@ -7344,8 +7344,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3463] = t7809*t215;
     df[3462] = df[3463];
     df[3461] = t7809*t475;
-    const double t8105 = df[3467];
-    const double t8112 = df[3461];
+    const MBPOL_POLY_REAL t8105 = df[3467];
+    const MBPOL_POLY_REAL t8112 = df[3461];
     df[3460] = t8105+t8112;
     df[3459] = df[3460];
     df[3458] = df[3459];
@@ -7355,16 +7355,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3453] = t7809*t275;
     df[3452] = t7809*t145;
     df[3451] = t7809*t254;
-    const double t7812 = df[3453];
-    const double t7813 = df[3451];
+    const MBPOL_POLY_REAL t7812 = df[3453];
+    const MBPOL_POLY_REAL t7813 = df[3451];
     df[3450] = t7812+t7813;
     df[3449] = df[3450];
     df[3448] = df[3449];
     df[3447] = df[3448];
     df[3446] = t7809*t146;
     df[3445] = t7809*t143;
-    const double t7814 = df[3445];
-    const double t8120 = df[3470];
+    const MBPOL_POLY_REAL t7814 = df[3445];
+    const MBPOL_POLY_REAL t8120 = df[3470];
     df[3444] = t8120+t7814;
     df[3443] = df[3444];
     df[3442] = df[3444];
@@ -7375,7 +7375,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3436] = df[3437];
     df[3435] = t3116*t145;
     df[3434] = t3116*t3120;
-    const double t7816 = df[3434];
+    const MBPOL_POLY_REAL t7816 = df[3434];
     df[3433] = t7816*t132;
     df[3432] = t7816*t240;
     df[3431] = df[3432];
@@ -7384,11 +7384,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3428] = df[3429];
     df[3427] = t7816*t145;
     df[3426] = t7816*t143;
-    const double t7817 = df[3426];
-    const double t8128 = df[3431];
+    const MBPOL_POLY_REAL t7817 = df[3426];
+    const MBPOL_POLY_REAL t8128 = df[3431];
     df[3425] = t8128+t7817;
     df[3424] = df[3425];
-    const double t8133 = df[3428];
+    const MBPOL_POLY_REAL t8133 = df[3428];
     df[3423] = t8133+t7817;
     df[3422] = df[3423];
     df[3421] = df[3424];
@@ -7400,13 +7400,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3414] = df[3416];
     df[3413] = df[3414];
     df[3412] = t7816*t139;
-    const double t7820 = df[3427];
-    const double t7821 = df[3412];
+    const MBPOL_POLY_REAL t7820 = df[3427];
+    const MBPOL_POLY_REAL t7821 = df[3412];
     df[3411] = t7820+t7821;
     df[3410] = df[3411];
     df[3409] = t7816*t155;
     df[3408] = t7816*t475;
-    const double t7822 = df[3408];
+    const MBPOL_POLY_REAL t7822 = df[3408];
     df[3407] = t8128+t7822;
     df[3406] = df[3407];
     df[3405] = t8128+t8133+t7817+t7822;
@@ -7427,8 +7427,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3389] = t7816*t215;
     df[3388] = df[3389];
     df[3386] = t7816*t254;
-    const double t7826 = df[3390];
-    const double t7827 = df[3386];
+    const MBPOL_POLY_REAL t7826 = df[3390];
+    const MBPOL_POLY_REAL t7827 = df[3386];
     df[3385] = t7826+t7827;
     df[3384] = df[3385];
     df[3383] = df[3384];
@@ -7438,19 +7438,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3379] = df[3380];
     df[3378] = df[3379];
     df[3377] = t7816*t136;
-    const double t7828 = df[3433];
-    const double t7829 = df[3377];
+    const MBPOL_POLY_REAL t7828 = df[3433];
+    const MBPOL_POLY_REAL t7829 = df[3377];
     df[3376] = t7828+t7829;
     df[3375] = df[3376];
-    const double t7830 = df[3430];
-    const double t7831 = t7816*t77;
+    const MBPOL_POLY_REAL t7830 = df[3430];
+    const MBPOL_POLY_REAL t7831 = t7816*t77;
     df[3374] = t7830+t7831;
     df[3373] = df[3374];
     df[3372] = t7828+t7830+t7831+t7829;
     df[3371] = df[3372];
     df[3370] = t7816*t212;
-    const double t7832 = df[3370];
-    const double t8140 = df[3388];
+    const MBPOL_POLY_REAL t7832 = df[3370];
+    const MBPOL_POLY_REAL t8140 = df[3388];
     df[3369] = t8140+t7832;
     df[3368] = df[3369];
     df[3367] = df[3369];
@@ -7461,15 +7461,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3362] = df[3363];
     df[3361] = t7816*t179;
     df[3360] = t7816*t146;
-    const double t7834 = df[3409];
-    const double t7835 = df[3360];
+    const MBPOL_POLY_REAL t7834 = df[3409];
+    const MBPOL_POLY_REAL t7835 = df[3360];
     df[3359] = t7820+t7821+t7834+t7835;
     df[3358] = df[3359];
     df[3357] = t7834+t7835;
     df[3356] = df[3357];
     df[3355] = t3116*t254;
-    const double t7836 = df[3475];
-    const double t7837 = df[3355];
+    const MBPOL_POLY_REAL t7836 = df[3475];
+    const MBPOL_POLY_REAL t7837 = df[3355];
     df[3354] = t7836+t7837;
     df[3353] = df[3354];
     df[3352] = df[3353];
@@ -7477,8 +7477,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3350] = t3116*t309;
     df[3349] = df[3350];
     df[3348] = t3116*t240;
-    const double t8145 = df[3477];
-    const double t8146 = df[3348];
+    const MBPOL_POLY_REAL t8145 = df[3477];
+    const MBPOL_POLY_REAL t8146 = df[3348];
     df[3347] = t8145+t8146;
     df[3346] = df[3347];
     df[3345] = df[3346];
@@ -7488,8 +7488,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3339] = t3116*t139;
     df[3338] = t3116*t179;
     df[3337] = t3116*t475;
-    const double t8147 = df[3349];
-    const double t8148 = df[3337];
+    const MBPOL_POLY_REAL t8147 = df[3349];
+    const MBPOL_POLY_REAL t8148 = df[3337];
     df[3336] = t8147+t8148;
     df[3335] = df[3336];
     df[3334] = df[3335];
@@ -7510,19 +7510,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3317] = t143*t145;
     df[3316] = t143*t139;
     df[3313] = t3120*t145;
-    const double t7841 = df[3435];
-    const double t7842 = df[3313];
+    const MBPOL_POLY_REAL t7841 = df[3435];
+    const MBPOL_POLY_REAL t7842 = df[3313];
     df[3312] = t7841+t7842;
-    const double t7843 = df[3339];
+    const MBPOL_POLY_REAL t7843 = df[3339];
     df[3311] = t7843+t7842;
     df[3310] = df[3311];
     df[3309] = t3120*t139;
-    const double t7844 = df[3309];
+    const MBPOL_POLY_REAL t7844 = df[3309];
     df[3308] = t7841+t7844;
     df[3307] = df[3308];
     df[3306] = t3120*t475;
     df[3305] = df[3306];
-    const double t7846 = df[3305];
+    const MBPOL_POLY_REAL t7846 = df[3305];
     df[3304] = t8146+t7846;
     df[3303] = t8148+t7846;
     df[3302] = df[3304];
@@ -7531,10 +7531,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3299] = df[3300];
     df[3298] = df[3299];
     df[3297] = t3120*t3120;
-    const double t7847 = df[3297];
+    const MBPOL_POLY_REAL t7847 = df[3297];
     df[3296] = t7847*t240;
     df[3295] = df[3296];
-    const double t7849 = df[3295];
+    const MBPOL_POLY_REAL t7849 = df[3295];
     df[3294] = t8112+t7849;
     df[3293] = df[3294];
     df[3292] = df[3293];
@@ -7542,7 +7542,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3290] = df[3291];
     df[3289] = df[3290];
     df[3288] = t7847*t254;
-    const double t7850 = df[3288];
+    const MBPOL_POLY_REAL t7850 = df[3288];
     df[3287] = t7813+t7850;
     df[3286] = df[3287];
     df[3285] = df[3286];
@@ -7550,7 +7550,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3283] = df[3284];
     df[3282] = df[3283];
     df[3281] = t7847*t275;
-    const double t7851 = df[3281];
+    const MBPOL_POLY_REAL t7851 = df[3281];
     df[3280] = t7812+t7851;
     df[3279] = t7850+t7851;
     df[3278] = df[3279];
@@ -7565,21 +7565,21 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3269] = df[3270];
     df[3268] = df[3269];
     df[3267] = t7847*t146;
-    const double t7852 = df[3446];
-    const double t7853 = df[3267];
+    const MBPOL_POLY_REAL t7852 = df[3446];
+    const MBPOL_POLY_REAL t7853 = df[3267];
     df[3266] = t7852+t7853;
-    const double t7854 = df[3465];
+    const MBPOL_POLY_REAL t7854 = df[3465];
     df[3265] = t7854+t7853;
     df[3264] = df[3265];
     df[3263] = t7847*t145;
-    const double t7855 = df[3452];
-    const double t7856 = df[3263];
+    const MBPOL_POLY_REAL t7855 = df[3452];
+    const MBPOL_POLY_REAL t7856 = df[3263];
     df[3262] = t7855+t7856;
-    const double t7857 = df[3466];
+    const MBPOL_POLY_REAL t7857 = df[3466];
     df[3261] = t7857+t7856;
     df[3260] = df[3261];
     df[3259] = t7847*t139;
-    const double t7858 = df[3259];
+    const MBPOL_POLY_REAL t7858 = df[3259];
     df[3258] = t7854+t7855+t7853+t7858;
     df[3257] = df[3258];
     df[3256] = t7855+t7858;
@@ -7588,8 +7588,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3253] = df[3254];
     df[3252] = df[3253];
     df[3251] = t7847*t179;
-    const double t7859 = df[3469];
-    const double t7860 = df[3251];
+    const MBPOL_POLY_REAL t7859 = df[3469];
+    const MBPOL_POLY_REAL t7860 = df[3251];
     df[3250] = t7859+t7860;
     df[3249] = df[3250];
     df[3248] = df[3249];
@@ -7599,7 +7599,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3244] = df[3245];
     df[3243] = df[3244];
     df[3242] = t7847*t309;
-    const double t8195 = df[3242];
+    const MBPOL_POLY_REAL t8195 = df[3242];
     df[3241] = t7814+t8195;
     df[3240] = df[3241];
     df[3239] = df[3240];
@@ -7607,7 +7607,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3236] = df[3237];
     df[3235] = df[3236];
     df[3234] = t7847*t143;
-    const double t7864 = df[3234];
+    const MBPOL_POLY_REAL t7864 = df[3234];
     df[3233] = t7849+t7864;
     df[3232] = df[3233];
     df[3231] = t8105+t7864;
@@ -7625,7 +7625,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3218] = df[3219];
     df[3217] = df[3220];
     df[3215] = t7847*t155;
-    const double t7868 = df[3215];
+    const MBPOL_POLY_REAL t7868 = df[3215];
     df[3214] = t7854+t7868;
     df[3213] = df[3214];
     df[3212] = t7857+t7852+t7856+t7868;
@@ -7633,10 +7633,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3210] = t7852+t7868;
     df[3209] = df[3210];
     df[3208] = t7847*t215;
-    const double t7869 = df[3208];
-    const double t8196 = df[3462];
+    const MBPOL_POLY_REAL t7869 = df[3208];
+    const MBPOL_POLY_REAL t8196 = df[3462];
     df[3207] = t8196+t7869;
-    const double t7870 = df[3472];
+    const MBPOL_POLY_REAL t7870 = df[3472];
     df[3206] = t7870+t7869;
     df[3205] = df[3206];
     df[3203] = df[3206];
@@ -7646,7 +7646,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3199] = df[3200];
     df[3198] = df[3199];
     df[3197] = t7847*t212;
-    const double t7872 = df[3197];
+    const MBPOL_POLY_REAL t7872 = df[3197];
     df[3196] = t8196+t7872;
     df[3195] = df[3196];
     df[3194] = df[3196];
@@ -7656,7 +7656,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3190] = df[3191];
     df[3189] = df[3190];
     df[3188] = t7847*t475;
-    const double t7874 = df[3188];
+    const MBPOL_POLY_REAL t7874 = df[3188];
     df[3187] = t8195+t7874;
     df[3186] = df[3187];
     df[3185] = df[3186];
@@ -7679,26 +7679,26 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3167] = df[3168];
     df[3166] = df[3168];
     df[3165] = df[3166];
-    const double t8200 = df[3165];
+    const MBPOL_POLY_REAL t8200 = df[3165];
     df[3164] = t8200*t136;
     df[3162] = t8200*t132;
-    const double t7878 = df[3164];
-    const double t7879 = df[3162];
+    const MBPOL_POLY_REAL t7878 = df[3164];
+    const MBPOL_POLY_REAL t7879 = df[3162];
     df[3161] = t7878+t7879;
     df[3160] = df[3161];
     df[3158] = t8200*t126;
-    const double t7881 = df[3158];
-    const double t7883 = t8200*t77;
+    const MBPOL_POLY_REAL t7881 = df[3158];
+    const MBPOL_POLY_REAL t7883 = t8200*t77;
     df[3156] = t7881+t7883;
     df[3155] = df[3156];
     df[3154] = t7878+t7879+t7881+t7883;
     df[3153] = df[3154];
     df[3152] = t3116+t3120;
-    const double t8220 = df[3152];
+    const MBPOL_POLY_REAL t8220 = df[3152];
     df[3151] = t8220*t126;
     df[3148] = t3120*t240;
     df[3147] = df[3148];
-    const double t7885 = df[3147];
+    const MBPOL_POLY_REAL t7885 = df[3147];
     df[3146] = t8148+t7885;
     df[3145] = df[3146];
     df[3144] = df[3145];
@@ -7706,7 +7706,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3142] = df[3143];
     df[3141] = df[3142];
     df[3140] = t3120*t309;
-    const double t7886 = df[3140];
+    const MBPOL_POLY_REAL t7886 = df[3140];
     df[3139] = t7846+t7886;
     df[3138] = df[3139];
     df[3137] = t8145+t7886;
@@ -7725,18 +7725,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3123] = df[3124];
     df[3121] = t8220*t136;
     df[3119] = t8220*t132;
-    const double t7891 = df[3121];
-    const double t7892 = df[3119];
+    const MBPOL_POLY_REAL t7891 = df[3121];
+    const MBPOL_POLY_REAL t7892 = df[3119];
     df[3118] = t7891+t7892;
     df[3117] = df[3118];
-    const double t7893 = df[3151];
-    const double t7895 = t8220*t77;
+    const MBPOL_POLY_REAL t7893 = df[3151];
+    const MBPOL_POLY_REAL t7895 = t8220*t77;
     df[3115] = t7893+t7895;
     df[3114] = df[3115];
     df[3113] = t7893+t7891+t7892+t7895;
     df[3112] = df[3113];
     df[3105] = t3120*t143;
-    const double t7896 = df[3105];
+    const MBPOL_POLY_REAL t7896 = df[3105];
     df[3104] = t7885+t7896;
     df[3103] = df[3104];
     df[3102] = t8147+t7896;
@@ -7754,10 +7754,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3089] = df[3090];
     df[3088] = df[3089];
     df[3087] = t3120*t215;
-    const double t7899 = df[3087];
-    const double t8254 = df[3436];
+    const MBPOL_POLY_REAL t7899 = df[3087];
+    const MBPOL_POLY_REAL t8254 = df[3436];
     df[3086] = t8254+t7899;
-    const double t7900 = df[3329];
+    const MBPOL_POLY_REAL t7900 = df[3329];
     df[3085] = t7900+t7899;
     df[3084] = df[3085];
     df[3082] = df[3085];
@@ -7767,7 +7767,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3078] = df[3079];
     df[3077] = df[3078];
     df[3076] = t3120*t212;
-    const double t7902 = df[3076];
+    const MBPOL_POLY_REAL t7902 = df[3076];
     df[3075] = t8254+t7902;
     df[3074] = df[3075];
     df[3073] = df[3075];
@@ -7777,7 +7777,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3069] = df[3070];
     df[3068] = df[3069];
     df[3067] = t3120*t254;
-    const double t7904 = df[3067];
+    const MBPOL_POLY_REAL t7904 = df[3067];
     df[3066] = t7837+t7904;
     df[3065] = df[3066];
     df[3064] = df[3065];
@@ -7785,7 +7785,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3062] = df[3063];
     df[3061] = df[3062];
     df[3060] = t3120*t275;
-    const double t7905 = df[3060];
+    const MBPOL_POLY_REAL t7905 = df[3060];
     df[3059] = t7836+t7905;
     df[3058] = t7904+t7905;
     df[3057] = df[3058];
@@ -7800,8 +7800,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3048] = df[3049];
     df[3047] = df[3048];
     df[3046] = t3120*t179;
-    const double t7906 = df[3338];
-    const double t7907 = df[3046];
+    const MBPOL_POLY_REAL t7906 = df[3338];
+    const MBPOL_POLY_REAL t7907 = df[3046];
     df[3045] = t7906+t7907;
     df[3044] = df[3045];
     df[3043] = df[3044];
@@ -7811,80 +7811,80 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[3039] = df[3040];
     df[3038] = df[3039];
     df[3037] = t3120*t155;
-    const double t7908 = df[3474];
-    const double t7909 = df[3037];
+    const MBPOL_POLY_REAL t7908 = df[3474];
+    const MBPOL_POLY_REAL t7909 = df[3037];
     df[3036] = t7908+t7909;
     df[3035] = df[3036];
-    const double t7910 = df[3476];
+    const MBPOL_POLY_REAL t7910 = df[3476];
     df[3034] = t7910+t7843+t7842+t7909;
     df[3033] = df[3034];
     df[3032] = t7910+t7909;
     df[3031] = df[3032];
     df[3030] = t3120*t146;
-    const double t7911 = df[3030];
+    const MBPOL_POLY_REAL t7911 = df[3030];
     df[3029] = t7910+t7911;
     df[3028] = t7908+t7841+t7844+t7911;
     df[3027] = df[3028];
     df[3026] = t7908+t7911;
     df[3025] = df[3026];
-    const double t7912 = t72+t73;
+    const MBPOL_POLY_REAL t7912 = t72+t73;
     df[3024] = t7912*t73;
-    const double t7913 = t67+t73;
+    const MBPOL_POLY_REAL t7913 = t67+t73;
     df[3023] = t7913*t73+t7798*t72;
-    const double t7917 = t72*t67;
+    const MBPOL_POLY_REAL t7917 = t72*t67;
     df[3022] = t7798*t73+t7917;
     df[3021] = t73*t67+t72*t50;
     df[3020] = df[3021];
-    const double t7921 = t50+t72;
+    const MBPOL_POLY_REAL t7921 = t50+t72;
     df[3019] = t7784*t73+t7921*t72;
     df[3018] = t73*t50+t7917;
     df[3017] = df[3018];
-    const double t7924 = t73*t37;
-    const double t7925 = t72*t37;
+    const MBPOL_POLY_REAL t7924 = t73*t37;
+    const MBPOL_POLY_REAL t7925 = t72*t37;
     df[3016] = t7924+t7925;
     df[3014] = t240*t275;
-    const double t7926 = df[3322];
-    const double t7927 = df[3014];
+    const MBPOL_POLY_REAL t7926 = df[3322];
+    const MBPOL_POLY_REAL t7927 = df[3014];
     df[3013] = t7926+t7927;
     df[3012] = df[3013];
     df[3011] = df[3012];
     df[3010] = df[3011];
     df[3009] = t240*t215;
-    const double t8339 = df[3324];
-    const double t8345 = df[3009];
+    const MBPOL_POLY_REAL t8339 = df[3324];
+    const MBPOL_POLY_REAL t8345 = df[3009];
     df[3008] = t8339+t8345;
     df[3007] = df[3008];
     df[3006] = df[3007];
     df[3005] = df[3006];
     df[3004] = df[3005];
     df[3002] = t240*t139;
-    const double t7929 = df[3316];
-    const double t7930 = df[3002];
+    const MBPOL_POLY_REAL t7929 = df[3316];
+    const MBPOL_POLY_REAL t7930 = df[3002];
     df[3001] = t7929+t7930;
     df[3000] = t240*t309;
     df[2999] = df[3000];
     df[2998] = t240*t254;
-    const double t7931 = df[3321];
-    const double t7932 = df[2998];
+    const MBPOL_POLY_REAL t7931 = df[3321];
+    const MBPOL_POLY_REAL t7932 = df[2998];
     df[2997] = t7931+t7932;
     df[2996] = df[2997];
     df[2995] = df[2996];
     df[2994] = df[2995];
     df[2993] = t240*t179;
-    const double t7933 = df[3320];
-    const double t7934 = df[2993];
+    const MBPOL_POLY_REAL t7933 = df[3320];
+    const MBPOL_POLY_REAL t7934 = df[2993];
     df[2992] = t7933+t7934;
     df[2991] = df[2992];
     df[2990] = df[2991];
     df[2989] = df[2990];
     df[2988] = t240*t146;
-    const double t7935 = df[3318];
-    const double t7936 = df[2988];
+    const MBPOL_POLY_REAL t7935 = df[3318];
+    const MBPOL_POLY_REAL t7936 = df[2988];
     df[2987] = t7935+t7936;
     df[2986] = df[2987];
     df[2985] = t240*t212;
-    const double t7937 = df[3323];
-    const double t7938 = df[2985];
+    const MBPOL_POLY_REAL t7937 = df[3323];
+    const MBPOL_POLY_REAL t7938 = df[2985];
     df[2984] = t7937+t7938;
     df[2983] = df[2984];
     df[2982] = df[2983];
@@ -7893,46 +7893,46 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2978] = t240*t143;
     df[2977] = df[2978];
     df[2976] = t240*t145;
-    const double t7939 = df[3317];
-    const double t7940 = df[2976];
+    const MBPOL_POLY_REAL t7939 = df[3317];
+    const MBPOL_POLY_REAL t7940 = df[2976];
     df[2975] = t7939+t7940;
     df[2974] = t240*t240;
-    const double t7941 = df[2974];
-    const double t8354 = df[3326];
+    const MBPOL_POLY_REAL t7941 = df[2974];
+    const MBPOL_POLY_REAL t8354 = df[3326];
     df[2973] = t8354+t7941;
     df[2972] = df[2973];
     df[2971] = df[2972];
     df[2970] = df[2971];
     df[2969] = df[2970];
     df[2968] = df[2969];
-    const double t8358 = df[2999];
+    const MBPOL_POLY_REAL t8358 = df[2999];
     df[2967] = t8358+t7941;
     df[2965] = t240*t155;
-    const double t7942 = df[3319];
-    const double t7943 = df[2965];
+    const MBPOL_POLY_REAL t7942 = df[3319];
+    const MBPOL_POLY_REAL t7943 = df[2965];
     df[2964] = t7942+t7943;
     df[2963] = df[2964];
     df[2961] = t146*t146;
     df[2960] = t146*t145;
-    const double t7944 = df[2961];
-    const double t7945 = df[2960];
+    const MBPOL_POLY_REAL t7944 = df[2961];
+    const MBPOL_POLY_REAL t7945 = df[2960];
     df[2959] = t7944+t7945;
     df[2958] = t146*t139;
-    const double t7946 = df[2958];
+    const MBPOL_POLY_REAL t7946 = df[2958];
     df[2957] = t7944+t7946;
     df[2956] = (t26+t37)*t37;
     df[2955] = (t20+t37)*t37;
     df[2954] = (t5+t37)*t37;
     df[2952] = t145*t145;
     df[2951] = t145*t139;
-    const double t7950 = df[2952];
-    const double t7951 = df[2951];
+    const MBPOL_POLY_REAL t7950 = df[2952];
+    const MBPOL_POLY_REAL t7951 = df[2951];
     df[2950] = t7950+t7951;
     df[2948] = t2404*t155;
     df[2947] = t2404*t2404;
-    const double t7952 = df[2947];
+    const MBPOL_POLY_REAL t7952 = df[2947];
     df[2946] = t7952*t143;
-    const double t8403 = df[2946];
+    const MBPOL_POLY_REAL t8403 = df[2946];
     df[2945] = t7864+t8403;
     df[2943] = t7952*t215;
     df[2942] = df[2943];
@@ -7940,7 +7940,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2940] = t7952*t275;
     df[2939] = t7952*t155;
     df[2938] = t7952*t309;
-    const double t7954 = df[2938];
+    const MBPOL_POLY_REAL t7954 = df[2938];
     df[2937] = t8105+t7954;
     df[2936] = t7849+t7954;
     df[2935] = t8403+t7954;
@@ -7950,10 +7950,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2930] = df[2931];
     df[2929] = df[2930];
     df[2928] = t7952*t475;
-    const double t8406 = df[2928];
+    const MBPOL_POLY_REAL t8406 = df[2928];
     df[2927] = t7874+t8406;
     df[2925] = t7952*t240;
-    const double t8412 = df[2925];
+    const MBPOL_POLY_REAL t8412 = df[2925];
     df[2924] = t8406+t8412;
     df[2923] = df[2924];
     df[2922] = df[2923];
@@ -7965,17 +7965,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2915] = t7952*t139;
     df[2913] = t7952*t136;
     df[2912] = t7952*t146;
-    const double t7961 = df[2939];
-    const double t7962 = df[2916];
-    const double t7963 = df[2915];
-    const double t7964 = df[2912];
+    const MBPOL_POLY_REAL t7961 = df[2939];
+    const MBPOL_POLY_REAL t7962 = df[2916];
+    const MBPOL_POLY_REAL t7963 = df[2915];
+    const MBPOL_POLY_REAL t7964 = df[2912];
     df[2911] = t7857+t7852+t7856+t7868+t7961+t7962+t7963+t7964;
     df[2910] = t7854+t7855+t7853+t7858+t7961+t7962+t7963+t7964;
     df[2909] = df[2911];
     df[2908] = df[2910];
     df[2907] = t7952*t212;
-    const double t7965 = df[2907];
-    const double t8415 = df[2942];
+    const MBPOL_POLY_REAL t7965 = df[2907];
+    const MBPOL_POLY_REAL t8415 = df[2942];
     df[2906] = t7870+t7869+t8415+t7965;
     df[2905] = t8196+t7872+t8415+t7965;
     df[2904] = t8415+t7965;
@@ -7988,7 +7988,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2897] = t2404*t212;
     df[2896] = t2404*t146;
     df[2895] = t2404*t3116;
-    const double t7967 = df[2895];
+    const MBPOL_POLY_REAL t7967 = df[2895];
     df[2894] = t7967*t240;
     df[2893] = df[2894];
     df[2892] = t7967*t309;
@@ -8008,16 +8008,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2877] = df[2878];
     df[2876] = t7967*t212;
     df[2875] = t2404*t143;
-    const double t8427 = df[2875];
+    const MBPOL_POLY_REAL t8427 = df[2875];
     df[2874] = t7896+t8427;
     df[2872] = t2404*t136;
     df[2871] = t2404*t240;
     df[2870] = df[2871];
-    const double t7970 = df[2870];
+    const MBPOL_POLY_REAL t7970 = df[2870];
     df[2869] = t8146+t7970;
     df[2868] = t2404*t215;
-    const double t7971 = df[2897];
-    const double t7972 = df[2868];
+    const MBPOL_POLY_REAL t7971 = df[2897];
+    const MBPOL_POLY_REAL t7972 = df[2868];
     df[2867] = t7900+t7899+t7971+t7972;
     df[2866] = t8254+t7902+t7971+t7972;
     df[2865] = t7971+t7972;
@@ -8025,7 +8025,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2862] = df[2865];
     df[2861] = df[2862];
     df[2859] = t2404*t475;
-    const double t8430 = df[2859];
+    const MBPOL_POLY_REAL t8430 = df[2859];
     df[2858] = t7970+t8430;
     df[2856] = df[2858];
     df[2855] = df[2856];
@@ -8038,18 +8038,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2848] = t2404*t275;
     df[2847] = t2404*t179;
     df[2846] = t2404*t3120;
-    const double t7976 = df[2846];
+    const MBPOL_POLY_REAL t7976 = df[2846];
     df[2845] = t7976*t215;
-    const double t7977 = df[2876];
-    const double t8437 = df[2845];
+    const MBPOL_POLY_REAL t7977 = df[2876];
+    const MBPOL_POLY_REAL t8437 = df[2845];
     df[2844] = t7977+t8437;
     df[2843] = df[2844];
     df[2842] = df[2843];
     df[2840] = df[2844];
     df[2839] = df[2840];
     df[2838] = t7976*t254;
-    const double t7980 = df[2890];
-    const double t7981 = df[2838];
+    const MBPOL_POLY_REAL t7980 = df[2890];
+    const MBPOL_POLY_REAL t7981 = df[2838];
     df[2837] = t7980+t7981;
     df[2836] = df[2837];
     df[2835] = df[2836];
@@ -8058,34 +8058,34 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2832] = t7976*t145;
     df[2831] = t7976*t139;
     df[2830] = t7976*t275;
-    const double t7982 = df[2883];
-    const double t7983 = df[2830];
+    const MBPOL_POLY_REAL t7982 = df[2883];
+    const MBPOL_POLY_REAL t7983 = df[2830];
     df[2829] = t7982+t7983;
     df[2828] = df[2829];
     df[2827] = df[2828];
     df[2826] = df[2827];
     df[2825] = df[2826];
     df[2824] = t7976*t475;
-    const double t7984 = df[2824];
-    const double t8443 = df[2893];
+    const MBPOL_POLY_REAL t7984 = df[2824];
+    const MBPOL_POLY_REAL t8443 = df[2893];
     df[2823] = t8443+t7984;
     df[2822] = df[2823];
     df[2821] = df[2822];
     df[2820] = df[2821];
-    const double t8444 = df[2877];
+    const MBPOL_POLY_REAL t8444 = df[2877];
     df[2818] = t8444+t7984;
     df[2817] = df[2822];
     df[2816] = df[2817];
     df[2815] = t7976*t155;
-    const double t7987 = df[2887];
-    const double t7988 = df[2885];
-    const double t7989 = df[2832];
-    const double t7990 = df[2815];
+    const MBPOL_POLY_REAL t7987 = df[2887];
+    const MBPOL_POLY_REAL t7988 = df[2885];
+    const MBPOL_POLY_REAL t7989 = df[2832];
+    const MBPOL_POLY_REAL t7990 = df[2815];
     df[2814] = t7987+t7988+t7989+t7990;
     df[2813] = df[2814];
     df[2811] = t7976*t143;
-    const double t7992 = df[2811];
-    const double t8445 = df[2891];
+    const MBPOL_POLY_REAL t7992 = df[2811];
+    const MBPOL_POLY_REAL t8445 = df[2891];
     df[2810] = t8445+t7992;
     df[2809] = df[2810];
     df[2808] = df[2809];
@@ -8093,15 +8093,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2805] = df[2807];
     df[2804] = df[2805];
     df[2803] = t7976*t146;
-    const double t7995 = df[2886];
-    const double t7996 = df[2879];
-    const double t7997 = df[2831];
-    const double t7998 = df[2803];
+    const MBPOL_POLY_REAL t7995 = df[2886];
+    const MBPOL_POLY_REAL t7996 = df[2879];
+    const MBPOL_POLY_REAL t7997 = df[2831];
+    const MBPOL_POLY_REAL t7998 = df[2803];
     df[2802] = t7995+t7996+t7997+t7998;
     df[2801] = df[2802];
     df[2800] = t7976*t309;
-    const double t8507 = df[2881];
-    const double t8508 = df[2800];
+    const MBPOL_POLY_REAL t8507 = df[2881];
+    const MBPOL_POLY_REAL t8508 = df[2800];
     df[2799] = t8507+t8508;
     df[2798] = df[2799];
     df[2797] = df[2798];
@@ -8109,20 +8109,20 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2794] = df[2795];
     df[2793] = df[2794];
     df[2792] = t7976*t212;
-    const double t8002 = df[2792];
-    const double t8525 = df[2888];
+    const MBPOL_POLY_REAL t8002 = df[2792];
+    const MBPOL_POLY_REAL t8525 = df[2888];
     df[2791] = t8525+t8002;
     df[2790] = df[2791];
     df[2789] = df[2790];
     df[2788] = df[2791];
     df[2787] = df[2788];
     df[2786] = t7967+t7976;
-    const double t8526 = df[2786];
+    const MBPOL_POLY_REAL t8526 = df[2786];
     df[2785] = t8526*t126;
     df[2783] = t8526*t132;
     df[2781] = t7976*t240;
     df[2780] = df[2781];
-    const double t8007 = df[2780];
+    const MBPOL_POLY_REAL t8007 = df[2780];
     df[2779] = t8444+t8007;
     df[2778] = df[2779];
     df[2777] = df[2778];
@@ -8130,18 +8130,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2775] = df[2776];
     df[2774] = df[2775];
     df[2773] = t7976*t179;
-    const double t8008 = df[2880];
-    const double t8009 = df[2773];
+    const MBPOL_POLY_REAL t8008 = df[2880];
+    const MBPOL_POLY_REAL t8009 = df[2773];
     df[2772] = t8008+t8009;
     df[2771] = df[2772];
     df[2770] = df[2771];
     df[2769] = df[2770];
     df[2767] = t8526*t136;
     df[2766] = t2404*t145;
-    const double t8011 = df[2948];
-    const double t8012 = df[2896];
-    const double t8013 = df[2849];
-    const double t8014 = df[2766];
+    const MBPOL_POLY_REAL t8011 = df[2948];
+    const MBPOL_POLY_REAL t8012 = df[2896];
+    const MBPOL_POLY_REAL t8013 = df[2849];
+    const MBPOL_POLY_REAL t8014 = df[2766];
     df[2765] = t7910+t7843+t7842+t7909+t8011+t8012+t8013+t8014;
     df[2764] = t7908+t7841+t7844+t7911+t8011+t8012+t8013+t8014;
     df[2763] = df[2765];
@@ -8149,7 +8149,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2761] = t2404*t132;
     df[2760] = t2404*t254;
     df[2759] = t2404*t309;
-    const double t8015 = df[2759];
+    const MBPOL_POLY_REAL t8015 = df[2759];
     df[2758] = t8147+t8015;
     df[2757] = t7885+t8015;
     df[2756] = t8427+t8015;
@@ -8159,88 +8159,88 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2751] = df[2752];
     df[2750] = df[2751];
     df[2748] = t139*t139;
-    const double t8018 = df[2748];
+    const MBPOL_POLY_REAL t8018 = df[2748];
     df[2747] = t7950+t8018;
     df[2746] = df[2747];
     df[2745] = t145+t139;
-    const double t8534 = df[2745];
+    const MBPOL_POLY_REAL t8534 = df[2745];
     df[2744] = t8534*t136;
     df[2742] = t8534*t132;
-    const double t8021 = df[2744];
-    const double t8022 = df[2742];
+    const MBPOL_POLY_REAL t8021 = df[2744];
+    const MBPOL_POLY_REAL t8022 = df[2742];
     df[2741] = t8021+t8022;
     df[2740] = df[2741];
     df[2738] = t8534*t126;
-    const double t8024 = df[2738];
-    const double t8026 = t8534*t77;
+    const MBPOL_POLY_REAL t8024 = df[2738];
+    const MBPOL_POLY_REAL t8026 = t8534*t77;
     df[2736] = t8021+t8022+t8024+t8026;
     df[2735] = df[2736];
     df[2734] = t8024+t8026;
     df[2733] = df[2734];
     df[2724] = t132*t132;
     df[2723] = t132*t126;
-    const double t8027 = df[2724];
-    const double t8028 = df[2723];
+    const MBPOL_POLY_REAL t8027 = df[2724];
+    const MBPOL_POLY_REAL t8028 = df[2723];
     df[2722] = t8027+t8028;
-    const double t8029 = t132*t77;
+    const MBPOL_POLY_REAL t8029 = t132*t77;
     df[2721] = t8029+t8027;
-    const double t8030 = t50*t50;
-    const double t8031 = t72*t72;
+    const MBPOL_POLY_REAL t8030 = t50*t50;
+    const MBPOL_POLY_REAL t8031 = t72*t72;
     df[2720] = t8030+t8031;
-    const double t8032 = t73*t73;
+    const MBPOL_POLY_REAL t8032 = t73*t73;
     df[2719] = t8030+t8032;
     df[2718] = df[2719];
     df[2717] = df[2720];
-    const double t8033 = t50*t37;
+    const MBPOL_POLY_REAL t8033 = t50*t37;
     df[2716] = t8033+t7925;
-    const double t8034 = t50*t26;
-    const double t8035 = t73*t26;
+    const MBPOL_POLY_REAL t8034 = t50*t26;
+    const MBPOL_POLY_REAL t8035 = t73*t26;
     df[2715] = t8034+t8035;
-    const double t8036 = t50*t20;
-    const double t8037 = t73*t20;
+    const MBPOL_POLY_REAL t8036 = t50*t20;
+    const MBPOL_POLY_REAL t8037 = t73*t20;
     df[2714] = t8036+t8037;
-    const double t8038 = t72*t26;
+    const MBPOL_POLY_REAL t8038 = t72*t26;
     df[2713] = t8036+t8038;
     df[2709] = t126*t126;
-    const double t8039 = t77*t77;
-    const double t8040 = df[2709];
+    const MBPOL_POLY_REAL t8039 = t77*t77;
+    const MBPOL_POLY_REAL t8040 = df[2709];
     df[2708] = t8039+t8040;
     df[2707] = df[2708];
     df[2706] = t8039+t7950+t8018+t8040;
     df[2705] = df[2706];
-    const double t8041 = t126*t77;
+    const MBPOL_POLY_REAL t8041 = t126*t77;
     df[2704] = t8041+t8040;
     df[2703] = t7951+t8041;
     df[2702] = df[2703];
     df[2701] = t77+t126;
-    const double t8042 = t8534*t67;
-    const double t8545 = df[2701];
-    const double t8044 = t8545*t73;
+    const MBPOL_POLY_REAL t8042 = t8534*t67;
+    const MBPOL_POLY_REAL t8545 = df[2701];
+    const MBPOL_POLY_REAL t8044 = t8545*t73;
     df[2700] = t8042+t8044;
     df[2699] = df[2700];
-    const double t8045 = t8534*t50;
-    const double t8047 = t8545*t72;
+    const MBPOL_POLY_REAL t8045 = t8534*t50;
+    const MBPOL_POLY_REAL t8047 = t8545*t72;
     df[2697] = t8045+t8047;
     df[2696] = df[2697];
-    const double t8048 = t8534*t73;
-    const double t8050 = t8545*t67;
+    const MBPOL_POLY_REAL t8048 = t8534*t73;
+    const MBPOL_POLY_REAL t8050 = t8545*t67;
     df[2694] = t8048+t8050;
     df[2693] = df[2694];
-    const double t8051 = t8534*t72;
-    const double t8053 = t8545*t50;
+    const MBPOL_POLY_REAL t8051 = t8534*t72;
+    const MBPOL_POLY_REAL t8053 = t8545*t50;
     df[2691] = t8051+t8053;
     df[2690] = df[2691];
-    const double t8054 = t8534*t37;
-    const double t8056 = t8545*t37;
+    const MBPOL_POLY_REAL t8054 = t8534*t37;
+    const MBPOL_POLY_REAL t8056 = t8545*t37;
     df[2688] = t8054+t8056;
-    const double t8058 = t8534*t20;
-    const double t8060 = t8545*t26;
+    const MBPOL_POLY_REAL t8058 = t8534*t20;
+    const MBPOL_POLY_REAL t8060 = t8545*t26;
     df[2686] = t8058+t8060;
     df[2684] = t77+t145+t139+t126;
     df[2682] = t254*t254;
     df[2681] = t254*t275;
-    const double t8061 = df[2682];
-    const double t8062 = df[2681];
+    const MBPOL_POLY_REAL t8061 = df[2682];
+    const MBPOL_POLY_REAL t8062 = df[2681];
     df[2680] = t8061+t8062;
     df[2679] = t254*t179;
     df[2678] = t254*t155;
@@ -8251,18 +8251,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2673] = t254*t132;
     df[2672] = t254*t126;
     df[2670] = t4135*t139;
-    const double t8063 = t7493*t20;
-    const double t8064 = t4135*t20;
+    const MBPOL_POLY_REAL t8063 = t7493*t20;
+    const MBPOL_POLY_REAL t8064 = t4135*t20;
     df[2669] = t8063+t8064;
-    const double t8065 = t7493*t26;
+    const MBPOL_POLY_REAL t8065 = t7493*t26;
     df[2668] = t8065+t8064;
     df[2667] = t4135*t212;
     df[2666] = t4135*t2341;
-    const double t8066 = df[2666];
+    const MBPOL_POLY_REAL t8066 = df[2666];
     df[2665] = t8066*t155;
     df[2664] = t8066*t475;
     df[2663] = df[2664];
-    const double t8067 = df[2663];
+    const MBPOL_POLY_REAL t8067 = df[2663];
     df[2662] = t7953+t8067;
     df[2661] = t8066*t132;
     df[2660] = t8066*t139;
@@ -8270,11 +8270,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2658] = t8066*t179;
     df[2657] = t8066*t136;
     df[2656] = t8066*t309;
-    const double t8068 = df[2656];
+    const MBPOL_POLY_REAL t8068 = df[2656];
     df[2655] = t7687+t8068;
     df[2654] = t7949+t8068;
     df[2652] = t8066*t240;
-    const double t8069 = df[2652];
+    const MBPOL_POLY_REAL t8069 = df[2652];
     df[2651] = t8067+t8069;
     df[2650] = df[2651];
     df[2649] = df[2650];
@@ -8287,8 +8287,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2640] = t8066*t215;
     df[2639] = df[2640];
     df[2638] = t8066*t212;
-    const double t8071 = df[2638];
-    const double t8571 = df[2639];
+    const MBPOL_POLY_REAL t8071 = df[2638];
+    const MBPOL_POLY_REAL t8571 = df[2639];
     df[2637] = t7974+t7690+t8571+t8071;
     df[2636] = t7694+t7693+t8571+t8071;
     df[2635] = t8571+t8071;
@@ -8297,7 +8297,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2632] = df[2633];
     df[2631] = t8066*t254;
     df[2630] = t8066*t143;
-    const double t8073 = df[2630];
+    const MBPOL_POLY_REAL t8073 = df[2630];
     df[2629] = t7948+t8073;
     df[2628] = t8068+t8073;
     df[2627] = df[2628];
@@ -8306,10 +8306,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2623] = df[2625];
     df[2622] = df[2623];
     df[2621] = t8066*t145;
-    const double t8076 = df[2665];
-    const double t8077 = df[2660];
-    const double t8078 = df[2659];
-    const double t8079 = df[2621];
+    const MBPOL_POLY_REAL t8076 = df[2665];
+    const MBPOL_POLY_REAL t8077 = df[2660];
+    const MBPOL_POLY_REAL t8078 = df[2659];
+    const MBPOL_POLY_REAL t8079 = df[2621];
     df[2620] = t7666+t7677+t7675+t7699+t8076+t8077+t8078+t8079;
     df[2619] = t7669+t7673+t7667+t7692+t8076+t8077+t8078+t8079;
     df[2618] = df[2620];
@@ -8319,12 +8319,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2614] = t7493*t37+t4135*t37;
     df[2613] = df[2614];
     df[2612] = t4135*t309;
-    const double t8082 = df[2612];
+    const MBPOL_POLY_REAL t8082 = df[2612];
     df[2611] = t8025+t8082;
     df[2610] = t7774+t8082;
     df[2608] = t4135*t155;
-    const double t8083 = t4135*t77;
-    const double t8084 = df[2615];
+    const MBPOL_POLY_REAL t8083 = t4135*t77;
+    const MBPOL_POLY_REAL t8084 = df[2615];
     df[2607] = t8083+t8084;
     df[2606] = df[2607];
     df[2605] = t7805+t7806+t8083+t8084;
@@ -8332,21 +8332,21 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2603] = df[2604];
     df[2602] = df[2605];
     df[2601] = t4135*t132;
-    const double t8085 = t4135*t26;
+    const MBPOL_POLY_REAL t8085 = t4135*t26;
     df[2600] = t8065+t8085;
     df[2599] = t8063+t8085;
     df[2598] = df[2600];
     df[2597] = t4135*t3120;
-    const double t8086 = df[2597];
+    const MBPOL_POLY_REAL t8086 = df[2597];
     df[2596] = t8086*t215;
     df[2595] = df[2596];
     df[2594] = t8086*t146;
     df[2593] = t8086*t143;
-    const double t8579 = df[2593];
+    const MBPOL_POLY_REAL t8579 = df[2593];
     df[2592] = t8004+t8579;
     df[2590] = t8086*t254;
     df[2589] = t8086*t240;
-    const double t8088 = df[2589];
+    const MBPOL_POLY_REAL t8088 = df[2589];
     df[2588] = t8579+t8088;
     df[2587] = df[2588];
     df[2586] = df[2587];
@@ -8356,14 +8356,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2582] = t7731+t8088;
     df[2581] = t7922+t8088;
     df[2579] = t8086*t475;
-    const double t8583 = df[2579];
+    const MBPOL_POLY_REAL t8583 = df[2579];
     df[2578] = t7999+t8583;
     df[2576] = t8086*t212;
     df[2574] = t8086*t145;
     df[2573] = t8086*t179;
     df[2572] = t8086*t139;
     df[2571] = t8086*t309;
-    const double t8091 = df[2571];
+    const MBPOL_POLY_REAL t8091 = df[2571];
     df[2570] = t7928+t8091;
     df[2569] = t8583+t8091;
     df[2568] = df[2569];
@@ -8372,27 +8372,27 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2565] = df[2566];
     df[2564] = df[2565];
     df[2562] = t8086*t275;
-    const double t8093 = df[2590];
-    const double t8094 = df[2562];
+    const MBPOL_POLY_REAL t8093 = df[2590];
+    const MBPOL_POLY_REAL t8094 = df[2562];
     df[2561] = t8093+t8094;
     df[2560] = df[2561];
     df[2559] = df[2560];
     df[2558] = df[2559];
     df[2557] = t8086*t155;
     df[2556] = t4135*t3116;
-    const double t8095 = df[2556];
+    const MBPOL_POLY_REAL t8095 = df[2556];
     df[2555] = t8095*t275;
-    const double t8096 = df[2555];
+    const MBPOL_POLY_REAL t8096 = df[2555];
     df[2554] = t8094+t8096;
     df[2553] = df[2554];
     df[2552] = df[2553];
     df[2551] = df[2552];
     df[2550] = df[2551];
     df[2549] = t8095*t146;
-    const double t8097 = df[2594];
-    const double t8098 = df[2549];
+    const MBPOL_POLY_REAL t8097 = df[2594];
+    const MBPOL_POLY_REAL t8098 = df[2549];
     df[2548] = t8097+t8098;
-    const double t8099 = df[2557];
+    const MBPOL_POLY_REAL t8099 = df[2557];
     df[2547] = t8099+t8098;
     df[2546] = df[2547];
     df[2545] = t7726+t7725+t8099+t8098;
@@ -8400,7 +8400,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2543] = df[2544];
     df[2542] = df[2545];
     df[2541] = t8095*t254;
-    const double t8100 = df[2541];
+    const MBPOL_POLY_REAL t8100 = df[2541];
     df[2540] = t8093+t8100;
     df[2539] = df[2540];
     df[2538] = t7947+t7637+t7709+t7716+t8093+t8094+t8096+t8100;
@@ -8421,8 +8421,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2523] = df[2524];
     df[2522] = df[2523];
     df[2521] = t8095*t179;
-    const double t8101 = df[2573];
-    const double t8102 = df[2521];
+    const MBPOL_POLY_REAL t8101 = df[2573];
+    const MBPOL_POLY_REAL t8102 = df[2521];
     df[2520] = t7710+t7711+t8101+t8102;
     df[2519] = t8101+t8102;
     df[2518] = df[2519];
@@ -8437,17 +8437,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2509] = df[2510];
     df[2508] = df[2509];
     df[2507] = t8086+t8095;
-    const double t8103 = df[3799];
-    const double t8104 = t8103*t20;
-    const double t8585 = df[2507];
-    const double t8106 = t8585*t20;
+    const MBPOL_POLY_REAL t8103 = df[3799];
+    const MBPOL_POLY_REAL t8104 = t8103*t20;
+    const MBPOL_POLY_REAL t8585 = df[2507];
+    const MBPOL_POLY_REAL t8106 = t8585*t20;
     df[2506] = t8104+t8106;
-    const double t8107 = df[3857];
-    const double t8108 = t8107*t26;
+    const MBPOL_POLY_REAL t8107 = df[3857];
+    const MBPOL_POLY_REAL t8108 = t8107*t26;
     df[2505] = t8108+t8106;
     df[2504] = t8095*t139;
-    const double t8109 = df[2574];
-    const double t8110 = df[2504];
+    const MBPOL_POLY_REAL t8109 = df[2574];
+    const MBPOL_POLY_REAL t8110 = df[2504];
     df[2503] = t7713+t7715+t7723+t7738+t8109+t8099+t8098+t8110;
     df[2502] = t7714+t7722+t7712+t7737+t8109+t8099+t8098+t8110;
     df[2501] = df[2503];
@@ -8460,15 +8460,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2494] = t7726+t7725+t8109+t8110;
     df[2493] = df[2494];
     df[2492] = df[2495];
-    const double t8111 = t8107*t67;
-    const double t8113 = t8585*t73;
+    const MBPOL_POLY_REAL t8111 = t8107*t67;
+    const MBPOL_POLY_REAL t8113 = t8585*t73;
     df[2490] = t8111+t8113;
-    const double t8114 = t8103*t50;
+    const MBPOL_POLY_REAL t8114 = t8103*t50;
     df[2489] = t8114+t8113;
     df[2488] = df[2490];
     df[2487] = df[2489];
     df[2486] = t8095*t155;
-    const double t8115 = df[2486];
+    const MBPOL_POLY_REAL t8115 = df[2486];
     df[2485] = t8099+t8115;
     df[2484] = df[2485];
     df[2483] = t8097+t8115;
@@ -8478,9 +8478,9 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2479] = df[2480];
     df[2478] = df[2481];
     df[2477] = t8095*t145;
-    const double t8116 = df[2477];
+    const MBPOL_POLY_REAL t8116 = df[2477];
     df[2476] = t8109+t8116;
-    const double t8117 = df[2572];
+    const MBPOL_POLY_REAL t8117 = df[2572];
     df[2475] = t7714+t7722+t7712+t7737+t8097+t8117+t8115+t8116;
     df[2474] = t7713+t7715+t7723+t7738+t8097+t8117+t8115+t8116;
     df[2473] = df[2475];
@@ -8494,7 +8494,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2465] = df[2466];
     df[2464] = df[2467];
     df[2463] = t8095*t240;
-    const double t8118 = df[2463];
+    const MBPOL_POLY_REAL t8118 = df[2463];
     df[2462] = t7928+t8118;
     df[2461] = t7922+t7728+t8088+t8118;
     df[2460] = t8583+t8118;
@@ -8506,7 +8506,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2453] = df[2454];
     df[2451] = t8585*t126;
     df[2450] = t8095*t309;
-    const double t8121 = df[2450];
+    const MBPOL_POLY_REAL t8121 = df[2450];
     df[2449] = t7731+t8121;
     df[2448] = t7922+t7728+t8091+t8121;
     df[2447] = t8579+t8121;
@@ -8515,8 +8515,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2443] = df[2447];
     df[2442] = df[2443];
     df[2441] = df[2442];
-    const double t8124 = df[2451];
-    const double t8126 = t8585*t77;
+    const MBPOL_POLY_REAL t8124 = df[2451];
+    const MBPOL_POLY_REAL t8126 = t8585*t77;
     df[2439] = t8124+t8126;
     df[2438] = df[2439];
     df[2437] = t7722+t7737+t7723+t7738+t8124+t8126;
@@ -8524,11 +8524,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2435] = df[2436];
     df[2434] = df[2437];
     df[2432] = df[2507];
-    const double t8611 = df[2432];
+    const MBPOL_POLY_REAL t8611 = df[2432];
     df[2431] = t8611*t132;
-    const double t8129 = df[3800]*t73;
-    const double t8130 = df[3799]*t72;
-    const double t8132 = t8611*t72;
+    const MBPOL_POLY_REAL t8129 = df[3800]*t73;
+    const MBPOL_POLY_REAL t8130 = df[3799]*t72;
+    const MBPOL_POLY_REAL t8132 = t8611*t72;
     df[2429] = t8129+t8130+t8113+t8132;
     df[2428] = df[2429];
     df[2427] = t8114+t8132;
@@ -8536,16 +8536,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2425] = df[2427];
     df[2424] = df[2426];
     df[2423] = t8611;
-    const double t8612 = df[2423];
-    const double t8134 = t8612*t26;
+    const MBPOL_POLY_REAL t8612 = df[2423];
+    const MBPOL_POLY_REAL t8134 = t8612*t26;
     df[2422] = t8108+t8134;
     df[2421] = t8104+t8134;
     df[2420] = df[2422];
     df[2419] = t8095*t215;
-    const double t8135 = df[2419];
-    const double t8613 = df[2595];
+    const MBPOL_POLY_REAL t8135 = df[2419];
+    const MBPOL_POLY_REAL t8613 = df[2595];
     df[2418] = t8613+t8135;
-    const double t8136 = df[2576];
+    const MBPOL_POLY_REAL t8136 = df[2576];
     df[2417] = t7947+t7637+t8136+t8135;
     df[2416] = t7709+t7716+t8136+t8135;
     df[2415] = t7718+t7730+t8136+t8135;
@@ -8562,7 +8562,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2403] = df[2404];
     df[2402] = df[2403];
     df[2401] = t8095*t212;
-    const double t8138 = df[2401];
+    const MBPOL_POLY_REAL t8138 = df[2401];
     df[2400] = t7709+t7716+t8613+t8138;
     df[2399] = t7947+t7637+t8613+t8138;
     df[2398] = t7720+t7719+t8613+t8138;
@@ -8578,13 +8578,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2388] = df[2389];
     df[2387] = df[2388];
     df[2386] = df[2387];
-    const double t8141 = t8612*t67;
+    const MBPOL_POLY_REAL t8141 = t8612*t67;
     df[2384] = t8129+t8141;
     df[2383] = t8130+t8141;
     df[2382] = df[2383];
     df[2381] = df[2384];
     df[2380] = t8095*t143;
-    const double t8142 = df[2380];
+    const MBPOL_POLY_REAL t8142 = df[2380];
     df[2379] = t7923+t8142;
     df[2378] = t8118+t8142;
     df[2377] = df[2378];
@@ -8609,15 +8609,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2357] = df[2359];
     df[2355] = t8103*t37+t8612*t37;
     df[2354] = df[2355];
-    const double t8149 = t8612*t50;
+    const MBPOL_POLY_REAL t8149 = t8612*t50;
     df[2352] = t8130+t8149;
     df[2351] = t8129+t8149;
     df[2350] = df[2351];
     df[2349] = df[2352];
     df[2348] = t7615+t7705+t8086+t8095;
     df[2346] = t8612*t136;
-    const double t8151 = df[2431];
-    const double t8152 = df[2346];
+    const MBPOL_POLY_REAL t8151 = df[2431];
+    const MBPOL_POLY_REAL t8152 = df[2346];
     df[2345] = t8151+t8152;
     df[2344] = df[2345];
     df[2343] = t8124+t8126+t8151+t8152;
@@ -8627,7 +8627,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2339] = df[2340];
     df[2338] = df[2341];
     df[2337] = t8095*t475;
-    const double t8153 = df[2337];
+    const MBPOL_POLY_REAL t8153 = df[2337];
     df[2336] = t8121+t8153;
     df[2335] = t8088+t8153;
     df[2334] = df[2336];
@@ -8654,8 +8654,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2312] = df[2316];
     df[2311] = t7493+t4135;
     df[2309] = t4135*t146;
-    const double t8156 = df[2608];
-    const double t8157 = df[2309];
+    const MBPOL_POLY_REAL t8156 = df[2608];
+    const MBPOL_POLY_REAL t8157 = df[2309];
     df[2308] = t8156+t8157;
     df[2307] = df[2308];
     df[2306] = t7772+t7773+t8156+t8157;
@@ -8663,24 +8663,24 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2304] = df[2305];
     df[2303] = df[2306];
     df[2302] = t4135*t179;
-    const double t8158 = df[3913];
-    const double t8159 = df[2302];
+    const MBPOL_POLY_REAL t8158 = df[3913];
+    const MBPOL_POLY_REAL t8159 = df[2302];
     df[2301] = t8158+t8159;
     df[2300] = df[2301];
     df[2299] = df[2300];
     df[2298] = df[2299];
     df[2297] = df[2298];
     df[2296] = t4135*t4135;
-    const double t8160 = df[2296];
+    const MBPOL_POLY_REAL t8160 = df[2296];
     df[2295] = t7739+t8160;
     df[2294] = t8160*t139;
     df[2293] = t8160*t309;
-    const double t8161 = df[2293];
+    const MBPOL_POLY_REAL t8161 = df[2293];
     df[2292] = t8019+t8161;
     df[2291] = t7757+t8161;
     df[2289] = t8160*t126;
-    const double t8162 = t8160*t77;
-    const double t8163 = df[2289];
+    const MBPOL_POLY_REAL t8162 = t8160*t77;
+    const MBPOL_POLY_REAL t8163 = df[2289];
     df[2288] = t8162+t8163;
     df[2287] = df[2288];
     df[2286] = t7743+t7744+t8162+t8163;
@@ -8688,14 +8688,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2284] = df[2286];
     df[2283] = df[2285];
     df[2282] = t8160*t240;
-    const double t8164 = df[2282];
+    const MBPOL_POLY_REAL t8164 = df[2282];
     df[2281] = t7757+t8164;
     df[2280] = t8019+t8164;
     df[2279] = df[2281];
     df[2277] = t8160*t132;
     df[2276] = t8160*t155;
     df[2275] = t8160*t143;
-    const double t8165 = df[2275];
+    const MBPOL_POLY_REAL t8165 = df[2275];
     df[2274] = t7746+t8165;
     df[2273] = t8164+t8165;
     df[2272] = df[2273];
@@ -8710,8 +8710,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2262] = df[2264];
     df[2261] = df[2262];
     df[2260] = t8160*t145;
-    const double t8168 = df[2294];
-    const double t8169 = df[2260];
+    const MBPOL_POLY_REAL t8168 = df[2294];
+    const MBPOL_POLY_REAL t8169 = df[2260];
     df[2259] = t8168+t8169;
     df[2258] = df[2259];
     df[2257] = t7749+t7750+t8168+t8169;
@@ -8719,8 +8719,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2255] = df[2256];
     df[2254] = df[2257];
     df[2253] = t8160*t146;
-    const double t8170 = df[2276];
-    const double t8171 = df[2253];
+    const MBPOL_POLY_REAL t8170 = df[2276];
+    const MBPOL_POLY_REAL t8171 = df[2253];
     df[2252] = t7753+t7743+t7744+t7754+t8168+t8170+t8169+t8171;
     df[2251] = df[2252];
     df[2250] = df[2251];
@@ -8734,7 +8734,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2242] = df[2243];
     df[2241] = df[2244];
     df[2240] = t8160*t475;
-    const double t8172 = df[2240];
+    const MBPOL_POLY_REAL t8172 = df[2240];
     df[2239] = t8161+t8172;
     df[2238] = df[2239];
     df[2237] = df[2238];
@@ -8760,16 +8760,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2216] = df[2219];
     df[2215] = t8160*t254;
     df[2213] = t8160*t179;
-    const double t8176 = df[3724];
-    const double t8177 = df[2213];
+    const MBPOL_POLY_REAL t8176 = df[3724];
+    const MBPOL_POLY_REAL t8177 = df[2213];
     df[2212] = t8176+t8177;
     df[2211] = df[2212];
     df[2210] = df[2211];
     df[2209] = df[2210];
     df[2208] = df[2209];
     df[2207] = t8160*t275;
-    const double t8178 = df[2215];
-    const double t8179 = df[2207];
+    const MBPOL_POLY_REAL t8178 = df[2215];
+    const MBPOL_POLY_REAL t8179 = df[2207];
     df[2206] = t8020+t7755+t8178+t8179;
     df[2205] = t8178+t8179;
     df[2204] = df[2205];
@@ -8783,40 +8783,40 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2196] = df[2197];
     df[2195] = df[2196];
     df[2194] = df[2195];
-    const double t8180 = t7739*t73;
-    const double t8181 = t8160*t67;
+    const MBPOL_POLY_REAL t8180 = t7739*t73;
+    const MBPOL_POLY_REAL t8181 = t8160*t67;
     df[2193] = t8180+t8181;
-    const double t8182 = t7739*t72;
+    const MBPOL_POLY_REAL t8182 = t7739*t72;
     df[2192] = t8182+t8181;
     df[2191] = df[2192];
     df[2190] = df[2193];
-    const double t8183 = t7739*t50;
-    const double t8184 = t8160*t72;
+    const MBPOL_POLY_REAL t8183 = t7739*t50;
+    const MBPOL_POLY_REAL t8184 = t8160*t72;
     df[2189] = t8183+t8184;
-    const double t8185 = t7739*t67;
+    const MBPOL_POLY_REAL t8185 = t7739*t67;
     df[2188] = t8185+t8184;
     df[2187] = df[2188];
     df[2186] = df[2189];
-    const double t8186 = t7739*t26;
-    const double t8187 = t8160*t26;
+    const MBPOL_POLY_REAL t8186 = t7739*t26;
+    const MBPOL_POLY_REAL t8187 = t8160*t26;
     df[2185] = t8186+t8187;
     df[2184] = df[2185];
-    const double t8188 = t7739*t20;
+    const MBPOL_POLY_REAL t8188 = t7739*t20;
     df[2183] = t8188+t8187;
-    const double t8189 = t8160*t20;
+    const MBPOL_POLY_REAL t8189 = t8160*t20;
     df[2182] = t8188+t8189;
     df[2181] = t8186+t8189;
     df[2180] = t8160*t212;
     df[2179] = t8182+t8180+t8160*t7912;
     df[2178] = df[2179];
-    const double t8191 = t8160*t73;
+    const MBPOL_POLY_REAL t8191 = t8160*t73;
     df[2177] = t8185+t8191;
     df[2176] = t8183+t8191;
     df[2175] = df[2177];
     df[2174] = df[2176];
     df[2173] = t8160*t136;
-    const double t8192 = df[2277];
-    const double t8193 = df[2173];
+    const MBPOL_POLY_REAL t8192 = df[2277];
+    const MBPOL_POLY_REAL t8193 = df[2173];
     df[2172] = t8192+t8193;
     df[2171] = df[2172];
     df[2170] = t8162+t8163+t8192+t8193;
@@ -8825,7 +8825,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2167] = t7743+t7744+t8192+t8193;
     df[2166] = df[2167];
     df[2165] = df[2168];
-    const double t8194 = t8160*t50;
+    const MBPOL_POLY_REAL t8194 = t8160*t50;
     df[2164] = t8182+t8194;
     df[2163] = t8180+t8194;
     df[2162] = df[2163];
@@ -8833,8 +8833,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2160] = t7739*t37+t8160*t37;
     df[2159] = df[2160];
     df[2158] = t8160*t215;
-    const double t8197 = df[2180];
-    const double t8198 = df[2158];
+    const MBPOL_POLY_REAL t8197 = df[2180];
+    const MBPOL_POLY_REAL t8198 = df[2158];
     df[2157] = t8020+t7755+t8197+t8198;
     df[2156] = df[2157];
     df[2155] = t7751+t7752+t8197+t8198;
@@ -8851,12 +8851,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2143] = df[2144];
     df[2142] = df[2143];
     df[2141] = t4135*t240;
-    const double t8655 = df[2141];
+    const MBPOL_POLY_REAL t8655 = df[2141];
     df[2140] = t8025+t8655;
     df[2138] = t7774+t8655;
     df[2137] = df[2138];
     df[2136] = t4135*t143;
-    const double t8202 = df[2136];
+    const MBPOL_POLY_REAL t8202 = df[2136];
     df[2135] = t8023+t8202;
     df[2134] = t8655+t8202;
     df[2133] = df[2134];
@@ -8870,23 +8870,23 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2125] = df[2132];
     df[2123] = df[2125];
     df[2122] = df[2123];
-    const double t8205 = t7493*t72;
-    const double t8206 = t4135*t50;
+    const MBPOL_POLY_REAL t8205 = t7493*t72;
+    const MBPOL_POLY_REAL t8206 = t4135*t50;
     df[2121] = t8205+t8206;
-    const double t8207 = t7493*t73;
+    const MBPOL_POLY_REAL t8207 = t7493*t73;
     df[2120] = t8207+t8206;
     df[2119] = df[2120];
     df[2118] = df[2121];
-    const double t8208 = t7493*t50;
-    const double t8209 = t4135*t72;
+    const MBPOL_POLY_REAL t8208 = t7493*t50;
+    const MBPOL_POLY_REAL t8209 = t4135*t72;
     df[2117] = t8208+t8209;
-    const double t8210 = t7493*t67;
+    const MBPOL_POLY_REAL t8210 = t7493*t67;
     df[2116] = t8210+t8209;
     df[2115] = df[2116];
     df[2114] = df[2117];
     df[2113] = t4135*t215;
-    const double t8211 = df[2667];
-    const double t8212 = df[2113];
+    const MBPOL_POLY_REAL t8211 = df[2667];
+    const MBPOL_POLY_REAL t8212 = df[2113];
     df[2112] = t8046+t7764+t8211+t8212;
     df[2111] = df[2112];
     df[2110] = t7770+t7771+t8211+t8212;
@@ -8904,25 +8904,25 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2097] = df[2098];
     df[2096] = t7493*t7912+t4135*t7912;
     df[2095] = df[2096];
-    const double t8216 = t4135*t73;
+    const MBPOL_POLY_REAL t8216 = t4135*t73;
     df[2094] = t8210+t8216;
     df[2093] = t8208+t8216;
     df[2092] = df[2093];
     df[2091] = df[2094];
     df[2090] = t4135*t2404;
-    const double t8217 = df[2090];
+    const MBPOL_POLY_REAL t8217 = df[2090];
     df[2089] = t8066+t8217;
-    const double t8218 = df[4025];
-    const double t8219 = t8218*t20;
-    const double t8673 = df[2089];
-    const double t8221 = t8673*t20;
+    const MBPOL_POLY_REAL t8218 = df[4025];
+    const MBPOL_POLY_REAL t8219 = t8218*t20;
+    const MBPOL_POLY_REAL t8673 = df[2089];
+    const MBPOL_POLY_REAL t8221 = t8673*t20;
     df[2088] = t8219+t8221;
-    const double t8222 = df[4029]*t26;
+    const MBPOL_POLY_REAL t8222 = df[4029]*t26;
     df[2087] = t8222+t8221;
     df[2086] = t7641+t7661+t8066+t8217;
     df[2085] = t8217*t179;
-    const double t8223 = df[2658];
-    const double t8224 = df[2085];
+    const MBPOL_POLY_REAL t8223 = df[2658];
+    const MBPOL_POLY_REAL t8224 = df[2085];
     df[2084] = t7680+t7681+t8223+t8224;
     df[2083] = t8223+t8224;
     df[2082] = df[2083];
@@ -8937,8 +8937,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2073] = df[2074];
     df[2072] = df[2073];
     df[2071] = t8217*t275;
-    const double t8225 = df[2631];
-    const double t8226 = df[2071];
+    const MBPOL_POLY_REAL t8225 = df[2631];
+    const MBPOL_POLY_REAL t8226 = df[2071];
     df[2070] = t7974+t7690+t8225+t8226;
     df[2069] = t8225+t8226;
     df[2068] = df[2069];
@@ -8953,14 +8953,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2059] = df[2060];
     df[2058] = df[2059];
     df[2057] = t8217*t212;
-    const double t8227 = df[2057];
+    const MBPOL_POLY_REAL t8227 = df[2057];
     df[2056] = t8071+t8227;
     df[2055] = df[2056];
     df[2054] = df[2055];
     df[2053] = df[2054];
     df[2052] = df[2053];
-    const double t8228 = df[2643];
-    const double t8229 = t8217*t77;
+    const MBPOL_POLY_REAL t8228 = df[2643];
+    const MBPOL_POLY_REAL t8229 = t8217*t77;
     df[2051] = t8228+t8229;
     df[2050] = df[2051];
     df[2049] = t7666+t7699+t8228+t8229;
@@ -8968,24 +8968,24 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2047] = df[2049];
     df[2046] = df[2048];
     df[2045] = t8217*t155;
-    const double t8230 = df[2045];
+    const MBPOL_POLY_REAL t8230 = df[2045];
     df[2044] = t8076+t8230;
     df[2043] = df[2044];
     df[2042] = df[2043];
     df[2041] = df[2042];
-    const double t8231 = t7671*t73;
-    const double t8233 = t8673*t67;
+    const MBPOL_POLY_REAL t8231 = t7671*t73;
+    const MBPOL_POLY_REAL t8233 = t8673*t67;
     df[2039] = t8231+t8233;
-    const double t8234 = t7958*t72;
+    const MBPOL_POLY_REAL t8234 = t7958*t72;
     df[2038] = t8234+t8233;
     df[2037] = df[2038];
     df[2036] = df[2039];
     df[2035] = t8217*t136;
-    const double t8235 = df[2657];
-    const double t8236 = df[2035];
+    const MBPOL_POLY_REAL t8235 = df[2657];
+    const MBPOL_POLY_REAL t8236 = df[2035];
     df[2034] = t8235+t8236;
     df[2033] = df[2034];
-    const double t8237 = df[2661];
+    const MBPOL_POLY_REAL t8237 = df[2661];
     df[2032] = t8237+t8236;
     df[2031] = df[2032];
     df[2030] = t7673+t7692+t8237+t8236;
@@ -8993,7 +8993,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2028] = df[2030];
     df[2027] = df[2029];
     df[2026] = t8217*t475;
-    const double t8238 = df[2026];
+    const MBPOL_POLY_REAL t8238 = df[2026];
     df[2025] = t7953+t7662+t8067+t8238;
     df[2024] = t8068+t8238;
     df[2023] = df[2024];
@@ -9004,7 +9004,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2017] = df[2024];
     df[2016] = df[2017];
     df[2015] = t8217*t146;
-    const double t8240 = df[2015];
+    const MBPOL_POLY_REAL t8240 = df[2015];
     df[2014] = t8078+t8240;
     df[2013] = df[2014];
     df[2012] = df[2013];
@@ -9015,17 +9015,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[2007] = df[2008];
     df[2006] = df[2009];
     df[2005] = t8673;
-    const double t8675 = df[2005];
+    const MBPOL_POLY_REAL t8675 = df[2005];
     df[2004] = t7671*t37+t8675*t37;
     df[2003] = df[2004];
-    const double t8245 = t8675*t26;
+    const MBPOL_POLY_REAL t8245 = t8675*t26;
     df[2001] = t8222+t8245;
     df[2000] = df[2001];
     df[1999] = t8219+t8245;
     df[1997] = t8217*t254;
-    const double t8247 = df[1997];
+    const MBPOL_POLY_REAL t8247 = df[1997];
     df[1996] = t8225+t8247;
-    const double t8248 = df[2641];
+    const MBPOL_POLY_REAL t8248 = df[2641];
     df[1995] = t7694+t7693+t8248+t8247;
     df[1994] = t8248+t8247;
     df[1993] = df[1994];
@@ -9040,7 +9040,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1984] = df[1985];
     df[1983] = df[1984];
     df[1982] = t8217*t309;
-    const double t8249 = df[1982];
+    const MBPOL_POLY_REAL t8249 = df[1982];
     df[1981] = t7654+t8249;
     df[1980] = t7957+t8249;
     df[1979] = t8067+t8249;
@@ -9050,7 +9050,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1975] = df[1976];
     df[1974] = df[1978];
     df[1972] = t8217*t240;
-    const double t8250 = df[1972];
+    const MBPOL_POLY_REAL t8250 = df[1972];
     df[1971] = t8238+t8250;
     df[1970] = t8068+t8073+t8238+t8250;
     df[1969] = df[1970];
@@ -9076,16 +9076,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1948] = df[1950];
     df[1947] = df[1965];
     df[1946] = df[2089];
-    const double t8253 = df[4027]*t50;
-    const double t8681 = df[1946];
-    const double t8255 = t8681*t72;
+    const MBPOL_POLY_REAL t8253 = df[4027]*t50;
+    const MBPOL_POLY_REAL t8681 = df[1946];
+    const MBPOL_POLY_REAL t8255 = t8681*t72;
     df[1945] = t8253+t8255;
-    const double t8256 = df[4028]*t67;
+    const MBPOL_POLY_REAL t8256 = df[4028]*t67;
     df[1944] = t8256+t8255;
     df[1943] = df[1944];
     df[1942] = df[1945];
     df[1941] = t8217*t143;
-    const double t8257 = df[1941];
+    const MBPOL_POLY_REAL t8257 = df[1941];
     df[1940] = t7696+t8257;
     df[1939] = t8069+t8257;
     df[1938] = df[1939];
@@ -9109,7 +9109,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1919] = df[1920];
     df[1918] = df[1919];
     df[1917] = t8217*t215;
-    const double t8260 = df[1917];
+    const MBPOL_POLY_REAL t8260 = df[1917];
     df[1916] = t8571+t8260;
     df[1915] = df[1916];
     df[1914] = t7694+t7693+t8227+t8260;
@@ -9131,12 +9131,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1897] = df[1898];
     df[1896] = df[1897];
     df[1895] = df[1896];
-    const double t8263 = t8681*t50;
+    const MBPOL_POLY_REAL t8263 = t8681*t50;
     df[1893] = t8234+t8263;
     df[1892] = t8231+t8263;
     df[1891] = df[1892];
     df[1890] = df[1893];
-    const double t8265 = t8681*t73;
+    const MBPOL_POLY_REAL t8265 = t8681*t73;
     df[1888] = t8231+t8234+t8255+t8265;
     df[1887] = df[1888];
     df[1886] = t8256+t8265;
@@ -9144,9 +9144,9 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1884] = df[1885];
     df[1883] = df[1886];
     df[1882] = t8217*t126;
-    const double t8266 = df[1882];
+    const MBPOL_POLY_REAL t8266 = df[1882];
     df[1881] = t8228+t8266;
-    const double t8267 = t8066*t77;
+    const MBPOL_POLY_REAL t8267 = t8066*t77;
     df[1880] = t8267+t8266;
     df[1879] = df[1880];
     df[1878] = t8237+t8267+t8236+t8266;
@@ -9156,7 +9156,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1874] = df[1876];
     df[1873] = df[1875];
     df[1872] = t8217*t132;
-    const double t8268 = df[1872];
+    const MBPOL_POLY_REAL t8268 = df[1872];
     df[1871] = t8237+t8268;
     df[1870] = t8235+t8268;
     df[1869] = df[1870];
@@ -9167,11 +9167,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1864] = df[1865];
     df[1863] = df[1866];
     df[1862] = t8217*t145;
-    const double t8269 = df[1862];
+    const MBPOL_POLY_REAL t8269 = df[1862];
     df[1861] = t8079+t8269;
     df[1860] = df[1861];
     df[1859] = t8217*t139;
-    const double t8270 = df[1859];
+    const MBPOL_POLY_REAL t8270 = df[1859];
     df[1858] = t8077+t8270;
     df[1857] = t7669+t7673+t7667+t7692+t8230+t8240+t8269+t8270;
     df[1856] = t7666+t7677+t7675+t7699+t8230+t8240+t8269+t8270;
@@ -9186,8 +9186,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1847] = df[1848];
     df[1846] = df[1849];
     df[1845] = t4135*t145;
-    const double t8271 = df[2670];
-    const double t8272 = df[1845];
+    const MBPOL_POLY_REAL t8271 = df[2670];
+    const MBPOL_POLY_REAL t8272 = df[1845];
     df[1844] = t7766+t7767+t7805+t7806+t8271+t8156+t8157+t8272;
     df[1843] = df[1844];
     df[1842] = df[1843];
@@ -9201,8 +9201,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1834] = df[1835];
     df[1833] = df[1836];
     df[1832] = t4135*t136;
-    const double t8273 = df[2601];
-    const double t8274 = df[1832];
+    const MBPOL_POLY_REAL t8273 = df[2601];
+    const MBPOL_POLY_REAL t8274 = df[1832];
     df[1831] = t8273+t8274;
     df[1830] = df[1831];
     df[1829] = t8083+t8084+t8273+t8274;
@@ -9212,7 +9212,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1825] = df[1827];
     df[1824] = df[1826];
     df[1823] = t4135*t475;
-    const double t8275 = df[1823];
+    const MBPOL_POLY_REAL t8275 = df[1823];
     df[1822] = t8082+t8275;
     df[1821] = df[1822];
     df[1820] = t8023+t8025+t8043+t7774+t8082+t8655+t8202+t8275;
@@ -9237,8 +9237,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1800] = t8043+t8275;
     df[1799] = df[1800];
     df[1798] = t4135*t275;
-    const double t8277 = df[2616];
-    const double t8278 = df[1798];
+    const MBPOL_POLY_REAL t8277 = df[2616];
+    const MBPOL_POLY_REAL t8278 = df[1798];
     df[1797] = t8046+t7764+t8277+t8278;
     df[1796] = t8277+t8278;
     df[1795] = df[1796];
@@ -9252,14 +9252,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1787] = df[1788];
     df[1786] = df[1787];
     df[1785] = df[1786];
-    const double t8279 = t4135*t67;
+    const MBPOL_POLY_REAL t8279 = t4135*t67;
     df[1784] = t8207+t8279;
     df[1783] = t8205+t8279;
     df[1782] = df[1783];
     df[1781] = df[1784];
     df[1779] = t2341*t275;
-    const double t8280 = df[2760];
-    const double t8281 = df[1779];
+    const MBPOL_POLY_REAL t8280 = df[2760];
+    const MBPOL_POLY_REAL t8281 = df[1779];
     df[1778] = t7900+t7899+t8280+t8281;
     df[1777] = t8280+t8281;
     df[1776] = df[1777];
@@ -9274,16 +9274,16 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1767] = df[1768];
     df[1766] = df[1767];
     df[1765] = t2341*t3120;
-    const double t8282 = df[1765];
+    const MBPOL_POLY_REAL t8282 = df[1765];
     df[1764] = t8282*t215;
-    const double t8688 = df[1764];
+    const MBPOL_POLY_REAL t8688 = df[1764];
     df[1763] = t8437+t8688;
     df[1762] = df[1763];
     df[1761] = df[1762];
     df[1760] = df[1761];
     df[1759] = df[1760];
     df[1757] = t8282*t309;
-    const double t8284 = df[1757];
+    const MBPOL_POLY_REAL t8284 = df[1757];
     df[1756] = t7984+t8284;
     df[1755] = df[1756];
     df[1754] = df[1755];
@@ -9291,13 +9291,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1752] = df[1753];
     df[1751] = df[1754];
     df[1749] = t8282*t254;
-    const double t8285 = df[1749];
+    const MBPOL_POLY_REAL t8285 = df[1749];
     df[1748] = t7983+t8285;
     df[1747] = df[1748];
     df[1746] = df[1747];
     df[1745] = df[1746];
     df[1744] = t8282*t240;
-    const double t8286 = df[1744];
+    const MBPOL_POLY_REAL t8286 = df[1744];
     df[1743] = t7992+t8286;
     df[1742] = df[1743];
     df[1741] = df[1742];
@@ -9307,13 +9307,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1736] = t8443+t8286;
     df[1735] = df[1743];
     df[1734] = t8282*t179;
-    const double t8288 = df[1734];
+    const MBPOL_POLY_REAL t8288 = df[1734];
     df[1733] = t8009+t8288;
     df[1732] = df[1733];
     df[1731] = df[1732];
     df[1730] = df[1731];
     df[1729] = t8282*t475;
-    const double t8689 = df[1729];
+    const MBPOL_POLY_REAL t8689 = df[1729];
     df[1728] = t8508+t8689;
     df[1727] = df[1728];
     df[1725] = df[1728];
@@ -9324,31 +9324,31 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1720] = df[1723];
     df[1719] = t7984+t8689;
     df[1718] = t8282*t139;
-    const double t8291 = df[1718];
+    const MBPOL_POLY_REAL t8291 = df[1718];
     df[1717] = t7997+t8291;
     df[1716] = t8282*t275;
-    const double t8292 = df[1716];
+    const MBPOL_POLY_REAL t8292 = df[1716];
     df[1715] = t7981+t8292;
     df[1714] = df[1715];
     df[1713] = df[1714];
     df[1712] = df[1713];
     df[1710] = t8282*t155;
-    const double t8294 = df[1710];
+    const MBPOL_POLY_REAL t8294 = df[1710];
     df[1709] = t7990+t8294;
     df[1708] = df[1709];
     df[1707] = t8282*t212;
-    const double t8295 = df[1707];
+    const MBPOL_POLY_REAL t8295 = df[1707];
     df[1706] = t8002+t8295;
     df[1705] = df[1706];
     df[1704] = df[1705];
     df[1703] = df[1704];
     df[1702] = df[1703];
     df[1701] = t8282*t146;
-    const double t8296 = df[1701];
+    const MBPOL_POLY_REAL t8296 = df[1701];
     df[1700] = t7998+t8296;
     df[1699] = df[1700];
     df[1698] = t8282*t143;
-    const double t8297 = df[1698];
+    const MBPOL_POLY_REAL t8297 = df[1698];
     df[1697] = t8507+t8297;
     df[1696] = t8007+t8297;
     df[1695] = df[1696];
@@ -9357,10 +9357,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1692] = df[1693];
     df[1691] = df[1692];
     df[1689] = t8282*t145;
-    const double t8298 = df[1689];
+    const MBPOL_POLY_REAL t8298 = df[1689];
     df[1688] = t7989+t8298;
     df[1687] = t2341*t475;
-    const double t8690 = df[1687];
+    const MBPOL_POLY_REAL t8690 = df[1687];
     df[1686] = t8015+t8690;
     df[1684] = df[1686];
     df[1683] = df[1684];
@@ -9371,18 +9371,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1678] = t8148+t7846+t8430+t8690;
     df[1677] = t8148+t8690;
     df[1676] = t2404+t2341;
-    const double t8301 = t8220*t73;
-    const double t8691 = df[1676];
-    const double t8303 = t8691*t67;
+    const MBPOL_POLY_REAL t8301 = t8220*t73;
+    const MBPOL_POLY_REAL t8691 = df[1676];
+    const MBPOL_POLY_REAL t8303 = t8691*t67;
     df[1675] = t8301+t8303;
-    const double t8304 = t8220*t72;
+    const MBPOL_POLY_REAL t8304 = t8220*t72;
     df[1674] = t8304+t8303;
     df[1673] = df[1674];
     df[1672] = df[1675];
     df[1671] = t2341*t3116;
-    const double t8305 = df[1671];
+    const MBPOL_POLY_REAL t8305 = df[1671];
     df[1670] = t8305*t275;
-    const double t8306 = df[1670];
+    const MBPOL_POLY_REAL t8306 = df[1670];
     df[1669] = t8292+t8306;
     df[1668] = t7980+t8306;
     df[1667] = df[1668];
@@ -9398,7 +9398,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1657] = df[1658];
     df[1656] = t7967+t7976+t8282+t8305;
     df[1655] = t8305*t215;
-    const double t8307 = df[1655];
+    const MBPOL_POLY_REAL t8307 = df[1655];
     df[1654] = t8525+t8307;
     df[1653] = t8525+t8437+t8688+t8307;
     df[1652] = t8295+t8307;
@@ -9416,28 +9416,28 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1639] = df[1640];
     df[1638] = df[1639];
     df[1637] = t8305*t145;
-    const double t8309 = df[1637];
+    const MBPOL_POLY_REAL t8309 = df[1637];
     df[1636] = t7995+t8309;
     df[1635] = t7995+t7989+t8298+t8309;
     df[1634] = t7995+t7997+t8291+t8309;
     df[1633] = df[1634];
     df[1632] = t8282+t8305;
-    const double t8310 = df[2785];
-    const double t8693 = df[1632];
-    const double t8312 = t8693*t77;
+    const MBPOL_POLY_REAL t8310 = df[2785];
+    const MBPOL_POLY_REAL t8693 = df[1632];
+    const MBPOL_POLY_REAL t8312 = t8693*t77;
     df[1631] = t8310+t8312;
     df[1630] = df[1631];
     df[1628] = t8693*t132;
-    const double t8314 = df[2783];
-    const double t8315 = df[1628];
+    const MBPOL_POLY_REAL t8314 = df[2783];
+    const MBPOL_POLY_REAL t8315 = df[1628];
     df[1627] = t8314+t8315;
-    const double t8316 = df[2767];
+    const MBPOL_POLY_REAL t8316 = df[2767];
     df[1626] = t8316+t8315;
     df[1625] = df[1626];
     df[1624] = t8310+t8316+t8312+t8315;
     df[1623] = df[1624];
     df[1622] = t8305*t179;
-    const double t8317 = df[1622];
+    const MBPOL_POLY_REAL t8317 = df[1622];
     df[1621] = t8008+t8009+t8288+t8317;
     df[1620] = t8008+t8317;
     df[1619] = df[1620];
@@ -9456,7 +9456,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1606] = df[1607];
     df[1605] = df[1606];
     df[1604] = t8305*t240;
-    const double t8318 = df[1604];
+    const MBPOL_POLY_REAL t8318 = df[1604];
     df[1603] = t8507+t8508+t8689+t8318;
     df[1602] = df[1603];
     df[1601] = t8689+t8318;
@@ -9476,7 +9476,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1586] = df[1603];
     df[1585] = df[1586];
     df[1584] = t8305*t254;
-    const double t8320 = df[1584];
+    const MBPOL_POLY_REAL t8320 = df[1584];
     df[1583] = t8285+t8320;
     df[1582] = t7980+t7981+t8285+t8320;
     df[1581] = t8525+t7982+t7983+t8002+t8285+t8295+t8307+t8320;
@@ -9497,7 +9497,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1566] = df[1567];
     df[1565] = df[1566];
     df[1564] = t8305*t139;
-    const double t8321 = df[1564];
+    const MBPOL_POLY_REAL t8321 = df[1564];
     df[1563] = t7988+t8321;
     df[1562] = t7988+t7989+t8298+t8321;
     df[1561] = df[1562];
@@ -9508,12 +9508,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1556] = df[1656];
     df[1555] = df[1556];
     df[1554] = df[1656];
-    const double t8323 = df[1554];
-    const double t8694 = df[1555];
+    const MBPOL_POLY_REAL t8323 = df[1554];
+    const MBPOL_POLY_REAL t8694 = df[1555];
     df[1553] = t8694*t26+t8323*t20;
     df[1551] = df[1554];
     df[1550] = t8305*t475;
-    const double t8326 = df[1550];
+    const MBPOL_POLY_REAL t8326 = df[1550];
     df[1549] = t8286+t8326;
     df[1548] = t8445+t8326;
     df[1547] = df[1548];
@@ -9539,7 +9539,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1526] = df[1530];
     df[1525] = df[1526];
     df[1524] = t8305*t155;
-    const double t8328 = df[1524];
+    const MBPOL_POLY_REAL t8328 = df[1524];
     df[1523] = t7996+t8328;
     df[1522] = t7996+t7990+t8294+t8328;
     df[1521] = df[1523];
@@ -9553,13 +9553,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1513] = t7996+t7998+t8296+t8328;
     df[1512] = df[1513];
     df[1511] = df[1551];
-    const double t8330 = t8694*t73;
-    const double t8331 = df[1511];
-    const double t8332 = t8331*t72;
+    const MBPOL_POLY_REAL t8330 = t8694*t73;
+    const MBPOL_POLY_REAL t8331 = df[1511];
+    const MBPOL_POLY_REAL t8332 = t8331*t72;
     df[1510] = t8330+t8332;
     df[1509] = df[1510];
     df[1508] = t8305*t143;
-    const double t8333 = df[1508];
+    const MBPOL_POLY_REAL t8333 = df[1508];
     df[1507] = t8443+t8333;
     df[1506] = df[1507];
     df[1505] = t8284+t8333;
@@ -9582,7 +9582,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1487] = df[1489];
     df[1486] = df[1487];
     df[1485] = t8305*t309;
-    const double t8336 = df[1485];
+    const MBPOL_POLY_REAL t8336 = df[1485];
     df[1484] = t8508+t8336;
     df[1483] = t8443+t8284+t8318+t8336;
     df[1482] = t8444+t8336;
@@ -9607,11 +9607,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1462] = df[1463];
     df[1461] = df[1462];
     df[1460] = df[1632];
-    const double t8699 = df[1460];
+    const MBPOL_POLY_REAL t8699 = df[1460];
     df[1459] = t8699*t126;
-    const double t8340 = df[1459];
+    const MBPOL_POLY_REAL t8340 = df[1459];
     df[1458] = t8310+t8340;
-    const double t8341 = t8526*t77;
+    const MBPOL_POLY_REAL t8341 = t8526*t77;
     df[1457] = t8341+t8340;
     df[1456] = df[1457];
     df[1455] = t7995+t7997+t8341+t8291+t8309+t8340;
@@ -9619,7 +9619,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1453] = df[1454];
     df[1452] = df[1455];
     df[1450] = t8699*t136;
-    const double t8343 = df[1450];
+    const MBPOL_POLY_REAL t8343 = df[1450];
     df[1449] = t8316+t8343;
     df[1448] = df[1449];
     df[1447] = t8314+t8343;
@@ -9631,7 +9631,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1441] = df[1442];
     df[1440] = df[1443];
     df[1439] = t8305*t146;
-    const double t8344 = df[1439];
+    const MBPOL_POLY_REAL t8344 = df[1439];
     df[1438] = t7987+t8344;
     df[1437] = t7987+t7998+t8296+t8344;
     df[1436] = df[1438];
@@ -9648,19 +9648,19 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1425] = df[1426];
     df[1424] = df[1427];
     df[1423] = df[1511];
-    const double t8700 = df[1423];
-    const double t8346 = t8700*t67;
+    const MBPOL_POLY_REAL t8700 = df[1423];
+    const MBPOL_POLY_REAL t8346 = t8700*t67;
     df[1422] = t8330+t8346;
     df[1421] = t8332+t8346;
     df[1420] = df[1421];
     df[1419] = df[1422];
-    const double t8348 = t8700*t50;
+    const MBPOL_POLY_REAL t8348 = t8700*t50;
     df[1417] = t8332+t8348;
     df[1416] = t8330+t8348;
     df[1415] = df[1416];
     df[1414] = df[1417];
     df[1413] = t8305*t212;
-    const double t8349 = df[1413];
+    const MBPOL_POLY_REAL t8349 = df[1413];
     df[1412] = t7977+t8349;
     df[1411] = t8525+t8002+t8688+t8349;
     df[1410] = t8688+t8349;
@@ -9682,9 +9682,9 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1394] = df[1395];
     df[1393] = df[1394];
     df[1392] = t2341*t254;
-    const double t8351 = df[1392];
+    const MBPOL_POLY_REAL t8351 = df[1392];
     df[1391] = t8280+t8351;
-    const double t8352 = df[2848];
+    const MBPOL_POLY_REAL t8352 = df[2848];
     df[1390] = t8254+t7902+t8352+t8351;
     df[1389] = t8352+t8351;
     df[1388] = df[1389];
@@ -9698,17 +9698,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1380] = df[1381];
     df[1379] = df[1380];
     df[1378] = df[1379];
-    const double t8353 = t8220*t67;
-    const double t8355 = t8691*t73;
+    const MBPOL_POLY_REAL t8353 = t8220*t67;
+    const MBPOL_POLY_REAL t8355 = t8691*t73;
     df[1376] = t8353+t8355;
-    const double t8356 = t8220*t50;
+    const MBPOL_POLY_REAL t8356 = t8220*t50;
     df[1375] = t8356+t8355;
     df[1374] = df[1376];
     df[1373] = df[1375];
     df[1371] = t8220*t37+t8691*t37;
     df[1370] = df[1371];
     df[1369] = t2341*t240;
-    const double t8361 = df[1369];
+    const MBPOL_POLY_REAL t8361 = df[1369];
     df[1368] = t8147+t7886+t7970+t8361;
     df[1367] = t8147+t8148+t7885+t7896+t8427+t8015+t8690+t8361;
     df[1366] = df[1367];
@@ -9734,7 +9734,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1345] = df[1347];
     df[1344] = df[1354];
     df[1343] = t2341*t215;
-    const double t8706 = df[1343];
+    const MBPOL_POLY_REAL t8706 = df[1343];
     df[1342] = t7972+t8706;
     df[1341] = df[1342];
     df[1340] = df[1341];
@@ -9742,12 +9742,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1338] = df[1339];
     df[1337] = df[1338];
     df[1335] = t2341*t145;
-    const double t8364 = df[1335];
+    const MBPOL_POLY_REAL t8364 = df[1335];
     df[1334] = t8014+t8364;
     df[1333] = df[1334];
     df[1332] = t2341*t179;
-    const double t8365 = df[2847];
-    const double t8366 = df[1332];
+    const MBPOL_POLY_REAL t8365 = df[2847];
+    const MBPOL_POLY_REAL t8366 = df[1332];
     df[1331] = t7906+t7907+t8365+t8366;
     df[1330] = t8365+t8366;
     df[1329] = df[1330];
@@ -9762,7 +9762,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1320] = df[1321];
     df[1319] = df[1320];
     df[1318] = t2341*t143;
-    const double t8367 = df[1318];
+    const MBPOL_POLY_REAL t8367 = df[1318];
     df[1317] = t8145+t8367;
     df[1316] = t7970+t8367;
     df[1315] = df[1316];
@@ -9771,13 +9771,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1312] = df[1313];
     df[1311] = df[1312];
     df[1309] = t2341*t155;
-    const double t8368 = df[1309];
+    const MBPOL_POLY_REAL t8368 = df[1309];
     df[1308] = t8011+t8368;
     df[1307] = df[1308];
     df[1306] = df[1307];
     df[1305] = df[1306];
     df[1304] = t2341*t139;
-    const double t8369 = df[1304];
+    const MBPOL_POLY_REAL t8369 = df[1304];
     df[1303] = t8013+t8369;
     df[1302] = t8013+t8014+t8364+t8369;
     df[1301] = df[1302];
@@ -9786,20 +9786,20 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1298] = df[1299];
     df[1297] = df[1300];
     df[1295] = t2341*t2341;
-    const double t8370 = df[1295];
+    const MBPOL_POLY_REAL t8370 = df[1295];
     df[1294] = t7952+t8370;
-    const double t8705 = df[3252];
-    const double t8371 = t8705*t20;
-    const double t8372 = df[1294];
-    const double t8373 = t8372*t20;
+    const MBPOL_POLY_REAL t8705 = df[3252];
+    const MBPOL_POLY_REAL t8371 = t8705*t20;
+    const MBPOL_POLY_REAL t8372 = df[1294];
+    const MBPOL_POLY_REAL t8373 = t8372*t20;
     df[1293] = t8371+t8373;
-    const double t8374 = t8200*t26;
+    const MBPOL_POLY_REAL t8374 = t8200*t26;
     df[1292] = t8374+t8373;
     df[1291] = t8370*t126;
-    const double t8375 = df[2898];
-    const double t8376 = df[1291];
+    const MBPOL_POLY_REAL t8375 = df[2898];
+    const MBPOL_POLY_REAL t8376 = df[1291];
     df[1290] = t8375+t8376;
-    const double t8377 = t7952*t77;
+    const MBPOL_POLY_REAL t8377 = t7952*t77;
     df[1289] = t8377+t8376;
     df[1288] = df[1289];
     df[1287] = t7855+t7858+t8377+t8376;
@@ -9808,17 +9808,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1284] = df[1286];
     df[1283] = t7809+t7847+t7952+t8370;
     df[1282] = t8370*t155;
-    const double t8378 = df[1282];
+    const MBPOL_POLY_REAL t8378 = df[1282];
     df[1281] = t7961+t8378;
     df[1280] = df[1281];
     df[1279] = df[1280];
     df[1278] = df[1279];
     df[1277] = t8370*t136;
-    const double t8379 = df[2913];
-    const double t8380 = df[1277];
+    const MBPOL_POLY_REAL t8379 = df[2913];
+    const MBPOL_POLY_REAL t8380 = df[1277];
     df[1276] = t8379+t8380;
     df[1275] = df[1276];
-    const double t8381 = df[2900];
+    const MBPOL_POLY_REAL t8381 = df[2900];
     df[1274] = t8381+t8380;
     df[1273] = df[1274];
     df[1272] = t8377+t8381+t8376+t8380;
@@ -9828,7 +9828,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1268] = df[1270];
     df[1267] = df[1269];
     df[1266] = t8370*t309;
-    const double t8382 = df[1266];
+    const MBPOL_POLY_REAL t8382 = df[1266];
     df[1265] = t8195+t8382;
     df[1264] = t8120+t8382;
     df[1263] = t8406+t8382;
@@ -9837,7 +9837,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1260] = df[1261];
     df[1259] = df[1260];
     df[1258] = df[1259];
-    const double t8384 = t8370*t77;
+    const MBPOL_POLY_REAL t8384 = t8370*t77;
     df[1256] = t8375+t8384;
     df[1255] = df[1256];
     df[1254] = t7857+t7856+t8375+t8384;
@@ -9845,8 +9845,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1252] = df[1253];
     df[1251] = df[1254];
     df[1250] = t8370*t179;
-    const double t8385 = df[2899];
-    const double t8386 = df[1250];
+    const MBPOL_POLY_REAL t8385 = df[2899];
+    const MBPOL_POLY_REAL t8386 = df[1250];
     df[1249] = t7859+t7860+t8385+t8386;
     df[1248] = t8385+t8386;
     df[1247] = df[1248];
@@ -9861,7 +9861,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1238] = df[1239];
     df[1237] = df[1238];
     df[1236] = t8370*t143;
-    const double t8387 = df[1236];
+    const MBPOL_POLY_REAL t8387 = df[1236];
     df[1235] = t7814+t8387;
     df[1234] = t8412+t8387;
     df[1233] = df[1234];
@@ -9885,7 +9885,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1214] = df[1216];
     df[1213] = df[1214];
     df[1212] = t8370*t475;
-    const double t8390 = df[1212];
+    const MBPOL_POLY_REAL t8390 = df[1212];
     df[1211] = t7954+t8390;
     df[1210] = df[1211];
     df[1209] = df[1210];
@@ -9896,10 +9896,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1203] = t8112+t7874+t8406+t8390;
     df[1202] = t8112+t8390;
     df[1201] = t8370*t139;
-    const double t8392 = df[1201];
+    const MBPOL_POLY_REAL t8392 = df[1201];
     df[1200] = t7963+t8392;
     df[1199] = t8370*t146;
-    const double t8393 = df[1199];
+    const MBPOL_POLY_REAL t8393 = df[1199];
     df[1198] = t7964+t8393;
     df[1197] = df[1198];
     df[1196] = df[1197];
@@ -9910,25 +9910,25 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1191] = df[1192];
     df[1190] = df[1193];
     df[1189] = t8372;
-    const double t8708 = t8705;
-    const double t8394 = t8708*t73;
-    const double t8395 = df[1189];
-    const double t8396 = t8395*t67;
+    const MBPOL_POLY_REAL t8708 = t8705;
+    const MBPOL_POLY_REAL t8394 = t8708*t73;
+    const MBPOL_POLY_REAL t8395 = df[1189];
+    const MBPOL_POLY_REAL t8396 = t8395*t67;
     df[1188] = t8394+t8396;
-    const double t8398 = t8708*t72;
+    const MBPOL_POLY_REAL t8398 = t8708*t72;
     df[1187] = t8398+t8396;
     df[1186] = df[1187];
     df[1185] = df[1188];
     df[1183] = t8370*t212;
-    const double t8400 = df[1183];
+    const MBPOL_POLY_REAL t8400 = df[1183];
     df[1182] = t7965+t8400;
     df[1181] = df[1182];
     df[1180] = df[1181];
     df[1179] = df[1180];
     df[1178] = df[1179];
     df[1177] = t8370*t275;
-    const double t8401 = df[2941];
-    const double t8402 = df[1177];
+    const MBPOL_POLY_REAL t8401 = df[2941];
+    const MBPOL_POLY_REAL t8402 = df[1177];
     df[1176] = t7870+t7869+t8401+t8402;
     df[1175] = t8401+t8402;
     df[1174] = df[1175];
@@ -9943,17 +9943,17 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1165] = df[1166];
     df[1164] = df[1165];
     df[1163] = df[1294];
-    const double t8709 = df[1163];
-    const double t8404 = t8709*t50;
+    const MBPOL_POLY_REAL t8709 = df[1163];
+    const MBPOL_POLY_REAL t8404 = t8709*t50;
     df[1162] = t8398+t8404;
     df[1161] = t8394+t8404;
     df[1160] = df[1161];
     df[1159] = df[1162];
-    const double t8710 = df[3167];
+    const MBPOL_POLY_REAL t8710 = df[3167];
     df[1157] = t8710*t37+t8709*t37;
     df[1156] = df[1157];
     df[1155] = t8370*t215;
-    const double t8408 = df[1155];
+    const MBPOL_POLY_REAL t8408 = df[1155];
     df[1154] = t8415+t8408;
     df[1153] = df[1154];
     df[1152] = t8196+t7872+t8400+t8408;
@@ -9975,15 +9975,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1135] = df[1136];
     df[1134] = df[1135];
     df[1133] = df[1134];
-    const double t8410 = t8710;
-    const double t8411 = t8410*t50;
-    const double t8413 = t8709*t72;
+    const MBPOL_POLY_REAL t8410 = t8710;
+    const MBPOL_POLY_REAL t8411 = t8410*t50;
+    const MBPOL_POLY_REAL t8413 = t8709*t72;
     df[1131] = t8411+t8413;
-    const double t8414 = t8410*t67;
+    const MBPOL_POLY_REAL t8414 = t8410*t67;
     df[1130] = t8414+t8413;
     df[1129] = df[1130];
     df[1128] = df[1131];
-    const double t8416 = t8709*t73;
+    const MBPOL_POLY_REAL t8416 = t8709*t73;
     df[1126] = t8394+t8398+t8413+t8416;
     df[1125] = df[1126];
     df[1124] = t8414+t8416;
@@ -9991,7 +9991,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1122] = df[1124];
     df[1121] = df[1123];
     df[1120] = t8370*t145;
-    const double t8417 = df[1120];
+    const MBPOL_POLY_REAL t8417 = df[1120];
     df[1119] = t7962+t8417;
     df[1118] = df[1119];
     df[1117] = t7854+t7855+t7853+t7858+t8378+t8392+t8393+t8417;
@@ -10007,9 +10007,9 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1107] = df[1108];
     df[1106] = df[1109];
     df[1105] = t8370*t254;
-    const double t8418 = df[1105];
+    const MBPOL_POLY_REAL t8418 = df[1105];
     df[1104] = t8401+t8418;
-    const double t8419 = df[2940];
+    const MBPOL_POLY_REAL t8419 = df[2940];
     df[1103] = t8196+t7872+t8419+t8418;
     df[1102] = t8419+t8418;
     df[1101] = df[1102];
@@ -10023,12 +10023,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1093] = df[1094];
     df[1092] = df[1093];
     df[1091] = df[1092];
-    const double t8421 = t8709*t26;
+    const MBPOL_POLY_REAL t8421 = t8709*t26;
     df[1089] = t8374+t8421;
     df[1088] = df[1089];
     df[1087] = t8371+t8421;
     df[1086] = t8370*t240;
-    const double t8422 = df[1086];
+    const MBPOL_POLY_REAL t8422 = df[1086];
     df[1085] = t7849+t8422;
     df[1084] = t8120+t7849+t8412+t8422;
     df[1083] = t8390+t8422;
@@ -10054,7 +10054,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1062] = df[1063];
     df[1061] = df[1062];
     df[1060] = t8370*t132;
-    const double t8424 = df[1060];
+    const MBPOL_POLY_REAL t8424 = df[1060];
     df[1059] = t8381+t8424;
     df[1058] = t8379+t8424;
     df[1057] = df[1058];
@@ -10065,7 +10065,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1052] = df[1053];
     df[1051] = df[1054];
     df[1050] = t2341*t212;
-    const double t8425 = df[1050];
+    const MBPOL_POLY_REAL t8425 = df[1050];
     df[1049] = t7971+t8425;
     df[1048] = t8254+t7902+t8706+t8425;
     df[1047] = t7900+t7899+t8706+t8425;
@@ -10086,18 +10086,18 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1032] = df[1033];
     df[1031] = df[1032];
     df[1030] = df[1031];
-    const double t8428 = t8691*t50;
+    const MBPOL_POLY_REAL t8428 = t8691*t50;
     df[1028] = t8304+t8428;
     df[1027] = t8301+t8428;
     df[1026] = df[1027];
     df[1025] = df[1028];
-    const double t8429 = t8220*t20;
-    const double t8431 = t8691*t20;
+    const MBPOL_POLY_REAL t8429 = t8220*t20;
+    const MBPOL_POLY_REAL t8431 = t8691*t20;
     df[1023] = t8429+t8431;
-    const double t8432 = t8220*t26;
+    const MBPOL_POLY_REAL t8432 = t8220*t26;
     df[1022] = t8432+t8431;
     df[1021] = t2341*t146;
-    const double t8433 = df[1021];
+    const MBPOL_POLY_REAL t8433 = df[1021];
     df[1020] = t8012+t8433;
     df[1019] = df[1020];
     df[1018] = df[1019];
@@ -10114,22 +10114,22 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[1007] = df[1008];
     df[1006] = df[1009];
     df[1005] = t2341*t136;
-    const double t8434 = df[2872];
-    const double t8435 = df[1005];
+    const MBPOL_POLY_REAL t8434 = df[2872];
+    const MBPOL_POLY_REAL t8435 = df[1005];
     df[1004] = t8434+t8435;
     df[1003] = df[1004];
-    const double t8436 = df[2761];
+    const MBPOL_POLY_REAL t8436 = df[2761];
     df[1002] = t8436+t8435;
     df[1001] = df[1002];
     df[1000] = t7908+t7911+t8436+t8435;
     df[999] = t7841+t7844+t8436+t8435;
     df[998] = df[999];
     df[997] = df[1000];
-    const double t8438 = t8691*t26;
+    const MBPOL_POLY_REAL t8438 = t8691*t26;
     df[995] = t8432+t8438;
     df[994] = t8429+t8438;
     df[993] = df[995];
-    const double t8440 = t8691*t72;
+    const MBPOL_POLY_REAL t8440 = t8691*t72;
     df[991] = t8301+t8304+t8355+t8440;
     df[990] = df[991];
     df[989] = t8356+t8440;
@@ -10137,7 +10137,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[987] = df[989];
     df[986] = df[988];
     df[985] = t2341*t132;
-    const double t8441 = df[985];
+    const MBPOL_POLY_REAL t8441 = df[985];
     df[984] = t8436+t8441;
     df[983] = t8434+t8441;
     df[982] = df[983];
@@ -10147,29 +10147,29 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[978] = df[981];
     df[977] = t3116+t3120+t2404+t2341;
     df[976] = t2341*t2404;
-    const double t8442 = df[976];
+    const MBPOL_POLY_REAL t8442 = df[976];
     df[975] = t8442*t146;
     df[974] = t8442*t143;
-    const double t8720 = df[974];
+    const MBPOL_POLY_REAL t8720 = df[974];
     df[973] = t7817+t8720;
     df[971] = t7816*t37+t8442*t37;
     df[970] = df[971];
     df[969] = t8442*t475;
     df[968] = df[969];
-    const double t8446 = df[968];
+    const MBPOL_POLY_REAL t8446 = df[968];
     df[967] = t7822+t8446;
     df[966] = df[967];
-    const double t8447 = t7816*t50;
-    const double t8448 = t8442*t72;
+    const MBPOL_POLY_REAL t8447 = t7816*t50;
+    const MBPOL_POLY_REAL t8448 = t8442*t72;
     df[965] = t8447+t8448;
-    const double t8449 = t7816*t67;
+    const MBPOL_POLY_REAL t8449 = t7816*t67;
     df[964] = t8449+t8448;
     df[963] = df[964];
     df[962] = df[965];
-    const double t8450 = t7816*t73;
-    const double t8451 = t8442*t67;
+    const MBPOL_POLY_REAL t8450 = t7816*t73;
+    const MBPOL_POLY_REAL t8451 = t8442*t67;
     df[961] = t8450+t8451;
-    const double t8452 = t7816*t72;
+    const MBPOL_POLY_REAL t8452 = t7816*t72;
     df[960] = t8452+t8451;
     df[959] = df[960];
     df[958] = df[961];
@@ -10178,7 +10178,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[955] = t8442*t145;
     df[954] = t8442*t254;
     df[953] = t8442*t240;
-    const double t8453 = df[953];
+    const MBPOL_POLY_REAL t8453 = df[953];
     df[952] = t8446+t8453;
     df[951] = df[952];
     df[950] = df[951];
@@ -10194,23 +10194,23 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[939] = t8133+t8453;
     df[938] = df[946];
     df[937] = df[938];
-    const double t8455 = t8442*t50;
+    const MBPOL_POLY_REAL t8455 = t8442*t50;
     df[936] = t8452+t8455;
     df[935] = t8450+t8455;
     df[934] = df[935];
     df[933] = df[936];
-    const double t8456 = t7816*t26;
-    const double t8457 = t8442*t26;
+    const MBPOL_POLY_REAL t8456 = t7816*t26;
+    const MBPOL_POLY_REAL t8457 = t8442*t26;
     df[932] = t8456+t8457;
-    const double t8458 = t7816*t20;
+    const MBPOL_POLY_REAL t8458 = t7816*t20;
     df[931] = t8458+t8457;
     df[930] = df[932];
-    const double t8460 = t8442*t20;
+    const MBPOL_POLY_REAL t8460 = t8442*t20;
     df[928] = t8458+t8460;
     df[927] = t8456+t8460;
     df[926] = t8442*t139;
-    const double t8461 = df[955];
-    const double t8462 = df[926];
+    const MBPOL_POLY_REAL t8461 = df[955];
+    const MBPOL_POLY_REAL t8462 = df[926];
     df[925] = t8461+t8462;
     df[924] = df[925];
     df[923] = t7830+t7831+t8461+t8462;
@@ -10218,14 +10218,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[921] = df[922];
     df[920] = df[923];
     df[919] = t8442*t179;
-    const double t8463 = df[3361];
-    const double t8464 = df[919];
+    const MBPOL_POLY_REAL t8463 = df[3361];
+    const MBPOL_POLY_REAL t8464 = df[919];
     df[918] = t8463+t8464;
     df[917] = df[918];
     df[916] = df[917];
     df[915] = df[916];
     df[914] = df[915];
-    const double t8465 = t8442*t73;
+    const MBPOL_POLY_REAL t8465 = t8442*t73;
     df[913] = t8450+t8452+t8448+t8465;
     df[912] = df[913];
     df[911] = t8449+t8465;
@@ -10233,8 +10233,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[909] = df[910];
     df[908] = df[911];
     df[907] = t8442*t215;
-    const double t8466 = df[957];
-    const double t8467 = df[907];
+    const MBPOL_POLY_REAL t8466 = df[957];
+    const MBPOL_POLY_REAL t8467 = df[907];
     df[906] = t8140+t7832+t8466+t8467;
     df[905] = df[906];
     df[904] = t7826+t7827+t8466+t8467;
@@ -10251,8 +10251,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[892] = df[893];
     df[891] = df[892];
     df[890] = t8442*t155;
-    const double t8469 = df[975];
-    const double t8470 = df[890];
+    const MBPOL_POLY_REAL t8469 = df[975];
+    const MBPOL_POLY_REAL t8470 = df[890];
     df[889] = t7820+t7821+t7834+t7835+t8469+t8461+t8462+t8470;
     df[888] = df[889];
     df[887] = df[888];
@@ -10266,7 +10266,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[879] = df[880];
     df[878] = df[881];
     df[877] = t8442*t309;
-    const double t8471 = df[877];
+    const MBPOL_POLY_REAL t8471 = df[877];
     df[876] = t8133+t8471;
     df[875] = t8128+t8471;
     df[874] = t8446+t8471;
@@ -10292,8 +10292,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[853] = df[855];
     df[852] = t7816+t8442;
     df[851] = t8442*t275;
-    const double t8474 = df[954];
-    const double t8475 = df[851];
+    const MBPOL_POLY_REAL t8474 = df[954];
+    const MBPOL_POLY_REAL t8475 = df[851];
     df[850] = t8140+t7832+t8474+t8475;
     df[849] = t8474+t8475;
     df[848] = df[849];
@@ -10308,8 +10308,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[839] = df[840];
     df[838] = df[839];
     df[837] = t8442*t136;
-    const double t8476 = df[956];
-    const double t8477 = df[837];
+    const MBPOL_POLY_REAL t8476 = df[956];
+    const MBPOL_POLY_REAL t8477 = df[837];
     df[836] = t8476+t8477;
     df[835] = df[836];
     df[834] = t7834+t7835+t8476+t8477;
@@ -10317,8 +10317,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[832] = df[833];
     df[831] = df[834];
     df[830] = t8442*t126;
-    const double t8478 = t8442*t77;
-    const double t8479 = df[830];
+    const MBPOL_POLY_REAL t8478 = t8442*t77;
+    const MBPOL_POLY_REAL t8479 = df[830];
     df[829] = t8478+t8479;
     df[828] = df[829];
     df[827] = t8476+t8478+t8477+t8479;
@@ -10328,7 +10328,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[823] = df[825];
     df[822] = df[824];
     df[821] = t2341*t309;
-    const double t8480 = df[821];
+    const MBPOL_POLY_REAL t8480 = df[821];
     df[820] = t7886+t8480;
     df[819] = t8146+t8480;
     df[818] = t8430+t8480;
@@ -10353,10 +10353,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[798] = df[799];
     df[797] = df[798];
     df[796] = t2341*t126;
-    const double t8483 = df[2850];
-    const double t8484 = df[796];
+    const MBPOL_POLY_REAL t8483 = df[2850];
+    const MBPOL_POLY_REAL t8484 = df[796];
     df[795] = t8483+t8484;
-    const double t8485 = t2404*t77;
+    const MBPOL_POLY_REAL t8485 = t2404*t77;
     df[794] = t8485+t8484;
     df[793] = df[794];
     df[792] = t8485+t8436+t8435+t8484;
@@ -10365,7 +10365,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[789] = t7908+t7911+t8485+t8484;
     df[788] = df[789];
     df[787] = df[790];
-    const double t8486 = t2341*t77;
+    const MBPOL_POLY_REAL t8486 = t2341*t77;
     df[786] = t8483+t8486;
     df[785] = df[786];
     df[784] = t8434+t8483+t8486+t8441;
@@ -10375,7 +10375,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[780] = df[781];
     df[779] = df[782];
     df[777] = t275*t275;
-    const double t8487 = df[777];
+    const MBPOL_POLY_REAL t8487 = df[777];
     df[776] = t8061+t8487;
     df[775] = df[776];
     df[774] = df[775];
@@ -10385,8 +10385,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[770] = df[771];
     df[769] = df[770];
     df[768] = t275*t179;
-    const double t8488 = df[2679];
-    const double t8489 = df[768];
+    const MBPOL_POLY_REAL t8488 = df[2679];
+    const MBPOL_POLY_REAL t8489 = df[768];
     df[767] = t8488+t8489;
     df[766] = df[767];
     df[765] = df[766];
@@ -10396,56 +10396,56 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[761] = df[762];
     df[760] = df[761];
     df[759] = t275*t155;
-    const double t8490 = df[2678];
-    const double t8491 = df[759];
+    const MBPOL_POLY_REAL t8490 = df[2678];
+    const MBPOL_POLY_REAL t8491 = df[759];
     df[758] = t8490+t8491;
     df[757] = df[758];
     df[756] = df[757];
     df[755] = df[756];
     df[754] = t275*t146;
-    const double t8492 = df[2677];
-    const double t8493 = df[754];
+    const MBPOL_POLY_REAL t8492 = df[2677];
+    const MBPOL_POLY_REAL t8493 = df[754];
     df[753] = t8492+t8493;
     df[752] = df[753];
     df[751] = df[752];
     df[750] = t8490+t8492+t8491+t8493;
     df[749] = df[750];
     df[748] = t275*t145;
-    const double t8494 = df[2676];
-    const double t8495 = df[748];
+    const MBPOL_POLY_REAL t8494 = df[2676];
+    const MBPOL_POLY_REAL t8495 = df[748];
     df[747] = t8494+t8495;
     df[746] = df[747];
     df[745] = t275*t139;
-    const double t8496 = df[2675];
-    const double t8497 = df[745];
+    const MBPOL_POLY_REAL t8496 = df[2675];
+    const MBPOL_POLY_REAL t8497 = df[745];
     df[744] = t8496+t8497;
     df[743] = t8490+t8492+t8494+t8496+t8491+t8493+t8495+t8497;
     df[742] = df[743];
     df[741] = t8494+t8496+t8495+t8497;
     df[740] = df[741];
     df[739] = t275*t136;
-    const double t8498 = df[2674];
-    const double t8499 = df[739];
+    const MBPOL_POLY_REAL t8498 = df[2674];
+    const MBPOL_POLY_REAL t8499 = df[739];
     df[738] = t8498+t8499;
     df[737] = df[738];
-    const double t8500 = df[2673];
+    const MBPOL_POLY_REAL t8500 = df[2673];
     df[736] = t8500+t8499;
     df[735] = df[736];
     df[734] = t275*t132;
-    const double t8501 = df[734];
+    const MBPOL_POLY_REAL t8501 = df[734];
     df[733] = t8500+t8501;
     df[732] = t8498+t8501;
     df[731] = df[732];
     df[730] = t275*t126;
-    const double t8502 = df[2672];
-    const double t8503 = df[730];
+    const MBPOL_POLY_REAL t8502 = df[2672];
+    const MBPOL_POLY_REAL t8503 = df[730];
     df[729] = t8502+t8503;
-    const double t8504 = t254*t77;
+    const MBPOL_POLY_REAL t8504 = t254*t77;
     df[728] = t8504+t8503;
     df[727] = df[728];
     df[726] = t8504+t8500+t8499+t8503;
     df[725] = df[726];
-    const double t8505 = t275*t77;
+    const MBPOL_POLY_REAL t8505 = t275*t77;
     df[724] = t8502+t8505;
     df[723] = df[724];
     df[722] = t8498+t8502+t8505+t8501;
@@ -10457,12 +10457,12 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[716] = df[717];
     df[715] = df[716];
     df[714] = df[715];
-    const double t8506 = t20+t26;
+    const MBPOL_POLY_REAL t8506 = t20+t26;
     df[713] = t8506*t26;
     df[712] = t8506*t37+t26*t20;
     df[710] = t215*t215;
-    const double t8509 = df[3491];
-    const double t8510 = df[710];
+    const MBPOL_POLY_REAL t8509 = df[3491];
+    const MBPOL_POLY_REAL t8510 = df[710];
     df[709] = t8509+t8061+t8487+t8510;
     df[708] = t8509+t8510;
     df[707] = df[708];
@@ -10477,7 +10477,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[697] = df[698];
     df[696] = df[697];
     df[695] = t215*t212;
-    const double t8512 = df[695];
+    const MBPOL_POLY_REAL t8512 = df[695];
     df[694] = t8510+t8512;
     df[693] = t8062+t8512;
     df[692] = df[693];
@@ -10485,7 +10485,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[690] = df[691];
     df[689] = df[690];
     df[688] = t215*t254;
-    const double t8513 = df[688];
+    const MBPOL_POLY_REAL t8513 = df[688];
     df[687] = t8509+t7807+t8510+t8513;
     df[686] = t7807+t8512+t8513;
     df[685] = t7807+t8513;
@@ -10493,7 +10493,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[683] = df[684];
     df[682] = df[683];
     df[681] = t215*t275;
-    const double t8514 = df[681];
+    const MBPOL_POLY_REAL t8514 = df[681];
     df[680] = t8509+t7808+t8510+t8514;
     df[679] = t7807+t7808+t8513+t8514;
     df[678] = t8513+t8514;
@@ -10513,8 +10513,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[664] = df[665];
     df[663] = df[664];
     df[662] = t215*t179;
-    const double t8515 = df[3484];
-    const double t8516 = df[662];
+    const MBPOL_POLY_REAL t8515 = df[3484];
+    const MBPOL_POLY_REAL t8516 = df[662];
     df[661] = t8515+t8488+t8489+t8516;
     df[660] = t8515+t8516;
     df[659] = df[660];
@@ -10529,11 +10529,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[650] = df[651];
     df[649] = df[650];
     df[648] = t215*t155;
-    const double t8517 = df[3483];
-    const double t8518 = df[648];
+    const MBPOL_POLY_REAL t8517 = df[3483];
+    const MBPOL_POLY_REAL t8518 = df[648];
     df[647] = t8517+t8518;
     df[646] = df[647];
-    const double t8519 = df[3482];
+    const MBPOL_POLY_REAL t8519 = df[3482];
     df[645] = t8519+t8518;
     df[644] = df[645];
     df[643] = t8519+t8498+t8501+t8518;
@@ -10541,7 +10541,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[641] = df[642];
     df[640] = df[643];
     df[639] = t215*t146;
-    const double t8520 = df[639];
+    const MBPOL_POLY_REAL t8520 = df[639];
     df[638] = t8519+t8520;
     df[637] = t8517+t8520;
     df[636] = df[637];
@@ -10550,10 +10550,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[633] = df[634];
     df[632] = df[635];
     df[631] = t215*t145;
-    const double t8521 = df[3481];
-    const double t8522 = df[631];
+    const MBPOL_POLY_REAL t8521 = df[3481];
+    const MBPOL_POLY_REAL t8522 = df[631];
     df[630] = t8521+t8522;
-    const double t8523 = df[3480];
+    const MBPOL_POLY_REAL t8523 = df[3480];
     df[629] = t8519+t8523+t8490+t8492+t8494+t8496+t8518+t8522;
     df[628] = t8519+t8523+t8491+t8493+t8495+t8497+t8518+t8522;
     df[627] = df[629];
@@ -10567,7 +10567,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[619] = df[620];
     df[618] = df[621];
     df[617] = t215*t139;
-    const double t8524 = df[617];
+    const MBPOL_POLY_REAL t8524 = df[617];
     df[616] = t8517+t8521+t8491+t8493+t8495+t8497+t8520+t8524;
     df[615] = t8517+t8521+t8490+t8492+t8494+t8496+t8520+t8524;
     df[614] = df[616];
@@ -10581,11 +10581,11 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[606] = df[607];
     df[605] = df[608];
     df[604] = t212+t215;
-    const double t8727 = df[604];
+    const MBPOL_POLY_REAL t8727 = df[604];
     df[603] = t8727*t136;
     df[601] = t8727*t132;
-    const double t8527 = df[603];
-    const double t8528 = df[601];
+    const MBPOL_POLY_REAL t8527 = df[603];
+    const MBPOL_POLY_REAL t8528 = df[601];
     df[600] = t8527+t8528;
     df[599] = df[600];
     df[598] = t8490+t8492+t8491+t8493+t8527+t8528;
@@ -10593,8 +10593,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[596] = df[598];
     df[595] = df[597];
     df[592] = t8727*t126;
-    const double t8530 = df[592];
-    const double t8532 = t8727*t77;
+    const MBPOL_POLY_REAL t8530 = df[592];
+    const MBPOL_POLY_REAL t8532 = t8727*t77;
     df[590] = t8530+t8532;
     df[589] = df[590];
     df[588] = t8527+t8528+t8530+t8532;
@@ -10603,57 +10603,57 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[585] = t8490+t8492+t8491+t8493+t8530+t8532;
     df[584] = df[586];
     df[583] = df[585];
-    const double t8533 = df[715]*t67;
-    const double t8535 = t8727*t73;
+    const MBPOL_POLY_REAL t8533 = df[715]*t67;
+    const MBPOL_POLY_REAL t8535 = t8727*t73;
     df[581] = t8533+t8535;
-    const double t8536 = df[714]*t50;
+    const MBPOL_POLY_REAL t8536 = df[714]*t50;
     df[580] = t8536+t8535;
     df[579] = df[580];
     df[578] = df[581];
-    const double t8537 = df[717]*t73;
-    const double t8538 = df[716]*t72;
-    const double t8540 = t8727*t72;
+    const MBPOL_POLY_REAL t8537 = df[717]*t73;
+    const MBPOL_POLY_REAL t8538 = df[716]*t72;
+    const MBPOL_POLY_REAL t8540 = t8727*t72;
     df[576] = t8537+t8538+t8535+t8540;
     df[575] = df[576];
     df[574] = t8536+t8540;
     df[573] = t8533+t8540;
     df[572] = df[574];
     df[571] = df[573];
-    const double t8542 = t8727*t67;
+    const MBPOL_POLY_REAL t8542 = t8727*t67;
     df[569] = t8537+t8542;
     df[568] = t8538+t8542;
     df[567] = df[568];
     df[566] = df[569];
-    const double t8544 = t8727*t50;
+    const MBPOL_POLY_REAL t8544 = t8727*t50;
     df[564] = t8538+t8544;
     df[563] = t8537+t8544;
     df[562] = df[563];
     df[561] = df[564];
-    const double t8738 = df[714];
+    const MBPOL_POLY_REAL t8738 = df[714];
     df[559] = t8738*t37+t8727*t37;
     df[558] = df[559];
-    const double t8739 = t8738;
-    const double t8548 = t8739*t26;
-    const double t8550 = t8727*t26;
+    const MBPOL_POLY_REAL t8739 = t8738;
+    const MBPOL_POLY_REAL t8548 = t8739*t26;
+    const MBPOL_POLY_REAL t8550 = t8727*t26;
     df[556] = t8548+t8550;
     df[555] = df[556];
-    const double t8552 = t8739*t20;
+    const MBPOL_POLY_REAL t8552 = t8739*t20;
     df[554] = t8552+t8550;
-    const double t8554 = t8727*t20;
+    const MBPOL_POLY_REAL t8554 = t8727*t20;
     df[552] = t8552+t8554;
     df[551] = t8548+t8554;
     df[550] = t212+t254+t215+t275;
     df[548] = t179*t179;
     df[547] = t179*t155;
     df[546] = t179*t146;
-    const double t8555 = df[547];
-    const double t8556 = df[546];
+    const MBPOL_POLY_REAL t8555 = df[547];
+    const MBPOL_POLY_REAL t8556 = df[546];
     df[545] = t8555+t8556;
     df[544] = df[545];
     df[543] = t179*t145;
     df[542] = t179*t139;
-    const double t8557 = df[543];
-    const double t8558 = df[542];
+    const MBPOL_POLY_REAL t8557 = df[543];
+    const MBPOL_POLY_REAL t8558 = df[542];
     df[541] = t8555+t8556+t8557+t8558;
     df[540] = df[541];
     df[539] = df[540];
@@ -10664,8 +10664,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[534] = df[535];
     df[533] = t179*t136;
     df[532] = t179*t132;
-    const double t8559 = df[533];
-    const double t8560 = df[532];
+    const MBPOL_POLY_REAL t8559 = df[533];
+    const MBPOL_POLY_REAL t8560 = df[532];
     df[531] = t8559+t8560;
     df[530] = df[531];
     df[529] = t8555+t8556+t8559+t8560;
@@ -10673,8 +10673,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[527] = df[529];
     df[526] = df[528];
     df[525] = t179*t126;
-    const double t8561 = t179*t77;
-    const double t8562 = df[525];
+    const MBPOL_POLY_REAL t8561 = t179*t77;
+    const MBPOL_POLY_REAL t8562 = df[525];
     df[524] = t8561+t8562;
     df[523] = df[524];
     df[522] = t8561+t8559+t8560+t8562;
@@ -10695,7 +10695,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[507] = df[510];
     df[506] = t179*t8506;
     df[504] = t155*t155;
-    const double t8563 = df[504];
+    const MBPOL_POLY_REAL t8563 = df[504];
     df[503] = t7944+t7950+t8018+t8563;
     df[502] = df[503];
     df[501] = t7944+t8563;
@@ -10703,7 +10703,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[499] = t8039+t7944+t8040+t8563;
     df[498] = df[499];
     df[497] = t155*t146;
-    const double t8564 = df[497];
+    const MBPOL_POLY_REAL t8564 = df[497];
     df[496] = t8563+t8564;
     df[495] = t7951+t8564;
     df[494] = df[495];
@@ -10712,7 +10712,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[491] = t8041+t8564;
     df[490] = df[491];
     df[489] = t155*t145;
-    const double t8565 = df[489];
+    const MBPOL_POLY_REAL t8565 = df[489];
     df[488] = t8563+t8565;
     df[487] = t7945+t8564+t8565;
     df[486] = t7946+t8565;
@@ -10722,7 +10722,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[482] = df[483];
     df[481] = df[482];
     df[480] = t155*t139;
-    const double t8566 = df[480];
+    const MBPOL_POLY_REAL t8566 = df[480];
     df[479] = t8563+t8566;
     df[478] = t7945+t8566;
     df[477] = df[478];
@@ -10731,15 +10731,15 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[474] = df[475];
     df[473] = df[474];
     df[472] = t146+t155;
-    const double t8741 = df[472];
+    const MBPOL_POLY_REAL t8741 = df[472];
     df[471] = t8741*t136;
-    const double t8568 = df[471];
+    const MBPOL_POLY_REAL t8568 = df[471];
     df[470] = t7944+t7950+t8018+t8021+t8563+t8568;
     df[469] = t7951+t8021+t8564+t8568;
     df[468] = t7946+t8021+t8565+t8568;
     df[467] = t7945+t8021+t8566+t8568;
     df[465] = t8741*t132;
-    const double t8570 = df[465];
+    const MBPOL_POLY_REAL t8570 = df[465];
     df[464] = t7944+t7950+t8018+t8022+t8563+t8570;
     df[463] = t7945+t8022+t8566+t8570;
     df[462] = t7946+t8022+t8565+t8570;
@@ -10750,10 +10750,10 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[457] = df[458];
     df[456] = df[459];
     df[454] = t8741*t126;
-    const double t8572 = df[454];
+    const MBPOL_POLY_REAL t8572 = df[454];
     df[453] = t7944+t7950+t8018+t8024+t8563+t8572;
     df[452] = t7951+t8024+t8564+t8572;
-    const double t8574 = t8741*t77;
+    const MBPOL_POLY_REAL t8574 = t8741*t77;
     df[450] = t7944+t7950+t8018+t8026+t8563+t8574;
     df[449] = t8024+t8026+t8572+t8574;
     df[448] = df[449];
@@ -10763,34 +10763,34 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[444] = df[445];
     df[443] = t8572+t8574;
     df[442] = df[443];
-    const double t8576 = t8741*t73;
+    const MBPOL_POLY_REAL t8576 = t8741*t73;
     df[440] = t8048+t8576;
     df[439] = t8053+t8576;
     df[438] = df[439];
     df[437] = df[440];
-    const double t8578 = t8741*t72;
+    const MBPOL_POLY_REAL t8578 = t8741*t72;
     df[435] = t8051+t8578;
     df[434] = t8050+t8578;
     df[433] = df[434];
-    const double t8580 = t8741*t67;
+    const MBPOL_POLY_REAL t8580 = t8741*t67;
     df[431] = t8042+t8580;
     df[430] = t8047+t8580;
     df[429] = df[430];
-    const double t8582 = t8741*t50;
+    const MBPOL_POLY_REAL t8582 = t8741*t50;
     df[427] = t8044+t8582;
     df[426] = df[427];
-    const double t8584 = t8741*t37;
+    const MBPOL_POLY_REAL t8584 = t8741*t37;
     df[424] = t8054+t8584;
-    const double t8586 = t8741*t26;
+    const MBPOL_POLY_REAL t8586 = t8741*t26;
     df[422] = t8060+t8586;
-    const double t8588 = t8545*t20;
-    const double t8590 = t8741*t20;
+    const MBPOL_POLY_REAL t8588 = t8545*t20;
+    const MBPOL_POLY_REAL t8590 = t8741*t20;
     df[420] = t8588+t8590;
-    const double t8591 = t20*t20;
-    const double t8592 = t26*t26;
+    const MBPOL_POLY_REAL t8591 = t20*t20;
+    const MBPOL_POLY_REAL t8592 = t26*t26;
     df[418] = t8591+t8592+t8506*t5;
     df[416] = t309*t309;
-    const double t8753 = df[416];
+    const MBPOL_POLY_REAL t8753 = df[416];
     df[415] = t8354+t8753;
     df[414] = df[415];
     df[413] = df[414];
@@ -10798,39 +10798,39 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[410] = df[411];
     df[409] = df[410];
     df[408] = t309*t143;
-    const double t8754 = df[2977];
-    const double t8755 = df[408];
+    const MBPOL_POLY_REAL t8754 = df[2977];
+    const MBPOL_POLY_REAL t8755 = df[408];
     df[407] = t8754+t7941+t8753+t8755;
     df[405] = t309*t215;
-    const double t8756 = df[405];
+    const MBPOL_POLY_REAL t8756 = df[405];
     df[404] = t7937+t8756;
     df[403] = df[404];
     df[402] = df[403];
     df[400] = df[404];
     df[399] = df[400];
     df[398] = t309*t212;
-    const double t8602 = df[398];
+    const MBPOL_POLY_REAL t8602 = df[398];
     df[397] = t8339+t8602;
     df[396] = df[397];
     df[395] = df[396];
     df[394] = df[397];
     df[393] = df[394];
     df[392] = t309*t254;
-    const double t8604 = df[392];
+    const MBPOL_POLY_REAL t8604 = df[392];
     df[391] = t7926+t8604;
     df[390] = df[391];
     df[389] = df[390];
     df[388] = df[389];
     df[387] = df[388];
     df[386] = t309*t275;
-    const double t8605 = df[386];
+    const MBPOL_POLY_REAL t8605 = df[386];
     df[385] = t7931+t8605;
     df[384] = df[385];
     df[383] = df[384];
     df[382] = df[383];
     df[381] = df[382];
     df[380] = t309*t179;
-    const double t8606 = df[380];
+    const MBPOL_POLY_REAL t8606 = df[380];
     df[379] = t7933+t8606;
     df[378] = df[379];
     df[377] = df[378];
@@ -10838,22 +10838,22 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[375] = t309*t155;
     df[374] = t309*t146;
     df[373] = t309*t145;
-    const double t8607 = df[375];
-    const double t8608 = df[373];
+    const MBPOL_POLY_REAL t8607 = df[375];
+    const MBPOL_POLY_REAL t8608 = df[373];
     df[372] = t7935+t7929+t8607+t8608;
     df[371] = df[372];
     df[370] = t309*t139;
-    const double t8609 = df[374];
-    const double t8610 = df[370];
+    const MBPOL_POLY_REAL t8609 = df[374];
+    const MBPOL_POLY_REAL t8610 = df[370];
     df[369] = t7942+t7939+t8609+t8610;
     df[368] = df[369];
     df[367] = t143+t309;
-    const double t8757 = df[367];
+    const MBPOL_POLY_REAL t8757 = df[367];
     df[366] = t8757*t136;
     df[363] = t8757*t132;
     df[361] = t8757*t126;
     df[358] = t136*t136;
-    const double t8614 = df[358];
+    const MBPOL_POLY_REAL t8614 = df[358];
     df[357] = t8027+t8614;
     df[356] = df[357];
     df[355] = t8039+t8027+t8040+t8614;
@@ -10863,7 +10863,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[351] = df[352];
     df[350] = df[353];
     df[349] = t136*t132;
-    const double t8615 = df[349];
+    const MBPOL_POLY_REAL t8615 = df[349];
     df[348] = t8614+t8615;
     df[347] = t8041+t8615;
     df[346] = df[347];
@@ -10872,7 +10872,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[343] = df[345];
     df[342] = df[344];
     df[341] = t136*t126;
-    const double t8616 = df[341];
+    const MBPOL_POLY_REAL t8616 = df[341];
     df[340] = t8614+t8616;
     df[339] = t8028+t8615+t8616;
     df[338] = t8029+t8616;
@@ -10883,7 +10883,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[333] = df[334];
     df[332] = df[333];
     df[331] = df[332];
-    const double t8617 = t136*t77;
+    const MBPOL_POLY_REAL t8617 = t136*t77;
     df[330] = t8617+t8614;
     df[329] = t8028+t8617;
     df[328] = df[329];
@@ -10894,8 +10894,8 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[323] = df[324];
     df[322] = df[323];
     df[321] = t132+t136;
-    const double t8760 = df[321];
-    const double t8619 = t8760*t73;
+    const MBPOL_POLY_REAL t8760 = df[321];
+    const MBPOL_POLY_REAL t8619 = t8760*t73;
     df[320] = t8044+t8619;
     df[319] = t8047+t8576+t8578+t8619;
     df[318] = t8048+t8051+t8047+t8619;
@@ -10903,41 +10903,41 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[316] = t8045+t8619;
     df[315] = df[316];
     df[314] = df[317];
-    const double t8621 = t8760*t72;
+    const MBPOL_POLY_REAL t8621 = t8760*t72;
     df[312] = t8048+t8051+t8044+t8621;
     df[311] = t8044+t8576+t8578+t8621;
     df[310] = t8582+t8621;
     df[309] = t8042+t8621;
     df[308] = df[310];
     df[307] = df[309];
-    const double t8623 = t8760*t67;
+    const MBPOL_POLY_REAL t8623 = t8760*t67;
     df[305] = t8050+t8623;
     df[304] = t8051+t8623;
     df[303] = t8576+t8623;
     df[302] = df[303];
     df[301] = df[305];
     df[300] = df[304];
-    const double t8625 = t8760*t50;
+    const MBPOL_POLY_REAL t8625 = t8760*t50;
     df[298] = t8053+t8625;
     df[297] = t8048+t8625;
     df[296] = t8578+t8625;
     df[295] = df[297];
     df[294] = df[296];
-    const double t8627 = t8760*t37;
+    const MBPOL_POLY_REAL t8627 = t8760*t37;
     df[292] = t8584+t8627;
     df[291] = t8056+t8627;
     df[290] = t8054+t8056+t8584+t8627;
-    const double t8628 = t8534*t26;
-    const double t8630 = t8760*t26;
+    const MBPOL_POLY_REAL t8628 = t8534*t26;
+    const MBPOL_POLY_REAL t8630 = t8760*t26;
     df[288] = t8628+t8630;
     df[287] = t8590+t8630;
     df[286] = t8628+t8060+t8586+t8630;
-    const double t8632 = t8760*t20;
+    const MBPOL_POLY_REAL t8632 = t8760*t20;
     df[284] = t8058+t8632;
     df[283] = t8628+t8588+t8586+t8632;
     df[282] = t146+t132+t155+t136;
     df[280] = t475*t155;
-    const double t8633 = df[280];
+    const MBPOL_POLY_REAL t8633 = df[280];
     df[279] = t8607+t8633;
     df[278] = t7942+t7943+t8607+t8633;
     df[277] = df[279];
@@ -10945,7 +10945,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[275] = t7935+t7936+t8607+t8633;
     df[274] = df[275];
     df[273] = t475*t275;
-    const double t8634 = df[273];
+    const MBPOL_POLY_REAL t8634 = df[273];
     df[272] = t7927+t8634;
     df[271] = t8604+t8634;
     df[270] = df[271];
@@ -10960,7 +10960,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[261] = df[262];
     df[260] = df[261];
     df[259] = t475*t212;
-    const double t8635 = df[259];
+    const MBPOL_POLY_REAL t8635 = df[259];
     df[258] = t8602+t8635;
     df[257] = t7937+t8345+t8756+t8635;
     df[256] = t8345+t8635;
@@ -10982,14 +10982,14 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[240] = df[241];
     df[239] = df[240];
     df[238] = t475*t146;
-    const double t8637 = df[238];
+    const MBPOL_POLY_REAL t8637 = df[238];
     df[237] = t8609+t8637;
     df[236] = t7935+t7936+t8609+t8637;
     df[235] = df[237];
     df[234] = t7942+t7943+t8609+t8637;
     df[233] = df[234];
     df[232] = t475*t215;
-    const double t8638 = df[232];
+    const MBPOL_POLY_REAL t8638 = df[232];
     df[231] = t8756+t8638;
     df[230] = t8339+t8345+t8756+t8638;
     df[229] = t7938+t8638;
@@ -11007,7 +11007,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[216] = df[217];
     df[215] = df[216];
     df[214] = t475*t309;
-    const double t8768 = df[214];
+    const MBPOL_POLY_REAL t8768 = df[214];
     df[213] = t8754+t8768;
     df[212] = df[213];
     df[211] = df[212];
@@ -11019,7 +11019,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[204] = df[205];
     df[203] = df[204];
     df[202] = t475*t475;
-    const double t8643 = df[202];
+    const MBPOL_POLY_REAL t8643 = df[202];
     df[201] = t7941+t8643;
     df[200] = df[201];
     df[199] = df[200];
@@ -11043,20 +11043,20 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[180] = df[181];
     df[179] = df[201];
     df[178] = t240+t475;
-    const double t8769 = df[178];
+    const MBPOL_POLY_REAL t8769 = df[178];
     df[177] = t8769*t136;
-    const double t8646 = df[366];
-    const double t8647 = df[177];
+    const MBPOL_POLY_REAL t8646 = df[366];
+    const MBPOL_POLY_REAL t8647 = df[177];
     df[176] = t8646+t8647;
     df[175] = df[176];
-    const double t8648 = df[363];
+    const MBPOL_POLY_REAL t8648 = df[363];
     df[174] = t8648+t8647;
     df[173] = df[174];
     df[172] = t7935+t7936+t8607+t8648+t8633+t8647;
     df[171] = df[172];
     df[170] = t475+t240+t143+t309;
     df[169] = t475*t145;
-    const double t8649 = df[169];
+    const MBPOL_POLY_REAL t8649 = df[169];
     df[168] = t8608+t8649;
     df[167] = t7939+t7940+t8608+t8649;
     df[166] = t7930+t7936+t8633+t8649;
@@ -11070,23 +11070,23 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[158] = t7929+t7930+t8608+t8648+t8647+t8649;
     df[157] = df[158];
     df[156] = df[170];
-    const double t8770 = df[156];
-    const double t8650 = t8770*t73;
-    const double t8652 = t8770*t72;
+    const MBPOL_POLY_REAL t8770 = df[156];
+    const MBPOL_POLY_REAL t8650 = t8770*t73;
+    const MBPOL_POLY_REAL t8652 = t8770*t72;
     df[155] = t8650+t8652;
     df[154] = df[155];
     df[152] = t8769*t132;
-    const double t8654 = df[152];
+    const MBPOL_POLY_REAL t8654 = df[152];
     df[151] = t8648+t8654;
     df[150] = t8646+t8654;
     df[149] = df[150];
     df[148] = t7942+t7943+t8609+t8646+t8637+t8654;
     df[147] = df[148];
     df[145] = t8769*t126;
-    const double t8656 = df[361];
-    const double t8657 = df[145];
+    const MBPOL_POLY_REAL t8656 = df[361];
+    const MBPOL_POLY_REAL t8657 = df[145];
     df[144] = t8656+t8657;
-    const double t8659 = t8757*t77;
+    const MBPOL_POLY_REAL t8659 = t8757*t77;
     df[143] = t8659+t8657;
     df[142] = df[143];
     df[141] = t8648+t8659+t8647+t8657;
@@ -11095,13 +11095,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[138] = t7935+t7936+t8607+t8659+t8633+t8657;
     df[137] = df[138];
     df[136] = df[139];
-    const double t8661 = t8770*t67;
+    const MBPOL_POLY_REAL t8661 = t8770*t67;
     df[133] = t8650+t8661;
     df[132] = t8652+t8661;
     df[131] = df[132];
     df[130] = df[133];
     df[129] = t475*t254;
-    const double t8662 = df[129];
+    const MBPOL_POLY_REAL t8662 = df[129];
     df[128] = t7932+t8662;
     df[127] = t7926+t7932+t8604+t8662;
     df[126] = t7937+t7931+t7932+t7938+t8756+t8605+t8638+t8662;
@@ -11122,7 +11122,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[111] = df[112];
     df[110] = df[111];
     df[109] = t475*t179;
-    const double t8663 = df[109];
+    const MBPOL_POLY_REAL t8663 = df[109];
     df[108] = t7933+t7934+t8606+t8663;
     df[107] = t8606+t8663;
     df[106] = df[107];
@@ -11141,7 +11141,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[93] = df[94];
     df[92] = df[93];
     df[91] = t475*t143;
-    const double t8664 = df[91];
+    const MBPOL_POLY_REAL t8664 = df[91];
     df[90] = t8643+t8664;
     df[89] = t8358+t8664;
     df[88] = df[89];
@@ -11164,13 +11164,13 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[70] = df[71];
     df[69] = df[70];
     df[68] = df[69];
-    const double t8668 = t8770*t50;
+    const MBPOL_POLY_REAL t8668 = t8770*t50;
     df[66] = t8652+t8668;
     df[65] = t8650+t8668;
     df[64] = df[65];
     df[63] = df[66];
     df[62] = t475*t240;
-    const double t8669 = df[62];
+    const MBPOL_POLY_REAL t8669 = df[62];
     df[61] = t8643+t8669;
     df[60] = t8755+t8669;
     df[59] = df[60];
@@ -11189,7 +11189,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[45] = df[46];
     df[44] = df[45];
     df[42] = t475*t139;
-    const double t8672 = df[42];
+    const MBPOL_POLY_REAL t8672 = df[42];
     df[41] = t8610+t8672;
     df[40] = t7935+t7929+t7940+t7943+t8607+t8608+t8637+t8672;
     df[39] = t7940+t7943+t8637+t8672;
@@ -11202,7 +11202,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[32] = t7939+t7940+t8610+t8646+t8654+t8672;
     df[31] = df[32];
     df[28] = t8770*t26+t8770*t20;
-    const double t8677 = t8769*t77;
+    const MBPOL_POLY_REAL t8677 = t8769*t77;
     df[25] = t8656+t8677;
     df[24] = df[25];
     df[23] = t8646+t8656+t8654+t8677;
@@ -11211,7 +11211,7 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[20] = t7942+t7943+t8609+t8656+t8637+t8677;
     df[19] = df[20];
     df[18] = df[21];
-    const double t8678 = t67*t67;
+    const MBPOL_POLY_REAL t8678 = t67*t67;
     df[17] = t8032+t8678;
     df[16] = t8031+t8678;
     df[15] = df[16];
@@ -11221,2586 +11221,2586 @@ t6389)*t3116+t7610*t212+(t6837+t7679)*t7493;
     df[11] = df[12];
     df[10] = df[11];
     df[9] = df[10];
-    const double t8682 = t67*t37;
+    const MBPOL_POLY_REAL t8682 = t67*t37;
     df[8] = t7924+t8682;
     df[7] = t8033+t8682;
     df[6] = t8033+t7924+t7925+t8682;
-    const double t8683 = t67*t26;
+    const MBPOL_POLY_REAL t8683 = t67*t26;
     df[5] = t8038+t8683;
-    const double t8684 = t72*t20;
+    const MBPOL_POLY_REAL t8684 = t72*t20;
     df[4] = t8034+t8037+t8684+t8683;
     df[3] = t8034+t8035+t8038+t8683;
-    const double t8685 = t67*t20;
+    const MBPOL_POLY_REAL t8685 = t67*t20;
     df[2] = t8684+t8685;
     df[1] = t8035+t8685;
-    const double t8718 = t257+t468+t311+t8282*t2758+t8217*t3334+df[2851]*t1497+df[2927]*
+    const MBPOL_POLY_REAL t8718 = t257+t468+t311+t8282*t2758+t8217*t3334+df[2851]*t1497+df[2927]*
 t2303+t8326*t2815+t8305*t2449+t7952*t5291+t7816*t6046;
-    const double t8801 = df[1799];
-    const double t8733 = t7809*t6116+df[2022]*t3481+t7739*t6790+t8160*t3883+t7705*t6937+
+    const MBPOL_POLY_REAL t8801 = df[1799];
+    const MBPOL_POLY_REAL t8733 = t7809*t6116+df[2022]*t3481+t7739*t6790+t8160*t3883+t7705*t6937+
 t7967*t5188+t8801*t3199+t7803*t6455+t7661*t7081+t7641*t7223+t8370*t1997+df
 [2321]*t4215;
-    const double t8814 = df[1721];
-    const double t8823 = df[966];
-    const double t8826 = df[2216];
-    const double t8751 = t7847*t5580+df[1677]*t2490+t8814*t2720+df[2662]*t3461+t8066*t4723+
+    const MBPOL_POLY_REAL t8814 = df[1721];
+    const MBPOL_POLY_REAL t8823 = df[966];
+    const MBPOL_POLY_REAL t8826 = df[2216];
+    const MBPOL_POLY_REAL t8751 = t7847*t5580+df[1677]*t2490+t8814*t2720+df[2662]*t3461+t8066*t4723+
 df[1202]*t2039+t7776*t6335+t8095*t4168+t8823*t1610+t8442*t1721+t8826*t4007;
-    const double t8765 = df[2578]*t4327+t8086*t4513+t7615*t7294+t8643*t325+t7984*t2755+t7976
+    const MBPOL_POLY_REAL t8765 = df[2578]*t4327+t8086*t4513+t7615*t7294+t8643*t325+t7984*t2755+t7976
 *t5060+t7493*t6619+t2404*t5159+t2341*t2937+t3120*t5703+t3116*t5786+t4135*t3982;
-    const double t8786 = t2341*t2884+t3116*t6159+t475*t134+t5387+t5477+t5525+df[2581]*t4215+
+    const MBPOL_POLY_REAL t8786 = t2341*t2884+t3116*t6159+t475*t134+t5387+t5477+t5525+df[2581]*t4215+
 t8043*t3201+t8370*t1837+t7616*t4226+t7615*t7302+t8430*t1495+df[2869]*t1497+
 t8305*t2552+t8690*t3009+df[3172]*t2033+df[1352]*t2490;
-    const double t8805 = t7803*t6444;
-    const double t8871 = df[2137];
-    const double t8806 = t8086*t4520+t8095*t4331+t8390*t2256+t7952*t5287+t7941*t325+t7816*
+    const MBPOL_POLY_REAL t8805 = t7803*t6444;
+    const MBPOL_POLY_REAL t8871 = df[2137];
+    const MBPOL_POLY_REAL t8806 = t8086*t4520+t8095*t4331+t8390*t2256+t7952*t5287+t7941*t325+t7816*
 t6069+t7809*t6146+t7999*t4470+t8172*t4005+t7822*t1757+t8871*t3199+t8286*t2815+
 t7976*t5027+t7739*t6681+df[2818]*t2718+t7705*t6880+t8805;
-    const double t8831 = t8275*t3197+df[1529]*t2785+t8443*t2755+t7967*t5215+t7742*t4018+df
+    const MBPOL_POLY_REAL t8831 = t8275*t3197+df[1529]*t2785+t8443*t2755+t7967*t5215+t7742*t4018+df
 [2648]*t3461+t8067*t3524+t8066*t4707+t8238*t3600+df[940]*t1610+t8282*t2764+df
 [2315]*t4204+t7641*t7188+df[61]*t141+df[4058]*t3486+t7661*t7077+t8446*t1608;
-    const double t8904 = df[2279];
-    const double t8918 = df[1591];
-    const double t8856 = t8442*t1695+t8904*t4007+t8160*t3906+df[2917]*t2303+t8406*t2351+
+    const MBPOL_POLY_REAL t8904 = df[2279];
+    const MBPOL_POLY_REAL t8918 = df[1591];
+    const MBPOL_POLY_REAL t8856 = t8442*t1695+t8904*t4007+t8160*t3906+df[2917]*t2303+t8406*t2351+
 t8052*t6455+t7776*t6422+df[1951]*t3481+t8217*t3147+df[3303]*t2515+t8918*t2720+
 df[1085]*t2039+t7847*t5663+df[2459]*t4327+t7493*t6588+t2404*t5314+t4135*t4049+
 t3120*t5681;
-    const double t8881 = t4135*t4759+t710+t7967*t5213+t7781*t6455+t8445*t2815+df[2937]*t2039
+    const MBPOL_POLY_REAL t8881 = t4135*t4759+t710+t7967*t5213+t7781*t6455+t8445*t2815+df[2937]*t2039
 +t7952*t5294+t8172*t4018+t8904*t4012+df[2292]*t4007+t8160*t3913+t7742*t4005+
 t8153*t4226+df[2449]*t4215+t7816*t6054+t8112*t2256+t7809*t6135+t649+df[2967]*
 t186+t7739*t6792;
-    const double t8914 = t8305*t2415+t8918*t2891+df[1681]*t2515+df[1484]*t2720+df[1719]*
+    const MBPOL_POLY_REAL t8914 = t8305*t2415+t8918*t2891+df[1681]*t2515+df[1484]*t2720+df[1719]*
 t2718+df[3902]*t4204+t7661*t7027+t7662*t3600+t7641*t7116+df[820]*t1497+df[876]*
 t1610;
-    const double t8943 = t7953*t3524+t7615*t7273+t8442*t1518+df[940]*t1761+t8052*t6446+t8753
+    const MBPOL_POLY_REAL t8943 = t7953*t3524+t7615*t7273+t8442*t1518+df[940]*t1761+t8052*t6446+t8753
 *t325+t7776*t6420+t8043*t3197+t8669*t118+df[183]*t141+df[2461]*t4222+t8095*
 t4317+df[2570]*t4327+t8086*t4409+t8583*t4470+t7822*t1608+df[2019]*t3486+t8871*
 t3195+t8148*t3009+df[1949]*t3477;
-    const double t8971 = df[2655]*t3481+t8066*t4710+df[2758]*t2490+t7976*t5033+t2404*t5111+
+    const MBPOL_POLY_REAL t8971 = df[2655]*t3481+t8066*t4710+df[2758]*t2490+t7976*t5033+t2404*t5111+
 t3116*t6163+t240*t5402+t2341*t2130+t475*t312+t7493*t7381+t3120*t5678;
-    const double t9000 = t475*t138+t3120*t5490+t4135*t4019+t3116*t6187+t7493*t7388+t2341*
+    const MBPOL_POLY_REAL t9000 = t475*t138+t3120*t5490+t4135*t4019+t3116*t6187+t7493*t7388+t2341*
 t2838+t309*t641+t240*t5389+t2404*t5318+df[2757]*t3009+t7739*t6706+t7992*t2815+
 t7976*t5038+df[2874]*t2490+df[1940]*t3461+t8049*t6455+t7776*t6432+t8442*t1743+
 df[2135]*t3199+df[2140]*t3201;
-    const double t9036 = t7803*t6446+t7641*t7210+df[2610]*t3197+df[875]*t1608+df[52]*t118+df
+    const MBPOL_POLY_REAL t9036 = t7803*t6446+t7641*t7210+df[2610]*t3197+df[875]*t1608+df[52]*t118+df
 [90]*t186+t7967*t5200+df[1264]*t2351+df[2379]*t4327+t8095*t4171+df[2448]*t4204;
-    const double t9075 = t8282*t2620+t8814*t2891+df[1738]*t2785+t7847*t5623+t8354*t325+df
+    const MBPOL_POLY_REAL t9075 = t8282*t2620+t8814*t2891+df[1738]*t2785+t7847*t5623+t8354*t325+df
 [2025]*t3477+t8370*t2031+df[1317]*t1497+t8801*t3195+df[2462]*t4470+df[1368]*
 t2515;
-    const double t9107 = df[1678]*t2480+df[1203]*t2037+df[1235]*t2303+t7705*t6914+df[1528]*
+    const MBPOL_POLY_REAL t9107 = df[1678]*t2480+df[1203]*t2037+df[1235]*t2303+t7705*t6914+df[1528]*
 t2787+df[1483]*t2718+t8305*t2432+t8333*t2755+t6019+t5735+t6047;
-    const double t9124 = t240*t5406+t309*t634+t143*t5730+t7493*t7391+t475*t322+t3116*t6174+
+    const MBPOL_POLY_REAL t9124 = t240*t5406+t309*t634+t143*t5730+t7493*t7391+t475*t322+t3116*t6174+
 t3120*t5485+t2404*t5312+t4135*t3996+t2341*t2852+t1081+df[3826]*t4321+df[2566]*
 t4323+df[2128]*t3234;
-    const double t9104 = df[2016];
-    const double t9111 = df[1679];
-    const double t9140 = t8198*t3839+df[2372]*t4325+t8135*t4406+t8754*t135+df[3005]*t440+df
+    const MBPOL_POLY_REAL t9104 = df[2016];
+    const MBPOL_POLY_REAL t9111 = df[1679];
+    const MBPOL_POLY_REAL t9140 = t8198*t3839+df[2372]*t4325+t8135*t4406+t8754*t135+df[3005]*t440+df
 [1976]*t3457+t8217*t3136+t9104*t3475+df[3498]*t6459+df[2970]*t327+df[1648]*
 t2881+t8305*t2580+t9111*t2503+df[1228]*t2301+df[1260]*t2299;
-    const double t9121 = df[1934];
-    const double t9123 = df[1948];
-    const double t9130 = df[1205];
-    const double t9132 = df[2326];
-    const double t9157 = t8020*t3965+df[3744]*t4016+t7739*t6780+t8046*t3191+df[1476]*t2716+
+    const MBPOL_POLY_REAL t9121 = df[1934];
+    const MBPOL_POLY_REAL t9123 = df[1948];
+    const MBPOL_POLY_REAL t9130 = df[1205];
+    const MBPOL_POLY_REAL t9132 = df[2326];
+    const MBPOL_POLY_REAL t9157 = t8020*t3965+df[3744]*t4016+t7739*t6780+t8046*t3191+df[1476]*t2716+
 df[1501]*t2751+t9121*t3459+t9123*t3479+df[3953]*t3455+t7693*t3557+df[1148]*
 t2166+t8370*t1842+t9130*t2016+t9132*t4236+df[1069]*t2018;
-    const double t9134 = df[1361];
-    const double t9175 = t9134*t2505+df[3333]*t2499+df[3344]*t1489+df[3439]*t2297+df[3457]*
+    const MBPOL_POLY_REAL t9134 = df[1361];
+    const MBPOL_POLY_REAL t9175 = t9134*t2505+df[3333]*t2499+df[3344]*t1489+df[3439]*t2297+df[3457]*
 t2035+t8196*t2080+t7809*t6118+t8212*t3765+df[3842]*t4229+t8095*t4177+df[1313]*
 t1491+df[1339]*t1973+df[3666]*t3203+df[3687]*t4020+t7974*t3677;
-    const double t9153 = df[3796];
-    const double t9162 = df[4072];
-    const double t9166 = df[1587];
-    const double t9159 = df[4081];
-    const double t9194 = t9153*t4207+t8160*t3668+df[2236]*t4046+df[2268]*t4044+df[3999]*
+    const MBPOL_POLY_REAL t9153 = df[3796];
+    const MBPOL_POLY_REAL t9162 = df[4072];
+    const MBPOL_POLY_REAL t9166 = df[1587];
+    const MBPOL_POLY_REAL t9159 = df[4081];
+    const MBPOL_POLY_REAL t9194 = t9153*t4207+t8160*t3668+df[2236]*t4046+df[2268]*t4044+df[3999]*
 t3507+t9159*t3488+t7661*t7019+t9162*t3453+df[1545]*t2792+df[56]*t128+t9166*
 t2712+t7899*t3146+df[3100]*t2497+t8467*t1675;
-    const double t9180 = df[3600];
-    const double t9187 = df[1751];
-    const double t9210 = t8442*t1522+df[943]*t1604+df[192]*t351+t8768*t133+df[225]*t244+
+    const MBPOL_POLY_REAL t9180 = df[3600];
+    const MBPOL_POLY_REAL t9187 = df[1751];
+    const MBPOL_POLY_REAL t9210 = t8442*t1522+df[943]*t1604+df[192]*t351+t8768*t133+df[225]*t244+
 t7967*t5209+t7952*t5302+df[86]*t181+t9180*t6457+t8089*t6510+t7776*t6424+df
 [3626]*t3205+t7976*t5076+df[1910]*t3421+t9187*t2749;
-    const double t9193 = df[1720];
-    const double t9201 = df[3135];
-    const double t9228 = df[1760]*t2597+t8282*t2820+t7869*t2214+t7847*t5584+t9193*t2710+df
+    const MBPOL_POLY_REAL t9193 = df[1720];
+    const MBPOL_POLY_REAL t9201 = df[3135];
+    const MBPOL_POLY_REAL t9228 = df[1760]*t2597+t8282*t2820+t7869*t2214+t7847*t5584+t9193*t2710+df
 [1735]*t2799+df[3869]*t4605+df[3905]*t4319+t7705*t6921+t9201*t1487+df[3182]*
 t2295+t8510*t1295+df[868]*t1606+df[3228]*t2021+t7615*t7291;
-    const double t9209 = df[3391];
-    const double t9242 = t7641*t7191+df[1818]*t3236+df[812]*t1493+t8140*t1564+t9209*t1600+df
+    const MBPOL_POLY_REAL t9209 = df[3391];
+    const MBPOL_POLY_REAL t9242 = t7641*t7191+df[1818]*t3236+df[812]*t1493+t8140*t1564+t9209*t1600+df
 [3420]*t1602+t7816*t6041+t8254*t2562+df[2585]*t4211+t8613*t4370+t8086*t4570+
 t8066*t4675+df[1693]*t2714+t1300+t1198;
-    const double t9259 = t2404*t5331+t475*t359+t143*t5725+t3116*t5783+t2341*t2176+t4135*
+    const MBPOL_POLY_REAL t9259 = t2404*t5331+t475*t359+t143*t5725+t3116*t5783+t2341*t2176+t4135*
 t4776+t240*t5394+t7493*t6615+t215*t1195+t3120*t5476+t309*t629+t1075+t991+t996+
 t1001+t1008+t1014+t9162*t3455;
-    const double t9254 = df[3439];
-    const double t9279 = df[4081]*t3507+t7694*t3557+t7641*t7229+t7615*t7265+df[2969]*t351+
+    const MBPOL_POLY_REAL t9254 = df[3439];
+    const MBPOL_POLY_REAL t9279 = df[4081]*t3507+t7694*t3557+t7641*t7229+t7615*t7265+df[2969]*t351+
 t8754*t133+df[2981]*t244+df[3086]*t2560+df[1227]*t2299+df[1259]*t2301+t8466*
 t1675+t8136*t4406+df[2584]*t4236+t8140*t1780+df[3391]*t1602+df[3419]*t1600+
 t9254*t2295+df[1692]*t2716;
-    const double t9255 = t9193;
-    const double t9301 = df[1703]*t2881+t8282*t2670+t9255*t2712+df[3456]*t2021+t8467*t1673+
+    const MBPOL_POLY_REAL t9255 = t9193;
+    const MBPOL_POLY_REAL t9301 = df[1703]*t2881+t8282*t2670+t9255*t2712+df[3456]*t2021+t8467*t1673+
 t7900*t3146+df[3330]*t2497+t7832*t1564+t8370*t1848+df[1206]*t2018+df[230]*t242+
 df[252]*t440+t8198*t3837+t7967*t5179+t7952*t5253+df[3997]*t3488+t7661*t7024+
 t7976*t5030;
-    const double t9291 = df[943];
-    const double t9295 = df[3498];
-    const double t9324 = t8442*t1709+df[1544]*t2799+t9153*t4229+df[3825]*t4319+df[3841]*
+    const MBPOL_POLY_REAL t9291 = df[943];
+    const MBPOL_POLY_REAL t9295 = df[3498];
+    const MBPOL_POLY_REAL t9324 = t8442*t1709+df[1544]*t2799+t9153*t4229+df[3825]*t4319+df[3841]*
 t4207+df[3868]*t4603+df[1653]*t2879+t9111*t2505+df[2235]*t4044+df[3343]*t1487+
 t9291*t1606+t7809*t6148+t8509*t1295+t9295*t6457+t7801*t6510+df[811]*t1491+df
 [867]*t1604+df[1312]*t1493+t7816*t5929;
-    const double t9297 = t9187;
-    const double t9325 = df[1739];
-    const double t9348 = df[2565]*t4325+t9297*t2751+t8138*t4370+df[2418]*t4404+t8095*t4173+
+    const MBPOL_POLY_REAL t9297 = t9187;
+    const MBPOL_POLY_REAL t9325 = df[1739];
+    const MBPOL_POLY_REAL t9348 = df[2565]*t4325+t9297*t2751+t8138*t4370+df[2418]*t4404+t8095*t4173+
 df[1475]*t2714+df[1500]*t2749+t8046*t4763+t7902*t2562+df[2267]*t4046+df[85]*
 t181+df[3896]*t4605+df[3901]*t4321+t7705*t6930+df[3952]*t3453+df[3969]*t3555+
 t7690*t3677+t9325*t2792;
-    const double t9332 = df[2319];
-    const double t9343 = df[56];
-    const double t9370 = t9180*t6459+t8089*t6683+df[3625]*t3203+t7764*t3191+df[3663]*t3205+
+    const MBPOL_POLY_REAL t9332 = df[2319];
+    const MBPOL_POLY_REAL t9343 = df[56];
+    const MBPOL_POLY_REAL t9370 = t9180*t6459+t8089*t6683+df[3625]*t3203+t7764*t3191+df[3663]*t3205+
 df[3684]*t4016+t7755*t3965+t7739*t6687+t8020*t4000+df[3743]*t4020+t7870*t2214+
 t8086*t4509+t9332*t4211+t8305*t2401+t9166*t2710+t9343*t128+t9104*t3479+df[2053]
 *t3421;
-    const double t9395 = df[1406]*t2597+t8211*t3765+t7776*t6337+t8197*t3839+t8160*t3716+df
+    const MBPOL_POLY_REAL t9395 = df[1406]*t2597+t8211*t3765+t7776*t6337+t8197*t3839+t8160*t3716+df
 [1147]*t2164+df[694]*t1264+df[1179]*t2166+t8066*t4672+df[2371]*t4323+df[3207]*
 t2078+t9121*t3457+t9123*t3475+df[1975]*t3459+df[191]*t327+t8768*t135+df[1338]*
 t2470+t9134*t2503;
-    const double t9365 = t9201;
-    const double t9376 = df[3182];
-    const double t9409 = t8217*t3375+t8212*t3763+df[2127]*t3236+df[1065]*t2016+df[3098]*
+    const MBPOL_POLY_REAL t9365 = t9201;
+    const MBPOL_POLY_REAL t9376 = df[3182];
+    const MBPOL_POLY_REAL t9409 = t8217*t3375+t8212*t3763+df[2127]*t3236+df[1065]*t2016+df[3098]*
 t2499+t9365*t1489+t9376*t2297+t7872*t2080+t7847*t5582+df[3227]*t2035+df[1909]*
 t3419+df[1817]*t3234+df[1043]*t1973+t1025+t1034+t1048+t1057+t6233+t6430;
-    const double t9389 = df[1801];
-    const double t9402 = df[3096];
-    const double t9431 = t2341*t2564+t3120*t5645+t240*t5501+t475*t246+t3116*t6098+t212*t6419
+    const MBPOL_POLY_REAL t9389 = df[1801];
+    const MBPOL_POLY_REAL t9402 = df[3096];
+    const MBPOL_POLY_REAL t9431 = t2341*t2564+t3120*t5645+t240*t5501+t475*t246+t3116*t6098+t212*t6419
 +t143*t6032+t7493*t6779+t4135*t4766+t2404*t5078+t215*t1236+t309*t668+df[3284]*
 t2166+t8282*t3096+t9389*t3203+df[3063]*t1973+t9402*t2505;
-    const double t9406 = df[2919];
-    const double t9408 = df[1531];
-    const double t9415 = df[1473];
-    const double t9417 = df[1498];
-    const double t9424 = df[2933];
-    const double t9433 = df[222];
-    const double t9455 = df[1914]*t3417+df[2867]*t1969+df[1411]*t2595+t7719*t4370+t7967*
+    const MBPOL_POLY_REAL t9406 = df[2919];
+    const MBPOL_POLY_REAL t9408 = df[1531];
+    const MBPOL_POLY_REAL t9415 = df[1473];
+    const MBPOL_POLY_REAL t9417 = df[1498];
+    const MBPOL_POLY_REAL t9424 = df[2933];
+    const MBPOL_POLY_REAL t9433 = df[222];
+    const MBPOL_POLY_REAL t9455 = df[1914]*t3417+df[2867]*t1969+df[1411]*t2595+t7719*t4370+t7967*
 t5288+t9415*t2712+t9417*t2751+df[2906]*t2160+t9406*t2295+t9408*t2792+t9424*
 t2021+t7705*t7189+t8401*t2214+df[1574]*t2881+df[119]*t244+t7809*t6314+t9433*
 t396;
-    const double t9423 = df[3505];
-    const double t9432 = df[3403];
-    const double t9435 = df[211];
-    const double t9442 = df[3289];
-    const double t9445 = df[3298];
-    const double t9457 = df[3729];
-    const double t9459 = df[2754];
-    const double t9477 = t9435*t128+df[198]*t351+df[257]*t394+t8086*t4692+t9423*t6459+t9442*
+    const MBPOL_POLY_REAL t9423 = df[3505];
+    const MBPOL_POLY_REAL t9432 = df[3403];
+    const MBPOL_POLY_REAL t9435 = df[211];
+    const MBPOL_POLY_REAL t9442 = df[3289];
+    const MBPOL_POLY_REAL t9445 = df[3298];
+    const MBPOL_POLY_REAL t9457 = df[3729];
+    const MBPOL_POLY_REAL t9459 = df[2754];
+    const MBPOL_POLY_REAL t9477 = t9435*t128+df[198]*t351+df[257]*t394+t8086*t4692+t9423*t6459+t9442*
 t2016+t7847*t5978+t9445*t1493+df[2532]*t4605+t7827*t1675+t7816*t6182+t9432*
 t1606+t8095*t4607+df[1048]*t1971+t7752*t3839+t9457*t4044+t9459*t2497;
-    const double t9446 = df[905]*t1670;
-    const double t9462 = df[1074];
-    const double t9469 = df[865];
-    const double t9471 = df[3675];
-    const double t9476 = df[2626];
-    const double t9481 = df[3590];
-    const double t9487 = df[2774];
-    const double t9498 = t9462*t2035+t7739*t6931+t8418*t2080+t7770*t3765+t9469*t1602+t9446+
+    const MBPOL_POLY_REAL t9446 = df[905]*t1670;
+    const MBPOL_POLY_REAL t9462 = df[1074];
+    const MBPOL_POLY_REAL t9469 = df[865];
+    const MBPOL_POLY_REAL t9471 = df[3675];
+    const MBPOL_POLY_REAL t9476 = df[2626];
+    const MBPOL_POLY_REAL t9481 = df[3590];
+    const MBPOL_POLY_REAL t9487 = df[2774];
+    const MBPOL_POLY_REAL t9498 = t9462*t2035+t7739*t6931+t8418*t2080+t7770*t3765+t9469*t1602+t9446+
 t9471*t3234+t8061*t1295+t8474*t1564+t9476*t3488+t8225*t3677+t8066*t4793+t9481*
 t6457+t7799*t6510+t8280*t3146+df[1152]*t2162+t9487*t2710+t8370*t2082;
-    const double t9465 = df[2816];
-    const double t9467 = df[3813];
-    const double t9472 = df[1357];
-    const double t9490 = df[2797];
-    const double t9493 = df[3789];
-    const double t9495 = df[1225];
-    const double t9497 = df[2808];
-    const double t9506 = df[2842];
-    const double t9510 = df[2852];
-    const double t9516 = df[3689];
-    const double t9520 = t9490*t2714+t9493*t4211+t9495*t2297+t9497*t2799+t9465*t2749+t9467*
+    const MBPOL_POLY_REAL t9465 = df[2816];
+    const MBPOL_POLY_REAL t9467 = df[3813];
+    const MBPOL_POLY_REAL t9472 = df[1357];
+    const MBPOL_POLY_REAL t9490 = df[2797];
+    const MBPOL_POLY_REAL t9493 = df[3789];
+    const MBPOL_POLY_REAL t9495 = df[1225];
+    const MBPOL_POLY_REAL t9497 = df[2808];
+    const MBPOL_POLY_REAL t9506 = df[2842];
+    const MBPOL_POLY_REAL t9510 = df[2852];
+    const MBPOL_POLY_REAL t9516 = df[3689];
+    const MBPOL_POLY_REAL t9520 = t9490*t2714+t9493*t4211+t9495*t2297+t9497*t2799+t9465*t2749+t9467*
 t4323+df[2834]*t2597+t7976*t5187+t9506*t2593+t9472*t2499+t9510*t1487+t8351*
 t2562+df[948]*t1600+t8442*t1783+t9516*t4046+df[2400]*t4367+df[2417]*t4401;
-    const double t9491 = df[2156]*t3834;
-    const double t9499 = df[2314];
-    const double t9503 = df[1961];
-    const double t9525 = df[2445];
-    const double t9527 = df[2457];
-    const double t9532 = df[2126];
-    const double t9535 = df[2217];
-    const double t9537 = df[2265];
-    const double t9543 = df[4109];
-    const double t9545 = df[3225];
-    const double t9548 = df[1930];
-    const double t9550 = df[3995];
-    const double t9553 = df[3131];
-    const double t9539 = t7718*t4406+t9525*t4229+t9527*t4319+t7615*t7668+t7641*t7521+t9532*
+    const MBPOL_POLY_REAL t9491 = df[2156]*t3834;
+    const MBPOL_POLY_REAL t9499 = df[2314];
+    const MBPOL_POLY_REAL t9503 = df[1961];
+    const MBPOL_POLY_REAL t9525 = df[2445];
+    const MBPOL_POLY_REAL t9527 = df[2457];
+    const MBPOL_POLY_REAL t9532 = df[2126];
+    const MBPOL_POLY_REAL t9535 = df[2217];
+    const MBPOL_POLY_REAL t9537 = df[2265];
+    const MBPOL_POLY_REAL t9543 = df[4109];
+    const MBPOL_POLY_REAL t9545 = df[3225];
+    const MBPOL_POLY_REAL t9548 = df[1930];
+    const MBPOL_POLY_REAL t9550 = df[3995];
+    const MBPOL_POLY_REAL t9553 = df[3131];
+    const MBPOL_POLY_REAL t9539 = t7718*t4406+t9525*t4229+t9527*t4319+t7615*t7668+t7641*t7521+t9532*
 t3205+t9491+t8178*t3965+t9535*t4016+t9537*t4020+t8160*t4003+t9543*t4325+t9545*
 t2018+t9499*t4207+t9548*t3455+t9550*t3479+t9503*t3507+t9553*t1491;
-    const double t9507 = df[3616];
-    const double t9512 = df[2646];
-    const double t9564 = df[809];
-    const double t9567 = df[413];
-    const double t9574 = df[395];
-    const double t9582 = df[3417];
-    const double t9561 = df[3141]*t2503+t9507*t3236+t8512*t1233+df[687]*t1225+t9512*t3453+
+    const MBPOL_POLY_REAL t9507 = df[3616];
+    const MBPOL_POLY_REAL t9512 = df[2646];
+    const MBPOL_POLY_REAL t9564 = df[809];
+    const MBPOL_POLY_REAL t9567 = df[413];
+    const MBPOL_POLY_REAL t9574 = df[395];
+    const MBPOL_POLY_REAL t9582 = df[3417];
+    const MBPOL_POLY_REAL t9561 = df[3141]*t2503+t9507*t3236+t8512*t1233+df[687]*t1225+t9512*t3453+
 t7776*t6708+t9564*t1489+t9567*t327+df[3531]*t6507+t8755*t135+t9574*t437+df[388]
 *t440+t8277*t3191+t8669*t133+t9582*t1604+df[84]*t181+df[2637]*t3415;
-    const double t9529 = df[4122];
-    const double t9538 = df[2111]*t3760;
-    const double t9540 = df[3179];
-    const double t9589 = df[3239];
-    const double t9592 = df[2369];
-    const double t9599 = df[4055];
-    const double t9607 = df[1596];
-    const double t9609 = df[1645];
-    const double t9612 = df[3950];
-    const double t9579 = t9589*t2301+t9529*t4236+t9592*t4321+t8217*t3559+t8247*t3557+df
+    const MBPOL_POLY_REAL t9529 = df[4122];
+    const MBPOL_POLY_REAL t9538 = df[2111]*t3760;
+    const MBPOL_POLY_REAL t9540 = df[3179];
+    const MBPOL_POLY_REAL t9589 = df[3239];
+    const MBPOL_POLY_REAL t9592 = df[2369];
+    const MBPOL_POLY_REAL t9599 = df[4055];
+    const MBPOL_POLY_REAL t9607 = df[1596];
+    const MBPOL_POLY_REAL t9609 = df[1645];
+    const MBPOL_POLY_REAL t9612 = df[3950];
+    const MBPOL_POLY_REAL t9579 = t9589*t2301+t9529*t4236+t9592*t4321+t8217*t3559+t8247*t3557+df
 [4043]*t3457+t9599*t3475+t9538+t9540*t2299+t7952*t5390+df[3928]*t3421+t9607*
 t2716+t9609*t2967+t9612*t3459+t8305*t2883+t7661*t7319+t4935+t4864;
-    const double t9563 = t9564;
-    const double t9565 = t9582;
-    const double t9569 = t9469;
-    const double t9571 = df[3141];
-    const double t9602 = t309*t661+t475*t458+t254*t4926+t3120*t5637+t2404*t5212+t240*t5523+
+    const MBPOL_POLY_REAL t9563 = t9564;
+    const MBPOL_POLY_REAL t9565 = t9582;
+    const MBPOL_POLY_REAL t9569 = t9469;
+    const MBPOL_POLY_REAL t9571 = df[3141];
+    const MBPOL_POLY_REAL t9602 = t309*t661+t475*t458+t254*t4926+t3120*t5637+t2404*t5212+t240*t5523+
 t3116*t6379+t212*t6417+t143*t6030+t215*t1227+t4135*t3193+t7493*t6771+t2341*
 t3148+t9563*t1487+t9565*t1606+t7816*t6206+t8475*t1564+t9569*t1600+t9571*t2505;
-    const double t9573 = t9567;
-    const double t9576 = t9553;
-    const double t9581 = t9589;
-    const double t9583 = t9545;
-    const double t9597 = t9435;
-    const double t9643 = df[402];
-    const double t9667 = df[249];
-    const double t9627 = t9573*t351+t8755*t133+t9576*t1493+t9643*t396+t9540*t2301+t9581*
+    const MBPOL_POLY_REAL t9573 = t9567;
+    const MBPOL_POLY_REAL t9576 = t9553;
+    const MBPOL_POLY_REAL t9581 = t9589;
+    const MBPOL_POLY_REAL t9583 = t9545;
+    const MBPOL_POLY_REAL t9597 = t9435;
+    const MBPOL_POLY_REAL t9643 = df[402];
+    const MBPOL_POLY_REAL t9667 = df[249];
+    const MBPOL_POLY_REAL t9627 = t9573*t351+t8755*t133+t9576*t1493+t9643*t396+t9540*t2301+t9581*
 t2299+t9583*t2016+df[3273]*t2166+df[3289]*t2018+df[3283]*t2164+df[3300]*t1491+
 t8669*t135+df[127]*t242+df[3052]*t1973+df[179]*t327+df[228]*t394+t9597*t128+df
 [3062]*t2470+t9667*t437+df[265]*t440;
-    const double t9603 = t9402;
-    const double t9606 = t9497;
-    const double t9611 = t9525;
-    const double t9619 = t9476;
-    const double t9655 = t9603*t2503+df[382]*t244+t9606*t2792+t9465*t2751+df[2826]*t2881+
+    const MBPOL_POLY_REAL t9603 = t9402;
+    const MBPOL_POLY_REAL t9606 = t9497;
+    const MBPOL_POLY_REAL t9611 = t9525;
+    const MBPOL_POLY_REAL t9619 = t9476;
+    const MBPOL_POLY_REAL t9655 = t9603*t2503+df[382]*t244+t9606*t2792+t9465*t2751+df[2826]*t2881+
 t7720*t4370+t9611*t4207+df[2453]*t4321+df[2531]*t4603+df[2551]*t4605+t8095*
 t4626+t8086*t4639+t8277*t4763+t9619*t3507+df[2636]*t3417+t8248*t3557+t8066*
 t4814+df[2645]*t3455+df[2680]*t1264+df[2416]*t4401;
-    const double t9633 = t9481;
-    const double t9636 = t9510;
-    const double t9641 = t9543;
-    const double t9646 = t9424;
-    const double t9654 = t9459;
-    const double t9659 = t9490;
-    const double t9726 = df[2789];
-    const double t9679 = t8370*t2216+t9633*t6459+t8352*t2562+t9636*t1489+df[2866]*t1971+
+    const MBPOL_POLY_REAL t9633 = t9481;
+    const MBPOL_POLY_REAL t9636 = t9510;
+    const MBPOL_POLY_REAL t9641 = t9543;
+    const MBPOL_POLY_REAL t9646 = t9424;
+    const MBPOL_POLY_REAL t9654 = t9459;
+    const MBPOL_POLY_REAL t9659 = t9490;
+    const MBPOL_POLY_REAL t9726 = df[2789];
+    const MBPOL_POLY_REAL t9679 = t8370*t2216+t9633*t6459+t8352*t2562+t9636*t1489+df[2866]*t1971+
 t7967*t5275+t9641*t4323+df[2905]*t2162+df[2919]*t2297+t9646*t2035+t8419*t2080+
 t7952*t5383+t7615*t7597+df[4120]*t4211+df[83]*t181+t9654*t2499+df[2774]*t2712+
 t9726*t2967+t9659*t2716+t7976*t5176;
-    const double t9664 = t9495;
-    const double t9670 = df[3509];
-    const double t9742 = df[3531];
-    const double t9707 = t8402*t2214+df[3613]*t3234+t9664*t2295+t9446+t7809*t6319+t8442*
+    const MBPOL_POLY_REAL t9664 = t9495;
+    const MBPOL_POLY_REAL t9670 = df[3509];
+    const MBPOL_POLY_REAL t9742 = df[3531];
+    const MBPOL_POLY_REAL t9707 = t8402*t2214+df[3613]*t3234+t9664*t2295+t9446+t7809*t6319+t8442*
 t1566+t8474*t1780+df[949]*t1602+t9670*t6457+t9742*t6507+df[1047]*t1969+t7800*
 t6510+t9462*t2021+t7847*t5970+df[686]*t1233+df[680]*t1225+t7826*t1675+t7641*
 t7546+t7827*t1673;
-    const double t9690 = t9537;
-    const double t9692 = df[4048];
-    const double t9694 = df[4051];
-    const double t9699 = t9592;
-    const double t9703 = t9550;
-    const double t9705 = t9532;
-    const double t9715 = t9417;
-    const double t9734 = t9432*t1604+t8487*t1295+t8179*t3965+t9690*t4016+t9692*t3459+t9694*
+    const MBPOL_POLY_REAL t9690 = t9537;
+    const MBPOL_POLY_REAL t9692 = df[4048];
+    const MBPOL_POLY_REAL t9694 = df[4051];
+    const MBPOL_POLY_REAL t9699 = t9592;
+    const MBPOL_POLY_REAL t9703 = t9550;
+    const MBPOL_POLY_REAL t9705 = t9532;
+    const MBPOL_POLY_REAL t9715 = t9417;
+    const MBPOL_POLY_REAL t9734 = t9432*t1604+t8487*t1295+t8179*t3965+t9690*t4016+t9692*t3459+t9694*
 t3479+t7661*t7474+df[2323]*t4229+t9699*t4319+df[2399]*t4367+t9703*t3475+t9705*
 t3203+t9491+df[2217]*t4020+t8178*t4000+df[4033]*t3421+t8160*t3967+df[1913]*
 t3415+t7739*t6997+t9715*t2749;
-    const double t9718 = t9607;
-    const double t9720 = t9493;
-    const double t9730 = t9516;
-    const double t9735 = t9415;
-    const double t9737 = t9457;
-    const double t9745 = t9548;
-    const double t9747 = df[1952];
-    const double t9795 = df[1403];
-    const double t9762 = df[1532]*t2799+t9718*t2714+t9720*t4236+df[1582]*t2879+t7799*t6683+
+    const MBPOL_POLY_REAL t9718 = t9607;
+    const MBPOL_POLY_REAL t9720 = t9493;
+    const MBPOL_POLY_REAL t9730 = t9516;
+    const MBPOL_POLY_REAL t9735 = t9415;
+    const MBPOL_POLY_REAL t9737 = t9457;
+    const MBPOL_POLY_REAL t9745 = t9548;
+    const MBPOL_POLY_REAL t9747 = df[1952];
+    const MBPOL_POLY_REAL t9795 = df[1403];
+    const MBPOL_POLY_REAL t9762 = df[1532]*t2799+t9718*t2714+t9720*t4236+df[1582]*t2879+t7799*t6683+
 t7771*t3765+t7770*t3763+t9472*t2497+df[1391]*t2560+t9730*t4044+t9795*t2593+
 t7752*t3837+t9735*t2710+t9737*t4046+df[1104]*t2078+t7776*t6528+df[1151]*t2160+
 df[3927]*t3419+t9745*t3453+t9747*t3488;
-    const double t9751 = t9612;
-    const double t9770 = t9471;
-    const double t9786 = df[1996]*t3555+t9751*t3457+t8226*t3677+t8217*t3679+t9538+t9467*
+    const MBPOL_POLY_REAL t9751 = t9612;
+    const MBPOL_POLY_REAL t9770 = t9471;
+    const MBPOL_POLY_REAL t9786 = df[1996]*t3555+t9751*t3457+t8226*t3677+t8217*t3679+t9538+t9467*
 t4325+t7730*t4406+t8305*t2990+df[1662]*t2597+df[1651]*t2595+t7705*t7131+t8282*
 t3055+df[3855]*t4404+t9389*t3205+t8278*t3191+t8281*t3146+t7751*t3839+t9770*
 t3236+t1420+t1319;
-    const double t9801 = t254*t4911+t309*t654+t143*t6028+t3116*t6074+t475*t214+t212*t6411+
+    const MBPOL_POLY_REAL t9801 = t254*t4911+t309*t654+t143*t6028+t3116*t6074+t475*t214+t212*t6411+
 t7493*t7283+t275*t1403+t240*t5495+t4135*t4176+t3120*t5622;
-    const double t9805 = df[548];
-    const double t9815 = t2341*t2459+t2404*t5205+t215*t1200+t989+t955+t9805*t856+t7976*t5098
+    const MBPOL_POLY_REAL t9805 = df[548];
+    const MBPOL_POLY_REAL t9815 = t2341*t2459+t2404*t5205+t215*t1200+t989+t955+t9805*t856+t7976*t5098
 +df[2145]*t3473+t7641*t7544+t7816*t6134+df[1381]*t2249+df[2073]*t3258;
-    const double t9832 = df[1396]*t2306+t7705*t7236+t8217*t3706+t8066*t4845+df[242]*t293+df
+    const MBPOL_POLY_REAL t9832 = df[1396]*t2306+t7705*t7236+t8217*t3706+t8066*t4845+df[242]*t293+df
 [2509]*t4264+df[2525]*t4284+t8095*t4575+df[1320]*t2204+t8086*t4659+df[1366]*
 t2217;
-    const double t9852 = df[1526]*t2377+t7661*t7437+df[2061]*t3198+t8370*t2333+df[2405]*
+    const MBPOL_POLY_REAL t9852 = df[1526]*t2377+t7661*t7437+df[2061]*t3198+t8370*t2333+df[2405]*
 t4145+df[1167]*t1825+df[188]*t253+t7739*t6952+df[1216]*t1876+t7847*t5926+df
 [1238]*t1883+df[113]*t102;
-    const double t9875 = df[1094]*t1794+df[97]*t101+df[2389]*t4134+df[2227]*t3806+df[800]*
+    const MBPOL_POLY_REAL t9875 = df[1094]*t1794+df[97]*t101+df[2389]*t4134+df[2227]*t3806+df[800]*
 t1321+df[1136]*t1811+df[1080]*t1791+df[82]*t100+df[2360]*t4123+df[1788]*t2972+
 df[1811]*t3001;
-    const double t9878 = df[3565];
-    const double t9899 = df[2313];
-    const double t9896 = df[856]*t1351+t9878*t6315+df[2298]*t3918+df[894]*t1364+t7776*t6602+
+    const MBPOL_POLY_REAL t9878 = df[3565];
+    const MBPOL_POLY_REAL t9899 = df[2313];
+    const MBPOL_POLY_REAL t9896 = df[856]*t1351+t9878*t6315+df[2298]*t3918+df[894]*t1364+t7776*t6602+
 t8442*t1720+df[915]*t1396+df[1898]*t3071+t9899*t4088+df[1921]*t3072+df[699]*
 t1089+df[1986]*t3091;
-    const double t9916 = df[1033]*t1788+df[47]*t66+t8282*t3077+df[3524]*t6260+df[1769]*t2825
+    const MBPOL_POLY_REAL t9916 = df[1033]*t1788+df[47]*t66+t8282*t3077+df[3524]*t6260+df[1769]*t2825
 +df[841]*t1331+df[1568]*t2519+t7615*t7611+df[650]*t1013+t7967*t5269+df[1610]*
 t2520+df[668]*t1033;
-    const double t9936 = t7809*t6357+df[2197]*t3590+t8160*t3993+t7952*t5316+df[2209]*t3618+
+    const MBPOL_POLY_REAL t9936 = t7809*t6357+df[2197]*t3590+t8160*t3993+t7952*t5316+df[2209]*t3618+
 df[2100]*t3424+df[1464]*t2342+df[1493]*t2343+df[692]*t1046+t8305*t2931+df[3500]
 *t6240+df[1947]*t3090;
-    const double t9954 = t7493*t6802+t309*t648+t240*t5450+t275*t1389+t2404*t5407+t475*t466+
+    const MBPOL_POLY_REAL t9954 = t7493*t6802+t309*t648+t240*t5450+t275*t1389+t2404*t5407+t475*t466+
 t2341*t2421+t4135*t4740+t3120*t5608+t179*t963+t254*t4905+t215*t1173+t143*t6026+
 t3116*t6377;
-    const double t9957 = t8176*t3981;
-    const double t9960 = t8020*t3952;
-    const double t9948 = df[1752];
-    const double t9970 = t212*t6405+t711+df[3485]*t1215+t9957+t9948*t2736+df[3595]*t6464+
+    const MBPOL_POLY_REAL t9957 = t8176*t3981;
+    const MBPOL_POLY_REAL t9960 = t8020*t3952;
+    const MBPOL_POLY_REAL t9948 = df[1752];
+    const MBPOL_POLY_REAL t9970 = t212*t6405+t711+df[3485]*t1215+t9957+t9948*t2736+df[3595]*t6464+
 t9960+t8442*t1642+t9255*t2695+df[1730]*t2919+df[1745]*t2871+df[1178]*t2152+
 t8066*t4861+t7641*t7515+df[3790]*t4219;
-    const double t9972 = t8102*t4569;
-    const double t9976 = t8046*t3178;
-    const double t9977 = t8101*t4567;
-    const double t9944 = df[1708];
-    const double t9952 = t9325*t2796;
-    const double t9965 = df[867];
-    const double t9987 = t9972+t7776*t6652+t9965*t1594+df[1665]*t2581+t9976+t9977+t8095*
+    const MBPOL_POLY_REAL t9972 = t8102*t4569;
+    const MBPOL_POLY_REAL t9976 = t8046*t3178;
+    const MBPOL_POLY_REAL t9977 = t8101*t4567;
+    const MBPOL_POLY_REAL t9944 = df[1708];
+    const MBPOL_POLY_REAL t9952 = t9325*t2796;
+    const MBPOL_POLY_REAL t9965 = df[867];
+    const MBPOL_POLY_REAL t9987 = t9972+t7776*t6652+t9965*t1594+df[1665]*t2581+t9976+t9977+t8095*
 t4512+df[1172]*t2207+t9944*t2646+t8282*t3048+t7753*t3886+t7739*t7038+t8086*
 t4633+df[3742]*t4009+t9952;
-    const double t9991 = t7764*t3180;
-    const double t9992 = t8464*t1713;
-    const double t9995 = t7694*t3542;
-    const double t9996 = t7974*t3664;
-    const double t9997 = t7755*t3954;
-    const double t9959 = t9291;
-    const double t10004 = df[3715]*t3820+df[3662]*t3207+df[3683]*t4033+t9991+t9992+df[1712]*
+    const MBPOL_POLY_REAL t9991 = t7764*t3180;
+    const MBPOL_POLY_REAL t9992 = t8464*t1713;
+    const MBPOL_POLY_REAL t9995 = t7694*t3542;
+    const MBPOL_POLY_REAL t9996 = t7974*t3664;
+    const MBPOL_POLY_REAL t9997 = t7755*t3954;
+    const MBPOL_POLY_REAL t9959 = t9291;
+    const MBPOL_POLY_REAL t10004 = df[3715]*t3820+df[3662]*t3207+df[3683]*t4033+t9991+t9992+df[1712]*
 t2578+t9959*t1592+t9995+t9996+t9997+t7767*t3261+t8470*t1640+df[1684]*t2478+df
 [2534]*t4597+df[1691]*t2702;
-    const double t10008 = t8467*t1664;
-    const double t10013 = t8089*t6499;
-    const double t10015 = t7681*t3695;
-    const double t10016 = t7859*t2322;
-    const double t10019 = t9878*t6591;
-    const double t10020 = t7680*t3693;
-    const double t9975 = t9159;
-    const double t10021 = df[3640]*t3746+t10008+df[3624]*t3209+df[1702]*t2865+df[846]*t1557+
+    const MBPOL_POLY_REAL t10008 = t8467*t1664;
+    const MBPOL_POLY_REAL t10013 = t8089*t6499;
+    const MBPOL_POLY_REAL t10015 = t7681*t3695;
+    const MBPOL_POLY_REAL t10016 = t7859*t2322;
+    const MBPOL_POLY_REAL t10019 = t9878*t6591;
+    const MBPOL_POLY_REAL t10020 = t7680*t3693;
+    const MBPOL_POLY_REAL t9975 = t9159;
+    const MBPOL_POLY_REAL t10021 = df[3640]*t3746+t10008+df[3624]*t3209+df[1702]*t2865+df[846]*t1557+
 df[1647]*t2867+t10013+t9975*t3500+t10015+t10016+df[1759]*t2585+t7868*t1996+
 t10019+t10020;
-    const double t10026 = t7907*t2446;
-    const double t9985 = df[2234];
-    const double t10012 = t9985*t4038;
-    const double t10038 = df[224]*t230+t7789*t6571+df[4062]*t3400+df[1278]*t2106+t10026+
+    const MBPOL_POLY_REAL t10026 = t7907*t2446;
+    const MBPOL_POLY_REAL t9985 = df[2234];
+    const MBPOL_POLY_REAL t10012 = t9985*t4038;
+    const MBPOL_POLY_REAL t10038 = df[224]*t230+t7789*t6571+df[4062]*t3400+df[1278]*t2106+t10026+
 t10012+t7909*t1436+df[1258]*t2287+df[3851]*t4353+df[3867]*t4591+df[3010]*t422+
 df[1908]*t3409+df[3004]*t429+df[2994]*t234+df[2989]*t202;
-    const double t10041 = t8177*t3986;
-    const double t10045 = t8754*t137;
-    const double t10046 = t8613*t4359;
-    const double t10048 = t7801*t6501;
-    const double t10053 = t8768*t131;
-    const double t10043 = df[811];
-    const double t10055 = t8156*t3286+t10041+df[1245]*t2326+df[1226]*t2289+df[2202]*t3958+
+    const MBPOL_POLY_REAL t10041 = t8177*t3986;
+    const MBPOL_POLY_REAL t10045 = t8754*t137;
+    const MBPOL_POLY_REAL t10046 = t8613*t4359;
+    const MBPOL_POLY_REAL t10048 = t7801*t6501;
+    const MBPOL_POLY_REAL t10053 = t8768*t131;
+    const MBPOL_POLY_REAL t10043 = df[811];
+    const MBPOL_POLY_REAL t10055 = t8156*t3286+t10041+df[1245]*t2326+df[1226]*t2289+df[2202]*t3958+
 t10045+t10046+df[1146]*t2154+t10048+t8115*t4496+df[4068]*t3438+df[1617]*t2921+
 t7677*t3337+t10053+t10043*t1481;
-    const double t10056 = t8198*t3828;
-    const double t10057 = t8515*t1192;
-    const double t10063 = t7899*t3133;
-    const double t10064 = t8211*t3752;
-    const double t10067 = t7902*t2547;
-    const double t10023 = t9295*t6441;
-    const double t10031 = df[2963];
-    const double t10072 = t10056+t10057+t8517*t1120+df[3541]*t6493+t10023+df[3880]*t4263+
+    const MBPOL_POLY_REAL t10056 = t8198*t3828;
+    const MBPOL_POLY_REAL t10057 = t8515*t1192;
+    const MBPOL_POLY_REAL t10063 = t7899*t3133;
+    const MBPOL_POLY_REAL t10064 = t8211*t3752;
+    const MBPOL_POLY_REAL t10067 = t7902*t2547;
+    const MBPOL_POLY_REAL t10023 = t9295*t6441;
+    const MBPOL_POLY_REAL t10031 = df[2963];
+    const MBPOL_POLY_REAL t10072 = t10056+t10057+t8517*t1120+df[3541]*t6493+t10023+df[3880]*t4263+
 t10063+t10064+df[1931]*t3447+t8370*t2384+t10067+df[3097]*t2476+df[3055]*t1954+
 df[3824]*t4306+t10031*t65;
-    const double t10082 = t8136*t4393;
-    const double t10090 = t8466*t1662;
-    const double t10040 = df[277];
-    const double t10091 = df[2968]*t341+df[2980]*t228+t7615*t7636+t9130*t2006+df[2583]*t4213
+    const MBPOL_POLY_REAL t10082 = t8136*t4393;
+    const MBPOL_POLY_REAL t10090 = t8466*t1662;
+    const MBPOL_POLY_REAL t10040 = df[277];
+    const MBPOL_POLY_REAL t10091 = df[2968]*t341+df[2980]*t228+t7615*t7636+t9130*t2006+df[2583]*t4213
 +t10082+t7952*t5376+t10040*t274+df[1816]*t3228+df[1793]*t3184+df[268]*t425+df
 [3808]*t4387+df[2564]*t4311+t10090;
-    const double t10095 = t8062*t1250;
-    const double t10101 = t8254*t2549;
-    const double t10103 = t8512*t1256;
-    const double t10104 = t7690*t3666;
-    const double t10105 = t8463*t1708;
-    const double t10065 = t9343*t120;
-    const double t10107 = df[251]*t431+df[1774]*t3139+df[3840]*t4201+t10095+df[2266]*t4040+
+    const MBPOL_POLY_REAL t10095 = t8062*t1250;
+    const MBPOL_POLY_REAL t10101 = t8254*t2549;
+    const MBPOL_POLY_REAL t10103 = t8512*t1256;
+    const MBPOL_POLY_REAL t10104 = t7690*t3666;
+    const MBPOL_POLY_REAL t10105 = t8463*t1708;
+    const MBPOL_POLY_REAL t10065 = t9343*t120;
+    const MBPOL_POLY_REAL t10107 = df[251]*t431+df[1774]*t3139+df[3840]*t4201+t10095+df[2266]*t4040+
 df[1305]*t1922+df[1327]*t2452+df[1311]*t1479+t10065+t10101+df[3351]*t1957+
 t10103+t10104+t10105+df[2080]*t3699;
-    const double t10109 = t8212*t3754;
-    const double t10112 = t7832*t1553;
-    const double t10113 = t8140*t1551;
-    const double t10116 = t8197*t3826;
-    const double t10123 = t7869*t2201;
-    const double t10100 = df[1975];
-    const double t10124 = t10109+t8217*t3632+df[1499]*t2738+t10112+t10113+df[3382]*t1656+df
+    const MBPOL_POLY_REAL t10109 = t8212*t3754;
+    const MBPOL_POLY_REAL t10112 = t7832*t1553;
+    const MBPOL_POLY_REAL t10113 = t8140*t1551;
+    const MBPOL_POLY_REAL t10116 = t8197*t3826;
+    const MBPOL_POLY_REAL t10123 = t7869*t2201;
+    const MBPOL_POLY_REAL t10100 = df[1975];
+    const MBPOL_POLY_REAL t10124 = t10109+t8217*t3632+df[1499]*t2738+t10112+t10113+df[3382]*t1656+df
 [3392]*t1585+t10116+df[2558]*t4595+t8099*t4542+t7705*t7222+t10100*t3445+df
 [1345]*t2483+df[3184]*t2280+t10123;
-    const double t10125 = t8158*t4164;
-    const double t10137 = t7860*t2320;
-    const double t10094 = df[2020];
-    const double t10097 = t9132;
-    const double t10143 = t10125+df[1042]*t1963+t9365*t1472+t8170*t4074+df[3895]*t4589+t8563
+    const MBPOL_POLY_REAL t10125 = t8158*t4164;
+    const MBPOL_POLY_REAL t10137 = t7860*t2320;
+    const MBPOL_POLY_REAL t10094 = df[2020];
+    const MBPOL_POLY_REAL t10097 = t9132;
+    const MBPOL_POLY_REAL t10143 = t10125+df[1042]*t1963+t9365*t1472+t8170*t4074+df[3895]*t4589+t8563
 *t617+df[3904]*t4304+df[1337]*t1961+df[3889]*t4562+df[1948]*t3492+df[1386]*
 t2553+t10137+df[1405]*t2587+t10094*t3490+t10097*t4224;
-    const double t10153 = t9805*t976;
-    const double t10154 = t8159*t4169;
-    const double t10156 = t7872*t2065;
-    const double t10135 = df[1065];
-    const double t10161 = df[104]*t204+df[3276]*t2145+df[2066]*t3670+t7847*t5881+df[3226]*
+    const MBPOL_POLY_REAL t10153 = t9805*t976;
+    const MBPOL_POLY_REAL t10154 = t8159*t4169;
+    const MBPOL_POLY_REAL t10156 = t7872*t2065;
+    const MBPOL_POLY_REAL t10135 = df[1065];
+    const MBPOL_POLY_REAL t10161 = df[104]*t204+df[3276]*t2145+df[2066]*t3670+t7847*t5881+df[3226]*
 t2002+df[3930]*t3402+t10135*t2014+t10153+t10154+t8160*t4110+t10156+df[1991]*
 t3548+df[81]*t169+t8555*t908+t7967*t5267;
-    const double t10165 = t8138*t4361;
-    const double t10166 = t8510*t1289;
-    const double t10168 = t7906*t2448;
-    const double t10148 = df[2371];
-    const double t10177 = df[1577]*t2873+t8518*t1145+df[3996]*t3483+t10165+t10166+t10148*
+    const MBPOL_POLY_REAL t10165 = t8138*t4361;
+    const MBPOL_POLY_REAL t10166 = t8510*t1289;
+    const MBPOL_POLY_REAL t10168 = t7906*t2448;
+    const MBPOL_POLY_REAL t10148 = df[2371];
+    const MBPOL_POLY_REAL t10177 = df[1577]*t2873+t8518*t1145+df[3996]*t3483+t10165+t10166+t10148*
 t4313+t10168+t7692*t3357+df[1474]*t2704+df[3332]*t2493+df[675]*t1213+df[1099]*
 t2071+t7834*t1516+df[3342]*t1474+df[2041]*t3310;
-    const double t10181 = t8516*t1194;
-    const double t10182 = t7693*t3544;
-    const double t10184 = t7900*t3135;
-    const double t10189 = t8196*t2067;
-    const double t10141 = df[3441];
-    const double t10195 = df[122]*t236+df[2052]*t3407+t10181+t10182+df[3951]*t3440+t10184+df
+    const MBPOL_POLY_REAL t10181 = t8516*t1194;
+    const MBPOL_POLY_REAL t10182 = t7693*t3544;
+    const MBPOL_POLY_REAL t10184 = t7900*t3135;
+    const MBPOL_POLY_REAL t10189 = t8196*t2067;
+    const MBPOL_POLY_REAL t10141 = df[3441];
+    const MBPOL_POLY_REAL t10195 = df[122]*t236+df[2052]*t3407+t10181+t10182+df[3951]*t3440+t10184+df
 [1589]*t2697+df[3447]*t2147+t10141*t2282+df[773]*t1281+t10189+df[2130]*t3226+df
 [3455]*t2000+df[755]*t1072+t7809*t6344;
-    const double t10200 = t8509*t1287;
-    const double t10201 = t8135*t4395;
-    const double t10209 = t7870*t2203;
-    const double t10158 = df[1521];
-    const double t10191 = df[191];
-    const double t10210 = t8305*t2779+df[764]*t1187+t7854*t2376+t7908*t1456+t10200+t10201+
+    const MBPOL_POLY_REAL t10200 = t8509*t1287;
+    const MBPOL_POLY_REAL t10201 = t8135*t4395;
+    const MBPOL_POLY_REAL t10209 = t7870*t2203;
+    const MBPOL_POLY_REAL t10158 = df[1521];
+    const MBPOL_POLY_REAL t10191 = df[191];
+    const MBPOL_POLY_REAL t10210 = t8305*t2779+df[764]*t1187+t7854*t2376+t7908*t1456+t10200+t10201+
 t7976*t5157+t10158*t2669+t7661*t7374+t10191*t344+df[1543]*t2794+df[3418]*t1587+
 t7816*t6234+t10209+t840;
-    const double t10231 = t475*t408+t309*t646+t7493*t7288+t212*t6401+t3116*t6383+t4135*t4189
+    const MBPOL_POLY_REAL t10231 = t475*t408+t309*t646+t7493*t7288+t212*t6401+t3116*t6383+t4135*t4189
 +t254*t4903+t275*t1383+t240*t5489+t179*t957+t143*t6024+t215*t1160+t2341*t1924+
 t2404*t5303+t3120*t5598+t155*t829;
-    const double t10235 = t7899*t3135;
-    const double t10190 = t9965;
-    const double t10220 = df[1345];
-    const double t10193 = t10220*t2478;
-    const double t10194 = df[1436];
-    const double t10239 = t9957+t9992+t10019+t10041+t10095+t10103+t10105+t10125+t10153+
+    const MBPOL_POLY_REAL t10235 = t7899*t3135;
+    const MBPOL_POLY_REAL t10190 = t9965;
+    const MBPOL_POLY_REAL t10220 = df[1345];
+    const MBPOL_POLY_REAL t10193 = t10220*t2478;
+    const MBPOL_POLY_REAL t10194 = df[1436];
+    const MBPOL_POLY_REAL t10239 = t9957+t9992+t10019+t10041+t10095+t10103+t10105+t10125+t10153+
 t10154+t10190*t1592+t10193+t10235+t10194*t2646+t9123*t3490+df[3714]*t3820;
-    const double t10243 = t7902*t2549;
-    const double t10246 = t7755*t3952;
-    const double t10248 = t8102*t4567;
-    const double t10254 = t8197*t3828;
-    const double t10255 = t8509*t1289;
-    const double t10204 = df[276];
-    const double t10225 = df[2534];
-    const double t10232 = df[268];
-    const double t10238 = df[1712];
-    const double t10242 = df[1278];
-    const double t10257 = t10225*t4595+df[1792]*t3184+t10243+t7754*t3886+t10204*t272+t10246+
+    const MBPOL_POLY_REAL t10243 = t7902*t2549;
+    const MBPOL_POLY_REAL t10246 = t7755*t3952;
+    const MBPOL_POLY_REAL t10248 = t8102*t4567;
+    const MBPOL_POLY_REAL t10254 = t8197*t3828;
+    const MBPOL_POLY_REAL t10255 = t8509*t1289;
+    const MBPOL_POLY_REAL t10204 = df[276];
+    const MBPOL_POLY_REAL t10225 = df[2534];
+    const MBPOL_POLY_REAL t10232 = df[268];
+    const MBPOL_POLY_REAL t10238 = df[1712];
+    const MBPOL_POLY_REAL t10242 = df[1278];
+    const MBPOL_POLY_REAL t10257 = t10225*t4595+df[1792]*t3184+t10243+t7754*t3886+t10204*t272+t10246+
 df[845]*t1557+t10248+t10232*t422+df[3540]*t6493+df[1326]*t2452+t10238*t2581+df
 [1680]*t2483+t10254+t10255+t10242*t2104;
-    const double t10260 = t8196*t2065;
-    const double t10269 = t8254*t2547;
-    const double t10245 = df[3485];
-    const double t10249 = df[1665];
-    const double t10252 = df[3455];
-    const double t10256 = df[104];
-    const double t10263 = df[3447];
-    const double t10267 = df[3418];
-    const double t10272 = df[3055];
-    const double t10274 = df[1405];
-    const double t10277 = df[1931];
-    const double t10276 = t10245*t1213+t10249*t2578+t10260+t10252*t2002+t10256*t202+t7852*
+    const MBPOL_POLY_REAL t10260 = t8196*t2065;
+    const MBPOL_POLY_REAL t10269 = t8254*t2547;
+    const MBPOL_POLY_REAL t10245 = df[3485];
+    const MBPOL_POLY_REAL t10249 = df[1665];
+    const MBPOL_POLY_REAL t10252 = df[3455];
+    const MBPOL_POLY_REAL t10256 = df[104];
+    const MBPOL_POLY_REAL t10263 = df[3447];
+    const MBPOL_POLY_REAL t10267 = df[3418];
+    const MBPOL_POLY_REAL t10272 = df[3055];
+    const MBPOL_POLY_REAL t10274 = df[1405];
+    const MBPOL_POLY_REAL t10277 = df[1931];
+    const MBPOL_POLY_REAL t10276 = t10245*t1213+t10249*t2578+t10260+t10252*t2002+t10256*t202+t7852*
 t1996+t8519*t1145+t10141*t2280+t10263*t2145+df[3850]*t4353+t10269+t10267*t1585+
 df[496]*t599+t10272*t1957+t10274*t2585+t10277*t3445;
-    const double t10283 = t8089*t6501;
-    const double t10236 = t9948;
-    const double t10251 = df[1727]*t2697;
-    const double t10280 = df[1337];
-    const double t10284 = df[251];
-    const double t10286 = df[1759];
-    const double t10290 = df[3595];
-    const double t10292 = df[1745];
-    const double t10300 = df[3624];
-    const double t10302 = df[1730];
-    const double t10296 = t10280*t1963+t9332*t4213+t10284*t429+t10286*t2587+t10283+t10236*
+    const MBPOL_POLY_REAL t10283 = t8089*t6501;
+    const MBPOL_POLY_REAL t10236 = t9948;
+    const MBPOL_POLY_REAL t10251 = df[1727]*t2697;
+    const MBPOL_POLY_REAL t10280 = df[1337];
+    const MBPOL_POLY_REAL t10284 = df[251];
+    const MBPOL_POLY_REAL t10286 = df[1759];
+    const MBPOL_POLY_REAL t10290 = df[3595];
+    const MBPOL_POLY_REAL t10292 = df[1745];
+    const MBPOL_POLY_REAL t10300 = df[3624];
+    const MBPOL_POLY_REAL t10302 = df[1730];
+    const MBPOL_POLY_REAL t10296 = t10280*t1963+t9332*t4213+t10284*t429+t10286*t2587+t10283+t10236*
 t2738+t10290*t6441+t10292*t2873+df[2234]*t4040+df[1740]*t2794+t7790*t6571+t7776
 *t6628+t7789*t6575+t10300*t3207+t10251+t10302*t2921;
-    const double t10306 = t7694*t3544;
-    const double t10308 = t8140*t1553;
-    const double t10266 = df[2986];
-    const double t10304 = df[2127];
-    const double t10309 = df[1042];
-    const double t10312 = df[1018];
-    const double t10315 = df[3840];
-    const double t10321 = df[1258];
-    const double t10323 = df[2994];
-    const double t10325 = df[3332];
-    const double t10327 = df[2989];
-    const double t10333 = df[3824];
-    const double t10313 = t10304*t3228+t10309*t1961+t10312*t1922+t10315*t4219+t7834*t1520+
+    const MBPOL_POLY_REAL t10306 = t7694*t3544;
+    const MBPOL_POLY_REAL t10308 = t8140*t1553;
+    const MBPOL_POLY_REAL t10266 = df[2986];
+    const MBPOL_POLY_REAL t10304 = df[2127];
+    const MBPOL_POLY_REAL t10309 = df[1042];
+    const MBPOL_POLY_REAL t10312 = df[1018];
+    const MBPOL_POLY_REAL t10315 = df[3840];
+    const MBPOL_POLY_REAL t10321 = df[1258];
+    const MBPOL_POLY_REAL t10323 = df[2994];
+    const MBPOL_POLY_REAL t10325 = df[3332];
+    const MBPOL_POLY_REAL t10327 = df[2989];
+    const MBPOL_POLY_REAL t10333 = df[3824];
+    const MBPOL_POLY_REAL t10313 = t10304*t3228+t10309*t1961+t10312*t1922+t10315*t4219+t7834*t1520+
 t10321*t2289+t10323*t236+t10325*t2476+t10327*t204+t10306+t10266*t274+t10308+
 t10333*t4304+t7816*t6107+t9209*t1587+df[1244]*t2326;
-    const double t10318 = t7974*t3666;
-    const double t10319 = t8212*t3752;
-    const double t10320 = t7832*t1551;
-    const double t10338 = df[1647];
-    const double t10342 = df[2980];
-    const double t10348 = df[3683];
-    const double t10351 = df[675];
-    const double t10364 = df[755];
-    const double t10331 = t10338*t2865+t10342*t230+df[3381]*t1656+t10318+t10319+t10320+
+    const MBPOL_POLY_REAL t10318 = t7974*t3666;
+    const MBPOL_POLY_REAL t10319 = t8212*t3752;
+    const MBPOL_POLY_REAL t10320 = t7832*t1551;
+    const MBPOL_POLY_REAL t10338 = df[1647];
+    const MBPOL_POLY_REAL t10342 = df[2980];
+    const MBPOL_POLY_REAL t10348 = df[3683];
+    const MBPOL_POLY_REAL t10351 = df[675];
+    const MBPOL_POLY_REAL t10364 = df[755];
+    const MBPOL_POLY_REAL t10331 = t10338*t2865+t10342*t230+df[3381]*t1656+t10318+t10319+t10320+
 t10348*t4009+t10351*t1215+df[772]*t1281+df[1773]*t3139+df[763]*t1187+t8160*
 t4076+t7766*t3261+t7705*t7216+t8170*t4084+t10364*t1076;
-    const double t10339 = t7764*t3178;
-    const double t10341 = t8754*t131;
-    const double t10344 = t7906*t2446;
-    const double t10345 = t7900*t3133;
-    const double t10289 = df[235];
-    const double t10367 = df[3662];
-    const double t10373 = df[224];
-    const double t10375 = df[751];
-    const double t10378 = df[3010];
-    const double t10382 = df[1617];
-    const double t10384 = df[3351];
-    const double t10388 = df[3342];
-    const double t10350 = t10367*t3209+t10289*t65+t10373*t228+t10375*t1072+t10378*t425+t8555
+    const MBPOL_POLY_REAL t10339 = t7764*t3178;
+    const MBPOL_POLY_REAL t10341 = t8754*t131;
+    const MBPOL_POLY_REAL t10344 = t7906*t2446;
+    const MBPOL_POLY_REAL t10345 = t7900*t3133;
+    const MBPOL_POLY_REAL t10289 = df[235];
+    const MBPOL_POLY_REAL t10367 = df[3662];
+    const MBPOL_POLY_REAL t10373 = df[224];
+    const MBPOL_POLY_REAL t10375 = df[751];
+    const MBPOL_POLY_REAL t10378 = df[3010];
+    const MBPOL_POLY_REAL t10382 = df[1617];
+    const MBPOL_POLY_REAL t10384 = df[3351];
+    const MBPOL_POLY_REAL t10388 = df[3342];
+    const MBPOL_POLY_REAL t10350 = t10367*t3209+t10289*t65+t10373*t228+t10375*t1072+t10378*t425+t8555
 *t912+t8556*t908+t10339+t10382*t2919+t10341+t10384*t1954+t10388*t1472+t10344+
 t10345+t9975*t3483+t8217*t3589+t8066*t4847;
-    const double t10355 = t8211*t3754;
-    const double t10359 = t7907*t2448;
-    const double t10368 = t8768*t137;
-    const double t10305 = t10043;
-    const double t10310 = df[3035];
-    const double t10393 = df[2968];
-    const double t10395 = df[3930];
-    const double t10416 = df[1908];
-    const double t10418 = df[2266];
-    const double t10370 = t10393*t344+t10355+t10395*t3400+t10305*t1479+df[1098]*t2071+t10359
+    const MBPOL_POLY_REAL t10355 = t8211*t3754;
+    const MBPOL_POLY_REAL t10359 = t7907*t2448;
+    const MBPOL_POLY_REAL t10368 = t8768*t137;
+    const MBPOL_POLY_REAL t10305 = t10043;
+    const MBPOL_POLY_REAL t10310 = df[3035];
+    const MBPOL_POLY_REAL t10393 = df[2968];
+    const MBPOL_POLY_REAL t10395 = df[3930];
+    const MBPOL_POLY_REAL t10416 = df[1908];
+    const MBPOL_POLY_REAL t10418 = df[2266];
+    const MBPOL_POLY_REAL t10370 = t10393*t344+t10355+t10395*t3400+t10305*t1479+df[1098]*t2071+t10359
 +t10310*t1454+df[80]*t169+t8157*t3286+df[1385]*t2553+t7911*t1456+t7835*t1516+
 t7615*t7674+t10416*t3407+t10368+t10418*t4038;
-    const double t10377 = t8510*t1287;
-    const double t10385 = t8516*t1192;
-    const double t10329 = t10135*t2006;
-    const double t10330 = t10191;
-    const double t10420 = df[122];
-    const double t10423 = df[3895];
-    const double t10428 = df[3004];
-    const double t10433 = df[1702];
-    const double t10439 = df[1311];
-    const double t10443 = df[1305];
-    const double t10387 = t10420*t234+t10423*t4591+t8171*t4074+t10428*t431+t10329+t10330*
+    const MBPOL_POLY_REAL t10377 = t8510*t1287;
+    const MBPOL_POLY_REAL t10385 = t8516*t1192;
+    const MBPOL_POLY_REAL t10329 = t10135*t2006;
+    const MBPOL_POLY_REAL t10330 = t10191;
+    const MBPOL_POLY_REAL t10420 = df[122];
+    const MBPOL_POLY_REAL t10423 = df[3895];
+    const MBPOL_POLY_REAL t10428 = df[3004];
+    const MBPOL_POLY_REAL t10433 = df[1702];
+    const MBPOL_POLY_REAL t10439 = df[1311];
+    const MBPOL_POLY_REAL t10443 = df[1305];
+    const MBPOL_POLY_REAL t10387 = t10420*t234+t10423*t4591+t8171*t4074+t10428*t431+t10329+t10330*
 t341+t10377+t7767*t3259+t7976*t5141+t10433*t2867+t8282*t3035+df[3639]*t3746+
 t10439*t1481+df[2201]*t3958+t10385+t10443*t2418;
-    const double t10400 = t7859*t2320;
-    const double t10402 = t8198*t3826;
-    const double t10403 = t7870*t2201;
-    const double t10406 = t8515*t1194;
-    const double t10343 = df[1699];
-    const double t10353 = df[3510]*t6464;
-    const double t10354 = df[2484];
-    const double t10450 = df[1691];
-    const double t10452 = df[3880];
-    const double t10458 = df[3867];
-    const double t10460 = df[3904];
-    const double t10407 = t10065+t10343*t2669+df[3888]*t4562+t8370*t2248+t10450*t2704+t10452
+    const MBPOL_POLY_REAL t10400 = t7859*t2320;
+    const MBPOL_POLY_REAL t10402 = t8198*t3826;
+    const MBPOL_POLY_REAL t10403 = t7870*t2201;
+    const MBPOL_POLY_REAL t10406 = t8515*t1194;
+    const MBPOL_POLY_REAL t10343 = df[1699];
+    const MBPOL_POLY_REAL t10353 = df[3510]*t6464;
+    const MBPOL_POLY_REAL t10354 = df[2484];
+    const MBPOL_POLY_REAL t10450 = df[1691];
+    const MBPOL_POLY_REAL t10452 = df[3880];
+    const MBPOL_POLY_REAL t10458 = df[3867];
+    const MBPOL_POLY_REAL t10460 = df[3904];
+    const MBPOL_POLY_REAL t10407 = t10065+t10343*t2669+df[3888]*t4562+t8370*t2248+t10450*t2704+t10452
 *t4261+t10353+t10354*t4494+t7910*t1436+t10400+t10458*t4589+t10402+t10403+t10460
 *t4306+t7809*t6308+t10406;
-    const double t10409 = t7801*t6499;
-    const double t10410 = t7860*t2322;
-    const double t10411 = t8466*t1664;
-    const double t10415 = t8138*t4359;
-    const double t10422 = t8046*t3180;
-    const double t10365 = df[1520];
-    const double t10369 = df[3213];
-    const double t10465 = df[3876];
-    const double t10467 = df[1577];
-    const double t10469 = df[1543];
-    const double t10475 = df[2052];
-    const double t10482 = df[1196];
-    const double t10493 = df[3226];
-    const double t10425 = t10465*t4263+t10409+t10410+t10411+t10467*t2871+t10469*t2796+t10365
+    const MBPOL_POLY_REAL t10409 = t7801*t6499;
+    const MBPOL_POLY_REAL t10410 = t7860*t2322;
+    const MBPOL_POLY_REAL t10411 = t8466*t1664;
+    const MBPOL_POLY_REAL t10415 = t8138*t4359;
+    const MBPOL_POLY_REAL t10422 = t8046*t3180;
+    const MBPOL_POLY_REAL t10365 = df[1520];
+    const MBPOL_POLY_REAL t10369 = df[3213];
+    const MBPOL_POLY_REAL t10465 = df[3876];
+    const MBPOL_POLY_REAL t10467 = df[1577];
+    const MBPOL_POLY_REAL t10469 = df[1543];
+    const MBPOL_POLY_REAL t10475 = df[2052];
+    const MBPOL_POLY_REAL t10482 = df[1196];
+    const MBPOL_POLY_REAL t10493 = df[3226];
+    const MBPOL_POLY_REAL t10425 = t10465*t4263+t10409+t10410+t10411+t10467*t2871+t10469*t2796+t10365
 *t2667+t10415+t10475*t3409+t10369*t2374+t10482*t2106+t8156*t3284+t7675*t3337+
 t10493*t2000+t10422+t8097*t4496+t7952*t5336;
-    const double t10434 = t7680*t3695;
-    const double t10502 = df[1499];
-    const double t10505 = t10094*t3492;
-    const double t10507 = df[3996];
-    const double t10513 = df[1226];
-    const double t10517 = df[3276];
-    const double t10528 = df[4068];
-    const double t10530 = df[3790];
-    const double t10445 = t7753*t3884+t10502*t2736+t10505+t10507*t3500+t9130*t2014+df[2079]*
+    const MBPOL_POLY_REAL t10434 = t7680*t3695;
+    const MBPOL_POLY_REAL t10502 = df[1499];
+    const MBPOL_POLY_REAL t10505 = t10094*t3492;
+    const MBPOL_POLY_REAL t10507 = df[3996];
+    const MBPOL_POLY_REAL t10513 = df[1226];
+    const MBPOL_POLY_REAL t10517 = df[3276];
+    const MBPOL_POLY_REAL t10528 = df[4068];
+    const MBPOL_POLY_REAL t10530 = df[3790];
+    const MBPOL_POLY_REAL t10445 = t7753*t3884+t10502*t2736+t10505+t10507*t3500+t9130*t2014+df[2079]*
 t3699+t10434+df[3807]*t4387+t10513*t2287+t7673*t3357+t10517*t2147+t9166*t2695+
 t7847*t5955+df[2065]*t3670+t10528*t3440+t10530*t4201;
-    const double t10453 = t8135*t4393;
-    const double t10455 = t8020*t3954;
-    const double t10414 = df[3975];
-    const double t10532 = df[4062];
-    const double t10547 = df[2558];
-    const double t10551 = df[2564];
-    const double t10462 = t10532*t3402+t8442*t1841+t8469*t1640+t7944*t617+t7853*t2376+t7661*
+    const MBPOL_POLY_REAL t10453 = t8135*t4393;
+    const MBPOL_POLY_REAL t10455 = t8020*t3954;
+    const MBPOL_POLY_REAL t10414 = df[3975];
+    const MBPOL_POLY_REAL t10532 = df[4062];
+    const MBPOL_POLY_REAL t10547 = df[2558];
+    const MBPOL_POLY_REAL t10551 = df[2564];
+    const MBPOL_POLY_REAL t10462 = t10532*t3402+t8442*t1841+t8469*t1640+t7944*t617+t7853*t2376+t7661*
 t7445+t8305*t2648+t10453+t7641*t7538+t10455+t7739*t6911+t10547*t4597+t10414*
 t3355+t10551*t4313+df[1990]*t3548+t8470*t1638;
-    const double t10464 = t7693*t3542;
-    const double t10474 = t7872*t2067;
-    const double t10476 = t7681*t3693;
-    const double t10479 = t8613*t4361;
-    const double t10426 = t10100;
-    const double t10560 = df[3097];
-    const double t10568 = df[3951];
-    const double t10570 = df[1146];
-    const double t10572 = df[1816];
-    const double t10576 = df[2041];
-    const double t10578 = df[1178];
-    const double t10480 = t10464+t8098*t4542+t8520*t1120+t10560*t2493+t8095*t4619+t10426*
+    const MBPOL_POLY_REAL t10464 = t7693*t3542;
+    const MBPOL_POLY_REAL t10474 = t7872*t2067;
+    const MBPOL_POLY_REAL t10476 = t7681*t3693;
+    const MBPOL_POLY_REAL t10479 = t8613*t4361;
+    const MBPOL_POLY_REAL t10426 = t10100;
+    const MBPOL_POLY_REAL t10560 = df[3097];
+    const MBPOL_POLY_REAL t10568 = df[3951];
+    const MBPOL_POLY_REAL t10570 = df[1146];
+    const MBPOL_POLY_REAL t10572 = df[1816];
+    const MBPOL_POLY_REAL t10576 = df[2041];
+    const MBPOL_POLY_REAL t10578 = df[1178];
+    const MBPOL_POLY_REAL t10480 = t10464+t8098*t4542+t8520*t1120+t10560*t2493+t8095*t4619+t10426*
 t3447+t10568*t3438+t10570*t2152+t10572*t3226+df[3183]*t2282+t10474+t10576*t3314
 +t10476+t10578*t2154+t8086*t4701+t10479;
-    const double t10484 = t8467*t1662;
-    const double t10487 = t8136*t4395;
-    const double t10488 = t8101*t4569;
-    const double t10491 = t7690*t3664;
-    const double t10495 = t7869*t2203;
-    const double t10438 = df[646];
-    const double t10441 = t10148;
-    const double t10586 = df[3742];
-    const double t10591 = df[2012];
-    const double t10594 = df[1474];
-    const double t10597 = df[3132];
-    const double t10599 = df[2583];
-    const double t10497 = df[1171]*t2207+t9959*t1594+t10484+t10438*t1143+t10586*t4033+t10487
+    const MBPOL_POLY_REAL t10484 = t8467*t1662;
+    const MBPOL_POLY_REAL t10487 = t8136*t4395;
+    const MBPOL_POLY_REAL t10488 = t8101*t4569;
+    const MBPOL_POLY_REAL t10491 = t7690*t3664;
+    const MBPOL_POLY_REAL t10495 = t7869*t2203;
+    const MBPOL_POLY_REAL t10438 = df[646];
+    const MBPOL_POLY_REAL t10441 = t10148;
+    const MBPOL_POLY_REAL t10586 = df[3742];
+    const MBPOL_POLY_REAL t10591 = df[2012];
+    const MBPOL_POLY_REAL t10594 = df[1474];
+    const MBPOL_POLY_REAL t10597 = df[3132];
+    const MBPOL_POLY_REAL t10599 = df[2583];
+    const MBPOL_POLY_REAL t10497 = df[1171]*t2207+t9959*t1594+t10484+t10438*t1143+t10586*t4033+t10487
 +t10488+t10441*t4311+t10591*t3310+t10491+t10594*t2702+t7967*t5282+t10597*t1474+
 t10495+t10599*t4224+t5375+t5446;
-    const double t10519 = t7493*t6439+t143*t6022+t309*t644+t2404*t5088+t2341*t2463+t3120*
+    const MBPOL_POLY_REAL t10519 = t7493*t6439+t143*t6022+t309*t644+t2404*t5088+t2341*t2463+t3120*
 t6014+t215*t1147+t212*t6397+t275*t1376+t3116*t6285+t475*t308+t240*t5465+t155*
 t817+t146*t5441+t179*t950+t4135*t3288+t254*t4901+t9957;
-    const double t10520 = t9960+t9972+t9976+t9977+t9991+t9992+t9995+t9996+t9997+t10008+
+    const MBPOL_POLY_REAL t10520 = t9960+t9972+t9976+t9977+t9991+t9992+t9995+t9996+t9997+t10008+
 t10013+t10015+t10016+t10019+t10020+t10026+t10041+t10045;
-    const double t10522 = t10046+t10048+t10053+t10056+t10057+t10063+t10064+t10067+t10082+
+    const MBPOL_POLY_REAL t10522 = t10046+t10048+t10053+t10056+t10057+t10063+t10064+t10067+t10082+
 t10090+t10095+t10101+t10103+t10104+t10105+t10109+t10112+t10113;
-    const double t10523 = t10116+t10123+t10125+t10137+t10153+t10154+t10156+t10165+t10166+
+    const MBPOL_POLY_REAL t10523 = t10116+t10123+t10125+t10137+t10153+t10154+t10156+t10165+t10166+
 t10168+t10181+t10182+t10184+t10189+t10200+t10201+t10209+t5360;
-    const double t10471 = t10348;
-    const double t10473 = t10528;
-    const double t10477 = t10274;
-    const double t10483 = t10572;
-    const double t10489 = t10338;
-    const double t10492 = t10532;
-    const double t10494 = t10597;
-    const double t10499 = t10599;
-    const double t10503 = t10367;
-    const double t10632 = df[80]*t169;
-    const double t10544 = t5420+df[3539]*t6493+t10471*t4033+t10473*t3438+t10477*t2587+t10632
+    const MBPOL_POLY_REAL t10471 = t10348;
+    const MBPOL_POLY_REAL t10473 = t10528;
+    const MBPOL_POLY_REAL t10477 = t10274;
+    const MBPOL_POLY_REAL t10483 = t10572;
+    const MBPOL_POLY_REAL t10489 = t10338;
+    const MBPOL_POLY_REAL t10492 = t10532;
+    const MBPOL_POLY_REAL t10494 = t10597;
+    const MBPOL_POLY_REAL t10499 = t10599;
+    const MBPOL_POLY_REAL t10503 = t10367;
+    const MBPOL_POLY_REAL t10632 = df[80]*t169;
+    const MBPOL_POLY_REAL t10544 = t5420+df[3539]*t6493+t10471*t4033+t10473*t3438+t10477*t2587+t10632
 +t7806*t3261+t10023+t10483*t3228+df[1208]*t2006+t10489*t2867+t10492*t3400+
 t10494*t1472+t8470*t1636+t10499*t4213+df[1636]*t2669+t10503*t3207+t7677*t3333;
-    const double t10506 = t10382;
-    const double t10510 = t10256;
-    const double t10516 = t10560;
-    const double t10521 = t10252;
-    const double t10525 = t10551;
-    const double t10564 = t10506*t2921+df[1384]*t2553+t7854*t2372+t10510*t204+t7809*t6317+
+    const MBPOL_POLY_REAL t10506 = t10382;
+    const MBPOL_POLY_REAL t10510 = t10256;
+    const MBPOL_POLY_REAL t10516 = t10560;
+    const MBPOL_POLY_REAL t10521 = t10252;
+    const MBPOL_POLY_REAL t10525 = t10551;
+    const MBPOL_POLY_REAL t10564 = t10506*t2921+df[1384]*t2553+t7854*t2372+t10510*t204+t7809*t6317+
 t7692*t3613+t8109*t4542+t8086*t4662+t10516*t2476+t7855*t2376+t10521*t2000+
 t10525*t4311+df[3638]*t3746+t7767*t3257+t7661*t7480+t8517*t1155+t10190*t1594+df
 [771]*t1281;
-    const double t10533 = t10304;
-    const double t10538 = t10482;
-    const double t10541 = t10300;
-    const double t10546 = t10280;
-    const double t10549 = t10467;
-    const double t10553 = t10378;
-    const double t10556 = t10315;
-    const double t10588 = t10533*t3226+t8521*t1120+t10426*t3445+t7976*t5180+t10538*t2245+df
+    const MBPOL_POLY_REAL t10533 = t10304;
+    const MBPOL_POLY_REAL t10538 = t10482;
+    const MBPOL_POLY_REAL t10541 = t10300;
+    const MBPOL_POLY_REAL t10546 = t10280;
+    const MBPOL_POLY_REAL t10549 = t10467;
+    const MBPOL_POLY_REAL t10553 = t10378;
+    const MBPOL_POLY_REAL t10556 = t10315;
+    const MBPOL_POLY_REAL t10588 = t10533*t3226+t8521*t1120+t10426*t3445+t7976*t5180+t10538*t2245+df
 [1791]*t3184+t10541*t3209+t10220*t2483+df[1587]*t2697+t10546*t1961+t10441*t4313
 +t10549*t2873+t9209*t1585+t8160*t4087+t10553*t422+df[2020]*t3490+t10556*t4201+
 t10330*t344;
-    const double t10559 = t10333;
-    const double t10561 = t10323;
-    const double t10563 = t10416;
-    const double t10566 = t10327;
-    const double t10574 = t10428;
-    const double t10579 = t10420;
-    const double t10608 = t10559*t4306+t10561*t234+t10563*t3409+t10566*t202+df[3806]*t4387+
+    const MBPOL_POLY_REAL t10559 = t10333;
+    const MBPOL_POLY_REAL t10561 = t10323;
+    const MBPOL_POLY_REAL t10563 = t10416;
+    const MBPOL_POLY_REAL t10566 = t10327;
+    const MBPOL_POLY_REAL t10574 = t10428;
+    const MBPOL_POLY_REAL t10579 = t10420;
+    const MBPOL_POLY_REAL t10608 = t10559*t4306+t10561*t234+t10563*t3409+t10566*t202+df[3806]*t4387+
 df[1097]*t2071+df[3380]*t1656+t9944*t2642+t7705*t7063+t8370*t2108+t10574*t429+
 t8282*t3020+df[1243]*t2326+t8522*t1145+t10579*t236+t7834*t1533+df[1679]*t2478+
 t8156*t4184;
-    const double t10584 = t9376;
-    const double t10587 = t10263;
-    const double t10592 = t10325;
-    const double t10601 = t10249;
-    const double t10603 = df[937];
-    const double t10631 = t10584*t2280+t8442*t1787+t10587*t2147+df[4085]*t3500+t10592*t2493+
+    const MBPOL_POLY_REAL t10584 = t9376;
+    const MBPOL_POLY_REAL t10587 = t10263;
+    const MBPOL_POLY_REAL t10592 = t10325;
+    const MBPOL_POLY_REAL t10601 = t10249;
+    const MBPOL_POLY_REAL t10603 = df[937];
+    const MBPOL_POLY_REAL t10631 = t10584*t2280+t8442*t1787+t10587*t2147+df[4085]*t3500+t10592*t2493+
 t8305*t2951+t7666*t3337+t7641*t7534+t8469*t1634+t7908*t1892+t7754*t3880+t8461*
 t1640+t10601*t2581+t10603*t1592+df[3713]*t3820+t7967*t5280+df[2200]*t3958+df
 [844]*t1557;
-    const double t10610 = df[1333];
-    const double t10613 = df[1962];
-    const double t10617 = t10547;
-    const double t10623 = t10290;
-    const double t10630 = t10439;
-    const double t10652 = t10610*t1922+t7952*t5345+t10613*t3492+t8095*t4498+t8099*t4615+
+    const MBPOL_POLY_REAL t10610 = df[1333];
+    const MBPOL_POLY_REAL t10613 = df[1962];
+    const MBPOL_POLY_REAL t10617 = t10547;
+    const MBPOL_POLY_REAL t10623 = t10290;
+    const MBPOL_POLY_REAL t10630 = t10439;
+    const MBPOL_POLY_REAL t10652 = t10610*t1922+t7952*t5345+t10613*t3492+t8095*t4498+t8099*t4615+
 t10617*t4595+df[2078]*t3699+t7842*t1436+t7816*t6259+df[1325]*t2452+t10623*t6464
 +t7909*t1857+t10040*t319+df[762]*t1187+t7841*t1456+df[1772]*t3139+t10630*t1479+
 t7789*t6612;
-    const double t10634 = t10245;
-    const double t10637 = t10232;
-    const double t10640 = t10267;
-    const double t10642 = t10443;
-    const double t10644 = t10286;
-    const double t10646 = t10284;
-    const double t10648 = t10530;
-    const double t10650 = t10493;
-    const double t10658 = t10238;
-    const double t10660 = t9254;
-    const double t10662 = t10594;
-    const double t10664 = t10418;
-    const double t10673 = t10634*t1215+df[2064]*t3670+t10637*t425+t7790*t6610+t10640*t1587+
+    const MBPOL_POLY_REAL t10634 = t10245;
+    const MBPOL_POLY_REAL t10637 = t10232;
+    const MBPOL_POLY_REAL t10640 = t10267;
+    const MBPOL_POLY_REAL t10642 = t10443;
+    const MBPOL_POLY_REAL t10644 = t10286;
+    const MBPOL_POLY_REAL t10646 = t10284;
+    const MBPOL_POLY_REAL t10648 = t10530;
+    const MBPOL_POLY_REAL t10650 = t10493;
+    const MBPOL_POLY_REAL t10658 = t10238;
+    const MBPOL_POLY_REAL t10660 = t9254;
+    const MBPOL_POLY_REAL t10662 = t10594;
+    const MBPOL_POLY_REAL t10664 = t10418;
+    const MBPOL_POLY_REAL t10673 = t10634*t1215+df[2064]*t3670+t10637*t425+t7790*t6610+t10640*t1587+
 t10642*t1918+t10644*t2585+t10646*t431+t10648*t4219+t10650*t2002+t8170*t4070+
 t8116*t4496+t8115*t4508+df[1072]*t2014+t10658*t2578+t10660*t2282+t10662*t2704+
 t10664*t4040;
-    const double t10669 = t10342;
-    const double t10671 = t10433;
-    const double t10675 = t10351;
-    const double t10679 = t10507;
-    const double t10684 = t10393;
-    const double t10686 = t10309;
-    const double t10691 = t10591;
-    const double t10693 = t10312;
-    const double t10695 = df[168]*t274+t7868*t1992+t10669*t228+t10671*t2865+t7835*t1531+
+    const MBPOL_POLY_REAL t10669 = t10342;
+    const MBPOL_POLY_REAL t10671 = t10433;
+    const MBPOL_POLY_REAL t10675 = t10351;
+    const MBPOL_POLY_REAL t10679 = t10507;
+    const MBPOL_POLY_REAL t10684 = t10393;
+    const MBPOL_POLY_REAL t10686 = t10309;
+    const MBPOL_POLY_REAL t10691 = t10591;
+    const MBPOL_POLY_REAL t10693 = t10312;
+    const MBPOL_POLY_REAL t10695 = df[168]*t274+t7868*t1992+t10669*t228+t10671*t2865+t7835*t1531+
 t10675*t1213+t8066*t4772+t8518*t1169+t10679*t3483+t10305*t1481+df[2975]*t65+
 t10684*t341+t10686*t1963+t8169*t4074+t7753*t3882+t7739*t6973+t10691*t3586+
 t10693*t1920;
-    const double t10696 = t10450;
-    const double t10698 = df[1860];
-    const double t10700 = df[3766];
-    const double t10706 = t10384;
-    const double t10708 = t10586;
-    const double t10710 = t10513;
-    const double t10717 = t10388;
-    const double t10720 = t10696*t2702+t10698*t3310+t10700*t4263+t8564*t578+t8217*t3317+
+    const MBPOL_POLY_REAL t10696 = t10450;
+    const MBPOL_POLY_REAL t10698 = df[1860];
+    const MBPOL_POLY_REAL t10700 = df[3766];
+    const MBPOL_POLY_REAL t10706 = t10384;
+    const MBPOL_POLY_REAL t10708 = t10586;
+    const MBPOL_POLY_REAL t10710 = t10513;
+    const MBPOL_POLY_REAL t10717 = t10388;
+    const MBPOL_POLY_REAL t10720 = t10696*t2702+t10698*t3310+t10700*t4263+t8564*t578+t8217*t3317+
 t7615*t7630+t8272*t3286+t10706*t1957+t10708*t4009+t10710*t2289+df[488]*t580+
 t10031*t282+df[1437]*t2644+t10717*t1474+df[1989]*t3548+t7744*t3886+df[2959]*
 t562+t10012;
-    const double t10731 = t10373;
-    const double t10734 = t10395;
-    const double t10737 = t10576;
-    const double t10739 = t10517;
-    const double t10744 = t10292;
-    const double t10746 = t10364;
-    const double t10748 = t10375;
-    const double t10752 = t10460;
-    const double t10754 = t10570;
-    const double t10743 = df[638]*t1157+df[1688]*t2646+t7950*t617+t8171*t4072+t10731*t230+df
+    const MBPOL_POLY_REAL t10731 = t10373;
+    const MBPOL_POLY_REAL t10734 = t10395;
+    const MBPOL_POLY_REAL t10737 = t10576;
+    const MBPOL_POLY_REAL t10739 = t10517;
+    const MBPOL_POLY_REAL t10744 = t10292;
+    const MBPOL_POLY_REAL t10746 = t10364;
+    const MBPOL_POLY_REAL t10748 = t10375;
+    const MBPOL_POLY_REAL t10752 = t10460;
+    const MBPOL_POLY_REAL t10754 = t10570;
+    const MBPOL_POLY_REAL t10743 = df[638]*t1157+df[1688]*t2646+t7950*t617+t8171*t4072+t10731*t230+df
 [1170]*t2207+t10734*t3402+t7847*t5948+t10737*t3584+t10739*t2145+t7766*t3255+
 t10236*t2736+t10744*t2871+t10746*t1088+t10748*t1090+df[4023]*t3335+t10752*t4304
 +t10754*t2154;
-    const double t10756 = df[746];
-    const double t10758 = t10242;
-    const double t10760 = t10423;
-    const double t10767 = t10469;
-    const double t10770 = t10475;
-    const double t10774 = df[53]*t120;
-    const double t10775 = t10225;
-    const double t10782 = t10578;
-    const double t10785 = t10568;
-    const double t10766 = t10756*t1072+t10758*t2243+t10760*t4589+df[3887]*t4562+df[3266]*
+    const MBPOL_POLY_REAL t10756 = df[746];
+    const MBPOL_POLY_REAL t10758 = t10242;
+    const MBPOL_POLY_REAL t10760 = t10423;
+    const MBPOL_POLY_REAL t10767 = t10469;
+    const MBPOL_POLY_REAL t10770 = t10475;
+    const MBPOL_POLY_REAL t10774 = df[53]*t120;
+    const MBPOL_POLY_REAL t10775 = t10225;
+    const MBPOL_POLY_REAL t10782 = t10578;
+    const MBPOL_POLY_REAL t10785 = t10568;
+    const MBPOL_POLY_REAL t10766 = t10756*t1072+t10758*t2243+t10760*t4589+df[3887]*t4562+df[3266]*
 t1994+t8556*t925+t10767*t2794+df[2326]*t4224+t10770*t3407+t7793*t6571+t10774+
 t10775*t4597+t7776*t6578+df[236]*t284+df[2548]*t4506+t10782*t2152+t7667*t3357+
 t10785*t3440;
-    const double t10787 = t10272;
-    const double t10793 = t10452;
-    const double t10796 = t10465;
-    const double t10800 = t10321;
-    const double t10802 = t10458;
-    const double t10805 = t10302;
-    const double t10808 = df[1118];
-    const double t10810 = t10277;
-    const double t10817 = t10502;
-    const double t10789 = t10787*t1954+t8157*t4186+t8555*t923+t8557*t908+t10793*t4259+t7820*
+    const MBPOL_POLY_REAL t10787 = t10272;
+    const MBPOL_POLY_REAL t10793 = t10452;
+    const MBPOL_POLY_REAL t10796 = t10465;
+    const MBPOL_POLY_REAL t10800 = t10321;
+    const MBPOL_POLY_REAL t10802 = t10458;
+    const MBPOL_POLY_REAL t10805 = t10302;
+    const MBPOL_POLY_REAL t10808 = df[1118];
+    const MBPOL_POLY_REAL t10810 = t10277;
+    const MBPOL_POLY_REAL t10817 = t10502;
+    const MBPOL_POLY_REAL t10789 = t10787*t1954+t8157*t4186+t8555*t923+t8557*t908+t10793*t4259+t7820*
 t1516+t10796*t4257+df[3029]*t1859+t9952+t10800*t2287+t10802*t4591+t7856*t1996+
 t10805*t2919+df[1720]*t2695+t10808*t2106+t10810*t3447+t10158*t2665+df[3849]*
 t4353+t10817*t2738;
-    const double t10812 = t7493*t6794+t155*t807+t275*t1372+t179*t946+t145*t5415+t3116*t6077+
+    const MBPOL_POLY_REAL t10812 = t7493*t6794+t155*t807+t275*t1372+t179*t946+t145*t5415+t3116*t6077+
 t2341*t2414+t240*t5508+t215*t1122+t254*t4899+t4135*t4880+t212*t6394+t146*t5438+
 t309*t640+t2404*t5217+t143*t6020+t3120*t6008+t475*t98+t4998;
-    const double t10813 = t5059+t9957+t9992+t10019+t10041+t10095+t10103+t10105+t10125+t10153
+    const MBPOL_POLY_REAL t10813 = t5059+t9957+t9992+t10019+t10041+t10095+t10103+t10105+t10125+t10153
 +t10154+t10235+t10243+t10246+t10248+t10254+t10255+t10260+t10269;
-    const double t10815 = t10283+t10306+t10308+t10318+t10319+t10320+t10339+t10341+t10344+
+    const MBPOL_POLY_REAL t10815 = t10283+t10306+t10308+t10318+t10319+t10320+t10339+t10341+t10344+
 t10345+t10355+t10359+t10368+t10377+t10385+t10400+t10402+t10403+t10406;
-    const double t10821 = t10409+t10410+t10411+t10415+t10422+t10434+t10453+t10455+t10464+
+    const MBPOL_POLY_REAL t10821 = t10409+t10410+t10411+t10415+t10422+t10434+t10453+t10455+t10464+
 t10474+t10476+t10479+t10484+t10487+t10488+t10491+t10495+t10353+t10796*t4259+
 t10546*t1963;
-    const double t10851 = t10691*t3584+t10601*t2578+t8305*t2851+t10494*t1474+t7806*t3259+df
+    const MBPOL_POLY_REAL t10851 = t10691*t3584+t10601*t2578+t8305*t2851+t10494*t1474+t7806*t3259+df
 [810]*t1479+t10630*t1481+df[3805]*t4387+t7641*t7550+t10610*t2418+df[843]*t1557+
 df[1988]*t3548+t8217*t3312+t7669*t3357+df[4082]*t3483+df[3848]*t4353+t10817*
 t2736+t10503*t3209+t9985*t4040;
-    const double t10881 = t8272*t3284+t8558*t908+t10731*t228+t10471*t4009+t10679*t3500+df
+    const MBPOL_POLY_REAL t10881 = t8272*t3284+t8558*t908+t10731*t228+t10471*t4009+t10679*t3500+df
 [2199]*t3958+t7952*t5343+df[2950]*t599+t10662*t2702+df[1169]*t2207+t8156*t4186+
 t10483*t3226+t10706*t1954+t7835*t1533+df[3637]*t3746+t7805*t3261+df[1324]*t2452
 +df[1974]*t3447+df[761]*t1187+t10516*t2493;
-    const double t10911 = df[770]*t1281+t10642*t1920+t8555*t925+df[2957]*t580+t7661*t7326+
+    const MBPOL_POLY_REAL t10911 = df[770]*t1281+t10642*t1920+t8555*t925+df[2957]*t580+t7661*t7326+
 t7675*t3333+t8171*t4070+t8556*t923+t8169*t4084+df[189]*t341+t10505+t8117*t4496+
 t8086*t4653+t10754*t2152+df[479]*t562+t10717*t1472+df[167]*t272+t10499*t4224+
 t10194*t2642;
-    const double t10947 = df[487]*t578+t10808*t2104+df[1096]*t2071+t8097*t4508+df[1771]*
+    const MBPOL_POLY_REAL t10947 = df[487]*t578+t10808*t2104+df[1096]*t2071+t8097*t4508+df[1771]*
 t3139+t10525*t4313+t10533*t3228+t10541*t3207+t10644*t2587+t8282*t3058+t10414*
 t3335+t10782*t2154+t10506*t2919+t10563*t3407+t10675*t1215+t10559*t4304+df[2370]
 *t4311+t10310*t1859+t7857*t1996+t10800*t2289;
-    const double t10981 = t10521*t2002+t7753*t3880+t7739*t6986+t7852*t1992+t7911*t1892+
+    const MBPOL_POLY_REAL t10981 = t10521*t2002+t7753*t3880+t7739*t6986+t7852*t1992+t7911*t1892+
 t10549*t2871+t10438*t1157+df[1563]*t2646+t10097*t4213+df[1242]*t2326+t10708*
 t4033+t10660*t2280+df[1588]*t2695+t10744*t2873+t10758*t2245+t10787*t1957+t10587
 *t2145+t7820*t1520+t10640*t1585;
-    const double t11012 = t10574*t431+t10553*t425+t10204*t284+df[4040]*t3355+t8520*t1155+df
+    const MBPOL_POLY_REAL t11012 = t10574*t431+t10553*t425+t10204*t284+df[4040]*t3355+t8520*t1155+df
 [3001]*t274+t7816*t6239+t10561*t236+df[630]*t1143+t10637*t422+t7744*t3884+t7743
 *t3886+df[3393]*t1587+df[3712]*t3820+t8524*t1120+t8271*t3286+t10492*t3402+t7809
 *t6347+t10710*t2287+t8157*t4184;
-    const double t11047 = t7834*t1531+t7821*t1516+t10684*t344+t10646*t429+t7754*t3882+t10746
+    const MBPOL_POLY_REAL t11047 = t7834*t1531+t7821*t1516+t10684*t344+t10646*t429+t7754*t3882+t10746
 *t1090+t10613*t3490+df[1635]*t2667+t8018*t617+t7673*t3613+t10473*t3440+df[1303]
 *t1922+t10748*t1088+t10756*t1076+t10556*t4219+df[3837]*t4263+t10634*t1213+df
 [744]*t1072+t10810*t3445;
-    const double t11008 = t10632;
-    const double t11075 = t8370*t2251+t8519*t1169+t8523*t1145+t7910*t1857+t10489*t2865+
+    const MBPOL_POLY_REAL t11008 = t10632;
+    const MBPOL_POLY_REAL t11075 = t8370*t2251+t8519*t1169+t8523*t1145+t7910*t1857+t10489*t2865+
 t10693*t1918+t10775*t4595+t7844*t1456+t8469*t1636+t11008+t7847*t5942+df[1383]*
 t2553+t10671*t2867+t10739*t2147+t8110*t4542+t7615*t7653+t10658*t2581+t8461*
 t1638+df[1717]*t2669+t7853*t2372;
-    const double t11109 = t10354*t4506+t10603*t1594+t10343*t2665+df[2077]*t3699+t7858*t2376+
+    const MBPOL_POLY_REAL t11109 = t10354*t4506+t10603*t1594+t10343*t2665+df[2077]*t3699+t7858*t2376+
 t10566*t204+t8160*t4144+t8168*t4074+t10767*t2796+t10698*t3314+df[1205]*t2014+
 t10266*t319+df[1858]*t3310+t10289*t282+t10538*t2243+df[1200]*t2106+t8170*t4072+
 t8066*t4849+t10365*t2644;
-    const double t11138 = df[3379]*t1656+t10664*t4038+t8557*t912+df[1739]*t2794+t10669*t230+
+    const MBPOL_POLY_REAL t11138 = df[3379]*t1656+t10664*t4038+t8557*t912+df[1739]*t2794+t10669*t230+
 t10251+df[3262]*t2374+t7794*t6571+t7793*t6575+df[2063]*t3670+t10650*t2000+t7766
 *t3257+t8462*t1640+t8442*t1729+t10696*t2704+t10648*t4201+t7705*t7163+df[3538]*
 t6493+t10700*t4261+df[2476]*t4494;
-    const double t11171 = t10369*t1994+t10752*t4306+t8470*t1634+t10760*t4591+t7976*t5178+
+    const MBPOL_POLY_REAL t11171 = t10369*t1994+t10752*t4306+t8470*t1634+t10760*t4591+t7976*t5178+
 t9297*t2738+t10686*t1961+t8098*t4615+t8095*t4544+df[3312]*t1454+t10785*t3438+
 t10579*t234+t7843*t1436+t10592*t2476+t10329+df[1790]*t3184+t10617*t4597+t7967*
 t5278+t10510*t202;
-    const double t11203 = t7790*t6612+t7789*t6610+df[41]*t65+t10774+t10193+t10584*t2282+df
+    const MBPOL_POLY_REAL t11203 = t7790*t6612+t7789*t6610+df[41]*t65+t10774+t10193+t10584*t2282+df
 [3886]*t4562+t9111*t2483+t10737*t3586+t10770*t3409+df[866]*t1592+t10793*t4257+
 t10802*t4589+t7767*t3255+t10805*t2921+t7699*t3337+t7776*t6573+t10477*t2585+
 t10623*t6441+t10734*t3400;
-    const double t11115 = df[1517]*t2771;
-    const double t11219 = t2404*t5252+t2341*t1896+t7493*t6756+t179*t934+t4135*t3263+t254*
+    const MBPOL_POLY_REAL t11115 = df[1517]*t2771;
+    const MBPOL_POLY_REAL t11219 = t2404*t5252+t2341*t1896+t7493*t6756+t179*t934+t4135*t3263+t254*
 t4897+t275*t1365+t489+t621+t10019+t10153+t8200*t5801+t7878*t2106+t11115+t8499*
 t1120;
-    const double t11224 = t8401*t2201;
-    const double t11233 = t8419*t2065;
-    const double t11118 = df[3205]*t2207;
-    const double t11121 = df[3984]*t3670;
-    const double t11123 = df[3967]*t3548;
-    const double t11124 = t9574;
-    const double t11240 = t11118+t9703*t3492+t11121+t11224+t11123+t11124*t422+df[4015]*t3699
+    const MBPOL_POLY_REAL t11224 = t8401*t2201;
+    const MBPOL_POLY_REAL t11233 = t8419*t2065;
+    const MBPOL_POLY_REAL t11118 = df[3205]*t2207;
+    const MBPOL_POLY_REAL t11121 = df[3984]*t3670;
+    const MBPOL_POLY_REAL t11123 = df[3967]*t3548;
+    const MBPOL_POLY_REAL t11124 = t9574;
+    const MBPOL_POLY_REAL t11240 = t11118+t9703*t3492+t11121+t11224+t11123+t11124*t422+df[4015]*t3699
 +df[387]*t429+t9715*t2738+t9751*t3447+t11233+t9646*t2002+df[2921]*t2280+t7952*
 t5340+df[381]*t228+df[376]*t202;
-    const double t11244 = t8489*t1192;
-    const double t11253 = t7718*t4395;
-    const double t11137 = df[4044];
-    const double t11142 = t8755*t137;
-    const double t11146 = t9643;
-    const double t11150 = df[3368]*t1557;
-    const double t11261 = df[4032]*t3407+df[1573]*t2867+t11244+t11137*t3445+t9573*t341+t9664
+    const MBPOL_POLY_REAL t11244 = t8489*t1192;
+    const MBPOL_POLY_REAL t11253 = t7718*t4395;
+    const MBPOL_POLY_REAL t11137 = df[4044];
+    const MBPOL_POLY_REAL t11142 = t8755*t137;
+    const MBPOL_POLY_REAL t11146 = t9643;
+    const MBPOL_POLY_REAL t11150 = df[3368]*t1557;
+    const MBPOL_POLY_REAL t11261 = df[4032]*t3407+df[1573]*t2867+t11244+t11137*t3445+t9573*t341+t9664
 *t2282+t11142+t8236*t3357+df[2550]*t4589+t11253+df[1531]*t2794+t11146*t234+
 t9583*t2014+t11150+t7725*t4542+df[671]*t1215;
-    const double t11274 = t8280*t3133;
-    const double t11155 = df[2864];
-    const double t11165 = df[2396]*t4353;
-    const double t11166 = df[1144];
-    const double t11169 = df[2763]*t1912;
-    const double t11278 = t7891*t1922+t8220*t5739+t11155*t1954+df[100]*t204+t8193*t3886+df
+    const MBPOL_POLY_REAL t11274 = t8280*t3133;
+    const MBPOL_POLY_REAL t11155 = df[2864];
+    const MBPOL_POLY_REAL t11165 = df[2396]*t4353;
+    const MBPOL_POLY_REAL t11166 = df[1144];
+    const MBPOL_POLY_REAL t11169 = df[2763]*t1912;
+    const MBPOL_POLY_REAL t11278 = t7891*t1922+t8220*t5739+t11155*t1954+df[100]*t204+t8193*t3886+df
 [3814]*t4311+df[657]*t1187+t8434*t1436+df[538]*t940+df[2776]*t2695+t11165+
 t11166*t2147+t11274+t11169+t8316*t2646+t8526*t5092;
-    const double t11290 = t8247*t3544;
-    const double t11297 = t8178*t3952;
-    const double t11176 = df[368]*t91;
-    const double t11178 = df[2909]*t2098;
-    const double t11179 = df[2903];
-    const double t11190 = t9535*t4009;
-    const double t11334 = df[3173];
-    const double t11298 = df[2769]*t2919+df[3299]*t1481+t11176+t11178+t11179*t2145+t11334*
+    const MBPOL_POLY_REAL t11290 = t8247*t3544;
+    const MBPOL_POLY_REAL t11297 = t8178*t3952;
+    const MBPOL_POLY_REAL t11176 = df[368]*t91;
+    const MBPOL_POLY_REAL t11178 = df[2909]*t2098;
+    const MBPOL_POLY_REAL t11179 = df[2903];
+    const MBPOL_POLY_REAL t11190 = t9535*t4009;
+    const MBPOL_POLY_REAL t11334 = df[3173];
+    const MBPOL_POLY_REAL t11298 = df[2769]*t2919+df[3299]*t1481+t11176+t11178+t11179*t2145+t11334*
 t2287+df[2516]*t4562+df[2530]*t4591+t8370*t2378+t11290+df[3926]*t3409+t7958*
 t7303+t7703*t3310+t8380*t2376+t11190+t11297;
-    const double t11300 = t8385*t2320;
-    const double t11301 = t8177*t3981;
-    const double t11302 = t8158*t4169;
-    const double t11306 = t7711*t4567;
-    const double t11307 = t8179*t3954;
-    const double t11308 = t7826*t1662;
-    const double t11310 = t8386*t2322;
-    const double t11311 = t7827*t1664;
-    const double t11195 = df[2501]*t4537;
-    const double t11199 = df[1015]*t1914;
-    const double t11316 = t8160*t3888+t11300+t11301+t11302+t9576*t1479+t8379*t1996+t11306+
+    const MBPOL_POLY_REAL t11300 = t8385*t2320;
+    const MBPOL_POLY_REAL t11301 = t8177*t3981;
+    const MBPOL_POLY_REAL t11302 = t8158*t4169;
+    const MBPOL_POLY_REAL t11306 = t7711*t4567;
+    const MBPOL_POLY_REAL t11307 = t8179*t3954;
+    const MBPOL_POLY_REAL t11308 = t7826*t1662;
+    const MBPOL_POLY_REAL t11310 = t8386*t2322;
+    const MBPOL_POLY_REAL t11311 = t7827*t1664;
+    const MBPOL_POLY_REAL t11195 = df[2501]*t4537;
+    const MBPOL_POLY_REAL t11199 = df[1015]*t1914;
+    const MBPOL_POLY_REAL t11316 = t8160*t3888+t11300+t11301+t11302+t9576*t1479+t8379*t1996+t11306+
 t11307+t11308+t11195+t11310+t11311+t7829*t1640+df[118]*t230+t11199+t8435*t1456;
-    const double t11324 = t7719*t4359;
-    const double t11325 = t8512*t1250;
-    const double t11206 = df[3865];
-    const double t11211 = df[3397];
-    const double t11217 = df[3658]*t3184;
-    const double t11337 = t7816*t6166+t9735*t2697+t8646*t65+t8614*t617+t11206*t4595+t11324+
+    const MBPOL_POLY_REAL t11324 = t7719*t4359;
+    const MBPOL_POLY_REAL t11325 = t8512*t1250;
+    const MBPOL_POLY_REAL t11206 = df[3865];
+    const MBPOL_POLY_REAL t11211 = df[3397];
+    const MBPOL_POLY_REAL t11217 = df[3658]*t3184;
+    const MBPOL_POLY_REAL t11337 = t7816*t6166+t9735*t2697+t8646*t65+t8614*t617+t11206*t4595+t11324+
 t11325+df[682]*t1213+t8757*t636+t9636*t1472+t11211*t1594+t9770*t3226+df[3291]*
 t2006+t8442*t1537+t11217+t8534*t5052;
-    const double t11342 = t7770*t3754;
-    const double t11349 = t8224*t3695;
-    const double t11350 = t7771*t3752;
-    const double t11356 = t8365*t2446;
-    const double t11231 = df[707]*t1281;
-    const double t11357 = t9654*t2476+t8559*t908+t7773*t3286+t11342+t9699*t4306+df[1841]*
+    const MBPOL_POLY_REAL t11342 = t7770*t3754;
+    const MBPOL_POLY_REAL t11349 = t8224*t3695;
+    const MBPOL_POLY_REAL t11350 = t7771*t3752;
+    const MBPOL_POLY_REAL t11356 = t8365*t2446;
+    const MBPOL_POLY_REAL t11231 = df[707]*t1281;
+    const MBPOL_POLY_REAL t11357 = t9654*t2476+t8559*t908+t7773*t3286+t11342+t9699*t4306+df[1841]*
 t3279+t8217*t3617+df[264]*t431+t8274*t3261+t11349+t11350+t7705*t7160+t11231+df
 [3143]*t2478+t9565*t1592+t11356;
-    const double t11372 = t7730*t4393;
-    const double t11375 = t8463*t1713;
-    const double t11239 = df[2473]*t4489;
-    const double t11242 = df[2153]*t3820;
-    const double t11246 = df[627]*t1138;
-    const double t11247 = t9506;
-    const double t11251 = t9527;
-    const double t11255 = df[1433]*t2638;
-    const double t11257 = df[3084]*t3139;
-    const double t11408 = t9747*t3483;
-    const double t11381 = t11408+t9745*t3440+t8343*t2669+t11239+t11242+t8699*t2671+t11246+
+    const MBPOL_POLY_REAL t11372 = t7730*t4393;
+    const MBPOL_POLY_REAL t11375 = t8463*t1713;
+    const MBPOL_POLY_REAL t11239 = df[2473]*t4489;
+    const MBPOL_POLY_REAL t11242 = df[2153]*t3820;
+    const MBPOL_POLY_REAL t11246 = df[627]*t1138;
+    const MBPOL_POLY_REAL t11247 = t9506;
+    const MBPOL_POLY_REAL t11251 = t9527;
+    const MBPOL_POLY_REAL t11255 = df[1433]*t2638;
+    const MBPOL_POLY_REAL t11257 = df[3084]*t3139;
+    const MBPOL_POLY_REAL t11408 = t9747*t3483;
+    const MBPOL_POLY_REAL t11381 = t11408+t9745*t3440+t8343*t2669+t11239+t11242+t8699*t2671+t11246+
 t11247*t2578+df[2833]*t2585+t11372+t11008+t11375+t9720*t4213+t11251*t4304+
 t11255+t11257;
-    const double t11386 = t8352*t2547;
-    const double t11387 = t7752*t3828;
-    const double t11392 = t8351*t2549;
-    const double t11393 = t8474*t1551;
-    const double t11395 = t7799*t6499;
-    const double t11397 = t8278*t3180;
-    const double t11260 = df[3074]*t2553;
-    const double t11263 = df[614]*t1115;
-    const double t11266 = df[1855]*t3306;
-    const double t11269 = df[3703]*t3958;
-    const double t11271 = df[2108]*t3746;
-    const double t11272 = t9667;
-    const double t11275 = df[3613];
-    const double t11432 = t11275*t3228;
-    const double t11398 = df[2825]*t2865+t11260+t11263+t8727*t1099+t11386+t11387+t11266+df
+    const MBPOL_POLY_REAL t11386 = t8352*t2547;
+    const MBPOL_POLY_REAL t11387 = t7752*t3828;
+    const MBPOL_POLY_REAL t11392 = t8351*t2549;
+    const MBPOL_POLY_REAL t11393 = t8474*t1551;
+    const MBPOL_POLY_REAL t11395 = t7799*t6499;
+    const MBPOL_POLY_REAL t11397 = t8278*t3180;
+    const MBPOL_POLY_REAL t11260 = df[3074]*t2553;
+    const MBPOL_POLY_REAL t11263 = df[614]*t1115;
+    const MBPOL_POLY_REAL t11266 = df[1855]*t3306;
+    const MBPOL_POLY_REAL t11269 = df[3703]*t3958;
+    const MBPOL_POLY_REAL t11271 = df[2108]*t3746;
+    const MBPOL_POLY_REAL t11272 = t9667;
+    const MBPOL_POLY_REAL t11275 = df[3613];
+    const MBPOL_POLY_REAL t11432 = t11275*t3228;
+    const MBPOL_POLY_REAL t11398 = df[2825]*t2865+t11260+t11263+t8727*t1099+t11386+t11387+t11266+df
 [3691]*t4038+t11269+t11271+t11392+t11393+t11272*t425+t11395+t11432+t11397;
-    const double t11405 = t8464*t1708;
-    const double t11409 = t8281*t3135;
-    const double t11412 = t8669*t131;
-    const double t11282 = df[1115]*t2100;
-    const double t11284 = df[2332];
-    const double t11286 = t9433;
-    const double t11292 = df[1906];
-    const double t11296 = df[2813]*t2636;
-    const double t11419 = t8152*t4263+t8612*t4265+df[3282]*t2154+t11282+t9389*t3207+t11405+
+    const MBPOL_POLY_REAL t11405 = t8464*t1708;
+    const MBPOL_POLY_REAL t11409 = t8281*t3135;
+    const MBPOL_POLY_REAL t11412 = t8669*t131;
+    const MBPOL_POLY_REAL t11282 = df[1115]*t2100;
+    const MBPOL_POLY_REAL t11284 = df[2332];
+    const MBPOL_POLY_REAL t11286 = t9433;
+    const MBPOL_POLY_REAL t11292 = df[1906];
+    const MBPOL_POLY_REAL t11296 = df[2813]*t2636;
+    const MBPOL_POLY_REAL t11419 = t8152*t4263+t8612*t4265+df[3282]*t2154+t11282+t9389*t3207+t11405+
 t11284*t4219+t11286*t236+t11409+t9611*t4201+t11412+t8527*t1072+t9603*t2483+
 t11292*t3402+t7740*t4074+t11296;
-    const double t11422 = t8402*t2203;
-    const double t11433 = t7751*t3826;
-    const double t11435 = t8176*t3986;
-    const double t11299 = df[2820];
-    const double t11305 = t9795;
-    const double t11313 = df[38]*t93;
-    const double t11320 = df[2413]*t4387;
-    const double t11459 = df[947];
-    const double t11326 = t11459*t1585;
-    const double t11461 = t11299*t2736;
-    const double t11441 = t11461+t11422+t9705*t3209+t11305*t2581+t11313+t9606*t2796+df[3061]
+    const MBPOL_POLY_REAL t11422 = t8402*t2203;
+    const MBPOL_POLY_REAL t11433 = t7751*t3826;
+    const MBPOL_POLY_REAL t11435 = t8176*t3986;
+    const MBPOL_POLY_REAL t11299 = df[2820];
+    const MBPOL_POLY_REAL t11305 = t9795;
+    const MBPOL_POLY_REAL t11313 = df[38]*t93;
+    const MBPOL_POLY_REAL t11320 = df[2413]*t4387;
+    const MBPOL_POLY_REAL t11459 = df[947];
+    const MBPOL_POLY_REAL t11326 = t11459*t1585;
+    const MBPOL_POLY_REAL t11461 = t11299*t2736;
+    const MBPOL_POLY_REAL t11441 = t11461+t11422+t9705*t3209+t11305*t2581+t11313+t9606*t2796+df[3061]
 *t1961+t9659*t2702+df[3042]*t2452+t11433+t11320+t11435+t9737*t4040+df[3051]*
 t1963+t11326+t7739*t7032;
-    const double t11445 = t8062*t1256;
-    const double t11447 = t8475*t1553;
-    const double t11452 = t8223*t3693;
-    const double t11457 = t8248*t3542;
-    const double t11458 = t8225*t3664;
-    const double t11332 = t9742*t6493;
-    const double t11338 = t9726;
-    const double t11340 = df[2634];
-    const double t11343 = t9609;
-    const double t11476 = df[4124];
-    const double t11460 = df[2647]*t3438+t11445+t8066*t4839+t11447+t8235*t3337+t11332+t8477*
+    const MBPOL_POLY_REAL t11445 = t8062*t1256;
+    const MBPOL_POLY_REAL t11447 = t8475*t1553;
+    const MBPOL_POLY_REAL t11452 = t8223*t3693;
+    const MBPOL_POLY_REAL t11457 = t8248*t3542;
+    const MBPOL_POLY_REAL t11458 = t8225*t3664;
+    const MBPOL_POLY_REAL t11332 = t9742*t6493;
+    const MBPOL_POLY_REAL t11338 = t9726;
+    const MBPOL_POLY_REAL t11340 = df[2634];
+    const MBPOL_POLY_REAL t11343 = t9609;
+    const MBPOL_POLY_REAL t11476 = df[4124];
+    const MBPOL_POLY_REAL t11460 = df[2647]*t3438+t11445+t8066*t4839+t11447+t8235*t3337+t11332+t8477*
 t1516+t11476*t4224+t11452+t7724*t4496+df[1661]*t2587+t11338*t2871+t11340*t3400+
 t11457+t11458+t11343*t2873;
-    const double t11480 = t8418*t2067;
-    const double t11354 = df[902]*t1656;
-    const double t11481 = t9581*t2289+t9641*t4313+df[483]*t787+df[492]*t776+t7776*t6616+df
+    const MBPOL_POLY_REAL t11480 = t8418*t2067;
+    const MBPOL_POLY_REAL t11354 = df[902]*t1656;
+    const MBPOL_POLY_REAL t11481 = t9581*t2289+t9641*t4313+df[483]*t787+df[492]*t776+t7776*t6616+df
 [1357]*t2493+t11354+t9633*t6464+t7615*t7657+t7792*t6571+df[3272]*t2152+df[3559]
 *t6566+df[3247]*t2326+t9569*t1587+df[886]*t1629+t11480;
-    const double t11483 = t8061*t1289;
-    const double t11486 = t7800*t6501;
-    const double t11487 = t8488*t1194;
-    const double t11488 = t8226*t3666;
-    const double t11490 = t8159*t4164;
-    const double t11499 = t7710*t4569;
-    const double t11374 = df[4100];
-    const double t11522 = df[1061];
-    const double t11501 = t11483+t9597*t120+t11486+t11487+t11488+t8498*t1145+t11490+df[1597]
+    const MBPOL_POLY_REAL t11483 = t8061*t1289;
+    const MBPOL_POLY_REAL t11486 = t7800*t6501;
+    const MBPOL_POLY_REAL t11487 = t8488*t1194;
+    const MBPOL_POLY_REAL t11488 = t8226*t3666;
+    const MBPOL_POLY_REAL t11490 = t8159*t4164;
+    const MBPOL_POLY_REAL t11499 = t7710*t4569;
+    const MBPOL_POLY_REAL t11374 = df[4100];
+    const MBPOL_POLY_REAL t11522 = df[1061];
+    const MBPOL_POLY_REAL t11501 = t11483+t9597*t120+t11486+t11487+t11488+t8498*t1145+t11490+df[1597]
 *t2704+df[197]*t344+df[470]*t772+t8741*t798+df[475]*t789+t11374*t4597+t11522*
 t2000+t11499+df[1613]*t2921;
-    const double t11502 = t8277*t3178;
-    const double t11505 = t7720*t4361;
-    const double t11514 = t8366*t2448;
-    const double t11520 = t8487*t1287;
-    const double t11380 = df[2618]*t3304;
-    const double t11384 = df[3195]*t2071;
-    const double t11391 = df[1040];
-    const double t11402 = df[164]*t302;
-    const double t11521 = t11502+t11380+t9670*t6441+t11505+t11384+t9563*t1474+t9690*t4033+
+    const MBPOL_POLY_REAL t11502 = t8277*t3178;
+    const MBPOL_POLY_REAL t11505 = t7720*t4361;
+    const MBPOL_POLY_REAL t11514 = t8366*t2448;
+    const MBPOL_POLY_REAL t11520 = t8487*t1287;
+    const MBPOL_POLY_REAL t11380 = df[2618]*t3304;
+    const MBPOL_POLY_REAL t11384 = df[3195]*t2071;
+    const MBPOL_POLY_REAL t11391 = df[1040];
+    const MBPOL_POLY_REAL t11402 = df[164]*t302;
+    const MBPOL_POLY_REAL t11521 = t11502+t11380+t9670*t6441+t11505+t11384+t9563*t1474+t9690*t4033+
 t8647*t274+t8769*t323+t11391*t1957+t11514+t9694*t3490+t9619*t3500+df[2249]*
 t4065+t11402+t11520;
-    const double t11534 = t2341*t1862+t136*t601+t4135*t4725+t7493*t7293+t2404*t5082+t254*
+    const MBPOL_POLY_REAL t11534 = t2341*t1862+t136*t601+t4135*t4725+t7493*t7293+t2404*t5082+t254*
 t4893+t179*t928+t275*t1357+t4970+t5021+t10019+t10153+t11301+t11302+t11325+
 t11375+t11405;
-    const double t11417 = t8755*t131;
-    const double t11428 = df[626]*t1138;
-    const double t11430 = df[613]*t1115;
-    const double t11562 = df[1661];
-    const double t11551 = t11435+t11445+t11490+df[3236]*t2287+df[3246]*t2326+t11417+t7773*
+    const MBPOL_POLY_REAL t11417 = t8755*t131;
+    const MBPOL_POLY_REAL t11428 = df[626]*t1138;
+    const MBPOL_POLY_REAL t11430 = df[613]*t1115;
+    const MBPOL_POLY_REAL t11562 = df[1661];
+    const MBPOL_POLY_REAL t11551 = t11435+t11445+t11490+df[3236]*t2287+df[3246]*t2326+t11417+t7773*
 t3284+t8769*t287+t8268*t3337+t8757*t631+t8151*t4263+t11320+t7739*t7026+t11562*
 t2585+t11428+t11430+t8220*t5733;
-    const double t11559 = t8365*t2448;
-    const double t11560 = t8401*t2203;
-    const double t11568 = t7710*t4567;
-    const double t11570 = t7720*t4359;
-    const double t11450 = t11522;
-    const double t11454 = t9442*t2014;
-    const double t11455 = df[2033];
-    const double t11567 = df[2249]*t4065;
-    const double t11577 = df[100];
-    const double t11573 = t7892*t1922+t11567+df[3128]*t1481+t7891*t2418+t8193*t3884+t11559+
+    const MBPOL_POLY_REAL t11559 = t8365*t2448;
+    const MBPOL_POLY_REAL t11560 = t8401*t2203;
+    const MBPOL_POLY_REAL t11568 = t7710*t4567;
+    const MBPOL_POLY_REAL t11570 = t7720*t4359;
+    const MBPOL_POLY_REAL t11450 = t11522;
+    const MBPOL_POLY_REAL t11454 = t9442*t2014;
+    const MBPOL_POLY_REAL t11455 = df[2033];
+    const MBPOL_POLY_REAL t11567 = df[2249]*t4065;
+    const MBPOL_POLY_REAL t11577 = df[100];
+    const MBPOL_POLY_REAL t11573 = t7892*t1922+t11567+df[3128]*t1481+t7891*t2418+t8193*t3884+t11559+
 t11560+df[3587]*t6441+df[4106]*t4311+t8424*t1996+t11577*t202+df[3298]*t1479+
 t11568+t11450*t2002+t11570+t11454+t11455*t3355;
-    const double t11596 = t7826*t1664;
-    const double t11468 = df[163]*t93;
-    const double t11587 = df[3282];
-    const double t11593 = df[1613];
-    const double t11597 = t11391*t1954+t8648*t274+t8152*t4261+t11587*t2152+t11374*t4595+df
+    const MBPOL_POLY_REAL t11596 = t7826*t1664;
+    const MBPOL_POLY_REAL t11468 = df[163]*t93;
+    const MBPOL_POLY_REAL t11587 = df[3282];
+    const MBPOL_POLY_REAL t11593 = df[1613];
+    const MBPOL_POLY_REAL t11597 = t11391*t1954+t8648*t274+t8152*t4261+t11587*t2152+t11374*t4595+df
 [410]*t344+t11468+t11269+t11593*t2919+t8693*t2940+t7615*t7672+t8500*t1120+t7726
 *t4542+t9472*t2476+t8066*t4853+df[3690]*t4040+df[3093]*t2478+t11596;
-    const double t11616 = t8352*t2549;
-    const double t11618 = t8488*t1192;
-    const double t11619 = t8061*t1287;
-    const double t11500 = df[1114]*t2098;
-    const double t11623 = t8237*t3357+df[2366]*t4304+t7829*t1638+t11242+df[3672]*t3228+t8315
+    const MBPOL_POLY_REAL t11616 = t8352*t2549;
+    const MBPOL_POLY_REAL t11618 = t8488*t1192;
+    const MBPOL_POLY_REAL t11619 = t8061*t1287;
+    const MBPOL_POLY_REAL t11500 = df[1114]*t2098;
+    const MBPOL_POLY_REAL t11623 = t8237*t3357+df[2366]*t4304+t7829*t1638+t11242+df[3672]*t3228+t8315
 *t2646+t11165+t8727*t1093+df[2262]*t4009+t7740*t4084+t7741*t4074+t11616+t11500+
 t11618+t11619+t8528*t1072+t11211*t1592;
-    const double t11626 = t7751*t3828;
-    const double t11631 = t7752*t3826;
-    const double t11635 = t7718*t4393;
-    const double t11637 = t8281*t3133;
-    const double t11645 = t8278*t3178;
-    const double t11638 = df[3926];
-    const double t11646 = t11343*t2871+t11626+df[3726]*t4038+df[464]*t772+t11631+t8741*t792+
+    const MBPOL_POLY_REAL t11626 = t7751*t3828;
+    const MBPOL_POLY_REAL t11631 = t7752*t3826;
+    const MBPOL_POLY_REAL t11635 = t7718*t4393;
+    const MBPOL_POLY_REAL t11637 = t8281*t3133;
+    const MBPOL_POLY_REAL t11645 = t8278*t3178;
+    const MBPOL_POLY_REAL t11638 = df[3926];
+    const MBPOL_POLY_REAL t11646 = t11343*t2871+t11626+df[3726]*t4038+df[464]*t772+t11631+t8741*t792+
 df[2856]*t1474+t11635+t8527*t1076+t11637+t7772*t3286+t7703*t3314+t7878*t2104+
 t11638*t3407+df[3173]*t2289+df[806]*t1472+t11645;
-    const double t11656 = t8475*t1551;
-    const double t11664 = t7800*t6499;
-    const double t11669 = t7827*t1662;
-    const double t11670 = t8224*t3693;
-    const double t11536 = df[37]*t91;
-    const double t11541 = df[1854]*t3304;
-    const double t11674 = df[1470]*t2695+t11155*t1957+t11124*t425+t11146*t236+t11656+t9670*
+    const MBPOL_POLY_REAL t11656 = t8475*t1551;
+    const MBPOL_POLY_REAL t11664 = t7800*t6499;
+    const MBPOL_POLY_REAL t11669 = t7827*t1662;
+    const MBPOL_POLY_REAL t11670 = t8224*t3693;
+    const MBPOL_POLY_REAL t11536 = df[37]*t91;
+    const MBPOL_POLY_REAL t11541 = df[1854]*t3304;
+    const MBPOL_POLY_REAL t11674 = df[1470]*t2695+t11155*t1957+t11124*t425+t11146*t236+t11656+t9670*
 t6464+t8192*t3886+df[1222]*t2280+t11536+t11332+t11664+df[1804]*t3209+df[862]*
 t1585+t11669+t11670+t11541+df[208]*t120;
-    const double t11684 = t8226*t3664;
-    const double t11691 = t8419*t2067;
-    const double t11694 = t8489*t1194;
-    const double t11558 = df[175];
-    const double t11661 = df[3051];
-    const double t11671 = df[886]*t1629;
-    const double t11672 = df[197];
-    const double t11698 = df[2920]*t2282+t11661*t1961+df[3041]*t2452+t11299*t2738+df[2805]*
+    const MBPOL_POLY_REAL t11684 = t8226*t3664;
+    const MBPOL_POLY_REAL t11691 = t8419*t2067;
+    const MBPOL_POLY_REAL t11694 = t8489*t1194;
+    const MBPOL_POLY_REAL t11558 = df[175];
+    const MBPOL_POLY_REAL t11661 = df[3051];
+    const MBPOL_POLY_REAL t11671 = df[886]*t1629;
+    const MBPOL_POLY_REAL t11672 = df[197];
+    const MBPOL_POLY_REAL t11698 = df[2920]*t2282+t11661*t1961+df[3041]*t2452+t11299*t2738+df[2805]*
 t2794+t11671+t11672*t341+df[2515]*t4562+t11684+df[2930]*t2000+t9529*t4213+df
 [537]*t940+t11558*t272+t11691+df[3992]*t3490+t11694+t8027*t617+t11150;
-    const double t11702 = t8386*t2320;
-    const double t11703 = t8366*t2446;
-    const double t11708 = t8223*t3695;
-    const double t11716 = t7770*t3752;
-    const double t11724 = t7771*t3754;
-    const double t11726 = t8225*t3666;
-    const double t11690 = df[3061];
-    const double t11727 = t11702+t11703+t11275*t3226+t11257+t11708+t11271+t11260+df[3222]*
+    const MBPOL_POLY_REAL t11702 = t8386*t2320;
+    const MBPOL_POLY_REAL t11703 = t8366*t2446;
+    const MBPOL_POLY_REAL t11708 = t8223*t3695;
+    const MBPOL_POLY_REAL t11716 = t7770*t3752;
+    const MBPOL_POLY_REAL t11724 = t7771*t3754;
+    const MBPOL_POLY_REAL t11726 = t8225*t3666;
+    const MBPOL_POLY_REAL t11690 = df[3061];
+    const MBPOL_POLY_REAL t11727 = t11702+t11703+t11275*t3226+t11257+t11708+t11271+t11260+df[3222]*
 t2006+df[1596]*t2702+t11716+df[2646]*t3440+t11217+t11123+t11121+t11724+t11690*
 t1963+t11726;
-    const double t11731 = t8248*t3544;
-    const double t11735 = t8669*t137;
-    const double t11740 = t8385*t2322;
-    const double t11579 = df[1516]*t2638;
-    const double t11589 = df[2500]*t4537;
-    const double t11701 = df[2550];
-    const double t11750 = t7952*t5320+t11340*t3402+t11731+df[1495]*t2736+t11579+t11735+
+    const MBPOL_POLY_REAL t11731 = t8248*t3544;
+    const MBPOL_POLY_REAL t11735 = t8669*t137;
+    const MBPOL_POLY_REAL t11740 = t8385*t2322;
+    const MBPOL_POLY_REAL t11579 = df[1516]*t2638;
+    const MBPOL_POLY_REAL t11589 = df[2500]*t4537;
+    const MBPOL_POLY_REAL t11701 = df[2550];
+    const MBPOL_POLY_REAL t11750 = t7952*t5320+t11340*t3402+t11731+df[1495]*t2736+t11579+t11735+
 t11701*t4591+t7776*t6695+df[3947]*t3445+t11740+t11118+t8381*t2376+t11179*t2147+
 t7792*t6575+df[3558]*t6566+t11589+t9408*t2796;
-    const double t11766 = t8487*t1289;
-    const double t11771 = t7730*t4395;
-    const double t11772 = t8179*t3952;
-    const double t11773 = t8351*t2547;
-    const double t11592 = df[2908]*t2100;
-    const double t11719 = df[1841]*t3279;
-    const double t11732 = df[682];
-    const double t11775 = t11592+t11719+df[2123]*t3207+df[77]*t169+t11286*t234+t8274*t3259+
+    const MBPOL_POLY_REAL t11766 = t8487*t1289;
+    const MBPOL_POLY_REAL t11771 = t7730*t4395;
+    const MBPOL_POLY_REAL t11772 = t8179*t3952;
+    const MBPOL_POLY_REAL t11773 = t8351*t2547;
+    const MBPOL_POLY_REAL t11592 = df[2908]*t2100;
+    const MBPOL_POLY_REAL t11719 = df[1841]*t3279;
+    const MBPOL_POLY_REAL t11732 = df[682];
+    const MBPOL_POLY_REAL t11775 = t11592+t11719+df[2123]*t3207+df[77]*t169+t11286*t234+t8274*t3259+
 t8200*t5795+df[469]*t776+t11305*t2578+t11766+t11732*t1215+df[474]*t789+t11247*
 t2581+t11771+t11772+t11773+df[3142]*t2483;
-    const double t11782 = t8418*t2065;
-    const double t11629 = df[2762]*t1914;
-    const double t11632 = df[2472]*t4489;
-    const double t11634 = df[2231]*t4033;
-    const double t11749 = df[671];
-    const double t11757 = df[264];
-    const double t11801 = df[482]*t787+df[3786]*t4224+t7734*t4496+t7828*t1640+t7816*t6279+
+    const MBPOL_POLY_REAL t11782 = t8418*t2065;
+    const MBPOL_POLY_REAL t11629 = df[2762]*t1914;
+    const MBPOL_POLY_REAL t11632 = df[2472]*t4489;
+    const MBPOL_POLY_REAL t11634 = df[2231]*t4033;
+    const MBPOL_POLY_REAL t11749 = df[671];
+    const MBPOL_POLY_REAL t11757 = df[264];
+    const MBPOL_POLY_REAL t11801 = df[482]*t787+df[3786]*t4224+t7734*t4496+t7828*t1640+t7816*t6279+
 t11782+df[3414]*t1594+t11749*t1213+t11272*t422+t8526*t5115+t11338*t2873+t11251*
 t4306+t11629+t11632+t11634+t11757*t429+t8477*t1520+t11384;
-    const double t11810 = t7719*t4361;
-    const double t11813 = t8402*t2201;
-    const double t11818 = t8178*t3954;
-    const double t11821 = t7711*t4569;
-    const double t11823 = t7799*t6501;
-    const double t11642 = df[2801]*t2771;
-    const double t11648 = df[1432]*t2636;
-    const double t11651 = df[737];
-    const double t11770 = df[2825];
-    const double t11824 = df[2794]*t2704+t11354+t11642+t8501*t1145+t11810+t11206*t4597+
+    const MBPOL_POLY_REAL t11810 = t7719*t4361;
+    const MBPOL_POLY_REAL t11813 = t8402*t2201;
+    const MBPOL_POLY_REAL t11818 = t8178*t3954;
+    const MBPOL_POLY_REAL t11821 = t7711*t4569;
+    const MBPOL_POLY_REAL t11823 = t7799*t6501;
+    const MBPOL_POLY_REAL t11642 = df[2801]*t2771;
+    const MBPOL_POLY_REAL t11648 = df[1432]*t2636;
+    const MBPOL_POLY_REAL t11651 = df[737];
+    const MBPOL_POLY_REAL t11770 = df[2825];
+    const MBPOL_POLY_REAL t11824 = df[2794]*t2704+t11354+t11642+t8501*t1145+t11810+t11206*t4597+
 t11813+t11648+t8370*t1998+t11770*t2867+t11651*t1143+t11818+t8314*t2669+df[656]*
 t1187+t11821+t8611*t4433+t11823;
-    const double t11827 = t8474*t1553;
-    const double t11832 = t8280*t3135;
-    const double t11666 = df[3834];
-    const double t11790 = df[118];
-    const double t11796 = df[2769];
-    const double t11800 = df[2833];
-    const double t11847 = t7791*t6571+t11459*t1587+t11827+t11166*t2145+df[2751]*t2493+t11832
+    const MBPOL_POLY_REAL t11827 = t8474*t1553;
+    const MBPOL_POLY_REAL t11832 = t8280*t3135;
+    const MBPOL_POLY_REAL t11666 = df[3834];
+    const MBPOL_POLY_REAL t11790 = df[118];
+    const MBPOL_POLY_REAL t11796 = df[2769];
+    const MBPOL_POLY_REAL t11800 = df[2833];
+    const MBPOL_POLY_REAL t11847 = t7791*t6571+t11459*t1587+t11827+t11166*t2145+df[2751]*t2493+t11832
 +t8436*t1456+t7705*t7080+t11790*t228+t11666*t4494+df[348]*t599+df[4014]*t3699+
 t11231+t11796*t2921+df[2775]*t2697+t11800*t2587+t8534*t5050+df[3815]*t4313;
-    const double t11856 = t8277*t3180;
-    const double t11685 = df[1014]*t1912;
-    const double t11687 = df[2617]*t3306;
-    const double t11689 = df[371]*t302;
-    const double t11700 = df[1003];
-    const double t11706 = t9599;
-    const double t11822 = df[1573];
-    const double t11826 = df[376];
-    const double t11831 = df[3272];
-    const double t11835 = df[381];
-    const double t11868 = t7879*t2106+df[2442]*t4219+t11284*t4201+t11685+t11687+t11689+
+    const MBPOL_POLY_REAL t11856 = t8277*t3180;
+    const MBPOL_POLY_REAL t11685 = df[1014]*t1912;
+    const MBPOL_POLY_REAL t11687 = df[2617]*t3306;
+    const MBPOL_POLY_REAL t11689 = df[371]*t302;
+    const MBPOL_POLY_REAL t11700 = df[1003];
+    const MBPOL_POLY_REAL t11706 = t9599;
+    const MBPOL_POLY_REAL t11822 = df[1573];
+    const MBPOL_POLY_REAL t11826 = df[376];
+    const MBPOL_POLY_REAL t11831 = df[3272];
+    const MBPOL_POLY_REAL t11835 = df[381];
+    const MBPOL_POLY_REAL t11868 = t7879*t2106+df[2442]*t4219+t11284*t4201+t11685+t11687+t11689+
 t11856+t8217*t3339+df[2623]*t3483+t11822*t2865+t11826*t204+t8273*t3261+t11831*
 t2154+t11700*t1454+t11835*t230+t8441*t1436+t11706*t3492;
-    const double t11869 = t8247*t3542;
-    const double t11709 = df[1448];
-    const double t11714 = df[1275];
-    const double t11840 = df[387];
-    const double t11843 = df[2530];
-    const double t11849 = df[4032];
-    const double t11854 = t11137*t3447;
-    const double t11891 = t11869+t11709*t2667+t11840*t431+df[1961]*t3500+t11843*t4589+t11714
+    const MBPOL_POLY_REAL t11869 = t8247*t3542;
+    const MBPOL_POLY_REAL t11709 = df[1448];
+    const MBPOL_POLY_REAL t11714 = df[1275];
+    const MBPOL_POLY_REAL t11840 = df[387];
+    const MBPOL_POLY_REAL t11843 = df[2530];
+    const MBPOL_POLY_REAL t11849 = df[4032];
+    const MBPOL_POLY_REAL t11854 = t11137*t3447;
+    const MBPOL_POLY_REAL t11891 = t11869+t11709*t2667+t11840*t431+df[1961]*t3500+t11843*t4589+t11714
 *t2374+t11292*t3400+t11849*t3409+t7671*t7452+t7702*t3310+t11854+t8160*t4115+
 t8654*t65+t8559*t912+t8560*t908+df[1927]*t3438+t8442*t1792+t8476*t1516;
-    const double t11905 = t4986+t2404*t5220+t275*t1350+t2341*t1458+t4135*t4757+t132*t5016+
+    const MBPOL_POLY_REAL t11905 = t4986+t2404*t5220+t275*t1350+t2341*t1458+t4135*t4757+t132*t5016+
 t136*t582+t254*t4889+t179*t915+t7493*t6823+t10019+t10153+t11224+t11233+t11244+
 t11253+t11274+t11290+t11297;
-    const double t11906 = t11300+t11301+t11302+t11306+t11307+t11308+t11310+t11311+t11324+
+    const MBPOL_POLY_REAL t11906 = t11300+t11301+t11302+t11306+t11307+t11308+t11310+t11311+t11324+
 t11325+t11342+t11349+t11350+t11356+t11372+t11375+t11386+t11387+t11392;
-    const double t11908 = t11393+t11395+t11397+t11405+t11409+t11412+t11422+t11433+t11435+
+    const MBPOL_POLY_REAL t11908 = t11393+t11395+t11397+t11405+t11409+t11412+t11422+t11433+t11435+
 t11445+t11447+t11452+t11457+t11458+t11480+t11483+t11486+t11487+t11488;
-    const double t11745 = df[1469];
-    const double t11754 = t11757;
-    const double t11759 = df[3406];
-    const double t11762 = df[3413];
-    const double t11925 = t11490+t11499+t11502+t11505+t11514+t11520+t11745*t2697+t7881*t2106
+    const MBPOL_POLY_REAL t11745 = df[1469];
+    const MBPOL_POLY_REAL t11754 = t11757;
+    const MBPOL_POLY_REAL t11759 = df[3406];
+    const MBPOL_POLY_REAL t11762 = df[3413];
+    const MBPOL_POLY_REAL t11925 = t11490+t11499+t11502+t11505+t11514+t11520+t11745*t2697+t7881*t2106
 +t8499*t1155+df[733]*t1157+t7615*t7617+t11282+t9512*t3438+t11754*t431+t8235*
 t3333+df[1903]*t3402+t11759*t1594+t8228*t3337+t11762*t1592;
-    const double t11764 = df[4105];
-    const double t11781 = t11790;
-    const double t11785 = t11840;
-    const double t11787 = t11835;
-    const double t11953 = t11263+t11764*t4313+t8442*t1523+t11246+t11402+df[151]*t284+t8769*
+    const MBPOL_POLY_REAL t11764 = df[4105];
+    const MBPOL_POLY_REAL t11781 = t11790;
+    const MBPOL_POLY_REAL t11785 = t11840;
+    const MBPOL_POLY_REAL t11787 = t11835;
+    const MBPOL_POLY_REAL t11953 = t11263+t11764*t4313+t8442*t1523+t11246+t11402+df[151]*t284+t8769*
 t276+t7893*t1922+t8220*t5777+t8200*t5788+t8657*t274+df[399]*t234+t11781*t230+
 t8699*t2681+t11785*t429+t11787*t228+df[393]*t422+t7816*t6270+t7828*t1634;
-    const double t11797 = df[1926];
-    const double t11803 = t11732;
-    const double t11806 = df[805];
-    const double t11808 = df[3235];
-    const double t11814 = t11577;
-    const double t11977 = t8340*t2669+t8343*t2665+t11195+t8434*t1857+t7830*t1640+t11797*
+    const MBPOL_POLY_REAL t11797 = df[1926];
+    const MBPOL_POLY_REAL t11803 = t11732;
+    const MBPOL_POLY_REAL t11806 = df[805];
+    const MBPOL_POLY_REAL t11808 = df[3235];
+    const MBPOL_POLY_REAL t11814 = t11577;
+    const MBPOL_POLY_REAL t11977 = t8340*t2669+t8343*t2665+t11195+t8434*t1857+t7830*t1640+t11797*
 t3440+df[1141]*t2147+t8484*t1456+t11803*t1213+t8376*t2376+t11806*t1474+t11190+
 t11808*t2289+t11239+df[2632]*t3400+t11814*t204+t7735*t4542+df[2852]*t1472+t8483
 *t1436;
-    const double t11820 = df[2622];
-    const double t11828 = df[2453];
-    const double t11846 = df[409];
-    const double t12005 = t11820*t3500+t7739*t6990+t7740*t4070+t11828*t4304+t8585*t4459+
+    const MBPOL_POLY_REAL t11820 = df[2622];
+    const MBPOL_POLY_REAL t11828 = df[2453];
+    const MBPOL_POLY_REAL t11846 = df[409];
+    const MBPOL_POLY_REAL t12005 = t11820*t3500+t7739*t6990+t7740*t4070+t11828*t4304+t8585*t4459+
 t8236*t3613+df[1401]*t2581+t11706*t3490+t9692*t3445+t7891*t1918+df[1871]*t3335+
 t8124*t4263+df[1059]*t1994+df[1038]*t1957+t7892*t1920+t11846*t341+t11142+t7704*
 t4496+df[4098]*t4597;
-    const double t11853 = df[3127];
-    const double t11863 = t11719;
-    const double t11876 = df[3221];
-    const double t11880 = df[3586];
-    const double t12035 = t11450*t2000+t11255+t11853*t1479+t9571*t2478+df[899]*t1656+t8266*
+    const MBPOL_POLY_REAL t11853 = df[3127];
+    const MBPOL_POLY_REAL t11863 = t11719;
+    const MBPOL_POLY_REAL t11876 = df[3221];
+    const MBPOL_POLY_REAL t11880 = df[3586];
+    const MBPOL_POLY_REAL t12035 = t11450*t2000+t11255+t11853*t1479+t9571*t2478+df[899]*t1656+t8266*
 t3357+df[2861]*t1954+t11863+t7725*t4615+df[2722]*t562+df[3529]*t6493+t11432+
 t7776*t6717+t8040*t617+df[3202]*t2207+t11876*t2014+t7778*t6571+t7791*t6610+
 t11880*t6464+df[247]*t425;
-    const double t11897 = df[2261];
-    const double t11900 = t11567;
-    const double t11902 = df[2750];
-    const double t11912 = df[1494];
-    const double t12065 = df[3193]*t2071+t7792*t6612+df[3557]*t6566+t9406*t2280+t8741*t779+
+    const MBPOL_POLY_REAL t11897 = df[2261];
+    const MBPOL_POLY_REAL t11900 = t11567;
+    const MBPOL_POLY_REAL t11902 = df[2750];
+    const MBPOL_POLY_REAL t11912 = df[1494];
+    const MBPOL_POLY_REAL t12065 = df[3193]*t2071+t7792*t6612+df[3557]*t6566+t9406*t2280+t8741*t779+
 df[468]*t787+df[463]*t789+df[453]*t772+t11897*t4033+t11900+t9408*t2794+t11902*
 t2476+df[340]*t580+t11178+df[219]*t236+df[205]*t120+t11912*t2738+t7879*t2245+
 t11408;
-    const double t11916 = t11334;
-    const double t11919 = t11672;
-    const double t11926 = t11843;
-    const double t11934 = t11749;
-    const double t11938 = df[2929];
-    const double t12091 = t11916*t2287+t7878*t2243+t11919*t344+t9467*t4311+t9423*t6441+df
+    const MBPOL_POLY_REAL t11916 = t11334;
+    const MBPOL_POLY_REAL t11919 = t11672;
+    const MBPOL_POLY_REAL t11926 = t11843;
+    const MBPOL_POLY_REAL t11934 = t11749;
+    const MBPOL_POLY_REAL t11938 = df[2929];
+    const MBPOL_POLY_REAL t12091 = t11916*t2287+t7878*t2243+t11919*t344+t9467*t4311+t9423*t6441+df
 [2901]*t2145+t11326+t11926*t4591+t8375*t1996+t8476*t1531+df[655]*t1187+t8647*
 t319+df[3779]*t4506+t11934*t1215+df[2514]*t4562+t8316*t2642+t11115+t11938*t2002
 +df[3862]*t4595;
-    const double t11950 = t11701;
-    const double t11952 = t11562;
-    const double t11962 = t9487;
-    const double t11966 = df[3946];
-    const double t12117 = t8502*t1145+t8380*t2372+t8066*t4818+df[984]*t1859+df[3366]*t1557+
+    const MBPOL_POLY_REAL t11950 = t11701;
+    const MBPOL_POLY_REAL t11952 = t11562;
+    const MBPOL_POLY_REAL t11962 = t9487;
+    const MBPOL_POLY_REAL t11966 = df[3946];
+    const MBPOL_POLY_REAL t12117 = t8502*t1145+t8380*t2372+t8066*t4818+df[984]*t1859+df[3366]*t1557+
 df[3245]*t2326+t11950*t4589+t11952*t2587+t8534*t5046+t8370*t2397+t7952*t5310+
 t7705*t7071+df[1642]*t2873+t8379*t1992+t11169+t11962*t2695+t8152*t4259+t9499*
 t4219+t11966*t3447;
-    const double t11968 = t11796;
-    const double t11975 = t9445;
-    const double t11980 = t11638;
-    const double t11984 = t11661;
-    const double t11991 = df[3785];
-    const double t12141 = t11968*t2919+t8479*t1516+t8160*t4132+t8615*t578+t8757*t627+t8656*
+    const MBPOL_POLY_REAL t11968 = t11796;
+    const MBPOL_POLY_REAL t11975 = t9445;
+    const MBPOL_POLY_REAL t11980 = t11638;
+    const MBPOL_POLY_REAL t11984 = t11661;
+    const MBPOL_POLY_REAL t11991 = df[3785];
+    const MBPOL_POLY_REAL t12141 = t11968*t2919+t8479*t1516+t8160*t4132+t8615*t578+t8757*t627+t8656*
 t65+t11975*t1481+df[3290]*t2006+t8217*t3359+t11980*t3409+t7703*t3584+t7772*
 t4186+t11984*t1963+df[3040]*t2452+t8192*t3880+t8163*t3886+df[2787]*t2871+t11991
 *t4213+t8435*t1892+t11296;
-    const double t11994 = df[2804];
-    const double t11999 = df[2365];
-    const double t12001 = df[2122];
-    const double t12009 = t11690;
-    const double t12011 = df[2793];
-    const double t12017 = t11822;
-    const double t12021 = t11593;
-    const double t12084 = df[492];
-    const double t12101 = df[1344];
-    const double t12168 = t11994*t2796+t11380+t8084*t3261+t8560*t925+t12084*t776+t11999*
+    const MBPOL_POLY_REAL t11994 = df[2804];
+    const MBPOL_POLY_REAL t11999 = df[2365];
+    const MBPOL_POLY_REAL t12001 = df[2122];
+    const MBPOL_POLY_REAL t12009 = t11690;
+    const MBPOL_POLY_REAL t12011 = df[2793];
+    const MBPOL_POLY_REAL t12017 = t11822;
+    const MBPOL_POLY_REAL t12021 = t11593;
+    const MBPOL_POLY_REAL t12084 = df[492];
+    const MBPOL_POLY_REAL t12101 = df[1344];
+    const MBPOL_POLY_REAL t12168 = t11994*t2796+t11380+t8084*t3261+t8560*t925+t12084*t776+t11999*
 t4306+t12001*t3209+df[2105]*t3746+df[1598]*t2704+df[3964]*t3548+t12009*t1961+
 t12011*t2702+t8477*t1533+df[3072]*t2553+t12101*t2493+t12017*t2867+t8526*t5118+
 t8310*t2646+t12021*t2921;
-    const double t12023 = df[2441];
-    const double t12039 = df[3991];
-    const double t12046 = t11587;
-    const double t12194 = t12023*t4201+t8498*t1169+t11313+df[2150]*t3820+t7741*t4072+t7769*
+    const MBPOL_POLY_REAL t12023 = df[2441];
+    const MBPOL_POLY_REAL t12039 = df[3991];
+    const MBPOL_POLY_REAL t12046 = t11587;
+    const MBPOL_POLY_REAL t12194 = t12023*t4201+t8498*t1169+t11313+df[2150]*t3820+t7741*t4072+t7769*
 t3286+df[2410]*t4387+t11199+df[3701]*t3958+df[3689]*t4038+df[3656]*t3184+t7749*
 t4074+t12039*t3492+t8274*t3257+t7684*t3310+t7958*t7420+t7702*t3586+df[4013]*
 t3699+t12046*t2154;
-    const double t12048 = t11831;
-    const double t12050 = t11476;
-    const double t12052 = df[3671];
-    const double t12064 = t11849;
-    const double t12070 = t11671;
-    const double t12219 = t12048*t2152+t12050*t4224+t12052*t3226+t8273*t3255+t7724*t4508+
+    const MBPOL_POLY_REAL t12048 = t11831;
+    const MBPOL_POLY_REAL t12050 = t11476;
+    const MBPOL_POLY_REAL t12052 = df[3671];
+    const MBPOL_POLY_REAL t12064 = t11849;
+    const MBPOL_POLY_REAL t12070 = t11671;
+    const MBPOL_POLY_REAL t12219 = t12048*t2152+t12050*t4224+t12052*t3226+t8273*t3255+t7724*t4508+
 t11266+df[2839]*t2578+t8727*t1079+t8530*t1072+t8527*t1088+t8528*t1090+df[74]*
 t169+t7773*t4184+t12064*t3407+df[1627]*t2644+t12070+t7829*t1636+t8151*t4257+
 t8193*t3882;
-    const double t12083 = t11826;
-    const double t12086 = df[3725];
-    const double t12089 = df[1221];
-    const double t12093 = t11770;
-    const double t12096 = df[861];
-    const double t12098 = t11800;
-    const double t12102 = df[3092];
-    const double t12244 = df[704]*t1281+t8503*t1120+df[536]*t940+t8559*t923+df[3081]*t3139+
+    const MBPOL_POLY_REAL t12083 = t11826;
+    const MBPOL_POLY_REAL t12086 = df[3725];
+    const MBPOL_POLY_REAL t12089 = df[1221];
+    const MBPOL_POLY_REAL t12093 = t11770;
+    const MBPOL_POLY_REAL t12096 = df[861];
+    const MBPOL_POLY_REAL t12098 = t11800;
+    const MBPOL_POLY_REAL t12102 = df[3092];
+    const MBPOL_POLY_REAL t12244 = df[704]*t1281+t8503*t1120+df[536]*t940+t8559*t923+df[3081]*t3139+
 df[3982]*t3670+t12083*t202+t8562*t908+t12086*t4040+df[1802]*t3207+t12089*t2282+
 t11176+t8646*t282+t12093*t2865+t11461+t12096*t1587+t12098*t2585+df[2394]*t4353+
 t12102*t2483+t4887;
-    const double t12275 = t471+t4961+t126*t4885+t254*(2.0*t4843+t1150+t1102+t1103+t1151+
-t1107+t1344+t1345+t1346+t1347)+t7493*(2.0*t6594+t4179+t3266+t3267+t4180+t3271+
-t6748+t6749+t6781+t6782)+t275*(2.0*t1301+t1163+t1124+t1126+t1164+t1130+t1337+
-t1338+t1339+t1340)+t179*(2.0*t931+t895+t897+t898+t899+t900+t902+t903+t905+t907)
-+t4135*(2.0*t4754+t4727+t3241+t4728+t4729+t4730+t3249+t3250+t4731+t4732)+t136*
-t470+t2404*(2.0*t5142+t1441+t1443+t1444+t1445+t1446+t1448+t1449+t1451+t1453)+
-t132*t4964+t2341*(2.0*t2109+t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+
+    const MBPOL_POLY_REAL t12275 = t471+t4961+t126*t4885+t254*(MBPOL_POLY_REAL(2)*t4843+t1150+t1102+t1103+t1151+
+t1107+t1344+t1345+t1346+t1347)+t7493*(MBPOL_POLY_REAL(2)*t6594+t4179+t3266+t3267+t4180+t3271+
+t6748+t6749+t6781+t6782)+t275*(MBPOL_POLY_REAL(2)*t1301+t1163+t1124+t1126+t1164+t1130+t1337+
+t1338+t1339+t1340)+t179*(MBPOL_POLY_REAL(2)*t931+t895+t897+t898+t899+t900+t902+t903+t905+t907)
++t4135*(MBPOL_POLY_REAL(2)*t4754+t4727+t3241+t4728+t4729+t4730+t3249+t3250+t4731+t4732)+t136*
+t470+t2404*(MBPOL_POLY_REAL(2)*t5142+t1441+t1443+t1444+t1445+t1446+t1448+t1449+t1451+t1453)+
+t132*t4964+t2341*(MBPOL_POLY_REAL(2)*t2109+t1423+t1424+t1426+t1427+t1428+t1430+t1431+t1433+
 t1435)+t7569+t4966+t215*t1250*t212+t10019+t10153+t4944+t4946;
-    const double t12276 = t11301+t11302+t11375+t11405+t11435+t11445+t11490+t11559+t11560+
+    const MBPOL_POLY_REAL t12276 = t11301+t11302+t11375+t11405+t11435+t11445+t11490+t11559+t11560+
 t11568+t11570+t11596+t11616+t11618+t11619+t11626+t11631+t11635+t11637;
-    const double t12278 = t11645+t11656+t11664+t11669+t11670+t11684+t11691+t11694+t11702+
+    const MBPOL_POLY_REAL t12278 = t11645+t11656+t11664+t11669+t11670+t11684+t11691+t11694+t11702+
 t11703+t11708+t11716+t11724+t11726+t11731+t11735+t11740+t11766+t11771;
-    const double t12287 = t11772+t11773+t11782+t11810+t11813+t11818+t11821+t11823+t11827+
-t11832+t11856+t11869+t4949+t4953+t4957+t8585*(2.0*t4187+t4436+t4437+t4245+t4438
+    const MBPOL_POLY_REAL t12287 = t11772+t11773+t11782+t11810+t11813+t11818+t11821+t11823+t11827+
+t11832+t11856+t11869+t4949+t4953+t4957+t8585*(MBPOL_POLY_REAL(2)*t4187+t4436+t4437+t4245+t4438
 +t4439+t4251+t4252+t4440+t4441)+t8151*t4259+df[2407]*t4387+df[2391]*t4353+
 t11999*t4304;
-    const double t12320 = t8152*t4257+t9499*t4201+t8160*(2.0*t3909+t4124+t3870+t4125+t4126+
+    const MBPOL_POLY_REAL t12320 = t8152*t4257+t9499*t4201+t8160*(MBPOL_POLY_REAL(2)*t3909+t4124+t3870+t4125+t4126+
 t4127+t3874+t3875+t4128+t4129)+t11900+t11634+df[3199]*t2207+df[3190]*t2071+
 t8193*t3880+t11541+t11863+t8274*t3255+df[1801]*t3209+t11592+t8381*t2372+df
-[3813]*t4313+t11952*t2585+df[1642]*t2871+t8693*(2.0*t2531+t2622+t2844+t2625+
+[3813]*t4313+t11952*t2585+df[1642]*t2871+t8693*(MBPOL_POLY_REAL(2)*t2531+t2622+t2844+t2625+
 t2627+t2847+t2933+t2934+t2942+t2943)+t8315*t2642;
-    const double t12358 = t12021*t2919+df[2704]*t599+df[2147]*t3820+df[3862]*t4597+t12001*
-t3207+df[2102]*t3746+t8217*(2.0*t3360+t3634+t3319+t3635+t3636+t3637+t3327+t3328
+    const MBPOL_POLY_REAL t12358 = t12021*t2919+df[2704]*t599+df[2147]*t3820+df[3862]*t4597+t12001*
+t3207+df[2102]*t3746+t8217*(MBPOL_POLY_REAL(2)*t3360+t3634+t3319+t3635+t3636+t3637+t3327+t3328
 +t3638+t3639)+t11455*t3335+t7829*t1634+t9503*t3500+t11797*t3438+t11666*t4506+df
 [1881]*t3355+t8268*t3333+df[1903]*t3400+t8163*t3884+df[2901]*t2147+t9718*t2702+
-(2.0*t7566+t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982)*t77+t12017*t2865;
-    const double t12392 = t11916*t2289+t7878*t2245+t7879*t2243+t7881*t2104+t8200*(2.0*t5532+
+(MBPOL_POLY_REAL(2)*t7566+t607+t831+t4979+t832+t4980+t611+t612+t4981+t4982)*t77+t12017*t2865;
+    const MBPOL_POLY_REAL t12392 = t11916*t2289+t7878*t2245+t7879*t2243+t7881*t2104+t8200*(MBPOL_POLY_REAL(2)*t5532+
 t2085+t2086+t2238+t2239+t2090+t5779+t5780+t5781+t5782)+df[1535]*t2796+t11579+
 t11912*t2736+t11745*t2695+t12098*t2587+t7769*t3284+t12052*t3228+t11975*t1479+
-t11454+df[4051]*t3492+t7958*(2.0*t6994+t3292+t3291+t3579+t3580+t3296+t7295+
+t11454+df[4051]*t3492+t7958*(MBPOL_POLY_REAL(2)*t6994+t3292+t3291+t3579+t3580+t3296+t7295+
 t7296+t7413+t7414)+df[4012]*t3699+t7684*t3314+t7702*t3584;
-    const double t12425 = t11994*t2794+t11642+t12011*t2704+t11854+t12064*t3409+t7773*t4186+
+    const MBPOL_POLY_REAL t12425 = t11994*t2794+t11642+t12011*t2704+t11854+t12064*t3409+t7773*t4186+
 t12039*t3490+t11938*t2000+df[3979]*t3670+t8192*t3882+t11897*t4009+df[3363]*
 t1557+t11880*t6441+t11651*t1157+t8501*t1169+df[729]*t1143+t11803*t1215+df[701]*
 t1281+df[654]*t1187+df[3508]*t6464;
-    const double t12464 = t12093*t2867+df[2822]*t2738+df[2787]*t2873+t8314*t2665+t12046*
-t2152+t12048*t2154+t11962*t2697+t9507*t3226+t8526*(2.0*t5014+t2654+t2673+t2674+
-t2675+t2676+t2658+t2659+t2677+t2678)+t11629+t8436*t1892+t7778*t6575+t7776*(2.0*
+    const MBPOL_POLY_REAL t12464 = t12093*t2867+df[2822]*t2738+df[2787]*t2873+t8314*t2665+t12046*
+t2152+t12048*t2154+t11962*t2697+t9507*t3226+t8526*(MBPOL_POLY_REAL(2)*t5014+t2654+t2673+t2674+
+t2675+t2676+t2658+t2659+t2677+t2678)+t11629+t8436*t1892+t7778*t6575+t7776*(MBPOL_POLY_REAL(2)*
 t6440+t6552+t6554+t6621+t6622+t6558+t6606+t6607+t6710+t6711)+t9406*t2282+t11968
-*t2921+t11902*t2493+t7952*(2.0*t5308+t2389+t2390+t2359+t2391+t2392+t2365+t2366+
+*t2921+t11902*t2493+t7952*(MBPOL_POLY_REAL(2)*t5308+t2389+t2390+t2359+t2391+t2392+t2365+t2366+
 t2393+t2394)+t11428+t11430;
-    const double t12325 = df[536];
-    const double t12498 = t8527*t1090+t8528*t1088+t7705*(2.0*t6939+t4476+t4477+t4501+t4502+
-t4481+t7073+t7074+t7263+t7264)+t8530*t1076+t8727*(2.0*t978+t1059+t1061+t1062+
+    const MBPOL_POLY_REAL t12325 = df[536];
+    const MBPOL_POLY_REAL t12498 = t8527*t1090+t8528*t1088+t7705*(MBPOL_POLY_REAL(2)*t6939+t4476+t4477+t4501+t4502+
+t4481+t7073+t7074+t7263+t7264)+t8530*t1076+t8727*(MBPOL_POLY_REAL(2)*t978+t1059+t1061+t1062+
 t1063+t1064+t1066+t1067+t1069+t1071)+t12325*t940+t7740*t4072+t11934*t1213+
 t11468+t8654*t282+t11558*t284+df[3069]*t2553+df[3039]*t2452+df[144]*t272+t11984
-*t1961+t8769*(2.0*t10+t51+t53+t55+t56+t57+t59+t60+t62+t64)+t11536+t11781*t228+
+*t1961+t8769*(MBPOL_POLY_REAL(2)*t10+t51+t53+t55+t56+t57+t59+t60+t62+t64)+t11536+t11781*t228+
 t11814*t202;
-    const double t12528 = df[73]*t169+df[3698]*t3958+t9730*t4040+t12086*t4038+t8237*t3613+df
-[3653]*t3184+t11846*t344+t7741*t4070+t7749*t4084+t7739*(2.0*t6702+t4054+t4051+
+    const MBPOL_POLY_REAL t12528 = df[73]*t169+df[3698]*t3958+t9730*t4040+t12086*t4038+t8237*t3613+df
+[3653]*t3184+t11846*t344+t7741*t4070+t7749*t4084+t7739*(MBPOL_POLY_REAL(2)*t6702+t4054+t4051+
 t4078+t4056+t4081+t6933+t6934+t6935+t6936)+t8559*t925+t8560*t923+t8562*t912+df
 [467]*t789+df[462]*t787+df[452]*t776+t8741*t692+df[450]*t772+t12102*t2478;
-    const double t12565 = df[3078]*t3139+df[204]*t120+t11919*t341+df[4098]*t4595+df[219]*
+    const MBPOL_POLY_REAL t12565 = df[3078]*t3139+df[204]*t120+t11919*t341+df[4098]*t4595+df[219]*
 t234+t11417+df[393]*t425+t11785*t431+t11787*t230+df[2839]*t2581+t11754*t429+df
-[247]*t422+df[330]*t562+df[339]*t578+t8648*t319+t8757*(2.0*t493+t259+t261+t262+
-t263+t264+t266+t267+t269+t271)+df[2853]*t1474+t11759*t1592+t7816*(2.0*t5932+
+[247]*t422+df[330]*t562+df[339]*t578+t8648*t319+t8757*(MBPOL_POLY_REAL(2)*t493+t259+t261+t262+
+t263+t264+t266+t267+t269+t271)+df[2853]*t1474+t11759*t1592+t7816*(MBPOL_POLY_REAL(2)*t5932+
 t1617+t1618+t1722+t1620+t1725+t6153+t6154+t6155+t6156)+t11950*t4591;
-    const double t12601 = df[399]*t236+df[3526]*t6493+t11926*t4589+t7615*(2.0*t7269+t4523+
+    const MBPOL_POLY_REAL t12601 = df[399]*t236+df[3526]*t6493+t11926*t4589+t7615*(MBPOL_POLY_REAL(2)*t7269+t4523+
 t4610+t4525+t4611+t4529+t7065+t7066+t7067+t7068)+t11764*t4311+t11980*t3407+df
 [2513]*t4562+t11589+t11876*t2006+t11632+t11828*t4306+t8124*t4261+t7703*t3586+
 t7772*t4184+t12023*t4219+t12009*t1963+t8500*t1155+df[1458]*t2667+t11709*t2644;
-    const double t12424 = df[3557];
-    const double t12637 = t11648+t11991*t4224+df[1401]*t2578+t12101*t2476+t7792*t6610+t12424
-*t6566+t8370*(2.0*t2051+t2335+t2336+t1982+t2337+t2338+t1986+t1987+t2339+t2340)+
+    const MBPOL_POLY_REAL t12424 = df[3557];
+    const MBPOL_POLY_REAL t12637 = t11648+t11991*t4224+df[1401]*t2578+t12101*t2476+t7792*t6610+t12424
+*t6566+t8370*(MBPOL_POLY_REAL(2)*t2051+t2335+t2336+t1982+t2337+t2338+t1986+t1987+t2339+t2340)+
 df[1290]*t2374+t11714*t1994+t7893*t2418+t7734*t4508+df[3773]*t4494+df[1141]*
 t2145+t11500+df[1061]*t2002+t7830*t1638+df[2721]*t580+t8534*t4995+t9512*t3440+
-t8066*(2.0*t4665+t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354);
-    const double t12668 = df[2632]*t3402+t11820*t3483+t7828*t1636+t11762*t1594+t7726*t4615+
+t8066*(MBPOL_POLY_REAL(2)*t4665+t3342+t3344+t3345+t3346+t3347+t3349+t3350+t3352+t3354);
+    const MBPOL_POLY_REAL t12668 = df[2632]*t3402+t11820*t3483+t7828*t1636+t11762*t1594+t7726*t4615+
 t12050*t4213+t11687+t8084*t3259+t8273*t3257+df[3961]*t3548+t11966*t3445+t7791*
 t6612+df[3244]*t2326+t11808*t2287+t12083*t204+t11689+df[795]*t1454+t8424*t1992+
 t11685;
-    const double t12700 = t11700*t1859+t8441*t1857+t9571*t2483+t11853*t1481+t8476*t1533+df
-[947]*t1587+t8442*(2.0*t1457+t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+
-t1515)+df[896]*t1656+t12070+df[2861]*t1957+t7891*t1920+t7892*t1918+t8220*(2.0*
+    const MBPOL_POLY_REAL t12700 = t11700*t1859+t8441*t1857+t9571*t2483+t11853*t1481+t8476*t1533+df
+[947]*t1587+t8442*(MBPOL_POLY_REAL(2)*t1457+t1503+t1504+t1506+t1507+t1508+t1510+t1511+t1513+
+t1515)+df[896]*t1656+t12070+df[2861]*t1957+t7891*t1920+t7892*t1918+t8220*(MBPOL_POLY_REAL(2)*
 t5502+t1900+t1901+t2407+t1903+t2410+t5721+t5722+t5723+t5724)+t12096*t1585+t8477
 *t1531+t8479*t1520+t11806*t1472+df[1038]*t1954+t12089*t2280+t4971;
-    const double t12715 = t215*t1247*t212;
-    const double t12718 = t6+t4135*(2.0*t3990+t3719+t3720+t3722+t3723+t3724+t3726+t3727+
-t3989)+t179*(2.0*t927+t875+t864+t867+t869+t878+t885+t886+t926)+t7493*(2.0*t6601
+    const MBPOL_POLY_REAL t12715 = t215*t1247*t212;
+    const MBPOL_POLY_REAL t12718 = t6+t4135*(MBPOL_POLY_REAL(2)*t3990+t3719+t3720+t3722+t3723+t3724+t3726+t3727+
+t3989)+t179*(MBPOL_POLY_REAL(2)*t927+t875+t864+t867+t869+t878+t885+t886+t926)+t7493*(MBPOL_POLY_REAL(2)*t6601
 +t3778+t3153+t3155+t3779+t3159+t3726+t3727+t6600)+t7516+t7531+t7535+t7540+t7545
 +t7551+t7563+t12715+t126*t594*t77+t1;
-    const double t12452 = df[3708]*t3873;
-    const double t12461 = df[3211]*t1985;
-    const double t12466 = df[1456];
-    const double t12540 = df[3218];
-    const double t12735 = df[72]*t164+df[48]*t115+df[3711]*t3814+t12452+df[260]*t416+df
-[3268]*t2139+t8694*(2.0*t2464+t2605+t2613+t2602+t2607+t2616+t2761+t2762+t2460)+
+    const MBPOL_POLY_REAL t12452 = df[3708]*t3873;
+    const MBPOL_POLY_REAL t12461 = df[3211]*t1985;
+    const MBPOL_POLY_REAL t12466 = df[1456];
+    const MBPOL_POLY_REAL t12540 = df[3218];
+    const MBPOL_POLY_REAL t12735 = df[72]*t164+df[48]*t115+df[3711]*t3814+t12452+df[260]*t416+df
+[3268]*t2139+t8694*(MBPOL_POLY_REAL(2)*t2464+t2605+t2613+t2602+t2607+t2616+t2761+t2762+t2460)+
 t12540*t2010+df[1539]*t2790+t12461+df[895]*t1653+df[3189]*t2059+df[3198]*t2195+
 t12466*t2660;
-    const double t12742 = t8463*t1702;
-    const double t12747 = t8062*t1244;
-    const double t12468 = df[1446];
-    const double t12470 = df[3117];
-    const double t12472 = df[3114];
-    const double t12475 = df[24];
-    const double t12478 = df[884]*t1626;
-    const double t12481 = df[35]*t58;
-    const double t12482 = df[2606];
-    const double t12485 = df[3027]*t1447;
-    const double t12486 = df[523];
-    const double t12751 = t12468*t2662+t12470*t1907+t12472*t1905+df[2526]*t4586+t12475*t63+
+    const MBPOL_POLY_REAL t12742 = t8463*t1702;
+    const MBPOL_POLY_REAL t12747 = t8062*t1244;
+    const MBPOL_POLY_REAL t12468 = df[1446];
+    const MBPOL_POLY_REAL t12470 = df[3117];
+    const MBPOL_POLY_REAL t12472 = df[3114];
+    const MBPOL_POLY_REAL t12475 = df[24];
+    const MBPOL_POLY_REAL t12478 = df[884]*t1626;
+    const MBPOL_POLY_REAL t12481 = df[35]*t58;
+    const MBPOL_POLY_REAL t12482 = df[2606];
+    const MBPOL_POLY_REAL t12485 = df[3027]*t1447;
+    const MBPOL_POLY_REAL t12486 = df[523];
+    const MBPOL_POLY_REAL t12751 = t12468*t2662+t12470*t1907+t12472*t1905+df[2526]*t4586+t12475*t63+
 t12742+t12478+t8534*t4994+t12481+t12482*t3251+t12747+t12485+t12486*t906+df
 [1168]*t2198;
-    const double t12492 = df[2031];
-    const double t12494 = df[2050];
-    const double t12497 = df[1830];
-    const double t12503 = df[2247]*t4062;
-    const double t12509 = df[611]*t1112;
-    const double t12510 = df[599];
-    const double t12512 = df[2362];
-    const double t12592 = t12512*t4301;
-    const double t12769 = t8585*(2.0*t4242+t4416+t4514+t4515+t4516+t4517+t4424+t4425+t4241)+
+    const MBPOL_POLY_REAL t12492 = df[2031];
+    const MBPOL_POLY_REAL t12494 = df[2050];
+    const MBPOL_POLY_REAL t12497 = df[1830];
+    const MBPOL_POLY_REAL t12503 = df[2247]*t4062;
+    const MBPOL_POLY_REAL t12509 = df[611]*t1112;
+    const MBPOL_POLY_REAL t12510 = df[599];
+    const MBPOL_POLY_REAL t12512 = df[2362];
+    const MBPOL_POLY_REAL t12592 = t12512*t4301;
+    const MBPOL_POLY_REAL t12769 = t8585*(MBPOL_POLY_REAL(2)*t4242+t4416+t4514+t4515+t4516+t4517+t4424+t4425+t4241)+
 t12492*t3351+t12494*t3329+df[3362]*t1545+t12497*t3253+df[857]*t1582+df[1922]*
 t3435+t12503+df[653]*t1184+df[2101]*t3743+df[1323]*t2443+df[243]*t419+t12509+
 t12510*t1068+t12592;
-    const double t12786 = t8159*t4161;
-    const double t12515 = df[624]*t1135;
-    const double t12519 = df[1288];
-    const double t12523 = df[1273];
-    const double t12526 = df[3033]*t1429;
-    const double t12529 = df[1514]*t2657;
-    const double t12533 = df[2707];
-    const double t12788 = t12515+df[2076]*t3690+df[2062]*t3661+df[203]*t112+t12519*t2367+df
-[842]*t1548+df[215]*t222+t12523*t2369+t12526+t12529+t8545*(2.0*t4878+t524+t4967
+    const MBPOL_POLY_REAL t12786 = t8159*t4161;
+    const MBPOL_POLY_REAL t12515 = df[624]*t1135;
+    const MBPOL_POLY_REAL t12519 = df[1288];
+    const MBPOL_POLY_REAL t12523 = df[1273];
+    const MBPOL_POLY_REAL t12526 = df[3033]*t1429;
+    const MBPOL_POLY_REAL t12529 = df[1514]*t2657;
+    const MBPOL_POLY_REAL t12533 = df[2707];
+    const MBPOL_POLY_REAL t12788 = t12515+df[2076]*t3690+df[2062]*t3661+df[203]*t112+t12519*t2367+df
+[842]*t1548+df[215]*t222+t12523*t2369+t12526+t12529+t8545*(MBPOL_POLY_REAL(2)*t4878+t524+t4967
 +t736+t737+t4968+t528+t529+t545)+t12533*t613+t12786+df[1899]*t3397;
-    const double t12806 = t9878*t6586;
-    const double t12544 = df[3633];
-    const double t12552 = t12424*t6563;
-    const double t12554 = df[3570];
-    const double t12557 = df[742]*t1065;
-    const double t12558 = df[735];
-    const double t12560 = df[3609];
-    const double t12563 = df[3495]*t3248;
-    const double t12811 = t8681*(2.0*t3045+t3361+t3363+t3365+t3366+t3367+t3369+t3370+t3044)+
-df[2512]*t4559+df[1609]*t2914+t7776*(2.0*t6409+t6531+t6532+t6642+t6643+t6536+
-t6633+t6634+t6408)+t12544*t3272+df[3621]*t3220+t8220*(2.0*t5468+t1931+t2995+
+    const MBPOL_POLY_REAL t12806 = t9878*t6586;
+    const MBPOL_POLY_REAL t12544 = df[3633];
+    const MBPOL_POLY_REAL t12552 = t12424*t6563;
+    const MBPOL_POLY_REAL t12554 = df[3570];
+    const MBPOL_POLY_REAL t12557 = df[742]*t1065;
+    const MBPOL_POLY_REAL t12558 = df[735];
+    const MBPOL_POLY_REAL t12560 = df[3609];
+    const MBPOL_POLY_REAL t12563 = df[3495]*t3248;
+    const MBPOL_POLY_REAL t12811 = t8681*(MBPOL_POLY_REAL(2)*t3045+t3361+t3363+t3365+t3366+t3367+t3369+t3370+t3044)+
+df[2512]*t4559+df[1609]*t2914+t7776*(MBPOL_POLY_REAL(2)*t6409+t6531+t6532+t6642+t6643+t6536+
+t6633+t6634+t6408)+t12544*t3272+df[3621]*t3220+t8220*(MBPOL_POLY_REAL(2)*t5468+t1931+t2995+
 t1934+t1936+t2998+t1872+t1873+t5466)+t12552+df[3537]*t6487+t12554*t6559+t12806+
 t12557+t12558*t1108+t12560*t6561+t12563;
-    const double t12818 = t9805*t971;
-    const double t12567 = df[1255];
-    const double t12572 = df[589];
-    const double t12577 = df[835];
-    const double t12579 = df[828];
-    const double t12581 = df[1869];
-    const double t12585 = df[1430]*t2633;
-    const double t12829 = df[1987]*t3539+df[3525]*t6490+t12567*t1988+df[1241]*t2317+df[2198]
-*t3949+t12818+df[3038]*t2440+t12572*t1070+t8727*(2.0*t975+t1049+t1050+t1039+
+    const MBPOL_POLY_REAL t12818 = t9805*t971;
+    const MBPOL_POLY_REAL t12567 = df[1255];
+    const MBPOL_POLY_REAL t12572 = df[589];
+    const MBPOL_POLY_REAL t12577 = df[835];
+    const MBPOL_POLY_REAL t12579 = df[828];
+    const MBPOL_POLY_REAL t12581 = df[1869];
+    const MBPOL_POLY_REAL t12585 = df[1430]*t2633;
+    const MBPOL_POLY_REAL t12829 = df[1987]*t3539+df[3525]*t6490+t12567*t1988+df[1241]*t2317+df[2198]
+*t3949+t12818+df[3038]*t2440+t12572*t1070+t8727*(MBPOL_POLY_REAL(2)*t975+t1049+t1050+t1039+
 t1051+t1052+t1043+t1044+t974)+t12577*t1512+t12579*t1514+t12581*t3331+df[3047]*
 t1948+t12585;
-    const double t12841 = t8464*t1705;
-    const double t12586 = df[1879];
-    const double t12589 = t12325*t901;
-    const double t12591 = df[2498]*t4534;
-    const double t12603 = df[3375];
-    const double t12605 = df[3373];
-    const double t12608 = df[1585];
-    const double t12683 = df[3401];
-    const double t12850 = t12586*t3353+t12589+t12591+df[3652]*t3172+df[1491]*t2731+df[1569]*
-t2862+df[3514]*t6450+t7816*(2.0*t6036+t1746+t1803+t1747+t1749+t1806+t1688+t1689
-+t6034)+t12841+t8442*(2.0*t1534+t1681+t1682+t1684+t1685+t1686+t1688+t1689+t1532
+    const MBPOL_POLY_REAL t12841 = t8464*t1705;
+    const MBPOL_POLY_REAL t12586 = df[1879];
+    const MBPOL_POLY_REAL t12589 = t12325*t901;
+    const MBPOL_POLY_REAL t12591 = df[2498]*t4534;
+    const MBPOL_POLY_REAL t12603 = df[3375];
+    const MBPOL_POLY_REAL t12605 = df[3373];
+    const MBPOL_POLY_REAL t12608 = df[1585];
+    const MBPOL_POLY_REAL t12683 = df[3401];
+    const MBPOL_POLY_REAL t12850 = t12586*t3353+t12589+t12591+df[3652]*t3172+df[1491]*t2731+df[1569]*
+t2862+df[3514]*t6450+t7816*(MBPOL_POLY_REAL(2)*t6036+t1746+t1803+t1747+t1749+t1806+t1688+t1689
++t6034)+t12841+t8442*(MBPOL_POLY_REAL(2)*t1534+t1681+t1682+t1684+t1685+t1686+t1688+t1689+t1532
 )+t12603*t1624+t12605*t1622+df[3378]*t1650+t12608*t2689+t12683*t1579;
-    const double t12611 = df[3170];
-    const double t12615 = df[3257]*t2364;
-    const double t12619 = df[1960];
-    const double t12622 = df[142];
-    const double t12626 = df[161]*t265;
-    const double t12627 = df[149];
-    const double t12630 = df[1852]*t3301;
-    const double t12632 = df[1839]*t3276;
-    const double t12870 = t12611*t2274+df[3243]*t2314+t12615+t8708*(2.0*t5605+t2181+t2228+
+    const MBPOL_POLY_REAL t12611 = df[3170];
+    const MBPOL_POLY_REAL t12615 = df[3257]*t2364;
+    const MBPOL_POLY_REAL t12619 = df[1960];
+    const MBPOL_POLY_REAL t12622 = df[142];
+    const MBPOL_POLY_REAL t12626 = df[161]*t265;
+    const MBPOL_POLY_REAL t12627 = df[149];
+    const MBPOL_POLY_REAL t12630 = df[1852]*t3301;
+    const MBPOL_POLY_REAL t12632 = df[1839]*t3276;
+    const MBPOL_POLY_REAL t12870 = t12611*t2274+df[3243]*t2314+t12615+t8708*(MBPOL_POLY_REAL(2)*t5605+t2181+t2228+
 t2180+t2183+t2231+t2118+t2119+t5599)+t12619*t3496+df[1812]*t3223+t12622*t270+df
 [700]*t1278+t12626+t12627*t61+t12630+t12632+df[2390]*t4350+df[1465]*t2692;
-    const double t12885 = t8176*t3975;
-    const double t12636 = df[1112]*t2095;
-    const double t12643 = df[3771];
-    const double t12646 = df[3764]*t4250;
-    const double t12649 = df[982];
-    const double t12651 = df[3722];
-    const double t12653 = df[3646];
-    const double t12887 = t12636+(2.0*t7560+t40+t39+t5004+t5005+t44+t5545+t5554+t5558)*t73+
+    const MBPOL_POLY_REAL t12885 = t8176*t3975;
+    const MBPOL_POLY_REAL t12636 = df[1112]*t2095;
+    const MBPOL_POLY_REAL t12643 = df[3771];
+    const MBPOL_POLY_REAL t12646 = df[3764]*t4250;
+    const MBPOL_POLY_REAL t12649 = df[982];
+    const MBPOL_POLY_REAL t12651 = df[3722];
+    const MBPOL_POLY_REAL t12653 = df[3646];
+    const MBPOL_POLY_REAL t12887 = t12636+(MBPOL_POLY_REAL(2)*t7560+t40+t39+t5004+t5005+t44+t5545+t5554+t5558)*t73+
 df[769]*t1275+df[760]*t1181+t12643*t4532+t12646+df[3679]*t4029+df[3697]*t3946+
 t12649*t1432+t12651*t4058+t12653*t3274+df[3636]*t3740+t12885+df[1770]*t3130;
-    const double t12897 = t8177*t3978;
-    const double t12659 = df[356];
-    const double t12664 = df[3160];
-    const double t12676 = df[2171];
-    const double t12678 = df[1625];
-    const double t12753 = df[3820];
-    const double t12909 = df[3077]*t3127+df[1350]*t2485+t12659*t615+df[2223]*t4023+df[3088]*
-t2487+t12664*t2091+t12897+t8709*(2.0*t1802+t2110+t2112+t2114+t2115+t2116+t2118+
-t2119+t1801)+df[1789]*t3175+df[3068]*t2541+df[3800]*(2.0*t6841+t4332+t4275+
+    const MBPOL_POLY_REAL t12897 = t8177*t3978;
+    const MBPOL_POLY_REAL t12659 = df[356];
+    const MBPOL_POLY_REAL t12664 = df[3160];
+    const MBPOL_POLY_REAL t12676 = df[2171];
+    const MBPOL_POLY_REAL t12678 = df[1625];
+    const MBPOL_POLY_REAL t12753 = df[3820];
+    const MBPOL_POLY_REAL t12909 = df[3077]*t3127+df[1350]*t2485+t12659*t615+df[2223]*t4023+df[3088]*
+t2487+t12664*t2091+t12897+t8709*(MBPOL_POLY_REAL(2)*t1802+t2110+t2112+t2114+t2115+t2116+t2118+
+t2119+t1801)+df[1789]*t3175+df[3068]*t2541+df[3800]*(MBPOL_POLY_REAL(2)*t6841+t4332+t4275+
 t4272+t4277+t4335+t4424+t4425+t6840)+t12753*t4298+t12676*t3878+t12678*t2631;
-    const double t12680 = df[3832];
-    const double t12685 = df[3752];
-    const double t12688 = df[785];
-    const double t12702 = df[1001];
-    const double t12707 = df[1012]*t1909;
-    const double t12933 = t12680*t4530+t7739*(2.0*t6712+t3931+t3857+t3858+t3860+t3934+t3898+
-t3899+t6709)+t12685*t4060+df[667]*t1208+t12688*t1434+t8160*(2.0*t3708+t3891+
-t3893+t3894+t3895+t3896+t3898+t3899+t3707)+t7671*(2.0*t7039+t3379+t3380+t3619+
-t3382+t3622+t3369+t3370+t7037)+df[2406]*t4384+df[326]*t559+t8760*(2.0*t435+t534
+    const MBPOL_POLY_REAL t12680 = df[3832];
+    const MBPOL_POLY_REAL t12685 = df[3752];
+    const MBPOL_POLY_REAL t12688 = df[785];
+    const MBPOL_POLY_REAL t12702 = df[1001];
+    const MBPOL_POLY_REAL t12707 = df[1012]*t1909;
+    const MBPOL_POLY_REAL t12933 = t12680*t4530+t7739*(MBPOL_POLY_REAL(2)*t6712+t3931+t3857+t3858+t3860+t3934+t3898+
+t3899+t6709)+t12685*t4060+df[667]*t1208+t12688*t1434+t8160*(MBPOL_POLY_REAL(2)*t3708+t3891+
+t3893+t3894+t3895+t3896+t3898+t3899+t3707)+t7671*(MBPOL_POLY_REAL(2)*t7039+t3379+t3380+t3619+
+t3382+t3622+t3369+t3370+t7037)+df[2406]*t4384+df[326]*t559+t8760*(MBPOL_POLY_REAL(2)*t435+t534
 +t536+t538+t539+t540+t542+t543+t545)+t12702*t1450+df[335]*t575+df[96]*t197+
 t12707+t8615*t596;
-    const double t12711 = df[2438];
-    const double t12714 = df[3973]*t3348;
-    const double t12722 = df[4005];
-    const double t12725 = df[1630];
-    const double t12728 = df[3910];
-    const double t12950 = df[1657]*t2572+df[3942]*t3432+t12711*t4253+t12714+df[3960]*t3536+
+    const MBPOL_POLY_REAL t12711 = df[2438];
+    const MBPOL_POLY_REAL t12714 = df[3973]*t3348;
+    const MBPOL_POLY_REAL t12722 = df[4005];
+    const MBPOL_POLY_REAL t12725 = df[1630];
+    const MBPOL_POLY_REAL t12728 = df[3910];
+    const MBPOL_POLY_REAL t12950 = df[1657]*t2572+df[3942]*t3432+t12711*t4253+t12714+df[3960]*t3536+
 df[3847]*t4347+df[3987]*t3498+df[3978]*t3658+df[4011]*t3687+t12722*t3299+df
 [1638]*t2859+t12725*t2629+df[3858]*t4583+t12728*t4484;
-    const double t12953 = t8158*t4158;
-    const double t12731 = df[3918];
-    const double t12734 = df[3939]*t3326;
-    const double t12737 = df[3777];
-    const double t12746 = df[3358]*t1509;
-    const double t12748 = df[3155];
-    const double t12752 = df[460];
-    const double t12754 = df[448];
-    const double t12967 = df[3885]*t4556+t12731*t3297+t12953+t12734+df[3922]*t3394+t12737*
+    const MBPOL_POLY_REAL t12953 = t8158*t4158;
+    const MBPOL_POLY_REAL t12731 = df[3918];
+    const MBPOL_POLY_REAL t12734 = df[3939]*t3326;
+    const MBPOL_POLY_REAL t12737 = df[3777];
+    const MBPOL_POLY_REAL t12746 = df[3358]*t1509;
+    const MBPOL_POLY_REAL t12748 = df[3155];
+    const MBPOL_POLY_REAL t12752 = df[460];
+    const MBPOL_POLY_REAL t12754 = df[448];
+    const MBPOL_POLY_REAL t12967 = df[3885]*t4556+t12731*t3297+t12953+t12734+df[3922]*t3394+t12737*
 t4482+df[3783]*t4197+df[3804]*t4381+df[481]*t572+df[473]*t556+t12746+t12748*
 t2093+t8741*t691+t12752*t768+t12754*t766;
-    const double t12764 = df[2287];
-    const double t12766 = df[2344];
-    const double t12770 = df[793];
-    const double t12773 = df[2470]*t4486;
-    const double t12775 = df[1057];
-    const double t12778 = df[437];
-    const double t12987 = t8691*(2.0*t2234+t1864+t2526+t2527+t2528+t2529+t1872+t1873+t2233)+
+    const MBPOL_POLY_REAL t12764 = df[2287];
+    const MBPOL_POLY_REAL t12766 = df[2344];
+    const MBPOL_POLY_REAL t12770 = df[793];
+    const MBPOL_POLY_REAL t12773 = df[2470]*t4486;
+    const MBPOL_POLY_REAL t12775 = df[1057];
+    const MBPOL_POLY_REAL t12778 = df[437];
+    const MBPOL_POLY_REAL t12987 = t8691*(MBPOL_POLY_REAL(2)*t2234+t1864+t2526+t2527+t2528+t2529+t1872+t1873+t2233)+
 df[1397]*t2575+df[1382]*t2544+df[2322]*t4217+df[1095]*t2062+t12764*t3876+t12766
 *t4255+df[802]*t1469+t12770*t1452+t12773+df[114]*t225+t12775*t1990+df[1034]*
 t1951+t12778*t507;
-    const double t12782 = df[530];
-    const double t12790 = df[3125]*t1466;
-    const double t12794 = df[731];
-    const double t12796 = df[727];
-    const double t12802 = df[173];
-    const double t12805 = t12084*t591;
-    const double t12809 = df[502]*t610;
-    const double t12810 = df[723];
-    const double t13009 = df[1068]*t2008+t12782*t904+df[1219]*t2277+df[2146]*t3817+t12790+df
-[717]*(2.0*t1257+t1015+t1026+t1018+t1020+t1029+t1043+t1044+t1255)+t12794*t1131+
-t12796*t1110+t8770*(2.0*t190+t150+t248+t149+t152+t251+t290+t291+t189)+df[185]*
+    const MBPOL_POLY_REAL t12782 = df[530];
+    const MBPOL_POLY_REAL t12790 = df[3125]*t1466;
+    const MBPOL_POLY_REAL t12794 = df[731];
+    const MBPOL_POLY_REAL t12796 = df[727];
+    const MBPOL_POLY_REAL t12802 = df[173];
+    const MBPOL_POLY_REAL t12805 = t12084*t591;
+    const MBPOL_POLY_REAL t12809 = df[502]*t610;
+    const MBPOL_POLY_REAL t12810 = df[723];
+    const MBPOL_POLY_REAL t13009 = df[1068]*t2008+t12782*t904+df[1219]*t2277+df[2146]*t3817+t12790+df
+[717]*(MBPOL_POLY_REAL(2)*t1257+t1015+t1026+t1018+t1020+t1029+t1043+t1044+t1255)+t12794*t1131+
+t12796*t1110+t8770*(MBPOL_POLY_REAL(2)*t190+t150+t248+t149+t152+t251+t290+t291+t189)+df[185]*
 t336+t12802*t268+t12805+df[1137]*t2142+t12809+t12810*t1133;
-    const double t12820 = t7776*t6537;
-    const double t13040 = t8694*t2617*t73+t7671*t3623*t73+t126*t596*t77+t12820*t73+t8220*
-t2999*t73+t7493*(2.0*t6597+t3156+t3777+t3153+t3158+t3780+t3726+t3727+t3160*t73)
-+t179*(2.0*t914+t876+t864+t866+t877+t870+t885+t886+t879*t73)+t4135*(t3728*t73+
-2.0*t3998+t3770+t3771+t3720+t3772+t3773+t3726+t3727)+t4991+t7576+t7579+t7582+
+    const MBPOL_POLY_REAL t12820 = t7776*t6537;
+    const MBPOL_POLY_REAL t13040 = t8694*t2617*t73+t7671*t3623*t73+t126*t596*t77+t12820*t73+t8220*
+t2999*t73+t7493*(MBPOL_POLY_REAL(2)*t6597+t3156+t3777+t3153+t3158+t3780+t3726+t3727+t3160*t73)
++t179*(MBPOL_POLY_REAL(2)*t914+t876+t864+t866+t877+t870+t885+t886+t879*t73)+t4135*(t3728*t73+
+MBPOL_POLY_REAL(2)*t3998+t3770+t3771+t3720+t3772+t3773+t3726+t3727)+t4991+t7576+t7579+t7582+
 t7587+t8442*t1690*t73+t7816*t1807*t73;
-    const double t13047 = t8681*t3371*t73+t7592+t7595+t12715+t8709*t2120*t73+t1+t12742+
+    const MBPOL_POLY_REAL t13047 = t8681*t3371*t73+t7592+t7595+t12715+t8709*t2120*t73+t1+t12742+
 t12747+t12786+t12806+t12818+t12841+t12885+t12897+t12953+t12603*t1622;
-    const double t12906 = df[769];
-    const double t12908 = df[760];
-    const double t12911 = df[3960];
-    const double t12913 = df[473];
-    const double t12916 = df[1217];
-    const double t12918 = df[1899];
-    const double t12921 = df[3987];
-    const double t12925 = df[1168];
-    const double t13071 = t12605*t1624+t12906*t1275+t12908*t1181+t12911*t3536+t12913*t556+
+    const MBPOL_POLY_REAL t12906 = df[769];
+    const MBPOL_POLY_REAL t12908 = df[760];
+    const MBPOL_POLY_REAL t12911 = df[3960];
+    const MBPOL_POLY_REAL t12913 = df[473];
+    const MBPOL_POLY_REAL t12916 = df[1217];
+    const MBPOL_POLY_REAL t12918 = df[1899];
+    const MBPOL_POLY_REAL t12921 = df[3987];
+    const MBPOL_POLY_REAL t12925 = df[1168];
+    const MBPOL_POLY_REAL t13071 = t12605*t1624+t12906*t1275+t12908*t1181+t12911*t3536+t12913*t556+
 t12766*t4253+t12714+t12916*t2277+t12918*t3397+t12722*t3297+t12921*t3498+t12746+
 t12754*t768+t12752*t766+t12925*t2198;
-    const double t12876 = df[1602];
-    const double t12928 = df[481];
-    const double t12930 = df[1465];
-    const double t12932 = df[1137];
-    const double t12935 = df[1488];
-    const double t12943 = df[2526];
-    const double t12945 = df[3978];
-    const double t13098 = t12928*t572+t12930*t2692+t12932*t2142+t12630+t12935*t2731+t12586*
+    const MBPOL_POLY_REAL t12876 = df[1602];
+    const MBPOL_POLY_REAL t12928 = df[481];
+    const MBPOL_POLY_REAL t12930 = df[1465];
+    const MBPOL_POLY_REAL t12932 = df[1137];
+    const MBPOL_POLY_REAL t12935 = df[1488];
+    const MBPOL_POLY_REAL t12943 = df[2526];
+    const MBPOL_POLY_REAL t12945 = df[3978];
+    const MBPOL_POLY_REAL t13098 = t12928*t572+t12930*t2692+t12932*t2142+t12630+t12935*t2731+t12586*
 t3351+t12581*t3329+df[435]*t507+t12622*t268+t12778*t512+t12943*t4586+t12945*
 t3658+t12796*t1108+t12810*t1131+t12563+t12876*t2689;
-    const double t12879 = df[3500];
-    const double t12898 = t12540;
-    const double t12951 = df[653];
-    const double t12963 = df[1569];
-    const double t12972 = df[335];
-    const double t12974 = df[326];
-    const double t13127 = t12951*t1184+t12879*t6450+t12494*t3331+t12627*t63+t12626+t8770*(
-2.0*t156+t148+t249+t149+t250+t153+t290+t291)+t8442*(2.0*t1716+t1812+t1682+t1813
+    const MBPOL_POLY_REAL t12879 = df[3500];
+    const MBPOL_POLY_REAL t12898 = t12540;
+    const MBPOL_POLY_REAL t12951 = df[653];
+    const MBPOL_POLY_REAL t12963 = df[1569];
+    const MBPOL_POLY_REAL t12972 = df[335];
+    const MBPOL_POLY_REAL t12974 = df[326];
+    const MBPOL_POLY_REAL t13127 = t12951*t1184+t12879*t6450+t12494*t3331+t12627*t63+t12626+t8770*(
+MBPOL_POLY_REAL(2)*t156+t148+t249+t149+t250+t153+t290+t291)+t8442*(MBPOL_POLY_REAL(2)*t1716+t1812+t1682+t1813
 +t1814+t1815+t1688+t1689)+t12963*t2862+df[3024]*t34+t12509+t12510*t1070+df[320]
 *t544+t12898*t2010+t12972*t575+t12974*t559;
-    const double t12904 = t12753;
-    const double t12976 = df[2512];
-    const double t12980 = df[857];
-    const double t12985 = df[3189];
-    const double t12988 = df[3198];
-    const double t12993 = df[1034];
-    const double t13156 = t12976*t4559+t12591+t12680*t4532+t12904*t4298+t12461+t12980*t1582+
-t12558*t1110+t12794*t1133+df[3177]*t2274+t12985*t2059+t12988*t2195+t7776*(2.0*
+    const MBPOL_POLY_REAL t12904 = t12753;
+    const MBPOL_POLY_REAL t12976 = df[2512];
+    const MBPOL_POLY_REAL t12980 = df[857];
+    const MBPOL_POLY_REAL t12985 = df[3189];
+    const MBPOL_POLY_REAL t12988 = df[3198];
+    const MBPOL_POLY_REAL t12993 = df[1034];
+    const MBPOL_POLY_REAL t13156 = t12976*t4559+t12591+t12680*t4532+t12904*t4298+t12461+t12980*t1582+
+t12558*t1110+t12794*t1133+df[3177]*t2274+t12985*t2059+t12988*t2195+t7776*(MBPOL_POLY_REAL(2)*
 t6365+t6630+t6533+t6532+t6535+t6631+t6633+t6634)+t12993*t1951+t12707+df[716]*(
-2.0*t1253+t1015+t1017+t1027+t1028+t1021+t1043+t1044)+t12523*t2367;
-    const double t12927 = df[3781];
-    const double t12999 = df[1382];
-    const double t13003 = df[3679];
-    const double t13010 = df[2390];
-    const double t13012 = df[1323];
-    const double t13185 = t12515+t12999*t2544+t12519*t2369+t12492*t3353+t13003*t4029+t12725*
+MBPOL_POLY_REAL(2)*t1253+t1015+t1017+t1027+t1028+t1021+t1043+t1044)+t12523*t2367;
+    const MBPOL_POLY_REAL t12927 = df[3781];
+    const MBPOL_POLY_REAL t12999 = df[1382];
+    const MBPOL_POLY_REAL t13003 = df[3679];
+    const MBPOL_POLY_REAL t13010 = df[2390];
+    const MBPOL_POLY_REAL t13012 = df[1323];
+    const MBPOL_POLY_REAL t13185 = t12515+t12999*t2544+t12519*t2369+t12492*t3353+t13003*t4029+t12725*
 t2631+t12927*t4197+t12737*t4484+t13010*t4350+t13012*t2443+t12649*t1434+t8160*(
-t3900*t73+2.0*t3753+t3924+t3894+t3925+t3926+t3927+t3898+t3899)+t8691*(2.0*t1777
+t3900*t73+MBPOL_POLY_REAL(2)*t3753+t3924+t3894+t3925+t3926+t3927+t3898+t3899)+t8691*(MBPOL_POLY_REAL(2)*t1777
 +t1864+t1866+t1868+t1869+t1870+t1872+t1873)+df[666]*t1208+t12702*t1452;
-    const double t13026 = df[2062];
-    const double t13029 = df[48];
-    const double t13046 = df[203];
-    const double t13214 = t12678*t2629+df[1608]*t2914+t13026*t3661+df[71]*t164+t13029*t115+
-t8681*(2.0*t3078+t3466+t3361+t3467+t3468+t3469+t3369+t3370)+t12486*t904+t8220*(
-2.0*t5462+t1931+t1933+t2996+t2997+t1937+t1872+t1873)+t12782*t906+df[1538]*t2790
-+t12481+t12475*t61+t7549*t73+(2.0*t7593+t40+t41+t5003+t43+t5006+t5545+t5554)*
+    const MBPOL_POLY_REAL t13026 = df[2062];
+    const MBPOL_POLY_REAL t13029 = df[48];
+    const MBPOL_POLY_REAL t13046 = df[203];
+    const MBPOL_POLY_REAL t13214 = t12678*t2629+df[1608]*t2914+t13026*t3661+df[71]*t164+t13029*t115+
+t8681*(MBPOL_POLY_REAL(2)*t3078+t3466+t3361+t3467+t3468+t3469+t3369+t3370)+t12486*t904+t8220*(
+MBPOL_POLY_REAL(2)*t5462+t1931+t1933+t2996+t2997+t1937+t1872+t1873)+t12782*t906+df[1538]*t2790
++t12481+t12475*t61+t7549*t73+(MBPOL_POLY_REAL(2)*t7593+t40+t41+t5003+t43+t5006+t5545+t5554)*
 t72+t13046*t112+t12552;
-    const double t13049 = df[2198];
-    const double t13054 = df[3047];
-    const double t13056 = df[3038];
-    const double t13061 = df[3537];
-    const double t13063 = df[3525];
-    const double t13067 = df[2101];
-    const double t13241 = t13049*t3949+t12554*t6561+df[184]*t336+t12526+t12485+t13054*t1948+
+    const MBPOL_POLY_REAL t13049 = df[2198];
+    const MBPOL_POLY_REAL t13054 = df[3047];
+    const MBPOL_POLY_REAL t13056 = df[3038];
+    const MBPOL_POLY_REAL t13061 = df[3537];
+    const MBPOL_POLY_REAL t13063 = df[3525];
+    const MBPOL_POLY_REAL t13067 = df[2101];
+    const MBPOL_POLY_REAL t13241 = t13049*t3949+t12554*t6561+df[184]*t336+t12526+t12485+t13054*t1948+
 t13056*t2440+t12470*t1905+t12472*t1907+t12802*t270+t12790+t13061*t6487+t13063*
 t6490+t12688*t1432+t13067*t3743;
-    const double t13069 = df[801];
-    const double t13073 = df[3697];
-    const double t13075 = df[2076];
-    const double t13078 = df[842];
-    const double t13085 = df[3068];
-    const double t13088 = df[1638];
-    const double t13090 = df[3077];
-    const double t13093 = df[1657];
-    const double t13267 = t13069*t1469+t12770*t1450+t12452+t13073*t3946+t13075*t3690+t12579*
-t1512+t12503+t13078*t1548+t12577*t1514+t8611*(2.0*t4162+t4416+t4418+t4420+t4421
+    const MBPOL_POLY_REAL t13069 = df[801];
+    const MBPOL_POLY_REAL t13073 = df[3697];
+    const MBPOL_POLY_REAL t13075 = df[2076];
+    const MBPOL_POLY_REAL t13078 = df[842];
+    const MBPOL_POLY_REAL t13085 = df[3068];
+    const MBPOL_POLY_REAL t13088 = df[1638];
+    const MBPOL_POLY_REAL t13090 = df[3077];
+    const MBPOL_POLY_REAL t13093 = df[1657];
+    const MBPOL_POLY_REAL t13267 = t13069*t1469+t12770*t1450+t12452+t13073*t3946+t13075*t3690+t12579*
+t1512+t12503+t13078*t1548+t12577*t1514+t8611*(MBPOL_POLY_REAL(2)*t4162+t4416+t4418+t4420+t4421
 +t4422+t4424+t4425)+t13085*t2541+t12711*t4255+t13088*t2859+t13090*t3127+df
 [2229]*t4023+t13093*t2572;
-    const double t13007 = t12683;
-    const double t13095 = df[243];
-    const double t13097 = df[260];
-    const double t13100 = df[3804];
-    const double t13107 = df[3088];
-    const double t13109 = df[3378];
-    const double t13111 = df[4011];
-    const double t13297 = t13095*t419+t13097*t416+t13100*t4381+df[3799]*(2.0*t6838+t4274+
+    const MBPOL_POLY_REAL t13007 = t12683;
+    const MBPOL_POLY_REAL t13095 = df[243];
+    const MBPOL_POLY_REAL t13097 = df[260];
+    const MBPOL_POLY_REAL t13100 = df[3804];
+    const MBPOL_POLY_REAL t13107 = df[3088];
+    const MBPOL_POLY_REAL t13109 = df[3378];
+    const MBPOL_POLY_REAL t13111 = df[4011];
+    const MBPOL_POLY_REAL t13297 = t13095*t419+t13097*t416+t13100*t4381+df[3799]*(MBPOL_POLY_REAL(2)*t6838+t4274+
 t4272+t4333+t4334+t4278+t4424+t4425)+t12664*t2093+t12748*t2091+t13107*t2487+
-t13109*t1650+t13111*t3687+t13007*t1579+t7816*(2.0*t5902+t1804+t1745+t1746+t1805
-+t1750+t1688+t1689)+t12809+t12805+t7958*(2.0*t6999+t3620+t3378+t3379+t3621+
-t3383+t3369+t3370)+t8331*(2.0*t2356+t2602+t2604+t2614+t2615+t2608+t2761+t2762);
-    const double t13123 = df[3362];
-    const double t13125 = df[1397];
-    const double t13128 = df[215];
-    const double t13131 = df[1987];
-    const double t13155 = df[2406];
-    const double t13326 = t13123*t1545+t12529+t13125*t2575+t13128*t222+t12585+t13131*t3539+
-t12533*t615+t8534*t4990+t12572*t1068+t12592+t8727*(2.0*t972+t1036+t1038+t1039+
-t1040+t1041+t1043+t1044)+t12685*t4058+t7739*(2.0*t6787+t3932+t3857+t3856+t3933+
+t13109*t1650+t13111*t3687+t13007*t1579+t7816*(MBPOL_POLY_REAL(2)*t5902+t1804+t1745+t1746+t1805
++t1750+t1688+t1689)+t12809+t12805+t7958*(MBPOL_POLY_REAL(2)*t6999+t3620+t3378+t3379+t3621+
+t3383+t3369+t3370)+t8331*(MBPOL_POLY_REAL(2)*t2356+t2602+t2604+t2614+t2615+t2608+t2761+t2762);
+    const MBPOL_POLY_REAL t13123 = df[3362];
+    const MBPOL_POLY_REAL t13125 = df[1397];
+    const MBPOL_POLY_REAL t13128 = df[215];
+    const MBPOL_POLY_REAL t13131 = df[1987];
+    const MBPOL_POLY_REAL t13155 = df[2406];
+    const MBPOL_POLY_REAL t13326 = t13123*t1545+t12529+t13125*t2575+t13128*t222+t12585+t13131*t3539+
+t12533*t615+t8534*t4990+t12572*t1068+t12592+t8727*(MBPOL_POLY_REAL(2)*t972+t1036+t1038+t1039+
+t1040+t1041+t1043+t1044)+t12685*t4058+t7739*(MBPOL_POLY_REAL(2)*t6787+t3932+t3857+t3856+t3933+
 t3861+t3898+t3899)+t12676*t3876+t12646+t13155*t4384;
-    const double t13051 = df[1349];
-    const double t13166 = df[2312];
-    const double t13169 = df[3922];
-    const double t13172 = df[3268];
-    const double t13182 = df[1789];
-    const double t13187 = df[114];
-    const double t13354 = t12643*t4530+t8709*(2.0*t1809+t2126+t2110+t2127+t2128+t2129+t2118+
+    const MBPOL_POLY_REAL t13051 = df[1349];
+    const MBPOL_POLY_REAL t13166 = df[2312];
+    const MBPOL_POLY_REAL t13169 = df[3922];
+    const MBPOL_POLY_REAL t13172 = df[3268];
+    const MBPOL_POLY_REAL t13182 = df[1789];
+    const MBPOL_POLY_REAL t13187 = df[114];
+    const MBPOL_POLY_REAL t13354 = t12643*t4530+t8709*(MBPOL_POLY_REAL(2)*t1809+t2126+t2110+t2127+t2128+t2129+t2118+
 t2119)+t12728*t4482+t13166*t4217+t13169*t3394+t12731*t3299+t13172*t2139+t12615+
 t12497*t3251+t12636+t12659*t613+t8615*t594+t13182*t3175+t13051*t2485+t13187*
 t225;
-    const double t13066 = df[1959];
-    const double t13190 = df[1095];
-    const double t13194 = df[1812];
-    const double t13198 = df[3885];
-    const double t13201 = df[3619];
-    const double t13206 = df[1922];
-    const double t13209 = df[3652];
-    const double t13213 = df[1241];
-    const double t13223 = df[700];
-    const double t13381 = t13190*t2062+t13194*t3223+t13198*t4556+t12560*t6559+t13201*t3220+
-t8545*(2.0*t4874+t741+t534+t4962+t742+t4963+t542+t543)+t12589+t13206*t3435+
-t13209*t3172+t13213*t2317+t12567*t1990+t13066*t3496+t8760*(2.0*t409+t521+t523+
+    const MBPOL_POLY_REAL t13066 = df[1959];
+    const MBPOL_POLY_REAL t13190 = df[1095];
+    const MBPOL_POLY_REAL t13194 = df[1812];
+    const MBPOL_POLY_REAL t13198 = df[3885];
+    const MBPOL_POLY_REAL t13201 = df[3619];
+    const MBPOL_POLY_REAL t13206 = df[1922];
+    const MBPOL_POLY_REAL t13209 = df[3652];
+    const MBPOL_POLY_REAL t13213 = df[1241];
+    const MBPOL_POLY_REAL t13223 = df[700];
+    const MBPOL_POLY_REAL t13381 = t13190*t2062+t13194*t3223+t13198*t4556+t12560*t6559+t13201*t3220+
+t8545*(MBPOL_POLY_REAL(2)*t4874+t741+t534+t4962+t742+t4963+t542+t543)+t12589+t13206*t3435+
+t13209*t3172+t13213*t2317+t12567*t1990+t13066*t3496+t8760*(MBPOL_POLY_REAL(2)*t409+t521+t523+
 t524+t525+t526+t528+t529)+t13223*t1278+t12773+t12466*t2662;
-    const double t13081 = df[1066];
-    const double t13236 = df[3942];
-    const double t13243 = df[3636];
-    const double t13246 = df[2146];
-    const double t13252 = df[895];
-    const double t13256 = df[3858];
-    const double t13258 = df[3847];
-    const double t13261 = df[3243];
-    const double t13407 = t8741*t689+t12482*t3253+t12632+t12734+t12557+t12544*t3274+t13236*
+    const MBPOL_POLY_REAL t13081 = df[1066];
+    const MBPOL_POLY_REAL t13236 = df[3942];
+    const MBPOL_POLY_REAL t13243 = df[3636];
+    const MBPOL_POLY_REAL t13246 = df[2146];
+    const MBPOL_POLY_REAL t13252 = df[895];
+    const MBPOL_POLY_REAL t13256 = df[3858];
+    const MBPOL_POLY_REAL t13258 = df[3847];
+    const MBPOL_POLY_REAL t13261 = df[3243];
+    const MBPOL_POLY_REAL t13407 = t8741*t689+t12482*t3253+t12632+t12734+t12557+t12544*t3274+t13236*
 t3432+t12653*t3272+t13243*t3740+t13246*t3817+t13081*t2008+t13252*t1653+t12478+
 t13256*t4583+t13258*t4347+t13261*t2314;
-    const double t13265 = df[1770];
-    const double t13281 = df[3711];
-    const double t13289 = t8770*t252;
-    const double t13438 = t13265*t3130+t8708*(2.0*t5595+t2229+t2179+t2180+t2230+t2184+t2118+
+    const MBPOL_POLY_REAL t13265 = df[1770];
+    const MBPOL_POLY_REAL t13281 = df[3711];
+    const MBPOL_POLY_REAL t13289 = t8770*t252;
+    const MBPOL_POLY_REAL t13438 = t13265*t3130+t8708*(MBPOL_POLY_REAL(2)*t5595+t2229+t2179+t2180+t2230+t2184+t2118+
 t2119)+df[95]*t197+t12775*t1988+t12651*t4060+t13281*t3814+t12764*t3878+t12468*
 t2660+t8708*t2232*t73+t13289*t73+t8727*t1053*t73+df[717]*t1030*t73+t8585*t4518*
 t73+df[3800]*t4336*t73+t7739*t3935*t73+t8691*t2530*t73;
-    const double t13453 = t215*t1244*t212;
-    const double t13338 = t12927*t4217;
-    const double t13459 = t6+t179*(2.0*t910+t875+t864+t876+t877+t878+t909)+t7493*(2.0*t7433+
-t3719+t3720+t3771+t3772+t3724+t7423)+t4135*(2.0*t3976+t3153+t3155+t3156+t3158+
-t3159+t3968)+t4900+t4906+t13453+t1+t12806+t12818+t4890+t4892+t4896+t8442*(2.0*
+    const MBPOL_POLY_REAL t13453 = t215*t1244*t212;
+    const MBPOL_POLY_REAL t13338 = t12927*t4217;
+    const MBPOL_POLY_REAL t13459 = t6+t179*(MBPOL_POLY_REAL(2)*t910+t875+t864+t876+t877+t878+t909)+t7493*(MBPOL_POLY_REAL(2)*t7433+
+t3719+t3720+t3771+t3772+t3724+t7423)+t4135*(MBPOL_POLY_REAL(2)*t3976+t3153+t3155+t3156+t3158+
+t3159+t3968)+t4900+t4906+t13453+t1+t12806+t12818+t4890+t4892+t4896+t8442*(MBPOL_POLY_REAL(2)*
 t1712+t1746+t1803+t1804+t1805+t1806+t1711)+t13338;
-    const double t13130 = df[3775]*t4486;
-    const double t13132 = t13012*t2440;
-    const double t13135 = t12932*t2139;
-    const double t13137 = df[1125]*t2117;
-    const double t13139 = df[3769]*t4534;
-    const double t13140 = df[636];
-    const double t13144 = df[644];
-    const double t13146 = df[3031];
-    const double t13148 = df[3025];
-    const double t13151 = t13054*t1951;
-    const double t13153 = t13056*t2443;
-    const double t13154 = df[2245];
-    const double t13158 = df[2228]*t4029;
-    const double t13348 = t13051*t2487;
-    const double t13476 = t13130+t13132+t13348+t13135+t13137+t13139+t13140*t1108+df[3023]*
+    const MBPOL_POLY_REAL t13130 = df[3775]*t4486;
+    const MBPOL_POLY_REAL t13132 = t13012*t2440;
+    const MBPOL_POLY_REAL t13135 = t12932*t2139;
+    const MBPOL_POLY_REAL t13137 = df[1125]*t2117;
+    const MBPOL_POLY_REAL t13139 = df[3769]*t4534;
+    const MBPOL_POLY_REAL t13140 = df[636];
+    const MBPOL_POLY_REAL t13144 = df[644];
+    const MBPOL_POLY_REAL t13146 = df[3031];
+    const MBPOL_POLY_REAL t13148 = df[3025];
+    const MBPOL_POLY_REAL t13151 = t13054*t1951;
+    const MBPOL_POLY_REAL t13153 = t13056*t2443;
+    const MBPOL_POLY_REAL t13154 = df[2245];
+    const MBPOL_POLY_REAL t13158 = df[2228]*t4029;
+    const MBPOL_POLY_REAL t13348 = t13051*t2487;
+    const MBPOL_POLY_REAL t13476 = t13130+t13132+t13348+t13135+t13137+t13139+t13140*t1108+df[3023]*
 t5544+t13144*t1131+t13146*t1432+t13148*t1450+t13151+t13153+t13154*t4060+t13158;
-    const double t13159 = df[3734];
-    const double t13162 = df[990]*t1871;
-    const double t13167 = df[3209];
-    const double t13173 = df[521]*t901;
-    const double t13174 = df[924];
-    const double t13177 = df[515]*t884;
-    const double t13178 = df[500];
-    const double t13180 = df[2482];
-    const double t13184 = t12974*t556;
-    const double t13498 = t13159*t3876+t13162+df[312]*t527+t8760*t402+t12898*t2008+t13167*
-t1990+t8395*(2.0*t1861+t2228+t2180+t2229+t2230+t2231+t1858)+t13173+t13174*t1622
+    const MBPOL_POLY_REAL t13159 = df[3734];
+    const MBPOL_POLY_REAL t13162 = df[990]*t1871;
+    const MBPOL_POLY_REAL t13167 = df[3209];
+    const MBPOL_POLY_REAL t13173 = df[521]*t901;
+    const MBPOL_POLY_REAL t13174 = df[924];
+    const MBPOL_POLY_REAL t13177 = df[515]*t884;
+    const MBPOL_POLY_REAL t13178 = df[500];
+    const MBPOL_POLY_REAL t13180 = df[2482];
+    const MBPOL_POLY_REAL t13184 = t12974*t556;
+    const MBPOL_POLY_REAL t13498 = t13159*t3876+t13162+df[312]*t527+t8760*t402+t12898*t2008+t13167*
+t1990+t8395*(MBPOL_POLY_REAL(2)*t1861+t2228+t2180+t2229+t2230+t2231+t1858)+t13173+t13174*t1622
 +t13177+t13178*t615+t13180*t4482+t8564*t596+t13184+df[319]*t541;
-    const double t13502 = t8464*t1702;
-    const double t13189 = df[3631]*t3276;
-    const double t13191 = t13201*t3223;
-    const double t13193 = t13265*t3127;
-    const double t13195 = t13190*t2059;
-    const double t13197 = t13111*t3690;
-    const double t13207 = df[3410];
-    const double t13211 = t13088*t2862;
-    const double t13212 = df[4021];
-    const double t13220 = t13010*t4347;
-    const double t13523 = t13189+t13191+t13193+t13502+t13195+t13197+t8160*(2.0*t3758+t3931+
-t3857+t3932+t3933+t3934+t3757)+df[4028]*(2.0*t7051+t3361+t3363+t3467+t3468+
-t3367+t7050)+t7816*(2.0*t5922+t1681+t1682+t1813+t1814+t1686+t5913)+t13207*t1514
-+t13007*t1582+t13211+t13212*t3331+t8612*(2.0*t4131+t4332+t4272+t4333+t4334+
+    const MBPOL_POLY_REAL t13502 = t8464*t1702;
+    const MBPOL_POLY_REAL t13189 = df[3631]*t3276;
+    const MBPOL_POLY_REAL t13191 = t13201*t3223;
+    const MBPOL_POLY_REAL t13193 = t13265*t3127;
+    const MBPOL_POLY_REAL t13195 = t13190*t2059;
+    const MBPOL_POLY_REAL t13197 = t13111*t3690;
+    const MBPOL_POLY_REAL t13207 = df[3410];
+    const MBPOL_POLY_REAL t13211 = t13088*t2862;
+    const MBPOL_POLY_REAL t13212 = df[4021];
+    const MBPOL_POLY_REAL t13220 = t13010*t4347;
+    const MBPOL_POLY_REAL t13523 = t13189+t13191+t13193+t13502+t13195+t13197+t8160*(MBPOL_POLY_REAL(2)*t3758+t3931+
+t3857+t3932+t3933+t3934+t3757)+df[4028]*(MBPOL_POLY_REAL(2)*t7051+t3361+t3363+t3467+t3468+
+t3367+t7050)+t7816*(MBPOL_POLY_REAL(2)*t5922+t1681+t1682+t1813+t1814+t1686+t5913)+t13207*t1514
++t13007*t1582+t13211+t13212*t3331+t8612*(MBPOL_POLY_REAL(2)*t4131+t4332+t4272+t4333+t4334+
 t4335+t4130)+df[1607]*t2914+t13220;
-    const double t13221 = df[1633];
-    const double t13224 = df[1623]*t2633;
-    const double t13225 = df[301];
-    const double t13227 = df[2546];
-    const double t13230 = t12925*t2195;
-    const double t13232 = t13194*t3220;
-    const double t13234 = t13182*t3172;
-    const double t13235 = df[3307];
-    const double t13238 = t12928*t575;
-    const double t13240 = df[912]*t1687;
-    const double t13242 = df[3310];
-    const double t13245 = df[2428]*t4423;
-    const double t13247 = t13155*t4381;
-    const double t13248 = df[3575];
-    const double t13251 = df[3568]*t6563;
-    const double t13541 = t13221*t2660+t13224+t13225*t507+t13227*t4530+t13230+t13232+t13234+
+    const MBPOL_POLY_REAL t13221 = df[1633];
+    const MBPOL_POLY_REAL t13224 = df[1623]*t2633;
+    const MBPOL_POLY_REAL t13225 = df[301];
+    const MBPOL_POLY_REAL t13227 = df[2546];
+    const MBPOL_POLY_REAL t13230 = t12925*t2195;
+    const MBPOL_POLY_REAL t13232 = t13194*t3220;
+    const MBPOL_POLY_REAL t13234 = t13182*t3172;
+    const MBPOL_POLY_REAL t13235 = df[3307];
+    const MBPOL_POLY_REAL t13238 = t12928*t575;
+    const MBPOL_POLY_REAL t13240 = df[912]*t1687;
+    const MBPOL_POLY_REAL t13242 = df[3310];
+    const MBPOL_POLY_REAL t13245 = df[2428]*t4423;
+    const MBPOL_POLY_REAL t13247 = t13155*t4381;
+    const MBPOL_POLY_REAL t13248 = df[3575];
+    const MBPOL_POLY_REAL t13251 = df[3568]*t6563;
+    const MBPOL_POLY_REAL t13541 = t13221*t2660+t13224+t13225*t507+t13227*t4530+t13230+t13232+t13234+
 t13235*t1452+t13238+t13240+t13242*t1434+t13245+t13247+t13248*t6559+t13251;
-    const double t13253 = df[3580]*t6632;
-    const double t13255 = t12918*t3394;
-    const double t13259 = df[882];
-    const double t13262 = t13206*t3432;
-    const double t13263 = df[2468];
-    const double t13266 = t13252*t1650;
-    const double t13269 = t13187*t222;
-    const double t13271 = df[2496];
-    const double t13274 = t12913*t559;
-    const double t13275 = df[446];
-    const double t13278 = t13093*t2575;
-    const double t13280 = t13061*t6490;
-    const double t13561 = t13253+t13255+t7776*(2.0*t6343+t6531+t6532+t6533+t6535+t6536+t6342
+    const MBPOL_POLY_REAL t13253 = df[3580]*t6632;
+    const MBPOL_POLY_REAL t13255 = t12918*t3394;
+    const MBPOL_POLY_REAL t13259 = df[882];
+    const MBPOL_POLY_REAL t13262 = t13206*t3432;
+    const MBPOL_POLY_REAL t13263 = df[2468];
+    const MBPOL_POLY_REAL t13266 = t13252*t1650;
+    const MBPOL_POLY_REAL t13269 = t13187*t222;
+    const MBPOL_POLY_REAL t13271 = df[2496];
+    const MBPOL_POLY_REAL t13274 = t12913*t559;
+    const MBPOL_POLY_REAL t13275 = df[446];
+    const MBPOL_POLY_REAL t13278 = t13093*t2575;
+    const MBPOL_POLY_REAL t13280 = t13061*t6490;
+    const MBPOL_POLY_REAL t13561 = t13253+t13255+t7776*(MBPOL_POLY_REAL(2)*t6343+t6531+t6532+t6533+t6535+t6536+t6342
 )+t13259*t1624+t13262+t13263*t4484+t13266+t13269+df[94]*t197+t13271*t4532+
-t13274+t13275*t768+t13278+t13280+t8691*(2.0*t2610+t1931+t2995+t2996+t2997+t2998
+t13274+t13275*t768+t13278+t13280+t8691*(MBPOL_POLY_REAL(2)*t2610+t1931+t2995+t2996+t2997+t2998
 +t2601);
-    const double t13577 = t8176*t3978;
-    const double t13285 = t12980*t1579;
-    const double t13287 = t13078*t1545;
-    const double t13290 = df[1055]*t1985;
-    const double t13293 = t13029*t112;
-    const double t13294 = df[3264];
-    const double t13296 = df[3260];
-    const double t13299 = df[3555];
-    const double t13302 = t13172*t2142;
-    const double t13303 = df[3255];
-    const double t13306 = t13261*t2317;
-    const double t13307 = df[4038];
-    const double t13310 = t13213*t2314;
-    const double t13466 = t13081*t2010;
-    const double t13578 = t13285+t13287+t13466+t13290+df[70]*t164+t13293+t13294*t2369+t13296
+    const MBPOL_POLY_REAL t13577 = t8176*t3978;
+    const MBPOL_POLY_REAL t13285 = t12980*t1579;
+    const MBPOL_POLY_REAL t13287 = t13078*t1545;
+    const MBPOL_POLY_REAL t13290 = df[1055]*t1985;
+    const MBPOL_POLY_REAL t13293 = t13029*t112;
+    const MBPOL_POLY_REAL t13294 = df[3264];
+    const MBPOL_POLY_REAL t13296 = df[3260];
+    const MBPOL_POLY_REAL t13299 = df[3555];
+    const MBPOL_POLY_REAL t13302 = t13172*t2142;
+    const MBPOL_POLY_REAL t13303 = df[3255];
+    const MBPOL_POLY_REAL t13306 = t13261*t2317;
+    const MBPOL_POLY_REAL t13307 = df[4038];
+    const MBPOL_POLY_REAL t13310 = t13213*t2314;
+    const MBPOL_POLY_REAL t13466 = t13081*t2010;
+    const MBPOL_POLY_REAL t13578 = t13285+t13287+t13466+t13290+df[70]*t164+t13293+t13294*t2369+t13296
 *t1988+t13299*t6561+t13302+t13303*t2367+t13306+t13307*t3353+t13310+t13577;
-    const double t13589 = t8463*t1705;
-    const double t13591 = t8062*t1247;
-    const double t13312 = df[575]*t1042;
-    const double t13317 = t13281*t3817;
-    const double t13319 = df[587]*t1065;
-    const double t13323 = t13246*t3814;
-    const double t13324 = df[3356];
-    const double t13328 = df[544];
-    const double t13330 = df[534];
-    const double t13332 = df[3706];
-    const double t13335 = t13073*t3949;
-    const double t13598 = t13312+t8727*(2.0*t969+t1015+t1026+t1027+t1028+t1029+t968)+t13317+
+    const MBPOL_POLY_REAL t13589 = t8463*t1705;
+    const MBPOL_POLY_REAL t13591 = t8062*t1247;
+    const MBPOL_POLY_REAL t13312 = df[575]*t1042;
+    const MBPOL_POLY_REAL t13317 = t13281*t3817;
+    const MBPOL_POLY_REAL t13319 = df[587]*t1065;
+    const MBPOL_POLY_REAL t13323 = t13246*t3814;
+    const MBPOL_POLY_REAL t13324 = df[3356];
+    const MBPOL_POLY_REAL t13328 = df[544];
+    const MBPOL_POLY_REAL t13330 = df[534];
+    const MBPOL_POLY_REAL t13332 = df[3706];
+    const MBPOL_POLY_REAL t13335 = t13073*t3949;
+    const MBPOL_POLY_REAL t13598 = t13312+t8727*(MBPOL_POLY_REAL(2)*t969+t1015+t1026+t1027+t1028+t1029+t968)+t13317+
 t13319+t12619*t3498+df[182]*t336+t13323+t13589+t13324*t1512+t13591+t7951*t594+
 t13328*t904+t13330*t906+t13332*t3878+t13335+t8545*t4873;
-    const double t13608 = t8177*t3975;
-    const double t13337 = df[3762];
-    const double t13339 = df[622];
-    const double t13341 = df[609];
-    const double t13343 = df[3493];
-    const double t13346 = t13049*t3946;
-    const double t13347 = df[1301];
-    const double t13350 = df[2178]*t3897;
-    const double t13352 = df[2169]*t3873;
-    const double t13353 = df[233];
-    const double t13357 = t13128*t225;
-    const double t13359 = t13123*t1548;
-    const double t13361 = df[1271]*t2364;
-    const double t13363 = t13109*t1653;
-    const double t13365 = df[3371]*t1626;
-    const double t13617 = t13337*t4253+t13339*t1133+t13341*t1110+t13343*t3251+t13346+t13347*
+    const MBPOL_POLY_REAL t13608 = t8177*t3975;
+    const MBPOL_POLY_REAL t13337 = df[3762];
+    const MBPOL_POLY_REAL t13339 = df[622];
+    const MBPOL_POLY_REAL t13341 = df[609];
+    const MBPOL_POLY_REAL t13343 = df[3493];
+    const MBPOL_POLY_REAL t13346 = t13049*t3946;
+    const MBPOL_POLY_REAL t13347 = df[1301];
+    const MBPOL_POLY_REAL t13350 = df[2178]*t3897;
+    const MBPOL_POLY_REAL t13352 = df[2169]*t3873;
+    const MBPOL_POLY_REAL t13353 = df[233];
+    const MBPOL_POLY_REAL t13357 = t13128*t225;
+    const MBPOL_POLY_REAL t13359 = t13123*t1548;
+    const MBPOL_POLY_REAL t13361 = df[1271]*t2364;
+    const MBPOL_POLY_REAL t13363 = t13109*t1653;
+    const MBPOL_POLY_REAL t13365 = df[3371]*t1626;
+    const MBPOL_POLY_REAL t13617 = t13337*t4253+t13339*t1133+t13341*t1110+t13343*t3251+t13346+t13347*
 t1905+t13608+t13350+t13352+t13353*t61+t13357+t13359+t13361+t13363+t13365;
-    const double t13367 = t13046*t115;
-    const double t13372 = df[3720]*t4062;
-    const double t13374 = t13097*t419;
-    const double t13376 = df[3153]*t2095;
-    const double t13377 = df[33];
-    const double t13384 = t12908*t1184;
-    const double t13385 = df[274];
-    const double t13388 = df[783]*t1429;
-    const double t13390 = t12906*t1278;
-    const double t13393 = df[791]*t1447;
-    const double t13395 = t12988*t2198;
-    const double t13397 = t12985*t2062;
-    const double t13539 = t12611*t2277;
-    const double t13638 = t13367+t7739*(2.0*t6696+t3893+t3894+t3925+t3926+t3896+t6694)+
-t13372+t13374+t13376+t13377*t63+t8410*(2.0*t5562+t2114+t2110+t2127+t2128+t2116+
+    const MBPOL_POLY_REAL t13367 = t13046*t115;
+    const MBPOL_POLY_REAL t13372 = df[3720]*t4062;
+    const MBPOL_POLY_REAL t13374 = t13097*t419;
+    const MBPOL_POLY_REAL t13376 = df[3153]*t2095;
+    const MBPOL_POLY_REAL t13377 = df[33];
+    const MBPOL_POLY_REAL t13384 = t12908*t1184;
+    const MBPOL_POLY_REAL t13385 = df[274];
+    const MBPOL_POLY_REAL t13388 = df[783]*t1429;
+    const MBPOL_POLY_REAL t13390 = t12906*t1278;
+    const MBPOL_POLY_REAL t13393 = df[791]*t1447;
+    const MBPOL_POLY_REAL t13395 = t12988*t2198;
+    const MBPOL_POLY_REAL t13397 = t12985*t2062;
+    const MBPOL_POLY_REAL t13539 = t12611*t2277;
+    const MBPOL_POLY_REAL t13638 = t13367+t7739*(MBPOL_POLY_REAL(2)*t6696+t3893+t3894+t3925+t3926+t3896+t6694)+
+t13372+t13374+t13376+t13377*t63+t8410*(MBPOL_POLY_REAL(2)*t5562+t2114+t2110+t2127+t2128+t2116+
 t5561)+t13384+t13385*t268+t13388+t13390+t13539+t13393+t13395+t13397;
-    const double t13399 = df[826]*t1509;
-    const double t13401 = t13069*t1466;
-    const double t13403 = t13236*t3435;
-    const double t13405 = df[3971];
-    const double t13409 = t12911*t3539;
-    const double t13411 = df[2095]*t3725;
-    const double t13413 = t13075*t3687;
-    const double t13415 = t13003*t4023;
-    const double t13417 = t13067*t3740;
-    const double t13419 = t13026*t3658;
-    const double t13421 = t12916*t2274;
-    const double t13422 = df[1194];
-    const double t13428 = t12921*t3496;
-    const double t13658 = t13399+t13401+t13403+t12608*t2692+t13405*t3351+t13409+t13411+
-t13413+t13415+t13417+t13419+t13421+t13422*t2091+t8741*(2.0*t687+t534+t536+t741+
+    const MBPOL_POLY_REAL t13399 = df[826]*t1509;
+    const MBPOL_POLY_REAL t13401 = t13069*t1466;
+    const MBPOL_POLY_REAL t13403 = t13236*t3435;
+    const MBPOL_POLY_REAL t13405 = df[3971];
+    const MBPOL_POLY_REAL t13409 = t12911*t3539;
+    const MBPOL_POLY_REAL t13411 = df[2095]*t3725;
+    const MBPOL_POLY_REAL t13413 = t13075*t3687;
+    const MBPOL_POLY_REAL t13415 = t13003*t4023;
+    const MBPOL_POLY_REAL t13417 = t13067*t3740;
+    const MBPOL_POLY_REAL t13419 = t13026*t3658;
+    const MBPOL_POLY_REAL t13421 = t12916*t2274;
+    const MBPOL_POLY_REAL t13422 = df[1194];
+    const MBPOL_POLY_REAL t13428 = t12921*t3496;
+    const MBPOL_POLY_REAL t13658 = t13399+t13401+t13403+t12608*t2692+t13405*t3351+t13409+t13411+
+t13413+t13415+t13417+t13419+t13421+t13422*t2091+t8741*(MBPOL_POLY_REAL(2)*t687+t534+t536+t741+
 t742+t540+t743)+t13428;
-    const double t13430 = t12945*t3661;
-    const double t13432 = t13095*t416;
-    const double t13439 = df[22]*t58;
-    const double t13440 = df[3937];
-    const double t13442 = df[1512];
-    const double t13445 = df[3112]*t1909;
-    const double t13451 = df[3123]*t1469;
-    const double t13452 = df[2746];
-    const double t13455 = df[2735];
-    const double t13458 = t12963*t2859;
-    const double t13460 = df[1561];
-    const double t13462 = df[749];
-    const double t13580 = df[1538];
-    const double t13679 = t13430+t13432+(t5536+t7541+t5549+t5550+t7542+t5553+t5554+t5552*t72
-)*t73+t7591*t72+t13439+t13440*t3329+t13442*t2662+t13445+t8220*(2.0*t5451+t2527+
+    const MBPOL_POLY_REAL t13430 = t12945*t3661;
+    const MBPOL_POLY_REAL t13432 = t13095*t416;
+    const MBPOL_POLY_REAL t13439 = df[22]*t58;
+    const MBPOL_POLY_REAL t13440 = df[3937];
+    const MBPOL_POLY_REAL t13442 = df[1512];
+    const MBPOL_POLY_REAL t13445 = df[3112]*t1909;
+    const MBPOL_POLY_REAL t13451 = df[3123]*t1469;
+    const MBPOL_POLY_REAL t13452 = df[2746];
+    const MBPOL_POLY_REAL t13455 = df[2735];
+    const MBPOL_POLY_REAL t13458 = t12963*t2859;
+    const MBPOL_POLY_REAL t13460 = df[1561];
+    const MBPOL_POLY_REAL t13462 = df[749];
+    const MBPOL_POLY_REAL t13580 = df[1538];
+    const MBPOL_POLY_REAL t13679 = t13430+t13432+(t5536+t7541+t5549+t5550+t7542+t5553+t5554+t5552*t72
+)*t73+t7591*t72+t13439+t13440*t3329+t13442*t2662+t13445+t8220*(MBPOL_POLY_REAL(2)*t5451+t2527+
 t1864+t1866+t1869+t2529+t5447)+t13580*t2790+t13451+t13452*t613+t13455*t766+
 t13458+t13460*t2629+t13462*t1068;
-    const double t13685 = t8158*t4161;
-    const double t13464 = df[740];
-    const double t13467 = df[1509]*t2760;
-    const double t13468 = t12935;
-    const double t13470 = df[2010];
-    const double t13473 = t13169*t3397;
-    const double t13475 = df[1867]*t3326;
-    const double t13478 = t13198*t4559;
-    const double t13480 = df[1887]*t3368;
-    const double t13482 = t12976*t4556;
-    const double t13484 = t12943*t4583;
-    const double t13485 = df[1428];
-    const double t13491 = t13131*t3536;
-    const double t13493 = t13223*t1275;
-    const double t13699 = t13464*t1070+t13467+t13468*t2731+t13685+t13470*t3297+t13473+t13475
-+t13478+t13480+t13482+t13484+t13485*t2631+t8700*(2.0*t2324+t2602+t2613+t2614+
+    const MBPOL_POLY_REAL t13685 = t8158*t4161;
+    const MBPOL_POLY_REAL t13464 = df[740];
+    const MBPOL_POLY_REAL t13467 = df[1509]*t2760;
+    const MBPOL_POLY_REAL t13468 = t12935;
+    const MBPOL_POLY_REAL t13470 = df[2010];
+    const MBPOL_POLY_REAL t13473 = t13169*t3397;
+    const MBPOL_POLY_REAL t13475 = df[1867]*t3326;
+    const MBPOL_POLY_REAL t13478 = t13198*t4559;
+    const MBPOL_POLY_REAL t13480 = df[1887]*t3368;
+    const MBPOL_POLY_REAL t13482 = t12976*t4556;
+    const MBPOL_POLY_REAL t13484 = t12943*t4583;
+    const MBPOL_POLY_REAL t13485 = df[1428];
+    const MBPOL_POLY_REAL t13491 = t13131*t3536;
+    const MBPOL_POLY_REAL t13493 = t13223*t1275;
+    const MBPOL_POLY_REAL t13699 = t13464*t1070+t13467+t13468*t2731+t13685+t13470*t3297+t13473+t13475
++t13478+t13480+t13482+t13484+t13485*t2631+t8700*(MBPOL_POLY_REAL(2)*t2324+t2602+t2613+t2614+
 t2615+t2616+t2323)+t13491+t13493;
-    const double t13704 = t8159*t4158;
-    const double t13495 = t13258*t4350;
-    const double t13496 = df[2258];
-    const double t13499 = df[3874];
-    const double t13503 = t13256*t4586;
-    const double t13504 = df[2307];
-    const double t13514 = df[3916]*t3301;
-    const double t13519 = t12993*t1948;
-    const double t13520 = df[1010];
-    const double t13524 = t13063*t6487;
-    const double t13724 = t13495+t13496*t4058+t13499*t4255+t13503+t13704+t13504*t3272+t12904
-*t4301+(2.0*t4902+t39+t40+t41+t43+t44+t35)*t67+df[715]*(2.0*t1251+t1039+t1049+
-t1036+t1040+t1052+t1249)+t13514+t8107*(2.0*t6908+t4416+t4515+t4418+t4421+t4517+
+    const MBPOL_POLY_REAL t13704 = t8159*t4158;
+    const MBPOL_POLY_REAL t13495 = t13258*t4350;
+    const MBPOL_POLY_REAL t13496 = df[2258];
+    const MBPOL_POLY_REAL t13499 = df[3874];
+    const MBPOL_POLY_REAL t13503 = t13256*t4586;
+    const MBPOL_POLY_REAL t13504 = df[2307];
+    const MBPOL_POLY_REAL t13514 = df[3916]*t3301;
+    const MBPOL_POLY_REAL t13519 = t12993*t1948;
+    const MBPOL_POLY_REAL t13520 = df[1010];
+    const MBPOL_POLY_REAL t13524 = t13063*t6487;
+    const MBPOL_POLY_REAL t13724 = t13495+t13496*t4058+t13499*t4255+t13503+t13704+t13504*t3272+t12904
+*t4301+(MBPOL_POLY_REAL(2)*t4902+t39+t40+t41+t43+t44+t35)*t67+df[715]*(MBPOL_POLY_REAL(2)*t1251+t1039+t1049+
+t1036+t1040+t1052+t1249)+t13514+t8107*(MBPOL_POLY_REAL(2)*t6908+t4416+t4515+t4418+t4421+t4517+
 t6903)+t13519+t13520*t1907+t13524+df[3513]*t6450+t12512*t4298;
-    const double t13528 = df[2342]*t4250;
-    const double t13530 = df[725]*t1112;
-    const double t13532 = df[721]*t1135;
-    const double t13534 = t13166*t4197;
-    const double t13536 = t12930*t2689;
-    const double t13538 = df[1444]*t2657;
-    const double t13540 = df[1877]*t3348;
-    const double t13546 = df[354]*t610;
-    const double t13548 = df[346]*t591;
-    const double t13550 = t12999*t2541;
-    const double t13552 = t13100*t4384;
-    const double t13554 = t13085*t2544;
-    const double t13556 = t13125*t2572;
-    const double t13558 = t13107*t2485;
-    const double t13744 = t13528+t13530+t13532+t13534+t13536+t13538+t13540+t8534*(2.0*t4987+
+    const MBPOL_POLY_REAL t13528 = df[2342]*t4250;
+    const MBPOL_POLY_REAL t13530 = df[725]*t1112;
+    const MBPOL_POLY_REAL t13532 = df[721]*t1135;
+    const MBPOL_POLY_REAL t13534 = t13166*t4197;
+    const MBPOL_POLY_REAL t13536 = t12930*t2689;
+    const MBPOL_POLY_REAL t13538 = df[1444]*t2657;
+    const MBPOL_POLY_REAL t13540 = df[1877]*t3348;
+    const MBPOL_POLY_REAL t13546 = df[354]*t610;
+    const MBPOL_POLY_REAL t13548 = df[346]*t591;
+    const MBPOL_POLY_REAL t13550 = t12999*t2541;
+    const MBPOL_POLY_REAL t13552 = t13100*t4384;
+    const MBPOL_POLY_REAL t13554 = t13085*t2544;
+    const MBPOL_POLY_REAL t13556 = t13125*t2572;
+    const MBPOL_POLY_REAL t13558 = t13107*t2485;
+    const MBPOL_POLY_REAL t13744 = t13528+t13530+t13532+t13534+t13536+t13538+t13540+t8534*(MBPOL_POLY_REAL(2)*t4987+
 t524+t4967+t521+t525+t4968+t743)+t13546+t13548+t13550+t13552+t13554+t13556+
 t13558;
-    const double t13560 = t13090*t3130;
-    const double t13564 = t12951*t1181;
-    const double t13566 = t13209*t3175;
-    const double t13567 = df[159];
-    const double t13570 = t12972*t572;
-    const double t13571 = df[3649];
-    const double t13574 = t13243*t3743;
-    const double t13576 = df[140]*t265;
-    const double t13582 = df[1850];
-    const double t13584 = df[1110];
-    const double t13586 = df[1837];
-    const double t13590 = df[1828]*t3248;
-    const double t13596 = df[154]*t289;
-    const double t13765 = t13560+df[665]*t1208+t13564+t13566+t13567*t270+t13570+t13571*t3253
-+t13574+t13576+t8770*(2.0*t104+t149+t248+t249+t250+t251+t103)+t13582*t3299+
-t13584*t2093+t13586*t3274+t13590+t8673*(2.0*t3192+t3619+t3379+t3620+t3621+t3622
+    const MBPOL_POLY_REAL t13560 = t13090*t3130;
+    const MBPOL_POLY_REAL t13564 = t12951*t1181;
+    const MBPOL_POLY_REAL t13566 = t13209*t3175;
+    const MBPOL_POLY_REAL t13567 = df[159];
+    const MBPOL_POLY_REAL t13570 = t12972*t572;
+    const MBPOL_POLY_REAL t13571 = df[3649];
+    const MBPOL_POLY_REAL t13574 = t13243*t3743;
+    const MBPOL_POLY_REAL t13576 = df[140]*t265;
+    const MBPOL_POLY_REAL t13582 = df[1850];
+    const MBPOL_POLY_REAL t13584 = df[1110];
+    const MBPOL_POLY_REAL t13586 = df[1837];
+    const MBPOL_POLY_REAL t13590 = df[1828]*t3248;
+    const MBPOL_POLY_REAL t13596 = df[154]*t289;
+    const MBPOL_POLY_REAL t13765 = t13560+df[665]*t1208+t13564+t13566+t13567*t270+t13570+t13571*t3253
++t13574+t13576+t8770*(MBPOL_POLY_REAL(2)*t104+t149+t248+t249+t250+t251+t103)+t13582*t3299+
+t13584*t2093+t13586*t3274+t13590+t8673*(MBPOL_POLY_REAL(2)*t3192+t3619+t3379+t3620+t3621+t3622
 +t3189)+t13596;
-    const double t13783 = t7447+t7450+t7455+t7459+t4135*(t3160*t67+2.0*t4002+t3153+t3777+
-t3778+t3779+t3780)+t7493*(2.0*t7364+t3770+t3720+t3722+t3723+t3773+t3728*t67)+
-t179*(2.0*t891+t864+t866+t867+t869+t870+t879*t67)+t4991+t13453+t4898*t67+t1+
+    const MBPOL_POLY_REAL t13783 = t7447+t7450+t7455+t7459+t4135*(t3160*t67+MBPOL_POLY_REAL(2)*t4002+t3153+t3777+
+t3778+t3779+t3780)+t7493*(MBPOL_POLY_REAL(2)*t7364+t3770+t3720+t3722+t3723+t3773+t3728*t67)+
+t179*(MBPOL_POLY_REAL(2)*t891+t864+t866+t867+t869+t870+t879*t67)+t4991+t13453+t4898*t67+t1+
 t12806+t12818+t13502+t13577+t13589;
-    const double t13625 = df[3512];
-    const double t13809 = t13591+t13608+t13685+t13704+t8107*t4518*t67+t13289*t67+t8727*t1030
+    const MBPOL_POLY_REAL t13625 = df[3512];
+    const MBPOL_POLY_REAL t13809 = t13591+t13608+t13685+t13704+t8107*t4518*t67+t13289*t67+t8727*t1030
 *t67+t8395*t2232*t67+t8700*t2617*t67+t8691*t2999*t67+t13401+t13393+t13524+
 t13625*t6450+t13348+t13132+t13388;
-    const double t13842 = t8545*t4871+t13439+t13570+t13491+t13485*t2629+t8700*(2.0*t2307+
-t2602+t2604+t2605+t2607+t2608)+t13514+t13473+df[714]*(2.0*t1246+t1038+t1039+
+    const MBPOL_POLY_REAL t13842 = t8545*t4871+t13439+t13570+t13491+t13485*t2629+t8700*(MBPOL_POLY_REAL(2)*t2307+
+t2602+t2604+t2605+t2607+t2608)+t13514+t13473+df[714]*(MBPOL_POLY_REAL(2)*t1246+t1038+t1039+
 t1050+t1051+t1041)+t13530+t13532+t13493+t7951*t596+t13225*t512+t8760*t401+
 t13207*t1512;
-    const double t13877 = t13520*t1905+t13162+df[298]*t507+t13385*t270+t13460*t2631+t13184+
+    const MBPOL_POLY_REAL t13877 = t13520*t1905+t13162+df[298]*t507+t13385*t270+t13460*t2631+t13184+
 t8673*t3623*t67+t7739*t3900*t67+t7816*t1690*t67+t8612*t4336*t67+t8410*t2120*t67
 +t8220*t2530*t67+df[4028]*t3371*t67+t12820*t67+t13495+t13377*t61+t13372;
-    const double t13913 = t12876*t2692+t13307*t3351+t13290+t13519+t8691*(2.0*t1785+t1931+
-t1933+t1934+t1936+t1937)+t7816*(2.0*t6057+t1812+t1682+t1684+t1685+t1815)+t13538
-+df[318]*t541+df[311]*t527+t13293+df[3820]*t4301+t13317+t13332*t3876+t8442*(2.0
+    const MBPOL_POLY_REAL t13913 = t12876*t2692+t13307*t3351+t13290+t13519+t8691*(MBPOL_POLY_REAL(2)*t1785+t1931+
+t1933+t1934+t1936+t1937)+t7816*(MBPOL_POLY_REAL(2)*t6057+t1812+t1682+t1684+t1685+t1815)+t13538
++df[318]*t541+df[311]*t527+t13293+df[3820]*t4301+t13317+t13332*t3876+t8442*(MBPOL_POLY_REAL(2)
 *t1691+t1745+t1746+t1747+t1749+t1750+t1807*t67)+t13066*t3498+t13335;
-    const double t13948 = t13415+df[2361]*t4298+t8612*(2.0*t4112+t4272+t4274+t4275+t4277+
-t4278)+t13552+t13193+t13482+t13271*t4530+df[13]*t34+t13376+t13539+t8410*(2.0*
+    const MBPOL_POLY_REAL t13948 = t13415+df[2361]*t4298+t8612*(MBPOL_POLY_REAL(2)*t4112+t4272+t4274+t4275+t4277+
+t4278)+t13552+t13193+t13482+t13271*t4530+df[13]*t34+t13376+t13539+t8410*(MBPOL_POLY_REAL(2)*
 t5559+t2126+t2110+t2112+t2115+t2129)+t13405*t3353+t13458+t13528+t13428+t13430+
 t13534;
-    const double t13981 = t13361+df[1606]*t2914+t13245+t13323+t13337*t4255+t13462*t1070+
+    const MBPOL_POLY_REAL t13981 = t13361+df[1606]*t2914+t13245+t13323+t13337*t4255+t13462*t1070+
 t13464*t1068+t13390+t13384+t13417+t13411+t13220+df[715]*t1053*t67+df[3019]*
 t5544+t13148*t1452+t13247;
-    const double t14015 = df[3022]*t5552+t13546+t7739*(2.0*t6795+t3894+t3924+t3891+t3895+
-t3927)+t13413+t13466+t13548+t13470*t3299+t13195+t13419+t13159*t3878+(2.0*t7456+
+    const MBPOL_POLY_REAL t14015 = df[3022]*t5552+t13546+t7739*(MBPOL_POLY_REAL(2)*t6795+t3894+t3924+t3891+t3895+
+t3927)+t13413+t13466+t13548+t13470*t3299+t13195+t13419+t13159*t3878+(MBPOL_POLY_REAL(2)*t7456+
 t40+t5003+t5004+t5005+t5006)*t50+t13584*t2091+t7539*t73+t7585*t72+t13442*t2660+
 t13467+t13234;
-    const double t13770 = df[1525];
-    const double t14050 = t13770*t2790+t13232+df[93]*t197+df[69]*t164+t8770*(2.0*t83+t148+
-t149+t150+t152+t153)+t13403+t13278+t13154*t4058+t13496*t4060+t13139+t8741*(2.0*
+    const MBPOL_POLY_REAL t13770 = df[1525];
+    const MBPOL_POLY_REAL t14050 = t13770*t2790+t13232+df[93]*t197+df[69]*t164+t8770*(MBPOL_POLY_REAL(2)*t83+t148+
+t149+t150+t152+t153)+t13403+t13278+t13154*t4058+t13496*t4060+t13139+t8741*(MBPOL_POLY_REAL(2)*
 t678+t523+t524+t736+t737+t526)+t13352+t13302+t13341*t1108+t13350+t13140*t1110;
-    const double t14085 = t13339*t1131+t13296*t1990+t13303*t2369+t13338+t13130+t13294*t2367+
+    const MBPOL_POLY_REAL t14085 = t13339*t1131+t13296*t1990+t13303*t2369+t13338+t13130+t13294*t2367+
 t13135+t13137+t13151+t13153+t13221*t2662+t13224+t13146*t1434+t13211+t13312+
 t13230+t13440*t3331;
-    const double t14122 = t13275*t766+t13422*t2093+t13238+t13144*t1133+t13421+t13558+t13560+
-t8709*(2.0*t1821+t2179+t2180+t2181+t2183+t2184)+t8103*(2.0*t6835+t4416+t4420+
-t4514+t4516+t4422)+t13158+t13263*t4482+t8160*(2.0*t3696+t3856+t3857+t3858+t3860
+    const MBPOL_POLY_REAL t14122 = t13275*t766+t13422*t2093+t13238+t13144*t1133+t13421+t13558+t13560+
+t8709*(MBPOL_POLY_REAL(2)*t1821+t2179+t2180+t2181+t2183+t2184)+t8103*(MBPOL_POLY_REAL(2)*t6835+t4416+t4420+
+t4514+t4516+t4422)+t13158+t13263*t4482+t8160*(MBPOL_POLY_REAL(2)*t3696+t3856+t3857+t3858+t3860
 +t3861+t3935*t67)+t13346+t13536+df[1486]*t2731+df[431]*t544;
-    const double t14158 = t13397+t13197+t13324*t1514+t13299*t6559+t13280+t13269+t13582*t3297
+    const MBPOL_POLY_REAL t14158 = t13397+t13197+t13324*t1514+t13299*t6559+t13280+t13269+t13582*t3297
 +t13586*t3272+t13590+t13287+t13484+t13167*t1988+t13399+t13455*t768+t13395+t8534
-*(2.0*t4983+t534+t4962+t538+t539+t4963)+t13180*t4484;
-    const double t14194 = t13347*t1907+t13359+t8727*(2.0*t966+t1015+t1017+t1018+t1020+t1021)
+*(MBPOL_POLY_REAL(2)*t4983+t534+t4962+t538+t539+t4963)+t13180*t4484;
+    const MBPOL_POLY_REAL t14194 = t13347*t1907+t13359+t8727*(MBPOL_POLY_REAL(2)*t966+t1015+t1017+t1018+t1020+t1021)
 +df[181]*t336+t13319+t13363+df[3399]*t1582+t13365+t13567*t268+t13596+t13576+
-t13452*t615+t13227*t4532+df[4027]*(2.0*t7048+t3466+t3361+t3365+t3366+t3469)+
+t13452*t615+t13227*t4532+df[4027]*(MBPOL_POLY_REAL(2)*t7048+t3466+t3361+t3365+t3366+t3469)+
 t13266+t13478;
-    const double t14229 = t13212*t3329+t13499*t4253+t13503+t13259*t1622+t13285+t13251+t13480
-+t13328*t906+t13504*t3274+t13451+t13445+t13310+t8220*(2.0*t5443+t1864+t1868+
+    const MBPOL_POLY_REAL t14229 = t13212*t3329+t13499*t4253+t13503+t13259*t1622+t13285+t13251+t13480
++t13328*t906+t13504*t3274+t13451+t13445+t13310+t8220*(MBPOL_POLY_REAL(2)*t5443+t1864+t1868+
 t2526+t2528+t1870)+t13235*t1450+t13242*t1432+df[664]*t1208+t13178*t613;
-    const double t14263 = t8564*t594+t13173+t13177+t13274+t13564+t13554+t13343*t3253+t13409+
-t13374+t13432+t13330*t904+t13475+t7776*(2.0*t6426+t6532+t6630+t6642+t6643+t6631
+    const MBPOL_POLY_REAL t14263 = t8564*t594+t13173+t13177+t13274+t13564+t13554+t13343*t3253+t13409+
+t13374+t13432+t13330*t904+t13475+t7776*(MBPOL_POLY_REAL(2)*t6426+t6532+t6630+t6642+t6643+t6631
 )+t13262+t13353*t63+t13556;
-    const double t14299 = t13240+t13174*t1624+t13550+t13255+t8681*(2.0*t3056+t3378+t3379+
+    const MBPOL_POLY_REAL t14299 = t13240+t13174*t1624+t13550+t13255+t8681*(MBPOL_POLY_REAL(2)*t3056+t3378+t3379+
 t3380+t3382+t3383)+t13566+t13571*t3251+t13357+t13367+t13306+df[3217]*t2008+
 t13574+t13189+t13191+t13253+t13540+t13248*t6561;
-    const double t13818 = df[171];
-    const double t13820 = df[987];
-    const double t13822 = df[978];
-    const double t13825 = df[970];
-    const double t13827 = df[958];
-    const double t13832 = df[3578];
-    const double t13834 = df[933];
-    const double t13836 = df[3551];
-    const double t13838 = df[3546];
-    const double t13840 = df[878];
-    const double t14320 = df[2688]*t473+t13818*t258+t13820*t1865+t13822*t1422+t8442*t1735+
-t13825*t1569+t13827*t1744+t7776*(2.0*t6480+t6543+t6454+t6456+t6479)+t13832*
+    const MBPOL_POLY_REAL t13818 = df[171];
+    const MBPOL_POLY_REAL t13820 = df[987];
+    const MBPOL_POLY_REAL t13822 = df[978];
+    const MBPOL_POLY_REAL t13825 = df[970];
+    const MBPOL_POLY_REAL t13827 = df[958];
+    const MBPOL_POLY_REAL t13832 = df[3578];
+    const MBPOL_POLY_REAL t13834 = df[933];
+    const MBPOL_POLY_REAL t13836 = df[3551];
+    const MBPOL_POLY_REAL t13838 = df[3546];
+    const MBPOL_POLY_REAL t13840 = df[878];
+    const MBPOL_POLY_REAL t14320 = df[2688]*t473+t13818*t258+t13820*t1865+t13822*t1422+t8442*t1735+
+t13825*t1569+t13827*t1744+t7776*(MBPOL_POLY_REAL(2)*t6480+t6543+t6454+t6456+t6479)+t13832*
 t6530+t13834*t1748+t13836*t6556+t13838*t6534+t13840*t1619;
-    const double t14321 = t9878*t6581;
-    const double t13843 = df[908];
-    const double t13846 = df[997];
-    const double t13848 = df[962];
-    const double t13852 = df[920];
-    const double t13855 = df[3566];
-    const double t13859 = df[823];
-    const double t14335 = t14321+t13843*t1683+df[891]*t1645+t13846*t1440+t13848*t1680+t713+
+    const MBPOL_POLY_REAL t14321 = t9878*t6581;
+    const MBPOL_POLY_REAL t13843 = df[908];
+    const MBPOL_POLY_REAL t13846 = df[997];
+    const MBPOL_POLY_REAL t13848 = df[962];
+    const MBPOL_POLY_REAL t13852 = df[920];
+    const MBPOL_POLY_REAL t13855 = df[3566];
+    const MBPOL_POLY_REAL t13859 = df[823];
+    const MBPOL_POLY_REAL t14335 = t14321+t13843*t1683+df[891]*t1645+t13846*t1440+t13848*t1680+t713+
 t7493*t7360+t4135*t4764+t13852*t1615+df[914]*t1696+t13855*t6553+df[855]*t1574+
 t13859*t1502+df[797]*t1461;
-    const double t13863 = df[831];
-    const double t13865 = df[130];
-    const double t13868 = df[147];
-    const double t13870 = df[136];
-    const double t13872 = df[787];
-    const double t13874 = df[779];
-    const double t13881 = df[596];
-    const double t14350 = df[838]*t1540+t13863*t1505+t13865*t147+t8739*t1245+t13868*t52+
+    const MBPOL_POLY_REAL t13863 = df[831];
+    const MBPOL_POLY_REAL t13865 = df[130];
+    const MBPOL_POLY_REAL t13868 = df[147];
+    const MBPOL_POLY_REAL t13870 = df[136];
+    const MBPOL_POLY_REAL t13872 = df[787];
+    const MBPOL_POLY_REAL t13874 = df[779];
+    const MBPOL_POLY_REAL t13881 = df[596];
+    const MBPOL_POLY_REAL t14350 = df[838]*t1540+t13863*t1505+t13865*t147+t8739*t1245+t13868*t52+
 t13870*t260+t13872*t1442+t13874*t1425+df[3521]*t6481+df[3512]*t6448+df[696]*
 t1270+df[689]*t1238+t13881*t1060;
-    const double t13883 = df[456];
-    const double t13888 = df[572];
-    const double t13890 = df[584];
-    const double t13892 = df[578];
-    const double t13894 = df[561];
-    const double t13898 = df[1215]*t2269;
-    const double t13899 = df[1251];
-    const double t14363 = t13883*t760+t179*(2.0*t888+t882+t883+t843+t887)+t7492+t7508+t7481+
+    const MBPOL_POLY_REAL t13883 = df[456];
+    const MBPOL_POLY_REAL t13888 = df[572];
+    const MBPOL_POLY_REAL t13890 = df[584];
+    const MBPOL_POLY_REAL t13892 = df[578];
+    const MBPOL_POLY_REAL t13894 = df[561];
+    const MBPOL_POLY_REAL t13898 = df[1215]*t2269;
+    const MBPOL_POLY_REAL t13899 = df[1251];
+    const MBPOL_POLY_REAL t14363 = t13883*t760+t179*(MBPOL_POLY_REAL(2)*t888+t882+t883+t843+t887)+t7492+t7508+t7481+
 t7504+t13888*t1035+t13890*t1058+t13892*t1037+t13894*t1019+t8691*t2226+t13898+
 t13899*t1978+df[1237]*t2309;
-    const double t13903 = df[1190];
-    const double t13905 = df[1185];
-    const double t13909 = df[1122];
-    const double t13911 = df[566];
-    const double t13914 = df[1159];
-    const double t13916 = df[1128];
-    const double t13918 = df[1156];
-    const double t13920 = df[1106];
-    const double t14379 = df[239]*t411+t13903*t2084+t13905*t2178+df[1164]*t2190+t8709*t1818+
+    const MBPOL_POLY_REAL t13903 = df[1190];
+    const MBPOL_POLY_REAL t13905 = df[1185];
+    const MBPOL_POLY_REAL t13909 = df[1122];
+    const MBPOL_POLY_REAL t13911 = df[566];
+    const MBPOL_POLY_REAL t13914 = df[1159];
+    const MBPOL_POLY_REAL t13916 = df[1128];
+    const MBPOL_POLY_REAL t13918 = df[1156];
+    const MBPOL_POLY_REAL t13920 = df[1106];
+    const MBPOL_POLY_REAL t14379 = df[239]*t411+t13903*t2084+t13905*t2178+df[1164]*t2190+t8709*t1818+
 t13909*t2111+t13911*t1016+t13914*t2182+t13916*t2113+t13918*t2049+t13920*t2088+
 df[1091]*t2053+df[1030]*t1943;
-    const double t13924 = df[1025];
-    const double t13927 = df[1079]*t2026;
-    const double t13928 = df[1051];
-    const double t13930 = df[1006];
-    const double t13932 = df[2613];
-    const double t13934 = df[2602];
-    const double t13938 = df[2492];
-    const double t13940 = df[2488];
-    const double t13942 = df[2478];
-    const double t13944 = df[2464];
-    const double t13947 = df[63];
-    const double t14394 = t13924*t1935+t13927+t13928*t1980+t13930*t1902+t13932*t4193+t13934*
+    const MBPOL_POLY_REAL t13924 = df[1025];
+    const MBPOL_POLY_REAL t13927 = df[1079]*t2026;
+    const MBPOL_POLY_REAL t13928 = df[1051];
+    const MBPOL_POLY_REAL t13930 = df[1006];
+    const MBPOL_POLY_REAL t13932 = df[2613];
+    const MBPOL_POLY_REAL t13934 = df[2602];
+    const MBPOL_POLY_REAL t13938 = df[2492];
+    const MBPOL_POLY_REAL t13940 = df[2488];
+    const MBPOL_POLY_REAL t13942 = df[2478];
+    const MBPOL_POLY_REAL t13944 = df[2464];
+    const MBPOL_POLY_REAL t13947 = df[63];
+    const MBPOL_POLY_REAL t14394 = t13924*t1935+t13927+t13928*t1980+t13930*t1902+t13932*t4193+t13934*
 t3244+df[2522]*t4577+df[2508]*t4550+t13938*t4527+t13940*t4419+t13942*t4475+
 t13944*t4479+df[68]*t158+t13947*t151;
-    const double t13951 = df[2542];
-    const double t13956 = df[2434];
-    const double t13958 = df[2425];
-    const double t13960 = df[2381];
-    const double t13964 = df[2349];
-    const double t13966 = df[2338];
-    const double t13969 = df[2354];
-    const double t14410 = df[1133]*t2133+t13951*t4524+df[44]*t106+df[2402]*t4376+df[2386]*
+    const MBPOL_POLY_REAL t13951 = df[2542];
+    const MBPOL_POLY_REAL t13956 = df[2434];
+    const MBPOL_POLY_REAL t13958 = df[2425];
+    const MBPOL_POLY_REAL t13960 = df[2381];
+    const MBPOL_POLY_REAL t13964 = df[2349];
+    const MBPOL_POLY_REAL t13966 = df[2338];
+    const MBPOL_POLY_REAL t13969 = df[2354];
+    const MBPOL_POLY_REAL t14410 = df[1133]*t2133+t13951*t4524+df[44]*t106+df[2402]*t4376+df[2386]*
 t4341+t13956*t4243+t13958*t4417+t13960*t4273+df[2359]*t4293+t13964*t4276+t13966
 *t4246+t8612*t4122+t13969*t4268;
-    const double t13975 = df[640];
-    const double t13977 = df[632];
-    const double t13979 = df[618];
-    const double t13982 = df[605];
-    const double t13985 = df[444]*t763;
-    const double t13988 = df[558];
-    const double t13992 = df[350];
-    const double t14426 = t9899*t4199+df[663]*t1203+df[649]*t1175+t13975*t1125+t13977*t1101+
+    const MBPOL_POLY_REAL t13975 = df[640];
+    const MBPOL_POLY_REAL t13977 = df[632];
+    const MBPOL_POLY_REAL t13979 = df[618];
+    const MBPOL_POLY_REAL t13982 = df[605];
+    const MBPOL_POLY_REAL t13985 = df[444]*t763;
+    const MBPOL_POLY_REAL t13988 = df[558];
+    const MBPOL_POLY_REAL t13992 = df[350];
+    const MBPOL_POLY_REAL t14426 = t9899*t4199+df[663]*t1203+df[649]*t1175+t13975*t1125+t13977*t1101+
 t13979*t1128+t13982*t1105+t13985+t8741*t677+t8727*t964+t13988*t993+t8103*t6831+
 df[1785]*t3167+t13992*t605;
-    const double t13994 = df[1825];
-    const double t13997 = df[1810]*t3213;
-    const double t13999 = df[1781];
-    const double t14001 = df[343];
-    const double t14007 = df[1672];
-    const double t14010 = df[1557];
-    const double t14446 = t13994*t3242+t13997+df[322]*t550+t13999*t3157+t14001*t585+df[331]*
-t567+df[1766]*t3122+df[8]*t17+t14007*t1932+t7739*t6691+t14010*t2623+t8331*(2.0*
+    const MBPOL_POLY_REAL t13994 = df[1825];
+    const MBPOL_POLY_REAL t13997 = df[1810]*t3213;
+    const MBPOL_POLY_REAL t13999 = df[1781];
+    const MBPOL_POLY_REAL t14001 = df[343];
+    const MBPOL_POLY_REAL t14007 = df[1672];
+    const MBPOL_POLY_REAL t14010 = df[1557];
+    const MBPOL_POLY_REAL t14446 = t13994*t3242+t13997+df[322]*t550+t13999*t3157+t14001*t585+df[331]*
+t567+df[1766]*t3122+df[8]*t17+t14007*t1932+t7739*t6691+t14010*t2623+t8331*(MBPOL_POLY_REAL(2)*
 t2396+t2385+t2823+t2386+t2387)+df[1605]*t2908;
-    const double t14018 = df[314];
-    const double t14020 = df[308];
-    const double t14024 = df[1452];
-    const double t14026 = df[1440];
-    const double t14028 = df[302];
-    const double t14030 = df[294];
-    const double t14035 = df[1419];
-    const double t14038 = df[1414];
-    const double t14087 = df[1486]*t2726;
-    const double t14463 = t14087+t14018*t537+t14020*t520+df[1463]*t2684+t14024*t2650+t14026*
+    const MBPOL_POLY_REAL t14018 = df[314];
+    const MBPOL_POLY_REAL t14020 = df[308];
+    const MBPOL_POLY_REAL t14024 = df[1452];
+    const MBPOL_POLY_REAL t14026 = df[1440];
+    const MBPOL_POLY_REAL t14028 = df[302];
+    const MBPOL_POLY_REAL t14030 = df[294];
+    const MBPOL_POLY_REAL t14035 = df[1419];
+    const MBPOL_POLY_REAL t14038 = df[1414];
+    const MBPOL_POLY_REAL t14087 = df[1486]*t2726;
+    const MBPOL_POLY_REAL t14463 = t14087+t14018*t537+t14020*t520+df[1463]*t2684+t14024*t2650+t14026*
 t2652+t14028*t501+t14030*t503+t8760*t380+df[1393]*t2566+df[1378]*t2536+t14035*
 t2603+df[1565]*t2853+t14038*t2606;
-    const double t14040 = df[1424];
-    const double t14042 = df[1285];
-    const double t14044 = df[1268];
-    const double t14047 = df[1297];
-    const double t14049 = df[1370];
-    const double t14053 = df[1374];
-    const double t14056 = t13580*t2782;
-    const double t14060 = df[2303];
-    const double t14062 = df[2254];
-    const double t14118 = df[1364]*t2508;
-    const double t14479 = t14040*t2626+t14042*t2360+t14044*t2357+df[1319]*t2434+t14047*t1898
+    const MBPOL_POLY_REAL t14040 = df[1424];
+    const MBPOL_POLY_REAL t14042 = df[1285];
+    const MBPOL_POLY_REAL t14044 = df[1268];
+    const MBPOL_POLY_REAL t14047 = df[1297];
+    const MBPOL_POLY_REAL t14049 = df[1370];
+    const MBPOL_POLY_REAL t14053 = df[1374];
+    const MBPOL_POLY_REAL t14056 = t13580*t2782;
+    const MBPOL_POLY_REAL t14060 = df[2303];
+    const MBPOL_POLY_REAL t14062 = df[2254];
+    const MBPOL_POLY_REAL t14118 = df[1364]*t2508;
+    const MBPOL_POLY_REAL t14479 = t14040*t2626+t14042*t2360+t14044*t2357+df[1319]*t2434+t14047*t1898
 +t14049*t1847+t14118+t14053*t1867+t14056+df[292]*t480+t4895*t67+t14060*t3265+
 t14062*t4052;
-    const double t14064 = df[2241];
-    const double t14067 = df[2284];
-    const double t14070 = df[2118];
-    const double t14072 = df[2161];
-    const double t14074 = df[2159];
-    const double t14076 = df[2175];
-    const double t14078 = df[2165];
-    const double t14080 = df[2190];
-    const double t14082 = df[2186];
-    const double t14495 = t14064*t4055+df[2297]*t4152+t14067*t3866+df[2142]*t3808+t14070*
+    const MBPOL_POLY_REAL t14064 = df[2241];
+    const MBPOL_POLY_REAL t14067 = df[2284];
+    const MBPOL_POLY_REAL t14070 = df[2118];
+    const MBPOL_POLY_REAL t14072 = df[2161];
+    const MBPOL_POLY_REAL t14074 = df[2159];
+    const MBPOL_POLY_REAL t14076 = df[2175];
+    const MBPOL_POLY_REAL t14078 = df[2165];
+    const MBPOL_POLY_REAL t14080 = df[2190];
+    const MBPOL_POLY_REAL t14082 = df[2186];
+    const MBPOL_POLY_REAL t14495 = t14064*t4055+df[2297]*t4152+t14067*t3866+df[2142]*t3808+t14070*
 t3154+t14072*t3859+t14074*t3851+t14076*t3890+t14078*t3868+t14080*t3855+t14082*
 t3892+df[2208]*t3969+df[2194]*t3940+df[2225]*t4014;
-    const double t14090 = df[2091];
-    const double t14093 = df[1967]*t3503;
-    const double t14094 = df[1942];
-    const double t14097 = df[1883];
-    const double t14099 = df[1874];
-    const double t14102 = df[1890];
-    const double t14104 = df[1863];
-    const double t14106 = df[1846];
-    const double t14108 = df[1833];
-    const double t14160 = df[1918]*t3426;
-    const double t14511 = t8160*t3680+t14090*t3721+t14093+t14094*t3362+t14160+t14097*t3364+
+    const MBPOL_POLY_REAL t14090 = df[2091];
+    const MBPOL_POLY_REAL t14093 = df[1967]*t3503;
+    const MBPOL_POLY_REAL t14094 = df[1942];
+    const MBPOL_POLY_REAL t14097 = df[1883];
+    const MBPOL_POLY_REAL t14099 = df[1874];
+    const MBPOL_POLY_REAL t14102 = df[1890];
+    const MBPOL_POLY_REAL t14104 = df[1863];
+    const MBPOL_POLY_REAL t14106 = df[1846];
+    const MBPOL_POLY_REAL t14108 = df[1833];
+    const MBPOL_POLY_REAL t14160 = df[1918]*t3426;
+    const MBPOL_POLY_REAL t14511 = t8160*t3680+t14090*t3721+t14093+t14094*t3362+t14160+t14097*t3364+
 t14099*t3341+df[1895]*t3388+t14102*t3381+t14104*t3322+t14106*t3294+t14108*t3269
 +t7454*t50;
-    const double t14115 = df[2114];
-    const double t14119 = df[2047];
-    const double t14121 = df[2036];
-    const double t14124 = df[2028];
-    const double t14126 = df[2003];
-    const double t14129 = df[2006];
-    const double t14132 = df[18];
-    const double t14134 = df[14];
-    const double t14528 = (2.0*t7505+t5425+t5422+t719+t5429)*t37+df[2072]*t3681+t14115*t3718
+    const MBPOL_POLY_REAL t14115 = df[2114];
+    const MBPOL_POLY_REAL t14119 = df[2047];
+    const MBPOL_POLY_REAL t14121 = df[2036];
+    const MBPOL_POLY_REAL t14124 = df[2028];
+    const MBPOL_POLY_REAL t14126 = df[2003];
+    const MBPOL_POLY_REAL t14129 = df[2006];
+    const MBPOL_POLY_REAL t14132 = df[18];
+    const MBPOL_POLY_REAL t14134 = df[14];
+    const MBPOL_POLY_REAL t14528 = (MBPOL_POLY_REAL(2)*t7505+t5425+t5422+t719+t5429)*t37+df[2072]*t3681+t14115*t3718
 +df[2097]*t3735+df[2058]*t3652+t14119*t3320+t14121*t3377+t14124*t3343+t14126*
 t3567+df[1983]*t3531+t14129*t3290+t8675*t3179+t14132*t54+t14134*t42;
-    const double t14141 = df[3017]*t5541;
-    const double t14144 = df[507];
-    const double t14148 = df[2717];
-    const double t14152 = df[2705];
-    const double t14154 = df[2702];
-    const double t14156 = df[2699];
-    const double t14159 = df[2690];
-    const double t14548 = t8770*(2.0*t49+t70+t46+t47+t48)+df[9]*t28+t14141+df[110]*t216+df
+    const MBPOL_POLY_REAL t14141 = df[3017]*t5541;
+    const MBPOL_POLY_REAL t14144 = df[507];
+    const MBPOL_POLY_REAL t14148 = df[2717];
+    const MBPOL_POLY_REAL t14152 = df[2705];
+    const MBPOL_POLY_REAL t14154 = df[2702];
+    const MBPOL_POLY_REAL t14156 = df[2699];
+    const MBPOL_POLY_REAL t14159 = df[2690];
+    const MBPOL_POLY_REAL t14548 = t8770*(MBPOL_POLY_REAL(2)*t49+t70+t46+t47+t48)+df[9]*t28+t14141+df[110]*t216+df
 [92]*t192+t14144*t868+t8410*t5566+t8534*t4978+t14148*t38+df[2716]*t3+t14152*
 t603+t14154*t587+t14156*t522+t14159*t505;
-    const double t14554 = t5539*t67;
-    const double t14557 = t5537*t50;
-    const double t14561 = t9805*t965;
-    const double t14162 = df[2696];
-    const double t14164 = df[2693];
-    const double t14171 = df[517];
-    const double t14173 = df[527];
-    const double t14176 = df[511];
-    const double t14179 = df[2733];
-    const double t14568 = t8545*t4870+t14162*t535+t14164*t498+df[180]*t329+(t12+t23+t7532+
+    const MBPOL_POLY_REAL t14554 = t5539*t67;
+    const MBPOL_POLY_REAL t14557 = t5537*t50;
+    const MBPOL_POLY_REAL t14561 = t9805*t965;
+    const MBPOL_POLY_REAL t14162 = df[2696];
+    const MBPOL_POLY_REAL t14164 = df[2693];
+    const MBPOL_POLY_REAL t14171 = df[517];
+    const MBPOL_POLY_REAL t14173 = df[527];
+    const MBPOL_POLY_REAL t14176 = df[511];
+    const MBPOL_POLY_REAL t14179 = df[2733];
+    const MBPOL_POLY_REAL t14568 = t8545*t4870+t14162*t535+t14164*t498+df[180]*t329+(t12+t23+t7532+
 t5533+t25+t14554)*t73+(t5533+t2+t7580+t23+t5000+t14557)*t72+t14171*t896+t14561+
 t14173*t894+t7816*t5880+t14176*t865+t7671*t7046+t14179*t758+t8220*t5442;
-    const double t14183 = df[1160];
-    const double t14185 = df[526];
-    const double t14187 = df[518];
-    const double t14195 = df[3020]*t5541;
-    const double t14196 = df[1129];
-    const double t14198 = df[1121];
-    const double t14200 = df[921];
-    const double t14203 = df[909];
-    const double t14251 = df[1164]*t2190;
-    const double t14262 = df[1133]*t2133;
-    const double t14267 = df[2208]*t3969;
-    const double t14275 = df[914]*t1696;
-    const double t14587 = t14321+t14251+t14183*t2182+t14185*t896+t14187*t894+df[3016]*t15+
+    const MBPOL_POLY_REAL t14183 = df[1160];
+    const MBPOL_POLY_REAL t14185 = df[526];
+    const MBPOL_POLY_REAL t14187 = df[518];
+    const MBPOL_POLY_REAL t14195 = df[3020]*t5541;
+    const MBPOL_POLY_REAL t14196 = df[1129];
+    const MBPOL_POLY_REAL t14198 = df[1121];
+    const MBPOL_POLY_REAL t14200 = df[921];
+    const MBPOL_POLY_REAL t14203 = df[909];
+    const MBPOL_POLY_REAL t14251 = df[1164]*t2190;
+    const MBPOL_POLY_REAL t14262 = df[1133]*t2133;
+    const MBPOL_POLY_REAL t14267 = df[2208]*t3969;
+    const MBPOL_POLY_REAL t14275 = df[914]*t1696;
+    const MBPOL_POLY_REAL t14587 = t14321+t14251+t14183*t2182+t14185*t896+t14187*t894+df[3016]*t15+
 t14262+t14267+t14195+t14196*t2111+t14198*t2113+t14200*t1615+t14275+t14203*t1680
 ;
-    const double t14593 = t4717*t37;
-    const double t14596 = t4749*t37;
-    const double t14600 = t848*t37;
-    const double t14206 = df[879];
-    const double t14208 = df[2465];
-    const double t14219 = df[2184];
-    const double t14221 = df[2174];
-    const double t14223 = df[2191];
-    const double t14278 = df[891]*t1645;
-    const double t14287 = df[2194]*t3940;
-    const double t14606 = t14278+t14206*t1619+t14208*t4479+df[4029]*t7055+t14287+t713+t718+
+    const MBPOL_POLY_REAL t14593 = t4717*t37;
+    const MBPOL_POLY_REAL t14596 = t4749*t37;
+    const MBPOL_POLY_REAL t14600 = t848*t37;
+    const MBPOL_POLY_REAL t14206 = df[879];
+    const MBPOL_POLY_REAL t14208 = df[2465];
+    const MBPOL_POLY_REAL t14219 = df[2184];
+    const MBPOL_POLY_REAL t14221 = df[2174];
+    const MBPOL_POLY_REAL t14223 = df[2191];
+    const MBPOL_POLY_REAL t14278 = df[891]*t1645;
+    const MBPOL_POLY_REAL t14287 = df[2194]*t3940;
+    const MBPOL_POLY_REAL t14606 = t14278+t14206*t1619+t14208*t4479+df[4029]*t7055+t14287+t713+t718+
 t7493*(t4192+t4875+t4716+t4719+t14593)+t4135*(t4192+t4716+t4718+t4719+t14596)+
-t179*(2.0*t874+t849+t873+t843+t14600)+t4927+t4930+t14219*t3851+t14221*t3892+
+t179*(MBPOL_POLY_REAL(2)*t874+t849+t873+t843+t14600)+t4927+t4930+t14219*t3851+t14221*t3892+
 t14223*t3855;
-    const double t14225 = df[2187];
-    const double t14227 = df[64];
-    const double t14230 = df[433];
-    const double t14232 = df[429];
-    const double t14234 = df[442];
-    const double t14236 = df[438];
-    const double t14238 = df[2092];
-    const double t14241 = df[457]*t763;
-    const double t14245 = df[19];
-    const double t14247 = df[15];
-    const double t14250 = df[854]*t1574;
-    const double t14322 = df[9]*t28;
-    const double t14625 = t14225*t3890+t14227*t151+t14093+t14230*t501+t14232*t537+t14234*
+    const MBPOL_POLY_REAL t14225 = df[2187];
+    const MBPOL_POLY_REAL t14227 = df[64];
+    const MBPOL_POLY_REAL t14230 = df[433];
+    const MBPOL_POLY_REAL t14232 = df[429];
+    const MBPOL_POLY_REAL t14234 = df[442];
+    const MBPOL_POLY_REAL t14236 = df[438];
+    const MBPOL_POLY_REAL t14238 = df[2092];
+    const MBPOL_POLY_REAL t14241 = df[457]*t763;
+    const MBPOL_POLY_REAL t14245 = df[19];
+    const MBPOL_POLY_REAL t14247 = df[15];
+    const MBPOL_POLY_REAL t14250 = df[854]*t1574;
+    const MBPOL_POLY_REAL t14322 = df[9]*t28;
+    const MBPOL_POLY_REAL t14625 = t14225*t3890+t14227*t151+t14093+t14230*t501+t14232*t537+t14234*
 t760+t14236*t503+t14238*t3718+t14241+t14322+df[5]*t17+t14245*t52+t14247*t42+
 t14250;
-    const double t14253 = df[426];
-    const double t14255 = df[832];
-    const double t14257 = df[822];
-    const double t14259 = df[1673];
-    const double t14264 = df[1884];
-    const double t14266 = df[2382];
-    const double t14269 = df[1891];
-    const double t14272 = df[2358]*t4293;
-    const double t14273 = df[2350];
-    const double t14333 = df[838]*t1540;
-    const double t14336 = df[2386]*t4341;
-    const double t14351 = df[1895]*t3388;
-    const double t14643 = t14333+t14336+t14253*t520+t14255*t1502+t14257*t1505+t14259*t1932+
+    const MBPOL_POLY_REAL t14253 = df[426];
+    const MBPOL_POLY_REAL t14255 = df[832];
+    const MBPOL_POLY_REAL t14257 = df[822];
+    const MBPOL_POLY_REAL t14259 = df[1673];
+    const MBPOL_POLY_REAL t14264 = df[1884];
+    const MBPOL_POLY_REAL t14266 = df[2382];
+    const MBPOL_POLY_REAL t14269 = df[1891];
+    const MBPOL_POLY_REAL t14272 = df[2358]*t4293;
+    const MBPOL_POLY_REAL t14273 = df[2350];
+    const MBPOL_POLY_REAL t14333 = df[838]*t1540;
+    const MBPOL_POLY_REAL t14336 = df[2386]*t4341;
+    const MBPOL_POLY_REAL t14351 = df[1895]*t3388;
+    const MBPOL_POLY_REAL t14643 = t14333+t14336+t14253*t520+t14255*t1502+t14257*t1505+t14259*t1932+
 df[1919]*t3426+t14264*t3362+t14266*t4273+t14351+t14269*t3381+t14272+t14273*
 t4276+t8741*t669+df[422]*t480;
-    const double t14279 = df[641];
-    const double t14281 = df[2740];
-    const double t14284 = df[633];
-    const double t14286 = df[619];
-    const double t14288 = df[351];
-    const double t14290 = df[342];
-    const double t14292 = df[1052];
-    const double t14296 = df[315];
-    const double t14301 = df[2327]*t4199;
-    const double t14366 = df[649]*t1175;
-    const double t14384 = df[1030]*t1943;
-    const double t14388 = df[322]*t550;
-    const double t14395 = df[331]*t567;
-    const double t14660 = t14366+t14279*t1125+t14281*t758+t8534*t4975+t14284*t1101+t14286*
+    const MBPOL_POLY_REAL t14279 = df[641];
+    const MBPOL_POLY_REAL t14281 = df[2740];
+    const MBPOL_POLY_REAL t14284 = df[633];
+    const MBPOL_POLY_REAL t14286 = df[619];
+    const MBPOL_POLY_REAL t14288 = df[351];
+    const MBPOL_POLY_REAL t14290 = df[342];
+    const MBPOL_POLY_REAL t14292 = df[1052];
+    const MBPOL_POLY_REAL t14296 = df[315];
+    const MBPOL_POLY_REAL t14301 = df[2327]*t4199;
+    const MBPOL_POLY_REAL t14366 = df[649]*t1175;
+    const MBPOL_POLY_REAL t14384 = df[1030]*t1943;
+    const MBPOL_POLY_REAL t14388 = df[322]*t550;
+    const MBPOL_POLY_REAL t14395 = df[331]*t567;
+    const MBPOL_POLY_REAL t14660 = t14366+t14279*t1125+t14281*t758+t8534*t4975+t14284*t1101+t14286*
 t1128+t14288*t603+t14290*t587+t14292*t1978+t14384+t14388+t14296*t535+t14395+
 t14301;
-    const double t14668 = t3846*t37;
-    const double t14302 = df[1873];
-    const double t14304 = df[307];
-    const double t14306 = df[2339];
-    const double t14308 = df[1864];
-    const double t14310 = df[1847];
-    const double t14319 = df[1373];
-    const double t14324 = t14118;
-    const double t14325 = df[1782];
-    const double t14327 = df[2543];
-    const double t14417 = df[2522]*t4577;
-    const double t14683 = t14302*t3343+t14304*t522+t14306*t4243+t14308*t3320+t14310*t3294+df
-[2224]*t4014+t8160*(t14668+t3919+t3850+t3920+t3921)+t8694*(2.0*t2513+t2475+
+    const MBPOL_POLY_REAL t14668 = t3846*t37;
+    const MBPOL_POLY_REAL t14302 = df[1873];
+    const MBPOL_POLY_REAL t14304 = df[307];
+    const MBPOL_POLY_REAL t14306 = df[2339];
+    const MBPOL_POLY_REAL t14308 = df[1864];
+    const MBPOL_POLY_REAL t14310 = df[1847];
+    const MBPOL_POLY_REAL t14319 = df[1373];
+    const MBPOL_POLY_REAL t14324 = t14118;
+    const MBPOL_POLY_REAL t14325 = df[1782];
+    const MBPOL_POLY_REAL t14327 = df[2543];
+    const MBPOL_POLY_REAL t14417 = df[2522]*t4577;
+    const MBPOL_POLY_REAL t14683 = t14302*t3343+t14304*t522+t14306*t4243+t14308*t3320+t14310*t3294+df
+[2224]*t4014+t8160*(t14668+t3919+t3850+t3920+t3921)+t8694*(MBPOL_POLY_REAL(2)*t2513+t2475+
 t2832+t2823)+t14056+t14319*t1865+t14324+t13997+t14325*t3157+t14327*t4524+t14417
 ;
-    const double t14331 = df[1026];
-    const double t14337 = df[1298];
-    const double t14340 = df[788];
-    const double t14342 = df[780];
-    const double t14344 = df[157];
-    const double t14346 = df[3583];
-    const double t14352 = df[3552];
-    const double t14354 = df[3573];
-    const double t14356 = df[583];
-    const double t14419 = df[1319]*t2434;
-    const double t14422 = df[1237]*t2309;
-    const double t14424 = df[1378]*t2536;
-    const double t14427 = df[1785]*t3167;
-    const double t14702 = t14419+t14331*t1935+t14422+t14424+t14427+t14337*t1898+t8107*t6898+
-t14340*t1440+t14342*t1422+t14344*t260+t14346*t6530+t7776*(2.0*t6351+t6543+t6545
+    const MBPOL_POLY_REAL t14331 = df[1026];
+    const MBPOL_POLY_REAL t14337 = df[1298];
+    const MBPOL_POLY_REAL t14340 = df[788];
+    const MBPOL_POLY_REAL t14342 = df[780];
+    const MBPOL_POLY_REAL t14344 = df[157];
+    const MBPOL_POLY_REAL t14346 = df[3583];
+    const MBPOL_POLY_REAL t14352 = df[3552];
+    const MBPOL_POLY_REAL t14354 = df[3573];
+    const MBPOL_POLY_REAL t14356 = df[583];
+    const MBPOL_POLY_REAL t14419 = df[1319]*t2434;
+    const MBPOL_POLY_REAL t14422 = df[1237]*t2309;
+    const MBPOL_POLY_REAL t14424 = df[1378]*t2536;
+    const MBPOL_POLY_REAL t14427 = df[1785]*t3167;
+    const MBPOL_POLY_REAL t14702 = t14419+t14331*t1935+t14422+t14424+t14427+t14337*t1898+t8107*t6898+
+t14340*t1440+t14342*t1422+t14344*t260+t14346*t6530+t7776*(MBPOL_POLY_REAL(2)*t6351+t6543+t6545
 +t6348)+t14352*t6556+t14354*t6553+t14356*t1060;
-    const double t14359 = df[2000];
-    const double t14362 = df[579];
-    const double t14365 = df[571];
-    const double t14367 = df[567];
-    const double t14369 = df[562];
-    const double t14372 = df[555];
-    const double t14374 = df[137];
-    const double t14376 = df[2007];
-    const double t14381 = df[2493];
-    const double t14383 = df[2487];
-    const double t14452 = df[1983]*t3531;
-    const double t14469 = df[110]*t216;
-    const double t14472 = df[2508]*t4550;
-    const double t14718 = t8675*t3163+t14359*t3567+t14452+t14362*t1035+t14365*t1037+t14367*
+    const MBPOL_POLY_REAL t14359 = df[2000];
+    const MBPOL_POLY_REAL t14362 = df[579];
+    const MBPOL_POLY_REAL t14365 = df[571];
+    const MBPOL_POLY_REAL t14367 = df[567];
+    const MBPOL_POLY_REAL t14369 = df[562];
+    const MBPOL_POLY_REAL t14372 = df[555];
+    const MBPOL_POLY_REAL t14374 = df[137];
+    const MBPOL_POLY_REAL t14376 = df[2007];
+    const MBPOL_POLY_REAL t14381 = df[2493];
+    const MBPOL_POLY_REAL t14383 = df[2487];
+    const MBPOL_POLY_REAL t14452 = df[1983]*t3531;
+    const MBPOL_POLY_REAL t14469 = df[110]*t216;
+    const MBPOL_POLY_REAL t14472 = df[2508]*t4550;
+    const MBPOL_POLY_REAL t14718 = t8675*t3163+t14359*t3567+t14452+t14362*t1035+t14365*t1037+t14367*
 t1016+t14369*t1019+t8727*t960+t14372*t993+t14374*t258+t14376*t3290+t14469+
 t14472+t14381*t4527+t14383*t4417;
-    const double t14385 = df[2479];
-    const double t14387 = df[508];
-    const double t14389 = df[1107];
-    const double t14391 = df[498];
-    const double t14393 = df[490];
-    const double t14396 = df[2435];
-    const double t14398 = df[2424];
-    const double t14401 = df[2420];
-    const double t14409 = df[1088];
-    const double t14490 = df[2402]*t4376;
-    const double t14501 = df[1091]*t2053;
-    const double t14738 = t14385*t4475+t14387*t868+t14389*t2088+t14391*t605+t14393*t585+
+    const MBPOL_POLY_REAL t14385 = df[2479];
+    const MBPOL_POLY_REAL t14387 = df[508];
+    const MBPOL_POLY_REAL t14389 = df[1107];
+    const MBPOL_POLY_REAL t14391 = df[498];
+    const MBPOL_POLY_REAL t14393 = df[490];
+    const MBPOL_POLY_REAL t14396 = df[2435];
+    const MBPOL_POLY_REAL t14398 = df[2424];
+    const MBPOL_POLY_REAL t14401 = df[2420];
+    const MBPOL_POLY_REAL t14409 = df[1088];
+    const MBPOL_POLY_REAL t14490 = df[2402]*t4376;
+    const MBPOL_POLY_REAL t14501 = df[1091]*t2053;
+    const MBPOL_POLY_REAL t14738 = t14385*t4475+t14387*t868+t14389*t2088+t14391*t605+t14393*t585+
 t14396*t4246+t14398*t4419+t8612*t4160+t14401*t4268+t14490+t7816*(t1739*t37+
 t1732+t1568+t1738+t1741)+t14501+t8709*t1793+t14409*t2049;
-    const double t14751 = t21*t37;
-    const double t14414 = df[131];
-    const double t14429 = df[2718];
-    const double t14433 = df[1191];
-    const double t14435 = df[1186];
-    const double t14505 = df[2097]*t3735;
-    const double t14508 = df[689]*t1238;
-    const double t14522 = df[663]*t1203;
-    const double t14764 = t14505+t13927+t14508+t14414*t147+t7776*t6544*t37+t7671*t3562*t37+
-t8103*t4285*t37+t14522+(t12+t14+t16+t18+t14751)*t67+(2.0*t4928+t719+t1307+t716)
+    const MBPOL_POLY_REAL t14751 = t21*t37;
+    const MBPOL_POLY_REAL t14414 = df[131];
+    const MBPOL_POLY_REAL t14429 = df[2718];
+    const MBPOL_POLY_REAL t14433 = df[1191];
+    const MBPOL_POLY_REAL t14435 = df[1186];
+    const MBPOL_POLY_REAL t14505 = df[2097]*t3735;
+    const MBPOL_POLY_REAL t14508 = df[689]*t1238;
+    const MBPOL_POLY_REAL t14522 = df[663]*t1203;
+    const MBPOL_POLY_REAL t14764 = t14505+t13927+t14508+t14414*t147+t7776*t6544*t37+t7671*t3562*t37+
+t8103*t4285*t37+t14522+(t12+t14+t16+t18+t14751)*t67+(MBPOL_POLY_REAL(2)*t4928+t719+t1307+t716)
 *t26+t14429*t38+df[2715]*t3+t13898+t14433*t2084+t14435*t2178;
-    const double t14437 = df[1415];
-    const double t14440 = df[1420];
-    const double t14442 = df[606];
-    const double t14444 = df[595];
-    const double t14447 = df[1007];
-    const double t14454 = df[295];
-    const double t14457 = df[993];
-    const double t14459 = df[986];
-    const double t14461 = df[979];
-    const double t14540 = df[1393]*t2566;
-    const double t14559 = df[1605]*t2908;
-    const double t14782 = t14437*t2606+t14540+t14440*t2603+t14442*t1105+t14444*t1058+t14447*
+    const MBPOL_POLY_REAL t14437 = df[1415];
+    const MBPOL_POLY_REAL t14440 = df[1420];
+    const MBPOL_POLY_REAL t14442 = df[606];
+    const MBPOL_POLY_REAL t14444 = df[595];
+    const MBPOL_POLY_REAL t14447 = df[1007];
+    const MBPOL_POLY_REAL t14454 = df[295];
+    const MBPOL_POLY_REAL t14457 = df[993];
+    const MBPOL_POLY_REAL t14459 = df[986];
+    const MBPOL_POLY_REAL t14461 = df[979];
+    const MBPOL_POLY_REAL t14540 = df[1393]*t2566;
+    const MBPOL_POLY_REAL t14559 = df[1605]*t2908;
+    const MBPOL_POLY_REAL t14782 = t14437*t2606+t14540+t14440*t2603+t14442*t1105+t14444*t1058+t14447*
 t1902+t8545*t4868+t8200*t5557+df[291]*t477+t14559+t14454*t505+t8691*t1779+
 t14457*t1847+t14459*t1867+t14461*t1425;
-    const double t14783 = t1731*t37;
-    const double t14466 = df[2304];
-    const double t14468 = df[998];
-    const double t14470 = df[300];
-    const double t14473 = df[2283];
-    const double t14476 = df[2255];
-    const double t14478 = df[2603];
-    const double t14489 = df[1834];
-    const double t14579 = df[2297]*t4152;
-    const double t14582 = df[797]*t1461;
-    const double t14589 = df[2072]*t3681;
-    const double t14803 = t8442*(t1738+t1740+t1568+t1741+t14783)+t14466*t3265+t14468*t1442+
+    const MBPOL_POLY_REAL t14783 = t1731*t37;
+    const MBPOL_POLY_REAL t14466 = df[2304];
+    const MBPOL_POLY_REAL t14468 = df[998];
+    const MBPOL_POLY_REAL t14470 = df[300];
+    const MBPOL_POLY_REAL t14473 = df[2283];
+    const MBPOL_POLY_REAL t14476 = df[2255];
+    const MBPOL_POLY_REAL t14478 = df[2603];
+    const MBPOL_POLY_REAL t14489 = df[1834];
+    const MBPOL_POLY_REAL t14579 = df[2297]*t4152;
+    const MBPOL_POLY_REAL t14582 = df[797]*t1461;
+    const MBPOL_POLY_REAL t14589 = df[2072]*t3681;
+    const MBPOL_POLY_REAL t14803 = t8442*(t1738+t1740+t1568+t1741+t14783)+t14466*t3265+t14468*t1442+
 t14470*t498+t14579+t14473*t3868+t14582+t14476*t4052+t14478*t3242+df[288]*t473+
 t14589+t7501*t37+(t8+t2+t14+t4996+t14557)*t73+(t14+t12+t4992+t18+t14554)*t72+
 t14489*t3269;
-    const double t14813 = t7*t37;
-    const double t14491 = df[1824];
-    const double t14493 = df[963];
-    const double t14496 = df[959];
-    const double t14498 = df[934];
-    const double t14500 = df[930];
-    const double t14506 = df[2027];
-    const double t14509 = df[2046];
-    const double t14512 = df[2037];
-    const double t14605 = df[2058]*t3652;
-    const double t14612 = df[239]*t411;
-    const double t14617 = df[180]*t329;
-    const double t14822 = t14491*t3244+t14493*t1683+t14496*t1744+t14498*t1748+t14500*t1569+
+    const MBPOL_POLY_REAL t14813 = t7*t37;
+    const MBPOL_POLY_REAL t14491 = df[1824];
+    const MBPOL_POLY_REAL t14493 = df[963];
+    const MBPOL_POLY_REAL t14496 = df[959];
+    const MBPOL_POLY_REAL t14498 = df[934];
+    const MBPOL_POLY_REAL t14500 = df[930];
+    const MBPOL_POLY_REAL t14506 = df[2027];
+    const MBPOL_POLY_REAL t14509 = df[2046];
+    const MBPOL_POLY_REAL t14512 = df[2037];
+    const MBPOL_POLY_REAL t14605 = df[2058]*t3652;
+    const MBPOL_POLY_REAL t14612 = df[239]*t411;
+    const MBPOL_POLY_REAL t14617 = df[180]*t329;
+    const MBPOL_POLY_REAL t14822 = t14491*t3244+t14493*t1683+t14496*t1744+t14498*t1748+t14500*t1569+
 t14605+t8760*t377+(t14+t2+t16+t4996+t14813)*t50+t14506*t3341+t14612+t14509*
 t3322+t14512*t3377+t8220*t5529+t14617;
-    const double t14517 = df[1558];
-    const double t14519 = df[2242];
-    const double t14523 = df[3547];
-    const double t14534 = df[2598];
-    const double t14619 = df[1565]*t2853;
-    const double t14626 = df[92]*t192;
-    const double t14628 = df[68]*t158;
-    const double t14636 = df[1766]*t3122;
-    const double t14638 = df[3521]*t6481;
-    const double t14639 = t13625*t6448;
-    const double t14642 = df[44]*t106;
-    const double t14647 = df[696]*t1270;
-    const double t14840 = t14619+t14517*t2623+t14519*t4055+t14626+t14628+t14523*t6534+t13468
+    const MBPOL_POLY_REAL t14517 = df[1558];
+    const MBPOL_POLY_REAL t14519 = df[2242];
+    const MBPOL_POLY_REAL t14523 = df[3547];
+    const MBPOL_POLY_REAL t14534 = df[2598];
+    const MBPOL_POLY_REAL t14619 = df[1565]*t2853;
+    const MBPOL_POLY_REAL t14626 = df[92]*t192;
+    const MBPOL_POLY_REAL t14628 = df[68]*t158;
+    const MBPOL_POLY_REAL t14636 = df[1766]*t3122;
+    const MBPOL_POLY_REAL t14638 = df[3521]*t6481;
+    const MBPOL_POLY_REAL t14639 = t13625*t6448;
+    const MBPOL_POLY_REAL t14642 = df[44]*t106;
+    const MBPOL_POLY_REAL t14647 = df[696]*t1270;
+    const MBPOL_POLY_REAL t14840 = t14619+t14517*t2623+t14519*t4055+t14626+t14628+t14523*t6534+t13468
 *t2726+t8739*t1223+df[2956]*t715+t14636+t14638+t14639+t14642+t14534*t4193+
 t14647;
-    const double t14854 = t3844*t37;
-    const double t14537 = df[31];
-    const double t14539 = df[512];
-    const double t14541 = df[1943];
-    const double t14546 = df[2119];
-    const double t14549 = df[2115];
-    const double t14551 = df[2162];
-    const double t14555 = df[2166];
-    const double t14558 = df[1441];
-    const double t14564 = df[1461]*t2684;
-    const double t14565 = df[1453];
-    const double t14567 = df[1267];
-    const double t14570 = df[1252];
-    const double t14661 = df[2142]*t3808;
-    const double t14861 = t14537*t54+t14539*t865+t14541*t3364+t8770*(2.0*t36+t27+t70+t76)+
+    const MBPOL_POLY_REAL t14854 = t3844*t37;
+    const MBPOL_POLY_REAL t14537 = df[31];
+    const MBPOL_POLY_REAL t14539 = df[512];
+    const MBPOL_POLY_REAL t14541 = df[1943];
+    const MBPOL_POLY_REAL t14546 = df[2119];
+    const MBPOL_POLY_REAL t14549 = df[2115];
+    const MBPOL_POLY_REAL t14551 = df[2162];
+    const MBPOL_POLY_REAL t14555 = df[2166];
+    const MBPOL_POLY_REAL t14558 = df[1441];
+    const MBPOL_POLY_REAL t14564 = df[1461]*t2684;
+    const MBPOL_POLY_REAL t14565 = df[1453];
+    const MBPOL_POLY_REAL t14567 = df[1267];
+    const MBPOL_POLY_REAL t14570 = df[1252];
+    const MBPOL_POLY_REAL t14661 = df[2142]*t3808;
+    const MBPOL_POLY_REAL t14861 = t14537*t54+t14539*t865+t14541*t3364+t8770*(MBPOL_POLY_REAL(2)*t36+t27+t70+t76)+
 t14546*t3154+t14549*t3721+t14551*t3859+t14661+t14555*t3866+t14558*t2650+t7739*(
 t3915+t3850+t3920+t3921+t14854)+t14564+t14565*t2652+t14567*t2360+t14570*t1980;
-    const double t14875 = t8331*t2821*t37;
-    const double t14887 = t8770*t75*t37;
-    const double t14574 = df[1425];
-    const double t14576 = df[1284];
-    const double t14888 = t14574*t2626+t14576*t2357+t8741*t492*t37+t8727*t997*t37+t8739*
+    const MBPOL_POLY_REAL t14875 = t8331*t2821*t37;
+    const MBPOL_POLY_REAL t14887 = t8770*t75*t37;
+    const MBPOL_POLY_REAL t14574 = df[1425];
+    const MBPOL_POLY_REAL t14576 = df[1284];
+    const MBPOL_POLY_REAL t14888 = t14574*t2626+t14576*t2357+t8741*t492*t37+t8727*t997*t37+t8739*
 t1002*t37+t8709*t2173*t37+t8691*t1926*t37+t14875+t8534*t486*t37+t8675*t3571*t37
 +t8612*t4283*t37+t8220*t1880*t37+t8410*t2045*t37+t14887+t14561;
-    const double t14620 = t14278;
-    const double t14624 = t14351;
-    const double t14915 = t14321+t713+t718+t4917+t4135*(t14593+t4875+t4192+t4876)+t179*(2.0*
+    const MBPOL_POLY_REAL t14620 = t14278;
+    const MBPOL_POLY_REAL t14624 = t14351;
+    const MBPOL_POLY_REAL t14915 = t14321+t713+t718+t4917+t4135*(t14593+t4875+t4192+t4876)+t179*(MBPOL_POLY_REAL(2)*
 t862+t849+t843+t853*t26+t14600)+t7493*(t14596+t4192+t4718+t4876)+t8709*t2045*
 t37+t8691*t1880*t37+t8694*t2824*t26+t8675*t3562*t37+t14620+t14206*t1615+t14555*
 t3868+t14624;
-    const double t14629 = t14661;
-    const double t14641 = t14336;
-    const double t14645 = t14333;
-    const double t14943 = t14281*t760+t14551*t3855+t14629+t8534*t4974+t14269*t3377+t14264*
+    const MBPOL_POLY_REAL t14629 = t14661;
+    const MBPOL_POLY_REAL t14641 = t14336;
+    const MBPOL_POLY_REAL t14645 = t14333;
+    const MBPOL_POLY_REAL t14943 = t14281*t760+t14551*t3855+t14629+t8534*t4974+t14269*t3377+t14264*
 t3364+df[420]*t473+t14302*t3341+df[424]*t477+t8741*t662+t14198*t2111+t14641+
 t14266*t4276+t14250+t14645+t14255*t1505;
-    const double t14657 = t14417;
-    const double t14659 = t14472;
-    const double t14667 = df[1963]*t3503;
-    const double t14671 = t14160;
-    const double t14753 = df[1077]*t2026;
-    const double t14970 = t7739*(t3850+t3919+t3916+t14668)+t8220*t5528+t14196*t2113+t8103*
-t6822+t8323*(2.0*t2451+t2832+t2823)+t14227*t147+t14657+t14659+t14409*t2047+
+    const MBPOL_POLY_REAL t14657 = t14417;
+    const MBPOL_POLY_REAL t14659 = t14472;
+    const MBPOL_POLY_REAL t14667 = df[1963]*t3503;
+    const MBPOL_POLY_REAL t14671 = t14160;
+    const MBPOL_POLY_REAL t14753 = df[1077]*t2026;
+    const MBPOL_POLY_REAL t14970 = t7739*(t3850+t3919+t3916+t14668)+t8220*t5528+t14196*t2113+t8103*
+t6822+t8323*(MBPOL_POLY_REAL(2)*t2451+t2832+t2823)+t14227*t147+t14657+t14659+t14409*t2047+
 t14753+t14292*t1980+df[2506]*t4268+t14667+t8585*t4262+t14671;
-    const double t14675 = t14522;
-    const double t14680 = t14638;
-    const double t14691 = t14419;
-    const double t15000 = t14286*t1125+t14541*t3362+t14675+t14444*t1060+t14356*t1058+t14442*
+    const MBPOL_POLY_REAL t14675 = t14522;
+    const MBPOL_POLY_REAL t14680 = t14638;
+    const MBPOL_POLY_REAL t14691 = t14419;
+    const MBPOL_POLY_REAL t15000 = t14286*t1125+t14541*t3362+t14675+t14444*t1060+t14356*t1058+t14442*
 t1101+t14680+t14362*t1037+t14365*t1035+t14367*t1019+t14327*t4527+t14381*t4524+
 t14383*t4419+t14385*t4479+t14208*t4475+t14691;
-    const double t14698 = t14636;
-    const double t14700 = t14642;
-    const double t14705 = t14384;
-    const double t15028 = t14372*t1004+t8727*t959+df[552]*t993+t14537*t52+t14698+t14700+
+    const MBPOL_POLY_REAL t14698 = t14636;
+    const MBPOL_POLY_REAL t14700 = t14642;
+    const MBPOL_POLY_REAL t14705 = t14384;
+    const MBPOL_POLY_REAL t15028 = t14372*t1004+t8727*t959+df[552]*t993+t14537*t52+t14698+t14700+
 t14247*t38+t14245*t54+t14705+t14331*t1932+t8691*t1784+df[1023]*t1847+t14447*
 t1898+t14468*t1440+t14565*t2650;
-    const double t14719 = t7776*t6546;
-    const double t14812 = t8770*t80;
-    const double t15061 = t14369*t1016+t8612*t4285*t37+t8220*t1926*t37+t14719*t26+t8103*
+    const MBPOL_POLY_REAL t14719 = t7776*t6546;
+    const MBPOL_POLY_REAL t14812 = t8770*t80;
+    const MBPOL_POLY_REAL t15061 = t14369*t1016+t8612*t4285*t37+t8220*t1926*t37+t14719*t26+t8103*
 t4283*t37+t7671*t3571*t37+t8410*t2173*t37+t14812*t26+t8760*t492*t37+t8727*t1002
 *t37+t8739*t997*t37+t8442*t1739*t37+t8545*t486*t37+t14564+t14457*t1878+t14558*
 t2652;
-    const double t14749 = t14505;
-    const double t15090 = t14574*t2623+t14440*t2606+t14567*t2357+t14259*t1935+t14546*t3157+
+    const MBPOL_POLY_REAL t14749 = t14505;
+    const MBPOL_POLY_REAL t15090 = t14574*t2623+t14440*t2606+t14567*t2357+t14259*t1935+t14546*t3157+
 t14549*t3718+t14749+t14238*t3721+t8673*t3313+df[2088]*t3567+t14429*t42+df[2714]
-*t17+t4888*t67+(2.0*t4915+t719+t716)*t20+t4924*t26;
-    const double t14767 = t14617;
-    const double t14770 = t14395;
-    const double t14774 = t14501;
-    const double t14778 = t14582;
-    const double t15118 = df[2955]*t715+t14767+t14344*t258+t14770+t14288*t605+t14389*t2084+
+*t17+t4888*t67+(MBPOL_POLY_REAL(2)*t4915+t719+t716)*t20+t4924*t26;
+    const MBPOL_POLY_REAL t14767 = t14617;
+    const MBPOL_POLY_REAL t14770 = t14395;
+    const MBPOL_POLY_REAL t14774 = t14501;
+    const MBPOL_POLY_REAL t14778 = t14582;
+    const MBPOL_POLY_REAL t15118 = df[2955]*t715+t14767+t14344*t258+t14770+t14288*t605+t14389*t2084+
 t14774+t14570*t1978+t14257*t1502+t14778+t14340*t1442+t14308*t3322+t14310*t3290+
 t8708*t5609+t14272+t14489*t3265;
-    const double t14789 = t14422;
-    const double t14797 = t14589;
-    const double t14800 = t14469;
-    const double t14802 = t14626;
-    const double t14805 = t14628;
-    const double t14807 = df[1213]*t2269;
-    const double t15145 = t14273*t4273+t14306*t4246+t14301+t14789+t14374*t260+t14414*t151+df
+    const MBPOL_POLY_REAL t14789 = t14422;
+    const MBPOL_POLY_REAL t14797 = t14589;
+    const MBPOL_POLY_REAL t14800 = t14469;
+    const MBPOL_POLY_REAL t14802 = t14626;
+    const MBPOL_POLY_REAL t14805 = t14628;
+    const MBPOL_POLY_REAL t14807 = df[1213]*t2269;
+    const MBPOL_POLY_REAL t15145 = t14273*t4273+t14306*t4246+t14301+t14789+t14374*t260+t14414*t151+df
 [2669]*t4193+t14290*t585+t8545*t4867+t14797+t14342*t1425+t14800+t14802+t14805+
 t14807;
-    const double t14811 = t14647;
-    const double t14814 = t14508;
-    const double t14820 = t14579;
-    const double t14826 = df[1807]*t3213;
-    const double t14828 = t14427;
-    const double t14830 = t14605;
-    const double t14833 = t14559;
-    const double t15170 = t14433*t2088+t14435*t2182+t14811+t14814+t8739*t1201+df[713]*t1306+
+    const MBPOL_POLY_REAL t14811 = t14647;
+    const MBPOL_POLY_REAL t14814 = t14508;
+    const MBPOL_POLY_REAL t14820 = t14579;
+    const MBPOL_POLY_REAL t14826 = df[1807]*t3213;
+    const MBPOL_POLY_REAL t14828 = t14427;
+    const MBPOL_POLY_REAL t14830 = t14605;
+    const MBPOL_POLY_REAL t14833 = t14559;
+    const MBPOL_POLY_REAL t15170 = t14433*t2088+t14435*t2182+t14811+t14814+t8739*t1201+df[713]*t1306+
 t14466*t3269+t14820+t14473*t3866+t14437*t2603+t14491*t3242+t14826+t14828+t14830
 +t14509*t3320+t14833;
-    const double t14842 = t14540;
-    const double t14845 = t14322;
-    const double t14905 = df[2220]*t4014;
-    const double t15200 = t14325*t3154+t14476*t4055+t14478*t3244+t14534*t4715+t14519*t4052+
+    const MBPOL_POLY_REAL t14842 = t14540;
+    const MBPOL_POLY_REAL t14845 = t14322;
+    const MBPOL_POLY_REAL t14905 = df[2220]*t4014;
+    const MBPOL_POLY_REAL t15200 = t14325*t3154+t14476*t4055+t14478*t3244+t14534*t4715+t14519*t4052+
 t14905+t14842+t14461*t1422+t14845+df[7]*t15+df[3]*t13+df[2]*t3+t12879*t6448+
 t14493*t1680+t14496*t1748;
-    const double t14862 = t14366;
-    const double t14871 = t14275;
-    const double t15228 = t14279*t1128+t14284*t1105+df[284]*t480+t14862+t8760*t376+t14539*
+    const MBPOL_POLY_REAL t14862 = t14366;
+    const MBPOL_POLY_REAL t14871 = t14275;
+    const MBPOL_POLY_REAL t15228 = t14279*t1128+t14284*t1105+df[284]*t480+t14862+t8760*t376+t14539*
 t868+t14387*t865+t8442*t1554+df[928]*t1569+t14200*t1619+t14871+t8218*t7033+
 t14219*t3848+df[2182]*t3851+t14187*t896+t14391*t603;
-    const double t14881 = t14251;
-    const double t14884 = t14262;
-    const double t14886 = t14612;
-    const double t14892 = t14087;
-    const double t15257 = t14393*t587+t14881+t14183*t2178+t14884+t14886+t14498*t1744+t14221*
+    const MBPOL_POLY_REAL t14881 = t14251;
+    const MBPOL_POLY_REAL t14884 = t14262;
+    const MBPOL_POLY_REAL t14886 = t14612;
+    const MBPOL_POLY_REAL t14892 = t14087;
+    const MBPOL_POLY_REAL t15257 = t14393*t587+t14881+t14183*t2178+t14884+t14886+t14498*t1744+t14221*
 t3890+t14195+t14892+t14241+df[286]*t484+t14185*t894+t14203*t1683+t14500*t1737+
 t14234*t758;
-    const double t15281 = t5539*t50;
-    const double t15284 = t5537*t67;
-    const double t14907 = t14490;
-    const double t14923 = t13770*t2782;
-    const double t15290 = t14236*t498+t14253*t522+t14396*t4243+t14230*t505+t14232*t535+
-t14398*t4417+t14401*t4287+t14907+t8770*(2.0*t22+t70+t76)+t14459*t1865+t7446*t50
+    const MBPOL_POLY_REAL t15281 = t5539*t50;
+    const MBPOL_POLY_REAL t15284 = t5537*t67;
+    const MBPOL_POLY_REAL t14907 = t14490;
+    const MBPOL_POLY_REAL t14923 = t13770*t2782;
+    const MBPOL_POLY_REAL t15290 = t14236*t498+t14253*t522+t14396*t4243+t14230*t505+t14232*t535+
+t14398*t4417+t14401*t4287+t14907+t8770*(MBPOL_POLY_REAL(2)*t22+t70+t76)+t14459*t1865+t7446*t50
 +(t714+t1305+t5425+t1304*t26)*t37+(t12+t16+t4993+t14751+t15281)*t73+(t2+t16+t9+
 t14813+t15284)*t72+t14923+t8160*(t14854+t3850+t3915+t3916);
-    const double t14929 = t14267;
-    const double t14931 = t14287;
-    const double t14947 = t14424;
-    const double t15322 = t14223*t3859+t14225*t3892+t14929+t14931+t14337*t1902+t8372*t1976+
-df[1293]*t2049+t14576*t2360+t7776*(2.0*t6404+t6545+t6543+t6544*t37)+t14506*
+    const MBPOL_POLY_REAL t14929 = t14267;
+    const MBPOL_POLY_REAL t14931 = t14287;
+    const MBPOL_POLY_REAL t14947 = t14424;
+    const MBPOL_POLY_REAL t15322 = t14223*t3859+t14225*t3892+t14929+t14931+t14337*t1902+t8372*t1976+
+df[1293]*t2049+t14576*t2360+t7776*(MBPOL_POLY_REAL(2)*t6404+t6545+t6543+t6544*t37)+t14506*
 t3343+t14376*t3294+t14512*t3381+t14359*t3565+t14947+t14319*t1867+t7816*(t14783+
 t1740+t1568+t1733);
-    const double t14953 = t14452;
-    const double t14955 = t14619;
-    const double t14959 = t14388;
-    const double t15346 = t14324+t14354*t6556+t14953+t14955+t14523*t6530+t14517*t2626+t14959
+    const MBPOL_POLY_REAL t14953 = t14452;
+    const MBPOL_POLY_REAL t14955 = t14619;
+    const MBPOL_POLY_REAL t14959 = t14388;
+    const MBPOL_POLY_REAL t15346 = t14324+t14354*t6556+t14953+t14955+t14523*t6530+t14517*t2626+t14959
 +t14296*t537+t14470*t503+t14454*t501+t14346*t6534+t14304*t520+t14352*t6553+
 t14875+t14887+t14561;
-    const double t15377 = t14321+t713+t179*(2.0*t859+t843+t853*t37)+t4943+t14767+t13818*t260
-+t13868*t54+t13870*t258+t13846*t1442+df[994]*t1880+t13820*t1867+df[977]*(2.0*
+    const MBPOL_POLY_REAL t15377 = t14321+t713+t179*(MBPOL_POLY_REAL(2)*t859+t843+t853*t37)+t4943+t14767+t13818*t260
++t13868*t54+t13870*t258+t13846*t1442+df[994]*t1880+t13820*t1867+df[977]*(MBPOL_POLY_REAL(2)*
 t1754+t1846)+t14812*t37+t8331*t2824*t37;
-    const double t15407 = t14719*t37+t13822*t1425+t14171*t894+t13825*t1737+t14176*t868+
+    const MBPOL_POLY_REAL t15407 = t14719*t37+t13822*t1425+t14171*t894+t13825*t1737+t14176*t868+
 t14144*t865+df[506]*t848+t13883*t758+t14007*t1935+t13956*t4246+t14667+t14094*
 t3364+t13958*t4419+df[2421]*t4285+t14671;
-    const double t15441 = t13865*t151+t14800+t14802+t14749+t14090*t3718+df[2087]*t3571+df
-[2684]*(2.0*t4865+t479)+t14955+t14010*t2626+df[1553]*t2821+t14624+t14102*t3377+
+    const MBPOL_POLY_REAL t15441 = t13865*t151+t14800+t14802+t14749+t14090*t3718+df[2087]*t3571+df
+[2684]*(MBPOL_POLY_REAL(2)*t4865+t479)+t14955+t14010*t2626+df[1553]*t2821+t14624+t14102*t3377+
 t14097*t3362+t14099*t3343+t14884;
-    const double t15474 = t13916*t2111+df[712]*t1304+t14811+t13975*t1128+t13977*t1105+df
-[2348]*(2.0*t4109+t4267)+t13969*t4287+t13964*t4273+df[2668]*t4749+t13966*t4243+
+    const MBPOL_POLY_REAL t15474 = t13916*t2111+df[712]*t1304+t14811+t13975*t1128+t13977*t1105+df
+[2348]*(MBPOL_POLY_REAL(2)*t4109+t4267)+t13969*t4287+t13964*t4273+df[2668]*t4749+t13966*t4243+
 df[2330]*t4199+t13947*t147+t14700+df[28]*t75+t14789;
-    const double t15505 = t13899*t1980+t13924*t1932+df[4]*t15+df[1]*t7+t14828+t13999*t3154+
+    const MBPOL_POLY_REAL t15505 = t13899*t1980+t13924*t1932+df[4]*t15+df[1]*t7+t14828+t13999*t3154+
 t14698+df[1022]*t1926+t13944*t4475+t14645+t13940*t4417+t13942*t4479+t13930*
 t1898+t13938*t4524;
-    const double t15538 = t14126*t3565+t14129*t3294+df[1999]*t3562+t14953+t13903*t2088+
-t13905*t2182+t13918*t2047+t14691+t14881+t13914*t2178+t7913*(2.0*t4+t2)+df[2183]
+    const MBPOL_POLY_REAL t15538 = t14126*t3565+t14129*t3294+df[1999]*t3562+t14953+t13903*t2088+
+t13905*t2182+t13918*t2047+t14691+t14881+t13914*t2178+t7913*(MBPOL_POLY_REAL(2)*t4+t2)+df[2183]
 *t3844+t14082*t3890+df[2181]*t3846+t14076*t3892;
-    const double t15572 = t14078*t3866+t14072*t3855+t14074*t3848+t13863*t1502+t13859*t1505+
-t14629+t14047*t1902+df[1292]*t2173+t14042*t2357+df[1283]*(2.0*t1940+t2044)+
+    const MBPOL_POLY_REAL t15572 = t14078*t3866+t14072*t3855+t14074*t3848+t13863*t1502+t13859*t1505+
+t14629+t14047*t1902+df[1292]*t2173+t14042*t2357+df[1283]*(MBPOL_POLY_REAL(2)*t1940+t2044)+
 t14044*t2360+t14778+t13872*t1440+df[554]*t1002+df[551]*t997;
-    const double t15608 = df[550]*(2.0*t956+t992)+df[2086]*(2.0*t3287+t3564)+t14797+t8694*(
-2.0*t2533+t2823)+t13874*t1422+t13988*t1004+df[2599]*t4717+t13932*t4715+t13934*
+    const MBPOL_POLY_REAL t15608 = df[550]*(MBPOL_POLY_REAL(2)*t956+t992)+df[2086]*(MBPOL_POLY_REAL(2)*t3287+t3564)+t14797+t8694*(
+MBPOL_POLY_REAL(2)*t2533+t2823)+t13874*t1422+t13988*t1004+df[2599]*t4717+t13932*t4715+t13934*
 t3242+t14830+t14119*t3322+t14121*t3381+t14124*t3341+t14833+t14179*t760;
-    const double t15642 = t14148*t42+df[2713]*t21+t7921*(2.0*t4952+t12)+(2.0*t4941+t719)*t5+
+    const MBPOL_POLY_REAL t15642 = t14148*t42+df[2713]*t21+t7921*(MBPOL_POLY_REAL(2)*t4952+t12)+(MBPOL_POLY_REAL(2)*t4941+t719)*t5+
 t14152*t605+t14154*t585+df[418]*t715+t14907+t13985+t8506*t655+t14641+t14805+
 t13960*t4276+df[2357]*t4293;
-    const double t15668 = t7479*t37+t14156*t520+t14162*t537+t14164*t503+t14159*t501+df[2686]
+    const MBPOL_POLY_REAL t15668 = t7479*t37+t14156*t520+t14162*t537+t14164*t503+t14159*t501+df[2686]
 *t492+t14070*t3157+t14173*t896+t14040*t2623+t14141+t15284*t73+t15281*t72+t13979
 *t1125+t13982*t1101+t13892*t1035;
-    const double t15702 = t13855*t6556+t13881*t1058+t13890*t1060+df[3550]*t6544+t13836*t6553
+    const MBPOL_POLY_REAL t15702 = t13855*t6556+t13881*t1058+t13890*t1060+df[3550]*t6544+t13836*t6553
 +df[2954]*t1306+t14753+t14035*t2606+t14038*t2603+t14842+t14947+t14053*t1865+df
-[287]*t486+df[283]*t477+df[282]*(2.0*t372+t472);
-    const double t15734 = t13840*t1615+t14657+t14115*t3721+t13838*t6530+t14659+df[2505]*
-t4283+df[852]*(2.0*t1343+t1568)+t14639+df[853]*t1574+t13888*t1037+t13928*t1978+
+[287]*t486+df[283]*t477+df[282]*(MBPOL_POLY_REAL(2)*t372+t472);
+    const MBPOL_POLY_REAL t15734 = t13840*t1615+t14657+t14115*t3721+t13838*t6530+t14659+df[2505]*
+t4283+df[852]*(MBPOL_POLY_REAL(2)*t1343+t1568)+t14639+df[853]*t1574+t13888*t1037+t13928*t1978+
 t13911*t1019+t13894*t1016+t14132*t52+t14134*t38;
-    const double t15765 = t14845+df[6]*t13+t14862+t14886+t14814+t14675+t14905+t14680+t14049*
+    const MBPOL_POLY_REAL t15765 = t14845+df[6]*t13+t14862+t14886+t14814+t14675+t14905+t14680+t14049*
 t1878+t14931+t14080*t3859+df[1363]*t2508+t14929+t14705;
-    const double t15803 = t8770*(2.0*t19+t70)+t14923+t14104*t3320+t7776*(2.0*t6361+t6543)+
-t13832*t6534+t13909*t2113+t13920*t2084+t14774+df[1087]*t2045+df[2311]*(2.0*
-t4085+t4192)+t14108*t3265+t14106*t3290+t13994*t3244+df[2295]*(2.0*t3864+t3850)+
+    const MBPOL_POLY_REAL t15803 = t8770*(MBPOL_POLY_REAL(2)*t19+t70)+t14923+t14104*t3320+t7776*(MBPOL_POLY_REAL(2)*t6361+t6543)+
+t13832*t6534+t13909*t2113+t13920*t2084+t14774+df[1087]*t2045+df[2311]*(MBPOL_POLY_REAL(2)*
+t4085+t4192)+t14108*t3265+t14106*t3290+t13994*t3244+df[2295]*(MBPOL_POLY_REAL(2)*t3864+t3850)+
 t14060*t3269;
-    const double t15835 = t14820+t13848*t1683+t13951*t4527+t13827*t1748+t13834*t1744+df[931]
+    const MBPOL_POLY_REAL t15835 = t14820+t13848*t1683+t13951*t4527+t13827*t1748+t13834*t1744+df[931]
 *t1739+df[927]*t1731+t14062*t4055+t14064*t4052+t13852*t1619+t14067*t3868+t13992
 *t603+t14001*t587+t14770+t14959;
-    const double t15863 = t14028*t505+t14030*t498+t14018*t535+t14024*t2652+t14020*t522+df
+    const MBPOL_POLY_REAL t15863 = t14028*t505+t14030*t498+t14018*t535+t14024*t2652+t14020*t522+df
 [290]*t484+t14892+t14826+t14871+t14564+t13843*t1680+t14026*t2650+t14620+t14807+
 t14561;
-    const double t15280 = t8881+t7705*t6859+t7874*t2351+df[2611]*t3199+t633+t8805+df[1207]*
+    const MBPOL_POLY_REAL t15280 = t8881+t7705*t6859+t7874*t2351+df[2611]*t3199+t633+t8805+df[1207]*
 t2033+df[1265]*t2303+t8370*t2069+df[1346]*t2480+df[1527]*t2785+t8914;
-    const double t15297 = t8943+df[1981]*t3461+t8217*t3151+df[1736]*t2787+t7847*t5646+t7846*
+    const MBPOL_POLY_REAL t15297 = t8943+df[1981]*t3461+t8217*t3151+df[1736]*t2787+t7847*t5646+t7846*
 t1495+t8284*t2755+t8282*t2816+t8275*t3201+t8446*t1757+df[1084]*t2037+t8971;
-    const double t15326 = t9000+t9036+t9075+t9107+df[1953]*t3486+df[1980]*t3524+df[819]*
+    const MBPOL_POLY_REAL t15326 = t9000+t9036+t9075+t9107+df[1953]*t3486+df[1980]*t3524+df[819]*
 t1495+df[2325]*t4222+df[1082]*t2033+df[3593]*t6444+df[2629]*t3481+df[2654]*
 t3600+df[2582]*t4226+df[2592]*t4215+df[407]*t141+df[1697]*t2720+df[2274]*t4007;
-    const double t15351 = df[2280]*t4018+df[2291]*t4005+df[2936]*t2256+df[2945]*t2039+df
+    const MBPOL_POLY_REAL t15351 = df[2280]*t4018+df[2291]*t4005+df[2936]*t2256+df[2945]*t2039+df
 [939]*t1757+t8066*t4668+t8086*t4545+t7816*t6051+t7615*t7287+t7661*t7017+t7809*
 t6110+t8823*t1761+t7952*t5305+t8826*t4012+t8160*t3901+df[973]*t1610+t8217*t3138
 ;
-    const double t15358 = t9954+t9970+t9987+t10004+t10021+t10038+t10055+t10072+t10091+t10107
+    const MBPOL_POLY_REAL t15358 = t9954+t9970+t9987+t10004+t10021+t10038+t10055+t10072+t10091+t10107
 +t10124+t10143+t10161+t10177+t10195+t10210;
-    const double t15359 = t10231+t10239+t10257+t10276+t10296+t10313+t10331+t10350+t10370+
+    const MBPOL_POLY_REAL t15359 = t10231+t10239+t10257+t10276+t10296+t10313+t10331+t10350+t10370+
 t10387+t10407+t10425+t10445+t10462+t10480+t10497;
-    const double t15360 = t10519+t10520+t10522+t10523+t10544+t10564+t10588+t10608+t10631+
+    const MBPOL_POLY_REAL t15360 = t10519+t10520+t10522+t10523+t10544+t10564+t10588+t10608+t10631+
 t10652+t10673+t10695+t10720+t10743+t10766+t10789;
-    const double t15361 = t10812+t10813+t10815+t10821+t10851+t10881+t10911+t10947+t10981+
+    const MBPOL_POLY_REAL t15361 = t10812+t10813+t10815+t10821+t10851+t10881+t10911+t10947+t10981+
 t11012+t11047+t11075+t11109+t11138+t11171+t11203;
-    const double t15362 = t11219+t11240+t11261+t11278+t11298+t11316+t11337+t11357+t11381+
+    const MBPOL_POLY_REAL t15362 = t11219+t11240+t11261+t11278+t11298+t11316+t11337+t11357+t11381+
 t11398+t11419+t11441+t11460+t11481+t11501+t11521;
-    const double t15363 = t11534+t11551+t11573+t11597+t11623+t11646+t11674+t11698+t11727+
+    const MBPOL_POLY_REAL t15363 = t11534+t11551+t11573+t11597+t11623+t11646+t11674+t11698+t11727+
 t11750+t11775+t11801+t11824+t11847+t11868+t11891;
-    const double t15364 = t11905+t11906+t11908+t11925+t11953+t11977+t12005+t12035+t12065+
+    const MBPOL_POLY_REAL t15364 = t11905+t11906+t11908+t11925+t11953+t11977+t12005+t12035+t12065+
 t12091+t12117+t12141+t12168+t12194+t12219+t12244;
-    const double t15365 = t12275+t12276+t12278+t12287+t12320+t12358+t12392+t12425+t12464+
+    const MBPOL_POLY_REAL t15365 = t12275+t12276+t12278+t12287+t12320+t12358+t12392+t12425+t12464+
 t12498+t12528+t12565+t12601+t12637+t12668+t12700;
-    const double t15366 = t12718+t12735+t12751+t12769+t12788+t12811+t12829+t12850+t12870+
+    const MBPOL_POLY_REAL t15366 = t12718+t12735+t12751+t12769+t12788+t12811+t12829+t12850+t12870+
 t12887+t12909+t12933+t12950+t12967+t12987+t13009;
-    const double t15367 = t13040+t13047+t13071+t13098+t13127+t13156+t13185+t13214+t13241+
+    const MBPOL_POLY_REAL t15367 = t13040+t13047+t13071+t13098+t13127+t13156+t13185+t13214+t13241+
 t13267+t13297+t13326+t13354+t13381+t13407+t13438;
-    const double t15368 = t13459+t13476+t13498+t13523+t13541+t13561+t13578+t13598+t13617+
+    const MBPOL_POLY_REAL t15368 = t13459+t13476+t13498+t13523+t13541+t13561+t13578+t13598+t13617+
 t13638+t13658+t13679+t13699+t13724+t13744+t13765;
-    const double t15369 = t13783+t13809+t13842+t13877+t13913+t13948+t13981+t14015+t14050+
+    const MBPOL_POLY_REAL t15369 = t13783+t13809+t13842+t13877+t13913+t13948+t13981+t14015+t14050+
 t14085+t14122+t14158+t14194+t14229+t14263+t14299;
-    const double t15370 = t14320+t14335+t14350+t14363+t14379+t14394+t14410+t14426+t14446+
+    const MBPOL_POLY_REAL t15370 = t14320+t14335+t14350+t14363+t14379+t14394+t14410+t14426+t14446+
 t14463+t14479+t14495+t14511+t14528+t14548+t14568;
-    const double t15371 = t14587+t14606+t14625+t14643+t14660+t14683+t14702+t14718+t14738+
+    const MBPOL_POLY_REAL t15371 = t14587+t14606+t14625+t14643+t14660+t14683+t14702+t14718+t14738+
 t14764+t14782+t14803+t14822+t14840+t14861+t14888;
-    const double t15372 = t14915+t14943+t14970+t15000+t15028+t15061+t15090+t15118+t15145+
+    const MBPOL_POLY_REAL t15372 = t14915+t14943+t14970+t15000+t15028+t15061+t15090+t15118+t15145+
 t15170+t15200+t15228+t15257+t15290+t15322+t15346;
-    const double t15373 = t15377+t15407+t15441+t15474+t15505+t15538+t15572+t15608+t15642+
+    const MBPOL_POLY_REAL t15373 = t15377+t15407+t15441+t15474+t15505+t15538+t15572+t15608+t15642+
 t15668+t15702+t15734+t15765+t15803+t15835+t15863;
 
     g[0] = t6837+t7679+t7387;
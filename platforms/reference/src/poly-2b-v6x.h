@@ -1,13 +1,19 @@
 #ifndef POLY_2B_V6X_H
 #define POLY_2B_V6X_H
 
+// the build's floating point type: double, or float for the single precision
+// builds of the mixed precision mode (poly-*-single*.cpp)
+
+#ifndef MBPOL_POLY_REAL
+#define MBPOL_POLY_REAL double
+#endif
 
 //
 // this is the polynomial used by x2b_v6<4> (including gradients)
 //
 
-double poly_2b_v6x_eval(const double a[1153],
-                         const double x[31],
-                               double g[31]);
+MBPOL_POLY_REAL poly_2b_v6x_eval(const MBPOL_POLY_REAL a[1153],
+                                 const MBPOL_POLY_REAL x[31],
+                                       MBPOL_POLY_REAL g[31]);
 
 #endif // POLY_2B_V6X_H
@@ -0,0 +1,19 @@
+//
+// poly-3b-v2x.cpp built for avx512; compile flags are set in
+// platforms/reference/CMakeLists.txt, selection happens in poly-dispatch.cpp
+//
+
+#ifdef MBPOL_POLY_ISA_DISPATCH
+
+#define poly_3b_v2x poly_3b_v2x_avx512
+#include "poly-3b-v2x.cpp"
+#undef poly_3b_v2x
+
+double poly_3b_v2x_eval_avx512(const double a[1163],
+                             const double x[36],
+                                   double g[36])
+{
+    return poly_3b_v2x_avx512::eval(a, x, g);
+}
+
+#endif
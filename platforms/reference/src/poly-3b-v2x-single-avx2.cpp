@@ -0,0 +1,22 @@
+//
+// poly-3b-v2x.cpp built in single precision for avx2; compile flags are set in
+// platforms/reference/CMakeLists.txt, selection happens in poly-dispatch.cpp
+//
+
+#ifdef MBPOL_POLY_ISA_DISPATCH
+
+#define MBPOL_POLY_REAL float
+#define poly_3b_v2x poly_3b_v2x_single_avx2
+#include "poly-3b-v2x.cpp"
+#undef poly_3b_v2x
+
+float poly_3b_v2x_eval_single_avx2(const float a[1163],
+                                   const float x[36],
+                                         float g[36])
+{
+    return poly_3b_v2x_single_avx2::eval(a, x, g);
+}
+
+#undef MBPOL_POLY_REAL
+
+#endif
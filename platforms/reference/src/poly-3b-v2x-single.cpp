@@ -0,0 +1,18 @@
+//
+// poly-3b-v2x.cpp built in single precision for the mixed precision mode,
+// selection happens in poly-dispatch.cpp
+//
+
+#define MBPOL_POLY_REAL float
+#define poly_3b_v2x poly_3b_v2x_single
+#include "poly-3b-v2x.cpp"
+#undef poly_3b_v2x
+
+float poly_3b_v2x_eval_single(const float a[1163],
+                              const float x[36],
+                                    float g[36])
+{
+    return poly_3b_v2x_single::eval(a, x, g);
+}
+
+#undef MBPOL_POLY_REAL
@@ -1,6 +1,13 @@
 #ifndef POLY_3B_V2X_H
 #define POLY_3B_V2X_H
 
+// the build's floating point type: double, or float for the single precision
+// builds of the mixed precision mode (poly-*-single*.cpp)
+
+#ifndef MBPOL_POLY_REAL
+#define MBPOL_POLY_REAL double
+#endif
+
 //
 // this is the polynomial used by x3b_v2 (including gradients)
 //
@@ -9,12 +16,12 @@ struct poly_3b_v2x {
     static const unsigned n_vars = 36;
     static const unsigned size = 1163;
 
-    static double eval(const double a[1163],
-                       const double x[36]);
+    static MBPOL_POLY_REAL eval(const MBPOL_POLY_REAL a[1163],
+                                const MBPOL_POLY_REAL x[36]);
 
-    static double eval(const double a[1163],
-                       const double x[36],
-                             double g[36]);
+    static MBPOL_POLY_REAL eval(const MBPOL_POLY_REAL a[1163],
+                                const MBPOL_POLY_REAL x[36],
+                                      MBPOL_POLY_REAL g[36]);
 };
 
 #endif // POLY_3B_V2X_H
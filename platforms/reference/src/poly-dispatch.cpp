@@ -0,0 +1,114 @@
+#include "poly-dispatch.h"
+#include "poly-2b-v6x.h"
+#include "poly-3b-v2x.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/MBPolTwoBodyForceImpl.h"
+
+#include <cstdlib>
+#include <string>
+#include <cstring>
+
+namespace MBPolPlugin {
+
+typedef double (*Poly2BFunction)(const double a[1153], const double x[31], double g[31]);
+typedef double (*Poly3BFunction)(const double a[1163], const double x[36], double g[36]);
+typedef float (*Poly2BSingleFunction)(const float a[1153], const float x[31], float g[31]);
+typedef float (*Poly3BSingleFunction)(const float a[1163], const float x[36], float g[36]);
+
+static double poly_3b_v2x_eval_generic(const double a[1163], const double x[36], double g[36]) {
+    return poly_3b_v2x::eval(a, x, g);
+}
+
+static PolynomialIsa  currentIsa = PolynomialIsaGeneric;
+static Poly2BFunction currentPoly2B = poly_2b_v6x_eval;
+static Poly3BFunction currentPoly3B = poly_3b_v2x_eval_generic;
+static Poly2BSingleFunction currentPoly2BSingle = poly_2b_v6x_eval_single;
+static Poly3BSingleFunction currentPoly3BSingle = poly_3b_v2x_eval_single;
+
+const char* getPolynomialIsaName(PolynomialIsa isa) {
+    switch (isa) {
+        case PolynomialIsaAVX2:   return "avx2";
+        case PolynomialIsaAVX512: return "avx512";
+        default:                  return "generic";
+    }
+}
+
+bool isPolynomialIsaAvailable(PolynomialIsa isa) {
+    if (isa == PolynomialIsaGeneric)
+        return true;
+#if defined(MBPOL_POLY_ISA_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (isa == PolynomialIsaAVX2)
+        return avx2;
+    if (isa == PolynomialIsaAVX512)
+        return avx2 && __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+void setPolynomialIsa(PolynomialIsa isa) {
+    if (!isPolynomialIsaAvailable(isa))
+        throw OpenMM::OpenMMException(std::string("MBPol polynomials are not available for instruction set ") + getPolynomialIsaName(isa));
+    currentIsa = isa;
+    MBPolTwoBodyForceImpl::setPolynomialInstructionSet(getPolynomialIsaName(isa));
+    switch (isa) {
+#ifdef MBPOL_POLY_ISA_DISPATCH
+        case PolynomialIsaAVX2:
+            currentPoly2B = poly_2b_v6x_eval_avx2;
+            currentPoly3B = poly_3b_v2x_eval_avx2;
+            currentPoly2BSingle = poly_2b_v6x_eval_single_avx2;
+            currentPoly3BSingle = poly_3b_v2x_eval_single_avx2;
+            break;
+        case PolynomialIsaAVX512:
+            currentPoly2B = poly_2b_v6x_eval_avx512;
+            currentPoly3B = poly_3b_v2x_eval_avx512;
+            currentPoly2BSingle = poly_2b_v6x_eval_single_avx512;
+            currentPoly3BSingle = poly_3b_v2x_eval_single_avx512;
+            break;
+#endif
+        default:
+            currentPoly2B = poly_2b_v6x_eval;
+            currentPoly3B = poly_3b_v2x_eval_generic;
+            currentPoly2BSingle = poly_2b_v6x_eval_single;
+            currentPoly3BSingle = poly_3b_v2x_eval_single;
+    }
+}
+
+PolynomialIsa selectPolynomialIsa() {
+    PolynomialIsa maxIsa = PolynomialIsaAVX512;
+    const char* requested = std::getenv("MBPOL_POLYNOMIAL_ISA");
+    if (requested != NULL) {
+        if (std::strcmp(requested, "generic") == 0)
+            maxIsa = PolynomialIsaGeneric;
+        else if (std::strcmp(requested, "avx2") == 0)
+            maxIsa = PolynomialIsaAVX2;
+    }
+    PolynomialIsa isa = maxIsa;
+    while (!isPolynomialIsaAvailable(isa))
+        isa = static_cast<PolynomialIsa>(isa - 1);
+    setPolynomialIsa(isa);
+    return isa;
+}
+
+PolynomialIsa getPolynomialIsa() {
+    return currentIsa;
+}
+
+double poly_2b_v6x_dispatch(const double a[1153], const double x[31], double g[31]) {
+    return currentPoly2B(a, x, g);
+}
+
+double poly_3b_v2x_dispatch(const double a[1163], const double x[36], double g[36]) {
+    return currentPoly3B(a, x, g);
+}
+
+float poly_2b_v6x_single_dispatch(const float a[1153], const float x[31], float g[31]) {
+    return currentPoly2BSingle(a, x, g);
+}
+
+float poly_3b_v2x_single_dispatch(const float a[1163], const float x[36], float g[36]) {
+    return currentPoly3BSingle(a, x, g);
+}
+
+} // namespace MBPolPlugin
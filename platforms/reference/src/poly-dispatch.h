@@ -0,0 +1,88 @@
+#ifndef POLY_DISPATCH_H
+#define POLY_DISPATCH_H
+
+//
+// runtime selection of the instruction set used by the generated
+// 2B/3B polynomials; each level is a separate build of poly-2b-v6x.cpp
+// and poly-3b-v2x.cpp (see poly-*-avx2.cpp and poly-*-avx512.cpp), in
+// double precision and in single precision (poly-*-single*.cpp)
+//
+
+namespace MBPolPlugin {
+
+enum PolynomialIsa {
+    PolynomialIsaGeneric = 0,
+    PolynomialIsaAVX2    = 1,
+    PolynomialIsaAVX512  = 2
+};
+
+/**
+ * Get a printable name ("generic", "avx2", "avx512") for an instruction set.
+ */
+const char* getPolynomialIsaName(PolynomialIsa isa);
+
+/**
+ * Whether the polynomials were compiled for isa and the running CPU supports it.
+ */
+bool isPolynomialIsaAvailable(PolynomialIsa isa);
+
+/**
+ * Pick the best available instruction set. The environment variable
+ * MBPOL_POLYNOMIAL_ISA (generic, avx2 or avx512) caps the choice.
+ */
+PolynomialIsa selectPolynomialIsa();
+
+/**
+ * Get the instruction set currently used by poly_2b_v6x_dispatch() and poly_3b_v2x_dispatch(),
+ * and by their single precision versions.
+ */
+PolynomialIsa getPolynomialIsa();
+
+/**
+ * Force a specific instruction set; throws OpenMMException if it is not available. The
+ * choice is reported by MBPolTwoBodyForce::getPolynomialInstructionSet().
+ */
+void setPolynomialIsa(PolynomialIsa isa);
+
+double poly_2b_v6x_dispatch(const double a[1153],
+                            const double x[31],
+                                  double g[31]);
+
+double poly_3b_v2x_dispatch(const double a[1163],
+                            const double x[36],
+                                  double g[36]);
+
+/**
+ * The polynomials evaluated in single precision, for the mixed precision mode of
+ * MBPolTwoBodyForce and MBPolThreeBodyForce.
+ */
+float poly_2b_v6x_single_dispatch(const float a[1153],
+                                  const float x[31],
+                                        float g[31]);
+
+float poly_3b_v2x_single_dispatch(const float a[1163],
+                                  const float x[36],
+                                        float g[36]);
+
+} // namespace MBPolPlugin
+
+float poly_2b_v6x_eval_single(const float a[1153], const float x[31], float g[31]);
+float poly_3b_v2x_eval_single(const float a[1163], const float x[36], float g[36]);
+
+#ifdef MBPOL_POLY_ISA_DISPATCH
+
+double poly_2b_v6x_eval_avx2(const double a[1153], const double x[31], double g[31]);
+double poly_2b_v6x_eval_avx512(const double a[1153], const double x[31], double g[31]);
+
+double poly_3b_v2x_eval_avx2(const double a[1163], const double x[36], double g[36]);
+double poly_3b_v2x_eval_avx512(const double a[1163], const double x[36], double g[36]);
+
+float poly_2b_v6x_eval_single_avx2(const float a[1153], const float x[31], float g[31]);
+float poly_2b_v6x_eval_single_avx512(const float a[1153], const float x[31], float g[31]);
+
+float poly_3b_v2x_eval_single_avx2(const float a[1163], const float x[36], float g[36]);
+float poly_3b_v2x_eval_single_avx512(const float a[1163], const float x[36], float g[36]);
+
+#endif
+
+#endif // POLY_DISPATCH_H
@@ -0,0 +1,316 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * Water configurations shared by the Reference platform and driver tests: a
+ * distorted cubic lattice at liquid density and copies of the 14-water cluster,
+ * with the particles and forces of the MB-pol water model.
+ */
+
+#ifndef OPENMM_MBPOL_TEST_WATERS_H_
+#define OPENMM_MBPOL_TEST_WATERS_H_
+
+#include "OpenMMMBPol.h"
+#include "openmm/State.h"
+#include "openmm/System.h"
+#include "openmm/Vec3.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <vector>
+
+// oxygen-oxygen distance of the lattice, liquid density
+
+const double waterLatticeSpacing = 0.3104;
+
+// flags of buildWaterLattice()
+
+enum WaterLatticeFlags {
+    PeriodicWaterBox   = 1, // set the periodic box to the lattice
+    WaterVirtualSites  = 2, // add the M site of every water as a virtual site
+    StretchedWaterBond = 4  // vary the first O-H bond from water to water
+};
+
+/**
+ * O, H, H of a water with its oxygen at a given point; phi turns the first O-H bond
+ * in the xy plane and tilt the plane of the molecule about that bond.
+ */
+inline void getWaterAtoms( const OpenMM::Vec3& oxygen, double phi, double tilt, double stretch, OpenMM::Vec3 atoms[3] ) {
+
+    const double rOH   = 0.09572;
+    const double theta = 104.52*M_PI/180.0;
+    OpenMM::Vec3 axis1( std::cos( phi ), std::sin( phi ), 0.0 );
+    OpenMM::Vec3 axis2( -std::sin( phi )*std::cos( tilt ), std::cos( phi )*std::cos( tilt ), std::sin( tilt ) );
+    atoms[0] = oxygen;
+    atoms[1] = oxygen + axis1*rOH*stretch;
+    atoms[2] = oxygen + (axis1*std::cos(theta) + axis2*std::sin(theta))*rOH;
+}
+
+/**
+ * O, H, H of water m of a side x side x side lattice, filled along x first; every
+ * oxygen is displaced by up to 0.03 nm and every water is oriented differently.
+ */
+inline void getLatticeWater( int m, int side, double waterSpacing, bool stretch, OpenMM::Vec3 atoms[3] ) {
+
+    OpenMM::Vec3 oxygen( (m % side + 0.5)*waterSpacing, ((m/side) % side + 0.5)*waterSpacing, (m/(side*side) + 0.5)*waterSpacing );
+    oxygen += OpenMM::Vec3( std::sin( 1.7*m ), std::cos( 2.3*m ), std::sin( 0.9*m + 0.3 ) )*0.03;
+    getWaterAtoms( oxygen, 0.8*m, 0.5*m, (stretch ? 1.0 + 0.03*std::sin( 1.3*m ) : 1.0), atoms );
+}
+
+/**
+ * Add the first numWaters waters of a side x side x side lattice to a System: O, H, H
+ * and, with WaterVirtualSites, the M site, so 3 or 4 particles per water.
+ *
+ * @param system     the System the particles are added to
+ * @param positions  on exit, the positions of the particles
+ * @param side       number of waters along each edge of the lattice
+ * @param flags      a combination of WaterLatticeFlags
+ * @param numWaters  number of waters; 0 fills the lattice
+ */
+inline void buildWaterLattice( OpenMM::System& system, std::vector<OpenMM::Vec3>& positions, int side, int flags, int numWaters = 0 ) {
+
+    const double virtualSiteWeightO = 0.573293118;
+    const double virtualSiteWeightH = 0.213353441;
+    if( numWaters == 0 ){
+        numWaters = side*side*side;
+    }
+    if( flags & PeriodicWaterBox ){
+        double boxDimension = side*waterLatticeSpacing;
+        system.setDefaultPeriodicBoxVectors( OpenMM::Vec3( boxDimension, 0.0, 0.0 ), OpenMM::Vec3( 0.0, boxDimension, 0.0 ),
+                                             OpenMM::Vec3( 0.0, 0.0, boxDimension ) );
+    }
+    int sitesPerWater = (flags & WaterVirtualSites) ? 4 : 3;
+    positions.resize( sitesPerWater*numWaters );
+    for( int m = 0; m < numWaters; m++ ){
+        int first = sitesPerWater*m;
+        getLatticeWater( m, side, waterLatticeSpacing, (flags & StretchedWaterBond) != 0, &positions[first] );
+        system.addParticle( 1.5999000e+01 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 1.0080000e+00 );
+        if( flags & WaterVirtualSites ){
+            positions[first+3] = positions[first]*virtualSiteWeightO + (positions[first+1] + positions[first+2])*virtualSiteWeightH;
+            system.addParticle( 0. ); // Virtual Site
+            system.setVirtualSite( first+3, new OpenMM::ThreeParticleAverageSite( first, first+1, first+2,
+                                                                                virtualSiteWeightO, virtualSiteWeightH, virtualSiteWeightH ) );
+        }
+    }
+}
+
+// the 14-water cluster of examples/Simulate14WaterCluster, O H H in Angstrom
+
+const int    watersPerCluster = 14;
+const double water14[3*watersPerCluster][3] = {
+    { -2.349377641189e-01, 1.798934467398e-01, 1.896881820756e-01 },
+    { 1.788456192811e-01, -4.351349633402e-01, -3.765224894244e-01 },
+    { 2.195852756811e-01, 8.816778044978e-02, 1.073177788976e+00 },
+
+    { -2.899375600289e+00, 4.533801552398e-01, 4.445704119756e-01 },
+    { -1.891275615534e+00, 3.753590916398e-01, 2.490296312756e-01 },
+    { -3.372062885819e+00, 2.555551963398e-01, -3.733422905244e-01 },
+
+    { 8.428220990811e-01, 4.870807363398e-01, 3.155605857676e+00 },
+    { 2.205240762811e-01, 1.158785963140e+00, 3.577474762076e+00 },
+    { 1.087801046381e+00, -1.129208591502e-01, 3.875459300076e+00 },
+
+    { 9.587606425811e-01, 1.739780448140e+00, -2.350038144714e+00 },
+    { 1.608290357181e+00, 1.084550067240e+00, -2.527800037751e+00 },
+    { 6.371470514811e-01, 1.907637977740e+00, -1.459391248124e+00 },
+
+    { -5.402595366189e-01, 3.436858949240e+00, -3.364294798244e-01 },
+    { -9.927075362189e-01, 4.233122552140e+00, -8.308930347244e-01 },
+    { -1.277172354239e+00, 2.836232717540e+00, -3.850631209244e-01 },
+
+    { 8.739387783811e-01, -1.626958848900e+00, -2.396798577774e+00 },
+    { 1.408213796381e+00, -2.079240526160e+00, -1.701669540424e+00 },
+    { 1.515572976181e+00, -1.166885340300e+00, -2.938074529504e+00 },
+
+    { 2.976994446581e+00, -4.267919297502e-01, 1.269092190476e+00 },
+    { 2.533682331181e+00, 2.556735979978e-02, 2.039154286576e+00 },
+    { 3.128503830381e+00, 2.419881502398e-01, 5.967620551756e-01 },
+
+    { -1.629810395359e+00, 8.289601626398e-01, -3.056166050894e+00 },
+    { -6.994519097189e-01, 8.049764115398e-01, -2.943175234164e+00 },
+    { -1.874145275955e+00, -8.466235253022e-02, -3.241518244384e+00 },
+
+    { -2.595625033599e+00, -1.646832204690e+00, 2.192150970676e+00 },
+    { -2.906585612949e+00, -9.062350233512e-01, 1.670815817176e+00 },
+    { -2.669295291189e+00, -1.431610358210e+00, 3.153621682076e+00 },
+
+    { 1.818457619381e+00, -2.794187137660e+00, 1.107580890756e-01 },
+    { 2.097391780281e+00, -1.959930744260e+00, 5.631032745756e-01 },
+    { 2.529698452281e+00, -3.454934434160e+00, 3.013241934756e-01 },
+
+    { -4.545107775189e-01, -3.318742298960e+00, 1.492762161876e+00 },
+    { 1.737151477811e-01, -3.171411334960e+00, 8.066594968756e-01 },
+    { -1.041679032169e+00, -2.555367771060e+00, 1.600821086376e+00 },
+
+    { -5.833794722189e-01, 3.052540693140e+00, 2.637054256676e+00 },
+    { -1.419205322489e+00, 2.586471523640e+00, 2.720532465476e+00 },
+    { -5.746468928189e-01, 3.408128243540e+00, 1.785534806076e+00 },
+
+    { 3.344764010581e+00, 1.359764839140e+00, -6.682810128244e-01 },
+    { 2.813836912981e+00, 2.168029298140e+00, -5.595663217244e-01 },
+    { 4.237583121481e+00, 1.647152701540e+00, -8.700689423244e-01 },
+
+    { -2.004856348130e+00, -1.781589543180e+00, -2.722539611524e+00 },
+    { -1.060302432829e+00, -1.994959751260e+00, -2.496572811216e+00 },
+    { -2.596156174389e+00, -2.566367260560e+00, -2.697712987614e+00 }
+};
+
+/**
+ * Copies of the 14-water cluster, clusterSpacing nm apart on a side x side x side
+ * lattice, each water with its M site as a virtual site.
+ *
+ * @return the number of waters
+ */
+inline int buildWaterClusters( OpenMM::System& system, std::vector<OpenMM::Vec3>& positions, int side, double clusterSpacing ) {
+
+    const double virtualSiteWeightO = 0.573293118;
+    const double virtualSiteWeightH = 0.213353441;
+    int numWaters = side*side*side*watersPerCluster;
+    positions.resize( 4*numWaters );
+    for( int m = 0; m < numWaters; m++ ){
+        int cluster = m/watersPerCluster;
+        int water   = m%watersPerCluster;
+        OpenMM::Vec3 offset( (cluster % side)*clusterSpacing, ((cluster/side) % side)*clusterSpacing, (cluster/(side*side))*clusterSpacing );
+        for( int a = 0; a < 3; a++ ){
+            const double* position = water14[3*water+a];
+            positions[4*m+a] = OpenMM::Vec3( position[0], position[1], position[2] )*0.1 + offset;
+        }
+        positions[4*m+3] = positions[4*m]*virtualSiteWeightO + (positions[4*m+1] + positions[4*m+2])*virtualSiteWeightH;
+
+        system.addParticle( 1.5999000e+01 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 0. ); // Virtual Site
+        system.setVirtualSite( 4*m+3, new OpenMM::ThreeParticleAverageSite( 4*m, 4*m+1, 4*m+2,
+                                                                           virtualSiteWeightO, virtualSiteWeightH, virtualSiteWeightH ) );
+    }
+    return numWaters;
+}
+
+/**
+ * Add the O, H, H of every water to a 1-, 2- or 3-body force.
+ */
+template <class ForceType>
+void addWaterParticles( ForceType* force, int numWaters, int sitesPerWater = 4 ) {
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numWaters; m++ ){
+        particleIndices[0] = sitesPerWater*m;
+        particleIndices[1] = sitesPerWater*m+1;
+        particleIndices[2] = sitesPerWater*m+2;
+        force->addParticle( particleIndices );
+    }
+}
+
+/**
+ * Electrostatics force with the charges and polarizabilities of numWaters waters of
+ * four sites each; the caller sets the cutoff, tolerances and other options.
+ */
+inline MBPolPlugin::MBPolElectrostaticsForce* createWaterElectrostaticsForce( int numWaters,
+                                                                           MBPolPlugin::MBPolElectrostaticsForce::NonbondedMethod method ) {
+
+    MBPolPlugin::MBPolElectrostaticsForce* mbpolElectrostaticsForce = new MBPolPlugin::MBPolElectrostaticsForce();
+    mbpolElectrostaticsForce->setNonbondedMethod( method );
+    for( int m = 0; m < numWaters; m++ ){
+        mbpolElectrostaticsForce->addElectrostatics( -5.1966000e-01, m, 0, 0.001310, 0.001310 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  0.,            m, 2, 0.001310, 0. );
+    }
+    return mbpolElectrostaticsForce;
+}
+
+/**
+ * Periodic side x side x side lattice with M sites and all MB-pol forces, one force
+ * group per force: 0 one-body, 1 two-body, 2 three-body, 3 electrostatics. The
+ * cutoffs (0.6 nm for 2B and PME, 0.52 nm for 3B) and the PME tolerance of 1e-3
+ * keep a 4 x 4 x 4 lattice quick to evaluate; charge redistribution is off.
+ *
+ * @return the edge of the box
+ */
+inline double buildWaterForceGroups( OpenMM::System& system, std::vector<OpenMM::Vec3>& positions, int side ) {
+
+    int numWaters = side*side*side;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+
+    MBPolPlugin::MBPolOneBodyForce* mbpolOneBodyForce = new MBPolPlugin::MBPolOneBodyForce();
+    mbpolOneBodyForce->setNonbondedMethod( MBPolPlugin::MBPolOneBodyForce::Periodic );
+    mbpolOneBodyForce->setForceGroup( 0 );
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numWaters; m++ ){
+        particleIndices[0] = 4*m;
+        particleIndices[1] = 4*m+1;
+        particleIndices[2] = 4*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+    }
+
+    MBPolPlugin::MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolPlugin::MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.6 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolPlugin::MBPolTwoBodyForce::CutoffPeriodic );
+    mbpolTwoBodyForce->setForceGroup( 1 );
+    addWaterParticles( mbpolTwoBodyForce, numWaters );
+
+    MBPolPlugin::MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolPlugin::MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolPlugin::MBPolThreeBodyForce::CutoffPeriodic );
+    mbpolThreeBodyForce->setForceGroup( 2 );
+    addWaterParticles( mbpolThreeBodyForce, numWaters );
+
+    MBPolPlugin::MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numWaters, MBPolPlugin::MBPolElectrostaticsForce::PME );
+    mbpolElectrostaticsForce->setCutoffDistance( 0.6 );
+    mbpolElectrostaticsForce->setIncludeChargeRedistribution( false );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-12 );
+    mbpolElectrostaticsForce->setAEwald( 0. );
+    mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-03 );
+    mbpolElectrostaticsForce->setForceGroup( 3 );
+
+    system.addForce( mbpolOneBodyForce );
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+    system.addForce( mbpolElectrostaticsForce );
+    return side*waterLatticeSpacing;
+}
+
+/**
+ * Relative root mean square difference of the forces of two States.
+ */
+inline double forceDifference( const OpenMM::State& expected, const OpenMM::State& found ) {
+
+    double difference = 0.0, norm = 0.0;
+    for( unsigned int ii = 0; ii < expected.getForces().size(); ii++ ){
+        OpenMM::Vec3 delta = found.getForces()[ii] - expected.getForces()[ii];
+        difference        += delta.dot( delta );
+        norm              += expected.getForces()[ii].dot( expected.getForces()[ii] );
+    }
+    return std::sqrt( difference/norm );
+}
+
+#endif // OPENMM_MBPOL_TEST_WATERS_H_
@@ -0,0 +1,502 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * Benchmark of the Reference MBPol forces on periodic boxes of water.
+ *
+ * Each run times full force evaluations, each force on its own (one force group
+ * per force) and the phases recorded by ReferenceMBPolTimers: neighbor lists,
+ * polynomials, the induced dipole pair table and iterations and PME spreading,
+ * FFT and gathering.
+ * Phase times are inclusive, e.g. Electrostatics.inducedDipoles contains the PME
+ * steps of the iterations. The dispersion term, a CustomNonbondedForce computed by
+ * OpenMM, is not included.
+ *
+ * Usage: TestMBPolBenchmark [options]
+ *   --waters n1,n2,...     water lattices at liquid density (default 125)
+ *   --pdb file             tile this box of water (e.g. python/water256_bulk.pdb) instead
+ *   --pdb-box size         edge of the box in the pdb file in nm (default 1.93996888399961804)
+ *   --replicas k1,k2,...   tile the pdb box k x k x k times (default 1)
+ *   --threads t1,t2,...    threads of the Reference kernels (ReferenceMBPolParallel); more than 1
+ *                          runs the 2B, 3B and induced dipole loops on that many threads through
+ *                          ReferenceMBPolScheduler (default 1,4)
+ *   --task-graph 0|1       also let the forces overlap through ReferenceMBPolTaskGraph (default 0)
+ *   --pair-table 0|1       build the induced dipole pair table once per evaluation (default 1); 0
+ *                          rebuilds it in every iteration, to measure what the table saves
+ *   --single-pme p1,p2     PME grids and FFTs in double (0) or single (1) precision, e.g. 0,1 to
+ *                          compare the Electrostatics.pmeFFT phases (default 0)
+ *   --virial 0|1           also fetch the virial of every force after each timed evaluation
+ *                          (default 0); the PME reciprocal space virial is only computed then,
+ *                          and shows up as the phase Electrostatics.reciprocalVirial
+ *   --repeats n            evaluations timed per run (default 1)
+ *   --json file            also write the results as JSON to file
+ *
+ * Without arguments it runs a small box quickly, as part of the test suite.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "OpenMMMBPol.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "MBPolReferenceElectrostaticsForce.h"
+#include "ReferenceMBPolParallel.h"
+#include "ReferenceMBPolScheduler.h"
+#include "ReferenceMBPolTaskGraph.h"
+#include "ReferenceMBPolTimers.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const int numberOfForces = 4;
+const char* forceNames[numberOfForces] = { "OneBody", "TwoBody", "ThreeBody", "Electrostatics" };
+
+struct BenchmarkRun {
+    std::string source;
+    int numberOfWaters;
+    double boxDimension;
+    int threads;
+    bool taskGraph;
+    bool pairTable;
+    bool singlePme;
+    bool virial;
+    int repeats;
+    double energy;
+    double meanTime, minTime;
+    double forceTimes[numberOfForces];
+    std::vector<std::string> phases;
+    std::vector<double> phaseTimes;
+    std::vector<int> phaseCounts;
+};
+
+std::vector<int> parseList( const std::string& list ) {
+    std::vector<int> values;
+    std::stringstream stream( list );
+    std::string item;
+    while( std::getline( stream, item, ',' ) ){
+        values.push_back( atoi( item.c_str() ) );
+    }
+    return values;
+}
+
+double secondsSince( const std::chrono::steady_clock::time_point& start ) {
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Water molecules with random orientation on a cubic lattice at liquid density
+// (the density of water256_bulk.pdb); returns the box edge.
+
+double buildWaterLattice( int numberOfWaters, std::vector<Vec3>& positions ) {
+
+    const double waterSpacing = 0.3104;
+    const double rOH          = 0.09572;
+    const double theta        = 104.52*M_PI/180.0;
+    int side = static_cast<int>(std::ceil( std::pow( static_cast<double>(numberOfWaters), 1.0/3.0 ) - 1.0e-9 ));
+
+    srand( 1234 );
+    positions.resize( 3*numberOfWaters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        Vec3 oxygen( (m % side + 0.5)*waterSpacing, ((m/side) % side + 0.5)*waterSpacing, (m/(side*side) + 0.5)*waterSpacing );
+
+        Vec3 u, v;
+        do {
+            u = Vec3( rand()/(double) RAND_MAX - 0.5, rand()/(double) RAND_MAX - 0.5, rand()/(double) RAND_MAX - 0.5 );
+        } while( u.dot(u) < 1.0e-2 || u.dot(u) > 0.25 );
+        u /= std::sqrt( u.dot(u) );
+        do {
+            v = Vec3( rand()/(double) RAND_MAX - 0.5, rand()/(double) RAND_MAX - 0.5, rand()/(double) RAND_MAX - 0.5 );
+            v -= u*u.dot(v);
+        } while( v.dot(v) < 1.0e-2 );
+        v /= std::sqrt( v.dot(v) );
+
+        positions[3*m]   = oxygen;
+        positions[3*m+1] = oxygen + u*rOH;
+        positions[3*m+2] = oxygen + (u*std::cos(theta) + v*std::sin(theta))*rOH;
+    }
+    return side*waterSpacing;
+}
+
+// O, H1, H2 of every HOH residue of a pdb file (in Angstrom), tiled replicas^3 times; returns the box edge.
+
+double buildWaterFromPdb( const std::string& fileName, double pdbBox, int replicas, std::vector<Vec3>& positions ) {
+
+    std::ifstream pdb( fileName.c_str() );
+    if( !pdb ){
+        throw OpenMMException( "TestMBPolBenchmark: cannot open " + fileName );
+    }
+    std::vector<Vec3> box;
+    std::string line;
+    while( std::getline( pdb, line ) ){
+        if( line.compare( 0, 6, "HETATM" ) != 0 && line.compare( 0, 6, "ATOM  " ) != 0 ){
+            continue;
+        }
+        std::string atomName;
+        std::stringstream( line.substr( 12, 4 ) ) >> atomName;
+        if( atomName == "M" ){
+            continue;
+        }
+        double x, y, z;
+        std::stringstream( line.substr( 30 ) ) >> x >> y >> z;
+        box.push_back( Vec3( x, y, z )*0.1 );
+    }
+    if( box.empty() || box.size() % 3 != 0 ){
+        throw OpenMMException( "TestMBPolBenchmark: " + fileName + " does not hold O, H1, H2 water molecules" );
+    }
+
+    positions.clear();
+    for( int ix = 0; ix < replicas; ix++ ){
+        for( int iy = 0; iy < replicas; iy++ ){
+            for( int iz = 0; iz < replicas; iz++ ){
+                Vec3 shift( ix*pdbBox, iy*pdbBox, iz*pdbBox );
+                for( unsigned int ii = 0; ii < box.size(); ii++ ){
+                    positions.push_back( box[ii] + shift );
+                }
+            }
+        }
+    }
+    return replicas*pdbBox;
+}
+
+// One force per force group, parameters as in python/mbpol.xml (cutoffs are capped at
+// half the box); the virtual M site of each water follows its three atoms.
+
+void buildSystem( System& system, const std::vector<Vec3>& waterPositions, double boxDimension, bool singlePme,
+                  std::vector<Vec3>& positions ) {
+
+    int numberOfWaters = waterPositions.size()/3;
+    system.setDefaultPeriodicBoxVectors( Vec3( boxDimension, 0.0, 0.0 ), Vec3( 0.0, boxDimension, 0.0 ), Vec3( 0.0, 0.0, boxDimension ) );
+
+    double virtualSiteWeightO = 0.573293118;
+    double virtualSiteWeightH = 0.213353441;
+    positions.resize( 4*numberOfWaters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        positions[4*m]   = waterPositions[3*m];
+        positions[4*m+1] = waterPositions[3*m+1];
+        positions[4*m+2] = waterPositions[3*m+2];
+        positions[4*m+3] = positions[4*m]*virtualSiteWeightO + (positions[4*m+1] + positions[4*m+2])*virtualSiteWeightH;
+
+        system.addParticle( 1.5999000e+01 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 0. ); // Virtual Site
+        system.setVirtualSite( 4*m+3, new ThreeParticleAverageSite( 4*m, 4*m+1, 4*m+2,
+                                                                   virtualSiteWeightO, virtualSiteWeightH, virtualSiteWeightH ) );
+    }
+
+    MBPolOneBodyForce* mbpolOneBodyForce = new MBPolOneBodyForce();
+    mbpolOneBodyForce->setNonbondedMethod( MBPolOneBodyForce::Periodic );
+    mbpolOneBodyForce->setForceGroup( 0 );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( std::min( 0.65, 0.5*boxDimension ) );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    mbpolTwoBodyForce->setForceGroup( 1 );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.45 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffPeriodic );
+    mbpolThreeBodyForce->setForceGroup( 2 );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = new MBPolElectrostaticsForce();
+    mbpolElectrostaticsForce->setNonbondedMethod( MBPolElectrostaticsForce::PME );
+    mbpolElectrostaticsForce->setCutoffDistance( std::min( 0.9, 0.5*boxDimension ) );
+    mbpolElectrostaticsForce->setIncludeChargeRedistribution( true );
+    mbpolElectrostaticsForce->setAEwald( 0. );
+    mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-04 );
+    mbpolElectrostaticsForce->setUseSinglePrecisionPme( singlePme );
+    mbpolElectrostaticsForce->setForceGroup( 3 );
+
+    std::vector<double> thole( 5 );
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+    mbpolElectrostaticsForce->setTholeParameters( thole );
+
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        particleIndices[0] = 4*m;
+        particleIndices[1] = 4*m+1;
+        particleIndices[2] = 4*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+        mbpolTwoBodyForce->addParticle( particleIndices );
+        mbpolThreeBodyForce->addParticle( particleIndices );
+
+        mbpolElectrostaticsForce->addElectrostatics( -5.1966000e-01, m, 0, 0.001310, 0.001310 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  0.,            m, 2, 0.001310, 0. );
+    }
+    system.addForce( mbpolOneBodyForce );
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+    system.addForce( mbpolElectrostaticsForce );
+}
+
+BenchmarkRun runBenchmark( const std::string& source, const std::vector<Vec3>& waterPositions, double boxDimension,
+                           int threads, bool taskGraph, bool pairTable, bool singlePme, bool virial, int repeats ) {
+
+    BenchmarkRun run;
+    run.source         = source;
+    run.numberOfWaters = waterPositions.size()/3;
+    run.boxDimension   = boxDimension;
+    run.taskGraph      = taskGraph;
+    run.pairTable      = pairTable;
+    run.singlePme      = singlePme;
+    run.virial         = virial;
+    run.repeats        = repeats;
+
+    // the loops of the kernels run on this many threads for the whole run; the
+    // number reported is the one the scheduler actually uses
+
+    int defaultNumThreads    = ReferenceMBPolParallel::getNumThreads();
+    bool defaultWorkStealing = ReferenceMBPolScheduler::getEnabled();
+    ReferenceMBPolParallel::setNumThreads( threads );
+    ReferenceMBPolScheduler::setEnabled( threads > 1 );
+    run.threads = ReferenceMBPolScheduler::getNumThreads();
+    MBPolReferenceElectrostaticsForce::setUseInducedDipolePairTable( pairTable );
+
+    System system;
+    std::vector<Vec3> positions;
+    buildSystem( system, waterPositions, boxDimension, singlePme, positions );
+
+    bool defaultEnabled = ReferenceMBPolTaskGraph::getDefaultEnabled();
+    ReferenceMBPolTaskGraph::setDefaultEnabled( taskGraph );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    ReferenceMBPolTaskGraph::setDefaultEnabled( defaultEnabled );
+    context.setPositions( positions );
+
+    // the first evaluation builds neighbor lists, PME plans and molecule orderings
+
+    run.energy = context.getState( State::Forces | State::Energy ).getPotentialEnergy();
+
+    ReferenceMBPolTimers::reset();
+    ReferenceMBPolTimers::setEnabled( true );
+    run.meanTime = 0.0;
+    run.minTime  = 1.0e+30;
+    std::vector<Vec3> forceVirial;
+    for( int ii = 0; ii < repeats; ii++ ){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        context.getState( State::Forces | State::Energy );
+        if( virial ){
+            dynamic_cast<MBPolOneBodyForce&>( system.getForce( 0 ) ).getVirial( context, forceVirial );
+            dynamic_cast<MBPolTwoBodyForce&>( system.getForce( 1 ) ).getVirial( context, forceVirial );
+            dynamic_cast<MBPolThreeBodyForce&>( system.getForce( 2 ) ).getVirial( context, forceVirial );
+            dynamic_cast<MBPolElectrostaticsForce&>( system.getForce( 3 ) ).getVirial( context, forceVirial );
+        }
+        double seconds = secondsSince( start );
+        run.meanTime  += seconds/repeats;
+        run.minTime    = std::min( run.minTime, seconds );
+    }
+    ReferenceMBPolTimers::setEnabled( false );
+
+    run.phases = ReferenceMBPolTimers::getPhases();
+    for( unsigned int ii = 0; ii < run.phases.size(); ii++ ){
+        run.phaseTimes.push_back( ReferenceMBPolTimers::getTime( run.phases[ii] )/repeats );
+        run.phaseCounts.push_back( ReferenceMBPolTimers::getCount( run.phases[ii] ) );
+    }
+
+    for( int group = 0; group < numberOfForces; group++ ){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( int ii = 0; ii < repeats; ii++ ){
+            context.getState( State::Forces | State::Energy, false, 1 << group );
+        }
+        run.forceTimes[group] = secondsSince( start )/repeats;
+    }
+    ReferenceMBPolParallel::setNumThreads( defaultNumThreads );
+    ReferenceMBPolScheduler::setEnabled( defaultWorkStealing );
+    MBPolReferenceElectrostaticsForce::setUseInducedDipolePairTable( true );
+    return run;
+}
+
+void printRun( const BenchmarkRun& run ) {
+
+    printf( "%s: %d waters, box %.4f nm, %d thread(s)%s%s%s%s, energy %.6f kJ/mol\n", run.source.c_str(), run.numberOfWaters,
+            run.boxDimension, run.threads, (run.taskGraph ? " and task graph" : ""),
+            (run.pairTable ? "" : ", no pair table"), (run.singlePme ? ", single precision PME" : ""),
+            (run.virial ? ", with virial" : ""), run.energy );
+    printf( "  evaluation            %10.4f s (min %.4f s)\n", run.meanTime, run.minTime );
+    for( int group = 0; group < numberOfForces; group++ ){
+        printf( "  %-20s  %10.4f s\n", forceNames[group], run.forceTimes[group] );
+    }
+    for( unsigned int ii = 0; ii < run.phases.size(); ii++ ){
+        printf( "    %-36s %10.4f s %8d\n", run.phases[ii].c_str(), run.phaseTimes[ii], run.phaseCounts[ii] );
+    }
+}
+
+void writeJson( std::ostream& out, const std::vector<BenchmarkRun>& runs ) {
+
+    out.precision( 10 );
+    out << "{\n";
+    out << "  \"benchmark\": \"TestMBPolBenchmark\",\n";
+    out << "  \"platform\": \"Reference\",\n";
+    out << "  \"polynomialIsa\": \"" << MBPolTwoBodyForce::getPolynomialInstructionSet() << "\",\n";
+    out << "  \"runs\": [\n";
+    for( unsigned int rr = 0; rr < runs.size(); rr++ ){
+        const BenchmarkRun& run = runs[rr];
+        out << "    {\n";
+        out << "      \"source\": \"" << run.source << "\",\n";
+        out << "      \"waters\": " << run.numberOfWaters << ",\n";
+        out << "      \"boxSize\": " << run.boxDimension << ",\n";
+        out << "      \"threads\": " << run.threads << ",\n";
+        out << "      \"taskGraph\": " << (run.taskGraph ? "true" : "false") << ",\n";
+        out << "      \"pairTable\": " << (run.pairTable ? "true" : "false") << ",\n";
+        out << "      \"singlePme\": " << (run.singlePme ? "true" : "false") << ",\n";
+        out << "      \"virial\": " << (run.virial ? "true" : "false") << ",\n";
+        out << "      \"repeats\": " << run.repeats << ",\n";
+        out << "      \"energy\": " << run.energy << ",\n";
+        out << "      \"evaluationSeconds\": " << run.meanTime << ",\n";
+        out << "      \"evaluationMinSeconds\": " << run.minTime << ",\n";
+        out << "      \"forceSeconds\": {";
+        for( int group = 0; group < numberOfForces; group++ ){
+            out << (group ? ", " : " ") << "\"" << forceNames[group] << "\": " << run.forceTimes[group];
+        }
+        out << " },\n";
+        out << "      \"phases\": {\n";
+        for( unsigned int ii = 0; ii < run.phases.size(); ii++ ){
+            out << "        \"" << run.phases[ii] << "\": { \"seconds\": " << run.phaseTimes[ii]
+                << ", \"count\": " << run.phaseCounts[ii] << " }" << (ii + 1 < run.phases.size() ? "," : "") << "\n";
+        }
+        out << "      }\n";
+        out << "    }" << (rr + 1 < runs.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestMBPolBenchmark running test..." << std::endl;
+
+        std::vector<int> waters( 1, 125 );
+        std::vector<int> replicas( 1, 1 );
+        std::vector<int> threads = parseList( "1,4" );
+        std::vector<int> precisions( 1, 0 );
+        int repeats = 1;
+        bool taskGraph = false;
+        bool pairTable = true;
+        bool virial    = false;
+        std::string pdbFileName, jsonFileName;
+        double pdbBox = 1.93996888399961804;
+
+        for( int ii = 1; ii < numberOfArguments; ii++ ){
+            std::string option = argv[ii];
+            if( ii + 1 == numberOfArguments ){
+                throw OpenMMException( "TestMBPolBenchmark: missing value for " + option );
+            }
+            std::string value = argv[++ii];
+            if( option == "--waters" ){
+                waters = parseList( value );
+            } else if( option == "--pdb" ){
+                pdbFileName = value;
+            } else if( option == "--pdb-box" ){
+                pdbBox = atof( value.c_str() );
+            } else if( option == "--replicas" ){
+                replicas = parseList( value );
+            } else if( option == "--threads" ){
+                threads = parseList( value );
+            } else if( option == "--task-graph" ){
+                taskGraph = (atoi( value.c_str() ) != 0);
+            } else if( option == "--pair-table" ){
+                pairTable = (atoi( value.c_str() ) != 0);
+            } else if( option == "--single-pme" ){
+                precisions = parseList( value );
+            } else if( option == "--virial" ){
+                virial = (atoi( value.c_str() ) != 0);
+            } else if( option == "--repeats" ){
+                repeats = std::max( 1, atoi( value.c_str() ) );
+            } else if( option == "--json" ){
+                jsonFileName = value;
+            } else {
+                throw OpenMMException( "TestMBPolBenchmark: unknown option " + option );
+            }
+        }
+
+        std::vector<BenchmarkRun> runs;
+        int numberOfBoxes = pdbFileName.empty() ? waters.size() : replicas.size();
+        for( int box = 0; box < numberOfBoxes; box++ ){
+            std::vector<Vec3> waterPositions;
+            double boxDimension;
+            std::string source;
+            if( pdbFileName.empty() ){
+                boxDimension = buildWaterLattice( waters[box], waterPositions );
+                source       = "lattice";
+            } else {
+                boxDimension = buildWaterFromPdb( pdbFileName, pdbBox, replicas[box], waterPositions );
+                source       = pdbFileName;
+            }
+            int firstRun = runs.size();
+            for( unsigned int pp = 0; pp < precisions.size(); pp++ ){
+                for( unsigned int tt = 0; tt < threads.size(); tt++ ){
+                    runs.push_back( runBenchmark( source, waterPositions, boxDimension, threads[tt], taskGraph, pairTable,
+                                                  precisions[pp] != 0, virial, repeats ) );
+                    printRun( runs.back() );
+
+                    // the number of threads must not change the result, and single precision grids
+                    // must stay well within the Ewald error tolerance
+
+                    ASSERT_EQUAL_TOL( runs[runs.size() - 1 - tt].energy, runs.back().energy, 1.0e-8 );
+                    ASSERT_EQUAL_TOL( runs[firstRun].energy, runs.back().energy, 1.0e-5 );
+                    ASSERT( ReferenceMBPolTimers::getCount( "Electrostatics.inducedDipoles" ) > 0 );
+                }
+            }
+        }
+
+        writeJson( std::cout, runs );
+        if( !jsonFileName.empty() ){
+            std::ofstream json( jsonFileName.c_str() );
+            writeJson( json, runs );
+        }
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,204 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests that MBPol*Force::computeCopies(), which evaluates several copies of
+ * the system (the beads of a ring polymer) in one call, gives the same energies and
+ * forces as setting the positions of each copy in the context in turn, and that the
+ * result does not depend on the number of threads.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "ReferenceMBPolParallel.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 64 waters of the shared lattice with one force per force group
+
+const int side           = 4;
+const int numberOfWaters = side*side*side;
+
+// beads displaced from the lattice by a few hundredths of a nm, as in a ring polymer of water at 300 K
+
+const int numberOfCopies = 4;
+
+void buildCopies( const std::vector<Vec3>& positions, std::vector<std::vector<Vec3> >& copies ) {
+
+    double virtualSiteWeightO = 0.573293118;
+    double virtualSiteWeightH = 0.213353441;
+    copies.resize( numberOfCopies );
+    for( int copy = 0; copy < numberOfCopies; copy++ ){
+        copies[copy] = positions;
+        for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+            double phase = 0.7*ii + 1.9*copy;
+            copies[copy][ii] += Vec3( std::sin( phase ), std::cos( 1.3*phase ), std::sin( 0.6*phase + 0.4 ) )*0.004;
+        }
+        for( int m = 0; m < numberOfWaters; m++ ){
+            copies[copy][4*m+3] = copies[copy][4*m]*virtualSiteWeightO + (copies[copy][4*m+1] + copies[copy][4*m+2])*virtualSiteWeightH;
+        }
+    }
+}
+
+// add the forces on the M sites to the atoms defining them, as the context does
+
+void distributeVirtualSiteForces( std::vector<Vec3>& forces ) {
+
+    double virtualSiteWeightO = 0.573293118;
+    double virtualSiteWeightH = 0.213353441;
+    for( int m = 0; m < numberOfWaters; m++ ){
+        forces[4*m]   += forces[4*m+3]*virtualSiteWeightO;
+        forces[4*m+1] += forces[4*m+3]*virtualSiteWeightH;
+        forces[4*m+2] += forces[4*m+3]*virtualSiteWeightH;
+    }
+}
+
+void computeCopies( System& system, Context& context, int group, const std::vector<std::vector<Vec3> >& copies,
+                    std::vector<std::vector<Vec3> >& forces, std::vector<double>& energies ) {
+
+    Force& force = system.getForce( group );
+    if( group == 0 ){
+        dynamic_cast<MBPolOneBodyForce&>( force ).computeCopies( context, copies, forces, energies );
+    } else if( group == 1 ){
+        dynamic_cast<MBPolTwoBodyForce&>( force ).computeCopies( context, copies, forces, energies );
+    } else if( group == 2 ){
+        dynamic_cast<MBPolThreeBodyForce&>( force ).computeCopies( context, copies, forces, energies );
+    } else {
+        dynamic_cast<MBPolElectrostaticsForce&>( force ).computeCopies( context, copies, forces, energies );
+    }
+    for( unsigned int copy = 0; copy < forces.size(); copy++ ){
+        distributeVirtualSiteForces( forces[copy] );
+    }
+}
+
+void testComputeCopies( ) {
+
+    std::string testName = "testComputeCopies";
+
+    int defaultNumThreads = ReferenceMBPolParallel::getNumThreads();
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterForceGroups( system, positions, side );
+    std::vector<std::vector<Vec3> > copies;
+    buildCopies( positions, copies );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+
+    for( int group = 0; group < 4; group++ ){
+
+        // one copy at a time through the context
+
+        std::vector<double> expectedEnergies( numberOfCopies );
+        std::vector<std::vector<Vec3> > expectedForces( numberOfCopies );
+        for( int copy = 0; copy < numberOfCopies; copy++ ){
+            context.setPositions( copies[copy] );
+            State state = context.getState( State::Forces | State::Energy, false, 1 << group );
+            expectedEnergies[copy] = state.getPotentialEnergy();
+            expectedForces[copy]   = state.getForces();
+        }
+
+        // all copies in one call, serially and on several threads
+
+        context.setPositions( positions );
+        std::vector<double> serialEnergies, energies;
+        std::vector<std::vector<Vec3> > serialForces, forces;
+        ReferenceMBPolParallel::setNumThreads( 1 );
+        computeCopies( system, context, group, copies, serialForces, serialEnergies );
+        ReferenceMBPolParallel::setNumThreads( 4 );
+        computeCopies( system, context, group, copies, forces, energies );
+
+        ASSERT_EQUAL( numberOfCopies, (int) energies.size() );
+        ASSERT_EQUAL( numberOfCopies, (int) forces.size() );
+        for( int copy = 0; copy < numberOfCopies; copy++ ){
+            std::cout << testName << ": group " << group << " copy " << copy << " energy " << energies[copy] << " kJ/mol" << std::endl;
+            ASSERT_EQUAL( serialEnergies[copy], energies[copy] );
+            ASSERT_EQUAL_TOL( expectedEnergies[copy], energies[copy], 1.0e-8 );
+            for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+                ASSERT_EQUAL_VEC( serialForces[copy][ii], forces[copy][ii], 0.0 );
+                if( ii % 4 != 3 ){
+                    ASSERT_EQUAL_VEC( expectedForces[copy][ii], forces[copy][ii], 1.0e-8 );
+                }
+            }
+        }
+    }
+
+    // the context still holds its own positions
+
+    State state = context.getState( State::Positions );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        ASSERT_EQUAL_VEC( positions[ii], state.getPositions()[ii], 1.0e-10 );
+    }
+
+    // every copy must have a position for each particle
+
+    copies[1].pop_back();
+    bool threw = false;
+    try {
+        std::vector<double> energies;
+        std::vector<std::vector<Vec3> > forces;
+        computeCopies( system, context, 1, copies, forces, energies );
+    } catch( const OpenMMException& e ) {
+        threw = true;
+    }
+    ASSERT( threw );
+
+    ReferenceMBPolParallel::setNumThreads( defaultNumThreads );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolCopies running test..." << std::endl;
+
+        testComputeCopies();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,245 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the deterministic mode of the Reference kernels
+ * (ReferenceMBPolScheduler::setDeterministic()), which adds the chunks of the
+ * 2B, 3B and induced dipole field loops and the PME grid in 64-bit fixed point:
+ * the energies, forces and molecule energies of a cluster of 14-water clusters
+ * and of a periodic lattice with PME must be the same bits for any number of
+ * threads, with and without work stealing, and agree with the double precision
+ * sums. The time of the loops with and without the mode is printed.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "ReferenceMBPolParallel.h"
+#include "ReferenceMBPolScheduler.h"
+#include "ReferenceMBPolTimers.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// copies of the cluster on a side x side x side lattice, 1.2 nm apart
+
+const int    side           = 2;
+const double clusterSpacing = 1.2;
+
+// waters per edge of the periodic lattice
+
+const int    latticeSide    = 4;
+
+void buildSystem( System& system, std::vector<Vec3>& positions ) {
+
+    int numberOfWaters = buildWaterClusters( system, positions, side, clusterSpacing );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.9 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setIncludeEnergyDecomposition( true );
+    mbpolThreeBodyForce->setCutoff( 0.45 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffNonPeriodic );
+    addWaterParticles( mbpolThreeBodyForce, numberOfWaters );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, MBPolElectrostaticsForce::NoCutoff );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-10 );
+
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+    system.addForce( mbpolElectrostaticsForce );
+}
+
+struct Evaluation {
+    double energy;
+    std::vector<Vec3> forces;
+    std::vector<double> moleculeEnergies;
+};
+
+// the molecule energies are those of the force threeBodyIndex, an MBPolThreeBodyForce with
+// the energy decomposition on
+
+Evaluation evaluate( System& system, const std::vector<Vec3>& positions, int threeBodyIndex, int numThreads, bool stealing ) {
+
+    ReferenceMBPolParallel::setNumThreads( numThreads );
+    ReferenceMBPolScheduler::setEnabled( stealing );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    context.computeVirtualSites();
+    State state = context.getState( State::Forces | State::Energy );
+
+    Evaluation evaluation;
+    evaluation.energy = state.getPotentialEnergy();
+    evaluation.forces = state.getForces();
+    dynamic_cast<MBPolThreeBodyForce&>( system.getForce( threeBodyIndex ) ).getMoleculeEnergies( context, evaluation.moleculeEnergies );
+    return evaluation;
+}
+
+void checkResultsDoNotDependOnThreads( const std::string& testName, System& system, const std::vector<Vec3>& positions,
+                                      int threeBodyIndex, double tolerance ) {
+
+    ReferenceMBPolScheduler::setDeterministic( false );
+    Evaluation serial = evaluate( system, positions, threeBodyIndex, 1, false );
+
+    ReferenceMBPolScheduler::setDeterministic( true );
+    Evaluation expected = evaluate( system, positions, threeBodyIndex, 1, false );
+    std::cout << testName << ": energy " << expected.energy << " kJ/mol, double precision sums " << serial.energy << " kJ/mol" << std::endl;
+
+    // fixed point rounds every chunk, and every contribution to a PME grid point, to 2^-32
+
+    ASSERT_EQUAL_TOL( serial.energy, expected.energy, tolerance );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        ASSERT_EQUAL_VEC( serial.forces[ii], expected.forces[ii], 100.0*tolerance );
+    }
+
+    const int threadCounts[] = { 2, 3, 4, 7 };
+    for( int stealing = 0; stealing < 2; stealing++ ){
+        for( int ii = 0; ii < 4; ii++ ){
+            Evaluation found = evaluate( system, positions, threeBodyIndex, threadCounts[ii], stealing == 1 );
+            ASSERT_EQUAL( expected.energy, found.energy );
+            for( unsigned int jj = 0; jj < positions.size(); jj++ ){
+                ASSERT_EQUAL( expected.forces[jj][0], found.forces[jj][0] );
+                ASSERT_EQUAL( expected.forces[jj][1], found.forces[jj][1] );
+                ASSERT_EQUAL( expected.forces[jj][2], found.forces[jj][2] );
+            }
+            for( unsigned int jj = 0; jj < expected.moleculeEnergies.size(); jj++ ){
+                ASSERT_EQUAL( expected.moleculeEnergies[jj], found.moleculeEnergies[jj] );
+            }
+        }
+    }
+}
+
+void testResultsDoNotDependOnThreads( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildSystem( system, positions );
+    checkResultsDoNotDependOnThreads( "testResultsDoNotDependOnThreads", system, positions, 1, 1.0e-10 );
+}
+
+void testPmeResultsDoNotDependOnThreads( ) {
+
+    // one-body, two-body, three-body and PME electrostatics; the many more grid points
+    // than chunks round to a larger difference from the double precision sums
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterForceGroups( system, positions, latticeSide );
+    dynamic_cast<MBPolThreeBodyForce&>( system.getForce( 2 ) ).setIncludeEnergyDecomposition( true );
+    checkResultsDoNotDependOnThreads( "testPmeResultsDoNotDependOnThreads", system, positions, 2, 1.0e-8 );
+}
+
+void testOverhead( ) {
+
+    std::string testName = "testOverhead";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildSystem( system, positions );
+
+    // the loops of a few evaluations on 4 threads with work stealing, summed in double precision and in fixed point
+
+    const int numberOfEvaluations = 5;
+    const char* phases[] = { "TwoBody.polynomial", "ThreeBody.polynomial", "Electrostatics.inducedDipoles" };
+    double seconds[2][3];
+    bool timersEnabled = ReferenceMBPolTimers::getEnabled();
+    ReferenceMBPolTimers::setEnabled( true );
+    for( int deterministic = 0; deterministic < 2; deterministic++ ){
+        ReferenceMBPolScheduler::setDeterministic( deterministic == 1 );
+        ReferenceMBPolParallel::setNumThreads( 4 );
+        ReferenceMBPolScheduler::setEnabled( true );
+        VerletIntegrator integrator( 0.0002 );
+        Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+        context.setPositions( positions );
+        context.computeVirtualSites();
+        context.getState( State::Forces | State::Energy );
+        ReferenceMBPolTimers::reset();
+        for( int step = 0; step < numberOfEvaluations; step++ ){
+            std::vector<Vec3> stepPositions( positions );
+            stepPositions[0] += Vec3( 0.0001*(step+1), 0.0, 0.0 );
+            context.setPositions( stepPositions );
+            context.computeVirtualSites();
+            context.getState( State::Forces | State::Energy );
+        }
+        for( int phase = 0; phase < 3; phase++ ){
+            seconds[deterministic][phase] = ReferenceMBPolTimers::getTime( phases[phase] )/numberOfEvaluations;
+        }
+    }
+    ReferenceMBPolTimers::setEnabled( timersEnabled );
+
+    std::cout << testName << ": " << side*side*side*watersPerCluster << " waters, 4 threads, seconds per evaluation" << std::endl;
+    char line[256];
+    snprintf( line, sizeof(line), "%-32s %12s %12s %10s\n", "phase", "double", "fixed point", "overhead" );
+    std::cout << line;
+    for( int phase = 0; phase < 3; phase++ ){
+        snprintf( line, sizeof(line), "%-32s %12.5f %12.5f %9.1f%%\n", phases[phase], seconds[0][phase], seconds[1][phase],
+                  100.0*(seconds[1][phase]/seconds[0][phase] - 1.0) );
+        std::cout << line;
+    }
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    bool enabled       = ReferenceMBPolScheduler::getEnabled();
+    bool deterministic = ReferenceMBPolScheduler::getDeterministic();
+    int numThreads     = ReferenceMBPolParallel::getNumThreads();
+    try {
+        std::cout << "TestReferenceMBPolDeterministic running test..." << std::endl;
+
+        testResultsDoNotDependOnThreads();
+        testPmeResultsDoNotDependOnThreads();
+        testOverhead();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+    ReferenceMBPolScheduler::setEnabled( enabled );
+    ReferenceMBPolScheduler::setDeterministic( deterministic );
+    ReferenceMBPolParallel::setNumThreads( numThreads );
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
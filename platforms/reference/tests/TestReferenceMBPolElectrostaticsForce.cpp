@@ -39,6 +39,7 @@
 #include "openmm/System.h"
 #include "openmm/MBPolElectrostaticsForce.h"
 #include "MBPolReferenceElectrostaticsForce.h"
+#include "MBPolTestWaters.h"
 #include "openmm/LangevinIntegrator.h"
 #include "openmm/VirtualSite.h"
 #include <iostream>
@@ -414,6 +415,44 @@ class WrappedMBPolReferenceElectrostaticsForceForComputeWaterCharge : public MBP
             ASSERT_EQUAL_VEC_MOD(particleO.chargeDerivatives[i], expectedChargeDerivatives[start_i+i], tolerance, testName);
         }
     }
+
+    // computeWaterCharges() evaluates the waters in blocks of 64; 64 + 7 waters
+    // give a full block and a partial one, each water must match computeWaterCharge()
+
+    void testComputeWaterChargeBlocks()   {
+        string testName = "testComputeWaterChargeBlocks";
+
+        const int side           = 5;
+        const int numberOfWaters = 64 + 7;
+        std::vector<ElectrostaticsParticleData> particleData( 4*numberOfWaters );
+        for( int m = 0; m < numberOfWaters; m++ ){
+            Vec3 atoms[3];
+            getLatticeWater( m, side, waterLatticeSpacing, true, atoms );
+            for( int s = 0; s < 3; s++ ){
+                particleData[4*m+s].position = RealVec( atoms[s][0], atoms[s][1], atoms[s][2] );
+            }
+            particleData[4*m+3].position = particleData[4*m].position*0.573293118 +
+                                           (particleData[4*m+1].position + particleData[4*m+2].position)*0.213353441;
+        }
+        std::vector<ElectrostaticsParticleData> singleWaterData( particleData );
+
+        computeWaterCharges( particleData );
+        for( int m = 0; m < numberOfWaters; m++ ){
+            computeWaterCharge( singleWaterData[4*m], singleWaterData[4*m+1], singleWaterData[4*m+2], singleWaterData[4*m+3] );
+        }
+
+        double tolerance = 1e-12;
+        for( int ii = 0; ii < 4*numberOfWaters; ii++ ){
+            ASSERT_EQUAL_TOL_MOD(singleWaterData[ii].charge, particleData[ii].charge, tolerance, testName);
+            for( int jj = 0; jj < 3; jj++ ){
+                ASSERT_EQUAL_VEC_MOD(singleWaterData[ii].chargeDerivatives[jj], particleData[ii].chargeDerivatives[jj], tolerance, testName);
+            }
+        }
+
+        // the waters of the lattice differ, so the charges must too
+
+        ASSERT( particleData[1].charge != particleData[4*(numberOfWaters-1)+1].charge );
+    }
 };
 
 static void testWater3VirtualSite() {
@@ -1711,6 +1750,105 @@ class WrappedMBPolReferencePmeElectrostaticsForceForcalculatePmeDirectElectrosta
     }
 };
 
+// NoCutoff evaluates the pairs of different waters beyond the damping distance (plus the
+// reach of the charge redistribution) without the Thole damping; allDamped moves the damping
+// distance out of reach, so that every pair goes through the damped kernels.
+class WrappedMBPolReferenceElectrostaticsForceForDampedPairs : public MBPolReferenceElectrostaticsForce {
+    public:
+    WrappedMBPolReferenceElectrostaticsForceForDampedPairs( bool allDamped ) :
+                       MBPolReferenceElectrostaticsForce( NoCutoff ), allDamped( allDamped ) {
+    }
+
+    int getNumUndampedPairs( void ) const {
+        return _undampedPairs.size();
+    }
+
+    protected:
+    void calculateInducedDipoles( const std::vector<ElectrostaticsParticleData>& particleData ) {
+        if( allDamped ){
+            _dampingDistance = 1.0e+50;
+        }
+        MBPolReferenceElectrostaticsForce::calculateInducedDipoles( particleData );
+    }
+
+    private:
+    bool allDamped;
+};
+
+static void testUndampedPairs() {
+
+    std::string testName      = "testUndampedPairs";
+    std::cout << "Test START: " << testName << std::endl;
+
+    // 4x4x4 waters with M sites, about 1.2 nm across
+
+    const int side            = 4;
+    const int numWaters       = side*side*side;
+    const int numParticles    = 4*numWaters;
+    std::vector<RealVec> positions( numParticles );
+    std::vector<RealOpenMM> charges, dampingFactors, polarity, tholes;
+    std::vector<int> moleculeIndices, atomTypes;
+    for( int m = 0; m < numWaters; m++ ){
+        Vec3 atoms[3];
+        getLatticeWater( m, side, waterLatticeSpacing, true, atoms );
+        for( int s = 0; s < 3; s++ ){
+            positions[4*m+s] = RealVec( atoms[s][0], atoms[s][1], atoms[s][2] );
+        }
+        positions[4*m+3] = positions[4*m]*0.573293118 + (positions[4*m+1] + positions[4*m+2])*0.213353441;
+
+        RealOpenMM siteCharges[4]   = { -5.1966000e-01, 2.5983000e-01, 2.5983000e-01, 0.0 };
+        RealOpenMM siteDamping[4]   = { 0.001310, 0.000294, 0.000294, 0.001310 };
+        RealOpenMM sitePolarity[4]  = { 0.001310, 0.000294, 0.000294, 0.0 };
+        int siteTypes[4]            = { 0, 1, 1, 2 };
+        for( int s = 0; s < 4; s++ ){
+            charges.push_back( siteCharges[s] );
+            dampingFactors.push_back( siteDamping[s] );
+            polarity.push_back( sitePolarity[s] );
+            moleculeIndices.push_back( m );
+            atomTypes.push_back( siteTypes[s] );
+        }
+    }
+
+    std::vector<RealOpenMM> thole(5);
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+
+    RealOpenMM energies[2];
+    std::vector<RealVec> forces[2];
+    int numUndampedPairs[2];
+    RealOpenMM dampingDistance = 0.0;
+    for( int allDamped = 0; allDamped < 2; allDamped++ ){
+        WrappedMBPolReferenceElectrostaticsForceForDampedPairs force( allDamped == 1 );
+        force.setTholeParameters( thole );
+        force.setIncludeChargeRedistribution( true );
+        force.setMutualInducedDipoleTargetEpsilon( 1.0e-10 );
+        forces[allDamped].assign( numParticles, RealVec( 0.0, 0.0, 0.0 ) );
+        energies[allDamped]         = force.calculateForceAndEnergy( positions, charges, moleculeIndices, atomTypes, tholes,
+                                                                     dampingFactors, polarity, forces[allDamped] );
+        numUndampedPairs[allDamped] = force.getNumUndampedPairs();
+        if( !allDamped ){
+            dampingDistance = force.getDampingDistance();
+        }
+    }
+    std::cout << testName << ": damping distance " << dampingDistance << " nm, " << numUndampedPairs[0]
+              << " of " << numParticles*(numParticles-1)/2 << " pairs undamped" << std::endl;
+
+    // the cluster must be wide enough for both kinds of pairs
+
+    ASSERT( numUndampedPairs[0] > 0 );
+    ASSERT( numUndampedPairs[0] < numParticles*(numParticles-1)/2 );
+    ASSERT_EQUAL( 0, numUndampedPairs[1] );
+
+    ASSERT_EQUAL_TOL_MOD( energies[1], energies[0], 1.0e-10, testName );
+    for( int ii = 0; ii < numParticles; ii++ ){
+        ASSERT_EQUAL_VEC_MOD( forces[1][ii], forces[0][ii], 1.0e-8, testName );
+    }
+    std::cout << "Test END: " << testName << std::endl << std::endl;
+}
+
 int main( int numberOfArguments, char* argv[] ) {
 
     try {
@@ -1745,11 +1883,14 @@ int main( int numberOfArguments, char* argv[] ) {
 
         WrappedMBPolReferenceElectrostaticsForceForComputeWaterCharge* wrapperForComputeWaterCharge = new WrappedMBPolReferenceElectrostaticsForceForComputeWaterCharge();
         wrapperForComputeWaterCharge->testComputeWaterCharge();
+        wrapperForComputeWaterCharge->testComputeWaterChargeBlocks();
 
         testWater3();
 
         testWater3VirtualSite();
 
+        testUndampedPairs();
+
         WrappedMBPolReferencePmeElectrostaticsForceForcalculatePmeDirectElectrostaticPairIxn* mbpolReferenceElectrostaticsForcePmePair = new WrappedMBPolReferencePmeElectrostaticsForceForcalculatePmeDirectElectrostaticPairIxn();
         mbpolReferenceElectrostaticsForcePmePair->setTholeParameters(tholes);
         mbpolReferenceElectrostaticsForcePmePair->setMutualInducedDipoleTargetEpsilon(1e-7);
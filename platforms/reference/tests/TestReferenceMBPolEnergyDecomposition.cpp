@@ -0,0 +1,306 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the energy decomposition of the MBPol forces: the shares of the
+ * molecules must add up to the energy of each force, a two-body share must be
+ * half the sum of the dimer energies of its molecule, and the electrostatics
+ * must split into its permanent and induction parts.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 125 waters on a distorted cubic lattice at liquid density
+
+const int    side           = 5;
+const int    numberOfWaters = side*side*side;
+
+MBPolElectrostaticsForce* createElectrostaticsForce( MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod, int numWaters ) {
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numWaters, nonbondedMethod );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-12 );
+    if( nonbondedMethod == MBPolElectrostaticsForce::PME ){
+        mbpolElectrostaticsForce->setCutoffDistance( 0.7 );
+        mbpolElectrostaticsForce->setAEwald( 0. );
+        mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-06 );
+    }
+
+    std::vector<double> thole( 5 );
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+    mbpolElectrostaticsForce->setTholeParameters( thole );
+    return mbpolElectrostaticsForce;
+}
+
+double sum( const std::vector<double>& values ) {
+    double total = 0.0;
+    for( unsigned int ii = 0; ii < values.size(); ii++ ){
+        total += values[ii];
+    }
+    return total;
+}
+
+// the shares of the molecules add up to the energy of the force
+
+template <class ForceType>
+void checkMoleculeEnergies( const std::string& testName, System& system, ForceType* force,
+                            const std::vector<Vec3>& positions, int numWaters ) {
+
+    force->setIncludeEnergyDecomposition( true );
+    system.addForce( force );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    double energy = context.getState( State::Energy ).getPotentialEnergy();
+
+    std::vector<double> energies;
+    force->getMoleculeEnergies( context, energies );
+    ASSERT_EQUAL( numWaters, static_cast<int>( energies.size() ) );
+    std::cout << testName << ": energy " << energy << " sum of the molecules " << sum( energies ) << " kJ/mol" << std::endl;
+    ASSERT_EQUAL_TOL( energy, sum( energies ), 1.0e-10 );
+}
+
+void testOneBodyDecomposition( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolOneBodyForce* mbpolOneBodyForce = new MBPolOneBodyForce();
+    mbpolOneBodyForce->setNonbondedMethod( MBPolOneBodyForce::Periodic );
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        particleIndices[0] = 4*m;
+        particleIndices[1] = 4*m+1;
+        particleIndices[2] = 4*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+    }
+    checkMoleculeEnergies( "testOneBodyDecomposition", system, mbpolOneBodyForce, positions, numberOfWaters );
+}
+
+void testTwoBodyDecomposition( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.65 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+    checkMoleculeEnergies( "testTwoBodyDecomposition", system, mbpolTwoBodyForce, positions, numberOfWaters );
+}
+
+void testThreeBodyDecomposition( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffPeriodic );
+    addWaterParticles( mbpolThreeBodyForce, numberOfWaters );
+    checkMoleculeEnergies( "testThreeBodyDecomposition", system, mbpolThreeBodyForce, positions, numberOfWaters );
+}
+
+// two-body energy of the waters first and second of a trimer, on their own
+
+double getDimerEnergy( const std::vector<Vec3>& trimerPositions, int first, int second ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond, 2 );
+    for( int ii = 0; ii < 4; ii++ ){
+        positions[ii]   = trimerPositions[4*first+ii];
+        positions[4+ii] = trimerPositions[4*second+ii];
+    }
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 10.0 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    addWaterParticles( mbpolTwoBodyForce, 2 );
+    system.addForce( mbpolTwoBodyForce );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    return context.getState( State::Energy ).getPotentialEnergy();
+}
+
+// in a trimer, each water gets half of the two dimer energies it takes part in
+
+void testTwoBodyTrimerShares( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond, 3 );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 10.0 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    mbpolTwoBodyForce->setIncludeEnergyDecomposition( true );
+    addWaterParticles( mbpolTwoBodyForce, 3 );
+    system.addForce( mbpolTwoBodyForce );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    context.getState( State::Energy );
+
+    std::vector<double> energies;
+    mbpolTwoBodyForce->getMoleculeEnergies( context, energies );
+    double dimer01 = getDimerEnergy( positions, 0, 1 );
+    double dimer02 = getDimerEnergy( positions, 0, 2 );
+    double dimer12 = getDimerEnergy( positions, 1, 2 );
+    ASSERT_EQUAL_TOL( 0.5*(dimer01 + dimer02), energies[0], 1.0e-10 );
+    ASSERT_EQUAL_TOL( 0.5*(dimer01 + dimer12), energies[1], 1.0e-10 );
+    ASSERT_EQUAL_TOL( 0.5*(dimer02 + dimer12), energies[2], 1.0e-10 );
+}
+
+void testElectrostaticsDecomposition( MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod ) {
+
+    std::string testName = nonbondedMethod == MBPolElectrostaticsForce::PME ? "testElectrostaticsDecompositionPME" : "testElectrostaticsDecompositionNoCutoff";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createElectrostaticsForce( nonbondedMethod, numberOfWaters );
+    mbpolElectrostaticsForce->setIncludeEnergyDecomposition( true );
+    system.addForce( mbpolElectrostaticsForce );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    context.computeVirtualSites();
+    double energy = context.getState( State::Energy ).getPotentialEnergy();
+
+    std::vector<double> permanent, induction;
+    mbpolElectrostaticsForce->getMoleculeEnergies( context, permanent, induction );
+    ASSERT_EQUAL( numberOfWaters, static_cast<int>( permanent.size() ) );
+    ASSERT_EQUAL( numberOfWaters, static_cast<int>( induction.size() ) );
+    std::cout << testName << ": energy " << energy << " permanent " << sum( permanent )
+              << " induction " << sum( induction ) << " kJ/mol" << std::endl;
+
+    // the reciprocal space induction energy is taken on the dipole side, the
+    // decomposition takes it on the charge side; both agree within the PME error
+
+    double tolerance = nonbondedMethod == MBPolElectrostaticsForce::PME ? 1.0e-3 : 1.0e-8;
+    ASSERT_EQUAL_TOL( energy, sum( permanent ) + sum( induction ), tolerance );
+    ASSERT( sum( induction ) < 0.0 );
+
+    std::vector<double> potentials, charges;
+    mbpolElectrostaticsForce->getSitePotentials( context, potentials, charges );
+    ASSERT_EQUAL( 4*numberOfWaters, static_cast<int>( potentials.size() ) );
+    ASSERT_EQUAL( 4*numberOfWaters, static_cast<int>( charges.size() ) );
+    double siteEnergy = 0.0;
+    for( unsigned int ii = 0; ii < potentials.size(); ii++ ){
+        siteEnergy += 0.5*charges[ii]*potentials[ii];
+    }
+    ASSERT_EQUAL_TOL( sum( permanent ) + sum( induction ), siteEnergy, 1.0e-10 );
+}
+
+// without setIncludeEnergyDecomposition(), or before the first evaluation, there is nothing to return
+
+void testDecompositionNotAvailable( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.65 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    mbpolTwoBodyForce->setIncludeEnergyDecomposition( true );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+    system.addForce( mbpolTwoBodyForce );
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createElectrostaticsForce( MBPolElectrostaticsForce::NoCutoff, numberOfWaters );
+    system.addForce( mbpolElectrostaticsForce );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+
+    std::vector<double> energies, induction;
+    bool thrown = false;
+    try {
+        mbpolTwoBodyForce->getMoleculeEnergies( context, energies );
+    } catch( const OpenMMException& ) {
+        thrown = true;
+    }
+    ASSERT( thrown );
+
+    context.getState( State::Energy );
+    mbpolTwoBodyForce->getMoleculeEnergies( context, energies );
+    thrown = false;
+    try {
+        mbpolElectrostaticsForce->getMoleculeEnergies( context, energies, induction );
+    } catch( const OpenMMException& ) {
+        thrown = true;
+    }
+    ASSERT( thrown );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolEnergyDecomposition running test..." << std::endl;
+
+        testOneBodyDecomposition();
+        testTwoBodyDecomposition();
+        testThreeBodyDecomposition();
+        testTwoBodyTrimerShares();
+        testElectrostaticsDecomposition( MBPolElectrostaticsForce::NoCutoff );
+        testElectrostaticsDecomposition( MBPolElectrostaticsForce::PME );
+        testDecompositionNotAvailable();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,442 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests MBPolEngine: for a cluster its energy and forces must agree with a Context
+ * holding the MBPol forces and the dispersion of mbpol.xml, and in a periodic box its
+ * forces and virial must be the derivatives of its energy. The neighbor list and the
+ * induced dipoles kept between calls must not change the result. The parameters the
+ * engine uses (ReferenceMBPolWaterParameters.h) must be those of python/mbpol.xml.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "ReferenceMBPolWaterParameters.h"
+#include "openmm/CustomNonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const double virtualSiteWeightO = 0.573293118;
+const double virtualSiteWeightH = 0.213353441;
+
+// O, H, H of the waters of MBPolTestWaters.h, 9 coordinates per water
+
+void buildWaters( int side, double waterSpacing, std::vector<double>& positions ) {
+
+    int numberOfWaters = side*side*side;
+    positions.resize( 9*numberOfWaters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        Vec3 atoms[3];
+        getLatticeWater( m, side, waterSpacing, true, atoms );
+        for( int s = 0; s < 3; s++ ){
+            for( int d = 0; d < 3; d++ ){
+                positions[9*m+3*s+d] = atoms[s][d];
+            }
+        }
+    }
+}
+
+// the same cluster as a System with the forces of mbpol.xml
+
+double computeWithContext( const std::vector<double>& coordinates, std::vector<Vec3>& forces ) {
+
+    int numberOfWaters = coordinates.size()/9;
+    System system;
+    std::vector<Vec3> positions( 4*numberOfWaters );
+
+    MBPolOneBodyForce* mbpolOneBodyForce = new MBPolOneBodyForce();
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.65 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.45 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffNonPeriodic );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = new MBPolElectrostaticsForce();
+    mbpolElectrostaticsForce->setNonbondedMethod( MBPolElectrostaticsForce::NoCutoff );
+    std::vector<double> thole( 5 );
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+    mbpolElectrostaticsForce->setTholeParameters( thole );
+
+    std::vector<double> c6Table( 4, 0.0 );
+    std::vector<double> d6Table( 4, 0.0 );
+    c6Table[0] = 9.92951990e-4;
+    c6Table[1] = c6Table[2] = 3.49345451e-4;
+    c6Table[3] = 8.40715638e-5;
+    d6Table[0] = 9.29548582e+01;
+    d6Table[1] = d6Table[2] = 9.77520243e+01;
+    d6Table[3] = 9.40647517e+01;
+    CustomNonbondedForce* dispersionForce = new CustomNonbondedForce( "-C6*tt6/r^6; tt6=1.0 - tt6sum*exp(-d6*r);"
+        "tt6sum = 1 + (1 + (1 + (1 + (1 + (1 + (1) * d6 * r / 6) * d6 * r / 5) * d6 * r / 4) * d6 * r / 3) * d6 * r / 2) * d6 * r / 1;"
+        "C6=C6table(type1, type2); d6=d6table(type1, type2)" );
+    dispersionForce->addTabulatedFunction( "C6table", new Discrete2DFunction( 2, 2, c6Table ) );
+    dispersionForce->addTabulatedFunction( "d6table", new Discrete2DFunction( 2, 2, d6Table ) );
+    dispersionForce->addPerParticleParameter( "type" );
+
+    std::vector<int> particleIndices(3);
+    std::vector<double> type(1);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        for( int s = 0; s < 3; s++ ){
+            positions[4*m+s] = Vec3( coordinates[9*m+3*s], coordinates[9*m+3*s+1], coordinates[9*m+3*s+2] );
+        }
+        positions[4*m+3] = positions[4*m]*virtualSiteWeightO + (positions[4*m+1] + positions[4*m+2])*virtualSiteWeightH;
+
+        system.addParticle( 1.5999000e+01 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 0. ); // Virtual Site
+        system.setVirtualSite( 4*m+3, new ThreeParticleAverageSite( 4*m, 4*m+1, 4*m+2,
+                                                                   virtualSiteWeightO, virtualSiteWeightH, virtualSiteWeightH ) );
+
+        particleIndices[0] = 4*m;
+        particleIndices[1] = 4*m+1;
+        particleIndices[2] = 4*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+        mbpolTwoBodyForce->addParticle( particleIndices );
+        mbpolThreeBodyForce->addParticle( particleIndices );
+
+        mbpolElectrostaticsForce->addElectrostatics( -5.1966000e-01, m, 0, 0.001310, 0.001310 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        mbpolElectrostaticsForce->addElectrostatics(  0.,            m, 2, 0.001310, 0. );
+
+        type[0] = 0.0;
+        dispersionForce->addParticle( type );
+        type[0] = 1.0;
+        dispersionForce->addParticle( type );
+        dispersionForce->addParticle( type );
+        dispersionForce->addParticle( type );
+    }
+
+    // dispersion only between the atoms of different waters
+
+    for( int ii = 0; ii < 4*numberOfWaters; ii++ ){
+        for( int jj = ii+1; jj < 4*numberOfWaters; jj++ ){
+            if( ii/4 == jj/4 || ii % 4 == 3 || jj % 4 == 3 ){
+                dispersionForce->addExclusion( ii, jj );
+            }
+        }
+    }
+
+    system.addForce( mbpolOneBodyForce );
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+    system.addForce( mbpolElectrostaticsForce );
+    system.addForce( dispersionForce );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    context.computeVirtualSites();
+    State state = context.getState( State::Forces | State::Energy );
+
+    // the force on M is passed on to O, H and H by the virtual site
+
+    forces.resize( 3*numberOfWaters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        for( int s = 0; s < 3; s++ ){
+            forces[3*m+s] = state.getForces()[4*m+s];
+        }
+    }
+    return state.getPotentialEnergy();
+}
+
+void testClusterAgainstContext( ) {
+
+    std::vector<double> positions;
+    buildWaters( 2, 0.31, positions );
+
+    MBPolEngine engine( 8 );
+    ASSERT_EQUAL( 24, engine.getNumAtoms() );
+    ASSERT( !engine.usesPeriodicBoundaryConditions() );
+
+    std::vector<double> forces( positions.size() );
+    double energy = engine.compute( &positions[0], &forces[0], NULL );
+
+    std::vector<Vec3> expectedForces;
+    double expectedEnergy = computeWithContext( positions, expectedForces );
+    std::cout << "testClusterAgainstContext: engine " << energy << " Context " << expectedEnergy << " kJ/mol" << std::endl;
+
+    ASSERT_EQUAL_TOL( expectedEnergy, energy, 1.0e-6 );
+    for( int ii = 0; ii < engine.getNumAtoms(); ii++ ){
+        ASSERT_EQUAL_VEC( expectedForces[ii], Vec3( forces[3*ii], forces[3*ii+1], forces[3*ii+2] ), 1.0e-5 );
+    }
+
+    // the energy alone gives the same result
+
+    ASSERT_EQUAL_TOL( energy, engine.compute( &positions[0], NULL, NULL ), 1.0e-12 );
+}
+
+void testPeriodicDerivatives( ) {
+
+    const int    side         = 4;
+    const double waterSpacing = 0.3104;
+    const double boxDimension = side*waterSpacing;
+    std::vector<double> positions;
+    buildWaters( side, waterSpacing, positions );
+
+    MBPolEngine engine( side*side*side );
+    engine.setCutoffDistance( 0.6 );
+    engine.setEwaldErrorTolerance( 1.0e-6 );
+    engine.setMutualInducedTargetEpsilon( 1.0e-12 );
+    engine.setBox( boxDimension, boxDimension, boxDimension );
+    ASSERT( engine.usesPeriodicBoundaryConditions() );
+
+    std::vector<double> forces( positions.size() );
+    std::vector<double> virial( 9 );
+    engine.compute( &positions[0], &forces[0], &virial[0] );
+
+    // forces against a finite difference of the energy along each coordinate of a few atoms
+
+    const double delta = 1.0e-5;
+    for( int ii = 0; ii < 12; ii += 5 ){
+        for( int d = 0; d < 3; d++ ){
+            std::vector<double> displaced( positions );
+            displaced[3*ii+d] = positions[3*ii+d] + delta;
+            double energyPlus  = engine.compute( &displaced[0], NULL, NULL );
+            displaced[3*ii+d] = positions[3*ii+d] - delta;
+            double energyMinus = engine.compute( &displaced[0], NULL, NULL );
+            ASSERT_EQUAL_TOL( -(energyPlus - energyMinus)/(2.0*delta), forces[3*ii+d], 1.0e-3 );
+        }
+    }
+
+    // diagonal of the virial against a uniform strain of the box and the positions
+
+    const double strain = 1.0e-5;
+    for( int axis = 0; axis < 3; axis++ ){
+        double energies[2];
+        for( int sign = 0; sign < 2; sign++ ){
+            double scale = 1.0 + (sign == 0 ? strain : -strain);
+            double edges[3] = { boxDimension, boxDimension, boxDimension };
+            edges[axis] *= scale;
+            engine.setBox( edges[0], edges[1], edges[2] );
+            std::vector<double> strained( positions );
+            for( unsigned int jj = axis; jj < strained.size(); jj += 3 ){
+                strained[jj] *= scale;
+            }
+            energies[sign] = engine.compute( &strained[0], NULL, NULL );
+        }
+        double finiteDifference = -(energies[0] - energies[1])/(2.0*strain);
+        std::cout << "testPeriodicDerivatives: W[" << axis << "][" << axis << "] " << virial[4*axis]
+                  << " -dE/de " << finiteDifference << " kJ/mol" << std::endl;
+        ASSERT_EQUAL_TOL( finiteDifference, virial[4*axis], 1.0e-3 );
+    }
+}
+
+void testConsecutiveSteps( ) {
+
+    const int    side         = 4;
+    const double waterSpacing = 0.3104;
+    const double boxDimension = side*waterSpacing;
+    std::vector<double> positions;
+    buildWaters( side, waterSpacing, positions );
+
+    MBPolEngine engine( side*side*side );
+    ASSERT( !engine.getInducedDipoleWarmStart() );
+    engine.setInducedDipoleWarmStart( true );
+    engine.setCutoffDistance( 0.6 );
+    engine.setMutualInducedTargetEpsilon( 1.0e-10 );
+    engine.setBox( boxDimension, boxDimension, boxDimension );
+    engine.compute( &positions[0], NULL, NULL );
+
+    // a small move keeps the neighbor list and starts from the previous dipoles
+
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        positions[ii] += 0.002*std::sin( 0.7*ii );
+    }
+    std::vector<double> forces( positions.size() );
+    double energy = engine.compute( &positions[0], &forces[0], NULL );
+    ASSERT_EQUAL( 1, engine.getNumNeighborListBuilds() );
+    ASSERT_EQUAL( 1, engine.getNumInducedDipoleWarmStarts() );
+
+    MBPolEngine coldEngine( side*side*side );
+    coldEngine.setCutoffDistance( 0.6 );
+    coldEngine.setMutualInducedTargetEpsilon( 1.0e-10 );
+    coldEngine.setBox( boxDimension, boxDimension, boxDimension );
+    std::vector<double> expectedForces( positions.size() );
+
+    // by default the engine starts from scratch even for unchanged positions
+
+    coldEngine.compute( &positions[0], NULL, NULL );
+    double expectedEnergy = coldEngine.compute( &positions[0], &expectedForces[0], NULL );
+    ASSERT_EQUAL( 0, coldEngine.getNumInducedDipoleWarmStarts() );
+
+    ASSERT_EQUAL_TOL( expectedEnergy, energy, 1.0e-8 );
+    for( unsigned int ii = 0; ii < forces.size(); ii++ ){
+        ASSERT_EQUAL_TOL( expectedForces[ii], forces[ii], 1.0e-5 );
+    }
+}
+
+// value of an attribute of the first element of the force field file that starts with
+// the given text, e.g. ("<Atom type=\"MBPol-O\"", "charge")
+
+double getForceFieldAttribute( const std::string& forceField, const std::string& element, const std::string& attribute ) {
+
+    size_t start = forceField.find( element );
+    ASSERT( start != std::string::npos );
+    size_t end   = forceField.find( '>', start );
+    size_t value = forceField.find( " " + attribute + "=\"", start );
+    ASSERT( value != std::string::npos && value < end );
+    return atof( forceField.c_str() + value + attribute.size() + 3 );
+}
+
+// the entries of a table of the force field script, e.g. "C6table = [ ... ]"
+
+std::vector<double> getForceFieldTable( const std::string& forceField, const std::string& name ) {
+
+    size_t start = forceField.find( name + " = [" );
+    ASSERT( start != std::string::npos );
+    size_t end = forceField.find( ']', start );
+    std::istringstream lines( forceField.substr( start + name.size() + 4, end - start - name.size() - 4 ) );
+    std::vector<double> table;
+    std::string line;
+    while( std::getline( lines, line ) ){
+        std::istringstream entries( line.substr( 0, line.find( '#' ) ) );
+        std::string entry;
+        while( std::getline( entries, entry, ',' ) ){
+            if( entry.find_first_not_of( " \t" ) != std::string::npos ){
+                table.push_back( atof( entry.c_str() ) );
+            }
+        }
+    }
+    return table;
+}
+
+void testParametersMatchForceField( ) {
+
+    std::ifstream file( MBPOL_FORCE_FIELD_FILE );
+    ASSERT( file.good() );
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string forceField = contents.str();
+
+    ASSERT_EQUAL( MBPolWaterParameters::twoBodyCutoff, getForceFieldAttribute( forceField, "<MBPolTwoBodyForce", "cutoff_nm" ) );
+    ASSERT_EQUAL( MBPolWaterParameters::threeBodyCutoff, getForceFieldAttribute( forceField, "<MBPolThreeBodyForce", "cutoff_nm" ) );
+    ASSERT_EQUAL( MBPolWaterParameters::virtualSiteWeightO, getForceFieldAttribute( forceField, "<VirtualSite type=\"average3\"", "weight1" ) );
+    ASSERT_EQUAL( MBPolWaterParameters::virtualSiteWeightH, getForceFieldAttribute( forceField, "<VirtualSite type=\"average3\"", "weight2" ) );
+    ASSERT_EQUAL( MBPolWaterParameters::virtualSiteWeightH, getForceFieldAttribute( forceField, "<VirtualSite type=\"average3\"", "weight3" ) );
+
+    // the electrostatics of the O, H and M types; the H-H Thole parameter is the dipole-dipole one, as in mbpol.py
+
+    const char* types[3] = { "MBPol-O", "MBPol-H", "MBPol-M" };
+    for( int type = 0; type < 3; type++ ){
+        std::string atom = std::string( "<Atom type=\"" ) + types[type] + "\" charge";
+        ASSERT_EQUAL( MBPolWaterParameters::siteCharge[type], getForceFieldAttribute( forceField, atom, "charge" ) );
+        ASSERT_EQUAL( MBPolWaterParameters::siteDampingFactor[type], getForceFieldAttribute( forceField, atom, "damping-factor" ) );
+        ASSERT_EQUAL( MBPolWaterParameters::sitePolarity[type], getForceFieldAttribute( forceField, atom, "polarizability" ) );
+    }
+    const char* tholeAttributes[5] = { "thole-charge-charge", "thole-charge-dipole", "thole-dipole-dipole",
+                                       "thole-dipole-dipole-singlebond", "thole-dipole-dipole" };
+    for( int ii = 0; ii < 5; ii++ ){
+        ASSERT_EQUAL( MBPolWaterParameters::thole[ii], getForceFieldAttribute( forceField, "<MBPolElectrostaticsForce", tholeAttributes[ii] ) );
+    }
+
+    // the 4x4 dispersion tables are indexed by the atom classes O = 0, H = 1, M = 2, Cl = 3
+
+    std::vector<double> c6Table = getForceFieldTable( forceField, "C6table" );
+    std::vector<double> d6Table = getForceFieldTable( forceField, "d6table" );
+    ASSERT_EQUAL( 16, (int) c6Table.size() );
+    ASSERT_EQUAL( 16, (int) d6Table.size() );
+    for( int typeI = 0; typeI < 2; typeI++ ){
+        for( int typeJ = 0; typeJ < 2; typeJ++ ){
+            ASSERT_EQUAL( MBPolWaterParameters::dispersionC6[typeI][typeJ], c6Table[4*typeI+typeJ] );
+            ASSERT_EQUAL( MBPolWaterParameters::dispersionD6[typeI][typeJ], d6Table[4*typeI+typeJ] );
+        }
+    }
+}
+
+void testInvalidArguments( ) {
+
+    MBPolEngine engine( 2 );
+    bool thrown = false;
+    try {
+        engine.setBox( 1.0, 0.0, 1.0 );
+    } catch( const OpenMMException& ) {
+        thrown = true;
+    }
+    ASSERT( thrown );
+
+    // a box smaller than twice the cutoff is rejected at the evaluation
+
+    std::vector<double> positions;
+    buildWaters( 1, 0.3, positions );
+    positions.resize( 18, 0.0 );
+    for( int ii = 0; ii < 9; ii++ ){
+        positions[9+ii] = positions[ii] + (ii % 3 == 0 ? 0.3 : 0.0);
+    }
+    engine.setBox( 1.0, 1.0, 1.0 );
+    thrown = false;
+    try {
+        engine.compute( &positions[0], NULL, NULL );
+    } catch( const OpenMMException& ) {
+        thrown = true;
+    }
+    ASSERT( thrown );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolEngine running test..." << std::endl;
+
+        testClusterAgainstContext();
+        testPeriodicDerivatives();
+        testConsecutiveSteps();
+        testInvalidArguments();
+        testParametersMatchForceField();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
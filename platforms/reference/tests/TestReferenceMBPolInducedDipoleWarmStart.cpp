@@ -0,0 +1,154 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests starting the induced dipole iterations of MBPolElectrostaticsForce
+ * from the dipoles of the previous evaluation: a Monte Carlo barostat style
+ * rescaling of the molecules must be warm-started, save iterations and give the
+ * same energy and forces as a cold start, and a large displacement must not be
+ * warm-started.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const int    side           = 4;
+const int    numberOfWaters = side*side*side;
+
+MBPolElectrostaticsForce* createElectrostaticsForce( bool warmStart ) {
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, MBPolElectrostaticsForce::PME );
+    mbpolElectrostaticsForce->setCutoffDistance( 0.6 );
+    mbpolElectrostaticsForce->setAEwald( 0. );
+    mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-05 );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-10 );
+    mbpolElectrostaticsForce->setInducedDipoleWarmStart( warmStart );
+    return mbpolElectrostaticsForce;
+}
+
+// move the molecules with their oxygens, as MonteCarloBarostat does, and scale the box
+
+void scaleMolecules( Context& context, const std::vector<Vec3>& positions, double scale, std::vector<Vec3>& scaledPositions ) {
+
+    scaledPositions = positions;
+    for( int m = 0; m < numberOfWaters; m++ ){
+        Vec3 shift = positions[4*m]*(scale - 1.0);
+        for( int ii = 0; ii < 4; ii++ ){
+            scaledPositions[4*m+ii] += shift;
+        }
+    }
+    double boxDimension = side*waterLatticeSpacing*scale;
+    context.setPeriodicBoxVectors( Vec3( boxDimension, 0.0, 0.0 ), Vec3( 0.0, boxDimension, 0.0 ), Vec3( 0.0, 0.0, boxDimension ) );
+    context.setPositions( scaledPositions );
+}
+
+void testBarostatTrial( ) {
+
+    std::string testName = "testBarostatTrial";
+
+    System coldSystem, warmSystem;
+    std::vector<Vec3> positions;
+    buildWaterLattice( coldSystem, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    buildWaterLattice( warmSystem, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    MBPolElectrostaticsForce* coldForce = createElectrostaticsForce( false );
+    MBPolElectrostaticsForce* warmForce = createElectrostaticsForce( true );
+    coldSystem.addForce( coldForce );
+    warmSystem.addForce( warmForce );
+
+    VerletIntegrator coldIntegrator( 0.0002 );
+    VerletIntegrator warmIntegrator( 0.0002 );
+    Context coldContext( coldSystem, coldIntegrator, Platform::getPlatformByName( "Reference" ) );
+    Context warmContext( warmSystem, warmIntegrator, Platform::getPlatformByName( "Reference" ) );
+
+    // the first evaluation has nothing to start from
+
+    warmContext.setPositions( positions );
+    warmContext.getState( State::Energy );
+    int numWarmStarts, numIterationsSaved;
+    warmForce->getInducedDipoleWarmStartStatistics( warmContext, numWarmStarts, numIterationsSaved );
+    ASSERT_EQUAL( 0, numWarmStarts );
+
+    // a volume trial
+
+    std::vector<Vec3> scaledPositions;
+    scaleMolecules( coldContext, positions, 1.005, scaledPositions );
+    scaleMolecules( warmContext, positions, 1.005, scaledPositions );
+    State coldState = coldContext.getState( State::Forces | State::Energy );
+    State warmState = warmContext.getState( State::Forces | State::Energy );
+
+    warmForce->getInducedDipoleWarmStartStatistics( warmContext, numWarmStarts, numIterationsSaved );
+    std::cout << testName << ": energy cold " << coldState.getPotentialEnergy() << " warm " << warmState.getPotentialEnergy()
+              << " kJ/mol, " << numIterationsSaved << " iterations saved" << std::endl;
+    ASSERT_EQUAL( 1, numWarmStarts );
+    ASSERT( numIterationsSaved > 0 );
+    ASSERT_EQUAL_TOL( coldState.getPotentialEnergy(), warmState.getPotentialEnergy(), 1.0e-7 );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        ASSERT_EQUAL_VEC( coldState.getForces()[ii], warmState.getForces()[ii], 1.0e-5 );
+    }
+
+    // a molecule moved far is not warm-started
+
+    scaledPositions[0] += Vec3( 0.1, 0.0, 0.0 );
+    warmContext.setPositions( scaledPositions );
+    warmContext.getState( State::Energy );
+    warmForce->getInducedDipoleWarmStartStatistics( warmContext, numWarmStarts, numIterationsSaved );
+    ASSERT_EQUAL( 1, numWarmStarts );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolInducedDipoleWarmStart running test..." << std::endl;
+
+        testBarostatTrial();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
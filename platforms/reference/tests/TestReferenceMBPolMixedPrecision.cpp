@@ -0,0 +1,193 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the mixed precision mode of MBPolTwoBodyForce and MBPolThreeBodyForce:
+ * the single precision polynomials must reproduce the energy and forces of the
+ * double precision ones, and must not add a drift to the total energy of an NVE run.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 64 waters on a distorted cubic lattice at liquid density
+
+const int    side           = 4;
+const int    numberOfWaters = side*side*side;
+
+// the same configuration in double and in mixed precision; the mode is switched
+// with updateParametersInContext()
+
+template <class ForceType>
+void checkMixedPrecision( const std::string& testName, ForceType* force ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | StretchedWaterBond );
+    addWaterParticles( force, numberOfWaters, 3 );
+    system.addForce( force );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    State doubleState = context.getState( State::Forces | State::Energy );
+
+    force->setUseMixedPrecision( true );
+    force->updateParametersInContext( context );
+    State mixedState = context.getState( State::Forces | State::Energy );
+
+    double energy      = doubleState.getPotentialEnergy();
+    double mixedEnergy = mixedState.getPotentialEnergy();
+    const std::vector<Vec3>& forces      = doubleState.getForces();
+    const std::vector<Vec3>& mixedForces = mixedState.getForces();
+    double norm       = 0.0;
+    double difference = 0.0;
+    for( unsigned int ii = 0; ii < forces.size(); ii++ ){
+        norm       += forces[ii].dot( forces[ii] );
+        difference += (mixedForces[ii] - forces[ii]).dot( mixedForces[ii] - forces[ii] );
+    }
+    double forceError = std::sqrt( difference/norm );
+    std::cout << testName << ": energy " << energy << " mixed " << mixedEnergy << " kJ/mol, relative rms force difference "
+              << forceError << std::endl;
+
+    ASSERT( mixedEnergy != energy );
+    ASSERT_EQUAL_TOL( energy, mixedEnergy, 1.0e-5 );
+    ASSERT( forceError < 1.0e-5 );
+}
+
+void testTwoBodyMixedPrecision( ) {
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.6 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    checkMixedPrecision( "testTwoBodyMixedPrecision", mbpolTwoBodyForce );
+}
+
+void testThreeBodyMixedPrecision( ) {
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffPeriodic );
+    checkMixedPrecision( "testThreeBodyMixedPrecision", mbpolThreeBodyForce );
+}
+
+// total energy along an NVE run of the cluster with the 1-, 2- and 3-body terms
+
+std::vector<double> runNVE( bool mixedPrecision, int numSteps ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, StretchedWaterBond );
+
+    MBPolOneBodyForce* mbpolOneBodyForce = new MBPolOneBodyForce();
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        particleIndices[0] = 3*m;
+        particleIndices[1] = 3*m+1;
+        particleIndices[2] = 3*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+    }
+    system.addForce( mbpolOneBodyForce );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.6 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    mbpolTwoBodyForce->setUseMixedPrecision( mixedPrecision );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters, 3 );
+    system.addForce( mbpolTwoBodyForce );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffNonPeriodic );
+    mbpolThreeBodyForce->setUseMixedPrecision( mixedPrecision );
+    addWaterParticles( mbpolThreeBodyForce, numberOfWaters, 3 );
+    system.addForce( mbpolThreeBodyForce );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+
+    std::vector<double> energies;
+    for( int step = 0; step <= numSteps; step++ ){
+        if( step > 0 ){
+            integrator.step( 1 );
+        }
+        State state = context.getState( State::Energy );
+        energies.push_back( state.getPotentialEnergy() + state.getKineticEnergy() );
+    }
+    return energies;
+}
+
+void testEnergyDrift( ) {
+
+    const int numSteps = 100;
+    std::vector<double> energies      = runNVE( false, numSteps );
+    std::vector<double> mixedEnergies = runNVE( true, numSteps );
+
+    double deviation      = 0.0;
+    double mixedDeviation = 0.0;
+    for( int step = 0; step <= numSteps; step++ ){
+        deviation      = std::max( deviation, std::abs( energies[step] - energies[0] ) );
+        mixedDeviation = std::max( mixedDeviation, std::abs( mixedEnergies[step] - mixedEnergies[0] ) );
+    }
+    std::cout << "testEnergyDrift: largest change of the total energy over " << numSteps << " steps, double "
+              << deviation << " mixed " << mixedDeviation << " kJ/mol" << std::endl;
+
+    ASSERT( mixedDeviation < 2.0*deviation + 1.0e-3 );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolMixedPrecision running test..." << std::endl;
+
+        testTwoBodyMixedPrecision();
+        testThreeBodyMixedPrecision();
+        testEnergyDrift();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,266 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the split of MBPolTwoBodyForce and MBPolElectrostaticsForce into
+ * ShortRange and LongRange parts for multiple time step integration: the two
+ * parts must add up to the full term, and the ShortRange forces must be the
+ * gradient of the ShortRange energy. The ShortRange electrostatics must vanish
+ * beyond the split distance and leave a smooth LongRange remainder.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 64 waters on a slightly distorted cubic lattice at liquid density, so that
+// oxygen-oxygen distances fall on both sides of and inside the 2B split region
+
+const int    side           = 4;
+const int    numberOfWaters = side*side*side;
+
+MBPolTwoBodyForce* createTwoBodyForce( MBPolTwoBodyForce::InteractionGroup interactionGroup, int forceGroup ) {
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.6 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    mbpolTwoBodyForce->setInteractionGroup( interactionGroup );
+    mbpolTwoBodyForce->setSplitDistance( 0.45 );
+    mbpolTwoBodyForce->setSplitWidth( 0.1 );
+    mbpolTwoBodyForce->setForceGroup( forceGroup );
+
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+    return mbpolTwoBodyForce;
+}
+
+MBPolElectrostaticsForce* createElectrostaticsForce( MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod,
+                                                     MBPolElectrostaticsForce::InteractionGroup interactionGroup, int forceGroup,
+                                                     int numWaters = numberOfWaters ) {
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numWaters, nonbondedMethod );
+    mbpolElectrostaticsForce->setInteractionGroup( interactionGroup );
+    mbpolElectrostaticsForce->setSplitDistance( 0.45 );
+    mbpolElectrostaticsForce->setSplitWidth( 0.1 );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-12 );
+    if( nonbondedMethod == MBPolElectrostaticsForce::PME ){
+        mbpolElectrostaticsForce->setCutoffDistance( 0.45 );
+        mbpolElectrostaticsForce->setIncludeChargeRedistribution( false );
+        mbpolElectrostaticsForce->setAEwald( 0. );
+        mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-03 );
+    }
+    mbpolElectrostaticsForce->setForceGroup( forceGroup );
+
+    std::vector<double> thole( 5 );
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+    mbpolElectrostaticsForce->setTholeParameters( thole );
+    return mbpolElectrostaticsForce;
+}
+
+// force groups 0, 1 and 2 hold the AllInteractions, ShortRange and LongRange forces
+
+void checkSplit( const std::string& testName, Context& context, const std::vector<Vec3>& positions ) {
+
+    context.setPositions( positions );
+    State all       = context.getState( State::Forces | State::Energy, false, 1 << 0 );
+    State shortPart = context.getState( State::Forces | State::Energy, false, 1 << 1 );
+    State longPart  = context.getState( State::Forces | State::Energy, false, 1 << 2 );
+
+    std::cout << testName << ": all " << all.getPotentialEnergy() << " short " << shortPart.getPotentialEnergy()
+              << " long " << longPart.getPotentialEnergy() << " kJ/mol" << std::endl;
+
+    ASSERT( shortPart.getPotentialEnergy() != 0.0 );
+    ASSERT( longPart.getPotentialEnergy() != 0.0 );
+    ASSERT_EQUAL_TOL( all.getPotentialEnergy(), shortPart.getPotentialEnergy() + longPart.getPotentialEnergy(), 1.0e-8 );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        ASSERT_EQUAL_VEC( all.getForces()[ii], shortPart.getForces()[ii] + longPart.getForces()[ii], 1.0e-6 );
+    }
+}
+
+// compare the ShortRange forces with central differences of the ShortRange energy along the forces
+
+void checkShortRangeGradient( const std::string& testName, Context& context, const std::vector<Vec3>& positions ) {
+
+    context.setPositions( positions );
+    State state = context.getState( State::Forces | State::Energy, false, 1 << 1 );
+    const std::vector<Vec3>& forces = state.getForces();
+
+    double norm = 0.0;
+    for( unsigned int ii = 0; ii < forces.size(); ii++ ){
+        norm += forces[ii].dot( forces[ii] );
+    }
+    norm = std::sqrt( norm );
+
+    const double delta = 1.0e-5;
+    std::vector<Vec3> displaced( positions );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        displaced[ii] = positions[ii] - forces[ii]*(delta/norm);
+    }
+    context.setPositions( displaced );
+    context.computeVirtualSites();
+    double energyPlus = context.getState( State::Energy, false, 1 << 1 ).getPotentialEnergy();
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        displaced[ii] = positions[ii] + forces[ii]*(delta/norm);
+    }
+    context.setPositions( displaced );
+    context.computeVirtualSites();
+    double energyMinus = context.getState( State::Energy, false, 1 << 1 ).getPotentialEnergy();
+
+    std::cout << testName << ": |F| " << norm << " dE/dx " << (energyPlus - energyMinus)/(2.0*delta) << std::endl;
+    ASSERT_EQUAL_TOL( norm, (energyPlus - energyMinus)/(2.0*delta), 1.0e-3 );
+}
+
+void testTwoBodySplit( ) {
+
+    std::string testName = "testTwoBodySplit";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    system.addForce( createTwoBodyForce( MBPolTwoBodyForce::AllInteractions, 0 ) );
+    system.addForce( createTwoBodyForce( MBPolTwoBodyForce::ShortRange, 1 ) );
+    system.addForce( createTwoBodyForce( MBPolTwoBodyForce::LongRange, 2 ) );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+
+    checkSplit( testName, context, positions );
+    checkShortRangeGradient( testName, context, positions );
+}
+
+void testElectrostaticsSplit( MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod ) {
+
+    std::string testName = nonbondedMethod == MBPolElectrostaticsForce::PME ? "testElectrostaticsSplitPME" : "testElectrostaticsSplitNoCutoff";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    system.addForce( createElectrostaticsForce( nonbondedMethod, MBPolElectrostaticsForce::AllInteractions, 0 ) );
+    system.addForce( createElectrostaticsForce( nonbondedMethod, MBPolElectrostaticsForce::ShortRange, 1 ) );
+    system.addForce( createElectrostaticsForce( nonbondedMethod, MBPolElectrostaticsForce::LongRange, 2 ) );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+
+    checkSplit( testName, context, positions );
+    checkShortRangeGradient( testName, context, positions );
+}
+
+// pull a water dimer apart along x, from an oxygen-oxygen distance of 0.30 nm through the
+// split region to 0.60 nm: beyond the split distance the ShortRange part must be zero, and
+// between neighbouring points the change of the LongRange energy must match the trapezoidal
+// integral of the LongRange force, so the remainder has no jumps
+
+void testElectrostaticsSplitSmoothness( ) {
+
+    std::string testName = "testElectrostaticsSplitSmoothness";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, WaterVirtualSites, 2 );
+    system.addForce( createElectrostaticsForce( MBPolElectrostaticsForce::NoCutoff, MBPolElectrostaticsForce::ShortRange, 1, 2 ) );
+    system.addForce( createElectrostaticsForce( MBPolElectrostaticsForce::NoCutoff, MBPolElectrostaticsForce::LongRange, 2, 2 ) );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+
+    const double step     = 0.0025;
+    Vec3 offset           = positions[4] - positions[0];
+    double previousEnergy = 0.0;
+    double previousForce  = 0.0;
+    double maxError       = 0.0;
+    for( int ii = 0; ii <= 120; ii++ ){
+        double distance = 0.30 + ii*step;
+        std::vector<Vec3> displaced( positions );
+        for( unsigned int jj = 4; jj < 8; jj++ ){
+            displaced[jj] = positions[jj] - offset + Vec3( distance, 0.0, 0.0 );
+        }
+        context.setPositions( displaced );
+        State shortPart = context.getState( State::Forces | State::Energy, false, 1 << 1 );
+        State longPart  = context.getState( State::Forces | State::Energy, false, 1 << 2 );
+
+        if( distance >= 0.45 ){
+            ASSERT_EQUAL_TOL( 0.0, shortPart.getPotentialEnergy(), 1.0e-10 );
+            for( unsigned int jj = 0; jj < displaced.size(); jj++ ){
+                ASSERT_EQUAL_VEC( Vec3( 0.0, 0.0, 0.0 ), shortPart.getForces()[jj], 1.0e-10 );
+            }
+        }
+
+        double force = 0.0;
+        for( unsigned int jj = 4; jj < 8; jj++ ){
+            force += longPart.getForces()[jj][0];
+        }
+        if( ii > 0 ){
+            double error = (longPart.getPotentialEnergy() - previousEnergy) + 0.5*step*(force + previousForce);
+            maxError     = std::max( maxError, std::fabs( error ) );
+            ASSERT_EQUAL_TOL( 0.0, error, 2.0e-3 );
+        }
+        previousEnergy = longPart.getPotentialEnergy();
+        previousForce  = force;
+    }
+    std::cout << testName << ": largest energy change not accounted for by the force " << maxError << " kJ/mol" << std::endl;
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolMultipleTimeStep running test..." << std::endl;
+
+        testTwoBodySplit();
+        testElectrostaticsSplit( MBPolElectrostaticsForce::NoCutoff );
+        testElectrostaticsSplit( MBPolElectrostaticsForce::PME );
+        testElectrostaticsSplitSmoothness();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,197 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the single precision PME grids of MBPolElectrostaticsForce: the
+ * energy and forces of a periodic water box must agree with the double precision
+ * grids to well within the Ewald error tolerance, also on the grid of the 4096
+ * water box of TestMBPolBenchmark, where the single precision FFT must match
+ * fftpack.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/internal/NonbondedForceImpl.h"
+#include "openmm/reference/fftpack.h"
+#include "ReferenceMBPolSingleFFT.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 64 waters on a distorted cubic lattice at liquid density
+
+const int    side           = 4;
+const int    numberOfWaters = side*side*side;
+
+// PME grid of the 4096 water lattice of TestMBPolBenchmark (cutoff 0.9 nm, tolerance 1e-4)
+
+int getBenchmarkGridSize( ) {
+
+    double boxDimension = 16*waterLatticeSpacing;
+    System system;
+    system.setDefaultPeriodicBoxVectors( Vec3( boxDimension, 0.0, 0.0 ), Vec3( 0.0, boxDimension, 0.0 ), Vec3( 0.0, 0.0, boxDimension ) );
+    NonbondedForce nb;
+    nb.setEwaldErrorTolerance( 1.0e-04 );
+    nb.setCutoffDistance( 0.9 );
+    double alpha;
+    int gridSizeX, gridSizeY, gridSizeZ;
+    NonbondedForceImpl::calcPMEParameters( system, nb, alpha, gridSizeX, gridSizeY, gridSizeZ );
+    return gridSizeX;
+}
+
+// with gridSize the grid and alpha are fixed instead of taken from the tolerance
+
+State computeState( bool useSinglePrecisionPme, int gridSize = 0 ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, MBPolElectrostaticsForce::PME );
+    mbpolElectrostaticsForce->setCutoffDistance( 0.6 );
+    mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-6 );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-10 );
+    mbpolElectrostaticsForce->setUseSinglePrecisionPme( useSinglePrecisionPme );
+    if( gridSize ){
+        mbpolElectrostaticsForce->setAEwald( 5.0 );
+        mbpolElectrostaticsForce->setPmeGridDimensions( std::vector<int>( 3, gridSize ) );
+    }
+    system.addForce( mbpolElectrostaticsForce );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    return context.getState( State::Forces | State::Energy );
+}
+
+void testSinglePrecisionPme( ) {
+
+    std::string testName = "testSinglePrecisionPme";
+
+    State expected = computeState( false );
+    State found    = computeState( true );
+
+    double forceError = forceDifference( expected, found );
+    std::cout << testName << ": energy double grids " << expected.getPotentialEnergy() << " single grids " << found.getPotentialEnergy()
+              << " kJ/mol, relative rms force difference " << forceError << std::endl;
+
+    ASSERT( expected.getPotentialEnergy() != found.getPotentialEnergy() );
+    ASSERT_EQUAL_TOL( expected.getPotentialEnergy(), found.getPotentialEnergy(), 1.0e-6 );
+    ASSERT( forceError < 1.0e-5 );
+}
+
+void testSinglePrecisionPmeBenchmarkGrid( ) {
+
+    std::string testName = "testSinglePrecisionPmeBenchmarkGrid";
+
+    int gridSize   = getBenchmarkGridSize();
+    State expected = computeState( false, gridSize );
+    State found    = computeState( true, gridSize );
+
+    double forceError = forceDifference( expected, found );
+    std::cout << testName << ": grid " << gridSize << "^3, energy double grids " << expected.getPotentialEnergy() << " single grids "
+              << found.getPotentialEnergy() << " kJ/mol, relative rms force difference " << forceError << std::endl;
+
+    ASSERT_EQUAL_TOL( expected.getPotentialEnergy(), found.getPotentialEnergy(), 1.0e-6 );
+    ASSERT( forceError < 1.0e-5 );
+}
+
+// forward and backward transforms of a random grid of that size against fftpack in double precision
+
+void testSingleFFTBenchmarkGrid( ) {
+
+    std::string testName = "testSingleFFTBenchmarkGrid";
+
+    int gridSize  = getBenchmarkGridSize();
+    int totalSize = gridSize*gridSize*gridSize;
+    std::vector<ReferenceMBPolSingleFFT::Complex> single( totalSize );
+    std::vector<t_complex> reference( totalSize );
+    srand( 5 );
+    for( int ii = 0; ii < totalSize; ii++ ){
+        single[ii].re    = static_cast<float>( rand() )/RAND_MAX;
+        single[ii].im    = 0.0f;
+        reference[ii].re = single[ii].re;
+        reference[ii].im = 0.0;
+    }
+
+    ReferenceMBPolSingleFFT fft;
+    fft.initialize( gridSize, gridSize, gridSize );
+    fftpack_t plan;
+    fftpack_init_3d( &plan, gridSize, gridSize, gridSize );
+    for( int direction = 0; direction < 2; direction++ ){
+        bool forward = (direction == 0);
+        fft.execute( &single[0], forward );
+        fftpack_exec_3d( plan, forward ? FFTPACK_FORWARD : FFTPACK_BACKWARD, &reference[0], &reference[0] );
+        double maxValue = 0.0;
+        double maxError = 0.0;
+        for( int ii = 0; ii < totalSize; ii++ ){
+            maxValue = std::max( maxValue, std::sqrt( reference[ii].re*reference[ii].re + reference[ii].im*reference[ii].im ) );
+            double deltaRe = single[ii].re - reference[ii].re;
+            double deltaIm = single[ii].im - reference[ii].im;
+            maxError = std::max( maxError, std::sqrt( deltaRe*deltaRe + deltaIm*deltaIm ) );
+        }
+        std::cout << testName << ": grid " << gridSize << "^3, " << (forward ? "forward" : "backward")
+                  << " largest error relative to the largest value " << maxError/maxValue << std::endl;
+        ASSERT( maxError < 1.0e-5*maxValue );
+    }
+    fftpack_destroy( plan );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolSinglePrecisionPme running test..." << std::endl;
+
+        testSinglePrecisionPme();
+        testSingleFFTBenchmarkGrid();
+        testSinglePrecisionPmeBenchmarkGrid();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the solver checkpoints of MBPolElectrostaticsForce: a Context restored from
+ * an OpenMM checkpoint and the solver checkpoint must start its first evaluation from the
+ * saved induced dipoles and give the energy and forces of the original Context, and a
+ * checkpoint of a different force must be rejected.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+const int    side           = 4;
+const int    numberOfWaters = side*side*side;
+
+MBPolElectrostaticsForce* createElectrostaticsForce( MBPolElectrostaticsForce::NonbondedMethod method ) {
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, method );
+    mbpolElectrostaticsForce->setCutoffDistance( 0.6 );
+    mbpolElectrostaticsForce->setAEwald( 0. );
+    mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-05 );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-10 );
+    return mbpolElectrostaticsForce;
+}
+
+void testRestart( ) {
+
+    std::string testName = "testRestart";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    MBPolElectrostaticsForce* force = createElectrostaticsForce( MBPolElectrostaticsForce::PME );
+    force->setInducedDipoleWarmStart( true );
+    system.addForce( force );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    State state = context.getState( State::Forces | State::Energy );
+
+    std::stringstream checkpoint, solverCheckpoint;
+    context.createCheckpoint( checkpoint );
+    force->createSolverCheckpoint( context, solverCheckpoint );
+
+    // the restarted run starts from the dipoles the first one converged
+
+    VerletIntegrator restartIntegrator( 0.0002 );
+    Context restartContext( system, restartIntegrator, Platform::getPlatformByName( "Reference" ) );
+    restartContext.loadCheckpoint( checkpoint );
+    force->loadSolverCheckpoint( restartContext, solverCheckpoint );
+    State restartState = restartContext.getState( State::Forces | State::Energy );
+
+    int numWarmStarts, numIterationsSaved;
+    force->getInducedDipoleWarmStartStatistics( restartContext, numWarmStarts, numIterationsSaved );
+    std::cout << testName << ": energy " << state.getPotentialEnergy() << " restarted " << restartState.getPotentialEnergy()
+              << " kJ/mol, " << numIterationsSaved << " iterations saved" << std::endl;
+    ASSERT_EQUAL( 1, numWarmStarts );
+    ASSERT( numIterationsSaved > 0 );
+    ASSERT_EQUAL_TOL( state.getPotentialEnergy(), restartState.getPotentialEnergy(), 1.0e-7 );
+    for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+        ASSERT_EQUAL_VEC( state.getForces()[ii], restartState.getForces()[ii], 1.0e-5 );
+    }
+
+    // the restored neighbor list must follow the molecules like a freshly built one
+
+    std::vector<Vec3> movedPositions( positions );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        Vec3 shift( 0.01*std::sin( 0.7*m ), 0.01*std::cos( 1.3*m ), 0.01*std::sin( 2.1*m ) );
+        for( int ii = 0; ii < 4; ii++ ){
+            movedPositions[4*m+ii] += shift;
+        }
+    }
+    context.setPositions( movedPositions );
+    restartContext.setPositions( movedPositions );
+    state        = context.getState( State::Energy );
+    restartState = restartContext.getState( State::Energy );
+    ASSERT_EQUAL_TOL( state.getPotentialEnergy(), restartState.getPotentialEnergy(), 1.0e-7 );
+}
+
+void testMismatch( ) {
+
+    System system, otherSystem;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    buildWaterLattice( otherSystem, positions, side, PeriodicWaterBox | WaterVirtualSites );
+    MBPolElectrostaticsForce* force      = createElectrostaticsForce( MBPolElectrostaticsForce::PME );
+    MBPolElectrostaticsForce* otherForce = createElectrostaticsForce( MBPolElectrostaticsForce::NoCutoff );
+    system.addForce( force );
+    otherSystem.addForce( otherForce );
+
+    VerletIntegrator integrator( 0.0002 );
+    VerletIntegrator otherIntegrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    Context otherContext( otherSystem, otherIntegrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    context.getState( State::Energy );
+
+    std::stringstream solverCheckpoint;
+    force->createSolverCheckpoint( context, solverCheckpoint );
+    bool threw = false;
+    try {
+        otherForce->loadSolverCheckpoint( otherContext, solverCheckpoint );
+    } catch( const OpenMMException& ) {
+        threw = true;
+    }
+    ASSERT( threw );
+
+    // a truncated checkpoint is rejected, not half loaded
+
+    std::string truncated = solverCheckpoint.str();
+    truncated.resize( truncated.size()/2 );
+    std::stringstream truncatedCheckpoint( truncated );
+    threw = false;
+    try {
+        force->loadSolverCheckpoint( context, truncatedCheckpoint );
+    } catch( const OpenMMException& ) {
+        threw = true;
+    }
+    ASSERT( threw );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolSolverCheckpoint running test..." << std::endl;
+
+        testRestart();
+        testMismatch();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,163 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests that evaluating the MBPol forces of a context concurrently
+ * (ReferenceMBPolTaskGraph) gives the same energies and forces as evaluating
+ * them one after the other, and reports the per-force timings.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "ReferenceMBPolTaskGraph.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 64 waters of the shared lattice with one force per force group
+
+const int side           = 4;
+const int numberOfWaters = side*side*side;
+
+void evaluate( Context& context, std::vector<double>& groupEnergies, double& energy, std::vector<Vec3>& forces ) {
+
+    State state = context.getState( State::Forces | State::Energy );
+    energy = state.getPotentialEnergy();
+    forces = state.getForces();
+
+    groupEnergies.resize( 4 );
+    for( int group = 0; group < 4; group++ ){
+        groupEnergies[group] = context.getState( State::Energy, false, 1 << group ).getPotentialEnergy();
+    }
+}
+
+void testTaskGraphIsTransparent( ) {
+
+    std::string testName = "testTaskGraphIsTransparent";
+
+    bool defaultEnabled = ReferenceMBPolTaskGraph::getDefaultEnabled();
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterForceGroups( system, positions, side );
+
+    // each force evaluated in turn
+
+    std::vector<double> serialGroupEnergies;
+    std::vector<Vec3> serialForces;
+    double serialEnergy;
+    {
+        ReferenceMBPolTaskGraph::setDefaultEnabled( false );
+        VerletIntegrator integrator( 0.0002 );
+        Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+        context.setPositions( positions );
+        evaluate( context, serialGroupEnergies, serialEnergy, serialForces );
+    }
+
+    // all forces of an evaluation run concurrently
+
+    std::vector<double> concurrentGroupEnergies;
+    std::vector<Vec3> concurrentForces;
+    double concurrentEnergy;
+    {
+        ReferenceMBPolTaskGraph::setDefaultEnabled( true );
+        VerletIntegrator integrator( 0.0002 );
+        Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+        context.setPositions( positions );
+
+        ASSERT_EQUAL( 1, ReferenceMBPolTaskGraph::getNumTaskGraphs() );
+        ReferenceMBPolTaskGraph* taskGraph = ReferenceMBPolTaskGraph::getTaskGraph( 0 );
+        ASSERT( taskGraph->getEnabled() );
+        ASSERT_EQUAL( 4, taskGraph->getNumTasks() );
+
+        // one full evaluation: the first force runs on the calling thread, the other three alongside it
+
+        context.getState( State::Forces | State::Energy );
+        int overlaps = 0;
+        for( int ii = 0; ii < taskGraph->getNumTasks(); ii++ ){
+            ASSERT_EQUAL( 1, taskGraph->getTaskCount( ii ) );
+            overlaps += taskGraph->getTaskOverlapCount( ii );
+        }
+        ASSERT_EQUAL( 3, overlaps );
+
+        // a single force group has nothing to overlap with
+
+        taskGraph->resetTimings();
+        context.getState( State::Energy, false, 1 << 2 );
+        for( int ii = 0; ii < taskGraph->getNumTasks(); ii++ ){
+            ASSERT_EQUAL( 0, taskGraph->getTaskOverlapCount( ii ) );
+        }
+
+        taskGraph->resetTimings();
+        evaluate( context, concurrentGroupEnergies, concurrentEnergy, concurrentForces );
+        std::cout << testName << ": per-force timings" << std::endl << taskGraph->getTimingReport();
+    }
+    ASSERT_EQUAL( 0, ReferenceMBPolTaskGraph::getNumTaskGraphs() );
+
+    ReferenceMBPolTaskGraph::setDefaultEnabled( defaultEnabled );
+
+    std::cout << testName << ": " << numberOfWaters << " waters, energy " << concurrentEnergy << " kJ/mol" << std::endl;
+
+    ASSERT_EQUAL_TOL( serialEnergy, concurrentEnergy, 1.0e-8 );
+    for( int group = 0; group < 4; group++ ){
+        ASSERT_EQUAL_TOL( serialGroupEnergies[group], concurrentGroupEnergies[group], 1.0e-8 );
+    }
+    for( unsigned int ii = 0; ii < serialForces.size(); ii++ ){
+        ASSERT_EQUAL_VEC( serialForces[ii], concurrentForces[ii], 1.0e-8 );
+    }
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolTaskGraph running test..." << std::endl;
+
+        testTaskGraphIsTransparent();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,135 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the Treecode method of MBPolElectrostaticsForce against NoCutoff:
+ * a small cluster, in which every pair of waters is within the reach of the
+ * Thole damping, must be identical, and the multipole expansions of a larger
+ * cluster must converge to the NoCutoff energy and forces.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+State computeState( int side, MBPolElectrostaticsForce::NonbondedMethod method, double openingAngle, int expansionOrder ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, WaterVirtualSites );
+    MBPolElectrostaticsForce* force = createWaterElectrostaticsForce( side*side*side, method );
+    force->setMutualInducedTargetEpsilon( 1.0e-10 );
+    force->setTreecodeOpeningAngle( openingAngle );
+    force->setTreecodeExpansionOrder( expansionOrder );
+    system.addForce( force );
+
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+    return context.getState( State::Forces | State::Energy );
+}
+
+void testSmallClusterIsExact( ) {
+
+    std::string testName = "testSmallClusterIsExact";
+
+    State expected = computeState( 2, MBPolElectrostaticsForce::NoCutoff, 0.5, 6 );
+    State found    = computeState( 2, MBPolElectrostaticsForce::Treecode, 0.5, 6 );
+
+    std::cout << testName << ": energy NoCutoff " << expected.getPotentialEnergy() << " Treecode " << found.getPotentialEnergy() << " kJ/mol" << std::endl;
+    ASSERT_EQUAL_TOL( expected.getPotentialEnergy(), found.getPotentialEnergy(), 1.0e-10 );
+    for( unsigned int ii = 0; ii < expected.getForces().size(); ii++ ){
+        ASSERT_EQUAL_VEC( expected.getForces()[ii], found.getForces()[ii], 1.0e-8 );
+    }
+}
+
+void testExpansionConvergence( ) {
+
+    std::string testName = "testExpansionConvergence";
+
+    const int side  = 7;
+    State expected  = computeState( side, MBPolElectrostaticsForce::NoCutoff, 0.5, 6 );
+    State lowOrder  = computeState( side, MBPolElectrostaticsForce::Treecode, 0.5, 2 );
+    State highOrder = computeState( side, MBPolElectrostaticsForce::Treecode, 0.5, 6 );
+
+    double lowOrderError  = forceDifference( expected, lowOrder );
+    double highOrderError = forceDifference( expected, highOrder );
+    std::cout << testName << ": energy NoCutoff " << expected.getPotentialEnergy() << " order 2 " << lowOrder.getPotentialEnergy()
+              << " order 6 " << highOrder.getPotentialEnergy() << " kJ/mol, force errors " << lowOrderError << " " << highOrderError << std::endl;
+
+    ASSERT_EQUAL_TOL( expected.getPotentialEnergy(), lowOrder.getPotentialEnergy(), 2.0e-3 );
+    ASSERT_EQUAL_TOL( expected.getPotentialEnergy(), highOrder.getPotentialEnergy(), 1.0e-4 );
+    ASSERT( lowOrderError < 3.0e-2 );
+    ASSERT( highOrderError < 1.0e-3 );
+    ASSERT( highOrderError < lowOrderError );
+}
+
+void testInvalidOpeningAngle( ) {
+
+    bool threw = false;
+    try {
+        computeState( 2, MBPolElectrostaticsForce::Treecode, 1.5, 6 );
+    } catch( const OpenMMException& ){
+        threw = true;
+    }
+    ASSERT( threw );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolTreecode running test..." << std::endl;
+
+        testSmallClusterIsExact();
+        testExpansionConvergence();
+        testInvalidOpeningAngle();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
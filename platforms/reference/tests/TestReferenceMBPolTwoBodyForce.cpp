@@ -39,6 +39,7 @@
 #include "openmm/System.h"
 #include "openmm/MBPolTwoBodyForce.h"
 #include "MBPolReferenceTwoBodyForce.h"
+#include "poly-dispatch.h"
 #include "openmm/LangevinIntegrator.h"
 #include <iostream>
 #include <vector>
@@ -228,6 +229,27 @@ void testImageMolecules( bool runTestWithAtomImaging, bool addPositionOffset) {
     }
 }
 
+void testPolynomialIsa( ) {
+
+    // the instruction set picked at plugin load is reported by MBPolTwoBodyForce
+
+    PolynomialIsa selectedIsa = getPolynomialIsa();
+    std::cout << "Polynomial instruction set: " << MBPolTwoBodyForce::getPolynomialInstructionSet() << std::endl;
+    ASSERT_EQUAL( std::string( getPolynomialIsaName( selectedIsa ) ), MBPolTwoBodyForce::getPolynomialInstructionSet() );
+
+    // every build available on this CPU must reproduce the reference energy and forces
+
+    for( int isa = PolynomialIsaGeneric; isa <= PolynomialIsaAVX512; isa++ ){
+        if( !isPolynomialIsaAvailable( static_cast<PolynomialIsa>(isa) ) )
+            continue;
+        setPolynomialIsa( static_cast<PolynomialIsa>(isa) );
+        ASSERT_EQUAL( std::string( getPolynomialIsaName( static_cast<PolynomialIsa>(isa) ) ), MBPolTwoBodyForce::getPolynomialInstructionSet() );
+        std::cout << "TestReferenceMBPolTwoBodyForce Cluster with " << getPolynomialIsaName( static_cast<PolynomialIsa>(isa) ) << " polynomials" << std::endl;
+        testTwoBody( 0, false );
+    }
+    setPolynomialIsa( selectedIsa );
+}
+
 int main( int numberOfArguments, char* argv[] ) {
 
     try {
@@ -250,7 +272,7 @@ int main( int numberOfArguments, char* argv[] ) {
         boxDimension = 50;
         testTwoBody( boxDimension, true);
 
-
+        testPolynomialIsa();
 
     } catch(const std::exception& e) {
         std::cout << "exception: " << e.what() << std::endl;
@@ -0,0 +1,212 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the virial tensor of the MBPol forces: each diagonal component must
+ * equal minus the derivative of the energy with respect to a uniform strain of
+ * the box and the positions along that axis, and the tensor must be symmetric.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// 125 waters on a distorted cubic lattice at liquid density; the box is
+// large enough for the 2B, 3B and PME cutoffs used below
+
+const int    side           = 5;
+const int    numberOfWaters = side*side*side;
+
+// energy with the box and all coordinates along axis scaled by 1 + strain
+
+double getStrainedEnergy( Context& context, const std::vector<Vec3>& positions, int axis, double strain ) {
+
+    Vec3 box[3];
+    context.getSystem().getDefaultPeriodicBoxVectors( box[0], box[1], box[2] );
+    box[axis] *= 1.0 + strain;
+    context.setPeriodicBoxVectors( box[0], box[1], box[2] );
+
+    std::vector<Vec3> strained( positions );
+    for( unsigned int ii = 0; ii < strained.size(); ii++ ){
+        strained[ii][axis] *= 1.0 + strain;
+    }
+    context.setPositions( strained );
+    context.computeVirtualSites();
+    return context.getState( State::Energy ).getPotentialEnergy();
+}
+
+template <class ForceType>
+void checkVirial( const std::string& testName, System& system, ForceType* force,
+                  const std::vector<Vec3>& positions, double tolerance ) {
+
+    system.addForce( force );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+
+    context.setPositions( positions );
+    context.getState( State::Forces | State::Energy );
+    std::vector<Vec3> virial;
+    force->getVirial( context, virial );
+    ASSERT_EQUAL( 3, static_cast<int>( virial.size() ) );
+
+    // the PME reciprocal space part is computed on the first request only, and must not be added twice
+
+    std::vector<Vec3> virialAgain;
+    force->getVirial( context, virialAgain );
+    for( int a = 0; a < 3; a++ ){
+        ASSERT_EQUAL_VEC( virial[a], virialAgain[a], 1.0e-12 );
+    }
+
+    const double strain = 1.0e-5;
+    double trace = 0.0;
+    for( int axis = 0; axis < 3; axis++ ){
+        double energyPlus  = getStrainedEnergy( context, positions, axis,  strain );
+        double energyMinus = getStrainedEnergy( context, positions, axis, -strain );
+        double finiteDifference = -(energyPlus - energyMinus)/(2.0*strain);
+        std::cout << testName << ": W[" << axis << "][" << axis << "] " << virial[axis][axis]
+                  << " -dE/de " << finiteDifference << " kJ/mol" << std::endl;
+        ASSERT_EQUAL_TOL( finiteDifference, virial[axis][axis], tolerance );
+        trace += std::fabs( virial[axis][axis] );
+    }
+
+    for( int a = 0; a < 3; a++ ){
+        for( int b = a+1; b < 3; b++ ){
+            ASSERT( std::fabs( virial[a][b] - virial[b][a] ) <= tolerance*trace );
+        }
+    }
+}
+
+void testOneBodyVirial( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolOneBodyForce* mbpolOneBodyForce = new MBPolOneBodyForce();
+    mbpolOneBodyForce->setNonbondedMethod( MBPolOneBodyForce::Periodic );
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        particleIndices[0] = 4*m;
+        particleIndices[1] = 4*m+1;
+        particleIndices[2] = 4*m+2;
+        mbpolOneBodyForce->addOneBody( particleIndices );
+    }
+    checkVirial( "testOneBodyVirial", system, mbpolOneBodyForce, positions, 1.0e-5 );
+}
+
+void testTwoBodyVirial( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.65 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+    checkVirial( "testTwoBodyVirial", system, mbpolTwoBodyForce, positions, 1.0e-5 );
+}
+
+void testThreeBodyVirial( ) {
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffPeriodic );
+    addWaterParticles( mbpolThreeBodyForce, numberOfWaters );
+    checkVirial( "testThreeBodyVirial", system, mbpolThreeBodyForce, positions, 1.0e-5 );
+}
+
+void testElectrostaticsVirial( MBPolElectrostaticsForce::NonbondedMethod nonbondedMethod ) {
+
+    std::string testName = nonbondedMethod == MBPolElectrostaticsForce::PME ? "testElectrostaticsVirialPME" : "testElectrostaticsVirialNoCutoff";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildWaterLattice( system, positions, side, PeriodicWaterBox | WaterVirtualSites | StretchedWaterBond );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, nonbondedMethod );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-12 );
+    if( nonbondedMethod == MBPolElectrostaticsForce::PME ){
+        mbpolElectrostaticsForce->setCutoffDistance( 0.7 );
+        mbpolElectrostaticsForce->setAEwald( 0. );
+        mbpolElectrostaticsForce->setEwaldErrorTolerance( 1.0e-06 );
+    }
+
+    std::vector<double> thole( 5 );
+    thole[TCC]   = 0.4;
+    thole[TCD]   = 0.4;
+    thole[TDD]   = 0.055;
+    thole[TDDOH] = 0.626;
+    thole[TDDHH] = 0.055;
+    mbpolElectrostaticsForce->setTholeParameters( thole );
+
+    // the real space cutoff makes the PME energy slightly discontinuous
+
+    double tolerance = nonbondedMethod == MBPolElectrostaticsForce::PME ? 1.0e-3 : 1.0e-5;
+    checkVirial( testName, system, mbpolElectrostaticsForce, positions, tolerance );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMBPolVirial running test..." << std::endl;
+
+        testOneBodyVirial();
+        testTwoBodyVirial();
+        testThreeBodyVirial();
+        testElectrostaticsVirial( MBPolElectrostaticsForce::NoCutoff );
+        testElectrostaticsVirial( MBPolElectrostaticsForce::PME );
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,218 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the work-stealing scheduler of the Reference kernels
+ * (ReferenceMBPolScheduler): every chunk of a loop with very uneven chunks
+ * runs once, and a cluster of 14-water clusters, whose triplets are
+ * concentrated in the clusters, gives the same energies and forces as the
+ * serial loops. The load-imbalance statistics of the 2B, 3B and induced
+ * dipole field loops are printed.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "ReferenceMBPolParallel.h"
+#include "ReferenceMBPolScheduler.h"
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// copies of the cluster on a side x side x side lattice, 1.2 nm apart
+
+const int    side           = 2;
+const double clusterSpacing = 1.2;
+
+void buildSystem( System& system, std::vector<Vec3>& positions ) {
+
+    int numberOfWaters = buildWaterClusters( system, positions, side, clusterSpacing );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.9 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffNonPeriodic );
+    addWaterParticles( mbpolTwoBodyForce, numberOfWaters );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.45 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffNonPeriodic );
+    addWaterParticles( mbpolThreeBodyForce, numberOfWaters );
+
+    MBPolElectrostaticsForce* mbpolElectrostaticsForce = createWaterElectrostaticsForce( numberOfWaters, MBPolElectrostaticsForce::NoCutoff );
+    mbpolElectrostaticsForce->setMutualInducedTargetEpsilon( 1.0e-10 );
+
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+    system.addForce( mbpolElectrostaticsForce );
+}
+
+void testEveryChunkRunsOnce( ) {
+
+    std::string testName = "testEveryChunkRunsOnce";
+
+    // the first chunks are 20 times as expensive as the others, so the equal
+    // blocks of the first run leave the first thread with most of the work
+
+    const int numChunks = 64;
+    ReferenceMBPolScheduler scheduler( "Test.uneven" );
+    for( int step = 0; step < 4; step++ ){
+        int numThreads = ReferenceMBPolScheduler::getNumThreads();
+        std::vector<int> calls( numChunks, 0 );
+        std::vector<double> sums( numThreads, 0.0 );
+        scheduler.run( numChunks, numThreads, [&]( int chunk, int thread ) {
+            int work = (chunk < 8 ? 200000 : 10000);
+            double sum = 0.0;
+            for( int ii = 0; ii < work; ii++ ){
+                sum += std::sqrt( (double) ii );
+            }
+            sums[thread] += sum;
+            calls[chunk]++;
+        });
+        for( int chunk = 0; chunk < numChunks; chunk++ ){
+            ASSERT_EQUAL( 1, calls[chunk] );
+        }
+    }
+    ReferenceMBPolScheduler::Statistics statistics = ReferenceMBPolScheduler::getStatistics( "Test.uneven" );
+    ASSERT_EQUAL( 4, statistics.runs );
+    ASSERT_EQUAL( 4*numChunks, statistics.chunks );
+    ASSERT( statistics.getImbalance() >= 1.0 );
+    std::cout << testName << ": steals " << statistics.steals << " imbalance " << statistics.getImbalance()
+              << " without stealing " << statistics.getStaticImbalance() << std::endl;
+
+    // an exception in a chunk reaches the caller
+
+    bool caught = false;
+    try {
+        scheduler.run( numChunks, ReferenceMBPolScheduler::getNumThreads(), [&]( int chunk, int thread ) {
+            if( chunk == numChunks/2 ){
+                throw std::runtime_error( "chunk failed" );
+            }
+        });
+    } catch( const std::runtime_error& ){
+        caught = true;
+    }
+    ASSERT( caught );
+
+    // inside another parallel loop the chunks run on the thread of the loop
+
+    ReferenceMBPolParallel::parallelFor( 4, [&]( int item ) {
+        ASSERT_EQUAL( 1, ReferenceMBPolScheduler::getNumThreads() );
+    });
+}
+
+void testWorkStealingIsTransparent( ) {
+
+    std::string testName = "testWorkStealingIsTransparent";
+
+    System system;
+    std::vector<Vec3> positions;
+    buildSystem( system, positions );
+
+    // a few evaluations, so that the later ones use the chunk costs of the earlier ones
+
+    const int numberOfEvaluations = 3;
+    std::vector<State> serialStates, stealingStates;
+    for( int stealing = 0; stealing < 2; stealing++ ){
+        ReferenceMBPolScheduler::setEnabled( stealing == 1 );
+        VerletIntegrator integrator( 0.0002 );
+        Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+        for( int step = 0; step < numberOfEvaluations; step++ ){
+            std::vector<Vec3> stepPositions( positions );
+            for( unsigned int ii = 0; ii < stepPositions.size(); ii++ ){
+                stepPositions[ii] += Vec3( 0.0005*step, 0.0, 0.0005*std::sin( 1.0*ii + step ) );
+            }
+            context.setPositions( stepPositions );
+            context.computeVirtualSites();
+            State state = context.getState( State::Forces | State::Energy );
+            (stealing ? stealingStates : serialStates).push_back( state );
+        }
+    }
+
+    std::cout << testName << ": " << side*side*side*watersPerCluster << " waters, " << ReferenceMBPolParallel::getNumThreads()
+              << " threads, energy " << stealingStates[0].getPotentialEnergy() << " kJ/mol" << std::endl;
+    std::cout << ReferenceMBPolScheduler::getReport();
+
+    for( int step = 0; step < numberOfEvaluations; step++ ){
+        ASSERT_EQUAL_TOL( serialStates[step].getPotentialEnergy(), stealingStates[step].getPotentialEnergy(), 1.0e-8 );
+        for( unsigned int ii = 0; ii < positions.size(); ii++ ){
+            ASSERT_EQUAL_VEC( serialStates[step].getForces()[ii], stealingStates[step].getForces()[ii], 1.0e-8 );
+        }
+    }
+
+    const int numberOfChunks = (side*side*side*watersPerCluster + 15)/16;
+    ReferenceMBPolScheduler::Statistics twoBody   = ReferenceMBPolScheduler::getStatistics( "TwoBody.polynomial" );
+    ReferenceMBPolScheduler::Statistics threeBody = ReferenceMBPolScheduler::getStatistics( "ThreeBody.polynomial" );
+    ReferenceMBPolScheduler::Statistics field     = ReferenceMBPolScheduler::getStatistics( "Electrostatics.inducedField" );
+    ASSERT_EQUAL( numberOfEvaluations, twoBody.runs );
+    ASSERT_EQUAL( numberOfEvaluations, threeBody.runs );
+    ASSERT_EQUAL( numberOfEvaluations*numberOfChunks, threeBody.chunks );
+    ASSERT( field.runs >= numberOfEvaluations );
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    bool enabled        = ReferenceMBPolScheduler::getEnabled();
+    int numThreads      = ReferenceMBPolParallel::getNumThreads();
+    try {
+        std::cout << "TestReferenceMBPolWorkStealing running test..." << std::endl;
+
+        // several threads even on a single core
+
+        ReferenceMBPolParallel::setNumThreads( 4 );
+        ReferenceMBPolScheduler::setEnabled( true );
+        ReferenceMBPolScheduler::resetStatistics();
+
+        testEveryChunkRunsOnce();
+
+        ReferenceMBPolScheduler::resetStatistics();
+        testWorkStealingIsTransparent();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+    ReferenceMBPolScheduler::setEnabled( enabled );
+    ReferenceMBPolParallel::setNumThreads( numThreads );
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -0,0 +1,209 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests that the pair and triplet lists derived from the shared master
+ * cell list agree with brute force and with computeThreeNeighborListVoxelHash().
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "ReferenceMasterCellList.h"
+#include "ReferenceThreeNeighborList.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+using namespace std;
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+double periodicDifference(double val1, double val2, double period) {
+    double diff = val1-val2;
+    double base = floor(diff/period+0.5)*period;
+    return diff-base;
+}
+
+double distance2(const RealVec& pos1, const RealVec& pos2, const RealVec& periodicBoxSize, bool usePeriodic) {
+    if (!usePeriodic) {
+        RealVec delta = pos1-pos2;
+        return delta.dot(delta);
+    }
+    double dx = periodicDifference(pos1[0], pos2[0], periodicBoxSize[0]);
+    double dy = periodicDifference(pos1[1], pos2[1], periodicBoxSize[1]);
+    double dz = periodicDifference(pos1[2], pos2[2], periodicBoxSize[2]);
+    return dx*dx+dy*dy+dz*dz;
+}
+
+bool compareTriplets(const AtomTriplet& a, const AtomTriplet& b) {
+    if (a.first != b.first)
+        return a.first < b.first;
+    if (a.second != b.second)
+        return a.second < b.second;
+    return a.third < b.third;
+}
+
+// Molecules of three atoms; the first atom of each is its reference atom.
+
+void buildPositions(vector<RealVec>& positions, vector<int>& referenceAtoms, int numMolecules, double size) {
+    positions.resize(3*numMolecules);
+    referenceAtoms.resize(numMolecules);
+    for (int i = 0; i < numMolecules; i++) {
+        RealVec oxygen(size*rand()/(double) RAND_MAX, size*rand()/(double) RAND_MAX, size*rand()/(double) RAND_MAX);
+        positions[3*i]   = oxygen;
+        positions[3*i+1] = oxygen + RealVec(0.1, 0, 0);
+        positions[3*i+2] = oxygen + RealVec(0, 0.1, 0);
+        referenceAtoms[i] = 3*i;
+    }
+}
+
+void verifyPairs(const ReferenceMasterCellList& list, const vector<int>& moleculeOfAtom, const vector<int>& referenceAtoms,
+                 const vector<RealVec>& positions, const RealVec& boxSize, bool usePeriodic, double cutoff) {
+
+    NeighborList pairs;
+    list.getPairs(pairs, moleculeOfAtom, positions, cutoff);
+    vector<AtomPair> found;
+    for (int i = 0; i < (int) pairs.size(); i++)
+        found.push_back(AtomPair(min(pairs[i].first, pairs[i].second), max(pairs[i].first, pairs[i].second)));
+    sort(found.begin(), found.end());
+
+    vector<AtomPair> expected;
+    for (int i = 0; i < (int) referenceAtoms.size(); i++)
+        for (int j = i+1; j < (int) referenceAtoms.size(); j++)
+            if (distance2(positions[referenceAtoms[i]], positions[referenceAtoms[j]], boxSize, usePeriodic) <= cutoff*cutoff)
+                expected.push_back(AtomPair(moleculeOfAtom[referenceAtoms[i]], moleculeOfAtom[referenceAtoms[j]]));
+    sort(expected.begin(), expected.end());
+
+    ASSERT(found == expected);
+}
+
+void verifyTriplets(const ReferenceMasterCellList& list, const vector<int>& moleculeOfAtom, const vector<int>& referenceAtoms,
+                    const vector<RealVec>& positions, const RealVec& boxSize, bool usePeriodic, double cutoff) {
+
+    ThreeNeighborList triplets;
+    list.getTriplets(triplets, moleculeOfAtom, positions, cutoff);
+    sort(triplets.begin(), triplets.end(), compareTriplets);
+
+    vector<RealVec> oxygens(referenceAtoms.size());
+    for (int i = 0; i < (int) referenceAtoms.size(); i++)
+        oxygens[i] = positions[referenceAtoms[i]];
+    ThreeNeighborList expected;
+    computeThreeNeighborListVoxelHash(expected, oxygens.size(), oxygens, boxSize, usePeriodic, cutoff, 0.0);
+    sort(expected.begin(), expected.end(), compareTriplets);
+
+    ASSERT_EQUAL(expected.size(), triplets.size());
+    for (int i = 0; i < (int) expected.size(); i++) {
+        ASSERT_EQUAL(expected[i].first, triplets[i].first);
+        ASSERT_EQUAL(expected[i].second, triplets[i].second);
+        ASSERT_EQUAL(expected[i].third, triplets[i].third);
+    }
+}
+
+void testDerivedLists(bool usePeriodic) {
+
+    const int numMolecules = 300;
+    const double size = 2.2;
+    RealVec boxSize(size, size, size);
+    vector<RealVec> positions;
+    vector<int> referenceAtoms;
+    buildPositions(positions, referenceAtoms, numMolecules, size);
+
+    // the two-body force uses every molecule, the three-body force the first half of them
+
+    ReferenceMasterCellList list;
+    vector<int> threeBodyAtoms(referenceAtoms.begin(), referenceAtoms.begin()+numMolecules/2);
+    ASSERT(list.addMolecules(referenceAtoms, 0.9, usePeriodic));
+    ASSERT(list.addMolecules(threeBodyAtoms, 0.45, usePeriodic));
+    ASSERT(!list.addMolecules(threeBodyAtoms, 0.45, !usePeriodic));
+    ASSERT(list.update(positions, boxSize));
+
+    vector<int> twoBodyMolecules(positions.size(), -1);
+    vector<int> threeBodyMolecules(positions.size(), -1);
+    for (int i = 0; i < numMolecules; i++)
+        twoBodyMolecules[referenceAtoms[i]] = i;
+    for (int i = 0; i < (int) threeBodyAtoms.size(); i++)
+        threeBodyMolecules[threeBodyAtoms[i]] = i;
+
+    verifyPairs(list, twoBodyMolecules, referenceAtoms, positions, boxSize, usePeriodic, 0.9);
+    verifyPairs(list, twoBodyMolecules, referenceAtoms, positions, boxSize, usePeriodic, 0.6);
+    verifyTriplets(list, threeBodyMolecules, threeBodyAtoms, positions, boxSize, usePeriodic, 0.45);
+
+    // moving every molecule by less than half the skin keeps the list, and the derived lists stay exact
+
+    for (int step = 0; step < 5; step++) {
+        for (int i = 0; i < (int) positions.size(); i++)
+            for (int j = 0; j < 3; j++)
+                positions[i][j] += 0.008*(2.0*rand()/(double) RAND_MAX-1.0);
+        ASSERT(!list.update(positions, boxSize));
+        verifyPairs(list, twoBodyMolecules, referenceAtoms, positions, boxSize, usePeriodic, 0.9);
+        verifyTriplets(list, threeBodyMolecules, threeBodyAtoms, positions, boxSize, usePeriodic, 0.45);
+    }
+    ASSERT_EQUAL(1, list.getNumBuilds());
+
+    // a larger move rebuilds it
+
+    positions[0] += RealVec(list.getSkin(), 0, 0);
+    ASSERT(list.update(positions, boxSize));
+    ASSERT_EQUAL(2, list.getNumBuilds());
+    verifyPairs(list, twoBodyMolecules, referenceAtoms, positions, boxSize, usePeriodic, 0.9);
+    verifyTriplets(list, threeBodyMolecules, threeBodyAtoms, positions, boxSize, usePeriodic, 0.45);
+}
+
+void testSharedPerOwner() {
+    int context1 = 0, context2 = 0;
+    ReferenceMasterCellList* list1 = ReferenceMasterCellList::acquire(&context1);
+    ReferenceMasterCellList* list2 = ReferenceMasterCellList::acquire(&context2);
+    ASSERT(list1 != list2);
+    ASSERT(ReferenceMasterCellList::acquire(&context1) == list1);
+    ReferenceMasterCellList::release(&context1);
+    ReferenceMasterCellList::release(&context1);
+    ReferenceMasterCellList::release(&context2);
+}
+
+int main() 
+{
+try {
+    testDerivedLists(true);
+
+    testDerivedLists(false);
+
+    testSharedPerOwner();
+
+    cout << "Test Passed" << endl;
+    return 0;
+}
+catch(const std::exception& e) {
+    cout << "exception: " << e.what() << endl;
+    cerr << "*** ERROR: Test Failed ***" << endl;
+    return 1;
+}
+}
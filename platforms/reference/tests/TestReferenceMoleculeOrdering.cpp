@@ -0,0 +1,206 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors: Mark Friedrichs                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the space-filling-curve molecule ordering used by the Reference
+ * two- and three-body kernels, and times it on a box of water whose molecules
+ * are registered in random order (as after a long run of diffusion).
+ *
+ * Usage: TestReferenceMoleculeOrdering [numberOfWaters]
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "OpenMMMBPol.h"
+#include "MBPolTestWaters.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "ReferenceMoleculeOrdering.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+// The waters of MBPolTestWaters.h on the smallest lattice that holds them;
+// molecule m is registered with the forces as moleculeOrder[m].
+
+void buildSystem( System& system, int numberOfWaters, const std::vector<int>& moleculeOrder, std::vector<Vec3>& positions ) {
+
+    int side = static_cast<int>(std::ceil( std::pow( static_cast<double>(numberOfWaters), 1.0/3.0 ) - 1.0e-9 ));
+    buildWaterLattice( system, positions, side, PeriodicWaterBox, numberOfWaters );
+
+    MBPolTwoBodyForce* mbpolTwoBodyForce = new MBPolTwoBodyForce();
+    mbpolTwoBodyForce->setCutoff( 0.9 );
+    mbpolTwoBodyForce->setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    mbpolTwoBodyForce->setForceGroup( 1 );
+
+    MBPolThreeBodyForce* mbpolThreeBodyForce = new MBPolThreeBodyForce();
+    mbpolThreeBodyForce->setCutoff( 0.52 );
+    mbpolThreeBodyForce->setNonbondedMethod( MBPolThreeBodyForce::CutoffPeriodic );
+    mbpolThreeBodyForce->setForceGroup( 2 );
+
+    std::vector<int> particleIndices(3);
+    for( int m = 0; m < numberOfWaters; m++ ){
+        particleIndices[0] = 3*moleculeOrder[m];
+        particleIndices[1] = 3*moleculeOrder[m]+1;
+        particleIndices[2] = 3*moleculeOrder[m]+2;
+        mbpolTwoBodyForce->addParticle( particleIndices );
+        mbpolThreeBodyForce->addParticle( particleIndices );
+    }
+    system.addForce( mbpolTwoBodyForce );
+    system.addForce( mbpolThreeBodyForce );
+}
+
+template <class T>
+void shuffle( std::vector<T>& items ) {
+    for( int ii = static_cast<int>(items.size()) - 1; ii > 0; ii-- ){
+        std::swap( items[ii], items[rand() % (ii+1)] );
+    }
+}
+
+void testMortonOrder( ) {
+
+    std::string testName = "testMortonOrder";
+
+    // a shuffled lattice: consecutive molecules along the curve must be close
+
+    int side = 16;
+    std::vector<RealVec> moleculePositions;
+    for( int ii = 0; ii < side*side*side; ii++ ){
+        moleculePositions.push_back( RealVec( ii % side, (ii/side) % side, ii/(side*side) ) );
+    }
+    shuffle( moleculePositions );
+
+    std::vector<int> order;
+    computeMortonOrder( order, moleculePositions, RealVec( side, side, side ), true );
+
+    std::vector<int> sorted( order );
+    std::sort( sorted.begin(), sorted.end() );
+    for( unsigned int ii = 0; ii < sorted.size(); ii++ ){
+        ASSERT_EQUAL( static_cast<int>(ii), sorted[ii] );
+    }
+
+    double shuffledStep = 0.0;
+    double orderedStep  = 0.0;
+    for( unsigned int ii = 1; ii < order.size(); ii++ ){
+        RealVec d1 = moleculePositions[ii] - moleculePositions[ii-1];
+        RealVec d2 = moleculePositions[order[ii]] - moleculePositions[order[ii-1]];
+        shuffledStep += std::sqrt( d1.dot(d1) );
+        orderedStep  += std::sqrt( d2.dot(d2) );
+    }
+    shuffledStep /= order.size() - 1;
+    orderedStep  /= order.size() - 1;
+    std::cout << testName << ": mean distance between consecutive molecules " << shuffledStep << " shuffled, " << orderedStep << " ordered" << std::endl;
+    ASSERT( orderedStep < 2.0 );
+    ASSERT( orderedStep < 0.25*shuffledStep );
+}
+
+double evaluate( int numberOfWaters, int reorderInterval, const std::vector<int>& moleculeOrder, int repeats,
+                 std::vector<Vec3>& forces, double& seconds ) {
+
+    ReferenceMoleculeOrdering::setDefaultReorderInterval( reorderInterval );
+
+    std::vector<Vec3> positions;
+    System system;
+    buildSystem( system, numberOfWaters, moleculeOrder, positions );
+    VerletIntegrator integrator( 0.0002 );
+    Context context( system, integrator, Platform::getPlatformByName( "Reference" ) );
+    context.setPositions( positions );
+
+    State state = context.getState( State::Forces | State::Energy );
+    std::clock_t start = std::clock();
+    for( int ii = 0; ii < repeats; ii++ ){
+        state = context.getState( State::Forces | State::Energy );
+    }
+    seconds = static_cast<double>(std::clock() - start)/CLOCKS_PER_SEC/repeats;
+    forces  = state.getForces();
+    return state.getPotentialEnergy();
+}
+
+void testOrderingIsTransparent( int numberOfWaters, int repeats ) {
+
+    std::string testName = "testOrderingIsTransparent";
+
+    std::vector<int> moleculeOrder( numberOfWaters );
+    for( int ii = 0; ii < numberOfWaters; ii++ ){
+        moleculeOrder[ii] = ii;
+    }
+    shuffle( moleculeOrder );
+
+    int defaultInterval = ReferenceMoleculeOrdering::getDefaultReorderInterval();
+
+    std::vector<Vec3> unsortedForces, sortedForces;
+    double unsortedSeconds, sortedSeconds;
+    double unsortedEnergy = evaluate( numberOfWaters, 0, moleculeOrder, repeats, unsortedForces, unsortedSeconds );
+    double sortedEnergy   = evaluate( numberOfWaters, defaultInterval, moleculeOrder, repeats, sortedForces, sortedSeconds );
+
+    ReferenceMoleculeOrdering::setDefaultReorderInterval( defaultInterval );
+
+    std::cout << testName << ": " << numberOfWaters << " waters, 2B+3B energy " << sortedEnergy << " kJ/mol" << std::endl;
+    std::cout << testName << ": time per evaluation " << unsortedSeconds << " s in registration order, "
+              << sortedSeconds << " s in Morton order" << std::endl;
+
+    ASSERT_EQUAL_TOL( unsortedEnergy, sortedEnergy, 1.0e-8 );
+    for( unsigned int ii = 0; ii < sortedForces.size(); ii++ ){
+        ASSERT_EQUAL_VEC( unsortedForces[ii], sortedForces[ii], 1.0e-8 );
+    }
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestReferenceMoleculeOrdering running test..." << std::endl;
+
+        int numberOfWaters = 256;
+        int repeats        = 1;
+        if( numberOfArguments > 1 ){
+            numberOfWaters = atoi( argv[1] );
+            repeats        = 5;
+        }
+
+        testMortonOrder();
+        testOrderingIsTransparent( numberOfWaters, repeats );
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 import mbpolplugin
+import numpy
 from simtk.openmm import app
 from simtk import unit
 
@@ -8,6 +9,21 @@ ATOM_TYPES = {
     "MBPol-M" : 2,
 }
 
+## @private
+def _waterIndices(data):
+    """The (O, H, H) atom indices of every water, one after another, as a NumPy array.
+
+    The waters are the angles of HOH residues. The array is built once per System
+    and shared by the generators, which register all waters with a single call.
+    """
+    if not hasattr(data, 'mbpolWaterIndices'):
+        angles = numpy.array(data.angles, dtype=numpy.intc).reshape(-1, 3)
+        isWater = numpy.array([atom.residue.name == 'HOH' for atom in data.atoms], dtype=bool)
+        # FIXME loop through all residues of the MBPol forces and match their name
+        water = isWater[angles].all(axis=1)
+        data.mbpolWaterIndices = angles[water][:, [1, 0, 2]].ravel()
+    return data.mbpolWaterIndices
+
 ## @private
 class MBPolOneBodyForceGenerator:
 
@@ -62,18 +78,7 @@ class MBPolOneBodyForceGenerator:
 
         force.setNonbondedMethod(methodMap[nonbondedMethod])
 
-        for i in range(len(data.angles)):
-            angle = data.angles[i]
-            atom1 = data.atoms[angle[0]]
-            atom2 = data.atoms[angle[1]]
-            atom3 = data.atoms[angle[2]]
-            if atom1.residue.name == 'HOH' and atom2.residue.name == 'HOH' and atom3.residue.name == 'HOH':
-                # FIXME loop through all residues of MBPolOneBodyForce and match their name
-                v = mbpolplugin.vectori()
-                v.push_back(atom2.index)
-                v.push_back(atom1.index)
-                v.push_back(atom3.index)
-                force.addOneBody(v);
+        force.addOneBodies(_waterIndices(data))
 
 app.forcefield.parsers["MBPolOneBodyForce"] = MBPolOneBodyForceGenerator.parseElement
 
@@ -135,19 +140,7 @@ class MBPolTwoBodyForceGenerator:
 
         force.setNonbondedMethod(methodMap[nonbondedMethod])
 
-        for i in range(len(data.angles)):
-            angle = data.angles[i]
-            atom1 = data.atoms[angle[0]]
-            atom2 = data.atoms[angle[1]]
-            atom3 = data.atoms[angle[2]]
-            if atom1.residue.name == 'HOH' and atom2.residue.name == 'HOH' and atom3.residue.name == 'HOH':
-                # FIXME loop through all residues of MBPolTwoBodyForce and match their name
-                v = mbpolplugin.vectori()
-                v.push_back(atom2.index)
-                v.push_back(atom1.index)
-                v.push_back(atom3.index)
-
-                force.addParticle(v)
+        force.addParticles(_waterIndices(data))
 
 app.forcefield.parsers["MBPolTwoBodyForce"] = MBPolTwoBodyForceGenerator.parseElement
 
@@ -208,19 +201,7 @@ class MBPolThreeBodyForceGenerator:
 
         force.setNonbondedMethod(methodMap[nonbondedMethod])
 
-        for i in range(len(data.angles)):
-            angle = data.angles[i]
-            atom1 = data.atoms[angle[0]]
-            atom2 = data.atoms[angle[1]]
-            atom3 = data.atoms[angle[2]]
-            if atom1.residue.name == 'HOH' and atom2.residue.name == 'HOH' and atom3.residue.name == 'HOH':
-                # FIXME loop through all residues of MBPolThreeBodyForce and match their name
-                v = mbpolplugin.vectori()
-                v.push_back(atom2.index)
-                v.push_back(atom1.index)
-                v.push_back(atom3.index)
-
-                force.addParticle(v)
+        force.addParticles(_waterIndices(data))
 
 app.forcefield.parsers["MBPolThreeBodyForce"] = MBPolThreeBodyForceGenerator.parseElement
 
@@ -307,22 +288,54 @@ class MBPolElectrostaticsForceGenerator:
         force.setNonbondedMethod(methodMap[nonbondedMethod])
         force.setTholeParameters(self.thole)
 
-        for i in range(len(data.angles)):
-            angle = data.angles[i]
-            # FIXME loop through all residues of MBPolElectrostaticsForce and match their name
+        # FIXME loop through all residues of MBPolElectrostaticsForce and match their name
 
-            # FIXME cheating! get virtual site index by max(otheratom indices)  + 1
-            global_atoms_indices = set([angle[local_atom_index] for local_atom_index in [0,1,2]])
-            virtual_site_index = max(global_atoms_indices) + 1
-            global_atoms_indices.add(virtual_site_index)
+        # FIXME cheating! get virtual site index by max(otheratom indices)  + 1
+        angles = numpy.sort(numpy.array(data.angles, dtype=numpy.intc).reshape(-1, 3), axis=1)
+        sites = numpy.column_stack((angles, angles[:, 2] + 1)).ravel()
+        molecules = numpy.repeat(numpy.arange(len(angles), dtype=numpy.intc), 4)
 
-            for atomIndex in global_atoms_indices:
+        types = [data.atomType[data.atoms[atomIndex]] for atomIndex in sites]
+        for atomIndex, t in zip(sites, types):
+            if t not in self.typeMap:
                 atom = data.atoms[atomIndex]
-                t = data.atomType[atom]
-                if t in self.typeMap:
-                    force.addElectrostatics(self.typeMap[t]['charge'], i, ATOM_TYPES[t], self.typeMap[t]['damping_factor'], self.typeMap[t]['polarizability'])
+                raise ValueError('No type for atom %s %s %d' % (atom.name, atom.residue.name, atom.residue.index))
 
-                else:
-                    raise ValueError('No type for atom %s %s %d' % (atom.name, atom.residue.name, atom.residue.index))
+        parameters = numpy.array([(self.typeMap[t]['charge'], self.typeMap[t]['damping_factor'], self.typeMap[t]['polarizability'])
+                                  for t in types]).reshape(-1, 3)
+        atomTypes = numpy.array([ATOM_TYPES[t] for t in types], dtype=numpy.intc)
+        force.addParticles(parameters[:, 0], molecules, atomTypes, parameters[:, 1], parameters[:, 2])
 
 app.forcefield.parsers["MBPolElectrostaticsForce"] = MBPolElectrostaticsForceGenerator.parseElement
+
+## Default force group of the forces evaluated on every ring polymer bead
+RPMD_ALL_BEADS_GROUP = 0
+## Default force group of the MB-pol terms evaluated on the contracted ring polymer
+RPMD_CONTRACTED_GROUP = 1
+
+def setRingPolymerContraction(system, numContractedCopies,
+                              contractedForces=(mbpolplugin.MBPolThreeBodyForce, mbpolplugin.MBPolElectrostaticsForce),
+                              contractedGroup=RPMD_CONTRACTED_GROUP):
+    """Prepare a system for ring polymer contraction.
+
+    The forces of the types in `contractedForces` (by default the three-body and
+    electrostatics terms) go into `contractedGroup`. Every other force keeps its
+    force group, so groups set up for multiple time stepping or reporting are
+    left alone. It is an error if one of them is already in `contractedGroup`.
+    The returned dictionary is the `contractions` argument of `RPMDIntegrator`;
+    1 evaluates the contracted terms at the centroid only:
+
+        contractions = mbpol.setRingPolymerContraction(system, 1)
+        integrator = mm.RPMDIntegrator(32, temperature, friction, timestep, contractions)
+    """
+    if numContractedCopies < 1:
+        raise ValueError("setRingPolymerContraction: numContractedCopies must be at least 1")
+    contracted = [isinstance(system.getForce(i), tuple(contractedForces)) for i in range(system.getNumForces())]
+    for i in range(system.getNumForces()):
+        if not contracted[i] and system.getForce(i).getForceGroup() == contractedGroup:
+            raise ValueError("setRingPolymerContraction: force %d (%s) is not contracted but is in force group %d; "
+                             "move it or choose another contractedGroup" % (i, type(system.getForce(i)).__name__, contractedGroup))
+    for i in range(system.getNumForces()):
+        if contracted[i]:
+            system.getForce(i).setForceGroup(contractedGroup)
+    return {contractedGroup: numContractedCopies}
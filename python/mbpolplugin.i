@@ -29,14 +29,127 @@ namespace std {
 #include "openmm/RPMDIntegrator.h"
 
 #include "openmm/RPMDMonteCarloBarostat.h"
+#include <sstream>
 %}
 
+// The bulk registration calls (addOneBodies, addParticles) take NumPy arrays, which are
+// copied into the std::vector in one step, or any sequence of numbers
+%{
+static bool mbpolConvertItem(PyObject* item, int& value) {
+    value = (int) PyLong_AsLong(item);
+    return !PyErr_Occurred();
+}
+
+static bool mbpolConvertItem(PyObject* item, double& value) {
+    value = PyFloat_AsDouble(item);
+    return !PyErr_Occurred();
+}
+
+template <class T>
+static bool mbpolCopyArray(PyObject* input, const char* dtype, std::vector<T>& output) {
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (numpy != NULL) {
+        PyObject* array = PyObject_CallMethod(numpy, (char*) "ascontiguousarray", (char*) "Os", input, dtype);
+        Py_DECREF(numpy);
+        if (array == NULL)
+            return false;
+        Py_buffer view;
+        if (PyObject_GetBuffer(array, &view, PyBUF_C_CONTIGUOUS) != 0) {
+            Py_DECREF(array);
+            return false;
+        }
+        const T* data = static_cast<const T*>(view.buf);
+        output.assign(data, data + view.len/sizeof(T));
+        PyBuffer_Release(&view);
+        Py_DECREF(array);
+        return true;
+    }
+    PyErr_Clear();
+    PyObject* sequence = PySequence_Fast(input, "expected a NumPy array or a sequence of numbers");
+    if (sequence == NULL)
+        return false;
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(sequence);
+    output.resize(size);
+    for (Py_ssize_t ii = 0; ii < size; ii++) {
+        if (!mbpolConvertItem(PySequence_Fast_GET_ITEM(sequence, ii), output[ii])) {
+            Py_DECREF(sequence);
+            return false;
+        }
+    }
+    Py_DECREF(sequence);
+    return true;
+}
+%}
+
+%typemap(in) const std::vector<int>& flatIndices (std::vector<int> temp),
+             const std::vector<int>& moleculeIndices (std::vector<int> temp),
+             const std::vector<int>& atomTypes (std::vector<int> temp) {
+    if (!mbpolCopyArray($input, "intc", temp))
+        SWIG_fail;
+    $1 = &temp;
+}
+
+%typemap(in) const std::vector<double>& charges (std::vector<double> temp),
+             const std::vector<double>& dampingFactors (std::vector<double> temp),
+             const std::vector<double>& polarities (std::vector<double> temp) {
+    if (!mbpolCopyArray($input, "float64", temp))
+        SWIG_fail;
+    $1 = &temp;
+}
+
 %feature("autodoc", "1");
 %nodefaultctor;
 
 
 using namespace OpenMM;
 
+// getVirial() returns the nine components of the virial tensor, row by row
+%define MBPOL_GET_VIRIAL
+    %extend {
+        std::vector<double> getVirial(Context& context) {
+            std::vector<Vec3> virial;
+            self->getVirial(context, virial);
+            std::vector<double> components;
+            for (int a = 0; a < 3; a++)
+                for (int b = 0; b < 3; b++)
+                    components.push_back(virial[a][b]);
+            return components;
+        }
+    }
+%enddef
+
+// getMoleculeEnergies() returns the share of every molecule; it raises if the
+// decomposition is not enabled or the force has not been evaluated yet
+%define MBPOL_ENERGY_DECOMPOSITION
+    void setIncludeEnergyDecomposition(bool includeEnergyDecomposition);
+    bool getIncludeEnergyDecomposition() const;
+
+    %exception getMoleculeEnergies {
+        try {
+            $action
+        } catch (std::exception& e) {
+            PyErr_SetString(PyExc_Exception, e.what());
+            SWIG_fail;
+        }
+    }
+    %extend {
+        std::vector<double> getMoleculeEnergies(Context& context) {
+            std::vector<double> energies;
+            self->getMoleculeEnergies(context, energies);
+            return energies;
+        }
+    }
+%enddef
+
+%{
+static PyObject* mbpolListFromVector(const std::vector<double>& values) {
+    PyObject* list = PyList_New(values.size());
+    for (unsigned int ii = 0; ii < values.size(); ii++)
+        PyList_SET_ITEM(list, ii, PyFloat_FromDouble(values[ii]));
+    return list;
+}
+%}
+
 namespace MBPolPlugin {
 
 class MBPolElectrostaticsForce : public OpenMM::Force {
@@ -45,7 +158,7 @@ public:
 
     int getNumElectrostatics() const;
 
-    enum NonbondedMethod { NoCutoff, PME };
+    enum NonbondedMethod { NoCutoff, PME, Treecode };
 
     void setNonbondedMethod(NonbondedMethod method);
 
@@ -57,6 +170,112 @@ public:
 
     bool getIncludeChargeRedistribution( void ) const;
 
+    void setInducedDipoleWarmStart( bool warmStart );
+
+    bool getInducedDipoleWarmStart( void ) const;
+
+    void setUseSinglePrecisionPme( bool useSinglePrecisionPme );
+
+    bool getUseSinglePrecisionPme( void ) const;
+
+    void setTreecodeOpeningAngle( double angle );
+
+    double getTreecodeOpeningAngle( void ) const;
+
+    void setTreecodeExpansionOrder( int order );
+
+    int getTreecodeExpansionOrder( void ) const;
+
+    %apply int& OUTPUT { int& numWarmStarts, int& numIterationsSaved };
+    void getInducedDipoleWarmStartStatistics(Context& context, int& numWarmStarts, int& numIterationsSaved);
+    %clear int& numWarmStarts, int& numIterationsSaved;
+
+    void setIncludeEnergyDecomposition( bool includeEnergyDecomposition );
+
+    bool getIncludeEnergyDecomposition( void ) const;
+
+    // getMoleculeEnergies() returns (permanent, induction) and getSitePotentials()
+    // (potentials, charges), as lists
+    %exception getMoleculeEnergies {
+        try {
+            $action
+        } catch (std::exception& e) {
+            PyErr_SetString(PyExc_Exception, e.what());
+            SWIG_fail;
+        }
+    }
+    %exception getSitePotentials {
+        try {
+            $action
+        } catch (std::exception& e) {
+            PyErr_SetString(PyExc_Exception, e.what());
+            SWIG_fail;
+        }
+    }
+    %extend {
+        PyObject* getMoleculeEnergies(Context& context) {
+            std::vector<double> permanent, induction;
+            self->getMoleculeEnergies(context, permanent, induction);
+            return Py_BuildValue("(NN)", mbpolListFromVector(permanent), mbpolListFromVector(induction));
+        }
+
+        PyObject* getSitePotentials(Context& context) {
+            std::vector<double> potentials, charges;
+            self->getSitePotentials(context, potentials, charges);
+            return Py_BuildValue("(NN)", mbpolListFromVector(potentials), mbpolListFromVector(charges));
+        }
+    }
+
+    // the solver checkpoint is returned and taken as bytes, e.g. to be stored next to
+    // the checkpoint of Simulation.saveCheckpoint(); a checkpoint of another force raises
+    %exception createSolverCheckpoint {
+        try {
+            $action
+        } catch (std::exception& e) {
+            PyErr_SetString(PyExc_Exception, e.what());
+            SWIG_fail;
+        }
+    }
+    %exception loadSolverCheckpoint {
+        try {
+            $action
+        } catch (std::exception& e) {
+            PyErr_SetString(PyExc_Exception, e.what());
+            SWIG_fail;
+        }
+    }
+    %extend {
+        PyObject* createSolverCheckpoint(Context& context) {
+            std::stringstream stream;
+            self->createSolverCheckpoint(context, stream);
+            std::string data = stream.str();
+            return PyBytes_FromStringAndSize(data.data(), data.size());
+        }
+
+        void loadSolverCheckpoint(Context& context, PyObject* checkpoint) {
+            char* data;
+            Py_ssize_t length;
+            if (PyBytes_AsStringAndSize(checkpoint, &data, &length) != 0)
+                throw OpenMMException("loadSolverCheckpoint: the checkpoint must be bytes");
+            std::stringstream stream(std::string(data, length));
+            self->loadSolverCheckpoint(context, stream);
+        }
+    }
+
+    enum InteractionGroup { AllInteractions, ShortRange, LongRange };
+
+    InteractionGroup getInteractionGroup() const;
+
+    void setInteractionGroup(InteractionGroup group);
+
+    double getSplitDistance() const;
+
+    void setSplitDistance(double distance);
+
+    double getSplitWidth() const;
+
+    void setSplitWidth(double width);
+
     // double getAEwald() const;
 
     // void setAEwald(double aewald);
@@ -70,6 +289,10 @@ public:
     int addElectrostatics(double charge,
                      int moleculeIndex, int atomType, double dampingFactor, double polarity);
 
+    int addParticles(const std::vector<double>& charges, const std::vector<int>& moleculeIndices,
+                     const std::vector<int>& atomTypes, const std::vector<double>& dampingFactors,
+                     const std::vector<double>& polarities);
+
     void getElectrostaticsParameters(int index, double& charge,
                      int& moleculeIndex, int& atomType, double& dampingFactor, double& polarity ) const;
 
@@ -93,6 +316,8 @@ public:
 
     void updateParametersInContext(Context& context);
 
+    MBPOL_GET_VIRIAL
+
     void setTholeParameters( std::vector< double > tholeP);
 };
 
@@ -110,11 +335,17 @@ public:
 
     int addOneBody(const std::vector<int> & particleIndices);
 
+    int addOneBodies(const std::vector<int> & flatIndices);
+
     void getOneBodyParameters(int particleIndex, std::vector<int>& particleIndices ) const;
     void setOneBodyParameters(int index, std::vector<int>& particleIndices  );
 
     void updateParametersInContext(Context& context);
 
+    MBPOL_GET_VIRIAL
+
+    MBPOL_ENERGY_DECOMPOSITION
+
 };
 
 class MBPolTwoBodyForce : public Force {
@@ -129,6 +360,8 @@ public:
 
     int addParticle(const std::vector<int> & particleIndices);
 
+    int addParticles(const std::vector<int> & flatIndices);
+
     int getNumMolecules(void) const;
     void setCutoff(double cutoff);
 
@@ -140,8 +373,28 @@ public:
     NonbondedMethod getNonbondedMethod() const;
     void setNonbondedMethod(NonbondedMethod method);
 
+    enum InteractionGroup { AllInteractions, ShortRange, LongRange };
+
+    InteractionGroup getInteractionGroup() const;
+    void setInteractionGroup(InteractionGroup group);
+
+    double getSplitDistance() const;
+    void setSplitDistance(double distance);
+
+    double getSplitWidth() const;
+    void setSplitWidth(double width);
+
+    void setUseMixedPrecision(bool useMixedPrecision);
+    bool getUseMixedPrecision() const;
+
+    static std::string getPolynomialInstructionSet();
+
     void updateParametersInContext(Context& context);
 
+    MBPOL_GET_VIRIAL
+
+    MBPOL_ENERGY_DECOMPOSITION
+
 };
 
 class MBPolThreeBodyForce : public Force {
@@ -156,6 +409,8 @@ public:
 
     int addParticle(const std::vector<int> & particleIndices);
 
+    int addParticles(const std::vector<int> & flatIndices);
+
     int getNumMolecules(void) const;
     void setCutoff(double cutoff);
 
@@ -167,7 +422,14 @@ public:
     NonbondedMethod getNonbondedMethod() const;
     void setNonbondedMethod(NonbondedMethod method);
 
+    void setUseMixedPrecision(bool useMixedPrecision);
+    bool getUseMixedPrecision() const;
+
     void updateParametersInContext(Context& context);
+
+    MBPOL_GET_VIRIAL
+
+    MBPOL_ENERGY_DECOMPOSITION
 };
 
 } // namespace
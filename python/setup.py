@@ -10,7 +10,8 @@ extension = Extension(name='_mbpolplugin',
                       sources=['MBPolPluginWrapper.cpp'],
                       libraries=['OpenMM', 'OpenMMMBPol'],
                       include_dirs=[os.path.join(openmm_dir, 'include'), mbpolplugin_header_dir],
-                      library_dirs=[os.path.join(openmm_dir, 'lib'), mbpolplugin_library_dir]
+                      library_dirs=[os.path.join(openmm_dir, 'lib'), mbpolplugin_library_dir],
+                      extra_compile_args=[] if sys.platform == 'win32' else ['-std=c++11']
                      )
 
 setup(name='mbpol',
@@ -0,0 +1,59 @@
+from __future__ import print_function
+
+import unittest
+from simtk.openmm import app
+import simtk.openmm as mm
+from simtk import unit
+import numpy
+import mbpol
+import mbpolplugin
+
+class TestBulkRegistration(unittest.TestCase):
+    """This tests the bulk addParticles() calls used by the force field generators."""
+
+    def testForceFieldRegistration(self):
+        pdb = app.PDBFile("pdb_files/water14.pdb")
+        forcefield = app.ForceField("../mbpol.xml")
+        system = forcefield.createSystem(pdb.topology, nonbondedMethod=app.NoCutoff)
+        forces = dict((type(system.getForce(i)), system.getForce(i)) for i in range(system.getNumForces()))
+
+        # each water is O, H, H followed by its M site
+        numWaters = 14
+        self.assertEqual(forces[mbpolplugin.MBPolOneBodyForce].getNumOneBodys(), numWaters)
+        self.assertEqual(forces[mbpolplugin.MBPolTwoBodyForce].getNumMolecules(), numWaters)
+        self.assertEqual(forces[mbpolplugin.MBPolThreeBodyForce].getNumMolecules(), numWaters)
+        for m in range(numWaters):
+            indices = mbpolplugin.vectori()
+            forces[mbpolplugin.MBPolTwoBodyForce].getParticleParameters(m, indices)
+            self.assertEqual(list(indices), [4*m, 4*m+1, 4*m+2])
+
+        electrostatics = forces[mbpolplugin.MBPolElectrostaticsForce]
+        self.assertEqual(electrostatics.getNumElectrostatics(), 4*numWaters)
+
+    def testBulkMatchesSingle(self):
+        indices = numpy.arange(30, dtype=numpy.int64).reshape(-1, 3)
+        bulk = mbpolplugin.MBPolThreeBodyForce()
+        self.assertEqual(bulk.addParticles(indices), 0)
+        self.assertEqual(bulk.addParticles([30, 31, 32]), 10)
+        single = mbpolplugin.MBPolThreeBodyForce()
+        for row in range(11):
+            v = mbpolplugin.vectori()
+            for k in range(3):
+                v.push_back(3*row + k)
+            single.addParticle(v)
+        self.assertEqual(bulk.getNumMolecules(), single.getNumMolecules())
+        for m in range(single.getNumMolecules()):
+            a = mbpolplugin.vectori()
+            b = mbpolplugin.vectori()
+            bulk.getParticleParameters(m, a)
+            single.getParticleParameters(m, b)
+            self.assertEqual(list(a), list(b))
+
+    def testInvalidArrays(self):
+        force = mbpolplugin.MBPolTwoBodyForce()
+        self.assertRaises(Exception, force.addParticles, numpy.arange(4))
+        electrostatics = mbpolplugin.MBPolElectrostaticsForce()
+        self.assertRaises(Exception, electrostatics.addParticles, [0.0, 0.0], [0], [0], [0.0], [0.0])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,76 @@
+from __future__ import print_function
+
+import os
+import unittest
+from simtk.openmm import app
+import simtk.openmm as mm
+from simtk import unit
+import numpy
+import mbpol
+import mbpolplugin
+
+# water256_bulk.pdb at the density of the bulk examples
+boxDimension = 19.3996888399961804/10.
+timestep = 0.5*unit.femtoseconds
+numSteps = int(os.environ.get("MBPOL_DRIFT_STEPS", "100"))
+
+def createSimulation(mixedPrecision):
+    pdb = app.PDBFile("../water256_bulk.pdb")
+    pdb.topology.setUnitCellDimensions([boxDimension]*3)
+    forcefield = app.ForceField("../mbpol.xml")
+    system = forcefield.createSystem(pdb.topology, nonbondedMethod=app.PME,
+                                     nonbondedCutoff=0.9*unit.nanometer, ewaldErrorTolerance=1e-6)
+    for i in range(system.getNumForces()):
+        force = system.getForce(i)
+        if type(force) in (mbpolplugin.MBPolTwoBodyForce, mbpolplugin.MBPolThreeBodyForce):
+            force.setUseMixedPrecision(mixedPrecision)
+    integrator = mm.VerletIntegrator(timestep)
+    platform = mm.Platform.getPlatformByName('Reference')
+    simulation = app.Simulation(pdb.topology, system, integrator, platform)
+    simulation.context.setPositions(pdb.positions)
+    simulation.context.computeVirtualSites()
+    return simulation
+
+def runNVE(mixedPrecision):
+    """Total energy (kJ/mol) along a short NVE run from the same initial velocities."""
+    simulation = createSimulation(mixedPrecision)
+    simulation.context.setVelocitiesToTemperature(300*unit.kelvin, 1234)
+    energies = []
+    for step in range(numSteps + 1):
+        if step > 0:
+            simulation.step(1)
+        state = simulation.context.getState(getEnergy=True)
+        energies.append((state.getPotentialEnergy() + state.getKineticEnergy()).value_in_unit(unit.kilojoule_per_mole))
+    return numpy.array(energies)
+
+class TestReferenceMBPolMixedPrecision(unittest.TestCase):
+    """This compares the single precision 2B/3B polynomials with the double precision path on water256_bulk.pdb."""
+
+    def testEnergyAndForces(self):
+        states = []
+        for mixedPrecision in (False, True):
+            simulation = createSimulation(mixedPrecision)
+            states.append(simulation.context.getState(getEnergy=True, getForces=True))
+        energies = [s.getPotentialEnergy().value_in_unit(unit.kilojoule_per_mole) for s in states]
+        forces = [numpy.array(s.getForces().value_in_unit(unit.kilojoule_per_mole/unit.nanometer)) for s in states]
+        forceError = numpy.sqrt(numpy.mean((forces[1] - forces[0])**2))/numpy.sqrt(numpy.mean(forces[0]**2))
+        print("energy double %.6f mixed %.6f kJ/mol, relative rms force difference %.2e" % (energies[0], energies[1], forceError))
+        self.assertTrue(abs(energies[1] - energies[0]) < 1e-5*abs(energies[0]))
+        self.assertTrue(forceError < 1e-5)
+
+    def testEnergyDrift(self):
+        time = numpy.arange(numSteps + 1)*timestep.value_in_unit(unit.picoseconds)
+        numWaters = 256
+        drifts = []
+        for mixedPrecision, label in ((False, "double"), (True, "mixed")):
+            energies = runNVE(mixedPrecision)
+            slope = numpy.polyfit(time, energies, 1)[0]
+            drifts.append((slope, numpy.std(energies)))
+            print("%s: drift %.3e kJ/mol/ps per water, total energy fluctuation %.3e kJ/mol" % (label, slope/numWaters, drifts[-1][1]))
+
+        # the single precision polynomials must not add a drift beyond the noise of the double precision run
+        (slopeDouble, fluctuation), (slopeMixed, _) = drifts
+        self.assertTrue(abs(slopeMixed - slopeDouble)*time[-1] < 3*fluctuation + 1e-3)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,144 @@
+from __future__ import print_function
+
+import unittest
+from simtk.openmm import app
+import simtk.openmm as mm
+from simtk import unit
+import numpy as np
+import random
+import mbpol
+
+class TestReferenceMBPolRPMD(unittest.TestCase):
+    """This tests ring polymer contraction of the MB-pol terms with RPMDIntegrator."""
+
+    def createSystem(self):
+        pdb = app.PDBFile("pdb_files/water3.pdb")
+        forcefield = app.ForceField("../mbpol.xml")
+        system = forcefield.createSystem(pdb.topology, nonbondedMethod=app.CutoffNonPeriodic, nonbondedCutoff=0.9*unit.nanometer)
+        return pdb, system
+
+    def isContracted(self, force):
+        return isinstance(force, (mbpol.mbpolplugin.MBPolThreeBodyForce, mbpol.mbpolplugin.MBPolElectrostaticsForce))
+
+    def test_water3_force_groups(self):
+        pdb, system = self.createSystem()
+
+        # a user assigned group of a force that is not contracted is kept
+
+        userGroup = 3
+        uncontracted = [i for i in range(system.getNumForces()) if not self.isContracted(system.getForce(i))]
+        system.getForce(uncontracted[0]).setForceGroup(userGroup)
+        groups = [system.getForce(i).getForceGroup() for i in range(system.getNumForces())]
+
+        contractions = mbpol.setRingPolymerContraction(system, 1)
+        self.assertEqual(contractions, {mbpol.RPMD_CONTRACTED_GROUP: 1})
+        for i in range(system.getNumForces()):
+            force = system.getForce(i)
+            expected = mbpol.RPMD_CONTRACTED_GROUP if self.isContracted(force) else groups[i]
+            self.assertEqual(force.getForceGroup(), expected)
+        self.assertEqual(system.getForce(uncontracted[0]).getForceGroup(), userGroup)
+
+        # a force that is not contracted must not share the contracted group
+
+        pdb, system = self.createSystem()
+        uncontracted = [i for i in range(system.getNumForces()) if not self.isContracted(system.getForce(i))]
+        system.getForce(uncontracted[0]).setForceGroup(mbpol.RPMD_CONTRACTED_GROUP)
+        with self.assertRaises(ValueError):
+            mbpol.setRingPolymerContraction(system, 1)
+        with self.assertRaises(ValueError):
+            mbpol.setRingPolymerContraction(system, 0, contractedGroup=5)
+
+    def test_water3_centroid_contraction(self):
+        numCopies = 4
+        pdb, system = self.createSystem()
+        contractions = mbpol.setRingPolymerContraction(system, 1)
+        contractedGroups = 1<<mbpol.RPMD_CONTRACTED_GROUP
+        beadGroups = 0
+        for i in range(system.getNumForces()):
+            if system.getForce(i).getForceGroup() != mbpol.RPMD_CONTRACTED_GROUP:
+                beadGroups |= 1<<system.getForce(i).getForceGroup()
+
+        # beads spread around the pdb geometry; M sites follow their water
+
+        weights = (0.573293118, 0.213353441, 0.213353441)
+        positions = pdb.positions.value_in_unit(unit.nanometer)
+        random.seed(1234)
+        copies = []
+        for copy in range(numCopies):
+            beads = [mm.Vec3(*[x + random.uniform(-0.005, 0.005) for x in p]) for p in positions]
+            for i in range(0, len(beads), 4):
+                beads[i+3] = beads[i]*weights[0] + beads[i+1]*weights[1] + beads[i+2]*weights[2]
+            copies.append(beads)
+        centroid = [sum((copies[copy][i] for copy in range(numCopies)), mm.Vec3(0, 0, 0))/numCopies for i in range(len(positions))]
+
+        # reference evaluations: the contracted terms on the centroid, and every term on each bead
+
+        platform = mm.Platform.getPlatformByName('Reference')
+        classicalContext = mm.Context(system, mm.VerletIntegrator(0.01*unit.femtoseconds), platform)
+        forceUnit = unit.kilojoule_per_mole/unit.nanometer
+
+        def evaluate(beads, groups):
+            classicalContext.setPositions(beads)
+            classicalContext.computeVirtualSites()
+            state = classicalContext.getState(getEnergy=True, getForces=True, groups=groups)
+            return state.getPotentialEnergy().value_in_unit(unit.kilojoule_per_mole), state.getForces(asNumpy=True).value_in_unit(forceUnit)
+
+        centroidEnergy, centroidForces = evaluate(centroid, contractedGroups)
+        beadForces = sum(evaluate(copies[copy], beadGroups)[1] for copy in range(numCopies))/numCopies
+        uncontractedForces = sum(evaluate(copies[copy], contractedGroups)[1] for copy in range(numCopies))/numCopies
+
+        # RPMDIntegrator reports the energy and forces of each bead without contraction, so the
+        # contracted forces are observed through the centroid velocity: with the thermostat off
+        # and the beads at rest, one step of dt gives the centroid the velocity dt/m times the
+        # bead averaged force; the springs cancel in the average, and with one contracted copy
+        # every bead feels the contracted terms at the centroid
+
+        dt = 0.01*unit.femtoseconds
+        integrator = mm.RPMDIntegrator(numCopies, 300*unit.kelvin, 1.0/unit.picoseconds, dt, contractions)
+        integrator.setApplyThermostat(False)
+        context = mm.Context(system, integrator, platform)
+        for copy in range(numCopies):
+            integrator.setPositions(copy, copies[copy])
+            integrator.setVelocities(copy, [mm.Vec3(0, 0, 0)]*len(positions))
+        integrator.step(1)
+
+        velocityUnit = unit.nanometer/unit.picosecond
+        velocity = sum(integrator.getState(copy, getVelocities=True).getVelocities(asNumpy=True).value_in_unit(velocityUnit) for copy in range(numCopies))/numCopies
+        step = dt.value_in_unit(unit.picosecond)
+        atoms = [i for i in range(len(positions)) if system.getParticleMass(i).value_in_unit(unit.dalton) > 0]
+        contractedForces = np.array(velocity)
+        for i in atoms:
+            contractedForces[i] = velocity[i]*system.getParticleMass(i).value_in_unit(unit.dalton)/step - beadForces[i]
+
+        def tolerance(reference):
+            return 1.0e-2 + 1.0e-4*abs(reference)
+
+        largestDeviation = 0.0
+        for i in atoms:
+            for k in range(3):
+                self.assertAlmostEqual(contractedForces[i][k], centroidForces[i][k], delta=tolerance(centroidForces[i][k]))
+                largestDeviation = max(largestDeviation, abs(uncontractedForces[i][k] - centroidForces[i][k]) - tolerance(centroidForces[i][k]))
+
+        # the beads are spread widely enough that evaluating the contracted terms on each bead
+        # would have failed the comparison above
+
+        self.assertTrue(largestDeviation > 0.0)
+
+        # the contracted energy on the centroid: its central difference along a random centroid
+        # displacement is the work of the observed contracted forces
+
+        displacement = [mm.Vec3(0, 0, 0)]*len(positions)
+        for i in atoms:
+            displacement[i] = mm.Vec3(*[random.uniform(-1.0, 1.0) for k in range(3)])
+        h = 1.0e-5
+        shifted = [[centroid[i] + displacement[i]*(sign*h) for i in range(len(positions))] for sign in (1, -1)]
+        for beads in shifted:
+            for i in range(0, len(beads), 4):
+                beads[i+3] = beads[i]*weights[0] + beads[i+1]*weights[1] + beads[i+2]*weights[2]
+        energyDifference = evaluate(shifted[0], contractedGroups)[0] - evaluate(shifted[1], contractedGroups)[0]
+        work = sum(contractedForces[i][k]*displacement[i][k] for i in atoms for k in range(3))
+        self.assertAlmostEqual(-energyDifference/(2*h), work, delta=1.0e-2*len(atoms) + 1.0e-4*abs(work))
+        self.assertTrue(centroidEnergy != 0.0)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,100 @@
+#include "openmm/serialization/MBPolElectrostaticsForceProxy.h"
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/MBPolElectrostaticsForce.h"
+#include <vector>
+
+using namespace MBPolPlugin;
+using namespace OpenMM;
+using namespace std;
+
+MBPolElectrostaticsForceProxy::MBPolElectrostaticsForceProxy() : SerializationProxy("MBPolElectrostaticsForce") {
+}
+
+void MBPolElectrostaticsForceProxy::serialize(const void* object, SerializationNode& node) const {
+    node.setIntProperty("version", 1);
+    const MBPolElectrostaticsForce& force = *reinterpret_cast<const MBPolElectrostaticsForce*>(object);
+    node.setIntProperty("forceGroup", force.getForceGroup());
+    node.setIntProperty("method", (int) force.getNonbondedMethod());
+    node.setIntProperty("interactionGroup", (int) force.getInteractionGroup());
+    node.setDoubleProperty("splitDistance", force.getSplitDistance());
+    node.setDoubleProperty("splitWidth", force.getSplitWidth());
+    node.setDoubleProperty("cutoff", force.getCutoffDistance());
+    node.setDoubleProperty("aEwald", force.getAEwald());
+    node.setDoubleProperty("ewaldErrorTolerance", force.getEwaldErrorTolerance());
+    vector<int> gridDimensions;
+    force.getPmeGridDimensions(gridDimensions);
+    node.setIntProperty("gridX", gridDimensions[0]).setIntProperty("gridY", gridDimensions[1]).setIntProperty("gridZ", gridDimensions[2]);
+    node.setIntProperty("mutualInducedMaxIterations", force.getMutualInducedMaxIterations());
+    node.setDoubleProperty("mutualInducedTargetEpsilon", force.getMutualInducedTargetEpsilon());
+    node.setBoolProperty("includeChargeRedistribution", force.getIncludeChargeRedistribution());
+    node.setBoolProperty("inducedDipoleWarmStart", force.getInducedDipoleWarmStart());
+    node.setBoolProperty("includeEnergyDecomposition", force.getIncludeEnergyDecomposition());
+    node.setBoolProperty("useSinglePrecisionPme", force.getUseSinglePrecisionPme());
+    node.setDoubleProperty("treecodeOpeningAngle", force.getTreecodeOpeningAngle());
+    node.setIntProperty("treecodeExpansionOrder", force.getTreecodeExpansionOrder());
+    SerializationNode& thole = node.createChildNode("TholeParameters");
+    vector<double> tholeParameters = force.getTholeParameters();
+    for (unsigned int ii = 0; ii < tholeParameters.size(); ii++)
+        thole.createChildNode("Thole").setDoubleProperty("value", tholeParameters[ii]);
+    SerializationNode& particles = node.createChildNode("Particles");
+    for (int ii = 0; ii < force.getNumElectrostatics(); ii++) {
+        double charge, dampingFactor, polarity;
+        int moleculeIndex, atomType;
+        force.getElectrostaticsParameters(ii, charge, moleculeIndex, atomType, dampingFactor, polarity);
+        particles.createChildNode("Particle").setDoubleProperty("charge", charge).setIntProperty("molecule", moleculeIndex)
+                 .setIntProperty("type", atomType).setDoubleProperty("damping", dampingFactor).setDoubleProperty("polarity", polarity);
+    }
+}
+
+void* MBPolElectrostaticsForceProxy::deserialize(const SerializationNode& node) const {
+    if (node.getIntProperty("version") != 1)
+        throw OpenMMException("Unsupported version number");
+    MBPolElectrostaticsForce* force = new MBPolElectrostaticsForce();
+    try {
+        force->setForceGroup(node.getIntProperty("forceGroup", 0));
+        force->setNonbondedMethod((MBPolElectrostaticsForce::NonbondedMethod) node.getIntProperty("method"));
+        force->setInteractionGroup((MBPolElectrostaticsForce::InteractionGroup) node.getIntProperty("interactionGroup"));
+        force->setSplitDistance(node.getDoubleProperty("splitDistance", 0.45));
+        force->setSplitWidth(node.getDoubleProperty("splitWidth", 0.1));
+        force->setCutoffDistance(node.getDoubleProperty("cutoff"));
+        force->setAEwald(node.getDoubleProperty("aEwald"));
+        force->setEwaldErrorTolerance(node.getDoubleProperty("ewaldErrorTolerance"));
+        vector<int> gridDimensions;
+        gridDimensions.push_back(node.getIntProperty("gridX"));
+        gridDimensions.push_back(node.getIntProperty("gridY"));
+        gridDimensions.push_back(node.getIntProperty("gridZ"));
+        force->setPmeGridDimensions(gridDimensions);
+        force->setMutualInducedMaxIterations(node.getIntProperty("mutualInducedMaxIterations"));
+        force->setMutualInducedTargetEpsilon(node.getDoubleProperty("mutualInducedTargetEpsilon"));
+        force->setIncludeChargeRedistribution(node.getBoolProperty("includeChargeRedistribution"));
+        force->setInducedDipoleWarmStart(node.getBoolProperty("inducedDipoleWarmStart"));
+        force->setIncludeEnergyDecomposition(node.getBoolProperty("includeEnergyDecomposition", false));
+        force->setUseSinglePrecisionPme(node.getBoolProperty("useSinglePrecisionPme", false));
+        force->setTreecodeOpeningAngle(node.getDoubleProperty("treecodeOpeningAngle"));
+        force->setTreecodeExpansionOrder(node.getIntProperty("treecodeExpansionOrder"));
+        const SerializationNode& thole = node.getChildNode("TholeParameters");
+        vector<double> tholeParameters;
+        for (unsigned int ii = 0; ii < thole.getChildren().size(); ii++)
+            tholeParameters.push_back(thole.getChildren()[ii].getDoubleProperty("value"));
+        force->setTholeParameters(tholeParameters);
+        const SerializationNode& particles = node.getChildNode("Particles");
+        int numParticles = particles.getChildren().size();
+        vector<double> charges(numParticles), dampingFactors(numParticles), polarities(numParticles);
+        vector<int> moleculeIndices(numParticles), atomTypes(numParticles);
+        for (int ii = 0; ii < numParticles; ii++) {
+            const SerializationNode& particle = particles.getChildren()[ii];
+            charges[ii]         = particle.getDoubleProperty("charge");
+            moleculeIndices[ii] = particle.getIntProperty("molecule");
+            atomTypes[ii]       = particle.getIntProperty("type");
+            dampingFactors[ii]  = particle.getDoubleProperty("damping");
+            polarities[ii]      = particle.getDoubleProperty("polarity");
+        }
+        force->addParticles(charges, moleculeIndices, atomTypes, dampingFactors, polarities);
+    }
+    catch (...) {
+        delete force;
+        throw;
+    }
+    return force;
+}
@@ -0,0 +1,52 @@
+#include "openmm/serialization/MBPolOneBodyForceProxy.h"
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/MBPolOneBodyForce.h"
+#include <vector>
+
+using namespace MBPolPlugin;
+using namespace OpenMM;
+using namespace std;
+
+MBPolOneBodyForceProxy::MBPolOneBodyForceProxy() : SerializationProxy("MBPolOneBodyForce") {
+}
+
+void MBPolOneBodyForceProxy::serialize(const void* object, SerializationNode& node) const {
+    node.setIntProperty("version", 1);
+    const MBPolOneBodyForce& force = *reinterpret_cast<const MBPolOneBodyForce*>(object);
+    node.setIntProperty("forceGroup", force.getForceGroup());
+    node.setIntProperty("method", (int) force.getNonbondedMethod());
+    node.setBoolProperty("includeEnergyDecomposition", force.getIncludeEnergyDecomposition());
+    SerializationNode& molecules = node.createChildNode("Molecules");
+    vector<int> particleIndices;
+    for (int ii = 0; ii < force.getNumOneBodys(); ii++) {
+        force.getOneBodyParameters(ii, particleIndices);
+        molecules.createChildNode("Molecule").setIntProperty("p1", particleIndices[0]).setIntProperty("p2", particleIndices[1]).setIntProperty("p3", particleIndices[2]);
+    }
+}
+
+void* MBPolOneBodyForceProxy::deserialize(const SerializationNode& node) const {
+    if (node.getIntProperty("version") != 1)
+        throw OpenMMException("Unsupported version number");
+    MBPolOneBodyForce* force = new MBPolOneBodyForce();
+    try {
+        force->setForceGroup(node.getIntProperty("forceGroup", 0));
+        force->setNonbondedMethod((MBPolOneBodyForce::NonbondedMethod) node.getIntProperty("method"));
+        force->setIncludeEnergyDecomposition(node.getBoolProperty("includeEnergyDecomposition", false));
+        const SerializationNode& molecules = node.getChildNode("Molecules");
+        vector<int> flatIndices;
+        flatIndices.reserve(3*molecules.getChildren().size());
+        for (unsigned int ii = 0; ii < molecules.getChildren().size(); ii++) {
+            const SerializationNode& molecule = molecules.getChildren()[ii];
+            flatIndices.push_back(molecule.getIntProperty("p1"));
+            flatIndices.push_back(molecule.getIntProperty("p2"));
+            flatIndices.push_back(molecule.getIntProperty("p3"));
+        }
+        force->addOneBodies(flatIndices);
+    }
+    catch (...) {
+        delete force;
+        throw;
+    }
+    return force;
+}
@@ -0,0 +1,35 @@
+#include "openmm/MBPolOneBodyForce.h"
+#include "openmm/MBPolTwoBodyForce.h"
+#include "openmm/MBPolThreeBodyForce.h"
+#include "openmm/MBPolElectrostaticsForce.h"
+#include "openmm/serialization/SerializationProxy.h"
+#include "openmm/serialization/MBPolOneBodyForceProxy.h"
+#include "openmm/serialization/MBPolTwoBodyForceProxy.h"
+#include "openmm/serialization/MBPolThreeBodyForceProxy.h"
+#include "openmm/serialization/MBPolElectrostaticsForceProxy.h"
+#include <typeinfo>
+
+// register the proxies when the library is loaded, so that XmlSerializer (and with it
+// System clones and checkpointed Systems) knows the MB-pol forces
+
+#if defined(WIN32)
+    #include <windows.h>
+    extern "C" OPENMM_EXPORT_MBPOL void registerMBPolSerializationProxies();
+    BOOL WINAPI DllMain(HANDLE hModule, DWORD  ul_reason_for_call, LPVOID lpReserved) {
+        if (ul_reason_for_call == DLL_PROCESS_ATTACH)
+            registerMBPolSerializationProxies();
+        return TRUE;
+    }
+#else
+    extern "C" void __attribute__((constructor)) registerMBPolSerializationProxies();
+#endif
+
+using namespace MBPolPlugin;
+using namespace OpenMM;
+
+extern "C" OPENMM_EXPORT_MBPOL void registerMBPolSerializationProxies() {
+    SerializationProxy::registerProxy(typeid(MBPolOneBodyForce),       new MBPolOneBodyForceProxy());
+    SerializationProxy::registerProxy(typeid(MBPolTwoBodyForce),       new MBPolTwoBodyForceProxy());
+    SerializationProxy::registerProxy(typeid(MBPolThreeBodyForce),     new MBPolThreeBodyForceProxy());
+    SerializationProxy::registerProxy(typeid(MBPolElectrostaticsForce), new MBPolElectrostaticsForceProxy());
+}
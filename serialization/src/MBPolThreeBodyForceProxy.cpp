@@ -0,0 +1,56 @@
+#include "openmm/serialization/MBPolThreeBodyForceProxy.h"
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/MBPolThreeBodyForce.h"
+#include <vector>
+
+using namespace MBPolPlugin;
+using namespace OpenMM;
+using namespace std;
+
+MBPolThreeBodyForceProxy::MBPolThreeBodyForceProxy() : SerializationProxy("MBPolThreeBodyForce") {
+}
+
+void MBPolThreeBodyForceProxy::serialize(const void* object, SerializationNode& node) const {
+    node.setIntProperty("version", 1);
+    const MBPolThreeBodyForce& force = *reinterpret_cast<const MBPolThreeBodyForce*>(object);
+    node.setIntProperty("forceGroup", force.getForceGroup());
+    node.setIntProperty("method", (int) force.getNonbondedMethod());
+    node.setBoolProperty("includeEnergyDecomposition", force.getIncludeEnergyDecomposition());
+    node.setBoolProperty("useMixedPrecision", force.getUseMixedPrecision());
+    node.setDoubleProperty("cutoff", force.getCutoff());
+    SerializationNode& molecules = node.createChildNode("Molecules");
+    vector<int> particleIndices;
+    for (int ii = 0; ii < force.getNumMolecules(); ii++) {
+        force.getParticleParameters(ii, particleIndices);
+        molecules.createChildNode("Molecule").setIntProperty("p1", particleIndices[0]).setIntProperty("p2", particleIndices[1]).setIntProperty("p3", particleIndices[2]);
+    }
+}
+
+void* MBPolThreeBodyForceProxy::deserialize(const SerializationNode& node) const {
+    if (node.getIntProperty("version") != 1)
+        throw OpenMMException("Unsupported version number");
+    MBPolThreeBodyForce* force = new MBPolThreeBodyForce();
+    try {
+        force->setForceGroup(node.getIntProperty("forceGroup", 0));
+        force->setNonbondedMethod((MBPolThreeBodyForce::NonbondedMethod) node.getIntProperty("method"));
+        force->setIncludeEnergyDecomposition(node.getBoolProperty("includeEnergyDecomposition", false));
+        force->setUseMixedPrecision(node.getBoolProperty("useMixedPrecision", false));
+        force->setCutoff(node.getDoubleProperty("cutoff"));
+        const SerializationNode& molecules = node.getChildNode("Molecules");
+        vector<int> flatIndices;
+        flatIndices.reserve(3*molecules.getChildren().size());
+        for (unsigned int ii = 0; ii < molecules.getChildren().size(); ii++) {
+            const SerializationNode& molecule = molecules.getChildren()[ii];
+            flatIndices.push_back(molecule.getIntProperty("p1"));
+            flatIndices.push_back(molecule.getIntProperty("p2"));
+            flatIndices.push_back(molecule.getIntProperty("p3"));
+        }
+        force->addParticles(flatIndices);
+    }
+    catch (...) {
+        delete force;
+        throw;
+    }
+    return force;
+}
@@ -0,0 +1,62 @@
+#include "openmm/serialization/MBPolTwoBodyForceProxy.h"
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/MBPolTwoBodyForce.h"
+#include <vector>
+
+using namespace MBPolPlugin;
+using namespace OpenMM;
+using namespace std;
+
+MBPolTwoBodyForceProxy::MBPolTwoBodyForceProxy() : SerializationProxy("MBPolTwoBodyForce") {
+}
+
+void MBPolTwoBodyForceProxy::serialize(const void* object, SerializationNode& node) const {
+    node.setIntProperty("version", 1);
+    const MBPolTwoBodyForce& force = *reinterpret_cast<const MBPolTwoBodyForce*>(object);
+    node.setIntProperty("forceGroup", force.getForceGroup());
+    node.setIntProperty("method", (int) force.getNonbondedMethod());
+    node.setBoolProperty("includeEnergyDecomposition", force.getIncludeEnergyDecomposition());
+    node.setBoolProperty("useMixedPrecision", force.getUseMixedPrecision());
+    node.setDoubleProperty("cutoff", force.getCutoff());
+    node.setIntProperty("interactionGroup", (int) force.getInteractionGroup());
+    node.setDoubleProperty("splitDistance", force.getSplitDistance());
+    node.setDoubleProperty("splitWidth", force.getSplitWidth());
+    SerializationNode& molecules = node.createChildNode("Molecules");
+    vector<int> particleIndices;
+    for (int ii = 0; ii < force.getNumMolecules(); ii++) {
+        force.getParticleParameters(ii, particleIndices);
+        molecules.createChildNode("Molecule").setIntProperty("p1", particleIndices[0]).setIntProperty("p2", particleIndices[1]).setIntProperty("p3", particleIndices[2]);
+    }
+}
+
+void* MBPolTwoBodyForceProxy::deserialize(const SerializationNode& node) const {
+    if (node.getIntProperty("version") != 1)
+        throw OpenMMException("Unsupported version number");
+    MBPolTwoBodyForce* force = new MBPolTwoBodyForce();
+    try {
+        force->setForceGroup(node.getIntProperty("forceGroup", 0));
+        force->setNonbondedMethod((MBPolTwoBodyForce::NonbondedMethod) node.getIntProperty("method"));
+        force->setIncludeEnergyDecomposition(node.getBoolProperty("includeEnergyDecomposition", false));
+        force->setUseMixedPrecision(node.getBoolProperty("useMixedPrecision", false));
+        force->setCutoff(node.getDoubleProperty("cutoff"));
+        force->setInteractionGroup((MBPolTwoBodyForce::InteractionGroup) node.getIntProperty("interactionGroup"));
+        force->setSplitDistance(node.getDoubleProperty("splitDistance"));
+        force->setSplitWidth(node.getDoubleProperty("splitWidth"));
+        const SerializationNode& molecules = node.getChildNode("Molecules");
+        vector<int> flatIndices;
+        flatIndices.reserve(3*molecules.getChildren().size());
+        for (unsigned int ii = 0; ii < molecules.getChildren().size(); ii++) {
+            const SerializationNode& molecule = molecules.getChildren()[ii];
+            flatIndices.push_back(molecule.getIntProperty("p1"));
+            flatIndices.push_back(molecule.getIntProperty("p2"));
+            flatIndices.push_back(molecule.getIntProperty("p3"));
+        }
+        force->addParticles(flatIndices);
+    }
+    catch (...) {
+        delete force;
+        throw;
+    }
+    return force;
+}
@@ -0,0 +1,316 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMMMBPol                             *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2008-2012 Stanford University and the Authors.      *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the serialization proxies of the MBPol forces: every parameter must survive
+ * a round trip through XmlSerializer, on its own and as part of a System.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "OpenMMMBPol.h"
+#include "openmm/System.h"
+#include "openmm/serialization/XmlSerializer.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace  OpenMM;
+using namespace MBPolPlugin;
+
+extern "C" void registerMBPolSerializationProxies();
+
+const int numberOfWaters = 3;
+
+void compareIndices( const std::vector<int>& expected, const std::vector<int>& found ) {
+    ASSERT_EQUAL( expected.size(), found.size() );
+    for( unsigned int ii = 0; ii < expected.size(); ii++ ){
+        ASSERT_EQUAL( expected[ii], found[ii] );
+    }
+}
+
+void testOneBody( ) {
+
+    MBPolOneBodyForce force;
+    force.setForceGroup( 3 );
+    force.setNonbondedMethod( MBPolOneBodyForce::Periodic );
+    force.setIncludeEnergyDecomposition( true );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        std::vector<int> particleIndices;
+        particleIndices.push_back( 4*m );
+        particleIndices.push_back( 4*m+1 );
+        particleIndices.push_back( 4*m+2 );
+        force.addOneBody( particleIndices );
+    }
+
+    std::stringstream buffer;
+    XmlSerializer::serialize<MBPolOneBodyForce>( &force, "Force", buffer );
+    MBPolOneBodyForce* copy = XmlSerializer::deserialize<MBPolOneBodyForce>( buffer );
+
+    MBPolOneBodyForce& force2 = *copy;
+    ASSERT_EQUAL( force.getForceGroup(), force2.getForceGroup() );
+    ASSERT_EQUAL( force.getNonbondedMethod(), force2.getNonbondedMethod() );
+    ASSERT_EQUAL( force.getIncludeEnergyDecomposition(), force2.getIncludeEnergyDecomposition() );
+    ASSERT_EQUAL( force.getNumOneBodys(), force2.getNumOneBodys() );
+    for( int ii = 0; ii < force.getNumOneBodys(); ii++ ){
+        std::vector<int> indices1, indices2;
+        force.getOneBodyParameters( ii, indices1 );
+        force2.getOneBodyParameters( ii, indices2 );
+        compareIndices( indices1, indices2 );
+    }
+    delete copy;
+}
+
+void testTwoBody( ) {
+
+    MBPolTwoBodyForce force;
+    force.setForceGroup( 1 );
+    force.setNonbondedMethod( MBPolTwoBodyForce::CutoffPeriodic );
+    force.setIncludeEnergyDecomposition( true );
+    force.setUseMixedPrecision( true );
+    force.setCutoff( 0.9 );
+    force.setInteractionGroup( MBPolTwoBodyForce::LongRange );
+    force.setSplitDistance( 0.5 );
+    force.setSplitWidth( 0.15 );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        std::vector<int> particleIndices;
+        particleIndices.push_back( 4*m );
+        particleIndices.push_back( 4*m+1 );
+        particleIndices.push_back( 4*m+2 );
+        force.addParticle( particleIndices );
+    }
+
+    std::stringstream buffer;
+    XmlSerializer::serialize<MBPolTwoBodyForce>( &force, "Force", buffer );
+    MBPolTwoBodyForce* copy = XmlSerializer::deserialize<MBPolTwoBodyForce>( buffer );
+
+    MBPolTwoBodyForce& force2 = *copy;
+    ASSERT_EQUAL( force.getForceGroup(), force2.getForceGroup() );
+    ASSERT_EQUAL( force.getNonbondedMethod(), force2.getNonbondedMethod() );
+    ASSERT_EQUAL( force.getIncludeEnergyDecomposition(), force2.getIncludeEnergyDecomposition() );
+    ASSERT_EQUAL( force.getUseMixedPrecision(), force2.getUseMixedPrecision() );
+    ASSERT_EQUAL( force.getCutoff(), force2.getCutoff() );
+    ASSERT_EQUAL( force.getInteractionGroup(), force2.getInteractionGroup() );
+    ASSERT_EQUAL( force.getSplitDistance(), force2.getSplitDistance() );
+    ASSERT_EQUAL( force.getSplitWidth(), force2.getSplitWidth() );
+    ASSERT_EQUAL( force.getNumMolecules(), force2.getNumMolecules() );
+    for( int ii = 0; ii < force.getNumMolecules(); ii++ ){
+        std::vector<int> indices1, indices2;
+        force.getParticleParameters( ii, indices1 );
+        force2.getParticleParameters( ii, indices2 );
+        compareIndices( indices1, indices2 );
+    }
+    delete copy;
+}
+
+void testThreeBody( ) {
+
+    MBPolThreeBodyForce force;
+    force.setForceGroup( 2 );
+    force.setNonbondedMethod( MBPolThreeBodyForce::CutoffNonPeriodic );
+    force.setIncludeEnergyDecomposition( true );
+    force.setUseMixedPrecision( true );
+    force.setCutoff( 0.45 );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        std::vector<int> particleIndices;
+        particleIndices.push_back( 4*m );
+        particleIndices.push_back( 4*m+1 );
+        particleIndices.push_back( 4*m+2 );
+        force.addParticle( particleIndices );
+    }
+
+    std::stringstream buffer;
+    XmlSerializer::serialize<MBPolThreeBodyForce>( &force, "Force", buffer );
+    MBPolThreeBodyForce* copy = XmlSerializer::deserialize<MBPolThreeBodyForce>( buffer );
+
+    MBPolThreeBodyForce& force2 = *copy;
+    ASSERT_EQUAL( force.getForceGroup(), force2.getForceGroup() );
+    ASSERT_EQUAL( force.getNonbondedMethod(), force2.getNonbondedMethod() );
+    ASSERT_EQUAL( force.getIncludeEnergyDecomposition(), force2.getIncludeEnergyDecomposition() );
+    ASSERT_EQUAL( force.getUseMixedPrecision(), force2.getUseMixedPrecision() );
+    ASSERT_EQUAL( force.getCutoff(), force2.getCutoff() );
+    ASSERT_EQUAL( force.getNumMolecules(), force2.getNumMolecules() );
+    for( int ii = 0; ii < force.getNumMolecules(); ii++ ){
+        std::vector<int> indices1, indices2;
+        force.getParticleParameters( ii, indices1 );
+        force2.getParticleParameters( ii, indices2 );
+        compareIndices( indices1, indices2 );
+    }
+    delete copy;
+}
+
+MBPolElectrostaticsForce* createElectrostaticsForce( ) {
+
+    MBPolElectrostaticsForce* force = new MBPolElectrostaticsForce();
+    force->setForceGroup( 4 );
+    force->setNonbondedMethod( MBPolElectrostaticsForce::PME );
+    force->setInteractionGroup( MBPolElectrostaticsForce::ShortRange );
+    force->setSplitDistance( 0.5 );
+    force->setSplitWidth( 0.15 );
+    force->setCutoffDistance( 0.7 );
+    force->setAEwald( 3.2 );
+    force->setEwaldErrorTolerance( 1.0e-5 );
+    std::vector<int> gridDimensions( 3 );
+    gridDimensions[0] = 24;
+    gridDimensions[1] = 25;
+    gridDimensions[2] = 27;
+    force->setPmeGridDimensions( gridDimensions );
+    force->setMutualInducedMaxIterations( 150 );
+    force->setMutualInducedTargetEpsilon( 1.0e-9 );
+    force->setIncludeChargeRedistribution( false );
+    force->setInducedDipoleWarmStart( true );
+    force->setIncludeEnergyDecomposition( true );
+    force->setUseSinglePrecisionPme( true );
+    force->setTreecodeOpeningAngle( 0.4 );
+    force->setTreecodeExpansionOrder( 5 );
+    std::vector<double> tholeParameters = force->getTholeParameters();
+    tholeParameters[2] = 0.06;
+    force->setTholeParameters( tholeParameters );
+    for( int m = 0; m < numberOfWaters; m++ ){
+        force->addElectrostatics( -5.1966000e-01, m, 0, 0.001310, 0.001310 );
+        force->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        force->addElectrostatics(  2.5983000e-01, m, 1, 0.000294, 0.000294 );
+        force->addElectrostatics(  0.,            m, 2, 0.001310, 0. );
+    }
+    return force;
+}
+
+void compareElectrostatics( const MBPolElectrostaticsForce& force, const MBPolElectrostaticsForce& force2 ) {
+
+    ASSERT_EQUAL( force.getForceGroup(), force2.getForceGroup() );
+    ASSERT_EQUAL( force.getNonbondedMethod(), force2.getNonbondedMethod() );
+    ASSERT_EQUAL( force.getInteractionGroup(), force2.getInteractionGroup() );
+    ASSERT_EQUAL( force.getSplitDistance(), force2.getSplitDistance() );
+    ASSERT_EQUAL( force.getSplitWidth(), force2.getSplitWidth() );
+    ASSERT_EQUAL( force.getCutoffDistance(), force2.getCutoffDistance() );
+    ASSERT_EQUAL( force.getAEwald(), force2.getAEwald() );
+    ASSERT_EQUAL( force.getEwaldErrorTolerance(), force2.getEwaldErrorTolerance() );
+    std::vector<int> gridDimensions1, gridDimensions2;
+    force.getPmeGridDimensions( gridDimensions1 );
+    force2.getPmeGridDimensions( gridDimensions2 );
+    compareIndices( gridDimensions1, gridDimensions2 );
+    ASSERT_EQUAL( force.getMutualInducedMaxIterations(), force2.getMutualInducedMaxIterations() );
+    ASSERT_EQUAL( force.getMutualInducedTargetEpsilon(), force2.getMutualInducedTargetEpsilon() );
+    ASSERT_EQUAL( force.getIncludeChargeRedistribution(), force2.getIncludeChargeRedistribution() );
+    ASSERT_EQUAL( force.getInducedDipoleWarmStart(), force2.getInducedDipoleWarmStart() );
+    ASSERT_EQUAL( force.getIncludeEnergyDecomposition(), force2.getIncludeEnergyDecomposition() );
+    ASSERT_EQUAL( force.getUseSinglePrecisionPme(), force2.getUseSinglePrecisionPme() );
+    ASSERT_EQUAL( force.getTreecodeOpeningAngle(), force2.getTreecodeOpeningAngle() );
+    ASSERT_EQUAL( force.getTreecodeExpansionOrder(), force2.getTreecodeExpansionOrder() );
+    std::vector<double> tholeParameters1 = force.getTholeParameters();
+    std::vector<double> tholeParameters2 = force2.getTholeParameters();
+    ASSERT_EQUAL( tholeParameters1.size(), tholeParameters2.size() );
+    for( unsigned int ii = 0; ii < tholeParameters1.size(); ii++ ){
+        ASSERT_EQUAL( tholeParameters1[ii], tholeParameters2[ii] );
+    }
+    ASSERT_EQUAL( force.getNumElectrostatics(), force2.getNumElectrostatics() );
+    for( int ii = 0; ii < force.getNumElectrostatics(); ii++ ){
+        double charge1, dampingFactor1, polarity1;
+        double charge2, dampingFactor2, polarity2;
+        int moleculeIndex1, atomType1, moleculeIndex2, atomType2;
+        force.getElectrostaticsParameters( ii, charge1, moleculeIndex1, atomType1, dampingFactor1, polarity1 );
+        force2.getElectrostaticsParameters( ii, charge2, moleculeIndex2, atomType2, dampingFactor2, polarity2 );
+        ASSERT_EQUAL( charge1, charge2 );
+        ASSERT_EQUAL( moleculeIndex1, moleculeIndex2 );
+        ASSERT_EQUAL( atomType1, atomType2 );
+        ASSERT_EQUAL( dampingFactor1, dampingFactor2 );
+        ASSERT_EQUAL( polarity1, polarity2 );
+    }
+}
+
+void testElectrostatics( ) {
+
+    MBPolElectrostaticsForce* force = createElectrostaticsForce();
+    std::stringstream buffer;
+    XmlSerializer::serialize<MBPolElectrostaticsForce>( force, "Force", buffer );
+    MBPolElectrostaticsForce* copy = XmlSerializer::deserialize<MBPolElectrostaticsForce>( buffer );
+    compareElectrostatics( *force, *copy );
+    delete copy;
+    delete force;
+}
+
+// a System written with XmlSerializer, e.g. by a checkpointing tool, must keep its MBPol forces
+
+void testSystem( ) {
+
+    System system;
+    for( int m = 0; m < numberOfWaters; m++ ){
+        system.addParticle( 1.5999000e+01 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 1.0080000e+00 );
+        system.addParticle( 0. );
+    }
+    MBPolTwoBodyForce* twoBodyForce = new MBPolTwoBodyForce();
+    for( int m = 0; m < numberOfWaters; m++ ){
+        std::vector<int> particleIndices;
+        particleIndices.push_back( 4*m );
+        particleIndices.push_back( 4*m+1 );
+        particleIndices.push_back( 4*m+2 );
+        twoBodyForce->addParticle( particleIndices );
+    }
+    system.addForce( twoBodyForce );
+    MBPolElectrostaticsForce* electrostaticsForce = createElectrostaticsForce();
+    system.addForce( electrostaticsForce );
+
+    std::stringstream buffer;
+    XmlSerializer::serialize<System>( &system, "System", buffer );
+    System* copy = XmlSerializer::deserialize<System>( buffer );
+
+    ASSERT_EQUAL( 2, copy->getNumForces() );
+    MBPolTwoBodyForce* twoBodyCopy = dynamic_cast<MBPolTwoBodyForce*>( &copy->getForce( 0 ) );
+    MBPolElectrostaticsForce* electrostaticsCopy = dynamic_cast<MBPolElectrostaticsForce*>( &copy->getForce( 1 ) );
+    ASSERT( twoBodyCopy != NULL );
+    ASSERT( electrostaticsCopy != NULL );
+    ASSERT_EQUAL( numberOfWaters, twoBodyCopy->getNumMolecules() );
+    compareElectrostatics( *electrostaticsForce, *electrostaticsCopy );
+    delete copy;
+}
+
+int main( int numberOfArguments, char* argv[] ) {
+
+    try {
+        std::cout << "TestSerializeMBPolForces running test..." << std::endl;
+        registerMBPolSerializationProxies();
+
+        testOneBody();
+        testTwoBody();
+        testThreeBody();
+        testElectrostatics();
+        testSystem();
+
+    } catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        std::cout << "FAIL - ERROR.  Test failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Done" << std::endl;
+    return 0;
+}